@@ -80,4 +80,11 @@
 
 #define SO_BPF_EXTENSIONS	48
 
+#define SO_ATTACH_REUSEPORT_CBPF	49
+#define SO_ATTACH_REUSEPORT_EBPF	50
+
+#define SO_INCOMING_CPU		51
+
+#define SO_ZEROCOPY		52
+
 #endif /* _UAPI__ASM_AVR32_SOCKET_H */
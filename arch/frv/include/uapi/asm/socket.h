@@ -80,5 +80,12 @@
 
 #define SO_BPF_EXTENSIONS	48
 
+#define SO_ATTACH_REUSEPORT_CBPF	49
+#define SO_ATTACH_REUSEPORT_EBPF	50
+
+#define SO_INCOMING_CPU		51
+
+#define SO_ZEROCOPY		52
+
 #endif /* _ASM_SOCKET_H */
 
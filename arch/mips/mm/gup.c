@@ -83,6 +83,9 @@ static int gup_huge_pmd(pmd_t pmd, unsigned long addr, unsigned long end,
 
 	refs = 0;
 	head = pte_page(pte);
+	/* a tmpfs team is not a compound page, leave it to the slow path */
+	if (!PageHead(head))
+		return 0;
 	page = head + ((addr & ~PMD_MASK) >> PAGE_SHIFT);
 	do {
 		VM_BUG_ON(compound_head(page) != head);
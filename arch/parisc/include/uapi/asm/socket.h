@@ -79,4 +79,11 @@
 
 #define SO_BPF_EXTENSIONS	0x4029
 
+#define SO_ATTACH_REUSEPORT_CBPF	0x402a
+#define SO_ATTACH_REUSEPORT_EBPF	0x402b
+
+#define SO_INCOMING_CPU		0x402c
+
+#define SO_ZEROCOPY		0x402d
+
 #endif /* _UAPI_ASM_SOCKET_H */
@@ -1051,6 +1051,9 @@ int gup_hugepte(pte_t *ptep, unsigned long sz, unsigned long addr,
 
 	refs = 0;
 	head = pte_page(pte);
+	/* a tmpfs team is not a compound page, leave it to the slow path */
+	if (!PageHead(head))
+		return 0;
 
 	page = head + ((addr & (sz-1)) >> PAGE_SHIFT);
 	tail = page;
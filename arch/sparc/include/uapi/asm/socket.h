@@ -76,6 +76,13 @@
 
 #define SO_BPF_EXTENSIONS	0x0032
 
+#define SO_ATTACH_REUSEPORT_CBPF	0x0033
+#define SO_ATTACH_REUSEPORT_EBPF	0x0034
+
+#define SO_INCOMING_CPU		0x0035
+
+#define SO_ZEROCOPY		0x0036
+
 /* Security levels - as per NRL IPv6 - don't actually do anything */
 #define SO_SECURITY_AUTHENTICATION		0x5001
 #define SO_SECURITY_ENCRYPTION_TRANSPORT	0x5002
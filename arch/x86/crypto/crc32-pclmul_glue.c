@@ -55,13 +55,13 @@ static u32 __attribute__((pure))
 	unsigned int prealign;
 
 	if (len < PCLMUL_MIN_LEN + SCALE_F_MASK || !irq_fpu_usable())
-		return crc32_le(crc, p, len);
+		return crc32_le_base(crc, p, len);
 
 	if ((long)p & SCALE_F_MASK) {
 		/* align p to 16 byte */
 		prealign = SCALE_F - ((long)p & SCALE_F_MASK);
 
-		crc = crc32_le(crc, p, prealign);
+		crc = crc32_le_base(crc, p, prealign);
 		len -= prealign;
 		p = (unsigned char *)(((unsigned long)p + SCALE_F_MASK) &
 				     ~SCALE_F_MASK);
@@ -74,7 +74,7 @@ static u32 __attribute__((pure))
 	kernel_fpu_end();
 
 	if (iremainder)
-		crc = crc32_le(crc, p + iquotient, iremainder);
+		crc = crc32_le_base(crc, p + iquotient, iremainder);
 
 	return crc;
 }
@@ -175,19 +175,36 @@ static const struct x86_cpu_id crc32pclmul_cpu_id[] = {
 };
 MODULE_DEVICE_TABLE(x86cpu, crc32pclmul_cpu_id);
 
+/* Offered to crc32_le() callers as well as to the crypto API */
+static struct crc32_algo crc32_pclmul_algo = {
+	.name		= "pclmul",
+	.crc32_le	= crc32_pclmul_le,
+};
+static bool crc32_pclmul_algo_registered;
 
 static int __init crc32_pclmul_mod_init(void)
 {
+	int err;
 
 	if (!x86_match_cpu(crc32pclmul_cpu_id)) {
 		pr_info("PCLMULQDQ-NI instructions are not detected.\n");
 		return -ENODEV;
 	}
-	return crypto_register_shash(&alg);
+	err = crypto_register_shash(&alg);
+	if (err)
+		return err;
+
+	if (crc32_register_algo(&crc32_pclmul_algo))
+		pr_info("crc32-pclmul: not used for crc32_le()\n");
+	else
+		crc32_pclmul_algo_registered = true;
+	return 0;
 }
 
 static void __exit crc32_pclmul_mod_fini(void)
 {
+	if (crc32_pclmul_algo_registered)
+		crc32_unregister_algo(&crc32_pclmul_algo);
 	crypto_unregister_shash(&alg);
 }
 
@@ -28,6 +28,7 @@
 #include <linux/module.h>
 #include <linux/string.h>
 #include <linux/kernel.h>
+#include <linux/crc32.h>
 #include <crypto/internal/hash.h>
 
 #include <asm/cpufeature.h>
@@ -227,6 +228,27 @@ static int crc32c_pcl_intel_digest(struct shash_desc *desc, const u8 *data,
 }
 #endif /* CONFIG_X86_64 */
 
+/* What __crc32c_le() callers get, both instructions where they pay off */
+static u32 __pure crc32c_intel_le(u32 crc, unsigned char const *p, size_t len)
+{
+#ifdef CONFIG_X86_64
+	if (cpu_has_pclmulqdq && len >= crc32c_pcl_breakeven &&
+	    irq_fpu_usable()) {
+		kernel_fpu_begin();
+		crc = crc_pcl(p, len, crc);
+		kernel_fpu_end();
+		return crc;
+	}
+#endif
+	return crc32c_intel_le_hw(crc, p, len);
+}
+
+static struct crc32_algo crc32c_intel_algo = {
+	.name		= "intel",
+	.crc32c_le	= crc32c_intel_le,
+};
+static bool crc32c_intel_algo_registered;
+
 static struct shash_alg alg = {
 	.setkey			=	crc32c_intel_setkey,
 	.init			=	crc32c_intel_init,
@@ -255,6 +277,8 @@ MODULE_DEVICE_TABLE(x86cpu, crc32c_cpu_id);
 
 static int __init crc32c_intel_mod_init(void)
 {
+	int err;
+
 	if (!x86_match_cpu(crc32c_cpu_id))
 		return -ENODEV;
 #ifdef CONFIG_X86_64
@@ -265,11 +289,21 @@ static int __init crc32c_intel_mod_init(void)
 		set_pcl_breakeven_point();
 	}
 #endif
-	return crypto_register_shash(&alg);
+	err = crypto_register_shash(&alg);
+	if (err)
+		return err;
+
+	if (crc32_register_algo(&crc32c_intel_algo))
+		pr_info("crc32c-intel: not used for __crc32c_le()\n");
+	else
+		crc32c_intel_algo_registered = true;
+	return 0;
 }
 
 static void __exit crc32c_intel_mod_fini(void)
 {
+	if (crc32c_intel_algo_registered)
+		crc32_unregister_algo(&crc32c_intel_algo);
 	crypto_unregister_shash(&alg);
 }
 
@@ -0,0 +1,451 @@
+/*
+ * Multi-buffer SHA-256, AVX2 accelerated
+ *
+ * Requests are queued on a per-cpu manager, whose worker hashes up to
+ * eight of them at once with sha256_x8_avx2(), one in each lane, and
+ * starts the next queued request in a lane as soon as the one there is
+ * done.  With fewer than eight requests queued, the worker waits up to
+ * flush_us for more before it starts.
+ *
+ * The data is copied into the lanes a chunk at a time, so lanes need
+ * not keep pages mapped while others catch up.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt)	KBUILD_MODNAME ": " fmt
+
+#include <crypto/internal/hash.h>
+#include <crypto/scatterwalk.h>
+#include <crypto/sha.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/string.h>
+#include <asm/byteorder.h>
+#include <asm/i387.h>
+#include <asm/xcr.h>
+#include <asm/xsave.h>
+
+#define SHA256_MB_LANES		8
+
+/* how much of a request a lane copies in at once */
+#define SHA256_MB_CHUNK		(16 * SHA256_BLOCK_SIZE)
+
+/* the layout sha256_x8_avx2() works on */
+struct sha256_mb_args {
+	u32			digest[SHA256_DIGEST_SIZE / 4][SHA256_MB_LANES];
+	const u8		*data[SHA256_MB_LANES];
+} __aligned(32);
+
+asmlinkage void sha256_x8_avx2(struct sha256_mb_args *args, u64 blocks);
+
+struct sha256_mb_reqctx {
+	struct sha256_state	sctx;
+	struct ahash_request	*req;
+	struct list_head	list;		/* on sha256_mb_mgr.queue */
+	unsigned int		nbytes;		/* of req->src to hash */
+	bool			final;
+};
+
+struct sha256_mb_lane {
+	struct ahash_request	*req;		/* NULL if the lane is idle */
+	unsigned int		offset;		/* of req->src copied in */
+	unsigned int		len;		/* bytes in @buf */
+	unsigned int		pos;		/* bytes of @buf hashed */
+	bool			padded;
+	u8			buf[SHA256_MB_CHUNK + 2 * SHA256_BLOCK_SIZE];
+};
+
+struct sha256_mb_mgr {
+	spinlock_t		lock;		/* protects @queue, @queued */
+	struct list_head	queue;
+	unsigned int		queued;
+	int			cpu;
+	struct delayed_work	flush;
+	struct sha256_mb_args	args;
+	struct sha256_mb_lane	lanes[SHA256_MB_LANES];
+};
+
+static struct sha256_mb_mgr __percpu *sha256_mb_mgrs;
+
+static unsigned int flush_us = 1000;
+module_param(flush_us, uint, 0644);
+MODULE_PARM_DESC(flush_us,
+		 "Time to wait for a full set of requests, in microseconds");
+
+static bool sha256_mb_lane_start(struct sha256_mb_mgr *mgr, int i)
+{
+	struct sha256_mb_lane *lane = &mgr->lanes[i];
+	struct sha256_mb_reqctx *rctx;
+	int w;
+
+	spin_lock_bh(&mgr->lock);
+	rctx = list_first_entry_or_null(&mgr->queue, struct sha256_mb_reqctx,
+					list);
+	if (rctx) {
+		list_del(&rctx->list);
+		mgr->queued--;
+	}
+	spin_unlock_bh(&mgr->lock);
+
+	if (!rctx)
+		return false;
+
+	lane->req = rctx->req;
+	lane->offset = 0;
+	lane->pos = 0;
+	lane->padded = false;
+	lane->len = rctx->sctx.count % SHA256_BLOCK_SIZE;
+	memcpy(lane->buf, rctx->sctx.buf, lane->len);
+
+	for (w = 0; w < SHA256_DIGEST_SIZE / 4; w++)
+		mgr->args.digest[w][i] = rctx->sctx.state[w];
+
+	return true;
+}
+
+static void sha256_mb_pad(struct sha256_mb_lane *lane, u64 count)
+{
+	unsigned int padlen = (lane->len < 56 ? 56 : 120) - lane->len;
+	__be64 bits = cpu_to_be64(count << 3);
+
+	lane->buf[lane->len] = 0x80;
+	memset(lane->buf + lane->len + 1, 0, padlen - 1);
+	lane->len += padlen;
+
+	memcpy(lane->buf + lane->len, &bits, sizeof(bits));
+	lane->len += sizeof(bits);
+}
+
+/* Returns the number of blocks ready in a busy lane, 0 once it is done. */
+static unsigned int sha256_mb_lane_fill(struct sha256_mb_lane *lane)
+{
+	struct ahash_request *req = lane->req;
+	struct sha256_mb_reqctx *rctx = ahash_request_ctx(req);
+	unsigned int n;
+
+	if (lane->len - lane->pos >= SHA256_BLOCK_SIZE)
+		return (lane->len - lane->pos) / SHA256_BLOCK_SIZE;
+
+	/* keep what is left of a block */
+	lane->len -= lane->pos;
+	memmove(lane->buf, lane->buf + lane->pos, lane->len);
+	lane->pos = 0;
+
+	n = min_t(unsigned int, rctx->nbytes - lane->offset,
+		  SHA256_MB_CHUNK - lane->len);
+	if (n) {
+		scatterwalk_map_and_copy(lane->buf + lane->len, req->src,
+					 lane->offset, n, 0);
+		lane->offset += n;
+		lane->len += n;
+		rctx->sctx.count += n;
+	}
+
+	/* less than a block left means all the data is in */
+	if (lane->len < SHA256_BLOCK_SIZE && rctx->final && !lane->padded) {
+		sha256_mb_pad(lane, rctx->sctx.count);
+		lane->padded = true;
+	}
+
+	return lane->len / SHA256_BLOCK_SIZE;
+}
+
+static void sha256_mb_lane_finish(struct sha256_mb_mgr *mgr, int i)
+{
+	struct sha256_mb_lane *lane = &mgr->lanes[i];
+	struct ahash_request *req = lane->req;
+	struct sha256_mb_reqctx *rctx = ahash_request_ctx(req);
+	int w;
+
+	for (w = 0; w < SHA256_DIGEST_SIZE / 4; w++)
+		rctx->sctx.state[w] = mgr->args.digest[w][i];
+
+	if (rctx->final) {
+		__be32 *dst = (__be32 *)req->result;
+
+		for (w = 0; w < SHA256_DIGEST_SIZE / 4; w++)
+			dst[w] = cpu_to_be32(rctx->sctx.state[w]);
+	} else {
+		memcpy(rctx->sctx.buf, lane->buf, lane->len);
+	}
+
+	lane->req = NULL;
+
+	local_bh_disable();
+	req->base.complete(&req->base, 0);
+	local_bh_enable();
+}
+
+static unsigned int sha256_mb_lane_next(struct sha256_mb_mgr *mgr, int i)
+{
+	struct sha256_mb_lane *lane = &mgr->lanes[i];
+	unsigned int blocks;
+
+	for (;;) {
+		if (!lane->req && !sha256_mb_lane_start(mgr, i))
+			return 0;
+
+		blocks = sha256_mb_lane_fill(lane);
+		if (blocks)
+			return blocks;
+
+		sha256_mb_lane_finish(mgr, i);
+	}
+}
+
+static void sha256_mb_flush(struct work_struct *work)
+{
+	struct sha256_mb_mgr *mgr = container_of(to_delayed_work(work),
+						 struct sha256_mb_mgr, flush);
+	unsigned int blocks[SHA256_MB_LANES];
+	unsigned int i, min_blocks;
+	const u8 *idle_data;
+
+	for (;;) {
+		min_blocks = UINT_MAX;
+		idle_data = NULL;
+
+		for (i = 0; i < SHA256_MB_LANES; i++) {
+			struct sha256_mb_lane *lane = &mgr->lanes[i];
+
+			blocks[i] = sha256_mb_lane_next(mgr, i);
+			if (!blocks[i])
+				continue;
+
+			mgr->args.data[i] = lane->buf + lane->pos;
+			min_blocks = min(min_blocks, blocks[i]);
+			idle_data = mgr->args.data[i];
+		}
+
+		if (!idle_data)
+			break;
+
+		/* idle lanes hash along a busy one, into digests unused */
+		for (i = 0; i < SHA256_MB_LANES; i++) {
+			if (!blocks[i])
+				mgr->args.data[i] = idle_data;
+		}
+
+		kernel_fpu_begin();
+		sha256_x8_avx2(&mgr->args, min_blocks);
+		kernel_fpu_end();
+
+		for (i = 0; i < SHA256_MB_LANES; i++) {
+			if (blocks[i])
+				mgr->lanes[i].pos += min_blocks *
+						     SHA256_BLOCK_SIZE;
+		}
+
+		cond_resched();
+	}
+}
+
+static int sha256_mb_submit(struct ahash_request *req, unsigned int nbytes,
+			    bool final)
+{
+	struct sha256_mb_reqctx *rctx = ahash_request_ctx(req);
+	struct sha256_state *sctx = &rctx->sctx;
+	struct sha256_mb_mgr *mgr;
+	unsigned long delay = 0;
+
+	/* no full block to hash, no need to wait for a lane */
+	if (!final && sctx->count % SHA256_BLOCK_SIZE + nbytes <
+		      SHA256_BLOCK_SIZE) {
+		scatterwalk_map_and_copy(sctx->buf +
+					 sctx->count % SHA256_BLOCK_SIZE,
+					 req->src, 0, nbytes, 0);
+		sctx->count += nbytes;
+		return 0;
+	}
+
+	rctx->req = req;
+	rctx->nbytes = nbytes;
+	rctx->final = final;
+
+	mgr = get_cpu_ptr(sha256_mb_mgrs);
+
+	spin_lock_bh(&mgr->lock);
+	list_add_tail(&rctx->list, &mgr->queue);
+	if (++mgr->queued < SHA256_MB_LANES)
+		delay = usecs_to_jiffies(flush_us);
+	spin_unlock_bh(&mgr->lock);
+
+	if (delay)
+		queue_delayed_work_on(mgr->cpu, system_wq, &mgr->flush, delay);
+	else
+		mod_delayed_work_on(mgr->cpu, system_wq, &mgr->flush, 0);
+
+	put_cpu_ptr(sha256_mb_mgrs);
+
+	return -EINPROGRESS;
+}
+
+static int sha256_mb_init(struct ahash_request *req)
+{
+	struct sha256_mb_reqctx *rctx = ahash_request_ctx(req);
+	struct sha256_state *sctx = &rctx->sctx;
+
+	sctx->state[0] = SHA256_H0;
+	sctx->state[1] = SHA256_H1;
+	sctx->state[2] = SHA256_H2;
+	sctx->state[3] = SHA256_H3;
+	sctx->state[4] = SHA256_H4;
+	sctx->state[5] = SHA256_H5;
+	sctx->state[6] = SHA256_H6;
+	sctx->state[7] = SHA256_H7;
+	sctx->count = 0;
+
+	return 0;
+}
+
+static int sha256_mb_update(struct ahash_request *req)
+{
+	return sha256_mb_submit(req, req->nbytes, false);
+}
+
+static int sha256_mb_final(struct ahash_request *req)
+{
+	return sha256_mb_submit(req, 0, true);
+}
+
+static int sha256_mb_finup(struct ahash_request *req)
+{
+	return sha256_mb_submit(req, req->nbytes, true);
+}
+
+static int sha256_mb_digest(struct ahash_request *req)
+{
+	sha256_mb_init(req);
+	return sha256_mb_finup(req);
+}
+
+static int sha256_mb_export(struct ahash_request *req, void *out)
+{
+	struct sha256_mb_reqctx *rctx = ahash_request_ctx(req);
+
+	memcpy(out, &rctx->sctx, sizeof(rctx->sctx));
+
+	return 0;
+}
+
+static int sha256_mb_import(struct ahash_request *req, const void *in)
+{
+	struct sha256_mb_reqctx *rctx = ahash_request_ctx(req);
+
+	memcpy(&rctx->sctx, in, sizeof(rctx->sctx));
+
+	return 0;
+}
+
+static int sha256_mb_cra_init(struct crypto_tfm *tfm)
+{
+	crypto_ahash_set_reqsize(__crypto_ahash_cast(tfm),
+				 sizeof(struct sha256_mb_reqctx));
+
+	return 0;
+}
+
+static struct ahash_alg alg = {
+	.init		=	sha256_mb_init,
+	.update		=	sha256_mb_update,
+	.final		=	sha256_mb_final,
+	.finup		=	sha256_mb_finup,
+	.digest		=	sha256_mb_digest,
+	.export		=	sha256_mb_export,
+	.import		=	sha256_mb_import,
+	.halg		=	{
+		.digestsize	=	SHA256_DIGEST_SIZE,
+		.statesize	=	sizeof(struct sha256_state),
+		.base		=	{
+			.cra_name	=	"sha256",
+			.cra_driver_name =	"sha256-mb",
+			/*
+			 * Below the single buffer drivers: a lone request
+			 * waits for company, so this is for users that
+			 * ask for it by name.
+			 */
+			.cra_priority	=	100,
+			.cra_flags	=	CRYPTO_ALG_TYPE_AHASH |
+						CRYPTO_ALG_ASYNC,
+			.cra_blocksize	=	SHA256_BLOCK_SIZE,
+			.cra_init	=	sha256_mb_cra_init,
+			.cra_module	=	THIS_MODULE,
+		}
+	}
+};
+
+static bool __init avx2_usable(void)
+{
+	u64 xcr0;
+
+	if (!cpu_has_avx2 || !cpu_has_osxsave)
+		return false;
+
+	xcr0 = xgetbv(XCR_XFEATURE_ENABLED_MASK);
+	if ((xcr0 & (XSTATE_SSE | XSTATE_YMM)) != (XSTATE_SSE | XSTATE_YMM)) {
+		pr_info("AVX2 detected but unusable.\n");
+
+		return false;
+	}
+
+	return true;
+}
+
+static int __init sha256_mb_mod_init(void)
+{
+	int cpu, err;
+
+	if (!avx2_usable())
+		return -ENODEV;
+
+	sha256_mb_mgrs = alloc_percpu(struct sha256_mb_mgr);
+	if (!sha256_mb_mgrs)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct sha256_mb_mgr *mgr = per_cpu_ptr(sha256_mb_mgrs, cpu);
+
+		spin_lock_init(&mgr->lock);
+		INIT_LIST_HEAD(&mgr->queue);
+		mgr->cpu = cpu;
+		INIT_DELAYED_WORK(&mgr->flush, sha256_mb_flush);
+	}
+
+	err = crypto_register_ahash(&alg);
+	if (err) {
+		free_percpu(sha256_mb_mgrs);
+		return err;
+	}
+
+	pr_info("Using AVX2 optimized multi-buffer SHA-256 implementation\n");
+
+	return 0;
+}
+
+static void __exit sha256_mb_mod_fini(void)
+{
+	int cpu;
+
+	crypto_unregister_ahash(&alg);
+
+	for_each_possible_cpu(cpu)
+		cancel_delayed_work_sync(&per_cpu_ptr(sha256_mb_mgrs,
+						      cpu)->flush);
+	free_percpu(sha256_mb_mgrs);
+}
+
+module_init(sha256_mb_mod_init);
+module_exit(sha256_mb_mod_fini);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("SHA256 Secure Hash Algorithm, AVX2 multi-buffer");
+
+MODULE_ALIAS("sha256");
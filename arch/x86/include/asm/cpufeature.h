@@ -225,6 +225,7 @@
 #define X86_FEATURE_AVX512PF	(9*32+26) /* AVX-512 Prefetch */
 #define X86_FEATURE_AVX512ER	(9*32+27) /* AVX-512 Exponential and Reciprocal */
 #define X86_FEATURE_AVX512CD	(9*32+28) /* AVX-512 Conflict Detection */
+#define X86_FEATURE_AVX512BW	(9*32+30) /* AVX-512 BW (Byte/Word granular) Instructions */
 
 /*
  * BUG word(s)
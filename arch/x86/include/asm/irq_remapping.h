@@ -31,6 +31,12 @@ struct msi_msg;
 struct pci_dev;
 struct irq_cfg;
 
+/* Where a posted interrupt goes, see irq_remapping_set_vcpu_affinity() */
+struct vcpu_data {
+	u64 pi_desc_addr;	/* physical address of the PI descriptor */
+	u32 vector;		/* guest vector */
+};
+
 #ifdef CONFIG_IRQ_REMAP
 
 extern void setup_irq_remapping_ops(void);
@@ -58,6 +64,10 @@ extern bool setup_remapped_irq(int irq,
 
 void irq_remap_modify_chip_defaults(struct irq_chip *chip);
 
+extern bool irq_remapping_cap_posting(void);
+extern int irq_remapping_set_vcpu_affinity(unsigned int irq,
+					   struct vcpu_data *vcpu_info);
+
 #else  /* CONFIG_IRQ_REMAP */
 
 static inline void setup_irq_remapping_ops(void) { }
@@ -101,6 +111,17 @@ static inline bool setup_remapped_irq(int irq,
 {
 	return false;
 }
+
+static inline bool irq_remapping_cap_posting(void)
+{
+	return false;
+}
+
+static inline int irq_remapping_set_vcpu_affinity(unsigned int irq,
+						  struct vcpu_data *vcpu_info)
+{
+	return -ENODEV;
+}
 #endif /* CONFIG_IRQ_REMAP */
 
 #endif /* __X86_IRQ_REMAPPING_H */
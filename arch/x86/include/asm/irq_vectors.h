@@ -105,6 +105,8 @@
 /* Vector for KVM to deliver posted interrupt IPI */
 #ifdef CONFIG_HAVE_KVM
 #define POSTED_INTR_VECTOR		0xf2
+/* Posted by the IOMMU while the target vcpu is blocked */
+#define POSTED_INTR_WAKEUP_VECTOR	0xf1
 #endif
 
 /*
@@ -40,6 +40,8 @@
 
 #define KVM_MMIO_SIZE 16
 
+#define KVM_HALT_POLL_NS_DEFAULT 500000
+
 #define KVM_PIO_PAGE_OFFSET 1
 #define KVM_COALESCED_MMIO_PAGE_OFFSET 2
 
@@ -644,6 +646,8 @@ struct kvm_vcpu_stat {
 	u32 irq_window_exits;
 	u32 nmi_window_exits;
 	u32 halt_exits;
+	u32 halt_successful_poll;
+	u32 halt_attempted_poll;
 	u32 halt_wakeup;
 	u32 request_irq_exits;
 	u32 irq_exits;
@@ -775,6 +779,42 @@ struct kvm_x86_ops {
 	bool (*mpx_supported)(void);
 
 	int (*check_nested_events)(struct kvm_vcpu *vcpu, bool external_intr);
+
+	/*
+	 * Hardware assisted dirty logging, NULL when dirty pages are tracked
+	 * by write protection.
+	 *
+	 * slot_enable_log_dirty: called when dirty logging is turned on for
+	 *	a memslot, instead of write protecting all of it.
+	 * flush_log_dirty: make sure the dirty bitmaps are up to date with
+	 *	whatever the hardware has logged so far.
+	 * enable_log_dirty_pt_masked: rearm logging for the pages in @mask
+	 *	just reported to userspace, instead of write protecting them.
+	 * cpu_dirty_log_size: pages a vcpu may have logged in hardware and
+	 *	not reported yet.
+	 */
+	void (*slot_enable_log_dirty)(struct kvm *kvm,
+				      struct kvm_memory_slot *slot);
+	void (*flush_log_dirty)(struct kvm *kvm);
+	void (*enable_log_dirty_pt_masked)(struct kvm *kvm,
+					   struct kvm_memory_slot *slot,
+					   gfn_t offset, unsigned long mask);
+	int cpu_dirty_log_size;
+
+	/*
+	 * Interrupts of assigned devices posted by the IOMMU, NULL when
+	 * they always go through the host.
+	 *
+	 * pre_block: called before the vcpu blocks, returns 1 if it must
+	 *	not block after all.
+	 * post_block: called once it has been woken up.
+	 * update_pi_irte: post @host_irq to @vcpu as @vector, or take it
+	 *	back if @vcpu is NULL.
+	 */
+	int (*pre_block)(struct kvm_vcpu *vcpu);
+	void (*post_block)(struct kvm_vcpu *vcpu);
+	int (*update_pi_irte)(unsigned int host_irq, struct kvm_vcpu *vcpu,
+			      u32 vector);
 };
 
 struct kvm_arch_async_pf {
@@ -811,6 +851,15 @@ void kvm_mmu_slot_remove_write_access(struct kvm *kvm, int slot);
 void kvm_mmu_write_protect_pt_masked(struct kvm *kvm,
 				     struct kvm_memory_slot *slot,
 				     gfn_t gfn_offset, unsigned long mask);
+void kvm_mmu_slot_leaf_clear_dirty(struct kvm *kvm,
+				   struct kvm_memory_slot *memslot);
+void kvm_mmu_slot_largepage_remove_write_access(struct kvm *kvm,
+					struct kvm_memory_slot *memslot);
+void kvm_mmu_zap_collapsible_sptes(struct kvm *kvm,
+				   struct kvm_memory_slot *memslot);
+void kvm_mmu_clear_dirty_pt_masked(struct kvm *kvm,
+				   struct kvm_memory_slot *slot,
+				   gfn_t gfn_offset, unsigned long mask);
 void kvm_mmu_zap_all(struct kvm *kvm);
 void kvm_mmu_invalidate_mmio_sptes(struct kvm *kvm);
 unsigned int kvm_mmu_calculate_mmu_pages(struct kvm *kvm);
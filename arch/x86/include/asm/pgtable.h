@@ -543,7 +543,13 @@ static inline int pmd_bad(pmd_t pmd)
 	if ((pmd_flags(pmd) & (_PAGE_NUMA|_PAGE_PRESENT)) == _PAGE_NUMA)
 		return 0;
 #endif
+#ifdef CONFIG_FORK_SHARE_PTE
+	/* a pte table shared on fork is mapped read-only */
+	return (pmd_flags(pmd) & ~(_PAGE_USER | _PAGE_RW)) !=
+		(_KERNPG_TABLE & ~_PAGE_RW);
+#else
 	return (pmd_flags(pmd) & ~_PAGE_USER) != _KERNPG_TABLE;
+#endif
 }
 
 static inline unsigned long pages_to_mb(unsigned long npg)
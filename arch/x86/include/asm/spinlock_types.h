@@ -3,6 +3,10 @@
 
 #include <linux/types.h>
 
+#ifdef CONFIG_QUEUED_SPINLOCKS
+#include <asm-generic/qspinlock_types.h>
+#else
+
 #ifdef CONFIG_PARAVIRT_SPINLOCKS
 #define __TICKET_LOCK_INC	2
 #define TICKET_SLOWPATH_FLAG	((__ticket_t)1)
@@ -34,6 +38,8 @@ typedef struct arch_spinlock {
 
 #define __ARCH_SPIN_LOCK_UNLOCKED	{ { 0 } }
 
+#endif /* CONFIG_QUEUED_SPINLOCKS */
+
 #include <asm/rwlock.h>
 
 #endif /* _ASM_X86_SPINLOCK_TYPES_H */
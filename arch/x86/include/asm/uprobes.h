@@ -33,12 +33,31 @@ typedef u8 uprobe_opcode_t;
 #define UPROBE_SWBP_INSN		0xcc
 #define UPROBE_SWBP_INSN_SIZE		   1
 
+/*
+ * An instruction the trap handler runs itself, without single-stepping
+ * it out of line.
+ *
+ * @kind: UPROBE_EMUL_*, or UPROBE_EMUL_NONE to single-step
+ * @ilen: length of the instruction
+ * @src: register read by a push or mov
+ * @dst: register written by a mov
+ * @offs: displacement of a relative call or jmp
+ */
+struct uprobe_emul {
+	u8				kind;
+	u8				ilen;
+	u8				src;
+	u8				dst;
+	s32				offs;
+};
+
 struct arch_uprobe {
 	u16				fixups;
 	union {
 		u8			insn[MAX_UINSN_BYTES];
 		u8			ixol[MAX_UINSN_BYTES];
 	};
+	struct uprobe_emul		emul;
 #ifdef CONFIG_X86_64
 	unsigned long			rip_rela_target_address;
 #endif
@@ -25,6 +25,9 @@
 #define MF_VECTOR 16
 #define MC_VECTOR 18
 
+/* vcpu mmap page offset of the dirty ring, see KVM_CAP_DIRTY_LOG_RING */
+#define KVM_DIRTY_LOG_PAGE_OFFSET 64
+
 /* Select x86 specific features in <linux/kvm.h> */
 #define __KVM_HAVE_PIT
 #define __KVM_HAVE_IOAPIC
@@ -132,25 +132,21 @@ void native_send_call_func_single_ipi(int cpu)
 	apic->send_IPI_mask(cpumask_of(cpu), CALL_FUNCTION_SINGLE_VECTOR);
 }
 
+/*
+ * Use the all-but-self shorthand when @mask is every other online cpu and
+ * no cpu is half way through coming up, which the shorthand would hit.
+ * A subset of the online cpus that leaves this cpu out and has the right
+ * weight is exactly that, no need to build a temporary mask for it.
+ */
 void native_send_call_func_ipi(const struct cpumask *mask)
 {
-	cpumask_var_t allbutself;
-
-	if (!alloc_cpumask_var(&allbutself, GFP_ATOMIC)) {
-		apic->send_IPI_mask(mask, CALL_FUNCTION_VECTOR);
-		return;
-	}
-
-	cpumask_copy(allbutself, cpu_online_mask);
-	cpumask_clear_cpu(smp_processor_id(), allbutself);
-
-	if (cpumask_equal(mask, allbutself) &&
+	if (cpumask_weight(mask) == num_online_cpus() - 1 &&
+	    !cpumask_test_cpu(smp_processor_id(), mask) &&
+	    cpumask_subset(mask, cpu_online_mask) &&
 	    cpumask_equal(cpu_online_mask, cpu_callout_mask))
 		apic->send_IPI_allbutself(CALL_FUNCTION_VECTOR);
 	else
 		apic->send_IPI_mask(mask, CALL_FUNCTION_VECTOR);
-
-	free_cpumask_var(allbutself);
 }
 
 static int smp_stop_nmi_callback(unsigned int val, struct pt_regs *regs)
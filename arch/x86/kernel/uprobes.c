@@ -49,6 +49,15 @@
 
 #define	UPROBE_TRAP_NR		UINT_MAX
 
+/* Instructions arch_uprobe_skip_sstep() emulates */
+#define UPROBE_EMUL_NONE	0
+#define UPROBE_EMUL_NOP		1
+#define UPROBE_EMUL_PUSH	2	/* push %reg */
+#define UPROBE_EMUL_MOV32	3	/* mov %reg32,%reg32 */
+#define UPROBE_EMUL_MOV64	4	/* mov %reg64,%reg64 */
+#define UPROBE_EMUL_CALL	5	/* call rel32 */
+#define UPROBE_EMUL_JMP		6	/* jmp rel8, jmp rel32 */
+
 /* Adaptations for mhiramat x86 decoder v14. */
 #define OPCODE1(insn)		((insn)->opcode.bytes[0])
 #define OPCODE2(insn)		((insn)->opcode.bytes[1])
@@ -412,6 +421,71 @@ static int validate_insn_bits(struct arch_uprobe *auprobe, struct mm_struct *mm,
 }
 #endif /* CONFIG_X86_64 */
 
+/*
+ * Note in arch_uprobe->emul whether arch_uprobe_skip_sstep() can run the
+ * instruction itself, which saves the trap of the single-step.  Only
+ * what is common at probe sites and has no side effect beyond the
+ * registers and the stack qualifies; everything else is single-stepped.
+ * Called before handle_riprel_insn() rewrites the instruction.
+ */
+static void prepare_emulation(struct arch_uprobe *auprobe, struct insn *insn)
+{
+	struct uprobe_emul *emul = &auprobe->emul;
+	u8 rex, modrm, reg, rm;
+	int i;
+
+	emul->kind = UPROBE_EMUL_NONE;
+
+	insn_get_length(insn);
+	emul->ilen = insn->length;
+	rex = insn->rex_prefix.value;
+
+	/* nop and nopl, possibly with operand size prefixes */
+	for (i = 0; i < insn->prefixes.nbytes; i++) {
+		if (insn->prefixes.bytes[i] != 0x66)
+			return;
+	}
+	if ((OPCODE1(insn) == 0x90 && !X86_REX_B(rex)) ||
+	    (OPCODE1(insn) == 0x0f && OPCODE2(insn) == 0x1f)) {
+		emul->kind = UPROBE_EMUL_NOP;
+		return;
+	}
+
+	/* anything else takes its default operand size */
+	if (insn->prefixes.nbytes)
+		return;
+
+	switch (OPCODE1(insn)) {
+	case 0x50 ... 0x57:
+		emul->src = (OPCODE1(insn) & 7) | (X86_REX_B(rex) ? 8 : 0);
+		emul->kind = UPROBE_EMUL_PUSH;
+		break;
+	case 0x89:		/* mov %reg,%r/m */
+	case 0x8b:		/* mov %r/m,%reg */
+		modrm = insn->modrm.value;
+		if (X86_MODRM_MOD(modrm) != 3)
+			break;
+		reg = X86_MODRM_REG(modrm) | (X86_REX_R(rex) ? 8 : 0);
+		rm = X86_MODRM_RM(modrm) | (X86_REX_B(rex) ? 8 : 0);
+		emul->src = OPCODE1(insn) == 0x89 ? reg : rm;
+		emul->dst = OPCODE1(insn) == 0x89 ? rm : reg;
+		emul->kind = X86_REX_W(rex) ? UPROBE_EMUL_MOV64 :
+					      UPROBE_EMUL_MOV32;
+		break;
+	case 0xe8:
+		emul->offs = insn->immediate.value;
+		emul->kind = UPROBE_EMUL_CALL;
+		break;
+	case 0xe9:
+	case 0xeb:
+		emul->offs = insn->immediate.value;
+		emul->kind = UPROBE_EMUL_JMP;
+		break;
+	default:
+		break;
+	}
+}
+
 /**
  * arch_uprobe_analyze_insn - instruction analysis including validity and fixups.
  * @mm: the probed address space.
@@ -429,6 +503,7 @@ int arch_uprobe_analyze_insn(struct arch_uprobe *auprobe, struct mm_struct *mm,
 	if (ret != 0)
 		return ret;
 
+	prepare_emulation(auprobe, &insn);
 	handle_riprel_insn(auprobe, mm, &insn);
 	prepare_fixups(auprobe, &insn);
 
@@ -668,26 +743,86 @@ void arch_uprobe_abort_xol(struct arch_uprobe *auprobe, struct pt_regs *regs)
 		regs->flags &= ~X86_EFLAGS_TF;
 }
 
+/* The register numbered @reg in a modrm byte, extended by REX */
+static unsigned long *uprobe_emul_reg(struct pt_regs *regs, u8 reg)
+{
+	switch (reg) {
+	case 0:		return &regs->ax;
+	case 1:		return &regs->cx;
+	case 2:		return &regs->dx;
+	case 3:		return &regs->bx;
+	case 4:		return &regs->sp;
+	case 5:		return &regs->bp;
+	case 6:		return &regs->si;
+	case 7:		return &regs->di;
+#ifdef CONFIG_X86_64
+	case 8:		return &regs->r8;
+	case 9:		return &regs->r9;
+	case 10:	return &regs->r10;
+	case 11:	return &regs->r11;
+	case 12:	return &regs->r12;
+	case 13:	return &regs->r13;
+	case 14:	return &regs->r14;
+	case 15:	return &regs->r15;
+#endif
+	}
+	BUG();
+}
+
+static int uprobe_emul_push(struct pt_regs *regs, unsigned long val)
+{
+	int size = is_ia32_task() ? 4 : 8;
+	unsigned long sp = regs->sp - size;
+
+	if (copy_to_user((void __user *)sp, &val, size))
+		return -EFAULT;
+
+	regs->sp = sp;
+	return 0;
+}
+
 /*
- * Skip these instructions as per the currently known x86 ISA.
- * rep=0x66*; nop=0x90
+ * Run the instruction noted by prepare_emulation() on @regs, with ip at
+ * the probed address.  Returns false if it must be single-stepped, e.g.
+ * if the stack is not writable, in which case @regs are left untouched
+ * and the single-step takes the fault.
  */
 static bool __skip_sstep(struct arch_uprobe *auprobe, struct pt_regs *regs)
 {
-	int i;
-
-	for (i = 0; i < MAX_UINSN_BYTES; i++) {
-		if (auprobe->insn[i] == 0x66)
-			continue;
-
-		if (auprobe->insn[i] == 0x90) {
-			regs->ip += i + 1;
-			return true;
-		}
+	struct uprobe_emul *emul = &auprobe->emul;
+	unsigned long ip = regs->ip + emul->ilen;
 
+	switch (emul->kind) {
+	case UPROBE_EMUL_NOP:
+		break;
+	case UPROBE_EMUL_PUSH:
+		if (uprobe_emul_push(regs, *uprobe_emul_reg(regs, emul->src)))
+			return false;
+		break;
+	case UPROBE_EMUL_MOV32:
+		*uprobe_emul_reg(regs, emul->dst) =
+			(u32)*uprobe_emul_reg(regs, emul->src);
+		break;
+	case UPROBE_EMUL_MOV64:
+		*uprobe_emul_reg(regs, emul->dst) =
+			*uprobe_emul_reg(regs, emul->src);
 		break;
+	case UPROBE_EMUL_CALL:
+		if (uprobe_emul_push(regs, ip))
+			return false;
+		ip += emul->offs;
+		break;
+	case UPROBE_EMUL_JMP:
+		ip += emul->offs;
+		break;
+	default:
+		return false;
 	}
-	return false;
+
+	if (is_ia32_task())
+		ip = (u32)ip;
+	regs->ip = ip;
+	return true;
 }
 
 bool arch_uprobe_skip_sstep(struct arch_uprobe *auprobe, struct pt_regs *regs)
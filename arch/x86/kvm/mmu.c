@@ -1232,6 +1232,31 @@ static bool __rmap_write_protect(struct kvm *kvm, unsigned long *rmapp,
 	return flush;
 }
 
+/*
+ * Clear the dirty bit of the sptes in @rmapp, so that the next write to
+ * them is logged by PML.  The sptes stay writable.
+ */
+static bool __rmap_clear_dirty(struct kvm *kvm, unsigned long *rmapp)
+{
+	u64 *sptep;
+	struct rmap_iterator iter;
+	bool flush = false;
+
+	for (sptep = rmap_get_first(*rmapp, &iter); sptep;
+	     sptep = rmap_get_next(&iter)) {
+		BUG_ON(!(*sptep & PT_PRESENT_MASK));
+
+		if (*sptep & shadow_dirty_mask) {
+			rmap_printk("rmap_clear_dirty: spte %p %llx\n",
+				    sptep, *sptep);
+			mmu_spte_update(sptep, *sptep & ~shadow_dirty_mask);
+			flush = true;
+		}
+	}
+
+	return flush;
+}
+
 /**
  * kvm_mmu_write_protect_pt_masked - write protect selected PT level pages
  * @kvm: kvm instance
@@ -1258,6 +1283,33 @@ void kvm_mmu_write_protect_pt_masked(struct kvm *kvm,
 	}
 }
 
+/**
+ * kvm_mmu_clear_dirty_pt_masked - clear dirty bit of selected PT level pages
+ * @kvm: kvm instance
+ * @slot: slot to clear
+ * @gfn_offset: start of the BITS_PER_LONG pages we care about
+ * @mask: indicates which pages we should clear
+ *
+ * The PML counterpart of kvm_mmu_write_protect_pt_masked(): the pages are
+ * logged again by the hardware on their next write.  The caller must flush
+ * the TLBs.
+ */
+void kvm_mmu_clear_dirty_pt_masked(struct kvm *kvm,
+				   struct kvm_memory_slot *slot,
+				   gfn_t gfn_offset, unsigned long mask)
+{
+	unsigned long *rmapp;
+
+	while (mask) {
+		rmapp = __gfn_to_rmap(slot->base_gfn + gfn_offset + __ffs(mask),
+				      PT_PAGE_TABLE_LEVEL, slot);
+		__rmap_clear_dirty(kvm, rmapp);
+
+		/* clear the first set bit */
+		mask &= mask - 1;
+	}
+}
+
 static bool rmap_write_protect(struct kvm *kvm, u64 gfn)
 {
 	struct kvm_memory_slot *slot;
@@ -4315,6 +4367,117 @@ void kvm_mmu_slot_remove_write_access(struct kvm *kvm, int slot)
 	spin_unlock(&kvm->mmu_lock);
 }
 
+static bool slot_rmap_write_protect(struct kvm *kvm, unsigned long *rmapp)
+{
+	return __rmap_write_protect(kvm, rmapp, false);
+}
+
+/*
+ * Apply @fn to the rmaps of @memslot for levels @start_level to @end_level,
+ * flushing the TLBs before mmu_lock is dropped and at the end if any call
+ * of @fn asked for it.
+ */
+static void slot_handle_level(struct kvm *kvm,
+			      struct kvm_memory_slot *memslot,
+			      int start_level, int end_level,
+			      bool (*fn)(struct kvm *kvm, unsigned long *rmapp))
+{
+	gfn_t last_gfn;
+	bool flush = false;
+	int i;
+
+	last_gfn = memslot->base_gfn + memslot->npages - 1;
+
+	spin_lock(&kvm->mmu_lock);
+
+	for (i = start_level; i <= end_level; ++i) {
+		unsigned long *rmapp;
+		unsigned long last_index, index;
+
+		rmapp = memslot->arch.rmap[i - PT_PAGE_TABLE_LEVEL];
+		last_index = gfn_to_index(last_gfn, memslot->base_gfn, i);
+
+		for (index = 0; index <= last_index; ++index, ++rmapp) {
+			if (*rmapp)
+				flush |= fn(kvm, rmapp);
+
+			if (need_resched() || spin_needbreak(&kvm->mmu_lock)) {
+				if (flush) {
+					kvm_flush_remote_tlbs(kvm);
+					flush = false;
+				}
+				cond_resched_lock(&kvm->mmu_lock);
+			}
+		}
+	}
+
+	if (flush)
+		kvm_flush_remote_tlbs(kvm);
+	spin_unlock(&kvm->mmu_lock);
+}
+
+/*
+ * Start PML dirty logging on the small pages of @memslot: a spte whose
+ * dirty bit is clear gets logged by the CPU on its next write.
+ */
+void kvm_mmu_slot_leaf_clear_dirty(struct kvm *kvm,
+				   struct kvm_memory_slot *memslot)
+{
+	slot_handle_level(kvm, memslot, PT_PAGE_TABLE_LEVEL,
+			  PT_PAGE_TABLE_LEVEL, __rmap_clear_dirty);
+}
+
+/*
+ * PML logs a large page mapping as a single GPA, so drop those mappings;
+ * they will not be created again until the end of the logging.
+ */
+void kvm_mmu_slot_largepage_remove_write_access(struct kvm *kvm,
+					struct kvm_memory_slot *memslot)
+{
+	slot_handle_level(kvm, memslot, PT_PAGE_TABLE_LEVEL + 1,
+			  PT_PAGE_TABLE_LEVEL + KVM_NR_PAGE_SIZES - 1,
+			  slot_rmap_write_protect);
+}
+
+/*
+ * Drop the small direct mappings of pages that are part of a huge page
+ * on the host, transparent or hugetlbfs.  They were split for dirty
+ * logging and the next fault maps them large again.  Indirect shadow
+ * pages follow the guest page tables and are left alone.
+ */
+static bool kvm_mmu_zap_collapsible_spte(struct kvm *kvm,
+					 unsigned long *rmapp)
+{
+	u64 *sptep;
+	struct rmap_iterator iter;
+	bool flush = false;
+	pfn_t pfn;
+
+	for (sptep = rmap_get_first(*rmapp, &iter); sptep;) {
+		BUG_ON(!(*sptep & PT_PRESENT_MASK));
+		pfn = spte_to_pfn(*sptep);
+
+		if (page_header(__pa(sptep))->role.direct &&
+		    !kvm_is_mmio_pfn(pfn) && PageCompound(pfn_to_page(pfn))) {
+			drop_spte(kvm, sptep);
+			flush = true;
+			sptep = rmap_get_first(*rmapp, &iter);
+			continue;
+		}
+
+		sptep = rmap_get_next(&iter);
+	}
+
+	return flush;
+}
+
+void kvm_mmu_zap_collapsible_sptes(struct kvm *kvm,
+				   struct kvm_memory_slot *memslot)
+{
+	slot_handle_level(kvm, memslot, PT_PAGE_TABLE_LEVEL,
+			  PT_PAGE_TABLE_LEVEL, kvm_mmu_zap_collapsible_spte);
+}
+
 #define BATCH_ZAP_PAGES	10
 static void kvm_zap_obsolete_pages(struct kvm *kvm)
 {
@@ -45,6 +45,7 @@
 #include <asm/perf_event.h>
 #include <asm/debugreg.h>
 #include <asm/kexec.h>
+#include <asm/irq_remapping.h>
 
 #include "trace.h"
 
@@ -91,6 +92,14 @@ module_param(enable_apicv, bool, S_IRUGO);
 
 static bool __read_mostly enable_shadow_vmcs = 1;
 module_param_named(enable_shadow_vmcs, enable_shadow_vmcs, bool, S_IRUGO);
+
+/*
+ * If pml=1, dirty logging uses Page Modification Logging: the CPU records
+ * the GPA of every page whose EPT dirty bit it sets, and KVM only has to
+ * clear dirty bits instead of write protecting the whole slot.
+ */
+static bool __read_mostly enable_pml = 1;
+module_param_named(pml, enable_pml, bool, S_IRUGO);
 /*
  * If nested=1, nested virtualization is supported, i.e., guests may use
  * VMX and be a hypervisor for its own guests. If nested=0, guests may not
@@ -114,6 +123,9 @@ module_param(nested, bool, S_IRUGO);
 
 #define VMX_MISC_EMULATED_PREEMPTION_TIMER_RATE 5
 
+/* Number of GPAs the PML buffer, one page, can hold */
+#define PML_ENTITY_NUM		512
+
 /*
  * These 2 parameters are used to config the controls for Pause-Loop Exiting:
  * ple_gap:    upper bound on the amount of time between two successive
@@ -385,11 +397,25 @@ struct nested_vmx {
 };
 
 #define POSTED_INTR_ON  0
-/* Posted-Interrupt Descriptor */
+#define POSTED_INTR_SN  1
+/*
+ * Posted-Interrupt Descriptor.  The notification fields are only used
+ * by the IOMMU, the CPU takes the vector from the VMCS.
+ */
 struct pi_desc {
 	u32 pir[8];     /* Posted interrupt requested */
-	u32 control;	/* bit 0 of control is outstanding notification bit */
-	u32 rsvd[7];
+	union {
+		struct {
+			u16	on	: 1,	/* outstanding notification */
+				sn	: 1,	/* suppress notification */
+				rsvd_1	: 14;
+			u8	nv;		/* notification vector */
+			u8	rsvd_2;
+			u32	ndst;		/* notification destination */
+		};
+		u64 control;
+	};
+	u32 rsvd[6];
 } __aligned(64);
 
 static bool pi_test_and_set_on(struct pi_desc *pi_desc)
@@ -398,6 +424,21 @@ static bool pi_test_and_set_on(struct pi_desc *pi_desc)
 			(unsigned long *)&pi_desc->control);
 }
 
+static bool pi_test_on(struct pi_desc *pi_desc)
+{
+	return test_bit(POSTED_INTR_ON, (unsigned long *)&pi_desc->control);
+}
+
+static void pi_set_sn(struct pi_desc *pi_desc)
+{
+	set_bit(POSTED_INTR_SN, (unsigned long *)&pi_desc->control);
+}
+
+static bool pi_is_pir_empty(struct pi_desc *pi_desc)
+{
+	return bitmap_empty((unsigned long *)pi_desc->pir, NR_VECTORS);
+}
+
 static bool pi_test_and_clear_on(struct pi_desc *pi_desc)
 {
 	return test_and_clear_bit(POSTED_INTR_ON,
@@ -478,6 +519,12 @@ struct vcpu_vmx {
 
 	/* Posted interrupt descriptor */
 	struct pi_desc pi_desc;
+	/* On blocked_vcpu_on_cpu of this cpu while blocked, else -1 */
+	int pi_pre_pcpu;
+	struct list_head pi_blocked_list;
+
+	/* Page Modification Logging buffer, PML_ENTITY_NUM GPAs */
+	struct page *pml_pg;
 
 	/* Support for a guest hypervisor (nested VMX) */
 	struct nested_vmx nested;
@@ -751,6 +798,13 @@ static DEFINE_PER_CPU(struct vmcs *, current_vmcs);
 static DEFINE_PER_CPU(struct list_head, loaded_vmcss_on_cpu);
 static DEFINE_PER_CPU(struct desc_ptr, host_gdt);
 
+/*
+ * Blocked vcpus whose posted interrupts notify this cpu with
+ * POSTED_INTR_WAKEUP_VECTOR.
+ */
+static DEFINE_PER_CPU(struct list_head, blocked_vcpu_on_cpu);
+static DEFINE_PER_CPU(spinlock_t, blocked_vcpu_on_cpu_lock);
+
 static unsigned long *vmx_io_bitmap_a;
 static unsigned long *vmx_io_bitmap_b;
 static unsigned long *vmx_msr_bitmap_legacy;
@@ -1038,6 +1092,11 @@ static inline bool cpu_has_vmx_shadow_vmcs(void)
 		SECONDARY_EXEC_SHADOW_VMCS;
 }
 
+static inline bool cpu_has_vmx_pml(void)
+{
+	return vmcs_config.cpu_based_2nd_exec_ctrl & SECONDARY_EXEC_ENABLE_PML;
+}
+
 static inline bool report_flexpriority(void)
 {
 	return flexpriority_enabled;
@@ -1786,6 +1845,75 @@ static void vmx_load_host_state(struct vcpu_vmx *vmx)
 	preempt_enable();
 }
 
+/* Interrupts of assigned devices may be posted to the guest by VT-d */
+static bool vmx_can_post_irqs(struct kvm *kvm)
+{
+	return enable_apicv && irqchip_in_kernel(kvm) &&
+	       irq_remapping_cap_posting();
+}
+
+static u32 pi_ndst(int cpu)
+{
+	u32 dest = cpu_physical_id(cpu);
+
+	return x2apic_enabled() ? dest : (dest << 8) & 0xff00;
+}
+
+/*
+ * Point the notifications of the IOMMU at the new cpu and let them
+ * through again.  A vcpu that blocked keeps the wakeup vector until
+ * vmx_post_block().
+ */
+static void vmx_vcpu_pi_load(struct kvm_vcpu *vcpu, int cpu)
+{
+	struct pi_desc *pi_desc = &to_vmx(vcpu)->pi_desc;
+	struct pi_desc old, new;
+
+	if (!vmx_can_post_irqs(vcpu->kvm))
+		return;
+
+	do {
+		old.control = new.control = pi_desc->control;
+		if (old.nv != POSTED_INTR_WAKEUP_VECTOR) {
+			new.ndst = pi_ndst(cpu);
+			new.nv = POSTED_INTR_VECTOR;
+		}
+		new.sn = 0;
+	} while (cmpxchg(&pi_desc->control, old.control,
+			 new.control) != old.control);
+
+	/*
+	 * Interrupts posted while SN was set did not set ON, which is what
+	 * sync_pir_to_irr() looks at.
+	 */
+	if (!pi_is_pir_empty(pi_desc))
+		pi_test_and_set_on(pi_desc);
+}
+
+/*
+ * A preempted vcpu will run again soon and pick up whatever was posted,
+ * there is no need to interrupt the cpu it was running on.
+ */
+static void vmx_vcpu_pi_put(struct kvm_vcpu *vcpu)
+{
+	if (vcpu->preempted && vmx_can_post_irqs(vcpu->kvm))
+		pi_set_sn(&to_vmx(vcpu)->pi_desc);
+}
+
+/* Handler for POSTED_INTR_WAKEUP_VECTOR, runs with interrupts off */
+static void pi_wakeup_handler(void)
+{
+	int cpu = smp_processor_id();
+	struct vcpu_vmx *vmx;
+
+	spin_lock(&per_cpu(blocked_vcpu_on_cpu_lock, cpu));
+	list_for_each_entry(vmx, &per_cpu(blocked_vcpu_on_cpu, cpu),
+			    pi_blocked_list)
+		if (pi_test_on(&vmx->pi_desc))
+			kvm_vcpu_kick(&vmx->vcpu);
+	spin_unlock(&per_cpu(blocked_vcpu_on_cpu_lock, cpu));
+}
+
 /*
  * Switches to specified vcpu, until a matching vcpu_put(), but assumes
  * vcpu mutex is already taken.
@@ -1836,10 +1964,14 @@ static void vmx_vcpu_load(struct kvm_vcpu *vcpu, int cpu)
 		vmcs_writel(HOST_IA32_SYSENTER_ESP, sysenter_esp); /* 22.2.3 */
 		vmx->loaded_vmcs->cpu = cpu;
 	}
+
+	vmx_vcpu_pi_load(vcpu, cpu);
 }
 
 static void vmx_vcpu_put(struct kvm_vcpu *vcpu)
 {
+	vmx_vcpu_pi_put(vcpu);
+
 	__vmx_load_host_state(to_vmx(vcpu));
 	if (!vmm_exclusive) {
 		__loaded_vmcs_clear(to_vmx(vcpu)->loaded_vmcs);
@@ -2836,7 +2968,8 @@ static __init int setup_vmcs_config(struct vmcs_config *vmcs_conf)
 			SECONDARY_EXEC_ENABLE_INVPCID |
 			SECONDARY_EXEC_APIC_REGISTER_VIRT |
 			SECONDARY_EXEC_VIRTUAL_INTR_DELIVERY |
-			SECONDARY_EXEC_SHADOW_VMCS;
+			SECONDARY_EXEC_SHADOW_VMCS |
+			SECONDARY_EXEC_ENABLE_PML;
 		if (adjust_vmx_controls(min2, opt2,
 					MSR_IA32_VMX_PROCBASED_CTLS2,
 					&_cpu_based_2nd_exec_control) < 0)
@@ -3064,6 +3197,8 @@ static __init int alloc_kvm_area(void)
 
 static __init int hardware_setup(void)
 {
+	int cpu;
+
 	if (setup_vmcs_config(&vmcs_config) < 0)
 		return -EIO;
 
@@ -3116,11 +3251,40 @@ static __init int hardware_setup(void)
 	if (nested)
 		nested_vmx_setup_ctls_msrs();
 
+	/*
+	 * PML logs the pages whose EPT dirty bit the CPU sets.  The shadow
+	 * EPT tables built for a nested guest do not use dirty bits, so their
+	 * pages could only be tracked by write protection.
+	 */
+	if (!enable_ept || !enable_ept_ad_bits || !cpu_has_vmx_pml() || nested)
+		enable_pml = 0;
+
+	if (!enable_pml) {
+		kvm_x86_ops->slot_enable_log_dirty = NULL;
+		kvm_x86_ops->flush_log_dirty = NULL;
+		kvm_x86_ops->enable_log_dirty_pt_masked = NULL;
+		kvm_x86_ops->cpu_dirty_log_size = 0;
+	}
+
+	for_each_possible_cpu(cpu) {
+		INIT_LIST_HEAD(&per_cpu(blocked_vcpu_on_cpu, cpu));
+		spin_lock_init(&per_cpu(blocked_vcpu_on_cpu_lock, cpu));
+	}
+
+	/* Interrupts are posted to the PI descriptors APICv delivers from */
+	if (!enable_apicv || !irq_remapping_cap_posting()) {
+		kvm_x86_ops->pre_block = NULL;
+		kvm_x86_ops->post_block = NULL;
+		kvm_x86_ops->update_pi_irte = NULL;
+	} else
+		kvm_set_posted_intr_wakeup_handler(pi_wakeup_handler);
+
 	return alloc_kvm_area();
 }
 
 static __exit void hardware_unsetup(void)
 {
+	kvm_set_posted_intr_wakeup_handler(NULL);
 	free_kvm_area();
 }
 
@@ -4338,6 +4502,8 @@ static u32 vmx_secondary_exec_control(struct vcpu_vmx *vmx)
 	   a current VMCS12
 	*/
 	exec_control &= ~SECONDARY_EXEC_SHADOW_VMCS;
+	if (!enable_pml)
+		exec_control &= ~SECONDARY_EXEC_ENABLE_PML;
 	return exec_control;
 }
 
@@ -4402,6 +4568,11 @@ static int vmx_vcpu_setup(struct vcpu_vmx *vmx)
 		vmcs_write32(PLE_WINDOW, ple_window);
 	}
 
+	if (enable_pml) {
+		vmcs_write64(PML_ADDRESS, page_to_phys(vmx->pml_pg));
+		vmcs_write16(GUEST_PML_INDEX, PML_ENTITY_NUM - 1);
+	}
+
 	vmcs_write32(PAGE_FAULT_ERROR_CODE_MASK, 0);
 	vmcs_write32(PAGE_FAULT_ERROR_CODE_MATCH, 0);
 	vmcs_write32(CR3_TARGET_COUNT, 0);           /* 22.2.1 */
@@ -4538,8 +4709,12 @@ static void vmx_vcpu_reset(struct kvm_vcpu *vcpu)
 		vmcs_write64(APIC_ACCESS_ADDR,
 			     page_to_phys(vmx->vcpu.kvm->arch.apic_access_page));
 
-	if (vmx_vm_has_apicv(vcpu->kvm))
-		memset(&vmx->pi_desc, 0, sizeof(struct pi_desc));
+	if (vmx_vm_has_apicv(vcpu->kvm)) {
+		/* Keep the notification fields the IOMMU may be using */
+		memset(vmx->pi_desc.pir, 0, sizeof(vmx->pi_desc.pir));
+		clear_bit(POSTED_INTR_ON,
+			  (unsigned long *)&vmx->pi_desc.control);
+	}
 
 	if (vmx->vpid != 0)
 		vmcs_write16(VIRTUAL_PROCESSOR_ID, vmx->vpid);
@@ -6529,6 +6704,26 @@ static int handle_invept(struct kvm_vcpu *vcpu)
 	return 1;
 }
 
+static int handle_pml_full(struct kvm_vcpu *vcpu)
+{
+	unsigned long exit_qualification;
+
+	exit_qualification = vmcs_readl(EXIT_QUALIFICATION);
+
+	/*
+	 * PML buffer filled up while executing iret from NMI, "blocked by
+	 * NMI" bit has to be set before next VM entry.
+	 */
+	if (!(to_vmx(vcpu)->idt_vectoring_info & VECTORING_INFO_VALID_MASK) &&
+			cpu_has_virtual_nmis() &&
+			(exit_qualification & INTR_INFO_UNBLOCK_NMI))
+		vmcs_set_bits(GUEST_INTERRUPTIBILITY_INFO,
+				GUEST_INTR_STATE_NMI);
+
+	/* The buffer was already drained by vmx_handle_exit(). */
+	return 1;
+}
+
 /*
  * The exit handlers return 1 if the exit was handled fully and guest execution
  * may resume.  Otherwise they set the kvm_run parameter to indicate what needs
@@ -6574,6 +6769,7 @@ static int (*const kvm_vmx_exit_handlers[])(struct kvm_vcpu *vcpu) = {
 	[EXIT_REASON_MWAIT_INSTRUCTION]	      = handle_invalid_op,
 	[EXIT_REASON_MONITOR_INSTRUCTION]     = handle_invalid_op,
 	[EXIT_REASON_INVEPT]                  = handle_invept,
+	[EXIT_REASON_PML_FULL]                = handle_pml_full,
 };
 
 static const int kvm_vmx_max_exit_handlers =
@@ -6874,12 +7070,49 @@ static void vmx_get_exit_info(struct kvm_vcpu *vcpu, u64 *info1, u64 *info2)
  * The guest has exited.  See if we can fix it or if we need userspace
  * assistance.
  */
+/*
+ * Move the GPAs logged since the last exit into the dirty bitmap.  The CPU
+ * fills the buffer from the top down and leaves GUEST_PML_INDEX pointing at
+ * the next free entry, or wrapped past zero when the buffer is full.
+ */
+static void vmx_flush_pml_buffer(struct kvm_vcpu *vcpu)
+{
+	struct vcpu_vmx *vmx = to_vmx(vcpu);
+	u64 *pml_buf;
+	u16 pml_idx;
+
+	pml_idx = vmcs_read16(GUEST_PML_INDEX);
+
+	/* Nothing logged */
+	if (pml_idx == PML_ENTITY_NUM - 1)
+		return;
+
+	if (pml_idx >= PML_ENTITY_NUM)
+		pml_idx = 0;
+	else
+		pml_idx++;
+
+	pml_buf = page_address(vmx->pml_pg);
+	for (; pml_idx < PML_ENTITY_NUM; pml_idx++)
+		mark_page_dirty(vcpu->kvm, pml_buf[pml_idx] >> PAGE_SHIFT);
+
+	vmcs_write16(GUEST_PML_INDEX, PML_ENTITY_NUM - 1);
+}
+
 static int vmx_handle_exit(struct kvm_vcpu *vcpu)
 {
 	struct vcpu_vmx *vmx = to_vmx(vcpu);
 	u32 exit_reason = vmx->exit_reason;
 	u32 vectoring_info = vmx->idt_vectoring_info;
 
+	/*
+	 * Drain the PML buffer on every exit, so that a vcpu outside guest
+	 * mode never holds unreported dirty pages and get_dirty_log only
+	 * needs to kick the vcpus.
+	 */
+	if (enable_pml)
+		vmx_flush_pml_buffer(vcpu);
+
 	/* If guest state is invalid, start emulating */
 	if (vmx->emulation_required)
 		return handle_invalid_guest_state(vcpu);
@@ -7448,6 +7681,8 @@ static void vmx_free_vcpu(struct kvm_vcpu *vcpu)
 	free_vpid(vmx);
 	free_loaded_vmcs(vmx->loaded_vmcs);
 	free_nested(vmx);
+	if (vmx->pml_pg)
+		__free_page(vmx->pml_pg);
 	kfree(vmx->guest_msrs);
 	kvm_vcpu_uninit(vcpu);
 	kmem_cache_free(kvm_vcpu_cache, vmx);
@@ -7464,6 +7699,12 @@ static struct kvm_vcpu *vmx_create_vcpu(struct kvm *kvm, unsigned int id)
 
 	allocate_vpid(vmx);
 
+	/* Notifications stay suppressed until the vcpu is first loaded */
+	vmx->pi_desc.nv = POSTED_INTR_VECTOR;
+	vmx->pi_desc.sn = 1;
+	vmx->pi_pre_pcpu = -1;
+	INIT_LIST_HEAD(&vmx->pi_blocked_list);
+
 	err = kvm_vcpu_init(&vmx->vcpu, kvm, id);
 	if (err)
 		goto free_vcpu;
@@ -7474,10 +7715,16 @@ static struct kvm_vcpu *vmx_create_vcpu(struct kvm *kvm, unsigned int id)
 		goto uninit_vcpu;
 	}
 
+	if (enable_pml) {
+		vmx->pml_pg = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (!vmx->pml_pg)
+			goto free_msrs;
+	}
+
 	vmx->loaded_vmcs = &vmx->vmcs01;
 	vmx->loaded_vmcs->vmcs = alloc_vmcs();
 	if (!vmx->loaded_vmcs->vmcs)
-		goto free_msrs;
+		goto free_pml;
 	if (!vmm_exclusive)
 		kvm_cpu_vmxon(__pa(per_cpu(vmxarea, raw_smp_processor_id())));
 	loaded_vmcs_init(vmx->loaded_vmcs);
@@ -7516,6 +7763,9 @@ static struct kvm_vcpu *vmx_create_vcpu(struct kvm *kvm, unsigned int id)
 
 free_vmcs:
 	free_loaded_vmcs(vmx->loaded_vmcs);
+free_pml:
+	if (vmx->pml_pg)
+		__free_page(vmx->pml_pg);
 free_msrs:
 	kfree(vmx->guest_msrs);
 uninit_vcpu:
@@ -8690,6 +8940,133 @@ static int vmx_check_intercept(struct kvm_vcpu *vcpu,
 	return X86EMUL_CONTINUE;
 }
 
+/*
+ * Dirty logging with PML: small pages stay writable with their dirty bit
+ * clear, so the first write to each one is logged by the CPU.  Large pages
+ * are still write protected so that they get split on the next write.
+ */
+static void vmx_slot_enable_log_dirty(struct kvm *kvm,
+				      struct kvm_memory_slot *slot)
+{
+	kvm_mmu_slot_leaf_clear_dirty(kvm, slot);
+	kvm_mmu_slot_largepage_remove_write_access(kvm, slot);
+}
+
+/*
+ * Each vcpu drains its PML buffer in vmx_handle_exit(), so only the vcpus
+ * currently in guest mode can hold pages not yet in the dirty bitmap.
+ */
+static void vmx_flush_log_dirty(struct kvm *kvm)
+{
+	struct kvm_vcpu *vcpu;
+	int i;
+
+	kvm_for_each_vcpu(i, vcpu, kvm)
+		kvm_vcpu_kick(vcpu);
+}
+
+static void vmx_enable_log_dirty_pt_masked(struct kvm *kvm,
+					   struct kvm_memory_slot *memslot,
+					   gfn_t offset, unsigned long mask)
+{
+	kvm_mmu_clear_dirty_pt_masked(kvm, memslot, offset, mask);
+}
+
+static void vmx_post_block(struct kvm_vcpu *vcpu)
+{
+	struct vcpu_vmx *vmx = to_vmx(vcpu);
+	struct pi_desc *pi_desc = &vmx->pi_desc;
+	struct pi_desc old, new;
+	unsigned long flags;
+	int cpu = vmx->pi_pre_pcpu;
+
+	if (cpu == -1)
+		return;
+
+	local_irq_save(flags);
+
+	do {
+		old.control = new.control = pi_desc->control;
+		new.ndst = pi_ndst(vcpu->cpu);
+		new.nv = POSTED_INTR_VECTOR;
+		new.sn = 0;
+	} while (cmpxchg(&pi_desc->control, old.control,
+			 new.control) != old.control);
+
+	spin_lock(&per_cpu(blocked_vcpu_on_cpu_lock, cpu));
+	list_del(&vmx->pi_blocked_list);
+	spin_unlock(&per_cpu(blocked_vcpu_on_cpu_lock, cpu));
+	vmx->pi_pre_pcpu = -1;
+
+	local_irq_restore(flags);
+}
+
+/*
+ * While the vcpu sleeps, interrupts the IOMMU posts for it notify the
+ * cpu it blocked on with POSTED_INTR_WAKEUP_VECTOR, whose handler kicks
+ * it awake.  Returns 1 if something was posted already, in which case
+ * the vcpu must not block.
+ */
+static int vmx_pre_block(struct kvm_vcpu *vcpu)
+{
+	struct vcpu_vmx *vmx = to_vmx(vcpu);
+	struct pi_desc *pi_desc = &vmx->pi_desc;
+	struct pi_desc old, new;
+	unsigned long flags;
+	int cpu;
+
+	if (!vmx_can_post_irqs(vcpu->kvm) ||
+	    list_empty(&vcpu->kvm->arch.assigned_dev_head))
+		return 0;
+
+	/* The vcpu is loaded, it cannot move with interrupts off */
+	local_irq_save(flags);
+	cpu = vcpu->cpu;
+
+	spin_lock(&per_cpu(blocked_vcpu_on_cpu_lock, cpu));
+	list_add_tail(&vmx->pi_blocked_list,
+		      &per_cpu(blocked_vcpu_on_cpu, cpu));
+	spin_unlock(&per_cpu(blocked_vcpu_on_cpu_lock, cpu));
+	vmx->pi_pre_pcpu = cpu;
+
+	do {
+		old.control = new.control = pi_desc->control;
+		if (old.on)
+			break;
+		new.ndst = pi_ndst(cpu);
+		new.nv = POSTED_INTR_WAKEUP_VECTOR;
+	} while (cmpxchg(&pi_desc->control, old.control,
+			 new.control) != old.control);
+
+	local_irq_restore(flags);
+
+	if (old.on) {
+		/* Undo the above, the vcpu goes straight back in */
+		vmx_post_block(vcpu);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Have the IOMMU post @host_irq as @vector straight into the PI
+ * descriptor of @vcpu, or give it back to the host if @vcpu is NULL.
+ */
+static int vmx_update_pi_irte(unsigned int host_irq, struct kvm_vcpu *vcpu,
+			      u32 vector)
+{
+	struct vcpu_data vcpu_info;
+
+	if (!vcpu)
+		return irq_remapping_set_vcpu_affinity(host_irq, NULL);
+
+	vcpu_info.pi_desc_addr = __pa(&to_vmx(vcpu)->pi_desc);
+	vcpu_info.vector = vector;
+
+	return irq_remapping_set_vcpu_affinity(host_irq, &vcpu_info);
+}
+
 static struct kvm_x86_ops vmx_x86_ops = {
 	.cpu_has_kvm_support = cpu_has_kvm_support,
 	.disabled_by_bios = vmx_disabled_by_bios,
@@ -8795,6 +9172,15 @@ static struct kvm_x86_ops vmx_x86_ops = {
 	.mpx_supported = vmx_mpx_supported,
 
 	.check_nested_events = vmx_check_nested_events,
+
+	.slot_enable_log_dirty = vmx_slot_enable_log_dirty,
+	.flush_log_dirty = vmx_flush_log_dirty,
+	.enable_log_dirty_pt_masked = vmx_enable_log_dirty_pt_masked,
+	.cpu_dirty_log_size = PML_ENTITY_NUM,
+
+	.pre_block = vmx_pre_block,
+	.post_block = vmx_post_block,
+	.update_pi_irte = vmx_update_pi_irte,
 };
 
 static int __init vmx_init(void)
@@ -139,6 +139,8 @@ struct kvm_stats_debugfs_item debugfs_entries[] = {
 	{ "irq_window", VCPU_STAT(irq_window_exits) },
 	{ "nmi_window", VCPU_STAT(nmi_window_exits) },
 	{ "halt_exits", VCPU_STAT(halt_exits) },
+	{ "halt_successful_poll", VCPU_STAT(halt_successful_poll) },
+	{ "halt_attempted_poll", VCPU_STAT(halt_attempted_poll) },
 	{ "halt_wakeup", VCPU_STAT(halt_wakeup) },
 	{ "hypercalls", VCPU_STAT(hypercalls) },
 	{ "request_irq", VCPU_STAT(request_irq_exits) },
@@ -3586,6 +3588,28 @@ static int kvm_vm_ioctl_reinject(struct kvm *kvm,
 	return 0;
 }
 
+/*
+ * Rearm dirty logging for the pages in @mask once they have been reported,
+ * by write protecting them or letting the hardware log them again.  Called
+ * with mmu_lock held, the caller flushes the TLBs.
+ */
+void kvm_arch_mmu_enable_log_dirty_pt_masked(struct kvm *kvm,
+					     struct kvm_memory_slot *slot,
+					     gfn_t gfn_offset,
+					     unsigned long mask)
+{
+	if (kvm_x86_ops->enable_log_dirty_pt_masked)
+		kvm_x86_ops->enable_log_dirty_pt_masked(kvm, slot, gfn_offset,
+							mask);
+	else
+		kvm_mmu_write_protect_pt_masked(kvm, slot, gfn_offset, mask);
+}
+
+int kvm_cpu_dirty_log_size(void)
+{
+	return kvm_x86_ops->cpu_dirty_log_size;
+}
+
 /**
  * kvm_vm_ioctl_get_dirty_log - get and clear the log of dirty pages in a slot
  * @kvm: kvm instance
@@ -3604,6 +3628,10 @@ static int kvm_vm_ioctl_reinject(struct kvm *kvm,
  * entry.  This is not a problem because the page will be reported dirty at
  * step 4 using the snapshot taken before and step 3 ensures that successive
  * writes will be logged for the next call.
+ *
+ * With hardware assisted logging, the hardware log is flushed into the
+ * bitmap first, and step 2 clears the dirty bit of the page instead so that
+ * the hardware logs its next write.
  */
 int kvm_vm_ioctl_get_dirty_log(struct kvm *kvm, struct kvm_dirty_log *log)
 {
@@ -3632,6 +3660,9 @@ int kvm_vm_ioctl_get_dirty_log(struct kvm *kvm, struct kvm_dirty_log *log)
 	dirty_bitmap_buffer = dirty_bitmap + n / sizeof(long);
 	memset(dirty_bitmap_buffer, 0, n);
 
+	if (kvm_x86_ops->flush_log_dirty)
+		kvm_x86_ops->flush_log_dirty(kvm);
+
 	spin_lock(&kvm->mmu_lock);
 
 	for (i = 0; i < n / sizeof(long); i++) {
@@ -3647,7 +3678,8 @@ int kvm_vm_ioctl_get_dirty_log(struct kvm *kvm, struct kvm_dirty_log *log)
 		dirty_bitmap_buffer[i] = mask;
 
 		offset = i * BITS_PER_LONG;
-		kvm_mmu_write_protect_pt_masked(kvm, memslot, offset, mask);
+		kvm_arch_mmu_enable_log_dirty_pt_masked(kvm, memslot, offset,
+							mask);
 	}
 	if (is_dirty)
 		kvm_flush_remote_tlbs(kvm);
@@ -5948,6 +5980,13 @@ static int vcpu_enter_guest(struct kvm_vcpu *vcpu)
 		vcpu->run->request_interrupt_window;
 	bool req_immediate_exit = false;
 
+	/* Let userspace collect the dirty ring before it overflows. */
+	if (unlikely(kvm_dirty_ring_soft_full(&vcpu->dirty_ring))) {
+		vcpu->run->exit_reason = KVM_EXIT_DIRTY_RING_FULL;
+		r = 0;
+		goto out;
+	}
+
 	if (vcpu->requests) {
 		if (kvm_check_request(KVM_REQ_MMU_RELOAD, vcpu))
 			kvm_mmu_unload(vcpu);
@@ -6014,18 +6053,20 @@ static int vcpu_enter_guest(struct kvm_vcpu *vcpu)
 			kvm_x86_ops->enable_irq_window(vcpu);
 
 		if (kvm_lapic_enabled(vcpu)) {
-			/*
-			 * Update architecture specific hints for APIC
-			 * virtual interrupt delivery.
-			 */
-			if (kvm_x86_ops->hwapic_irr_update)
-				kvm_x86_ops->hwapic_irr_update(vcpu,
-					kvm_lapic_find_highest_irr(vcpu));
 			update_cr8_intercept(vcpu);
 			kvm_lapic_sync_to_vapic(vcpu);
 		}
 	}
 
+	/*
+	 * Update architecture specific hints for APIC virtual interrupt
+	 * delivery.  Interrupts posted by the IOMMU do not come with a
+	 * KVM_REQ_EVENT, so this is done on every entry.
+	 */
+	if (kvm_x86_ops->hwapic_irr_update && kvm_lapic_enabled(vcpu))
+		kvm_x86_ops->hwapic_irr_update(vcpu,
+			kvm_lapic_find_highest_irr(vcpu));
+
 	r = kvm_mmu_reload(vcpu);
 	if (unlikely(r)) {
 		goto cancel_injection;
@@ -6167,7 +6208,13 @@ static int __vcpu_run(struct kvm_vcpu *vcpu)
 			r = vcpu_enter_guest(vcpu);
 		else {
 			srcu_read_unlock(&kvm->srcu, vcpu->srcu_idx);
-			kvm_vcpu_block(vcpu);
+			if (!kvm_x86_ops->pre_block ||
+			    !kvm_x86_ops->pre_block(vcpu)) {
+				kvm_vcpu_block(vcpu);
+				if (kvm_x86_ops->post_block)
+					kvm_x86_ops->post_block(vcpu);
+			} else
+				kvm_make_request(KVM_REQ_UNHALT, vcpu);
 			vcpu->srcu_idx = srcu_read_lock(&kvm->srcu);
 			if (kvm_check_request(KVM_REQ_UNHALT, vcpu)) {
 				kvm_apic_accept_events(vcpu);
@@ -7332,12 +7379,30 @@ void kvm_arch_commit_memory_region(struct kvm *kvm,
 	if (nr_mmu_pages)
 		kvm_mmu_change_mmu_pages(kvm, nr_mmu_pages);
 	/*
-	 * Write protect all pages for dirty logging.
-	 * Existing largepage mappings are destroyed here and new ones will
-	 * not be created until the end of the logging.
+	 * Write protect all pages for dirty logging, or let the hardware log
+	 * them when it can.
+	 * Existing largepage mappings are write protected here and split by
+	 * the next write, new ones will not be created until the end of the
+	 * logging.
+	 */
+	if ((change != KVM_MR_DELETE) &&
+	    (mem->flags & KVM_MEM_LOG_DIRTY_PAGES)) {
+		if (kvm_x86_ops->slot_enable_log_dirty)
+			kvm_x86_ops->slot_enable_log_dirty(kvm,
+				id_to_memslot(kvm->memslots, mem->slot));
+		else
+			kvm_mmu_slot_remove_write_access(kvm, mem->slot);
+	}
+
+	/*
+	 * Once logging stops, zap the small mappings it left behind so that
+	 * large pages, up to 1GB with EPT and hugetlbfs, come back.
 	 */
-	if ((change != KVM_MR_DELETE) && (mem->flags & KVM_MEM_LOG_DIRTY_PAGES))
-		kvm_mmu_slot_remove_write_access(kvm, mem->slot);
+	if ((change != KVM_MR_DELETE) &&
+	    (old->flags & KVM_MEM_LOG_DIRTY_PAGES) &&
+	    !(mem->flags & KVM_MEM_LOG_DIRTY_PAGES))
+		kvm_mmu_zap_collapsible_sptes(kvm,
+			id_to_memslot(kvm->memslots, mem->slot));
 }
 
 void kvm_arch_flush_shadow_all(struct kvm *kvm)
@@ -7566,6 +7631,67 @@ bool kvm_arch_has_noncoherent_dma(struct kvm *kvm)
 }
 EXPORT_SYMBOL_GPL(kvm_arch_has_noncoherent_dma);
 
+#ifdef CONFIG_KVM_DEVICE_ASSIGNMENT
+/* The vcpu an MSI route delivers to, if it can only be that one */
+static struct kvm_vcpu *kvm_msi_single_vcpu(struct kvm *kvm,
+					    struct kvm_lapic_irq *irq)
+{
+	struct kvm_vcpu *vcpu, *dest = NULL;
+	int i;
+
+	if (irq->trig_mode || (irq->delivery_mode != APIC_DM_FIXED &&
+			       irq->delivery_mode != APIC_DM_LOWEST))
+		return NULL;
+
+	kvm_for_each_vcpu(i, vcpu, kvm) {
+		if (!kvm_apic_present(vcpu) ||
+		    !kvm_apic_match_dest(vcpu, NULL, irq->shorthand,
+					 irq->dest_id, irq->dest_mode))
+			continue;
+		if (dest)
+			return NULL;
+		dest = vcpu;
+	}
+
+	return dest;
+}
+
+/*
+ * Have the IOMMU post @host_irq straight to the guest if @set and
+ * @guest_irq is a single MSI route to a single vcpu, otherwise let it
+ * go through the host handler again.
+ */
+int kvm_arch_update_pi_irte(struct kvm *kvm, unsigned int host_irq,
+			    u32 guest_irq, bool set)
+{
+	struct kvm_kernel_irq_routing_entry *e;
+	struct kvm_irq_routing_table *irq_rt;
+	struct kvm_vcpu *vcpu = NULL;
+	struct kvm_lapic_irq irq;
+	int n = 0;
+
+	if (!kvm_x86_ops->update_pi_irte || !irqchip_in_kernel(kvm))
+		return 0;
+
+	rcu_read_lock();
+	irq_rt = rcu_dereference(kvm->irq_routing);
+	if (set && guest_irq < irq_rt->nr_rt_entries)
+		hlist_for_each_entry(e, &irq_rt->map[guest_irq], link) {
+			if (e->type != KVM_IRQ_ROUTING_MSI || n++)
+				break;
+			kvm_set_msi_irq(e, &irq);
+			vcpu = kvm_msi_single_vcpu(kvm, &irq);
+		}
+	rcu_read_unlock();
+
+	if (n != 1)
+		vcpu = NULL;
+
+	return kvm_x86_ops->update_pi_irte(host_irq, vcpu,
+					   vcpu ? irq.vector : 0);
+}
+#endif
+
 EXPORT_TRACEPOINT_SYMBOL_GPL(kvm_exit);
 EXPORT_TRACEPOINT_SYMBOL_GPL(kvm_inj_virq);
 EXPORT_TRACEPOINT_SYMBOL_GPL(kvm_page_fault);
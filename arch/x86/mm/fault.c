@@ -355,8 +355,6 @@ void vmalloc_sync_all(void)
  * 64-bit:
  *
  *   Handle a fault on the vmalloc area
- *
- * This assumes no large pages in there.
  */
 static noinline __kprobes int vmalloc_fault(unsigned long address)
 {
@@ -409,6 +407,10 @@ static noinline __kprobes int vmalloc_fault(unsigned long address)
 	if (pmd_none(*pmd) || pmd_page(*pmd) != pmd_page(*pmd_ref))
 		BUG();
 
+	/* huge vmalloc mappings have no pte level to check */
+	if (pmd_large(*pmd))
+		return 0;
+
 	pte_ref = pte_offset_kernel(pmd_ref, address);
 	if (!pte_present(*pte_ref))
 		return -1;
@@ -1134,6 +1136,27 @@ __do_page_fault(struct pt_regs *regs, unsigned long error_code,
 	if (error_code & PF_WRITE)
 		flags |= FAULT_FLAG_WRITE;
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	/*
+	 * Try not-present and write faults from user space without
+	 * mmap_sem first; any fault that needs more than a pte set up
+	 * from the page cache or a fresh anonymous page comes back with
+	 * VM_FAULT_RETRY and is handled below. Protection faults on reads
+	 * always end up in bad_area(), leave them alone.
+	 */
+	if ((error_code & PF_USER) &&
+	    (!(error_code & PF_PROT) || (error_code & PF_WRITE))) {
+		fault = handle_speculative_fault(mm, address, flags);
+		if (!(fault & VM_FAULT_RETRY)) {
+			tsk->min_flt++;
+			perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS_MIN, 1,
+				      regs, address);
+			check_v8086_mode(regs, address, tsk);
+			return;
+		}
+	}
+#endif
+
 	/*
 	 * When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in
@@ -474,3 +474,39 @@ void native_set_fixmap(enum fixed_addresses idx, phys_addr_t phys,
 {
 	__native_set_fixmap(idx, pfn_pte(phys >> PAGE_SHIFT, flags));
 }
+
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+/**
+ * pmd_set_huge - map a PMD_SIZE chunk of RAM with a single kernel pmd
+ * @pmd: the empty pmd to fill in
+ * @addr: physical address of the chunk, PMD_SIZE aligned
+ * @prot: protection of the mapping
+ *
+ * Returns 1 if the huge mapping was set up, 0 if the caller has to map
+ * the chunk with ptes instead.
+ */
+int pmd_set_huge(pmd_t *pmd, phys_addr_t addr, pgprot_t prot)
+{
+	if (!cpu_has_pse)
+		return 0;
+
+	set_pte((pte_t *)pmd, pfn_pte((u64)addr >> PAGE_SHIFT,
+			__pgprot(pgprot_val(prot) | _PAGE_PSE)));
+	return 1;
+}
+
+/**
+ * pmd_clear_huge - clear a kernel pmd if it is a huge mapping
+ * @pmd: the pmd to check
+ *
+ * Returns 1 if @pmd mapped a huge page and has been cleared.
+ */
+int pmd_clear_huge(pmd_t *pmd)
+{
+	if (pmd_large(*pmd)) {
+		pmd_clear(pmd);
+		return 1;
+	}
+	return 0;
+}
+#endif /* CONFIG_HAVE_ARCH_HUGE_VMAP */
@@ -311,9 +311,27 @@ no_merge:
 	return 0;
 }
 
+/*
+ * Check if appending @next after @prev would leave a gap in the SG list,
+ * for queues that have flagged they can't handle that.
+ */
+static bool bio_gap_to_next(struct request_queue *q, struct bio *prev,
+			    struct bio *next)
+{
+	if (!(q->queue_flags & (1 << QUEUE_FLAG_SG_GAPS)))
+		return false;
+	if (!prev->bi_vcnt || !next->bi_vcnt)
+		return false;
+
+	return bvec_gap_to_prev(&prev->bi_io_vec[prev->bi_vcnt - 1],
+				next->bi_io_vec[0].bv_offset);
+}
+
 int ll_back_merge_fn(struct request_queue *q, struct request *req,
 		     struct bio *bio)
 {
+	if (bio_gap_to_next(q, req->biotail, bio))
+		return 0;
 	if (blk_rq_sectors(req) + bio_sectors(bio) >
 	    blk_rq_get_max_sectors(req)) {
 		req->cmd_flags |= REQ_NOMERGE;
@@ -332,6 +350,8 @@ int ll_back_merge_fn(struct request_queue *q, struct request *req,
 int ll_front_merge_fn(struct request_queue *q, struct request *req,
 		      struct bio *bio)
 {
+	if (bio_gap_to_next(q, bio, req->bio))
+		return 0;
 	if (blk_rq_sectors(req) + bio_sectors(bio) >
 	    blk_rq_get_max_sectors(req)) {
 		req->cmd_flags |= REQ_NOMERGE;
@@ -372,6 +392,9 @@ static int ll_merge_requests_fn(struct request_queue *q, struct request *req,
 	if (req_no_special_merge(req) || req_no_special_merge(next))
 		return 0;
 
+	if (bio_gap_to_next(q, req->biotail, next->bio))
+		return 0;
+
 	/*
 	 * Will it become too large?
 	 */
@@ -26,11 +26,47 @@ static int get_first_sibling(unsigned int cpu)
 	return cpu;
 }
 
-int blk_mq_update_queue_map(unsigned int *map, unsigned int nr_queues)
+/*
+ * Map each online cpu to the first queue whose interrupt affinity covers
+ * it.  Returns false, leaving @map alone, if some online cpu isn't
+ * covered by any queue.
+ */
+static bool blk_mq_affinity_queue_map(unsigned int *map,
+				      unsigned int nr_queues,
+				      const struct cpumask *affinity)
+{
+	unsigned int cpu, queue;
+
+	for_each_online_cpu(cpu) {
+		for (queue = 0; queue < nr_queues; queue++)
+			if (cpumask_test_cpu(cpu, &affinity[queue]))
+				break;
+		if (queue == nr_queues)
+			return false;
+	}
+
+	for_each_possible_cpu(cpu) {
+		map[cpu] = 0;
+		if (!cpu_online(cpu))
+			continue;
+		for (queue = 0; queue < nr_queues; queue++)
+			if (cpumask_test_cpu(cpu, &affinity[queue]))
+				break;
+		map[cpu] = queue;
+	}
+
+	return true;
+}
+
+int blk_mq_update_queue_map(unsigned int *map, unsigned int nr_queues,
+			    const struct cpumask *affinity)
 {
 	unsigned int i, nr_cpus, nr_uniq_cpus, queue, first_sibling;
 	cpumask_var_t cpus;
 
+	if (affinity && blk_mq_affinity_queue_map(map, nr_queues, affinity))
+		return 0;
+
 	if (!alloc_cpumask_var(&cpus, GFP_ATOMIC))
 		return 1;
 
@@ -80,17 +116,17 @@ int blk_mq_update_queue_map(unsigned int *map, unsigned int nr_queues)
 	return 0;
 }
 
-unsigned int *blk_mq_make_queue_map(struct blk_mq_reg *reg)
+unsigned int *blk_mq_make_queue_map(struct blk_mq_tag_set *set)
 {
 	unsigned int *map;
 
 	/* If cpus are offline, map them to first hctx */
 	map = kzalloc_node(sizeof(*map) * num_possible_cpus(), GFP_KERNEL,
-				reg->numa_node);
+				set->numa_node);
 	if (!map)
 		return NULL;
 
-	if (!blk_mq_update_queue_map(map, reg->nr_hw_queues))
+	if (!blk_mq_update_queue_map(map, set->nr_hw_queues, set->affinity))
 		return map;
 
 	kfree(map);
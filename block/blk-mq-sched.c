@@ -0,0 +1,218 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/rcupdate.h>
+#include <linux/blktrace_api.h>
+
+#include <trace/events/block.h>
+
+#include <linux/blk-mq.h>
+#include "blk.h"
+#include "blk-mq.h"
+#include "blk-mq-sched.h"
+
+/*
+ * Requests that must not be reordered or held back: anything that isn't
+ * regular fs I/O, and the steps of a flush sequence.
+ */
+static bool blk_mq_sched_bypass(struct request *rq)
+{
+	return rq->cmd_type != REQ_TYPE_FS || (rq->cmd_flags & REQ_FLUSH_SEQ);
+}
+
+/*
+ * Hand requests to the scheduler attached to the queue of @hctx. Head
+ * insertions (requeues and the like) and bypass requests go straight to
+ * the dispatch list, which is always served before the scheduler.
+ */
+void blk_mq_sched_insert_requests(struct blk_mq_hw_ctx *hctx,
+				  struct list_head *list, bool at_head)
+{
+	struct elevator_queue *e = hctx->queue->elevator;
+	struct request *rq, *next;
+	LIST_HEAD(bypass);
+
+	list_for_each_entry_safe(rq, next, list, queuelist) {
+		trace_block_rq_insert(hctx->queue, rq);
+		blk_mq_add_timer(rq);
+
+		if (at_head || blk_mq_sched_bypass(rq))
+			list_move_tail(&rq->queuelist, &bypass);
+	}
+
+	if (!list_empty(&bypass)) {
+		spin_lock(&hctx->lock);
+		if (at_head)
+			list_splice(&bypass, &hctx->dispatch);
+		else
+			list_splice_tail(&bypass, &hctx->dispatch);
+		spin_unlock(&hctx->lock);
+	}
+
+	if (!list_empty(list))
+		e->type->mq_ops.insert_requests(hctx, list);
+}
+
+/*
+ * The hardware queue may be run without any request being held, e.g. when
+ * a driver restarts a stopped queue, so the run side can race with a
+ * scheduler switch. It only looks at the elevator under rcu_read_lock(),
+ * and blk_mq_sched_switch() waits for a grace period before tearing the
+ * old scheduler down.
+ */
+struct request *__blk_mq_sched_dispatch(struct blk_mq_hw_ctx *hctx)
+{
+	struct elevator_queue *e;
+	struct request *rq = NULL;
+
+	rcu_read_lock();
+	e = ACCESS_ONCE(hctx->queue->elevator);
+	if (e)
+		rq = e->type->mq_ops.dispatch_request(hctx);
+	rcu_read_unlock();
+
+	return rq;
+}
+
+bool __blk_mq_sched_has_work(struct blk_mq_hw_ctx *hctx)
+{
+	struct elevator_queue *e;
+	bool ret = false;
+
+	rcu_read_lock();
+	e = ACCESS_ONCE(hctx->queue->elevator);
+	if (e)
+		ret = e->type->mq_ops.has_work(hctx);
+	rcu_read_unlock();
+
+	return ret;
+}
+
+static void blk_mq_sched_exit_hctxs(struct request_queue *q,
+				    struct elevator_queue *e,
+				    unsigned int nr_hctx)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (i == nr_hctx)
+			break;
+		if (e->type->mq_ops.exit_hctx)
+			e->type->mq_ops.exit_hctx(hctx, i);
+		hctx->sched_data = NULL;
+	}
+}
+
+static void blk_mq_sched_detach(struct request_queue *q)
+{
+	struct elevator_queue *e = q->elevator;
+
+	if (e->registered)
+		elv_unregister_queue(q);
+
+	q->elevator = NULL;
+	synchronize_rcu();
+
+	blk_mq_sched_exit_hctxs(q, e, q->nr_hw_queues);
+	elevator_exit(e);
+}
+
+static int blk_mq_sched_attach(struct request_queue *q, struct elevator_type *e)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct elevator_queue *eq;
+	unsigned int i;
+	int ret;
+
+	/* on failure, this drops the module reference for us */
+	eq = elevator_alloc(q, e);
+	if (!eq)
+		return -ENOMEM;
+
+	ret = e->mq_ops.init_sched(q, eq);
+	if (ret)
+		goto err_put;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		ret = e->mq_ops.init_hctx(hctx, eq, i);
+		if (ret) {
+			blk_mq_sched_exit_hctxs(q, eq, i);
+			elevator_exit(eq);
+			return ret;
+		}
+	}
+
+	/* pairs with the ACCESS_ONCE() in the dispatch side */
+	smp_wmb();
+	q->elevator = eq;
+
+	/*
+	 * A queue that isn't registered yet gets its iosched directory from
+	 * blk_register_queue().
+	 */
+	if (blk_queue_init_done(q)) {
+		ret = elv_register_queue(q);
+		if (ret) {
+			blk_mq_sched_detach(q);
+			return ret;
+		}
+	}
+
+	return 0;
+
+err_put:
+	kobject_put(&eq->kobj);
+	return ret;
+}
+
+/**
+ * blk_mq_sched_switch - attach, replace or remove the I/O scheduler
+ * @q:		the blk-mq request queue
+ * @e:		the new scheduler type, or %NULL for none
+ *
+ * Description:
+ *	Freezes @q, so no request is held by the old scheduler, and swaps
+ *	the scheduler while the queue is empty. The caller's module reference
+ *	on @e is handed to the new scheduler. Unlike the legacy elevator
+ *	switch, the old scheduler is torn down before the new one is set
+ *	up, as they would share the per hardware queue scheduler data. If
+ *	setting up @e fails, the queue is left without a scheduler.
+ */
+int blk_mq_sched_switch(struct request_queue *q, struct elevator_type *e)
+{
+	int ret = 0;
+
+	if (!q->elevator && !e)
+		return 0;
+
+	blk_mq_freeze_queue(q);
+
+	if (q->elevator)
+		blk_mq_sched_detach(q);
+	if (e)
+		ret = blk_mq_sched_attach(q, e);
+
+	blk_mq_unfreeze_queue(q);
+
+	if (e && !ret)
+		blk_add_trace_msg(q, "elv switch: %s", e->elevator_name);
+
+	return ret;
+}
+
+/*
+ * Release time teardown, the queue is dead and unregistered by now.
+ */
+void blk_mq_sched_exit(struct request_queue *q)
+{
+	struct elevator_queue *e = q->elevator;
+
+	if (!e)
+		return;
+
+	q->elevator = NULL;
+	blk_mq_sched_exit_hctxs(q, e, q->nr_hw_queues);
+	elevator_exit(e);
+}
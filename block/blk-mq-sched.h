@@ -0,0 +1,49 @@
+#ifndef INT_BLK_MQ_SCHED_H
+#define INT_BLK_MQ_SCHED_H
+
+#include <linux/blk-mq.h>
+
+int blk_mq_sched_switch(struct request_queue *q, struct elevator_type *e);
+void blk_mq_sched_exit(struct request_queue *q);
+
+void blk_mq_sched_insert_requests(struct blk_mq_hw_ctx *hctx,
+				  struct list_head *list, bool at_head);
+struct request *__blk_mq_sched_dispatch(struct blk_mq_hw_ctx *hctx);
+bool __blk_mq_sched_has_work(struct blk_mq_hw_ctx *hctx);
+
+/*
+ * The elevator of a blk-mq queue is only set while an I/O scheduler is
+ * attached to it.
+ */
+static inline bool blk_mq_sched_active(struct request_queue *q)
+{
+	return ACCESS_ONCE(q->elevator) != NULL;
+}
+
+static inline void blk_mq_sched_insert_request(struct blk_mq_hw_ctx *hctx,
+					       struct request *rq,
+					       bool at_head)
+{
+	LIST_HEAD(list);
+
+	list_add(&rq->queuelist, &list);
+	blk_mq_sched_insert_requests(hctx, &list, at_head);
+}
+
+static inline struct request *blk_mq_sched_dispatch(struct blk_mq_hw_ctx *hctx)
+{
+	if (!blk_mq_sched_active(hctx->queue))
+		return NULL;
+
+	return __blk_mq_sched_dispatch(hctx);
+}
+
+static inline bool blk_mq_sched_has_work(struct blk_mq_hw_ctx *hctx)
+{
+	if (!blk_mq_sched_active(hctx->queue))
+		return false;
+
+	return __blk_mq_sched_has_work(hctx);
+}
+
+#endif
@@ -10,6 +10,7 @@
 #include <linux/smp.h>
 
 #include <linux/blk-mq.h>
+#include "blk.h"
 #include "blk-mq.h"
 #include "blk-mq-tag.h"
 
@@ -174,6 +175,13 @@ static ssize_t blk_mq_hw_sysfs_run_show(struct blk_mq_hw_ctx *hctx, char *page)
 	return sprintf(page, "%lu\n", hctx->run);
 }
 
+static ssize_t blk_mq_hw_sysfs_poll_show(struct blk_mq_hw_ctx *hctx, char *page)
+{
+	return sprintf(page, "considered=%lu, invoked=%lu, success=%lu\n",
+		       hctx->poll_considered, hctx->poll_invoked,
+		       hctx->poll_success);
+}
+
 static ssize_t blk_mq_hw_sysfs_dispatched_show(struct blk_mq_hw_ctx *hctx,
 					       char *page)
 {
@@ -244,6 +252,102 @@ static ssize_t blk_mq_hw_sysfs_tags_show(struct blk_mq_hw_ctx *hctx, char *page)
 	return blk_mq_tag_sysfs_show(hctx->tags, page);
 }
 
+static ssize_t blk_mq_hw_sysfs_active_show(struct blk_mq_hw_ctx *hctx, char *page)
+{
+	return sprintf(page, "%u\n", atomic_read(&hctx->nr_active));
+}
+
+static ssize_t blk_mq_hw_sysfs_lat_show(struct blk_mq_hw_ctx *hctx,
+					char *page, int type)
+{
+	char *start_page = page;
+	int i, dir, size, cpu;
+
+	page += sprintf(page, "%8s\t%s\n", "usecs",
+			"read: <=4k <=16k <=64k >64k\twrite: <=4k <=16k <=64k >64k");
+
+	for (i = 0; i < BLK_MQ_LAT_BUCKETS; i++) {
+		page += sprintf(page, "%8lu", i ? 2UL << i : 0UL);
+
+		for (dir = READ; dir <= WRITE; dir++) {
+			*page++ = '\t';
+			for (size = 0; size < BLK_MQ_LAT_SIZES; size++) {
+				unsigned long sum = 0;
+
+				for_each_possible_cpu(cpu) {
+					struct blk_mq_lat_stats *stats;
+
+					stats = per_cpu_ptr(hctx->lat_stats, cpu);
+					sum += stats->bucket[type][dir][size][i];
+				}
+				page += sprintf(page, size ? " %lu" : "%lu",
+						sum);
+			}
+		}
+		*page++ = '\n';
+	}
+
+	return page - start_page;
+}
+
+static ssize_t blk_mq_hw_sysfs_queue_lat_show(struct blk_mq_hw_ctx *hctx,
+					      char *page)
+{
+	return blk_mq_hw_sysfs_lat_show(hctx, page, BLK_MQ_LAT_QUEUE);
+}
+
+static ssize_t blk_mq_hw_sysfs_device_lat_show(struct blk_mq_hw_ctx *hctx,
+					       char *page)
+{
+	return blk_mq_hw_sysfs_lat_show(hctx, page, BLK_MQ_LAT_DEVICE);
+}
+
+struct blk_mq_inflight_data {
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int inflight[2];
+};
+
+static void blk_mq_inflight_iter(void *__data, unsigned long *free_tags)
+{
+	struct blk_mq_inflight_data *data = __data;
+	struct blk_mq_hw_ctx *hctx = data->hctx;
+	struct blk_mq_tags *tags = hctx->tags;
+	unsigned int tag = 0;
+
+	do {
+		struct request *rq;
+
+		tag = find_next_zero_bit(free_tags, tags->nr_tags, tag);
+		if (tag >= tags->nr_tags)
+			break;
+
+		rq = tags->rqs[tag++];
+
+		/* with a shared tag set, the tag may belong to another queue */
+		if (rq->q != hctx->queue)
+			continue;
+		if (test_bit(REQ_ATOM_STARTED, &rq->atomic_flags))
+			data->inflight[rq_data_dir(rq)]++;
+	} while (1);
+}
+
+/*
+ * Requests handed to the driver and not completed yet, reads and writes.
+ * Sampled from the tag map, so nothing is counted in the I/O path.
+ */
+static ssize_t blk_mq_hw_sysfs_inflight_show(struct blk_mq_hw_ctx *hctx,
+					     char *page)
+{
+	struct blk_mq_inflight_data data = {
+		.hctx		= hctx,
+	};
+
+	blk_mq_tag_busy_iter(hctx->tags, blk_mq_inflight_iter, &data);
+
+	return sprintf(page, "%u %u\n", data.inflight[READ],
+				data.inflight[WRITE]);
+}
+
 static ssize_t blk_mq_hw_sysfs_cpus_show(struct blk_mq_hw_ctx *hctx, char *page)
 {
 	unsigned int i, queue_num, first = 1;
@@ -307,6 +411,10 @@ static struct blk_mq_hw_ctx_sysfs_entry blk_mq_hw_sysfs_dispatched = {
 	.attr = {.name = "dispatched", .mode = S_IRUGO },
 	.show = blk_mq_hw_sysfs_dispatched_show,
 };
+static struct blk_mq_hw_ctx_sysfs_entry blk_mq_hw_sysfs_poll = {
+	.attr = {.name = "io_poll", .mode = S_IRUGO },
+	.show = blk_mq_hw_sysfs_poll_show,
+};
 static struct blk_mq_hw_ctx_sysfs_entry blk_mq_hw_sysfs_pending = {
 	.attr = {.name = "pending", .mode = S_IRUGO },
 	.show = blk_mq_hw_sysfs_rq_list_show,
@@ -320,6 +428,22 @@ static struct blk_mq_hw_ctx_sysfs_entry blk_mq_hw_sysfs_tags = {
 	.attr = {.name = "tags", .mode = S_IRUGO },
 	.show = blk_mq_hw_sysfs_tags_show,
 };
+static struct blk_mq_hw_ctx_sysfs_entry blk_mq_hw_sysfs_active = {
+	.attr = {.name = "active", .mode = S_IRUGO },
+	.show = blk_mq_hw_sysfs_active_show,
+};
+static struct blk_mq_hw_ctx_sysfs_entry blk_mq_hw_sysfs_queue_lat = {
+	.attr = {.name = "queue_latency", .mode = S_IRUGO },
+	.show = blk_mq_hw_sysfs_queue_lat_show,
+};
+static struct blk_mq_hw_ctx_sysfs_entry blk_mq_hw_sysfs_device_lat = {
+	.attr = {.name = "device_latency", .mode = S_IRUGO },
+	.show = blk_mq_hw_sysfs_device_lat_show,
+};
+static struct blk_mq_hw_ctx_sysfs_entry blk_mq_hw_sysfs_inflight = {
+	.attr = {.name = "inflight", .mode = S_IRUGO },
+	.show = blk_mq_hw_sysfs_inflight_show,
+};
 static struct blk_mq_hw_ctx_sysfs_entry blk_mq_hw_sysfs_cpus = {
 	.attr = {.name = "cpu_list", .mode = S_IRUGO },
 	.show = blk_mq_hw_sysfs_cpus_show,
@@ -332,7 +456,12 @@ static struct attribute *default_hw_ctx_attrs[] = {
 	&blk_mq_hw_sysfs_pending.attr,
 	&blk_mq_hw_sysfs_ipi.attr,
 	&blk_mq_hw_sysfs_tags.attr,
+	&blk_mq_hw_sysfs_active.attr,
 	&blk_mq_hw_sysfs_cpus.attr,
+	&blk_mq_hw_sysfs_poll.attr,
+	&blk_mq_hw_sysfs_queue_lat.attr,
+	&blk_mq_hw_sysfs_device_lat.attr,
+	&blk_mq_hw_sysfs_inflight.attr,
 	NULL,
 };
 
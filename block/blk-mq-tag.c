@@ -1,43 +1,100 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
-#include <linux/percpu_ida.h>
+#include <linux/sbitmap.h>
 
 #include <linux/blk-mq.h>
 #include "blk.h"
 #include "blk-mq.h"
 #include "blk-mq-tag.h"
 
+bool blk_mq_has_free_tags(struct blk_mq_tags *tags)
+{
+	return !tags || sbitmap_queue_free_tags(&tags->free_tags) != 0;
+}
+
 /*
- * Per tagged queue (tag address space) map
+ * If a previously inactive queue goes active, bump the active user count.
  */
-struct blk_mq_tags {
-	unsigned int nr_tags;
-	unsigned int nr_reserved_tags;
-	unsigned int nr_batch_move;
-	unsigned int nr_max_cache;
-
-	struct percpu_ida free_tags;
-	struct percpu_ida reserved_tags;
-};
+void __blk_mq_tag_busy(struct blk_mq_hw_ctx *hctx)
+{
+	if (!test_bit(BLK_MQ_S_TAG_ACTIVE, &hctx->state) &&
+	    !test_and_set_bit(BLK_MQ_S_TAG_ACTIVE, &hctx->state))
+		atomic_inc(&hctx->tags->active_queues);
+}
 
-void blk_mq_wait_for_tags(struct blk_mq_tags *tags)
+/*
+ * If a previously busy queue goes inactive, potential waiters could now
+ * be allowed to queue. Wake them up and check.
+ */
+void __blk_mq_tag_idle(struct blk_mq_hw_ctx *hctx)
 {
-	int tag = blk_mq_get_tag(tags, __GFP_WAIT, false);
-	blk_mq_put_tag(tags, tag);
+	struct blk_mq_tags *tags = hctx->tags;
+
+	if (!test_and_clear_bit(BLK_MQ_S_TAG_ACTIVE, &hctx->state))
+		return;
+
+	atomic_dec(&tags->active_queues);
+
+	smp_mb__after_atomic_dec();
+	if (waitqueue_active(&tags->wait))
+		wake_up_all(&tags->wait);
 }
 
-bool blk_mq_has_free_tags(struct blk_mq_tags *tags)
+/*
+ * For shared tag users, we track the number of currently active users
+ * and attempt to provide a fair share of the tag depth for each of them.
+ */
+static inline bool hctx_may_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct blk_mq_tags *tags = hctx->tags;
+	unsigned int depth, users;
+
+	if (!(hctx->flags & BLK_MQ_F_TAG_SHARED))
+		return true;
+	if (!test_bit(BLK_MQ_S_TAG_ACTIVE, &hctx->state))
+		return true;
+
+	/*
+	 * Don't try dividing an ant
+	 */
+	depth = tags->nr_tags - tags->nr_reserved_tags;
+	if (depth == 1)
+		return true;
+
+	users = atomic_read(&tags->active_queues);
+	if (!users)
+		return true;
+
+	/*
+	 * Allow at least some tags
+	 */
+	depth = max((depth + users - 1) / users, 4U);
+	return atomic_read(&hctx->nr_active) < depth;
+}
+
+void blk_mq_wait_for_tags(struct blk_mq_hw_ctx *hctx, bool reserved)
 {
-	return !tags ||
-		percpu_ida_free_tags(&tags->free_tags, nr_cpu_ids) != 0;
+	int tag;
+
+	/*
+	 * A queue that has used up its share of a shared tag map waits for
+	 * one of its own requests to complete, or for another user to go
+	 * idle, even if the tag map itself still has free tags.
+	 */
+	if (!reserved && !hctx_may_queue(hctx))
+		wait_event(hctx->tags->wait, hctx_may_queue(hctx));
+
+	tag = blk_mq_get_tag(hctx, __GFP_WAIT, reserved);
+	if (tag != BLK_MQ_TAG_FAIL)
+		blk_mq_put_tag(hctx, tag);
 }
 
 static unsigned int __blk_mq_get_tag(struct blk_mq_tags *tags, gfp_t gfp)
 {
 	int tag;
 
-	tag = percpu_ida_alloc(&tags->free_tags, (gfp & __GFP_WAIT) ?
-			       TASK_UNINTERRUPTIBLE : TASK_RUNNING);
+	tag = sbitmap_queue_get(&tags->free_tags, (gfp & __GFP_WAIT) ?
+				TASK_UNINTERRUPTIBLE : TASK_RUNNING);
 	if (tag < 0)
 		return BLK_MQ_TAG_FAIL;
 	return tag + tags->nr_reserved_tags;
@@ -53,26 +110,30 @@ static unsigned int __blk_mq_get_reserved_tag(struct blk_mq_tags *tags,
 		return BLK_MQ_TAG_FAIL;
 	}
 
-	tag = percpu_ida_alloc(&tags->reserved_tags, (gfp & __GFP_WAIT) ?
-			       TASK_UNINTERRUPTIBLE : TASK_RUNNING);
+	tag = sbitmap_queue_get(&tags->reserved_tags, (gfp & __GFP_WAIT) ?
+				TASK_UNINTERRUPTIBLE : TASK_RUNNING);
 	if (tag < 0)
 		return BLK_MQ_TAG_FAIL;
 	return tag;
 }
 
-unsigned int blk_mq_get_tag(struct blk_mq_tags *tags, gfp_t gfp, bool reserved)
+unsigned int blk_mq_get_tag(struct blk_mq_hw_ctx *hctx, gfp_t gfp,
+			    bool reserved)
 {
-	if (!reserved)
-		return __blk_mq_get_tag(tags, gfp);
+	if (!reserved) {
+		if (!hctx_may_queue(hctx))
+			return BLK_MQ_TAG_FAIL;
+		return __blk_mq_get_tag(hctx->tags, gfp);
+	}
 
-	return __blk_mq_get_reserved_tag(tags, gfp);
+	return __blk_mq_get_reserved_tag(hctx->tags, gfp);
 }
 
 static void __blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
 {
 	BUG_ON(tag >= tags->nr_tags);
 
-	percpu_ida_free(&tags->free_tags, tag - tags->nr_reserved_tags);
+	sbitmap_queue_clear(&tags->free_tags, tag - tags->nr_reserved_tags);
 }
 
 static void __blk_mq_put_reserved_tag(struct blk_mq_tags *tags,
@@ -80,48 +141,66 @@ static void __blk_mq_put_reserved_tag(struct blk_mq_tags *tags,
 {
 	BUG_ON(tag >= tags->nr_reserved_tags);
 
-	percpu_ida_free(&tags->reserved_tags, tag);
+	sbitmap_queue_clear(&tags->reserved_tags, tag);
 }
 
-void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+void blk_mq_put_tag(struct blk_mq_hw_ctx *hctx, unsigned int tag)
 {
+	struct blk_mq_tags *tags = hctx->tags;
+
 	if (tag >= tags->nr_reserved_tags)
 		__blk_mq_put_tag(tags, tag);
 	else
 		__blk_mq_put_reserved_tag(tags, tag);
+
+	/*
+	 * Waiters for a fair share of a shared map are not covered by the
+	 * tag map wakeups, so kick them here.
+	 */
+	if (hctx->flags & BLK_MQ_F_TAG_SHARED) {
+		smp_mb();
+		if (waitqueue_active(&tags->wait))
+			wake_up_all(&tags->wait);
+	}
 }
 
-static int __blk_mq_tag_iter(unsigned id, void *data)
+struct blk_mq_tag_iter_data {
+	unsigned long *tag_map;
+	unsigned int offset;
+};
+
+static int __blk_mq_tag_iter(unsigned int id, void *data)
 {
-	unsigned long *tag_map = data;
-	__set_bit(id, tag_map);
+	struct blk_mq_tag_iter_data *iter = data;
+
+	__set_bit(iter->offset + id, iter->tag_map);
 	return 0;
 }
 
 void blk_mq_tag_busy_iter(struct blk_mq_tags *tags,
 			  void (*fn)(void *, unsigned long *), void *data)
 {
-	unsigned long *tag_map;
+	struct blk_mq_tag_iter_data iter;
 	size_t map_size;
 
 	map_size = ALIGN(tags->nr_tags, BITS_PER_LONG) / BITS_PER_LONG;
-	tag_map = kzalloc(map_size * sizeof(unsigned long), GFP_ATOMIC);
-	if (!tag_map)
+	iter.tag_map = kzalloc(map_size * sizeof(unsigned long), GFP_ATOMIC);
+	if (!iter.tag_map)
 		return;
 
-	percpu_ida_for_each_free(&tags->free_tags, __blk_mq_tag_iter, tag_map);
-	if (tags->nr_reserved_tags)
-		percpu_ida_for_each_free(&tags->reserved_tags, __blk_mq_tag_iter,
-			tag_map);
+	iter.offset = tags->nr_reserved_tags;
+	sbitmap_for_each_free(&tags->free_tags.sb, __blk_mq_tag_iter, &iter);
+	iter.offset = 0;
+	sbitmap_for_each_free(&tags->reserved_tags.sb, __blk_mq_tag_iter,
+			      &iter);
 
-	fn(data, tag_map);
-	kfree(tag_map);
+	fn(data, iter.tag_map);
+	kfree(iter.tag_map);
 }
 
 struct blk_mq_tags *blk_mq_init_tags(unsigned int total_tags,
 				     unsigned int reserved_tags, int node)
 {
-	unsigned int nr_tags, nr_cache;
 	struct blk_mq_tags *tags;
 	int ret;
 
@@ -134,41 +213,26 @@ struct blk_mq_tags *blk_mq_init_tags(unsigned int total_tags,
 	if (!tags)
 		return NULL;
 
-	nr_tags = total_tags - reserved_tags;
-	nr_cache = nr_tags / num_possible_cpus();
-
-	if (nr_cache < BLK_MQ_TAG_CACHE_MIN)
-		nr_cache = BLK_MQ_TAG_CACHE_MIN;
-	else if (nr_cache > BLK_MQ_TAG_CACHE_MAX)
-		nr_cache = BLK_MQ_TAG_CACHE_MAX;
-
 	tags->nr_tags = total_tags;
 	tags->nr_reserved_tags = reserved_tags;
-	tags->nr_max_cache = nr_cache;
-	tags->nr_batch_move = max(1u, nr_cache / 2);
+	atomic_set(&tags->active_queues, 0);
+	init_waitqueue_head(&tags->wait);
+	INIT_LIST_HEAD(&tags->page_list);
 
-	ret = __percpu_ida_init(&tags->free_tags, tags->nr_tags -
-				tags->nr_reserved_tags,
-				tags->nr_max_cache,
-				tags->nr_batch_move);
+	ret = sbitmap_queue_init_node(&tags->free_tags, tags->nr_tags -
+				      tags->nr_reserved_tags, node);
 	if (ret)
 		goto err_free_tags;
 
-	if (reserved_tags) {
-		/*
-		 * With max_cahe and batch set to 1, the allocator fallbacks to
-		 * no cached. It's fine reserved tags allocation is slow.
-		 */
-		ret = __percpu_ida_init(&tags->reserved_tags, reserved_tags,
-				1, 1);
-		if (ret)
-			goto err_reserved_tags;
-	}
+	ret = sbitmap_queue_init_node(&tags->reserved_tags, reserved_tags,
+				      node);
+	if (ret)
+		goto err_reserved_tags;
 
 	return tags;
 
 err_reserved_tags:
-	percpu_ida_destroy(&tags->free_tags);
+	sbitmap_queue_free(&tags->free_tags);
 err_free_tags:
 	kfree(tags);
 	return NULL;
@@ -176,31 +240,28 @@ err_free_tags:
 
 void blk_mq_free_tags(struct blk_mq_tags *tags)
 {
-	percpu_ida_destroy(&tags->free_tags);
-	percpu_ida_destroy(&tags->reserved_tags);
+	sbitmap_queue_free(&tags->free_tags);
+	sbitmap_queue_free(&tags->reserved_tags);
 	kfree(tags);
 }
 
 ssize_t blk_mq_tag_sysfs_show(struct blk_mq_tags *tags, char *page)
 {
 	char *orig_page = page;
-	unsigned int cpu;
 
 	if (!tags)
 		return 0;
 
-	page += sprintf(page, "nr_tags=%u, reserved_tags=%u, batch_move=%u,"
-			" max_cache=%u\n", tags->nr_tags, tags->nr_reserved_tags,
-			tags->nr_batch_move, tags->nr_max_cache);
+	page += sprintf(page, "nr_tags=%u, reserved_tags=%u, bits_per_word=%u,"
+			" wake_batch=%u\n", tags->nr_tags, tags->nr_reserved_tags,
+			1U << tags->free_tags.sb.shift,
+			tags->free_tags.wake_batch);
 
 	page += sprintf(page, "nr_free=%u, nr_reserved=%u\n",
-			percpu_ida_free_tags(&tags->free_tags, nr_cpu_ids),
-			percpu_ida_free_tags(&tags->reserved_tags, nr_cpu_ids));
-
-	for_each_possible_cpu(cpu) {
-		page += sprintf(page, "  cpu%02u: nr_free=%u\n", cpu,
-				percpu_ida_free_tags(&tags->free_tags, cpu));
-	}
+			sbitmap_queue_free_tags(&tags->free_tags),
+			sbitmap_queue_free_tags(&tags->reserved_tags));
+	page += sprintf(page, "active_queues=%u\n",
+			atomic_read(&tags->active_queues));
 
 	return page - orig_page;
 }
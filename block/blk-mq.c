@@ -14,6 +14,7 @@
 #include <linux/cache.h>
 #include <linux/sched/sysctl.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
 
 #include <trace/events/block.h>
 
@@ -21,6 +22,7 @@
 #include "blk.h"
 #include "blk-mq.h"
 #include "blk-mq-tag.h"
+#include "blk-mq-sched.h"
 
 static DEFINE_MUTEX(all_q_mutex);
 static LIST_HEAD(all_q_list);
@@ -79,11 +81,16 @@ static struct request *__blk_mq_alloc_request(struct blk_mq_hw_ctx *hctx,
 	struct request *rq;
 	unsigned int tag;
 
-	tag = blk_mq_get_tag(hctx->tags, gfp, reserved);
+	blk_mq_tag_busy(hctx);
+
+	tag = blk_mq_get_tag(hctx, gfp, reserved);
 	if (tag != BLK_MQ_TAG_FAIL) {
-		rq = hctx->rqs[tag];
+		rq = hctx->tags->rqs[tag];
 		rq->tag = tag;
 
+		if (hctx->flags & BLK_MQ_F_TAG_SHARED)
+			atomic_inc(&hctx->nr_active);
+
 		return rq;
 	}
 
@@ -141,7 +148,7 @@ static void __blk_mq_drain_queue(struct request_queue *q)
  * Guarantee no request is in use, so we can change any data structure of
  * the queue afterward.
  */
-static void blk_mq_freeze_queue(struct request_queue *q)
+void blk_mq_freeze_queue(struct request_queue *q)
 {
 	bool drain;
 
@@ -153,13 +160,14 @@ static void blk_mq_freeze_queue(struct request_queue *q)
 	if (drain)
 		__blk_mq_drain_queue(q);
 }
+EXPORT_SYMBOL_GPL(blk_mq_freeze_queue);
 
 void blk_mq_drain_queue(struct request_queue *q)
 {
 	__blk_mq_drain_queue(q);
 }
 
-static void blk_mq_unfreeze_queue(struct request_queue *q)
+void blk_mq_unfreeze_queue(struct request_queue *q)
 {
 	bool wake = false;
 
@@ -173,6 +181,7 @@ static void blk_mq_unfreeze_queue(struct request_queue *q)
 	if (wake)
 		wake_up_all(&q->mq_freeze_wq);
 }
+EXPORT_SYMBOL_GPL(blk_mq_unfreeze_queue);
 
 bool blk_mq_can_queue(struct blk_mq_hw_ctx *hctx)
 {
@@ -186,10 +195,13 @@ static void blk_mq_rq_ctx_init(struct request_queue *q, struct blk_mq_ctx *ctx,
 	if (blk_queue_io_stat(q))
 		rw_flags |= REQ_IO_STAT;
 
+	/* requests of a shared tag set are handed between queues */
+	rq->q = q;
 	rq->mq_ctx = ctx;
 	rq->cmd_flags = rw_flags;
 	rq->start_time = jiffies;
 	set_start_time_ns(rq);
+	rq->mq_stamp_ns = ktime_to_ns(ktime_get());
 	ctx->rq_dispatched[rw_is_sync(rw_flags)]++;
 }
 
@@ -214,7 +226,7 @@ static struct request *blk_mq_alloc_request_pinned(struct request_queue *q,
 			break;
 
 		__blk_mq_run_hw_queue(hctx);
-		blk_mq_wait_for_tags(hctx->tags);
+		blk_mq_wait_for_tags(hctx, reserved);
 	} while (1);
 
 	return rq;
@@ -265,8 +277,11 @@ static void __blk_mq_free_request(struct blk_mq_hw_ctx *hctx,
 	const int tag = rq->tag;
 	struct request_queue *q = rq->q;
 
+	if (hctx->flags & BLK_MQ_F_TAG_SHARED)
+		atomic_dec(&hctx->nr_active);
+
 	blk_mq_rq_init(hctx, rq);
-	blk_mq_put_tag(hctx->tags, tag);
+	blk_mq_put_tag(hctx, tag);
 
 	blk_mq_queue_exit(q);
 }
@@ -283,21 +298,69 @@ void blk_mq_free_request(struct request *rq)
 	__blk_mq_free_request(hctx, ctx, rq);
 }
 
-bool blk_mq_end_io_partial(struct request *rq, int error, unsigned int nr_bytes)
+/*
+ * Finish a request whose bytes have all been completed already, e.g. by
+ * the driver calling blk_update_request() itself.
+ */
+void __blk_mq_end_io(struct request *rq, int error)
 {
-	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
-		return true;
-
 	blk_account_io_done(rq);
 
 	if (rq->end_io)
 		rq->end_io(rq, error);
 	else
 		blk_mq_free_request(rq);
+}
+EXPORT_SYMBOL(__blk_mq_end_io);
+
+bool blk_mq_end_io_partial(struct request *rq, int error, unsigned int nr_bytes)
+{
+	if (blk_update_request(rq, error, nr_bytes))
+		return true;
+
+	__blk_mq_end_io(rq, error);
 	return false;
 }
 EXPORT_SYMBOL(blk_mq_end_io_partial);
 
+static unsigned int blk_mq_lat_size(struct request *rq)
+{
+	unsigned int bytes = blk_rq_bytes(rq);
+
+	if (bytes <= 4096)
+		return 0;
+	if (bytes <= 16384)
+		return 1;
+	if (bytes <= 65536)
+		return 2;
+	return 3;
+}
+
+/*
+ * Account the time since the request was last stamped in the latency
+ * histogram @type of @hctx, and stamp it again. Requests that never got
+ * a queue time stamp, like the flush request, only count once issued.
+ */
+static void blk_mq_account_latency(struct blk_mq_hw_ctx *hctx,
+				   struct request *rq, int type)
+{
+	u64 now = ktime_to_ns(ktime_get());
+
+	if (rq->mq_stamp_ns) {
+		u64 usecs = div_u64(now - rq->mq_stamp_ns, NSEC_PER_USEC);
+		int bucket = 0;
+
+		if (usecs >= 4)
+			bucket = min_t(int, ilog2(usecs) - 1,
+				       BLK_MQ_LAT_BUCKETS - 1);
+
+		this_cpu_inc(hctx->lat_stats->bucket[type][rq_data_dir(rq)]
+				[blk_mq_lat_size(rq)][bucket]);
+	}
+
+	rq->mq_stamp_ns = now;
+}
+
 static void __blk_mq_complete_request_remote(void *data)
 {
 	struct request *rq = data;
@@ -308,8 +371,12 @@ static void __blk_mq_complete_request_remote(void *data)
 void __blk_mq_complete_request(struct request *rq)
 {
 	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct request_queue *q = rq->q;
 	int cpu;
 
+	blk_mq_account_latency(q->mq_ops->map_queue(q, ctx->cpu), rq,
+			       BLK_MQ_LAT_DEVICE);
+
 	if (!ctx->ipi_redirect) {
 		rq->q->softirq_done_fn(rq);
 		return;
@@ -344,18 +411,20 @@ void blk_mq_complete_request(struct request *rq)
 }
 EXPORT_SYMBOL(blk_mq_complete_request);
 
-static void blk_mq_start_request(struct request *rq, bool last)
+static void blk_mq_start_request(struct blk_mq_hw_ctx *hctx,
+				 struct request *rq, bool last)
 {
 	struct request_queue *q = rq->q;
 
 	trace_block_rq_issue(q, rq);
+	blk_mq_account_latency(hctx, rq, BLK_MQ_LAT_QUEUE);
 
 	/*
 	 * Just mark start time and set the started bit. Due to memory
 	 * ordering, we know we'll see the correct deadline as long as
 	 * REQ_ATOMIC_STARTED is seen.
 	 */
-	rq->deadline = jiffies + q->rq_timeout;
+	rq->deadline = jiffies + (rq->timeout ? rq->timeout : q->rq_timeout);
 	set_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
 
 	if (q->dma_drain_size && blk_rq_bytes(rq)) {
@@ -378,7 +447,7 @@ static void blk_mq_start_request(struct request *rq, bool last)
 		rq->cmd_flags |= REQ_END;
 }
 
-static void blk_mq_requeue_request(struct request *rq)
+static void __blk_mq_requeue_request(struct request *rq)
 {
 	struct request_queue *q = rq->q;
 
@@ -391,6 +460,37 @@ static void blk_mq_requeue_request(struct request *rq)
 		rq->nr_phys_segments--;
 }
 
+static void blk_mq_requeue_work(struct work_struct *work)
+{
+	struct request *rq;
+
+	rq = container_of(work, struct request, mq_flush_work);
+
+	memset(&rq->csd, 0, sizeof(rq->csd));
+	blk_mq_insert_request(rq, true, true, false);
+}
+
+/**
+ * blk_mq_requeue_request - put a started request back on its software queue
+ * @rq:		the request being requeued
+ *
+ * Description:
+ *	For drivers that fail a request in a retryable way after it has
+ *	been handed to them. The software queue lock isn't irq safe, so the
+ *	actual insertion is punted to kblockd, the same way flush sequencing
+ *	does it. Safe to call from interrupt context with driver locks held.
+ **/
+void blk_mq_requeue_request(struct request *rq)
+{
+	__blk_mq_requeue_request(rq);
+	blk_clear_rq_complete(rq);
+
+	BUG_ON(blk_queued_rq(rq));
+	INIT_WORK(&rq->mq_flush_work, blk_mq_requeue_work);
+	kblockd_schedule_work(rq->q, &rq->mq_flush_work);
+}
+EXPORT_SYMBOL(blk_mq_requeue_request);
+
 struct blk_mq_timeout_data {
 	struct blk_mq_hw_ctx *hctx;
 	unsigned long *next;
@@ -401,6 +501,7 @@ static void blk_mq_timeout_check(void *__data, unsigned long *free_tags)
 {
 	struct blk_mq_timeout_data *data = __data;
 	struct blk_mq_hw_ctx *hctx = data->hctx;
+	struct blk_mq_tags *tags = hctx->tags;
 	unsigned int tag;
 
 	 /* It may not be in flight yet (this is where
@@ -412,12 +513,15 @@ static void blk_mq_timeout_check(void *__data, unsigned long *free_tags)
 	do {
 		struct request *rq;
 
-		tag = find_next_zero_bit(free_tags, hctx->queue_depth, tag);
-		if (tag >= hctx->queue_depth)
+		tag = find_next_zero_bit(free_tags, tags->nr_tags, tag);
+		if (tag >= tags->nr_tags)
 			break;
 
-		rq = hctx->rqs[tag++];
+		rq = tags->rqs[tag++];
 
+		/* with a shared tag set, the tag may belong to another queue */
+		if (rq->q != hctx->queue)
+			continue;
 		if (!test_bit(REQ_ATOM_STARTED, &rq->atomic_flags))
 			continue;
 
@@ -454,6 +558,14 @@ static void blk_mq_rq_timer(unsigned long data)
 
 	if (next_set)
 		mod_timer(&q->timeout, round_jiffies_up(next));
+	else {
+		/*
+		 * Nothing is in flight, so stop counting this queue towards
+		 * the fair share of a shared tag set.
+		 */
+		queue_for_each_hw_ctx(q, hctx, i)
+			blk_mq_tag_idle(hctx);
+	}
 }
 
 /*
@@ -549,15 +661,24 @@ static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
 	queued = 0;
 
 	/*
-	 * Now process all the entries, sending them to the driver.
+	 * Now process all the entries, sending them to the driver. Once
+	 * those are gone, keep pulling from the I/O scheduler, if any.
 	 */
-	while (!list_empty(&rq_list)) {
+	while (1) {
 		int ret;
 
-		rq = list_first_entry(&rq_list, struct request, queuelist);
-		list_del_init(&rq->queuelist);
+		if (!list_empty(&rq_list)) {
+			rq = list_first_entry(&rq_list, struct request,
+						queuelist);
+			list_del_init(&rq->queuelist);
+		} else {
+			rq = blk_mq_sched_dispatch(hctx);
+			if (!rq)
+				break;
+		}
 
-		blk_mq_start_request(rq, list_empty(&rq_list));
+		blk_mq_start_request(hctx, rq, list_empty(&rq_list) &&
+					 !blk_mq_sched_has_work(hctx));
 
 		ret = q->mq_ops->queue_rq(hctx, rq);
 		switch (ret) {
@@ -571,7 +692,7 @@ static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
 			 * time
 			 */
 			list_add(&rq->queuelist, &rq_list);
-			blk_mq_requeue_request(rq);
+			__blk_mq_requeue_request(rq);
 			break;
 		default:
 			pr_err("blk-mq: bad return on queue: %d\n", ret);
@@ -622,7 +743,8 @@ void blk_mq_run_queues(struct request_queue *q, bool async)
 
 	queue_for_each_hw_ctx(q, hctx, i) {
 		if ((!blk_mq_hctx_has_pending(hctx) &&
-		    list_empty_careful(&hctx->dispatch)) ||
+		    list_empty_careful(&hctx->dispatch) &&
+		    !blk_mq_sched_has_work(hctx)) ||
 		    test_bit(BLK_MQ_S_STOPPED, &hctx->state))
 			continue;
 
@@ -631,6 +753,58 @@ void blk_mq_run_queues(struct request_queue *q, bool async)
 }
 EXPORT_SYMBOL(blk_mq_run_queues);
 
+/**
+ * blk_poll - spin for completions on the current cpu's hardware queue
+ * @q:		the request queue to poll
+ *
+ * Description:
+ *   Called by a task that has submitted IO and set itself to a sleeping
+ *   state, instead of going straight to io_schedule(). If the driver
+ *   supports polling and polling is enabled on @q, reap completions on the
+ *   hardware queue mapped to this cpu until the waiting task is woken, a
+ *   reschedule is needed or a signal is pending. Returns %true if the task
+ *   was woken by a polled completion (and is now %TASK_RUNNING), %false if
+ *   the caller should go to sleep as usual.
+ */
+bool blk_poll(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	long state;
+
+	if (!q->mq_ops || !q->mq_ops->poll || !blk_queue_poll(q))
+		return false;
+
+	hctx = q->mq_ops->map_queue(q, get_cpu());
+	put_cpu();
+	hctx->poll_considered++;
+
+	state = current->state;
+	while (!need_resched()) {
+		int ret;
+
+		hctx->poll_invoked++;
+
+		ret = q->mq_ops->poll(hctx);
+		if (ret > 0) {
+			hctx->poll_success++;
+			set_current_state(TASK_RUNNING);
+			return true;
+		}
+
+		if (signal_pending_state(state, current))
+			set_current_state(TASK_RUNNING);
+
+		if (current->state == TASK_RUNNING)
+			return true;
+		if (ret < 0)
+			break;
+		cpu_relax();
+	}
+
+	return false;
+}
+EXPORT_SYMBOL_GPL(blk_poll);
+
 void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
 {
 	cancel_delayed_work(&hctx->delayed_work);
@@ -678,6 +852,33 @@ static void blk_mq_work_fn(struct work_struct *work)
 	__blk_mq_run_hw_queue(hctx);
 }
 
+static void blk_mq_delay_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = container_of(work, struct blk_mq_hw_ctx, delay_work.work);
+
+	if (test_and_clear_bit(BLK_MQ_S_STOPPED, &hctx->state))
+		__blk_mq_run_hw_queue(hctx);
+}
+
+/**
+ * blk_mq_delay_queue - restart a stopped hardware queue after a delay
+ * @hctx:	the hardware queue, stopped by the driver
+ * @msecs:	delay in milliseconds
+ *
+ * Description:
+ *	The blk-mq counterpart of blk_delay_queue(), for drivers that had to
+ *	return BLK_MQ_RQ_QUEUE_BUSY without any I/O in flight whose
+ *	completion would restart the queue.
+ **/
+void blk_mq_delay_queue(struct blk_mq_hw_ctx *hctx, unsigned long msecs)
+{
+	kblockd_schedule_delayed_work(hctx->queue, &hctx->delay_work,
+				      msecs_to_jiffies(msecs));
+}
+EXPORT_SYMBOL(blk_mq_delay_queue);
+
 static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
 				    struct request *rq, bool at_head)
 {
@@ -713,6 +914,8 @@ void blk_mq_insert_request(struct request *rq, bool at_head, bool run_queue,
 	if (rq->cmd_flags & (REQ_FLUSH | REQ_FUA) &&
 	    !(rq->cmd_flags & (REQ_FLUSH_SEQ))) {
 		blk_insert_flush(rq);
+	} else if (blk_mq_sched_active(q)) {
+		blk_mq_sched_insert_request(hctx, rq, at_head);
 	} else {
 		spin_lock(&ctx->lock);
 		__blk_mq_insert_request(hctx, rq, at_head);
@@ -743,6 +946,15 @@ static void blk_mq_insert_requests(struct request_queue *q,
 		ctx = current_ctx;
 	hctx = q->mq_ops->map_queue(q, ctx->cpu);
 
+	if (blk_mq_sched_active(q)) {
+		struct request *rq;
+
+		list_for_each_entry(rq, list, queuelist)
+			rq->mq_ctx = ctx;
+		blk_mq_sched_insert_requests(hctx, list, false);
+		goto out;
+	}
+
 	/*
 	 * preemption doesn't flush plug list, so it's possible ctx->cpu is
 	 * offline now
@@ -757,7 +969,7 @@ static void blk_mq_insert_requests(struct request_queue *q,
 		__blk_mq_insert_request(hctx, rq, false);
 	}
 	spin_unlock(&ctx->lock);
-
+out:
 	blk_mq_put_ctx(current_ctx);
 
 	blk_mq_run_hw_queue(hctx, from_schedule);
@@ -906,6 +1118,17 @@ static void blk_mq_make_request(struct request_queue *q, struct bio *bio)
 		}
 	}
 
+	/*
+	 * With an I/O scheduler attached, requests don't linger in the
+	 * software queues, so there is nothing to merge with there.
+	 */
+	if (blk_mq_sched_active(q)) {
+		blk_mq_bio_to_request(rq, bio);
+		blk_mq_sched_insert_request(hctx, rq, false);
+		blk_mq_put_ctx(ctx);
+		goto run_queue;
+	}
+
 	spin_lock(&ctx->lock);
 
 	if ((hctx->flags & BLK_MQ_F_SHOULD_MERGE) &&
@@ -937,11 +1160,11 @@ struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
 }
 EXPORT_SYMBOL(blk_mq_map_queue);
 
-struct blk_mq_hw_ctx *blk_mq_alloc_single_hw_queue(struct blk_mq_reg *reg,
+struct blk_mq_hw_ctx *blk_mq_alloc_single_hw_queue(struct blk_mq_tag_set *set,
 						   unsigned int hctx_index)
 {
 	return kmalloc_node(sizeof(struct blk_mq_hw_ctx),
-				GFP_KERNEL | __GFP_ZERO, reg->numa_node);
+				GFP_KERNEL | __GFP_ZERO, set->numa_node);
 }
 EXPORT_SYMBOL(blk_mq_alloc_single_hw_queue);
 
@@ -998,85 +1221,37 @@ static void blk_mq_hctx_notify(void *data, unsigned long action,
 	blk_mq_run_hw_queue(hctx, true);
 }
 
-static int blk_mq_init_hw_commands(struct blk_mq_hw_ctx *hctx,
-				   int (*init)(void *, struct blk_mq_hw_ctx *,
-					struct request *, unsigned int),
-				   void *data)
+struct request *blk_mq_tag_to_rq(struct blk_mq_hw_ctx *hctx, unsigned int tag)
 {
-	unsigned int i;
-	int ret = 0;
-
-	for (i = 0; i < hctx->queue_depth; i++) {
-		struct request *rq = hctx->rqs[i];
-
-		ret = init(data, hctx, rq, i);
-		if (ret)
-			break;
-	}
-
-	return ret;
-}
-
-int blk_mq_init_commands(struct request_queue *q,
-			 int (*init)(void *, struct blk_mq_hw_ctx *,
-					struct request *, unsigned int),
-			 void *data)
-{
-	struct blk_mq_hw_ctx *hctx;
-	unsigned int i;
-	int ret = 0;
-
-	queue_for_each_hw_ctx(q, hctx, i) {
-		ret = blk_mq_init_hw_commands(hctx, init, data);
-		if (ret)
-			break;
-	}
-
-	return ret;
+	return hctx->tags->rqs[tag];
 }
-EXPORT_SYMBOL(blk_mq_init_commands);
+EXPORT_SYMBOL(blk_mq_tag_to_rq);
 
-static void blk_mq_free_hw_commands(struct blk_mq_hw_ctx *hctx,
-				    void (*free)(void *, struct blk_mq_hw_ctx *,
-					struct request *, unsigned int),
-				    void *data)
+static void blk_mq_free_rq_map(struct blk_mq_tag_set *set,
+		struct blk_mq_tags *tags, unsigned int hctx_idx)
 {
-	unsigned int i;
+	struct page *page;
 
-	for (i = 0; i < hctx->queue_depth; i++) {
-		struct request *rq = hctx->rqs[i];
+	if (tags->rqs && set->ops->exit_request) {
+		int i;
 
-		free(data, hctx, rq, i);
+		for (i = 0; i < tags->nr_tags; i++) {
+			if (!tags->rqs[i])
+				continue;
+			set->ops->exit_request(set->driver_data, tags->rqs[i],
+						hctx_idx, i);
+		}
 	}
-}
-
-void blk_mq_free_commands(struct request_queue *q,
-			  void (*free)(void *, struct blk_mq_hw_ctx *,
-					struct request *, unsigned int),
-			  void *data)
-{
-	struct blk_mq_hw_ctx *hctx;
-	unsigned int i;
 
-	queue_for_each_hw_ctx(q, hctx, i)
-		blk_mq_free_hw_commands(hctx, free, data);
-}
-EXPORT_SYMBOL(blk_mq_free_commands);
-
-static void blk_mq_free_rq_map(struct blk_mq_hw_ctx *hctx)
-{
-	struct page *page;
-
-	while (!list_empty(&hctx->page_list)) {
-		page = list_first_entry(&hctx->page_list, struct page, lru);
+	while (!list_empty(&tags->page_list)) {
+		page = list_first_entry(&tags->page_list, struct page, lru);
 		list_del_init(&page->lru);
 		__free_pages(page, page->private);
 	}
 
-	kfree(hctx->rqs);
+	kfree(tags->rqs);
 
-	if (hctx->tags)
-		blk_mq_free_tags(hctx->tags);
+	blk_mq_free_tags(tags);
 }
 
 static size_t order_to_size(unsigned int order)
@@ -1089,28 +1264,34 @@ static size_t order_to_size(unsigned int order)
 	return ret;
 }
 
-static int blk_mq_init_rq_map(struct blk_mq_hw_ctx *hctx,
-			      unsigned int reserved_tags, int node)
+static struct blk_mq_tags *blk_mq_init_rq_map(struct blk_mq_tag_set *set,
+		unsigned int hctx_idx)
 {
+	struct blk_mq_tags *tags;
 	unsigned int i, j, entries_per_page, max_order = 4;
 	size_t rq_size, left;
 
-	INIT_LIST_HEAD(&hctx->page_list);
+	tags = blk_mq_init_tags(set->queue_depth, set->reserved_tags,
+				set->numa_node);
+	if (!tags)
+		return NULL;
 
-	hctx->rqs = kmalloc_node(hctx->queue_depth * sizeof(struct request *),
-					GFP_KERNEL, node);
-	if (!hctx->rqs)
-		return -ENOMEM;
+	tags->rqs = kzalloc_node(set->queue_depth * sizeof(struct request *),
+				 GFP_KERNEL, set->numa_node);
+	if (!tags->rqs) {
+		blk_mq_free_tags(tags);
+		return NULL;
+	}
 
 	/*
 	 * rq_size is the size of the request plus driver payload, rounded
 	 * to the cacheline size
 	 */
-	rq_size = round_up(sizeof(struct request) + hctx->cmd_size,
+	rq_size = round_up(sizeof(struct request) + set->cmd_size,
 				cache_line_size());
-	left = rq_size * hctx->queue_depth;
+	left = rq_size * set->queue_depth;
 
-	for (i = 0; i < hctx->queue_depth;) {
+	for (i = 0; i < set->queue_depth; ) {
 		int this_order = max_order;
 		struct page *page;
 		int to_do;
@@ -1120,7 +1301,8 @@ static int blk_mq_init_rq_map(struct blk_mq_hw_ctx *hctx,
 			this_order--;
 
 		do {
-			page = alloc_pages_node(node, GFP_KERNEL, this_order);
+			page = alloc_pages_node(set->numa_node, GFP_KERNEL,
+						this_order);
 			if (page)
 				break;
 			if (!this_order--)
@@ -1130,43 +1312,44 @@ static int blk_mq_init_rq_map(struct blk_mq_hw_ctx *hctx,
 		} while (1);
 
 		if (!page)
-			break;
+			goto fail;
 
 		page->private = this_order;
-		list_add_tail(&page->lru, &hctx->page_list);
+		list_add_tail(&page->lru, &tags->page_list);
 
 		p = page_address(page);
 		entries_per_page = order_to_size(this_order) / rq_size;
-		to_do = min(entries_per_page, hctx->queue_depth - i);
+		to_do = min(entries_per_page, set->queue_depth - i);
 		left -= to_do * rq_size;
 		for (j = 0; j < to_do; j++) {
-			hctx->rqs[i] = p;
-			blk_mq_rq_init(hctx, hctx->rqs[i]);
+			tags->rqs[i] = p;
+			blk_rq_init(NULL, tags->rqs[i]);
+			if (set->cmd_size)
+				tags->rqs[i]->special = blk_mq_rq_to_pdu(p);
+			if (set->ops->init_request) {
+				if (set->ops->init_request(set->driver_data,
+						tags->rqs[i], hctx_idx, i,
+						set->numa_node)) {
+					tags->rqs[i] = NULL;
+					goto fail;
+				}
+			}
+
 			p += rq_size;
 			i++;
 		}
 	}
 
-	if (i < (reserved_tags + BLK_MQ_TAG_MIN))
-		goto err_rq_map;
-	else if (i != hctx->queue_depth) {
-		hctx->queue_depth = i;
-		pr_warn("%s: queue depth set to %u because of low memory\n",
-					__func__, i);
-	}
-
-	hctx->tags = blk_mq_init_tags(hctx->queue_depth, reserved_tags, node);
-	if (!hctx->tags) {
-err_rq_map:
-		blk_mq_free_rq_map(hctx);
-		return -ENOMEM;
-	}
+	return tags;
 
-	return 0;
+fail:
+	pr_warn("%s: failed to allocate requests\n", __func__);
+	blk_mq_free_rq_map(set, tags, hctx_idx);
+	return NULL;
 }
 
 static int blk_mq_init_hw_queues(struct request_queue *q,
-				 struct blk_mq_reg *reg, void *driver_data)
+				 struct blk_mq_tag_set *set)
 {
 	struct blk_mq_hw_ctx *hctx;
 	unsigned int i, j;
@@ -1180,24 +1363,24 @@ static int blk_mq_init_hw_queues(struct request_queue *q,
 
 		node = hctx->numa_node;
 		if (node == NUMA_NO_NODE)
-			node = hctx->numa_node = reg->numa_node;
+			node = hctx->numa_node = set->numa_node;
 
 		INIT_DELAYED_WORK(&hctx->delayed_work, blk_mq_work_fn);
+		INIT_DELAYED_WORK(&hctx->delay_work, blk_mq_delay_work_fn);
 		spin_lock_init(&hctx->lock);
 		INIT_LIST_HEAD(&hctx->dispatch);
 		hctx->queue = q;
 		hctx->queue_num = i;
-		hctx->flags = reg->flags;
-		hctx->queue_depth = reg->queue_depth;
-		hctx->cmd_size = reg->cmd_size;
+		hctx->flags = set->flags;
+		hctx->cmd_size = set->cmd_size;
+		hctx->tags = set->tags[i];
+		hctx->queue_depth = hctx->tags->nr_tags;
+		atomic_set(&hctx->nr_active, 0);
 
 		blk_mq_init_cpu_notifier(&hctx->cpu_notifier,
 						blk_mq_hctx_notify, hctx);
 		blk_mq_register_cpu_notifier(&hctx->cpu_notifier);
 
-		if (blk_mq_init_rq_map(hctx, reg->reserved_tags, node))
-			break;
-
 		/*
 		 * Allocate space for all possible cpus to avoid allocation in
 		 * runtime
@@ -1213,11 +1396,15 @@ static int blk_mq_init_hw_queues(struct request_queue *q,
 		if (!hctx->ctx_map)
 			break;
 
+		hctx->lat_stats = alloc_percpu(struct blk_mq_lat_stats);
+		if (!hctx->lat_stats)
+			break;
+
 		hctx->nr_ctx_map = num_maps;
 		hctx->nr_ctx = 0;
 
-		if (reg->ops->init_hctx &&
-		    reg->ops->init_hctx(hctx, driver_data, i))
+		if (set->ops->init_hctx &&
+		    set->ops->init_hctx(hctx, set->driver_data, i))
 			break;
 	}
 
@@ -1231,11 +1418,11 @@ static int blk_mq_init_hw_queues(struct request_queue *q,
 		if (i == j)
 			break;
 
-		if (reg->ops->exit_hctx)
-			reg->ops->exit_hctx(hctx, j);
+		if (set->ops->exit_hctx)
+			set->ops->exit_hctx(hctx, j);
 
 		blk_mq_unregister_cpu_notifier(&hctx->cpu_notifier);
-		blk_mq_free_rq_map(hctx);
+		free_percpu(hctx->lat_stats);
 		kfree(hctx->ctxs);
 	}
 
@@ -1294,41 +1481,88 @@ static void blk_mq_map_swqueue(struct request_queue *q)
 	}
 }
 
-struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
-					void *driver_data)
+static void blk_mq_update_tag_set_depth(struct blk_mq_tag_set *set)
 {
-	struct blk_mq_hw_ctx **hctxs;
-	struct blk_mq_ctx *ctx;
+	struct blk_mq_hw_ctx *hctx;
 	struct request_queue *q;
+	bool shared;
 	int i;
 
-	if (!reg->nr_hw_queues ||
-	    !reg->ops->queue_rq || !reg->ops->map_queue ||
-	    !reg->ops->alloc_hctx || !reg->ops->free_hctx)
-		return ERR_PTR(-EINVAL);
+	if (set->tag_list.next == set->tag_list.prev)
+		shared = false;
+	else
+		shared = true;
 
-	if (!reg->queue_depth)
-		reg->queue_depth = BLK_MQ_MAX_DEPTH;
-	else if (reg->queue_depth > BLK_MQ_MAX_DEPTH) {
-		pr_err("blk-mq: queuedepth too large (%u)\n", reg->queue_depth);
-		reg->queue_depth = BLK_MQ_MAX_DEPTH;
+	/*
+	 * The shared flag decides whether requests are accounted in
+	 * hctx->nr_active, so only flip it with the queue drained.
+	 */
+	list_for_each_entry(q, &set->tag_list, tag_set_list) {
+		blk_mq_freeze_queue(q);
+
+		queue_for_each_hw_ctx(q, hctx, i) {
+			if (shared)
+				hctx->flags |= BLK_MQ_F_TAG_SHARED;
+			else
+				hctx->flags &= ~BLK_MQ_F_TAG_SHARED;
+		}
+		blk_mq_unfreeze_queue(q);
 	}
+}
+
+static void blk_mq_add_queue_tag_set(struct blk_mq_tag_set *set,
+				     struct request_queue *q)
+{
+	q->tag_set = set;
+
+	mutex_lock(&set->tag_list_lock);
+	list_add_tail(&q->tag_set_list, &set->tag_list);
+	blk_mq_update_tag_set_depth(set);
+	mutex_unlock(&set->tag_list_lock);
+}
+
+/*
+ * Detach @q from its tag set.  Called from blk_cleanup_queue(), so that
+ * the remaining users of the set get their full share back as soon as
+ * the queue is dead, and again at release time for queues that were
+ * never cleaned up.
+ */
+void blk_mq_exit_queue(struct request_queue *q)
+{
+	struct blk_mq_tag_set *set = q->tag_set;
 
-	if (reg->queue_depth < (reg->reserved_tags + BLK_MQ_TAG_MIN))
-		return ERR_PTR(-EINVAL);
+	/*
+	 * The driver may free the set once all its queues are cleaned up,
+	 * so don't touch it again after the first call.
+	 */
+	if (!set || list_empty(&q->tag_set_list))
+		return;
+
+	mutex_lock(&set->tag_list_lock);
+	list_del_init(&q->tag_set_list);
+	blk_mq_update_tag_set_depth(set);
+	mutex_unlock(&set->tag_list_lock);
+}
+
+struct request_queue *blk_mq_init_queue(struct blk_mq_tag_set *set)
+{
+	struct blk_mq_hw_ctx **hctxs;
+	struct blk_mq_ctx *ctx;
+	struct request_queue *q;
+	int i;
 
 	ctx = alloc_percpu(struct blk_mq_ctx);
 	if (!ctx)
 		return ERR_PTR(-ENOMEM);
 
-	hctxs = kmalloc_node(reg->nr_hw_queues * sizeof(*hctxs), GFP_KERNEL,
-			reg->numa_node);
+	hctxs = kmalloc_node(set->nr_hw_queues * sizeof(*hctxs), GFP_KERNEL,
+			set->numa_node);
 
 	if (!hctxs)
 		goto err_percpu;
 
-	for (i = 0; i < reg->nr_hw_queues; i++) {
-		hctxs[i] = reg->ops->alloc_hctx(reg, i);
+	for (i = 0; i < set->nr_hw_queues; i++) {
+		hctxs[i] = set->ops->alloc_hctx(set, i);
 		if (!hctxs[i])
 			goto err_hctxs;
 
@@ -1336,11 +1570,11 @@ struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
 		hctxs[i]->queue_num = i;
 	}
 
-	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	q = blk_alloc_queue_node(GFP_KERNEL, set->numa_node);
 	if (!q)
 		goto err_hctxs;
 
-	q->mq_map = blk_mq_make_queue_map(reg);
+	q->mq_map = blk_mq_make_queue_map(set);
 	if (!q->mq_map)
 		goto err_map;
 
@@ -1348,33 +1582,37 @@ struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
 	blk_queue_rq_timeout(q, 30000);
 
 	q->nr_queues = nr_cpu_ids;
-	q->nr_hw_queues = reg->nr_hw_queues;
+	q->nr_hw_queues = set->nr_hw_queues;
 
 	q->queue_ctx = ctx;
 	q->queue_hw_ctx = hctxs;
 
-	q->mq_ops = reg->ops;
+	q->mq_ops = set->ops;
 	q->queue_flags |= QUEUE_FLAG_MQ_DEFAULT;
 
 	q->sg_reserved_size = INT_MAX;
 
+	/* drivers may look at the set from ->map_queue() */
+	q->tag_set = set;
+	INIT_LIST_HEAD(&q->tag_set_list);
+
 	blk_queue_make_request(q, blk_mq_make_request);
-	blk_queue_rq_timed_out(q, reg->ops->timeout);
-	if (reg->timeout)
-		blk_queue_rq_timeout(q, reg->timeout);
+	blk_queue_rq_timed_out(q, set->ops->timeout);
+	if (set->timeout)
+		blk_queue_rq_timeout(q, set->timeout);
 
-	if (reg->ops->complete)
-		blk_queue_softirq_done(q, reg->ops->complete);
+	if (set->ops->complete)
+		blk_queue_softirq_done(q, set->ops->complete);
 
 	blk_mq_init_flush(q);
-	blk_mq_init_cpu_queues(q, reg->nr_hw_queues);
+	blk_mq_init_cpu_queues(q, set->nr_hw_queues);
 
-	q->flush_rq = kzalloc(round_up(sizeof(struct request) + reg->cmd_size,
+	q->flush_rq = kzalloc(round_up(sizeof(struct request) + set->cmd_size,
 				cache_line_size()), GFP_KERNEL);
 	if (!q->flush_rq)
 		goto err_hw;
 
-	if (blk_mq_init_hw_queues(q, reg, driver_data))
+	if (blk_mq_init_hw_queues(q, set))
 		goto err_flush_rq;
 
 	blk_mq_map_swqueue(q);
@@ -1383,6 +1621,8 @@ struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
 	list_add_tail(&q->all_q_node, &all_q_list);
 	mutex_unlock(&all_q_mutex);
 
+	blk_mq_add_queue_tag_set(set, q);
+
 	return q;
 
 err_flush_rq:
@@ -1392,10 +1632,10 @@ err_hw:
 err_map:
 	blk_cleanup_queue(q);
 err_hctxs:
-	for (i = 0; i < reg->nr_hw_queues; i++) {
+	for (i = 0; i < set->nr_hw_queues; i++) {
 		if (!hctxs[i])
 			break;
-		reg->ops->free_hctx(hctxs[i], i);
+		set->ops->free_hctx(hctxs[i], i);
 	}
 	kfree(hctxs);
 err_percpu:
@@ -1409,10 +1649,13 @@ void blk_mq_free_queue(struct request_queue *q)
 	struct blk_mq_hw_ctx *hctx;
 	int i;
 
+	blk_mq_exit_queue(q);
+
 	queue_for_each_hw_ctx(q, hctx, i) {
+		cancel_delayed_work_sync(&hctx->delay_work);
+		free_percpu(hctx->lat_stats);
 		kfree(hctx->ctx_map);
 		kfree(hctx->ctxs);
-		blk_mq_free_rq_map(hctx);
 		blk_mq_unregister_cpu_notifier(&hctx->cpu_notifier);
 		if (q->mq_ops->exit_hctx)
 			q->mq_ops->exit_hctx(hctx, i);
@@ -1432,12 +1675,76 @@ void blk_mq_free_queue(struct request_queue *q)
 	mutex_unlock(&all_q_mutex);
 }
 
+/*
+ * Alloc a tag set to be associated with one or more request queues.
+ * May fail with EINVAL for various error conditions. May adjust the
+ * requested depth down, if it is too large. In that case, the set
+ * value will be stored in set->queue_depth.
+ */
+int blk_mq_alloc_tag_set(struct blk_mq_tag_set *set)
+{
+	int i;
+
+	if (!set->nr_hw_queues ||
+	    !set->ops->queue_rq || !set->ops->map_queue ||
+	    !set->ops->alloc_hctx || !set->ops->free_hctx)
+		return -EINVAL;
+
+	if (!set->queue_depth)
+		set->queue_depth = BLK_MQ_MAX_DEPTH;
+	else if (set->queue_depth > BLK_MQ_MAX_DEPTH) {
+		pr_err("blk-mq: queuedepth too large (%u)\n", set->queue_depth);
+		set->queue_depth = BLK_MQ_MAX_DEPTH;
+	}
+
+	if (set->queue_depth < (set->reserved_tags + BLK_MQ_TAG_MIN))
+		return -EINVAL;
+
+	set->tags = kzalloc_node(set->nr_hw_queues * sizeof(*set->tags),
+				 GFP_KERNEL, set->numa_node);
+	if (!set->tags)
+		return -ENOMEM;
+
+	for (i = 0; i < set->nr_hw_queues; i++) {
+		set->tags[i] = blk_mq_init_rq_map(set, i);
+		if (!set->tags[i])
+			goto out_unwind;
+	}
+
+	mutex_init(&set->tag_list_lock);
+	INIT_LIST_HEAD(&set->tag_list);
+
+	return 0;
+
+out_unwind:
+	while (--i >= 0)
+		blk_mq_free_rq_map(set, set->tags[i], i);
+	kfree(set->tags);
+	set->tags = NULL;
+	return -ENOMEM;
+}
+EXPORT_SYMBOL(blk_mq_alloc_tag_set);
+
+void blk_mq_free_tag_set(struct blk_mq_tag_set *set)
+{
+	int i;
+
+	WARN_ON_ONCE(!list_empty(&set->tag_list));
+
+	for (i = 0; i < set->nr_hw_queues; i++)
+		blk_mq_free_rq_map(set, set->tags[i], i);
+	kfree(set->tags);
+	set->tags = NULL;
+}
+EXPORT_SYMBOL(blk_mq_free_tag_set);
+
 /* Basically redo blk_mq_init_queue with queue frozen */
 static void blk_mq_queue_reinit(struct request_queue *q)
 {
 	blk_mq_freeze_queue(q);
 
-	blk_mq_update_queue_map(q->mq_map, q->nr_hw_queues);
+	blk_mq_update_queue_map(q->mq_map, q->nr_hw_queues,
+				q->tag_set->affinity);
 
 	/*
 	 * redo blk_mq_init_cpu_queues and blk_mq_init_hw_queues. FIXME: maybe
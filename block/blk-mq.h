@@ -22,11 +22,31 @@ struct blk_mq_ctx {
 	struct kobject		kobj;
 };
 
+/*
+ * Latency histograms of a hardware queue, kept per cpu. Bucket 0 counts
+ * latencies below 4 usecs, bucket i of [2^(i+1), 2^(i+2)) usecs, and the
+ * last one anything longer.
+ */
+#define BLK_MQ_LAT_BUCKETS	16
+#define BLK_MQ_LAT_SIZES	4	/* <= 4k, <= 16k, <= 64k, larger */
+
+enum {
+	BLK_MQ_LAT_QUEUE,	/* allocation to dispatch */
+	BLK_MQ_LAT_DEVICE,	/* dispatch to completion */
+	BLK_MQ_LAT_NR,
+};
+
+struct blk_mq_lat_stats {
+	unsigned long bucket[BLK_MQ_LAT_NR][2][BLK_MQ_LAT_SIZES]
+			    [BLK_MQ_LAT_BUCKETS];
+};
+
 void __blk_mq_complete_request(struct request *rq);
 void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async);
 void blk_mq_init_flush(struct request_queue *q);
 void blk_mq_drain_queue(struct request_queue *q);
 void blk_mq_free_queue(struct request_queue *q);
+void blk_mq_exit_queue(struct request_queue *q);
 void blk_mq_rq_init(struct blk_mq_hw_ctx *hctx, struct request *rq);
 
 /*
@@ -45,9 +65,10 @@ void blk_mq_disable_hotplug(void);
 /*
  * CPU -> queue mappings
  */
-struct blk_mq_reg;
-extern unsigned int *blk_mq_make_queue_map(struct blk_mq_reg *reg);
-extern int blk_mq_update_queue_map(unsigned int *map, unsigned int nr_queues);
+struct blk_mq_tag_set;
+extern unsigned int *blk_mq_make_queue_map(struct blk_mq_tag_set *set);
+extern int blk_mq_update_queue_map(unsigned int *map, unsigned int nr_queues,
+				   const struct cpumask *affinity);
 
 void blk_mq_add_timer(struct request *rq);
 
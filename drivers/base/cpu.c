@@ -16,6 +16,7 @@
 #include <linux/acpi.h>
 #include <linux/of.h>
 #include <linux/cpufeature.h>
+#include <linux/pm_qos.h>
 
 #include "base.h"
 
@@ -354,6 +355,12 @@ int register_cpu(struct cpu *cpu, int num)
 	if (!error)
 		register_cpu_under_node(num, cpu_to_node(num));
 
+#ifdef CONFIG_PM
+	/* per-cpu wakeup latency limit for cpuidle, 0 is no constraint */
+	if (!error)
+		dev_pm_qos_expose_latency_limit(&cpu->dev, 0);
+#endif
+
 	return error;
 }
 
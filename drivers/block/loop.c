@@ -70,7 +70,6 @@
 #include <linux/writeback.h>
 #include <linux/completion.h>
 #include <linux/highmem.h>
-#include <linux/kthread.h>
 #include <linux/splice.h>
 #include <linux/sysfs.h>
 #include <linux/miscdevice.h>
@@ -284,12 +283,12 @@ static int do_lo_send_write(struct loop_device *lo, struct bio_vec *bvec,
 	return ret;
 }
 
-static int lo_send(struct loop_device *lo, struct bio *bio, loff_t pos)
+static int lo_send(struct loop_device *lo, struct request *rq, loff_t pos)
 {
 	int (*do_lo_send)(struct loop_device *, struct bio_vec *, loff_t,
 			struct page *page);
 	struct bio_vec bvec;
-	struct bvec_iter iter;
+	struct req_iterator iter;
 	struct page *page = NULL;
 	int ret = 0;
 
@@ -303,7 +302,7 @@ static int lo_send(struct loop_device *lo, struct bio *bio, loff_t pos)
 		do_lo_send = do_lo_send_direct_write;
 	}
 
-	bio_for_each_segment(bvec, bio, iter) {
+	rq_for_each_segment(bvec, rq, iter) {
 		ret = do_lo_send(lo, &bvec, pos, page);
 		if (ret < 0)
 			break;
@@ -390,38 +389,147 @@ do_lo_receive(struct loop_device *lo,
 	return retval;
 }
 
+/*
+ * Zero everything in @rq past its first @done bytes, for reads that ran
+ * into the end of the backing file.
+ */
+static void lo_zero_fill_rq(struct request *rq, unsigned int done)
+{
+	struct bio_vec bvec;
+	struct req_iterator iter;
+
+	rq_for_each_segment(bvec, rq, iter) {
+		if (done >= bvec.bv_len) {
+			done -= bvec.bv_len;
+			continue;
+		}
+		zero_user(bvec.bv_page, bvec.bv_offset + done,
+			  bvec.bv_len - done);
+		done = 0;
+	}
+}
+
 static int
-lo_receive(struct loop_device *lo, struct bio *bio, int bsize, loff_t pos)
+lo_receive(struct loop_device *lo, struct request *rq, int bsize, loff_t pos)
 {
 	struct bio_vec bvec;
-	struct bvec_iter iter;
+	struct req_iterator iter;
+	unsigned int done = 0;
 	ssize_t s;
 
-	bio_for_each_segment(bvec, bio, iter) {
+	rq_for_each_segment(bvec, rq, iter) {
 		s = do_lo_receive(lo, &bvec, bsize, pos);
 		if (s < 0)
 			return s;
 
 		if (s != bvec.bv_len) {
-			zero_fill_bio(bio);
+			lo_zero_fill_rq(rq, done + s);
 			break;
 		}
 		pos += bvec.bv_len;
+		done += bvec.bv_len;
 	}
 	return 0;
 }
 
-static int do_bio_filebacked(struct loop_device *lo, struct bio *bio)
+/*
+ * Direct I/O needs the file offset and every segment aligned to the
+ * logical block size of the device under the backing file.  Requests
+ * that aren't, which is rare for anything a filesystem submits, take the
+ * buffered path instead.
+ */
+static bool lo_rq_dio_aligned(struct loop_device *lo, struct request *rq,
+			      loff_t pos)
+{
+	struct bio_vec bvec;
+	struct req_iterator iter;
+
+	if (pos & lo->lo_dio_align)
+		return false;
+
+	rq_for_each_segment(bvec, rq, iter) {
+		if ((bvec.bv_offset | bvec.bv_len) & lo->lo_dio_align)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Read or write the whole of @rq with a single vectored call on the
+ * O_DIRECT file, so the data moves between the request's pages and the
+ * backing device without going through the backing file's page cache.
+ */
+static int lo_rw_direct(struct loop_device *lo, struct request *rq,
+			loff_t pos)
+{
+	struct file *file = lo->lo_dio_file;
+	struct iovec fast_iov[UIO_FASTIOV], *iov = fast_iov;
+	unsigned int len = blk_rq_bytes(rq);
+	unsigned long nr_segs = 0, i = 0;
+	struct bio_vec bvec;
+	struct req_iterator iter;
+	mm_segment_t old_fs;
+	ssize_t ret;
+
+	rq_for_each_segment(bvec, rq, iter)
+		nr_segs++;
+
+	if (nr_segs > UIO_FASTIOV) {
+		iov = kmalloc_array(nr_segs, sizeof(*iov), GFP_NOIO);
+		if (!iov)
+			return -ENOMEM;
+	}
+
+	rq_for_each_segment(bvec, rq, iter) {
+		iov[i].iov_base = (void __user *)(kmap(bvec.bv_page) +
+						  bvec.bv_offset);
+		iov[i].iov_len = bvec.bv_len;
+		i++;
+	}
+
+	old_fs = get_fs();
+	set_fs(get_ds());
+	if (rq_data_dir(rq) == WRITE)
+		ret = vfs_writev(file, (const struct iovec __user *)iov,
+				 nr_segs, &pos);
+	else
+		ret = vfs_readv(file, (const struct iovec __user *)iov,
+				nr_segs, &pos);
+	set_fs(old_fs);
+
+	rq_for_each_segment(bvec, rq, iter)
+		kunmap(bvec.bv_page);
+
+	if (iov != fast_iov)
+		kfree(iov);
+
+	if (ret < 0)
+		return ret;
+
+	if (rq_data_dir(rq) == READ) {
+		if (ret != len)
+			lo_zero_fill_rq(rq, ret);
+		return 0;
+	}
+
+	if (likely(ret == len))
+		return 0;
+	printk_ratelimited(KERN_ERR "loop: Write error at byte offset %llu, length %u.\n",
+			(unsigned long long)pos, len);
+	return -EIO;
+}
+
+static int do_req_filebacked(struct loop_device *lo, struct request *rq)
 {
 	loff_t pos;
 	int ret;
 
-	pos = ((loff_t) bio->bi_iter.bi_sector << 9) + lo->lo_offset;
+	pos = ((loff_t) blk_rq_pos(rq) << 9) + lo->lo_offset;
 
-	if (bio_rw(bio) == WRITE) {
+	if (rq_data_dir(rq) == WRITE) {
 		struct file *file = lo->lo_backing_file;
 
-		if (bio->bi_rw & REQ_FLUSH) {
+		if (rq->cmd_flags & REQ_FLUSH) {
 			ret = vfs_fsync(file, 0);
 			if (unlikely(ret && ret != -EINVAL)) {
 				ret = -EIO;
@@ -435,7 +543,7 @@ static int do_bio_filebacked(struct loop_device *lo, struct bio *bio)
 		 * encryption is enabled, because it may give an attacker
 		 * useful information.
 		 */
-		if (bio->bi_rw & REQ_DISCARD) {
+		if (rq->cmd_flags & REQ_DISCARD) {
 			struct file *file = lo->lo_backing_file;
 			int mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
 
@@ -445,188 +553,238 @@ static int do_bio_filebacked(struct loop_device *lo, struct bio *bio)
 				goto out;
 			}
 			ret = file->f_op->fallocate(file, mode, pos,
-						    bio->bi_iter.bi_size);
+						    blk_rq_bytes(rq));
 			if (unlikely(ret && ret != -EINVAL &&
 				     ret != -EOPNOTSUPP))
 				ret = -EIO;
 			goto out;
 		}
 
-		ret = lo_send(lo, bio, pos);
+		if (!blk_rq_bytes(rq))
+			ret = 0;
+		else if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) &&
+			 lo_rq_dio_aligned(lo, rq, pos))
+			ret = lo_rw_direct(lo, rq, pos);
+		else
+			ret = lo_send(lo, rq, pos);
 
-		if ((bio->bi_rw & REQ_FUA) && !ret) {
+		if ((rq->cmd_flags & REQ_FUA) && !ret) {
 			ret = vfs_fsync(file, 0);
 			if (unlikely(ret && ret != -EINVAL))
 				ret = -EIO;
 		}
-	} else
-		ret = lo_receive(lo, bio, lo->lo_blocksize, pos);
+	} else if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) &&
+		   lo_rq_dio_aligned(lo, rq, pos))
+		ret = lo_rw_direct(lo, rq, pos);
+	else
+		ret = lo_receive(lo, rq, lo->lo_blocksize, pos);
 
 out:
 	return ret;
 }
 
-/*
- * Add bio to back of pending list
- */
-static void loop_add_bio(struct loop_device *lo, struct bio *bio)
+static void loop_handle_cmd(struct loop_cmd *cmd)
 {
-	lo->lo_bio_count++;
-	bio_list_add(&lo->lo_bio_list, bio);
+	struct loop_device *lo = cmd->rq->q->queuedata;
+	int ret;
+
+	ret = do_req_filebacked(lo, cmd->rq);
+	cmd->rq->errors = ret ? -EIO : 0;
+	blk_mq_complete_request(cmd->rq);
 }
 
 /*
- * Grab first pending buffer
+ * Buffered writes to the backing file serialize on its i_mutex anyway, so
+ * they are handled one after another by a single work item rather than
+ * having a pile of workers contend for it.
  */
-static struct bio *loop_get_bio(struct loop_device *lo)
+static void loop_queue_write_work(struct work_struct *work)
 {
-	lo->lo_bio_count--;
-	return bio_list_pop(&lo->lo_bio_list);
-}
+	struct loop_device *lo =
+		container_of(work, struct loop_device, write_work);
+	LIST_HEAD(cmd_list);
 
-static void loop_make_request(struct request_queue *q, struct bio *old_bio)
-{
-	struct loop_device *lo = q->queuedata;
-	int rw = bio_rw(old_bio);
+	spin_lock_irq(&lo->lo_lock);
+ repeat:
+	list_splice_init(&lo->write_cmd_head, &cmd_list);
+	spin_unlock_irq(&lo->lo_lock);
 
-	if (rw == READA)
-		rw = READ;
+	while (!list_empty(&cmd_list)) {
+		struct loop_cmd *cmd = list_first_entry(&cmd_list,
+				struct loop_cmd, list);
 
-	BUG_ON(!lo || (rw != READ && rw != WRITE));
+		list_del_init(&cmd->list);
+		loop_handle_cmd(cmd);
+	}
 
 	spin_lock_irq(&lo->lo_lock);
-	if (lo->lo_state != Lo_bound)
-		goto out;
-	if (unlikely(rw == WRITE && (lo->lo_flags & LO_FLAGS_READ_ONLY)))
-		goto out;
-	if (lo->lo_bio_count >= q->nr_congestion_on)
-		wait_event_lock_irq(lo->lo_req_wait,
-				    lo->lo_bio_count < q->nr_congestion_off,
-				    lo->lo_lock);
-	loop_add_bio(lo, old_bio);
-	wake_up(&lo->lo_event);
-	spin_unlock_irq(&lo->lo_lock);
-	return;
-
-out:
+	if (!list_empty(&lo->write_cmd_head))
+		goto repeat;
+	lo->write_started = false;
 	spin_unlock_irq(&lo->lo_lock);
-	bio_io_error(old_bio);
 }
 
-struct switch_request {
-	struct file *file;
-	struct completion wait;
-};
-
-static void do_loop_switch(struct loop_device *, struct switch_request *);
-
-static inline void loop_handle_bio(struct loop_device *lo, struct bio *bio)
+static void loop_queue_work(struct work_struct *work)
 {
-	if (unlikely(!bio->bi_bdev)) {
-		do_loop_switch(lo, bio->bi_private);
-		bio_put(bio);
-	} else {
-		int ret = do_bio_filebacked(lo, bio);
-		bio_endio(bio, ret);
-	}
+	struct loop_cmd *cmd = container_of(work, struct loop_cmd, work);
+
+	loop_handle_cmd(cmd);
 }
 
 /*
- * worker thread that handles reads/writes to file backed loop devices,
- * to avoid blocking in our make_request_fn. it also does loop decrypting
- * on reads for block backed loop, as that is too heavy to do from
- * b_end_io context where irqs may be disabled.
- *
- * Loop explanation:  loop_clr_fd() sets lo_state to Lo_rundown before
- * calling kthread_stop().  Therefore once kthread_should_stop() is
- * true, make_request will not place any more requests.  Therefore
- * once kthread_should_stop() is true and lo_bio is NULL, we are
- * done with the loop.
+ * Reads, and all I/O in direct mode, get a work item of their own on the
+ * per-device workqueue, so requests to the backing file run concurrently
+ * instead of queueing up behind a single thread.
  */
-static int loop_thread(void *data)
+static int loop_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq)
 {
-	struct loop_device *lo = data;
-	struct bio *bio;
+	struct loop_cmd *cmd = blk_mq_rq_to_pdu(rq);
+	struct loop_device *lo = rq->q->queuedata;
 
-	set_user_nice(current, -20);
+	if (lo->lo_state != Lo_bound || rq->cmd_type != REQ_TYPE_FS)
+		return BLK_MQ_RQ_QUEUE_ERROR;
+	if (rq_data_dir(rq) == WRITE && (lo->lo_flags & LO_FLAGS_READ_ONLY))
+		return BLK_MQ_RQ_QUEUE_ERROR;
 
-	while (!kthread_should_stop() || !bio_list_empty(&lo->lo_bio_list)) {
+	if (rq_data_dir(rq) == WRITE && !(lo->lo_flags & LO_FLAGS_DIRECT_IO)) {
+		bool need_sched = true;
 
-		wait_event_interruptible(lo->lo_event,
-				!bio_list_empty(&lo->lo_bio_list) ||
-				kthread_should_stop());
-
-		if (bio_list_empty(&lo->lo_bio_list))
-			continue;
 		spin_lock_irq(&lo->lo_lock);
-		bio = loop_get_bio(lo);
-		if (lo->lo_bio_count < lo->lo_queue->nr_congestion_off)
-			wake_up(&lo->lo_req_wait);
+		if (lo->write_started)
+			need_sched = false;
+		else
+			lo->write_started = true;
+		list_add_tail(&cmd->list, &lo->write_cmd_head);
 		spin_unlock_irq(&lo->lo_lock);
 
-		BUG_ON(!bio);
-		loop_handle_bio(lo, bio);
+		if (need_sched)
+			queue_work(lo->wq, &lo->write_work);
+	} else {
+		queue_work(lo->wq, &cmd->work);
 	}
 
-	return 0;
+	return BLK_MQ_RQ_QUEUE_OK;
 }
 
-/*
- * loop_switch performs the hard work of switching a backing store.
- * First it needs to flush existing IO, it does this by sending a magic
- * BIO down the pipe. The completion of this BIO does the actual switch.
- */
-static int loop_switch(struct loop_device *lo, struct file *file)
-{
-	struct switch_request w;
-	struct bio *bio = bio_alloc(GFP_KERNEL, 0);
-	if (!bio)
-		return -ENOMEM;
-	init_completion(&w.wait);
-	w.file = file;
-	bio->bi_private = &w;
-	bio->bi_bdev = NULL;
-	loop_make_request(lo->lo_queue, bio);
-	wait_for_completion(&w.wait);
+static int loop_init_request(void *data, struct request *rq,
+		unsigned int hctx_idx, unsigned int request_idx,
+		unsigned int numa_node)
+{
+	struct loop_cmd *cmd = blk_mq_rq_to_pdu(rq);
+
+	cmd->rq = rq;
+	INIT_WORK(&cmd->work, loop_queue_work);
 	return 0;
 }
 
-/*
- * Helper to flush the IOs in loop, but keeping loop thread running
- */
-static int loop_flush(struct loop_device *lo)
+static void loop_softirq_done_fn(struct request *rq)
 {
-	/* loop not yet configured, no running thread, nothing to flush */
-	if (!lo->lo_thread)
-		return 0;
-
-	return loop_switch(lo, NULL);
+	blk_mq_end_io(rq, rq->errors);
 }
 
+static struct blk_mq_ops loop_mq_ops = {
+	.queue_rq	= loop_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+	.init_request	= loop_init_request,
+	.complete	= loop_softirq_done_fn,
+};
+
 /*
- * Do the actual switch; called from the BIO completion routine
+ * Switch the backing store of a live device. Freezing the queue waits for
+ * all requests in flight, so none of them can still be holding on to the
+ * old file when it is swapped out.
  */
-static void do_loop_switch(struct loop_device *lo, struct switch_request *p)
+static void loop_switch(struct loop_device *lo, struct file *file)
 {
-	struct file *file = p->file;
 	struct file *old_file = lo->lo_backing_file;
-	struct address_space *mapping;
+	struct address_space *mapping = file->f_mapping;
+	struct file *dio_file;
 
-	/* if no new file, only flush of queued bios requested */
-	if (!file)
-		goto out;
+	blk_mq_freeze_queue(lo->lo_queue);
 
-	mapping = file->f_mapping;
 	mapping_set_gfp_mask(old_file->f_mapping, lo->old_gfp_mask);
 	lo->lo_backing_file = file;
 	lo->lo_blocksize = S_ISBLK(mapping->host->i_mode) ?
 		mapping->host->i_bdev->bd_block_size : PAGE_SIZE;
 	lo->old_gfp_mask = mapping_gfp_mask(mapping);
 	mapping_set_gfp_mask(mapping, lo->old_gfp_mask & ~(__GFP_IO|__GFP_FS));
-out:
-	complete(&p->wait);
+
+	/* the O_DIRECT file refers to the old backing store */
+	dio_file = lo->lo_dio_file;
+	lo->lo_dio_file = NULL;
+	lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+
+	blk_mq_unfreeze_queue(lo->lo_queue);
+
+	if (dio_file)
+		fput(dio_file);
+}
+
+/*
+ * Helper to wait for the IOs in flight on a bound device
+ */
+static void loop_flush(struct loop_device *lo)
+{
+	/* loop not yet configured, nothing to flush */
+	if (lo->lo_state != Lo_bound)
+		return;
+
+	blk_mq_freeze_queue(lo->lo_queue);
+	blk_mq_unfreeze_queue(lo->lo_queue);
 }
 
+/*
+ * Switch between buffered and direct I/O against the backing file.  Direct
+ * I/O goes through a second struct file opened with O_DIRECT on the same
+ * path, so the file handed to us by userspace is left alone.  It needs a
+ * backing filesystem that implements ->direct_IO, an offset aligned to the
+ * logical block size of the device below it, and no transfer function,
+ * as that has to bounce the data anyway.  The device quietly stays in
+ * buffered mode if any of this doesn't hold.
+ */
+static void __loop_update_dio(struct loop_device *lo, bool dio)
+{
+	struct file *file = lo->lo_backing_file;
+	struct inode *inode = file->f_mapping->host;
+	struct file *dio_file = NULL, *old_file;
+	struct block_device *bdev;
+	unsigned short bsize = 0;
+	bool use_dio = false;
+
+	bdev = S_ISBLK(inode->i_mode) ? inode->i_bdev : inode->i_sb->s_bdev;
+	if (bdev)
+		bsize = bdev_logical_block_size(bdev);
+
+	lo->use_dio = dio;
+	if (dio && bsize && !(lo->lo_offset & (bsize - 1)) &&
+	    lo->transfer == transfer_none &&
+	    file->f_mapping->a_ops->direct_IO)
+		use_dio = true;
+
+	if (use_dio == !!(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		return;
+
+	if (use_dio) {
+		dio_file = dentry_open(&file->f_path, file->f_flags | O_DIRECT,
+				       file->f_cred);
+		if (IS_ERR(dio_file))
+			return;
+	}
+
+	blk_mq_freeze_queue(lo->lo_queue);
+	old_file = lo->lo_dio_file;
+	lo->lo_dio_file = dio_file;
+	if (use_dio) {
+		lo->lo_dio_align = bsize - 1;
+		lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+	} else {
+		lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+	}
+	blk_mq_unfreeze_queue(lo->lo_queue);
+
+	if (old_file)
+		fput(old_file);
+}
 
 /*
  * loop_change_fd switched the backing store of a loopback device to
@@ -670,9 +828,8 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 		goto out_putf;
 
 	/* and ... switch */
-	error = loop_switch(lo, file);
-	if (error)
-		goto out_putf;
+	loop_switch(lo, file);
+	__loop_update_dio(lo, lo->use_dio);
 
 	fput(old_file);
 	if (lo->lo_flags & LO_FLAGS_PARTSCAN)
@@ -759,11 +916,19 @@ static ssize_t loop_attr_partscan_show(struct loop_device *lo, char *buf)
 	return sprintf(buf, "%s\n", partscan ? "1" : "0");
 }
 
+static ssize_t loop_attr_dio_show(struct loop_device *lo, char *buf)
+{
+	int dio = (lo->lo_flags & LO_FLAGS_DIRECT_IO);
+
+	return sprintf(buf, "%s\n", dio ? "1" : "0");
+}
+
 LOOP_ATTR_RO(backing_file);
 LOOP_ATTR_RO(offset);
 LOOP_ATTR_RO(sizelimit);
 LOOP_ATTR_RO(autoclear);
 LOOP_ATTR_RO(partscan);
+LOOP_ATTR_RO(dio);
 
 static struct attribute *loop_attrs[] = {
 	&loop_attr_backing_file.attr,
@@ -771,6 +936,7 @@ static struct attribute *loop_attrs[] = {
 	&loop_attr_sizelimit.attr,
 	&loop_attr_autoclear.attr,
 	&loop_attr_partscan.attr,
+	&loop_attr_dio.attr,
 	NULL,
 };
 
@@ -878,6 +1044,14 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 	if ((loff_t)(sector_t)size != size)
 		goto out_putf;
 
+	lo->wq = alloc_workqueue("kloopd%d",
+			WQ_MEM_RECLAIM | WQ_HIGHPRI | WQ_UNBOUND, 16,
+			lo->lo_number);
+	if (!lo->wq) {
+		error = -ENOMEM;
+		goto out_putf;
+	}
+
 	error = 0;
 
 	set_device_ro(bdev, (lo_flags & LO_FLAGS_READ_ONLY) != 0);
@@ -889,12 +1063,9 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 	lo->transfer = transfer_none;
 	lo->ioctl = NULL;
 	lo->lo_sizelimit = 0;
-	lo->lo_bio_count = 0;
 	lo->old_gfp_mask = mapping_gfp_mask(mapping);
 	mapping_set_gfp_mask(mapping, lo->old_gfp_mask & ~(__GFP_IO|__GFP_FS));
 
-	bio_list_init(&lo->lo_bio_list);
-
 	if (!(lo_flags & LO_FLAGS_READ_ONLY) && file->f_op->fsync)
 		blk_queue_flush(lo->lo_queue, REQ_FLUSH);
 
@@ -906,14 +1077,8 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 
 	set_blocksize(bdev, lo_blocksize);
 
-	lo->lo_thread = kthread_create(loop_thread, lo, "loop%d",
-						lo->lo_number);
-	if (IS_ERR(lo->lo_thread)) {
-		error = PTR_ERR(lo->lo_thread);
-		goto out_clr;
-	}
 	lo->lo_state = Lo_bound;
-	wake_up_process(lo->lo_thread);
+	__loop_update_dio(lo, (file->f_flags & O_DIRECT) != 0);
 	if (part_shift)
 		lo->lo_flags |= LO_FLAGS_PARTSCAN;
 	if (lo->lo_flags & LO_FLAGS_PARTSCAN)
@@ -925,18 +1090,6 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 	bdgrab(bdev);
 	return 0;
 
-out_clr:
-	loop_sysfs_exit(lo);
-	lo->lo_thread = NULL;
-	lo->lo_device = NULL;
-	lo->lo_backing_file = NULL;
-	lo->lo_flags = 0;
-	set_capacity(lo->lo_disk, 0);
-	invalidate_bdev(bdev);
-	bd_set_size(bdev, 0);
-	kobject_uevent(&disk_to_dev(bdev->bd_disk)->kobj, KOBJ_CHANGE);
-	mapping_set_gfp_mask(mapping, lo->old_gfp_mask);
-	lo->lo_state = Lo_unbound;
  out_putf:
 	fput(file);
  out:
@@ -985,6 +1138,7 @@ loop_init_xfer(struct loop_device *lo, struct loop_func_table *xfer,
 static int loop_clr_fd(struct loop_device *lo)
 {
 	struct file *filp = lo->lo_backing_file;
+	struct file *dio_file = lo->lo_dio_file;
 	gfp_t gfp = lo->old_gfp_mask;
 	struct block_device *bdev = lo->lo_device;
 
@@ -1010,15 +1164,22 @@ static int loop_clr_fd(struct loop_device *lo)
 	if (filp == NULL)
 		return -EINVAL;
 
+	/*
+	 * Once the queue is frozen nothing is in flight, and requests
+	 * issued after it thaws are failed by loop_queue_rq().
+	 */
+	blk_mq_freeze_queue(lo->lo_queue);
+
 	spin_lock_irq(&lo->lo_lock);
 	lo->lo_state = Lo_rundown;
+	lo->lo_backing_file = NULL;
+	lo->lo_dio_file = NULL;
 	spin_unlock_irq(&lo->lo_lock);
 
-	kthread_stop(lo->lo_thread);
+	blk_mq_unfreeze_queue(lo->lo_queue);
 
-	spin_lock_irq(&lo->lo_lock);
-	lo->lo_backing_file = NULL;
-	spin_unlock_irq(&lo->lo_lock);
+	destroy_workqueue(lo->wq);
+	lo->wq = NULL;
 
 	loop_release_xfer(lo);
 	lo->transfer = NULL;
@@ -1028,7 +1189,7 @@ static int loop_clr_fd(struct loop_device *lo)
 	lo->lo_offset = 0;
 	lo->lo_sizelimit = 0;
 	lo->lo_encrypt_key_size = 0;
-	lo->lo_thread = NULL;
+	lo->use_dio = false;
 	memset(lo->lo_encrypt_key, 0, LO_KEY_SIZE);
 	memset(lo->lo_crypt_name, 0, LO_NAME_SIZE);
 	memset(lo->lo_file_name, 0, LO_NAME_SIZE);
@@ -1060,6 +1221,8 @@ static int loop_clr_fd(struct loop_device *lo)
 	 * bd_mutex which is usually taken before lo_ctl_mutex.
 	 */
 	fput(filp);
+	if (dio_file)
+		fput(dio_file);
 	return 0;
 }
 
@@ -1079,29 +1242,39 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 	if ((unsigned int) info->lo_encrypt_key_size > LO_KEY_SIZE)
 		return -EINVAL;
 
+	/*
+	 * Drain the I/O in flight, none of it may see the transfer function
+	 * or offset change under it, or direct I/O still being used with a
+	 * transfer function.
+	 */
+	blk_mq_freeze_queue(lo->lo_queue);
+
 	err = loop_release_xfer(lo);
 	if (err)
-		return err;
+		goto exit;
 
 	if (info->lo_encrypt_type) {
 		unsigned int type = info->lo_encrypt_type;
 
+		err = -EINVAL;
 		if (type >= MAX_LO_CRYPT)
-			return -EINVAL;
+			goto exit;
 		xfer = xfer_funcs[type];
 		if (xfer == NULL)
-			return -EINVAL;
+			goto exit;
 	} else
 		xfer = NULL;
 
 	err = loop_init_xfer(lo, xfer, info);
 	if (err)
-		return err;
+		goto exit;
 
 	if (lo->lo_offset != info->lo_offset ||
 	    lo->lo_sizelimit != info->lo_sizelimit)
-		if (figure_loop_size(lo, info->lo_offset, info->lo_sizelimit))
-			return -EFBIG;
+		if (figure_loop_size(lo, info->lo_offset, info->lo_sizelimit)) {
+			err = -EFBIG;
+			goto exit;
+		}
 
 	loop_config_discard(lo);
 
@@ -1115,6 +1288,20 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 	lo->transfer = xfer->transfer;
 	lo->ioctl = xfer->ioctl;
 
+	lo->lo_encrypt_key_size = info->lo_encrypt_key_size;
+	lo->lo_init[0] = info->lo_init[0];
+	lo->lo_init[1] = info->lo_init[1];
+	if (info->lo_encrypt_key_size) {
+		memcpy(lo->lo_encrypt_key, info->lo_encrypt_key,
+		       info->lo_encrypt_key_size);
+		lo->lo_key_owner = uid;
+	}	
+
+	/* the offset or transfer function may have changed */
+	__loop_update_dio(lo, lo->use_dio);
+
+	blk_mq_unfreeze_queue(lo->lo_queue);
+
 	if ((lo->lo_flags & LO_FLAGS_AUTOCLEAR) !=
 	     (info->lo_flags & LO_FLAGS_AUTOCLEAR))
 		lo->lo_flags ^= LO_FLAGS_AUTOCLEAR;
@@ -1126,16 +1313,11 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		ioctl_by_bdev(lo->lo_device, BLKRRPART, 0);
 	}
 
-	lo->lo_encrypt_key_size = info->lo_encrypt_key_size;
-	lo->lo_init[0] = info->lo_init[0];
-	lo->lo_init[1] = info->lo_init[1];
-	if (info->lo_encrypt_key_size) {
-		memcpy(lo->lo_encrypt_key, info->lo_encrypt_key,
-		       info->lo_encrypt_key_size);
-		lo->lo_key_owner = uid;
-	}	
-
 	return 0;
+
+exit:
+	blk_mq_unfreeze_queue(lo->lo_queue);
+	return err;
 }
 
 static int
@@ -1285,6 +1467,17 @@ static int loop_set_capacity(struct loop_device *lo, struct block_device *bdev)
 	return figure_loop_size(lo, lo->lo_offset, lo->lo_sizelimit);
 }
 
+static int loop_set_dio(struct loop_device *lo, unsigned long arg)
+{
+	if (lo->lo_state != Lo_bound)
+		return -ENXIO;
+
+	__loop_update_dio(lo, !!arg);
+	if (lo->use_dio == !!(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		return 0;
+	return -EINVAL;
+}
+
 static int lo_ioctl(struct block_device *bdev, fmode_t mode,
 	unsigned int cmd, unsigned long arg)
 {
@@ -1328,6 +1521,11 @@ static int lo_ioctl(struct block_device *bdev, fmode_t mode,
 		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
 			err = loop_set_capacity(lo, bdev);
 		break;
+	case LOOP_SET_DIRECT_IO:
+		err = -EPERM;
+		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
+			err = loop_set_dio(lo, arg);
+		break;
 	default:
 		err = lo->ioctl ? lo->ioctl(lo, cmd, arg) : -EINVAL;
 	}
@@ -1482,6 +1680,7 @@ static int lo_compat_ioctl(struct block_device *bdev, fmode_t mode,
 		arg = (unsigned long) compat_ptr(arg);
 	case LOOP_SET_FD:
 	case LOOP_CHANGE_FD:
+	case LOOP_SET_DIRECT_IO:
 		err = lo_ioctl(bdev, mode, cmd, arg);
 		break;
 	default:
@@ -1524,7 +1723,7 @@ static void lo_release(struct gendisk *disk, fmode_t mode)
 
 	if (lo->lo_flags & LO_FLAGS_AUTOCLEAR) {
 		/*
-		 * In autoclear mode, stop the loop thread
+		 * In autoclear mode, stop the loop workqueue
 		 * and remove configuration after last close.
 		 */
 		err = loop_clr_fd(lo);
@@ -1532,8 +1731,8 @@ static void lo_release(struct gendisk *disk, fmode_t mode)
 			return;
 	} else {
 		/*
-		 * Otherwise keep thread (if running) and config,
-		 * but flush possible ongoing bios in thread.
+		 * Otherwise keep workqueue (if bound) and config,
+		 * but wait for the requests still in flight.
 		 */
 		loop_flush(lo);
 	}
@@ -1626,17 +1825,30 @@ static int loop_add(struct loop_device **l, int i)
 		goto out_free_dev;
 	i = err;
 
-	err = -ENOMEM;
-	lo->lo_queue = blk_alloc_queue(GFP_KERNEL);
-	if (!lo->lo_queue)
+	lo->tag_set.ops = &loop_mq_ops;
+	lo->tag_set.nr_hw_queues = 1;
+	lo->tag_set.queue_depth = 128;
+	lo->tag_set.numa_node = NUMA_NO_NODE;
+	lo->tag_set.cmd_size = sizeof(struct loop_cmd);
+	lo->tag_set.flags = BLK_MQ_F_SHOULD_MERGE;
+	lo->tag_set.driver_data = lo;
+
+	err = blk_mq_alloc_tag_set(&lo->tag_set);
+	if (err)
 		goto out_free_idr;
 
-	/*
-	 * set queue make_request_fn
-	 */
-	blk_queue_make_request(lo->lo_queue, loop_make_request);
+	lo->lo_queue = blk_mq_init_queue(&lo->tag_set);
+	if (IS_ERR(lo->lo_queue)) {
+		err = -ENOMEM;
+		goto out_cleanup_tags;
+	}
 	lo->lo_queue->queuedata = lo;
 
+	INIT_LIST_HEAD(&lo->write_cmd_head);
+	INIT_WORK(&lo->write_work, loop_queue_write_work);
+
+	err = -ENOMEM;
+
 	disk = lo->lo_disk = alloc_disk(1 << part_shift);
 	if (!disk)
 		goto out_free_queue;
@@ -1664,9 +1876,6 @@ static int loop_add(struct loop_device **l, int i)
 	disk->flags |= GENHD_FL_EXT_DEVT;
 	mutex_init(&lo->lo_ctl_mutex);
 	lo->lo_number		= i;
-	lo->lo_thread		= NULL;
-	init_waitqueue_head(&lo->lo_event);
-	init_waitqueue_head(&lo->lo_req_wait);
 	spin_lock_init(&lo->lo_lock);
 	disk->major		= LOOP_MAJOR;
 	disk->first_minor	= i << part_shift;
@@ -1680,6 +1889,8 @@ static int loop_add(struct loop_device **l, int i)
 
 out_free_queue:
 	blk_cleanup_queue(lo->lo_queue);
+out_cleanup_tags:
+	blk_mq_free_tag_set(&lo->tag_set);
 out_free_idr:
 	idr_remove(&loop_index_idr, i);
 out_free_dev:
@@ -1692,6 +1903,7 @@ static void loop_remove(struct loop_device *lo)
 {
 	del_gendisk(lo->lo_disk);
 	blk_cleanup_queue(lo->lo_queue);
+	blk_mq_free_tag_set(&lo->tag_set);
 	put_disk(lo->lo_disk);
 	kfree(lo);
 }
@@ -56,26 +56,37 @@ static unsigned int debugflags;
 #endif /* NDEBUG */
 
 static unsigned int nbds_max = 16;
+static unsigned int max_connections = 4;
 static struct nbd_device *nbd_dev;
 static int max_part;
 
 /*
- * Use just one lock (or at most 1 per NIC). Two arguments for this:
- * 1. Each NIC is essentially a synchronization point for all servers
- *    accessed through that NIC so there's no need to have more locks
- *    than NICs anyway.
- * 2. More locks lead to more "Dirty cache line bouncing" which will slow
- *    down each lock to the point where they're actually slower than just
- *    a single lock.
- * Thanks go to Jens Axboe and Al Viro for their LKML emails explaining this!
+ * Per-request driver data.  Requests are sent from a work item, as the
+ * send blocks on the socket, and the hardware queue they were issued on
+ * picks the connection they go out on.
  */
-static DEFINE_SPINLOCK(nbd_lock);
+struct nbd_cmd {
+	struct work_struct work;
+	struct nbd_device *nbd;
+	struct request *req;
+	struct list_head list;		/* on nbd_sock->queue_head */
+	unsigned int hwq;
+	int index;			/* connection the request went out on */
+};
+
+/*
+ * The handle sent to the server is the hardware queue and tag of the
+ * request, so replies are matched without searching.
+ */
+#define NBD_HANDLE_HWQ_SHIFT	16
+#define NBD_HANDLE_TAG_MASK	((1U << NBD_HANDLE_HWQ_SHIFT) - 1)
 
 #ifndef NDEBUG
 static const char *ioctl_cmd_to_ascii(int cmd)
 {
 	switch (cmd) {
 	case NBD_SET_SOCK: return "set-sock";
+	case NBD_ADD_SOCK: return "add-sock";
 	case NBD_SET_BLKSIZE: return "set-blksize";
 	case NBD_SET_SIZE: return "set-size";
 	case NBD_SET_TIMEOUT: return "set-timeout";
@@ -105,21 +116,23 @@ static const char *nbdcmd_to_ascii(int cmd)
 }
 #endif /* NDEBUG */
 
-static void nbd_end_request(struct request *req)
+static void nbd_complete_rq(struct request *req)
 {
 	int error = req->errors ? -EIO : 0;
-	struct request_queue *q = req->q;
-	unsigned long flags;
 
 	dprintk(DBG_BLKDEV, "%s: request %p: %s\n", req->rq_disk->disk_name,
 			req, error ? "failed" : "done");
 
-	spin_lock_irqsave(q->queue_lock, flags);
-	__blk_end_request_all(req, error);
-	spin_unlock_irqrestore(q->queue_lock, flags);
+	blk_mq_end_io(req, error);
 }
 
-static void sock_shutdown(struct nbd_device *nbd, int lock)
+static void nbd_end_request(struct request *req)
+{
+	blk_mq_complete_request(req);
+}
+
+static void nbd_sock_shutdown(struct nbd_device *nbd, struct nbd_sock *nsock,
+			      int lock)
 {
 	/* Forcibly shutdown the socket causing all listeners
 	 * to error
@@ -128,14 +141,27 @@ static void sock_shutdown(struct nbd_device *nbd, int lock)
 	 * there should be a more generic interface rather than
 	 * calling socket ops directly here */
 	if (lock)
-		mutex_lock(&nbd->tx_lock);
-	if (nbd->sock) {
-		dev_warn(disk_to_dev(nbd->disk), "shutting down socket\n");
-		kernel_sock_shutdown(nbd->sock, SHUT_RDWR);
-		nbd->sock = NULL;
+		mutex_lock(&nsock->tx_lock);
+	if (nsock->sock) {
+		dev_warn(disk_to_dev(nbd->disk), "shutting down socket %d\n",
+			 (int)(nsock - nbd->socks));
+		kernel_sock_shutdown(nsock->sock, SHUT_RDWR);
 	}
 	if (lock)
-		mutex_unlock(&nbd->tx_lock);
+		mutex_unlock(&nsock->tx_lock);
+}
+
+/*
+ * Requests are spread over all connections, so the device can't go on
+ * with any of them gone: take them all down, which makes every receiver
+ * bail out.
+ */
+static void sock_shutdown(struct nbd_device *nbd)
+{
+	int i;
+
+	for (i = 0; i < nbd->num_connections; i++)
+		nbd_sock_shutdown(nbd, &nbd->socks[i], 1);
 }
 
 static void nbd_xmit_timeout(unsigned long arg)
@@ -150,10 +176,10 @@ static void nbd_xmit_timeout(unsigned long arg)
 /*
  *  Send or receive packet.
  */
-static int sock_xmit(struct nbd_device *nbd, int send, void *buf, int size,
-		int msg_flags)
+static int sock_xmit(struct nbd_device *nbd, struct nbd_sock *nsock, int send,
+		void *buf, int size, int msg_flags)
 {
-	struct socket *sock = nbd->sock;
+	struct socket *sock = nsock->sock;
 	int result;
 	struct msghdr msg;
 	struct kvec iov;
@@ -206,7 +232,7 @@ static int sock_xmit(struct nbd_device *nbd, int send, void *buf, int size,
 				task_pid_nr(current), current->comm,
 				dequeue_signal_lock(current, &current->blocked, &info));
 			result = -EINTR;
-			sock_shutdown(nbd, !send);
+			nbd_sock_shutdown(nbd, nsock, !send);
 			break;
 		}
 
@@ -225,19 +251,20 @@ static int sock_xmit(struct nbd_device *nbd, int send, void *buf, int size,
 	return result;
 }
 
-static inline int sock_send_bvec(struct nbd_device *nbd, struct bio_vec *bvec,
-		int flags)
+static inline int sock_send_bvec(struct nbd_device *nbd, struct nbd_sock *nsock,
+		struct bio_vec *bvec, int flags)
 {
 	int result;
 	void *kaddr = kmap(bvec->bv_page);
-	result = sock_xmit(nbd, 1, kaddr + bvec->bv_offset,
+	result = sock_xmit(nbd, nsock, 1, kaddr + bvec->bv_offset,
 			   bvec->bv_len, flags);
 	kunmap(bvec->bv_page);
 	return result;
 }
 
-/* always call with the tx_lock held */
-static int nbd_send_req(struct nbd_device *nbd, struct request *req)
+/* always call with the tx_lock of @nsock held */
+static int nbd_send_req(struct nbd_device *nbd, struct nbd_sock *nsock,
+			struct request *req, u32 handle)
 {
 	int result, flags;
 	struct nbd_request request;
@@ -254,14 +281,15 @@ static int nbd_send_req(struct nbd_device *nbd, struct request *req)
 		request.from = cpu_to_be64((u64)blk_rq_pos(req) << 9);
 		request.len = htonl(size);
 	}
-	memcpy(request.handle, &req, sizeof(req));
+	memset(request.handle, 0, sizeof(request.handle));
+	memcpy(request.handle, &handle, sizeof(handle));
 
 	dprintk(DBG_TX, "%s: request %p: sending control (%s@%llu,%uB)\n",
 			nbd->disk->disk_name, req,
 			nbdcmd_to_ascii(nbd_cmd(req)),
 			(unsigned long long)blk_rq_pos(req) << 9,
 			blk_rq_bytes(req));
-	result = sock_xmit(nbd, 1, &request, sizeof(request),
+	result = sock_xmit(nbd, nsock, 1, &request, sizeof(request),
 			(nbd_cmd(req) == NBD_CMD_WRITE) ? MSG_MORE : 0);
 	if (result <= 0) {
 		dev_err(disk_to_dev(nbd->disk),
@@ -282,7 +310,7 @@ static int nbd_send_req(struct nbd_device *nbd, struct request *req)
 				flags = MSG_MORE;
 			dprintk(DBG_TX, "%s: request %p: sending %d bytes data\n",
 					nbd->disk->disk_name, req, bvec.bv_len);
-			result = sock_send_bvec(nbd, &bvec, flags);
+			result = sock_send_bvec(nbd, nsock, &bvec, flags);
 			if (result <= 0) {
 				dev_err(disk_to_dev(nbd->disk),
 					"Send data failed (result %d)\n",
@@ -298,50 +326,65 @@ error_out:
 }
 
 static struct request *nbd_find_request(struct nbd_device *nbd,
-					struct request *xreq)
+					struct nbd_sock *nsock, u32 handle)
 {
-	struct request *req, *tmp;
-	int err;
+	unsigned int hwq = handle >> NBD_HANDLE_HWQ_SHIFT;
+	unsigned int tag = handle & NBD_HANDLE_TAG_MASK;
+	struct request *req;
+	struct nbd_cmd *cmd;
+	int err = -ENOENT;
+
+	if (hwq >= nbd->tag_set.nr_hw_queues ||
+	    tag >= nbd->tag_set.queue_depth)
+		goto out;
 
-	err = wait_event_interruptible(nbd->active_wq, nbd->active_req != xreq);
+	req = blk_mq_tag_to_rq(nbd->disk->queue->queue_hw_ctx[hwq], tag);
+	cmd = blk_mq_rq_to_pdu(req);
+
+	err = wait_event_interruptible(nsock->active_wq,
+				       nsock->active_req != req);
 	if (unlikely(err))
 		goto out;
 
-	spin_lock(&nbd->queue_lock);
-	list_for_each_entry_safe(req, tmp, &nbd->queue_head, queuelist) {
-		if (req != xreq)
-			continue;
-		list_del_init(&req->queuelist);
-		spin_unlock(&nbd->queue_lock);
+	/*
+	 * Only a request that went out on this connection and hasn't seen
+	 * its reply yet is on the list.
+	 */
+	err = -ENOENT;
+	spin_lock(&nsock->queue_lock);
+	if (!list_empty(&cmd->list) && cmd->index == nsock - nbd->socks) {
+		list_del_init(&cmd->list);
+		spin_unlock(&nsock->queue_lock);
 		return req;
 	}
-	spin_unlock(&nbd->queue_lock);
-
-	err = -ENOENT;
+	spin_unlock(&nsock->queue_lock);
 
 out:
 	return ERR_PTR(err);
 }
 
-static inline int sock_recv_bvec(struct nbd_device *nbd, struct bio_vec *bvec)
+static inline int sock_recv_bvec(struct nbd_device *nbd, struct nbd_sock *nsock,
+		struct bio_vec *bvec)
 {
 	int result;
 	void *kaddr = kmap(bvec->bv_page);
-	result = sock_xmit(nbd, 0, kaddr + bvec->bv_offset, bvec->bv_len,
+	result = sock_xmit(nbd, nsock, 0, kaddr + bvec->bv_offset, bvec->bv_len,
 			MSG_WAITALL);
 	kunmap(bvec->bv_page);
 	return result;
 }
 
 /* NULL returned = something went wrong, inform userspace */
-static struct request *nbd_read_stat(struct nbd_device *nbd)
+static struct request *nbd_read_stat(struct nbd_device *nbd,
+				     struct nbd_sock *nsock)
 {
 	int result;
 	struct nbd_reply reply;
 	struct request *req;
+	u32 handle;
 
 	reply.magic = 0;
-	result = sock_xmit(nbd, 0, &reply, sizeof(reply), MSG_WAITALL);
+	result = sock_xmit(nbd, nsock, 0, &reply, sizeof(reply), MSG_WAITALL);
 	if (result <= 0) {
 		dev_err(disk_to_dev(nbd->disk),
 			"Receive control failed (result %d)\n", result);
@@ -355,14 +398,15 @@ static struct request *nbd_read_stat(struct nbd_device *nbd)
 		goto harderror;
 	}
 
-	req = nbd_find_request(nbd, *(struct request **)reply.handle);
+	memcpy(&handle, reply.handle, sizeof(handle));
+	req = nbd_find_request(nbd, nsock, handle);
 	if (IS_ERR(req)) {
 		result = PTR_ERR(req);
 		if (result != -ENOENT)
 			goto harderror;
 
-		dev_err(disk_to_dev(nbd->disk), "Unexpected reply (%p)\n",
-			reply.handle);
+		dev_err(disk_to_dev(nbd->disk), "Unexpected reply (0x%x)\n",
+			handle);
 		result = -EBADR;
 		goto harderror;
 	}
@@ -381,7 +425,7 @@ static struct request *nbd_read_stat(struct nbd_device *nbd)
 		struct bio_vec bvec;
 
 		rq_for_each_segment(bvec, req, iter) {
-			result = sock_recv_bvec(nbd, &bvec);
+			result = sock_recv_bvec(nbd, nsock, &bvec);
 			if (result <= 0) {
 				dev_err(disk_to_dev(nbd->disk), "Receive data failed (result %d)\n",
 					result);
@@ -412,15 +456,32 @@ static struct device_attribute pid_attr = {
 	.show = pid_show,
 };
 
-static int nbd_do_it(struct nbd_device *nbd)
+/*
+ * One receiver per connection.  Whichever of them fails first takes all
+ * connections down, see sock_shutdown().
+ */
+static int nbd_recv_thread(void *data)
 {
+	struct nbd_sock *nsock = data;
+	struct nbd_device *nbd = nsock->nbd;
 	struct request *req;
-	int ret;
+
+	set_user_nice(current, -20);
+	while ((req = nbd_read_stat(nbd, nsock)) != NULL)
+		nbd_end_request(req);
+
+	sock_shutdown(nbd);
+	if (atomic_dec_and_test(&nbd->recv_threads))
+		wake_up(&nbd->recv_wq);
+	return 0;
+}
+
+static int nbd_do_it(struct nbd_device *nbd)
+{
+	int i, ret;
 
 	BUG_ON(nbd->magic != NBD_MAGIC);
 
-	sk_set_memalloc(nbd->sock->sk);
-	nbd->pid = task_pid_nr(current);
 	ret = device_create_file(disk_to_dev(nbd->disk), &pid_attr);
 	if (ret) {
 		dev_err(disk_to_dev(nbd->disk), "device_create_file failed!\n");
@@ -428,8 +489,27 @@ static int nbd_do_it(struct nbd_device *nbd)
 		return ret;
 	}
 
-	while ((req = nbd_read_stat(nbd)) != NULL)
-		nbd_end_request(req);
+	for (i = 0; i < nbd->num_connections; i++) {
+		struct nbd_sock *nsock = &nbd->socks[i];
+		struct task_struct *thread;
+
+		sk_set_memalloc(nsock->sock->sk);
+		atomic_inc(&nbd->recv_threads);
+		thread = kthread_run(nbd_recv_thread, nsock, "%s-recv%d",
+				     nbd->disk->disk_name, i);
+		if (IS_ERR(thread)) {
+			atomic_dec(&nbd->recv_threads);
+			nbd->harderror = PTR_ERR(thread);
+			sock_shutdown(nbd);
+			break;
+		}
+	}
+
+	/* a signal to nbd-client tears the connections down */
+	if (wait_event_interruptible(nbd->recv_wq,
+				     !atomic_read(&nbd->recv_threads)))
+		sock_shutdown(nbd);
+	wait_event(nbd->recv_wq, !atomic_read(&nbd->recv_threads));
 
 	device_remove_file(disk_to_dev(nbd->disk), &pid_attr);
 	nbd->pid = 0;
@@ -438,41 +518,69 @@ static int nbd_do_it(struct nbd_device *nbd)
 
 static void nbd_clear_que(struct nbd_device *nbd)
 {
-	struct request *req;
+	struct nbd_cmd *cmd, *tmp;
+	int i;
 
 	BUG_ON(nbd->magic != NBD_MAGIC);
 
 	/*
-	 * Because we have set nbd->sock to NULL under the tx_lock, all
-	 * modifications to the list must have completed by now.  For
-	 * the same reason, the active_req must be NULL.
-	 *
-	 * As a consequence, we don't need to take the spin lock while
-	 * purging the list here.
+	 * All sockets are gone and the send work has been flushed, so
+	 * nothing new gets onto the lists.  A receiver may still be around
+	 * after NBD_CLEAR_SOCK though, so take each request off under the
+	 * lock: whoever does that completes it.
 	 */
-	BUG_ON(nbd->sock);
-	BUG_ON(nbd->active_req);
+	for (i = 0; i < nbd->num_connections; i++) {
+		struct nbd_sock *nsock = &nbd->socks[i];
+		LIST_HEAD(list);
 
-	while (!list_empty(&nbd->queue_head)) {
-		req = list_entry(nbd->queue_head.next, struct request,
-				 queuelist);
-		list_del_init(&req->queuelist);
-		req->errors++;
-		nbd_end_request(req);
-	}
+		BUG_ON(nsock->sock);
+		BUG_ON(nsock->active_req);
 
-	while (!list_empty(&nbd->waiting_queue)) {
-		req = list_entry(nbd->waiting_queue.next, struct request,
-				 queuelist);
-		list_del_init(&req->queuelist);
-		req->errors++;
-		nbd_end_request(req);
+		spin_lock(&nsock->queue_lock);
+		list_splice_init(&nsock->queue_head, &list);
+		spin_unlock(&nsock->queue_lock);
+
+		list_for_each_entry_safe(cmd, tmp, &list, list) {
+			list_del_init(&cmd->list);
+			cmd->req->errors++;
+			nbd_end_request(cmd->req);
+		}
 	}
 }
 
+/*
+ * Detach all connections and fail whatever was still waiting for a reply.
+ * Senders only use a socket under its tx_lock, so once it has been
+ * cleared under that lock none of them can still be holding on to it.
+ */
+static void nbd_clear_socks(struct nbd_device *nbd)
+{
+	int i;
+
+	for (i = 0; i < nbd->num_connections; i++) {
+		struct nbd_sock *nsock = &nbd->socks[i];
+		struct socket *sock;
+
+		mutex_lock(&nsock->tx_lock);
+		sock = nsock->sock;
+		nsock->sock = NULL;
+		mutex_unlock(&nsock->tx_lock);
+		if (sock)
+			sockfd_put(sock);
+	}
+
+	flush_workqueue(nbd->send_wq);
+	nbd_clear_que(nbd);
+	nbd->num_connections = 0;
+}
 
-static void nbd_handle_req(struct nbd_device *nbd, struct request *req)
+static void nbd_handle_req(struct nbd_device *nbd, struct nbd_cmd *cmd)
 {
+	struct request *req = cmd->req;
+	struct nbd_sock *nsock;
+	bool failed = false;
+	int nr_conns;
+
 	if (req->cmd_type != REQ_TYPE_FS)
 		goto error_out;
 
@@ -497,29 +605,51 @@ static void nbd_handle_req(struct nbd_device *nbd, struct request *req)
 
 	req->errors = 0;
 
-	mutex_lock(&nbd->tx_lock);
-	if (unlikely(!nbd->sock)) {
-		mutex_unlock(&nbd->tx_lock);
+	nr_conns = ACCESS_ONCE(nbd->num_connections);
+	if (unlikely(!nr_conns)) {
 		dev_err(disk_to_dev(nbd->disk),
 			"Attempted send on closed socket\n");
 		goto error_out;
 	}
+	cmd->index = cmd->hwq % nr_conns;
+	nsock = &nbd->socks[cmd->index];
 
-	nbd->active_req = req;
+	mutex_lock(&nsock->tx_lock);
+	if (unlikely(!nsock->sock)) {
+		mutex_unlock(&nsock->tx_lock);
+		dev_err(disk_to_dev(nbd->disk),
+			"Attempted send on closed socket\n");
+		goto error_out;
+	}
+
+	nsock->active_req = req;
+
+	/*
+	 * Queue the request before sending it, the reply may well beat us
+	 * back from nbd_send_req().
+	 */
+	spin_lock(&nsock->queue_lock);
+	list_add_tail(&cmd->list, &nsock->queue_head);
+	spin_unlock(&nsock->queue_lock);
 
-	if (nbd_send_req(nbd, req) != 0) {
+	if (nbd_send_req(nbd, nsock, req,
+			 (cmd->hwq << NBD_HANDLE_HWQ_SHIFT) | req->tag) != 0) {
 		dev_err(disk_to_dev(nbd->disk), "Request send failed\n");
-		req->errors++;
-		nbd_end_request(req);
-	} else {
-		spin_lock(&nbd->queue_lock);
-		list_add_tail(&req->queuelist, &nbd->queue_head);
-		spin_unlock(&nbd->queue_lock);
+		spin_lock(&nsock->queue_lock);
+		if (!list_empty(&cmd->list)) {
+			list_del_init(&cmd->list);
+			failed = true;
+		}
+		spin_unlock(&nsock->queue_lock);
+		if (failed) {
+			req->errors++;
+			nbd_end_request(req);
+		}
 	}
 
-	nbd->active_req = NULL;
-	mutex_unlock(&nbd->tx_lock);
-	wake_up_all(&nbd->active_wq);
+	nsock->active_req = NULL;
+	mutex_unlock(&nsock->tx_lock);
+	wake_up_all(&nsock->active_wq);
 
 	return;
 
@@ -528,32 +658,11 @@ error_out:
 	nbd_end_request(req);
 }
 
-static int nbd_thread(void *data)
+static void nbd_send_work(struct work_struct *work)
 {
-	struct nbd_device *nbd = data;
-	struct request *req;
+	struct nbd_cmd *cmd = container_of(work, struct nbd_cmd, work);
 
-	set_user_nice(current, -20);
-	while (!kthread_should_stop() || !list_empty(&nbd->waiting_queue)) {
-		/* wait for something to do */
-		wait_event_interruptible(nbd->waiting_wq,
-					 kthread_should_stop() ||
-					 !list_empty(&nbd->waiting_queue));
-
-		/* extract request */
-		if (list_empty(&nbd->waiting_queue))
-			continue;
-
-		spin_lock_irq(&nbd->queue_lock);
-		req = list_entry(nbd->waiting_queue.next, struct request,
-				 queuelist);
-		list_del_init(&req->queuelist);
-		spin_unlock_irq(&nbd->queue_lock);
-
-		/* handle request */
-		nbd_handle_req(nbd, req);
-	}
-	return 0;
+	nbd_handle_req(cmd->nbd, cmd);
 }
 
 /*
@@ -563,43 +672,43 @@ static int nbd_thread(void *data)
  *   { printk( "Warning: Ignoring result!\n"); nbd_end_request( req ); }
  */
 
-static void do_nbd_request(struct request_queue *q)
-		__releases(q->queue_lock) __acquires(q->queue_lock)
+static int nbd_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *req)
 {
-	struct request *req;
-	
-	while ((req = blk_fetch_request(q)) != NULL) {
-		struct nbd_device *nbd;
-
-		spin_unlock_irq(q->queue_lock);
-
-		dprintk(DBG_BLKDEV, "%s: request %p: dequeued (flags=%x)\n",
-				req->rq_disk->disk_name, req, req->cmd_type);
+	struct nbd_cmd *cmd = blk_mq_rq_to_pdu(req);
+	struct nbd_device *nbd = cmd->nbd;
 
-		nbd = req->rq_disk->private_data;
+	dprintk(DBG_BLKDEV, "%s: request %p: dequeued (flags=%x)\n",
+			req->rq_disk->disk_name, req, req->cmd_type);
 
-		BUG_ON(nbd->magic != NBD_MAGIC);
-
-		if (unlikely(!nbd->sock)) {
-			dev_err(disk_to_dev(nbd->disk),
-				"Attempted send on closed socket\n");
-			req->errors++;
-			nbd_end_request(req);
-			spin_lock_irq(q->queue_lock);
-			continue;
-		}
+	BUG_ON(nbd->magic != NBD_MAGIC);
 
-		spin_lock_irq(&nbd->queue_lock);
-		list_add_tail(&req->queuelist, &nbd->waiting_queue);
-		spin_unlock_irq(&nbd->queue_lock);
+	/* sending blocks, so it is done from the send workqueue */
+	cmd->hwq = hctx->queue_num;
+	queue_work(nbd->send_wq, &cmd->work);
+	return BLK_MQ_RQ_QUEUE_OK;
+}
 
-		wake_up(&nbd->waiting_wq);
+static int nbd_init_request(void *data, struct request *req,
+		unsigned int hctx_idx, unsigned int request_idx,
+		unsigned int numa_node)
+{
+	struct nbd_cmd *cmd = blk_mq_rq_to_pdu(req);
 
-		spin_lock_irq(q->queue_lock);
-	}
+	cmd->nbd = data;
+	cmd->req = req;
+	INIT_WORK(&cmd->work, nbd_send_work);
+	INIT_LIST_HEAD(&cmd->list);
+	return 0;
 }
 
-/* Must be called with tx_lock held */
+static struct blk_mq_ops nbd_mq_ops = {
+	.queue_rq	= nbd_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+	.init_request	= nbd_init_request,
+	.complete	= nbd_complete_rq,
+};
+
+/* Must be called with config_lock held */
 
 static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *nbd,
 		       unsigned int cmd, unsigned long arg)
@@ -607,48 +716,63 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *nbd,
 	switch (cmd) {
 	case NBD_DISCONNECT: {
 		struct request sreq;
+		int i;
 
 		dev_info(disk_to_dev(nbd->disk), "NBD_DISCONNECT\n");
-		if (!nbd->sock)
+		if (!nbd->num_connections)
 			return -EINVAL;
 
-		mutex_unlock(&nbd->tx_lock);
+		mutex_unlock(&nbd->config_lock);
 		fsync_bdev(bdev);
-		mutex_lock(&nbd->tx_lock);
+		mutex_lock(&nbd->config_lock);
 		blk_rq_init(NULL, &sreq);
 		sreq.cmd_type = REQ_TYPE_SPECIAL;
 		nbd_cmd(&sreq) = NBD_CMD_DISC;
 
 		/* Check again after getting mutex back.  */
-		if (!nbd->sock)
+		if (!nbd->num_connections)
 			return -EINVAL;
 
 		nbd->disconnect = 1;
 
-		nbd_send_req(nbd, &sreq);
+		/* the server may be serving each connection separately */
+		for (i = 0; i < nbd->num_connections; i++) {
+			struct nbd_sock *nsock = &nbd->socks[i];
+
+			mutex_lock(&nsock->tx_lock);
+			if (nsock->sock)
+				nbd_send_req(nbd, nsock, &sreq, 0);
+			mutex_unlock(&nsock->tx_lock);
+		}
 		return 0;
 	}
  
-	case NBD_CLEAR_SOCK: {
-		struct socket *sock = nbd->sock;
-		nbd->sock = NULL;
-		nbd_clear_que(nbd);
-		BUG_ON(!list_empty(&nbd->queue_head));
-		BUG_ON(!list_empty(&nbd->waiting_queue));
+	case NBD_CLEAR_SOCK:
+		nbd_clear_socks(nbd);
 		kill_bdev(bdev);
-		if (sock)
-			sockfd_put(sock);
 		return 0;
-	}
 
-	case NBD_SET_SOCK: {
+	case NBD_SET_SOCK:
+		if (nbd->num_connections)
+			return -EBUSY;
+		/* fall through */
+	case NBD_ADD_SOCK: {
+		struct nbd_sock *nsock;
 		struct socket *sock;
 		int err;
-		if (nbd->sock)
+
+		/* connections can't be added to a running device */
+		if (nbd->pid)
 			return -EBUSY;
+		if (nbd->num_connections >= max_connections)
+			return -ENOSPC;
 		sock = sockfd_lookup(arg, &err);
 		if (sock) {
-			nbd->sock = sock;
+			nsock = &nbd->socks[nbd->num_connections];
+			mutex_lock(&nsock->tx_lock);
+			nsock->sock = sock;
+			mutex_unlock(&nsock->tx_lock);
+			nbd->num_connections++;
 			if (max_part > 0)
 				bdev->bd_invalidated = 1;
 			nbd->disconnect = 0; /* we're connected now */
@@ -688,16 +812,16 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *nbd,
 		return 0;
 
 	case NBD_DO_IT: {
-		struct task_struct *thread;
-		struct socket *sock;
 		int error;
 
 		if (nbd->pid)
 			return -EBUSY;
-		if (!nbd->sock)
+		if (!nbd->num_connections)
 			return -EINVAL;
 
-		mutex_unlock(&nbd->tx_lock);
+		/* claim the device before the lock is dropped */
+		nbd->pid = task_pid_nr(current);
+		mutex_unlock(&nbd->config_lock);
 
 		if (nbd->flags & NBD_FLAG_READ_ONLY)
 			set_device_ro(bdev, true);
@@ -709,29 +833,17 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *nbd,
 		else
 			blk_queue_flush(nbd->disk->queue, 0);
 
-		thread = kthread_create(nbd_thread, nbd, "%s",
-					nbd->disk->disk_name);
-		if (IS_ERR(thread)) {
-			mutex_lock(&nbd->tx_lock);
-			return PTR_ERR(thread);
-		}
-		wake_up_process(thread);
 		error = nbd_do_it(nbd);
-		kthread_stop(thread);
 
-		mutex_lock(&nbd->tx_lock);
+		mutex_lock(&nbd->config_lock);
 		if (error)
 			return error;
-		sock_shutdown(nbd, 0);
-		sock = nbd->sock;
-		nbd->sock = NULL;
-		nbd_clear_que(nbd);
+		sock_shutdown(nbd);
+		nbd_clear_socks(nbd);
 		dev_warn(disk_to_dev(nbd->disk), "queue cleared\n");
 		kill_bdev(bdev);
 		queue_flag_clear_unlocked(QUEUE_FLAG_DISCARD, nbd->disk->queue);
 		set_device_ro(bdev, false);
-		if (sock)
-			sockfd_put(sock);
 		nbd->flags = 0;
 		nbd->bytesize = 0;
 		bdev->bd_inode->i_size = 0;
@@ -750,13 +862,20 @@ static int __nbd_ioctl(struct block_device *bdev, struct nbd_device *nbd,
 		 */
 		return 0;
 
-	case NBD_PRINT_DEBUG:
-		dev_info(disk_to_dev(nbd->disk),
-			"next = %p, prev = %p, head = %p\n",
-			nbd->queue_head.next, nbd->queue_head.prev,
-			&nbd->queue_head);
+	case NBD_PRINT_DEBUG: {
+		int i;
+
+		for (i = 0; i < nbd->num_connections; i++) {
+			struct nbd_sock *nsock = &nbd->socks[i];
+
+			dev_info(disk_to_dev(nbd->disk),
+				"sock %d: next = %p, prev = %p, head = %p\n",
+				i, nsock->queue_head.next,
+				nsock->queue_head.prev, &nsock->queue_head);
+		}
 		return 0;
 	}
+	}
 	return -ENOTTY;
 }
 
@@ -775,9 +894,9 @@ static int nbd_ioctl(struct block_device *bdev, fmode_t mode,
 	dprintk(DBG_IOCTL, "%s: nbd_ioctl cmd=%s(0x%x) arg=%lu\n",
 		nbd->disk->disk_name, ioctl_cmd_to_ascii(cmd), cmd, arg);
 
-	mutex_lock(&nbd->tx_lock);
+	mutex_lock(&nbd->config_lock);
 	error = __nbd_ioctl(bdev, nbd, cmd, arg);
-	mutex_unlock(&nbd->tx_lock);
+	mutex_unlock(&nbd->config_lock);
 
 	return error;
 }
@@ -831,20 +950,63 @@ static int __init nbd_init(void)
 	if (nbds_max > 1UL << (MINORBITS - part_shift))
 		return -EINVAL;
 
+	if (!max_connections)
+		return -EINVAL;
+
 	for (i = 0; i < nbds_max; i++) {
-		struct gendisk *disk = alloc_disk(1 << part_shift);
-		if (!disk)
+		struct nbd_device *nbd = &nbd_dev[i];
+		struct gendisk *disk;
+		int j;
+
+		nbd->socks = kcalloc(max_connections, sizeof(*nbd->socks),
+				     GFP_KERNEL);
+		if (!nbd->socks)
 			goto out;
-		nbd_dev[i].disk = disk;
+		for (j = 0; j < max_connections; j++) {
+			struct nbd_sock *nsock = &nbd->socks[j];
+
+			nsock->nbd = nbd;
+			spin_lock_init(&nsock->queue_lock);
+			INIT_LIST_HEAD(&nsock->queue_head);
+			init_waitqueue_head(&nsock->active_wq);
+			mutex_init(&nsock->tx_lock);
+		}
+
+		nbd->send_wq = alloc_workqueue("knbd%d",
+				WQ_MEM_RECLAIM | WQ_HIGHPRI | WQ_UNBOUND, 0, i);
+		if (!nbd->send_wq)
+			goto out_free_socks;
+
+		/*
+		 * One hardware queue per connection the device may have, the
+		 * requests of each go out on their own socket.
+		 */
+		nbd->tag_set.ops = &nbd_mq_ops;
+		nbd->tag_set.nr_hw_queues = max_connections;
+		nbd->tag_set.queue_depth = 128;
+		nbd->tag_set.numa_node = NUMA_NO_NODE;
+		nbd->tag_set.cmd_size = sizeof(struct nbd_cmd);
+		nbd->tag_set.flags = BLK_MQ_F_SHOULD_MERGE;
+		nbd->tag_set.driver_data = nbd;
+
+		err = blk_mq_alloc_tag_set(&nbd->tag_set);
+		if (err)
+			goto out_free_wq;
+
+		err = -ENOMEM;
+		disk = alloc_disk(1 << part_shift);
+		if (!disk)
+			goto out_free_tags;
+		nbd->disk = disk;
 		/*
 		 * The new linux 2.5 block layer implementation requires
 		 * every gendisk to have its very own request_queue struct.
 		 * These structs are big so we dynamically allocate them.
 		 */
-		disk->queue = blk_init_queue(do_nbd_request, &nbd_lock);
-		if (!disk->queue) {
+		disk->queue = blk_mq_init_queue(&nbd->tag_set);
+		if (IS_ERR(disk->queue)) {
 			put_disk(disk);
-			goto out;
+			goto out_free_tags;
 		}
 		/*
 		 * Tell the block layer that we are not a rotational device
@@ -868,12 +1030,9 @@ static int __init nbd_init(void)
 	for (i = 0; i < nbds_max; i++) {
 		struct gendisk *disk = nbd_dev[i].disk;
 		nbd_dev[i].magic = NBD_MAGIC;
-		INIT_LIST_HEAD(&nbd_dev[i].waiting_queue);
-		spin_lock_init(&nbd_dev[i].queue_lock);
-		INIT_LIST_HEAD(&nbd_dev[i].queue_head);
-		mutex_init(&nbd_dev[i].tx_lock);
-		init_waitqueue_head(&nbd_dev[i].active_wq);
-		init_waitqueue_head(&nbd_dev[i].waiting_wq);
+		mutex_init(&nbd_dev[i].config_lock);
+		atomic_set(&nbd_dev[i].recv_threads, 0);
+		init_waitqueue_head(&nbd_dev[i].recv_wq);
 		nbd_dev[i].blksize = 1024;
 		nbd_dev[i].bytesize = 0;
 		disk->major = NBD_MAJOR;
@@ -886,10 +1045,20 @@ static int __init nbd_init(void)
 	}
 
 	return 0;
+
+out_free_tags:
+	blk_mq_free_tag_set(&nbd_dev[i].tag_set);
+out_free_wq:
+	destroy_workqueue(nbd_dev[i].send_wq);
+out_free_socks:
+	kfree(nbd_dev[i].socks);
 out:
 	while (i--) {
 		blk_cleanup_queue(nbd_dev[i].disk->queue);
 		put_disk(nbd_dev[i].disk);
+		blk_mq_free_tag_set(&nbd_dev[i].tag_set);
+		destroy_workqueue(nbd_dev[i].send_wq);
+		kfree(nbd_dev[i].socks);
 	}
 	kfree(nbd_dev);
 	return err;
@@ -905,6 +1074,9 @@ static void __exit nbd_cleanup(void)
 			del_gendisk(disk);
 			blk_cleanup_queue(disk->queue);
 			put_disk(disk);
+			blk_mq_free_tag_set(&nbd_dev[i].tag_set);
+			destroy_workqueue(nbd_dev[i].send_wq);
+			kfree(nbd_dev[i].socks);
 		}
 	}
 	unregister_blkdev(NBD_MAJOR, "nbd");
@@ -922,6 +1094,8 @@ module_param(nbds_max, int, 0444);
 MODULE_PARM_DESC(nbds_max, "number of network block devices to initialize (default: 16)");
 module_param(max_part, int, 0444);
 MODULE_PARM_DESC(max_part, "number of partitions per device (default: 0)");
+module_param(max_connections, uint, 0444);
+MODULE_PARM_DESC(max_connections, "maximum number of connections per device (default: 4)");
 #ifndef NDEBUG
 module_param(debugflags, int, 0644);
 MODULE_PARM_DESC(debugflags, "flags for controlling debug output");
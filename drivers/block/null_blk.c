@@ -8,6 +8,15 @@
 #include <linux/slab.h>
 #include <linux/blk-mq.h>
 #include <linux/hrtimer.h>
+#include <linux/highmem.h>
+#include <linux/radix-tree.h>
+#include <linux/random.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#define NULL_PAGE_SECTORS_SHIFT	(PAGE_SHIFT - 9)
+#define NULL_PAGE_SECTORS	(1 << NULL_PAGE_SECTORS_SHIFT)
 
 struct nullb_cmd {
 	struct list_head list;
@@ -17,33 +26,86 @@ struct nullb_cmd {
 	struct bio *bio;
 	unsigned int tag;
 	struct nullb_queue *nq;
+	struct hrtimer timer;
+	int error;
+
+	/* Stage timestamps, see null_account_cmd() */
+	u64 queued_ns;
+	u64 start_ns;
+	u64 hw_done_ns;
 };
 
 struct nullb_queue {
 	unsigned long *tag_map;
 	wait_queue_head_t wait;
 	unsigned int queue_depth;
+	struct nullb *nullb;
 
 	struct nullb_cmd *cmds;
 };
 
+/*
+ * The life of a request in the driver, as exported in debugfs:
+ *
+ * throttle:	waiting for bandwidth or IOPS budget on the emulated device
+ * device:	being serviced by the emulated device
+ * complete:	from the emulated interrupt to the request being ended
+ */
+enum {
+	NULL_STAGE_THROTTLE	= 0,
+	NULL_STAGE_DEVICE	= 1,
+	NULL_STAGE_COMPLETE	= 2,
+	NULL_STAGE_NR,
+};
+
+static const char *const null_stage_names[NULL_STAGE_NR] = {
+	"throttle", "device", "complete",
+};
+
+struct null_stage_stats {
+	u64 nr;
+	u64 total_ns[NULL_STAGE_NR];
+	u64 max_ns[NULL_STAGE_NR];
+};
+
 struct nullb {
 	struct list_head list;
 	unsigned int index;
 	struct request_queue *q;
 	struct gendisk *disk;
+	struct blk_mq_tag_set *tag_set;
+	struct blk_mq_tag_set __tag_set;
 	struct hrtimer timer;
 	unsigned int queue_depth;
 	spinlock_t lock;
 
 	struct nullb_queue *queues;
 	unsigned int nr_queues;
+
+	/* Written data when memory_backed is set, indexed by page */
+	struct radix_tree_root pages;
+	spinlock_t pages_lock;
+
+	/* When the emulated device is done with what it was given so far */
+	spinlock_t throttle_lock;
+	u64 next_free_ns;
+
+	struct null_stage_stats __percpu *stats;
+	struct dentry *debugfs;
 };
 
 static LIST_HEAD(nullb_list);
 static struct mutex lock;
 static int null_major;
 static int nullb_indexes;
+static struct blk_mq_tag_set tag_set;
+static struct dentry *null_debugfs_root;
+
+/*
+ * Set when completions in timer mode are timed per command rather than
+ * batched per cpu, i.e. when the latency varies or the device is throttled.
+ */
+static bool cmd_timers;
 
 struct completion_queue {
 	struct llist_head list;
@@ -68,6 +130,12 @@ enum {
 	NULL_Q_MQ		= 2,
 };
 
+enum {
+	NULL_LAT_FIXED		= 0,
+	NULL_LAT_UNIFORM	= 1,
+	NULL_LAT_BIMODAL	= 2,
+};
+
 static int submit_queues;
 module_param(submit_queues, int, S_IRUGO);
 MODULE_PARM_DESC(submit_queues, "Number of submission queues");
@@ -100,6 +168,38 @@ static int completion_nsec = 10000;
 module_param(completion_nsec, int, S_IRUGO);
 MODULE_PARM_DESC(completion_nsec, "Time in ns to complete a request in hardware. Default: 10,000ns");
 
+static int completion_dist = NULL_LAT_FIXED;
+module_param(completion_dist, int, S_IRUGO);
+MODULE_PARM_DESC(completion_dist, "Completion latency distribution in timer mode. 0-fixed, 1-uniform, 2-bimodal");
+
+static int completion_max_nsec;
+module_param(completion_max_nsec, int, S_IRUGO);
+MODULE_PARM_DESC(completion_max_nsec, "Upper bound of the uniform latency distribution. Default: completion_nsec");
+
+static int completion_slow_nsec = 1000000;
+module_param(completion_slow_nsec, int, S_IRUGO);
+MODULE_PARM_DESC(completion_slow_nsec, "Latency of slow requests in the bimodal distribution. Default: 1,000,000ns");
+
+static int completion_slow_pct = 1;
+module_param(completion_slow_pct, int, S_IRUGO);
+MODULE_PARM_DESC(completion_slow_pct, "Percentage of slow requests in the bimodal distribution. Default: 1");
+
+static unsigned int max_iops;
+module_param(max_iops, uint, S_IRUGO);
+MODULE_PARM_DESC(max_iops, "Limit each device to this many requests per second, 0 for no limit. Default: 0");
+
+static unsigned int max_mbps;
+module_param(max_mbps, uint, S_IRUGO);
+MODULE_PARM_DESC(max_mbps, "Limit each device to this bandwidth in MB/s, 0 for no limit. Default: 0");
+
+static bool memory_backed;
+module_param(memory_backed, bool, S_IRUGO);
+MODULE_PARM_DESC(memory_backed, "Store written data in memory and return it on reads. Default: false");
+
+static bool stage_stats;
+module_param(stage_stats, bool, S_IRUGO);
+MODULE_PARM_DESC(stage_stats, "Export per-stage request timings in debugfs. Default: false");
+
 static int hw_queue_depth = 64;
 module_param(hw_queue_depth, int, S_IRUGO);
 MODULE_PARM_DESC(hw_queue_depth, "Queue depth for each hardware queue. Default: 64");
@@ -108,6 +208,10 @@ static bool use_per_node_hctx = false;
 module_param(use_per_node_hctx, bool, S_IRUGO);
 MODULE_PARM_DESC(use_per_node_hctx, "Use per-node allocation for hardware context queues. Default: false");
 
+static bool shared_tags;
+module_param(shared_tags, bool, S_IRUGO);
+MODULE_PARM_DESC(shared_tags, "Share tag set between devices for blk-mq. Default: false");
+
 static void put_tag(struct nullb_queue *nq, unsigned int tag)
 {
 	clear_bit_unlock(tag, nq->tag_map);
@@ -172,41 +276,83 @@ static struct nullb_cmd *alloc_cmd(struct nullb_queue *nq, int can_wait)
 	return cmd;
 }
 
+static inline u64 null_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static void null_account_cmd(struct nullb_cmd *cmd)
+{
+	struct null_stage_stats *stats;
+	u64 lat[NULL_STAGE_NR];
+	unsigned long flags;
+	int i;
+
+	lat[NULL_STAGE_THROTTLE] = cmd->start_ns - cmd->queued_ns;
+	lat[NULL_STAGE_DEVICE] = cmd->hw_done_ns - cmd->start_ns;
+	lat[NULL_STAGE_COMPLETE] = null_now() - cmd->hw_done_ns;
+
+	/* commands are ended from both process and interrupt context */
+	local_irq_save(flags);
+	stats = this_cpu_ptr(cmd->nq->nullb->stats);
+	stats->nr++;
+	for (i = 0; i < NULL_STAGE_NR; i++) {
+		stats->total_ns[i] += lat[i];
+		if (lat[i] > stats->max_ns[i])
+			stats->max_ns[i] = lat[i];
+	}
+	local_irq_restore(flags);
+}
+
 static void end_cmd(struct nullb_cmd *cmd)
 {
+	if (stage_stats)
+		null_account_cmd(cmd);
+
 	switch (queue_mode)  {
 	case NULL_Q_MQ:
-		blk_mq_end_io(cmd->rq, 0);
+		blk_mq_end_io(cmd->rq, cmd->error);
 		return;
 	case NULL_Q_RQ:
 		INIT_LIST_HEAD(&cmd->rq->queuelist);
-		blk_end_request_all(cmd->rq, 0);
+		blk_end_request_all(cmd->rq, cmd->error);
 		break;
 	case NULL_Q_BIO:
-		bio_endio(cmd->bio, 0);
+		bio_endio(cmd->bio, cmd->error);
 		break;
 	}
 
 	free_cmd(cmd);
 }
 
-static enum hrtimer_restart null_cmd_timer_expired(struct hrtimer *timer)
+static int null_complete_cq(struct completion_queue *cq)
 {
-	struct completion_queue *cq;
 	struct llist_node *entry;
 	struct nullb_cmd *cmd;
+	int found = 0;
+	u64 now = 0;
 
-	cq = &per_cpu(completion_queues, smp_processor_id());
+	if (stage_stats)
+		now = null_now();
 
 	while ((entry = llist_del_all(&cq->list)) != NULL) {
 		entry = llist_reverse_order(entry);
 		do {
 			cmd = container_of(entry, struct nullb_cmd, ll_list);
-			end_cmd(cmd);
 			entry = entry->next;
+			cmd->hw_done_ns = now;
+			end_cmd(cmd);
+			found++;
 		} while (entry);
 	}
 
+	return found;
+}
+
+static enum hrtimer_restart null_cmd_timer_expired(struct hrtimer *timer)
+{
+	null_complete_cq(&per_cpu(completion_queues, smp_processor_id()));
+
 	return HRTIMER_NORESTART;
 }
 
@@ -229,31 +375,237 @@ static void null_softirq_done_fn(struct request *rq)
 	end_cmd(rq->special);
 }
 
+static void null_complete_cmd(struct nullb_cmd *cmd)
+{
+	switch (queue_mode)  {
+	case NULL_Q_MQ:
+		blk_mq_complete_request(cmd->rq);
+		break;
+	case NULL_Q_RQ:
+		blk_complete_request(cmd->rq);
+		break;
+	case NULL_Q_BIO:
+		/*
+		 * XXX: no proper submitting cpu information available.
+		 */
+		end_cmd(cmd);
+		break;
+	}
+}
+
+static enum hrtimer_restart null_cmd_timer_fn(struct hrtimer *timer)
+{
+	struct nullb_cmd *cmd = container_of(timer, struct nullb_cmd, timer);
+
+	if (stage_stats)
+		cmd->hw_done_ns = null_now();
+	null_complete_cmd(cmd);
+
+	return HRTIMER_NORESTART;
+}
+
+static void null_init_cmd_timer(struct nullb_cmd *cmd)
+{
+	hrtimer_init(&cmd->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	cmd->timer.function = null_cmd_timer_fn;
+}
+
+static unsigned int null_cmd_bytes(struct nullb_cmd *cmd)
+{
+	if (queue_mode == NULL_Q_BIO)
+		return cmd->bio->bi_iter.bi_size;
+	return blk_rq_bytes(cmd->rq);
+}
+
+static u64 null_cmd_latency(void)
+{
+	u32 spread = completion_max_nsec - completion_nsec + 1;
+
+	switch (completion_dist) {
+	case NULL_LAT_UNIFORM:
+		return completion_nsec + prandom_u32_max(spread);
+	case NULL_LAT_BIMODAL:
+		if (prandom_u32_max(100) < completion_slow_pct)
+			return completion_slow_nsec;
+		/* fall through */
+	default:
+		return completion_nsec;
+	}
+}
+
+/*
+ * The emulated device transfers one command at a time at the configured
+ * rate. Returns when it is done transferring @cmd, and records when it
+ * started.
+ */
+static u64 null_throttle(struct nullb *nullb, struct nullb_cmd *cmd, u64 now)
+{
+	u64 bytes = null_cmd_bytes(cmd);
+	unsigned long flags;
+	u64 cost = 0, start;
+
+	if (max_iops)
+		cost = div_u64(NSEC_PER_SEC, max_iops);
+	if (max_mbps)
+		cost = max(cost, div_u64(bytes * NSEC_PER_USEC, max_mbps));
+
+	if (!cost) {
+		cmd->start_ns = now;
+		return now;
+	}
+
+	spin_lock_irqsave(&nullb->throttle_lock, flags);
+	start = max(now, nullb->next_free_ns);
+	nullb->next_free_ns = start + cost;
+	spin_unlock_irqrestore(&nullb->throttle_lock, flags);
+
+	cmd->start_ns = start;
+	return start + cost;
+}
+
+static void null_cmd_end_delayed(struct nullb *nullb, struct nullb_cmd *cmd)
+{
+	u64 done = null_throttle(nullb, cmd, null_now()) + null_cmd_latency();
+
+	hrtimer_start(&cmd->timer, ns_to_ktime(done), HRTIMER_MODE_ABS);
+}
+
+static struct page *null_lookup_page(struct nullb *nullb, sector_t sector,
+				     bool alloc)
+{
+	pgoff_t idx = sector >> NULL_PAGE_SECTORS_SHIFT;
+	unsigned long flags;
+	struct page *page;
+
+	/* pages are only freed once the device is gone */
+	rcu_read_lock();
+	page = radix_tree_lookup(&nullb->pages, idx);
+	rcu_read_unlock();
+
+	if (page || !alloc)
+		return page;
+
+	/* We may be called from ->queue_rq(), which must not sleep */
+	page = alloc_page(GFP_ATOMIC | __GFP_ZERO | __GFP_HIGHMEM);
+	if (!page)
+		return NULL;
+
+	spin_lock_irqsave(&nullb->pages_lock, flags);
+	page->index = idx;
+	if (radix_tree_insert(&nullb->pages, idx, page)) {
+		__free_page(page);
+		page = radix_tree_lookup(&nullb->pages, idx);
+	}
+	spin_unlock_irqrestore(&nullb->pages_lock, flags);
+
+	return page;
+}
+
+static int null_transfer(struct nullb *nullb, struct page *page,
+			 unsigned int len, unsigned int off, bool is_write,
+			 sector_t sector)
+{
+	void *kaddr = kmap_atomic(page);
+	void *buf = kaddr + off;
+	unsigned int offset, chunk;
+	struct page *dpage;
+	void *dst;
+	int ret = 0;
+
+	while (len) {
+		offset = (sector & (NULL_PAGE_SECTORS - 1)) << 9;
+		chunk = min_t(unsigned int, len, PAGE_SIZE - offset);
+
+		dpage = null_lookup_page(nullb, sector, is_write);
+		if (dpage) {
+			dst = kmap_atomic(dpage);
+			if (is_write)
+				memcpy(dst + offset, buf, chunk);
+			else
+				memcpy(buf, dst + offset, chunk);
+			kunmap_atomic(dst);
+		} else if (is_write) {
+			ret = -ENOMEM;
+			break;
+		} else {
+			/* never written, reads back as zeroes */
+			memset(buf, 0, chunk);
+		}
+
+		buf += chunk;
+		len -= chunk;
+		sector += chunk >> 9;
+	}
+
+	kunmap_atomic(kaddr);
+	return ret;
+}
+
+static int null_handle_data(struct nullb *nullb, struct nullb_cmd *cmd)
+{
+	struct bio_vec bvec;
+	sector_t sector;
+	bool is_write;
+	int err;
+
+	if (queue_mode == NULL_Q_BIO) {
+		struct bvec_iter iter;
+		struct bio *bio = cmd->bio;
+
+		sector = bio->bi_iter.bi_sector;
+		is_write = bio_data_dir(bio) == WRITE;
+		bio_for_each_segment(bvec, bio, iter) {
+			err = null_transfer(nullb, bvec.bv_page, bvec.bv_len,
+					    bvec.bv_offset, is_write, sector);
+			if (err)
+				return err;
+			sector += bvec.bv_len >> 9;
+		}
+	} else {
+		struct req_iterator iter;
+		struct request *rq = cmd->rq;
+
+		if (rq->cmd_type != REQ_TYPE_FS)
+			return 0;
+
+		sector = blk_rq_pos(rq);
+		is_write = rq_data_dir(rq) == WRITE;
+		rq_for_each_segment(bvec, rq, iter) {
+			err = null_transfer(nullb, bvec.bv_page, bvec.bv_len,
+					    bvec.bv_offset, is_write, sector);
+			if (err)
+				return err;
+			sector += bvec.bv_len >> 9;
+		}
+	}
+
+	return 0;
+}
+
 static inline void null_handle_cmd(struct nullb_cmd *cmd)
 {
+	struct nullb *nullb = cmd->nq->nullb;
+
+	cmd->error = 0;
+	if (stage_stats)
+		cmd->queued_ns = cmd->start_ns = cmd->hw_done_ns = null_now();
+
+	if (memory_backed)
+		cmd->error = null_handle_data(nullb, cmd);
+
 	/* Complete IO by inline, softirq or timer */
 	switch (irqmode) {
 	case NULL_IRQ_SOFTIRQ:
-		switch (queue_mode)  {
-		case NULL_Q_MQ:
-			blk_mq_complete_request(cmd->rq);
-			break;
-		case NULL_Q_RQ:
-			blk_complete_request(cmd->rq);
-			break;
-		case NULL_Q_BIO:
-			/*
-			 * XXX: no proper submitting cpu information available.
-			 */
-			end_cmd(cmd);
-			break;
-		}
+		null_complete_cmd(cmd);
 		break;
 	case NULL_IRQ_NONE:
 		end_cmd(cmd);
 		break;
 	case NULL_IRQ_TIMER:
-		null_cmd_end_timer(cmd);
+		if (cmd_timers)
+			null_cmd_end_delayed(nullb, cmd);
+		else
+			null_cmd_end_timer(cmd);
 		break;
 	}
 }
@@ -320,10 +672,10 @@ static int null_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq)
 	return BLK_MQ_RQ_QUEUE_OK;
 }
 
-static struct blk_mq_hw_ctx *null_alloc_hctx(struct blk_mq_reg *reg, unsigned int hctx_index)
+static struct blk_mq_hw_ctx *null_alloc_hctx(struct blk_mq_tag_set *set, unsigned int hctx_index)
 {
-	int b_size = DIV_ROUND_UP(reg->nr_hw_queues, nr_online_nodes);
-	int tip = (reg->nr_hw_queues % nr_online_nodes);
+	int b_size = DIV_ROUND_UP(set->nr_hw_queues, nr_online_nodes);
+	int tip = (set->nr_hw_queues % nr_online_nodes);
 	int node = 0, i, n;
 
 	/*
@@ -338,7 +690,7 @@ static struct blk_mq_hw_ctx *null_alloc_hctx(struct blk_mq_reg *reg, unsigned in
 
 			tip--;
 			if (!tip)
-				b_size = reg->nr_hw_queues / nr_online_nodes;
+				b_size = set->nr_hw_queues / nr_online_nodes;
 		}
 	}
 
@@ -367,45 +719,185 @@ static void null_init_queue(struct nullb *nullb, struct nullb_queue *nq)
 
 	init_waitqueue_head(&nq->wait);
 	nq->queue_depth = nullb->queue_depth;
+	nq->nullb = nullb;
 }
 
-static int null_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
-			  unsigned int index)
+/*
+ * The tag set may be shared between devices, so the per-device queues are
+ * hooked up here rather than from ->init_hctx(), which only gets the
+ * set's driver_data.
+ */
+static void null_init_queues(struct nullb *nullb)
+{
+	struct request_queue *q = nullb->q;
+	struct blk_mq_hw_ctx *hctx;
+	struct nullb_queue *nq;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		nq = &nullb->queues[i];
+		hctx->driver_data = nq;
+		null_init_queue(nullb, nq);
+		nullb->nr_queues++;
+	}
+}
+
+/*
+ * Only timer completions are deferred, so that is the only mode where there
+ * is anything to poll for. Completions are still held back until the
+ * emulated completion_nsec has passed, polling just saves the wakeup.
+ * Per command timers are not polled, they complete in their own time.
+ */
+static int null_poll(struct blk_mq_hw_ctx *hctx)
 {
-	struct nullb *nullb = data;
-	struct nullb_queue *nq = &nullb->queues[index];
+	struct completion_queue *cq;
+	int found = 0;
+
+	if (irqmode != NULL_IRQ_TIMER || cmd_timers)
+		return -EOPNOTSUPP;
 
-	hctx->driver_data = nq;
-	null_init_queue(nullb, nq);
-	nullb->nr_queues++;
+	local_irq_disable();
+	cq = &per_cpu(completion_queues, smp_processor_id());
+	if (ktime_to_ns(hrtimer_get_remaining(&cq->timer)) <= 0)
+		found = null_complete_cq(cq);
+	local_irq_enable();
+
+	return found;
+}
 
+static int null_init_request(void *data, struct request *rq,
+		unsigned int hctx_idx, unsigned int request_idx,
+		unsigned int numa_node)
+{
+	null_init_cmd_timer(blk_mq_rq_to_pdu(rq));
 	return 0;
 }
 
 static struct blk_mq_ops null_mq_ops = {
 	.queue_rq       = null_queue_rq,
 	.map_queue      = blk_mq_map_queue,
-	.init_hctx	= null_init_hctx,
 	.complete	= null_softirq_done_fn,
+	.init_request	= null_init_request,
+	.poll		= null_poll,
 };
 
-static struct blk_mq_reg null_mq_reg = {
-	.ops		= &null_mq_ops,
-	.queue_depth	= 64,
-	.cmd_size	= sizeof(struct nullb_cmd),
-	.flags		= BLK_MQ_F_SHOULD_MERGE,
+/*
+ * Free all backing pages. This must only be called when there are no other
+ * users of the device.
+ */
+#define FREE_BATCH 16
+static void null_free_pages(struct nullb *nullb)
+{
+	unsigned long pos = 0;
+	struct page *pages[FREE_BATCH];
+	int nr_pages, i;
+
+	do {
+		nr_pages = radix_tree_gang_lookup(&nullb->pages,
+				(void **)pages, pos, FREE_BATCH);
+
+		for (i = 0; i < nr_pages; i++) {
+			pos = pages[i]->index;
+			radix_tree_delete(&nullb->pages, pos);
+			__free_page(pages[i]);
+		}
+
+		pos++;
+	} while (nr_pages == FREE_BATCH);
+}
+
+static int null_stats_show(struct seq_file *m, void *v)
+{
+	struct nullb *nullb = m->private;
+	struct null_stage_stats sum, *stats;
+	int cpu, i;
+
+	memset(&sum, 0, sizeof(sum));
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(nullb->stats, cpu);
+		sum.nr += stats->nr;
+		for (i = 0; i < NULL_STAGE_NR; i++) {
+			sum.total_ns[i] += stats->total_ns[i];
+			sum.max_ns[i] = max(sum.max_ns[i], stats->max_ns[i]);
+		}
+	}
+
+	seq_printf(m, "requests %llu\n", (unsigned long long)sum.nr);
+	for (i = 0; i < NULL_STAGE_NR; i++)
+		seq_printf(m, "%s_total_ns %llu\n%s_max_ns %llu\n",
+			   null_stage_names[i],
+			   (unsigned long long)sum.total_ns[i],
+			   null_stage_names[i],
+			   (unsigned long long)sum.max_ns[i]);
+	return 0;
+}
+
+static int null_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, null_stats_show, inode->i_private);
+}
+
+/*
+ * Any write resets the counters. This isn't synchronized against requests
+ * being ended, so only do it with the device idle.
+ */
+static ssize_t null_stats_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct nullb *nullb = file_inode(file)->i_private;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(nullb->stats, cpu), 0,
+		       sizeof(struct null_stage_stats));
+	return count;
+}
+
+static const struct file_operations null_stats_fops = {
+	.open		= null_stats_open,
+	.read		= seq_read,
+	.write		= null_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+	.owner		= THIS_MODULE,
 };
 
 static void null_del_dev(struct nullb *nullb)
 {
 	list_del_init(&nullb->list);
 
+	debugfs_remove(nullb->debugfs);
 	del_gendisk(nullb->disk);
 	blk_cleanup_queue(nullb->q);
+	if (queue_mode == NULL_Q_MQ && nullb->tag_set == &nullb->__tag_set)
+		blk_mq_free_tag_set(nullb->tag_set);
 	put_disk(nullb->disk);
+	null_free_pages(nullb);
+	free_percpu(nullb->stats);
 	kfree(nullb);
 }
 
+static int null_init_tag_set(struct blk_mq_tag_set *set)
+{
+	memset(set, 0, sizeof(*set));
+	set->ops = &null_mq_ops;
+	set->nr_hw_queues = submit_queues;
+	set->queue_depth = hw_queue_depth;
+	set->numa_node = home_node;
+	set->cmd_size = sizeof(struct nullb_cmd);
+	set->flags = BLK_MQ_F_SHOULD_MERGE;
+
+	if (use_per_node_hctx) {
+		set->ops->alloc_hctx = null_alloc_hctx;
+		set->ops->free_hctx = null_free_hctx;
+	} else {
+		set->ops->alloc_hctx = blk_mq_alloc_single_hw_queue;
+		set->ops->free_hctx = blk_mq_free_single_hw_queue;
+	}
+
+	return blk_mq_alloc_tag_set(set);
+}
+
 static int null_open(struct block_device *bdev, fmode_t mode)
 {
 	return 0;
@@ -442,6 +934,7 @@ static int setup_commands(struct nullb_queue *nq)
 		INIT_LIST_HEAD(&cmd->list);
 		cmd->ll_list.next = NULL;
 		cmd->tag = -1U;
+		null_init_cmd_timer(cmd);
 	}
 
 	return 0;
@@ -509,27 +1002,34 @@ static int null_add_dev(void)
 		return -ENOMEM;
 
 	spin_lock_init(&nullb->lock);
-
-	if (queue_mode == NULL_Q_MQ && use_per_node_hctx)
-		submit_queues = nr_online_nodes;
+	spin_lock_init(&nullb->pages_lock);
+	spin_lock_init(&nullb->throttle_lock);
+	INIT_RADIX_TREE(&nullb->pages, GFP_ATOMIC);
+
+	if (stage_stats) {
+		nullb->stats = alloc_percpu(struct null_stage_stats);
+		if (!nullb->stats)
+			goto err;
+	}
 
 	if (setup_queues(nullb))
 		goto err;
 
 	if (queue_mode == NULL_Q_MQ) {
-		null_mq_reg.numa_node = home_node;
-		null_mq_reg.queue_depth = hw_queue_depth;
-		null_mq_reg.nr_hw_queues = submit_queues;
-
-		if (use_per_node_hctx) {
-			null_mq_reg.ops->alloc_hctx = null_alloc_hctx;
-			null_mq_reg.ops->free_hctx = null_free_hctx;
+		if (shared_tags) {
+			nullb->tag_set = &tag_set;
 		} else {
-			null_mq_reg.ops->alloc_hctx = blk_mq_alloc_single_hw_queue;
-			null_mq_reg.ops->free_hctx = blk_mq_free_single_hw_queue;
+			nullb->tag_set = &nullb->__tag_set;
+			if (null_init_tag_set(nullb->tag_set))
+				goto queue_fail;
 		}
 
-		nullb->q = blk_mq_init_queue(&null_mq_reg, nullb);
+		nullb->q = blk_mq_init_queue(nullb->tag_set);
+		if (IS_ERR(nullb->q)) {
+			nullb->q = NULL;
+			goto tag_set_fail;
+		}
+		null_init_queues(nullb);
 	} else if (queue_mode == NULL_Q_BIO) {
 		nullb->q = blk_alloc_queue_node(GFP_KERNEL, home_node);
 		blk_queue_make_request(nullb->q, null_queue_bio);
@@ -550,10 +1050,15 @@ static int null_add_dev(void)
 
 	disk = nullb->disk = alloc_disk_node(1, home_node);
 	if (!disk) {
-queue_fail:
 		blk_cleanup_queue(nullb->q);
+tag_set_fail:
+		if (queue_mode == NULL_Q_MQ &&
+		    nullb->tag_set == &nullb->__tag_set)
+			blk_mq_free_tag_set(nullb->tag_set);
+queue_fail:
 		cleanup_queues(nullb);
 err:
+		free_percpu(nullb->stats);
 		kfree(nullb);
 		return -ENOMEM;
 	}
@@ -578,6 +1083,12 @@ err:
 	disk->queue		= nullb->q;
 	sprintf(disk->disk_name, "nullb%d", nullb->index);
 	add_disk(disk);
+
+	if (null_debugfs_root)
+		nullb->debugfs = debugfs_create_file(disk->disk_name,
+						     S_IRUGO | S_IWUSR,
+						     null_debugfs_root, nullb,
+						     &null_stats_fops);
 	return 0;
 }
 
@@ -592,18 +1103,35 @@ static int __init null_init(void)
 	}
 
 	if (queue_mode == NULL_Q_MQ && use_per_node_hctx) {
-		if (submit_queues < nr_online_nodes) {
+		if (submit_queues < nr_online_nodes)
 			pr_warn("null_blk: submit_queues param is set to %u.",
 							nr_online_nodes);
-			submit_queues = nr_online_nodes;
-		}
+		submit_queues = nr_online_nodes;
 	} else if (submit_queues > nr_cpu_ids)
 		submit_queues = nr_cpu_ids;
 	else if (!submit_queues)
 		submit_queues = 1;
 
+	if (completion_dist < NULL_LAT_FIXED ||
+	    completion_dist > NULL_LAT_BIMODAL) {
+		pr_warn("null_blk: invalid completion_dist, using fixed\n");
+		completion_dist = NULL_LAT_FIXED;
+	}
+
+	if (completion_max_nsec < completion_nsec)
+		completion_max_nsec = completion_nsec;
+
+	cmd_timers = completion_dist != NULL_LAT_FIXED || max_iops || max_mbps;
+	if (cmd_timers && irqmode != NULL_IRQ_TIMER) {
+		pr_warn("null_blk: latency and throttle need irqmode=2\n");
+		irqmode = NULL_IRQ_TIMER;
+	}
+
 	mutex_init(&lock);
 
+	if (stage_stats)
+		null_debugfs_root = debugfs_create_dir("null_blk", NULL);
+
 	/* Initialize a separate list for each CPU for issuing softirqs */
 	for_each_possible_cpu(i) {
 		struct completion_queue *cq = &per_cpu(completion_queues, i);
@@ -617,9 +1145,20 @@ static int __init null_init(void)
 		cq->timer.function = null_cmd_timer_expired;
 	}
 
+	if (queue_mode == NULL_Q_MQ && shared_tags) {
+		if (null_init_tag_set(&tag_set)) {
+			debugfs_remove(null_debugfs_root);
+			return -ENOMEM;
+		}
+	}
+
 	null_major = register_blkdev(0, "nullb");
-	if (null_major < 0)
+	if (null_major < 0) {
+		if (queue_mode == NULL_Q_MQ && shared_tags)
+			blk_mq_free_tag_set(&tag_set);
+		debugfs_remove(null_debugfs_root);
 		return null_major;
+	}
 
 	for (i = 0; i < nr_devices; i++) {
 		if (null_add_dev()) {
@@ -644,6 +1183,11 @@ static void __exit null_exit(void)
 		null_del_dev(nullb);
 	}
 	mutex_unlock(&lock);
+
+	if (queue_mode == NULL_Q_MQ && shared_tags)
+		blk_mq_free_tag_set(&tag_set);
+
+	debugfs_remove(null_debugfs_root);
 }
 
 module_init(null_init);
@@ -53,8 +53,16 @@ static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /* Flags for zram pages (table[page_no].flags) */
 enum zram_pageflags {
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/* Page is filled with one repeated word, kept in table.element */
+	ZRAM_SAME,
+	/* Page didn't compress below max_zpage_size, stored as is */
+	ZRAM_HUGE,
+	/* Page wasn't accessed since the slots were last marked idle */
+	ZRAM_IDLE,
+	/* Page was written back, table.element is the backing block */
+	ZRAM_WB,
+	/* Page is being written back */
+	ZRAM_UNDER_WB,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
@@ -63,7 +71,10 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	unsigned long handle;
+	union {
+		unsigned long handle;
+		unsigned long element;	/* ZRAM_SAME word or ZRAM_WB blk */
+	};
 	u16 size;	/* object size (excluding header) */
 	u8 flags;
 } __aligned(4);
@@ -77,7 +88,14 @@ struct zram_stats {
 	atomic64_t invalid_io;	/* non-page-aligned I/O requests */
 	atomic64_t notify_free;	/* no. of swap slot free notifications */
 	atomic64_t zero_pages;		/* no. of zero filled pages */
+	atomic64_t same_pages;		/* no. of same element filled pages */
 	atomic64_t pages_stored;	/* no. of pages currently stored */
+	atomic64_t huge_pages;		/* no. of incompressible pages */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	atomic64_t bd_count;		/* no. of backing device pages */
+	atomic64_t bd_reads;		/* no. of backing device reads */
+	atomic64_t bd_writes;		/* no. of backing device writes */
+#endif
 };
 
 struct zram_meta {
@@ -102,5 +120,13 @@ struct zram {
 	int max_comp_streams;
 	struct zram_stats stats;
 	char compressor[10];
+#ifdef CONFIG_ZRAM_WRITEBACK
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned int old_block_size;
+	/* allocated blocks of the backing device, block 0 is never used */
+	unsigned long *bitmap;
+	unsigned long nr_pages;
+#endif
 };
 #endif
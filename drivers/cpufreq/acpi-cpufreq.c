@@ -406,6 +406,35 @@ static unsigned int check_freqs(const struct cpumask *mask, unsigned int freq,
 	return 0;
 }
 
+static int prepare_drv_write(struct acpi_cpufreq_data *data,
+			     struct drv_cmd *cmd, unsigned int next_perf_state)
+{
+	struct acpi_processor_performance *perf = data->acpi_data;
+
+	switch (data->cpu_feature) {
+	case SYSTEM_INTEL_MSR_CAPABLE:
+		cmd->type = SYSTEM_INTEL_MSR_CAPABLE;
+		cmd->addr.msr.reg = MSR_IA32_PERF_CTL;
+		cmd->val = (u32) perf->states[next_perf_state].control;
+		break;
+	case SYSTEM_AMD_MSR_CAPABLE:
+		cmd->type = SYSTEM_AMD_MSR_CAPABLE;
+		cmd->addr.msr.reg = MSR_AMD_PERF_CTL;
+		cmd->val = (u32) perf->states[next_perf_state].control;
+		break;
+	case SYSTEM_IO_CAPABLE:
+		cmd->type = SYSTEM_IO_CAPABLE;
+		cmd->addr.io.port = perf->control_register.address;
+		cmd->addr.io.bit_width = perf->control_register.bit_width;
+		cmd->val = (u32) perf->states[next_perf_state].control;
+		break;
+	default:
+		return -ENODEV;
+	}
+
+	return 0;
+}
+
 static int acpi_cpufreq_target(struct cpufreq_policy *policy,
 			       unsigned int index)
 {
@@ -434,27 +463,9 @@ static int acpi_cpufreq_target(struct cpufreq_policy *policy,
 		}
 	}
 
-	switch (data->cpu_feature) {
-	case SYSTEM_INTEL_MSR_CAPABLE:
-		cmd.type = SYSTEM_INTEL_MSR_CAPABLE;
-		cmd.addr.msr.reg = MSR_IA32_PERF_CTL;
-		cmd.val = (u32) perf->states[next_perf_state].control;
-		break;
-	case SYSTEM_AMD_MSR_CAPABLE:
-		cmd.type = SYSTEM_AMD_MSR_CAPABLE;
-		cmd.addr.msr.reg = MSR_AMD_PERF_CTL;
-		cmd.val = (u32) perf->states[next_perf_state].control;
-		break;
-	case SYSTEM_IO_CAPABLE:
-		cmd.type = SYSTEM_IO_CAPABLE;
-		cmd.addr.io.port = perf->control_register.address;
-		cmd.addr.io.bit_width = perf->control_register.bit_width;
-		cmd.val = (u32) perf->states[next_perf_state].control;
-		break;
-	default:
-		result = -ENODEV;
+	result = prepare_drv_write(data, &cmd, next_perf_state);
+	if (result)
 		goto out;
-	}
 
 	/* cpufreq holds the hotplug lock, so we are safe from here on */
 	if (policy->shared_type != CPUFREQ_SHARED_TYPE_ANY)
@@ -480,6 +491,39 @@ out:
 	return result;
 }
 
+/*
+ * Called with interrupts off on a cpu of @policy, which only has more
+ * than one cpu if any of them can set the frequency for all.
+ */
+static unsigned int acpi_cpufreq_fast_switch(struct cpufreq_policy *policy,
+					     unsigned int target_freq)
+{
+	struct acpi_cpufreq_data *data = per_cpu(acfreq_data, policy->cpu);
+	struct acpi_processor_performance *perf = data->acpi_data;
+	unsigned int next_perf_state, index;
+	struct drv_cmd cmd;
+
+	if (cpufreq_frequency_table_target(policy, data->freq_table,
+					   target_freq, CPUFREQ_RELATION_L,
+					   &index))
+		return 0;
+
+	next_perf_state = data->freq_table[index].driver_data;
+	if (perf->state == next_perf_state) {
+		if (likely(!data->resume))
+			return data->freq_table[index].frequency;
+		data->resume = 0;
+	}
+
+	if (prepare_drv_write(data, &cmd, next_perf_state))
+		return 0;
+
+	do_drv_write(&cmd);
+	perf->state = next_perf_state;
+
+	return data->freq_table[index].frequency;
+}
+
 static unsigned long
 acpi_cpufreq_guess_freq(struct acpi_cpufreq_data *data, unsigned int cpu)
 {
@@ -712,6 +756,16 @@ static int acpi_cpufreq_cpu_init(struct cpufreq_policy *policy)
 	}
 #endif
 
+	/*
+	 * Fast switching writes only the local cpu's control register and
+	 * skips the transition notifiers, which the TSC code needs unless
+	 * it runs at a constant rate.
+	 */
+	policy->fast_switch_possible = !acpi_pstate_strict &&
+		cpu_has(c, X86_FEATURE_CONSTANT_TSC) &&
+		(!policy_is_shared(policy) ||
+		 policy->shared_type == CPUFREQ_SHARED_TYPE_ANY);
+
 	/* capability check */
 	if (perf->state_count <= 1) {
 		pr_debug("No P-States\n");
@@ -887,6 +941,7 @@ static struct freq_attr *acpi_cpufreq_attr[] = {
 static struct cpufreq_driver acpi_cpufreq_driver = {
 	.verify		= cpufreq_generic_frequency_table_verify,
 	.target_index	= acpi_cpufreq_target,
+	.fast_switch	= acpi_cpufreq_fast_switch,
 	.bios_limit	= acpi_processor_get_bios_limit,
 	.init		= acpi_cpufreq_cpu_init,
 	.exit		= acpi_cpufreq_cpu_exit,
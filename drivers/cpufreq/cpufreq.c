@@ -1160,6 +1160,9 @@ static int __cpufreq_add_dev(struct device *dev, struct subsys_interface *sif)
 		goto err_set_policy_cpu;
 	}
 
+	if (!cpufreq_driver->fast_switch)
+		policy->fast_switch_possible = false;
+
 	/* related cpus should atleast have policy->cpus */
 	cpumask_or(policy->related_cpus, policy->related_cpus, policy->cpus);
 
@@ -1885,6 +1888,34 @@ out:
 }
 EXPORT_SYMBOL_GPL(__cpufreq_driver_target);
 
+/**
+ * cpufreq_driver_fast_switch - switch frequency without sleeping
+ * @policy: policy to switch, with ->fast_switch_possible set
+ * @target_freq: new frequency, clamped to the policy limits
+ *
+ * Meant for governors running from scheduler context: the driver's
+ * ->fast_switch() runs with interrupts off on a cpu of @policy and no
+ * transition notifiers are sent.  Returns the frequency actually set, or
+ * 0 if it could not be changed.
+ */
+unsigned int cpufreq_driver_fast_switch(struct cpufreq_policy *policy,
+					unsigned int target_freq)
+{
+	unsigned int freq;
+
+	if (target_freq > policy->max)
+		target_freq = policy->max;
+	if (target_freq < policy->min)
+		target_freq = policy->min;
+
+	freq = cpufreq_driver->fast_switch(policy, target_freq);
+	if (freq)
+		policy->cur = freq;
+
+	return freq;
+}
+EXPORT_SYMBOL_GPL(cpufreq_driver_fast_switch);
+
 int cpufreq_driver_target(struct cpufreq_policy *policy,
 			  unsigned int target_freq,
 			  unsigned int relation)
@@ -0,0 +1,313 @@
+/*
+ *  linux/drivers/cpufreq/cpufreq_schedutil.c
+ *
+ *  CPUFreq governor picking frequencies from the scheduler's view of how
+ *  busy each cpu is, instead of sampling idle time from a timer.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/cpufreq.h>
+#include <linux/init.h>
+#include <linux/irq_work.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+/* Minimum time between two frequency changes of a policy, in usecs */
+static unsigned int rate_limit_us = 10000;
+module_param(rate_limit_us, uint, 0644);
+MODULE_PARM_DESC(rate_limit_us,
+		 "Minimum time between frequency changes (usecs)");
+
+struct sugov_policy {
+	struct cpufreq_policy *policy;
+
+	raw_spinlock_t update_lock;	/* protects all of the below */
+	u64 last_freq_update_time;
+	unsigned int next_freq;
+	bool work_in_progress;
+	bool need_freq_update;
+
+	/* slow path, for drivers that can't switch from scheduler context */
+	struct irq_work irq_work;
+	struct work_struct work;
+	struct mutex work_lock;		/* serializes driver calls */
+};
+
+struct sugov_cpu {
+	struct update_util_data update_util;
+	struct sugov_policy *sg_policy;
+
+	/* last update from the scheduler, under sg_policy->update_lock */
+	unsigned long util;
+	unsigned long max;
+	u64 last_update;
+};
+
+static DEFINE_PER_CPU(struct sugov_cpu, sugov_cpu);
+
+static bool sugov_should_update_freq(struct sugov_policy *sg_policy, u64 time)
+{
+	struct cpufreq_policy *policy = sg_policy->policy;
+	u64 delay_ns;
+
+	if (sg_policy->work_in_progress)
+		return false;
+
+	if (unlikely(sg_policy->need_freq_update)) {
+		sg_policy->need_freq_update = false;
+		return true;
+	}
+
+	delay_ns = max_t(u64, (u64)ACCESS_ONCE(rate_limit_us) * NSEC_PER_USEC,
+			 policy->cpuinfo.transition_latency);
+
+	return (s64)(time - sg_policy->last_freq_update_time) >= (s64)delay_ns;
+}
+
+/*
+ * The utilization is measured at the current frequency, so scale that
+ * rather than the maximum one, with 25% headroom: a cpu that is busy 80%
+ * of the time keeps its speed, a busier one speeds up and an idler one
+ * slows down.
+ */
+static unsigned int sugov_next_freq(struct sugov_policy *sg_policy, u64 time)
+{
+	struct cpufreq_policy *policy = sg_policy->policy;
+	unsigned long util = 0, max = 1;
+	unsigned int freq = policy->cur;
+	int j;
+
+	for_each_cpu(j, policy->cpus) {
+		struct sugov_cpu *j_sg_cpu = &per_cpu(sugov_cpu, j);
+
+		/*
+		 * An idle cpu stops sending updates; once its last one is
+		 * over a tick old, don't let it hold the policy up.
+		 */
+		if (j != smp_processor_id() &&
+		    (s64)(time - j_sg_cpu->last_update) > TICK_NSEC)
+			continue;
+
+		if (j_sg_cpu->util == ULONG_MAX)
+			return policy->cpuinfo.max_freq;
+
+		if (j_sg_cpu->util * max > util * j_sg_cpu->max) {
+			util = j_sg_cpu->util;
+			max = j_sg_cpu->max;
+		}
+	}
+
+	return div_u64((u64)(freq + (freq >> 2)) * util, max);
+}
+
+static void sugov_update_commit(struct sugov_policy *sg_policy, u64 time,
+				unsigned int next_freq)
+{
+	struct cpufreq_policy *policy = sg_policy->policy;
+
+	if (sg_policy->next_freq == next_freq)
+		return;
+
+	sg_policy->next_freq = next_freq;
+	sg_policy->last_freq_update_time = time;
+
+	if (policy->fast_switch_possible) {
+		cpufreq_driver_fast_switch(policy, next_freq);
+	} else {
+		sg_policy->work_in_progress = true;
+		irq_work_queue(&sg_policy->irq_work);
+	}
+}
+
+/* Called by the scheduler, with the rq lock held and interrupts off */
+static void sugov_update(struct update_util_data *hook, u64 time,
+			 unsigned long util, unsigned long max)
+{
+	struct sugov_cpu *sg_cpu = container_of(hook, struct sugov_cpu,
+						update_util);
+	struct sugov_policy *sg_policy = sg_cpu->sg_policy;
+
+	raw_spin_lock(&sg_policy->update_lock);
+
+	sg_cpu->util = util;
+	sg_cpu->max = max;
+	sg_cpu->last_update = time;
+
+	if (sugov_should_update_freq(sg_policy, time))
+		sugov_update_commit(sg_policy, time,
+				    sugov_next_freq(sg_policy, time));
+
+	raw_spin_unlock(&sg_policy->update_lock);
+}
+
+static void sugov_work(struct work_struct *work)
+{
+	struct sugov_policy *sg_policy = container_of(work, struct sugov_policy,
+						      work);
+	unsigned long flags;
+
+	mutex_lock(&sg_policy->work_lock);
+	__cpufreq_driver_target(sg_policy->policy, sg_policy->next_freq,
+				CPUFREQ_RELATION_L);
+	mutex_unlock(&sg_policy->work_lock);
+
+	raw_spin_lock_irqsave(&sg_policy->update_lock, flags);
+	sg_policy->work_in_progress = false;
+	raw_spin_unlock_irqrestore(&sg_policy->update_lock, flags);
+}
+
+static void sugov_irq_work(struct irq_work *irq_work)
+{
+	struct sugov_policy *sg_policy = container_of(irq_work,
+						      struct sugov_policy,
+						      irq_work);
+
+	queue_work(system_highpri_wq, &sg_policy->work);
+}
+
+static int sugov_init(struct cpufreq_policy *policy)
+{
+	struct sugov_policy *sg_policy;
+
+	if (WARN_ON(policy->governor_data))
+		return -EBUSY;
+
+	sg_policy = kzalloc(sizeof(*sg_policy), GFP_KERNEL);
+	if (!sg_policy)
+		return -ENOMEM;
+
+	sg_policy->policy = policy;
+	raw_spin_lock_init(&sg_policy->update_lock);
+	init_irq_work(&sg_policy->irq_work, sugov_irq_work);
+	INIT_WORK(&sg_policy->work, sugov_work);
+	mutex_init(&sg_policy->work_lock);
+
+	policy->governor_data = sg_policy;
+	return 0;
+}
+
+static void sugov_exit(struct cpufreq_policy *policy)
+{
+	struct sugov_policy *sg_policy = policy->governor_data;
+
+	policy->governor_data = NULL;
+	mutex_destroy(&sg_policy->work_lock);
+	kfree(sg_policy);
+}
+
+static void sugov_start(struct cpufreq_policy *policy)
+{
+	struct sugov_policy *sg_policy = policy->governor_data;
+	unsigned int cpu;
+
+	sg_policy->last_freq_update_time = 0;
+	sg_policy->next_freq = UINT_MAX;
+	sg_policy->work_in_progress = false;
+	sg_policy->need_freq_update = false;
+
+	for_each_cpu(cpu, policy->cpus) {
+		struct sugov_cpu *sg_cpu = &per_cpu(sugov_cpu, cpu);
+
+		sg_cpu->sg_policy = sg_policy;
+		sg_cpu->util = 0;
+		sg_cpu->max = 1;
+		sg_cpu->last_update = 0;
+		sg_cpu->update_util.func = sugov_update;
+		cpufreq_set_update_util_data(cpu, &sg_cpu->update_util);
+	}
+}
+
+static void sugov_stop(struct cpufreq_policy *policy)
+{
+	struct sugov_policy *sg_policy = policy->governor_data;
+	unsigned int cpu;
+
+	for_each_cpu(cpu, policy->cpus)
+		cpufreq_set_update_util_data(cpu, NULL);
+
+	synchronize_sched();
+
+	irq_work_sync(&sg_policy->irq_work);
+	cancel_work_sync(&sg_policy->work);
+}
+
+static void sugov_limits(struct cpufreq_policy *policy)
+{
+	struct sugov_policy *sg_policy = policy->governor_data;
+	unsigned long flags;
+
+	if (!policy->fast_switch_possible) {
+		mutex_lock(&sg_policy->work_lock);
+		if (policy->max < policy->cur)
+			__cpufreq_driver_target(policy, policy->max,
+						CPUFREQ_RELATION_H);
+		else if (policy->min > policy->cur)
+			__cpufreq_driver_target(policy, policy->min,
+						CPUFREQ_RELATION_L);
+		mutex_unlock(&sg_policy->work_lock);
+	}
+
+	/* let the next update from the scheduler apply the new limits */
+	raw_spin_lock_irqsave(&sg_policy->update_lock, flags);
+	sg_policy->need_freq_update = true;
+	raw_spin_unlock_irqrestore(&sg_policy->update_lock, flags);
+}
+
+static int cpufreq_governor_schedutil(struct cpufreq_policy *policy,
+				      unsigned int event)
+{
+	switch (event) {
+	case CPUFREQ_GOV_POLICY_INIT:
+		return sugov_init(policy);
+	case CPUFREQ_GOV_POLICY_EXIT:
+		sugov_exit(policy);
+		break;
+	case CPUFREQ_GOV_START:
+		sugov_start(policy);
+		break;
+	case CPUFREQ_GOV_STOP:
+		sugov_stop(policy);
+		break;
+	case CPUFREQ_GOV_LIMITS:
+		sugov_limits(policy);
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static struct cpufreq_governor cpufreq_gov_schedutil = {
+	.name		= "schedutil",
+	.governor	= cpufreq_governor_schedutil,
+	/* like ondemand, fall back to performance on very slow hardware */
+	.max_transition_latency	= 10 * NSEC_PER_MSEC,
+	.owner		= THIS_MODULE,
+};
+
+static int __init cpufreq_gov_schedutil_init(void)
+{
+	return cpufreq_register_governor(&cpufreq_gov_schedutil);
+}
+
+static void __exit cpufreq_gov_schedutil_exit(void)
+{
+	cpufreq_unregister_governor(&cpufreq_gov_schedutil);
+}
+
+MODULE_DESCRIPTION("CPUfreq policy governor 'schedutil'");
+MODULE_LICENSE("GPL");
+
+fs_initcall(cpufreq_gov_schedutil_init);
+module_exit(cpufreq_gov_schedutil_exit);
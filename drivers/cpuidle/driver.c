@@ -14,6 +14,7 @@
 #include <linux/cpuidle.h>
 #include <linux/cpumask.h>
 #include <linux/clockchips.h>
+#include <linux/jiffies.h>
 
 #include "cpuidle.h"
 
@@ -179,16 +180,37 @@ static void __cpuidle_driver_init(struct cpuidle_driver *drv)
 }
 
 #ifdef CONFIG_ARCH_HAS_CPU_RELAX
+/*
+ * Polling is only worth it for short idle periods, so give up after a
+ * while and let the governor pick a real idle state for the rest; it
+ * learns about the misprediction through dev->poll_time_limit.
+ */
+#define POLL_IDLE_TIME_LIMIT	(TICK_NSEC / 16)
+#define POLL_IDLE_RELAX_COUNT	200
+
 static int poll_idle(struct cpuidle_device *dev,
 		struct cpuidle_driver *drv, int index)
 {
+	unsigned int loop_count = 0;
 	ktime_t	t1, t2;
 	s64 diff;
 
+	dev->poll_time_limit = 0;
+
 	t1 = ktime_get();
 	local_irq_enable();
-	while (!need_resched())
+	while (!need_resched()) {
 		cpu_relax();
+		if (loop_count++ < POLL_IDLE_RELAX_COUNT)
+			continue;
+
+		loop_count = 0;
+		if (ktime_to_ns(ktime_sub(ktime_get(), t1)) >
+		    POLL_IDLE_TIME_LIMIT) {
+			dev->poll_time_limit = 1;
+			break;
+		}
+	}
 
 	t2 = ktime_get();
 	diff = ktime_to_us(ktime_sub(t2, t1));
@@ -209,7 +231,7 @@ static void poll_idle_init(struct cpuidle_driver *drv)
 	state->exit_latency = 0;
 	state->target_residency = 0;
 	state->power_usage = -1;
-	state->flags = CPUIDLE_FLAG_TIME_VALID;
+	state->flags = CPUIDLE_FLAG_TIME_VALID | CPUIDLE_FLAG_POLLING;
 	state->enter = poll_idle;
 	state->disabled = false;
 }
@@ -12,6 +12,7 @@
 
 #include <linux/kernel.h>
 #include <linux/cpuidle.h>
+#include <linux/cpu.h>
 #include <linux/pm_qos.h>
 #include <linux/time.h>
 #include <linux/ktime.h>
@@ -45,7 +46,7 @@
  * state:
  * 1) Energy break even point
  * 2) Performance impact
- * 3) Latency tolerance (from pmqos infrastructure)
+ * 3) Latency tolerance (from pmqos infrastructure, global and per cpu)
  * These these three factors are treated independently.
  *
  * Energy break even point
@@ -86,6 +87,9 @@
  * For this, we use a different predictor: We track the duration of the last 8
  * intervals and if the stand deviation of these 8 intervals is below a
  * threshold value, we use the average of these intervals as prediction.
+ * Only wakeups from other sources than the next timer are recorded, as
+ * the timer ones are predicted exactly already; when there have been none
+ * for the last 8 wakeups, the detector is not used.
  *
  * Limiting Performance Impact
  * ---------------------------
@@ -116,6 +120,15 @@
  * The iowait factor may look low, but realize that this is also already
  * represented in the system load average.
  *
+ * Polling
+ * -------
+ * Where there is a polling state before the first real C state, it is
+ * picked when the predicted idle time is shorter than what the first C
+ * state needs to break even, or when that state's exit latency is over
+ * the latency limit of this cpu.  Polling stops after a while even when
+ * nothing needs to run, and that is accounted like a sleep until the next
+ * timer, so a misprediction makes polling less likely next time.
+ *
  */
 
 struct menu_device {
@@ -128,6 +141,7 @@ struct menu_device {
 	unsigned int	correction_factor[BUCKETS];
 	unsigned int	intervals[INTERVALS];
 	int		interval_ptr;
+	int		timer_wakeups;	/* in a row, up to INTERVALS */
 };
 
 
@@ -286,7 +300,9 @@ again:
 static int menu_select(struct cpuidle_driver *drv, struct cpuidle_device *dev)
 {
 	struct menu_device *data = &__get_cpu_var(menu_devices);
+	struct device *device = get_cpu_device(dev->cpu);
 	int latency_req = pm_qos_request(PM_QOS_CPU_DMA_LATENCY);
+	int resume_latency = device ? __dev_pm_qos_read_value(device) : 0;
 	int i;
 	unsigned int interactivity_req;
 	struct timespec t;
@@ -298,6 +314,10 @@ static int menu_select(struct cpuidle_driver *drv, struct cpuidle_device *dev)
 
 	data->last_state_idx = 0;
 
+	/* A resume latency of 0 means no constraint for this cpu */
+	if (resume_latency > 0 && resume_latency < latency_req)
+		latency_req = resume_latency;
+
 	/* Special case when user has set very strict latency requirement */
 	if (unlikely(latency_req == 0))
 		return 0;
@@ -326,7 +346,8 @@ static int menu_select(struct cpuidle_driver *drv, struct cpuidle_device *dev)
 					 data->correction_factor[data->bucket],
 					 RESOLUTION * DECAY);
 
-	get_typical_interval(data);
+	if (data->timer_wakeups < INTERVALS)
+		get_typical_interval(data);
 
 	/*
 	 * Performance multiplier defines a minimum predicted idle
@@ -338,13 +359,25 @@ static int menu_select(struct cpuidle_driver *drv, struct cpuidle_device *dev)
 		latency_req = interactivity_req;
 
 	/*
-	 * We want to default to C1 (hlt), not to busy polling
-	 * unless the timer is happening really really soon.
+	 * We want to default to C1 (hlt), not to busy polling unless we
+	 * expect to be woken up really really soon, or C1 is too slow to
+	 * wake up from for this cpu.
 	 */
-	if (data->next_timer_us > 5 &&
-	    !drv->states[CPUIDLE_DRIVER_STATE_START].disabled &&
-		dev->states_usage[CPUIDLE_DRIVER_STATE_START].disable == 0)
+	if (drv->states[0].flags & CPUIDLE_FLAG_POLLING) {
+		struct cpuidle_state *s;
+		unsigned int polling_threshold;
+
+		s = &drv->states[CPUIDLE_DRIVER_STATE_START];
+		polling_threshold = max_t(unsigned int, 5, s->target_residency);
+		if (data->predicted_us > polling_threshold &&
+		    s->exit_latency <= latency_req && !s->disabled &&
+		    dev->states_usage[CPUIDLE_DRIVER_STATE_START].disable == 0)
+			data->last_state_idx = CPUIDLE_DRIVER_STATE_START;
+	} else if (data->next_timer_us > 5 &&
+		   !drv->states[CPUIDLE_DRIVER_STATE_START].disabled &&
+		   dev->states_usage[CPUIDLE_DRIVER_STATE_START].disable == 0) {
 		data->last_state_idx = CPUIDLE_DRIVER_STATE_START;
+	}
 
 	/*
 	 * Find the idle state with the lowest power while satisfying
@@ -414,6 +447,15 @@ static void menu_update(struct cpuidle_driver *drv, struct cpuidle_device *dev)
 		/* Use timer value as is */
 		measured_us = data->next_timer_us;
 
+	} else if ((target->flags & CPUIDLE_FLAG_POLLING) &&
+		   dev->poll_time_limit) {
+		/*
+		 * Polling timed out, so we predicted too short an idle
+		 * period; had we slept, the next timer might well have been
+		 * what woke us up.  Assume so.
+		 */
+		measured_us = data->next_timer_us;
+
 	} else {
 		/* Use measured value */
 		measured_us = cpuidle_get_last_residency(dev);
@@ -451,7 +493,17 @@ static void menu_update(struct cpuidle_driver *drv, struct cpuidle_device *dev)
 
 	data->correction_factor[data->bucket] = new_factor;
 
-	/* update the repeating-pattern data */
+	/*
+	 * Update the repeating-pattern data, but only with wakeups that the
+	 * next timer doesn't explain (within 1/8 of its expiry).
+	 */
+	if ((u64)measured_us * 8 >= (u64)data->next_timer_us * 7) {
+		if (data->timer_wakeups < INTERVALS)
+			data->timer_wakeups++;
+		return;
+	}
+
+	data->timer_wakeups = 0;
 	data->intervals[data->interval_ptr++] = measured_us;
 	if (data->interval_ptr >= INTERVALS)
 		data->interval_ptr = 0;
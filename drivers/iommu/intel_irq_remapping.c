@@ -51,6 +51,9 @@ static int ir_ioapic_num, ir_hpet_num;
  */
 static DEFINE_RAW_SPINLOCK(irq_2_ir_lock);
 
+/* Every remapping unit can post interrupts to a vcpu */
+static bool intel_ir_posting;
+
 static int __init parse_ioapics_under_ir(void);
 
 static struct irq_2_iommu *irq_2_iommu(unsigned int irq)
@@ -269,6 +272,7 @@ static int free_irte(int irq)
 	irq_iommu->irte_index = 0;
 	irq_iommu->sub_handle = 0;
 	irq_iommu->irte_mask = 0;
+	irq_iommu->posted = 0;
 
 	raw_spin_unlock_irqrestore(&irq_2_ir_lock, flags);
 
@@ -650,6 +654,11 @@ static int __init intel_enable_irq_remapping(void)
 
 	irq_remapping_enabled = 1;
 
+	intel_ir_posting = true;
+	for_each_iommu(iommu, drhd)
+		if (!cap_pi_support(iommu->cap))
+			intel_ir_posting = false;
+
 	/*
 	 * VT-d has a different layout for IO-APIC entries when
 	 * interrupt remapping is enabled. So it needs a special routine
@@ -1011,9 +1020,12 @@ intel_ioapic_set_affinity(struct irq_data *data, const struct cpumask *mask,
 
 	/*
 	 * Atomically updates the IRTE with the new destination, vector
-	 * and flushes the interrupt entry cache.
+	 * and flushes the interrupt entry cache.  A posted interrupt keeps
+	 * going to its vcpu, the new destination is only used once it is
+	 * taken back by intel_set_vcpu_affinity().
 	 */
-	modify_irte(irq, &irte);
+	if (!irq_2_iommu(irq)->posted)
+		modify_irte(irq, &irte);
 
 	/*
 	 * After this point, all the interrupts will start arriving
@@ -1049,7 +1061,8 @@ static void intel_compose_msi_msg(struct pci_dev *pdev,
 	else
 		set_hpet_sid(&irte, hpet_id);
 
-	modify_irte(irq, &irte);
+	if (!irq_2_iommu(irq)->posted)
+		modify_irte(irq, &irte);
 
 	msg->address_hi = MSI_ADDR_BASE_HI;
 	msg->data = sub_handle;
@@ -1129,6 +1142,73 @@ static int intel_setup_hpet_msi(unsigned int irq, unsigned int id)
 	return ret;
 }
 
+static bool intel_irq_posting_supported(void)
+{
+	return intel_ir_posting;
+}
+
+/* The PI descriptor address is split between the two halves of the IRTE */
+#define PDA_LOW_BIT	26
+#define PDA_HIGH_BIT	32
+
+static int intel_set_vcpu_affinity(int irq, struct vcpu_data *vcpu_info)
+{
+	struct irq_2_iommu *irq_iommu = irq_2_iommu(irq);
+	struct irq_cfg *cfg = irq_get_chip_data(irq);
+	struct irq_desc *desc = irq_to_desc(irq);
+	struct irte irte, old;
+	unsigned long flags;
+	unsigned int dest;
+	int ret;
+
+	if (!irq_iommu || !desc)
+		return -ENODEV;
+
+	/* Serialize against intel_ioapic_set_affinity() */
+	raw_spin_lock_irqsave(&desc->lock, flags);
+
+	ret = -EBUSY;
+	if (get_irte(irq, &old))
+		goto out;
+
+	if (vcpu_info) {
+		memset(&irte, 0, sizeof(irte));
+		irte.p_present = 1;
+		irte.p_fpd = old.fpd;
+		irte.p_avail = old.avail;
+		irte.p_pst = 1;
+		irte.p_vector = vcpu_info->vector;
+		irte.pda_l = (vcpu_info->pi_desc_addr >> (32 - PDA_LOW_BIT)) &
+			     ~(-1UL << PDA_LOW_BIT);
+		irte.pda_h = (vcpu_info->pi_desc_addr >> 32) &
+			     ~(-1UL << PDA_HIGH_BIT);
+	} else {
+		ret = 0;
+		if (!irq_iommu->posted)
+			goto out;
+
+		/* Back to the host vector and cpus the irq still owns */
+		ret = apic->cpu_mask_to_apicid_and(cfg->domain,
+						   desc->irq_data.affinity,
+						   &dest);
+		if (ret)
+			goto out;
+		prepare_irte(&irte, cfg->vector, dest);
+	}
+
+	/* Source validation is the same in both formats */
+	irte.sid = old.sid;
+	irte.sq = old.sq;
+	irte.svt = old.svt;
+
+	ret = modify_irte(irq, &irte);
+	if (!ret)
+		irq_iommu->posted = !!vcpu_info;
+out:
+	raw_spin_unlock_irqrestore(&desc->lock, flags);
+	return ret;
+}
+
 struct irq_remap_ops intel_irq_remap_ops = {
 	.supported		= intel_irq_remapping_supported,
 	.prepare		= dmar_table_init,
@@ -1143,4 +1223,6 @@ struct irq_remap_ops intel_irq_remap_ops = {
 	.msi_alloc_irq		= intel_msi_alloc_irq,
 	.msi_setup_irq		= intel_msi_setup_irq,
 	.setup_hpet_msi		= intel_setup_hpet_msi,
+	.posting_supported	= intel_irq_posting_supported,
+	.set_vcpu_affinity	= intel_set_vcpu_affinity,
 };
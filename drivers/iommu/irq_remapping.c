@@ -1,4 +1,5 @@
 #include <linux/seq_file.h>
+#include <linux/export.h>
 #include <linux/cpumask.h>
 #include <linux/kernel.h>
 #include <linux/string.h>
@@ -345,6 +346,43 @@ static int msi_setup_remapped_irq(struct pci_dev *pdev, unsigned int irq,
 	return remap_ops->msi_setup_irq(pdev, irq, index, sub_handle);
 }
 
+/**
+ * irq_remapping_cap_posting - check for posted interrupt support
+ *
+ * Returns true if remapped interrupts can be posted straight to a vcpu with
+ * irq_remapping_set_vcpu_affinity().
+ */
+bool irq_remapping_cap_posting(void)
+{
+	if (!irq_remapping_enabled || !remap_ops ||
+	    !remap_ops->posting_supported || !remap_ops->set_vcpu_affinity)
+		return false;
+
+	return remap_ops->posting_supported();
+}
+EXPORT_SYMBOL_GPL(irq_remapping_cap_posting);
+
+/**
+ * irq_remapping_set_vcpu_affinity - post an interrupt to a vcpu
+ * @irq: remapped host interrupt, typically the MSI of an assigned device
+ * @vcpu_info: descriptor and guest vector to post to, or NULL
+ *
+ * Once posted, the interrupt is delivered to the guest by the IOMMU and
+ * no longer reaches the host handler.  With @vcpu_info NULL it goes back
+ * to the host cpus of its affinity mask.
+ */
+int irq_remapping_set_vcpu_affinity(unsigned int irq,
+				    struct vcpu_data *vcpu_info)
+{
+	struct irq_cfg *cfg = irq_get_chip_data(irq);
+
+	if (!cfg || !irq_remapped(cfg) || !irq_remapping_cap_posting())
+		return -ENODEV;
+
+	return remap_ops->set_vcpu_affinity(irq, vcpu_info);
+}
+EXPORT_SYMBOL_GPL(irq_remapping_set_vcpu_affinity);
+
 int setup_hpet_msi_remapped(unsigned int irq, unsigned int id)
 {
 	if (!remap_ops || !remap_ops->setup_hpet_msi)
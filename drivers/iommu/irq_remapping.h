@@ -30,6 +30,7 @@ struct irq_data;
 struct cpumask;
 struct pci_dev;
 struct msi_msg;
+struct vcpu_data;
 
 extern int disable_irq_remap;
 extern int irq_remap_broken;
@@ -81,6 +82,12 @@ struct irq_remap_ops {
 
 	/* Setup interrupt remapping for an HPET MSI */
 	int (*setup_hpet_msi)(unsigned int, unsigned int);
+
+	/* Check whether interrupts can be posted to a vcpu */
+	bool (*posting_supported)(void);
+
+	/* Post a remapped interrupt to a vcpu, or with NULL take it back */
+	int (*set_vcpu_affinity)(int irq, struct vcpu_data *vcpu_info);
 };
 
 extern struct irq_remap_ops intel_irq_remap_ops;
@@ -340,10 +340,12 @@ struct cached_dev {
 	struct delayed_work	writeback_rate_update;
 
 	/*
-	 * Internal to the writeback code, so read_dirty() can keep track of
-	 * where it's at.
+	 * Internal to the writeback code: writes to the backing device are
+	 * issued in the order read_dirty() started their reads, so that they
+	 * reach the backing device sorted and can be merged.
 	 */
-	sector_t		last_read;
+	struct closure_waitlist	writeback_ordering_wait;
+	atomic_t		writeback_sequence_next;
 
 	/* Limit number of writeback bios in flight */
 	struct semaphore	in_flight;
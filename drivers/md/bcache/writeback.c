@@ -96,9 +96,17 @@ static unsigned writeback_delay(struct cached_dev *dc, unsigned sectors)
 	return bch_next_delay(&dc->writeback_rate, sectors);
 }
 
+/*
+ * Contiguous dirty keys are read and written back together, up to these
+ * limits per pass, between waits on the writeback rate.
+ */
+#define MAX_WRITEBACKS_IN_PASS	5
+#define MAX_WRITESIZE_IN_PASS	5000	/* in sectors */
+
 struct dirty_io {
 	struct closure		cl;
 	struct cached_dev	*dc;
+	uint16_t		sequence;
 	struct bio		bio;
 };
 
@@ -181,14 +189,38 @@ static void write_dirty(struct closure *cl)
 {
 	struct dirty_io *io = container_of(cl, struct dirty_io, cl);
 	struct keybuf_key *w = io->bio.bi_private;
+	struct cached_dev *dc = io->dc;
 
-	dirty_init(w);
-	io->bio.bi_rw		= WRITE;
-	io->bio.bi_iter.bi_sector = KEY_START(&w->key);
-	io->bio.bi_bdev		= io->dc->bdev;
-	io->bio.bi_end_io	= dirty_endio;
+	if (atomic_read(&dc->writeback_sequence_next) != io->sequence) {
+		/* Not our turn to write; wait for a write to be issued */
+		closure_wait(&dc->writeback_ordering_wait, cl);
 
-	closure_bio_submit(&io->bio, cl, &io->dc->disk);
+		/*
+		 * The previous write may have been issued before we were on
+		 * the wait list, in which case nobody else will wake us.
+		 */
+		if (atomic_read(&dc->writeback_sequence_next) == io->sequence)
+			closure_wake_up(&dc->writeback_ordering_wait);
+
+		continue_at(cl, write_dirty, system_wq);
+	}
+
+	/*
+	 * A failed read clears the dirty bit; don't write what we didn't
+	 * read to the backing device.
+	 */
+	if (KEY_DIRTY(&w->key)) {
+		dirty_init(w);
+		io->bio.bi_rw		= WRITE;
+		io->bio.bi_iter.bi_sector = KEY_START(&w->key);
+		io->bio.bi_bdev		= dc->bdev;
+		io->bio.bi_end_io	= dirty_endio;
+
+		closure_bio_submit(&io->bio, cl, &dc->disk);
+	}
+
+	atomic_set(&dc->writeback_sequence_next, io->sequence + 1);
+	closure_wake_up(&dc->writeback_ordering_wait);
 
 	continue_at(cl, write_dirty_finish, system_wq);
 }
@@ -216,10 +248,16 @@ static void read_dirty_submit(struct closure *cl)
 static void read_dirty(struct cached_dev *dc)
 {
 	unsigned delay = 0;
-	struct keybuf_key *w;
+	struct keybuf_key *next, *keys[MAX_WRITEBACKS_IN_PASS], *w;
+	size_t size;
+	int nk, i;
 	struct dirty_io *io;
 	struct closure cl;
+	struct blk_plug plug;
+	uint16_t sequence = 0;
 
+	BUG_ON(!llist_empty(&dc->writeback_ordering_wait.list));
+	atomic_set(&dc->writeback_sequence_next, sequence);
 	closure_init_stack(&cl);
 
 	/*
@@ -227,56 +265,91 @@ static void read_dirty(struct cached_dev *dc)
 	 * mempools.
 	 */
 
-	while (!kthread_should_stop()) {
+	next = bch_keybuf_next(&dc->writeback_keys);
+
+	while (!kthread_should_stop() && next) {
 		try_to_freeze();
 
-		w = bch_keybuf_next(&dc->writeback_keys);
-		if (!w)
-			break;
+		size = 0;
+		nk = 0;
 
-		BUG_ON(ptr_stale(dc->disk.c, &w->key, 0));
+		/*
+		 * Gather a run of contiguous keys; the keybuf is sorted, and
+		 * their writes will be issued in this order.
+		 */
+		do {
+			BUG_ON(ptr_stale(dc->disk.c, &next->key, 0));
 
-		if (KEY_START(&w->key) != dc->last_read ||
-		    jiffies_to_msecs(delay) > 50)
-			while (!kthread_should_stop() && delay)
-				delay = schedule_timeout_uninterruptible(delay);
+			if (nk >= MAX_WRITEBACKS_IN_PASS ||
+			    size >= MAX_WRITESIZE_IN_PASS)
+				break;
 
-		dc->last_read	= KEY_OFFSET(&w->key);
+			if (nk && bkey_cmp(&keys[nk - 1]->key,
+					   &START_KEY(&next->key)))
+				break;
 
-		io = kzalloc(sizeof(struct dirty_io) + sizeof(struct bio_vec)
-			     * DIV_ROUND_UP(KEY_SIZE(&w->key), PAGE_SECTORS),
-			     GFP_KERNEL);
-		if (!io)
-			goto err;
+			size += KEY_SIZE(&next->key);
+			keys[nk++] = next;
+		} while ((next = bch_keybuf_next(&dc->writeback_keys)));
 
-		w->private	= io;
-		io->dc		= dc;
+		blk_start_plug(&plug);
 
-		dirty_init(w);
-		io->bio.bi_iter.bi_sector = PTR_OFFSET(&w->key, 0);
-		io->bio.bi_bdev		= PTR_CACHE(dc->disk.c,
-						    &w->key, 0)->bdev;
-		io->bio.bi_rw		= READ;
-		io->bio.bi_end_io	= read_dirty_endio;
+		for (i = 0; i < nk; i++) {
+			w = keys[i];
+
+			io = kzalloc(sizeof(struct dirty_io) +
+				     sizeof(struct bio_vec) *
+				     DIV_ROUND_UP(KEY_SIZE(&w->key),
+						  PAGE_SECTORS),
+				     GFP_KERNEL);
+			if (!io)
+				goto err;
 
-		if (bio_alloc_pages(&io->bio, GFP_KERNEL))
-			goto err_free;
+			w->private	= io;
+			io->dc		= dc;
+			io->sequence	= sequence++;
 
-		trace_bcache_writeback(&w->key);
+			dirty_init(w);
+			io->bio.bi_iter.bi_sector = PTR_OFFSET(&w->key, 0);
+			io->bio.bi_bdev		= PTR_CACHE(dc->disk.c,
+							    &w->key, 0)->bdev;
+			io->bio.bi_rw		= READ;
+			io->bio.bi_end_io	= read_dirty_endio;
 
-		down(&dc->in_flight);
-		closure_call(&io->cl, read_dirty_submit, NULL, &cl);
+			if (bio_alloc_pages(&io->bio, GFP_KERNEL))
+				goto err_free;
 
-		delay = writeback_delay(dc, KEY_SIZE(&w->key));
+			trace_bcache_writeback(&w->key);
+
+			down(&dc->in_flight);
+			closure_call(&io->cl, read_dirty_submit, NULL, &cl);
+		}
+
+		blk_finish_plug(&plug);
+
+		delay = writeback_delay(dc, size);
+
+		while (!kthread_should_stop() && delay)
+			delay = schedule_timeout_uninterruptible(delay);
 	}
 
 	if (0) {
 err_free:
 		kfree(w->private);
 err:
-		bch_keybuf_del(&dc->writeback_keys, w);
+		blk_finish_plug(&plug);
+
+		/*
+		 * Give back the keys we gathered but didn't start, so the
+		 * next refill finds them again.
+		 */
+		for (; i < nk; i++)
+			bch_keybuf_del(&dc->writeback_keys, keys[i]);
 	}
 
+	if (next)
+		bch_keybuf_del(&dc->writeback_keys, next);
+
 	/*
 	 * Wait for outstanding writeback IOs to finish (and keybuf slots to be
 	 * freed) before refilling again
@@ -481,6 +554,7 @@ void bch_sectors_dirty_init(struct cached_dev *dc)
 int bch_cached_dev_writeback_init(struct cached_dev *dc)
 {
 	sema_init(&dc->in_flight, 64);
+	init_llist_head(&dc->writeback_ordering_wait.list);
 	init_rwsem(&dc->writeback_lock);
 	bch_keybuf_init(&dc->writeback_keys);
 
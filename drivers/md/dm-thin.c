@@ -175,14 +175,23 @@ struct pool {
 	struct dm_bio_prison *prison;
 	struct dm_kcopyd_client *copier;
 
+	/*
+	 * wq runs the pool wide work: completed mappings, commits and
+	 * flushes.  The deferred bios of each thin are processed by that
+	 * thin's own worker on thin_wq, so thins run in parallel.
+	 */
 	struct workqueue_struct *wq;
 	struct work_struct worker;
 	struct delayed_work waker;
 	struct delayed_work no_space_timeout;
+	struct workqueue_struct *thin_wq;
 
 	unsigned long last_commit_jiffies;
 	unsigned ref_count;
 
+	/* serializes data block allocation between the thin workers */
+	struct mutex alloc_lock;
+
 	spinlock_t lock;
 	struct bio_list deferred_flush_bios;
 	struct list_head prepared_mappings;
@@ -192,7 +201,6 @@ struct pool {
 	struct dm_deferred_set *shared_read_ds;
 	struct dm_deferred_set *all_io_ds;
 
-	struct dm_thin_new_mapping *next_mapping;
 	mempool_t *mapping_pool;
 
 	process_bio_fn process_bio;
@@ -237,6 +245,9 @@ struct thin_c {
 	struct bio_list retry_on_resume_list;
 	struct rb_root sort_bio_list; /* sorted list of deferred bios */
 
+	struct work_struct worker;
+	struct dm_thin_new_mapping *next_mapping;
+
 	/*
 	 * Ensures the thin is not destroyed until the worker has finished
 	 * iterating the active_thins list.
@@ -256,6 +267,15 @@ static void wake_worker(struct pool *pool)
 	queue_work(pool->wq, &pool->worker);
 }
 
+/*
+ * wake_thin_worker() is used when bios are added to a thin's
+ * deferred_bio_list.
+ */
+static void wake_thin_worker(struct thin_c *tc)
+{
+	queue_work(tc->pool->thin_wq, &tc->worker);
+}
+
 /*----------------------------------------------------------------*/
 
 static int bio_detain(struct pool *pool, struct dm_cell_key *key, struct bio *bio,
@@ -307,7 +327,7 @@ static void cell_defer_no_holder_no_free(struct thin_c *tc,
 	dm_cell_release_no_holder(pool->prison, cell, &tc->deferred_bio_list);
 	spin_unlock_irqrestore(&tc->lock, flags);
 
-	wake_worker(pool);
+	wake_thin_worker(tc);
 }
 
 static void cell_error(struct pool *pool,
@@ -526,6 +546,8 @@ static void issue(struct thin_c *tc, struct bio *bio)
 	spin_lock_irqsave(&pool->lock, flags);
 	bio_list_add(&pool->deferred_flush_bios, bio);
 	spin_unlock_irqrestore(&pool->lock, flags);
+
+	wake_worker(pool);
 }
 
 static void remap_to_origin_and_issue(struct thin_c *tc, struct bio *bio)
@@ -631,7 +653,7 @@ static void cell_defer(struct thin_c *tc, struct dm_bio_prison_cell *cell)
 	cell_release(pool, cell, &tc->deferred_bio_list);
 	spin_unlock_irqrestore(&tc->lock, flags);
 
-	wake_worker(pool);
+	wake_thin_worker(tc);
 }
 
 /*
@@ -646,7 +668,7 @@ static void cell_defer_no_holder(struct thin_c *tc, struct dm_bio_prison_cell *c
 	cell_release_no_holder(pool, cell, &tc->deferred_bio_list);
 	spin_unlock_irqrestore(&tc->lock, flags);
 
-	wake_worker(pool);
+	wake_thin_worker(tc);
 }
 
 static void process_prepared_mapping_fail(struct dm_thin_new_mapping *m)
@@ -791,27 +813,31 @@ static void save_and_set_endio(struct bio *bio, bio_end_io_t **save,
 	bio->bi_end_io = fn;
 }
 
-static int ensure_next_mapping(struct pool *pool)
+/*
+ * Each thin keeps its own spare mapping, so that its worker can't have
+ * it taken by another thin's.
+ */
+static int ensure_next_mapping(struct thin_c *tc)
 {
-	if (pool->next_mapping)
+	if (tc->next_mapping)
 		return 0;
 
-	pool->next_mapping = mempool_alloc(pool->mapping_pool, GFP_ATOMIC);
+	tc->next_mapping = mempool_alloc(tc->pool->mapping_pool, GFP_ATOMIC);
 
-	return pool->next_mapping ? 0 : -ENOMEM;
+	return tc->next_mapping ? 0 : -ENOMEM;
 }
 
-static struct dm_thin_new_mapping *get_next_mapping(struct pool *pool)
+static struct dm_thin_new_mapping *get_next_mapping(struct thin_c *tc)
 {
-	struct dm_thin_new_mapping *m = pool->next_mapping;
+	struct dm_thin_new_mapping *m = tc->next_mapping;
 
-	BUG_ON(!pool->next_mapping);
+	BUG_ON(!tc->next_mapping);
 
 	memset(m, 0, sizeof(struct dm_thin_new_mapping));
 	INIT_LIST_HEAD(&m->list);
 	m->bio = NULL;
 
-	pool->next_mapping = NULL;
+	tc->next_mapping = NULL;
 
 	return m;
 }
@@ -823,7 +849,7 @@ static void schedule_copy(struct thin_c *tc, dm_block_t virt_block,
 {
 	int r;
 	struct pool *pool = tc->pool;
-	struct dm_thin_new_mapping *m = get_next_mapping(pool);
+	struct dm_thin_new_mapping *m = get_next_mapping(tc);
 
 	m->tc = tc;
 	m->virt_block = virt_block;
@@ -889,7 +915,7 @@ static void schedule_zero(struct thin_c *tc, dm_block_t virt_block,
 			  struct bio *bio)
 {
 	struct pool *pool = tc->pool;
-	struct dm_thin_new_mapping *m = get_next_mapping(pool);
+	struct dm_thin_new_mapping *m = get_next_mapping(tc);
 
 	m->quiesced = true;
 	m->prepared = false;
@@ -965,7 +991,7 @@ static void check_low_water_mark(struct pool *pool, dm_block_t free_blocks)
 
 static void set_pool_mode(struct pool *pool, enum pool_mode new_mode);
 
-static int alloc_data_block(struct thin_c *tc, dm_block_t *result)
+static int __alloc_data_block(struct thin_c *tc, dm_block_t *result)
 {
 	int r;
 	dm_block_t free_blocks;
@@ -1012,6 +1038,22 @@ static int alloc_data_block(struct thin_c *tc, dm_block_t *result)
 	return 0;
 }
 
+/*
+ * Mapping lookups from the thin workers run concurrently, allocations
+ * are taken one at a time so the free block count checks hold.
+ */
+static int alloc_data_block(struct thin_c *tc, dm_block_t *result)
+{
+	int r;
+	struct pool *pool = tc->pool;
+
+	mutex_lock(&pool->alloc_lock);
+	r = __alloc_data_block(tc, result);
+	mutex_unlock(&pool->alloc_lock);
+
+	return r;
+}
+
 /*
  * If we have run out of space, queue bios until the device is
  * resumed, presumably after having been reloaded with more space.
@@ -1113,7 +1155,7 @@ static void process_discard(struct thin_c *tc, struct bio *bio)
 			 * IO may still be going to the destination block.  We must
 			 * quiesce before we can do the removal.
 			 */
-			m = get_next_mapping(pool);
+			m = get_next_mapping(tc);
 			m->tc = tc;
 			m->pass_discard = pool->pf.discard_passdown;
 			m->definitely_not_shared = !lookup_result.shared;
@@ -1481,7 +1523,7 @@ static void process_thin_deferred_bios(struct thin_c *tc)
 		 * this bio might require one, we pause until there are some
 		 * prepared mappings to process.
 		 */
-		if (ensure_next_mapping(pool)) {
+		if (ensure_next_mapping(tc)) {
 			spin_lock_irqsave(&tc->lock, flags);
 			bio_list_add(&tc->deferred_bio_list, bio);
 			bio_list_merge(&tc->deferred_bio_list, &bios);
@@ -1497,43 +1539,26 @@ static void process_thin_deferred_bios(struct thin_c *tc)
 	blk_finish_plug(&plug);
 }
 
-static void thin_get(struct thin_c *tc);
-static void thin_put(struct thin_c *tc);
-
-/*
- * We can't hold rcu_read_lock() around code that can block.  So we
- * find a thin with the rcu lock held; bump a refcount; then drop
- * the lock.
- */
-static struct thin_c *get_first_thin(struct pool *pool)
+static void do_thin_worker(struct work_struct *ws)
 {
-	struct thin_c *tc = NULL;
+	struct thin_c *tc = container_of(ws, struct thin_c, worker);
 
-	rcu_read_lock();
-	if (!list_empty(&pool->active_thins)) {
-		tc = list_entry_rcu(pool->active_thins.next, struct thin_c, list);
-		thin_get(tc);
-	}
-	rcu_read_unlock();
-
-	return tc;
+	process_thin_deferred_bios(tc);
 }
 
-static struct thin_c *get_next_thin(struct pool *pool, struct thin_c *tc)
+/*
+ * Kick the workers of thins with bios still deferred, eg. those that
+ * ran out of mappings and are waiting on completions processed here.
+ */
+static void wake_deferred_thins(struct pool *pool)
 {
-	struct thin_c *old_tc = tc;
+	struct thin_c *tc;
 
 	rcu_read_lock();
-	list_for_each_entry_continue_rcu(tc, &pool->active_thins, list) {
-		thin_get(tc);
-		thin_put(old_tc);
-		rcu_read_unlock();
-		return tc;
-	}
-	thin_put(old_tc);
+	list_for_each_entry_rcu(tc, &pool->active_thins, list)
+		if (!bio_list_empty(&tc->deferred_bio_list))
+			wake_thin_worker(tc);
 	rcu_read_unlock();
-
-	return NULL;
 }
 
 static void process_deferred_bios(struct pool *pool)
@@ -1541,13 +1566,8 @@ static void process_deferred_bios(struct pool *pool)
 	unsigned long flags;
 	struct bio *bio;
 	struct bio_list bios;
-	struct thin_c *tc;
 
-	tc = get_first_thin(pool);
-	while (tc) {
-		process_thin_deferred_bios(tc);
-		tc = get_next_thin(pool, tc);
-	}
+	wake_deferred_thins(pool);
 
 	/*
 	 * If there are any deferred flush bios, we must commit
@@ -1795,13 +1815,12 @@ static void metadata_operation_failed(struct pool *pool, const char *op, int r)
 static void thin_defer_bio(struct thin_c *tc, struct bio *bio)
 {
 	unsigned long flags;
-	struct pool *pool = tc->pool;
 
 	spin_lock_irqsave(&tc->lock, flags);
 	bio_list_add(&tc->deferred_bio_list, bio);
 	spin_unlock_irqrestore(&tc->lock, flags);
 
-	wake_worker(pool);
+	wake_thin_worker(tc);
 }
 
 static void thin_hook_bio(struct thin_c *tc, struct bio *bio)
@@ -2049,11 +2068,12 @@ static void __pool_destroy(struct pool *pool)
 	dm_bio_prison_destroy(pool->prison);
 	dm_kcopyd_client_destroy(pool->copier);
 
+	if (pool->thin_wq)
+		destroy_workqueue(pool->thin_wq);
+
 	if (pool->wq)
 		destroy_workqueue(pool->wq);
 
-	if (pool->next_mapping)
-		mempool_free(pool->next_mapping, pool->mapping_pool);
 	mempool_destroy(pool->mapping_pool);
 	dm_deferred_set_destroy(pool->shared_read_ds);
 	dm_deferred_set_destroy(pool->all_io_ds);
@@ -2120,10 +2140,19 @@ static struct pool *pool_create(struct mapped_device *pool_md,
 		goto bad_wq;
 	}
 
+	pool->thin_wq = alloc_workqueue("dm-" DM_MSG_PREFIX "-bios",
+					WQ_MEM_RECLAIM, 0);
+	if (!pool->thin_wq) {
+		*error = "Error creating pool's thin workqueue";
+		err_p = ERR_PTR(-ENOMEM);
+		goto bad_thin_wq;
+	}
+
 	INIT_WORK(&pool->worker, do_worker);
 	INIT_DELAYED_WORK(&pool->waker, do_waker);
 	INIT_DELAYED_WORK(&pool->no_space_timeout, do_no_space_timeout);
 	spin_lock_init(&pool->lock);
+	mutex_init(&pool->alloc_lock);
 	bio_list_init(&pool->deferred_flush_bios);
 	INIT_LIST_HEAD(&pool->prepared_mappings);
 	INIT_LIST_HEAD(&pool->prepared_discards);
@@ -2144,7 +2173,6 @@ static struct pool *pool_create(struct mapped_device *pool_md,
 		goto bad_all_io_ds;
 	}
 
-	pool->next_mapping = NULL;
 	pool->mapping_pool = mempool_create_slab_pool(MAPPING_POOL_SIZE,
 						      _new_mapping_cache);
 	if (!pool->mapping_pool) {
@@ -2166,6 +2194,8 @@ bad_mapping_pool:
 bad_all_io_ds:
 	dm_deferred_set_destroy(pool->shared_read_ds);
 bad_shared_read_ds:
+	destroy_workqueue(pool->thin_wq);
+bad_thin_wq:
 	destroy_workqueue(pool->wq);
 bad_wq:
 	dm_kcopyd_client_destroy(pool->copier);
@@ -2686,6 +2716,7 @@ static void pool_postsuspend(struct dm_target *ti)
 
 	cancel_delayed_work(&pool->waker);
 	cancel_delayed_work(&pool->no_space_timeout);
+	flush_workqueue(pool->thin_wq);
 	flush_workqueue(pool->wq);
 	(void) commit(pool);
 }
@@ -3157,6 +3188,10 @@ static void thin_dtr(struct dm_target *ti)
 	spin_unlock_irqrestore(&tc->pool->lock, flags);
 	synchronize_rcu();
 
+	flush_work(&tc->worker);
+	if (tc->next_mapping)
+		mempool_free(tc->next_mapping, tc->pool->mapping_pool);
+
 	mutex_lock(&dm_thin_pool_table.mutex);
 
 	__pool_dec(tc->pool);
@@ -3207,6 +3242,7 @@ static int thin_ctr(struct dm_target *ti, unsigned argc, char **argv)
 	bio_list_init(&tc->deferred_bio_list);
 	bio_list_init(&tc->retry_on_resume_list);
 	tc->sort_bio_list = RB_ROOT;
+	INIT_WORK(&tc->worker, do_thin_worker);
 
 	if (argc == 3) {
 		r = dm_get_device(ti, argv[2], FMODE_READ, &origin_dev);
@@ -3286,9 +3322,9 @@ static int thin_ctr(struct dm_target *ti, unsigned argc, char **argv)
 	spin_unlock_irqrestore(&tc->pool->lock, flags);
 	/*
 	 * This synchronize_rcu() call is needed here otherwise we risk a
-	 * wake_worker() call finding no bios to process (because the newly
-	 * added tc isn't yet visible).  So this reduces latency since we
-	 * aren't then dependent on the periodic commit to wake_worker().
+	 * wake_deferred_thins() call missing this thin's bios (because the
+	 * newly added tc isn't yet visible).  So this reduces latency since
+	 * we aren't then dependent on the next kick of the pool worker.
 	 */
 	synchronize_rcu();
 
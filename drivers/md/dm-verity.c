@@ -12,12 +12,18 @@
  * hash device. Setting this greatly improves performance when data and hash
  * are on the same disk on different partitions on devices with poor random
  * access behavior.
+ *
+ * With the optional "check_at_most_once" feature argument, data blocks are
+ * hashed only on their first read; a bitmap records the blocks already
+ * verified.  This trades protection against the data device being modified
+ * after a block was first read for not rehashing hot data.
  */
 
 #include "dm-bufio.h"
 
 #include <linux/module.h>
 #include <linux/device-mapper.h>
+#include <linux/vmalloc.h>
 #include <crypto/hash.h>
 
 #define DM_MSG_PREFIX			"verity"
@@ -59,6 +65,9 @@ struct dm_verity {
 
 	struct workqueue_struct *verify_wq;
 
+	/* bitmap of the data blocks already verified, if check_at_most_once */
+	unsigned long *validated_blocks;
+
 	/* starting blocks for each tree level. 0 is the lowest level. */
 	sector_t hash_level_block[DM_VERITY_MAX_LEVELS];
 };
@@ -290,6 +299,13 @@ static int verity_verify_io(struct dm_verity_io *io)
 		int r;
 		unsigned todo;
 
+		if (v->validated_blocks &&
+		    likely(test_bit(io->block + b, v->validated_blocks))) {
+			bio_advance_iter(bio, &io->iter,
+					 1 << v->data_dev_block_bits);
+			continue;
+		}
+
 		if (likely(v->levels)) {
 			/*
 			 * First, we try to get the requested hash for
@@ -372,6 +388,9 @@ test_block_hash:
 			v->hash_failed = 1;
 			return -EIO;
 		}
+
+		if (v->validated_blocks)
+			set_bit(io->block + b, v->validated_blocks);
 	}
 
 	return 0;
@@ -546,6 +565,8 @@ static void verity_status(struct dm_target *ti, status_type_t type,
 		else
 			for (x = 0; x < v->salt_size; x++)
 				DMEMIT("%02x", v->salt[x]);
+		if (v->validated_blocks)
+			DMEMIT(" 1 check_at_most_once");
 		break;
 	}
 }
@@ -607,6 +628,8 @@ static void verity_dtr(struct dm_target *ti)
 	if (v->verify_wq)
 		destroy_workqueue(v->verify_wq);
 
+	vfree(v->validated_blocks);
+
 	if (v->vec_mempool)
 		mempool_destroy(v->vec_mempool);
 
@@ -643,17 +666,28 @@ static void verity_dtr(struct dm_target *ti)
  *	<algorithm>
  *	<digest>
  *	<salt>		Hex string or "-" if no salt.
+ *
+ * Optional parameters:
+ *	<#opt_params>	The number of optional parameters that follow.
+ *	check_at_most_once
+ *			Verify each data block only the first time it is read.
  */
 static int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 {
 	struct dm_verity *v;
-	unsigned num;
+	struct dm_arg_set as;
+	const char *opt_string;
+	unsigned num, opt_params;
 	unsigned long long num_ll;
 	int r;
 	int i;
 	sector_t hash_position;
 	char dummy;
 
+	static struct dm_arg _args[] = {
+		{0, 1, "Invalid number of feature args"},
+	};
+
 	v = kzalloc(sizeof(struct dm_verity), GFP_KERNEL);
 	if (!v) {
 		ti->error = "Cannot allocate verity structure";
@@ -668,8 +702,8 @@ static int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 		goto bad;
 	}
 
-	if (argc != 10) {
-		ti->error = "Invalid argument count: exactly 10 arguments required";
+	if (argc < 10) {
+		ti->error = "Invalid argument count: at least 10 arguments required";
 		r = -EINVAL;
 		goto bad;
 	}
@@ -790,6 +824,45 @@ static int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 		}
 	}
 
+	argv += 10;
+	argc -= 10;
+
+	/* Optional parameters */
+	if (argc) {
+		as.argc = argc;
+		as.argv = argv;
+
+		r = dm_read_arg_group(_args, &as, &opt_params, &ti->error);
+		if (r)
+			goto bad;
+
+		while (opt_params--) {
+			opt_string = dm_shift_arg(&as);
+			if (!opt_string) {
+				ti->error = "Not enough feature arguments";
+				r = -EINVAL;
+				goto bad;
+			}
+
+			if (!strcasecmp(opt_string, "check_at_most_once")) {
+				if (v->validated_blocks)
+					continue;
+				v->validated_blocks =
+					vzalloc(BITS_TO_LONGS(v->data_blocks) *
+						sizeof(unsigned long));
+				if (!v->validated_blocks) {
+					ti->error = "Cannot allocate validated_blocks bitset";
+					r = -ENOMEM;
+					goto bad;
+				}
+			} else {
+				ti->error = "Invalid feature arguments";
+				r = -EINVAL;
+				goto bad;
+			}
+		}
+	}
+
 	v->hash_per_block_bits =
 		__fls((1 << v->hash_dev_block_bits) / v->digest_size);
 
@@ -865,7 +938,7 @@ bad:
 
 static struct target_type verity_target = {
 	.name		= "verity",
-	.version	= {1, 2, 0},
+	.version	= {1, 3, 0},
 	.module		= THIS_MODULE,
 	.ctr		= verity_ctr,
 	.dtr		= verity_dtr,
@@ -20,6 +20,7 @@
 #include <linux/list.h>
 #include <linux/mm.h>
 #include <linux/mutex.h>
+#include <linux/sched.h>
 #include <linux/timer.h>
 #include <linux/wait.h>
 #include <linux/workqueue.h>
@@ -97,6 +98,11 @@ struct md_rdev {
 	atomic_t	read_errors;	/* number of consecutive read errors that
 					 * we have tried to ignore.
 					 */
+	unsigned long	read_latency;	/* decaying average of the time taken
+					 * by reads, in nanoseconds.  Updated
+					 * without locking by personalities
+					 * that balance reads.
+					 */
 	struct timespec last_read_error;	/* monotonic time since our
 						 * last read error
 						 */
@@ -447,6 +453,32 @@ static inline void rdev_dec_pending(struct md_rdev *rdev, struct mddev *mddev)
 		set_bit(MD_RECOVERY_NEEDED, &mddev->recovery);
 }
 
+/*
+ * Fold the completion time of a read started at 'start' (local_clock())
+ * into the device's average read latency, weighting the new sample 1/8.
+ */
+static inline void rdev_account_read(struct md_rdev *rdev, u64 start)
+{
+	u64 now = local_clock();
+	unsigned long avg = ACCESS_ONCE(rdev->read_latency);
+	unsigned long lat = 0;
+
+	if (now > start)
+		lat = min_t(u64, now - start, ULONG_MAX);
+
+	ACCESS_ONCE(rdev->read_latency) = avg - (avg >> 3) + (lat >> 3);
+}
+
+/*
+ * Expected time for a new read to complete on the device: its queue
+ * depth, this read included, times its average read latency.
+ */
+static inline u64 rdev_read_cost(struct md_rdev *rdev)
+{
+	return (u64)(atomic_read(&rdev->nr_pending) + 1) *
+		(ACCESS_ONCE(rdev->read_latency) + 1);
+}
+
 static inline void md_sync_acct(struct block_device *bdev, unsigned long nr_sectors)
 {
         atomic_add(nr_sectors, &bdev->bd_contains->bd_disk->sync_io);
@@ -325,9 +325,11 @@ static void raid1_end_read_request(struct bio *bio, int error)
 	 */
 	update_head_pos(mirror, r1_bio);
 
-	if (uptodate)
+	if (uptodate) {
+		rdev_account_read(conf->mirrors[mirror].rdev,
+				  r1_bio->read_start);
 		set_bit(R1BIO_Uptodate, &r1_bio->state);
-	else {
+	} else {
 		/* If all other devices have failed, we want to return
 		 * the error upwards rather than fail the last device.
 		 * Here we redefine "uptodate" to mean "Don't want to retry"
@@ -518,7 +520,7 @@ static int read_balance(struct r1conf *conf, struct r1bio *r1_bio, int *max_sect
 	int has_nonrot_disk;
 	int disk;
 	sector_t best_dist;
-	unsigned int min_pending;
+	u64 min_cost;
 	struct md_rdev *rdev;
 	int choose_first;
 	int choose_next_idle;
@@ -535,7 +537,7 @@ static int read_balance(struct r1conf *conf, struct r1bio *r1_bio, int *max_sect
 	best_dist_disk = -1;
 	best_dist = MaxSector;
 	best_pending_disk = -1;
-	min_pending = UINT_MAX;
+	min_cost = ULLONG_MAX;
 	best_good_sectors = 0;
 	has_nonrot_disk = 0;
 	choose_next_idle = 0;
@@ -551,6 +553,7 @@ static int read_balance(struct r1conf *conf, struct r1bio *r1_bio, int *max_sect
 		sector_t first_bad;
 		int bad_sectors;
 		unsigned int pending;
+		u64 cost;
 		bool nonrot;
 
 		rdev = rcu_dereference(conf->mirrors[disk].rdev);
@@ -657,8 +660,9 @@ static int read_balance(struct r1conf *conf, struct r1bio *r1_bio, int *max_sect
 		if (choose_next_idle)
 			continue;
 
-		if (min_pending > pending) {
-			min_pending = pending;
+		cost = rdev_read_cost(rdev);
+		if (min_cost > cost) {
+			min_cost = cost;
 			best_pending_disk = disk;
 		}
 
@@ -670,9 +674,10 @@ static int read_balance(struct r1conf *conf, struct r1bio *r1_bio, int *max_sect
 
 	/*
 	 * If all disks are rotational, choose the closest disk. If any disk is
-	 * non-rotational, choose the disk with less pending request even the
-	 * disk is rotational, which might/might not be optimal for raids with
-	 * mixed ratation/non-rotational disks depending on workload.
+	 * non-rotational, choose the disk expected to complete the read first,
+	 * from its number of pending requests and its recent read latency,
+	 * even if the disk is rotational: a slow disk only gets reads while
+	 * the fast ones are queued deeply enough to be slower still.
 	 */
 	if (best_disk == -1) {
 		if (has_nonrot_disk)
@@ -694,6 +699,7 @@ static int read_balance(struct r1conf *conf, struct r1bio *r1_bio, int *max_sect
 			goto retry;
 		}
 		sectors = best_good_sectors;
+		r1_bio->read_start = local_clock();
 
 		if (conf->mirrors[best_disk].next_seq_sect != this_sector)
 			conf->mirrors[best_disk].seq_start = this_sector;
@@ -137,6 +137,8 @@ struct r1bio {
 	 * if the IO is in READ direction, then this is where we read
 	 */
 	int			read_disk;
+	/* local_clock() when the read was issued, for the read latency */
+	u64			read_start;
 
 	struct list_head	retry_list;
 	/* Next two are only valid when R1BIO_BehindIO is set */
@@ -385,6 +385,7 @@ static void raid10_end_read_request(struct bio *bio, int error)
 		 * user-side. So if something waits for IO, then it will
 		 * wait for the 'master' bio.
 		 */
+		rdev_account_read(rdev, r10_bio->read_start);
 		set_bit(R10BIO_Uptodate, &r10_bio->state);
 	} else {
 		/* If all other devices that store this block have
@@ -792,6 +793,10 @@ static struct md_rdev *read_balance(struct r10conf *conf,
 	struct md_rdev *best_rdev, *rdev = NULL;
 	int do_balance;
 	int best_slot;
+	struct md_rdev *best_cost_rdev;
+	int best_cost_slot;
+	u64 best_cost, cost;
+	int has_nonrot_disk;
 	struct geom *geo = &conf->geo;
 
 	raid10_find_phys(conf, r10_bio);
@@ -802,6 +807,10 @@ retry:
 	best_rdev = NULL;
 	best_dist = MaxSector;
 	best_good_sectors = 0;
+	best_cost_slot = -1;
+	best_cost_rdev = NULL;
+	best_cost = ULLONG_MAX;
+	has_nonrot_disk = 0;
 	do_balance = 1;
 	/*
 	 * Check if we can balance. We can balance on the whole
@@ -869,6 +878,14 @@ retry:
 		if (!do_balance)
 			break;
 
+		has_nonrot_disk |= blk_queue_nonrot(bdev_get_queue(rdev->bdev));
+		cost = rdev_read_cost(rdev);
+		if (cost < best_cost) {
+			best_cost = cost;
+			best_cost_slot = slot;
+			best_cost_rdev = rdev;
+		}
+
 		/* This optimisation is debatable, and completely destroys
 		 * sequential read speed for 'far copies' arrays.  So only
 		 * keep it for 'near' arrays, and review those later.
@@ -888,9 +905,19 @@ retry:
 			best_rdev = rdev;
 		}
 	}
+	/*
+	 * As in raid1, if any copy is on a non-rotational disk, prefer the
+	 * disk expected to complete the read first over the closest one,
+	 * for both near and far layouts.
+	 */
 	if (slot >= conf->copies) {
-		slot = best_slot;
-		rdev = best_rdev;
+		if (has_nonrot_disk && best_cost_slot >= 0) {
+			slot = best_cost_slot;
+			rdev = best_cost_rdev;
+		} else {
+			slot = best_slot;
+			rdev = best_rdev;
+		}
 	}
 
 	if (slot >= 0) {
@@ -903,6 +930,7 @@ retry:
 			goto retry;
 		}
 		r10_bio->read_slot = slot;
+		r10_bio->read_start = local_clock();
 	} else
 		rdev = NULL;
 	rcu_read_unlock();
@@ -105,6 +105,8 @@ struct r10bio {
 	 * if the IO is in READ direction, then this is where we read
 	 */
 	int			read_slot;
+	/* local_clock() when the read was issued, for the read latency */
+	u64			read_start;
 
 	struct list_head	retry_list;
 	/*
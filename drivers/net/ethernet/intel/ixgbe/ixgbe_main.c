@@ -2062,6 +2062,61 @@ dma_sync:
 	return skb;
 }
 
+/**
+ * ixgbe_run_rx_filter - run the netdev Rx filter on a frame in its page
+ * @rx_ring: rx descriptor ring to transact packets on
+ * @rx_desc: descriptor at next_to_clean
+ * @fp: Rx filter of the netdev
+ *
+ * This function runs the Rx filter on the frame at next_to_clean before
+ * any skb is allocated for it.  Only frames contained in a single buffer
+ * are filtered, everything else is passed.  A dropped frame has its page
+ * handed back to the ring and next_to_clean is advanced past it.
+ *
+ * Returns the verdict of the filter.
+ **/
+static u32 ixgbe_run_rx_filter(struct ixgbe_ring *rx_ring,
+			       union ixgbe_adv_rx_desc *rx_desc,
+			       const struct sk_filter *fp)
+{
+	struct ixgbe_rx_buffer *rx_buffer;
+	u32 ntc, verdict;
+
+	rx_buffer = &rx_ring->rx_buffer_info[rx_ring->next_to_clean];
+
+	if (rx_buffer->skb ||
+	    !ixgbe_test_staterr(rx_desc, IXGBE_RXD_STAT_EOP) ||
+	    ixgbe_test_staterr(rx_desc, IXGBE_RXDADV_ERR_FRAME_ERR_MASK))
+		return RX_FILTER_PASS;
+
+	dma_sync_single_range_for_cpu(rx_ring->dev,
+				      rx_buffer->dma,
+				      rx_buffer->page_offset,
+				      ixgbe_rx_bufsz(rx_ring),
+				      DMA_FROM_DEVICE);
+
+	verdict = netdev_rx_filter_run(fp, rx_ring->netdev,
+				       page_address(rx_buffer->page) +
+				       rx_buffer->page_offset,
+				       le16_to_cpu(rx_desc->wb.upper.length),
+				       rx_ring->queue_index);
+	if (verdict != RX_FILTER_DROP)
+		return verdict;
+
+	/* the page was never given away, hand it back as it is */
+	ixgbe_reuse_rx_page(rx_ring, rx_buffer);
+	rx_buffer->dma = 0;
+	rx_buffer->page = NULL;
+
+	ntc = rx_ring->next_to_clean + 1;
+	ntc = (ntc < rx_ring->count) ? ntc : 0;
+	rx_ring->next_to_clean = ntc;
+
+	prefetch(IXGBE_RX_DESC(rx_ring, ntc));
+
+	return RX_FILTER_DROP;
+}
+
 /**
  * ixgbe_clean_rx_irq - Clean completed descriptors from Rx ring - bounce buf
  * @q_vector: structure containing interrupt and ring information
@@ -2086,10 +2141,15 @@ static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 	unsigned int mss = 0;
 #endif /* IXGBE_FCOE */
 	u16 cleaned_count = ixgbe_desc_unused(rx_ring);
+	struct sk_filter *fp;
+
+	rcu_read_lock();
+	fp = netdev_rx_filter(rx_ring->netdev);
 
 	while (likely(total_rx_packets < budget)) {
 		union ixgbe_adv_rx_desc *rx_desc;
 		struct sk_buff *skb;
+		u32 verdict = RX_FILTER_PASS;
 
 		/* return some buffers to hardware, one at a time is too slow */
 		if (cleaned_count >= IXGBE_RX_BUFFER_WRITE) {
@@ -2109,6 +2169,16 @@ static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 		 */
 		rmb();
 
+		/* let the Rx filter drop the frame before we build an skb */
+		if (fp) {
+			verdict = ixgbe_run_rx_filter(rx_ring, rx_desc, fp);
+			if (verdict == RX_FILTER_DROP) {
+				cleaned_count++;
+				total_rx_packets++;
+				continue;
+			}
+		}
+
 		/* retrieve a buffer from the ring */
 		skb = ixgbe_fetch_rx_buffer(rx_ring, rx_desc);
 
@@ -2129,6 +2199,12 @@ static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 		/* probably a little skewed due to removing CRC */
 		total_rx_bytes += skb->len;
 
+		if (unlikely(verdict == RX_FILTER_TX)) {
+			netdev_rx_filter_xmit(skb, rx_ring->netdev);
+			total_rx_packets++;
+			continue;
+		}
+
 		/* populate checksum, timestamp, VLAN, and protocol */
 		ixgbe_process_skb_fields(rx_ring, rx_desc, skb);
 
@@ -2164,6 +2240,8 @@ static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 		total_rx_packets++;
 	}
 
+	rcu_read_unlock();
+
 	u64_stats_update_begin(&rx_ring->syncp);
 	rx_ring->stats.packets += total_rx_packets;
 	rx_ring->stats.bytes += total_rx_bytes;
@@ -6699,6 +6777,32 @@ static void ixgbe_tx_olinfo_status(union ixgbe_adv_tx_desc *tx_desc,
 #define IXGBE_TXD_CMD (IXGBE_TXD_CMD_EOP | \
 		       IXGBE_TXD_CMD_RS)
 
+static int __ixgbe_maybe_stop_tx(struct ixgbe_ring *tx_ring, u16 size)
+{
+	netif_stop_subqueue(tx_ring->netdev, tx_ring->queue_index);
+	/* Herbert's original patch had:
+	 *  smp_mb__after_netif_stop_queue();
+	 * but since that doesn't exist yet, just open code it. */
+	smp_mb();
+
+	/* We need to check again in a case another CPU has just
+	 * made room available. */
+	if (likely(ixgbe_desc_unused(tx_ring) < size))
+		return -EBUSY;
+
+	/* A reprieve! - use start_queue because it doesn't call schedule */
+	netif_start_subqueue(tx_ring->netdev, tx_ring->queue_index);
+	++tx_ring->tx_stats.restart_queue;
+	return 0;
+}
+
+static inline int ixgbe_maybe_stop_tx(struct ixgbe_ring *tx_ring, u16 size)
+{
+	if (likely(ixgbe_desc_unused(tx_ring) >= size))
+		return 0;
+	return __ixgbe_maybe_stop_tx(tx_ring, size);
+}
+
 static void ixgbe_tx_map(struct ixgbe_ring *tx_ring,
 			 struct ixgbe_tx_buffer *first,
 			 const u8 hdr_len)
@@ -6817,8 +6921,14 @@ static void ixgbe_tx_map(struct ixgbe_ring *tx_ring,
 
 	tx_ring->next_to_use = i;
 
-	/* notify HW of packet */
-	ixgbe_write_tail(tx_ring, i);
+	ixgbe_maybe_stop_tx(tx_ring, DESC_NEEDED);
+
+	/* notify HW of packet, unless the stack has more for this ring
+	 * right behind it. A stopped queue gets no further packets, so the
+	 * tail has to be written then regardless.
+	 */
+	if (netif_xmit_stopped(txring_txq(tx_ring)) || !skb->xmit_more)
+		ixgbe_write_tail(tx_ring, i);
 
 	return;
 dma_error:
@@ -6836,6 +6946,9 @@ dma_error:
 	}
 
 	tx_ring->next_to_use = i;
+
+	/* earlier packets may have deferred the tail write to this one */
+	ixgbe_write_tail(tx_ring, i);
 }
 
 static void ixgbe_atr(struct ixgbe_ring *ring,
@@ -6926,32 +7039,6 @@ static void ixgbe_atr(struct ixgbe_ring *ring,
 					      input, common, ring->queue_index);
 }
 
-static int __ixgbe_maybe_stop_tx(struct ixgbe_ring *tx_ring, u16 size)
-{
-	netif_stop_subqueue(tx_ring->netdev, tx_ring->queue_index);
-	/* Herbert's original patch had:
-	 *  smp_mb__after_netif_stop_queue();
-	 * but since that doesn't exist yet, just open code it. */
-	smp_mb();
-
-	/* We need to check again in a case another CPU has just
-	 * made room available. */
-	if (likely(ixgbe_desc_unused(tx_ring) < size))
-		return -EBUSY;
-
-	/* A reprieve! - use start_queue because it doesn't call schedule */
-	netif_start_subqueue(tx_ring->netdev, tx_ring->queue_index);
-	++tx_ring->tx_stats.restart_queue;
-	return 0;
-}
-
-static inline int ixgbe_maybe_stop_tx(struct ixgbe_ring *tx_ring, u16 size)
-{
-	if (likely(ixgbe_desc_unused(tx_ring) >= size))
-		return 0;
-	return __ixgbe_maybe_stop_tx(tx_ring, size);
-}
-
 static u16 ixgbe_select_queue(struct net_device *dev, struct sk_buff *skb,
 			      void *accel_priv, select_queue_fallback_t fallback)
 {
@@ -7120,14 +7207,15 @@ xmit_fcoe:
 #endif /* IXGBE_FCOE */
 	ixgbe_tx_map(tx_ring, first, hdr_len);
 
-	ixgbe_maybe_stop_tx(tx_ring, DESC_NEEDED);
-
 	return NETDEV_TX_OK;
 
 out_drop:
 	dev_kfree_skb_any(first->skb);
 	first->skb = NULL;
 
+	/* earlier packets may have deferred the tail write to this one */
+	ixgbe_write_tail(tx_ring, tx_ring->next_to_use);
+
 	return NETDEV_TX_OK;
 }
 
@@ -8135,6 +8223,7 @@ skip_sriov:
 
 	netdev->priv_flags |= IFF_UNICAST_FLT;
 	netdev->priv_flags |= IFF_SUPP_NOFCS;
+	netdev->priv_flags |= IFF_RX_FILTER;
 
 #ifdef CONFIG_IXGBE_DCB
 	netdev->dcbnl_ops = &dcbnl_ops;
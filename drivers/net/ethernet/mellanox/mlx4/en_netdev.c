@@ -2563,6 +2563,8 @@ int mlx4_en_init_netdev(struct mlx4_en_dev *mdev, int port,
 	if (mdev->dev->caps.steering_mode != MLX4_STEERING_MODE_A0)
 		dev->priv_flags |= IFF_UNICAST_FLT;
 
+	dev->priv_flags |= IFF_RX_FILTER;
+
 	if (mdev->dev->caps.tunnel_offload_mode == MLX4_TUNNEL_OFFLOAD_MODE_VXLAN) {
 		dev->hw_enc_features |= NETIF_F_IP_CSUM | NETIF_F_RXCSUM |
 					NETIF_F_TSO | NETIF_F_GSO_UDP_TUNNEL;
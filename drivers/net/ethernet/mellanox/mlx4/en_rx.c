@@ -657,6 +657,8 @@ int mlx4_en_process_rx_cq(struct net_device *dev, struct mlx4_en_cq *cq, int bud
 	int factor = priv->cqe_factor;
 	u64 timestamp;
 	bool l2_tunnel;
+	struct sk_filter *fp;
+	u32 verdict;
 
 	if (!priv->port_up)
 		return 0;
@@ -664,6 +666,9 @@ int mlx4_en_process_rx_cq(struct net_device *dev, struct mlx4_en_cq *cq, int bud
 	if (budget <= 0)
 		return polled;
 
+	rcu_read_lock();
+	fp = netdev_rx_filter(dev);
+
 	/* We assume a 1:1 mapping between CQEs and Rx descriptors, so Rx
 	 * descriptor offset can be deduced from the CQE index instead of
 	 * reading 'cqe->index' */
@@ -738,6 +743,32 @@ int mlx4_en_process_rx_cq(struct net_device *dev, struct mlx4_en_cq *cq, int bud
 		length -= ring->fcs_del;
 		ring->bytes += length;
 		ring->packets++;
+
+		/* Run the Rx filter while the frame is still in its buffer */
+		verdict = RX_FILTER_PASS;
+		if (fp && length <= priv->frag_info[0].frag_size) {
+			dma_addr_t dma = be64_to_cpu(rx_desc->data[0].addr);
+
+			dma_sync_single_for_cpu(priv->ddev, dma, length,
+						DMA_FROM_DEVICE);
+			verdict = netdev_rx_filter_run(fp, dev,
+					page_address(frags[0].page) +
+					frags[0].page_offset,
+					length, cq->ring);
+			if (verdict == RX_FILTER_DROP)
+				goto next;
+			if (verdict == RX_FILTER_TX) {
+				skb = mlx4_en_rx_skb(priv, rx_desc, frags,
+						     length);
+				if (!skb) {
+					priv->stats.rx_dropped++;
+					goto next;
+				}
+				netdev_rx_filter_xmit(skb, dev);
+				goto next;
+			}
+		}
+
 		l2_tunnel = (dev->hw_enc_features & NETIF_F_RXCSUM) &&
 			(cqe->vlan_my_qpn & cpu_to_be32(MLX4_CQE_L2_TUNNEL));
 
@@ -861,6 +892,7 @@ next:
 	}
 
 out:
+	rcu_read_unlock();
 	AVG_PERF_COUNTER(priv->pstats.rx_coal_avg, polled);
 	mlx4_cq_set_ci(&cq->mcq);
 	wmb(); /* ensure HW sees CQ consumer before we post new buffers */
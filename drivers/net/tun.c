@@ -786,7 +786,7 @@ static netdev_tx_t tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 			  >= dev->tx_queue_len)
 		goto drop;
 
-	if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+	if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC)))
 		goto drop;
 
 	if (skb->sk) {
@@ -1012,7 +1012,8 @@ static struct sk_buff *tun_alloc_skb(struct tun_file *tfile,
 /* Get packet from user space buffer */
 static ssize_t tun_get_user(struct tun_struct *tun, struct tun_file *tfile,
 			    void *msg_control, const struct iovec *iv,
-			    size_t total_len, size_t count, int noblock)
+			    size_t total_len, size_t count, int noblock,
+			    struct sk_buff_head *queue)
 {
 	struct tun_pi pi = { 0, cpu_to_be16(ETH_P_IP) };
 	struct sk_buff *skb;
@@ -1184,7 +1185,10 @@ static ssize_t tun_get_user(struct tun_struct *tun, struct tun_file *tfile,
 	skb_probe_transport_header(skb, 0);
 
 	rxhash = skb_get_hash(skb);
-	netif_rx_ni(skb);
+	if (queue)
+		__skb_queue_tail(queue, skb);
+	else
+		netif_rx_ni(skb);
 
 	tun->dev->stats.rx_packets++;
 	tun->dev->stats.rx_bytes += len;
@@ -1207,7 +1211,7 @@ static ssize_t tun_chr_aio_write(struct kiocb *iocb, const struct iovec *iv,
 	tun_debug(KERN_INFO, tun, "tun_chr_write %ld\n", count);
 
 	result = tun_get_user(tun, tfile, NULL, iv, iov_length(iv, count),
-			      count, file->f_flags & O_NONBLOCK);
+			      count, file->f_flags & O_NONBLOCK, NULL);
 
 	tun_put(tun);
 	return result;
@@ -1401,6 +1405,126 @@ out:
 	return ret;
 }
 
+static void __user *tun_user_ptr(u64 ptr, bool compat)
+{
+#ifdef CONFIG_COMPAT
+	if (compat)
+		return compat_ptr((compat_uptr_t)ptr);
+#endif
+	return (void __user *)(unsigned long)ptr;
+}
+
+static ssize_t tun_import_msg(const struct tun_msg *msg, int type,
+			      bool compat, struct iovec *fast,
+			      struct iovec **iov)
+{
+#ifdef CONFIG_COMPAT
+	if (compat)
+		return compat_rw_copy_check_uvector(type,
+				tun_user_ptr(msg->iov, true), msg->iovlen,
+				UIO_FASTIOV, fast, iov);
+#endif
+	return rw_copy_check_uvector(type, tun_user_ptr(msg->iov, false),
+				     msg->iovlen, UIO_FASTIOV, fast, iov);
+}
+
+/* Hand a batch of written packets to the stack in one softirq section. */
+static void tun_rx_batch(struct sk_buff_head *queue)
+{
+	struct sk_buff *skb;
+
+	local_bh_disable();
+	while ((skb = __skb_dequeue(queue)))
+		netif_receive_skb(skb);
+	local_bh_enable();
+}
+
+static ssize_t tun_send_one(struct tun_struct *tun, struct tun_file *tfile,
+			    const struct iovec *iov, size_t len,
+			    unsigned long count, bool noblock,
+			    struct sk_buff_head *queue)
+{
+	ssize_t ret;
+
+	/* Never sleep on sndbuf while holding packets that count against
+	 * it: deliver what we have first.
+	 */
+	ret = tun_get_user(tun, tfile, NULL, iov, len, count,
+			   noblock || !skb_queue_empty(queue), queue);
+	if (ret == -EAGAIN && !noblock && !skb_queue_empty(queue)) {
+		tun_rx_batch(queue);
+		ret = tun_get_user(tun, tfile, NULL, iov, len, count, false,
+				   queue);
+	}
+
+	return ret;
+}
+
+/* TUNSENDMMSG and TUNRECVMMSG */
+static long tun_chr_mmsg(struct file *file, unsigned int cmd,
+			 void __user *argp, bool compat)
+{
+	struct tun_file *tfile = file->private_data;
+	struct iovec iovstack[UIO_FASTIOV], *iov;
+	struct tun_msg __user *umsg;
+	struct sk_buff_head queue;
+	struct tun_struct *tun;
+	struct tun_mmsg mm;
+	struct tun_msg msg;
+	ssize_t len, ret = 0;
+	unsigned int i;
+	bool noblock;
+
+	if (copy_from_user(&mm, argp, sizeof(mm)))
+		return -EFAULT;
+	if (mm.flags & ~TUN_MMSG_DONTWAIT)
+		return -EINVAL;
+	mm.count = min_t(u32, mm.count, TUN_MMSG_MAX);
+	umsg = tun_user_ptr(mm.msgs, compat);
+	noblock = (file->f_flags & O_NONBLOCK) ||
+		  (mm.flags & TUN_MMSG_DONTWAIT);
+
+	tun = __tun_get(tfile);
+	if (!tun)
+		return -EBADFD;
+
+	__skb_queue_head_init(&queue);
+	for (i = 0; i < mm.count; i++) {
+		if (copy_from_user(&msg, umsg + i, sizeof(msg))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		iov = iovstack;
+		len = tun_import_msg(&msg, cmd == TUNSENDMMSG ? WRITE : READ,
+				     compat, iovstack, &iov);
+		if (len < 0)
+			ret = len;
+		else if (cmd == TUNSENDMMSG)
+			ret = tun_send_one(tun, tfile, iov, len, msg.iovlen,
+					   noblock, &queue);
+		else
+			ret = min_t(ssize_t, len,
+				    tun_do_read(tun, tfile, iov, len,
+						noblock || i));
+		if (iov != iovstack)
+			kfree(iov);
+		if (ret < 0)
+			break;
+
+		if (put_user((u32)ret, &umsg[i].len)) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+
+	if (!skb_queue_empty(&queue))
+		tun_rx_batch(&queue);
+	tun_put(tun);
+
+	return i ? i : ret;
+}
+
 static void tun_free_netdev(struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
@@ -1467,7 +1591,7 @@ static int tun_sendmsg(struct kiocb *iocb, struct socket *sock,
 	if (!tun)
 		return -EBADFD;
 	ret = tun_get_user(tun, tfile, m->msg_control, m->msg_iov, total_len,
-			   m->msg_iovlen, m->msg_flags & MSG_DONTWAIT);
+			   m->msg_iovlen, m->msg_flags & MSG_DONTWAIT, NULL);
 	tun_put(tun);
 	return ret;
 }
@@ -2132,6 +2256,9 @@ unlock:
 static long tun_chr_ioctl(struct file *file,
 			  unsigned int cmd, unsigned long arg)
 {
+	if (cmd == TUNSENDMMSG || cmd == TUNRECVMMSG)
+		return tun_chr_mmsg(file, cmd, (void __user *)arg, false);
+
 	return __tun_chr_ioctl(file, cmd, arg, sizeof (struct ifreq));
 }
 
@@ -2140,6 +2267,9 @@ static long tun_chr_compat_ioctl(struct file *file,
 			 unsigned int cmd, unsigned long arg)
 {
 	switch (cmd) {
+	case TUNSENDMMSG:
+	case TUNRECVMMSG:
+		return tun_chr_mmsg(file, cmd, compat_ptr(arg), true);
 	case TUNSETIFF:
 	case TUNGETIFF:
 	case TUNSETTXFILTER:
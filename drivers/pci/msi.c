@@ -388,6 +388,14 @@ static void free_msi_irqs(struct pci_dev *dev)
 			BUG_ON(irq_has_action(entry->irq + i));
 	}
 
+	if (dev->msix_affinity) {
+		list_for_each_entry(entry, &dev->msi_list, list)
+			if (entry->irq)
+				irq_set_affinity_managed(entry->irq, NULL);
+		kfree(dev->msix_affinity);
+		dev->msix_affinity = NULL;
+	}
+
 	arch_teardown_msi_irqs(dev);
 
 	list_for_each_entry_safe(entry, tmp, &dev->msi_list, list) {
@@ -1191,3 +1199,58 @@ int pci_enable_msix_range(struct pci_dev *dev, struct msix_entry *entries,
 	return nvec;
 }
 EXPORT_SYMBOL(pci_enable_msix_range);
+
+/**
+ * pci_enable_msix_range_affinity - enable MSI-X with vectors spread over cpus
+ * @dev: pointer to the pci_dev data structure of MSI-X device function
+ * @entries: pointer to an array of MSI-X entries
+ * @minvec: minimum number of MSI-X irqs requested
+ * @maxvec: maximum number of MSI-X irqs requested
+ *
+ * Works like pci_enable_msix_range(), and in addition spreads the
+ * allocated vectors over the online cpus with irq_create_affinity_masks()
+ * and hands their affinity to the kernel, so that per-queue interrupts
+ * stay local to the node and cpus serving the queue.  The mask of each
+ * vector can be read back with pci_msix_vector_affinity().  If the masks
+ * can't be allocated MSI-X is left enabled with the default affinity.
+ **/
+int pci_enable_msix_range_affinity(struct pci_dev *dev,
+				   struct msix_entry *entries,
+				   int minvec, int maxvec)
+{
+	int nvec, i;
+
+	nvec = pci_enable_msix_range(dev, entries, minvec, maxvec);
+	if (nvec < 0)
+		return nvec;
+
+	dev->msix_affinity = irq_create_affinity_masks(nvec);
+	if (!dev->msix_affinity)
+		return nvec;
+
+	for (i = 0; i < nvec; i++)
+		irq_set_affinity_managed(entries[i].vector,
+					 &dev->msix_affinity[i]);
+
+	return nvec;
+}
+EXPORT_SYMBOL(pci_enable_msix_range_affinity);
+
+/**
+ * pci_msix_vector_affinity - cpus an MSI-X vector is spread to
+ * @dev: pointer to the pci_dev data structure of MSI-X device function
+ * @nr: index of the vector in the entries given to
+ *	pci_enable_msix_range_affinity()
+ *
+ * Returns the mask, or %NULL if the vectors of @dev weren't spread.  The
+ * masks of consecutive vectors are consecutive, so the result can be
+ * given to blk-mq as the affinity of a run of hardware queues.
+ **/
+const struct cpumask *pci_msix_vector_affinity(struct pci_dev *dev, int nr)
+{
+	if (!dev->msix_affinity)
+		return NULL;
+
+	return &dev->msix_affinity[nr];
+}
+EXPORT_SYMBOL(pci_msix_vector_affinity);
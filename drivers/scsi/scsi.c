@@ -44,6 +44,7 @@
 #include <linux/string.h>
 #include <linux/slab.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/delay.h>
 #include <linux/init.h>
 #include <linux/completion.h>
@@ -605,7 +606,7 @@ void scsi_log_completion(struct scsi_cmnd *cmd, int disposition)
 			if (level > 3)
 				scmd_printk(KERN_INFO, cmd,
 					    "scsi host busy %d failed %d\n",
-					    cmd->device->host->host_busy,
+					    atomic_read(&cmd->device->host->host_busy),
 					    cmd->device->host->host_failed);
 		}
 	}
@@ -733,14 +734,18 @@ int scsi_dispatch_cmd(struct scsi_cmnd *cmd)
  *
  * Description: This function is the mid-level's (SCSI Core) interrupt routine,
  * which regains ownership of the SCSI command (de facto) from a LLDD, and
- * calls blk_complete_request() for further processing.
+ * calls blk_complete_request() (or blk_mq_complete_request() for blk-mq
+ * hosts) for further processing.
  *
  * This function is interrupt context safe.
  */
 static void scsi_done(struct scsi_cmnd *cmd)
 {
 	trace_scsi_dispatch_cmd_done(cmd);
-	blk_complete_request(cmd->request);
+	if (cmd->request->mq_ctx)
+		blk_mq_complete_request(cmd->request);
+	else
+		blk_complete_request(cmd->request);
 }
 
 /**
@@ -761,17 +766,21 @@ void scsi_finish_command(struct scsi_cmnd *cmd)
 
 	scsi_device_unbusy(sdev);
 
-        /*
-         * Clear the flags which say that the device/host is no longer
-         * capable of accepting new commands.  These are set in scsi_queue.c
-         * for both the queue full condition on a device, and for a
-         * host full condition on the host.
+	/*
+	 * Clear the flags which say that the device/host is no longer
+	 * capable of accepting new commands.  These are set in scsi_queue.c
+	 * for both the queue full condition on a device, and for a
+	 * host full condition on the host.
 	 *
-	 * XXX(hch): What about locking?
-         */
-        shost->host_blocked = 0;
-	starget->target_blocked = 0;
-        sdev->device_blocked = 0;
+	 * Only write them when set, to keep the cachelines clean on the
+	 * fast path.
+	 */
+	if (atomic_read(&shost->host_blocked))
+		atomic_set(&shost->host_blocked, 0);
+	if (atomic_read(&starget->target_blocked))
+		atomic_set(&starget->target_blocked, 0);
+	if (atomic_read(&sdev->device_blocked))
+		atomic_set(&sdev->device_blocked, 0);
 
 	/*
 	 * If we have valid sense information, then some kind of recovery
@@ -1396,6 +1405,10 @@ MODULE_LICENSE("GPL");
 module_param(scsi_logging_level, int, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(scsi_logging_level, "a bit mask of logging levels");
 
+bool scsi_use_blk_mq = true;
+module_param_named(use_blk_mq, scsi_use_blk_mq, bool, S_IRUGO);
+MODULE_PARM_DESC(use_blk_mq, "use blk-mq for hosts whose driver supports it");
+
 static int __init init_scsi(void)
 {
 	int error;
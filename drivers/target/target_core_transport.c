@@ -517,6 +517,7 @@ EXPORT_SYMBOL(transport_deregister_session);
 static void target_remove_from_state_list(struct se_cmd *cmd)
 {
 	struct se_device *dev = cmd->se_dev;
+	struct se_device_queue *q;
 	unsigned long flags;
 
 	if (!dev)
@@ -525,12 +526,13 @@ static void target_remove_from_state_list(struct se_cmd *cmd)
 	if (cmd->transport_state & CMD_T_BUSY)
 		return;
 
-	spin_lock_irqsave(&dev->execute_task_lock, flags);
+	q = per_cpu_ptr(dev->queues, cmd->cpuid);
+	spin_lock_irqsave(&q->lock, flags);
 	if (cmd->state_active) {
 		list_del(&cmd->state_list);
 		cmd->state_active = false;
 	}
-	spin_unlock_irqrestore(&dev->execute_task_lock, flags);
+	spin_unlock_irqrestore(&q->lock, flags);
 }
 
 static int transport_cmd_check_stop(struct se_cmd *cmd, bool remove_from_lists,
@@ -699,7 +701,12 @@ void target_complete_cmd(struct se_cmd *cmd, u8 scsi_status)
 	cmd->transport_state |= (CMD_T_COMPLETE | CMD_T_ACTIVE);
 	spin_unlock_irqrestore(&cmd->t_state_lock, flags);
 
-	queue_work(target_completion_wq, &cmd->work);
+	/*
+	 * Complete on the CPU the command was submitted from, so that the
+	 * fabric's per-CPU state stays cache hot instead of every
+	 * completion running wherever the backend interrupt landed.
+	 */
+	queue_work_on(cmd->cpuid, target_completion_wq, &cmd->work);
 }
 EXPORT_SYMBOL(target_complete_cmd);
 
@@ -720,17 +727,23 @@ void target_complete_cmd_with_length(struct se_cmd *cmd, u8 scsi_status, int len
 }
 EXPORT_SYMBOL(target_complete_cmd_with_length);
 
+/*
+ * Commands in flight are kept on the list of the CPU they were submitted
+ * on, so that submission and completion on different CPUs, and of
+ * different sessions, do not all bounce a single per-device lock.
+ */
 static void target_add_to_state_list(struct se_cmd *cmd)
 {
 	struct se_device *dev = cmd->se_dev;
+	struct se_device_queue *q = per_cpu_ptr(dev->queues, cmd->cpuid);
 	unsigned long flags;
 
-	spin_lock_irqsave(&dev->execute_task_lock, flags);
+	spin_lock_irqsave(&q->lock, flags);
 	if (!cmd->state_active) {
-		list_add_tail(&cmd->state_list, &dev->state_list);
+		list_add_tail(&cmd->state_list, &q->state_list);
 		cmd->state_active = true;
 	}
-	spin_unlock_irqrestore(&dev->execute_task_lock, flags);
+	spin_unlock_irqrestore(&q->lock, flags);
 }
 
 /*
@@ -1132,6 +1145,7 @@ void transport_init_se_cmd(
 	spin_lock_init(&cmd->t_state_lock);
 	kref_init(&cmd->cmd_kref);
 	cmd->transport_state = CMD_T_DEV_ACTIVE;
+	cmd->cpuid = raw_smp_processor_id();
 
 	cmd->se_tfo = tfo;
 	cmd->se_sess = se_sess;
@@ -37,6 +37,14 @@ enum {
 #define vhost_used_event(vq) ((u16 __user *)&vq->avail->ring[vq->num])
 #define vhost_avail_event(vq) ((u16 __user *)&vq->used->ring[vq->num])
 
+#define vhost_packed_desc(vq) ((struct vring_packed_desc __user *)vq->desc)
+#define vhost_driver_event(vq) \
+	((struct vring_packed_desc_event __user *)vq->avail)
+#define vhost_device_event(vq) \
+	((struct vring_packed_desc_event __user *)vq->used)
+
+#define VHOST_WRAP_CTR (1 << VRING_PACKED_EVENT_F_WRAP_CTR)
+
 static void vhost_poll_func(struct file *file, wait_queue_head_t *wqh,
 			    poll_table *pt)
 {
@@ -175,6 +183,13 @@ void vhost_poll_queue(struct vhost_poll *poll)
 }
 EXPORT_SYMBOL_GPL(vhost_poll_queue);
 
+/* A check for pending work only, used to cut a busy loop short. */
+bool vhost_has_work(struct vhost_dev *dev)
+{
+	return !list_empty(&dev->work_list);
+}
+EXPORT_SYMBOL_GPL(vhost_has_work);
+
 static void vhost_vq_reset(struct vhost_dev *dev,
 			   struct vhost_virtqueue *vq)
 {
@@ -187,6 +202,9 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 	vq->last_used_idx = 0;
 	vq->signalled_used = 0;
 	vq->signalled_used_valid = false;
+	vq->avail_wrap_counter = true;
+	vq->used_wrap_counter = true;
+	vq->packed_fetches = 0;
 	vq->used_flags = 0;
 	vq->log_used = false;
 	vq->log_addr = -1ull;
@@ -198,6 +216,7 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 	vq->call_ctx = NULL;
 	vq->call = NULL;
 	vq->log_ctx = NULL;
+	vq->busyloop_timeout = 0;
 }
 
 static int vhost_worker(void *data)
@@ -257,6 +276,10 @@ static void vhost_vq_free_iovecs(struct vhost_virtqueue *vq)
 	vq->log = NULL;
 	kfree(vq->heads);
 	vq->heads = NULL;
+	kfree(vq->packed_descs);
+	vq->packed_descs = NULL;
+	kfree(vq->packed_fetched);
+	vq->packed_fetched = NULL;
 }
 
 /* Helper to allocate iovec buffers for all vqs. */
@@ -271,7 +294,13 @@ static long vhost_dev_alloc_iovecs(struct vhost_dev *dev)
 				       GFP_KERNEL);
 		vq->log = kmalloc(sizeof *vq->log * UIO_MAXIOV, GFP_KERNEL);
 		vq->heads = kmalloc(sizeof *vq->heads * UIO_MAXIOV, GFP_KERNEL);
-		if (!vq->indirect || !vq->log || !vq->heads)
+		/* Packed rings are limited to UIO_MAXIOV entries. */
+		vq->packed_descs = kmalloc(sizeof *vq->packed_descs *
+					   UIO_MAXIOV, GFP_KERNEL);
+		vq->packed_fetched = kmalloc(sizeof *vq->packed_fetched *
+					     UIO_MAXIOV, GFP_KERNEL);
+		if (!vq->indirect || !vq->log || !vq->heads ||
+		    !vq->packed_descs || !vq->packed_fetched)
 			goto err_nomem;
 	}
 	return 0;
@@ -312,6 +341,8 @@ void vhost_dev_init(struct vhost_dev *dev,
 		vq->log = NULL;
 		vq->indirect = NULL;
 		vq->heads = NULL;
+		vq->packed_descs = NULL;
+		vq->packed_fetched = NULL;
 		vq->dev = dev;
 		mutex_init(&vq->mutex);
 		vhost_vq_reset(dev, vq);
@@ -538,12 +569,33 @@ static int memory_access_ok(struct vhost_dev *d, struct vhost_memory *mem,
 	return 1;
 }
 
+/* What log_addr points at: the used ring, or the descriptors that we write
+ * back into for a packed ring. */
+static size_t vq_log_size(struct vhost_dev *d, unsigned int num)
+{
+	size_t s = vhost_has_feature(d, VIRTIO_RING_F_EVENT_IDX) ? 2 : 0;
+
+	if (vhost_has_feature(d, VIRTIO_RING_F_PACKED))
+		return num * sizeof(struct vring_packed_desc);
+	return sizeof(struct vring_used) +
+	       num * sizeof(struct vring_used_elem) + s;
+}
+
 static int vq_access_ok(struct vhost_dev *d, unsigned int num,
 			struct vring_desc __user *desc,
 			struct vring_avail __user *avail,
 			struct vring_used __user *used)
 {
 	size_t s = vhost_has_feature(d, VIRTIO_RING_F_EVENT_IDX) ? 2 : 0;
+
+	if (vhost_has_feature(d, VIRTIO_RING_F_PACKED))
+		return num <= UIO_MAXIOV &&
+		       access_ok(VERIFY_WRITE, desc,
+				 num * sizeof(struct vring_packed_desc)) &&
+		       access_ok(VERIFY_READ, avail,
+				 sizeof(struct vring_packed_desc_event)) &&
+		       access_ok(VERIFY_WRITE, used,
+				 sizeof(struct vring_packed_desc_event));
 	return access_ok(VERIFY_READ, desc, num * sizeof *desc) &&
 	       access_ok(VERIFY_READ, avail,
 			 sizeof *avail + num * sizeof *avail->ring + s) &&
@@ -569,21 +621,23 @@ static int vq_log_access_ok(struct vhost_dev *d, struct vhost_virtqueue *vq,
 			    void __user *log_base)
 {
 	struct vhost_memory *mp;
-	size_t s = vhost_has_feature(d, VIRTIO_RING_F_EVENT_IDX) ? 2 : 0;
 
 	mp = rcu_dereference_protected(vq->dev->memory,
 				       lockdep_is_held(&vq->mutex));
 	return vq_memory_access_ok(log_base, mp,
 			    vhost_has_feature(vq->dev, VHOST_F_LOG_ALL)) &&
 		(!vq->log_used || log_access_ok(log_base, vq->log_addr,
-					sizeof *vq->used +
-					vq->num * sizeof *vq->used->ring + s));
+						vq_log_size(d, vq->num)));
 }
 
 /* Can we start vq? */
 /* Caller should have vq mutex and device mutex */
 int vhost_vq_access_ok(struct vhost_virtqueue *vq)
 {
+	/* Packed ring positions from VHOST_SET_VRING_BASE index the ring. */
+	if (vhost_has_feature(vq->dev, VIRTIO_RING_F_PACKED) &&
+	    (vq->last_avail_idx >= vq->num || vq->last_used_idx >= vq->num))
+		return 0;
 	return vq_access_ok(vq->dev, vq->num, vq->desc, vq->avail, vq->used) &&
 		vq_log_access_ok(vq->dev, vq, vq->log_base);
 }
@@ -676,6 +730,18 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 			r = -EFAULT;
 			break;
 		}
+		/* Packed rings have no used index in guest memory to start
+		 * from, so the base carries both positions and their wrap
+		 * counters, the used one in the top half. */
+		if (vhost_has_feature(d, VIRTIO_RING_F_PACKED)) {
+			vq->last_avail_idx = s.num & (VHOST_WRAP_CTR - 1);
+			vq->avail_wrap_counter = !!(s.num & VHOST_WRAP_CTR);
+			vq->last_used_idx = s.num >> 16 & (VHOST_WRAP_CTR - 1);
+			vq->used_wrap_counter = !!(s.num >> 16 &
+						   VHOST_WRAP_CTR);
+			vq->packed_fetches = 0;
+			break;
+		}
 		if (s.num > 0xffff) {
 			r = -EINVAL;
 			break;
@@ -687,6 +753,24 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 	case VHOST_GET_VRING_BASE:
 		s.index = idx;
 		s.num = vq->last_avail_idx;
+		if (vhost_has_feature(d, VIRTIO_RING_F_PACKED))
+			s.num |= (vq->avail_wrap_counter ? VHOST_WRAP_CTR : 0) |
+				 (vq->last_used_idx |
+				  (vq->used_wrap_counter ?
+				   VHOST_WRAP_CTR : 0)) << 16;
+		if (copy_to_user(argp, &s, sizeof s))
+			r = -EFAULT;
+		break;
+	case VHOST_SET_VRING_BUSYLOOP_TIMEOUT:
+		if (copy_from_user(&s, argp, sizeof s)) {
+			r = -EFAULT;
+			break;
+		}
+		vq->busyloop_timeout = s.num;
+		break;
+	case VHOST_GET_VRING_BUSYLOOP_TIMEOUT:
+		s.index = idx;
+		s.num = vq->busyloop_timeout;
 		if (copy_to_user(argp, &s, sizeof s))
 			r = -EFAULT;
 		break;
@@ -729,8 +813,7 @@ long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp)
 			/* Also validate log access for used ring if enabled. */
 			if ((a.flags & (0x1 << VHOST_VRING_F_LOG)) &&
 			    !log_access_ok(vq->log_base, a.log_guest_addr,
-					   sizeof *vq->used +
-					   vq->num * sizeof *vq->used->ring)) {
+					   vq_log_size(d, vq->num))) {
 				r = -EINVAL;
 				break;
 			}
@@ -1030,12 +1113,44 @@ static int vhost_update_avail_event(struct vhost_virtqueue *vq, u16 avail_event)
 	return 0;
 }
 
+/* Tell the guest whether and where to kick us on a packed ring.  This is
+ * only a hint, like the event index, so the write is not logged. */
+static int vhost_update_device_event(struct vhost_virtqueue *vq)
+{
+	struct vring_packed_desc_event __user *event = vhost_device_event(vq);
+	u16 flags;
+
+	if (vq->used_flags & VRING_USED_F_NO_NOTIFY) {
+		flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+	} else if (vhost_has_feature(vq->dev, VIRTIO_RING_F_EVENT_IDX)) {
+		if (__put_user(vq->last_avail_idx |
+			       (vq->avail_wrap_counter ? VHOST_WRAP_CTR : 0),
+			       &event->off_wrap))
+			return -EFAULT;
+		/* The guest must see the offset before the flag. */
+		smp_wmb();
+		flags = VRING_PACKED_EVENT_FLAG_DESC;
+	} else {
+		flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+	}
+
+	if (__put_user(flags, &event->flags))
+		return -EFAULT;
+	return 0;
+}
+
 int vhost_init_used(struct vhost_virtqueue *vq)
 {
 	int r;
 	if (!vq->private_data)
 		return 0;
 
+	/* The positions came with VHOST_SET_VRING_BASE. */
+	if (vhost_has_feature(vq->dev, VIRTIO_RING_F_PACKED)) {
+		vq->signalled_used_valid = false;
+		return vhost_update_device_event(vq);
+	}
+
 	r = vhost_update_used_flags(vq);
 	if (r)
 		return r;
@@ -1190,6 +1305,210 @@ static int get_indirect(struct vhost_dev *dev, struct vhost_virtqueue *vq,
 	return 0;
 }
 
+/* get_indirect() for the packed ring, whose table is read in order. */
+static int get_indirect_packed(struct vhost_dev *dev,
+			       struct vhost_virtqueue *vq,
+			       struct iovec iov[], unsigned int iov_size,
+			       unsigned int *out_num, unsigned int *in_num,
+			       struct vhost_log *log, unsigned int *log_num,
+			       struct vring_packed_desc *indirect)
+{
+	struct vring_packed_desc desc;
+	unsigned int i, count;
+	int ret;
+
+	/* Sanity check */
+	if (unlikely(indirect->len % sizeof desc || !indirect->len)) {
+		vq_err(vq, "Invalid length in indirect descriptor: "
+		       "len 0x%llx not multiple of 0x%zx\n",
+		       (unsigned long long)indirect->len,
+		       sizeof desc);
+		return -EINVAL;
+	}
+
+	ret = translate_desc(dev, indirect->addr, indirect->len, vq->indirect,
+			     UIO_MAXIOV);
+	if (unlikely(ret < 0)) {
+		vq_err(vq, "Translation failure %d in indirect.\n", ret);
+		return ret;
+	}
+
+	/* We will use the result as an address to read from, so most
+	 * architectures only need a compiler barrier here. */
+	read_barrier_depends();
+
+	count = indirect->len / sizeof desc;
+	for (i = 0; i < count; i++) {
+		unsigned iov_count = *in_num + *out_num;
+
+		if (unlikely(memcpy_fromiovec((unsigned char *)&desc,
+					      vq->indirect, sizeof desc))) {
+			vq_err(vq, "Failed indirect descriptor: idx %d, %zx\n",
+			       i, (size_t)indirect->addr + i * sizeof desc);
+			return -EINVAL;
+		}
+		if (unlikely(desc.flags & VRING_DESC_F_INDIRECT)) {
+			vq_err(vq, "Nested indirect descriptor: idx %d, %zx\n",
+			       i, (size_t)indirect->addr + i * sizeof desc);
+			return -EINVAL;
+		}
+
+		ret = translate_desc(dev, desc.addr, desc.len, iov + iov_count,
+				     iov_size - iov_count);
+		if (unlikely(ret < 0)) {
+			vq_err(vq, "Translation failure %d indirect idx %d\n",
+			       ret, i);
+			return ret;
+		}
+		/* If this is an input descriptor, increment that count. */
+		if (desc.flags & VRING_DESC_F_WRITE) {
+			*in_num += ret;
+			if (unlikely(log)) {
+				log[*log_num].addr = desc.addr;
+				log[*log_num].len = desc.len;
+				++*log_num;
+			}
+		} else {
+			/* If it's an output descriptor, they're all supposed
+			 * to come before any input descriptors. */
+			if (unlikely(*in_num)) {
+				vq_err(vq, "Indirect descriptor "
+				       "has out after in: idx %d\n", i);
+				return -EINVAL;
+			}
+			*out_num += ret;
+		}
+	}
+	return 0;
+}
+
+/* Has the guest made the packed descriptor with these flags available on
+ * the lap given by wrap_counter? */
+static inline bool vhost_packed_desc_avail(u16 flags, bool wrap_counter)
+{
+	bool avail = flags & (1 << VRING_PACKED_DESC_F_AVAIL);
+	bool used = flags & (1 << VRING_PACKED_DESC_F_USED);
+
+	return avail == wrap_counter && used != wrap_counter;
+}
+
+/* vhost_get_vq_desc() for the packed ring.  The chain starts at
+ * last_avail_idx and runs on through the ring, its last descriptor holds
+ * the buffer id that we return. */
+static int vhost_get_vq_desc_packed(struct vhost_dev *dev,
+				    struct vhost_virtqueue *vq,
+				    struct iovec iov[], unsigned int iov_size,
+				    unsigned int *out_num, unsigned int *in_num,
+				    struct vhost_log *log,
+				    unsigned int *log_num)
+{
+	struct vring_packed_desc __user *ring = vhost_packed_desc(vq);
+	struct vring_packed_desc desc;
+	bool wrap_counter = vq->avail_wrap_counter;
+	unsigned int i = vq->last_avail_idx, found = 0;
+	u16 flags;
+	int ret;
+
+	if (unlikely(__get_user(flags, &ring[i].flags))) {
+		vq_err(vq, "Failed to access desc flags at %p\n",
+		       &ring[i].flags);
+		return -EFAULT;
+	}
+
+	/* If there's nothing new since last we looked, return invalid. */
+	if (!vhost_packed_desc_avail(flags, wrap_counter))
+		return vq->num;
+
+	/* Only read the chain after the guest has exposed its head, which
+	 * it makes available last. */
+	smp_rmb();
+
+	/* When we start there are none of either input nor output. */
+	*out_num = *in_num = 0;
+	if (unlikely(log))
+		*log_num = 0;
+
+	do {
+		unsigned iov_count = *in_num + *out_num;
+		if (unlikely(++found > vq->num)) {
+			vq_err(vq, "Loop detected: last one at %u "
+			       "vq size %u head %u\n",
+			       i, vq->num, vq->last_avail_idx);
+			return -EINVAL;
+		}
+		ret = __copy_from_user(&desc, ring + i, sizeof desc);
+		if (unlikely(ret)) {
+			vq_err(vq, "Failed to get descriptor: idx %d addr %p\n",
+			       i, ring + i);
+			return -EFAULT;
+		}
+		if (++i == vq->num) {
+			i = 0;
+			wrap_counter ^= 1;
+		}
+
+		if (desc.flags & VRING_DESC_F_INDIRECT) {
+			ret = get_indirect_packed(dev, vq, iov, iov_size,
+						  out_num, in_num,
+						  log, log_num, &desc);
+			if (unlikely(ret < 0)) {
+				vq_err(vq, "Failure detected "
+				       "in indirect descriptor at idx %d\n", i);
+				return ret;
+			}
+			continue;
+		}
+
+		ret = translate_desc(dev, desc.addr, desc.len, iov + iov_count,
+				     iov_size - iov_count);
+		if (unlikely(ret < 0)) {
+			vq_err(vq, "Translation failure %d descriptor idx %d\n",
+			       ret, i);
+			return ret;
+		}
+		if (desc.flags & VRING_DESC_F_WRITE) {
+			/* If this is an input descriptor,
+			 * increment that count. */
+			*in_num += ret;
+			if (unlikely(log)) {
+				log[*log_num].addr = desc.addr;
+				log[*log_num].len = desc.len;
+				++*log_num;
+			}
+		} else {
+			/* If it's an output descriptor, they're all supposed
+			 * to come before any input descriptors. */
+			if (unlikely(*in_num)) {
+				vq_err(vq, "Descriptor has out after in: "
+				       "idx %d\n", i);
+				return -EINVAL;
+			}
+			*out_num += ret;
+		}
+	} while (desc.flags & VRING_DESC_F_NEXT);
+
+	/* If their number is silly, that's an error. */
+	if (unlikely(desc.id >= vq->num)) {
+		vq_err(vq, "Guest says buffer id %u > %u is available",
+		       desc.id, vq->num);
+		return -EINVAL;
+	}
+
+	/* On success, remember where we were and how far the buffer goes,
+	 * then move on. */
+	vq->packed_fetched[vq->packed_fetches++ % UIO_MAXIOV] =
+		vq->last_avail_idx |
+		(vq->avail_wrap_counter ? VHOST_WRAP_CTR : 0);
+	vq->packed_descs[desc.id] = found;
+	vq->last_avail_idx = i;
+	vq->avail_wrap_counter = wrap_counter;
+
+	/* Assume notifications from guest are disabled at this point,
+	 * if they aren't we would need to update the device event. */
+	BUG_ON(!(vq->used_flags & VRING_USED_F_NO_NOTIFY));
+	return desc.id;
+}
+
 /* This looks in the virtqueue and for the first available buffer, and converts
  * it to an iovec for convenient access.  Since descriptors consist of some
  * number of output then some number of input descriptors, it's actually two
@@ -1208,6 +1527,10 @@ int vhost_get_vq_desc(struct vhost_dev *dev, struct vhost_virtqueue *vq,
 	u16 last_avail_idx;
 	int ret;
 
+	if (vhost_has_feature(dev, VIRTIO_RING_F_PACKED))
+		return vhost_get_vq_desc_packed(dev, vq, iov, iov_size,
+						out_num, in_num, log, log_num);
+
 	/* Check it isn't doing very strange things with descriptor numbers. */
 	last_avail_idx = vq->last_avail_idx;
 	if (unlikely(__get_user(vq->avail_idx, &vq->avail->idx))) {
@@ -1324,7 +1647,21 @@ EXPORT_SYMBOL_GPL(vhost_get_vq_desc);
 /* Reverse the effect of vhost_get_vq_desc. Useful for error handling. */
 void vhost_discard_vq_desc(struct vhost_virtqueue *vq, int n)
 {
-	vq->last_avail_idx -= n;
+	u16 off_wrap;
+
+	if (!vhost_has_feature(vq->dev, VIRTIO_RING_F_PACKED)) {
+		vq->last_avail_idx -= n;
+		return;
+	}
+
+	/* Buffers take a varying number of descriptors: go back to where
+	 * the n-th last fetch started. */
+	if (!n)
+		return;
+	vq->packed_fetches -= n;
+	off_wrap = vq->packed_fetched[vq->packed_fetches % UIO_MAXIOV];
+	vq->last_avail_idx = off_wrap & (VHOST_WRAP_CTR - 1);
+	vq->avail_wrap_counter = !!(off_wrap & VHOST_WRAP_CTR);
 }
 EXPORT_SYMBOL_GPL(vhost_discard_vq_desc);
 
@@ -1381,6 +1718,63 @@ static int __vhost_add_used_n(struct vhost_virtqueue *vq,
 	return 0;
 }
 
+/* vhost_add_used_n() for the packed ring: each buffer is written back
+ * into the first descriptor it took, and we skip over the rest. */
+static int vhost_add_used_n_packed(struct vhost_virtqueue *vq,
+				   struct vring_used_elem *heads,
+				   unsigned count)
+{
+	struct vring_packed_desc __user *ring = vhost_packed_desc(vq);
+	struct vring_packed_desc __user *used;
+	unsigned int i, n;
+	u16 flags;
+
+	for (n = 0; n < count; n++) {
+		if (unlikely(heads[n].id >= vq->num)) {
+			vq_err(vq, "Used id %u out of range", heads[n].id);
+			return -EINVAL;
+		}
+		used = ring + vq->last_used_idx;
+		if (__put_user(heads[n].id, &used->id)) {
+			vq_err(vq, "Failed to write used id");
+			return -EFAULT;
+		}
+		if (__put_user(heads[n].len, &used->len)) {
+			vq_err(vq, "Failed to write used len");
+			return -EFAULT;
+		}
+		/* Make sure buffer is written before we flag it used. */
+		smp_wmb();
+		flags = vq->used_wrap_counter ?
+			1 << VRING_PACKED_DESC_F_AVAIL |
+			1 << VRING_PACKED_DESC_F_USED : 0;
+		if (__put_user(flags, &used->flags)) {
+			vq_err(vq, "Failed to write used flags");
+			return -EFAULT;
+		}
+		if (unlikely(vq->log_used)) {
+			/* Make sure data is seen before log. */
+			smp_wmb();
+			/* Log used descriptor write. */
+			log_write(vq->log_base,
+				  vq->log_addr +
+				   ((void __user *)used - (void __user *)ring),
+				  sizeof *used);
+		}
+
+		i = vq->last_used_idx + vq->packed_descs[heads[n].id];
+		if (i >= vq->num) {
+			i -= vq->num;
+			vq->used_wrap_counter ^= 1;
+		}
+		vq->last_used_idx = i;
+	}
+
+	if (unlikely(vq->log_used) && vq->log_ctx)
+		eventfd_signal(vq->log_ctx, 1);
+	return 0;
+}
+
 /* After we've used one of their buffers, we tell them about it.  We'll then
  * want to notify the guest, using eventfd. */
 int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
@@ -1388,6 +1782,9 @@ int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
 {
 	int start, n, r;
 
+	if (vhost_has_feature(vq->dev, VIRTIO_RING_F_PACKED))
+		return vhost_add_used_n_packed(vq, heads, count);
+
 	start = vq->last_used_idx % vq->num;
 	n = vq->num - start;
 	if (n < count) {
@@ -1417,6 +1814,46 @@ int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
 }
 EXPORT_SYMBOL_GPL(vhost_add_used_n);
 
+/* vhost_notify() for the packed ring, whose positions wrap at vq->num. */
+static bool vhost_notify_packed(struct vhost_dev *dev,
+				struct vhost_virtqueue *vq)
+{
+	struct vring_packed_desc_event __user *event = vhost_driver_event(vq);
+	u16 flags, off_wrap, event_idx, old, new;
+	bool v;
+
+	if (__get_user(flags, &event->flags)) {
+		vq_err(vq, "Failed to get driver event flags");
+		return true;
+	}
+	if (flags != VRING_PACKED_EVENT_FLAG_DESC)
+		return flags != VRING_PACKED_EVENT_FLAG_DISABLE;
+
+	/* Read the offset after the flag that says it is valid. */
+	smp_rmb();
+	if (__get_user(off_wrap, &event->off_wrap)) {
+		vq_err(vq, "Failed to get driver event offset");
+		return true;
+	}
+
+	old = vq->signalled_used;
+	v = vq->signalled_used_valid;
+	new = vq->signalled_used = vq->last_used_idx;
+	vq->signalled_used_valid = true;
+
+	if (unlikely(!v))
+		return true;
+
+	/* Move what we signalled last, and the guest's event if it is
+	 * still on the lap before, to below 0, see vring_need_event(). */
+	event_idx = off_wrap & ~VHOST_WRAP_CTR;
+	if (!!(off_wrap & VHOST_WRAP_CTR) != vq->used_wrap_counter)
+		event_idx -= vq->num;
+	if (old > new)
+		old -= vq->num;
+	return vring_need_event(event_idx, new, old);
+}
+
 static bool vhost_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 {
 	__u16 old, new, event;
@@ -1426,6 +1863,13 @@ static bool vhost_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 	 * interrupts. */
 	smp_mb();
 
+	if (vhost_has_feature(dev, VIRTIO_RING_F_PACKED)) {
+		if (vhost_has_feature(dev, VIRTIO_F_NOTIFY_ON_EMPTY) &&
+		    unlikely(vhost_vq_avail_empty(dev, vq)))
+			return true;
+		return vhost_notify_packed(dev, vq);
+	}
+
 	if (vhost_has_feature(dev, VIRTIO_F_NOTIFY_ON_EMPTY) &&
 	    unlikely(vq->avail_idx == vq->last_avail_idx))
 		return true;
@@ -1491,6 +1935,18 @@ bool vhost_enable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 	if (!(vq->used_flags & VRING_USED_F_NO_NOTIFY))
 		return false;
 	vq->used_flags &= ~VRING_USED_F_NO_NOTIFY;
+	if (vhost_has_feature(dev, VIRTIO_RING_F_PACKED)) {
+		r = vhost_update_device_event(vq);
+		if (r) {
+			vq_err(vq, "Failed to enable notification at %p: %d\n",
+			       vhost_device_event(vq), r);
+			return false;
+		}
+		/* They could have slipped one in as we were doing that: make
+		 * sure it's written, then check again. */
+		smp_mb();
+		return !vhost_vq_avail_empty(dev, vq);
+	}
 	if (!vhost_has_feature(dev, VIRTIO_RING_F_EVENT_IDX)) {
 		r = vhost_update_used_flags(vq);
 		if (r) {
@@ -1520,6 +1976,29 @@ bool vhost_enable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 }
 EXPORT_SYMBOL_GPL(vhost_enable_notify);
 
+/* Has the guest added no buffers since we last looked?  Faults count as
+ * empty, the caller will find out on the real fetch.
+ */
+bool vhost_vq_avail_empty(struct vhost_dev *dev, struct vhost_virtqueue *vq)
+{
+	u16 avail_idx, flags;
+
+	if (vhost_has_feature(dev, VIRTIO_RING_F_PACKED)) {
+		struct vring_packed_desc __user *desc;
+
+		desc = vhost_packed_desc(vq) + vq->last_avail_idx;
+		if (__get_user(flags, &desc->flags))
+			return true;
+		return !vhost_packed_desc_avail(flags, vq->avail_wrap_counter);
+	}
+
+	if (__get_user(avail_idx, &vq->avail->idx))
+		return true;
+
+	return avail_idx == vq->avail_idx;
+}
+EXPORT_SYMBOL_GPL(vhost_vq_avail_empty);
+
 /* We don't need to be notified again. */
 void vhost_disable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 {
@@ -1528,6 +2007,16 @@ void vhost_disable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 	if (vq->used_flags & VRING_USED_F_NO_NOTIFY)
 		return;
 	vq->used_flags |= VRING_USED_F_NO_NOTIFY;
+	if (vhost_has_feature(dev, VIRTIO_RING_F_PACKED)) {
+		/* With EVENT_IDX, the guest only kicks at the offset. */
+		if (vhost_has_feature(dev, VIRTIO_RING_F_EVENT_IDX))
+			return;
+		r = vhost_update_device_event(vq);
+		if (r)
+			vq_err(vq, "Failed to disable notification at %p: %d\n",
+			       vhost_device_event(vq), r);
+		return;
+	}
 	if (!vhost_has_feature(dev, VIRTIO_RING_F_EVENT_IDX)) {
 		r = vhost_update_used_flags(vq);
 		if (r)
@@ -46,6 +46,7 @@ int vhost_poll_start(struct vhost_poll *poll, struct file *file);
 void vhost_poll_stop(struct vhost_poll *poll);
 void vhost_poll_flush(struct vhost_poll *poll);
 void vhost_poll_queue(struct vhost_poll *poll);
+bool vhost_has_work(struct vhost_dev *dev);
 void vhost_work_flush(struct vhost_dev *dev, struct vhost_work *work);
 long vhost_vring_ioctl(struct vhost_dev *d, int ioctl, void __user *argp);
 
@@ -96,10 +97,24 @@ struct vhost_virtqueue {
 	/* Last used index value we have signalled on */
 	bool signalled_used_valid;
 
+	/* Packed ring only, where desc, avail and used are the descriptors
+	 * and the driver and device event areas, and last_avail_idx and
+	 * last_used_idx are ring positions: their wrap counters, the
+	 * descriptors each buffer id we fetched took, and where each of the
+	 * last UIO_MAXIOV fetches started, for vhost_discard_vq_desc(). */
+	bool avail_wrap_counter;
+	bool used_wrap_counter;
+	u16 *packed_descs;
+	u16 *packed_fetched;
+	u16 packed_fetches;
+
 	/* Log writes to used structure. */
 	bool log_used;
 	u64 log_addr;
 
+	/* How long to spin on an empty ring before sleeping, in us. */
+	u32 busyloop_timeout;
+
 	struct iovec iov[UIO_MAXIOV];
 	struct iovec *indirect;
 	struct vring_used_elem *heads;
@@ -157,6 +172,7 @@ void vhost_add_used_and_signal_n(struct vhost_dev *, struct vhost_virtqueue *,
 void vhost_signal(struct vhost_dev *, struct vhost_virtqueue *);
 void vhost_disable_notify(struct vhost_dev *, struct vhost_virtqueue *);
 bool vhost_enable_notify(struct vhost_dev *, struct vhost_virtqueue *);
+bool vhost_vq_avail_empty(struct vhost_dev *, struct vhost_virtqueue *);
 
 int vhost_log_write(struct vhost_virtqueue *vq, struct vhost_log *log,
 		    unsigned int log_num, u64 len);
@@ -171,6 +187,7 @@ enum {
 	VHOST_FEATURES = (1ULL << VIRTIO_F_NOTIFY_ON_EMPTY) |
 			 (1ULL << VIRTIO_RING_F_INDIRECT_DESC) |
 			 (1ULL << VIRTIO_RING_F_EVENT_IDX) |
+			 (1ULL << VIRTIO_RING_F_PACKED) |
 			 (1ULL << VHOST_F_LOG_ALL),
 };
 
@@ -54,6 +54,20 @@
 #define END_USE(vq)
 #endif
 
+/* What the packed ring keeps for each buffer id handed to the other side. */
+struct vring_packed_state {
+	/* Token for callbacks, NULL while the id is free. */
+	void *data;
+	/* Indirect descriptor table, if any. */
+	void *indir_desc;
+	/* Descriptors used in the ring. */
+	u16 num;
+	/* Last id taken along with this one, one per descriptor. */
+	u16 last;
+	/* Next id on the free list. */
+	u16 next;
+};
+
 struct vring_virtqueue
 {
 	struct virtqueue vq;
@@ -73,14 +87,29 @@ struct vring_virtqueue
 	/* Host publishes avail event idx */
 	bool event;
 
-	/* Head of free buffer list. */
+	/* Host and Guest use the packed layout, vring_packed */
+	bool packed;
+
+	/* Head of free buffer list (of free ids, for the packed ring). */
 	unsigned int free_head;
 	/* Number we've added since last sync. */
 	unsigned int num_added;
 
-	/* Last used index we've seen. */
+	/* Last used index we've seen (ring position, for the packed ring). */
 	u16 last_used_idx;
 
+	/* Packed ring only: the ring, where we add the next buffer, the wrap
+	 * counters for what we add and what we expect back, the avail and
+	 * used flags that go with the former, the flags we last wrote to the
+	 * driver event area and our per id state. */
+	struct vring_packed vring_packed;
+	u16 next_avail_idx;
+	bool avail_wrap_counter;
+	bool used_wrap_counter;
+	u16 avail_used_flags;
+	u16 event_flags_shadow;
+	struct vring_packed_state *packed_state;
+
 	/* How to notify other side. FIXME: commonalize hcalls! */
 	bool (*notify)(struct virtqueue *vq);
 
@@ -93,7 +122,7 @@ struct vring_virtqueue
 	ktime_t last_add_time;
 #endif
 
-	/* Tokens for callbacks. */
+	/* Tokens for callbacks (split ring only). */
 	void *data[];
 };
 
@@ -184,6 +213,173 @@ static inline int vring_add_indirect(struct vring_virtqueue *vq,
 	return head;
 }
 
+static inline u16 vring_packed_off_wrap(u16 idx, bool wrap_counter)
+{
+	return idx | wrap_counter << VRING_PACKED_EVENT_F_WRAP_CTR;
+}
+
+/* Step past descriptor i of the packed ring, flipping our wrap counter and
+ * the flags that go with it every time we go round. */
+static inline u16 vring_packed_next_avail(struct vring_virtqueue *vq, u16 i)
+{
+	if (++i < vq->vring_packed.num)
+		return i;
+	vq->avail_wrap_counter ^= 1;
+	vq->avail_used_flags ^= 1 << VRING_PACKED_DESC_F_AVAIL |
+				1 << VRING_PACKED_DESC_F_USED;
+	return 0;
+}
+
+/* Set up an indirect table for buffer id, pointed to by the descriptor at
+ * the head of the packed ring. */
+static int vring_add_indirect_packed(struct vring_virtqueue *vq,
+				     struct scatterlist *sgs[],
+				     struct scatterlist *(*next)
+				       (struct scatterlist *, unsigned int *),
+				     unsigned int total_sg,
+				     unsigned int total_out,
+				     unsigned int total_in,
+				     unsigned int out_sgs,
+				     unsigned int in_sgs,
+				     u16 id, gfp_t gfp)
+{
+	struct vring_packed_desc *desc;
+	u16 head = vq->next_avail_idx;
+	struct scatterlist *sg;
+	int i, n;
+
+	/* Lowmem only, as for vring_add_indirect(). */
+	gfp &= ~(__GFP_HIGHMEM | __GFP_HIGH);
+
+	desc = kmalloc(total_sg * sizeof(struct vring_packed_desc), gfp);
+	if (!desc)
+		return -ENOMEM;
+
+	i = 0;
+	for (n = 0; n < out_sgs + in_sgs; n++) {
+		for (sg = sgs[n]; sg;
+		     sg = next(sg, n < out_sgs ? &total_out : &total_in)) {
+			desc[i].flags = n < out_sgs ? 0 : VRING_DESC_F_WRITE;
+			desc[i].addr = sg_phys(sg);
+			desc[i].len = sg->length;
+			desc[i].id = 0;
+			i++;
+		}
+	}
+	BUG_ON(i != total_sg);
+
+	vq->vring_packed.desc[head].addr = virt_to_phys(desc);
+	/* kmemleak gives a false positive, as it's hidden by virt_to_phys */
+	kmemleak_ignore(desc);
+	vq->vring_packed.desc[head].len = i * sizeof(struct vring_packed_desc);
+	vq->vring_packed.desc[head].id = id;
+	vq->packed_state[id].indir_desc = desc;
+
+	return 0;
+}
+
+/* virtqueue_add() for the packed ring, called with the queue in use.
+ * Every descriptor takes an id off the free list, so we never run out of
+ * ids before we run out of descriptors, but only the first one is passed
+ * to the other side. */
+static int virtqueue_add_packed(struct vring_virtqueue *vq,
+				struct scatterlist *sgs[],
+				struct scatterlist *(*next)
+				  (struct scatterlist *, unsigned int *),
+				unsigned int total_sg,
+				unsigned int total_out,
+				unsigned int total_in,
+				unsigned int out_sgs,
+				unsigned int in_sgs,
+				void *data,
+				gfp_t gfp)
+{
+	struct vring_packed_desc *desc = vq->vring_packed.desc;
+	struct vring_packed_state *state;
+	struct scatterlist *sg;
+	unsigned int n, c, descs_used;
+	u16 head, i, id, buf_id, flags;
+	u16 uninitialized_var(last), uninitialized_var(head_flags);
+
+	head = vq->next_avail_idx;
+	id = buf_id = vq->free_head;
+	state = &vq->packed_state[buf_id];
+	state->indir_desc = NULL;
+
+	if (vq->indirect && total_sg > 1 && vq->vq.num_free &&
+	    !vring_add_indirect_packed(vq, sgs, next, total_sg, total_out,
+				       total_in, out_sgs, in_sgs, buf_id,
+				       gfp)) {
+		head_flags = VRING_DESC_F_INDIRECT | vq->avail_used_flags;
+		descs_used = 1;
+		last = id;
+		id = state->next;
+		i = vring_packed_next_avail(vq, head);
+		goto add_head;
+	}
+
+	BUG_ON(total_sg > vq->vring_packed.num);
+	BUG_ON(total_sg == 0);
+
+	if (vq->vq.num_free < total_sg) {
+		pr_debug("Can't add buf len %i - avail = %i\n",
+			 total_sg, vq->vq.num_free);
+		/* Same historical notify as virtqueue_add(). */
+		if (out_sgs)
+			vq->notify(&vq->vq);
+		END_USE(vq);
+		return -ENOSPC;
+	}
+
+	descs_used = total_sg;
+	i = head;
+	c = 0;
+	for (n = 0; n < out_sgs + in_sgs; n++) {
+		for (sg = sgs[n]; sg;
+		     sg = next(sg, n < out_sgs ? &total_out : &total_in)) {
+			flags = vq->avail_used_flags |
+				(++c == total_sg ? 0 : VRING_DESC_F_NEXT) |
+				(n < out_sgs ? 0 : VRING_DESC_F_WRITE);
+			/* The head goes last, see below. */
+			if (c == 1)
+				head_flags = flags;
+			else
+				desc[i].flags = flags;
+			desc[i].addr = sg_phys(sg);
+			desc[i].len = sg->length;
+			desc[i].id = buf_id;
+			last = id;
+			id = vq->packed_state[id].next;
+			i = vring_packed_next_avail(vq, i);
+		}
+	}
+
+add_head:
+	vq->vq.num_free -= descs_used;
+	vq->next_avail_idx = i;
+	vq->free_head = id;
+
+	state->data = data;
+	state->num = descs_used;
+	state->last = last;
+
+	/* The other side may start on the buffer as soon as it sees the head
+	 * descriptor, which must therefore be made available last. */
+	virtio_wmb(vq->weak_barriers);
+	desc[head].flags = head_flags;
+	vq->num_added += descs_used;
+
+	/* This is very unlikely, but theoretically possible.  Kick
+	 * just in case. */
+	if (unlikely(vq->num_added == (1 << 16) - 1))
+		virtqueue_kick(&vq->vq);
+
+	pr_debug("Added buffer id %u to %p\n", buf_id, vq);
+	END_USE(vq);
+
+	return 0;
+}
+
 static inline int virtqueue_add(struct virtqueue *_vq,
 				struct scatterlist *sgs[],
 				struct scatterlist *(*next)
@@ -224,6 +420,11 @@ static inline int virtqueue_add(struct virtqueue *_vq,
 
 	total_sg = total_in + total_out;
 
+	if (vq->packed)
+		return virtqueue_add_packed(vq, sgs, next, total_sg, total_out,
+					    total_in, out_sgs, in_sgs, data,
+					    gfp);
+
 	/* If the host supports indirect descriptor tables, and we have multiple
 	 * buffers, then go indirect. FIXME: tune this threshold */
 	if (vq->indirect && total_sg > 1 && vq->vq.num_free) {
@@ -386,6 +587,27 @@ int virtqueue_add_inbuf(struct virtqueue *vq,
 }
 EXPORT_SYMBOL_GPL(virtqueue_add_inbuf);
 
+/* old and new are ring positions, old is negative if we went round since.
+ * An event offset from the other side's previous lap is moved there too. */
+static bool vring_packed_need_kick(struct vring_virtqueue *vq, u16 new,
+				   u16 old)
+{
+	struct vring_packed_desc_event *device = vq->vring_packed.device;
+	u16 flags, off_wrap, event_idx;
+
+	flags = ACCESS_ONCE(device->flags);
+	if (flags != VRING_PACKED_EVENT_FLAG_DESC)
+		return flags != VRING_PACKED_EVENT_FLAG_DISABLE;
+
+	off_wrap = ACCESS_ONCE(device->off_wrap);
+	event_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+	if (!!(off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) !=
+	    vq->avail_wrap_counter)
+		event_idx -= vq->vring_packed.num;
+
+	return vring_need_event(event_idx, new, old);
+}
+
 /**
  * virtqueue_kick_prepare - first half of split virtqueue_kick call.
  * @vq: the struct virtqueue
@@ -408,8 +630,8 @@ bool virtqueue_kick_prepare(struct virtqueue *_vq)
 	 * event. */
 	virtio_mb(vq->weak_barriers);
 
-	old = vq->vring.avail->idx - vq->num_added;
-	new = vq->vring.avail->idx;
+	new = vq->packed ? vq->next_avail_idx : vq->vring.avail->idx;
+	old = new - vq->num_added;
 	vq->num_added = 0;
 
 #ifdef DEBUG
@@ -420,7 +642,9 @@ bool virtqueue_kick_prepare(struct virtqueue *_vq)
 	vq->last_add_time_valid = false;
 #endif
 
-	if (vq->event) {
+	if (vq->packed) {
+		needs_kick = vring_packed_need_kick(vq, new, old);
+	} else if (vq->event) {
 		needs_kick = vring_need_event(vring_avail_event(&vq->vring),
 					      new, old);
 	} else {
@@ -500,11 +724,96 @@ static void detach_buf(struct vring_virtqueue *vq, unsigned int head)
 	vq->vq.num_free++;
 }
 
+static void detach_buf_packed(struct vring_virtqueue *vq, u16 id)
+{
+	struct vring_packed_state *state = &vq->packed_state[id];
+
+	/* Clear data ptr. */
+	state->data = NULL;
+
+	/* Give back the ids taken with it, and the descriptors. */
+	vq->packed_state[state->last].next = vq->free_head;
+	vq->free_head = id;
+	vq->vq.num_free += state->num;
+
+	/* Free the indirect table */
+	kfree(state->indir_desc);
+	state->indir_desc = NULL;
+}
+
+/* A packed descriptor is used once the other side has set both its avail
+ * and used flags to the wrap counter of the lap it is on. */
+static inline bool is_used_desc_packed(const struct vring_virtqueue *vq,
+				       u16 idx, bool used_wrap_counter)
+{
+	u16 flags = ACCESS_ONCE(vq->vring_packed.desc[idx].flags);
+	bool avail = flags & (1 << VRING_PACKED_DESC_F_AVAIL);
+	bool used = flags & (1 << VRING_PACKED_DESC_F_USED);
+
+	return avail == used && used == used_wrap_counter;
+}
+
 static inline bool more_used(const struct vring_virtqueue *vq)
 {
+	if (vq->packed)
+		return is_used_desc_packed(vq, vq->last_used_idx,
+					   vq->used_wrap_counter);
 	return vq->last_used_idx != vq->vring.used->idx;
 }
 
+/* virtqueue_get_buf() for the packed ring, called with the queue in use. */
+static void *virtqueue_get_buf_packed(struct vring_virtqueue *vq,
+				      unsigned int *len)
+{
+	unsigned int last_used = vq->last_used_idx;
+	void *ret;
+	u16 id;
+
+	if (!more_used(vq)) {
+		pr_debug("No more buffers in queue\n");
+		return NULL;
+	}
+
+	/* Only read id and len once the flags said they were written. */
+	virtio_rmb(vq->weak_barriers);
+
+	id = vq->vring_packed.desc[last_used].id;
+	*len = vq->vring_packed.desc[last_used].len;
+
+	if (unlikely(id >= vq->vring_packed.num)) {
+		BAD_RING(vq, "id %u out of range\n", id);
+		return NULL;
+	}
+	if (unlikely(!vq->packed_state[id].data)) {
+		BAD_RING(vq, "id %u is not a head!\n", id);
+		return NULL;
+	}
+
+	/* detach_buf_packed clears data, so grab it now. */
+	ret = vq->packed_state[id].data;
+	detach_buf_packed(vq, id);
+
+	/* The other side used as many descriptors as we gave it. */
+	last_used += vq->packed_state[id].num;
+	if (last_used >= vq->vring_packed.num) {
+		last_used -= vq->vring_packed.num;
+		vq->used_wrap_counter ^= 1;
+	}
+	vq->last_used_idx = last_used;
+
+	/* If we expect an interrupt for the next entry, tell host
+	 * by writing event index and flush out the write before
+	 * the read in the next get_buf call. */
+	if (vq->event_flags_shadow == VRING_PACKED_EVENT_FLAG_DESC) {
+		vq->vring_packed.driver->off_wrap =
+			vring_packed_off_wrap(last_used,
+					      vq->used_wrap_counter);
+		virtio_mb(vq->weak_barriers);
+	}
+
+	return ret;
+}
+
 /**
  * virtqueue_get_buf - get the next used buffer
  * @vq: the struct virtqueue we're talking about.
@@ -535,6 +844,15 @@ void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
 		return NULL;
 	}
 
+	if (vq->packed) {
+		ret = virtqueue_get_buf_packed(vq, len);
+#ifdef DEBUG
+		vq->last_add_time_valid = false;
+#endif
+		END_USE(vq);
+		return ret;
+	}
+
 	if (!more_used(vq)) {
 		pr_debug("No more buffers in queue\n");
 		END_USE(vq);
@@ -591,10 +909,39 @@ void virtqueue_disable_cb(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
+	if (vq->packed) {
+		u16 flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+
+		if (vq->event_flags_shadow != flags) {
+			vq->event_flags_shadow = flags;
+			vq->vring_packed.driver->flags = flags;
+		}
+		return;
+	}
+
 	vq->vring.avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
 }
 EXPORT_SYMBOL_GPL(virtqueue_disable_cb);
 
+/* Ask for an interrupt from the used descriptor at off_wrap on, or from
+ * any, as the packed ring's counterpart of clearing NO_INTERRUPT. */
+static void vring_packed_enable_cb(struct vring_virtqueue *vq, u16 off_wrap)
+{
+	if (vq->event) {
+		vq->vring_packed.driver->off_wrap = off_wrap;
+		/* The offset must be there before the other side sees
+		 * FLAG_DESC. */
+		virtio_wmb(vq->weak_barriers);
+	}
+
+	if (vq->event_flags_shadow == VRING_PACKED_EVENT_FLAG_DISABLE) {
+		vq->event_flags_shadow = vq->event ?
+					 VRING_PACKED_EVENT_FLAG_DESC :
+					 VRING_PACKED_EVENT_FLAG_ENABLE;
+		vq->vring_packed.driver->flags = vq->event_flags_shadow;
+	}
+}
+
 /**
  * virtqueue_enable_cb_prepare - restart callbacks after disable_cb
  * @vq: the struct virtqueue we're talking about.
@@ -614,6 +961,14 @@ unsigned virtqueue_enable_cb_prepare(struct virtqueue *_vq)
 
 	START_USE(vq);
 
+	if (vq->packed) {
+		last_used_idx = vring_packed_off_wrap(vq->last_used_idx,
+						      vq->used_wrap_counter);
+		vring_packed_enable_cb(vq, last_used_idx);
+		END_USE(vq);
+		return last_used_idx;
+	}
+
 	/* We optimistically turn back on interrupts, then check if there was
 	 * more to do. */
 	/* Depending on the VIRTIO_RING_F_EVENT_IDX feature, we need to
@@ -640,6 +995,10 @@ bool virtqueue_poll(struct virtqueue *_vq, unsigned last_used_idx)
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
 	virtio_mb(vq->weak_barriers);
+	if (vq->packed)
+		return is_used_desc_packed(vq, last_used_idx &
+				~(1 << VRING_PACKED_EVENT_F_WRAP_CTR),
+				last_used_idx >> VRING_PACKED_EVENT_F_WRAP_CTR);
 	return (u16)last_used_idx != vq->vring.used->idx;
 }
 EXPORT_SYMBOL_GPL(virtqueue_poll);
@@ -682,6 +1041,29 @@ bool virtqueue_enable_cb_delayed(struct virtqueue *_vq)
 
 	START_USE(vq);
 
+	if (vq->packed) {
+		unsigned int used_idx;
+		bool wrap_counter = vq->used_wrap_counter;
+
+		/* TODO: tune this threshold */
+		bufs = (vq->vring_packed.num - vq->vq.num_free) * 3 / 4;
+		used_idx = vq->last_used_idx + bufs;
+		if (used_idx >= vq->vring_packed.num) {
+			used_idx -= vq->vring_packed.num;
+			wrap_counter ^= 1;
+		}
+		vring_packed_enable_cb(vq, vring_packed_off_wrap(used_idx,
+							       wrap_counter));
+		virtio_mb(vq->weak_barriers);
+		if (is_used_desc_packed(vq, vq->last_used_idx,
+					vq->used_wrap_counter)) {
+			END_USE(vq);
+			return false;
+		}
+		END_USE(vq);
+		return true;
+	}
+
 	/* We optimistically turn back on interrupts, then check if there was
 	 * more to do. */
 	/* Depending on the VIRTIO_RING_F_USED_EVENT_IDX feature, we need to
@@ -718,7 +1100,17 @@ void *virtqueue_detach_unused_buf(struct virtqueue *_vq)
 
 	START_USE(vq);
 
-	for (i = 0; i < vq->vring.num; i++) {
+	for (i = 0; vq->packed && i < vq->vring_packed.num; i++) {
+		if (!vq->packed_state[i].data)
+			continue;
+		/* detach_buf_packed clears data, so grab it now. */
+		buf = vq->packed_state[i].data;
+		detach_buf_packed(vq, i);
+		END_USE(vq);
+		return buf;
+	}
+
+	for (i = 0; !vq->packed && i < vq->vring.num; i++) {
 		if (!vq->data[i])
 			continue;
 		/* detach_buf clears data, so grab it now. */
@@ -768,6 +1160,7 @@ struct virtqueue *vring_new_virtqueue(unsigned int index,
 {
 	struct vring_virtqueue *vq;
 	unsigned int i;
+	bool packed = virtio_has_feature(vdev, VIRTIO_RING_F_PACKED);
 
 	/* We assume num is a power of 2. */
 	if (num & (num - 1)) {
@@ -775,11 +1168,33 @@ struct virtqueue *vring_new_virtqueue(unsigned int index,
 		return NULL;
 	}
 
-	vq = kmalloc(sizeof(*vq) + sizeof(void *)*num, GFP_KERNEL);
+	/* Packed ring offsets leave one bit of off_wrap to the counter. */
+	if (packed && num > 1 << VRING_PACKED_EVENT_F_WRAP_CTR) {
+		dev_warn(&vdev->dev, "Bad packed virtqueue length %u\n", num);
+		return NULL;
+	}
+
+	vq = kmalloc(sizeof(*vq) + (packed ? 0 : sizeof(void *)*num),
+		     GFP_KERNEL);
 	if (!vq)
 		return NULL;
 
-	vring_init(&vq->vring, num, pages, vring_align);
+	vq->packed = packed;
+	vq->packed_state = NULL;
+	if (packed) {
+		vq->packed_state = kmalloc(sizeof(*vq->packed_state) * num,
+					   GFP_KERNEL);
+		if (!vq->packed_state) {
+			kfree(vq);
+			return NULL;
+		}
+		vring_packed_init(&vq->vring_packed, num, pages, vring_align);
+		/* Only num is meaningful, for virtqueue_get_vring_size(). */
+		memset(&vq->vring, 0, sizeof(vq->vring));
+		vq->vring.num = num;
+	} else {
+		vring_init(&vq->vring, num, pages, vring_align);
+	}
 	vq->vq.callback = callback;
 	vq->vq.vdev = vdev;
 	vq->vq.name = name;
@@ -799,6 +1214,33 @@ struct virtqueue *vring_new_virtqueue(unsigned int index,
 	vq->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC);
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
 
+	if (packed) {
+		/* Both wrap counters start at 1, so a zeroed ring is all
+		 * descriptors neither available nor used. */
+		memset(vq->vring_packed.desc, 0,
+		       num * sizeof(struct vring_packed_desc));
+		vq->next_avail_idx = 0;
+		vq->avail_wrap_counter = 1;
+		vq->used_wrap_counter = 1;
+		vq->avail_used_flags = 1 << VRING_PACKED_DESC_F_AVAIL;
+
+		/* No callback?  Tell other side not to bother us. */
+		vq->event_flags_shadow = callback ?
+					 VRING_PACKED_EVENT_FLAG_ENABLE :
+					 VRING_PACKED_EVENT_FLAG_DISABLE;
+		vq->vring_packed.driver->flags = vq->event_flags_shadow;
+
+		/* Put every id on the free list. */
+		vq->free_head = 0;
+		for (i = 0; i < num; i++) {
+			vq->packed_state[i].data = NULL;
+			vq->packed_state[i].indir_desc = NULL;
+			vq->packed_state[i].next = i + 1;
+		}
+
+		return &vq->vq;
+	}
+
 	/* No callback?  Tell other side not to bother us. */
 	if (!callback)
 		vq->vring.avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
@@ -818,6 +1260,7 @@ EXPORT_SYMBOL_GPL(vring_new_virtqueue);
 void vring_del_virtqueue(struct virtqueue *vq)
 {
 	list_del(&vq->list);
+	kfree(to_vvq(vq)->packed_state);
 	kfree(to_vvq(vq));
 }
 EXPORT_SYMBOL_GPL(vring_del_virtqueue);
@@ -833,6 +1276,8 @@ void vring_transport_features(struct virtio_device *vdev)
 			break;
 		case VIRTIO_RING_F_EVENT_IDX:
 			break;
+		case VIRTIO_RING_F_PACKED:
+			break;
 		default:
 			/* We don't understand this bit. */
 			clear_bit(i, vdev->features);
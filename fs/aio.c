@@ -40,6 +40,7 @@
 #include <linux/ramfs.h>
 #include <linux/percpu-refcount.h>
 #include <linux/mount.h>
+#include <linux/poll.h>
 
 #include <asm/kmap_types.h>
 #include <asm/uaccess.h>
@@ -1293,6 +1294,323 @@ static ssize_t aio_setup_single_vector(struct kiocb *kiocb,
 	return 0;
 }
 
+/*
+ * A buffered read of a regular file does not wait in io_submit() for the
+ * pages it needs to be read in: the page cache starts the I/O, queues
+ * ->wait on the page it would have waited for, and returns -EIOCBRETRY.
+ * The read is then done again from a workqueue, in the mm of the
+ * submitter, once the page is unlocked; and so on until it is complete.
+ */
+struct aio_buffered_read {
+	struct kiocb		*iocb;
+	aio_rw_op		*rw_op;
+	struct iovec		*iovec;		/* what is left to read */
+	unsigned long		nr_segs;
+	struct iovec		*iovec_alloc;	/* to free when done */
+	struct iovec		inline_vec;
+	ssize_t			done;
+	struct mm_struct	*mm;
+	/* the wakeup, and the return of the read which queued the wait */
+	atomic_t		pending;
+	struct wait_bit_queue	wait;
+	struct work_struct	work;
+};
+
+static int aio_buffered_read_wake(wait_queue_t *wait, unsigned mode,
+				  int sync, void *arg)
+{
+	struct aio_buffered_read *r = container_of(wait,
+					struct aio_buffered_read, wait.wait);
+	struct wait_bit_key *key = arg;
+
+	if (r->wait.key.flags != key->flags ||
+	    r->wait.key.bit_nr != key->bit_nr ||
+	    test_bit(key->bit_nr, key->flags))
+		return 0;
+
+	list_del_init(&wait->task_list);
+	if (atomic_dec_and_test(&r->pending))
+		schedule_work(&r->work);
+	return 1;
+}
+
+/*
+ * Read as much as can be read without waiting.  Returns false if the read
+ * is waiting for a page, true once it is over.
+ */
+static bool aio_buffered_read_step(struct aio_buffered_read *r)
+{
+	struct kiocb *req = r->iocb;
+	ssize_t ret;
+
+	for (;;) {
+		atomic_set(&r->pending, 2);
+		ret = r->rw_op(req, r->iovec, r->nr_segs, req->ki_pos);
+		if (ret == -EIOCBRETRY) {
+			if (!atomic_dec_and_test(&r->pending))
+				return false;
+			/* The page was unlocked already */
+			continue;
+		}
+		if (ret <= 0) {
+			if (!r->done)
+				r->done = ret;
+			return true;
+		}
+
+		r->done += ret;
+		if (r->done >= req->ki_nbytes)
+			return true;
+		while (ret) {
+			if (ret < r->iovec->iov_len) {
+				r->iovec->iov_base += ret;
+				r->iovec->iov_len -= ret;
+				break;
+			}
+			ret -= r->iovec->iov_len;
+			r->iovec++;
+			r->nr_segs--;
+		}
+	}
+}
+
+static void aio_buffered_read_complete(struct aio_buffered_read *r)
+{
+	ssize_t ret = r->done;
+
+	if (unlikely(ret == -ERESTARTSYS || ret == -ERESTARTNOINTR ||
+		     ret == -ERESTARTNOHAND ||
+		     ret == -ERESTART_RESTARTBLOCK))
+		ret = -EINTR;
+	aio_complete(r->iocb, ret, 0);
+
+	mmdrop(r->mm);
+	kfree(r->iovec_alloc);
+	kfree(r);
+}
+
+static void aio_buffered_read_work(struct work_struct *work)
+{
+	struct aio_buffered_read *r = container_of(work,
+					struct aio_buffered_read, work);
+	struct mm_struct *mm = r->mm;
+
+	if (!atomic_inc_not_zero(&mm->mm_users)) {
+		if (!r->done)
+			r->done = -EFAULT;
+		aio_buffered_read_complete(r);
+		return;
+	}
+
+	use_mm(mm);
+	if (aio_buffered_read_step(r)) {
+		unuse_mm(mm);
+		mmput(mm);
+		aio_buffered_read_complete(r);
+		return;
+	}
+	unuse_mm(mm);
+	mmput(mm);
+}
+
+/*
+ * Start the buffered read of @req.  Takes over @iovec, unless it is
+ * @inline_vec, and returns true; or returns false, to have the read done
+ * synchronously, if it cannot.
+ */
+static bool aio_buffered_read(struct kiocb *req, aio_rw_op *rw_op,
+			      struct iovec *iovec, struct iovec *inline_vec,
+			      unsigned long nr_segs)
+{
+	struct aio_buffered_read *r;
+
+	r = kmalloc(sizeof(*r), GFP_KERNEL);
+	if (!r)
+		return false;
+
+	r->iocb = req;
+	r->rw_op = rw_op;
+	if (iovec == inline_vec) {
+		r->inline_vec = *inline_vec;
+		r->iovec = &r->inline_vec;
+		r->iovec_alloc = NULL;
+	} else {
+		r->iovec = iovec;
+		r->iovec_alloc = iovec;
+	}
+	r->nr_segs = nr_segs;
+	r->done = 0;
+	r->mm = current->mm;
+	atomic_inc(&r->mm->mm_count);
+	init_waitqueue_func_entry(&r->wait.wait, aio_buffered_read_wake);
+	INIT_WORK(&r->work, aio_buffered_read_work);
+	req->ki_waitq = &r->wait;
+
+	if (aio_buffered_read_step(r))
+		aio_buffered_read_complete(r);
+	return true;
+}
+
+/*
+ * IOCB_CMD_POLL: a one-shot wait for any of the poll events in aio_buf,
+ * completed with the events which became ready.  The wait is queued on the
+ * file's poll waitqueue, and its wakeup has the events checked again from
+ * a workqueue: f_op->poll() may sleep, and is not to be called from there.
+ *
+ * Whoever takes the wait off the waitqueue, under its lock, owns the
+ * request: the wakeup and io_cancel() then queue the work, and the work
+ * either queues the wait again or completes the request.  The submitter
+ * holds a reference of its own until it is done with the request, which
+ * may be woken as soon as f_op->poll() has queued it.
+ */
+struct aio_poll {
+	struct kiocb		*iocb;
+	unsigned		events;
+	unsigned		mask;		/* to complete with */
+	wait_queue_head_t	*head;
+	bool			cancelled;
+	int			error;
+	atomic_t		refs;
+	wait_queue_t		wait;
+	struct work_struct	work;
+	poll_table		pt;
+};
+
+static void aio_poll_put(struct aio_poll *p)
+{
+	if (atomic_dec_and_test(&p->refs)) {
+		aio_complete(p->iocb, p->error ? p->error : p->mask, 0);
+		kfree(p);
+	}
+}
+
+/* Drops the wait's reference, once it is off the waitqueue for good */
+static void aio_poll_complete(struct aio_poll *p, unsigned mask)
+{
+	p->mask = mask;
+	aio_poll_put(p);
+}
+
+static int aio_poll_wake(wait_queue_t *wait, unsigned mode, int sync,
+			 void *key)
+{
+	struct aio_poll *p = container_of(wait, struct aio_poll, wait);
+
+	if (key && !((unsigned long)key & p->events))
+		return 0;
+
+	list_del_init(&wait->task_list);
+	schedule_work(&p->work);
+	return 1;
+}
+
+static void aio_poll_work(struct work_struct *work)
+{
+	struct aio_poll *p = container_of(work, struct aio_poll, work);
+	struct file *file = p->iocb->ki_filp;
+	unsigned mask = 0;
+
+	if (!ACCESS_ONCE(p->cancelled)) {
+		spin_lock_irq(&p->head->lock);
+		__add_wait_queue(p->head, &p->wait);
+		spin_unlock_irq(&p->head->lock);
+
+		mask = file->f_op->poll(file, NULL) & p->events;
+		if (!mask && !ACCESS_ONCE(p->cancelled))
+			return;
+
+		spin_lock_irq(&p->head->lock);
+		if (list_empty(&p->wait.task_list)) {
+			/* Woken or cancelled meanwhile: the work is queued */
+			spin_unlock_irq(&p->head->lock);
+			return;
+		}
+		list_del_init(&p->wait.task_list);
+		spin_unlock_irq(&p->head->lock);
+	}
+	aio_poll_complete(p, mask);
+}
+
+/* Called with ctx->ctx_lock held, interrupts off */
+static int aio_poll_cancel(struct kiocb *iocb)
+{
+	struct aio_poll *p = iocb->private;
+	wait_queue_head_t *head = ACCESS_ONCE(p->head);
+
+	p->cancelled = true;
+	if (!head)
+		return 0;	/* the submitter sees it */
+
+	spin_lock(&head->lock);
+	if (!list_empty(&p->wait.task_list)) {
+		list_del_init(&p->wait.task_list);
+		schedule_work(&p->work);
+	}
+	spin_unlock(&head->lock);
+	return 0;
+}
+
+static void aio_poll_queue_proc(struct file *file, wait_queue_head_t *head,
+				poll_table *pt)
+{
+	struct aio_poll *p = container_of(pt, struct aio_poll, pt);
+
+	/* A single wait cannot be on several waitqueues */
+	if (unlikely(p->head)) {
+		p->error = -EINVAL;
+		return;
+	}
+	p->head = head;
+	add_wait_queue(head, &p->wait);
+}
+
+static ssize_t aio_poll(struct kiocb *req, unsigned long events)
+{
+	struct file *file = req->ki_filp;
+	struct aio_poll *p;
+	unsigned mask;
+
+	if (!file->f_op->poll)
+		return -EINVAL;
+	if (req->ki_pos || req->ki_nbytes || (events & ~0xffffUL))
+		return -EINVAL;
+
+	p = kmalloc(sizeof(*p), GFP_KERNEL);
+	if (!p)
+		return -ENOMEM;
+
+	p->iocb = req;
+	p->events = events | POLLERR | POLLHUP;
+	p->mask = 0;
+	p->head = NULL;
+	p->cancelled = false;
+	p->error = 0;
+	/* the submitter's, and the wait's */
+	atomic_set(&p->refs, 2);
+	init_waitqueue_func_entry(&p->wait, aio_poll_wake);
+	INIT_WORK(&p->work, aio_poll_work);
+	init_poll_funcptr(&p->pt, aio_poll_queue_proc);
+	p->pt._key = p->events;
+	req->private = p;
+	kiocb_set_cancel_fn(req, aio_poll_cancel);
+
+	mask = file->f_op->poll(file, &p->pt) & p->events;
+	if (!p->head) {
+		/* Nothing to wait on: the file is always ready */
+		aio_poll_complete(p, mask);
+	} else if (mask || p->error || ACCESS_ONCE(p->cancelled)) {
+		spin_lock_irq(&p->head->lock);
+		if (!list_empty(&p->wait.task_list)) {
+			list_del_init(&p->wait.task_list);
+			aio_poll_complete(p, mask);
+		}
+		/* or it was woken already, and the work completes it */
+		spin_unlock_irq(&p->head->lock);
+	}
+	aio_poll_put(p);
+	return 0;
+}
+
 /*
  * aio_setup_iocb:
  *	Performs the initial checks and aio retry method
@@ -1353,6 +1671,11 @@ rw_common:
 			break;
 		}
 
+		if (rw == READ && !(file->f_flags & O_DIRECT) &&
+		    S_ISREG(file_inode(file)->i_mode) &&
+		    aio_buffered_read(req, rw_op, iovec, &inline_vec, nr_segs))
+			return 0;
+
 		if (rw == WRITE)
 			file_start_write(file);
 
@@ -1376,6 +1699,9 @@ rw_common:
 		ret = file->f_op->aio_fsync(req, 0);
 		break;
 
+	case IOCB_CMD_POLL:
+		return aio_poll(req, (unsigned long)buf);
+
 	default:
 		pr_debug("EINVAL: no operation provided\n");
 		return -EINVAL;
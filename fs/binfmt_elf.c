@@ -34,6 +34,7 @@
 #include <linux/utsname.h>
 #include <linux/coredump.h>
 #include <linux/sched.h>
+#include <linux/syscalls.h>
 #include <asm/uaccess.h>
 #include <asm/param.h>
 #include <asm/page.h>
@@ -368,6 +369,71 @@ static unsigned long elf_map(struct file *filep, unsigned long addr,
 
 #endif /* !elf_map */
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Replace the huge page aligned part of a read-only executable segment,
+ * which elf_map() has just mapped from the page cache at map_addr, with
+ * anonymous memory eligible for transparent huge pages and copy the text
+ * into it.  Large text is then covered by a few PMD sized TLB entries
+ * instead of thousands of small ones.  The copy is private to the process,
+ * so it costs memory per process and the range no longer shows up as
+ * file backed in /proc/<pid>/maps.  Any failure puts the file mapping
+ * back and the segment simply stays on small pages.
+ */
+static void elf_map_huge_text(struct file *filep, unsigned long map_addr,
+		struct elf_phdr *eppnt, int prot)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	unsigned long off = eppnt->p_offset - ELF_PAGEOFFSET(eppnt->p_vaddr);
+	unsigned long start, end, len, addr;
+	loff_t pos;
+	ssize_t n;
+
+	start = ALIGN(map_addr, HPAGE_PMD_SIZE);
+	end = (map_addr + ELF_PAGEOFFSET(eppnt->p_vaddr) + eppnt->p_filesz) &
+		HPAGE_PMD_MASK;
+	if (end <= start)
+		return;
+	len = end - start;
+	pos = off + (start - map_addr);
+
+	addr = vm_mmap(NULL, start, len, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, 0);
+	if (addr != start)
+		goto restore;
+
+	down_write(&mm->mmap_sem);
+	vma = find_vma(mm, start);
+	if (!vma || vma->vm_start > start ||
+	    hugepage_madvise(vma, &vma->vm_flags, MADV_HUGEPAGE)) {
+		up_write(&mm->mmap_sem);
+		goto restore;
+	}
+	up_write(&mm->mmap_sem);
+
+	for (addr = start; addr < end; addr += n) {
+		n = vfs_read(filep, (char __user *)addr, end - addr, &pos);
+		if (n <= 0)
+			goto restore;
+	}
+
+	if (sys_mprotect(start, len, prot))
+		goto restore;
+	return;
+
+restore:
+	vm_mmap(filep, start, len, prot,
+		MAP_PRIVATE | MAP_DENYWRITE | MAP_EXECUTABLE | MAP_FIXED,
+		off + (start - map_addr));
+}
+#else
+static inline void elf_map_huge_text(struct file *filep,
+		unsigned long map_addr, struct elf_phdr *eppnt, int prot)
+{
+}
+#endif
+
 static unsigned long total_mapping_size(struct elf_phdr *cmds, int nr)
 {
 	int i, first_idx = -1, last_idx = -1;
@@ -826,6 +892,11 @@ static int load_elf_binary(struct linux_binprm *bprm)
 			goto out_free_dentry;
 		}
 
+		if ((elf_prot & PROT_EXEC) && !(elf_prot & PROT_WRITE) &&
+		    test_bit(MMF_HUGE_TEXT, &current->mm->flags))
+			elf_map_huge_text(bprm->file, error, elf_ppnt,
+					  elf_prot);
+
 		if (!load_addr_set) {
 			load_addr_set = 1;
 			load_addr = (elf_ppnt->p_vaddr - elf_ppnt->p_offset);
@@ -749,6 +749,14 @@ static int __bio_add_page(struct request_queue *q, struct bio *bio, struct page
 	if (bio->bi_vcnt >= bio->bi_max_vecs)
 		return 0;
 
+	/*
+	 * If the queue doesn't support SG gaps and adding this
+	 * offset would create a gap, disallow it.
+	 */
+	if (q->queue_flags & (1 << QUEUE_FLAG_SG_GAPS) && bio->bi_vcnt > 0 &&
+	    bvec_gap_to_prev(&bio->bi_io_vec[bio->bi_vcnt - 1], offset))
+		return 0;
+
 	/*
 	 * we might lose a segment or two here, but rather that than
 	 * make this too complex.
@@ -1938,6 +1946,25 @@ bad:
 EXPORT_SYMBOL(bioset_create);
 
 #ifdef CONFIG_BLK_CGROUP
+/**
+ * bio_associate_blkcg - associate a bio with a blkcg
+ * @bio: target bio
+ * @blkcg_css: css of the blkcg to associate
+ *
+ * Associate @bio with the blkcg of @blkcg_css, whichever task issues it:
+ * used for writeback, done on behalf of the cgroup which dirtied the
+ * pages.  A reference on @blkcg_css is taken, to be put when @bio is
+ * released.
+ */
+int bio_associate_blkcg(struct bio *bio, struct cgroup_subsys_state *blkcg_css)
+{
+	if (unlikely(bio->bi_css))
+		return -EBUSY;
+	css_get(blkcg_css);
+	bio->bi_css = blkcg_css;
+	return 0;
+}
+
 /**
  * bio_associate_current - associate a bio with %current
  * @bio: target bio
@@ -1967,12 +1994,14 @@ int bio_associate_current(struct bio *bio)
 	get_io_context_active(ioc);
 	bio->bi_ioc = ioc;
 
-	/* associate blkcg if exists */
-	rcu_read_lock();
-	css = task_css(current, blkio_cgrp_id);
-	if (css && css_tryget(css))
-		bio->bi_css = css;
-	rcu_read_unlock();
+	/* associate blkcg if exists, and not already done for writeback */
+	if (!bio->bi_css) {
+		rcu_read_lock();
+		css = task_css(current, blkio_cgrp_id);
+		if (css && css_tryget(css))
+			bio->bi_css = css;
+		rcu_read_unlock();
+	}
 
 	return 0;
 }
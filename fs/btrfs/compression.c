@@ -32,6 +32,7 @@
 #include <linux/writeback.h>
 #include <linux/bit_spinlock.h>
 #include <linux/slab.h>
+#include <linux/percpu.h>
 #include "ctree.h"
 #include "disk-io.h"
 #include "transaction.h"
@@ -743,9 +744,17 @@ static int comp_num_workspace[BTRFS_COMPRESS_TYPES];
 static atomic_t comp_alloc_workspace[BTRFS_COMPRESS_TYPES];
 static wait_queue_head_t comp_workspace_wait[BTRFS_COMPRESS_TYPES];
 
+/*
+ * a workspace parked on each cpu, found again without touching the shared
+ * idle list and its lock, so that compressing on all cpus at once scales
+ */
+static struct list_head * __percpu *comp_cpu_workspace[BTRFS_COMPRESS_TYPES];
+
 static struct btrfs_compress_op *btrfs_compress_op[] = {
 	&btrfs_zlib_compress,
 	&btrfs_lzo_compress,
+	&btrfs_lz4_compress,
+	&btrfs_lz4hc_compress,
 };
 
 void __init btrfs_init_compress(void)
@@ -757,7 +766,25 @@ void __init btrfs_init_compress(void)
 		spin_lock_init(&comp_workspace_lock[i]);
 		atomic_set(&comp_alloc_workspace[i], 0);
 		init_waitqueue_head(&comp_workspace_wait[i]);
+		/* without it, every workspace goes through the idle list */
+		comp_cpu_workspace[i] = alloc_percpu(struct list_head *);
+	}
+}
+
+const char *btrfs_compress_type2str(int type)
+{
+	switch (type) {
+	case BTRFS_COMPRESS_ZLIB:
+		return "zlib";
+	case BTRFS_COMPRESS_LZO:
+		return "lzo";
+	case BTRFS_COMPRESS_LZ4:
+		return "lz4";
+	case BTRFS_COMPRESS_LZ4HC:
+		return "lz4hc";
 	}
+
+	return NULL;
 }
 
 /*
@@ -775,6 +802,13 @@ static struct list_head *find_workspace(int type)
 	atomic_t *alloc_workspace		= &comp_alloc_workspace[idx];
 	wait_queue_head_t *workspace_wait	= &comp_workspace_wait[idx];
 	int *num_workspace			= &comp_num_workspace[idx];
+	struct list_head * __percpu *cpu_workspace = comp_cpu_workspace[idx];
+
+	if (cpu_workspace) {
+		workspace = this_cpu_xchg(*cpu_workspace, NULL);
+		if (workspace)
+			return workspace;
+	}
 again:
 	spin_lock(workspace_lock);
 	if (!list_empty(idle_workspace)) {
@@ -818,6 +852,16 @@ static void free_workspace(int type, struct list_head *workspace)
 	atomic_t *alloc_workspace		= &comp_alloc_workspace[idx];
 	wait_queue_head_t *workspace_wait	= &comp_workspace_wait[idx];
 	int *num_workspace			= &comp_num_workspace[idx];
+	struct list_head * __percpu *cpu_workspace = comp_cpu_workspace[idx];
+
+	/*
+	 * only park it on this cpu while nobody can be waiting for one, a
+	 * waiter is woken by whoever puts a workspace on the idle list
+	 */
+	if (cpu_workspace &&
+	    atomic_read(alloc_workspace) <= num_online_cpus() &&
+	    !this_cpu_cmpxchg(*cpu_workspace, NULL, workspace))
+		return;
 
 	spin_lock(workspace_lock);
 	if (*num_workspace < num_online_cpus()) {
@@ -842,9 +886,21 @@ wake:
 static void free_workspaces(void)
 {
 	struct list_head *workspace;
-	int i;
+	int i, cpu;
 
 	for (i = 0; i < BTRFS_COMPRESS_TYPES; i++) {
+		if (comp_cpu_workspace[i]) {
+			for_each_possible_cpu(cpu) {
+				workspace = *per_cpu_ptr(comp_cpu_workspace[i],
+							 cpu);
+				if (!workspace)
+					continue;
+				btrfs_compress_op[i]->free_workspace(workspace);
+				atomic_dec(&comp_alloc_workspace[i]);
+			}
+			free_percpu(comp_cpu_workspace[i]);
+			comp_cpu_workspace[i] = NULL;
+		}
 		while (!list_empty(&comp_idle_workspace[i])) {
 			workspace = comp_idle_workspace[i].next;
 			list_del(workspace);
@@ -21,6 +21,7 @@
 
 void btrfs_init_compress(void);
 void btrfs_exit_compress(void);
+const char *btrfs_compress_type2str(int type);
 
 int btrfs_compress_pages(int type, struct address_space *mapping,
 			 u64 start, unsigned long len,
@@ -77,5 +78,7 @@ struct btrfs_compress_op {
 
 extern struct btrfs_compress_op btrfs_zlib_compress;
 extern struct btrfs_compress_op btrfs_lzo_compress;
+extern struct btrfs_compress_op btrfs_lz4_compress;
+extern struct btrfs_compress_op btrfs_lz4hc_compress;
 
 #endif
@@ -2698,6 +2698,100 @@ int btrfs_find_item(struct btrfs_root *fs_root, struct btrfs_path *found_path,
 	return 0;
 }
 
+/*
+ * walk down to the leaf of key without taking locks on the nodes.
+ *
+ * Every node is read optimistically, and its lock sequence checked
+ * after we took the pointer to the next level out of it.  Only the leaf
+ * is read locked, and then the sequence of every node on the path is
+ * checked again.  A node cow'ed, split or merged had to be write locked
+ * for it, so if none of them changed, the path we walked was the real
+ * one while we held the leaf lock, the same as if we had locked our way
+ * down.
+ *
+ * Only blocks that are cached and uptodate are used.  Anything else,
+ * including a node being written, makes us give up with -EAGAIN, and
+ * the caller falls back to a locked search.
+ */
+static int search_slot_lockless(struct btrfs_root *root,
+				struct btrfs_key *key, struct btrfs_path *p)
+{
+	unsigned int seq[BTRFS_MAX_LEVEL];
+	struct extent_buffer *b;
+	int top_level;
+	int level;
+	int slot;
+	int ret;
+	u64 gen = 0;
+
+	b = btrfs_root_node(root);
+	level = top_level = btrfs_header_level(b);
+	if (level >= BTRFS_MAX_LEVEL) {
+		free_extent_buffer(b);
+		return -EAGAIN;
+	}
+
+	while (1) {
+		u32 nritems;
+		u64 blocknr;
+
+		p->nodes[level] = b;
+		seq[level] = btrfs_tree_read_seq(b);
+		if (seq[level] & 1)
+			goto fail;
+		if (btrfs_header_level(b) != level ||
+		    (level != top_level && btrfs_header_generation(b) != gen))
+			goto fail;
+		if (level == 0)
+			break;
+
+		nritems = btrfs_header_nritems(b);
+		if (nritems == 0 || nritems > BTRFS_NODEPTRS_PER_BLOCK(root))
+			goto fail;
+		ret = generic_bin_search(b, offsetof(struct btrfs_node, ptrs),
+					 sizeof(struct btrfs_key_ptr), key,
+					 nritems, &slot);
+		if (ret && slot > 0)
+			slot--;
+		p->slots[level] = slot;
+		blocknr = btrfs_node_blockptr(b, slot);
+		gen = btrfs_node_ptr_generation(b, slot);
+		if (btrfs_tree_seq_retry(b, seq[level]))
+			goto fail;
+
+		b = find_extent_buffer(root->fs_info, blocknr);
+		if (!b)
+			goto fail;
+		level--;
+		if (!extent_buffer_uptodate(b) ||
+		    test_bit(EXTENT_BUFFER_STALE, &b->bflags)) {
+			p->nodes[level] = b;
+			goto fail;
+		}
+	}
+
+	btrfs_tree_read_lock(b);
+	p->locks[0] = BTRFS_READ_LOCK;
+	if (btrfs_header_level(b) != 0 ||
+	    (top_level && btrfs_header_generation(b) != gen))
+		goto fail;
+	for (level = 1; level <= top_level; level++)
+		if (btrfs_tree_seq_retry(p->nodes[level], seq[level]))
+			goto fail;
+	if (p->nodes[top_level] != ACCESS_ONCE(root->node))
+		goto fail;
+
+	ret = generic_bin_search(b, offsetof(struct btrfs_leaf, items),
+				 sizeof(struct btrfs_item), key,
+				 btrfs_header_nritems(b), &slot);
+	p->slots[0] = slot;
+	return ret;
+
+fail:
+	btrfs_release_path(p);
+	return -EAGAIN;
+}
+
 /*
  * look for key in the tree.  path is filled in with nodes along the way
  * if key is found, we return zero and you can find the item in the leaf
@@ -2757,6 +2851,14 @@ int btrfs_search_slot(struct btrfs_trans_handle *trans, struct btrfs_root
 
 	min_write_lock_level = write_lock_level;
 
+	/* plain lookups first try to get to the leaf without locking */
+	if (!cow && !p->search_commit_root && !p->skip_locking &&
+	    !p->keep_locks && !lowest_level && !p->search_for_split) {
+		ret = search_slot_lockless(root, key, p);
+		if (ret != -EAGAIN)
+			goto done;
+	}
+
 again:
 	prev_cmp = -1;
 	/*
@@ -146,6 +146,12 @@ struct extent_buffer {
 	atomic_t spinning_writers;
 	int lock_nested;
 
+	/*
+	 * bumped when the write lock is taken and again when it is
+	 * released, so it is odd while the buffer may be changing
+	 */
+	unsigned int lock_seq;
+
 	/* protects write locks */
 	rwlock_t lock;
 
@@ -433,24 +433,118 @@ fail:
 	return ret;
 }
 
+/*
+ * a run of at least twice this many pages is split into chunks that
+ * are checksummed in parallel by the csum workers
+ */
+#define BTRFS_CSUM_CHUNK_PAGES 16
+
+struct btrfs_csum_chunk {
+	struct btrfs_work work;
+	struct bio_vec *bvec;
+	int nr;
+	u32 *csums;
+	atomic_t *pending;
+	struct completion *done;
+};
+
+static void csum_bvecs(struct bio_vec *bvec, int nr, u32 *csums)
+{
+	char *data;
+	int i;
+
+	for (i = 0; i < nr; i++, bvec++) {
+		data = kmap_atomic(bvec->bv_page);
+		csums[i] = btrfs_csum_data(data + bvec->bv_offset, ~(u32)0,
+					   bvec->bv_len);
+		kunmap_atomic(data);
+		btrfs_csum_final(csums[i], (char *)(csums + i));
+	}
+}
+
+static void csum_chunk_worker(struct btrfs_work *work)
+{
+	struct btrfs_csum_chunk *chunk;
+
+	chunk = container_of(work, struct btrfs_csum_chunk, work);
+	csum_bvecs(chunk->bvec, chunk->nr, chunk->csums);
+	if (atomic_dec_and_test(chunk->pending))
+		complete(chunk->done);
+}
+
+/*
+ * store the final checksum of each of the nr bvecs in csums.
+ *
+ * A long run is cut into up to thread_pool_size chunks, and all but
+ * the first are handed to the csum workers, so the checksums of a big
+ * bio are computed on several cpus at once.  The caller does the first
+ * chunk itself and then waits for the rest, so this may sleep.
+ */
+void btrfs_csum_bvecs(struct btrfs_fs_info *fs_info, struct bio_vec *bvec,
+		      int nr, u32 *csums)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct btrfs_csum_chunk *chunks;
+	atomic_t pending;
+	int nr_chunks;
+	int i;
+
+	nr_chunks = min(nr / BTRFS_CSUM_CHUNK_PAGES,
+			fs_info->thread_pool_size);
+	if (nr_chunks < 2)
+		goto inline_csum;
+
+	chunks = kmalloc_array(nr_chunks - 1, sizeof(*chunks), GFP_NOFS);
+	if (!chunks)
+		goto inline_csum;
+
+	atomic_set(&pending, nr_chunks - 1);
+	for (i = 1; i < nr_chunks; i++) {
+		struct btrfs_csum_chunk *chunk = &chunks[i - 1];
+		int first = i * nr / nr_chunks;
+
+		chunk->bvec = bvec + first;
+		chunk->nr = (i + 1) * nr / nr_chunks - first;
+		chunk->csums = csums + first;
+		chunk->pending = &pending;
+		chunk->done = &done;
+		btrfs_init_work(&chunk->work, csum_chunk_worker, NULL, NULL);
+		btrfs_queue_work(fs_info->csum_workers, &chunk->work);
+	}
+	csum_bvecs(bvec, nr / nr_chunks, csums);
+	wait_for_completion(&done);
+	kfree(chunks);
+	return;
+
+inline_csum:
+	csum_bvecs(bvec, nr, csums);
+}
+
 int btrfs_csum_one_bio(struct btrfs_root *root, struct inode *inode,
 		       struct bio *bio, u64 file_start, int contig)
 {
 	struct btrfs_ordered_sum *sums;
 	struct btrfs_ordered_extent *ordered;
-	char *data;
 	struct bio_vec *bvec = bio->bi_io_vec;
 	int bio_index = 0;
 	int index;
 	unsigned long total_bytes = 0;
 	unsigned long this_sum_bytes = 0;
 	u64 offset;
+	u32 *csums;
 
 	WARN_ON(bio->bi_vcnt <= 0);
+	csums = kmalloc_array(bio->bi_vcnt, sizeof(u32), GFP_NOFS);
+	if (!csums)
+		return -ENOMEM;
 	sums = kzalloc(btrfs_ordered_sum_size(root, bio->bi_iter.bi_size),
 		       GFP_NOFS);
-	if (!sums)
+	if (!sums) {
+		kfree(csums);
 		return -ENOMEM;
+	}
+
+	btrfs_csum_bvecs(root->fs_info, bvec, bio->bi_vcnt, csums);
 
 	sums->len = bio->bi_iter.bi_size;
 	INIT_LIST_HEAD(&sums->list);
@@ -490,14 +584,7 @@ int btrfs_csum_one_bio(struct btrfs_root *root, struct inode *inode,
 			index = 0;
 		}
 
-		data = kmap_atomic(bvec->bv_page);
-		sums->sums[index] = ~(u32)0;
-		sums->sums[index] = btrfs_csum_data(data + bvec->bv_offset,
-						    sums->sums[index],
-						    bvec->bv_len);
-		kunmap_atomic(data);
-		btrfs_csum_final(sums->sums[index],
-				 (char *)(sums->sums + index));
+		sums->sums[index] = csums[bio_index];
 
 		bio_index++;
 		index++;
@@ -509,6 +596,7 @@ int btrfs_csum_one_bio(struct btrfs_root *root, struct inode *inode,
 	this_sum_bytes = 0;
 	btrfs_add_ordered_sum(inode, ordered, sums);
 	btrfs_put_ordered_extent(ordered);
+	kfree(csums);
 	return 0;
 }
 
@@ -2662,6 +2662,7 @@ const struct file_operations btrfs_file_operations = {
 	.release	= btrfs_release_file,
 	.fsync		= btrfs_sync_file,
 	.fallocate	= btrfs_fallocate,
+	.copy_file_range = btrfs_copy_file_range,
 	.unlocked_ioctl	= btrfs_ioctl,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl	= btrfs_ioctl,
@@ -0,0 +1,707 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include "ctree.h"
+#include "disk-io.h"
+#include "transaction.h"
+#include "free-space-tree.h"
+
+/*
+ * The free space tree records the free extents of every block group, so
+ * that caching a block group is a walk over its own items rather than a
+ * scan of all the extent items in its range, and that nothing has to be
+ * written back for it at transaction commit the way the free space cache
+ * inodes are.  It is updated as the extent tree is: extents are removed
+ * from it when their extent item is inserted, and added back when the
+ * extent item is deleted, from the same delayed ref processing.
+ *
+ * Every block group has a (start, BTRFS_FREE_SPACE_INFO_KEY, length) item
+ * counting its free extents, followed by one (start,
+ * BTRFS_FREE_SPACE_EXTENT_KEY, length) item per extent.  The extents are
+ * kept merged, so an allocated range always lies within a single one of
+ * them.
+ */
+
+/*
+ * search for the last item at or before key, which has to exist since the
+ * keys used are past the info item of the block group
+ */
+static int search_prev_slot(struct btrfs_trans_handle *trans,
+			    struct btrfs_root *root, struct btrfs_key *key,
+			    struct btrfs_path *path, int ins_len, int cow)
+{
+	int ret;
+
+	ret = btrfs_search_slot(trans, root, key, path, ins_len, cow);
+	if (ret < 0)
+		return ret;
+	if (ret == 0)
+		return 0;
+
+	if (path->slots[0] == 0) {
+		WARN_ON(1);
+		btrfs_release_path(path);
+		return -EIO;
+	}
+	path->slots[0]--;
+	return 0;
+}
+
+static int add_new_free_space_info(struct btrfs_trans_handle *trans,
+				   struct btrfs_fs_info *fs_info,
+				   struct btrfs_block_group_cache *block_group,
+				   struct btrfs_path *path, u32 extent_count)
+{
+	struct btrfs_root *root = fs_info->free_space_root;
+	struct btrfs_free_space_info *info;
+	struct btrfs_key key;
+	struct extent_buffer *leaf;
+	int ret;
+
+	key.objectid = block_group->key.objectid;
+	key.type = BTRFS_FREE_SPACE_INFO_KEY;
+	key.offset = block_group->key.offset;
+
+	ret = btrfs_insert_empty_item(trans, root, path, &key, sizeof(*info));
+	if (ret)
+		goto out;
+
+	leaf = path->nodes[0];
+	info = btrfs_item_ptr(leaf, path->slots[0],
+			      struct btrfs_free_space_info);
+	btrfs_set_free_space_extent_count(leaf, info, extent_count);
+	btrfs_set_free_space_flags(leaf, info, 0);
+	btrfs_mark_buffer_dirty(leaf);
+out:
+	btrfs_release_path(path);
+	return ret;
+}
+
+static int update_free_space_extent_count(struct btrfs_trans_handle *trans,
+				struct btrfs_fs_info *fs_info,
+				struct btrfs_block_group_cache *block_group,
+				struct btrfs_path *path, int delta)
+{
+	struct btrfs_root *root = fs_info->free_space_root;
+	struct btrfs_free_space_info *info;
+	struct btrfs_key key;
+	struct extent_buffer *leaf;
+	u32 extent_count;
+	int ret;
+
+	if (!delta)
+		return 0;
+
+	key.objectid = block_group->key.objectid;
+	key.type = BTRFS_FREE_SPACE_INFO_KEY;
+	key.offset = block_group->key.offset;
+
+	ret = btrfs_search_slot(trans, root, &key, path, 0, 1);
+	if (ret > 0)
+		ret = -ENOENT;
+	if (ret)
+		goto out;
+
+	leaf = path->nodes[0];
+	info = btrfs_item_ptr(leaf, path->slots[0],
+			      struct btrfs_free_space_info);
+	extent_count = btrfs_free_space_extent_count(leaf, info);
+	btrfs_set_free_space_extent_count(leaf, info, extent_count + delta);
+	btrfs_mark_buffer_dirty(leaf);
+out:
+	btrfs_release_path(path);
+	return ret;
+}
+
+static int insert_free_space_extent(struct btrfs_trans_handle *trans,
+				    struct btrfs_fs_info *fs_info,
+				    struct btrfs_path *path,
+				    u64 start, u64 size)
+{
+	struct btrfs_key key;
+	int ret;
+
+	key.objectid = start;
+	key.type = BTRFS_FREE_SPACE_EXTENT_KEY;
+	key.offset = size;
+
+	ret = btrfs_insert_empty_item(trans, fs_info->free_space_root, path,
+				      &key, 0);
+	btrfs_release_path(path);
+	return ret;
+}
+
+/*
+ * give a block group created in this transaction its items, the whole of
+ * it being free, before the first update of its free space
+ */
+static int __add_block_group_free_space(struct btrfs_trans_handle *trans,
+				struct btrfs_fs_info *fs_info,
+				struct btrfs_block_group_cache *block_group,
+				struct btrfs_path *path)
+{
+	int ret;
+
+	block_group->needs_free_space = 0;
+
+	ret = add_new_free_space_info(trans, fs_info, block_group, path, 1);
+	if (ret)
+		return ret;
+
+	return insert_free_space_extent(trans, fs_info, path,
+					block_group->key.objectid,
+					block_group->key.offset);
+}
+
+int btrfs_add_block_group_free_space(struct btrfs_trans_handle *trans,
+				struct btrfs_fs_info *fs_info,
+				struct btrfs_block_group_cache *block_group)
+{
+	struct btrfs_path *path;
+	int ret = 0;
+
+	if (!block_group->needs_free_space)
+		return 0;
+
+	path = btrfs_alloc_path();
+	if (!path)
+		return -ENOMEM;
+
+	mutex_lock(&block_group->free_space_lock);
+	if (block_group->needs_free_space)
+		ret = __add_block_group_free_space(trans, fs_info, block_group,
+						   path);
+	mutex_unlock(&block_group->free_space_lock);
+
+	btrfs_free_path(path);
+	return ret;
+}
+
+int btrfs_remove_block_group_free_space(struct btrfs_trans_handle *trans,
+				struct btrfs_fs_info *fs_info,
+				struct btrfs_block_group_cache *block_group)
+{
+	struct btrfs_root *root = fs_info->free_space_root;
+	struct btrfs_path *path;
+	struct btrfs_key key, found_key;
+	struct extent_buffer *leaf;
+	u64 start, end;
+	int done = 0, nr;
+	int ret = 0;
+
+	if (!block_group->free_space_tracked)
+		return 0;
+
+	mutex_lock(&block_group->free_space_lock);
+	if (block_group->needs_free_space) {
+		/* nothing was inserted for it yet */
+		block_group->needs_free_space = 0;
+		mutex_unlock(&block_group->free_space_lock);
+		return 0;
+	}
+
+	path = btrfs_alloc_path();
+	if (!path) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	start = block_group->key.objectid;
+	end = block_group->key.objectid + block_group->key.offset;
+
+	key.objectid = end - 1;
+	key.type = (u8)-1;
+	key.offset = (u64)-1;
+
+	/* delete backwards, down to the info item of the block group */
+	while (!done) {
+		ret = search_prev_slot(trans, root, &key, path, -1, 1);
+		if (ret)
+			goto out;
+
+		leaf = path->nodes[0];
+		nr = 0;
+		path->slots[0]++;
+		while (path->slots[0] > 0) {
+			btrfs_item_key_to_cpu(leaf, &found_key,
+					      path->slots[0] - 1);
+
+			if (found_key.type == BTRFS_FREE_SPACE_INFO_KEY) {
+				ASSERT(found_key.objectid == start);
+				done = 1;
+				nr++;
+				path->slots[0]--;
+				break;
+			}
+
+			ASSERT(found_key.type == BTRFS_FREE_SPACE_EXTENT_KEY);
+			ASSERT(found_key.objectid >= start &&
+			       found_key.objectid < end);
+			nr++;
+			path->slots[0]--;
+		}
+
+		ret = btrfs_del_items(trans, root, path, path->slots[0], nr);
+		if (ret)
+			goto out;
+		btrfs_release_path(path);
+	}
+
+out:
+	mutex_unlock(&block_group->free_space_lock);
+	btrfs_free_path(path);
+	return ret;
+}
+
+static int __remove_from_free_space_tree(struct btrfs_trans_handle *trans,
+				struct btrfs_fs_info *fs_info,
+				struct btrfs_block_group_cache *block_group,
+				struct btrfs_path *path, u64 start, u64 size)
+{
+	struct btrfs_root *root = fs_info->free_space_root;
+	struct btrfs_key key;
+	u64 found_start, found_end;
+	u64 end = start + size;
+	int delta = -1;
+	int ret;
+
+	key.objectid = start;
+	key.type = BTRFS_FREE_SPACE_EXTENT_KEY;
+	key.offset = (u64)-1;
+
+	ret = search_prev_slot(trans, root, &key, path, -1, 1);
+	if (ret)
+		return ret;
+
+	btrfs_item_key_to_cpu(path->nodes[0], &key, path->slots[0]);
+	found_start = key.objectid;
+	found_end = key.objectid + key.offset;
+	if (key.type != BTRFS_FREE_SPACE_EXTENT_KEY ||
+	    start < found_start || end > found_end) {
+		btrfs_release_path(path);
+		if (fs_info->creating_free_space_tree)
+			return 0;
+		btrfs_err(fs_info,
+			  "free space tree has no free extent at %llu len %llu",
+			  start, size);
+		return -ENOENT;
+	}
+
+	ret = btrfs_del_item(trans, root, path);
+	if (ret)
+		return ret;
+	btrfs_release_path(path);
+
+	if (start > found_start) {
+		ret = insert_free_space_extent(trans, fs_info, path,
+					       found_start,
+					       start - found_start);
+		if (ret)
+			return ret;
+		delta++;
+	}
+
+	if (end < found_end) {
+		ret = insert_free_space_extent(trans, fs_info, path, end,
+					       found_end - end);
+		if (ret)
+			return ret;
+		delta++;
+	}
+
+	return update_free_space_extent_count(trans, fs_info, block_group,
+					      path, delta);
+}
+
+static int __add_to_free_space_tree(struct btrfs_trans_handle *trans,
+				struct btrfs_fs_info *fs_info,
+				struct btrfs_block_group_cache *block_group,
+				struct btrfs_path *path, u64 start, u64 size)
+{
+	struct btrfs_root *root = fs_info->free_space_root;
+	struct btrfs_key key;
+	u64 end = start + size;
+	u64 new_start = start, new_end = end;
+	int delta = 1;
+	int ret;
+
+	/*
+	 * the last extent starting before the new one either overlaps it,
+	 * or ends where it starts and is merged with it
+	 */
+	key.objectid = end - 1;
+	key.type = BTRFS_FREE_SPACE_EXTENT_KEY;
+	key.offset = (u64)-1;
+
+	ret = search_prev_slot(trans, root, &key, path, -1, 1);
+	if (ret)
+		return ret;
+
+	btrfs_item_key_to_cpu(path->nodes[0], &key, path->slots[0]);
+	if (key.type == BTRFS_FREE_SPACE_EXTENT_KEY) {
+		if (key.objectid + key.offset > start) {
+			btrfs_release_path(path);
+			if (fs_info->creating_free_space_tree)
+				return 0;
+			btrfs_err(fs_info,
+		"free space tree already has free extent at %llu len %llu",
+				  key.objectid, key.offset);
+			return -EEXIST;
+		}
+		if (key.objectid + key.offset == start) {
+			new_start = key.objectid;
+			ret = btrfs_del_item(trans, root, path);
+			if (ret)
+				return ret;
+			delta--;
+		}
+	}
+	btrfs_release_path(path);
+
+	/* and the extent at its end, if any, is merged too */
+	if (end < block_group->key.objectid + block_group->key.offset) {
+		key.objectid = end;
+		key.type = BTRFS_FREE_SPACE_EXTENT_KEY;
+		key.offset = (u64)-1;
+
+		ret = search_prev_slot(trans, root, &key, path, -1, 1);
+		if (ret)
+			return ret;
+
+		btrfs_item_key_to_cpu(path->nodes[0], &key, path->slots[0]);
+		if (key.type == BTRFS_FREE_SPACE_EXTENT_KEY &&
+		    key.objectid == end) {
+			new_end = end + key.offset;
+			ret = btrfs_del_item(trans, root, path);
+			if (ret)
+				return ret;
+			delta--;
+		}
+		btrfs_release_path(path);
+	}
+
+	ret = insert_free_space_extent(trans, fs_info, path, new_start,
+				       new_end - new_start);
+	if (ret)
+		return ret;
+
+	return update_free_space_extent_count(trans, fs_info, block_group,
+					      path, delta);
+}
+
+static int update_free_space_tree(struct btrfs_trans_handle *trans,
+				  struct btrfs_fs_info *fs_info,
+				  u64 start, u64 size, int add)
+{
+	struct btrfs_block_group_cache *block_group;
+	struct btrfs_path *path;
+	int ret = 0;
+
+	if (!fs_info->free_space_root)
+		return 0;
+
+	block_group = btrfs_lookup_block_group(fs_info, start);
+	if (!block_group) {
+		WARN_ON(1);
+		return -ENOENT;
+	}
+
+	if (!block_group->free_space_tracked)
+		goto out;
+
+	path = btrfs_alloc_path();
+	if (!path) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	mutex_lock(&block_group->free_space_lock);
+	if (block_group->needs_free_space)
+		ret = __add_block_group_free_space(trans, fs_info, block_group,
+						   path);
+	if (!ret && add)
+		ret = __add_to_free_space_tree(trans, fs_info, block_group,
+					       path, start, size);
+	else if (!ret)
+		ret = __remove_from_free_space_tree(trans, fs_info,
+						    block_group, path,
+						    start, size);
+	mutex_unlock(&block_group->free_space_lock);
+
+	btrfs_free_path(path);
+out:
+	btrfs_put_block_group(block_group);
+	return ret;
+}
+
+int btrfs_add_to_free_space_tree(struct btrfs_trans_handle *trans,
+				 struct btrfs_fs_info *fs_info,
+				 u64 start, u64 size)
+{
+	return update_free_space_tree(trans, fs_info, start, size, 1);
+}
+
+int btrfs_remove_from_free_space_tree(struct btrfs_trans_handle *trans,
+				      struct btrfs_fs_info *fs_info,
+				      u64 start, u64 size)
+{
+	return update_free_space_tree(trans, fs_info, start, size, 0);
+}
+
+/*
+ * fill in the items of a block group the free space tree does not track yet
+ * from the extent items in its range
+ */
+static int populate_free_space_tree(struct btrfs_trans_handle *trans,
+				    struct btrfs_fs_info *fs_info,
+				    struct btrfs_block_group_cache *block_group)
+{
+	struct btrfs_root *extent_root = fs_info->extent_root;
+	struct btrfs_path *path, *path2;
+	struct extent_buffer *leaf;
+	struct btrfs_key key;
+	u64 start, end;
+	int extent_count = 0;
+	int ret;
+
+	path = btrfs_alloc_path();
+	if (!path)
+		return -ENOMEM;
+	path->reada = 1;
+
+	path2 = btrfs_alloc_path();
+	if (!path2) {
+		btrfs_free_path(path);
+		return -ENOMEM;
+	}
+
+	ret = add_new_free_space_info(trans, fs_info, block_group, path2, 0);
+	if (ret)
+		goto out;
+
+	start = block_group->key.objectid;
+	end = block_group->key.objectid + block_group->key.offset;
+
+	key.objectid = start;
+	key.type = BTRFS_EXTENT_ITEM_KEY;
+	key.offset = 0;
+
+	ret = btrfs_search_slot(NULL, extent_root, &key, path, 0, 0);
+	if (ret < 0)
+		goto out;
+
+	while (1) {
+		leaf = path->nodes[0];
+		if (path->slots[0] >= btrfs_header_nritems(leaf)) {
+			ret = btrfs_next_leaf(extent_root, path);
+			if (ret < 0)
+				goto out;
+			if (ret)
+				break;
+			continue;
+		}
+
+		btrfs_item_key_to_cpu(leaf, &key, path->slots[0]);
+		if (key.objectid >= end)
+			break;
+
+		if (key.type == BTRFS_EXTENT_ITEM_KEY ||
+		    key.type == BTRFS_METADATA_ITEM_KEY) {
+			if (start < key.objectid) {
+				ret = insert_free_space_extent(trans, fs_info,
+						path2, start,
+						key.objectid - start);
+				if (ret)
+					goto out;
+				extent_count++;
+			}
+			if (key.type == BTRFS_METADATA_ITEM_KEY)
+				start = key.objectid +
+					fs_info->tree_root->leafsize;
+			else
+				start = key.objectid + key.offset;
+		}
+		path->slots[0]++;
+	}
+	btrfs_release_path(path);
+
+	if (start < end) {
+		ret = insert_free_space_extent(trans, fs_info, path2, start,
+					       end - start);
+		if (ret)
+			goto out;
+		extent_count++;
+	}
+
+	ret = update_free_space_extent_count(trans, fs_info, block_group,
+					     path2, extent_count);
+out:
+	btrfs_free_path(path2);
+	btrfs_free_path(path);
+	return ret;
+}
+
+int btrfs_create_free_space_tree(struct btrfs_fs_info *fs_info)
+{
+	struct btrfs_trans_handle *trans;
+	struct btrfs_root *tree_root = fs_info->tree_root;
+	struct btrfs_root *free_space_root;
+	struct btrfs_block_group_cache *block_group;
+	u64 start = 0;
+	int ret;
+
+	trans = btrfs_start_transaction(tree_root, 0);
+	if (IS_ERR(trans))
+		return PTR_ERR(trans);
+
+	fs_info->creating_free_space_tree = 1;
+	free_space_root = btrfs_create_tree(trans, fs_info,
+					    BTRFS_FREE_SPACE_TREE_OBJECTID);
+	if (IS_ERR(free_space_root)) {
+		ret = PTR_ERR(free_space_root);
+		goto abort;
+	}
+	free_space_root->block_rsv = &fs_info->global_block_rsv;
+	fs_info->free_space_root = free_space_root;
+
+	while ((block_group = btrfs_lookup_first_block_group(fs_info,
+							     start))) {
+		mutex_lock(&block_group->free_space_lock);
+		ret = 0;
+		if (!block_group->free_space_tracked) {
+			ret = populate_free_space_tree(trans, fs_info,
+						       block_group);
+			if (!ret)
+				block_group->free_space_tracked = 1;
+		}
+		mutex_unlock(&block_group->free_space_lock);
+
+		start = block_group->key.objectid + block_group->key.offset;
+		btrfs_put_block_group(block_group);
+		if (ret)
+			goto abort;
+	}
+
+	btrfs_set_fs_compat_ro(fs_info, FREE_SPACE_TREE);
+
+	ret = btrfs_commit_transaction(trans, tree_root);
+	fs_info->creating_free_space_tree = 0;
+	return ret;
+
+abort:
+	fs_info->creating_free_space_tree = 0;
+	btrfs_abort_transaction(trans, tree_root, ret);
+	btrfs_end_transaction(trans, tree_root);
+	return ret;
+}
+
+/*
+ * cache a block group from its free space tree items in the commit root,
+ * called by the caching thread with the caching mutex and commit_root_sem
+ * held.  Returns -ENOENT when the block group has no items there yet, so
+ * that the extent tree is scanned instead.
+ */
+int load_free_space_tree(struct btrfs_caching_control *caching_ctl)
+{
+	struct btrfs_block_group_cache *block_group;
+	struct btrfs_fs_info *fs_info;
+	struct btrfs_root *root;
+	struct btrfs_path *path;
+	struct btrfs_free_space_info *info;
+	struct extent_buffer *leaf;
+	struct btrfs_key key;
+	u64 end, total_found = 0;
+	u32 extent_count, found = 0;
+	int ret;
+
+	block_group = caching_ctl->block_group;
+	fs_info = block_group->fs_info;
+	root = fs_info->free_space_root;
+	if (!root)
+		return -ENOENT;
+
+	path = btrfs_alloc_path();
+	if (!path)
+		return -ENOMEM;
+
+	/* see load_extent_tree_free() */
+	path->skip_locking = 1;
+	path->search_commit_root = 1;
+	path->reada = 1;
+
+	key.objectid = block_group->key.objectid;
+	key.type = BTRFS_FREE_SPACE_INFO_KEY;
+	key.offset = block_group->key.offset;
+	end = block_group->key.objectid + block_group->key.offset;
+
+	ret = btrfs_search_slot(NULL, root, &key, path, 0, 0);
+	if (ret > 0)
+		ret = -ENOENT;
+	if (ret)
+		goto out;
+
+	leaf = path->nodes[0];
+	info = btrfs_item_ptr(leaf, path->slots[0],
+			      struct btrfs_free_space_info);
+	extent_count = btrfs_free_space_extent_count(leaf, info);
+	path->slots[0]++;
+
+	while (1) {
+		if (btrfs_fs_closing(fs_info) > 1)
+			goto done;
+
+		leaf = path->nodes[0];
+		if (path->slots[0] >= btrfs_header_nritems(leaf)) {
+			ret = btrfs_next_leaf(root, path);
+			if (ret < 0)
+				goto out;
+			if (ret)
+				break;
+			continue;
+		}
+
+		btrfs_item_key_to_cpu(leaf, &key, path->slots[0]);
+		if (key.type != BTRFS_FREE_SPACE_EXTENT_KEY ||
+		    key.objectid >= end)
+			break;
+
+		total_found += add_new_free_space(block_group, fs_info,
+						  key.objectid,
+						  key.objectid + key.offset);
+		if (total_found > (1024 * 1024 * 2)) {
+			total_found = 0;
+			wake_up(&caching_ctl->wait);
+		}
+		found++;
+		path->slots[0]++;
+	}
+
+	if (found != extent_count) {
+		btrfs_err(fs_info,
+	"free space tree has %u extents for block group %llu, expected %u",
+			  found, block_group->key.objectid, extent_count);
+		ret = -EIO;
+		goto out;
+	}
+done:
+	ret = 0;
+	caching_ctl->progress = (u64)-1;
+out:
+	btrfs_free_path(path);
+	return ret;
+}
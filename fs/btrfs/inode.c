@@ -7009,24 +7009,27 @@ static void btrfs_endio_direct_read(struct bio *bio, int err)
 	struct btrfs_root *root = BTRFS_I(inode)->root;
 	struct bio *dio_bio;
 	u32 *csums = (u32 *)dip->csum;
+	u32 *computed = NULL;
 	u64 start;
 	int i;
 
+	/* checksum the whole bio at once, so that it's done in parallel */
+	if (!(BTRFS_I(inode)->flags & BTRFS_INODE_NODATASUM)) {
+		computed = kmalloc_array(bio->bi_vcnt, sizeof(u32), GFP_NOFS);
+		if (computed)
+			btrfs_csum_bvecs(root->fs_info, bio->bi_io_vec,
+					 bio->bi_vcnt, computed);
+	}
+
 	start = dip->logical_offset;
 	bio_for_each_segment_all(bvec, bio, i) {
 		if (!(BTRFS_I(inode)->flags & BTRFS_INODE_NODATASUM)) {
-			struct page *page = bvec->bv_page;
-			char *kaddr;
-			u32 csum = ~(u32)0;
-			unsigned long flags;
-
-			local_irq_save(flags);
-			kaddr = kmap_atomic(page);
-			csum = btrfs_csum_data(kaddr + bvec->bv_offset,
-					       csum, bvec->bv_len);
-			btrfs_csum_final(csum, (char *)&csum);
-			kunmap_atomic(kaddr);
-			local_irq_restore(flags);
+			u32 csum;
+
+			if (computed)
+				csum = computed[i];
+			else
+				btrfs_csum_bvecs(root->fs_info, bvec, 1, &csum);
 
 			flush_dcache_page(bvec->bv_page);
 			if (csum != csums[i]) {
@@ -7039,6 +7042,7 @@ static void btrfs_endio_direct_read(struct bio *bio, int err)
 
 		start += bvec->bv_len;
 	}
+	kfree(computed);
 
 	unlock_extent(&BTRFS_I(inode)->io_tree, dip->logical_offset,
 		      dip->logical_offset + dip->bytes - 1);
@@ -160,6 +160,8 @@ int btrfs_try_tree_write_lock(struct extent_buffer *eb)
 	atomic_inc(&eb->write_locks);
 	atomic_inc(&eb->spinning_writers);
 	eb->lock_owner = current->pid;
+	eb->lock_seq++;
+	smp_wmb();
 	return 1;
 }
 
@@ -232,6 +234,8 @@ again:
 	atomic_inc(&eb->spinning_writers);
 	atomic_inc(&eb->write_locks);
 	eb->lock_owner = current->pid;
+	eb->lock_seq++;
+	smp_wmb();
 }
 
 /*
@@ -246,6 +250,10 @@ void btrfs_tree_unlock(struct extent_buffer *eb)
 	btrfs_assert_tree_locked(eb);
 	atomic_dec(&eb->write_locks);
 
+	/* let lockless readers know the buffer may have changed */
+	smp_wmb();
+	eb->lock_seq++;
+
 	if (blockers) {
 		WARN_ON(atomic_read(&eb->spinning_writers));
 		atomic_dec(&eb->blocking_writers);
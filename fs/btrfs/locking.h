@@ -48,6 +48,26 @@ static inline void btrfs_tree_unlock_rw(struct extent_buffer *eb, int rw)
 		BUG();
 }
 
+/*
+ * lockless readers of a tree block take its lock sequence before looking
+ * at it, and check with btrfs_tree_seq_retry() once they are done that
+ * no writer had it locked in the meantime.
+ */
+static inline unsigned int btrfs_tree_read_seq(struct extent_buffer *eb)
+{
+	unsigned int seq = ACCESS_ONCE(eb->lock_seq);
+
+	smp_rmb();
+	return seq;
+}
+
+static inline int btrfs_tree_seq_retry(struct extent_buffer *eb,
+				       unsigned int seq)
+{
+	smp_rmb();
+	return (seq & 1) || ACCESS_ONCE(eb->lock_seq) != seq;
+}
+
 static inline void btrfs_set_lock_blocking(struct extent_buffer *eb)
 {
 	btrfs_set_lock_blocking_rw(eb, BTRFS_WRITE_LOCK);
@@ -22,6 +22,7 @@
 #include "hash.h"
 #include "transaction.h"
 #include "xattr.h"
+#include "compression.h"
 
 #define BTRFS_PROP_HANDLERS_HT_BITS 8
 static DEFINE_HASHTABLE(prop_handlers_ht, BTRFS_PROP_HANDLERS_HT_BITS);
@@ -382,6 +383,10 @@ static int prop_compression_validate(const char *value, size_t len)
 		return 0;
 	else if (!strncmp("zlib", value, len))
 		return 0;
+	else if (!strncmp("lz4", value, len))
+		return 0;
+	else if (!strncmp("lz4hc", value, len))
+		return 0;
 
 	return -EINVAL;
 }
@@ -404,9 +409,17 @@ static int prop_compression_apply(struct inode *inode,
 		type = BTRFS_COMPRESS_LZO;
 	else if (!strncmp("zlib", value, len))
 		type = BTRFS_COMPRESS_ZLIB;
+	else if (!strncmp("lz4", value, len))
+		type = BTRFS_COMPRESS_LZ4;
+	else if (!strncmp("lz4hc", value, len))
+		type = BTRFS_COMPRESS_LZ4HC;
 	else
 		return -EINVAL;
 
+	if (type == BTRFS_COMPRESS_LZ4 || type == BTRFS_COMPRESS_LZ4HC)
+		btrfs_set_fs_incompat(BTRFS_I(inode)->root->fs_info,
+				      COMPRESS_LZ4);
+
 	BTRFS_I(inode)->flags &= ~BTRFS_INODE_NOCOMPRESS;
 	BTRFS_I(inode)->flags |= BTRFS_INODE_COMPRESS;
 	BTRFS_I(inode)->force_compress = type;
@@ -416,12 +429,5 @@ static int prop_compression_apply(struct inode *inode,
 
 static const char *prop_compression_extract(struct inode *inode)
 {
-	switch (BTRFS_I(inode)->force_compress) {
-	case BTRFS_COMPRESS_ZLIB:
-		return "zlib";
-	case BTRFS_COMPRESS_LZO:
-		return "lzo";
-	}
-
-	return NULL;
+	return btrfs_compress_type2str(BTRFS_I(inode)->force_compress);
 }
@@ -32,6 +32,7 @@
 #include <linux/vt.h>
 #include <linux/falloc.h>
 #include <linux/fs.h>
+#include <linux/fincore.h>
 #include <linux/file.h>
 #include <linux/ppp_defs.h>
 #include <linux/ppp-ioctl.h>
@@ -889,6 +890,7 @@ COMPATIBLE_IOCTL(FIOASYNC)
 COMPATIBLE_IOCTL(FIONBIO)
 COMPATIBLE_IOCTL(FIONREAD)  /* This is also TIOCINQ */
 COMPATIBLE_IOCTL(FS_IOC_FIEMAP)
+COMPATIBLE_IOCTL(FS_IOC_FINCORE)
 /* 0x00 */
 COMPATIBLE_IOCTL(FIBMAP)
 COMPATIBLE_IOCTL(FIGETBSZ)
@@ -1507,6 +1509,7 @@ static long do_ioctl_trans(int fd, unsigned int cmd,
 	case KDSETLED:
 	/* NBD */
 	case NBD_SET_SOCK:
+	case NBD_ADD_SOCK:
 	case NBD_SET_BLKSIZE:
 	case NBD_SET_SIZE:
 	case NBD_SET_SIZE_BLOCKS:
@@ -968,24 +968,23 @@ dentry_lru_isolate(struct list_head *item, spinlock_t *lru_lock, void *arg)
 /**
  * prune_dcache_sb - shrink the dcache
  * @sb: superblock
- * @nr_to_scan : number of entries to try to free
- * @nid: which node to scan for freeable entities
+ * @sc: shrink control, passed to list_lru_shrink_walk()
  *
- * Attempt to shrink the superblock dcache LRU by @nr_to_scan entries. This is
+ * Attempt to shrink the superblock dcache LRU by @sc->nr_to_scan entries,
+ * on the node of @sc, and of its cgroup only if it reclaims one. This is
  * done when we need more memory an called from the superblock shrinker
  * function.
  *
  * This function may fail to free any resources if all the dentries are in
  * use.
  */
-long prune_dcache_sb(struct super_block *sb, unsigned long nr_to_scan,
-		     int nid)
+long prune_dcache_sb(struct super_block *sb, struct shrink_control *sc)
 {
 	LIST_HEAD(dispose);
 	long freed;
 
-	freed = list_lru_walk_node(&sb->s_dentry_lru, nid, dentry_lru_isolate,
-				       &dispose, &nr_to_scan);
+	freed = list_lru_shrink_walk(&sb->s_dentry_lru, sc,
+				     dentry_lru_isolate, &dispose);
 	shrink_dentry_list(&dispose);
 	return freed;
 }
@@ -2238,6 +2237,129 @@ next:
  	return found;
 }
 
+/*
+ * Dentries being looked up in a filesystem which lets lookups run without
+ * the directory's i_mutex (FS_PARALLEL_LOOKUP) are kept on a hash of their
+ * own, through d_lru, until the lookup is done: a lookup of the same name
+ * meanwhile waits for that one to finish rather than calling i_op->lookup
+ * on a second dentry.
+ *
+ * The bucket lock nests inside d_lock.  A dentry is taken off the hash
+ * before d_move() can change its name, so the name of one on the hash may
+ * be compared without d_lock.
+ */
+#define IN_LOOKUP_SHIFT 8
+
+static struct in_lookup_bucket {
+	spinlock_t lock;
+	struct list_head head;
+	wait_queue_head_t wait;
+} in_lookup_hashtable[1 << IN_LOOKUP_SHIFT];
+
+static inline struct in_lookup_bucket *in_lookup_hash(
+		const struct dentry *parent, unsigned int hash)
+{
+	hash += (unsigned long) parent / L1_CACHE_BYTES;
+	return in_lookup_hashtable + hash_32(hash, IN_LOOKUP_SHIFT);
+}
+
+static inline bool d_same_name(const struct dentry *dentry,
+			       const struct dentry *parent,
+			       const struct qstr *name)
+{
+	if (likely(!(parent->d_flags & DCACHE_OP_COMPARE))) {
+		if (dentry->d_name.len != name->len)
+			return false;
+		return dentry_cmp(dentry, name->name, name->len) == 0;
+	}
+	return parent->d_op->d_compare(parent, dentry, dentry->d_name.len,
+				       dentry->d_name.name, name) == 0;
+}
+
+/**
+ * d_alloc_parallel - allocate a dentry to look a name up without i_mutex
+ * @parent: parent dentry
+ * @name: qstr of the name, hashed
+ *
+ * Returns the hashed dentry of the name if there is one, waiting first for
+ * a lookup of it already in progress; otherwise a new in-lookup dentry, on
+ * which the caller calls i_op->lookup and then d_lookup_done().
+ * Returns ERR_PTR(-ENOMEM) if no dentry could be allocated.
+ */
+struct dentry *d_alloc_parallel(struct dentry *parent,
+				const struct qstr *name)
+{
+	struct in_lookup_bucket *b = in_lookup_hash(parent, name->hash);
+	struct dentry *new = d_alloc(parent, name);
+	struct dentry *dentry;
+
+	if (unlikely(!new))
+		return ERR_PTR(-ENOMEM);
+	/* Waiters find it on the hash under RCU, and may outlive it there */
+	spin_lock(&new->d_lock);
+	new->d_flags |= DCACHE_PAR_LOOKUP | DCACHE_RCUACCESS;
+	spin_unlock(&new->d_lock);
+retry:
+	dentry = d_lookup(parent, name);
+	if (dentry)
+		goto out_found;
+
+	rcu_read_lock();
+	spin_lock(&b->lock);
+	list_for_each_entry(dentry, &b->head, d_lru) {
+		if (dentry->d_name.hash != name->hash ||
+		    dentry->d_parent != parent ||
+		    !d_same_name(dentry, parent, name))
+			continue;
+		spin_unlock(&b->lock);
+		if (!lockref_get_not_dead(&dentry->d_lockref)) {
+			rcu_read_unlock();
+			goto retry;
+		}
+		rcu_read_unlock();
+		wait_event(b->wait, !d_in_lookup(dentry));
+		/* The lookup failed, or found the name under another dentry */
+		if (d_unhashed(dentry)) {
+			dput(dentry);
+			goto retry;
+		}
+		goto out_found;
+	}
+	list_add(&new->d_lru, &b->head);
+	spin_unlock(&b->lock);
+	rcu_read_unlock();
+
+	/*
+	 * A lookup which hashed its dentry after the d_lookup() above, and so
+	 * was already off the in-lookup hash, must be seen now.
+	 */
+	dentry = d_lookup(parent, name);
+	if (!dentry)
+		return new;
+out_found:
+	d_lookup_done(new);
+	dput(new);
+	return dentry;
+}
+EXPORT_SYMBOL(d_alloc_parallel);
+
+/*
+ * Called with d_lock held, on a dentry from d_alloc_parallel(), once the
+ * lookup is done or before d_move() renames it.
+ */
+void __d_lookup_done(struct dentry *dentry)
+{
+	struct in_lookup_bucket *b = in_lookup_hash(dentry->d_parent,
+						    dentry->d_name.hash);
+
+	spin_lock(&b->lock);
+	dentry->d_flags &= ~DCACHE_PAR_LOOKUP;
+	list_del_init(&dentry->d_lru);
+	spin_unlock(&b->lock);
+	wake_up_all(&b->wait);
+}
+EXPORT_SYMBOL(__d_lookup_done);
+
 /**
  * d_hash_and_lookup - hash the qstr then search for a dentry
  * @dir: Directory to search in
@@ -2514,6 +2636,10 @@ static void __d_move(struct dentry *dentry, struct dentry *target,
 
 	dentry_lock_for_move(dentry, target);
 
+	/* Its name is about to change: end its lookup while it is found */
+	if (unlikely(d_in_lookup(target)))
+		__d_lookup_done(target);
+
 	write_seqcount_begin(&dentry->d_seq);
 	write_seqcount_begin_nested(&target->d_seq, DENTRY_D_LOCK_NESTED);
 
@@ -2674,6 +2800,9 @@ static void __d_materialise_dentry(struct dentry *dentry, struct dentry *anon)
 
 	dentry_lock_for_move(anon, dentry);
 
+	if (unlikely(d_in_lookup(dentry)))
+		__d_lookup_done(dentry);
+
 	write_seqcount_begin(&dentry->d_seq);
 	write_seqcount_begin_nested(&anon->d_seq, DENTRY_D_LOCK_NESTED);
 
@@ -3371,6 +3500,12 @@ static void __init dcache_init(void)
 	dentry_cache = KMEM_CACHE(dentry,
 		SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|SLAB_MEM_SPREAD);
 
+	for (loop = 0; loop < (1U << IN_LOOKUP_SHIFT); loop++) {
+		spin_lock_init(&in_lookup_hashtable[loop].lock);
+		INIT_LIST_HEAD(&in_lookup_hashtable[loop].head);
+		init_waitqueue_head(&in_lookup_hashtable[loop].wait);
+	}
+
 	/* Hash may have been set up in dcache_init_early */
 	if (!hashdist)
 		return;
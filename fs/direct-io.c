@@ -127,11 +127,13 @@ struct dio {
 	spinlock_t bio_lock;		/* protects BIO fields below */
 	int page_errors;		/* errno from get_user_pages() */
 	int is_async;			/* is IO async ? */
+	bool kernel_pages;		/* iovec holds kernel addresses */
 	bool defer_completion;		/* defer AIO completion to workqueue? */
 	int io_error;			/* IO error in completion path */
 	unsigned long refcount;		/* direct_io_worker() and bios */
 	struct bio *bio_list;		/* singly linked via bi_private */
 	struct task_struct *waiter;	/* waiting task (NULL if none) */
+	struct block_device *bio_bdev;	/* bdev of the last submitted bio */
 
 	/* AIO related stuff */
 	struct kiocb *iocb;		/* kiocb */
@@ -161,17 +163,40 @@ static inline unsigned dio_pages_present(struct dio_submit *sdio)
 /*
  * Go grab and pin some userspace pages.   Typically we'll get 64 at a time.
  */
+/*
+ * In-kernel callers running under KERNEL_DS, like the loop driver in
+ * direct I/O mode, pass lowmem or kmap()ed buffers that the caller keeps
+ * pinned for the duration of the I/O.  get_user_pages_fast() can't look
+ * those up, so find the pages directly and take the reference the
+ * completion side drops.
+ */
+static int dio_get_kernel_pages(unsigned long addr, int nr_pages,
+				struct page **pages)
+{
+	int i;
+
+	for (i = 0; i < nr_pages; i++) {
+		pages[i] = kmap_to_page((void *)(addr + i * PAGE_SIZE));
+		page_cache_get(pages[i]);
+	}
+	return nr_pages;
+}
+
 static inline int dio_refill_pages(struct dio *dio, struct dio_submit *sdio)
 {
 	int ret;
 	int nr_pages;
 
 	nr_pages = min(sdio->total_pages - sdio->curr_page, DIO_PAGES);
-	ret = get_user_pages_fast(
-		sdio->curr_user_address,		/* Where from? */
-		nr_pages,			/* How many pages? */
-		dio->rw == READ,		/* Write to memory? */
-		&dio->pages[0]);		/* Put results here */
+	if (dio->kernel_pages)
+		ret = dio_get_kernel_pages(sdio->curr_user_address, nr_pages,
+					   &dio->pages[0]);
+	else
+		ret = get_user_pages_fast(
+			sdio->curr_user_address,	/* Where from? */
+			nr_pages,			/* How many pages? */
+			dio->rw == READ,		/* Write to memory? */
+			&dio->pages[0]);		/* Put results here */
 
 	if (ret < 0 && sdio->blocks_available && (dio->rw & WRITE)) {
 		struct page *page = ZERO_PAGE(0);
@@ -398,12 +423,13 @@ static inline void dio_bio_submit(struct dio *dio, struct dio_submit *sdio)
 	unsigned long flags;
 
 	bio->bi_private = dio;
+	dio->bio_bdev = bio->bi_bdev;
 
 	spin_lock_irqsave(&dio->bio_lock, flags);
 	dio->refcount++;
 	spin_unlock_irqrestore(&dio->bio_lock, flags);
 
-	if (dio->is_async && dio->rw == READ)
+	if (dio->is_async && dio->rw == READ && !dio->kernel_pages)
 		bio_set_pages_dirty(bio);
 
 	if (sdio->submit_io)
@@ -449,7 +475,12 @@ static struct bio *dio_await_one(struct dio *dio)
 		__set_current_state(TASK_UNINTERRUPTIBLE);
 		dio->waiter = current;
 		spin_unlock_irqrestore(&dio->bio_lock, flags);
-		io_schedule();
+		/*
+		 * If the queue supports it, spin for the completion instead
+		 * of sleeping. This only returns true once we're running.
+		 */
+		if (!dio->bio_bdev || !blk_poll(bdev_get_queue(dio->bio_bdev)))
+			io_schedule();
 		/* wake up sets us TASK_RUNNING */
 		spin_lock_irqsave(&dio->bio_lock, flags);
 		dio->waiter = NULL;
@@ -474,13 +505,18 @@ static int dio_bio_complete(struct dio *dio, struct bio *bio)
 	if (!uptodate)
 		dio->io_error = -EIO;
 
-	if (dio->is_async && dio->rw == READ) {
+	if (dio->is_async && dio->rw == READ && !dio->kernel_pages) {
 		bio_check_pages_dirty(bio);	/* transfers ownership */
 	} else {
 		bio_for_each_segment_all(bvec, bio, i) {
 			struct page *page = bvec->bv_page;
 
-			if (dio->rw == READ && !PageCompound(page))
+			/*
+			 * Kernel pages belong to the caller, which may well
+			 * hold them locked, so leave dirtying to it.
+			 */
+			if (dio->rw == READ && !PageCompound(page) &&
+			    !dio->kernel_pages)
 				set_page_dirty_lock(page);
 			page_cache_release(page);
 		}
@@ -1208,6 +1244,7 @@ do_blockdev_direct_IO(int rw, struct kiocb *iocb, struct inode *inode,
 
 	dio->inode = inode;
 	dio->rw = rw;
+	dio->kernel_pages = segment_eq(get_fs(), KERNEL_DS);
 
 	/*
 	 * For AIO O_(D)SYNC writes we need to defer completions to a workqueue
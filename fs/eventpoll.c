@@ -42,6 +42,7 @@
 #include <linux/seq_file.h>
 #include <linux/compat.h>
 #include <linux/rculist.h>
+#include <net/busy_poll.h>
 
 /*
  * LOCKING:
@@ -92,7 +93,12 @@
  */
 
 /* Epoll private bits inside the event mask */
-#define EP_PRIVATE_BITS (EPOLLWAKEUP | EPOLLONESHOT | EPOLLET)
+#define EP_PRIVATE_BITS (EPOLLWAKEUP | EPOLLONESHOT | EPOLLET | EPOLLEXCLUSIVE)
+
+#define EPOLLINOUT_BITS (POLLIN | POLLOUT)
+
+#define EPOLLEXCLUSIVE_OK_BITS (EPOLLINOUT_BITS | POLLERR | POLLHUP | \
+				EPOLLWAKEUP | EPOLLET | EPOLLEXCLUSIVE)
 
 /* Maximum number of nesting allowed inside epoll sets */
 #define EP_MAX_NESTS 4
@@ -219,6 +225,13 @@ struct eventpoll {
 	/* used to optimize loop detection check */
 	int visited;
 	struct list_head visited_list_link;
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	/* napi context of the last socket found ready, to busy poll */
+	unsigned int napi_id;
+	/* and the SO_BUSY_POLL time of that socket */
+	unsigned int busy_poll_usecs;
+#endif
 };
 
 /* Wait structure used by the poll hooks */
@@ -379,6 +392,75 @@ static inline int ep_events_available(struct eventpoll *ep)
 	return !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
 }
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+struct ep_busy_loop_arg {
+	struct eventpoll *ep;
+	unsigned long end_time;
+};
+
+static bool ep_busy_loop_end(void *p)
+{
+	struct ep_busy_loop_arg *arg = p;
+
+	return ep_events_available(arg->ep) ||
+	       busy_loop_timeout(arg->end_time) || signal_pending(current);
+}
+
+/*
+ * Busy polls the napi context of the sockets of the set, before ep_poll()
+ * goes to sleep: for net.core.busy_poll microseconds, as poll() and
+ * select() do, or else for the SO_BUSY_POLL time of the sockets.
+ */
+static void ep_busy_loop(struct eventpoll *ep, int nonblock)
+{
+	unsigned int napi_id = ACCESS_ONCE(ep->napi_id);
+	unsigned long usecs = ACCESS_ONCE(sysctl_net_busy_poll);
+	struct ep_busy_loop_arg arg;
+
+	if (!usecs)
+		usecs = ACCESS_ONCE(ep->busy_poll_usecs);
+	if (!napi_id || !usecs)
+		return;
+
+	arg.ep = ep;
+	arg.end_time = busy_loop_us_clock() + usecs;
+	napi_busy_loop(napi_id, arg.end_time,
+		       nonblock ? NULL : ep_busy_loop_end, &arg);
+}
+
+/*
+ * Records the napi context of a socket of the set, when it is added and
+ * whenever it is found ready: it is the one with traffic to busy poll.
+ * Called with ep->mtx held.
+ */
+static void ep_set_busy_poll_napi_id(struct epitem *epi)
+{
+	struct eventpoll *ep = epi->ep;
+	struct socket *sock;
+	struct sock *sk;
+	int err;
+
+	sock = sock_from_file(epi->ffd.file, &err);
+	if (!sock)
+		return;
+
+	sk = sock->sk;
+	if (!sk || !sk->sk_napi_id)
+		return;
+
+	ep->napi_id = ACCESS_ONCE(sk->sk_napi_id);
+	ep->busy_poll_usecs = ACCESS_ONCE(sk->sk_ll_usec);
+}
+#else
+static inline void ep_busy_loop(struct eventpoll *ep, int nonblock)
+{
+}
+
+static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
+{
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 /**
  * ep_call_nested - Perform a bound (possibly) nested call, by checking
  *                  that the recursion limit is not exceeded, and that
@@ -1002,6 +1084,7 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
 	int pwake = 0;
+	int ewake = 0;
 	unsigned long flags;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
@@ -1069,8 +1152,30 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
 	 * wait list.
 	 */
-	if (waitqueue_active(&ep->wq))
+	if (waitqueue_active(&ep->wq)) {
+		/*
+		 * An exclusive wait only counts as a wakeup, for the waitqueue
+		 * of the file to stop there, if the event is one we wait for:
+		 * a POLLIN and POLLOUT together may be meant for others.
+		 */
+		if ((epi->event.events & EPOLLEXCLUSIVE) &&
+		    !((unsigned long)key & POLLFREE)) {
+			switch ((unsigned long)key & EPOLLINOUT_BITS) {
+			case POLLIN:
+				if (epi->event.events & POLLIN)
+					ewake = 1;
+				break;
+			case POLLOUT:
+				if (epi->event.events & POLLOUT)
+					ewake = 1;
+				break;
+			case 0:
+				ewake = 1;
+				break;
+			}
+		}
 		wake_up_locked(&ep->wq);
+	}
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
@@ -1081,7 +1186,10 @@ out_unlock:
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
-	return 1;
+	if (!(epi->event.events & EPOLLEXCLUSIVE))
+		ewake = 1;
+
+	return ewake;
 }
 
 /*
@@ -1098,7 +1206,10 @@ static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
 		init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
 		pwq->whead = whead;
 		pwq->base = epi;
-		add_wait_queue(whead, &pwq->wait);
+		if (epi->event.events & EPOLLEXCLUSIVE)
+			add_wait_queue_exclusive(whead, &pwq->wait);
+		else
+			add_wait_queue(whead, &pwq->wait);
 		list_add_tail(&pwq->llink, &epi->pwqlist);
 		epi->nwait++;
 	} else {
@@ -1334,6 +1445,8 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	if (full_check && reverse_path_check())
 		goto error_remove_epi;
 
+	ep_set_busy_poll_napi_id(epi);
+
 	/* We have to drop the new item inside our item list to keep track of it */
 	spin_lock_irqsave(&ep->lock, flags);
 
@@ -1515,6 +1628,7 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 		 * can change the item.
 		 */
 		if (revents) {
+			ep_set_busy_poll_napi_id(epi);
 			if (__put_user(revents, &uevent->events) ||
 			    __put_user(epi->event.data, &uevent->data)) {
 				list_add(&epi->rdllink, head);
@@ -1606,11 +1720,17 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		 * caller specified a non blocking operation.
 		 */
 		timed_out = 1;
+		if (!ep_events_available(ep))
+			ep_busy_loop(ep, timed_out);
 		spin_lock_irqsave(&ep->lock, flags);
 		goto check_events;
 	}
 
 fetch_events:
+	/* Rather than sleeping for the interrupt, poll the device for it */
+	if (!ep_events_available(ep))
+		ep_busy_loop(ep, timed_out);
+
 	spin_lock_irqsave(&ep->lock, flags);
 
 	if (!ep_events_available(ep)) {
@@ -1816,111 +1936,77 @@ SYSCALL_DEFINE1(epoll_create, int, size)
 }
 
 /*
- * The following function implements the controller interface for
- * the eventpoll file that enables the insertion/removal/change of
- * file descriptors inside the interest set.
+ * Checks an operation on the target file @tfile, in the eventpoll file
+ * @file, before any lock is taken for it.
  */
-SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
-		struct epoll_event __user *, event)
+static int ep_ctl_check(struct file *file, int op, struct file *tfile,
+			struct epoll_event *epds)
 {
-	int error;
-	int full_check = 0;
-	struct fd f, tf;
-	struct eventpoll *ep;
-	struct epitem *epi;
-	struct epoll_event epds;
-	struct eventpoll *tep = NULL;
-
-	error = -EFAULT;
-	if (ep_op_has_event(op) &&
-	    copy_from_user(&epds, event, sizeof(struct epoll_event)))
-		goto error_return;
-
-	error = -EBADF;
-	f = fdget(epfd);
-	if (!f.file)
-		goto error_return;
-
-	/* Get the "struct file *" for the target file */
-	tf = fdget(fd);
-	if (!tf.file)
-		goto error_fput;
-
 	/* The target file descriptor must support poll */
-	error = -EPERM;
-	if (!tf.file->f_op->poll)
-		goto error_tgt_fput;
+	if (!tfile->f_op->poll)
+		return -EPERM;
 
 	/* Check if EPOLLWAKEUP is allowed */
-	ep_take_care_of_epollwakeup(&epds);
+	if (ep_op_has_event(op))
+		ep_take_care_of_epollwakeup(epds);
 
 	/*
 	 * We have to check that the file structure underneath the file descriptor
 	 * the user passed to us _is_ an eventpoll file. And also we do not permit
 	 * adding an epoll file descriptor inside itself.
 	 */
-	error = -EINVAL;
-	if (f.file == tf.file || !is_file_epoll(f.file))
-		goto error_tgt_fput;
+	if (file == tfile || !is_file_epoll(file))
+		return -EINVAL;
 
 	/*
-	 * At this point it is safe to assume that the "private_data" contains
-	 * our own data structure.
+	 * epoll adds to the wakeup queue at EPOLL_CTL_ADD time only, so
+	 * EPOLLEXCLUSIVE is not allowed for an EPOLL_CTL_MOD operation.
+	 * Nor are nested exclusive wakeups supported.
 	 */
-	ep = f.file->private_data;
-
-	/*
-	 * When we insert an epoll file descriptor, inside another epoll file
-	 * descriptor, there is the change of creating closed loops, which are
-	 * better be handled here, than in more critical paths. While we are
-	 * checking for loops we also determine the list of files reachable
-	 * and hang them on the tfile_check_list, so we can check that we
-	 * haven't created too many possible wakeup paths.
-	 *
-	 * We do not need to take the global 'epumutex' on EPOLL_CTL_ADD when
-	 * the epoll file descriptor is attaching directly to a wakeup source,
-	 * unless the epoll file descriptor is nested. The purpose of taking the
-	 * 'epmutex' on add is to prevent complex toplogies such as loops and
-	 * deep wakeup paths from forming in parallel through multiple
-	 * EPOLL_CTL_ADD operations.
-	 */
-	mutex_lock_nested(&ep->mtx, 0);
-	if (op == EPOLL_CTL_ADD) {
-		if (!list_empty(&f.file->f_ep_links) ||
-						is_file_epoll(tf.file)) {
-			full_check = 1;
-			mutex_unlock(&ep->mtx);
-			mutex_lock(&epmutex);
-			if (is_file_epoll(tf.file)) {
-				error = -ELOOP;
-				if (ep_loop_check(ep, tf.file) != 0) {
-					clear_tfile_check_list();
-					goto error_tgt_fput;
-				}
-			} else
-				list_add(&tf.file->f_tfile_llink,
-							&tfile_check_list);
-			mutex_lock_nested(&ep->mtx, 0);
-			if (is_file_epoll(tf.file)) {
-				tep = tf.file->private_data;
-				mutex_lock_nested(&tep->mtx, 1);
-			}
-		}
+	if (ep_op_has_event(op) && (epds->events & EPOLLEXCLUSIVE)) {
+		if (op == EPOLL_CTL_MOD)
+			return -EINVAL;
+		if (op == EPOLL_CTL_ADD && (is_file_epoll(tfile) ||
+				(epds->events & ~EPOLLEXCLUSIVE_OK_BITS)))
+			return -EINVAL;
 	}
+	return 0;
+}
+
+/*
+ * Whether adding @tfile to the eventpoll file @file must check for loops
+ * and wakeup paths under epmutex: only when epoll files are nested.
+ */
+static inline int ep_ctl_needs_full_check(struct file *file, int op,
+					  struct file *tfile)
+{
+	return op == EPOLL_CTL_ADD &&
+	       (!list_empty(&file->f_ep_links) || is_file_epoll(tfile));
+}
+
+/*
+ * Does an operation checked by ep_ctl_check(), with ep->mtx held, and
+ * epmutex too for a @full_check.
+ */
+static int ep_ctl_locked(struct eventpoll *ep, int op, struct file *tfile,
+			 int fd, struct epoll_event *epds, int full_check)
+{
+	struct epitem *epi;
+	int error;
 
 	/*
 	 * Try to lookup the file inside our RB tree, Since we grabbed "mtx"
 	 * above, we can be sure to be able to use the item looked up by
 	 * ep_find() till we release the mutex.
 	 */
-	epi = ep_find(ep, tf.file, fd);
+	epi = ep_find(ep, tfile, fd);
 
 	error = -EINVAL;
 	switch (op) {
 	case EPOLL_CTL_ADD:
 		if (!epi) {
-			epds.events |= POLLERR | POLLHUP;
-			error = ep_insert(ep, &epds, tf.file, fd, full_check);
+			epds->events |= POLLERR | POLLHUP;
+			error = ep_insert(ep, epds, tfile, fd, full_check);
 		} else
 			error = -EEXIST;
 		if (full_check)
@@ -1934,19 +2020,111 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 		break;
 	case EPOLL_CTL_MOD:
 		if (epi) {
-			epds.events |= POLLERR | POLLHUP;
-			error = ep_modify(ep, epi, &epds);
+			/* nor can the events of an exclusive wait change */
+			if (!(epi->event.events & EPOLLEXCLUSIVE)) {
+				epds->events |= POLLERR | POLLHUP;
+				error = ep_modify(ep, epi, epds);
+			}
 		} else
 			error = -ENOENT;
 		break;
 	}
+	return error;
+}
+
+/*
+ * Does an operation checked by ep_ctl_check(), taking the locks it needs.
+ */
+static int ep_ctl(struct file *file, int op, struct file *tfile, int fd,
+		  struct epoll_event *epds)
+{
+	int error, full_check = 0;
+	struct eventpoll *ep;
+	struct eventpoll *tep = NULL;
+
+	/*
+	 * At this point it is safe to assume that the "private_data" contains
+	 * our own data structure.
+	 */
+	ep = file->private_data;
+
+	/*
+	 * When we insert an epoll file descriptor, inside another epoll file
+	 * descriptor, there is the change of creating closed loops, which are
+	 * better be handled here, than in more critical paths. While we are
+	 * checking for loops we also determine the list of files reachable
+	 * and hang them on the tfile_check_list, so we can check that we
+	 * haven't created too many possible wakeup paths.
+	 *
+	 * We do not need to take the global 'epumutex' on EPOLL_CTL_ADD when
+	 * the epoll file descriptor is attaching directly to a wakeup source,
+	 * unless the epoll file descriptor is nested. The purpose of taking the
+	 * 'epmutex' on add is to prevent complex toplogies such as loops and
+	 * deep wakeup paths from forming in parallel through multiple
+	 * EPOLL_CTL_ADD operations.
+	 */
+	mutex_lock_nested(&ep->mtx, 0);
+	if (ep_ctl_needs_full_check(file, op, tfile)) {
+		full_check = 1;
+		mutex_unlock(&ep->mtx);
+		mutex_lock(&epmutex);
+		if (is_file_epoll(tfile)) {
+			error = -ELOOP;
+			if (ep_loop_check(ep, tfile) != 0) {
+				clear_tfile_check_list();
+				goto out_unlock_epmutex;
+			}
+		} else
+			list_add(&tfile->f_tfile_llink, &tfile_check_list);
+		mutex_lock_nested(&ep->mtx, 0);
+		if (is_file_epoll(tfile)) {
+			tep = tfile->private_data;
+			mutex_lock_nested(&tep->mtx, 1);
+		}
+	}
+
+	error = ep_ctl_locked(ep, op, tfile, fd, epds, full_check);
+
 	if (tep != NULL)
 		mutex_unlock(&tep->mtx);
 	mutex_unlock(&ep->mtx);
 
-error_tgt_fput:
+out_unlock_epmutex:
 	if (full_check)
 		mutex_unlock(&epmutex);
+	return error;
+}
+
+/*
+ * The following function implements the controller interface for
+ * the eventpoll file that enables the insertion/removal/change of
+ * file descriptors inside the interest set.
+ */
+SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
+		struct epoll_event __user *, event)
+{
+	int error;
+	struct fd f, tf;
+	struct epoll_event epds;
+
+	error = -EFAULT;
+	if (ep_op_has_event(op) &&
+	    copy_from_user(&epds, event, sizeof(struct epoll_event)))
+		goto error_return;
+
+	error = -EBADF;
+	f = fdget(epfd);
+	if (!f.file)
+		goto error_return;
+
+	/* Get the "struct file *" for the target file */
+	tf = fdget(fd);
+	if (!tf.file)
+		goto error_fput;
+
+	error = ep_ctl_check(f.file, op, tf.file, &epds);
+	if (!error)
+		error = ep_ctl(f.file, op, tf.file, fd, &epds);
 
 	fdput(tf);
 error_fput:
@@ -1956,6 +2134,76 @@ error_return:
 	return error;
 }
 
+/*
+ * The batch variant of epoll_ctl(): does the @ncmds operations of @cmds
+ * in turn, under a single hold of ep->mtx, and stores the result of each
+ * in its result field.  Only the additions which nest epoll files drop
+ * ep->mtx, for the loop and wakeup path checks under epmutex.  Returns the
+ * number of operations done, whether they succeeded or not.
+ */
+SYSCALL_DEFINE4(epoll_ctl_batch, int, epfd, int, flags, int, ncmds,
+		struct epoll_ctl_cmd __user *, cmds)
+{
+	struct epoll_ctl_cmd cmd;
+	struct epoll_event epds;
+	struct eventpoll *ep;
+	struct fd f, tf;
+	int i, error;
+
+	if (flags || ncmds <= 0)
+		return -EINVAL;
+
+	f = fdget(epfd);
+	if (!f.file)
+		return -EBADF;
+
+	error = -EINVAL;
+	if (!is_file_epoll(f.file))
+		goto out_fput;
+	ep = f.file->private_data;
+
+	mutex_lock_nested(&ep->mtx, 0);
+	for (i = 0; i < ncmds; i++) {
+		if (copy_from_user(&cmd, &cmds[i], sizeof(cmd)))
+			break;
+
+		epds.events = cmd.events;
+		epds.data = cmd.data;
+		error = -EINVAL;
+		if (cmd.flags)
+			goto set_result;
+
+		error = -EBADF;
+		tf = fdget(cmd.fd);
+		if (!tf.file)
+			goto set_result;
+
+		error = ep_ctl_check(f.file, cmd.op, tf.file, &epds);
+		if (!error) {
+			if (ep_ctl_needs_full_check(f.file, cmd.op, tf.file)) {
+				/* epmutex nests outside ep->mtx */
+				mutex_unlock(&ep->mtx);
+				error = ep_ctl(f.file, cmd.op, tf.file, cmd.fd,
+					       &epds);
+				mutex_lock_nested(&ep->mtx, 0);
+			} else
+				error = ep_ctl_locked(ep, cmd.op, tf.file,
+						      cmd.fd, &epds, 0);
+		}
+		fdput(tf);
+set_result:
+		if (put_user(error, &cmds[i].result))
+			break;
+		cond_resched();
+	}
+	mutex_unlock(&ep->mtx);
+
+	error = i ? i : -EFAULT;
+out_fput:
+	fdput(f);
+	return error;
+}
+
 /*
  * Implement the event wait interface for the eventpoll file. It is the kernel
  * part of the user space epoll_wait(2).
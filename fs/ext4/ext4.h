@@ -201,6 +201,7 @@ typedef struct ext4_io_end {
 } ext4_io_end_t;
 
 struct ext4_io_submit {
+	struct writeback_control *io_wbc;
 	int			io_op;
 	struct bio		*io_bio;
 	ext4_io_end_t		*io_end;
@@ -811,6 +812,7 @@ do {									       \
 #endif /* defined(__KERNEL__) || defined(__linux__) */
 
 #include "extents_status.h"
+#include "fast_commit.h"
 
 /*
  * fourth extended file system inode data in memory
@@ -843,6 +845,13 @@ struct ext4_inode_info {
 	 */
 	struct rw_semaphore xattr_sem;
 
+	/*
+	 * ext4_lookup() runs without the directory's i_mutex, so the
+	 * directory's entries are only changed under i_dir_sem held for
+	 * write, and are looked up under it held for read.
+	 */
+	struct rw_semaphore i_dir_sem;
+
 	struct list_head i_orphan;	/* unlinked but open inodes */
 
 	/*
@@ -889,9 +898,9 @@ struct ext4_inode_info {
 	/* extents status tree */
 	struct ext4_es_tree i_es_tree;
 	rwlock_t i_es_lock;
+	seqcount_t i_es_seq;		/* lockless i_es_tree lookups */
 	struct list_head i_es_lru;
 	unsigned int i_es_lru_nr;	/* protected by i_es_lock */
-	unsigned long i_touch_when;	/* jiffies of last accessing */
 
 	/* ialloc */
 	ext4_group_t	i_last_alloc_group;
@@ -942,6 +951,16 @@ struct ext4_inode_info {
 
 	/* Precomputed uuid+inum+igen checksum for seeding inode checksums */
 	__u32 i_csum_seed;
+
+	/*
+	 * Fast commit state [s_fc_lock]: the link in s_fc_q, the range of
+	 * logical blocks whose mapping changed since the last full commit,
+	 * and the transaction that last changed the inode.
+	 */
+	struct list_head i_fc_list;
+	ext4_lblk_t i_fc_lblk_start;
+	ext4_lblk_t i_fc_lblk_len;
+	tid_t i_fc_tid;
 };
 
 /*
@@ -950,6 +969,7 @@ struct ext4_inode_info {
 #define	EXT4_VALID_FS			0x0001	/* Unmounted cleanly */
 #define	EXT4_ERROR_FS			0x0002	/* Errors detected */
 #define	EXT4_ORPHAN_FS			0x0004	/* Orphans being recovered */
+#define	EXT4_FC_REPLAY			0x0020	/* Fast commit replay ongoing */
 
 /*
  * Misc. filesystem flags
@@ -969,6 +989,7 @@ struct ext4_inode_info {
 #define EXT4_MOUNT_ERRORS_MASK		0x00070
 #define EXT4_MOUNT_MINIX_DF		0x00080	/* Mimics the Minix statfs */
 #define EXT4_MOUNT_NOLOAD		0x00100	/* Don't use existing journal*/
+#define EXT4_MOUNT_DAX			0x00200	/* Direct Access */
 #define EXT4_MOUNT_DATA_FLAGS		0x00C00	/* Mode for data writes: */
 #define EXT4_MOUNT_JOURNAL_DATA		0x00400	/* Write data to journal */
 #define EXT4_MOUNT_ORDERED_DATA		0x00800	/* Flush data before commit */
@@ -985,6 +1006,7 @@ struct ext4_inode_info {
 #define EXT4_MOUNT_DIOREAD_NOLOCK	0x400000 /* Enable support for dio read nolocking */
 #define EXT4_MOUNT_JOURNAL_CHECKSUM	0x800000 /* Journal checksums */
 #define EXT4_MOUNT_JOURNAL_ASYNC_COMMIT	0x1000000 /* Journal Async Commit */
+#define EXT4_MOUNT_JOURNAL_FAST_COMMIT	0x2000000 /* Fast commits for fsync */
 #define EXT4_MOUNT_DELALLOC		0x8000000 /* Delalloc support */
 #define EXT4_MOUNT_DATA_ERR_ABORT	0x10000000 /* Abort on file data write */
 #define EXT4_MOUNT_BLOCK_VALIDITY	0x20000000 /* Block validity checking */
@@ -1259,6 +1281,12 @@ struct ext4_sb_info {
 	unsigned short *s_mb_offsets;
 	unsigned int *s_mb_maxs;
 	unsigned int s_group_info_size;
+	/* initialized groups by order of largest free extent, and of
+	 * average fragment size; each list protected by its own lock */
+	struct list_head *s_mb_largest_free_orders;
+	rwlock_t *s_mb_largest_free_orders_locks;
+	struct list_head *s_mb_avg_fragment_size;
+	rwlock_t *s_mb_avg_fragment_size_locks;
 
 	/* tunables */
 	unsigned long s_stripe;
@@ -1268,6 +1296,7 @@ struct ext4_sb_info {
 	unsigned int s_mb_stats;
 	unsigned int s_mb_order2_reqs;
 	unsigned int s_mb_group_prealloc;
+	unsigned int s_mb_optimize_scan;
 	unsigned int s_max_dir_size_kb;
 	/* where last allocation was done - for stream allocation */
 	unsigned long s_mb_last_group;
@@ -1329,7 +1358,7 @@ struct ext4_sb_info {
 	/* Reclaim extents from extent status tree */
 	struct shrinker s_es_shrinker;
 	struct list_head s_es_lru;
-	unsigned long s_es_last_sorted;
+	unsigned int s_es_nr_inode;	/* protected by s_es_lru_lock */
 	struct percpu_counter s_extent_cache_cnt;
 	struct mb_cache *s_mb_cache;
 	spinlock_t s_es_lru_lock ____cacheline_aligned_in_smp;
@@ -1338,6 +1367,18 @@ struct ext4_sb_info {
 	struct ratelimit_state s_err_ratelimit_state;
 	struct ratelimit_state s_warning_ratelimit_state;
 	struct ratelimit_state s_msg_ratelimit_state;
+
+	/*
+	 * Fast commits: the inodes and the directory entry changes to
+	 * record, and whether they must fall back to a full commit until
+	 * s_fc_ineligible_tid has committed [s_fc_lock].
+	 */
+	spinlock_t s_fc_lock;
+	struct list_head s_fc_q;
+	struct list_head s_fc_dentry_q;
+	bool s_fc_ineligible;
+	tid_t s_fc_ineligible_tid;
+	struct ext4_fc_replay_state s_fc_replay_state;
 };
 
 static inline struct ext4_sb_info *EXT4_SB(struct super_block *sb)
@@ -1561,7 +1602,8 @@ static inline void ext4_clear_state_flags(struct ext4_inode_info *ei)
 					 EXT4_FEATURE_INCOMPAT_64BIT| \
 					 EXT4_FEATURE_INCOMPAT_FLEX_BG| \
 					 EXT4_FEATURE_INCOMPAT_MMP |	\
-					 EXT4_FEATURE_INCOMPAT_INLINE_DATA)
+					 EXT4_FEATURE_INCOMPAT_INLINE_DATA | \
+					 EXT4_FEATURE_INCOMPAT_LARGEDIR)
 #define EXT4_FEATURE_RO_COMPAT_SUPP	(EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER| \
 					 EXT4_FEATURE_RO_COMPAT_LARGE_FILE| \
 					 EXT4_FEATURE_RO_COMPAT_GDT_CSUM| \
@@ -1738,6 +1780,19 @@ static inline __le16 ext4_rec_len_to_disk(unsigned len, unsigned blocksize)
 #define DX_HASH_HALF_MD4_UNSIGNED	4
 #define DX_HASH_TEA_UNSIGNED		5
 
+/*
+ * Depth of the htree, counting the root: three levels with the largedir
+ * feature, two without.
+ */
+#define EXT4_HTREE_LEVEL_COMPAT	2
+#define EXT4_HTREE_LEVEL	3
+
+static inline int ext4_dir_htree_level(struct super_block *sb)
+{
+	return EXT4_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_LARGEDIR) ?
+		EXT4_HTREE_LEVEL : EXT4_HTREE_LEVEL_COMPAT;
+}
+
 static inline u32 ext4_chksum(struct ext4_sb_info *sbi, u32 crc,
 			      const void *address, unsigned int length)
 {
@@ -2038,6 +2093,26 @@ static inline  unsigned char get_dtype(struct super_block *sb, int filetype)
 	return ext4_filetype_table[filetype];
 }
 
+/* fast_commit.c */
+extern int ext4_fc_enabled(struct super_block *sb);
+extern void ext4_fc_init_sb(struct super_block *sb);
+extern void ext4_fc_init_inode(struct inode *inode);
+extern void ext4_fc_del(struct inode *inode);
+extern void ext4_fc_mark_ineligible(struct super_block *sb, handle_t *handle);
+extern void ext4_fc_track_inode(handle_t *handle, struct inode *inode);
+extern void ext4_fc_track_range(handle_t *handle, struct inode *inode,
+				ext4_lblk_t lblk, ext4_lblk_t len);
+extern void ext4_fc_track_create(handle_t *handle, struct dentry *dentry);
+extern void ext4_fc_track_link(handle_t *handle, struct dentry *dentry);
+extern void ext4_fc_track_unlink(handle_t *handle, struct dentry *dentry);
+extern int ext4_fc_commit(journal_t *journal, tid_t commit_tid);
+extern void ext4_fc_cleanup(journal_t *journal, tid_t tid);
+extern int ext4_fc_replay(journal_t *journal, struct buffer_head *bh,
+			  enum passtype pass, int off, tid_t expected_tid);
+extern void ext4_fc_replay_cleanup(struct super_block *sb);
+extern int ext4_fc_replay_check_excluded(struct super_block *sb,
+					 ext4_fsblk_t block);
+
 /* fsync.c */
 extern int ext4_sync_file(struct file *, loff_t, loff_t, int);
 
@@ -2069,6 +2144,8 @@ extern void ext4_mark_bitmap_end(int start_bit, int end_bit, char *bitmap);
 extern int ext4_init_inode_table(struct super_block *sb,
 				 ext4_group_t group, int barrier);
 extern void ext4_end_bitmap_read(struct buffer_head *bh, int uptodate);
+extern int ext4_mark_inode_used(struct super_block *sb, unsigned long ino,
+				umode_t mode);
 
 /* mballoc.c */
 extern long ext4_mb_stats;
@@ -2091,6 +2168,8 @@ extern int ext4_mb_add_groupinfo(struct super_block *sb,
 extern int ext4_group_add_blocks(handle_t *handle, struct super_block *sb,
 				ext4_fsblk_t block, unsigned long count);
 extern int ext4_trim_fs(struct super_block *, struct fstrim_range *);
+extern int ext4_mb_mark_bb(struct super_block *sb, ext4_fsblk_t block,
+			   int len, int state);
 
 /* inode.c */
 struct buffer_head *ext4_getblk(handle_t *, struct inode *,
@@ -2133,6 +2212,8 @@ extern int ext4_punch_hole(struct inode *inode, loff_t offset, loff_t length);
 extern int ext4_truncate_restart_trans(handle_t *, struct inode *, int nblocks);
 extern void ext4_set_inode_flags(struct inode *);
 extern void ext4_get_inode_flags(struct ext4_inode_info *);
+extern void ext4_raw_inode_csum_set(struct super_block *sb, unsigned long ino,
+				    struct ext4_inode *raw);
 extern int ext4_alloc_da_blocks(struct inode *inode);
 extern void ext4_set_aops(struct inode *inode);
 extern int ext4_writepage_trans_blocks(struct inode *);
@@ -2187,6 +2268,11 @@ extern int ext4_generic_delete_entry(handle_t *handle,
 				     void *entry_buf,
 				     int buf_size,
 				     int csum_size);
+extern int ext4_fc_replay_link_entry(struct inode *dir, struct inode *inode,
+				     const struct qstr *name);
+extern int ext4_fc_replay_unlink_entry(struct inode *dir,
+				       const struct qstr *name,
+				       unsigned long ino);
 
 /* resize.c */
 extern int ext4_group_add(struct super_block *sb,
@@ -2387,9 +2473,15 @@ static inline void ext4_r_blocks_count_set(struct ext4_super_block *es,
 	es->s_r_blocks_count_hi = cpu_to_le32(blk >> 32);
 }
 
-static inline loff_t ext4_isize(struct ext4_inode *raw_inode)
+/*
+ * i_size_high of a directory was i_dir_acl, so is only trusted when the
+ * largedir feature says directories may grow past 4GB.
+ */
+static inline loff_t ext4_isize(struct super_block *sb,
+				struct ext4_inode *raw_inode)
 {
-	if (S_ISREG(le16_to_cpu(raw_inode->i_mode)))
+	if (S_ISREG(le16_to_cpu(raw_inode->i_mode)) ||
+	    EXT4_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_LARGEDIR))
 		return ((loff_t)le32_to_cpu(raw_inode->i_size_high) << 32) |
 			le32_to_cpu(raw_inode->i_size_lo);
 	else
@@ -2415,6 +2507,18 @@ struct ext4_group_info *ext4_get_group_info(struct super_block *sb,
 	 return grp_info[indexv][indexh];
 }
 
+/*
+ * Bitmaps can be read before mballoc sets up the group info, by the fast
+ * commit replay: there is no group info to flag them corrupt in then.
+ */
+static inline struct ext4_group_info *ext4_bitmap_group_info(
+				struct super_block *sb, ext4_group_t group)
+{
+	if (!EXT4_SB(sb)->s_group_info)
+		return NULL;
+	return ext4_get_group_info(sb, group);
+}
+
 /*
  * Reading s_groups_count requires using smp_rmb() afterwards.  See
  * the locking protocol documented in the comments of ext4_group_add()
@@ -2473,7 +2577,12 @@ struct ext4_group_info {
 	ext4_grpblk_t	bb_free;	/* total free blocks */
 	ext4_grpblk_t	bb_fragments;	/* nr of freespace fragments */
 	ext4_grpblk_t	bb_largest_free_order;/* order of largest frag in BG */
+	ext4_grpblk_t	bb_avg_fragment_size_order;	/* order of average
+							   fragment in BG */
+	ext4_group_t	bb_group;	/* group number */
 	struct          list_head bb_prealloc_list;
+	struct		list_head bb_largest_free_order_node;
+	struct		list_head bb_avg_fragment_size_node;
 #ifdef DOUBLE_CHECK
 	void            *bb_bitmap;
 #endif
@@ -2745,6 +2854,12 @@ extern int ext4_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo,
 			__u64 start, __u64 len);
 extern int ext4_ext_precache(struct inode *inode);
 extern int ext4_collapse_range(struct inode *inode, loff_t offset, loff_t len);
+extern int ext4_ext_next_mapped_block(struct inode *inode, ext4_lblk_t lblk,
+				      ext4_lblk_t *next);
+extern int ext4_ext_replay_add_range(struct inode *inode,
+				     struct ext4_extent *ex);
+extern int ext4_ext_replay_del_range(struct inode *inode, ext4_lblk_t lblk,
+				     ext4_lblk_t len);
 
 /* move_extent.c */
 extern void ext4_double_down_write_data_sem(struct inode *first,
@@ -78,7 +78,8 @@
 
 #define EXT4_RESERVE_TRANS_BLOCKS	12U
 
-#define EXT4_INDEX_EXTRA_TRANS_BLOCKS	8
+/* Splitting a leaf of a three level htree may split every index node too */
+#define EXT4_INDEX_EXTRA_TRANS_BLOCKS	12
 
 #ifdef CONFIG_QUOTA
 /* Amount of blocks needed for quota update - we know that the structure was
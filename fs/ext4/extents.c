@@ -4839,6 +4839,7 @@ static long ext4_zero_range(struct file *file, loff_t offset,
 		ext4_std_error(inode->i_sb, ret);
 		goto out_dio;
 	}
+	ext4_fc_mark_ineligible(inode->i_sb, handle);
 
 	inode->i_mtime = inode->i_ctime = ext4_current_time(inode);
 
@@ -5470,6 +5471,7 @@ int ext4_collapse_range(struct inode *inode, loff_t offset, loff_t len)
 		ret = PTR_ERR(handle);
 		goto out_dio;
 	}
+	ext4_fc_mark_ineligible(sb, handle);
 
 	down_write(&EXT4_I(inode)->i_data_sem);
 	ext4_discard_preallocations(inode);
@@ -5513,3 +5515,109 @@ out_mutex:
 	mutex_unlock(&inode->i_mutex);
 	return ret;
 }
+
+/*
+ * ext4_ext_next_mapped_block:
+ * sets *next to the first block at or after lblk which the extent tree
+ * maps, or to EXT_MAX_BLOCKS if there is none. Like
+ * ext4_ext_next_allocated_block(), it may stop at the first block of an
+ * index entry, which isn't mapped itself.
+ */
+int ext4_ext_next_mapped_block(struct inode *inode, ext4_lblk_t lblk,
+			       ext4_lblk_t *next)
+{
+	struct ext4_ext_path *path;
+	struct ext4_extent *ex;
+	ext4_lblk_t ee_block;
+
+	down_read(&EXT4_I(inode)->i_data_sem);
+	path = ext4_ext_find_extent(inode, lblk, NULL, 0);
+	if (IS_ERR(path)) {
+		up_read(&EXT4_I(inode)->i_data_sem);
+		return PTR_ERR(path);
+	}
+
+	ex = path[path->p_depth].p_ext;
+	if (ex) {
+		ee_block = le32_to_cpu(ex->ee_block);
+		if (lblk < ee_block)
+			*next = ee_block;
+		else if (lblk < ee_block + ext4_ext_get_actual_len(ex))
+			*next = lblk;
+		else
+			*next = ext4_ext_next_allocated_block(path);
+	} else
+		*next = ext4_ext_next_allocated_block(path);
+
+	ext4_ext_drop_refs(path);
+	kfree(path);
+	up_read(&EXT4_I(inode)->i_data_sem);
+	return 0;
+}
+
+/*
+ * ext4_ext_replay_add_range:
+ * for the fast commit replay, maps the blocks of ex, which no extent in
+ * the tree overlaps, and marks them in use.
+ */
+int ext4_ext_replay_add_range(struct inode *inode, struct ext4_extent *ex)
+{
+	unsigned int len = ext4_ext_get_actual_len(ex);
+	struct ext4_ext_path *path;
+	handle_t *handle;
+	int ret;
+
+	ret = ext4_mb_mark_bb(inode->i_sb, ext4_ext_pblock(ex), len, 1);
+	if (ret)
+		return ret;
+
+	handle = ext4_journal_start(inode, EXT4_HT_MAP_BLOCKS,
+				    ext4_writepage_trans_blocks(inode));
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	down_write(&EXT4_I(inode)->i_data_sem);
+	path = ext4_ext_find_extent(inode, le32_to_cpu(ex->ee_block), NULL, 0);
+	if (IS_ERR(path)) {
+		ret = PTR_ERR(path);
+	} else {
+		ret = ext4_ext_insert_extent(handle, inode, path, ex, 0);
+		ext4_ext_drop_refs(path);
+		kfree(path);
+	}
+	up_write(&EXT4_I(inode)->i_data_sem);
+
+	if (!ret) {
+		dquot_alloc_block_nofail(inode, len);
+		ret = ext4_mark_inode_dirty(handle, inode);
+	}
+	ext4_journal_stop(handle);
+	return ret;
+}
+
+/*
+ * ext4_ext_replay_del_range:
+ * for the fast commit replay, unmaps len blocks from lblk on, and frees
+ * them.
+ */
+int ext4_ext_replay_del_range(struct inode *inode, ext4_lblk_t lblk,
+			      ext4_lblk_t len)
+{
+	handle_t *handle;
+	int ret;
+
+	down_write(&EXT4_I(inode)->i_data_sem);
+	ret = ext4_es_remove_extent(inode, lblk, len);
+	if (!ret)
+		ret = ext4_ext_remove_space(inode, lblk, lblk + len - 1);
+	up_write(&EXT4_I(inode)->i_data_sem);
+	if (ret)
+		return ret;
+
+	handle = ext4_journal_start(inode, EXT4_HT_TRUNCATE, 1);
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+	ret = ext4_mark_inode_dirty(handle, inode);
+	ext4_journal_stop(handle);
+	return ret;
+}
@@ -10,7 +10,6 @@
  * Ext4 extents status tree core functions.
  */
 #include <linux/rbtree.h>
-#include <linux/list_sort.h>
 #include "ext4.h"
 #include "extents_status.h"
 
@@ -154,7 +153,8 @@ int __init ext4_init_es(void)
 {
 	ext4_es_cachep = kmem_cache_create("ext4_extent_status",
 					   sizeof(struct extent_status),
-					   0, (SLAB_RECLAIM_ACCOUNT), NULL);
+					   0, (SLAB_RECLAIM_ACCOUNT |
+					       SLAB_DESTROY_BY_RCU), NULL);
 	if (ext4_es_cachep == NULL)
 		return -ENOMEM;
 	return 0;
@@ -664,6 +664,7 @@ int ext4_es_insert_extent(struct inode *inode, ext4_lblk_t lblk,
 	ext4_es_insert_extent_check(inode, &newes);
 
 	write_lock(&EXT4_I(inode)->i_es_lock);
+	write_seqcount_begin(&EXT4_I(inode)->i_es_seq);
 	err = __es_remove_extent(inode, lblk, end);
 	if (err != 0)
 		goto error;
@@ -676,6 +677,7 @@ retry:
 		err = 0;
 
 error:
+	write_seqcount_end(&EXT4_I(inode)->i_es_seq);
 	write_unlock(&EXT4_I(inode)->i_es_lock);
 
 	ext4_es_print_tree(inode);
@@ -709,67 +711,105 @@ void ext4_es_cache_extent(struct inode *inode, ext4_lblk_t lblk,
 	write_lock(&EXT4_I(inode)->i_es_lock);
 
 	es = __es_tree_search(&EXT4_I(inode)->i_es_tree.root, lblk);
-	if (!es || es->es_lblk > end)
+	if (!es || es->es_lblk > end) {
+		write_seqcount_begin(&EXT4_I(inode)->i_es_seq);
 		__es_insert_extent(inode, &newes);
+		write_seqcount_end(&EXT4_I(inode)->i_es_seq);
+	}
 	write_unlock(&EXT4_I(inode)->i_es_lock);
 }
 
+/*
+ * The longest path in a red-black tree is at most twice the shortest one,
+ * so no tree indexed by ext4_lblk_t can be deeper than this.
+ */
+#define EXT4_ES_MAX_DEPTH	(2 * 32)
+
+/*
+ * Find the extent covering @lblk and copy it into @es.
+ *
+ * This is called either under i_es_lock or under rcu_read_lock() with
+ * i_es_seq sampled.  In the latter case writers may be rotating and
+ * erasing nodes underneath us, so nothing here may BUG on what it reads
+ * and the walk is bounded by EXT4_ES_MAX_DEPTH.  Extents are freed to a
+ * SLAB_DESTROY_BY_RCU cache, so a node we reach is still an extent_status
+ * until the grace period ends, and anything read from it is only trusted
+ * once i_es_seq has been validated.
+ *
+ * Return: 1 on found, 0 on not, -EAGAIN if the walk ran away.
+ */
+static int __es_lookup_extent(struct ext4_es_tree *tree, ext4_lblk_t lblk,
+			      struct extent_status *es)
+{
+	struct extent_status *es1;
+	struct rb_node *node;
+	int depth = 0;
+
+	/* find extent in cache firstly */
+	es1 = ACCESS_ONCE(tree->cache_es);
+	if (es1 && in_range(lblk, es1->es_lblk, es1->es_len)) {
+		es_debug("%u cached by [%u/%u)\n",
+			 lblk, es1->es_lblk, es1->es_len);
+		goto found;
+	}
+
+	node = ACCESS_ONCE(tree->root.rb_node);
+	while (node) {
+		if (++depth > EXT4_ES_MAX_DEPTH)
+			return -EAGAIN;
+		es1 = rb_entry(node, struct extent_status, rb_node);
+		if (lblk < es1->es_lblk)
+			node = ACCESS_ONCE(node->rb_left);
+		else if (lblk - es1->es_lblk >= es1->es_len)
+			node = ACCESS_ONCE(node->rb_right);
+		else
+			goto found;
+	}
+	return 0;
+
+found:
+	es->es_lblk = es1->es_lblk;
+	es->es_len = es1->es_len;
+	es->es_pblk = es1->es_pblk;
+	return 1;
+}
+
 /*
  * ext4_es_lookup_extent() looks up an extent in extent status tree.
  *
  * ext4_es_lookup_extent is called by ext4_map_blocks/ext4_da_map_blocks.
+ * The tree is walked locklessly first; i_es_lock is only taken if a
+ * writer raced with us.
  *
  * Return: 1 on found, 0 on not
  */
 int ext4_es_lookup_extent(struct inode *inode, ext4_lblk_t lblk,
 			  struct extent_status *es)
 {
-	struct ext4_es_tree *tree;
-	struct extent_status *es1 = NULL;
-	struct rb_node *node;
-	int found = 0;
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	unsigned int seq;
+	int found;
 
 	trace_ext4_es_lookup_extent_enter(inode, lblk);
 	es_debug("lookup extent in block %u\n", lblk);
 
-	tree = &EXT4_I(inode)->i_es_tree;
-	read_lock(&EXT4_I(inode)->i_es_lock);
-
-	/* find extent in cache firstly */
 	es->es_lblk = es->es_len = es->es_pblk = 0;
-	if (tree->cache_es) {
-		es1 = tree->cache_es;
-		if (in_range(lblk, es1->es_lblk, es1->es_len)) {
-			es_debug("%u cached by [%u/%u)\n",
-				 lblk, es1->es_lblk, es1->es_len);
-			found = 1;
-			goto out;
-		}
-	}
-
-	node = tree->root.rb_node;
-	while (node) {
-		es1 = rb_entry(node, struct extent_status, rb_node);
-		if (lblk < es1->es_lblk)
-			node = node->rb_left;
-		else if (lblk > ext4_es_end(es1))
-			node = node->rb_right;
-		else {
-			found = 1;
-			break;
-		}
-	}
 
-out:
-	if (found) {
-		BUG_ON(!es1);
-		es->es_lblk = es1->es_lblk;
-		es->es_len = es1->es_len;
-		es->es_pblk = es1->es_pblk;
+	rcu_read_lock();
+	seq = raw_seqcount_begin(&ei->i_es_seq);
+	found = __es_lookup_extent(&ei->i_es_tree, lblk, es);
+	if (read_seqcount_retry(&ei->i_es_seq, seq))
+		found = -EAGAIN;
+	rcu_read_unlock();
+
+	if (found < 0) {
+		es->es_lblk = es->es_len = es->es_pblk = 0;
+		read_lock(&ei->i_es_lock);
+		found = __es_lookup_extent(&ei->i_es_tree, lblk, es);
+		read_unlock(&ei->i_es_lock);
+		BUG_ON(found < 0);
 	}
 
-	read_unlock(&EXT4_I(inode)->i_es_lock);
-
 	trace_ext4_es_lookup_extent_exit(inode, es, found);
 	return found;
 }
@@ -896,111 +936,79 @@ int ext4_es_remove_extent(struct inode *inode, ext4_lblk_t lblk,
 	BUG_ON(end < lblk);
 
 	write_lock(&EXT4_I(inode)->i_es_lock);
+	write_seqcount_begin(&EXT4_I(inode)->i_es_seq);
 	err = __es_remove_extent(inode, lblk, end);
+	write_seqcount_end(&EXT4_I(inode)->i_es_seq);
 	write_unlock(&EXT4_I(inode)->i_es_lock);
 	ext4_es_print_tree(inode);
 	return err;
 }
 
-static int ext4_inode_touch_time_cmp(void *priv, struct list_head *a,
-				     struct list_head *b)
-{
-	struct ext4_inode_info *eia, *eib;
-	eia = list_entry(a, struct ext4_inode_info, i_es_lru);
-	eib = list_entry(b, struct ext4_inode_info, i_es_lru);
-
-	if (ext4_test_inode_state(&eia->vfs_inode, EXT4_STATE_EXT_PRECACHED) &&
-	    !ext4_test_inode_state(&eib->vfs_inode, EXT4_STATE_EXT_PRECACHED))
-		return 1;
-	if (!ext4_test_inode_state(&eia->vfs_inode, EXT4_STATE_EXT_PRECACHED) &&
-	    ext4_test_inode_state(&eib->vfs_inode, EXT4_STATE_EXT_PRECACHED))
-		return -1;
-	if (eia->i_touch_when == eib->i_touch_when)
-		return 0;
-	if (time_after(eia->i_touch_when, eib->i_touch_when))
-		return 1;
-	else
-		return -1;
-}
-
+/*
+ * Reclaim from the inodes on sbi->s_es_lru in round-robin order.  Each
+ * inode is rotated to the tail as it is visited, and s_es_lru_lock is
+ * dropped while its extents are reclaimed, so the lock is only ever held
+ * for a single list operation.  An inode cannot be freed while we hold its
+ * i_es_lock because ext4_clear_inode() removes all of its extents before
+ * taking it off the list.  Precached inodes are skipped unless a full pass
+ * over the list made no progress.
+ */
 static int __ext4_es_shrink(struct ext4_sb_info *sbi, int nr_to_scan,
 			    struct ext4_inode_info *locked_ei)
 {
 	struct ext4_inode_info *ei;
-	struct list_head *cur, *tmp;
-	LIST_HEAD(skipped);
 	int nr_shrunk = 0;
-	int retried = 0, skip_precached = 1, nr_skipped = 0;
-
-	spin_lock(&sbi->s_es_lru_lock);
+	int skip_precached = 1;
+	int nr_to_walk;
 
 retry:
-	list_for_each_safe(cur, tmp, &sbi->s_es_lru) {
+	spin_lock(&sbi->s_es_lru_lock);
+	nr_to_walk = sbi->s_es_nr_inode;
+	while (nr_to_walk-- > 0) {
 		int shrunk;
 
 		/*
 		 * If we have already reclaimed all extents from extent
 		 * status tree, just stop the loop immediately.
 		 */
-		if (percpu_counter_read_positive(&sbi->s_extent_cache_cnt) == 0)
+		if (list_empty(&sbi->s_es_lru) ||
+		    percpu_counter_read_positive(&sbi->s_extent_cache_cnt) == 0)
 			break;
 
-		ei = list_entry(cur, struct ext4_inode_info, i_es_lru);
-
-		/*
-		 * Skip the inode that is newer than the last_sorted
-		 * time.  Normally we try hard to avoid shrinking
-		 * precached inodes, but we will as a last resort.
-		 */
-		if ((sbi->s_es_last_sorted < ei->i_touch_when) ||
-		    (skip_precached && ext4_test_inode_state(&ei->vfs_inode,
-						EXT4_STATE_EXT_PRECACHED))) {
-			nr_skipped++;
-			list_move_tail(cur, &skipped);
+		ei = list_first_entry(&sbi->s_es_lru, struct ext4_inode_info,
+				      i_es_lru);
+		if (ei->i_es_lru_nr == 0) {
+			list_del_init(&ei->i_es_lru);
+			sbi->s_es_nr_inode--;
 			continue;
 		}
+		list_move_tail(&ei->i_es_lru, &sbi->s_es_lru);
 
-		if (ei->i_es_lru_nr == 0 || ei == locked_ei ||
-		    !write_trylock(&ei->i_es_lock))
+		if ((skip_precached && ext4_test_inode_state(&ei->vfs_inode,
+						EXT4_STATE_EXT_PRECACHED)) ||
+		    ei == locked_ei || !write_trylock(&ei->i_es_lock))
 			continue;
+		spin_unlock(&sbi->s_es_lru_lock);
 
+		write_seqcount_begin(&ei->i_es_seq);
 		shrunk = __es_try_to_reclaim_extents(ei, nr_to_scan);
-		if (ei->i_es_lru_nr == 0)
-			list_del_init(&ei->i_es_lru);
+		write_seqcount_end(&ei->i_es_seq);
 		write_unlock(&ei->i_es_lock);
 
 		nr_shrunk += shrunk;
 		nr_to_scan -= shrunk;
 		if (nr_to_scan == 0)
-			break;
+			goto out;
+		spin_lock(&sbi->s_es_lru_lock);
 	}
+	spin_unlock(&sbi->s_es_lru_lock);
 
-	/* Move the newer inodes into the tail of the LRU list. */
-	list_splice_tail(&skipped, &sbi->s_es_lru);
-	INIT_LIST_HEAD(&skipped);
-
-	/*
-	 * If we skipped any inodes, and we weren't able to make any
-	 * forward progress, sort the list and try again.
-	 */
-	if ((nr_shrunk == 0) && nr_skipped && !retried) {
-		retried++;
-		list_sort(NULL, &sbi->s_es_lru, ext4_inode_touch_time_cmp);
-		sbi->s_es_last_sorted = jiffies;
-		ei = list_first_entry(&sbi->s_es_lru, struct ext4_inode_info,
-				      i_es_lru);
-		/*
-		 * If there are no non-precached inodes left on the
-		 * list, start releasing precached extents.
-		 */
-		if (ext4_test_inode_state(&ei->vfs_inode,
-					  EXT4_STATE_EXT_PRECACHED))
-			skip_precached = 0;
+	if (nr_shrunk == 0 && skip_precached) {
+		skip_precached = 0;
 		goto retry;
 	}
 
-	spin_unlock(&sbi->s_es_lru_lock);
-
+out:
 	if (locked_ei && nr_shrunk == 0)
 		nr_shrunk = __es_try_to_reclaim_extents(locked_ei, nr_to_scan);
 
@@ -1043,7 +1051,7 @@ void ext4_es_register_shrinker(struct ext4_sb_info *sbi)
 {
 	INIT_LIST_HEAD(&sbi->s_es_lru);
 	spin_lock_init(&sbi->s_es_lru_lock);
-	sbi->s_es_last_sorted = 0;
+	sbi->s_es_nr_inode = 0;
 	sbi->s_es_shrinker.scan_objects = ext4_es_scan;
 	sbi->s_es_shrinker.count_objects = ext4_es_count;
 	sbi->s_es_shrinker.seeks = DEFAULT_SEEKS;
@@ -1060,14 +1068,14 @@ void ext4_es_lru_add(struct inode *inode)
 	struct ext4_inode_info *ei = EXT4_I(inode);
 	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
 
-	ei->i_touch_when = jiffies;
-
 	if (!list_empty(&ei->i_es_lru))
 		return;
 
 	spin_lock(&sbi->s_es_lru_lock);
-	if (list_empty(&ei->i_es_lru))
+	if (list_empty(&ei->i_es_lru)) {
 		list_add_tail(&ei->i_es_lru, &sbi->s_es_lru);
+		sbi->s_es_nr_inode++;
+	}
 	spin_unlock(&sbi->s_es_lru_lock);
 }
 
@@ -1077,8 +1085,10 @@ void ext4_es_lru_del(struct inode *inode)
 	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
 
 	spin_lock(&sbi->s_es_lru_lock);
-	if (!list_empty(&ei->i_es_lru))
+	if (!list_empty(&ei->i_es_lru)) {
 		list_del_init(&ei->i_es_lru);
+		sbi->s_es_nr_inode--;
+	}
 	spin_unlock(&sbi->s_es_lru_lock);
 }
 
@@ -0,0 +1,1158 @@
+/*
+ *  fs/ext4/fast_commit.c
+ *
+ * Fast commits: instead of committing the running transaction, fsync can
+ * write just what changed in the inodes it has to make durable, to the
+ * fast commit area at the end of the journal.  What is recorded is logical:
+ * the raw inodes, the extents mapped into them and the ranges unmapped
+ * from them, and the directory entries added and removed, as tracked by
+ * the ext4_fc_track_*() calls.  Operations whose effects cannot be told
+ * that way mark the running transaction ineligible, and fsync falls back
+ * to a full commit until it has committed.
+ *
+ * Fast commits are only valid on top of the transaction that was running
+ * when they were written: the next full commit makes them obsolete, and
+ * jbd2 then reuses the area from its start.  Recovery replays them, after
+ * the log, through ext4_fc_replay(): before mballoc is set up, so block
+ * allocation and freeing go through the simple versions in mballoc.c
+ * while EXT4_FC_REPLAY is set.
+ */
+
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/crc32.h>
+#include <linux/blkdev.h>
+#include "ext4.h"
+#include "ext4_jbd2.h"
+#include "ext4_extents.h"
+
+/* An inode taken off s_fc_q by a fast commit, with its tracked range */
+struct ext4_fc_inode_snap {
+	struct inode *inode;
+	ext4_lblk_t lblk_start;
+	ext4_lblk_t lblk_len;
+};
+
+/* The blocks a fast commit is written to */
+struct ext4_fc_write {
+	journal_t *journal;
+	struct buffer_head **bhs;
+	int nblks;
+	int off;		/* of the free space in the last block */
+	u32 crc;		/* of the records since the head or last tail */
+};
+
+int ext4_fc_enabled(struct super_block *sb)
+{
+	journal_t *journal = EXT4_SB(sb)->s_journal;
+
+	return test_opt(sb, JOURNAL_FAST_COMMIT) && journal &&
+	       JBD2_HAS_INCOMPAT_FEATURE(journal,
+					 JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+}
+
+void ext4_fc_init_sb(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	spin_lock_init(&sbi->s_fc_lock);
+	INIT_LIST_HEAD(&sbi->s_fc_q);
+	INIT_LIST_HEAD(&sbi->s_fc_dentry_q);
+	sbi->s_fc_ineligible = false;
+}
+
+void ext4_fc_init_inode(struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+
+	INIT_LIST_HEAD(&ei->i_fc_list);
+	ei->i_fc_lblk_start = 0;
+	ei->i_fc_lblk_len = 0;
+	ei->i_fc_tid = 0;
+}
+
+/* Called when the inode is evicted: nobody can track it any more */
+void ext4_fc_del(struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+
+	if (list_empty(&ei->i_fc_list))
+		return;
+	spin_lock(&sbi->s_fc_lock);
+	list_del_init(&ei->i_fc_list);
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+/*
+ * The transaction of @handle makes a change fast commits cannot record:
+ * fall back to full commits until it has committed.
+ */
+void ext4_fc_mark_ineligible(struct super_block *sb, handle_t *handle)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	tid_t tid;
+
+	if (!ext4_fc_enabled(sb) || !ext4_handle_valid(handle))
+		return;
+
+	tid = handle->h_transaction->t_tid;
+	spin_lock(&sbi->s_fc_lock);
+	if (!sbi->s_fc_ineligible || tid_gt(tid, sbi->s_fc_ineligible_tid))
+		sbi->s_fc_ineligible_tid = tid;
+	sbi->s_fc_ineligible = true;
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+/* Called with s_fc_lock held */
+static void __ext4_fc_track(handle_t *handle, struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+
+	ei->i_fc_tid = handle->h_transaction->t_tid;
+	if (list_empty(&ei->i_fc_list))
+		list_add_tail(&ei->i_fc_list, &EXT4_SB(inode->i_sb)->s_fc_q);
+}
+
+/* The raw inode changed: called by ext4_mark_inode_dirty() */
+void ext4_fc_track_inode(handle_t *handle, struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	if (!ext4_fc_enabled(sb) || !ext4_handle_valid(handle))
+		return;
+
+	/* Blocks of journalled data and quota are only in the journal */
+	if ((S_ISREG(inode->i_mode) && ext4_should_journal_data(inode)) ||
+	    IS_NOQUOTA(inode)) {
+		ext4_fc_mark_ineligible(sb, handle);
+		return;
+	}
+
+	spin_lock(&sbi->s_fc_lock);
+	__ext4_fc_track(handle, inode);
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+/*
+ * The mapping of @len logical blocks from @lblk on changed.  Directory
+ * blocks are not recorded: replaying the entry changes rebuilds them.
+ */
+void ext4_fc_track_range(handle_t *handle, struct inode *inode,
+			 ext4_lblk_t lblk, ext4_lblk_t len)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	ext4_lblk_t end;
+
+	if (!ext4_fc_enabled(sb) || !ext4_handle_valid(handle) ||
+	    S_ISDIR(inode->i_mode) || !len)
+		return;
+
+	if (!ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)) {
+		ext4_fc_mark_ineligible(sb, handle);
+		return;
+	}
+
+	spin_lock(&sbi->s_fc_lock);
+	if (ei->i_fc_lblk_len) {
+		end = max(ei->i_fc_lblk_start + ei->i_fc_lblk_len - 1,
+			  lblk + len - 1);
+		ei->i_fc_lblk_start = min(ei->i_fc_lblk_start, lblk);
+		ei->i_fc_lblk_len = end - ei->i_fc_lblk_start + 1;
+	} else {
+		ei->i_fc_lblk_start = lblk;
+		ei->i_fc_lblk_len = len;
+	}
+	__ext4_fc_track(handle, inode);
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+static void ext4_fc_track_dentry(handle_t *handle, struct dentry *dentry,
+				 int op)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	struct inode *inode = dentry->d_inode;
+	struct super_block *sb = dir->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_dentry_update *fcd;
+
+	if (!ext4_fc_enabled(sb) || !ext4_handle_valid(handle))
+		return;
+
+	fcd = kmalloc(sizeof(*fcd) + dentry->d_name.len, GFP_NOFS);
+	if (!fcd) {
+		ext4_fc_mark_ineligible(sb, handle);
+		return;
+	}
+	fcd->fcd_op = op;
+	fcd->fcd_tid = handle->h_transaction->t_tid;
+	fcd->fcd_parent = dir->i_ino;
+	fcd->fcd_ino = inode->i_ino;
+	fcd->fcd_len = dentry->d_name.len;
+	memcpy(fcd->fcd_name, dentry->d_name.name, dentry->d_name.len);
+
+	spin_lock(&sbi->s_fc_lock);
+	list_add_tail(&fcd->fcd_list, &sbi->s_fc_dentry_q);
+	__ext4_fc_track(handle, dir);
+	__ext4_fc_track(handle, inode);
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+void ext4_fc_track_create(handle_t *handle, struct dentry *dentry)
+{
+	ext4_fc_track_dentry(handle, dentry, EXT4_FC_TAG_CREAT);
+}
+
+void ext4_fc_track_link(handle_t *handle, struct dentry *dentry)
+{
+	ext4_fc_track_dentry(handle, dentry, EXT4_FC_TAG_LINK);
+}
+
+void ext4_fc_track_unlink(handle_t *handle, struct dentry *dentry)
+{
+	ext4_fc_track_dentry(handle, dentry, EXT4_FC_TAG_UNLINK);
+}
+
+/*
+ * jbd2 calls this once transaction @tid has committed: what was tracked in
+ * it, or before, is on disk now.
+ */
+void ext4_fc_cleanup(journal_t *journal, tid_t tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_inode_info *ei, *ei_n;
+	struct ext4_fc_dentry_update *fcd, *fcd_n;
+	LIST_HEAD(free_list);
+
+	spin_lock(&sbi->s_fc_lock);
+	list_for_each_entry_safe(ei, ei_n, &sbi->s_fc_q, i_fc_list) {
+		if (tid_geq(tid, ei->i_fc_tid)) {
+			list_del_init(&ei->i_fc_list);
+			ei->i_fc_lblk_len = 0;
+		}
+	}
+	list_for_each_entry_safe(fcd, fcd_n, &sbi->s_fc_dentry_q, fcd_list) {
+		if (tid_geq(tid, fcd->fcd_tid))
+			list_move_tail(&fcd->fcd_list, &free_list);
+	}
+	if (sbi->s_fc_ineligible && tid_geq(tid, sbi->s_fc_ineligible_tid))
+		sbi->s_fc_ineligible = false;
+	spin_unlock(&sbi->s_fc_lock);
+
+	list_for_each_entry_safe(fcd, fcd_n, &free_list, fcd_list)
+		kfree(fcd);
+}
+
+/* Called with s_fc_lock held */
+static int ext4_fc_count_inodes(struct ext4_sb_info *sbi)
+{
+	struct ext4_inode_info *ei;
+	int n = 0;
+
+	list_for_each_entry(ei, &sbi->s_fc_q, i_fc_list)
+		n++;
+	return n;
+}
+
+/*
+ * Take references on up to @max inodes of s_fc_q; with @detach, take them
+ * off it too, as the fast commit being written records them.  Inodes being
+ * evicted are skipped.  Called with s_fc_lock held.
+ */
+static int ext4_fc_grab_inodes(struct ext4_sb_info *sbi,
+			       struct ext4_fc_inode_snap *snap, int max,
+			       bool detach)
+{
+	struct ext4_inode_info *ei, *ei_n;
+	int n = 0;
+
+	list_for_each_entry_safe(ei, ei_n, &sbi->s_fc_q, i_fc_list) {
+		if (n == max)
+			break;
+		if (!igrab(&ei->vfs_inode))
+			continue;
+		snap[n].inode = &ei->vfs_inode;
+		snap[n].lblk_start = ei->i_fc_lblk_start;
+		snap[n].lblk_len = ei->i_fc_lblk_len;
+		if (detach) {
+			list_del_init(&ei->i_fc_list);
+			ei->i_fc_lblk_len = 0;
+		}
+		n++;
+	}
+	return n;
+}
+
+/*
+ * Start writing back the data of the tracked inodes, before the fast
+ * commit holds the full commits off: allocating blocks for it may need
+ * the journal.
+ */
+static int ext4_fc_write_data(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_inode_snap *snap;
+	int i, n, ret = 0;
+
+	spin_lock(&sbi->s_fc_lock);
+	n = ext4_fc_count_inodes(sbi);
+	spin_unlock(&sbi->s_fc_lock);
+	if (!n)
+		return 0;
+
+	snap = kmalloc_array(n, sizeof(*snap), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+
+	spin_lock(&sbi->s_fc_lock);
+	n = ext4_fc_grab_inodes(sbi, snap, n, false);
+	spin_unlock(&sbi->s_fc_lock);
+
+	for (i = 0; i < n; i++) {
+		if (!ret)
+			ret = filemap_fdatawrite(snap[i].inode->i_mapping);
+		iput(snap[i].inode);
+	}
+	kfree(snap);
+	return ret;
+}
+
+/*
+ * Room for @len bytes of records: in the last block if they fit, else in
+ * a new one, the rest of the last being padded out.
+ */
+static u8 *ext4_fc_reserve(struct ext4_fc_write *w, int len, int *errp)
+{
+	int bsize = w->journal->j_blocksize;
+	struct buffer_head *bh;
+	struct ext4_fc_tl tl;
+	u8 *dst;
+
+	if (w->nblks && w->off + len <= bsize) {
+		dst = (u8 *)w->bhs[w->nblks - 1]->b_data + w->off;
+		w->off += len;
+		return dst;
+	}
+
+	if (w->nblks && w->off + sizeof(tl) <= bsize) {
+		tl.fc_tag = cpu_to_le16(EXT4_FC_TAG_PAD);
+		tl.fc_len = cpu_to_le16(bsize - w->off - sizeof(tl));
+		memcpy(w->bhs[w->nblks - 1]->b_data + w->off, &tl, sizeof(tl));
+	}
+
+	*errp = jbd2_fc_get_buf(w->journal, &bh);
+	if (*errp)
+		return NULL;
+	w->bhs[w->nblks++] = bh;
+	w->off = len;
+	return (u8 *)bh->b_data;
+}
+
+/* Append a record whose value is @val, followed by @data */
+static int ext4_fc_add_tlv(struct ext4_fc_write *w, int tag,
+			   const void *val, int len,
+			   const void *data, int dlen)
+{
+	struct ext4_fc_tl tl;
+	int err = 0;
+	u8 *dst;
+
+	dst = ext4_fc_reserve(w, sizeof(tl) + len + dlen, &err);
+	if (!dst)
+		return err;
+
+	tl.fc_tag = cpu_to_le16(tag);
+	tl.fc_len = cpu_to_le16(len + dlen);
+	memcpy(dst, &tl, sizeof(tl));
+	memcpy(dst + sizeof(tl), val, len);
+	if (dlen)
+		memcpy(dst + sizeof(tl) + len, data, dlen);
+	w->crc = crc32_le(w->crc, dst, sizeof(tl) + len + dlen);
+	return 0;
+}
+
+/*
+ * The tail closes the fast commit: its crc covers the records since the
+ * head or the previous tail, and itself up to the crc.  The rest of its
+ * block is padded out, as the next fast commit starts a new block.
+ */
+static int ext4_fc_write_tail(struct ext4_fc_write *w, tid_t tid)
+{
+	int bsize = w->journal->j_blocksize;
+	struct ext4_fc_tail tail;
+	struct ext4_fc_tl tl;
+	int err = 0;
+	u8 *dst;
+
+	dst = ext4_fc_reserve(w, sizeof(tl) + sizeof(tail), &err);
+	if (!dst)
+		return err;
+
+	tl.fc_tag = cpu_to_le16(EXT4_FC_TAG_TAIL);
+	tl.fc_len = cpu_to_le16(sizeof(tail));
+	tail.fc_tid = cpu_to_le32(tid);
+	memcpy(dst, &tl, sizeof(tl));
+	memcpy(dst + sizeof(tl), &tail.fc_tid, sizeof(tail.fc_tid));
+	w->crc = crc32_le(w->crc, dst,
+			  sizeof(tl) + offsetof(struct ext4_fc_tail, fc_crc));
+	tail.fc_crc = cpu_to_le32(w->crc);
+	memcpy(dst + sizeof(tl) + offsetof(struct ext4_fc_tail, fc_crc),
+	       &tail.fc_crc, sizeof(tail.fc_crc));
+
+	if (w->off + sizeof(tl) <= bsize) {
+		tl.fc_tag = cpu_to_le16(EXT4_FC_TAG_PAD);
+		tl.fc_len = cpu_to_le16(bsize - w->off - sizeof(tl));
+		memcpy(w->bhs[w->nblks - 1]->b_data + w->off, &tl, sizeof(tl));
+	}
+	return 0;
+}
+
+static int ext4_fc_write_inode(struct ext4_fc_write *w, struct inode *inode)
+{
+	__le32 ino = cpu_to_le32(inode->i_ino);
+	struct ext4_iloc iloc;
+	int ret;
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+	ret = ext4_fc_add_tlv(w, EXT4_FC_TAG_INODE, &ino, sizeof(ino),
+			      ext4_raw_inode(&iloc),
+			      EXT4_INODE_SIZE(inode->i_sb));
+	brelse(iloc.bh);
+	return ret;
+}
+
+/*
+ * Record the mapping of the tracked range: unmap all of it, then map the
+ * extents it has now, so that replaying gives the same result however the
+ * mapping went before.
+ */
+static int ext4_fc_write_inode_data(struct ext4_fc_write *w,
+				    struct ext4_fc_inode_snap *snap)
+{
+	struct inode *inode = snap->inode;
+	ext4_lblk_t cur = snap->lblk_start;
+	ext4_lblk_t end = snap->lblk_start + snap->lblk_len - 1;
+	struct ext4_fc_del_range del;
+	struct ext4_fc_add_range add;
+	struct ext4_map_blocks map;
+	struct ext4_extent ex;
+	ext4_lblk_t next;
+	int ret;
+
+	if (!snap->lblk_len)
+		return 0;
+
+	del.fc_ino = cpu_to_le32(inode->i_ino);
+	del.fc_lblk = cpu_to_le32(snap->lblk_start);
+	del.fc_len = cpu_to_le32(snap->lblk_len);
+	ret = ext4_fc_add_tlv(w, EXT4_FC_TAG_DEL_RANGE, &del, sizeof(del),
+			      NULL, 0);
+	if (ret)
+		return ret;
+
+	while (cur <= end) {
+		map.m_lblk = cur;
+		map.m_len = min_t(ext4_lblk_t, end - cur + 1,
+				  EXT_UNINIT_MAX_LEN);
+		ret = ext4_map_blocks(NULL, inode, &map, 0);
+		if (ret < 0)
+			return ret;
+		if (!ret) {
+			/* A hole: skip to where the tree maps blocks again */
+			ret = ext4_ext_next_mapped_block(inode, cur, &next);
+			if (ret)
+				return ret;
+			if (next >= EXT_MAX_BLOCKS || next > end)
+				break;
+			cur = max(next, cur + 1);
+			continue;
+		}
+
+		ex.ee_block = cpu_to_le32(cur);
+		ex.ee_len = cpu_to_le16(ret);
+		ext4_ext_store_pblock(&ex, map.m_pblk);
+		if (map.m_flags & EXT4_MAP_UNWRITTEN)
+			ext4_ext_mark_uninitialized(&ex);
+		add.fc_ino = cpu_to_le32(inode->i_ino);
+		memcpy(add.fc_ex, &ex, sizeof(ex));
+		ret = ext4_fc_add_tlv(w, EXT4_FC_TAG_ADD_RANGE, &add,
+				      sizeof(add), NULL, 0);
+		if (ret)
+			return ret;
+		cur += map.m_len;
+	}
+	return 0;
+}
+
+/*
+ * Write the fast commit blocks out: behind a cache flush, so that the data
+ * written before is durable first, and with FUA.
+ */
+static void ext4_fc_submit_bufs(struct ext4_fc_write *w)
+{
+	journal_t *journal = w->journal;
+	int i, write_op = WRITE_SYNC;
+
+	if (journal->j_flags & JBD2_BARRIER) {
+		if (journal->j_fs_dev != journal->j_dev)
+			blkdev_issue_flush(journal->j_fs_dev, GFP_NOFS, NULL);
+		write_op = WRITE_FLUSH_FUA;
+	}
+
+	for (i = 0; i < w->nblks; i++) {
+		struct buffer_head *bh = w->bhs[i];
+
+		lock_buffer(bh);
+		clear_buffer_dirty(bh);
+		set_buffer_uptodate(bh);
+		bh->b_end_io = end_buffer_write_sync;
+		get_bh(bh);
+		submit_bh(write_op, bh);
+		if (write_op == WRITE_FLUSH_FUA)
+			write_op = WRITE_FUA;
+	}
+}
+
+/*
+ * Hold the updates off, with room to take every inode off s_fc_q: it only
+ * shrinks while no handle is running.
+ */
+static struct ext4_fc_inode_snap *ext4_fc_lock_updates(journal_t *journal,
+						       int *max)
+{
+	struct ext4_sb_info *sbi = EXT4_SB((struct super_block *)
+					   journal->j_private);
+	struct ext4_fc_inode_snap *snap;
+	int n;
+
+	for (;;) {
+		spin_lock(&sbi->s_fc_lock);
+		n = ext4_fc_count_inodes(sbi);
+		spin_unlock(&sbi->s_fc_lock);
+
+		snap = kmalloc_array(max(n, 1), sizeof(*snap), GFP_NOFS);
+		if (!snap)
+			return NULL;
+
+		jbd2_journal_lock_updates(journal);
+		spin_lock(&sbi->s_fc_lock);
+		if (ext4_fc_count_inodes(sbi) <= n) {
+			spin_unlock(&sbi->s_fc_lock);
+			*max = n;
+			return snap;
+		}
+		spin_unlock(&sbi->s_fc_lock);
+		jbd2_journal_unlock_updates(journal);
+		kfree(snap);
+	}
+}
+
+/*
+ * Write the fast commit.  The records are taken with the updates held off,
+ * so that they are consistent with each other; the inodes they are for are
+ * returned in *@snapp, to be released once the fast commit has ended.
+ */
+static int ext4_fc_perform_commit(journal_t *journal, tid_t tid,
+				  struct ext4_fc_write *w,
+				  struct ext4_fc_inode_snap **snapp,
+				  int *nsnapp)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_dentry_update *fcd, *fcd_n;
+	struct ext4_fc_dentry_info info;
+	struct ext4_fc_inode_snap *snap;
+	struct ext4_fc_head head;
+	struct address_space *mapping;
+	LIST_HEAD(dentries);
+	int i, n, ret = 0;
+
+	snap = ext4_fc_lock_updates(journal, &n);
+	if (!snap)
+		return -ENOMEM;
+	*snapp = snap;
+
+	spin_lock(&sbi->s_fc_lock);
+	if (sbi->s_fc_ineligible) {
+		spin_unlock(&sbi->s_fc_lock);
+		ret = -EAGAIN;
+		goto out_unlock;
+	}
+	*nsnapp = n = ext4_fc_grab_inodes(sbi, snap, n, true);
+	list_splice_init(&sbi->s_fc_dentry_q, &dentries);
+	spin_unlock(&sbi->s_fc_lock);
+
+	w->crc = ~0;
+	if (journal->j_fc_off == 0) {
+		head.fc_features = cpu_to_le32(EXT4_FC_SUPPORTED_FEATURES);
+		head.fc_tid = cpu_to_le32(tid);
+		ret = ext4_fc_add_tlv(w, EXT4_FC_TAG_HEAD, &head, sizeof(head),
+				      NULL, 0);
+		if (ret)
+			goto out_unlock;
+	}
+
+	for (i = 0; i < n; i++) {
+		ret = ext4_fc_write_inode(w, snap[i].inode);
+		if (!ret)
+			ret = ext4_fc_write_inode_data(w, &snap[i]);
+		if (ret)
+			goto out_unlock;
+	}
+
+	list_for_each_entry(fcd, &dentries, fcd_list) {
+		info.fc_parent_ino = cpu_to_le32(fcd->fcd_parent);
+		info.fc_ino = cpu_to_le32(fcd->fcd_ino);
+		ret = ext4_fc_add_tlv(w, fcd->fcd_op, &info, sizeof(info),
+				      fcd->fcd_name, fcd->fcd_len);
+		if (ret)
+			goto out_unlock;
+	}
+
+	ret = ext4_fc_write_tail(w, tid);
+
+out_unlock:
+	jbd2_journal_unlock_updates(journal);
+	list_for_each_entry_safe(fcd, fcd_n, &dentries, fcd_list)
+		kfree(fcd);
+	if (ret)
+		return ret;
+
+	/*
+	 * The data the records map must reach the disk before they do.
+	 * Without delalloc, pages dirtied since may already be mapped, and
+	 * would be exposed stale by a replay.
+	 */
+	for (i = 0; i < n; i++) {
+		mapping = snap[i].inode->i_mapping;
+		ret = filemap_fdatawait(mapping);
+		if (ret)
+			return ret;
+		if (!test_opt(sb, DELALLOC) &&
+		    mapping_tagged(mapping, PAGECACHE_TAG_DIRTY))
+			return -EAGAIN;
+	}
+
+	ext4_fc_submit_bufs(w);
+	return jbd2_fc_wait_bufs(journal, w->nblks);
+}
+
+/**
+ * ext4_fc_commit() - make the changes tracked in a transaction durable
+ * @journal:	journal of the filesystem
+ * @commit_tid:	the transaction
+ *
+ * Called by fsync in place of committing @commit_tid: writes a fast commit
+ * if @commit_tid is still running and eligible, or falls back to a full
+ * commit.
+ */
+int ext4_fc_commit(journal_t *journal, tid_t commit_tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_fc_write w = { .journal = journal };
+	struct ext4_fc_inode_snap *snap = NULL;
+	int i, nsnap = 0, needs_barrier, ret, err;
+
+	/* As ext4_sync_file() does for a full commit */
+	needs_barrier = (journal->j_flags & JBD2_BARRIER) &&
+		!jbd2_trans_will_send_data_barrier(journal, commit_tid);
+
+	ret = ext4_fc_write_data(sb);
+	if (ret)
+		return ret;
+
+	w.bhs = kmalloc_array(journal->j_fc_last - journal->j_fc_first,
+			      sizeof(*w.bhs), GFP_KERNEL);
+	if (!w.bhs) {
+		ret = jbd2_complete_transaction(journal, commit_tid);
+		goto out;
+	}
+
+	ret = jbd2_fc_begin_commit(journal, commit_tid);
+	if (ret == -EALREADY) {
+		ret = 0;
+		goto out;
+	}
+	if (ret) {
+		ret = jbd2_complete_transaction(journal, commit_tid);
+		goto out;
+	}
+
+	ret = ext4_fc_perform_commit(journal, commit_tid, &w, &snap, &nsnap);
+	if (ret)
+		ret = jbd2_fc_end_commit_fallback(journal, commit_tid);
+	else
+		ret = jbd2_fc_end_commit(journal);
+
+	for (i = 0; i < nsnap; i++)
+		iput(snap[i].inode);
+	kfree(snap);
+out:
+	kfree(w.bhs);
+	if (needs_barrier) {
+		err = blkdev_issue_flush(sb->s_bdev, GFP_KERNEL, NULL);
+		if (!ret)
+			ret = err;
+	}
+	return ret;
+}
+
+/*
+ * Replay
+ */
+
+static int ext4_fc_record_region(struct super_block *sb, ext4_fsblk_t pblk,
+				 unsigned int len)
+{
+	struct ext4_fc_replay_state *state = &EXT4_SB(sb)->s_fc_replay_state;
+	struct ext4_fc_alloc_region *regions;
+
+	if (state->fc_regions_used == state->fc_regions_size) {
+		regions = krealloc(state->fc_regions,
+				   (state->fc_regions_size + 32) *
+				   sizeof(*regions), GFP_NOFS);
+		if (!regions)
+			return -ENOMEM;
+		state->fc_regions = regions;
+		state->fc_regions_size += 32;
+	}
+	state->fc_regions[state->fc_regions_used].pblk = pblk;
+	state->fc_regions[state->fc_regions_used].len = len;
+	state->fc_regions_used++;
+	return 0;
+}
+
+/*
+ * Whether a fast commit being replayed maps @blk: the block allocator must
+ * leave it alone, though it is still free in the bitmap.
+ */
+int ext4_fc_replay_check_excluded(struct super_block *sb, ext4_fsblk_t blk)
+{
+	struct ext4_fc_replay_state *state = &EXT4_SB(sb)->s_fc_replay_state;
+	int i;
+
+	for (i = 0; i < state->fc_regions_valid; i++) {
+		if (blk >= state->fc_regions[i].pblk &&
+		    blk < state->fc_regions[i].pblk + state->fc_regions[i].len)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * PASS_SCAN: find how many records the valid fast commits hold, those that
+ * belong to @expected_tid and whose tail checks, and the blocks they map.
+ */
+static int ext4_fc_replay_scan(journal_t *journal, struct buffer_head *bh,
+			       int off, tid_t expected_tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_fc_replay_state *state = &EXT4_SB(sb)->s_fc_replay_state;
+	u8 *start = (u8 *)bh->b_data, *end = start + journal->j_blocksize;
+	struct ext4_fc_add_range range;
+	struct ext4_fc_head head;
+	struct ext4_fc_tail tail;
+	struct ext4_fc_tl tl;
+	struct ext4_extent ex;
+	u8 *cur, *val;
+	int tag, len, ret;
+
+	if (off == 0) {
+		state->fc_replay_num_tags = 0;
+		state->fc_replay_expected_off = 0;
+		state->fc_cur_tag = 0;
+		state->fc_crc = ~0;
+		state->fc_regions_used = 0;
+		state->fc_regions_valid = 0;
+	}
+	if (off != state->fc_replay_expected_off)
+		return JBD2_FC_REPLAY_STOP;
+	state->fc_replay_expected_off++;
+
+	for (cur = start; cur + sizeof(tl) <= end; cur = val + len) {
+		memcpy(&tl, cur, sizeof(tl));
+		tag = le16_to_cpu(tl.fc_tag);
+		len = le16_to_cpu(tl.fc_len);
+		val = cur + sizeof(tl);
+		if (val + len > end)
+			return JBD2_FC_REPLAY_STOP;
+		if (off == 0 && cur == start && tag != EXT4_FC_TAG_HEAD)
+			return JBD2_FC_REPLAY_STOP;
+
+		switch (tag) {
+		case EXT4_FC_TAG_HEAD:
+			if (off != 0 || cur != start || len != sizeof(head))
+				return JBD2_FC_REPLAY_STOP;
+			memcpy(&head, val, sizeof(head));
+			if (le32_to_cpu(head.fc_tid) != expected_tid)
+				return JBD2_FC_REPLAY_STOP;
+			if (le32_to_cpu(head.fc_features) &
+			    ~EXT4_FC_SUPPORTED_FEATURES) {
+				ext4_msg(sb, KERN_ERR, "unsupported fast "
+					 "commit features %x",
+					 le32_to_cpu(head.fc_features));
+				return -EOPNOTSUPP;
+			}
+			break;
+		case EXT4_FC_TAG_ADD_RANGE:
+			if (len != sizeof(range))
+				return JBD2_FC_REPLAY_STOP;
+			memcpy(&range, val, sizeof(range));
+			memcpy(&ex, range.fc_ex, sizeof(ex));
+			ret = ext4_fc_record_region(sb, ext4_ext_pblock(&ex),
+						ext4_ext_get_actual_len(&ex));
+			if (ret)
+				return ret;
+			break;
+		case EXT4_FC_TAG_DEL_RANGE:
+			if (len != sizeof(struct ext4_fc_del_range))
+				return JBD2_FC_REPLAY_STOP;
+			break;
+		case EXT4_FC_TAG_CREAT:
+		case EXT4_FC_TAG_LINK:
+		case EXT4_FC_TAG_UNLINK:
+			if (len <= sizeof(struct ext4_fc_dentry_info) ||
+			    len > sizeof(struct ext4_fc_dentry_info) +
+				  EXT4_NAME_LEN)
+				return JBD2_FC_REPLAY_STOP;
+			break;
+		case EXT4_FC_TAG_INODE:
+			if (len != sizeof(struct ext4_fc_inode) +
+				   EXT4_INODE_SIZE(sb))
+				return JBD2_FC_REPLAY_STOP;
+			break;
+		case EXT4_FC_TAG_TAIL:
+			if (len != sizeof(tail))
+				return JBD2_FC_REPLAY_STOP;
+			memcpy(&tail, val, sizeof(tail));
+			state->fc_crc = crc32_le(state->fc_crc, cur,
+				sizeof(tl) + offsetof(struct ext4_fc_tail,
+						      fc_crc));
+			state->fc_cur_tag++;
+			if (le32_to_cpu(tail.fc_tid) != expected_tid ||
+			    le32_to_cpu(tail.fc_crc) != state->fc_crc)
+				return JBD2_FC_REPLAY_STOP;
+			state->fc_replay_num_tags = state->fc_cur_tag;
+			state->fc_regions_valid = state->fc_regions_used;
+			state->fc_crc = ~0;
+			continue;
+		case EXT4_FC_TAG_PAD:
+			return JBD2_FC_REPLAY_CONTINUE;
+		default:
+			return JBD2_FC_REPLAY_STOP;
+		}
+		state->fc_crc = crc32_le(state->fc_crc, cur, sizeof(tl) + len);
+		state->fc_cur_tag++;
+	}
+	return JBD2_FC_REPLAY_CONTINUE;
+}
+
+static struct buffer_head *ext4_fc_raw_inode_bh(struct super_block *sb,
+						unsigned long ino,
+						struct ext4_inode **raw)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_group_desc *gdp;
+	struct buffer_head *bh;
+	unsigned long offset;
+
+	if (!ino || ino > le32_to_cpu(sbi->s_es->s_inodes_count))
+		return ERR_PTR(-EIO);
+	gdp = ext4_get_group_desc(sb, (ino - 1) / EXT4_INODES_PER_GROUP(sb),
+				  NULL);
+	if (!gdp)
+		return ERR_PTR(-EIO);
+
+	offset = (ino - 1) % EXT4_INODES_PER_GROUP(sb);
+	bh = sb_bread(sb, ext4_inode_table(sb, gdp) +
+			  offset / sbi->s_inodes_per_block);
+	if (!bh)
+		return ERR_PTR(-EIO);
+	*raw = (struct ext4_inode *)(bh->b_data +
+		(offset % sbi->s_inodes_per_block) * EXT4_INODE_SIZE(sb));
+	return bh;
+}
+
+/* Whether the on-disk orphan list holds @ino */
+static int ext4_fc_orphan_listed(struct super_block *sb, unsigned long ino)
+{
+	struct ext4_super_block *es = EXT4_SB(sb)->s_es;
+	unsigned long cur = le32_to_cpu(es->s_last_orphan);
+	unsigned long n = le32_to_cpu(es->s_inodes_count);
+	struct ext4_inode *raw;
+	struct buffer_head *bh;
+
+	while (cur && n--) {
+		if (cur == ino)
+			return 1;
+		bh = ext4_fc_raw_inode_bh(sb, cur, &raw);
+		if (IS_ERR(bh))
+			return 0;
+		cur = le32_to_cpu(raw->i_dtime);
+		brelse(bh);
+	}
+	return 0;
+}
+
+/*
+ * EXT4_FC_TAG_INODE: copy the raw inode in.  The blocks of regular files
+ * and directories are as the log left them, with the ranges and entries
+ * replayed on top: so their block map, block count, and for directories
+ * the size, are kept.  An inode left without links goes on the orphan
+ * list, for the mount to delete it.
+ */
+static int ext4_fc_replay_inode(struct super_block *sb, u8 *val, int len)
+{
+	struct ext4_super_block *es = EXT4_SB(sb)->s_es;
+	struct ext4_fc_inode fc_inode;
+	struct ext4_extent_header *eh;
+	struct ext4_inode *raw;
+	struct buffer_head *bh;
+	__le32 i_block[EXT4_N_BLOCKS];
+	__le32 blocks_lo, size_lo, size_high, flags, dtime;
+	__le16 blocks_high;
+	unsigned long ino;
+	u32 keep;
+	umode_t mode;
+	int new;
+
+	memcpy(&fc_inode, val, sizeof(fc_inode));
+	ino = le32_to_cpu(fc_inode.fc_ino);
+	bh = ext4_fc_raw_inode_bh(sb, ino, &raw);
+	if (IS_ERR(bh))
+		return PTR_ERR(bh);
+
+	memcpy(i_block, raw->i_block, sizeof(i_block));
+	blocks_lo = raw->i_blocks_lo;
+	blocks_high = raw->osd2.linux2.l_i_blocks_high;
+	size_lo = raw->i_size_lo;
+	size_high = raw->i_size_high;
+	flags = raw->i_flags;
+	dtime = raw->i_dtime;
+
+	memcpy(raw, val + sizeof(fc_inode), len - sizeof(fc_inode));
+	mode = le16_to_cpu(raw->i_mode);
+	new = ext4_mark_inode_used(sb, ino, mode);
+	if (new < 0) {
+		brelse(bh);
+		return new;
+	}
+
+	if (S_ISREG(mode) || S_ISDIR(mode)) {
+		if (new) {
+			memset(raw->i_block, 0, sizeof(raw->i_block));
+			if (le32_to_cpu(raw->i_flags) & EXT4_EXTENTS_FL) {
+				eh = (struct ext4_extent_header *)raw->i_block;
+				eh->eh_magic = cpu_to_le16(EXT4_EXT_MAGIC);
+				eh->eh_max = cpu_to_le16(
+					(sizeof(raw->i_block) - sizeof(*eh)) /
+					sizeof(struct ext4_extent));
+			}
+			raw->i_blocks_lo = 0;
+			raw->osd2.linux2.l_i_blocks_high = 0;
+		} else {
+			memcpy(raw->i_block, i_block, sizeof(i_block));
+			raw->i_blocks_lo = blocks_lo;
+			raw->osd2.linux2.l_i_blocks_high = blocks_high;
+			keep = EXT4_EXTENTS_FL;
+			if (S_ISDIR(mode)) {
+				keep |= EXT4_INDEX_FL;
+				raw->i_size_lo = size_lo;
+				raw->i_size_high = size_high;
+			}
+			raw->i_flags = cpu_to_le32(
+				(le32_to_cpu(raw->i_flags) & ~keep) |
+				(le32_to_cpu(flags) & keep));
+		}
+	}
+
+	/* i_dtime links the orphan list, which the log left consistent */
+	raw->i_dtime = new ? 0 : dtime;
+	if (!raw->i_links_count && !ext4_fc_orphan_listed(sb, ino)) {
+		raw->i_dtime = es->s_last_orphan;
+		es->s_last_orphan = cpu_to_le32(ino);
+		ext4_superblock_csum_set(sb);
+		mark_buffer_dirty(EXT4_SB(sb)->s_sbh);
+	}
+
+	ext4_raw_inode_csum_set(sb, ino, raw);
+	mark_buffer_dirty(bh);
+	brelse(bh);
+	return 0;
+}
+
+/*
+ * The inodes of the records below may have been deleted since, or never
+ * been committed: their records are skipped then.
+ */
+static int ext4_fc_replay_add_range(struct super_block *sb, u8 *val)
+{
+	struct ext4_fc_add_range range;
+	struct ext4_extent ex;
+	struct inode *inode;
+	int ret;
+
+	memcpy(&range, val, sizeof(range));
+	memcpy(&ex, range.fc_ex, sizeof(ex));
+	inode = ext4_iget(sb, le32_to_cpu(range.fc_ino));
+	if (IS_ERR(inode)) {
+		jbd_debug(1, "fast commit: inode %u not found\n",
+			  le32_to_cpu(range.fc_ino));
+		return 0;
+	}
+	ret = ext4_ext_replay_add_range(inode, &ex);
+	iput(inode);
+	return ret;
+}
+
+static int ext4_fc_replay_del_range(struct super_block *sb, u8 *val)
+{
+	struct ext4_fc_del_range range;
+	struct inode *inode;
+	int ret;
+
+	memcpy(&range, val, sizeof(range));
+	inode = ext4_iget(sb, le32_to_cpu(range.fc_ino));
+	if (IS_ERR(inode)) {
+		jbd_debug(1, "fast commit: inode %u not found\n",
+			  le32_to_cpu(range.fc_ino));
+		return 0;
+	}
+	ret = ext4_ext_replay_del_range(inode, le32_to_cpu(range.fc_lblk),
+					le32_to_cpu(range.fc_len));
+	iput(inode);
+	return ret;
+}
+
+static int ext4_fc_replay_dentry(struct super_block *sb, int tag,
+				 u8 *val, int len)
+{
+	struct ext4_fc_dentry_info darg;
+	struct inode *dir, *inode;
+	struct qstr name;
+	int ret;
+
+	memcpy(&darg, val, sizeof(darg));
+	name.name = val + sizeof(darg);
+	name.len = len - sizeof(darg);
+	name.hash = full_name_hash(name.name, name.len);
+
+	dir = ext4_iget(sb, le32_to_cpu(darg.fc_parent_ino));
+	if (IS_ERR(dir)) {
+		jbd_debug(1, "fast commit: dir %u not found\n",
+			  le32_to_cpu(darg.fc_parent_ino));
+		return 0;
+	}
+
+	if (tag == EXT4_FC_TAG_UNLINK) {
+		ret = ext4_fc_replay_unlink_entry(dir, &name,
+						  le32_to_cpu(darg.fc_ino));
+	} else {
+		inode = ext4_iget(sb, le32_to_cpu(darg.fc_ino));
+		if (IS_ERR(inode)) {
+			iput(dir);
+			return 0;
+		}
+		ret = ext4_fc_replay_link_entry(dir, inode, &name);
+		iput(inode);
+	}
+	iput(dir);
+	return ret;
+}
+
+/**
+ * ext4_fc_replay() - jbd2 callback to replay the fast commit area
+ * @journal:		journal of the filesystem
+ * @bh:			a block of the fast commit area
+ * @pass:		PASS_SCAN or PASS_REPLAY
+ * @off:		index of @bh in the area
+ * @expected_tid:	the transaction the fast commits must belong to
+ *
+ * Returns JBD2_FC_REPLAY_CONTINUE to get the next block, or
+ * JBD2_FC_REPLAY_STOP past the last record to replay, or an error.
+ */
+int ext4_fc_replay(journal_t *journal, struct buffer_head *bh,
+		   enum passtype pass, int off, tid_t expected_tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_replay_state *state = &sbi->s_fc_replay_state;
+	u8 *start = (u8 *)bh->b_data, *end = start + journal->j_blocksize;
+	struct ext4_fc_tl tl;
+	u8 *cur, *val;
+	int tag, len, ret;
+
+	if (pass == PASS_SCAN)
+		return ext4_fc_replay_scan(journal, bh, off, expected_tid);
+	if (pass != PASS_REPLAY)
+		return JBD2_FC_REPLAY_STOP;
+
+	if (off == 0) {
+		state->fc_cur_tag = 0;
+		if (!state->fc_replay_num_tags)
+			return JBD2_FC_REPLAY_STOP;
+		ext4_msg(sb, KERN_INFO, "replaying fast commits");
+		sbi->s_mount_state |= EXT4_FC_REPLAY;
+		state->fc_was_ro = !!(sb->s_flags & MS_RDONLY);
+		sb->s_flags &= ~MS_RDONLY;
+	}
+
+	for (cur = start; cur + sizeof(tl) <= end; cur = val + len) {
+		if (state->fc_cur_tag >= state->fc_replay_num_tags)
+			return JBD2_FC_REPLAY_STOP;
+		memcpy(&tl, cur, sizeof(tl));
+		tag = le16_to_cpu(tl.fc_tag);
+		len = le16_to_cpu(tl.fc_len);
+		val = cur + sizeof(tl);
+		if (tag == EXT4_FC_TAG_PAD)
+			return JBD2_FC_REPLAY_CONTINUE;
+		state->fc_cur_tag++;
+
+		switch (tag) {
+		case EXT4_FC_TAG_INODE:
+			ret = ext4_fc_replay_inode(sb, val, len);
+			break;
+		case EXT4_FC_TAG_ADD_RANGE:
+			ret = ext4_fc_replay_add_range(sb, val);
+			break;
+		case EXT4_FC_TAG_DEL_RANGE:
+			ret = ext4_fc_replay_del_range(sb, val);
+			break;
+		case EXT4_FC_TAG_CREAT:
+		case EXT4_FC_TAG_LINK:
+		case EXT4_FC_TAG_UNLINK:
+			ret = ext4_fc_replay_dentry(sb, tag, val, len);
+			break;
+		default:
+			ret = 0;
+			break;
+		}
+		if (ret < 0) {
+			ext4_msg(sb, KERN_ERR, "fast commit replay failed: "
+				 "tag %d, error %d", tag, ret);
+			return ret;
+		}
+	}
+	return JBD2_FC_REPLAY_CONTINUE;
+}
+
+/* Called once the journal is loaded, whether there was a replay or not */
+void ext4_fc_replay_cleanup(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_replay_state *state = &sbi->s_fc_replay_state;
+
+	if (sbi->s_mount_state & EXT4_FC_REPLAY) {
+		sbi->s_mount_state &= ~EXT4_FC_REPLAY;
+		if (state->fc_was_ro)
+			sb->s_flags |= MS_RDONLY;
+	}
+	kfree(state->fc_regions);
+	memset(state, 0, sizeof(*state));
+}
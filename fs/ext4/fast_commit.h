@@ -0,0 +1,100 @@
+/*
+ *  fs/ext4/fast_commit.h
+ *
+ * On-disk format of ext4 fast commits, and their in-memory state.
+ */
+
+#ifndef _EXT4_FAST_COMMIT_H
+#define _EXT4_FAST_COMMIT_H
+
+/*
+ * A fast commit is a series of records, each a struct ext4_fc_tl followed
+ * by fc_len bytes of value, written to the fast commit area of the
+ * journal. It opens with EXT4_FC_TAG_HEAD when it is the first one after
+ * a full commit, and closes with EXT4_FC_TAG_TAIL. A record never spans
+ * two blocks: the end of a block is padded with EXT4_FC_TAG_PAD.
+ */
+#define EXT4_FC_TAG_ADD_RANGE	0x0001
+#define EXT4_FC_TAG_DEL_RANGE	0x0002
+#define EXT4_FC_TAG_CREAT	0x0003
+#define EXT4_FC_TAG_LINK	0x0004
+#define EXT4_FC_TAG_UNLINK	0x0005
+#define EXT4_FC_TAG_INODE	0x0006
+#define EXT4_FC_TAG_PAD		0x0007
+#define EXT4_FC_TAG_TAIL	0x0008
+#define EXT4_FC_TAG_HEAD	0x0009
+
+/* Features of the fast commit format, none yet */
+#define EXT4_FC_SUPPORTED_FEATURES	0x0
+
+struct ext4_fc_tl {
+	__le16 fc_tag;
+	__le16 fc_len;
+};
+
+/* EXT4_FC_TAG_HEAD: the transaction the fast commits belong to */
+struct ext4_fc_head {
+	__le32 fc_features;
+	__le32 fc_tid;
+};
+
+/* EXT4_FC_TAG_ADD_RANGE: an extent to map into the inode */
+struct ext4_fc_add_range {
+	__le32 fc_ino;
+	__u8 fc_ex[12];		/* struct ext4_extent */
+};
+
+/* EXT4_FC_TAG_DEL_RANGE: logical blocks to unmap from the inode */
+struct ext4_fc_del_range {
+	__le32 fc_ino;
+	__le32 fc_lblk;
+	__le32 fc_len;
+};
+
+/* EXT4_FC_TAG_CREAT, _LINK and _UNLINK: the name follows */
+struct ext4_fc_dentry_info {
+	__le32 fc_parent_ino;
+	__le32 fc_ino;
+	__u8 fc_dname[0];
+};
+
+/* EXT4_FC_TAG_INODE: the raw inode follows */
+struct ext4_fc_inode {
+	__le32 fc_ino;
+	__u8 fc_raw_inode[0];
+};
+
+/* EXT4_FC_TAG_TAIL: crc32 of the records since the last tail */
+struct ext4_fc_tail {
+	__le32 fc_tid;
+	__le32 fc_crc;
+};
+
+/* A directory entry change, queued in s_fc_dentry_q */
+struct ext4_fc_dentry_update {
+	struct list_head fcd_list;
+	int fcd_op;			/* EXT4_FC_TAG_CREAT, ... */
+	tid_t fcd_tid;
+	__u32 fcd_parent;
+	__u32 fcd_ino;
+	unsigned int fcd_len;
+	unsigned char fcd_name[0];
+};
+
+/* Blocks which a fast commit being replayed maps */
+struct ext4_fc_alloc_region {
+	ext4_fsblk_t pblk;
+	unsigned int len;
+};
+
+struct ext4_fc_replay_state {
+	int fc_replay_num_tags;		/* records found valid by PASS_SCAN */
+	int fc_replay_expected_off;	/* next block PASS_SCAN expects */
+	int fc_cur_tag;			/* records seen in the current pass */
+	u32 fc_crc;			/* of the records since the last tail */
+	int fc_was_ro;			/* MS_RDONLY cleared for the replay */
+	struct ext4_fc_alloc_region *fc_regions;
+	int fc_regions_size, fc_regions_used, fc_regions_valid;
+};
+
+#endif /* _EXT4_FAST_COMMIT_H */
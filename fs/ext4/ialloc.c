@@ -77,9 +77,13 @@ static unsigned ext4_init_inode_bitmap(struct super_block *sb,
 	 * allocation, essentially implementing a per-group read-only flag. */
 	if (!ext4_group_desc_csum_verify(sb, block_group, gdp)) {
 		ext4_error(sb, "Checksum bad for group %u", block_group);
-		grp = ext4_get_group_info(sb, block_group);
-		set_bit(EXT4_GROUP_INFO_BBITMAP_CORRUPT_BIT, &grp->bb_state);
-		set_bit(EXT4_GROUP_INFO_IBITMAP_CORRUPT_BIT, &grp->bb_state);
+		grp = ext4_bitmap_group_info(sb, block_group);
+		if (grp) {
+			set_bit(EXT4_GROUP_INFO_BBITMAP_CORRUPT_BIT,
+				&grp->bb_state);
+			set_bit(EXT4_GROUP_INFO_IBITMAP_CORRUPT_BIT,
+				&grp->bb_state);
+		}
 		return 0;
 	}
 
@@ -184,8 +188,10 @@ verify:
 		put_bh(bh);
 		ext4_error(sb, "Corrupt inode bitmap - block_group = %u, "
 			   "inode_bitmap = %llu", block_group, bitmap_blk);
-		grp = ext4_get_group_info(sb, block_group);
-		set_bit(EXT4_GROUP_INFO_IBITMAP_CORRUPT_BIT, &grp->bb_state);
+		grp = ext4_bitmap_group_info(sb, block_group);
+		if (grp)
+			set_bit(EXT4_GROUP_INFO_IBITMAP_CORRUPT_BIT,
+				&grp->bb_state);
 		return NULL;
 	}
 	ext4_unlock_group(sb, block_group);
@@ -1058,6 +1064,83 @@ out:
 	return ERR_PTR(err);
 }
 
+/*
+ * Mark inode @ino in use, for the fast commit replay of an inode created
+ * after the last full commit.  Returns 1 if it was free, 0 if it was in use
+ * already.  The percpu counters are set from the group descriptors only
+ * after the journal is loaded, so they are left alone.
+ */
+int ext4_mark_inode_used(struct super_block *sb, unsigned long ino,
+			 umode_t mode)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct buffer_head *inode_bitmap_bh = NULL, *group_desc_bh;
+	struct ext4_group_desc *gdp;
+	ext4_group_t group;
+	unsigned long bit;
+	int err = -EIO;
+
+	if (ino < EXT4_FIRST_INO(sb) ||
+	    ino > le32_to_cpu(sbi->s_es->s_inodes_count))
+		return -EIO;
+
+	group = (ino - 1) / EXT4_INODES_PER_GROUP(sb);
+	bit = (ino - 1) % EXT4_INODES_PER_GROUP(sb);
+	inode_bitmap_bh = ext4_read_inode_bitmap(sb, group);
+	if (!inode_bitmap_bh)
+		return -EIO;
+
+	if (ext4_test_bit(bit, inode_bitmap_bh->b_data)) {
+		err = 0;
+		goto out;
+	}
+
+	gdp = ext4_get_group_desc(sb, group, &group_desc_bh);
+	if (!gdp)
+		goto out;
+
+	ext4_lock_group(sb, group);
+	ext4_set_bit(bit, inode_bitmap_bh->b_data);
+	if (ext4_has_group_desc_csum(sb)) {
+		int free = EXT4_INODES_PER_GROUP(sb) -
+			ext4_itable_unused_count(sb, gdp);
+
+		if (gdp->bg_flags & cpu_to_le16(EXT4_BG_INODE_UNINIT)) {
+			gdp->bg_flags &= cpu_to_le16(~EXT4_BG_INODE_UNINIT);
+			free = 0;
+		}
+		if (bit + 1 > free)
+			ext4_itable_unused_set(sb, gdp,
+					EXT4_INODES_PER_GROUP(sb) - bit - 1);
+	}
+	ext4_free_inodes_set(sb, gdp, ext4_free_inodes_count(sb, gdp) - 1);
+	if (S_ISDIR(mode))
+		ext4_used_dirs_set(sb, gdp, ext4_used_dirs_count(sb, gdp) + 1);
+	if (ext4_has_group_desc_csum(sb)) {
+		ext4_inode_bitmap_csum_set(sb, group, gdp, inode_bitmap_bh,
+					   EXT4_INODES_PER_GROUP(sb) / 8);
+		ext4_group_desc_csum_set(sb, group, gdp);
+	}
+	ext4_unlock_group(sb, group);
+
+	if (sbi->s_log_groups_per_flex) {
+		ext4_group_t f = ext4_flex_group(sbi, group);
+
+		atomic_dec(&sbi->s_flex_groups[f].free_inodes);
+		if (S_ISDIR(mode))
+			atomic_inc(&sbi->s_flex_groups[f].used_dirs);
+	}
+
+	err = ext4_handle_dirty_metadata(NULL, NULL, inode_bitmap_bh);
+	if (!err)
+		err = ext4_handle_dirty_metadata(NULL, NULL, group_desc_bh);
+	if (!err)
+		err = 1;
+out:
+	brelse(inode_bitmap_bh);
+	return err;
+}
+
 /* Verify that we are loading a valid orphan from disk */
 struct inode *ext4_orphan_get(struct super_block *sb, unsigned long ino)
 {
@@ -116,6 +116,43 @@ static void ext4_inode_csum_set(struct inode *inode, struct ext4_inode *raw,
 		raw->i_checksum_hi = cpu_to_le16(csum >> 16);
 }
 
+/*
+ * Set the checksum of on-disk inode @ino, which has no in-memory inode: for
+ * the fast commit replay, which writes inodes out directly.
+ */
+void ext4_raw_inode_csum_set(struct super_block *sb, unsigned long ino,
+			     struct ext4_inode *raw)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	__le32 inum = cpu_to_le32(ino);
+	int has_hi = 0;
+	__u32 csum;
+
+	if (sbi->s_es->s_creator_os != cpu_to_le32(EXT4_OS_LINUX) ||
+	    !EXT4_HAS_RO_COMPAT_FEATURE(sb,
+		EXT4_FEATURE_RO_COMPAT_METADATA_CSUM))
+		return;
+
+	if (EXT4_INODE_SIZE(sb) > EXT4_GOOD_OLD_INODE_SIZE)
+		has_hi = EXT4_GOOD_OLD_INODE_SIZE +
+			le16_to_cpu(raw->i_extra_isize) >=
+			offsetof(struct ext4_inode, i_checksum_hi) +
+			sizeof(raw->i_checksum_hi);
+
+	raw->i_checksum_lo = 0;
+	if (has_hi)
+		raw->i_checksum_hi = 0;
+	csum = ext4_chksum(sbi, sbi->s_csum_seed, (__u8 *)&inum,
+			   sizeof(inum));
+	csum = ext4_chksum(sbi, csum, (__u8 *)&raw->i_generation,
+			   sizeof(raw->i_generation));
+	csum = ext4_chksum(sbi, csum, (__u8 *)raw, EXT4_INODE_SIZE(sb));
+
+	raw->i_checksum_lo = cpu_to_le16(csum & 0xFFFF);
+	if (has_hi)
+		raw->i_checksum_hi = cpu_to_le16(csum >> 16);
+}
+
 static inline int ext4_begin_ordered_truncate(struct inode *inode,
 					      loff_t new_size)
 {
@@ -251,6 +288,8 @@ void ext4_evict_inode(struct inode *inode)
 		goto no_delete;
 	}
 
+	/* Fast commits do not record inodes being freed */
+	ext4_fc_mark_ineligible(inode->i_sb, handle);
 	if (IS_SYNC(inode))
 		ext4_handle_sync(handle);
 	inode->i_size = 0;
@@ -702,6 +741,8 @@ found:
 
 has_zeroout:
 	up_write((&EXT4_I(inode)->i_data_sem));
+	if (retval > 0)
+		ext4_fc_track_range(handle, inode, map->m_lblk, map->m_len);
 	if (retval > 0 && map->m_flags & EXT4_MAP_MAPPED) {
 		ret = check_block_validity(inode, map);
 		if (ret != 0)
@@ -980,6 +1021,12 @@ retry_journal:
 		page_cache_release(page);
 		return PTR_ERR(handle);
 	}
+	/*
+	 * Blocks allocated here, in place of delalloc, are mapped before
+	 * their data is written: fast commits would not wait for it.
+	 */
+	if (test_opt(inode->i_sb, DELALLOC))
+		ext4_fc_mark_ineligible(inode->i_sb, handle);
 
 	lock_page(page);
 	if (page->mapping != mapping) {
@@ -3168,13 +3215,17 @@ static ssize_t ext4_ext_direct_IO(int rw, struct kiocb *iocb,
 		get_block_func = ext4_get_block_write;
 		dio_flags = DIO_LOCKING;
 	}
-	ret = __blockdev_direct_IO(rw, iocb, inode,
-				   inode->i_sb->s_bdev, iov,
-				   offset, nr_segs,
-				   get_block_func,
-				   ext4_end_io_dio,
-				   NULL,
-				   dio_flags);
+	if (IS_DAX(inode))
+		ret = dax_do_io(rw, iocb, inode, iov, offset, nr_segs,
+				get_block_func, ext4_end_io_dio, dio_flags);
+	else
+		ret = __blockdev_direct_IO(rw, iocb, inode,
+					   inode->i_sb->s_bdev, iov,
+					   offset, nr_segs,
+					   get_block_func,
+					   ext4_end_io_dio,
+					   NULL,
+					   dio_flags);
 
 	/*
 	 * Put our reference to io_end. This can free the io_end structure e.g.
@@ -3358,11 +3409,6 @@ static int ext4_block_zero_page_range(handle_t *handle,
 	struct page *page;
 	int err = 0;
 
-	page = find_or_create_page(mapping, from >> PAGE_CACHE_SHIFT,
-				   mapping_gfp_mask(mapping) & ~__GFP_FS);
-	if (!page)
-		return -ENOMEM;
-
 	blocksize = inode->i_sb->s_blocksize;
 	max = blocksize - (offset & (blocksize - 1));
 
@@ -3373,6 +3419,16 @@ static int ext4_block_zero_page_range(handle_t *handle,
 	if (length > max || length < 0)
 		length = max;
 
+	/* DAX files have no page cache, zero the storage itself */
+	if (IS_DAX(inode))
+		return dax_zero_page_range(inode, from, length,
+					   ext4_get_block);
+
+	page = find_or_create_page(mapping, from >> PAGE_CACHE_SHIFT,
+				   mapping_gfp_mask(mapping) & ~__GFP_FS);
+	if (!page)
+		return -ENOMEM;
+
 	iblock = index << (PAGE_CACHE_SHIFT - inode->i_sb->s_blocksize_bits);
 
 	if (!page_has_buffers(page))
@@ -3624,6 +3680,9 @@ int ext4_punch_hole(struct inode *inode, loff_t offset, loff_t length)
 					    stop_block);
 
 	up_write(&EXT4_I(inode)->i_data_sem);
+	if (!ret)
+		ext4_fc_track_range(handle, inode, first_block,
+				    stop_block - first_block);
 	if (IS_SYNC(inode))
 		ext4_handle_sync(handle);
 
@@ -3702,6 +3761,7 @@ void ext4_truncate(struct inode *inode)
 	unsigned int credits;
 	handle_t *handle;
 	struct address_space *mapping = inode->i_mapping;
+	ext4_lblk_t last_block;
 
 	/*
 	 * There is a possibility that we're either freeing the inode
@@ -3771,6 +3831,11 @@ void ext4_truncate(struct inode *inode)
 
 	up_write(&ei->i_data_sem);
 
+	last_block = (inode->i_size + inode->i_sb->s_blocksize - 1) >>
+		EXT4_BLOCK_SIZE_BITS(inode->i_sb);
+	ext4_fc_track_range(handle, inode, last_block,
+			    EXT_MAX_BLOCKS - last_block);
+
 	if (IS_SYNC(inode))
 		ext4_handle_sync(handle);
 
@@ -3957,8 +4022,11 @@ void ext4_set_inode_flags(struct inode *inode)
 		new_fl |= S_NOATIME;
 	if (flags & EXT4_DIRSYNC_FL)
 		new_fl |= S_DIRSYNC;
+	if (test_opt(inode->i_sb, DAX) && S_ISREG(inode->i_mode) &&
+	    !(flags & EXT4_JOURNAL_DATA_FL))
+		new_fl |= S_DAX;
 	inode_set_flags(inode, new_fl,
-			S_SYNC|S_APPEND|S_IMMUTABLE|S_NOATIME|S_DIRSYNC);
+			S_SYNC|S_APPEND|S_IMMUTABLE|S_NOATIME|S_DIRSYNC|S_DAX);
 }
 
 /* Propagate flags from i_flags to EXT4_I(inode)->i_flags */
@@ -4121,7 +4189,7 @@ struct inode *ext4_iget(struct super_block *sb, unsigned long ino)
 	if (EXT4_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_64BIT))
 		ei->i_file_acl |=
 			((__u64)le16_to_cpu(raw_inode->i_file_acl_high)) << 32;
-	inode->i_size = ext4_isize(raw_inode);
+	inode->i_size = ext4_isize(sb, raw_inode);
 	ei->i_disksize = inode->i_size;
 #ifdef CONFIG_QUOTA
 	ei->i_reserved_quota = 0;
@@ -4357,7 +4425,7 @@ static int ext4_do_update_inode(handle_t *handle,
 		raw_inode->i_file_acl_high =
 			cpu_to_le16(ei->i_file_acl >> 32);
 	raw_inode->i_file_acl_lo = cpu_to_le32(ei->i_file_acl);
-	if (ei->i_disksize != ext4_isize(raw_inode)) {
+	if (ei->i_disksize != ext4_isize(inode->i_sb, raw_inode)) {
 		ext4_isize_set(raw_inode, ei->i_disksize);
 		need_datasync = 1;
 	}
@@ -4968,6 +5036,8 @@ int ext4_mark_inode_dirty(handle_t *handle, struct inode *inode)
 	}
 	if (!err)
 		err = ext4_mark_iloc_dirty(handle, inode, &iloc);
+	if (!err)
+		ext4_fc_track_inode(handle, inode);
 	return err;
 }
 
@@ -5094,6 +5164,7 @@ int ext4_change_inode_journal_flag(struct inode *inode, int val)
 	if (IS_ERR(handle))
 		return PTR_ERR(handle);
 
+	ext4_fc_mark_ineligible(inode->i_sb, handle);
 	err = ext4_mark_inode_dirty(handle, inode);
 	ext4_handle_sync(handle);
 	ext4_journal_stop(handle);
@@ -5174,6 +5245,9 @@ retry_alloc:
 		ret = VM_FAULT_SIGBUS;
 		goto out;
 	}
+	/* As in ext4_write_begin() */
+	if (test_opt(inode->i_sb, DELALLOC))
+		ext4_fc_mark_ineligible(inode->i_sb, handle);
 	ret = __block_page_mkwrite(vma, vmf, get_block);
 	if (!ret && ext4_should_journal_data(inode)) {
 		if (ext4_walk_page_buffers(handle, page_buffers(page), 0,
@@ -260,6 +260,11 @@ long ext4_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		if ((jflag ^ oldflags) & (EXT4_JOURNAL_DATA_FL)) {
 			if (!capable(CAP_SYS_RESOURCE))
 				goto flags_out;
+			/* that would switch S_DAX under open files */
+			if (test_opt(inode->i_sb, DAX)) {
+				err = -EOPNOTSUPP;
+				goto flags_out;
+			}
 		}
 		if ((flags ^ oldflags) & EXT4_EXTENTS_FL)
 			migrate = 1;
@@ -703,18 +703,74 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int old = grp->bb_largest_free_order;
+	int new = -1; /* uninit */
 	int i;
-	int bits;
-
-	grp->bb_largest_free_order = -1; /* uninit */
 
-	bits = sb->s_blocksize_bits + 1;
-	for (i = bits; i >= 0; i--) {
+	for (i = MB_NUM_ORDERS(sb) - 1; i >= 0; i--) {
 		if (grp->bb_counters[i] > 0) {
-			grp->bb_largest_free_order = i;
+			new = i;
 			break;
 		}
 	}
+	if (new == old)
+		return;
+
+	/* keep the group on the list for its order, see ext4_mb_pick_groups */
+	if (old >= 0) {
+		write_lock(&sbi->s_mb_largest_free_orders_locks[old]);
+		list_del_init(&grp->bb_largest_free_order_node);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[old]);
+	}
+	grp->bb_largest_free_order = new;
+	if (new >= 0) {
+		write_lock(&sbi->s_mb_largest_free_orders_locks[new]);
+		list_add_tail(&grp->bb_largest_free_order_node,
+			      &sbi->s_mb_largest_free_orders[new]);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[new]);
+	}
+}
+
+static int mb_avg_fragment_size_order(struct super_block *sb,
+				      ext4_grpblk_t len)
+{
+	int order = fls(len) - 1;
+
+	if (order < 0)
+		return 0;
+	return min(order, MB_NUM_ORDERS(sb) - 1);
+}
+
+/*
+ * Move the group to the list for the order of its average fragment size,
+ * as its free space or number of fragments changed.
+ */
+static void
+mb_update_avg_fragment_size(struct super_block *sb, struct ext4_group_info *grp)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int old = grp->bb_avg_fragment_size_order;
+	int new = -1;
+
+	if (grp->bb_fragments && grp->bb_free)
+		new = mb_avg_fragment_size_order(sb,
+					grp->bb_free / grp->bb_fragments);
+	if (new == old)
+		return;
+
+	if (old >= 0) {
+		write_lock(&sbi->s_mb_avg_fragment_size_locks[old]);
+		list_del_init(&grp->bb_avg_fragment_size_node);
+		write_unlock(&sbi->s_mb_avg_fragment_size_locks[old]);
+	}
+	grp->bb_avg_fragment_size_order = new;
+	if (new >= 0) {
+		write_lock(&sbi->s_mb_avg_fragment_size_locks[new]);
+		list_add_tail(&grp->bb_avg_fragment_size_node,
+			      &sbi->s_mb_avg_fragment_size[new]);
+		write_unlock(&sbi->s_mb_avg_fragment_size_locks[new]);
+	}
 }
 
 static noinline_for_stack
@@ -762,6 +818,7 @@ void ext4_mb_generate_buddy(struct super_block *sb,
 		set_bit(EXT4_GROUP_INFO_BBITMAP_CORRUPT_BIT, &grp->bb_state);
 	}
 	mb_set_largest_free_order(sb, grp);
+	mb_update_avg_fragment_size(sb, grp);
 
 	clear_bit(EXT4_GROUP_INFO_NEED_INIT_BIT, &(grp->bb_state));
 
@@ -1472,6 +1529,7 @@ static void mb_free_blocks(struct inode *inode, struct ext4_buddy *e4b,
 
 done:
 	mb_set_largest_free_order(sb, e4b->bd_info);
+	mb_update_avg_fragment_size(sb, e4b->bd_info);
 	mb_check_buddy(e4b);
 }
 
@@ -1596,6 +1654,7 @@ static int mb_mark_used(struct ext4_buddy *e4b, struct ext4_free_extent *ex)
 		e4b->bd_info->bb_counters[ord]++;
 	}
 	mb_set_largest_free_order(e4b->bd_sb, e4b->bd_info);
+	mb_update_avg_fragment_size(e4b->bd_sb, e4b->bd_info);
 
 	ext4_set_bits(e4b->bd_bitmap, ex->fe_start, len0);
 	mb_check_buddy(e4b);
@@ -2061,6 +2120,116 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * Look for the extent in @group with criteria @cr, if the group looks good
+ * enough. ac->ac_status tells whether the search is over.
+ */
+static int ext4_mb_scan_group(struct ext4_allocation_context *ac,
+			      ext4_group_t group, int cr)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_buddy e4b;
+	int err;
+
+	/* This now checks without needing the buddy page */
+	if (!ext4_mb_good_group(ac, group, cr))
+		return 0;
+
+	err = ext4_mb_load_buddy(sb, group, &e4b);
+	if (err)
+		return err;
+
+	ext4_lock_group(sb, group);
+
+	/*
+	 * We need to check again after locking the
+	 * block group
+	 */
+	if (!ext4_mb_good_group(ac, group, cr))
+		goto out_unlock;
+
+	ac->ac_groups_scanned++;
+	if (cr == 0 && ac->ac_2order < sb->s_blocksize_bits+2)
+		ext4_mb_simple_scan_group(ac, &e4b);
+	else if (cr == 1 && sbi->s_stripe &&
+			!(ac->ac_g_ex.fe_len % sbi->s_stripe))
+		ext4_mb_scan_aligned(ac, &e4b);
+	else
+		ext4_mb_complex_scan_group(ac, &e4b);
+
+out_unlock:
+	ext4_unlock_group(sb, group);
+	ext4_mb_unload_buddy(&e4b);
+	return 0;
+}
+
+static bool ext4_mb_should_optimize_scan(struct ext4_allocation_context *ac)
+{
+	struct super_block *sb = ac->ac_sb;
+
+	if (!EXT4_SB(sb)->s_mb_optimize_scan)
+		return false;
+	/* the lists know nothing of the groups non-extent files may use */
+	if (!ext4_test_inode_flag(ac->ac_inode, EXT4_INODE_EXTENTS))
+		return false;
+	return ext4_get_groups_count(sb) >= MB_DEFAULT_LINEAR_SCAN_THRESHOLD;
+}
+
+/*
+ * Pick up to MB_OPTIMIZE_SCAN_GROUPS groups good for criteria @cr from the
+ * lists: for criteria 0, those whose largest free extent is of the order of
+ * the request or more; for criteria 1, those whose average fragment is at
+ * least as long as the request. Smallest orders first, to keep the large
+ * extents for the requests which need them. Only initialized groups are on
+ * the lists: the others are left to the linear scans of criteria 2 and 3.
+ */
+static int ext4_mb_pick_groups(struct ext4_allocation_context *ac, int cr,
+			       ext4_group_t ngroups, ext4_group_t *groups)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_group_info *grp;
+	struct list_head *lists, *pos;
+	rwlock_t *locks;
+	int i, nr = 0;
+
+	if (cr == 0) {
+		lists = sbi->s_mb_largest_free_orders;
+		locks = sbi->s_mb_largest_free_orders_locks;
+		i = ac->ac_2order;
+	} else {
+		lists = sbi->s_mb_avg_fragment_size;
+		locks = sbi->s_mb_avg_fragment_size_locks;
+		i = mb_avg_fragment_size_order(sb, ac->ac_g_ex.fe_len);
+	}
+
+	for (; i < MB_NUM_ORDERS(sb) && nr < MB_OPTIMIZE_SCAN_GROUPS; i++) {
+		if (list_empty(&lists[i]))
+			continue;
+		read_lock(&locks[i]);
+		list_for_each(pos, &lists[i]) {
+			if (cr == 0)
+				grp = list_entry(pos, struct ext4_group_info,
+						 bb_largest_free_order_node);
+			else
+				grp = list_entry(pos, struct ext4_group_info,
+						 bb_avg_fragment_size_node);
+			/* still being initialized */
+			if (EXT4_MB_GRP_NEED_INIT(grp))
+				continue;
+			if (grp->bb_group >= ngroups ||
+			    !ext4_mb_good_group(ac, grp->bb_group, cr))
+				continue;
+			groups[nr++] = grp->bb_group;
+			if (nr == MB_OPTIMIZE_SCAN_GROUPS)
+				break;
+		}
+		read_unlock(&locks[i]);
+	}
+	return nr;
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
@@ -2070,6 +2239,7 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 	struct ext4_sb_info *sbi;
 	struct super_block *sb;
 	struct ext4_buddy e4b;
+	bool optimize_scan;
 
 	sb = ac->ac_sb;
 	sbi = EXT4_SB(sb);
@@ -2119,6 +2289,7 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 
 	/* Let's just scan groups to find more-less suitable blocks */
 	cr = ac->ac_2order ? 0 : 1;
+	optimize_scan = ext4_mb_should_optimize_scan(ac);
 	/*
 	 * cr == 0 try to get exact allocation,
 	 * cr == 3  try to get anything
@@ -2126,6 +2297,23 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 repeat:
 	for (; cr < 4 && ac->ac_status == AC_STATUS_CONTINUE; cr++) {
 		ac->ac_criteria = cr;
+
+		if (optimize_scan && cr < 2) {
+			ext4_group_t groups[MB_OPTIMIZE_SCAN_GROUPS];
+			int nr;
+
+			nr = ext4_mb_pick_groups(ac, cr, ngroups, groups);
+			for (i = 0; i < nr; i++) {
+				cond_resched();
+				err = ext4_mb_scan_group(ac, groups[i], cr);
+				if (err)
+					goto out;
+				if (ac->ac_status != AC_STATUS_CONTINUE)
+					break;
+			}
+			continue;
+		}
+
 		/*
 		 * searching for the right group start
 		 * from the goal value specified
@@ -2141,38 +2329,10 @@ repeat:
 			if (group >= ngroups)
 				group = 0;
 
-			/* This now checks without needing the buddy page */
-			if (!ext4_mb_good_group(ac, group, cr))
-				continue;
-
-			err = ext4_mb_load_buddy(sb, group, &e4b);
+			err = ext4_mb_scan_group(ac, group, cr);
 			if (err)
 				goto out;
 
-			ext4_lock_group(sb, group);
-
-			/*
-			 * We need to check again after locking the
-			 * block group
-			 */
-			if (!ext4_mb_good_group(ac, group, cr)) {
-				ext4_unlock_group(sb, group);
-				ext4_mb_unload_buddy(&e4b);
-				continue;
-			}
-
-			ac->ac_groups_scanned++;
-			if (cr == 0 && ac->ac_2order < sb->s_blocksize_bits+2)
-				ext4_mb_simple_scan_group(ac, &e4b);
-			else if (cr == 1 && sbi->s_stripe &&
-					!(ac->ac_g_ex.fe_len % sbi->s_stripe))
-				ext4_mb_scan_aligned(ac, &e4b);
-			else
-				ext4_mb_complex_scan_group(ac, &e4b);
-
-			ext4_unlock_group(sb, group);
-			ext4_mb_unload_buddy(&e4b);
-
 			if (ac->ac_status != AC_STATUS_CONTINUE)
 				break;
 		}
@@ -2411,6 +2571,10 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
+	meta_group_info[i]->bb_avg_fragment_size_order = -1;  /* uninit */
+	meta_group_info[i]->bb_group = group;
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_avg_fragment_size_node);
 
 #ifdef DOUBLE_CHECK
 	{
@@ -2560,6 +2724,29 @@ int ext4_mb_init(struct super_block *sb)
 		goto out;
 	}
 
+	i = MB_NUM_ORDERS(sb);
+	sbi->s_mb_largest_free_orders =
+		kmalloc(i * sizeof(struct list_head), GFP_KERNEL);
+	sbi->s_mb_largest_free_orders_locks =
+		kmalloc(i * sizeof(rwlock_t), GFP_KERNEL);
+	sbi->s_mb_avg_fragment_size =
+		kmalloc(i * sizeof(struct list_head), GFP_KERNEL);
+	sbi->s_mb_avg_fragment_size_locks =
+		kmalloc(i * sizeof(rwlock_t), GFP_KERNEL);
+	if (!sbi->s_mb_largest_free_orders ||
+	    !sbi->s_mb_largest_free_orders_locks ||
+	    !sbi->s_mb_avg_fragment_size ||
+	    !sbi->s_mb_avg_fragment_size_locks) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < MB_NUM_ORDERS(sb); i++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[i]);
+		rwlock_init(&sbi->s_mb_largest_free_orders_locks[i]);
+		INIT_LIST_HEAD(&sbi->s_mb_avg_fragment_size[i]);
+		rwlock_init(&sbi->s_mb_avg_fragment_size_locks[i]);
+	}
+
 	ret = ext4_groupinfo_create_slab(sb->s_blocksize);
 	if (ret < 0)
 		goto out;
@@ -2587,6 +2774,7 @@ int ext4_mb_init(struct super_block *sb)
 	sbi->s_mb_stats = MB_DEFAULT_STATS;
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
 	/*
 	 * The default group preallocation is 512, which for 4k block
 	 * sizes translates to 2 megabytes.  However for bigalloc file
@@ -2645,6 +2833,14 @@ out_free_locality_groups:
 out_free_groupinfo_slab:
 	ext4_groupinfo_destroy_slabs();
 out:
+	kfree(sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = NULL;
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = NULL;
+	kfree(sbi->s_mb_avg_fragment_size);
+	sbi->s_mb_avg_fragment_size = NULL;
+	kfree(sbi->s_mb_avg_fragment_size_locks);
+	sbi->s_mb_avg_fragment_size_locks = NULL;
 	kfree(sbi->s_mb_offsets);
 	sbi->s_mb_offsets = NULL;
 	kfree(sbi->s_mb_maxs);
@@ -2700,6 +2896,10 @@ int ext4_mb_release(struct super_block *sb)
 			kfree(sbi->s_group_info[i]);
 		ext4_kvfree(sbi->s_group_info);
 	}
+	kfree(sbi->s_mb_largest_free_orders);
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	kfree(sbi->s_mb_avg_fragment_size);
+	kfree(sbi->s_mb_avg_fragment_size_locks);
 	kfree(sbi->s_mb_offsets);
 	kfree(sbi->s_mb_maxs);
 	if (sbi->s_buddy_cache)
@@ -4349,6 +4549,170 @@ static int ext4_mb_discard_preallocations(struct super_block *sb, int needed)
 	return freed;
 }
 
+/**
+ * ext4_mb_mark_bb() - mark blocks in use or free in the on-disk bitmaps
+ * @sb:		super block
+ * @block:	first block
+ * @len:	number of blocks
+ * @state:	1 to mark the blocks in use, 0 to mark them free
+ *
+ * For the fast commit replay, which runs before mballoc is set up: only
+ * the bitmaps and group descriptors are updated, without journal.  The
+ * percpu counters are set from the group descriptors after the journal is
+ * loaded.
+ */
+int ext4_mb_mark_bb(struct super_block *sb, ext4_fsblk_t block,
+		    int len, int state)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct buffer_head *bitmap_bh, *gd_bh;
+	struct ext4_group_desc *gdp;
+	ext4_group_t group;
+	ext4_grpblk_t blkoff;
+	int i, clen, count, changed, err;
+
+	while (len > 0) {
+		ext4_get_group_no_and_offset(sb, block, &group, &blkoff);
+		/* Stop at the end of the group */
+		count = min_t(int, len, EXT4_BLOCKS_PER_GROUP(sb) - blkoff);
+		clen = EXT4_NUM_B2C(sbi, count);
+
+		bitmap_bh = ext4_read_block_bitmap(sb, group);
+		if (!bitmap_bh)
+			return -EIO;
+		gdp = ext4_get_group_desc(sb, group, &gd_bh);
+		if (!gdp) {
+			brelse(bitmap_bh);
+			return -EIO;
+		}
+
+		ext4_lock_group(sb, group);
+		if (state &&
+		    (gdp->bg_flags & cpu_to_le16(EXT4_BG_BLOCK_UNINIT))) {
+			gdp->bg_flags &= cpu_to_le16(~EXT4_BG_BLOCK_UNINIT);
+			ext4_free_group_clusters_set(sb, gdp,
+				ext4_free_clusters_after_init(sb, group, gdp));
+		}
+		changed = 0;
+		for (i = 0; i < clen; i++) {
+			int bit = EXT4_B2C(sbi, blkoff) + i;
+
+			if (!!mb_test_bit(bit, bitmap_bh->b_data) == !!state)
+				continue;
+			if (state)
+				mb_set_bit(bit, bitmap_bh->b_data);
+			else
+				mb_clear_bit(bit, bitmap_bh->b_data);
+			changed++;
+		}
+		if (state)
+			changed = -changed;
+		ext4_free_group_clusters_set(sb, gdp,
+			ext4_free_group_clusters(sb, gdp) + changed);
+		ext4_block_bitmap_csum_set(sb, group, gdp, bitmap_bh);
+		ext4_group_desc_csum_set(sb, group, gdp);
+		ext4_unlock_group(sb, group);
+
+		if (sbi->s_log_groups_per_flex) {
+			ext4_group_t flex_group = ext4_flex_group(sbi, group);
+
+			atomic64_add(changed,
+				&sbi->s_flex_groups[flex_group].free_clusters);
+		}
+
+		err = ext4_handle_dirty_metadata(NULL, NULL, bitmap_bh);
+		if (!err)
+			err = ext4_handle_dirty_metadata(NULL, NULL, gd_bh);
+		brelse(bitmap_bh);
+		if (err)
+			return err;
+
+		block += count;
+		len -= count;
+	}
+	return 0;
+}
+
+/*
+ * Block allocation for the fast commit replay: the first free block from
+ * the goal on, one at a time, that no fast commit still to be replayed
+ * claims.  The only callers then are the extent tree and directory code,
+ * which ask for metadata blocks.
+ */
+static ext4_fsblk_t ext4_mb_new_blocks_simple(handle_t *handle,
+				struct ext4_allocation_request *ar, int *errp)
+{
+	struct super_block *sb = ar->inode->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	ext4_group_t group, ngroups = ext4_get_groups_count(sb);
+	struct buffer_head *bitmap_bh;
+	ext4_fsblk_t goal, blk, block = 0;
+	ext4_grpblk_t blkoff, i, max;
+	ext4_group_t n;
+
+	goal = ar->goal;
+	if (goal < le32_to_cpu(sbi->s_es->s_first_data_block) ||
+	    goal >= ext4_blocks_count(sbi->s_es))
+		goal = le32_to_cpu(sbi->s_es->s_first_data_block);
+	ext4_get_group_no_and_offset(sb, goal, &group, &blkoff);
+
+	for (n = 0; n < ngroups && !block; n++) {
+		bitmap_bh = ext4_read_block_bitmap(sb, group);
+		if (!bitmap_bh) {
+			*errp = -EIO;
+			return 0;
+		}
+		max = EXT4_CLUSTERS_PER_GROUP(sb);
+		i = EXT4_B2C(sbi, blkoff);
+		while (1) {
+			i = mb_find_next_zero_bit(bitmap_bh->b_data, max, i);
+			if (i >= max)
+				break;
+			blk = ext4_group_first_block_no(sb, group) +
+				EXT4_C2B(sbi, i);
+			if (!ext4_fc_replay_check_excluded(sb, blk)) {
+				block = blk;
+				break;
+			}
+			i++;
+		}
+		brelse(bitmap_bh);
+		if (++group == ngroups)
+			group = 0;
+		blkoff = 0;
+	}
+
+	if (!block) {
+		*errp = -ENOSPC;
+		return 0;
+	}
+
+	*errp = ext4_mb_mark_bb(sb, block, 1, 1);
+	if (*errp)
+		return 0;
+	ar->len = 1;
+	dquot_alloc_block_nofail(ar->inode, 1);
+	return block;
+}
+
+/*
+ * And freeing, for the fast commit replay: the freed blocks may be used
+ * again at once, as there is no transaction for them to wait for.
+ */
+static void ext4_free_blocks_simple(struct inode *inode, ext4_fsblk_t block,
+				    unsigned long count, int flags)
+{
+	int err;
+
+	err = ext4_mb_mark_bb(inode->i_sb, block, count, 0);
+	if (err) {
+		ext4_std_error(inode->i_sb, err);
+		return;
+	}
+	if (!(flags & EXT4_FREE_BLOCKS_NO_QUOT_UPDATE))
+		dquot_free_block(inode, count);
+}
+
 /*
  * Main entry point into mballoc to allocate blocks
  * it tries to use preallocation first, then falls back
@@ -4369,6 +4733,9 @@ ext4_fsblk_t ext4_mb_new_blocks(handle_t *handle,
 	sb = ar->inode->i_sb;
 	sbi = EXT4_SB(sb);
 
+	if (unlikely(sbi->s_mount_state & EXT4_FC_REPLAY))
+		return ext4_mb_new_blocks_simple(handle, ar, errp);
+
 	trace_ext4_request_blocks(ar);
 
 	/* Allow to use superuser reservation for quota file */
@@ -4660,6 +5027,11 @@ void ext4_free_blocks(handle_t *handle, struct inode *inode,
 		}
 	}
 
+	if (unlikely(sbi->s_mount_state & EXT4_FC_REPLAY)) {
+		ext4_free_blocks_simple(inode, block, count, flags);
+		return;
+	}
+
 	/*
 	 * We need to make sure we don't reuse the freed block until
 	 * after the transaction is committed, which we can do by
@@ -89,6 +89,21 @@ extern ushort ext4_mballoc_debug;
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * with 'mb_optimize_scan', criteria 0 and 1 take the groups to try from
+ * lists of groups by their largest free extent and average fragment size,
+ * rather than going through the groups in turn, on file systems with at
+ * least MB_DEFAULT_LINEAR_SCAN_THRESHOLD groups; and try at most
+ * MB_OPTIMIZE_SCAN_GROUPS of them before moving on to the next criteria.
+ * You can tune it via /sys/fs/ext4/<partition>/mb_optimize_scan
+ */
+#define MB_DEFAULT_OPTIMIZE_SCAN		1
+#define MB_DEFAULT_LINEAR_SCAN_THRESHOLD	16
+#define MB_OPTIMIZE_SCAN_GROUPS			8
+
+/* Number of buddy orders, the bitmap itself included */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
 
 struct ext4_free_data {
 	/* MUST be the first member */
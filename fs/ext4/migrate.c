@@ -467,6 +467,7 @@ int ext4_ext_migrate(struct inode *inode)
 		retval = PTR_ERR(handle);
 		return retval;
 	}
+	ext4_fc_mark_ineligible(inode->i_sb, handle);
 	goal = (((inode->i_ino - 1) / EXT4_INODES_PER_GROUP(inode->i_sb)) *
 		EXT4_INODES_PER_GROUP(inode->i_sb)) + 1;
 	owner[0] = i_uid_read(inode);
@@ -568,6 +569,7 @@ err_out:
 		 */
 		free_ext_block(handle, tmp_inode);
 	else {
+		ext4_fc_mark_ineligible(inode->i_sb, handle);
 		retval = ext4_ext_swap_inode_data(handle, inode, tmp_inode);
 		if (retval)
 			/*
@@ -632,6 +634,7 @@ int ext4_ind_migrate(struct inode *inode)
 	handle = ext4_journal_start(inode, EXT4_HT_MIGRATE, 1);
 	if (IS_ERR(handle))
 		return PTR_ERR(handle);
+	ext4_fc_mark_ineligible(inode->i_sb, handle);
 
 	down_write(&EXT4_I(inode)->i_data_sem);
 	ret = ext4_ext_check_inode(inode);
@@ -677,7 +677,7 @@ dx_probe(const struct qstr *d_name, struct inode *dir,
 	struct dx_frame *frame = frame_in;
 	u32 hash;
 
-	frame->bh = NULL;
+	memset(frame_in, 0, EXT4_HTREE_LEVEL * sizeof(frame_in[0]));
 	bh = ext4_read_dirblock(dir, 0, INDEX);
 	if (IS_ERR(bh)) {
 		*err = PTR_ERR(bh);
@@ -709,9 +709,13 @@ dx_probe(const struct qstr *d_name, struct inode *dir,
 		goto fail;
 	}
 
-	if ((indirect = root->info.indirect_levels) > 1) {
+	indirect = root->info.indirect_levels;
+	if (indirect >= ext4_dir_htree_level(dir->i_sb)) {
 		ext4_warning(dir->i_sb, "Unimplemented inode hash depth: %#06x",
 			     root->info.indirect_levels);
+		if (ext4_dir_htree_level(dir->i_sb) < EXT4_HTREE_LEVEL)
+			ext4_warning(dir->i_sb, "Directory needs the "
+				     "largedir feature to be read");
 		brelse(bh);
 		*err = ERR_BAD_DX_DIR;
 		goto fail;
@@ -806,12 +810,13 @@ fail:
 
 static void dx_release (struct dx_frame *frames)
 {
-	if (frames[0].bh == NULL)
-		return;
+	int i;
 
-	if (((struct dx_root *) frames[0].bh->b_data)->info.indirect_levels)
-		brelse(frames[1].bh);
-	brelse(frames[0].bh);
+	/* dx_probe() zeroed the frames past the ones it filled in */
+	for (i = 0; i < EXT4_HTREE_LEVEL && frames[i].bh; i++) {
+		brelse(frames[i].bh);
+		frames[i].bh = NULL;
+	}
 }
 
 /*
@@ -953,7 +958,7 @@ int ext4_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 {
 	struct dx_hash_info hinfo;
 	struct ext4_dir_entry_2 *de;
-	struct dx_frame frames[2], *frame;
+	struct dx_frame frames[EXT4_HTREE_LEVEL], *frame;
 	struct inode *dir;
 	ext4_lblk_t block;
 	int count = 0;
@@ -1360,7 +1365,7 @@ static struct buffer_head * ext4_dx_find_entry(struct inode *dir, const struct q
 {
 	struct super_block * sb = dir->i_sb;
 	struct dx_hash_info	hinfo;
-	struct dx_frame frames[2], *frame;
+	struct dx_frame frames[EXT4_HTREE_LEVEL], *frame;
 	struct buffer_head *bh;
 	ext4_lblk_t block;
 	int retval;
@@ -1411,15 +1416,24 @@ static struct dentry *ext4_lookup(struct inode *dir, struct dentry *dentry, unsi
 	struct inode *inode;
 	struct ext4_dir_entry_2 *de;
 	struct buffer_head *bh;
+	__u32 ino = 0;
 
 	if (dentry->d_name.len > EXT4_NAME_LEN)
 		return ERR_PTR(-ENAMETOOLONG);
 
+	/*
+	 * Not across ext4_iget(), which may wait for an inode being evicted,
+	 * and so for a journal commit held up by a handle waiting here.
+	 */
+	down_read(&EXT4_I(dir)->i_dir_sem);
 	bh = ext4_find_entry(dir, &dentry->d_name, &de, NULL);
-	inode = NULL;
 	if (bh) {
-		__u32 ino = le32_to_cpu(de->inode);
+		ino = le32_to_cpu(de->inode);
 		brelse(bh);
+	}
+	up_read(&EXT4_I(dir)->i_dir_sem);
+	inode = NULL;
+	if (ino) {
 		if (!ext4_valid_inum(dir->i_sb, ino)) {
 			EXT4_ERROR_INODE(dir, "bad inode number: %u", ino);
 			return ERR_PTR(-EIO);
@@ -1448,11 +1462,15 @@ struct dentry *ext4_get_parent(struct dentry *child)
 	struct ext4_dir_entry_2 * de;
 	struct buffer_head *bh;
 
+	down_read(&EXT4_I(child->d_inode)->i_dir_sem);
 	bh = ext4_find_entry(child->d_inode, &dotdot, &de, NULL);
-	if (!bh)
+	if (!bh) {
+		up_read(&EXT4_I(child->d_inode)->i_dir_sem);
 		return ERR_PTR(-ENOENT);
+	}
 	ino = le32_to_cpu(de->inode);
 	brelse(bh);
+	up_read(&EXT4_I(child->d_inode)->i_dir_sem);
 
 	if (!ext4_valid_inum(child->d_inode->i_sb, ino)) {
 		EXT4_ERROR_INODE(child->d_inode,
@@ -1759,7 +1777,7 @@ static int make_indexed_dir(handle_t *handle, struct dentry *dentry,
 	int		namelen = dentry->d_name.len;
 	struct buffer_head *bh2;
 	struct dx_root	*root;
-	struct dx_frame	frames[2], *frame;
+	struct dx_frame	frames[EXT4_HTREE_LEVEL], *frame;
 	struct dx_entry *entries;
 	struct ext4_dir_entry_2	*de, *de2;
 	struct ext4_dir_entry_tail *t;
@@ -1838,6 +1856,7 @@ static int make_indexed_dir(handle_t *handle, struct dentry *dentry,
 		hinfo.hash_version += EXT4_SB(dir->i_sb)->s_hash_unsigned;
 	hinfo.seed = EXT4_SB(dir->i_sb)->s_hash_seed;
 	ext4fs_dirhash(name, namelen, &hinfo);
+	memset(frames, 0, sizeof(frames));
 	frame = frames;
 	frame->entries = entries;
 	frame->at = entries;
@@ -1875,8 +1894,8 @@ static int make_indexed_dir(handle_t *handle, struct dentry *dentry,
  * may not sleep between calling this and putting something into
  * the entry, as someone else might have used it while you slept.
  */
-static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
-			  struct inode *inode)
+static int __ext4_add_entry(handle_t *handle, struct dentry *dentry,
+			    struct inode *inode)
 {
 	struct inode *dir = dentry->d_parent->d_inode;
 	struct buffer_head *bh;
@@ -1952,21 +1971,36 @@ static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
 	return retval;
 }
 
+static int ext4_add_entry(handle_t *handle, struct dentry *dentry,
+			  struct inode *inode)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	int retval;
+
+	down_write(&EXT4_I(dir)->i_dir_sem);
+	retval = __ext4_add_entry(handle, dentry, inode);
+	up_write(&EXT4_I(dir)->i_dir_sem);
+	return retval;
+}
+
 /*
  * Returns 0 for success, or a negative error value
  */
 static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
 			     struct inode *inode)
 {
-	struct dx_frame frames[2], *frame;
+	struct dx_frame frames[EXT4_HTREE_LEVEL], *frame;
 	struct dx_entry *entries, *at;
 	struct dx_hash_info hinfo;
 	struct buffer_head *bh;
 	struct inode *dir = dentry->d_parent->d_inode;
 	struct super_block *sb = dir->i_sb;
 	struct ext4_dir_entry_2 *de;
+	int restart;
 	int err;
 
+again:
+	restart = 0;
 	frame = dx_probe(&dentry->d_name, dir, &hinfo, frames, &err);
 	if (!frame)
 		return err;
@@ -1994,18 +2028,42 @@ static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
 	/* Need to split index? */
 	if (dx_get_count(entries) == dx_get_limit(entries)) {
 		ext4_lblk_t newblock;
-		unsigned icount = dx_get_count(entries);
-		int levels = frame - frames;
+		unsigned icount;
+		int levels = frame - frames + 1;
+		int add_level = 1;
 		struct dx_entry *entries2;
 		struct dx_node *node2;
 		struct buffer_head *bh2;
 
-		if (levels && (dx_get_count(frames->entries) ==
-			       dx_get_limit(frames->entries))) {
-			ext4_warning(sb, "Directory index full!");
+		/*
+		 * Split the lowest index block whose parent has room for
+		 * one more entry, or add a level under the root if none
+		 * has.  Splitting above the bottom level leaves the path
+		 * to the leaf stale: the entry is then added by probing
+		 * again, once the split is done.
+		 */
+		while (frame > frames) {
+			if (dx_get_count((frame - 1)->entries) <
+			    dx_get_limit((frame - 1)->entries)) {
+				add_level = 0;
+				break;
+			}
+			frame--;
+			at = frame->at;
+			entries = frame->entries;
+			restart = 1;
+		}
+		if (add_level && levels == ext4_dir_htree_level(sb)) {
+			ext4_warning(sb, "Directory (ino: %lu) index full, "
+				     "reached max htree level: %d",
+				     dir->i_ino, levels);
+			if (ext4_dir_htree_level(sb) < EXT4_HTREE_LEVEL)
+				ext4_warning(sb, "Large directory feature is "
+					     "not enabled on this filesystem");
 			err = -ENOSPC;
 			goto cleanup;
 		}
+		icount = dx_get_count(entries);
 		bh2 = ext4_append(handle, dir, &newblock);
 		if (IS_ERR(bh2)) {
 			err = PTR_ERR(bh2);
@@ -2020,15 +2078,15 @@ static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
 		err = ext4_journal_get_write_access(handle, frame->bh);
 		if (err)
 			goto journal_error;
-		if (levels) {
+		if (!add_level) {
 			unsigned icount1 = icount/2, icount2 = icount - icount1;
 			unsigned hash2 = dx_get_hash(entries + icount1);
 			dxtrace(printk(KERN_DEBUG "Split index %i/%i\n",
 				       icount1, icount2));
 
-			BUFFER_TRACE(frame->bh, "get_write_access"); /* index root */
+			BUFFER_TRACE(frame->bh, "get_write_access"); /* parent */
 			err = ext4_journal_get_write_access(handle,
-							     frames[0].bh);
+							    (frame - 1)->bh);
 			if (err)
 				goto journal_error;
 
@@ -2044,15 +2102,26 @@ static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
 				frame->entries = entries = entries2;
 				swap(frame->bh, bh2);
 			}
-			dx_insert_block(frames + 0, hash2, newblock);
-			dxtrace(dx_show_index("node", frames[1].entries));
+			dx_insert_block(frame - 1, hash2, newblock);
+			dxtrace(dx_show_index("node", frame->entries));
 			dxtrace(dx_show_index("node",
 			       ((struct dx_node *) bh2->b_data)->entries));
 			err = ext4_handle_dirty_dx_node(handle, dir, bh2);
 			if (err)
 				goto journal_error;
 			brelse (bh2);
+			err = ext4_handle_dirty_dx_node(handle, dir,
+							(frame - 1)->bh);
+			if (err)
+				goto journal_error;
+			if (restart) {
+				err = ext4_handle_dirty_dx_node(handle, dir,
+								frame->bh);
+				goto journal_error;
+			}
 		} else {
+			struct dx_root *dxroot;
+
 			dxtrace(printk(KERN_DEBUG
 				       "Creating second level index...\n"));
 			memcpy((char *) entries2, (char *) entries,
@@ -2062,22 +2131,18 @@ static int ext4_dx_add_entry(handle_t *handle, struct dentry *dentry,
 			/* Set up root */
 			dx_set_count(entries, 1);
 			dx_set_block(entries + 0, newblock);
-			((struct dx_root *) frames[0].bh->b_data)->info.indirect_levels = 1;
-
-			/* Add new access path frame */
-			frame = frames + 1;
-			frame->at = at = at - entries + entries2;
-			frame->entries = entries = entries2;
-			frame->bh = bh2;
-			err = ext4_journal_get_write_access(handle,
-							     frame->bh);
+			dxroot = (struct dx_root *)frames[0].bh->b_data;
+			dxroot->info.indirect_levels += 1;
+			dxtrace(printk(KERN_DEBUG
+				       "Creating %d level index...\n",
+				       dxroot->info.indirect_levels));
+			err = ext4_handle_dirty_dx_node(handle, dir, frame->bh);
 			if (err)
 				goto journal_error;
-		}
-		err = ext4_handle_dirty_dx_node(handle, dir, frames[0].bh);
-		if (err) {
-			ext4_std_error(inode->i_sb, err);
-			goto cleanup;
+			err = ext4_handle_dirty_dx_node(handle, dir, bh2);
+			brelse(bh2);
+			restart = 1;
+			goto journal_error;
 		}
 	}
 	de = do_split(handle, dir, &bh, frame, &hinfo, &err);
@@ -2091,6 +2156,9 @@ journal_error:
 cleanup:
 	brelse(bh);
 	dx_release(frames);
+	/* The split changed the path to the leaf: look it up again */
+	if (restart && err == 0)
+		goto again;
 	return err;
 }
 
@@ -2137,10 +2205,10 @@ int ext4_generic_delete_entry(handle_t *handle,
 	return -ENOENT;
 }
 
-static int ext4_delete_entry(handle_t *handle,
-			     struct inode *dir,
-			     struct ext4_dir_entry_2 *de_del,
-			     struct buffer_head *bh)
+static int __ext4_delete_entry(handle_t *handle,
+			       struct inode *dir,
+			       struct ext4_dir_entry_2 *de_del,
+			       struct buffer_head *bh)
 {
 	int err, csum_size = 0;
 
@@ -2179,6 +2247,19 @@ out:
 	return err;
 }
 
+static int ext4_delete_entry(handle_t *handle,
+			     struct inode *dir,
+			     struct ext4_dir_entry_2 *de_del,
+			     struct buffer_head *bh)
+{
+	int err;
+
+	down_write(&EXT4_I(dir)->i_dir_sem);
+	err = __ext4_delete_entry(handle, dir, de_del, bh);
+	up_write(&EXT4_I(dir)->i_dir_sem);
+	return err;
+}
+
 /*
  * DIR_NLINK feature is set if 1) nlinks > EXT4_LINK_MAX or 2) nlinks == 2,
  * since this indicates that nlinks count was previously 1.
@@ -2252,6 +2333,8 @@ retry:
 		inode->i_fop = &ext4_file_operations;
 		ext4_set_aops(inode);
 		err = ext4_add_nondir(handle, dentry, inode);
+		if (!err)
+			ext4_fc_track_create(handle, dentry);
 		if (!err && IS_DIRSYNC(dir))
 			ext4_handle_sync(handle);
 	}
@@ -2284,6 +2367,7 @@ retry:
 	if (!IS_ERR(inode)) {
 		init_special_inode(inode, inode->i_mode, rdev);
 		inode->i_op = &ext4_special_inode_operations;
+		ext4_fc_mark_ineligible(dir->i_sb, handle);
 		err = ext4_add_nondir(handle, dentry, inode);
 		if (!err && IS_DIRSYNC(dir))
 			ext4_handle_sync(handle);
@@ -2315,6 +2399,7 @@ retry:
 		inode->i_op = &ext4_file_inode_operations;
 		inode->i_fop = &ext4_file_operations;
 		ext4_set_aops(inode);
+		ext4_fc_mark_ineligible(dir->i_sb, handle);
 		d_tmpfile(dentry, inode);
 		err = ext4_orphan_add(handle, inode);
 		if (err)
@@ -2434,6 +2519,7 @@ retry:
 
 	inode->i_op = &ext4_dir_inode_operations;
 	inode->i_fop = &ext4_dir_operations;
+	ext4_fc_mark_ineligible(dir->i_sb, handle);
 	err = ext4_init_new_dir(handle, dir, inode);
 	if (err)
 		goto out_clear_inode;
@@ -2729,6 +2815,7 @@ static int ext4_rmdir(struct inode *dir, struct dentry *dentry)
 
 	if (IS_DIRSYNC(dir))
 		ext4_handle_sync(handle);
+	ext4_fc_mark_ineligible(dir->i_sb, handle);
 
 	retval = ext4_delete_entry(handle, dir, de, bh);
 	if (retval)
@@ -2802,6 +2889,7 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 	retval = ext4_delete_entry(handle, dir, de, bh);
 	if (retval)
 		goto end_unlink;
+	ext4_fc_track_unlink(handle, dentry);
 	dir->i_ctime = dir->i_mtime = ext4_current_time(dir);
 	ext4_update_dx_flag(dir);
 	ext4_mark_inode_dirty(handle, dir);
@@ -2861,6 +2949,7 @@ retry:
 	err = PTR_ERR(inode);
 	if (IS_ERR(inode))
 		goto out_stop;
+	ext4_fc_mark_ineligible(dir->i_sb, handle);
 
 	if (l > EXT4_N_BLOCKS * 4) {
 		inode->i_op = &ext4_symlink_inode_operations;
@@ -2909,6 +2998,7 @@ retry:
 		inode->i_size = l-1;
 	}
 	EXT4_I(inode)->i_disksize = inode->i_size;
+	ext4_fc_mark_ineligible(dir->i_sb, handle);
 	err = ext4_add_nondir(handle, dentry, inode);
 	if (!err && IS_DIRSYNC(dir))
 		ext4_handle_sync(handle);
@@ -2957,9 +3047,12 @@ retry:
 		/* this can happen only for tmpfile being
 		 * linked the first time
 		 */
-		if (inode->i_nlink == 1)
+		if (inode->i_nlink == 1) {
 			ext4_orphan_del(handle, inode);
+			ext4_fc_mark_ineligible(dir->i_sb, handle);
+		}
 		d_instantiate(dentry, inode);
+		ext4_fc_track_link(handle, dentry);
 	} else {
 		drop_nlink(inode);
 		iput(inode);
@@ -2970,6 +3063,85 @@ retry:
 	return err;
 }
 
+/*
+ * For the fast commit replay: add an entry @name for @inode to @dir,
+ * unless it has one already.  The link count is left alone, as the
+ * replayed inode has it right.
+ */
+int ext4_fc_replay_link_entry(struct inode *dir, struct inode *inode,
+			      const struct qstr *name)
+{
+	struct dentry *dentry_dir, *dentry;
+	struct ext4_dir_entry_2 *de;
+	struct buffer_head *bh;
+	handle_t *handle;
+	int err;
+
+	bh = ext4_find_entry(dir, name, &de, NULL);
+	if (IS_ERR(bh))
+		return PTR_ERR(bh);
+	if (bh) {
+		brelse(bh);
+		return 0;
+	}
+
+	/* ext4_add_entry() wants the dentry, and its parent's */
+	ihold(dir);
+	dentry_dir = d_obtain_alias(dir);
+	if (IS_ERR(dentry_dir))
+		return PTR_ERR(dentry_dir);
+	dentry = d_alloc(dentry_dir, name);
+	if (!dentry) {
+		err = -ENOMEM;
+		goto out_dir;
+	}
+
+	handle = ext4_journal_start(dir, EXT4_HT_DIR,
+		EXT4_DATA_TRANS_BLOCKS(dir->i_sb) +
+		EXT4_INDEX_EXTRA_TRANS_BLOCKS);
+	if (IS_ERR(handle)) {
+		err = PTR_ERR(handle);
+	} else {
+		err = ext4_add_entry(handle, dentry, inode);
+		ext4_journal_stop(handle);
+	}
+	d_drop(dentry);
+	dput(dentry);
+out_dir:
+	/* Unhashed, so that dput() lets go of the inode at once */
+	d_drop(dentry_dir);
+	dput(dentry_dir);
+	return err;
+}
+
+/* And remove the entry @name of @dir, if it is for inode @ino */
+int ext4_fc_replay_unlink_entry(struct inode *dir, const struct qstr *name,
+				unsigned long ino)
+{
+	struct ext4_dir_entry_2 *de;
+	struct buffer_head *bh;
+	handle_t *handle;
+	int err;
+
+	bh = ext4_find_entry(dir, name, &de, NULL);
+	if (IS_ERR_OR_NULL(bh))
+		return PTR_ERR(bh);
+	if (le32_to_cpu(de->inode) != ino) {
+		brelse(bh);
+		return 0;
+	}
+
+	handle = ext4_journal_start(dir, EXT4_HT_DIR,
+				    EXT4_DATA_TRANS_BLOCKS(dir->i_sb));
+	if (IS_ERR(handle)) {
+		brelse(bh);
+		return PTR_ERR(handle);
+	}
+	err = ext4_delete_entry(handle, dir, de, bh);
+	ext4_journal_stop(handle);
+	brelse(bh);
+	return err;
+}
 
 /*
  * Try to find buffer head where contains the parent block.
@@ -3038,7 +3210,9 @@ static int ext4_rename_dir_finish(handle_t *handle, struct ext4_renament *ent,
 {
 	int retval;
 
+	down_write(&EXT4_I(ent->inode)->i_dir_sem);
 	ent->parent_de->inode = cpu_to_le32(dir_ino);
+	up_write(&EXT4_I(ent->inode)->i_dir_sem);
 	BUFFER_TRACE(ent->dir_bh, "call ext4_handle_dirty_metadata");
 	if (!ent->dir_inlined) {
 		if (is_dx(ent->inode)) {
@@ -3069,10 +3243,12 @@ static int ext4_setent(handle_t *handle, struct ext4_renament *ent,
 	retval = ext4_journal_get_write_access(handle, ent->bh);
 	if (retval)
 		return retval;
+	down_write(&EXT4_I(ent->dir)->i_dir_sem);
 	ent->de->inode = cpu_to_le32(ino);
 	if (EXT4_HAS_INCOMPAT_FEATURE(ent->dir->i_sb,
 				      EXT4_FEATURE_INCOMPAT_FILETYPE))
 		ent->de->file_type = file_type;
+	up_write(&EXT4_I(ent->dir)->i_dir_sem);
 	ent->dir->i_version++;
 	ent->dir->i_ctime = ent->dir->i_mtime =
 		ext4_current_time(ent->dir);
@@ -3210,6 +3386,7 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 
 	if (IS_DIRSYNC(old.dir) || IS_DIRSYNC(new.dir))
 		ext4_handle_sync(handle);
+	ext4_fc_mark_ineligible(old.dir->i_sb, handle);
 
 	if (S_ISDIR(old.inode->i_mode)) {
 		if (new.inode) {
@@ -3334,6 +3511,7 @@ static int ext4_cross_rename(struct inode *old_dir, struct dentry *old_dentry,
 
 	if (IS_DIRSYNC(old.dir) || IS_DIRSYNC(new.dir))
 		ext4_handle_sync(handle);
+	ext4_fc_mark_ineligible(old.dir->i_sb, handle);
 
 	if (S_ISDIR(old.inode->i_mode)) {
 		old.is_dir = true;
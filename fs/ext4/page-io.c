@@ -353,6 +353,7 @@ void ext4_io_submit(struct ext4_io_submit *io)
 void ext4_io_submit_init(struct ext4_io_submit *io,
 			 struct writeback_control *wbc)
 {
+	io->io_wbc = wbc;
 	io->io_op = (wbc->sync_mode == WB_SYNC_ALL ?  WRITE_SYNC : WRITE);
 	io->io_bio = NULL;
 	io->io_end = NULL;
@@ -371,6 +372,7 @@ static int io_submit_init_bio(struct ext4_io_submit *io,
 	bio->bi_bdev = bh->b_bdev;
 	bio->bi_end_io = ext4_end_bio;
 	bio->bi_private = ext4_get_io_end(io->io_end);
+	wbc_init_bio(io->io_wbc, bio);
 	io->io_bio = bio;
 	io->io_next_block = bh->b_blocknr;
 	return 0;
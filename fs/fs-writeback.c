@@ -66,16 +66,6 @@ int writeback_in_progress(struct backing_dev_info *bdi)
 }
 EXPORT_SYMBOL(writeback_in_progress);
 
-static inline struct backing_dev_info *inode_to_bdi(struct inode *inode)
-{
-	struct super_block *sb = inode->i_sb;
-
-	if (sb_is_blkdev_sb(sb))
-		return inode->i_mapping->backing_dev_info;
-
-	return sb->s_bdi;
-}
-
 static inline struct inode *wb_inode(struct list_head *head)
 {
 	return list_entry(head, struct inode, i_wb_list);
@@ -179,16 +169,81 @@ void bdi_start_background_writeback(struct backing_dev_info *bdi)
 	bdi_wakeup_thread(bdi);
 }
 
+/**
+ * wb_start_background_writeback - start background writeback of a wb
+ * @wb: the cgroup wb over its background threshold
+ *
+ * Like bdi_start_background_writeback(), but for the dirty inodes of one
+ * cgroup only: its flusher writes them until the cgroup is back below its
+ * background threshold.
+ */
+void wb_start_background_writeback(struct bdi_writeback *wb)
+{
+	struct backing_dev_info *bdi = wb->bdi;
+
+	trace_writeback_wake_background(bdi);
+	spin_lock_bh(&bdi->wb_lock);
+	if (test_bit(BDI_registered, &bdi->state))
+		mod_delayed_work(bdi_wq, &wb->dwork, 0);
+	spin_unlock_bh(&bdi->wb_lock);
+}
+
+#ifdef CONFIG_CGROUP_WRITEBACK
+/**
+ * inode_attach_wb - attribute an inode to the cgroups dirtying it
+ * @inode: the inode being dirtied
+ *
+ * The first task to dirty an inode decides which wb of its bdi it goes on,
+ * and so which cgroup its dirty pages count against and which blkcg its
+ * writeback I/O is charged to.
+ */
+void inode_attach_wb(struct inode *inode)
+{
+	struct bdi_writeback *wb;
+
+	if (inode->i_wb)
+		return;
+	wb = wb_get_create(inode_to_bdi(inode));
+	cmpxchg(&inode->i_wb, NULL, wb);
+}
+
+/**
+ * wbc_init_bio - charge a writeback bio to the blkcg of its wb
+ * @wbc: the writeback_control the bio is written for
+ * @bio: the bio, not yet submitted
+ *
+ * Writeback done by the flusher is issued from a kworker, but belongs to
+ * the cgroup which dirtied the inode: associate it with that blkcg.
+ */
+void wbc_init_bio(struct writeback_control *wbc, struct bio *bio)
+{
+	if (wbc->wb && wbc->wb->blkcg_css)
+		bio_associate_blkcg(bio, wbc->wb->blkcg_css);
+}
+EXPORT_SYMBOL_GPL(wbc_init_bio);
+
+static inline void wbc_attach_inode(struct writeback_control *wbc,
+				    struct inode *inode)
+{
+	wbc->wb = inode_to_wb(inode);
+}
+#else
+static inline void wbc_attach_inode(struct writeback_control *wbc,
+				    struct inode *inode)
+{
+}
+#endif
+
 /*
  * Remove the inode from the writeback list it is on.
  */
 void inode_wb_list_del(struct inode *inode)
 {
-	struct backing_dev_info *bdi = inode_to_bdi(inode);
+	struct bdi_writeback *wb = inode_to_wb(inode);
 
-	spin_lock(&bdi->wb.list_lock);
+	spin_lock(&wb->list_lock);
 	list_del_init(&inode->i_wb_list);
-	spin_unlock(&bdi->wb.list_lock);
+	spin_unlock(&wb->list_lock);
 }
 
 /*
@@ -457,6 +512,7 @@ __writeback_single_inode(struct inode *inode, struct writeback_control *wbc)
 
 	trace_writeback_single_inode_start(inode, wbc, nr_to_write);
 
+	wbc_attach_inode(wbc, inode);
 	ret = do_writepages(mapping, wbc);
 
 	/*
@@ -763,10 +819,19 @@ static long writeback_inodes_wb(struct bdi_writeback *wb, long nr_pages,
 	return nr_pages - work.nr_pages;
 }
 
-static bool over_bground_thresh(struct backing_dev_info *bdi)
+static bool over_bground_thresh(struct bdi_writeback *wb)
 {
+	struct backing_dev_info *bdi = wb->bdi;
 	unsigned long background_thresh, dirty_thresh;
 
+#ifdef CONFIG_CGROUP_WRITEBACK
+	if (!wb_is_root(wb)) {
+		wb_dirty_limits(wb, &background_thresh, &dirty_thresh);
+		if (wb_dirty_pages(wb) > background_thresh)
+			return true;
+	}
+#endif
+
 	global_dirty_limits(&background_thresh, &dirty_thresh);
 
 	if (global_page_state(NR_FILE_DIRTY) +
@@ -839,7 +904,7 @@ static long wb_writeback(struct bdi_writeback *wb,
 		 * For background writeout, stop when we are below the
 		 * background dirty threshold
 		 */
-		if (work->for_background && !over_bground_thresh(wb->bdi))
+		if (work->for_background && !over_bground_thresh(wb))
 			break;
 
 		/*
@@ -900,6 +965,23 @@ static long wb_writeback(struct bdi_writeback *wb,
 	return nr_pages - work->nr_pages;
 }
 
+/*
+ * Do @work on all the wbs of @bdi, the root wb first.  The cgroup wbs are
+ * only freed with their bdi, so the list can be walked without a lock.
+ */
+static long bdi_writeback(struct backing_dev_info *bdi,
+			  struct wb_writeback_work *work)
+{
+	long wrote = wb_writeback(&bdi->wb, work);
+#ifdef CONFIG_CGROUP_WRITEBACK
+	struct bdi_writeback *wb;
+
+	list_for_each_entry_rcu(wb, &bdi->wb_list, bdi_node)
+		wrote += wb_writeback(wb, work);
+#endif
+	return wrote;
+}
+
 /*
  * Return the next wb_writeback_work struct that hasn't been processed yet.
  */
@@ -929,9 +1011,14 @@ static unsigned long get_nr_dirty_pages(void)
 		get_nr_dirty_inodes();
 }
 
+/*
+ * The flusher of the root wb writes all the wbs of the bdi when it is over
+ * the global or bdi background threshold; that of a cgroup wb just its own
+ * inodes when it is over the threshold of the cgroup.
+ */
 static long wb_check_background_flush(struct bdi_writeback *wb)
 {
-	if (over_bground_thresh(wb->bdi)) {
+	if (over_bground_thresh(wb)) {
 
 		struct wb_writeback_work work = {
 			.nr_pages	= LONG_MAX,
@@ -941,6 +1028,8 @@ static long wb_check_background_flush(struct bdi_writeback *wb)
 			.reason		= WB_REASON_BACKGROUND,
 		};
 
+		if (wb_is_root(wb))
+			return bdi_writeback(wb->bdi, &work);
 		return wb_writeback(wb, &work);
 	}
 
@@ -982,7 +1071,10 @@ static long wb_check_old_data_flush(struct bdi_writeback *wb)
 }
 
 /*
- * Retrieve work items and do the writeback they describe
+ * Retrieve work items and do the writeback they describe.  The work items
+ * of a bdi are all done by the flusher of its root wb, on every wb of the
+ * bdi; the flushers of the cgroup wbs just do periodic and background
+ * writeback of their own inodes.
  */
 static long wb_do_writeback(struct bdi_writeback *wb)
 {
@@ -990,12 +1082,16 @@ static long wb_do_writeback(struct bdi_writeback *wb)
 	struct wb_writeback_work *work;
 	long wrote = 0;
 
+	if (!wb_is_root(wb))
+		return wb_check_old_data_flush(wb) +
+		       wb_check_background_flush(wb);
+
 	set_bit(BDI_writeback_running, &wb->bdi->state);
 	while ((work = get_next_work_item(bdi)) != NULL) {
 
 		trace_writeback_exec(bdi, work);
 
-		wrote += wb_writeback(wb, work);
+		wrote += bdi_writeback(bdi, work);
 
 		/*
 		 * Notify the caller of completion if this is a synchronous
@@ -1042,22 +1138,22 @@ void bdi_writeback_workfn(struct work_struct *work)
 		do {
 			pages_written = wb_do_writeback(wb);
 			trace_writeback_pages_written(pages_written);
-		} while (!list_empty(&bdi->work_list));
+		} while (wb_is_root(wb) && !list_empty(&bdi->work_list));
 	} else {
 		/*
 		 * bdi_wq can't get enough workers and we're running off
 		 * the emergency worker.  Don't hog it.  Hopefully, 1024 is
 		 * enough for efficient IO.
 		 */
-		pages_written = writeback_inodes_wb(&bdi->wb, 1024,
+		pages_written = writeback_inodes_wb(wb, 1024,
 						    WB_REASON_FORKER_THREAD);
 		trace_writeback_pages_written(pages_written);
 	}
 
-	if (!list_empty(&bdi->work_list))
+	if (wb_is_root(wb) && !list_empty(&bdi->work_list))
 		mod_delayed_work(bdi_wq, &wb->dwork, 0);
 	else if (wb_has_dirty_io(wb) && dirty_writeback_interval)
-		bdi_wakeup_thread_delayed(bdi);
+		wb_wakeup_delayed(wb);
 
 	current->flags &= ~PF_SWAPWRITE;
 }
@@ -1189,11 +1285,14 @@ void __mark_inode_dirty(struct inode *inode, int flags)
 		 * reposition it (that would break b_dirty time-ordering).
 		 */
 		if (!was_dirty) {
+			struct bdi_writeback *wb;
 			bool wakeup_bdi = false;
 			bdi = inode_to_bdi(inode);
 
 			spin_unlock(&inode->i_lock);
-			spin_lock(&bdi->wb.list_lock);
+			inode_attach_wb(inode);
+			wb = inode_to_wb(inode);
+			spin_lock(&wb->list_lock);
 			if (bdi_cap_writeback_dirty(bdi)) {
 				WARN(!test_bit(BDI_registered, &bdi->state),
 				     "bdi-%s not registered\n", bdi->name);
@@ -1204,16 +1303,16 @@ void __mark_inode_dirty(struct inode *inode, int flags)
 				 * bdi thread to make sure background
 				 * write-back happens later.
 				 */
-				if (!wb_has_dirty_io(&bdi->wb))
+				if (!wb_has_dirty_io(wb))
 					wakeup_bdi = true;
 			}
 
 			inode->dirtied_when = jiffies;
-			list_move(&inode->i_wb_list, &bdi->wb.b_dirty);
-			spin_unlock(&bdi->wb.list_lock);
+			list_move(&inode->i_wb_list, &wb->b_dirty);
+			spin_unlock(&wb->list_lock);
 
 			if (wakeup_bdi)
-				bdi_wakeup_thread_delayed(bdi);
+				wb_wakeup_delayed(wb);
 			return;
 		}
 	}
@@ -1406,7 +1505,7 @@ EXPORT_SYMBOL(sync_inodes_sb);
  */
 int write_inode_now(struct inode *inode, int sync)
 {
-	struct bdi_writeback *wb = &inode_to_bdi(inode)->wb;
+	struct bdi_writeback *wb = inode_to_wb(inode);
 	struct writeback_control wbc = {
 		.nr_to_write = LONG_MAX,
 		.sync_mode = sync ? WB_SYNC_ALL : WB_SYNC_NONE,
@@ -1435,7 +1534,7 @@ EXPORT_SYMBOL(write_inode_now);
  */
 int sync_inode(struct inode *inode, struct writeback_control *wbc)
 {
-	return writeback_single_inode(inode, &inode_to_bdi(inode)->wb, wbc);
+	return writeback_single_inode(inode, inode_to_wb(inode), wbc);
 }
 EXPORT_SYMBOL(sync_inode);
 
@@ -26,15 +26,64 @@ MODULE_ALIAS("devname:fuse");
 
 static struct kmem_cache *fuse_req_cachep;
 
-static struct fuse_conn *fuse_get_conn(struct file *file)
+static struct fuse_chan *fuse_get_chan(struct file *file)
 {
 	/*
 	 * Lockless access is OK, because file->private data is set
-	 * once during mount and is valid until the file is released.
+	 * once during mount or clone and is valid until the file is
+	 * released.
 	 */
 	return file->private_data;
 }
 
+/* The channel serving the current CPU */
+static struct fuse_chan *fuse_chan_get(struct fuse_conn *fc)
+{
+	struct fuse_chan **map = ACCESS_ONCE(fc->chan_map);
+
+	if (!map)
+		return &fc->chan;
+	smp_read_barrier_depends();
+	return ACCESS_ONCE(map[raw_smp_processor_id()]);
+}
+
+/*
+ * Lock the channel to queue a request to.  A channel being released may
+ * still be in the map for a moment, in which case look again; unless
+ * the connection is going away, then any channel will do.
+ */
+static struct fuse_chan *fuse_chan_lock(struct fuse_conn *fc)
+{
+	struct fuse_chan *fch;
+
+	for (;;) {
+		fch = fuse_chan_get(fc);
+		spin_lock(&fch->lock);
+		if (likely(!fch->released) || !fc->connected)
+			return fch;
+		spin_unlock(&fch->lock);
+		cpu_relax();
+	}
+}
+
+/*
+ * Lock the channel of a queued request.  The pending requests of a
+ * released channel move to another one, so check that it's still the
+ * same once locked.
+ */
+static struct fuse_chan *fuse_req_lock_chan(struct fuse_req *req)
+{
+	struct fuse_chan *fch;
+
+	for (;;) {
+		fch = ACCESS_ONCE(req->chan);
+		spin_lock(&fch->lock);
+		if (likely(fch == req->chan))
+			return fch;
+		spin_unlock(&fch->lock);
+	}
+}
+
 static void fuse_request_init(struct fuse_req *req, struct page **pages,
 			      struct fuse_page_desc *page_descs,
 			      unsigned npages)
@@ -280,6 +329,10 @@ void fuse_put_request(struct fuse_conn *fc, struct fuse_req *req)
 		if (req->waiting)
 			atomic_dec(&fc->num_waiting);
 
+		/* The opener gave up before taking the backing file */
+		if (req->passthrough_filp)
+			fput(req->passthrough_filp);
+
 		if (req->stolen_file)
 			put_reserved_req(fc, req);
 		else
@@ -301,26 +354,30 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 
 static u64 fuse_get_unique(struct fuse_conn *fc)
 {
-	fc->reqctr++;
+	u64 unique;
+
 	/* zero is special */
-	if (fc->reqctr == 0)
-		fc->reqctr = 1;
+	do {
+		unique = atomic64_inc_return(&fc->reqctr);
+	} while (unlikely(!unique));
 
-	return fc->reqctr;
+	return unique;
 }
 
-static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
+/* Called with fch->lock held */
+static void queue_request(struct fuse_chan *fch, struct fuse_req *req)
 {
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
+	req->chan = fch;
+	list_add_tail(&req->list, &fch->pending);
 	req->state = FUSE_REQ_PENDING;
 	if (!req->waiting) {
 		req->waiting = 1;
-		atomic_inc(&fc->num_waiting);
+		atomic_inc(&fch->fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	wake_up(&fch->waitq);
+	kill_fasync(&fch->fasync, SIGIO, POLL_IN);
 }
 
 void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
@@ -331,27 +388,33 @@ void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 
 	spin_lock(&fc->lock);
 	if (fc->connected) {
+		struct fuse_chan *fch = fuse_chan_get(fc);
+
 		fc->forget_list_tail->next = forget;
 		fc->forget_list_tail = forget;
-		wake_up(&fc->waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+		wake_up(&fch->waitq);
+		kill_fasync(&fch->fasync, SIGIO, POLL_IN);
 	} else {
 		kfree(forget);
 	}
 	spin_unlock(&fc->lock);
 }
 
+/* Called with fc->lock held */
 static void flush_bg_queue(struct fuse_conn *fc)
 {
 	while (fc->active_background < fc->max_background &&
 	       !list_empty(&fc->bg_queue)) {
+		struct fuse_chan *fch;
 		struct fuse_req *req;
 
 		req = list_entry(fc->bg_queue.next, struct fuse_req, list);
 		list_del(&req->list);
 		fc->active_background++;
 		req->in.h.unique = fuse_get_unique(fc);
-		queue_request(fc, req);
+		fch = fuse_chan_lock(fc);
+		queue_request(fch, req);
+		spin_unlock(&fch->lock);
 	}
 }
 
@@ -363,19 +426,26 @@ static void flush_bg_queue(struct fuse_conn *fc)
  * the 'end' callback is called if given, else the reference to the
  * request is released
  *
- * Called with fc->lock, unlocks it
+ * Called with fch->lock, unlocks it.  @fch is NULL for a request that
+ * never got queued.
  */
-static void request_end(struct fuse_conn *fc, struct fuse_req *req)
-__releases(fc->lock)
+static void request_end(struct fuse_conn *fc, struct fuse_chan *fch,
+			struct fuse_req *req)
+__releases(fch->lock)
 {
 	void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
+	bool background = req->background;
+
 	req->end = NULL;
 	list_del(&req->list);
 	list_del(&req->intr_entry);
 	req->state = FUSE_REQ_FINISHED;
-	if (req->background) {
-		req->background = 0;
+	req->background = 0;
+	if (fch)
+		spin_unlock(&fch->lock);
 
+	if (background) {
+		spin_lock(&fc->lock);
 		if (fc->num_background == fc->max_background)
 			fc->blocked = 0;
 
@@ -391,50 +461,56 @@ __releases(fc->lock)
 		fc->num_background--;
 		fc->active_background--;
 		flush_bg_queue(fc);
+		spin_unlock(&fc->lock);
 	}
-	spin_unlock(&fc->lock);
 	wake_up(&req->waitq);
 	if (end)
 		end(fc, req);
 	fuse_put_request(fc, req);
 }
 
-static void wait_answer_interruptible(struct fuse_conn *fc,
-				      struct fuse_req *req)
-__releases(fc->lock)
-__acquires(fc->lock)
+/*
+ * Returns with the channel of the request locked, which is not
+ * necessarily @fch anymore
+ */
+static struct fuse_chan *wait_answer_interruptible(struct fuse_chan *fch,
+						   struct fuse_req *req)
+__releases(fch->lock)
+__acquires(req->chan->lock)
 {
 	if (signal_pending(current))
-		return;
+		return fch;
 
-	spin_unlock(&fc->lock);
+	spin_unlock(&fch->lock);
 	wait_event_interruptible(req->waitq, req->state == FUSE_REQ_FINISHED);
-	spin_lock(&fc->lock);
+	return fuse_req_lock_chan(req);
 }
 
-static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
+static void queue_interrupt(struct fuse_chan *fch, struct fuse_req *req)
 {
-	list_add_tail(&req->intr_entry, &fc->interrupts);
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	list_add_tail(&req->intr_entry, &fch->interrupts);
+	wake_up(&fch->waitq);
+	kill_fasync(&fch->fasync, SIGIO, POLL_IN);
 }
 
+/* Called with req->chan->lock held, releases it */
 static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
-__releases(fc->lock)
-__acquires(fc->lock)
+__releases(req->chan->lock)
 {
+	struct fuse_chan *fch = req->chan;
+
 	if (!fc->no_interrupt) {
 		/* Any signal may interrupt this */
-		wait_answer_interruptible(fc, req);
+		fch = wait_answer_interruptible(fch, req);
 
 		if (req->aborted)
 			goto aborted;
 		if (req->state == FUSE_REQ_FINISHED)
-			return;
+			goto out;
 
 		req->interrupted = 1;
 		if (req->state == FUSE_REQ_SENT)
-			queue_interrupt(fc, req);
+			queue_interrupt(fch, req);
 	}
 
 	if (!req->force) {
@@ -442,20 +518,20 @@ __acquires(fc->lock)
 
 		/* Only fatal signals may interrupt this */
 		block_sigs(&oldset);
-		wait_answer_interruptible(fc, req);
+		fch = wait_answer_interruptible(fch, req);
 		restore_sigs(&oldset);
 
 		if (req->aborted)
 			goto aborted;
 		if (req->state == FUSE_REQ_FINISHED)
-			return;
+			goto out;
 
 		/* Request is not yet in userspace, bail out */
 		if (req->state == FUSE_REQ_PENDING) {
 			list_del(&req->list);
 			__fuse_put_request(req);
 			req->out.h.error = -EINTR;
-			return;
+			goto out;
 		}
 	}
 
@@ -463,12 +539,12 @@ __acquires(fc->lock)
 	 * Either request is already in userspace, or it was forced.
 	 * Wait it out.
 	 */
-	spin_unlock(&fc->lock);
+	spin_unlock(&fch->lock);
 	wait_event(req->waitq, req->state == FUSE_REQ_FINISHED);
-	spin_lock(&fc->lock);
+	fch = fuse_req_lock_chan(req);
 
 	if (!req->aborted)
-		return;
+		goto out;
 
  aborted:
 	BUG_ON(req->state != FUSE_REQ_FINISHED);
@@ -478,30 +554,35 @@ __acquires(fc->lock)
 		   locked state, there mustn't be any filesystem
 		   operation (e.g. page fault), since that could lead
 		   to deadlock */
-		spin_unlock(&fc->lock);
+		spin_unlock(&fch->lock);
 		wait_event(req->waitq, !req->locked);
-		spin_lock(&fc->lock);
+		return;
 	}
+ out:
+	spin_unlock(&fch->lock);
 }
 
 static void __fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
 {
+	struct fuse_chan *fch;
+
 	BUG_ON(req->background);
-	spin_lock(&fc->lock);
+	fch = fuse_chan_lock(fc);
 	if (!fc->connected)
 		req->out.h.error = -ENOTCONN;
 	else if (fc->conn_error)
 		req->out.h.error = -ECONNREFUSED;
 	else {
 		req->in.h.unique = fuse_get_unique(fc);
-		queue_request(fc, req);
+		queue_request(fch, req);
 		/* acquire extra reference, since request is still needed
 		   after request_end() */
 		__fuse_get_request(req);
 
 		request_wait_answer(fc, req);
+		return;
 	}
-	spin_unlock(&fc->lock);
+	spin_unlock(&fch->lock);
 }
 
 void fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
@@ -534,8 +615,9 @@ static void fuse_request_send_nowait(struct fuse_conn *fc, struct fuse_req *req)
 		fuse_request_send_nowait_locked(fc, req);
 		spin_unlock(&fc->lock);
 	} else {
+		spin_unlock(&fc->lock);
 		req->out.h.error = -ENOTCONN;
-		request_end(fc, req);
+		request_end(fc, NULL, req);
 	}
 }
 
@@ -549,16 +631,17 @@ EXPORT_SYMBOL_GPL(fuse_request_send_background);
 static int fuse_request_send_notify_reply(struct fuse_conn *fc,
 					  struct fuse_req *req, u64 unique)
 {
+	struct fuse_chan *fch;
 	int err = -ENODEV;
 
 	req->isreply = 0;
 	req->in.h.unique = unique;
-	spin_lock(&fc->lock);
+	fch = fuse_chan_lock(fc);
 	if (fc->connected) {
-		queue_request(fc, req);
+		queue_request(fch, req);
 		err = 0;
 	}
-	spin_unlock(&fc->lock);
+	spin_unlock(&fch->lock);
 
 	return err;
 }
@@ -575,6 +658,29 @@ void fuse_request_send_background_locked(struct fuse_conn *fc,
 	fuse_request_send_nowait_locked(fc, req);
 }
 
+bool fuse_lock_unsent_request(struct fuse_req *req)
+{
+	struct fuse_chan *fch;
+
+	/* Leaving the INIT state takes fc->lock for background requests */
+	if (req->state == FUSE_REQ_INIT)
+		return true;
+	if (!req->chan)
+		return false;
+
+	fch = fuse_req_lock_chan(req);
+	if (req->state == FUSE_REQ_PENDING)
+		return true;
+	spin_unlock(&fch->lock);
+	return false;
+}
+
+void fuse_unlock_unsent_request(struct fuse_req *req)
+{
+	if (req->state != FUSE_REQ_INIT)
+		spin_unlock(&req->chan->lock);
+}
+
 void fuse_force_forget(struct file *file, u64 nodeid)
 {
 	struct inode *inode = file_inode(file);
@@ -601,16 +707,16 @@ void fuse_force_forget(struct file *file, u64 nodeid)
  * anything that could cause a page-fault.  If the request was already
  * aborted bail out.
  */
-static int lock_request(struct fuse_conn *fc, struct fuse_req *req)
+static int lock_request(struct fuse_req *req)
 {
 	int err = 0;
 	if (req) {
-		spin_lock(&fc->lock);
+		spin_lock(&req->chan->lock);
 		if (req->aborted)
 			err = -ENOENT;
 		else
 			req->locked = 1;
-		spin_unlock(&fc->lock);
+		spin_unlock(&req->chan->lock);
 	}
 	return err;
 }
@@ -620,14 +726,14 @@ static int lock_request(struct fuse_conn *fc, struct fuse_req *req)
  * requester thread is currently waiting for it to be unlocked, so
  * wake it up.
  */
-static void unlock_request(struct fuse_conn *fc, struct fuse_req *req)
+static void unlock_request(struct fuse_req *req)
 {
 	if (req) {
-		spin_lock(&fc->lock);
+		spin_lock(&req->chan->lock);
 		req->locked = 0;
 		if (req->aborted)
 			wake_up(&req->waitq);
-		spin_unlock(&fc->lock);
+		spin_unlock(&req->chan->lock);
 	}
 }
 
@@ -687,7 +793,7 @@ static int fuse_copy_fill(struct fuse_copy_state *cs)
 	struct page *page;
 	int err;
 
-	unlock_request(cs->fc, cs->req);
+	unlock_request(cs->req);
 	fuse_copy_finish(cs);
 	if (cs->pipebufs) {
 		struct pipe_buffer *buf = cs->pipebufs;
@@ -742,7 +848,7 @@ static int fuse_copy_fill(struct fuse_copy_state *cs)
 		cs->addr += cs->len;
 	}
 
-	return lock_request(cs->fc, cs->req);
+	return lock_request(cs->req);
 }
 
 /* Do as much copy to/from userspace buffer as we can */
@@ -793,7 +899,7 @@ static int fuse_try_move_page(struct fuse_copy_state *cs, struct page **pagep)
 	struct page *newpage;
 	struct pipe_buffer *buf = cs->pipebufs;
 
-	unlock_request(cs->fc, cs->req);
+	unlock_request(cs->req);
 	fuse_copy_finish(cs);
 
 	err = buf->ops->confirm(cs->pipe, buf);
@@ -847,12 +953,12 @@ static int fuse_try_move_page(struct fuse_copy_state *cs, struct page **pagep)
 		lru_cache_add_file(newpage);
 
 	err = 0;
-	spin_lock(&cs->fc->lock);
+	spin_lock(&cs->req->chan->lock);
 	if (cs->req->aborted)
 		err = -ENOENT;
 	else
 		*pagep = newpage;
-	spin_unlock(&cs->fc->lock);
+	spin_unlock(&cs->req->chan->lock);
 
 	if (err) {
 		unlock_page(newpage);
@@ -872,7 +978,7 @@ out_fallback:
 	cs->pg = buf->page;
 	cs->offset = buf->offset;
 
-	err = lock_request(cs->fc, cs->req);
+	err = lock_request(cs->req);
 	if (err)
 		return err;
 
@@ -887,7 +993,7 @@ static int fuse_ref_page(struct fuse_copy_state *cs, struct page *page,
 	if (cs->nr_segs == cs->pipe->buffers)
 		return -EIO;
 
-	unlock_request(cs->fc, cs->req);
+	unlock_request(cs->req);
 	fuse_copy_finish(cs);
 
 	buf = cs->pipebufs;
@@ -1003,31 +1109,31 @@ static int forget_pending(struct fuse_conn *fc)
 	return fc->forget_list_head.next != NULL;
 }
 
-static int request_pending(struct fuse_conn *fc)
+static int request_pending(struct fuse_chan *fch)
 {
-	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts) ||
-		forget_pending(fc);
+	return !list_empty(&fch->pending) || !list_empty(&fch->interrupts) ||
+		forget_pending(fch->fc);
 }
 
 /* Wait until a request is available on the pending list */
-static void request_wait(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void request_wait(struct fuse_chan *fch)
+__releases(fch->lock)
+__acquires(fch->lock)
 {
 	DECLARE_WAITQUEUE(wait, current);
 
-	add_wait_queue_exclusive(&fc->waitq, &wait);
-	while (fc->connected && !request_pending(fc)) {
+	add_wait_queue_exclusive(&fch->waitq, &wait);
+	while (fch->fc->connected && !request_pending(fch)) {
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (signal_pending(current))
 			break;
 
-		spin_unlock(&fc->lock);
+		spin_unlock(&fch->lock);
 		schedule();
-		spin_lock(&fc->lock);
+		spin_lock(&fch->lock);
 	}
 	set_current_state(TASK_RUNNING);
-	remove_wait_queue(&fc->waitq, &wait);
+	remove_wait_queue(&fch->waitq, &wait);
 }
 
 /*
@@ -1036,11 +1142,12 @@ __acquires(fc->lock)
  * Unlike other requests this is assembled on demand, without a need
  * to allocate a separate fuse_req structure.
  *
- * Called with fc->lock held, releases it
+ * Called with fch->lock held, releases it
  */
-static int fuse_read_interrupt(struct fuse_conn *fc, struct fuse_copy_state *cs,
+static int fuse_read_interrupt(struct fuse_chan *fch,
+			       struct fuse_copy_state *cs,
 			       size_t nbytes, struct fuse_req *req)
-__releases(fc->lock)
+__releases(fch->lock)
 {
 	struct fuse_in_header ih;
 	struct fuse_interrupt_in arg;
@@ -1048,7 +1155,7 @@ __releases(fc->lock)
 	int err;
 
 	list_del_init(&req->intr_entry);
-	req->intr_unique = fuse_get_unique(fc);
+	req->intr_unique = fuse_get_unique(fch->fc);
 	memset(&ih, 0, sizeof(ih));
 	memset(&arg, 0, sizeof(arg));
 	ih.len = reqsize;
@@ -1056,7 +1163,7 @@ __releases(fc->lock)
 	ih.unique = req->intr_unique;
 	arg.unique = req->in.h.unique;
 
-	spin_unlock(&fc->lock);
+	spin_unlock(&fch->lock);
 	if (nbytes < reqsize)
 		return -EINVAL;
 
@@ -1191,46 +1298,54 @@ __releases(fc->lock)
  * request_end().  Otherwise add it to the processing list, and set
  * the 'sent' flag.
  */
-static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
+static ssize_t fuse_dev_do_read(struct fuse_chan *fch, struct file *file,
 				struct fuse_copy_state *cs, size_t nbytes)
 {
+	struct fuse_conn *fc = fch->fc;
 	int err;
 	struct fuse_req *req;
 	struct fuse_in *in;
 	unsigned reqsize;
 
  restart:
-	spin_lock(&fc->lock);
+	spin_lock(&fch->lock);
 	err = -EAGAIN;
 	if ((file->f_flags & O_NONBLOCK) && fc->connected &&
-	    !request_pending(fc))
+	    !request_pending(fch))
 		goto err_unlock;
 
-	request_wait(fc);
+	request_wait(fch);
 	err = -ENODEV;
 	if (!fc->connected)
 		goto err_unlock;
 	err = -ERESTARTSYS;
-	if (!request_pending(fc))
+	if (!request_pending(fch))
 		goto err_unlock;
 
-	if (!list_empty(&fc->interrupts)) {
-		req = list_entry(fc->interrupts.next, struct fuse_req,
+	if (!list_empty(&fch->interrupts)) {
+		req = list_entry(fch->interrupts.next, struct fuse_req,
 				 intr_entry);
-		return fuse_read_interrupt(fc, cs, nbytes, req);
+		return fuse_read_interrupt(fch, cs, nbytes, req);
 	}
 
 	if (forget_pending(fc)) {
-		if (list_empty(&fc->pending) || fc->forget_batch-- > 0)
-			return fuse_read_forget(fc, cs, nbytes);
+		if (list_empty(&fch->pending) || fch->forget_batch-- > 0) {
+			/* Forgets are queued on the connection */
+			spin_unlock(&fch->lock);
+			spin_lock(&fc->lock);
+			if (forget_pending(fc))
+				return fuse_read_forget(fc, cs, nbytes);
+			spin_unlock(&fc->lock);
+			goto restart;
+		}
 
-		if (fc->forget_batch <= -8)
-			fc->forget_batch = 16;
+		if (fch->forget_batch <= -8)
+			fch->forget_batch = 16;
 	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
+	req = list_entry(fch->pending.next, struct fuse_req, list);
 	req->state = FUSE_REQ_READING;
-	list_move(&req->list, &fc->io);
+	list_move(&req->list, &fch->io);
 
 	in = &req->in;
 	reqsize = in->h.len;
@@ -1240,40 +1355,40 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		/* SETXATTR is special, since it may contain too large data */
 		if (in->h.opcode == FUSE_SETXATTR)
 			req->out.h.error = -E2BIG;
-		request_end(fc, req);
+		request_end(fc, fch, req);
 		goto restart;
 	}
-	spin_unlock(&fc->lock);
+	spin_unlock(&fch->lock);
 	cs->req = req;
 	err = fuse_copy_one(cs, &in->h, sizeof(in->h));
 	if (!err)
 		err = fuse_copy_args(cs, in->numargs, in->argpages,
 				     (struct fuse_arg *) in->args, 0);
 	fuse_copy_finish(cs);
-	spin_lock(&fc->lock);
+	spin_lock(&fch->lock);
 	req->locked = 0;
 	if (req->aborted) {
-		request_end(fc, req);
+		request_end(fc, fch, req);
 		return -ENODEV;
 	}
 	if (err) {
 		req->out.h.error = -EIO;
-		request_end(fc, req);
+		request_end(fc, fch, req);
 		return err;
 	}
 	if (!req->isreply)
-		request_end(fc, req);
+		request_end(fc, fch, req);
 	else {
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
+		list_move_tail(&req->list, &fch->processing);
 		if (req->interrupted)
-			queue_interrupt(fc, req);
-		spin_unlock(&fc->lock);
+			queue_interrupt(fch, req);
+		spin_unlock(&fch->lock);
 	}
 	return reqsize;
 
  err_unlock:
-	spin_unlock(&fc->lock);
+	spin_unlock(&fch->lock);
 	return err;
 }
 
@@ -1282,13 +1397,13 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
 {
 	struct fuse_copy_state cs;
 	struct file *file = iocb->ki_filp;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *fch = fuse_get_chan(file);
+	if (!fch)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 1, iov, nr_segs);
+	fuse_copy_init(&cs, fch->fc, 1, iov, nr_segs);
 
-	return fuse_dev_do_read(fc, file, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_read(fch, file, &cs, iov_length(iov, nr_segs));
 }
 
 static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
@@ -1300,18 +1415,18 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 	int do_wakeup = 0;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(in);
-	if (!fc)
+	struct fuse_chan *fch = fuse_get_chan(in);
+	if (!fch)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
 	if (!bufs)
 		return -ENOMEM;
 
-	fuse_copy_init(&cs, fc, 1, NULL, 0);
+	fuse_copy_init(&cs, fch->fc, 1, NULL, 0);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
-	ret = fuse_dev_do_read(fc, in, &cs, len);
+	ret = fuse_dev_do_read(fch, in, &cs, len);
 	if (ret < 0)
 		goto out;
 
@@ -1747,11 +1862,11 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 }
 
 /* Look up request on processing list by unique ID */
-static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
+static struct fuse_req *request_find(struct fuse_chan *fch, u64 unique)
 {
 	struct fuse_req *req;
 
-	list_for_each_entry(req, &fc->processing, list) {
+	list_for_each_entry(req, &fch->processing, list) {
 		if (req->in.h.unique == unique || req->intr_unique == unique)
 			return req;
 	}
@@ -1788,9 +1903,10 @@ static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
  * it from the list and copy the rest of the buffer to the request.
  * The request is finished by calling request_end()
  */
-static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
+static ssize_t fuse_dev_do_write(struct fuse_chan *fch,
 				 struct fuse_copy_state *cs, size_t nbytes)
 {
+	struct fuse_conn *fc = fch->fc;
 	int err;
 	struct fuse_req *req;
 	struct fuse_out_header oh;
@@ -1819,20 +1935,20 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	if (oh.error <= -1000 || oh.error > 0)
 		goto err_finish;
 
-	spin_lock(&fc->lock);
+	spin_lock(&fch->lock);
 	err = -ENOENT;
 	if (!fc->connected)
 		goto err_unlock;
 
-	req = request_find(fc, oh.unique);
+	req = request_find(fch, oh.unique);
 	if (!req)
 		goto err_unlock;
 
 	if (req->aborted) {
-		spin_unlock(&fc->lock);
+		spin_unlock(&fch->lock);
 		fuse_copy_finish(cs);
-		spin_lock(&fc->lock);
-		request_end(fc, req);
+		spin_lock(&fch->lock);
+		request_end(fc, fch, req);
 		return -ENOENT;
 	}
 	/* Is it an interrupt reply? */
@@ -1844,38 +1960,41 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 		if (oh.error == -ENOSYS)
 			fc->no_interrupt = 1;
 		else if (oh.error == -EAGAIN)
-			queue_interrupt(fc, req);
+			queue_interrupt(fch, req);
 
-		spin_unlock(&fc->lock);
+		spin_unlock(&fch->lock);
 		fuse_copy_finish(cs);
 		return nbytes;
 	}
 
 	req->state = FUSE_REQ_WRITING;
-	list_move(&req->list, &fc->io);
+	list_move(&req->list, &fch->io);
 	req->out.h = oh;
 	req->locked = 1;
 	cs->req = req;
 	if (!req->out.page_replace)
 		cs->move_pages = 0;
-	spin_unlock(&fc->lock);
+	spin_unlock(&fch->lock);
 
 	err = copy_out_args(cs, &req->out, nbytes);
 	fuse_copy_finish(cs);
+	/* The backing file is looked up in the daemon's file table */
+	if (!err && !req->out.h.error && req->out.passthrough)
+		err = fuse_passthrough_setup(req);
 
-	spin_lock(&fc->lock);
+	spin_lock(&fch->lock);
 	req->locked = 0;
 	if (!err) {
 		if (req->aborted)
 			err = -ENOENT;
 	} else if (!req->aborted)
 		req->out.h.error = -EIO;
-	request_end(fc, req);
+	request_end(fc, fch, req);
 
 	return err ? err : nbytes;
 
  err_unlock:
-	spin_unlock(&fc->lock);
+	spin_unlock(&fch->lock);
  err_finish:
 	fuse_copy_finish(cs);
 	return err;
@@ -1885,13 +2004,13 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
 			      unsigned long nr_segs, loff_t pos)
 {
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(iocb->ki_filp);
-	if (!fc)
+	struct fuse_chan *fch = fuse_get_chan(iocb->ki_filp);
+	if (!fch)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 0, iov, nr_segs);
+	fuse_copy_init(&cs, fch->fc, 0, iov, nr_segs);
 
-	return fuse_dev_do_write(fc, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_write(fch, &cs, iov_length(iov, nr_segs));
 }
 
 static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
@@ -1902,12 +2021,12 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	unsigned idx;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc;
+	struct fuse_chan *fch;
 	size_t rem;
 	ssize_t ret;
 
-	fc = fuse_get_conn(out);
-	if (!fc)
+	fch = fuse_get_chan(out);
+	if (!fch)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
@@ -1954,14 +2073,14 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	}
 	pipe_unlock(pipe);
 
-	fuse_copy_init(&cs, fc, 0, NULL, nbuf);
+	fuse_copy_init(&cs, fch->fc, 0, NULL, nbuf);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
 
 	if (flags & SPLICE_F_MOVE)
 		cs.move_pages = 1;
 
-	ret = fuse_dev_do_write(fc, &cs, len);
+	ret = fuse_dev_do_write(fch, &cs, len);
 
 	for (idx = 0; idx < nbuf; idx++) {
 		struct pipe_buffer *buf = &bufs[idx];
@@ -1975,18 +2094,18 @@ out:
 static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *fch = fuse_get_chan(file);
+	if (!fch)
 		return POLLERR;
 
-	poll_wait(file, &fc->waitq, wait);
+	poll_wait(file, &fch->waitq, wait);
 
-	spin_lock(&fc->lock);
-	if (!fc->connected)
+	spin_lock(&fch->lock);
+	if (!fch->fc->connected)
 		mask = POLLERR;
-	else if (request_pending(fc))
+	else if (request_pending(fch))
 		mask |= POLLIN | POLLRDNORM;
-	spin_unlock(&fc->lock);
+	spin_unlock(&fch->lock);
 
 	return mask;
 }
@@ -1994,18 +2113,19 @@ static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 /*
  * Abort all requests on the given list (pending or processing)
  *
- * This function releases and reacquires fc->lock
+ * This function releases and reacquires fch->lock
  */
-static void end_requests(struct fuse_conn *fc, struct list_head *head)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void end_requests(struct fuse_conn *fc, struct fuse_chan *fch,
+			 struct list_head *head)
+__releases(fch->lock)
+__acquires(fch->lock)
 {
 	while (!list_empty(head)) {
 		struct fuse_req *req;
 		req = list_entry(head->next, struct fuse_req, list);
 		req->out.h.error = -ECONNABORTED;
-		request_end(fc, req);
-		spin_lock(&fc->lock);
+		request_end(fc, fch, req);
+		spin_lock(&fch->lock);
 	}
 }
 
@@ -2020,13 +2140,13 @@ __acquires(fc->lock)
  * called after waiting for the request to be unlocked (if it was
  * locked).
  */
-static void end_io_requests(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void end_io_requests(struct fuse_conn *fc, struct fuse_chan *fch)
+__releases(fch->lock)
+__acquires(fch->lock)
 {
-	while (!list_empty(&fc->io)) {
+	while (!list_empty(&fch->io)) {
 		struct fuse_req *req =
-			list_entry(fc->io.next, struct fuse_req, list);
+			list_entry(fch->io.next, struct fuse_req, list);
 		void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
 
 		req->aborted = 1;
@@ -2037,23 +2157,32 @@ __acquires(fc->lock)
 		if (end) {
 			req->end = NULL;
 			__fuse_get_request(req);
-			spin_unlock(&fc->lock);
+			spin_unlock(&fch->lock);
 			wait_event(req->waitq, !req->locked);
 			end(fc, req);
 			fuse_put_request(fc, req);
-			spin_lock(&fc->lock);
+			spin_lock(&fch->lock);
 		}
 	}
 }
 
-static void end_queued_requests(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void end_queued_requests(struct fuse_conn *fc, struct fuse_chan *fch)
+__releases(fch->lock)
+__acquires(fch->lock)
+{
+	end_requests(fc, fch, &fch->pending);
+	end_requests(fc, fch, &fch->processing);
+}
+
+/*
+ * Queue the background requests still held back, so that they are
+ * aborted with the rest, and drop the forgets.  Called with fc->lock
+ * held, after clearing fc->connected.
+ */
+static void end_unqueued_requests(struct fuse_conn *fc)
 {
 	fc->max_background = UINT_MAX;
 	flush_bg_queue(fc);
-	end_requests(fc, &fc->pending);
-	end_requests(fc, &fc->processing);
 	while (forget_pending(fc))
 		kfree(dequeue_forget(fc, 1, NULL));
 }
@@ -2094,34 +2223,185 @@ static void end_polls(struct fuse_conn *fc)
  */
 void fuse_abort_conn(struct fuse_conn *fc)
 {
+	struct fuse_chan *fch;
+
 	spin_lock(&fc->lock);
-	if (fc->connected) {
-		fc->connected = 0;
-		fc->blocked = 0;
-		fc->initialized = 1;
-		end_io_requests(fc);
-		end_queued_requests(fc);
-		end_polls(fc);
-		wake_up_all(&fc->waitq);
-		wake_up_all(&fc->blocked_waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	if (!fc->connected) {
+		spin_unlock(&fc->lock);
+		return;
 	}
+	fc->connected = 0;
+	fc->blocked = 0;
+	fc->initialized = 1;
+	end_unqueued_requests(fc);
+	end_polls(fc);
 	spin_unlock(&fc->lock);
+
+	/*
+	 * No channel is added to a connection that is down, so the list
+	 * is stable without fc->lock, which finishing requests may take.
+	 */
+	list_for_each_entry(fch, &fc->chans, entry) {
+		spin_lock(&fch->lock);
+		end_io_requests(fc, fch);
+		end_queued_requests(fc, fch);
+		wake_up_all(&fch->waitq);
+		kill_fasync(&fch->fasync, SIGIO, POLL_IN);
+		spin_unlock(&fch->lock);
+	}
+	wake_up_all(&fc->blocked_waitq);
 }
 EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
+/* The channel after @fch on fc->chans, wrapping around */
+static struct fuse_chan *fuse_chan_next(struct fuse_conn *fc,
+					struct fuse_chan *fch)
+{
+	if (list_is_last(&fch->entry, &fc->chans))
+		return list_first_entry(&fc->chans, struct fuse_chan, entry);
+	return list_entry(fch->entry.next, struct fuse_chan, entry);
+}
+
+/*
+ * Spread the CPUs over the channels which are not released, and return
+ * how many of those there are.  With none left the map is not touched.
+ *
+ * Called with fc->lock held
+ */
+static int fuse_chan_map_update(struct fuse_conn *fc, struct fuse_chan **map)
+{
+	struct fuse_chan *fch;
+	int cpu, alive = 0;
+
+	list_for_each_entry(fch, &fc->chans, entry) {
+		if (!fch->released)
+			alive++;
+	}
+	if (!alive || !map)
+		return alive;
+
+	fch = list_first_entry(&fc->chans, struct fuse_chan, entry);
+	for_each_possible_cpu(cpu) {
+		while (fch->released)
+			fch = fuse_chan_next(fc, fch);
+		ACCESS_ONCE(map[cpu]) = fch;
+		fch = fuse_chan_next(fc, fch);
+	}
+
+	return alive;
+}
+
+/*
+ * Hand the requests which userspace hasn't seen yet over to a channel
+ * which is still open.
+ *
+ * Called with fc->lock and fch->lock held
+ */
+static void fuse_chan_migrate(struct fuse_conn *fc, struct fuse_chan *fch)
+{
+	struct fuse_chan *to = fuse_chan_next(fc, fch);
+	struct fuse_req *req;
+
+	while (to->released)
+		to = fuse_chan_next(fc, to);
+
+	spin_lock_nested(&to->lock, SINGLE_DEPTH_NESTING);
+	list_for_each_entry(req, &fch->pending, list)
+		req->chan = to;
+	list_splice_tail_init(&fch->pending, &to->pending);
+	wake_up_all(&to->waitq);
+	kill_fasync(&to->fasync, SIGIO, POLL_IN);
+	spin_unlock(&to->lock);
+}
+
+/*
+ * Add a channel to the connection for the @file being opened on
+ * /dev/fuse.  Called with fuse_mutex held, which also keeps the file
+ * from being used for a mount in the meantime.
+ */
+static int fuse_chan_clone(struct fuse_conn *fc, struct file *file)
+{
+	struct fuse_chan **map = NULL;
+	struct fuse_chan *fch;
+	int err;
+
+	if (file->private_data)
+		return -EINVAL;
+
+	fch = kmalloc(sizeof(*fch), GFP_KERNEL);
+	if (!fch)
+		return -ENOMEM;
+	fuse_chan_init(fch, fc);
+
+	if (!fc->chan_map) {
+		map = kcalloc(nr_cpu_ids, sizeof(*map), GFP_KERNEL);
+		if (!map) {
+			kfree(fch);
+			return -ENOMEM;
+		}
+	}
+
+	spin_lock(&fc->lock);
+	err = -ENODEV;
+	if (fc->connected) {
+		list_add_tail(&fch->entry, &fc->chans);
+		if (map) {
+			fuse_chan_map_update(fc, map);
+			/* fuse_chan_get() may look at the map right away */
+			smp_wmb();
+			fc->chan_map = map;
+			map = NULL;
+		} else {
+			fuse_chan_map_update(fc, fc->chan_map);
+		}
+		err = 0;
+	}
+	spin_unlock(&fc->lock);
+	kfree(map);
+
+	if (err) {
+		kfree(fch);
+		return err;
+	}
+
+	file->private_data = fch;
+	fuse_conn_get(fc);
+
+	return 0;
+}
+
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (fc) {
+	struct fuse_chan *fch = fuse_get_chan(file);
+	if (fch) {
+		struct fuse_conn *fc = fch->fc;
+		int alive;
+
 		spin_lock(&fc->lock);
-		fc->connected = 0;
-		fc->blocked = 0;
-		fc->initialized = 1;
-		end_queued_requests(fc);
-		end_polls(fc);
-		wake_up_all(&fc->blocked_waitq);
+		spin_lock(&fch->lock);
+		fch->released = 1;
+		alive = fuse_chan_map_update(fc, fc->chan_map);
+		if (!alive) {
+			fc->connected = 0;
+			fc->blocked = 0;
+			fc->initialized = 1;
+		} else if (fc->connected) {
+			fuse_chan_migrate(fc, fch);
+		}
+		spin_unlock(&fch->lock);
+		if (!alive) {
+			end_unqueued_requests(fc);
+			end_polls(fc);
+		}
 		spin_unlock(&fc->lock);
+
+		/* Whatever is left here can't be answered anymore */
+		spin_lock(&fch->lock);
+		end_queued_requests(fc, fch);
+		spin_unlock(&fch->lock);
+
+		if (!alive)
+			wake_up_all(&fc->blocked_waitq);
 		fuse_conn_put(fc);
 	}
 
@@ -2131,12 +2411,45 @@ EXPORT_SYMBOL_GPL(fuse_dev_release);
 
 static int fuse_dev_fasync(int fd, struct file *file, int on)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *fch = fuse_get_chan(file);
+	if (!fch)
 		return -EPERM;
 
 	/* No locking - fasync_helper does its own locking */
-	return fasync_helper(fd, file, on, &fc->fasync);
+	return fasync_helper(fd, file, on, &fch->fasync);
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct fuse_chan *fch = NULL;
+	struct file *old;
+	__u32 oldfd;
+	int err;
+
+	if (cmd != FUSE_DEV_IOC_CLONE)
+		return -ENOTTY;
+
+	if (get_user(oldfd, (__u32 __user *) arg))
+		return -EFAULT;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EBADF;
+
+	/* Only the channels of a mounted fuse device can be cloned */
+	if (file->f_op == &fuse_dev_operations && old->f_op == file->f_op)
+		fch = fuse_get_chan(old);
+
+	err = -EINVAL;
+	if (fch) {
+		mutex_lock(&fuse_mutex);
+		err = fuse_chan_clone(fch->fc, file);
+		mutex_unlock(&fuse_mutex);
+	}
+	fput(old);
+
+	return err;
 }
 
 const struct file_operations fuse_dev_operations = {
@@ -2151,6 +2464,8 @@ const struct file_operations fuse_dev_operations = {
 	.poll		= fuse_dev_poll,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+	.compat_ioctl	= fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
@@ -458,10 +458,13 @@ static int fuse_create_open(struct inode *dir, struct dentry *entry,
 	req->out.args[0].value = &outentry;
 	req->out.args[1].size = sizeof(outopen);
 	req->out.args[1].value = &outopen;
+	req->out.passthrough = fc->passthrough;
 	fuse_request_send(fc, req);
 	err = req->out.h.error;
 	if (err)
 		goto out_free_ff;
+	ff->passthrough_filp = req->passthrough_filp;
+	req->passthrough_filp = NULL;
 
 	err = -EIO;
 	if (!S_ISREG(outentry.attr.mode) || invalid_nodeid(outentry.nodeid))
@@ -979,6 +982,15 @@ static int fuse_do_getattr(struct inode *inode, struct kstat *stat,
 	return err;
 }
 
+static void fuse_fillattr_cached(struct inode *inode, struct kstat *stat)
+{
+	struct fuse_inode *fi = get_fuse_inode(inode);
+
+	generic_fillattr(inode, stat);
+	stat->mode = fi->orig_i_mode;
+	stat->ino = fi->orig_ino;
+}
+
 int fuse_update_attributes(struct inode *inode, struct kstat *stat,
 			   struct file *file, bool *refreshed)
 {
@@ -992,11 +1004,8 @@ int fuse_update_attributes(struct inode *inode, struct kstat *stat,
 	} else {
 		r = false;
 		err = 0;
-		if (stat) {
-			generic_fillattr(inode, stat);
-			stat->mode = fi->orig_i_mode;
-			stat->ino = fi->orig_ino;
-		}
+		if (stat)
+			fuse_fillattr_cached(inode, stat);
 	}
 
 	if (refreshed != NULL)
@@ -1834,6 +1843,20 @@ static int fuse_getattr(struct vfsmount *mnt, struct dentry *entry,
 	if (!fuse_allow_current_process(fc))
 		return -EACCES;
 
+	switch (stat->query_flags) {
+	case AT_STATX_FORCE_SYNC:
+		return fuse_do_getattr(inode, stat, NULL);
+	case AT_STATX_DONT_SYNC:
+		fuse_fillattr_cached(inode, stat);
+		return 0;
+	}
+
+	/* The file type and inode number never change */
+	if (!(stat->request_mask & ~(STATX_TYPE | STATX_INO))) {
+		fuse_fillattr_cached(inode, stat);
+		return 0;
+	}
+
 	return fuse_update_attributes(inode, stat, NULL, NULL);
 }
 
@@ -32,6 +32,9 @@
 /** It could be as large as PATH_MAX, but would that have any uses? */
 #define FUSE_NAME_MAX 1024
 
+/** Magic number of fuse superblocks */
+#define FUSE_SUPER_MAGIC 0x65735546
+
 /** Number of dentries for each connection in the control filesystem */
 #define FUSE_CTL_NUM_DENTRIES 5
 
@@ -155,6 +158,9 @@ struct fuse_file {
 	/** Wait queue head for poll */
 	wait_queue_head_t poll_wait;
 
+	/** Backing file for FOPEN_PASSTHROUGH, or NULL */
+	struct file *passthrough_filp;
+
 	/** Has flock been performed on this file? */
 	bool flock:1;
 };
@@ -209,6 +215,9 @@ struct fuse_out {
 	/** Pages may be replaced with new ones */
 	unsigned page_replace:1;
 
+	/** Last argument is a fuse_open_out which may name a backing file */
+	unsigned passthrough:1;
+
 	/** Number or arguments */
 	unsigned numargs;
 
@@ -251,7 +260,7 @@ struct fuse_io_priv {
  */
 struct fuse_req {
 	/** This can be on either pending processing or io lists in
-	    fuse_conn */
+	    fuse_chan */
 	struct list_head list;
 
 	/** Entry on the interrupts list  */
@@ -266,7 +275,7 @@ struct fuse_req {
 	/*
 	 * The following bitfields are either set once before the
 	 * request is queued or setting/clearing them is protected by
-	 * fuse_conn->lock
+	 * the lock of the channel it is queued on
 	 */
 
 	/** True if the request has reply */
@@ -362,6 +371,55 @@ struct fuse_req {
 
 	/** Request is stolen from fuse_file->reserved_req */
 	struct file *stolen_file;
+
+	/** The channel the request is queued on */
+	struct fuse_chan *chan;
+
+	/** Backing file named by an open reply, until the opener takes it */
+	struct file *passthrough_filp;
+};
+
+/**
+ * A channel of a connection: the queues of one /dev/fuse file.
+ *
+ * The file the filesystem was mounted with has the first channel, and
+ * FUSE_DEV_IOC_CLONE adds more, so that the threads of a daemon don't
+ * all contend on the same lists.  A request is queued to the channel
+ * serving the CPU it was submitted on, and answered through it.
+ */
+struct fuse_chan {
+	/** Lock protecting the queues, and the requests on them */
+	spinlock_t lock;
+
+	/** The connection this channel belongs to */
+	struct fuse_conn *fc;
+
+	/** Readers of the channel are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** The list of requests being processed */
+	struct list_head processing;
+
+	/** The list of requests under I/O */
+	struct list_head io;
+
+	/** Pending interrupts */
+	struct list_head interrupts;
+
+	/** Batching of FORGET requests (positive indicates FORGET batch) */
+	int forget_batch;
+
+	/** The file of the channel was released, it takes no requests */
+	int released;
+
+	/** O_ASYNC requests */
+	struct fasync_struct *fasync;
+
+	/** Entry on fc->chans */
+	struct list_head entry;
 };
 
 /**
@@ -395,17 +453,14 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
-	/** Readers of the connection are waiting on this */
-	wait_queue_head_t waitq;
+	/** The channel of the file the filesystem was mounted with */
+	struct fuse_chan chan;
 
-	/** The list of pending requests */
-	struct list_head pending;
+	/** All the channels of the connection, released ones too */
+	struct list_head chans;
 
-	/** The list of requests being processed */
-	struct list_head processing;
-
-	/** The list of requests under I/O */
-	struct list_head io;
+	/** Channel serving each CPU, NULL until the first clone */
+	struct fuse_chan **chan_map;
 
 	/** The next unique kernel file handle */
 	u64 khctr;
@@ -428,16 +483,10 @@ struct fuse_conn {
 	/** The list of background requests set aside for later queuing */
 	struct list_head bg_queue;
 
-	/** Pending interrupts */
-	struct list_head interrupts;
-
 	/** Queue of pending forgets */
 	struct fuse_forget_link forget_list_head;
 	struct fuse_forget_link *forget_list_tail;
 
-	/** Batching of FORGET requests (positive indicates FORGET batch) */
-	int forget_batch;
-
 	/** Flag indicating that INIT reply has been received. Allocating
 	 * any fuse request will be suspended until the flag is set */
 	int initialized;
@@ -454,7 +503,7 @@ struct fuse_conn {
 	wait_queue_head_t reserved_req_waitq;
 
 	/** The next unique request id */
-	u64 reqctr;
+	atomic64_t reqctr;
 
 	/** Connection established, cleared on umount, connection
 	    abort and device release */
@@ -483,6 +532,9 @@ struct fuse_conn {
 	/** write-back cache policy (default is write-through) */
 	unsigned writeback_cache:1;
 
+	/** Opens may pass read, write and mmap through to a backing file */
+	unsigned passthrough:1;
+
 	/*
 	 * The following bitfields are only for optimization purposes
 	 * and hence races in setting them will not cause malfunction
@@ -578,9 +630,6 @@ struct fuse_conn {
 	/** number of dentries used in the above array */
 	int ctl_ndents;
 
-	/** O_ASYNC requests */
-	struct fasync_struct *fasync;
-
 	/** Key for lock owner ID scrambling */
 	u32 scramble_key[4];
 
@@ -787,6 +836,13 @@ void fuse_request_send_background(struct fuse_conn *fc, struct fuse_req *req);
 void fuse_request_send_background_locked(struct fuse_conn *fc,
 					 struct fuse_req *req);
 
+/**
+ * Keep a background request from being read by userspace, if it
+ * hasn't been yet.  Called with fc->lock held
+ */
+bool fuse_lock_unsent_request(struct fuse_req *req);
+void fuse_unlock_unsent_request(struct fuse_req *req);
+
 /* Abort all requests */
 void fuse_abort_conn(struct fuse_conn *fc);
 
@@ -811,6 +867,11 @@ void fuse_conn_kill(struct fuse_conn *fc);
  */
 void fuse_conn_init(struct fuse_conn *fc);
 
+/**
+ * Initialize a channel of fuse_conn
+ */
+void fuse_chan_init(struct fuse_chan *fch, struct fuse_conn *fc);
+
 /**
  * Release reference to fuse_conn
  */
@@ -898,4 +959,13 @@ int fuse_write_inode(struct inode *inode, struct writeback_control *wbc);
 int fuse_do_setattr(struct inode *inode, struct iattr *attr,
 		    struct file *file);
 
+/* passthrough.c */
+int fuse_passthrough_setup(struct fuse_req *req);
+ssize_t fuse_passthrough_aio_read(struct kiocb *iocb, const struct iovec *iov,
+				  unsigned long nr_segs, loff_t pos);
+ssize_t fuse_passthrough_aio_write(struct kiocb *iocb,
+				   const struct iovec *iov,
+				   unsigned long nr_segs, loff_t pos);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+
 #endif /* _FS_FUSE_I_H */
@@ -0,0 +1,170 @@
+/*
+  FUSE: Filesystem in Userspace
+  Passing data I/O through to a backing file
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+#include "fuse_i.h"
+
+#include <linux/aio.h>
+#include <linux/file.h>
+#include <linux/fsnotify.h>
+#include <linux/pagemap.h>
+#include <linux/uio.h>
+
+/*
+ * An open file of a passthrough connection may be backed by a file of
+ * the daemon: the reply to FUSE_OPEN or FUSE_CREATE sets
+ * FOPEN_PASSTHROUGH and names the file in passthrough_fd.  Reads,
+ * writes and mmaps of the fuse file then go straight to the backing
+ * file, while the daemon still serves everything else.
+ *
+ * Called with the reply copied in, in the context of the daemon
+ * writing it, so that passthrough_fd is looked up in its file table.
+ */
+int fuse_passthrough_setup(struct fuse_req *req)
+{
+	struct fuse_open_out *outarg;
+	struct file *filp;
+	struct inode *inode;
+
+	outarg = req->out.args[req->out.numargs - 1].value;
+	if (!(outarg->open_flags & FOPEN_PASSTHROUGH))
+		return 0;
+
+	/* The fuse file is not going to go through the page cache */
+	if (outarg->open_flags & FOPEN_DIRECT_IO)
+		return -EINVAL;
+
+	/* The backing file is used with the opener's credentials */
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	filp = fget(outarg->passthrough_fd);
+	if (!filp)
+		return -EBADF;
+
+	inode = file_inode(filp);
+	if (!S_ISREG(inode->i_mode) || !filp->f_op->aio_read ||
+	    !filp->f_op->aio_write || !filp->f_op->mmap)
+		goto out_inval;
+
+	/* Don't let fuse files stack on each other */
+	if (inode->i_sb->s_magic == FUSE_SUPER_MAGIC)
+		goto out_inval;
+
+	req->passthrough_filp = filp;
+	return 0;
+
+ out_inval:
+	fput(filp);
+	return -EINVAL;
+}
+
+/*
+ * Do a read or write on the backing file, the way vfs_readv() and
+ * vfs_writev() would have done it on a file opened to it.  The iocb
+ * is completed synchronously.
+ */
+static ssize_t fuse_passthrough_rw(struct kiocb *iocb, int rw,
+				   const struct iovec *iov,
+				   unsigned long nr_segs, loff_t pos)
+{
+	struct fuse_file *ff = iocb->ki_filp->private_data;
+	struct file *filp = ff->passthrough_filp;
+	struct kiocb kiocb;
+	ssize_t ret;
+
+	if (!(filp->f_mode & (rw == WRITE ? FMODE_WRITE : FMODE_READ)))
+		return -EBADF;
+
+	ret = rw_verify_area(rw, filp, &pos, iov_length(iov, nr_segs));
+	if (ret < 0)
+		return ret;
+
+	init_sync_kiocb(&kiocb, filp);
+	kiocb.ki_pos = pos;
+	kiocb.ki_nbytes = ret;
+
+	if (rw == WRITE) {
+		file_start_write(filp);
+		ret = filp->f_op->aio_write(&kiocb, iov, nr_segs, pos);
+	} else {
+		ret = filp->f_op->aio_read(&kiocb, iov, nr_segs, pos);
+	}
+	if (ret == -EIOCBQUEUED)
+		ret = wait_on_sync_kiocb(&kiocb);
+	if (rw == WRITE)
+		file_end_write(filp);
+
+	if (ret > 0) {
+		if (rw == WRITE)
+			fsnotify_modify(filp);
+		else
+			fsnotify_access(filp);
+	}
+	iocb->ki_pos = kiocb.ki_pos;
+	return ret;
+}
+
+ssize_t fuse_passthrough_aio_read(struct kiocb *iocb, const struct iovec *iov,
+				  unsigned long nr_segs, loff_t pos)
+{
+	ssize_t ret;
+
+	ret = fuse_passthrough_rw(iocb, READ, iov, nr_segs, pos);
+	fuse_invalidate_atime(file_inode(iocb->ki_filp));
+
+	return ret;
+}
+
+ssize_t fuse_passthrough_aio_write(struct kiocb *iocb,
+				   const struct iovec *iov,
+				   unsigned long nr_segs, loff_t pos)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	ssize_t ret;
+
+	ret = fuse_passthrough_rw(iocb, WRITE, iov, nr_segs, pos);
+	if (ret > 0) {
+		/* Drop what other opens may have cached of the range */
+		invalidate_mapping_pages(inode->i_mapping,
+					 pos >> PAGE_CACHE_SHIFT,
+					 (iocb->ki_pos - 1) >> PAGE_CACHE_SHIFT);
+		fuse_write_update_size(inode, iocb->ki_pos);
+	}
+	fuse_invalidate_attr(inode);
+
+	return ret;
+}
+
+/*
+ * Map the backing file instead: the vma takes a reference to it, and
+ * drops the one mmap_region() took to the fuse file.
+ */
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *filp = ff->passthrough_filp;
+	int ret;
+
+	/* mprotect() must not be able to override what the daemon granted */
+	if ((vma->vm_flags & VM_SHARED) && !(filp->f_mode & FMODE_WRITE)) {
+		if (vma->vm_flags & VM_WRITE)
+			return -EACCES;
+		vma->vm_flags &= ~VM_MAYWRITE;
+	}
+
+	vma->vm_file = get_file(filp);
+	ret = filp->f_op->mmap(filp, vma);
+	if (ret) {
+		vma->vm_file = file;
+		fput(filp);
+		return ret;
+	}
+	fput(file);
+
+	return 0;
+}
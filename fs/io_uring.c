@@ -0,0 +1,1475 @@
+/*
+ *  fs/io_uring.c
+ *
+ *  Asynchronous I/O through rings shared with userspace.
+ *
+ *  io_uring_setup() returns a file descriptor, through which userspace
+ *  mmaps a submission queue (SQ) ring, an array of submission queue
+ *  entries, and a completion queue (CQ) ring.  Userspace fills in sqes,
+ *  puts their indexes in the SQ ring and moves its tail; the kernel
+ *  consumes them from the head, either when told to by io_uring_enter(),
+ *  or from a kernel thread polling the SQ ring, with IORING_SETUP_SQPOLL.
+ *  Completions are posted at the tail of the CQ ring as struct
+ *  io_uring_cqe, and userspace reaps them by moving its head: neither
+ *  submission nor completion needs a system call of its own.
+ *
+ *  Each ring is written by one side only, which orders its stores to the
+ *  entries before the store to the tail, with smp_wmb(); the other side
+ *  reads the tail, and then the entries after an smp_rmb().
+ *
+ *  Files and buffers can be registered with io_uring_register(), for sqes
+ *  to name them by index: a fixed file needs no lookup in the file table,
+ *  and the pages of a fixed buffer are pinned once, at registration.
+ *
+ *  Reads, writes and fsyncs are done from a workqueue, in the mm of the
+ *  ring's creator; polls wait on the file's waitqueue, as IOCB_CMD_POLL
+ *  does in fs/aio.c.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/syscalls.h>
+#include <linux/compat.h>
+#include <linux/uio.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/fdtable.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/mmu_context.h>
+#include <linux/percpu.h>
+#include <linux/percpu-refcount.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/blkdev.h>
+#include <linux/anon_inodes.h>
+#include <linux/poll.h>
+#include <linux/sizes.h>
+#include <linux/hugetlb.h>
+
+#include <asm/uaccess.h>
+
+#include <linux/io_uring.h>
+
+#define IORING_MAX_ENTRIES	4096
+#define IORING_MAX_FIXED_FILES	1024
+
+struct io_uring {
+	u32 head ____cacheline_aligned_in_smp;
+	u32 tail ____cacheline_aligned_in_smp;
+};
+
+/*
+ * The SQ ring: the array holds indexes into the array of sqes, which is
+ * mapped separately.  Entries with a bad index are counted in dropped.
+ */
+struct io_sq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			dropped;
+	u32			flags;
+	u32			array[];
+};
+
+/*
+ * The CQ ring: completions which did not fit are counted in overflow.
+ */
+struct io_cq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			overflow;
+	struct io_uring_cqe	cqes[] ____cacheline_aligned_in_smp;
+};
+
+struct io_mapped_ubuf {
+	u64		ubuf;
+	size_t		len;
+	struct page	**pages;
+	unsigned int	nr_pages;
+};
+
+struct io_ring_ctx {
+	struct percpu_ref	refs;
+	unsigned int		flags;
+	bool			compat;
+
+	/* SQ ring, consumed under uring_lock */
+	struct io_sq_ring	*sq_ring;
+	size_t			sq_ring_size;
+	unsigned		cached_sq_head;
+	unsigned		sq_entries;
+	unsigned		sq_mask;
+	unsigned		sq_thread_idle;
+	struct io_uring_sqe	*sq_sqes;
+	size_t			sq_sqes_size;
+
+	/* CQ ring, filled under completion_lock */
+	struct io_cq_ring	*cq_ring;
+	size_t			cq_ring_size;
+	unsigned		cached_cq_tail;
+	unsigned		cq_entries;
+	unsigned		cq_mask;
+	wait_queue_head_t	cq_wait;	/* for poll() on the ring */
+
+	/* where reads, writes and fsyncs are done, in sqo_mm */
+	struct workqueue_struct	*sqo_wq;
+	struct mm_struct	*sqo_mm;
+	/* the SQ polling thread, if IORING_SETUP_SQPOLL */
+	struct task_struct	*sqo_thread;
+	wait_queue_head_t	sqo_wait;
+
+	/* registered with io_uring_register(), under uring_lock */
+	struct file		**user_files;
+	unsigned		nr_user_files;
+	struct io_mapped_ubuf	*user_bufs;
+	unsigned		nr_user_bufs;
+
+	struct mutex		uring_lock;
+	wait_queue_head_t	wait;		/* for completions */
+	spinlock_t		completion_lock;
+	struct list_head	cancel_list;	/* pending polls */
+	struct completion	ctx_done;
+};
+
+struct io_poll_iocb {
+	unsigned		events;
+	wait_queue_head_t	*head;
+	bool			cancelled;
+	int			error;
+	wait_queue_t		wait;
+	poll_table		pt;
+};
+
+struct io_kiocb {
+	struct file		*file;
+	struct io_ring_ctx	*ctx;
+	struct list_head	list;		/* on ctx->cancel_list */
+	struct io_uring_sqe	sqe;		/* userspace may reuse its own */
+	struct work_struct	work;
+	struct io_poll_iocb	poll;
+	atomic_t		refs;
+	unsigned		result;
+};
+
+static struct kmem_cache *req_cachep;
+
+static const struct file_operations io_uring_fops;
+
+static void io_ring_ctx_ref_free(struct percpu_ref *ref)
+{
+	struct io_ring_ctx *ctx = container_of(ref, struct io_ring_ctx, refs);
+
+	complete(&ctx->ctx_done);
+}
+
+static struct io_ring_ctx *io_ring_ctx_alloc(struct io_uring_params *p)
+{
+	struct io_ring_ctx *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return NULL;
+
+	if (percpu_ref_init(&ctx->refs, io_ring_ctx_ref_free)) {
+		kfree(ctx);
+		return NULL;
+	}
+
+	ctx->flags = p->flags;
+	init_waitqueue_head(&ctx->cq_wait);
+	init_waitqueue_head(&ctx->sqo_wait);
+	init_completion(&ctx->ctx_done);
+	mutex_init(&ctx->uring_lock);
+	init_waitqueue_head(&ctx->wait);
+	spin_lock_init(&ctx->completion_lock);
+	INIT_LIST_HEAD(&ctx->cancel_list);
+	return ctx;
+}
+
+/*
+ * Completions.  A completion which does not fit in the CQ ring, because
+ * userspace has not reaped enough of them, is dropped and counted.
+ */
+static void io_cqring_fill_event(struct io_ring_ctx *ctx, u64 user_data,
+				 long res)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	struct io_uring_cqe *cqe;
+	unsigned tail;
+
+	tail = ctx->cached_cq_tail;
+	/* see where userspace's head is, before reusing its entries */
+	smp_rmb();
+	if (tail - ACCESS_ONCE(ring->r.head) == ring->ring_entries) {
+		ring->overflow++;
+		return;
+	}
+
+	cqe = &ring->cqes[tail & ctx->cq_mask];
+	cqe->user_data = user_data;
+	cqe->res = res;
+	cqe->flags = 0;
+	ctx->cached_cq_tail++;
+}
+
+static void io_commit_cqring(struct io_ring_ctx *ctx)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+
+	if (ctx->cached_cq_tail != ACCESS_ONCE(ring->r.tail)) {
+		/* order the cqes before the tail which publishes them */
+		smp_wmb();
+		ACCESS_ONCE(ring->r.tail) = ctx->cached_cq_tail;
+		/* and the tail before the test of the waitqueues */
+		smp_mb();
+	}
+}
+
+static void io_cqring_ev_posted(struct io_ring_ctx *ctx)
+{
+	if (waitqueue_active(&ctx->wait))
+		wake_up(&ctx->wait);
+	if (waitqueue_active(&ctx->cq_wait))
+		wake_up_interruptible(&ctx->cq_wait);
+}
+
+static void io_cqring_add_event(struct io_ring_ctx *ctx, u64 user_data,
+				long res)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	io_cqring_fill_event(ctx, user_data, res);
+	io_commit_cqring(ctx);
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+	io_cqring_ev_posted(ctx);
+}
+
+static unsigned io_cqring_events(struct io_cq_ring *ring)
+{
+	/* See comment at the top of this file */
+	smp_rmb();
+	return ACCESS_ONCE(ring->r.tail) - ACCESS_ONCE(ring->r.head);
+}
+
+/*
+ * Requests.  Each holds a reference on the ring, which is not freed until
+ * the last of them has completed.
+ */
+static struct io_kiocb *io_get_req(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+
+	if (!percpu_ref_tryget(&ctx->refs))
+		return NULL;
+
+	req = kmem_cache_alloc(req_cachep, GFP_KERNEL);
+	if (!req) {
+		percpu_ref_put(&ctx->refs);
+		return NULL;
+	}
+
+	req->file = NULL;
+	req->ctx = ctx;
+	INIT_LIST_HEAD(&req->list);
+	return req;
+}
+
+static void io_free_req(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+
+	if (req->file)
+		fput(req->file);
+	kmem_cache_free(req_cachep, req);
+	percpu_ref_put(&ctx->refs);
+}
+
+/*
+ * A fixed file is only pinned by the request with get_file(): it needs no
+ * lookup in the file table, and io_uring_register() can drop it while the
+ * request is in flight.
+ */
+static int io_req_set_file(struct io_ring_ctx *ctx, struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	unsigned fd = sqe->fd;
+
+	if (sqe->flags & IOSQE_FIXED_FILE) {
+		if (unlikely(!ctx->user_files || fd >= ctx->nr_user_files))
+			return -EBADF;
+		req->file = ctx->user_files[fd];
+		get_file(req->file);
+		return 0;
+	}
+
+	/* The SQ polling thread has no file table of its own */
+	if (ctx->flags & IORING_SETUP_SQPOLL)
+		return -EBADF;
+
+	req->file = fget(fd);
+	if (unlikely(!req->file))
+		return -EBADF;
+	return 0;
+}
+
+static ssize_t io_import_fixed(struct io_ring_ctx *ctx,
+			       const struct io_uring_sqe *sqe)
+{
+	struct io_mapped_ubuf *imu;
+	unsigned index = sqe->buf_index;
+	u64 buf_addr = sqe->addr;
+	size_t len = sqe->len;
+
+	if (unlikely(!ctx->user_bufs || index >= ctx->nr_user_bufs))
+		return -EFAULT;
+
+	imu = &ctx->user_bufs[index];
+	if (buf_addr + len < buf_addr)
+		return -EFAULT;
+	if (buf_addr < imu->ubuf || buf_addr + len > imu->ubuf + imu->len)
+		return -EFAULT;
+	return len;
+}
+
+static ssize_t io_read_write(struct io_kiocb *req, int rw, bool fixed)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct file *file = req->file;
+	loff_t pos = sqe->off;
+	void __user *buf = (void __user *)(unsigned long)sqe->addr;
+	ssize_t ret;
+
+	if (unlikely(sqe->ioprio || sqe->rw_flags))
+		return -EINVAL;
+	if (unlikely(!(file->f_mode & (rw == READ ? FMODE_READ : FMODE_WRITE))))
+		return -EBADF;
+
+	if (fixed) {
+		ret = io_import_fixed(req->ctx, sqe);
+		if (ret < 0)
+			return ret;
+		if (rw == READ)
+			return vfs_read(file, buf, ret, &pos);
+		return vfs_write(file, buf, ret, &pos);
+	}
+
+	/* A compat struct iovec is not the native one */
+	if (req->ctx->compat)
+		return -EINVAL;
+	if (rw == READ)
+		return vfs_readv(file, buf, sqe->len, &pos);
+	return vfs_writev(file, buf, sqe->len, &pos);
+}
+
+static int io_fsync(struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	loff_t sqe_off = sqe->off;
+	loff_t sqe_len = sqe->len;
+	loff_t end = sqe_off + sqe_len;
+
+	if (unlikely(sqe->ioprio || sqe->buf_index))
+		return -EINVAL;
+	if (unlikely(sqe->fsync_flags & ~IORING_FSYNC_DATASYNC))
+		return -EINVAL;
+
+	return vfs_fsync_range(req->file, sqe_off,
+			       sqe_len ? end - 1 : LLONG_MAX,
+			       sqe->fsync_flags & IORING_FSYNC_DATASYNC);
+}
+
+static long io_issue_sqe(struct io_kiocb *req)
+{
+	switch (req->sqe.opcode) {
+	case IORING_OP_READV:
+		return io_read_write(req, READ, false);
+	case IORING_OP_WRITEV:
+		return io_read_write(req, WRITE, false);
+	case IORING_OP_READ_FIXED:
+		return io_read_write(req, READ, true);
+	case IORING_OP_WRITE_FIXED:
+		return io_read_write(req, WRITE, true);
+	case IORING_OP_FSYNC:
+		return io_fsync(req);
+	}
+	return -EINVAL;
+}
+
+/*
+ * Reads, writes and fsyncs are done here, in the mm of the ring's creator
+ * for the user addresses of the sqe; and with USER_DS, for them not to
+ * reach the kernel.
+ */
+static void io_sq_wq_submit_work(struct work_struct *work)
+{
+	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
+	struct mm_struct *mm = req->ctx->sqo_mm;
+	mm_segment_t old_fs;
+	long ret;
+
+	if (!atomic_inc_not_zero(&mm->mm_users)) {
+		ret = -EFAULT;
+	} else {
+		old_fs = get_fs();
+		set_fs(USER_DS);
+		use_mm(mm);
+		ret = io_issue_sqe(req);
+		unuse_mm(mm);
+		set_fs(old_fs);
+		mmput(mm);
+	}
+
+	if (unlikely(ret == -ERESTARTSYS || ret == -ERESTARTNOINTR ||
+		     ret == -ERESTARTNOHAND ||
+		     ret == -ERESTART_RESTARTBLOCK))
+		ret = -EINTR;
+	io_cqring_add_event(req->ctx, req->sqe.user_data, ret);
+	io_free_req(req);
+}
+
+/*
+ * IORING_OP_POLL_ADD: a one-shot wait for the poll events of the sqe,
+ * completed with the events which became ready, as IOCB_CMD_POLL is.  The
+ * wakeup has the events checked again from the workqueue, since
+ * f_op->poll() may sleep.
+ *
+ * Whoever takes the wait off the waitqueue, under its lock, owns the
+ * request: the wakeup and IORING_OP_POLL_REMOVE then queue the work, and
+ * the work either queues the wait again or completes the request.  The
+ * submitter holds a reference of its own until it is done with the
+ * request, which may be woken as soon as f_op->poll() has queued it.
+ */
+static void io_poll_put(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	unsigned long flags;
+	long res;
+
+	if (!atomic_dec_and_test(&req->refs))
+		return;
+
+	res = req->poll.error ? req->poll.error : req->result;
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	list_del(&req->list);
+	io_cqring_fill_event(ctx, req->sqe.user_data, res);
+	io_commit_cqring(ctx);
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+	io_cqring_ev_posted(ctx);
+	io_free_req(req);
+}
+
+/* Drops the wait's reference, once it is off the waitqueue for good */
+static void io_poll_complete(struct io_kiocb *req, unsigned mask)
+{
+	req->result = mask;
+	io_poll_put(req);
+}
+
+static int io_poll_wake(wait_queue_t *wait, unsigned mode, int sync,
+			void *key)
+{
+	struct io_poll_iocb *poll = container_of(wait, struct io_poll_iocb,
+						 wait);
+	struct io_kiocb *req = container_of(poll, struct io_kiocb, poll);
+
+	if (key && !((unsigned long)key & poll->events))
+		return 0;
+
+	list_del_init(&wait->task_list);
+	queue_work(req->ctx->sqo_wq, &req->work);
+	return 1;
+}
+
+static void io_poll_work(struct work_struct *work)
+{
+	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
+	struct io_poll_iocb *poll = &req->poll;
+	unsigned mask = 0;
+
+	if (!ACCESS_ONCE(poll->cancelled)) {
+		spin_lock_irq(&poll->head->lock);
+		__add_wait_queue(poll->head, &poll->wait);
+		spin_unlock_irq(&poll->head->lock);
+
+		mask = req->file->f_op->poll(req->file, NULL) & poll->events;
+		if (!mask && !ACCESS_ONCE(poll->cancelled))
+			return;
+
+		spin_lock_irq(&poll->head->lock);
+		if (list_empty(&poll->wait.task_list)) {
+			/* Woken or cancelled meanwhile: the work is queued */
+			spin_unlock_irq(&poll->head->lock);
+			return;
+		}
+		list_del_init(&poll->wait.task_list);
+		spin_unlock_irq(&poll->head->lock);
+	}
+	io_poll_complete(req, mask);
+}
+
+/* Called with ctx->completion_lock held, interrupts off */
+static void io_poll_cancel(struct io_kiocb *req)
+{
+	struct io_poll_iocb *poll = &req->poll;
+	wait_queue_head_t *head = ACCESS_ONCE(poll->head);
+
+	poll->cancelled = true;
+	if (!head)
+		return;		/* the submitter sees it */
+
+	spin_lock(&head->lock);
+	if (!list_empty(&poll->wait.task_list)) {
+		list_del_init(&poll->wait.task_list);
+		queue_work(req->ctx->sqo_wq, &req->work);
+	}
+	spin_unlock(&head->lock);
+}
+
+static void io_poll_remove_all(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+
+	spin_lock_irq(&ctx->completion_lock);
+	list_for_each_entry(req, &ctx->cancel_list, list)
+		io_poll_cancel(req);
+	spin_unlock_irq(&ctx->completion_lock);
+}
+
+/* IORING_OP_POLL_REMOVE: cancel the poll whose user_data is sqe->addr */
+static int io_poll_remove(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_kiocb *poll_req;
+	int ret = -ENOENT;
+
+	if (req->sqe.ioprio || req->sqe.off || req->sqe.len ||
+	    req->sqe.buf_index || req->sqe.poll_events)
+		return -EINVAL;
+
+	spin_lock_irq(&ctx->completion_lock);
+	list_for_each_entry(poll_req, &ctx->cancel_list, list) {
+		if (poll_req->sqe.user_data == req->sqe.addr) {
+			io_poll_cancel(poll_req);
+			ret = 0;
+			break;
+		}
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+	return ret;
+}
+
+static void io_poll_queue_proc(struct file *file, wait_queue_head_t *head,
+			       poll_table *pt)
+{
+	struct io_poll_iocb *poll = container_of(pt, struct io_poll_iocb, pt);
+
+	/* A single wait cannot be on several waitqueues */
+	if (unlikely(poll->head)) {
+		poll->error = -EINVAL;
+		return;
+	}
+	poll->head = head;
+	add_wait_queue(head, &poll->wait);
+}
+
+static int io_poll_add(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_poll_iocb *poll = &req->poll;
+	struct file *file = req->file;
+	unsigned mask;
+
+	if (req->sqe.addr || req->sqe.ioprio || req->sqe.off ||
+	    req->sqe.len || req->sqe.buf_index)
+		return -EINVAL;
+	if (!file->f_op->poll)
+		return -EBADF;
+
+	poll->events = req->sqe.poll_events | POLLERR | POLLHUP;
+	poll->head = NULL;
+	poll->cancelled = false;
+	poll->error = 0;
+	init_waitqueue_func_entry(&poll->wait, io_poll_wake);
+	init_poll_funcptr(&poll->pt, io_poll_queue_proc);
+	poll->pt._key = poll->events;
+	INIT_WORK(&req->work, io_poll_work);
+	req->result = 0;
+	/* the submitter's, and the wait's */
+	atomic_set(&req->refs, 2);
+
+	spin_lock_irq(&ctx->completion_lock);
+	list_add_tail(&req->list, &ctx->cancel_list);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	mask = file->f_op->poll(file, &poll->pt) & poll->events;
+	if (!poll->head) {
+		/* Nothing to wait on: the file is always ready */
+		io_poll_complete(req, mask);
+	} else if (mask || poll->error || ACCESS_ONCE(poll->cancelled)) {
+		spin_lock_irq(&poll->head->lock);
+		if (!list_empty(&poll->wait.task_list)) {
+			list_del_init(&poll->wait.task_list);
+			io_poll_complete(req, mask);
+		}
+		/* or it was woken already, and the work completes it */
+		spin_unlock_irq(&poll->head->lock);
+	}
+	io_poll_put(req);
+	return 0;
+}
+
+/*
+ * Returns an error to complete the sqe with, or 0 once the request is on
+ * its way.
+ */
+static int io_submit_sqe(struct io_ring_ctx *ctx,
+			 const struct io_uring_sqe *sqe)
+{
+	struct io_kiocb *req;
+	int ret;
+
+	if (unlikely(sqe->flags & ~IOSQE_FIXED_FILE))
+		return -EINVAL;
+
+	req = io_get_req(ctx);
+	if (unlikely(!req))
+		return -EAGAIN;
+	req->sqe = *sqe;
+
+	switch (sqe->opcode) {
+	case IORING_OP_NOP:
+		io_cqring_add_event(ctx, sqe->user_data, 0);
+		io_free_req(req);
+		return 0;
+
+	case IORING_OP_POLL_REMOVE:
+		ret = io_poll_remove(req);
+		if (!ret)
+			io_cqring_add_event(ctx, sqe->user_data, 0);
+		break;
+
+	case IORING_OP_POLL_ADD:
+		ret = io_req_set_file(ctx, req);
+		if (!ret)
+			ret = io_poll_add(req);
+		if (ret)
+			break;
+		return 0;
+
+	case IORING_OP_READV:
+	case IORING_OP_WRITEV:
+	case IORING_OP_READ_FIXED:
+	case IORING_OP_WRITE_FIXED:
+	case IORING_OP_FSYNC:
+		ret = io_req_set_file(ctx, req);
+		if (ret)
+			break;
+		INIT_WORK(&req->work, io_sq_wq_submit_work);
+		queue_work(ctx->sqo_wq, &req->work);
+		return 0;
+
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	io_free_req(req);
+	return ret;
+}
+
+/*
+ * Copies the next sqe from the SQ ring, skipping the entries with an index
+ * out of range.  The head is only stored back by io_commit_sqring().
+ */
+static bool io_get_sqring(struct io_ring_ctx *ctx, struct io_uring_sqe *sqe)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+	unsigned head, index;
+
+	for (;;) {
+		head = ctx->cached_sq_head;
+		/* See comment at the top of this file */
+		smp_rmb();
+		if (head == ACCESS_ONCE(ring->r.tail))
+			return false;
+
+		index = ACCESS_ONCE(ring->array[head & ctx->sq_mask]);
+		ctx->cached_sq_head++;
+		if (likely(index < ctx->sq_entries)) {
+			*sqe = ctx->sq_sqes[index];
+			return true;
+		}
+		ring->dropped++;
+	}
+}
+
+static void io_commit_sqring(struct io_ring_ctx *ctx)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+
+	if (ring->r.head != ctx->cached_sq_head) {
+		/* the sqes were copied before userspace may reuse them */
+		smp_mb();
+		ACCESS_ONCE(ring->r.head) = ctx->cached_sq_head;
+	}
+}
+
+/* Called with ctx->uring_lock held */
+static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned to_submit)
+{
+	struct io_uring_sqe sqe;
+	struct blk_plug plug;
+	unsigned i;
+	int ret;
+
+	blk_start_plug(&plug);
+	for (i = 0; i < to_submit; i++) {
+		if (!io_get_sqring(ctx, &sqe))
+			break;
+		ret = io_submit_sqe(ctx, &sqe);
+		if (ret)
+			io_cqring_add_event(ctx, sqe.user_data, ret);
+	}
+	io_commit_sqring(ctx);
+	blk_finish_plug(&plug);
+
+	return i;
+}
+
+static bool io_sqring_empty(struct io_ring_ctx *ctx)
+{
+	/* See comment at the top of this file */
+	smp_rmb();
+	return ctx->cached_sq_head == ACCESS_ONCE(ctx->sq_ring->r.tail);
+}
+
+/*
+ * The SQ polling thread: submits whatever userspace queues, and goes to
+ * sleep after sq_thread_idle without any, with IORING_SQ_NEED_WAKEUP set
+ * for io_uring_enter() to wake it up again.
+ */
+static int io_sq_thread(void *data)
+{
+	struct io_ring_ctx *ctx = data;
+	unsigned long timeout = jiffies + ctx->sq_thread_idle;
+	DEFINE_WAIT(wait);
+
+	while (!kthread_should_stop()) {
+		if (!io_sqring_empty(ctx)) {
+			mutex_lock(&ctx->uring_lock);
+			io_submit_sqes(ctx, ctx->sq_entries);
+			mutex_unlock(&ctx->uring_lock);
+			timeout = jiffies + ctx->sq_thread_idle;
+			continue;
+		}
+
+		if (time_before(jiffies, timeout)) {
+			cond_resched();
+			continue;
+		}
+
+		prepare_to_wait(&ctx->sqo_wait, &wait, TASK_INTERRUPTIBLE);
+		ctx->sq_ring->flags |= IORING_SQ_NEED_WAKEUP;
+		/* the flag before the test of the tail, see io_uring_enter() */
+		smp_mb();
+		if (io_sqring_empty(ctx) && !kthread_should_stop())
+			schedule();
+		finish_wait(&ctx->sqo_wait, &wait);
+		ctx->sq_ring->flags &= ~IORING_SQ_NEED_WAKEUP;
+		timeout = jiffies + ctx->sq_thread_idle;
+	}
+	return 0;
+}
+
+static int io_sq_offload_start(struct io_ring_ctx *ctx,
+			       struct io_uring_params *p)
+{
+	int ret;
+
+	ctx->sqo_mm = current->mm;
+	atomic_inc(&ctx->sqo_mm->mm_count);
+
+	ctx->sqo_wq = alloc_workqueue("io_ring-wq", WQ_UNBOUND | WQ_FREEZABLE,
+				      min(ctx->sq_entries - 1,
+					  2 * num_online_cpus()));
+	if (!ctx->sqo_wq)
+		return -ENOMEM;
+
+	if (!(ctx->flags & IORING_SETUP_SQPOLL)) {
+		if (ctx->flags & IORING_SETUP_SQ_AFF)
+			return -EINVAL;
+		return 0;
+	}
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	ctx->sq_thread_idle = msecs_to_jiffies(p->sq_thread_idle);
+	if (!ctx->sq_thread_idle)
+		ctx->sq_thread_idle = HZ;
+
+	ctx->sqo_thread = kthread_create(io_sq_thread, ctx, "io_uring-sq");
+	if (IS_ERR(ctx->sqo_thread)) {
+		ret = PTR_ERR(ctx->sqo_thread);
+		ctx->sqo_thread = NULL;
+		return ret;
+	}
+
+	if (ctx->flags & IORING_SETUP_SQ_AFF) {
+		unsigned cpu = p->sq_thread_cpu;
+
+		if (cpu >= nr_cpu_ids || !cpu_online(cpu)) {
+			kthread_stop(ctx->sqo_thread);
+			ctx->sqo_thread = NULL;
+			return -EINVAL;
+		}
+		kthread_bind(ctx->sqo_thread, cpu);
+	}
+	wake_up_process(ctx->sqo_thread);
+	return 0;
+}
+
+static void io_sq_offload_stop(struct io_ring_ctx *ctx)
+{
+	if (ctx->sqo_thread) {
+		kthread_stop(ctx->sqo_thread);
+		ctx->sqo_thread = NULL;
+	}
+	if (ctx->sqo_wq) {
+		destroy_workqueue(ctx->sqo_wq);
+		ctx->sqo_wq = NULL;
+	}
+}
+
+static void io_sqe_files_unregister(struct io_ring_ctx *ctx)
+{
+	unsigned i;
+
+	for (i = 0; i < ctx->nr_user_files; i++)
+		fput(ctx->user_files[i]);
+	kfree(ctx->user_files);
+	ctx->user_files = NULL;
+	ctx->nr_user_files = 0;
+}
+
+static int io_sqe_files_register(struct io_ring_ctx *ctx, void __user *arg,
+				 unsigned nr_args)
+{
+	__s32 __user *fds = (__s32 __user *) arg;
+	int ret = 0;
+	unsigned i;
+
+	if (ctx->user_files)
+		return -EBUSY;
+	if (!nr_args || nr_args > IORING_MAX_FIXED_FILES)
+		return -EINVAL;
+
+	ctx->user_files = kcalloc(nr_args, sizeof(struct file *), GFP_KERNEL);
+	if (!ctx->user_files)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_args; i++) {
+		struct file *file;
+		__s32 fd;
+
+		ret = -EFAULT;
+		if (copy_from_user(&fd, &fds[i], sizeof(fd)))
+			break;
+
+		ret = -EBADF;
+		file = fget(fd);
+		if (!file)
+			break;
+		/* A ring among its own fixed files would never be freed */
+		if (file->f_op == &io_uring_fops) {
+			fput(file);
+			break;
+		}
+		ctx->user_files[i] = file;
+		ctx->nr_user_files++;
+		ret = 0;
+	}
+
+	if (ret)
+		io_sqe_files_unregister(ctx);
+	return ret;
+}
+
+static void io_unaccount_mem(struct mm_struct *mm, unsigned long nr_pages)
+{
+	down_write(&mm->mmap_sem);
+	mm->pinned_vm -= nr_pages;
+	up_write(&mm->mmap_sem);
+}
+
+static void io_sqe_buffer_unregister(struct io_ring_ctx *ctx)
+{
+	unsigned i, j;
+
+	for (i = 0; i < ctx->nr_user_bufs; i++) {
+		struct io_mapped_ubuf *imu = &ctx->user_bufs[i];
+
+		for (j = 0; j < imu->nr_pages; j++)
+			put_page(imu->pages[j]);
+		io_unaccount_mem(ctx->sqo_mm, imu->nr_pages);
+		kvfree(imu->pages);
+	}
+	kfree(ctx->user_bufs);
+	ctx->user_bufs = NULL;
+	ctx->nr_user_bufs = 0;
+}
+
+static int io_copy_iov(struct io_ring_ctx *ctx, struct iovec *dst,
+		       void __user *arg, unsigned index)
+{
+	struct iovec __user *src;
+
+#ifdef CONFIG_COMPAT
+	if (ctx->compat) {
+		struct compat_iovec __user *ciovs;
+		struct compat_iovec ciov;
+
+		ciovs = (struct compat_iovec __user *) arg;
+		if (copy_from_user(&ciov, &ciovs[index], sizeof(ciov)))
+			return -EFAULT;
+
+		dst->iov_base = compat_ptr(ciov.iov_base);
+		dst->iov_len = ciov.iov_len;
+		return 0;
+	}
+#endif
+
+	src = (struct iovec __user *) arg;
+	if (copy_from_user(dst, &src[index], sizeof(*dst)))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Pins the pages of one buffer, charged to RLIMIT_MEMLOCK as the pages
+ * pinned by RDMA memory registration are.  Only anonymous and hugetlbfs
+ * memory can be registered: the pages of a file may be truncated or
+ * written back under the pin.
+ */
+static int io_sqe_buffer_map(struct io_ring_ctx *ctx,
+			     struct io_mapped_ubuf *imu, struct iovec *iov)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct **vmas = NULL;
+	unsigned long ubuf, start, end, nr_pages, lock_limit;
+	long pret;
+	int ret, i;
+
+	ubuf = (unsigned long) iov->iov_base;
+	if (!iov->iov_len || iov->iov_len > SZ_1G || ubuf + iov->iov_len < ubuf)
+		return -EFAULT;
+
+	start = ubuf >> PAGE_SHIFT;
+	end = (ubuf + iov->iov_len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	nr_pages = end - start;
+
+	imu->pages = kmalloc(nr_pages * sizeof(struct page *),
+			     GFP_KERNEL | __GFP_NOWARN);
+	if (!imu->pages)
+		imu->pages = vmalloc(nr_pages * sizeof(struct page *));
+	vmas = kmalloc(nr_pages * sizeof(struct vm_area_struct *),
+		       GFP_KERNEL | __GFP_NOWARN);
+	if (!vmas)
+		vmas = vmalloc(nr_pages * sizeof(struct vm_area_struct *));
+	ret = -ENOMEM;
+	if (!imu->pages || !vmas)
+		goto err;
+
+	lock_limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+
+	down_write(&mm->mmap_sem);
+	if (mm->pinned_vm + nr_pages > lock_limit && !capable(CAP_IPC_LOCK)) {
+		up_write(&mm->mmap_sem);
+		goto err;
+	}
+	mm->pinned_vm += nr_pages;
+
+	pret = get_user_pages(current, mm, ubuf & PAGE_MASK, nr_pages, 1, 0,
+			      imu->pages, vmas);
+	ret = -EFAULT;
+	if (pret == nr_pages) {
+		ret = 0;
+		for (i = 0; i < nr_pages; i++) {
+			struct vm_area_struct *vma = vmas[i];
+
+			if (vma->vm_file && !is_file_hugepages(vma->vm_file)) {
+				ret = -EOPNOTSUPP;
+				break;
+			}
+		}
+	}
+	if (ret) {
+		for (i = 0; i < pret; i++)
+			put_page(imu->pages[i]);
+		mm->pinned_vm -= nr_pages;
+	}
+	up_write(&mm->mmap_sem);
+	if (ret)
+		goto err;
+
+	kvfree(vmas);
+	imu->ubuf = ubuf;
+	imu->len = iov->iov_len;
+	imu->nr_pages = nr_pages;
+	return 0;
+err:
+	kvfree(vmas);
+	kvfree(imu->pages);
+	imu->pages = NULL;
+	return ret;
+}
+
+static int io_sqe_buffer_register(struct io_ring_ctx *ctx, void __user *arg,
+				  unsigned nr_args)
+{
+	int ret = 0;
+	unsigned i;
+
+	if (ctx->user_bufs)
+		return -EBUSY;
+	if (!nr_args || nr_args > UIO_MAXIOV)
+		return -EINVAL;
+	/* The pages are charged to sqo_mm, and uncharged from it */
+	if (current->mm != ctx->sqo_mm)
+		return -EINVAL;
+
+	ctx->user_bufs = kcalloc(nr_args, sizeof(struct io_mapped_ubuf),
+				 GFP_KERNEL);
+	if (!ctx->user_bufs)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_args; i++) {
+		struct iovec iov;
+
+		ret = io_copy_iov(ctx, &iov, arg, i);
+		if (ret)
+			break;
+		ret = io_sqe_buffer_map(ctx, &ctx->user_bufs[i], &iov);
+		if (ret)
+			break;
+		ctx->nr_user_bufs++;
+	}
+
+	if (ret)
+		io_sqe_buffer_unregister(ctx);
+	return ret;
+}
+
+static void *io_mem_alloc(size_t size)
+{
+	gfp_t gfp_flags = GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN |
+			  __GFP_NORETRY;
+
+	return (void *) __get_free_pages(gfp_flags, get_order(size));
+}
+
+static void io_mem_free(void *ptr, size_t size)
+{
+	if (ptr)
+		free_pages((unsigned long) ptr, get_order(size));
+}
+
+static int io_allocate_scq_urings(struct io_ring_ctx *ctx,
+				  struct io_uring_params *p)
+{
+	struct io_sq_ring *sq_ring;
+	struct io_cq_ring *cq_ring;
+
+	ctx->sq_ring_size = sizeof(struct io_sq_ring) +
+			    p->sq_entries * sizeof(u32);
+	sq_ring = io_mem_alloc(ctx->sq_ring_size);
+	if (!sq_ring)
+		return -ENOMEM;
+	ctx->sq_ring = sq_ring;
+	sq_ring->ring_mask = p->sq_entries - 1;
+	sq_ring->ring_entries = p->sq_entries;
+	ctx->sq_mask = sq_ring->ring_mask;
+	ctx->sq_entries = sq_ring->ring_entries;
+
+	ctx->sq_sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+	ctx->sq_sqes = io_mem_alloc(ctx->sq_sqes_size);
+	if (!ctx->sq_sqes)
+		return -ENOMEM;
+
+	ctx->cq_ring_size = sizeof(struct io_cq_ring) +
+			    p->cq_entries * sizeof(struct io_uring_cqe);
+	cq_ring = io_mem_alloc(ctx->cq_ring_size);
+	if (!cq_ring)
+		return -ENOMEM;
+	ctx->cq_ring = cq_ring;
+	cq_ring->ring_mask = p->cq_entries - 1;
+	cq_ring->ring_entries = p->cq_entries;
+	ctx->cq_mask = cq_ring->ring_mask;
+	ctx->cq_entries = cq_ring->ring_entries;
+	return 0;
+}
+
+static void io_ring_ctx_free(struct io_ring_ctx *ctx)
+{
+	io_sq_offload_stop(ctx);
+	io_sqe_buffer_unregister(ctx);
+	io_sqe_files_unregister(ctx);
+	if (ctx->sqo_mm)
+		mmdrop(ctx->sqo_mm);
+
+	io_mem_free(ctx->sq_ring, ctx->sq_ring_size);
+	io_mem_free(ctx->sq_sqes, ctx->sq_sqes_size);
+	io_mem_free(ctx->cq_ring, ctx->cq_ring_size);
+
+	kfree(ctx);
+}
+
+/*
+ * Stops the submissions, and frees the ring once the requests in flight
+ * have completed: the pending polls are cancelled for that.
+ */
+static void io_ring_ctx_wait_and_kill(struct io_ring_ctx *ctx)
+{
+	mutex_lock(&ctx->uring_lock);
+	percpu_ref_kill(&ctx->refs);
+	mutex_unlock(&ctx->uring_lock);
+
+	/* The SQ polling thread is not to submit anything more */
+	if (ctx->sqo_thread) {
+		kthread_stop(ctx->sqo_thread);
+		ctx->sqo_thread = NULL;
+	}
+
+	io_poll_remove_all(ctx);
+	wait_for_completion(&ctx->ctx_done);
+	io_ring_ctx_free(ctx);
+}
+
+static int io_uring_release(struct inode *inode, struct file *file)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+
+	file->private_data = NULL;
+	io_ring_ctx_wait_and_kill(ctx);
+	return 0;
+}
+
+static unsigned int io_uring_poll(struct file *file, poll_table *wait)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &ctx->cq_wait, wait);
+	/* See comment at the top of this file */
+	smp_rmb();
+	if (ACCESS_ONCE(ctx->sq_ring->r.tail) - ctx->cached_sq_head !=
+	    ctx->sq_ring->ring_entries)
+		mask |= POLLOUT | POLLWRNORM;
+	if (ACCESS_ONCE(ctx->cq_ring->r.head) != ctx->cached_cq_tail)
+		mask |= POLLIN | POLLRDNORM;
+
+	return mask;
+}
+
+static int io_uring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	loff_t offset = (loff_t) vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long sz = vma->vm_end - vma->vm_start;
+	struct io_ring_ctx *ctx = file->private_data;
+	unsigned long pfn;
+	size_t size;
+	void *ptr;
+
+	switch (offset) {
+	case IORING_OFF_SQ_RING:
+		ptr = ctx->sq_ring;
+		size = ctx->sq_ring_size;
+		break;
+	case IORING_OFF_SQES:
+		ptr = ctx->sq_sqes;
+		size = ctx->sq_sqes_size;
+		break;
+	case IORING_OFF_CQ_RING:
+		ptr = ctx->cq_ring;
+		size = ctx->cq_ring_size;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (sz > PAGE_ALIGN(size))
+		return -EINVAL;
+
+	pfn = virt_to_phys(ptr) >> PAGE_SHIFT;
+	return remap_pfn_range(vma, vma->vm_start, pfn, sz, vma->vm_page_prot);
+}
+
+static const struct file_operations io_uring_fops = {
+	.release	= io_uring_release,
+	.mmap		= io_uring_mmap,
+	.poll		= io_uring_poll,
+	.llseek		= noop_llseek,
+};
+
+static int io_cqring_wait(struct io_ring_ctx *ctx, int min_events,
+			  const sigset_t __user *sig, size_t sigsz)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	sigset_t ksigmask, sigsaved;
+	int ret;
+
+	if (io_cqring_events(ring) >= min_events)
+		return 0;
+
+	if (sig) {
+		if (sigsz != sizeof(sigset_t))
+			return -EINVAL;
+		if (copy_from_user(&ksigmask, sig, sizeof(ksigmask)))
+			return -EFAULT;
+		sigsaved = current->blocked;
+		set_current_blocked(&ksigmask);
+	}
+
+	ret = wait_event_interruptible(ctx->wait,
+				       io_cqring_events(ring) >= min_events);
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+
+	/* See sys_epoll_pwait() */
+	if (sig) {
+		if (ret == -EINTR) {
+			memcpy(&current->saved_sigmask, &sigsaved,
+			       sizeof(sigsaved));
+			set_restore_sigmask();
+		} else
+			set_current_blocked(&sigsaved);
+	}
+
+	return ret;
+}
+
+/*
+ * sys_io_uring_enter:
+ *	Submits up to to_submit sqes from the SQ ring, or just wakes up the
+ *	SQ polling thread with IORING_ENTER_SQ_WAKEUP; and, with
+ *	IORING_ENTER_GETEVENTS, waits until at least min_complete
+ *	completions are in the CQ ring.  Returns the number of sqes
+ *	submitted, if any, or the result of the wait.
+ */
+SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
+		u32, min_complete, u32, flags, const sigset_t __user *, sig,
+		size_t, sigsz)
+{
+	struct io_ring_ctx *ctx;
+	long ret = -EBADF;
+	int submitted = 0;
+	struct fd f;
+
+	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP))
+		return -EINVAL;
+
+	f = fdget(fd);
+	if (!f.file)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (f.file->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = f.file->private_data;
+	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		if (flags & IORING_ENTER_SQ_WAKEUP)
+			wake_up(&ctx->sqo_wait);
+		submitted = to_submit;
+	} else if (to_submit) {
+		to_submit = min(to_submit, ctx->sq_entries);
+
+		mutex_lock(&ctx->uring_lock);
+		submitted = io_submit_sqes(ctx, to_submit);
+		mutex_unlock(&ctx->uring_lock);
+	}
+
+	ret = 0;
+	if (flags & IORING_ENTER_GETEVENTS) {
+		min_complete = min(min_complete, ctx->cq_entries);
+		ret = io_cqring_wait(ctx, min_complete, sig, sigsz);
+	}
+
+out_fput:
+	fdput(f);
+	return submitted ? submitted : ret;
+}
+
+static int io_uring_get_fd(struct io_ring_ctx *ctx, struct file **filep)
+{
+	struct file *file;
+	int fd;
+
+	fd = get_unused_fd_flags(O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return fd;
+
+	file = anon_inode_getfile("[io_uring]", &io_uring_fops, ctx,
+				  O_RDWR | O_CLOEXEC);
+	if (IS_ERR(file)) {
+		put_unused_fd(fd);
+		return PTR_ERR(file);
+	}
+
+	*filep = file;
+	return fd;
+}
+
+/*
+ * sys_io_uring_setup:
+ *	Creates a ring of at least entries sqes, rounded up to a power of
+ *	two, with twice as many cqes.  The offsets to mmap the rings at are
+ *	copied back in params.  Returns the file descriptor of the ring.
+ */
+SYSCALL_DEFINE2(io_uring_setup, u32, entries,
+		struct io_uring_params __user *, params)
+{
+	struct io_uring_params p;
+	struct io_ring_ctx *ctx;
+	struct file *file;
+	int ret, fd, i;
+
+	if (copy_from_user(&p, params, sizeof(p)))
+		return -EFAULT;
+	for (i = 0; i < ARRAY_SIZE(p.resv); i++) {
+		if (p.resv[i])
+			return -EINVAL;
+	}
+	if (p.flags & ~(IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF))
+		return -EINVAL;
+	if (!entries || entries > IORING_MAX_ENTRIES)
+		return -EINVAL;
+
+	p.sq_entries = roundup_pow_of_two(entries);
+	p.cq_entries = 2 * p.sq_entries;
+
+	ctx = io_ring_ctx_alloc(&p);
+	if (!ctx)
+		return -ENOMEM;
+	ctx->compat = is_compat_task();
+
+	ret = io_allocate_scq_urings(ctx, &p);
+	if (ret)
+		goto err;
+
+	ret = io_sq_offload_start(ctx, &p);
+	if (ret)
+		goto err;
+
+	memset(&p.sq_off, 0, sizeof(p.sq_off));
+	p.sq_off.head = offsetof(struct io_sq_ring, r.head);
+	p.sq_off.tail = offsetof(struct io_sq_ring, r.tail);
+	p.sq_off.ring_mask = offsetof(struct io_sq_ring, ring_mask);
+	p.sq_off.ring_entries = offsetof(struct io_sq_ring, ring_entries);
+	p.sq_off.flags = offsetof(struct io_sq_ring, flags);
+	p.sq_off.dropped = offsetof(struct io_sq_ring, dropped);
+	p.sq_off.array = offsetof(struct io_sq_ring, array);
+
+	memset(&p.cq_off, 0, sizeof(p.cq_off));
+	p.cq_off.head = offsetof(struct io_cq_ring, r.head);
+	p.cq_off.tail = offsetof(struct io_cq_ring, r.tail);
+	p.cq_off.ring_mask = offsetof(struct io_cq_ring, ring_mask);
+	p.cq_off.ring_entries = offsetof(struct io_cq_ring, ring_entries);
+	p.cq_off.overflow = offsetof(struct io_cq_ring, overflow);
+	p.cq_off.cqes = offsetof(struct io_cq_ring, cqes);
+
+	fd = io_uring_get_fd(ctx, &file);
+	if (fd < 0) {
+		ret = fd;
+		goto err;
+	}
+
+	/* From here on, the ring is freed by the release of the file */
+	if (copy_to_user(params, &p, sizeof(p))) {
+		put_unused_fd(fd);
+		fput(file);
+		return -EFAULT;
+	}
+	fd_install(fd, file);
+	return fd;
+err:
+	io_ring_ctx_wait_and_kill(ctx);
+	return ret;
+}
+
+/*
+ * sys_io_uring_register:
+ *	Registers nr_args file descriptors, or struct iovecs of buffers, at
+ *	arg with a ring, for its sqes to refer to them by index; or drops
+ *	the set registered.  Only one set of each can be registered at once.
+ */
+SYSCALL_DEFINE4(io_uring_register, unsigned int, fd, unsigned int, opcode,
+		void __user *, arg, unsigned int, nr_args)
+{
+	struct io_ring_ctx *ctx;
+	long ret = -EBADF;
+	struct fd f;
+
+	f = fdget(fd);
+	if (!f.file)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (f.file->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = f.file->private_data;
+
+	mutex_lock(&ctx->uring_lock);
+	switch (opcode) {
+	case IORING_REGISTER_BUFFERS:
+		ret = io_sqe_buffer_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_BUFFERS:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = -ENXIO;
+		if (!ctx->user_bufs)
+			break;
+		io_sqe_buffer_unregister(ctx);
+		ret = 0;
+		break;
+	case IORING_REGISTER_FILES:
+		ret = io_sqe_files_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_FILES:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = -ENXIO;
+		if (!ctx->user_files)
+			break;
+		io_sqe_files_unregister(ctx);
+		ret = 0;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+	mutex_unlock(&ctx->uring_lock);
+
+out_fput:
+	fdput(f);
+	return ret;
+}
+
+static int __init io_uring_init(void)
+{
+	req_cachep = KMEM_CACHE(io_kiocb, SLAB_HWCACHE_ALIGN | SLAB_PANIC);
+	return 0;
+};
+__initcall(io_uring_init);
@@ -15,6 +15,7 @@
 #include <linux/writeback.h>
 #include <linux/buffer_head.h>
 #include <linux/falloc.h>
+#include <linux/fincore.h>
 
 #include <asm/ioctls.h>
 
@@ -215,6 +216,31 @@ static int ioctl_fiemap(struct file *filp, unsigned long arg)
 	return error;
 }
 
+/*
+ * Like mincore(), only let those who could write the file see which parts
+ * of it others have been reading.
+ */
+static int ioctl_fincore(struct file *filp, unsigned long arg)
+{
+	struct fincore_range range;
+	struct fincore_range __user *urange = (void __user *)arg;
+	struct inode *inode = file_inode(filp);
+	int error;
+
+	if (!inode_owner_or_capable(inode) &&
+	    inode_permission(inode, MAY_WRITE))
+		return -EPERM;
+
+	if (copy_from_user(&range, urange, sizeof(range)))
+		return -EFAULT;
+
+	error = filemap_fincore(filp->f_mapping, &range, urange->fr_extents);
+	if (!error && copy_to_user(urange, &range, sizeof(range)))
+		error = -EFAULT;
+
+	return error;
+}
+
 #ifdef CONFIG_BLOCK
 
 static inline sector_t logical_to_blk(struct inode *inode, loff_t offset)
@@ -588,6 +614,9 @@ int do_vfs_ioctl(struct file *filp, unsigned int fd, unsigned int cmd,
 	case FS_IOC_FIEMAP:
 		return ioctl_fiemap(filp, arg);
 
+	case FS_IOC_FINCORE:
+		return ioctl_fincore(filp, arg);
+
 	case FIGETBSZ:
 		return put_user(inode->i_sb->s_blocksize, argp);
 
@@ -754,6 +754,220 @@ wait_commit:
 }
 EXPORT_SYMBOL(jbd2_complete_transaction);
 
+/**
+ * jbd2_fc_begin_commit() - start a fast commit on top of a transaction
+ * @journal: Journal to act on.
+ * @tid: The running transaction whose changes the fast commit records.
+ *
+ * Waits for any fast commit or full commit in progress to finish.  Returns
+ * -EALREADY if @tid has been committed meanwhile, so there is nothing left
+ * to do, and -EINVAL if @tid is not the running transaction, so the caller
+ * must wait for its full commit instead.  On success, the fast commit must
+ * be ended with jbd2_fc_end_commit() or jbd2_fc_end_commit_fallback(); until
+ * then, the commit of @tid is held off.
+ */
+int jbd2_fc_begin_commit(journal_t *journal, tid_t tid)
+{
+	if (!journal->j_fc_wbuf)
+		return -EOPNOTSUPP;
+
+	write_lock(&journal->j_state_lock);
+	while (journal->j_flags & (JBD2_FAST_COMMIT_ONGOING |
+				   JBD2_FULL_COMMIT_ONGOING)) {
+		DEFINE_WAIT(wait);
+
+		prepare_to_wait(&journal->j_fc_wait, &wait,
+				TASK_UNINTERRUPTIBLE);
+		write_unlock(&journal->j_state_lock);
+		schedule();
+		finish_wait(&journal->j_fc_wait, &wait);
+		write_lock(&journal->j_state_lock);
+	}
+	if (tid_geq(journal->j_commit_sequence, tid)) {
+		write_unlock(&journal->j_state_lock);
+		return -EALREADY;
+	}
+	if (is_journal_aborted(journal) || !journal->j_running_transaction ||
+	    journal->j_running_transaction->t_tid != tid) {
+		write_unlock(&journal->j_state_lock);
+		return -EINVAL;
+	}
+	journal->j_flags |= JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+
+	/*
+	 * Recovery skips a log marked empty, and with it the fast commit
+	 * area: mark the log in use before the first fast commit block.
+	 */
+	mutex_lock(&journal->j_checkpoint_mutex);
+	if (journal->j_flags & JBD2_FLUSHED)
+		jbd2_journal_update_sb_log_tail(journal,
+						journal->j_tail_sequence,
+						journal->j_tail, WRITE_FUA);
+	mutex_unlock(&journal->j_checkpoint_mutex);
+
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_begin_commit);
+
+static void jbd2_fc_end(journal_t *journal)
+{
+	write_lock(&journal->j_state_lock);
+	journal->j_flags &= ~JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+	wake_up(&journal->j_fc_wait);
+}
+
+/**
+ * jbd2_fc_end_commit() - end a fast commit that was written out
+ * @journal: Journal to act on.
+ */
+int jbd2_fc_end_commit(journal_t *journal)
+{
+	jbd2_fc_end(journal);
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_end_commit);
+
+/**
+ * jbd2_fc_end_commit_fallback() - end a fast commit, with a full commit
+ * @journal: Journal to act on.
+ * @tid: The transaction the fast commit was started on.
+ *
+ * For when the fast commit could not be written: commits @tid in full, and
+ * waits for it.
+ */
+int jbd2_fc_end_commit_fallback(journal_t *journal, tid_t tid)
+{
+	jbd2_fc_end(journal);
+	return jbd2_complete_transaction(journal, tid);
+}
+EXPORT_SYMBOL(jbd2_fc_end_commit_fallback);
+
+/**
+ * jbd2_fc_get_buf() - get the next block of the fast commit area
+ * @journal: Journal to act on.
+ * @bh_out: Returns the buffer, zeroed.
+ *
+ * Returns -ENOSPC once the area is full, until the next full commit.  The
+ * buffer is kept by the journal until jbd2_fc_wait_bufs() or the next full
+ * commit releases it.
+ */
+int jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out)
+{
+	unsigned long long pblock;
+	unsigned long blocknr;
+	struct buffer_head *bh;
+	int ret;
+
+	*bh_out = NULL;
+	if (journal->j_fc_off >= journal->j_fc_last - journal->j_fc_first)
+		return -ENOSPC;
+
+	blocknr = journal->j_fc_first + journal->j_fc_off;
+	ret = jbd2_journal_bmap(journal, blocknr, &pblock);
+	if (ret)
+		return ret;
+
+	bh = __getblk(journal->j_dev, pblock, journal->j_blocksize);
+	if (!bh)
+		return -ENOMEM;
+
+	memset(bh->b_data, 0, journal->j_blocksize);
+	journal->j_fc_wbuf[journal->j_fc_off++] = bh;
+	*bh_out = bh;
+
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_get_buf);
+
+/**
+ * jbd2_fc_wait_bufs() - wait for the last fast commit blocks to be written
+ * @journal: Journal to act on.
+ * @num_blks: Number of blocks handed out by jbd2_fc_get_buf() to wait for.
+ */
+int jbd2_fc_wait_bufs(journal_t *journal, int num_blks)
+{
+	struct buffer_head *bh;
+	int i, j_fc_off, ret = 0;
+
+	j_fc_off = journal->j_fc_off;
+	for (i = j_fc_off - 1; i >= j_fc_off - num_blks; i--) {
+		bh = journal->j_fc_wbuf[i];
+		wait_on_buffer(bh);
+		if (unlikely(!buffer_uptodate(bh)))
+			ret = -EIO;
+		put_bh(bh);
+		journal->j_fc_wbuf[i] = NULL;
+	}
+
+	return ret;
+}
+EXPORT_SYMBOL(jbd2_fc_wait_bufs);
+
+/*
+ * Drop the fast commit blocks still held, and start the area afresh: once
+ * the transaction they were written on top of is committed, recovery no
+ * longer looks at them.
+ */
+static void jbd2_fc_release_bufs(journal_t *journal)
+{
+	int i;
+
+	for (i = 0; i < journal->j_fc_off; i++) {
+		if (journal->j_fc_wbuf[i]) {
+			put_bh(journal->j_fc_wbuf[i]);
+			journal->j_fc_wbuf[i] = NULL;
+		}
+	}
+	journal->j_fc_off = 0;
+}
+
+/*
+ * Called by the commit of a transaction: hold any further fast commit off,
+ * and wait for the one in progress, which the commit would otherwise race
+ * with for the transaction's metadata.
+ */
+void jbd2_fc_start_full_commit(journal_t *journal)
+{
+	if (!journal->j_fc_wbuf)
+		return;
+
+	write_lock(&journal->j_state_lock);
+	journal->j_flags |= JBD2_FULL_COMMIT_ONGOING;
+	while (journal->j_flags & JBD2_FAST_COMMIT_ONGOING) {
+		DEFINE_WAIT(wait);
+
+		prepare_to_wait(&journal->j_fc_wait, &wait,
+				TASK_UNINTERRUPTIBLE);
+		write_unlock(&journal->j_state_lock);
+		schedule();
+		finish_wait(&journal->j_fc_wait, &wait);
+		write_lock(&journal->j_state_lock);
+	}
+	write_unlock(&journal->j_state_lock);
+}
+
+/*
+ * Called at the end of the commit of @tid: the fast commits on top of it are
+ * obsolete, so the area can be reused and the filesystem can forget what it
+ * tracked for them.
+ */
+void jbd2_fc_end_full_commit(journal_t *journal, tid_t tid)
+{
+	if (!journal->j_fc_wbuf)
+		return;
+
+	jbd2_fc_release_bufs(journal);
+	if (journal->j_fc_cleanup_callback)
+		journal->j_fc_cleanup_callback(journal, tid);
+
+	write_lock(&journal->j_state_lock);
+	journal->j_flags &= ~JBD2_FULL_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+	wake_up(&journal->j_fc_wait);
+}
+
 /*
  * Log buffer allocation routines:
  */
@@ -1082,6 +1296,7 @@ static journal_t * journal_init_common (void)
 	init_waitqueue_head(&journal->j_wait_commit);
 	init_waitqueue_head(&journal->j_wait_updates);
 	init_waitqueue_head(&journal->j_wait_reserved);
+	init_waitqueue_head(&journal->j_fc_wait);
 	mutex_init(&journal->j_barrier);
 	mutex_init(&journal->j_checkpoint_mutex);
 	spin_lock_init(&journal->j_revoke_lock);
@@ -1267,6 +1482,46 @@ static void journal_fail_superblock (journal_t *journal)
 	journal->j_sb_buffer = NULL;
 }
 
+static unsigned long journal_fc_blocks(journal_superblock_t *sb)
+{
+	unsigned long num_fc_blks = be32_to_cpu(sb->s_num_fc_blks);
+
+	return num_fc_blks ? num_fc_blks : JBD2_DEFAULT_FAST_COMMIT_BLOCKS;
+}
+
+/*
+ * The fast commit area is carved out of the end of the journal.  Set up its
+ * bounds, and return the end of the log proper, which stops short of it.
+ */
+static unsigned long journal_fc_area_init(journal_t *journal)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+	unsigned long last = be32_to_cpu(sb->s_maxlen);
+
+	journal->j_fc_last = last;
+	if (JBD2_HAS_INCOMPAT_FEATURE(journal,
+				      JBD2_FEATURE_INCOMPAT_FAST_COMMIT))
+		last -= journal_fc_blocks(sb);
+	journal->j_fc_first = last;
+	journal->j_fc_off = 0;
+
+	return last;
+}
+
+static int journal_fc_alloc_wbuf(journal_t *journal, unsigned long n)
+{
+	if (journal->j_fc_wbuf)
+		return 0;
+	journal->j_fc_wbuf = kmalloc(n * sizeof(struct buffer_head *),
+				     GFP_KERNEL);
+	if (!journal->j_fc_wbuf) {
+		printk(KERN_ERR "%s: Can't allocate bhs for fast commits\n",
+			__func__);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
 /*
  * Given a journal_t structure, initialise the various fields for
  * startup of a new journaling session.  We use this both when creating
@@ -1280,7 +1535,7 @@ static int journal_reset(journal_t *journal)
 	unsigned long long first, last;
 
 	first = be32_to_cpu(sb->s_first);
-	last = be32_to_cpu(sb->s_maxlen);
+	last = journal_fc_area_init(journal);
 	if (first + JBD2_MIN_JOURNAL_BLOCKS > last + 1) {
 		printk(KERN_ERR "JBD2: Journal too short (blocks %llu-%llu).\n",
 		       first, last);
@@ -1546,6 +1801,15 @@ static int journal_get_superblock(journal_t *journal)
 		}
 	}
 
+	if (JBD2_HAS_INCOMPAT_FEATURE(journal,
+				      JBD2_FEATURE_INCOMPAT_FAST_COMMIT) &&
+	    be32_to_cpu(sb->s_first) + JBD2_MIN_JOURNAL_BLOCKS +
+	    journal_fc_blocks(sb) > journal->j_maxlen) {
+		printk(KERN_ERR "JBD2: Fast commit area too large: %lu\n",
+		       journal_fc_blocks(sb));
+		goto out;
+	}
+
 	/* Check superblock checksum */
 	if (!jbd2_superblock_csum_verify(journal, sb)) {
 		printk(KERN_ERR "JBD2: journal checksum error\n");
@@ -1585,9 +1849,13 @@ static int load_superblock(journal_t *journal)
 	journal->j_tail_sequence = be32_to_cpu(sb->s_sequence);
 	journal->j_tail = be32_to_cpu(sb->s_start);
 	journal->j_first = be32_to_cpu(sb->s_first);
-	journal->j_last = be32_to_cpu(sb->s_maxlen);
+	journal->j_last = journal_fc_area_init(journal);
 	journal->j_errno = be32_to_cpu(sb->s_errno);
 
+	if (JBD2_HAS_INCOMPAT_FEATURE(journal,
+				      JBD2_FEATURE_INCOMPAT_FAST_COMMIT))
+		return journal_fc_alloc_wbuf(journal, journal->j_fc_last -
+						    journal->j_fc_first);
 	return 0;
 }
 
@@ -1713,6 +1981,7 @@ int jbd2_journal_destroy(journal_t *journal)
 	if (journal->j_chksum_driver)
 		crypto_free_shash(journal->j_chksum_driver);
 	kfree(journal->j_wbuf);
+	kfree(journal->j_fc_wbuf);
 	kfree(journal);
 
 	return err;
@@ -1786,6 +2055,58 @@ int jbd2_journal_check_available_features (journal_t *journal, unsigned long com
 	return 0;
 }
 
+/*
+ * The fast commit area takes the end of the log, so it can only be set up
+ * while nothing lives there: right after the journal is loaded, before the
+ * first transaction.  The superblock goes out at once, as recovery must
+ * know about the area before anything is written to it.
+ */
+static int journal_enable_fast_commit(journal_t *journal)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+	unsigned long num_fc_blks = JBD2_DEFAULT_FAST_COMMIT_BLOCKS;
+	int err;
+
+	if (be32_to_cpu(sb->s_first) + JBD2_MIN_JOURNAL_BLOCKS +
+	    num_fc_blks > be32_to_cpu(sb->s_maxlen))
+		return -EINVAL;
+	err = journal_fc_alloc_wbuf(journal, num_fc_blks);
+	if (err)
+		return err;
+
+	mutex_lock(&journal->j_checkpoint_mutex);
+	write_lock(&journal->j_state_lock);
+	if (journal->j_running_transaction ||
+	    journal->j_committing_transaction ||
+	    journal->j_head != journal->j_tail ||
+	    journal->j_free != journal->j_last - journal->j_first) {
+		err = -EBUSY;
+		goto out_unlock;
+	}
+
+	sb->s_num_fc_blks = cpu_to_be32(num_fc_blks);
+	sb->s_feature_incompat |=
+		cpu_to_be32(JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+	journal->j_last = journal_fc_area_init(journal);
+	journal->j_free = journal->j_last - journal->j_first;
+	if (journal->j_head >= journal->j_last) {
+		journal->j_head = journal->j_first;
+		journal->j_tail = journal->j_first;
+		if (sb->s_start)
+			sb->s_start = cpu_to_be32(journal->j_first);
+	}
+	write_unlock(&journal->j_state_lock);
+
+	jbd2_write_superblock(journal, WRITE_FUA);
+	mutex_unlock(&journal->j_checkpoint_mutex);
+	return 0;
+
+out_unlock:
+	write_unlock(&journal->j_state_lock);
+	mutex_unlock(&journal->j_checkpoint_mutex);
+	return err;
+}
+
 /**
  * int jbd2_journal_set_features () - Mark a given journal feature in the superblock
  * @journal: Journal to act on.
@@ -1854,6 +2175,11 @@ int jbd2_journal_set_features (journal_t *journal, unsigned long compat,
 		sb->s_feature_incompat &=
 			~cpu_to_be32(JBD2_FEATURE_INCOMPAT_CSUM_V2);
 
+	/* If enabling fast commits, carve their area out of the log */
+	if (INCOMPAT_FEATURE_ON(JBD2_FEATURE_INCOMPAT_FAST_COMMIT) &&
+	    journal_enable_fast_commit(journal))
+		return 0;
+
 	sb->s_feature_compat    |= cpu_to_be32(compat);
 	sb->s_feature_ro_compat |= cpu_to_be32(ro);
 	sb->s_feature_incompat  |= cpu_to_be32(incompat);
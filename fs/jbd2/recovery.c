@@ -38,11 +38,12 @@ struct recovery_info
 	int		nr_revoke_hits;
 };
 
-enum passtype {PASS_SCAN, PASS_REVOKE, PASS_REPLAY};
 static int do_one_pass(journal_t *journal,
 				struct recovery_info *info, enum passtype pass);
 static int scan_revoke_records(journal_t *, struct buffer_head *,
 				tid_t, struct recovery_info *);
+static int fc_do_one_pass(journal_t *journal,
+			  struct recovery_info *info, enum passtype pass);
 
 #ifdef __KERNEL__
 
@@ -244,6 +245,10 @@ do {									\
  * end of the log.  In the second, we assemble the list of revoke
  * blocks.  In the third and final pass, we replay any un-revoked blocks
  * in the log.
+ *
+ * If the journal has a fast commit area, the fast commits written on top of
+ * the last committed transaction are then handed to the filesystem, in a
+ * scan pass and a replay pass of their own.
  */
 int jbd2_journal_recover(journal_t *journal)
 {
@@ -273,6 +278,10 @@ int jbd2_journal_recover(journal_t *journal)
 		err = do_one_pass(journal, &info, PASS_REVOKE);
 	if (!err)
 		err = do_one_pass(journal, &info, PASS_REPLAY);
+	if (!err)
+		err = fc_do_one_pass(journal, &info, PASS_SCAN);
+	if (!err)
+		err = fc_do_one_pass(journal, &info, PASS_REPLAY);
 
 	jbd_debug(1, "JBD2: recovery, exit status %d, "
 		  "recovered transactions %u to %u\n",
@@ -412,6 +421,50 @@ static int jbd2_block_tag_csum_verify(journal_t *j, journal_block_tag_t *tag,
 	return tag->t_checksum == cpu_to_be16(csum32);
 }
 
+/*
+ * Walk the fast commit area, handing each block to the filesystem.  Fast
+ * commits are only meaningful on top of the state the log replay has just
+ * restored, so they must carry the tid of the transaction that follows the
+ * last one recovered; the filesystem checks that, and their integrity, and
+ * tells us where the valid ones end.
+ */
+static int fc_do_one_pass(journal_t *journal,
+			  struct recovery_info *info, enum passtype pass)
+{
+	unsigned long next_fc_block;
+	struct buffer_head *bh;
+	int err = 0;
+
+	if (!JBD2_HAS_INCOMPAT_FEATURE(journal,
+				       JBD2_FEATURE_INCOMPAT_FAST_COMMIT) ||
+	    !journal->j_fc_replay_callback)
+		return 0;
+
+	jbd_debug(1, "Fast commit replay: pass %d, expected tid %u\n",
+		  pass, info->end_transaction);
+	for (next_fc_block = journal->j_fc_first;
+	     next_fc_block < journal->j_fc_last; next_fc_block++) {
+		err = jread(&bh, journal, next_fc_block);
+		if (err)
+			break;
+
+		err = journal->j_fc_replay_callback(journal, bh, pass,
+					next_fc_block - journal->j_fc_first,
+					info->end_transaction);
+		brelse(bh);
+		if (err <= 0)
+			break;
+		err = 0;
+	}
+
+	if (err < 0) {
+		printk(KERN_ERR "JBD2: fast commit replay failed, pass %d, "
+		       "error %d\n", pass, err);
+		return err;
+	}
+	return 0;
+}
+
 static int do_one_pass(journal_t *journal,
 			struct recovery_info *info, enum passtype pass)
 {
@@ -196,8 +196,15 @@ static DEFINE_HASHTABLE(blocked_hash, BLOCKED_HASH_BITS);
  * In particular, adding an entry to the fl_block list requires that you hold
  * both the i_lock and the blocked_lock_lock (acquired in that order). Deleting
  * an entry from the list however only requires the file_lock_lock.
+ *
+ * All of the above only goes for POSIX blockers. Flock and lease blockers
+ * play no part in deadlock detection, so their fl_block lists, and the
+ * fl_next pointers of their waiters, are instead protected by the i_lock
+ * together with the file_lock_lglock lock of the cpu whose file_lock_list
+ * holds the blocker (see locks_lock_blocker()). Only contended POSIX locks
+ * then touch this global lock, which gets a cacheline of its own.
  */
-static DEFINE_SPINLOCK(blocked_lock_lock);
+static __cacheline_aligned_in_smp DEFINE_SPINLOCK(blocked_lock_lock);
 
 static struct kmem_cache *filelock_cache __read_mostly;
 
@@ -536,15 +543,53 @@ static void locks_delete_block(struct file_lock *waiter)
 	spin_unlock(&blocked_lock_lock);
 }
 
+/*
+ * Lock the fl_block list of a flock or lease blocker. While the blocker is
+ * on a file_lock_list, /proc/locks can walk its waiters, so take the lock
+ * of that list's cpu, which it holds along with all the others. Once the
+ * blocker is off the list only the i_lock is needed.
+ *
+ * Must be called with the i_lock held, which keeps fl_link stable.
+ */
+static void locks_lock_blocker(struct file_lock *blocker)
+{
+	if (!hlist_unhashed(&blocker->fl_link))
+		lg_local_lock_cpu(&file_lock_lglock, blocker->fl_link_cpu);
+}
+
+static void locks_unlock_blocker(struct file_lock *blocker)
+{
+	if (!hlist_unhashed(&blocker->fl_link))
+		lg_local_unlock_cpu(&file_lock_lglock, blocker->fl_link_cpu);
+}
+
+/*
+ * Remove a waiter from the block list of the flock or lease blocking it,
+ * if it is still on one.
+ *
+ * Must be called with the i_lock held.
+ */
+static void locks_delete_flock_block(struct file_lock *waiter)
+{
+	struct file_lock *blocker = waiter->fl_next;
+
+	if (!blocker)
+		return;
+	locks_lock_blocker(blocker);
+	__locks_delete_block(waiter);
+	locks_unlock_blocker(blocker);
+}
+
 /* Insert waiter into blocker's block list.
  * We use a circular list so that processes can be easily woken up in
  * the order they blocked. The documentation doesn't require this but
  * it seems like the reasonable thing to do.
  *
- * Must be called with both the i_lock and blocked_lock_lock held. The fl_block
- * list itself is protected by the blocked_lock_lock, but by ensuring that the
- * i_lock is also held on insertions we can avoid taking the blocked_lock_lock
- * in some cases when we see that the fl_block list is empty.
+ * Must be called with the i_lock held, and with either the blocked_lock_lock
+ * or locks_lock_blocker() as the blocker requires. The fl_block list of a
+ * POSIX blocker is protected by the blocked_lock_lock, but by ensuring that
+ * the i_lock is also held on insertions we can avoid taking the
+ * blocked_lock_lock in some cases when we see that the fl_block list is empty.
  */
 static void __locks_insert_block(struct file_lock *blocker,
 					struct file_lock *waiter)
@@ -560,11 +605,32 @@ static void __locks_insert_block(struct file_lock *blocker,
 static void locks_insert_block(struct file_lock *blocker,
 					struct file_lock *waiter)
 {
+	if (!IS_POSIX(blocker)) {
+		locks_lock_blocker(blocker);
+		__locks_insert_block(blocker, waiter);
+		locks_unlock_blocker(blocker);
+		return;
+	}
 	spin_lock(&blocked_lock_lock);
 	__locks_insert_block(blocker, waiter);
 	spin_unlock(&blocked_lock_lock);
 }
 
+static void __locks_wake_up_blocks(struct file_lock *blocker)
+{
+	while (!list_empty(&blocker->fl_block)) {
+		struct file_lock *waiter;
+
+		waiter = list_first_entry(&blocker->fl_block,
+				struct file_lock, fl_block);
+		__locks_delete_block(waiter);
+		if (waiter->fl_lmops && waiter->fl_lmops->lm_notify)
+			waiter->fl_lmops->lm_notify(waiter);
+		else
+			wake_up(&waiter->fl_wait);
+	}
+}
+
 /*
  * Wake up processes blocked waiting for blocker.
  *
@@ -582,18 +648,15 @@ static void locks_wake_up_blocks(struct file_lock *blocker)
 	if (list_empty(&blocker->fl_block))
 		return;
 
-	spin_lock(&blocked_lock_lock);
-	while (!list_empty(&blocker->fl_block)) {
-		struct file_lock *waiter;
-
-		waiter = list_first_entry(&blocker->fl_block,
-				struct file_lock, fl_block);
-		__locks_delete_block(waiter);
-		if (waiter->fl_lmops && waiter->fl_lmops->lm_notify)
-			waiter->fl_lmops->lm_notify(waiter);
-		else
-			wake_up(&waiter->fl_wait);
+	if (!IS_POSIX(blocker)) {
+		locks_lock_blocker(blocker);
+		__locks_wake_up_blocks(blocker);
+		locks_unlock_blocker(blocker);
+		return;
 	}
+
+	spin_lock(&blocked_lock_lock);
+	__locks_wake_up_blocks(blocker);
 	spin_unlock(&blocked_lock_lock);
 }
 
@@ -1388,7 +1451,7 @@ restart:
 	error = wait_event_interruptible_timeout(new_fl->fl_wait,
 						!new_fl->fl_next, break_time);
 	spin_lock(&inode->i_lock);
-	locks_delete_block(new_fl);
+	locks_delete_flock_block(new_fl);
 	if (error >= 0) {
 		if (error == 0)
 			time_out_leases(inode);
@@ -1777,6 +1840,7 @@ int fcntl_setlease(unsigned int fd, struct file *filp, long arg)
  */
 int flock_lock_file_wait(struct file *filp, struct file_lock *fl)
 {
+	struct inode *inode = file_inode(filp);
 	int error;
 	might_sleep();
 	for (;;) {
@@ -1787,7 +1851,9 @@ int flock_lock_file_wait(struct file *filp, struct file_lock *fl)
 		if (!error)
 			continue;
 
-		locks_delete_block(fl);
+		spin_lock(&inode->i_lock);
+		locks_delete_flock_block(fl);
+		spin_unlock(&inode->i_lock);
 		break;
 	}
 	return error;
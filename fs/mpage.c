@@ -578,6 +578,7 @@ alloc_new:
 				bio_get_nr_vecs(bdev), GFP_NOFS|__GFP_HIGH);
 		if (bio == NULL)
 			goto confused;
+		wbc_init_bio(wbc, bio);
 	}
 
 	/*
@@ -1270,12 +1270,47 @@ static void follow_dotdot(struct nameidata *nd)
 	nd->inode = nd->path.dentry->d_inode;
 }
 
+/*
+ * Filesystems with FS_PARALLEL_LOOKUP have i_op->lookup called without the
+ * directory's i_mutex, on a dentry from d_alloc_parallel().  Not for those
+ * with i_op->atomic_open, which is passed dentries still to be looked up.
+ */
+static inline bool parallel_lookup(struct inode *dir)
+{
+	return (dir->i_sb->s_type->fs_flags & FS_PARALLEL_LOOKUP) &&
+	       !dir->i_op->atomic_open;
+}
+
+/*
+ * Allocate a dentry for i_op->lookup to be called on, unless a concurrent
+ * lookup of the same name in a parallel lookup directory got there first:
+ * in which case its result is returned, and need_lookup is cleared.
+ */
+static struct dentry *lookup_alloc(struct qstr *name, struct dentry *dir,
+				   bool *need_lookup)
+{
+	struct dentry *dentry;
+
+	if (parallel_lookup(dir->d_inode)) {
+		dentry = d_alloc_parallel(dir, name);
+		if (!IS_ERR(dentry))
+			*need_lookup = d_in_lookup(dentry);
+		return dentry;
+	}
+
+	dentry = d_alloc(dir, name);
+	if (unlikely(!dentry))
+		return ERR_PTR(-ENOMEM);
+	*need_lookup = true;
+	return dentry;
+}
+
 /*
  * This looks up the name in dcache, possibly revalidates the old dentry and
  * allocates a new one if not found or not valid.  In the need_lookup argument
  * returns whether i_op->lookup is necessary.
  *
- * dir->d_inode->i_mutex must be held
+ * dir->d_inode->i_mutex must be held, unless it is a parallel_lookup() one
  */
 static struct dentry *lookup_dcache(struct qstr *name, struct dentry *dir,
 				    unsigned int flags, bool *need_lookup)
@@ -1300,13 +1335,8 @@ static struct dentry *lookup_dcache(struct qstr *name, struct dentry *dir,
 		}
 	}
 
-	if (!dentry) {
-		dentry = d_alloc(dir, name);
-		if (unlikely(!dentry))
-			return ERR_PTR(-ENOMEM);
-
-		*need_lookup = true;
-	}
+	if (!dentry)
+		dentry = lookup_alloc(name, dir, need_lookup);
 	return dentry;
 }
 
@@ -1314,7 +1344,7 @@ static struct dentry *lookup_dcache(struct qstr *name, struct dentry *dir,
  * Call i_op->lookup on the dentry.  The dentry must be negative and
  * unhashed.
  *
- * dir->d_inode->i_mutex must be held
+ * dir->d_inode->i_mutex must be held, unless it is a parallel_lookup() one
  */
 static struct dentry *lookup_real(struct inode *dir, struct dentry *dentry,
 				  unsigned int flags)
@@ -1323,11 +1353,13 @@ static struct dentry *lookup_real(struct inode *dir, struct dentry *dentry,
 
 	/* Don't create child dentry for a dead directory. */
 	if (unlikely(IS_DEADDIR(dir))) {
+		d_lookup_done(dentry);
 		dput(dentry);
 		return ERR_PTR(-ENOENT);
 	}
 
 	old = dir->i_op->lookup(dir, dentry, flags);
+	d_lookup_done(dentry);
 	if (unlikely(old)) {
 		dput(dentry);
 		dentry = old;
@@ -1455,9 +1487,13 @@ static int lookup_slow(struct nameidata *nd, struct path *path)
 	parent = nd->path.dentry;
 	BUG_ON(nd->inode != parent->d_inode);
 
-	mutex_lock(&parent->d_inode->i_mutex);
-	dentry = __lookup_hash(&nd->last, parent, nd->flags);
-	mutex_unlock(&parent->d_inode->i_mutex);
+	if (parallel_lookup(parent->d_inode)) {
+		dentry = __lookup_hash(&nd->last, parent, nd->flags);
+	} else {
+		mutex_lock(&parent->d_inode->i_mutex);
+		dentry = __lookup_hash(&nd->last, parent, nd->flags);
+		mutex_unlock(&parent->d_inode->i_mutex);
+	}
 	if (IS_ERR(dentry))
 		return PTR_ERR(dentry);
 	path->mnt = nd->path.mnt;
@@ -2234,13 +2270,11 @@ mountpoint_last(struct nameidata *nd, struct path *path)
 		 * so that means that this dentry is probably a symlink or the
 		 * path doesn't actually point to a mounted dentry.
 		 */
-		dentry = d_alloc(dir, &nd->last);
-		if (!dentry) {
-			error = -ENOMEM;
-			mutex_unlock(&dir->d_inode->i_mutex);
-			goto out;
-		}
-		dentry = lookup_real(dir->d_inode, dentry, nd->flags);
+		bool need_lookup;
+
+		dentry = lookup_alloc(&nd->last, dir, &need_lookup);
+		if (!IS_ERR(dentry) && need_lookup)
+			dentry = lookup_real(dir->d_inode, dentry, nd->flags);
 		error = PTR_ERR(dentry);
 		if (IS_ERR(dentry)) {
 			mutex_unlock(&dir->d_inode->i_mutex);
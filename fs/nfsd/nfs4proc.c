@@ -754,6 +754,8 @@ nfsd4_lookup(struct svc_rqst *rqstp, struct nfsd4_compound_state *cstate,
 			   &cstate->current_fh);
 }
 
+static bool nfsd4_read_splice_ok(struct svc_rqst *rqstp);
+
 static __be32
 nfsd4_read(struct svc_rqst *rqstp, struct nfsd4_compound_state *cstate,
 	   struct nfsd4_read *read)
@@ -772,9 +774,10 @@ nfsd4_read(struct svc_rqst *rqstp, struct nfsd4_compound_state *cstate,
 	 * following compound.
 	 *
 	 * To ensure proper ordering, we therefore turn off zero copy if
-	 * the client wants us to do more in this compound:
+	 * the client wants us to do anything more in this compound that
+	 * could change what it reads:
 	 */
-	if (!nfsd4_last_compound_op(rqstp))
+	if (!nfsd4_read_splice_ok(rqstp))
 		rqstp->rq_splice_ok = false;
 
 	nfs4_lock_state();
@@ -1220,6 +1223,23 @@ bool nfsd4_cache_this_op(struct nfsd4_op *op)
 	return OPDESC(op)->op_flags & OP_CACHEME;
 }
 
+/*
+ * A READ may splice page cache pages into the reply as long as none of
+ * the ops after it in the compound modifies anything; read-only ops such
+ * as GETATTR may follow.
+ */
+static bool nfsd4_read_splice_ok(struct svc_rqst *rqstp)
+{
+	struct nfsd4_compoundres *resp = rqstp->rq_resp;
+	struct nfsd4_compoundargs *argp = rqstp->rq_argp;
+	int i;
+
+	for (i = resp->opcnt; i < argp->opcnt; i++)
+		if (OPDESC(&argp->ops[i])->op_flags & OP_MODIFIES_SOMETHING)
+			return false;
+	return true;
+}
+
 static bool need_wrongsec_check(struct svc_rqst *rqstp)
 {
 	struct nfsd4_compoundres *resp = rqstp->rq_resp;
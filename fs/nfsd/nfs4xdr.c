@@ -2951,34 +2951,36 @@ nfsd4_encode_open_downgrade(struct nfsd4_compoundres *resp, __be32 nfserr, struc
 	return nfserr;
 }
 
+/*
+ * Let nfsd_vfs_read() splice page cache pages straight into the reply's
+ * page list, without copying the data.
+ */
 static __be32
-nfsd4_encode_read(struct nfsd4_compoundres *resp, __be32 nfserr,
-		  struct nfsd4_read *read)
+nfsd4_encode_splice_read(struct nfsd4_compoundres *resp,
+			 struct nfsd4_read *read, unsigned long *maxcount)
+{
+	read->rd_vlen = 0;
+	return nfsd_read_file(read->rd_rqstp, read->rd_fhp, read->rd_filp,
+			read->rd_offset, NULL, 0, maxcount);
+}
+
+/*
+ * Read into the reply's own pages through an iovec covering them.
+ */
+static __be32
+nfsd4_encode_readv(struct nfsd4_compoundres *resp,
+		   struct nfsd4_read *read, unsigned long *maxcount)
 {
-	u32 eof;
 	int v;
 	struct page *page;
-	unsigned long maxcount; 
 	long len;
-	__be32 *p;
-
-	if (nfserr)
-		return nfserr;
-	if (resp->xbuf->page_len)
-		return nfserr_resource;
-
-	RESERVE_SPACE(8); /* eof flag and byte count */
-
-	maxcount = svc_max_payload(resp->rqstp);
-	if (maxcount > read->rd_length)
-		maxcount = read->rd_length;
 
-	len = maxcount;
+	len = *maxcount;
 	v = 0;
 	while (len > 0) {
 		page = *(resp->rqstp->rq_next_page);
 		if (!page) { /* ran out of pages */
-			maxcount -= len;
+			*maxcount -= len;
 			break;
 		}
 		resp->rqstp->rq_vec[v].iov_base = page_address(page);
@@ -2990,9 +2992,42 @@ nfsd4_encode_read(struct nfsd4_compoundres *resp, __be32 nfserr,
 	}
 	read->rd_vlen = v;
 
-	nfserr = nfsd_read_file(read->rd_rqstp, read->rd_fhp, read->rd_filp,
+	return nfsd_read_file(read->rd_rqstp, read->rd_fhp, read->rd_filp,
 			read->rd_offset, resp->rqstp->rq_vec, read->rd_vlen,
-			&maxcount);
+			maxcount);
+}
+
+static __be32
+nfsd4_encode_read(struct nfsd4_compoundres *resp, __be32 nfserr,
+		  struct nfsd4_read *read)
+{
+	u32 eof;
+	struct file *file = read->rd_filp;
+	unsigned long maxcount; 
+	__be32 *p;
+
+	if (nfserr)
+		return nfserr;
+	if (resp->xbuf->page_len)
+		return nfserr_resource;
+
+	RESERVE_SPACE(8); /* eof flag and byte count */
+
+	maxcount = svc_max_payload(resp->rqstp);
+	if (maxcount > read->rd_length)
+		maxcount = read->rd_length;
+
+	/*
+	 * nfsd4_read() has cleared rq_splice_ok unless this READ is the
+	 * last op of the compound that can bear on its data. Without a
+	 * file to check for ->splice_read (the special stateids), build
+	 * the iovec anyway; nfsd_vfs_read() still splices if the file it
+	 * opens allows it.
+	 */
+	if (file && file->f_op->splice_read && resp->rqstp->rq_splice_ok)
+		nfserr = nfsd4_encode_splice_read(resp, read, &maxcount);
+	else
+		nfserr = nfsd4_encode_readv(resp, read, &maxcount);
 
 	if (nfserr)
 		return nfserr;
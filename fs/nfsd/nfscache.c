@@ -27,29 +27,43 @@
  */
 #define TARGET_BUCKET_SIZE	64
 
-static struct hlist_head *	cache_hash;
-static struct list_head 	lru_head;
+/*
+ * Each hash bucket has its own lock and LRU list, so that calls whose xids
+ * hash to different buckets never contend. The LRU list doubles as the
+ * hash chain; it is kept short by TARGET_BUCKET_SIZE.
+ */
+struct nfsd_drc_bucket {
+	struct list_head	lru_head;
+	spinlock_t		cache_lock;
+	unsigned int		num_entries;	/* entries on lru_head */
+};
+
+static struct nfsd_drc_bucket	*drc_hashtbl;
 static struct kmem_cache	*drc_slab;
 
 /* max number of entries allowed in the cache */
 static unsigned int		max_drc_entries;
 
+/* max number of entries allowed in a single bucket */
+static unsigned int		max_bucket_entries;
+
 /* number of significant bits in the hash value */
 static unsigned int		maskbits;
 
 /*
- * Stats and other tracking of on the duplicate reply cache. All of these and
- * the "rc" fields in nfsdstats are protected by the cache_lock
+ * Stats and other tracking of on the duplicate reply cache. The totals are
+ * atomic; the rest, and the "rc" fields in nfsdstats, are updated under
+ * whichever bucket lock is held and so are only approximate.
  */
 
 /* total number of entries */
-static unsigned int		num_drc_entries;
+static atomic_t			num_drc_entries;
 
 /* cache misses due only to checksum comparison failures */
 static unsigned int		payload_misses;
 
 /* amount of memory (in bytes) currently consumed by the DRC */
-static unsigned int		drc_mem_usage;
+static atomic_t			drc_mem_usage;
 
 /* longest hash chain seen */
 static unsigned int		longest_chain;
@@ -73,9 +87,9 @@ static struct shrinker nfsd_reply_cache_shrinker = {
 /*
  * locking for the reply cache:
  * A cache entry is "single use" if c_state == RC_INPROG
- * Otherwise, it when accessing _prev or _next, the lock must be held.
+ * Otherwise, it when accessing _prev or _next, the lock of the bucket its
+ * c_xid hashes to must be held.
  */
-static DEFINE_SPINLOCK(cache_lock);
 static DECLARE_DELAYED_WORK(cache_cleaner, cache_cleaner_func);
 
 /*
@@ -116,6 +130,12 @@ nfsd_hashsize(unsigned int limit)
 	return roundup_pow_of_two(limit / TARGET_BUCKET_SIZE);
 }
 
+static inline struct nfsd_drc_bucket *
+nfsd_cache_bucket_find(__be32 xid)
+{
+	return &drc_hashtbl[hash_32((__force u32)xid, maskbits)];
+}
+
 static struct svc_cacherep *
 nfsd_reply_cache_alloc(void)
 {
@@ -126,43 +146,54 @@ nfsd_reply_cache_alloc(void)
 		rp->c_state = RC_UNUSED;
 		rp->c_type = RC_NOCACHE;
 		INIT_LIST_HEAD(&rp->c_lru);
-		INIT_HLIST_NODE(&rp->c_hash);
+		atomic_inc(&num_drc_entries);
+		atomic_add(sizeof(*rp), &drc_mem_usage);
 	}
 	return rp;
 }
 
+/*
+ * Free an entry, unlinking it from the LRU list of bucket b if it is on
+ * one. b's lock must be held in that case.
+ */
 static void
-nfsd_reply_cache_free_locked(struct svc_cacherep *rp)
+nfsd_reply_cache_free_locked(struct nfsd_drc_bucket *b,
+			     struct svc_cacherep *rp)
 {
 	if (rp->c_type == RC_REPLBUFF && rp->c_replvec.iov_base) {
-		drc_mem_usage -= rp->c_replvec.iov_len;
+		atomic_sub(rp->c_replvec.iov_len, &drc_mem_usage);
 		kfree(rp->c_replvec.iov_base);
 	}
-	if (!hlist_unhashed(&rp->c_hash))
-		hlist_del(&rp->c_hash);
-	list_del(&rp->c_lru);
-	--num_drc_entries;
-	drc_mem_usage -= sizeof(*rp);
+	if (!list_empty(&rp->c_lru)) {
+		list_del(&rp->c_lru);
+		--b->num_entries;
+	}
+	atomic_dec(&num_drc_entries);
+	atomic_sub(sizeof(*rp), &drc_mem_usage);
 	kmem_cache_free(drc_slab, rp);
 }
 
 static void
 nfsd_reply_cache_free(struct svc_cacherep *rp)
 {
-	spin_lock(&cache_lock);
-	nfsd_reply_cache_free_locked(rp);
-	spin_unlock(&cache_lock);
+	struct nfsd_drc_bucket *b = nfsd_cache_bucket_find(rp->c_xid);
+
+	spin_lock(&b->cache_lock);
+	nfsd_reply_cache_free_locked(b, rp);
+	spin_unlock(&b->cache_lock);
 }
 
 int nfsd_reply_cache_init(void)
 {
 	unsigned int hashsize;
+	unsigned int i;
 
-	INIT_LIST_HEAD(&lru_head);
 	max_drc_entries = nfsd_cache_size_limit();
-	num_drc_entries = 0;
+	atomic_set(&num_drc_entries, 0);
+	atomic_set(&drc_mem_usage, 0);
 	hashsize = nfsd_hashsize(max_drc_entries);
 	maskbits = ilog2(hashsize);
+	max_bucket_entries = max(1U, max_drc_entries >> maskbits);
 
 	register_shrinker(&nfsd_reply_cache_shrinker);
 	drc_slab = kmem_cache_create("nfsd_drc", sizeof(struct svc_cacherep),
@@ -170,9 +201,13 @@ int nfsd_reply_cache_init(void)
 	if (!drc_slab)
 		goto out_nomem;
 
-	cache_hash = kcalloc(hashsize, sizeof(struct hlist_head), GFP_KERNEL);
-	if (!cache_hash)
+	drc_hashtbl = kcalloc(hashsize, sizeof(*drc_hashtbl), GFP_KERNEL);
+	if (!drc_hashtbl)
 		goto out_nomem;
+	for (i = 0; i < hashsize; i++) {
+		INIT_LIST_HEAD(&drc_hashtbl[i].lru_head);
+		spin_lock_init(&drc_hashtbl[i].cache_lock);
+	}
 
 	return 0;
 out_nomem:
@@ -184,17 +219,23 @@ out_nomem:
 void nfsd_reply_cache_shutdown(void)
 {
 	struct svc_cacherep	*rp;
+	struct nfsd_drc_bucket	*b;
+	unsigned int		i;
 
 	unregister_shrinker(&nfsd_reply_cache_shrinker);
 	cancel_delayed_work_sync(&cache_cleaner);
 
-	while (!list_empty(&lru_head)) {
-		rp = list_entry(lru_head.next, struct svc_cacherep, c_lru);
-		nfsd_reply_cache_free_locked(rp);
+	for (i = 0; drc_hashtbl && i < (1U << maskbits); i++) {
+		b = &drc_hashtbl[i];
+		while (!list_empty(&b->lru_head)) {
+			rp = list_entry(b->lru_head.next, struct svc_cacherep,
+					c_lru);
+			nfsd_reply_cache_free_locked(b, rp);
+		}
 	}
 
-	kfree (cache_hash);
-	cache_hash = NULL;
+	kfree (drc_hashtbl);
+	drc_hashtbl = NULL;
 
 	if (drc_slab) {
 		kmem_cache_destroy(drc_slab);
@@ -203,27 +244,19 @@ void nfsd_reply_cache_shutdown(void)
 }
 
 /*
- * Move cache entry to end of LRU list, and queue the cleaner to run if it's
- * not already scheduled.
+ * Move cache entry to end of the LRU list of its bucket, and queue the
+ * cleaner to run if it's not already scheduled.
  */
 static void
-lru_put_end(struct svc_cacherep *rp)
+lru_put_end(struct nfsd_drc_bucket *b, struct svc_cacherep *rp)
 {
 	rp->c_timestamp = jiffies;
-	list_move_tail(&rp->c_lru, &lru_head);
+	if (list_empty(&rp->c_lru))
+		++b->num_entries;
+	list_move_tail(&rp->c_lru, &b->lru_head);
 	schedule_delayed_work(&cache_cleaner, RC_EXPIRE);
 }
 
-/*
- * Move a cache entry from one hash list to another
- */
-static void
-hash_refile(struct svc_cacherep *rp)
-{
-	hlist_del_init(&rp->c_hash);
-	hlist_add_head(&rp->c_hash, cache_hash + hash_32(rp->c_xid, maskbits));
-}
-
 static inline bool
 nfsd_cache_entry_expired(struct svc_cacherep *rp)
 {
@@ -232,30 +265,55 @@ nfsd_cache_entry_expired(struct svc_cacherep *rp)
 }
 
 /*
- * Walk the LRU list and prune off entries that are older than RC_EXPIRE.
- * Also prune the oldest ones when the total exceeds the max number of entries.
+ * Walk the LRU list of bucket b and prune off entries that are older than
+ * RC_EXPIRE. Also prune the oldest ones when the bucket holds more than its
+ * share of the max number of entries. Must be called with b's lock held.
  */
 static long
-prune_cache_entries(void)
+prune_bucket(struct nfsd_drc_bucket *b)
 {
 	struct svc_cacherep *rp, *tmp;
 	long freed = 0;
 
-	list_for_each_entry_safe(rp, tmp, &lru_head, c_lru) {
+	list_for_each_entry_safe(rp, tmp, &b->lru_head, c_lru) {
 		if (!nfsd_cache_entry_expired(rp) &&
-		    num_drc_entries <= max_drc_entries)
+		    b->num_entries <= max_bucket_entries)
 			break;
-		nfsd_reply_cache_free_locked(rp);
+		nfsd_reply_cache_free_locked(b, rp);
 		freed++;
 	}
+	return freed;
+}
+
+/*
+ * Prune every bucket in turn, taking only one bucket lock at a time.
+ */
+static long
+prune_cache_entries(void)
+{
+	struct nfsd_drc_bucket *b;
+	unsigned int i;
+	bool empty = true;
+	long freed = 0;
+
+	for (i = 0; i < (1U << maskbits); i++) {
+		b = &drc_hashtbl[i];
+		if (list_empty(&b->lru_head))
+			continue;
+		spin_lock(&b->cache_lock);
+		freed += prune_bucket(b);
+		if (!list_empty(&b->lru_head))
+			empty = false;
+		spin_unlock(&b->cache_lock);
+	}
 
 	/*
-	 * Conditionally rearm the job. If we cleaned out the list, then
+	 * Conditionally rearm the job. If we cleaned out the lists, then
 	 * cancel any pending run (since there won't be any work to do).
 	 * Otherwise, we rearm the job or modify the existing one to run in
 	 * RC_EXPIRE since we just ran the pruner.
 	 */
-	if (list_empty(&lru_head))
+	if (empty)
 		cancel_delayed_work(&cache_cleaner);
 	else
 		mod_delayed_work(system_wq, &cache_cleaner, RC_EXPIRE);
@@ -265,32 +323,19 @@ prune_cache_entries(void)
 static void
 cache_cleaner_func(struct work_struct *unused)
 {
-	spin_lock(&cache_lock);
 	prune_cache_entries();
-	spin_unlock(&cache_lock);
 }
 
 static unsigned long
 nfsd_reply_cache_count(struct shrinker *shrink, struct shrink_control *sc)
 {
-	unsigned long num;
-
-	spin_lock(&cache_lock);
-	num = num_drc_entries;
-	spin_unlock(&cache_lock);
-
-	return num;
+	return atomic_read(&num_drc_entries);
 }
 
 static unsigned long
 nfsd_reply_cache_scan(struct shrinker *shrink, struct shrink_control *sc)
 {
-	unsigned long freed;
-
-	spin_lock(&cache_lock);
-	freed = prune_cache_entries();
-	spin_unlock(&cache_lock);
-	return freed;
+	return prune_cache_entries();
 }
 /*
  * Walk an xdr_buf and get a CRC for at most the first RC_CSUMLEN bytes
@@ -346,19 +391,17 @@ nfsd_cache_match(struct svc_rqst *rqstp, __wsum csum, struct svc_cacherep *rp)
 }
 
 /*
- * Search the request hash for an entry that matches the given rqstp.
- * Must be called with cache_lock held. Returns the found entry or
- * NULL on failure.
+ * Search bucket b for an entry that matches the given rqstp. Must be
+ * called with b's lock held. Returns the found entry or NULL on failure.
  */
 static struct svc_cacherep *
-nfsd_cache_search(struct svc_rqst *rqstp, __wsum csum)
+nfsd_cache_search(struct nfsd_drc_bucket *b, struct svc_rqst *rqstp,
+		  __wsum csum)
 {
 	struct svc_cacherep	*rp, *ret = NULL;
-	struct hlist_head 	*rh;
 	unsigned int		entries = 0;
 
-	rh = &cache_hash[hash_32(rqstp->rq_xid, maskbits)];
-	hlist_for_each_entry(rp, rh, c_hash) {
+	list_for_each_entry(rp, &b->lru_head, c_lru) {
 		++entries;
 		if (nfsd_cache_match(rqstp, csum, rp)) {
 			ret = rp;
@@ -369,22 +412,22 @@ nfsd_cache_search(struct svc_rqst *rqstp, __wsum csum)
 	/* tally hash chain length stats */
 	if (entries > longest_chain) {
 		longest_chain = entries;
-		longest_chain_cachesize = num_drc_entries;
+		longest_chain_cachesize = atomic_read(&num_drc_entries);
 	} else if (entries == longest_chain) {
 		/* prefer to keep the smallest cachesize possible here */
-		longest_chain_cachesize = min(longest_chain_cachesize,
-						num_drc_entries);
+		longest_chain_cachesize = min_t(unsigned int,
+					longest_chain_cachesize,
+					atomic_read(&num_drc_entries));
 	}
 
 	return ret;
 }
 
 /*
- * Try to find an entry matching the current call in the cache. When none
- * is found, we try to grab the oldest expired entry off the LRU list. If
- * a suitable one isn't there, then drop the cache_lock and allocate a
- * new one, then search again in case one got inserted while this thread
- * didn't hold the lock.
+ * Try to find an entry matching the current call in the cache. Since the
+ * common case is a miss followed by an insert, a new entry is allocated
+ * before taking the lock of the bucket the xid hashes to; it is freed
+ * again if the search turns up a match.
  */
 int
 nfsd_cache_lookup(struct svc_rqst *rqstp)
@@ -395,6 +438,7 @@ nfsd_cache_lookup(struct svc_rqst *rqstp)
 				vers = rqstp->rq_vers,
 				proc = rqstp->rq_proc;
 	__wsum			csum;
+	struct nfsd_drc_bucket	*b = nfsd_cache_bucket_find(xid);
 	unsigned long		age;
 	int type = rqstp->rq_cachetype;
 	int rtn = RC_DOIT;
@@ -412,19 +456,15 @@ nfsd_cache_lookup(struct svc_rqst *rqstp)
 	 * preallocate an entry.
 	 */
 	rp = nfsd_reply_cache_alloc();
-	spin_lock(&cache_lock);
-	if (likely(rp)) {
-		++num_drc_entries;
-		drc_mem_usage += sizeof(*rp);
-	}
+	spin_lock(&b->cache_lock);
 
-	/* go ahead and prune the cache */
-	prune_cache_entries();
+	/* go ahead and prune the bucket */
+	prune_bucket(b);
 
-	found = nfsd_cache_search(rqstp, csum);
+	found = nfsd_cache_search(b, rqstp, csum);
 	if (found) {
 		if (likely(rp))
-			nfsd_reply_cache_free_locked(rp);
+			nfsd_reply_cache_free_locked(b, rp);
 		rp = found;
 		goto found_entry;
 	}
@@ -446,25 +486,24 @@ nfsd_cache_lookup(struct svc_rqst *rqstp)
 	rp->c_len = rqstp->rq_arg.len;
 	rp->c_csum = csum;
 
-	hash_refile(rp);
-	lru_put_end(rp);
+	lru_put_end(b, rp);
 
 	/* release any buffer */
 	if (rp->c_type == RC_REPLBUFF) {
-		drc_mem_usage -= rp->c_replvec.iov_len;
+		atomic_sub(rp->c_replvec.iov_len, &drc_mem_usage);
 		kfree(rp->c_replvec.iov_base);
 		rp->c_replvec.iov_base = NULL;
 	}
 	rp->c_type = RC_NOCACHE;
  out:
-	spin_unlock(&cache_lock);
+	spin_unlock(&b->cache_lock);
 	return rtn;
 
 found_entry:
 	nfsdstats.rchits++;
 	/* We found a matching entry which is either in progress or done. */
 	age = jiffies - rp->c_timestamp;
-	lru_put_end(rp);
+	lru_put_end(b, rp);
 
 	rtn = RC_DROPIT;
 	/* Request being processed or excessive rexmits */
@@ -492,7 +531,7 @@ found_entry:
 		break;
 	default:
 		printk(KERN_WARNING "nfsd: bad repcache type %d\n", rp->c_type);
-		nfsd_reply_cache_free_locked(rp);
+		nfsd_reply_cache_free_locked(b, rp);
 	}
 
 	goto out;
@@ -518,6 +557,7 @@ void
 nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, __be32 *statp)
 {
 	struct svc_cacherep *rp = rqstp->rq_cacherep;
+	struct nfsd_drc_bucket *b;
 	struct kvec	*resv = &rqstp->rq_res.head[0], *cachv;
 	int		len;
 	size_t		bufsize = 0;
@@ -525,6 +565,7 @@ nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, __be32 *statp)
 	if (!rp)
 		return;
 
+	b = nfsd_cache_bucket_find(rp->c_xid);
 	len = resv->iov_len - ((char*)statp - (char*)resv->iov_base);
 	len >>= 2;
 
@@ -555,13 +596,13 @@ nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, __be32 *statp)
 		nfsd_reply_cache_free(rp);
 		return;
 	}
-	spin_lock(&cache_lock);
-	drc_mem_usage += bufsize;
-	lru_put_end(rp);
+	atomic_add(bufsize, &drc_mem_usage);
+	spin_lock(&b->cache_lock);
+	lru_put_end(b, rp);
 	rp->c_secure = rqstp->rq_secure;
 	rp->c_type = cachetype;
 	rp->c_state = RC_DONE;
-	spin_unlock(&cache_lock);
+	spin_unlock(&b->cache_lock);
 	return;
 }
 
@@ -592,18 +633,18 @@ nfsd_cache_append(struct svc_rqst *rqstp, struct kvec *data)
  */
 static int nfsd_reply_cache_stats_show(struct seq_file *m, void *v)
 {
-	spin_lock(&cache_lock);
 	seq_printf(m, "max entries:           %u\n", max_drc_entries);
-	seq_printf(m, "num entries:           %u\n", num_drc_entries);
+	seq_printf(m, "num entries:           %u\n",
+			atomic_read(&num_drc_entries));
 	seq_printf(m, "hash buckets:          %u\n", 1 << maskbits);
-	seq_printf(m, "mem usage:             %u\n", drc_mem_usage);
+	seq_printf(m, "mem usage:             %u\n",
+			atomic_read(&drc_mem_usage));
 	seq_printf(m, "cache hits:            %u\n", nfsdstats.rchits);
 	seq_printf(m, "cache misses:          %u\n", nfsdstats.rcmisses);
 	seq_printf(m, "not cached:            %u\n", nfsdstats.rcnocache);
 	seq_printf(m, "payload misses:        %u\n", payload_misses);
 	seq_printf(m, "longest chain len:     %u\n", longest_chain);
 	seq_printf(m, "cachesize at longest:  %u\n", longest_chain_cachesize);
-	spin_unlock(&cache_lock);
 	return 0;
 }
 
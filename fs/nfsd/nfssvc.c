@@ -52,6 +52,19 @@ static int			nfsd(void *vrqstp);
  */
 DEFINE_MUTEX(nfsd_mutex);
 
+/*
+ * Bounds on the number of threads in each pool, which then grows when
+ * requests queue for want of an idle thread and shrinks again when its
+ * threads sit idle. The default zero max keeps the thread counts written
+ * to the "threads" and "pool_threads" files.
+ */
+static unsigned int nfsd_pool_min_threads = 1;
+module_param_named(pool_min_threads, nfsd_pool_min_threads, uint, 0644);
+MODULE_PARM_DESC(pool_min_threads, "Fewest threads an autoscaling pool shrinks to");
+static unsigned int nfsd_pool_max_threads;
+module_param_named(pool_max_threads, nfsd_pool_max_threads, uint, 0644);
+MODULE_PARM_DESC(pool_max_threads, "Most threads a pool grows to; 0 disables autoscaling");
+
 /*
  * nfsd_drc_lock protects nfsd_drc_max_pages and nfsd_drc_pages_used.
  * nfsd_drc_max_pages limits the total amount of memory available for
@@ -404,6 +417,8 @@ int nfsd_create_serv(struct net *net)
 				      nfsd_last_thread, nfsd, THIS_MODULE);
 	if (nn->nfsd_serv == NULL)
 		return -ENOMEM;
+	nn->nfsd_serv->sv_pool_min_threads = nfsd_pool_min_threads;
+	nn->nfsd_serv->sv_pool_max_threads = nfsd_pool_max_threads;
 
 	error = svc_bind(nn->nfsd_serv, net);
 	if (error < 0) {
@@ -555,6 +570,19 @@ out:
 }
 
 
+/*
+ * Add a thread to the pool of rqstp, which has had requests queue for want
+ * of an idle thread.
+ */
+static void nfsd_grow_pool(struct svc_rqst *rqstp)
+{
+	mutex_lock(&nfsd_mutex);
+	/* Don't add threads to a server that is being shut down */
+	if (!signalled())
+		svc_pool_grow(rqstp->rq_server, rqstp->rq_pool);
+	mutex_unlock(&nfsd_mutex);
+}
+
 /*
  * This is the NFS server kernel thread
  */
@@ -614,6 +642,8 @@ nfsd(void *vrqstp)
 		validate_process_creds();
 		svc_process(rqstp);
 		validate_process_creds();
+		if (svc_pool_wants_thread(rqstp->rq_pool))
+			nfsd_grow_pool(rqstp);
 	}
 
 	/* Clear signals before calling svc_exit_thread() */
@@ -1,6 +1,7 @@
 #include <linux/fanotify.h>
 #include <linux/fdtable.h>
 #include <linux/fsnotify_backend.h>
+#include <linux/hash.h>
 #include <linux/init.h>
 #include <linux/jiffies.h>
 #include <linux/kernel.h> /* UINT_MAX */
@@ -27,13 +28,29 @@ static bool should_merge(struct fsnotify_event *old_fsn,
 	return false;
 }
 
-/* and the list better be locked by something too! */
-static int fanotify_merge(struct list_head *list, struct fsnotify_event *event)
+static struct hlist_head *fanotify_merge_head(struct fsnotify_group *group,
+					      struct fsnotify_event *fsn_event)
 {
-	struct fsnotify_event *test_event;
-	bool do_merge = false;
+	struct fanotify_event_info *event = FANOTIFY_E(fsn_event);
+	unsigned long key;
 
-	pr_debug("%s: list=%p event=%p\n", __func__, list, event);
+	key = (unsigned long)fsn_event->inode ^ (unsigned long)event->tgid;
+	return &group->fanotify_data.merge_hash[hash_long(key,
+						FANOTIFY_MERGE_HASH_BITS)];
+}
+
+/*
+ * Called with the notification_mutex held.  Instead of walking the whole
+ * queue, look for a pending event on the same object in the merge hash;
+ * if there is none, hash the new event, which is queued after we return.
+ */
+static int fanotify_merge(struct fsnotify_group *group,
+			  struct fsnotify_event *event)
+{
+	struct fanotify_event_info *test_event;
+	struct hlist_head *head;
+
+	pr_debug("%s: group=%p event=%p\n", __func__, group, event);
 
 #ifdef CONFIG_FANOTIFY_ACCESS_PERMISSIONS
 	/*
@@ -45,18 +62,16 @@ static int fanotify_merge(struct list_head *list, struct fsnotify_event *event)
 		return 0;
 #endif
 
-	list_for_each_entry_reverse(test_event, list, list) {
-		if (should_merge(test_event, event)) {
-			do_merge = true;
-			break;
+	head = fanotify_merge_head(group, event);
+	hlist_for_each_entry(test_event, head, merge_list) {
+		if (should_merge(&test_event->fse, event)) {
+			test_event->fse.mask |= event->mask;
+			return 1;
 		}
 	}
 
-	if (!do_merge)
-		return 0;
-
-	test_event->mask |= event->mask;
-	return 1;
+	hlist_add_head(&FANOTIFY_E(event)->merge_list, head);
+	return 0;
 }
 
 #ifdef CONFIG_FANOTIFY_ACCESS_PERMISSIONS
@@ -166,6 +181,7 @@ struct fanotify_event_info *fanotify_alloc_event(struct inode *inode, u32 mask,
 init: __maybe_unused
 	fsnotify_init_event(&event->fse, inode, mask);
 	event->tgid = get_pid(task_tgid(current));
+	INIT_HLIST_NODE(&event->merge_list);
 	if (path) {
 		event->path = *path;
 		path_get(&event->path);
@@ -233,6 +249,7 @@ static void fanotify_free_group_priv(struct fsnotify_group *group)
 {
 	struct user_struct *user;
 
+	kfree(group->fanotify_data.merge_hash);
 	user = group->fanotify_data.user;
 	atomic_dec(&user->fanotify_listeners);
 	free_uid(user);
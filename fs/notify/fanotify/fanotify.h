@@ -5,6 +5,9 @@
 extern struct kmem_cache *fanotify_event_cachep;
 extern struct kmem_cache *fanotify_perm_event_cachep;
 
+#define FANOTIFY_MERGE_HASH_BITS	9
+#define FANOTIFY_MERGE_HASH_SIZE	(1 << FANOTIFY_MERGE_HASH_BITS)
+
 /*
  * Structure for normal fanotify events. It gets allocated in
  * fanotify_handle_event() and freed when the information is retrieved by
@@ -18,6 +21,8 @@ struct fanotify_event_info {
 	 */
 	struct path path;
 	struct pid *tgid;
+	/* in the group's merge_hash while on its notification list */
+	struct hlist_node merge_list;
 };
 
 #ifdef CONFIG_FANOTIFY_ACCESS_PERMISSIONS
@@ -82,10 +82,13 @@ void fsnotify_destroy_event(struct fsnotify_group *group,
  * event off the queue to deal with.  The function returns 0 if the event was
  * added to the queue, 1 if the event was merged with some other queued event,
  * 2 if the queue of events has overflown.
+ *
+ * @merge is called with the notification_mutex held, even when the queue is
+ * empty; when it returns 0 the event is queued right after.
  */
 int fsnotify_add_notify_event(struct fsnotify_group *group,
 			      struct fsnotify_event *event,
-			      int (*merge)(struct list_head *,
+			      int (*merge)(struct fsnotify_group *,
 					   struct fsnotify_event *))
 {
 	int ret = 0;
@@ -106,8 +109,8 @@ int fsnotify_add_notify_event(struct fsnotify_group *group,
 		goto queue;
 	}
 
-	if (!list_empty(list) && merge) {
-		ret = merge(list, event);
+	if (merge) {
+		ret = merge(group, event);
 		if (ret) {
 			mutex_unlock(&group->notification_mutex);
 			return ret;
@@ -85,6 +85,9 @@
  * and quota formats.
  * dq_data_lock protects data from dq_dqb and also mem_dqinfo structures and
  * also guards consistency of dquot->dq_dqb with inode->i_blocks, i_bytes.
+ * Usage changes which cannot hit any limit are not done under dq_data_lock
+ * but accumulated in per-cpu counters of the dquot, which are folded into
+ * dq_dqb under dq_data_lock before anyone looks at the exact usage.
  * i_blocks and i_bytes updates itself are guarded by i_lock acquired directly
  * in inode_add_bytes() and inode_sub_bytes(). dq_state_lock protects
  * modifications of quota state (on quotaon and quotaoff) and readers who care
@@ -399,6 +402,68 @@ void mark_info_dirty(struct super_block *sb, int type)
 }
 EXPORT_SYMBOL(mark_info_dirty);
 
+/*
+ * Move @fbc into the usage @value it holds deltas for and return the amount
+ * moved.  A total which would take usage below zero can only be seen when
+ * racing with updates on other cpus (the lockless paths never release more
+ * than is known to be in use), so such a remainder stays in the counter for
+ * the next fold.
+ */
+static s64 dquot_fold_counter(struct percpu_counter *fbc, qsize_t value,
+			      int negative)
+{
+	s64 delta = percpu_counter_sum(fbc);
+
+	if (!negative && value + delta < 0)
+		delta = -value;
+	if (delta)
+		percpu_counter_add(fbc, -delta);
+	return delta;
+}
+
+/*
+ * Fold the per-cpu usage deltas of @dquot into dq_dqb so that dq_dqb holds
+ * the exact usage.  Needs dq_data_lock.
+ */
+static void dquot_fold(struct dquot *dquot)
+{
+	struct mem_dqblk *dm = &dquot->dq_dqb;
+	int negative = sb_dqopt(dquot->dq_sb)->flags & DQUOT_NEGATIVE_USAGE;
+	s64 delta;
+
+	delta = dquot_fold_counter(&dquot->dq_curspace, dm->dqb_curspace,
+				   negative);
+	if (delta) {
+		dm->dqb_curspace += delta;
+		if (delta < 0) {
+			if (dm->dqb_curspace <= dm->dqb_bsoftlimit)
+				dm->dqb_btime = (time_t) 0;
+			clear_bit(DQ_BLKS_B, &dquot->dq_flags);
+		}
+	}
+	dm->dqb_rsvspace += dquot_fold_counter(&dquot->dq_rsvspace,
+					       dm->dqb_rsvspace, 0);
+	delta = dquot_fold_counter(&dquot->dq_curinodes, dm->dqb_curinodes,
+				   negative);
+	if (delta) {
+		dm->dqb_curinodes += delta;
+		if (delta < 0) {
+			if (dm->dqb_curinodes <= dm->dqb_isoftlimit)
+				dm->dqb_itime = (time_t) 0;
+			clear_bit(DQ_INODES_B, &dquot->dq_flags);
+		}
+	}
+}
+
+static void dquot_fold_all(struct dquot * const *dquots)
+{
+	int cnt;
+
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
+		if (dquots[cnt])
+			dquot_fold(dquots[cnt]);
+}
+
 /*
  *	Read dquot from disk and alloc space for it
  */
@@ -453,6 +518,9 @@ int dquot_commit(struct dquot *dquot)
 		goto out_sem;
 	}
 	spin_unlock(&dq_list_lock);
+	spin_lock(&dq_data_lock);
+	dquot_fold(dquot);
+	spin_unlock(&dq_data_lock);
 	/* Inactive dquot can be only if there was error during read/init
 	 * => we have better not writing it */
 	if (test_bit(DQ_ACTIVE_B, &dquot->dq_flags))
@@ -478,6 +546,9 @@ int dquot_release(struct dquot *dquot)
 	if (atomic_read(&dquot->dq_count) > 1)
 		goto out_dqlock;
 	mutex_lock(&dqopt->dqio_mutex);
+	spin_lock(&dq_data_lock);
+	dquot_fold(dquot);
+	spin_unlock(&dq_data_lock);
 	if (dqopt->ops[dquot->dq_id.type]->release_dqblk) {
 		ret = dqopt->ops[dquot->dq_id.type]->release_dqblk(dquot);
 		/* Write the info */
@@ -504,6 +575,9 @@ EXPORT_SYMBOL(dquot_destroy);
 
 static inline void do_destroy_dquot(struct dquot *dquot)
 {
+	percpu_counter_destroy(&dquot->dq_curinodes);
+	percpu_counter_destroy(&dquot->dq_rsvspace);
+	percpu_counter_destroy(&dquot->dq_curspace);
 	dquot->dq_sb->dq_op->destroy_dquot(dquot);
 }
 
@@ -812,6 +886,13 @@ static struct dquot *get_empty_dquot(struct super_block *sb, int type)
 	if(!dquot)
 		return NULL;
 
+	if (percpu_counter_init(&dquot->dq_curspace, 0))
+		goto out_free;
+	if (percpu_counter_init(&dquot->dq_rsvspace, 0))
+		goto out_curspace;
+	if (percpu_counter_init(&dquot->dq_curinodes, 0))
+		goto out_rsvspace;
+
 	mutex_init(&dquot->dq_lock);
 	INIT_LIST_HEAD(&dquot->dq_free);
 	INIT_LIST_HEAD(&dquot->dq_inuse);
@@ -823,6 +904,14 @@ static struct dquot *get_empty_dquot(struct super_block *sb, int type)
 	atomic_set(&dquot->dq_count, 1);
 
 	return dquot;
+
+out_rsvspace:
+	percpu_counter_destroy(&dquot->dq_rsvspace);
+out_curspace:
+	percpu_counter_destroy(&dquot->dq_curspace);
+out_free:
+	sb->dq_op->destroy_dquot(dquot);
+	return NULL;
 }
 
 /*
@@ -1139,6 +1228,160 @@ static void dquot_decr_space(struct dquot *dquot, qsize_t number)
 	clear_bit(DQ_BLKS_B, &dquot->dq_flags);
 }
 
+/*
+ * Per-cpu batches of the usage counters.  Each cpu can hold back up to one
+ * batch per counter and have one more update in flight, so usage seen
+ * without dq_data_lock is off by less than dquot_slack().
+ */
+#define DQUOT_SPACE_BATCH	(1 << 20)
+#define DQUOT_INODE_BATCH	16
+
+static inline qsize_t dquot_slack(s32 batch)
+{
+	return (qsize_t)batch * 3 * num_online_cpus();
+}
+
+static inline qsize_t dquot_approx(qsize_t value, struct percpu_counter *fbc)
+{
+	return value + percpu_counter_read(fbc);
+}
+
+/*
+ * Can @space be charged to @dquot without looking at the exact usage? Only
+ * if it stays clear of all block limits even in the worst case.
+ */
+static bool bdq_headroom(struct dquot *dquot, qsize_t space)
+{
+	struct mem_dqblk *dm = &dquot->dq_dqb;
+	qsize_t tspace;
+
+	if (!sb_has_quota_limits_enabled(dquot->dq_sb, dquot->dq_id.type) ||
+	    test_bit(DQ_FAKE_B, &dquot->dq_flags))
+		return true;
+
+	tspace = dquot_approx(dm->dqb_curspace, &dquot->dq_curspace) +
+		 dquot_approx(dm->dqb_rsvspace, &dquot->dq_rsvspace) +
+		 space + dquot_slack(DQUOT_SPACE_BATCH);
+	return (!dm->dqb_bhardlimit || tspace <= dm->dqb_bhardlimit) &&
+	       (!dm->dqb_bsoftlimit || tspace <= dm->dqb_bsoftlimit);
+}
+
+/* Can space be released from @dquot without info_bdq_free() warning? */
+static bool bdq_free_quiet(struct dquot *dquot)
+{
+	struct mem_dqblk *dm = &dquot->dq_dqb;
+
+	if (test_bit(DQ_FAKE_B, &dquot->dq_flags))
+		return true;
+	return dm->dqb_bsoftlimit &&
+	       dquot_approx(dm->dqb_curspace, &dquot->dq_curspace) +
+	       dquot_slack(DQUOT_SPACE_BATCH) <= dm->dqb_bsoftlimit;
+}
+
+/* Is there certainly at least @number of usage in @value + @fbc? */
+static bool dquot_has_usage(qsize_t value, struct percpu_counter *fbc,
+			    qsize_t number, s32 batch)
+{
+	return dquot_approx(value, fbc) >= number + dquot_slack(batch);
+}
+
+/*
+ * Change space usage of all @dquots by @cur and reserved space by @rsv
+ * without taking dq_data_lock.  This is only possible if each of the
+ * dquots is far enough from its limits, and from zero when releasing,
+ * that no check, warning or grace time can depend on the exact usage.
+ * Returns false if the caller has to fall back to the checks under
+ * dq_data_lock.
+ */
+static bool dquot_space_fast(struct dquot * const *dquots, qsize_t cur,
+			     qsize_t rsv)
+{
+	struct dquot *dquot;
+	int cnt;
+
+	if (abs64(cur) > DQUOT_SPACE_BATCH || abs64(rsv) > DQUOT_SPACE_BATCH)
+		return false;
+
+	/* Keep our own update in flight bounded to one per cpu */
+	preempt_disable();
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
+		dquot = dquots[cnt];
+		if (!dquot)
+			continue;
+		if (cur + rsv > 0 && !bdq_headroom(dquot, cur + rsv))
+			goto slow;
+		if (cur + rsv < 0 && !bdq_free_quiet(dquot))
+			goto slow;
+		if (cur < 0 && !dquot_has_usage(dquot->dq_dqb.dqb_curspace,
+				&dquot->dq_curspace, -cur, DQUOT_SPACE_BATCH))
+			goto slow;
+		if (rsv < 0 && !dquot_has_usage(dquot->dq_dqb.dqb_rsvspace,
+				&dquot->dq_rsvspace, -rsv, DQUOT_SPACE_BATCH))
+			goto slow;
+	}
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
+		dquot = dquots[cnt];
+		if (!dquot)
+			continue;
+		if (cur)
+			__percpu_counter_add(&dquot->dq_curspace, cur,
+					     DQUOT_SPACE_BATCH);
+		if (rsv)
+			__percpu_counter_add(&dquot->dq_rsvspace, rsv,
+					     DQUOT_SPACE_BATCH);
+	}
+	preempt_enable();
+	return true;
+slow:
+	preempt_enable();
+	return false;
+}
+
+/* Same as dquot_space_fast() for inode usage */
+static bool dquot_inodes_fast(struct dquot * const *dquots, qsize_t inodes)
+{
+	struct dquot *dquot;
+	struct mem_dqblk *dm;
+	qsize_t cur;
+	int cnt;
+
+	preempt_disable();
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
+		dquot = dquots[cnt];
+		if (!dquot)
+			continue;
+		dm = &dquot->dq_dqb;
+		if (inodes < 0 && !dquot_has_usage(dm->dqb_curinodes,
+				&dquot->dq_curinodes, -inodes,
+				DQUOT_INODE_BATCH))
+			goto slow;
+		if (!sb_has_quota_limits_enabled(dquot->dq_sb,
+						 dquot->dq_id.type) ||
+		    test_bit(DQ_FAKE_B, &dquot->dq_flags))
+			continue;
+		cur = dquot_approx(dm->dqb_curinodes, &dquot->dq_curinodes) +
+		      dquot_slack(DQUOT_INODE_BATCH);
+		if (inodes > 0) {
+			cur += inodes;
+			if ((dm->dqb_ihardlimit && cur > dm->dqb_ihardlimit) ||
+			    (dm->dqb_isoftlimit && cur > dm->dqb_isoftlimit))
+				goto slow;
+		} else if (!dm->dqb_isoftlimit || cur > dm->dqb_isoftlimit) {
+			/* info_idq_free() might want to warn */
+			goto slow;
+		}
+	}
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
+		if (dquots[cnt])
+			__percpu_counter_add(&dquots[cnt]->dq_curinodes, inodes,
+					     DQUOT_INODE_BATCH);
+	preempt_enable();
+	return true;
+slow:
+	preempt_enable();
+	return false;
+}
+
 struct dquot_warn {
 	struct super_block *w_sb;
 	struct kqid w_dq_id;
@@ -1617,7 +1860,13 @@ int __dquot_alloc_space(struct inode *inode, qsize_t number, int flags)
 		warn[cnt].w_type = QUOTA_NL_NOWARN;
 
 	down_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
+	if (dquot_space_fast(dquots, reserve ? 0 : number,
+			     reserve ? number : 0)) {
+		inode_incr_space(inode, number, reserve);
+		goto out_dirty;
+	}
 	spin_lock(&dq_data_lock);
+	dquot_fold_all(dquots);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (!dquots[cnt])
 			continue;
@@ -1638,7 +1887,7 @@ int __dquot_alloc_space(struct inode *inode, qsize_t number, int flags)
 	}
 	inode_incr_space(inode, number, reserve);
 	spin_unlock(&dq_data_lock);
-
+out_dirty:
 	if (reserve)
 		goto out_flush_warn;
 	mark_all_dquot_dirty(dquots);
@@ -1666,7 +1915,12 @@ int dquot_alloc_inode(const struct inode *inode)
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
 		warn[cnt].w_type = QUOTA_NL_NOWARN;
 	down_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
+	if (dquot_inodes_fast(dquots, 1)) {
+		mark_all_dquot_dirty(dquots);
+		goto out_unlock;
+	}
 	spin_lock(&dq_data_lock);
+	dquot_fold_all(dquots);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (!dquots[cnt])
 			continue;
@@ -1685,6 +1939,7 @@ warn_put_all:
 	spin_unlock(&dq_data_lock);
 	if (ret == 0)
 		mark_all_dquot_dirty(dquots);
+out_unlock:
 	up_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
 	flush_warnings(warn);
 	return ret;
@@ -1704,7 +1959,12 @@ int dquot_claim_space_nodirty(struct inode *inode, qsize_t number)
 	}
 
 	down_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
+	if (dquot_space_fast(inode->i_dquot, number, -number)) {
+		inode_claim_rsv_space(inode, number);
+		goto out_dirty;
+	}
 	spin_lock(&dq_data_lock);
+	dquot_fold_all(inode->i_dquot);
 	/* Claim reserved quotas to allocated quotas */
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (inode->i_dquot[cnt])
@@ -1714,6 +1974,7 @@ int dquot_claim_space_nodirty(struct inode *inode, qsize_t number)
 	/* Update inode bytes */
 	inode_claim_rsv_space(inode, number);
 	spin_unlock(&dq_data_lock);
+out_dirty:
 	mark_all_dquot_dirty(inode->i_dquot);
 	up_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
 	return 0;
@@ -1733,7 +1994,12 @@ void dquot_reclaim_space_nodirty(struct inode *inode, qsize_t number)
 	}
 
 	down_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
+	if (dquot_space_fast(inode->i_dquot, -number, number)) {
+		inode_reclaim_rsv_space(inode, number);
+		goto out_dirty;
+	}
 	spin_lock(&dq_data_lock);
+	dquot_fold_all(inode->i_dquot);
 	/* Claim reserved quotas to allocated quotas */
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (inode->i_dquot[cnt])
@@ -1743,6 +2009,7 @@ void dquot_reclaim_space_nodirty(struct inode *inode, qsize_t number)
 	/* Update inode bytes */
 	inode_reclaim_rsv_space(inode, number);
 	spin_unlock(&dq_data_lock);
+out_dirty:
 	mark_all_dquot_dirty(inode->i_dquot);
 	up_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
 	return;
@@ -1766,12 +2033,20 @@ void __dquot_free_space(struct inode *inode, qsize_t number, int flags)
 		return;
 	}
 
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
+		warn[cnt].w_type = QUOTA_NL_NOWARN;
+
 	down_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
+	if (dquot_space_fast(dquots, reserve ? 0 : -number,
+			     reserve ? -number : 0)) {
+		inode_decr_space(inode, number, reserve);
+		goto out_dirty;
+	}
 	spin_lock(&dq_data_lock);
+	dquot_fold_all(dquots);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		int wtype;
 
-		warn[cnt].w_type = QUOTA_NL_NOWARN;
 		if (!dquots[cnt])
 			continue;
 		wtype = info_bdq_free(dquots[cnt], number);
@@ -1784,7 +2059,7 @@ void __dquot_free_space(struct inode *inode, qsize_t number, int flags)
 	}
 	inode_decr_space(inode, number, reserve);
 	spin_unlock(&dq_data_lock);
-
+out_dirty:
 	if (reserve)
 		goto out_unlock;
 	mark_all_dquot_dirty(dquots);
@@ -1808,12 +2083,17 @@ void dquot_free_inode(const struct inode *inode)
 	if (!dquot_active(inode))
 		return;
 
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
+		warn[cnt].w_type = QUOTA_NL_NOWARN;
+
 	down_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
+	if (dquot_inodes_fast(dquots, -1))
+		goto out_dirty;
 	spin_lock(&dq_data_lock);
+	dquot_fold_all(dquots);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		int wtype;
 
-		warn[cnt].w_type = QUOTA_NL_NOWARN;
 		if (!dquots[cnt])
 			continue;
 		wtype = info_idq_free(dquots[cnt], 1);
@@ -1822,6 +2102,7 @@ void dquot_free_inode(const struct inode *inode)
 		dquot_decr_inodes(dquots[cnt], 1);
 	}
 	spin_unlock(&dq_data_lock);
+out_dirty:
 	mark_all_dquot_dirty(dquots);
 	up_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
 	flush_warnings(warn);
@@ -1865,6 +2146,8 @@ int __dquot_transfer(struct inode *inode, struct dquot **transfer_to)
 		return 0;
 	}
 	spin_lock(&dq_data_lock);
+	dquot_fold_all(inode->i_dquot);
+	dquot_fold_all(transfer_to);
 	cur_space = inode_get_bytes(inode);
 	rsv_space = inode_get_rsv_space(inode);
 	space = cur_space + rsv_space;
@@ -2418,6 +2701,7 @@ static void do_get_dqblk(struct dquot *dquot, struct fs_disk_quota *di)
 	di->d_id = from_kqid_munged(current_user_ns(), dquot->dq_id);
 
 	spin_lock(&dq_data_lock);
+	dquot_fold(dquot);
 	di->d_blk_hardlimit = stoqb(dm->dqb_bhardlimit);
 	di->d_blk_softlimit = stoqb(dm->dqb_bsoftlimit);
 	di->d_ino_hardlimit = dm->dqb_ihardlimit;
@@ -2470,6 +2754,7 @@ static int do_set_dqblk(struct dquot *dquot, struct fs_disk_quota *di)
 		return -ERANGE;
 
 	spin_lock(&dq_data_lock);
+	dquot_fold(dquot);
 	if (di->d_fieldmask & FS_DQ_BCOUNT) {
 		dm->dqb_curspace = di->d_bcount - dm->dqb_rsvspace;
 		check_blim = 1;
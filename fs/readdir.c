@@ -14,12 +14,16 @@
 #include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/dirent.h>
+#include <linux/namei.h>
+#include <linux/mount.h>
 #include <linux/security.h>
 #include <linux/syscalls.h>
 #include <linux/unistd.h>
 
 #include <asm/uaccess.h>
 
+#include "internal.h"
+
 int iterate_dir(struct file *file, struct dir_context *ctx)
 {
 	struct inode *inode = file_inode(file);
@@ -302,3 +306,167 @@ SYSCALL_DEFINE3(getdents64, unsigned int, fd,
 	fdput(f);
 	return error;
 }
+
+/*
+ * readdirplus() returns the entries of a directory together with their
+ * attributes, saving the stat() of each name which "ls -l" and the like
+ * would otherwise make.  The names are first gathered into a page by
+ * ->iterate, as nfsd_buffered_readdir() does: the attributes can only be
+ * had once the directory is no longer being read, since getting them may
+ * need to look the name up, and the lookup takes i_mutex.
+ */
+struct readdirplus_entry {
+	u64		ino;
+	loff_t		offset;
+	unsigned int	d_type;
+	int		namlen;
+	char		name[0];
+};
+
+struct readdirplus_callback {
+	struct dir_context ctx;
+	char *page;
+	int used;
+	int full;
+};
+
+static int readdirplus_fill(void *__buf, const char *name, int namlen,
+			    loff_t offset, u64 ino, unsigned int d_type)
+{
+	struct readdirplus_callback *buf = __buf;
+	struct readdirplus_entry *de = (void *)(buf->page + buf->used);
+	int reclen = ALIGN(sizeof(*de) + namlen, sizeof(u64));
+
+	if (buf->used + reclen > PAGE_SIZE) {
+		buf->full = 1;
+		return -EINVAL;
+	}
+	de->ino = ino;
+	de->offset = offset;
+	de->d_type = d_type;
+	de->namlen = namlen;
+	memcpy(de->name, name, namlen);
+	buf->used += reclen;
+	return 0;
+}
+
+/*
+ * Get the attributes of @de, found in the directory open as @file.  The
+ * mask of the result is left 0 for "..", which may be on another mount,
+ * and for a name which has gone away meanwhile.
+ */
+static void readdirplus_getattr(struct file *file,
+				struct readdirplus_entry *de,
+				struct kstat *stat, unsigned int mask,
+				unsigned int flags)
+{
+	struct dentry *parent = file->f_path.dentry;
+	struct path path;
+	int error;
+
+	memset(stat, 0, sizeof(*stat));
+	if (de->namlen == 2 && de->name[0] == '.' && de->name[1] == '.')
+		return;
+
+	if (de->namlen == 1 && de->name[0] == '.') {
+		path.dentry = dget(parent);
+	} else {
+		mutex_lock(&parent->d_inode->i_mutex);
+		path.dentry = lookup_one_len(de->name, parent, de->namlen);
+		mutex_unlock(&parent->d_inode->i_mutex);
+		if (IS_ERR(path.dentry))
+			return;
+		if (!path.dentry->d_inode) {
+			dput(path.dentry);
+			return;
+		}
+	}
+	path.mnt = mntget(file->f_path.mnt);
+	while (d_mountpoint(path.dentry) && follow_down_one(&path))
+		;
+
+	error = vfs_getattr_mask(&path, stat, mask, flags);
+	if (error)
+		memset(stat, 0, sizeof(*stat));
+	path_put(&path);
+}
+
+SYSCALL_DEFINE5(readdirplus, unsigned int, fd,
+		struct linux_dirent_plus __user *, dirent, unsigned int, count,
+		unsigned int, flags, unsigned int, mask)
+{
+	struct readdirplus_callback buf = {
+		.ctx.actor = readdirplus_fill,
+	};
+	struct readdirplus_entry *de, *next;
+	struct linux_dirent_plus __user *cur = dirent;
+	struct kstat stat;
+	struct fd f;
+	char *end;
+	int reclen, error;
+
+	if (flags & ~AT_STATX_SYNC_TYPE)
+		return -EINVAL;
+	if ((flags & AT_STATX_SYNC_TYPE) == AT_STATX_SYNC_TYPE)
+		return -EINVAL;
+	if (mask & STATX__RESERVED)
+		return -EINVAL;
+	if (!access_ok(VERIFY_WRITE, dirent, count))
+		return -EFAULT;
+
+	f = fdget(fd);
+	if (!f.file)
+		return -EBADF;
+
+	error = -ENOMEM;
+	buf.page = (char *)__get_free_page(GFP_KERNEL);
+	if (!buf.page)
+		goto out;
+
+	error = iterate_dir(f.file, &buf.ctx);
+	if (error < 0 && !(buf.full && buf.used))
+		goto out_free;
+	error = 0;
+
+	de = (void *)buf.page;
+	end = buf.page + buf.used;
+	while ((char *)de < end) {
+		next = (void *)de + ALIGN(sizeof(*de) + de->namlen,
+					  sizeof(u64));
+		reclen = ALIGN(offsetof(struct linux_dirent_plus, d_name) +
+			       de->namlen + 1, sizeof(u64));
+		if (reclen > count) {
+			if (cur == dirent)
+				error = -EINVAL;
+			break;
+		}
+
+		readdirplus_getattr(f.file, de, &stat, mask, flags);
+		if (cp_statx(&stat, &cur->d_stat) ||
+		    __put_user(de->ino, &cur->d_ino) ||
+		    __put_user((char *)next < end ? next->offset :
+			       buf.ctx.pos, &cur->d_off) ||
+		    __put_user(reclen, &cur->d_reclen) ||
+		    __put_user(de->d_type, &cur->d_type) ||
+		    __clear_user(cur->__spare, sizeof(cur->__spare)) ||
+		    copy_to_user(cur->d_name, de->name, de->namlen) ||
+		    __put_user(0, cur->d_name + de->namlen)) {
+			if (cur == dirent)
+				error = -EFAULT;
+			break;
+		}
+		cur = (void __user *)cur + reclen;
+		count -= reclen;
+		de = next;
+	}
+	/* Whatever did not fit is returned by the next call */
+	if ((char *)de < end)
+		vfs_llseek(f.file, de->offset, SEEK_SET);
+	if (!error)
+		error = (void __user *)cur - (void __user *)dirent;
+out_free:
+	free_page((unsigned long)buf.page);
+out:
+	fdput(f);
+	return error;
+}
@@ -31,6 +31,7 @@
 #include <linux/security.h>
 #include <linux/gfp.h>
 #include <linux/socket.h>
+#include <linux/net.h>
 #include <linux/compat.h>
 #include "internal.h"
 
@@ -1412,6 +1413,16 @@ static long do_splice(struct file *in, loff_t __user *off_in,
 		return ret;
 	}
 
+#ifdef CONFIG_NET
+	if (S_ISSOCK(file_inode(in)->i_mode) &&
+	    S_ISSOCK(file_inode(out)->i_mode)) {
+		if (off_in || off_out)
+			return -ESPIPE;
+
+		return sock_splice_to_sock(in, out, len, flags);
+	}
+#endif
+
 	return -EINVAL;
 }
 
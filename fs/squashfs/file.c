@@ -47,6 +47,7 @@
 #include <linux/string.h>
 #include <linux/pagemap.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -497,7 +498,117 @@ out:
 	return 0;
 }
 
+/*
+ * Readahead.  Reading the first page of a block fills all the pages of the
+ * block, so one page per block is enough to read the whole readahead window.
+ * The blocks after the first are decompressed by squashfs_read_wq, in
+ * parallel with each other and with the first one, which is read here since
+ * it is the one most likely waited for.
+ */
+static struct workqueue_struct *squashfs_read_wq;
+
+struct squashfs_read_work {
+	struct work_struct work;
+	struct page *page;
+};
+
+static void squashfs_read_work_fn(struct work_struct *work)
+{
+	struct squashfs_read_work *rw = container_of(work,
+		struct squashfs_read_work, work);
+
+	squashfs_readpage(NULL, rw->page);
+	page_cache_release(rw->page);
+	kfree(rw);
+}
+
+static void squashfs_readahead_block(struct address_space *mapping,
+	struct page *page, struct page **first)
+{
+	struct squashfs_read_work *rw;
+
+	list_del(&page->lru);
+	if (add_to_page_cache_lru(page, mapping, page->index,
+				mapping_gfp_mask(mapping))) {
+		page_cache_release(page);
+		return;
+	}
+
+	if (*first == NULL) {
+		*first = page;
+		return;
+	}
+
+	rw = kmalloc(sizeof(*rw), GFP_KERNEL);
+	if (rw == NULL) {
+		squashfs_readpage(NULL, page);
+		page_cache_release(page);
+		return;
+	}
+
+	INIT_WORK(&rw->work, squashfs_read_work_fn);
+	rw->page = page;
+	queue_work(squashfs_read_wq, &rw->work);
+}
+
+static int squashfs_readpages(struct file *file, struct address_space *mapping,
+	struct list_head *pages, unsigned nr_pages)
+{
+	struct inode *inode = mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_CACHE_SHIFT;
+	struct page *page, *next, *block_page = NULL, *first = NULL;
+
+	/*
+	 * With a single decompressor the blocks would only be decompressed
+	 * one after the other, leave them to squashfs_readpage
+	 */
+	if (squashfs_max_decompressors() == 1)
+		return 0;
+
+	/*
+	 * The pages are listed in decreasing index order.  Pages not taken
+	 * are freed by the caller, those of their block are allocated again
+	 * as the block is read.  The page marked for the next asynchronous
+	 * readahead is preferred, so that the mark is kept.
+	 */
+	list_for_each_entry_safe_reverse(page, next, pages, lru) {
+		if (block_page && page->index >> shift ==
+					block_page->index >> shift) {
+			if (PageReadahead(page) && !PageReadahead(block_page))
+				block_page = page;
+			continue;
+		}
+
+		if (block_page)
+			squashfs_readahead_block(mapping, block_page, &first);
+		block_page = page;
+	}
+	if (block_page)
+		squashfs_readahead_block(mapping, block_page, &first);
+
+	if (first) {
+		squashfs_readpage(file, first);
+		page_cache_release(first);
+	}
+
+	return 0;
+}
+
+int __init squashfs_init_read_wq(void)
+{
+	squashfs_read_wq = alloc_workqueue("squashfs_read",
+					   WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+	return squashfs_read_wq ? 0 : -ENOMEM;
+}
+
+void squashfs_destroy_read_wq(void)
+{
+	destroy_workqueue(squashfs_read_wq);
+}
+
 
 const struct address_space_operations squashfs_aops = {
-	.readpage = squashfs_readpage
+	.readpage = squashfs_readpage,
+	.readpages = squashfs_readpages
 };
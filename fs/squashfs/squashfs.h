@@ -69,6 +69,8 @@ extern __le64 *squashfs_read_fragment_index_table(struct super_block *,
 /* file.c */
 void squashfs_copy_cache(struct page *, struct squashfs_cache_entry *, int,
 				int);
+extern int squashfs_init_read_wq(void);
+extern void squashfs_destroy_read_wq(void);
 
 /* file_xxx.c */
 extern int squashfs_readpage_block(struct page *, u64, int);
@@ -18,6 +18,8 @@
 #include <asm/uaccess.h>
 #include <asm/unistd.h>
 
+#include "internal.h"
+
 void generic_fillattr(struct inode *inode, struct kstat *stat)
 {
 	stat->dev = inode->i_sb->s_dev;
@@ -33,10 +35,40 @@ void generic_fillattr(struct inode *inode, struct kstat *stat)
 	stat->ctime = inode->i_ctime;
 	stat->blksize = (1 << inode->i_blkbits);
 	stat->blocks = inode->i_blocks;
+	stat->result_mask |= STATX_BASIC_STATS;
 }
 
 EXPORT_SYMBOL(generic_fillattr);
 
+/*
+ * A filesystem's ->getattr may look at stat->request_mask and
+ * stat->query_flags to skip fetching what is not wanted, or to return
+ * cached attributes; one which does not set stat->result_mask is taken
+ * to have filled in all the basic stats.
+ */
+int __vfs_getattr(struct path *path, struct kstat *stat, u32 request_mask,
+		  unsigned int query_flags)
+{
+	struct inode *inode = path->dentry->d_inode;
+	int retval;
+
+	stat->request_mask = request_mask & STATX_ALL;
+	stat->query_flags = query_flags & AT_STATX_SYNC_TYPE;
+	stat->result_mask = 0;
+
+	if (inode->i_op->getattr) {
+		retval = inode->i_op->getattr(path->mnt, path->dentry, stat);
+		if (!retval && !stat->result_mask)
+			stat->result_mask = STATX_BASIC_STATS;
+		return retval;
+	}
+
+	generic_fillattr(inode, stat);
+	return 0;
+}
+
+EXPORT_SYMBOL(__vfs_getattr);
+
 /**
  * vfs_getattr_nosec - getattr without security checks
  * @path: file to get attributes from
@@ -51,25 +83,39 @@ EXPORT_SYMBOL(generic_fillattr);
  */
 int vfs_getattr_nosec(struct path *path, struct kstat *stat)
 {
-	struct inode *inode = path->dentry->d_inode;
-
-	if (inode->i_op->getattr)
-		return inode->i_op->getattr(path->mnt, path->dentry, stat);
-
-	generic_fillattr(inode, stat);
-	return 0;
+	return __vfs_getattr(path, stat, STATX_BASIC_STATS,
+			     AT_STATX_SYNC_AS_STAT);
 }
 
 EXPORT_SYMBOL(vfs_getattr_nosec);
 
-int vfs_getattr(struct path *path, struct kstat *stat)
+/**
+ * vfs_getattr_mask - get the attributes of a file
+ * @path: file to get attributes from
+ * @stat: structure to return attributes in
+ * @request_mask: STATX_* fields wanted
+ * @query_flags: AT_STATX_SYNC_TYPE flags
+ *
+ * The fields filled in are returned in stat->result_mask: they may be
+ * more than were asked for, or fewer if the filesystem does not have them.
+ */
+int vfs_getattr_mask(struct path *path, struct kstat *stat, u32 request_mask,
+		     unsigned int query_flags)
 {
 	int retval;
 
 	retval = security_inode_getattr(path->mnt, path->dentry);
 	if (retval)
 		return retval;
-	return vfs_getattr_nosec(path, stat);
+	return __vfs_getattr(path, stat, request_mask, query_flags);
+}
+
+EXPORT_SYMBOL(vfs_getattr_mask);
+
+int vfs_getattr(struct path *path, struct kstat *stat)
+{
+	return vfs_getattr_mask(path, stat, STATX_BASIC_STATS,
+				AT_STATX_SYNC_AS_STAT);
 }
 
 EXPORT_SYMBOL(vfs_getattr);
@@ -87,27 +133,37 @@ int vfs_fstat(unsigned int fd, struct kstat *stat)
 }
 EXPORT_SYMBOL(vfs_fstat);
 
-int vfs_fstatat(int dfd, const char __user *filename, struct kstat *stat,
-		int flag)
+/**
+ * vfs_statx - get the attributes of a file by name
+ * @dfd: directory @filename is relative to, or AT_FDCWD
+ * @filename: name of the file
+ * @flags: AT_* lookup flags, and AT_STATX_SYNC_TYPE flags
+ * @stat: structure to return attributes in
+ * @request_mask: STATX_* fields wanted
+ */
+int vfs_statx(int dfd, const char __user *filename, int flags,
+	      struct kstat *stat, u32 request_mask)
 {
 	struct path path;
 	int error = -EINVAL;
 	unsigned int lookup_flags = 0;
 
-	if ((flag & ~(AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT |
-		      AT_EMPTY_PATH)) != 0)
+	if ((flags & ~(AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT |
+		       AT_EMPTY_PATH | AT_STATX_SYNC_TYPE)) != 0)
+		goto out;
+	if ((flags & AT_STATX_SYNC_TYPE) == AT_STATX_SYNC_TYPE)
 		goto out;
 
-	if (!(flag & AT_SYMLINK_NOFOLLOW))
+	if (!(flags & AT_SYMLINK_NOFOLLOW))
 		lookup_flags |= LOOKUP_FOLLOW;
-	if (flag & AT_EMPTY_PATH)
+	if (flags & AT_EMPTY_PATH)
 		lookup_flags |= LOOKUP_EMPTY;
 retry:
 	error = user_path_at(dfd, filename, lookup_flags, &path);
 	if (error)
 		goto out;
 
-	error = vfs_getattr(&path, stat);
+	error = vfs_getattr_mask(&path, stat, request_mask, flags);
 	path_put(&path);
 	if (retry_estale(error, lookup_flags)) {
 		lookup_flags |= LOOKUP_REVAL;
@@ -116,6 +172,17 @@ retry:
 out:
 	return error;
 }
+EXPORT_SYMBOL(vfs_statx);
+
+int vfs_fstatat(int dfd, const char __user *filename, struct kstat *stat,
+		int flag)
+{
+	if ((flag & ~(AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT |
+		      AT_EMPTY_PATH)) != 0)
+		return -EINVAL;
+
+	return vfs_statx(dfd, filename, flag, stat, STATX_BASIC_STATS);
+}
 EXPORT_SYMBOL(vfs_fstatat);
 
 int vfs_stat(const char __user *name, struct kstat *stat)
@@ -445,6 +512,59 @@ SYSCALL_DEFINE4(fstatat64, int, dfd, const char __user *, filename,
 }
 #endif /* __ARCH_WANT_STAT64 || __ARCH_WANT_COMPAT_STAT64 */
 
+long cp_statx(const struct kstat *stat, struct statx __user *buffer)
+{
+	struct statx tmp;
+
+	memset(&tmp, 0, sizeof(tmp));
+
+	tmp.stx_mask = stat->result_mask;
+	tmp.stx_blksize = stat->blksize;
+	tmp.stx_nlink = stat->nlink;
+	tmp.stx_uid = from_kuid_munged(current_user_ns(), stat->uid);
+	tmp.stx_gid = from_kgid_munged(current_user_ns(), stat->gid);
+	tmp.stx_mode = stat->mode;
+	tmp.stx_ino = stat->ino;
+	tmp.stx_size = stat->size;
+	tmp.stx_blocks = stat->blocks;
+	tmp.stx_atime.tv_sec = stat->atime.tv_sec;
+	tmp.stx_atime.tv_nsec = stat->atime.tv_nsec;
+	tmp.stx_ctime.tv_sec = stat->ctime.tv_sec;
+	tmp.stx_ctime.tv_nsec = stat->ctime.tv_nsec;
+	tmp.stx_mtime.tv_sec = stat->mtime.tv_sec;
+	tmp.stx_mtime.tv_nsec = stat->mtime.tv_nsec;
+	tmp.stx_rdev_major = MAJOR(stat->rdev);
+	tmp.stx_rdev_minor = MINOR(stat->rdev);
+	tmp.stx_dev_major = MAJOR(stat->dev);
+	tmp.stx_dev_minor = MINOR(stat->dev);
+
+	return copy_to_user(buffer, &tmp, sizeof(tmp)) ? -EFAULT : 0;
+}
+
+/**
+ * sys_statx - get the attributes of a file, as far as asked for
+ * @dfd: directory @filename is relative to, or AT_FDCWD
+ * @filename: name of the file, or "" with AT_EMPTY_PATH for @dfd itself
+ * @flags: AT_* lookup flags, and AT_STATX_SYNC_TYPE flags
+ * @mask: STATX_* fields wanted
+ * @buffer: result, with stx_mask saying which fields were filled in
+ */
+SYSCALL_DEFINE5(statx, int, dfd, const char __user *, filename,
+		unsigned, flags, unsigned int, mask,
+		struct statx __user *, buffer)
+{
+	struct kstat stat;
+	int error;
+
+	if (mask & STATX__RESERVED)
+		return -EINVAL;
+
+	error = vfs_statx(dfd, filename, flags, &stat, mask);
+	if (error)
+		return error;
+	return cp_statx(&stat, buffer);
+}
+
 /* Caller is here responsible for sufficient locking (ie. inode->i_lock) */
 void __inode_add_bytes(struct inode *inode, loff_t bytes)
 {
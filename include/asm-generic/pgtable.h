@@ -815,6 +815,21 @@ static inline void pmdp_set_numa(struct mm_struct *mm, unsigned long addr,
 }
 #endif /* CONFIG_NUMA_BALANCING */
 
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+int pmd_set_huge(pmd_t *pmd, phys_addr_t addr, pgprot_t prot);
+int pmd_clear_huge(pmd_t *pmd);
+#else
+static inline int pmd_set_huge(pmd_t *pmd, phys_addr_t addr, pgprot_t prot)
+{
+	return 0;
+}
+
+static inline int pmd_clear_huge(pmd_t *pmd)
+{
+	return 0;
+}
+#endif /* CONFIG_HAVE_ARCH_HUGE_VMAP */
+
 #endif /* CONFIG_MMU */
 
 #endif /* !__ASSEMBLY__ */
@@ -11,6 +11,7 @@
 
 struct kioctx;
 struct kiocb;
+struct wait_bit_queue;
 
 #define KIOCB_KEY		0
 
@@ -52,6 +53,12 @@ struct kiocb {
 	 * this is the underlying eventfd context to deliver events to.
 	 */
 	struct eventfd_ctx	*ki_eventfd;
+
+	/*
+	 * Set for a buffered read which is not to wait for pages to be read
+	 * in: see do_generic_file_read().
+	 */
+	struct wait_bit_queue	*ki_waitq;
 };
 
 static inline bool is_sync_kiocb(struct kiocb *kiocb)
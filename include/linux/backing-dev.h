@@ -59,6 +59,19 @@ struct bdi_writeback {
 	struct list_head b_io;		/* parked for writeback */
 	struct list_head b_more_io;	/* parked for more writeback */
 	spinlock_t list_lock;		/* protects the b_* lists */
+
+#ifdef CONFIG_CGROUP_WRITEBACK
+	/*
+	 * A cgroup wb holds the inodes dirtied by the tasks of one memory
+	 * and blkio cgroup pair, so that they are written back, and their
+	 * dirtiers throttled, apart from those of the other cgroups.  The
+	 * root wb, embedded in the bdi, has no cgroups.
+	 */
+	struct list_head bdi_node;	/* on bdi->wb_list */
+	struct cgroup_subsys_state *memcg_css;
+	struct cgroup_subsys_state *blkcg_css;
+	atomic_long_t nr_dirty;		/* dirty pages of its inodes */
+#endif
 };
 
 struct backing_dev_info {
@@ -98,6 +111,9 @@ struct backing_dev_info {
 	spinlock_t wb_lock;	  /* protects work_list & wb.dwork scheduling */
 
 	struct list_head work_list;
+#ifdef CONFIG_CGROUP_WRITEBACK
+	struct list_head wb_list; /* cgroup wbs, added under wb_lock */
+#endif
 
 	struct device *dev;
 
@@ -121,9 +137,11 @@ int __must_check bdi_setup_and_register(struct backing_dev_info *, char *, unsig
 void bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages,
 			enum wb_reason reason);
 void bdi_start_background_writeback(struct backing_dev_info *bdi);
+void wb_start_background_writeback(struct bdi_writeback *wb);
 void bdi_writeback_workfn(struct work_struct *work);
 int bdi_has_dirty_io(struct backing_dev_info *bdi);
 void bdi_wakeup_thread_delayed(struct backing_dev_info *bdi);
+void wb_wakeup_delayed(struct bdi_writeback *wb);
 void bdi_lock_two(struct bdi_writeback *wb1, struct bdi_writeback *wb2);
 
 extern spinlock_t bdi_lock;
@@ -138,6 +156,69 @@ static inline int wb_has_dirty_io(struct bdi_writeback *wb)
 	       !list_empty(&wb->b_more_io);
 }
 
+static inline bool wb_is_root(struct bdi_writeback *wb)
+{
+	return wb == &wb->bdi->wb;
+}
+
+static inline struct backing_dev_info *inode_to_bdi(struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+
+	if (sb_is_blkdev_sb(sb))
+		return inode->i_mapping->backing_dev_info;
+
+	return sb->s_bdi;
+}
+
+#ifdef CONFIG_CGROUP_WRITEBACK
+struct bdi_writeback *wb_get_create(struct backing_dev_info *bdi);
+void inode_attach_wb(struct inode *inode);
+
+/*
+ * The wb which an inode is on the lists of, and which its dirty pages are
+ * accounted to.  It is attached when the inode is first dirtied, and does
+ * not change after, but for a block device inode switching bdi.
+ */
+static inline struct bdi_writeback *inode_to_wb(struct inode *inode)
+{
+	struct bdi_writeback *wb = ACCESS_ONCE(inode->i_wb);
+
+	return wb ? wb : &inode_to_bdi(inode)->wb;
+}
+
+static inline void wb_account_dirty(struct address_space *mapping, long nr)
+{
+	struct bdi_writeback *wb;
+
+	if (mapping->host) {
+		wb = ACCESS_ONCE(mapping->host->i_wb);
+		if (wb)
+			atomic_long_add(nr, &wb->nr_dirty);
+	}
+}
+
+static inline unsigned long wb_dirty_pages(struct bdi_writeback *wb)
+{
+	long nr = atomic_long_read(&wb->nr_dirty);
+
+	return nr > 0 ? nr : 0;
+}
+#else
+static inline void inode_attach_wb(struct inode *inode)
+{
+}
+
+static inline struct bdi_writeback *inode_to_wb(struct inode *inode)
+{
+	return &inode_to_bdi(inode)->wb;
+}
+
+static inline void wb_account_dirty(struct address_space *mapping, long nr)
+{
+}
+#endif
+
 static inline void __add_bdi_stat(struct backing_dev_info *bdi,
 		enum bdi_stat_item item, s64 amount)
 {
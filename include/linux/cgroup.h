@@ -36,6 +36,9 @@ extern void cgroup_post_fork(struct task_struct *p);
 extern void cgroup_exit(struct task_struct *p);
 extern int cgroupstats_build(struct cgroupstats *stats,
 				struct dentry *dentry);
+extern long cgroup_dir_for_each_task(struct dentry *dentry, long skip,
+				     int (*fn)(struct task_struct *, void *),
+				     void *data);
 
 extern int proc_cgroup_show(struct seq_file *, void *);
 
@@ -47,6 +50,18 @@ enum cgroup_subsys_id {
 };
 #undef SUBSYS
 
+/*
+ * Per-cpu links of the tree of csses with stat updates not flushed yet,
+ * see css_rstat_updated().  A css updated on a cpu is on its parent's
+ * updated_children list for that cpu, and so are all of its ancestors.
+ * The lists end with the parent itself, so a css is on a list exactly
+ * when its updated_next is set.  An updated root points to itself.
+ */
+struct css_rstat_cpu {
+	struct cgroup_subsys_state *updated_children;
+	struct cgroup_subsys_state *updated_next;
+};
+
 /* Per-subsystem/per-cgroup state maintained by the system. */
 struct cgroup_subsys_state {
 	/* the cgroup that this css is attached to */
@@ -61,6 +76,9 @@ struct cgroup_subsys_state {
 	/* the parent css */
 	struct cgroup_subsys_state *parent;
 
+	/* for subsystems with ->css_rstat_flush(), see css_rstat_updated() */
+	struct css_rstat_cpu __percpu *rstat_cpu;
+
 	unsigned long flags;
 
 	/* percpu_ref killing and RCU release */
@@ -116,6 +134,23 @@ static inline void css_put(struct cgroup_subsys_state *css)
 		percpu_ref_put(&css->refcnt);
 }
 
+/*
+ * Recursive stats: a subsystem keeps its counters per cpu and reports
+ * each update with css_rstat_updated().  css_rstat_flush() then hands
+ * ->css_rstat_flush() only the csses and cpus with something pending,
+ * children before their parent, so the subsystem can fold the per-cpu
+ * deltas into totals and carry them up the hierarchy.
+ */
+void css_rstat_updated(struct cgroup_subsys_state *css, int cpu);
+void css_rstat_flush(struct cgroup_subsys_state *css);
+void css_rstat_flush_hold(struct cgroup_subsys_state *css);
+void css_rstat_flush_release(void);
+
+/* cgroup core only */
+void css_rstat_boot(void);
+int css_rstat_init(struct cgroup_subsys_state *css);
+void css_rstat_exit(struct cgroup_subsys_state *css);
+
 /* bits in struct cgroup flags field */
 enum {
 	/* Control Group is dead */
@@ -573,6 +608,7 @@ struct cgroup_subsys {
 	int (*css_online)(struct cgroup_subsys_state *css);
 	void (*css_offline)(struct cgroup_subsys_state *css);
 	void (*css_free)(struct cgroup_subsys_state *css);
+	void (*css_rstat_flush)(struct cgroup_subsys_state *css, int cpu);
 
 	int (*can_attach)(struct cgroup_subsys_state *css,
 			  struct cgroup_taskset *tset);
@@ -866,6 +902,13 @@ static inline int cgroupstats_build(struct cgroupstats *stats,
 	return -EINVAL;
 }
 
+static inline long cgroup_dir_for_each_task(struct dentry *dentry, long skip,
+				int (*fn)(struct task_struct *, void *),
+				void *data)
+{
+	return -EINVAL;
+}
+
 /* No cgroups - nothing to do */
 static inline int cgroup_attach_task_all(struct task_struct *from,
 					 struct task_struct *t)
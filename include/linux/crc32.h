@@ -7,6 +7,7 @@
 
 #include <linux/types.h>
 #include <linux/bitrev.h>
+#include <linux/list.h>
 
 extern u32  crc32_le(u32 crc, unsigned char const *p, size_t len);
 extern u32  crc32_be(u32 crc, unsigned char const *p, size_t len);
@@ -53,6 +54,32 @@ extern u32  __crc32c_le(u32 crc, unsigned char const *p, size_t len);
  */
 extern u32  __crc32c_le_combine(u32 crc1, u32 crc2, size_t len2);
 
+/* The table driven implementations, whatever crc32_le() dispatches to */
+extern u32  crc32_le_base(u32 crc, unsigned char const *p, size_t len);
+extern u32  __crc32c_le_base(u32 crc, unsigned char const *p, size_t len);
+
+/**
+ * struct crc32_algo - an implementation of crc32_le() and __crc32c_le()
+ * @name: name shown when it gets picked
+ * @crc32_le: like crc32_le(), or NULL
+ * @crc32c_le: like __crc32c_le(), or NULL
+ * @crc32_le_perf: page calls per timing period of @crc32_le, set on
+ *		   registering
+ * @crc32c_le_perf: the same for @crc32c_le
+ * @list: entry in the list of registered implementations
+ */
+struct crc32_algo {
+	const char *name;
+	u32 (*crc32_le)(u32 crc, unsigned char const *p, size_t len);
+	u32 (*crc32c_le)(u32 crc, unsigned char const *p, size_t len);
+	unsigned long crc32_le_perf;
+	unsigned long crc32c_le_perf;
+	struct list_head list;
+};
+
+extern int  crc32_register_algo(struct crc32_algo *algo);
+extern void crc32_unregister_algo(struct crc32_algo *algo);
+
 #define crc32(seed, data, length)  crc32_le(seed, (unsigned char const *)(data), length)
 
 /*
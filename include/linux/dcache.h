@@ -123,7 +123,7 @@ struct dentry {
 	unsigned long d_time;		/* used by d_revalidate */
 	void *d_fsdata;			/* fs-specific data */
 
-	struct list_head d_lru;		/* LRU list */
+	struct list_head d_lru;		/* LRU list, or in-lookup hash */
 	/*
 	 * d_child and d_rcu can share memory
 	 */
@@ -222,6 +222,7 @@ struct dentry_operations {
 #define DCACHE_FILE_TYPE		0x00400000 /* Other file type */
 
 #define DCACHE_MAY_FREE			0x00800000
+#define DCACHE_PAR_LOOKUP		0x01000000 /* in lookup, no i_mutex */
 
 extern seqlock_t rename_lock;
 
@@ -245,6 +246,8 @@ extern void d_set_d_op(struct dentry *dentry, const struct dentry_operations *op
 /* allocate/de-allocate */
 extern struct dentry * d_alloc(struct dentry *, const struct qstr *);
 extern struct dentry * d_alloc_pseudo(struct super_block *, const struct qstr *);
+extern struct dentry * d_alloc_parallel(struct dentry *, const struct qstr *);
+extern void __d_lookup_done(struct dentry *);
 extern struct dentry * d_splice_alias(struct inode *, struct dentry *);
 extern struct dentry * d_add_ci(struct dentry *, struct inode *, struct qstr *);
 extern struct dentry *d_find_any_alias(struct inode *inode);
@@ -383,6 +386,36 @@ static inline int d_unlinked(const struct dentry *dentry)
 	return d_unhashed(dentry) && !IS_ROOT(dentry);
 }
 
+/**
+ *	d_in_lookup -	is dentry being looked up
+ *	@dentry: entry to check
+ *
+ *	Returns true if the dentry came from d_alloc_parallel(), and
+ *	d_lookup_done() has not been called on it yet.
+ */
+
+static inline int d_in_lookup(const struct dentry *dentry)
+{
+	return dentry->d_flags & DCACHE_PAR_LOOKUP;
+}
+
+/**
+ *	d_lookup_done -	end the lookup of a dentry
+ *	@dentry: entry which i_op->lookup has been called on
+ *
+ *	Wakes up the lookups of the same name waiting for this one.  Does
+ *	nothing if the dentry was not in lookup.
+ */
+
+static inline void d_lookup_done(struct dentry *dentry)
+{
+	if (unlikely(d_in_lookup(dentry))) {
+		spin_lock(&dentry->d_lock);
+		__d_lookup_done(dentry);
+		spin_unlock(&dentry->d_lock);
+	}
+}
+
 static inline int cant_mount(const struct dentry *dentry)
 {
 	return (dentry->d_flags & DCACHE_CANT_MOUNT);
@@ -146,6 +146,19 @@ struct irte {
 				__reserved_2	: 8,
 				dest_id		: 32;
 		};
+		/* Posted format, when p_pst is set */
+		struct {
+			__u64	p_present	: 1,
+				p_fpd		: 1,
+				__p_reserved_1	: 6,
+				p_avail		: 4,
+				__p_reserved_2	: 2,
+				p_urgent	: 1,
+				p_pst		: 1,
+				p_vector	: 8,
+				__p_reserved_3	: 14,
+				pda_l		: 26;
+		};
 		__u64 low;
 	};
 
@@ -156,6 +169,11 @@ struct irte {
 				svt		: 2,
 				__reserved_3	: 44;
 		};
+		/* Posted format, sid, sq and svt stay where they are */
+		struct {
+			__u64	__p_reserved_4	: 32,
+				pda_h		: 32;
+		};
 		__u64 high;
 	};
 };
@@ -183,6 +183,8 @@ struct fsnotify_group {
 			wait_queue_head_t access_waitq;
 			atomic_t bypass_perm;
 #endif /* CONFIG_FANOTIFY_ACCESS_PERMISSIONS */
+			/* queued events hashed by object, for merging */
+			struct hlist_head *merge_hash;
 			int f_flags;
 			unsigned int max_marks;
 			struct user_struct *user;
@@ -324,7 +326,7 @@ extern void fsnotify_destroy_event(struct fsnotify_group *group,
 /* attach the event to the group notification queue */
 extern int fsnotify_add_notify_event(struct fsnotify_group *group,
 				     struct fsnotify_event *event,
-				     int (*merge)(struct list_head *,
+				     int (*merge)(struct fsnotify_group *,
 						  struct fsnotify_event *));
 /* true if the group notification queue is empty */
 extern bool fsnotify_notify_queue_is_empty(struct fsnotify_group *group);
@@ -182,6 +182,7 @@ enum trace_reg {
 };
 
 struct ftrace_event_call;
+struct sk_filter;
 
 struct ftrace_event_class {
 	char			*system;
@@ -234,6 +235,7 @@ enum {
 	TRACE_EVENT_FL_WAS_ENABLED_BIT,
 	TRACE_EVENT_FL_USE_CALL_FILTER_BIT,
 	TRACE_EVENT_FL_TRACEPOINT_BIT,
+	TRACE_EVENT_FL_KPROBE_BIT,
 };
 
 /*
@@ -247,6 +249,7 @@ enum {
  *                     it is best to clear the buffers that used it).
  *  USE_CALL_FILTER - For ftrace internal events, don't use file filter
  *  TRACEPOINT    - Event is a tracepoint
+ *  KPROBE        - Event is a kprobe or kretprobe
  */
 enum {
 	TRACE_EVENT_FL_FILTERED		= (1 << TRACE_EVENT_FL_FILTERED_BIT),
@@ -256,6 +259,7 @@ enum {
 	TRACE_EVENT_FL_WAS_ENABLED	= (1 << TRACE_EVENT_FL_WAS_ENABLED_BIT),
 	TRACE_EVENT_FL_USE_CALL_FILTER	= (1 << TRACE_EVENT_FL_USE_CALL_FILTER_BIT),
 	TRACE_EVENT_FL_TRACEPOINT	= (1 << TRACE_EVENT_FL_TRACEPOINT_BIT),
+	TRACE_EVENT_FL_KPROBE		= (1 << TRACE_EVENT_FL_KPROBE_BIT),
 };
 
 struct ftrace_event_call {
@@ -286,6 +290,7 @@ struct ftrace_event_call {
 #ifdef CONFIG_PERF_EVENTS
 	int				perf_refcount;
 	struct hlist_head __percpu	*perf_events;
+	struct sk_filter __rcu		*prog;	/* attached BPF program */
 
 	int	(*perf_perm)(struct ftrace_event_call *,
 			     struct perf_event *);
@@ -465,7 +470,7 @@ __event_trigger_test_discard(struct ftrace_event_file *file,
 		*tt = event_triggers_call(file, entry);
 
 	if (test_bit(FTRACE_EVENT_FL_SOFT_DISABLED_BIT, &file->flags))
-		ring_buffer_discard_commit(buffer, event);
+		trace_current_buffer_discard_commit(buffer, event);
 	else if (!filter_check_discard(file, entry, buffer, event))
 		return false;
 
@@ -619,6 +624,12 @@ extern int  ftrace_profile_set_filter(struct perf_event *event, int event_id,
 extern void ftrace_profile_free_filter(struct perf_event *event);
 extern void *perf_trace_buf_prepare(int size, unsigned short type,
 				    struct pt_regs *regs, int *rctxp);
+extern void perf_trace_run_bpf_submit(void *raw_data, int size, int rctx,
+				      struct ftrace_event_call *call,
+				      u64 addr, u64 count,
+				      struct pt_regs *regs,
+				      struct hlist_head *head,
+				      struct task_struct *task);
 
 static inline void
 perf_trace_buf_submit(void *raw_data, int size, int rctx, u64 addr,
@@ -629,4 +640,14 @@ perf_trace_buf_submit(void *raw_data, int size, int rctx, u64 addr,
 }
 #endif
 
+#ifdef CONFIG_BPF_EVENTS
+unsigned int trace_call_bpf(struct ftrace_event_call *call, void *ctx);
+#else
+static inline unsigned int trace_call_bpf(struct ftrace_event_call *call,
+					  void *ctx)
+{
+	return 1;
+}
+#endif
+
 #endif /* _LINUX_FTRACE_EVENT_H */
@@ -305,6 +305,25 @@ struct page *
 __alloc_pages_nodemask(gfp_t gfp_mask, unsigned int order,
 		       struct zonelist *zonelist, nodemask_t *nodemask);
 
+unsigned long __alloc_pages_bulk(gfp_t gfp_mask, struct zonelist *zonelist,
+			nodemask_t *nodemask, int nr_pages,
+			struct list_head *page_list, struct page **page_array);
+
+/* Bulk allocate order-0 pages from the local node */
+static inline unsigned long
+alloc_pages_bulk_list(gfp_t gfp_mask, int nr_pages, struct list_head *list)
+{
+	return __alloc_pages_bulk(gfp_mask, node_zonelist(numa_node_id(),
+				  gfp_mask), NULL, nr_pages, list, NULL);
+}
+
+static inline unsigned long
+alloc_pages_bulk_array(gfp_t gfp_mask, int nr_pages, struct page **page_array)
+{
+	return __alloc_pages_bulk(gfp_mask, node_zonelist(numa_node_id(),
+				  gfp_mask), NULL, nr_pages, NULL, page_array);
+}
+
 static inline struct page *
 __alloc_pages(gfp_t gfp_mask, unsigned int order,
 		struct zonelist *zonelist)
@@ -379,6 +398,7 @@ extern void free_memcg_kmem_pages(unsigned long addr, unsigned int order);
 #define free_page(addr) free_pages((addr), 0)
 
 void page_alloc_init(void);
+void page_alloc_init_late(void);
 void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp);
 void drain_all_pages(void);
 void drain_local_pages(void *dummy);
@@ -33,6 +33,8 @@ extern int move_huge_pmd(struct vm_area_struct *vma,
 extern int change_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
 			unsigned long addr, pgprot_t newprot,
 			int prot_numa);
+extern int vmf_insert_pfn_pmd(struct vm_area_struct *vma, unsigned long addr,
+			pmd_t *pmd, unsigned long pfn, bool write);
 
 enum transparent_hugepage_flag {
 	TRANSPARENT_HUGEPAGE_FLAG,
@@ -142,12 +144,35 @@ static inline int pmd_trans_huge_lock(pmd_t *pmd, struct vm_area_struct *vma,
 	else
 		return 0;
 }
+/*
+ * A huge pmd in a vma with ->pmd_fault maps a team of small page cache
+ * pages which happen to be physically contiguous (see shmem_pmd_fault()).
+ * Each page keeps its own count and mapcount: splitting such a pmd only
+ * turns it back into ptes, the pages themselves are left alone.
+ */
+static inline bool vma_huge_team(struct vm_area_struct *vma)
+{
+	return vma->vm_ops && vma->vm_ops->pmd_fault &&
+		!(vma->vm_flags & VM_MIXEDMAP);
+}
+/*
+ * A huge pmd in a VM_MIXEDMAP vma with ->pmd_fault maps a run of
+ * persistent memory pfns directly (see dax_pmd_fault()).  Nothing is
+ * counted against the pfns: splitting gives special ptes, as
+ * vm_insert_mixed() makes them, and zapping just drops the entry.
+ */
+static inline bool vma_huge_dax(struct vm_area_struct *vma)
+{
+	return vma->vm_ops && vma->vm_ops->pmd_fault &&
+		(vma->vm_flags & VM_MIXEDMAP);
+}
 static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
 					 unsigned long start,
 					 unsigned long end,
 					 long adjust_next)
 {
-	if (!vma->anon_vma || vma->vm_ops)
+	if ((!vma->anon_vma || vma->vm_ops) && !vma_huge_team(vma) &&
+	    !vma_huge_dax(vma))
 		return;
 	__vma_adjust_trans_huge(vma, start, end, adjust_next);
 }
@@ -170,6 +195,14 @@ extern int do_huge_pmd_numa_page(struct mm_struct *mm, struct vm_area_struct *vm
 
 #define transparent_hugepage_enabled(__vma) 0
 
+static inline bool vma_huge_team(struct vm_area_struct *vma)
+{
+	return false;
+}
+static inline bool vma_huge_dax(struct vm_area_struct *vma)
+{
+	return false;
+}
 #define transparent_hugepage_flags 0UL
 static inline int
 split_huge_page_to_list(struct page *page, struct list_head *list)
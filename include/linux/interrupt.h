@@ -241,6 +241,10 @@ extern int irq_can_set_affinity(unsigned int irq);
 extern int irq_select_affinity(unsigned int irq);
 
 extern int irq_set_affinity_hint(unsigned int irq, const struct cpumask *m);
+extern int irq_set_affinity_managed(unsigned int irq,
+				    const struct cpumask *mask);
+
+extern struct cpumask *irq_create_affinity_masks(unsigned int nvec);
 
 /**
  * struct irq_affinity_notify - context for notification of IRQ affinity changes
@@ -289,6 +293,17 @@ static inline int irq_set_affinity_hint(unsigned int irq,
 {
 	return -EINVAL;
 }
+
+static inline int irq_set_affinity_managed(unsigned int irq,
+					   const struct cpumask *mask)
+{
+	return 0;
+}
+
+static inline struct cpumask *irq_create_affinity_masks(unsigned int nvec)
+{
+	return NULL;
+}
 #endif /* CONFIG_SMP */
 
 /*
@@ -69,6 +69,7 @@ extern void *jbd2_alloc(size_t size, gfp_t flags);
 extern void jbd2_free(void *ptr, size_t size);
 
 #define JBD2_MIN_JOURNAL_BLOCKS 1024
+#define JBD2_DEFAULT_FAST_COMMIT_BLOCKS 256
 
 #ifdef __KERNEL__
 
@@ -260,7 +261,9 @@ typedef struct journal_superblock_s
 /* 0x0050 */
 	__u8	s_checksum_type;	/* checksum type */
 	__u8	s_padding2[3];
-	__u32	s_padding[42];
+/* 0x0054 */
+	__be32	s_num_fc_blks;		/* Number of fast commit blocks */
+	__u32	s_padding[41];
 	__be32	s_checksum;		/* crc32c(superblock) */
 
 /* 0x0100 */
@@ -284,6 +287,7 @@ typedef struct journal_superblock_s
 #define JBD2_FEATURE_INCOMPAT_64BIT		0x00000002
 #define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
 #define JBD2_FEATURE_INCOMPAT_CSUM_V2		0x00000008
+#define JBD2_FEATURE_INCOMPAT_FAST_COMMIT	0x00000020
 
 /* Features known to this kernel version: */
 #define JBD2_KNOWN_COMPAT_FEATURES	JBD2_FEATURE_COMPAT_CHECKSUM
@@ -291,7 +295,8 @@ typedef struct journal_superblock_s
 #define JBD2_KNOWN_INCOMPAT_FEATURES	(JBD2_FEATURE_INCOMPAT_REVOKE | \
 					JBD2_FEATURE_INCOMPAT_64BIT | \
 					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT | \
-					JBD2_FEATURE_INCOMPAT_CSUM_V2)
+					JBD2_FEATURE_INCOMPAT_CSUM_V2 | \
+					JBD2_FEATURE_INCOMPAT_FAST_COMMIT)
 
 #ifdef __KERNEL__
 
@@ -387,6 +392,13 @@ struct jbd2_inode {
 
 struct jbd2_revoke_table_s;
 
+/* The passes of journal recovery */
+enum passtype {PASS_SCAN, PASS_REVOKE, PASS_REPLAY};
+
+/* Return values of j_fc_replay_callback */
+#define JBD2_FC_REPLAY_STOP	0
+#define JBD2_FC_REPLAY_CONTINUE	1
+
 /**
  * struct handle_s - The handle_s type is the concrete type associated with
  *     handle_t.
@@ -568,7 +580,9 @@ struct transaction_s
 	struct list_head	t_inode_list;
 
 	/*
-	 * Protects info related to handles
+	 * Protects t_max_wait when debugging.  Handles are started, extended
+	 * and stopped by atomic operations on t_updates and
+	 * t_outstanding_credits alone, under j_state_lock held for read.
 	 */
 	spinlock_t		t_handle_lock;
 
@@ -594,13 +608,13 @@ struct transaction_s
 
 	/*
 	 * Number of outstanding updates running on this transaction
-	 * [t_handle_lock]
+	 * [none]
 	 */
 	atomic_t		t_updates;
 
 	/*
 	 * Number of buffers reserved for use by all handles in this transaction
-	 * handle but not yet modified. [t_handle_lock]
+	 * handle but not yet modified. [none]
 	 */
 	atomic_t		t_outstanding_credits;
 
@@ -622,7 +636,7 @@ struct transaction_s
 	ktime_t			t_start_time;
 
 	/*
-	 * How many handles used this transaction? [t_handle_lock]
+	 * How many handles used this transaction? [none]
 	 */
 	atomic_t		t_handle_count;
 
@@ -740,6 +754,15 @@ jbd2_time_diff(unsigned long start, unsigned long end)
  * @j_proc_entry: procfs entry for the jbd statistics directory
  * @j_stats: Overall statistics
  * @j_private: An opaque pointer to fs-private information.
+ * @j_fc_first: The block number of the first fast commit block
+ * @j_fc_last: The block number one beyond the last fast commit block
+ * @j_fc_off: Number of fast commit blocks handed out since the last full
+ *	commit
+ * @j_fc_wbuf: array of buffer_heads for the fast commit blocks in use
+ * @j_fc_wait: Wait queue for a fast commit or a full commit to finish
+ * @j_fc_replay_callback: Called by recovery for each fast commit block
+ * @j_fc_cleanup_callback: Called after each full commit, so the fs can drop
+ *	the fast commit state the full commit made redundant
  */
 
 struct journal_s
@@ -982,6 +1005,38 @@ struct journal_s
 
 	/* Precomputed journal UUID checksum for seeding other checksums */
 	__u32 j_csum_seed;
+
+	/*
+	 * Fast commit area: the last s_num_fc_blks blocks of the journal,
+	 * which the log proper [j_first, j_last) stops short of.
+	 */
+	unsigned long		j_fc_first;
+	unsigned long		j_fc_last;
+
+	/* Next free block of the fast commit area, relative to j_fc_first */
+	unsigned long		j_fc_off;
+
+	/* Buffers for the fast commit blocks written since the last commit */
+	struct buffer_head	**j_fc_wbuf;
+
+	/* Wait for JBD2_FAST_COMMIT_ONGOING or JBD2_FULL_COMMIT_ONGOING */
+	wait_queue_head_t	j_fc_wait;
+
+	/*
+	 * Called for each block of the fast commit area, in order, during
+	 * the PASS_SCAN and then the PASS_REPLAY pass of recovery.  It
+	 * returns JBD2_FC_REPLAY_CONTINUE for more blocks, JBD2_FC_REPLAY_STOP
+	 * at the end of the valid fast commits, or a negative error.
+	 */
+	int			(*j_fc_replay_callback)(journal_t *journal,
+							struct buffer_head *bh,
+							enum passtype pass,
+							int off,
+							tid_t expected_tid);
+
+	/* Called after each full commit, with the tid just committed */
+	void			(*j_fc_cleanup_callback)(journal_t *journal,
+							 tid_t tid);
 };
 
 /*
@@ -996,6 +1051,8 @@ struct journal_s
 #define JBD2_ABORT_ON_SYNCDATA_ERR	0x040	/* Abort the journal on file
 						 * data write error in ordered
 						 * mode */
+#define JBD2_FAST_COMMIT_ONGOING	0x080	/* Fast commit in progress */
+#define JBD2_FULL_COMMIT_ONGOING	0x100	/* Full commit in progress */
 
 /*
  * Function declarations for the journaling transaction and buffer
@@ -1124,6 +1181,7 @@ extern int	 jbd2_journal_invalidatepage(journal_t *,
 extern int	 jbd2_journal_try_to_free_buffers(journal_t *, struct page *, gfp_t);
 extern int	 jbd2_journal_stop(handle_t *);
 extern int	 jbd2_journal_flush (journal_t *);
+extern void	 jbd2_journal_wait_updates(journal_t *);
 extern void	 jbd2_journal_lock_updates (journal_t *);
 extern void	 jbd2_journal_unlock_updates (journal_t *);
 
@@ -1236,6 +1294,15 @@ int jbd2_complete_transaction(journal_t *journal, tid_t tid);
 int jbd2_log_do_checkpoint(journal_t *journal);
 int jbd2_trans_will_send_data_barrier(journal_t *journal, tid_t tid);
 
+/* Fast commits */
+int jbd2_fc_begin_commit(journal_t *journal, tid_t tid);
+int jbd2_fc_end_commit(journal_t *journal);
+int jbd2_fc_end_commit_fallback(journal_t *journal, tid_t tid);
+int jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bh_out);
+int jbd2_fc_wait_bufs(journal_t *journal, int num_blks);
+void jbd2_fc_start_full_commit(journal_t *journal);
+void jbd2_fc_end_full_commit(journal_t *journal, tid_t tid);
+
 void __jbd2_log_wait_for_space(journal_t *journal);
 extern void __jbd2_journal_drop_transaction(journal_t *, transaction_t *);
 extern int jbd2_cleanup_journal_tail(journal_t *);
@@ -0,0 +1,88 @@
+#ifndef KVM_DIRTY_RING_H
+#define KVM_DIRTY_RING_H
+
+#include <linux/kvm.h>
+
+struct kvm;
+struct page;
+
+/*
+ * Per-vcpu ring of dirty gfns, shared with userspace.
+ *
+ * The vcpu pushes entries at dirty_index, userspace collects them and
+ * flags them for reset, and KVM_RESET_DIRTY_RINGS retires them from
+ * reset_index on, rearming dirty logging for their pages.  Both indexes
+ * only grow and are masked with size - 1 to address the ring.
+ *
+ * @dirty_index: free running counter of entries pushed
+ * @reset_index: free running counter of entries reset
+ * @size: number of entries, a power of two
+ * @soft_limit: used entries at which the vcpu exits to userspace with
+ *	KVM_EXIT_DIRTY_RING_FULL, leaving room for what the vcpu may still
+ *	push before it gets there
+ * @dirty_gfns: the ring itself, mapped by userspace
+ */
+struct kvm_dirty_ring {
+	u32 dirty_index;
+	u32 reset_index;
+	u32 size;
+	u32 soft_limit;
+	struct kvm_dirty_gfn *dirty_gfns;
+};
+
+/* Largest ring userspace may ask for, in entries */
+#define KVM_DIRTY_RING_MAX_ENTRIES	65536
+
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+
+int kvm_dirty_ring_alloc(struct kvm_dirty_ring *ring, u32 size);
+void kvm_dirty_ring_free(struct kvm_dirty_ring *ring);
+u32 kvm_dirty_ring_get_rsvd_entries(void);
+bool kvm_dirty_ring_push(struct kvm_dirty_ring *ring, u32 slot, u64 offset);
+int kvm_dirty_ring_reset(struct kvm *kvm, struct kvm_dirty_ring *ring);
+struct page *kvm_dirty_ring_get_page(struct kvm_dirty_ring *ring,
+				     u32 offset);
+
+static inline bool kvm_dirty_ring_soft_full(struct kvm_dirty_ring *ring)
+{
+	return ring->size && ring->dirty_index -
+	       ACCESS_ONCE(ring->reset_index) >= ring->soft_limit;
+}
+
+#else /* CONFIG_HAVE_KVM_DIRTY_RING */
+
+static inline int kvm_dirty_ring_alloc(struct kvm_dirty_ring *ring, u32 size)
+{
+	return 0;
+}
+
+static inline void kvm_dirty_ring_free(struct kvm_dirty_ring *ring)
+{
+}
+
+static inline bool kvm_dirty_ring_push(struct kvm_dirty_ring *ring,
+				       u32 slot, u64 offset)
+{
+	return false;
+}
+
+static inline int kvm_dirty_ring_reset(struct kvm *kvm,
+				       struct kvm_dirty_ring *ring)
+{
+	return 0;
+}
+
+static inline struct page *kvm_dirty_ring_get_page(struct kvm_dirty_ring *ring,
+						   u32 offset)
+{
+	return NULL;
+}
+
+static inline bool kvm_dirty_ring_soft_full(struct kvm_dirty_ring *ring)
+{
+	return false;
+}
+
+#endif /* CONFIG_HAVE_KVM_DIRTY_RING */
+
+#endif /* KVM_DIRTY_RING_H */
@@ -30,6 +30,7 @@
 #include <linux/kvm_para.h>
 
 #include <linux/kvm_types.h>
+#include <linux/kvm_dirty_ring.h>
 
 #include <asm/kvm_host.h>
 
@@ -236,6 +237,7 @@ struct kvm_vcpu {
 	int sigset_active;
 	sigset_t sigset;
 	struct kvm_vcpu_stat stat;
+	unsigned int halt_poll_ns;	/* see kvm_vcpu_block() */
 
 #ifdef CONFIG_HAS_IOMEM
 	int mmio_needed;
@@ -268,6 +270,7 @@ struct kvm_vcpu {
 	} spin_loop;
 #endif
 	bool preempted;
+	struct kvm_dirty_ring dirty_ring;
 	struct kvm_vcpu_arch arch;
 };
 
@@ -414,6 +417,7 @@ struct kvm {
 	bool tlbs_dirty;
 
 	struct list_head devices;
+	u32 dirty_ring_size;	/* bytes per vcpu, 0 if rings are not used */
 };
 
 #define kvm_err(fmt, ...) \
@@ -581,6 +585,7 @@ struct kvm_memory_slot *gfn_to_memslot(struct kvm *kvm, gfn_t gfn);
 int kvm_is_visible_gfn(struct kvm *kvm, gfn_t gfn);
 unsigned long kvm_host_page_size(struct kvm *kvm, gfn_t gfn);
 void mark_page_dirty(struct kvm *kvm, gfn_t gfn);
+struct kvm_vcpu *kvm_get_running_vcpu(void);
 
 void kvm_vcpu_block(struct kvm_vcpu *vcpu);
 void kvm_vcpu_kick(struct kvm_vcpu *vcpu);
@@ -606,6 +611,11 @@ int kvm_get_dirty_log(struct kvm *kvm,
 			struct kvm_dirty_log *log, int *is_dirty);
 int kvm_vm_ioctl_get_dirty_log(struct kvm *kvm,
 				struct kvm_dirty_log *log);
+void kvm_arch_mmu_enable_log_dirty_pt_masked(struct kvm *kvm,
+					     struct kvm_memory_slot *slot,
+					     gfn_t gfn_offset,
+					     unsigned long mask);
+int kvm_cpu_dirty_log_size(void);
 
 int kvm_vm_ioctl_irq_line(struct kvm *kvm, struct kvm_irq_level *irq_level,
 			bool line_status);
@@ -755,6 +765,8 @@ int kvm_set_irq(struct kvm *kvm, int irq_source_id, u32 irq, int level,
 int kvm_set_irq_inatomic(struct kvm *kvm, int irq_source_id, u32 irq, int level);
 int kvm_set_msi(struct kvm_kernel_irq_routing_entry *irq_entry, struct kvm *kvm,
 		int irq_source_id, int level, bool line_status);
+void kvm_set_msi_irq(struct kvm_kernel_irq_routing_entry *e,
+		     struct kvm_lapic_irq *irq);
 bool kvm_irq_has_notifier(struct kvm *kvm, unsigned irqchip, unsigned pin);
 void kvm_notify_acked_irq(struct kvm *kvm, unsigned irqchip, unsigned pin);
 void kvm_register_irq_ack_notifier(struct kvm *kvm,
@@ -1010,6 +1022,9 @@ long kvm_vm_ioctl_assigned_device(struct kvm *kvm, unsigned ioctl,
 				  unsigned long arg);
 
 void kvm_free_all_assigned_devices(struct kvm *kvm);
+void kvm_assigned_dev_update_posting(struct kvm *kvm);
+int kvm_arch_update_pi_irte(struct kvm *kvm, unsigned int host_irq,
+			    u32 guest_irq, bool set);
 
 #else
 
@@ -1020,6 +1035,7 @@ static inline long kvm_vm_ioctl_assigned_device(struct kvm *kvm, unsigned ioctl,
 }
 
 static inline void kvm_free_all_assigned_devices(struct kvm *kvm) {}
+static inline void kvm_assigned_dev_update_posting(struct kvm *kvm) {}
 
 #endif
 
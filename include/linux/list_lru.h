@@ -9,6 +9,9 @@
 
 #include <linux/list.h>
 #include <linux/nodemask.h>
+#include <linux/shrinker.h>
+
+struct mem_cgroup;
 
 /* list_lru_walk_cb has to always return one of those */
 enum lru_status {
@@ -21,23 +24,66 @@ enum lru_status {
 				   internally, but has to return locked. */
 };
 
-struct list_lru_node {
-	spinlock_t		lock;
+struct list_lru_one {
 	struct list_head	list;
 	/* kept as signed so we can catch imbalance bugs */
 	long			nr_items;
+};
+
+struct list_lru_memcg {
+	int			nr;
+	/* per cgroup lists, indexed by memcg_cache_id() */
+	struct list_lru_one	*lru[0];
+};
+
+struct list_lru_node {
+	/* protects all the lists of the node, the per cgroup ones too */
+	spinlock_t		lock;
+	/* the only list of a cgroup unaware lru, the root's of an aware one */
+	struct list_lru_one	lru;
+#ifdef CONFIG_MEMCG_KMEM
+	/* per cgroup lists of a cgroup aware lru, NULL otherwise */
+	struct list_lru_memcg	*memcg_lrus;
+#endif
+	/* items on all the lists of the node */
+	long			nr_items;
 } ____cacheline_aligned_in_smp;
 
 struct list_lru {
 	struct list_lru_node	*node;
 	nodemask_t		active_nodes;
+#ifdef CONFIG_MEMCG_KMEM
+	struct list_head	list;
+#endif
 };
 
+#ifdef CONFIG_MEMCG_KMEM
+int memcg_update_all_list_lrus(int num_groups);
+#endif
+
 void list_lru_destroy(struct list_lru *lru);
-int list_lru_init_key(struct list_lru *lru, struct lock_class_key *key);
+int __list_lru_init(struct list_lru *lru, bool memcg_aware,
+		    struct lock_class_key *key);
+
+static inline int list_lru_init_key(struct list_lru *lru,
+				    struct lock_class_key *key)
+{
+	return __list_lru_init(lru, false, key);
+}
+
 static inline int list_lru_init(struct list_lru *lru)
 {
-	return list_lru_init_key(lru, NULL);
+	return __list_lru_init(lru, false, NULL);
+}
+
+/*
+ * A cgroup aware lru keeps the objects charged to each kmem accounted
+ * cgroup on a list of their own, for them to be shrunk by the cgroup's
+ * reclaim alone. All the objects must be slab objects.
+ */
+static inline int list_lru_init_memcg(struct list_lru *lru)
+{
+	return __list_lru_init(lru, true, NULL);
 }
 
 /**
@@ -72,15 +118,38 @@ bool list_lru_add(struct list_lru *lru, struct list_head *item);
 bool list_lru_del(struct list_lru *lru, struct list_head *item);
 
 /**
- * list_lru_count_node: return the number of objects currently held by @lru
+ * list_lru_count_one: return the number of objects of a cgroup held by @lru
  * @lru: the lru pointer.
  * @nid: the node id to count from.
+ * @memcg: the cgroup to count from, NULL for the root.
  *
  * Always return a non-negative number, 0 for empty lists. There is no
  * guarantee that the list is not updated while the count is being computed.
  * Callers that want such a guarantee need to provide an outer lock.
  */
+unsigned long list_lru_count_one(struct list_lru *lru,
+				 int nid, struct mem_cgroup *memcg);
+
+/**
+ * list_lru_count_node: return the number of objects currently held by @lru
+ * @lru: the lru pointer.
+ * @nid: the node id to count from.
+ *
+ * Counts the objects of all cgroups. Same guarantees as list_lru_count_one.
+ */
 unsigned long list_lru_count_node(struct list_lru *lru, int nid);
+
+/*
+ * For a shrinker: the node of @sc, and its cgroup if it is reclaiming one,
+ * or all of them for global reclaim.
+ */
+static inline unsigned long list_lru_shrink_count(struct list_lru *lru,
+						  struct shrink_control *sc)
+{
+	if (sc->memcg)
+		return list_lru_count_one(lru, sc->nid, sc->memcg);
+	return list_lru_count_node(lru, sc->nid);
+}
 static inline unsigned long list_lru_count(struct list_lru *lru)
 {
 	long count = 0;
@@ -95,9 +164,10 @@ static inline unsigned long list_lru_count(struct list_lru *lru)
 typedef enum lru_status
 (*list_lru_walk_cb)(struct list_head *item, spinlock_t *lock, void *cb_arg);
 /**
- * list_lru_walk_node: walk a list_lru, isolating and disposing freeable items.
+ * list_lru_walk_one: walk a list_lru, isolating and disposing freeable items.
  * @lru: the lru pointer.
  * @nid: the node id to scan from.
+ * @memcg: the cgroup to scan from, NULL for the root.
  * @isolate: callback function that is resposible for deciding what to do with
  *  the item currently being scanned
  * @cb_arg: opaque type that will be passed to @isolate
@@ -115,10 +185,32 @@ typedef enum lru_status
  *
  * Return value: the number of objects effectively removed from the LRU.
  */
+unsigned long list_lru_walk_one(struct list_lru *lru,
+				int nid, struct mem_cgroup *memcg,
+				list_lru_walk_cb isolate, void *cb_arg,
+				unsigned long *nr_to_walk);
+
+/**
+ * list_lru_walk_node: walk all the lists of a node, as for list_lru_walk_one.
+ *
+ * The walk is shared out among the cgroups' lists by their length, so that
+ * none is left alone while others are long.
+ */
 unsigned long list_lru_walk_node(struct list_lru *lru, int nid,
 				 list_lru_walk_cb isolate, void *cb_arg,
 				 unsigned long *nr_to_walk);
 
+static inline unsigned long
+list_lru_shrink_walk(struct list_lru *lru, struct shrink_control *sc,
+		     list_lru_walk_cb isolate, void *cb_arg)
+{
+	if (sc->memcg)
+		return list_lru_walk_one(lru, sc->nid, sc->memcg, isolate,
+					 cb_arg, &sc->nr_to_scan);
+	return list_lru_walk_node(lru, sc->nid, isolate, cb_arg,
+				  &sc->nr_to_scan);
+}
+
 static inline unsigned long
 list_lru_walk(struct list_lru *lru, list_lru_walk_cb isolate,
 	      void *cb_arg, unsigned long nr_to_walk)
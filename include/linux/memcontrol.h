@@ -30,6 +30,9 @@ struct page;
 struct mm_struct;
 struct kmem_cache;
 
+/* Bits of a memcg id, as stored in shadow entries (see mm/workingset.c) */
+#define MEM_CGROUP_ID_SHIFT	16
+
 /*
  * The corresponding mem_cgroup_stat_names is defined in mm/memcontrol.c,
  * These two lists should keep in accord with each other.
@@ -130,6 +133,9 @@ void mem_cgroup_iter_break(struct mem_cgroup *, struct mem_cgroup *);
 int mem_cgroup_inactive_anon_is_low(struct lruvec *lruvec);
 int mem_cgroup_select_victim_node(struct mem_cgroup *memcg);
 unsigned long mem_cgroup_get_lru_size(struct lruvec *lruvec, enum lru_list);
+unsigned short mem_cgroup_lruvec_id(struct lruvec *lruvec);
+struct lruvec *mem_cgroup_id_lruvec(unsigned short id, struct zone *zone);
+void mem_cgroup_count_refault(struct lruvec *lruvec, int file, bool activate);
 void mem_cgroup_update_lru_size(struct lruvec *, enum lru_list, int);
 extern void mem_cgroup_print_oom_info(struct mem_cgroup *memcg,
 					struct task_struct *p);
@@ -230,6 +236,9 @@ void mem_cgroup_split_huge_fixup(struct page *head);
 bool mem_cgroup_bad_page_check(struct page *page);
 void mem_cgroup_print_bad_page(struct page *page);
 #endif
+#ifdef CONFIG_CGROUP_WRITEBACK
+unsigned long mem_cgroup_dirtyable_pages(struct cgroup_subsys_state *css);
+#endif
 #else /* CONFIG_MEMCG */
 struct mem_cgroup;
 
@@ -352,6 +361,22 @@ mem_cgroup_get_lru_size(struct lruvec *lruvec, enum lru_list lru)
 	return 0;
 }
 
+static inline unsigned short mem_cgroup_lruvec_id(struct lruvec *lruvec)
+{
+	return 0;
+}
+
+static inline struct lruvec *mem_cgroup_id_lruvec(unsigned short id,
+						  struct zone *zone)
+{
+	return &zone->lruvec;
+}
+
+static inline void mem_cgroup_count_refault(struct lruvec *lruvec, int file,
+					    bool activate)
+{
+}
+
 static inline void
 mem_cgroup_update_lru_size(struct lruvec *lruvec, enum lru_list lru,
 			      int increment)
@@ -491,6 +516,8 @@ void __memcg_kmem_commit_charge(struct page *page,
 void __memcg_kmem_uncharge_pages(struct page *page, int order);
 
 int memcg_cache_id(struct mem_cgroup *memcg);
+bool memcg_kmem_is_active(struct mem_cgroup *memcg);
+struct mem_cgroup *mem_cgroup_from_kmem(void *ptr);
 
 char *memcg_create_cache_name(struct mem_cgroup *memcg,
 			      struct kmem_cache *root_cache);
@@ -531,7 +558,7 @@ memcg_kmem_newpage_charge(gfp_t gfp, struct mem_cgroup **memcg, int order)
 	 * __GFP_NOFAIL allocations will move on even if charging is not
 	 * possible. Therefore we don't even try, and have this allocation
 	 * unaccounted. We could in theory charge it with
-	 * res_counter_charge_nofail, but we hope those allocations are rare,
+	 * page_counter_charge(), but we hope those allocations are rare,
 	 * and won't be worth the trouble.
 	 */
 	if (!(gfp & __GFP_KMEMCG) || (gfp & __GFP_NOFAIL))
@@ -638,6 +665,16 @@ static inline int memcg_cache_id(struct mem_cgroup *memcg)
 	return -1;
 }
 
+static inline bool memcg_kmem_is_active(struct mem_cgroup *memcg)
+{
+	return false;
+}
+
+static inline struct mem_cgroup *mem_cgroup_from_kmem(void *ptr)
+{
+	return NULL;
+}
+
 static inline int memcg_alloc_cache_params(struct mem_cgroup *memcg,
 		struct kmem_cache *s, struct kmem_cache *root_cache)
 {
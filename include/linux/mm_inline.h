@@ -22,12 +22,91 @@ static inline int page_is_file_cache(struct page *page)
 	return !PageSwapBacked(page);
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Once the multi-generational LRU is enabled on a lruvec, its evictable
+ * pages are on its generations, and all accounted as inactive: PG_active
+ * only says a page was activated, and so put on the youngest generation,
+ * since it was last seen in the oldest. Checked under the lru_lock, which
+ * is also held to switch a lruvec between the two.
+ */
+static inline bool lru_gen_lruvec(struct lruvec *lruvec, enum lru_list lru)
+{
+	return lruvec->lrugen.enabled && lru != LRU_UNEVICTABLE;
+}
+
+static inline int lru_gen_from_seq(unsigned long seq)
+{
+	return seq % MAX_NR_GENS;
+}
+
+static inline enum lru_list lru_gen_account_lru(enum lru_list lru)
+{
+	return is_file_lru(lru) ? LRU_INACTIVE_FILE : LRU_INACTIVE_ANON;
+}
+
+/*
+ * Activated pages start in the youngest generation, others one above the
+ * oldest, so as to be given a round of aging.
+ */
+static inline void lru_gen_add_page(struct page *page, struct lruvec *lruvec,
+				    enum lru_list lru)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	int file = is_file_lru(lru);
+	unsigned long seq;
+
+	if (is_active_lru(lru))
+		seq = lrugen->max_seq;
+	else
+		seq = lrugen->min_seq[file] + 1;
+	list_add(&page->lru, &lrugen->lists[lru_gen_from_seq(seq)][file]);
+}
+
+/* To be evicted first */
+static inline void lru_gen_move_page_tail(struct page *page,
+					  struct lruvec *lruvec,
+					  enum lru_list lru)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	int file = is_file_lru(lru);
+	int gen = lru_gen_from_seq(lrugen->min_seq[file]);
+
+	list_move_tail(&page->lru, &lrugen->lists[gen][file]);
+}
+#else
+static inline bool lru_gen_lruvec(struct lruvec *lruvec, enum lru_list lru)
+{
+	return false;
+}
+
+static inline enum lru_list lru_gen_account_lru(enum lru_list lru)
+{
+	return lru;
+}
+
+static inline void lru_gen_add_page(struct page *page, struct lruvec *lruvec,
+				    enum lru_list lru)
+{
+}
+
+static inline void lru_gen_move_page_tail(struct page *page,
+					  struct lruvec *lruvec,
+					  enum lru_list lru)
+{
+}
+#endif
+
 static __always_inline void add_page_to_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
 	int nr_pages = hpage_nr_pages(page);
+	if (lru_gen_lruvec(lruvec, lru)) {
+		lru_gen_add_page(page, lruvec, lru);
+		lru = lru_gen_account_lru(lru);
+	} else
+		list_add(&page->lru, &lruvec->lists[lru]);
 	mem_cgroup_update_lru_size(lruvec, lru, nr_pages);
-	list_add(&page->lru, &lruvec->lists[lru]);
 	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, nr_pages);
 }
 
@@ -35,11 +114,23 @@ static __always_inline void del_page_from_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
 	int nr_pages = hpage_nr_pages(page);
+	if (lru_gen_lruvec(lruvec, lru))
+		lru = lru_gen_account_lru(lru);
 	mem_cgroup_update_lru_size(lruvec, lru, -nr_pages);
 	list_del(&page->lru);
 	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, -nr_pages);
 }
 
+/* Move a page on @lru, which it is on, to where it is reclaimed next */
+static __always_inline void move_page_to_lru_tail(struct page *page,
+				struct lruvec *lruvec, enum lru_list lru)
+{
+	if (lru_gen_lruvec(lruvec, lru))
+		lru_gen_move_page_tail(page, lruvec, lru);
+	else
+		list_move_tail(&page->lru, &lruvec->lists[lru]);
+}
+
 /**
  * page_lru_base_type - which LRU list type should a page be on?
  * @page: the page to test
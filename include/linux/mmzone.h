@@ -207,9 +207,42 @@ struct zone_reclaim_stat {
 	unsigned long		recent_scanned[2];
 };
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * The multi-generational LRU keeps the evictable pages of a lruvec on a
+ * sliding window of generations, from min_seq, the oldest, to max_seq, the
+ * youngest, each with a list per type (anon and file). A generation's
+ * lists are indexed by its sequence number modulo MAX_NR_GENS.
+ *
+ * Aging opens a new youngest generation, after walking page tables to move
+ * the accessed bits of ptes to PG_referenced. Eviction takes pages from the
+ * tail of the oldest generation; those found referenced go to the youngest
+ * instead. There are always at least MIN_NR_GENS generations of each type:
+ * when the oldest has been emptied down to that, it is time to age.
+ */
+#define MIN_NR_GENS	2
+#define MAX_NR_GENS	4
+
+struct lru_gen {
+	/* Whether the evictable pages are here rather than on lists[] */
+	bool enabled;
+	unsigned long max_seq;
+	/* The oldest generation, anon in [0] and file in [1] */
+	unsigned long min_seq[2];
+	struct list_head lists[MAX_NR_GENS][2];
+};
+
+extern bool lru_gen_enabled;
+#endif
+
 struct lruvec {
 	struct list_head lists[NR_LRU_LISTS];
 	struct zone_reclaim_stat reclaim_stat;
+	/* Evictions & activations on the inactive lists */
+	atomic_long_t inactive_age;
+#ifdef CONFIG_LRU_GEN
+	struct lru_gen lrugen;
+#endif
 #ifdef CONFIG_MEMCG
 	struct zone *zone;
 #endif
@@ -399,9 +432,6 @@ struct zone {
 	spinlock_t		lru_lock;
 	struct lruvec		lruvec;
 
-	/* Evictions & activations on the inactive file list */
-	atomic_long_t		inactive_age;
-
 	unsigned long		pages_scanned;	   /* since last reclaim */
 	unsigned long		flags;		   /* zone flags, see below */
 
@@ -773,6 +803,12 @@ typedef struct pglist_data {
 	struct task_struct *kswapd;	/* Protected by lock_memory_hotplug() */
 	int kswapd_max_order;
 	enum zone_type classzone_idx;
+#ifdef CONFIG_COMPACTION
+	int kcompactd_max_order;
+	enum zone_type kcompactd_classzone_idx;
+	wait_queue_head_t kcompactd_wait;
+	struct task_struct *kcompactd;	/* Protected by lock_memory_hotplug() */
+#endif
 #ifdef CONFIG_NUMA_BALANCING
 	/* Lock serializing the migrate rate limiting window */
 	spinlock_t numabalancing_migrate_lock;
@@ -783,6 +819,13 @@ typedef struct pglist_data {
 	/* Number of pages migrated during the rate limiting time interval */
 	unsigned long numabalancing_migrate_nr_pages;
 #endif
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+	/*
+	 * First pfn of the node whose struct page is still to be initialised,
+	 * ULONG_MAX once all are.  Protected by pgdat_resize_lock().
+	 */
+	unsigned long first_deferred_pfn;
+#endif
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
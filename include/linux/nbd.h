@@ -17,25 +17,39 @@
 
 #include <linux/wait.h>
 #include <linux/mutex.h>
+#include <linux/blk-mq.h>
 #include <uapi/linux/nbd.h>
 
 struct request;
+struct nbd_device;
 
-struct nbd_device {
-	int flags;
-	int harderror;		/* Code of hard error			*/
-	struct socket * sock;	/* If == NULL, device is not ready, yet	*/
-	int magic;
+/* one connection to the server */
+struct nbd_sock {
+	struct nbd_device *nbd;
+	struct socket * sock;	/* If == NULL, connection is not ready	*/
 
 	spinlock_t queue_lock;
 	struct list_head queue_head;	/* Requests waiting result */
 	struct request *active_req;
 	wait_queue_head_t active_wq;
-	struct list_head waiting_queue;	/* Requests to be sent */
-	wait_queue_head_t waiting_wq;
 
 	struct mutex tx_lock;
+};
+
+struct nbd_device {
+	int flags;
+	int harderror;		/* Code of hard error			*/
+	struct nbd_sock *socks;
+	int num_connections;
+	int magic;
+
+	atomic_t recv_threads;
+	wait_queue_head_t recv_wq;
+	struct workqueue_struct *send_wq;
+
+	struct mutex config_lock;
 	struct gendisk *disk;
+	struct blk_mq_tag_set tag_set;
 	int blksize;
 	u64 bytesize;
 	pid_t pid; /* pid of nbd-client, if attached */
@@ -181,6 +181,9 @@ struct proto_ops {
 				      int offset, size_t size, int flags);
 	ssize_t 	(*splice_read)(struct socket *sock,  loff_t *ppos,
 				       struct pipe_inode_info *pipe, size_t len, unsigned int flags);
+	ssize_t		(*splice_to_sock)(struct socket *sock,
+					  struct socket *out, size_t len,
+					  unsigned int flags);
 	int		(*set_peek_off)(struct sock *sk, int val);
 };
 
@@ -219,6 +222,8 @@ int sock_recvmsg(struct socket *sock, struct msghdr *msg, size_t size,
 struct file *sock_alloc_file(struct socket *sock, int flags, const char *dname);
 struct socket *sockfd_lookup(int fd, int *err);
 struct socket *sock_from_file(struct file *file, int *err);
+long sock_splice_to_sock(struct file *in, struct file *out, size_t len,
+			 unsigned int flags);
 #define		     sockfd_put(sock) fput(sock->file)
 int net_ratelimit(void);
 
@@ -191,6 +191,8 @@ extern struct static_key rps_needed;
 struct neighbour;
 struct neigh_parms;
 struct sk_buff;
+struct sk_filter;
+struct sock_filter;
 
 struct netdev_hw_addr {
 	struct list_head	list;
@@ -316,6 +318,9 @@ struct napi_struct {
 	struct net_device	*dev;
 	struct sk_buff		*gro_list;
 	struct sk_buff		*skb;
+	/* GRO_NORMAL skbs batched for netif_receive_skb_list() */
+	struct sk_buff_head	rx_list;
+	int			rx_count;
 	struct list_head	dev_list;
 	struct hlist_node	napi_hash_node;
 	unsigned int		napi_id;
@@ -1181,6 +1186,7 @@ struct net_device_ops {
  * @IFF_LIVE_ADDR_CHANGE: device supports hardware address
  *	change when it's running
  * @IFF_MACVLAN: Macvlan device
+ * @IFF_RX_FILTER: driver runs dev->rx_filter on its Rx buffers
  */
 enum netdev_priv_flags {
 	IFF_802_1Q_VLAN			= 1<<0,
@@ -1205,6 +1211,7 @@ enum netdev_priv_flags {
 	IFF_SUPP_NOFCS			= 1<<19,
 	IFF_LIVE_ADDR_CHANGE		= 1<<20,
 	IFF_MACVLAN			= 1<<21,
+	IFF_RX_FILTER			= 1<<22,
 };
 
 #define IFF_802_1Q_VLAN			IFF_802_1Q_VLAN
@@ -1229,6 +1236,7 @@ enum netdev_priv_flags {
 #define IFF_SUPP_NOFCS			IFF_SUPP_NOFCS
 #define IFF_LIVE_ADDR_CHANGE		IFF_LIVE_ADDR_CHANGE
 #define IFF_MACVLAN			IFF_MACVLAN
+#define IFF_RX_FILTER			IFF_RX_FILTER
 
 /*
  *	The DEVICE structure.
@@ -1428,6 +1436,7 @@ struct net_device {
 
 	rx_handler_func_t __rcu	*rx_handler;
 	void __rcu		*rx_handler_data;
+	struct sk_filter __rcu	*rx_filter;	/* see netdev_rx_filter_run() */
 
 	struct netdev_queue __rcu *ingress_queue;
 	unsigned char		broadcast[MAX_ADDR_LEN];	/* hw bcast add	*/
@@ -1779,6 +1788,10 @@ struct packet_type {
 					 struct net_device *,
 					 struct packet_type *,
 					 struct net_device *);
+	/* optional, receives a whole batch of skbs for this type */
+	void			(*list_func) (struct sk_buff_head *,
+					      struct packet_type *,
+					      struct net_device *);
 	bool			(*id_match)(struct packet_type *ptype,
 					    struct sock *sk);
 	void			*af_packet_priv;
@@ -2597,6 +2610,7 @@ static inline void dev_consume_skb_any(struct sk_buff *skb)
 int netif_rx(struct sk_buff *skb);
 int netif_rx_ni(struct sk_buff *skb);
 int netif_receive_skb(struct sk_buff *skb);
+void netif_receive_skb_list(struct sk_buff_head *head);
 gro_result_t napi_gro_receive(struct napi_struct *napi, struct sk_buff *skb);
 void napi_gro_flush(struct napi_struct *napi, bool flush_old);
 struct sk_buff *napi_get_frags(struct napi_struct *napi);
@@ -2615,6 +2629,25 @@ int netdev_rx_handler_register(struct net_device *dev,
 			       void *rx_handler_data);
 void netdev_rx_handler_unregister(struct net_device *dev);
 
+int dev_change_rx_filter(struct net_device *dev, struct sock_filter *insns,
+			 unsigned int len);
+u32 netdev_rx_filter_run(const struct sk_filter *fp, struct net_device *dev,
+			 void *data, unsigned int len, u16 queue);
+void netdev_rx_filter_xmit(struct sk_buff *skb, struct net_device *dev);
+
+/**
+ *	netdev_rx_filter - get the Rx filter of a device
+ *	@dev: network device
+ *
+ *	Returns the filter to pass to netdev_rx_filter_run() or NULL.  The
+ *	caller must be in a rcu_read_lock() section and the filter is only
+ *	valid inside it.
+ */
+static inline struct sk_filter *netdev_rx_filter(struct net_device *dev)
+{
+	return rcu_dereference(dev->rx_filter);
+}
+
 bool dev_valid_name(const char *name);
 int dev_ioctl(struct net *net, unsigned int cmd, void __user *);
 int dev_ethtool(struct net *net, struct ifreq *);
@@ -2632,12 +2665,16 @@ int dev_set_mac_address(struct net_device *, struct sockaddr *);
 int dev_change_carrier(struct net_device *, bool new_carrier);
 int dev_get_phys_port_id(struct net_device *dev,
 			 struct netdev_phys_port_id *ppid);
-int dev_hard_start_xmit(struct sk_buff *skb, struct net_device *dev,
-			struct netdev_queue *txq);
+struct sk_buff *validate_xmit_skb_list(struct sk_buff *skb,
+				       struct net_device *dev);
+struct sk_buff *dev_hard_start_xmit(struct sk_buff *skb,
+				    struct net_device *dev,
+				    struct netdev_queue *txq, int *ret);
 int dev_forward_skb(struct net_device *dev, struct sk_buff *skb);
 bool is_skb_forwardable(struct net_device *dev, struct sk_buff *skb);
 
 extern int		netdev_budget;
+extern int		gro_normal_batch;
 
 /* Called by rtnetlink.c:rtnl_unlock() */
 void netdev_run_todo(void);
@@ -2853,6 +2890,39 @@ static inline void txq_trans_update(struct netdev_queue *txq)
 		txq->trans_start = jiffies;
 }
 
+/**
+ *	__netdev_start_xmit - call a driver's ndo_start_xmit
+ *	@ops: device operations
+ *	@skb: buffer to transmit
+ *	@dev: network device
+ *	@more: more skbs are handed to the same queue right after this one
+ *
+ *	@more is passed on as skb->xmit_more. A driver that sees it set may
+ *	defer notifying the hardware of new descriptors, but it must do so
+ *	anyway if it stops the queue, as no further call may follow then.
+ */
+static inline netdev_tx_t __netdev_start_xmit(const struct net_device_ops *ops,
+					      struct sk_buff *skb,
+					      struct net_device *dev, bool more)
+{
+	skb->xmit_more = more ? 1 : 0;
+	return ops->ndo_start_xmit(skb, dev);
+}
+
+static inline netdev_tx_t netdev_start_xmit(struct sk_buff *skb,
+					    struct net_device *dev,
+					    struct netdev_queue *txq, bool more)
+{
+	const struct net_device_ops *ops = dev->netdev_ops;
+	netdev_tx_t rc;
+
+	rc = __netdev_start_xmit(ops, skb, dev, more);
+	if (rc == NETDEV_TX_OK)
+		txq_trans_update(txq);
+
+	return rc;
+}
+
 /**
  *	netif_tx_lock - grab network device transmit lock
  *	@dev: network device
@@ -3218,6 +3288,10 @@ static inline bool net_gso_ok(netdev_features_t features, int gso_type)
 	BUILD_BUG_ON(SKB_GSO_TCP_ECN != (NETIF_F_TSO_ECN >> NETIF_F_GSO_SHIFT));
 	BUILD_BUG_ON(SKB_GSO_TCPV6   != (NETIF_F_TSO6 >> NETIF_F_GSO_SHIFT));
 	BUILD_BUG_ON(SKB_GSO_FCOE    != (NETIF_F_FSO >> NETIF_F_GSO_SHIFT));
+	BUILD_BUG_ON(SKB_GSO_UDP_L4  !=
+		     (NETIF_F_GSO_UDP_L4 >> NETIF_F_GSO_SHIFT));
+	BUILD_BUG_ON(SKB_GSO_SCTP    !=
+		     (NETIF_F_GSO_SCTP >> NETIF_F_GSO_SHIFT));
 
 	return (features & feature) == feature;
 }
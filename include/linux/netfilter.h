@@ -195,6 +195,27 @@ NF_HOOK(uint8_t pf, unsigned int hook, struct sk_buff *skb,
 	return NF_HOOK_THRESH(pf, hook, skb, in, out, okfn, INT_MIN);
 }
 
+/* Run the hook over a list of skbs. The skbs that are accepted are kept
+ * on @list for the caller to pass on in a batch; dropped, stolen and
+ * queued ones are removed from it.
+ */
+static inline void
+NF_HOOK_LIST(uint8_t pf, unsigned int hook, struct sk_buff_head *list,
+	     struct net_device *in, struct net_device *out,
+	     int (*okfn)(struct sk_buff *))
+{
+	struct sk_buff *skb, *tmp;
+
+	if (!nf_hooks_active(pf, hook))
+		return;
+
+	skb_queue_walk_safe(list, skb, tmp) {
+		__skb_unlink(skb, list);
+		if (nf_hook(pf, hook, skb, in, out, okfn) == 1)
+			__skb_queue_before(list, tmp, skb);
+	}
+}
+
 /* Call setsockopt() */
 int nf_setsockopt(struct sock *sk, u_int8_t pf, int optval, char __user *opt,
 		  unsigned int len);
@@ -294,6 +315,12 @@ nf_nat_decode_session(struct sk_buff *skb, struct flowi *fl, u_int8_t family)
 #else /* !CONFIG_NETFILTER */
 #define NF_HOOK(pf, hook, skb, indev, outdev, okfn) (okfn)(skb)
 #define NF_HOOK_COND(pf, hook, skb, indev, outdev, okfn, cond) (okfn)(skb)
+static inline void
+NF_HOOK_LIST(uint8_t pf, unsigned int hook, struct sk_buff_head *list,
+	     struct net_device *in, struct net_device *out,
+	     int (*okfn)(struct sk_buff *))
+{
+}
 static inline int nf_hook_thresh(u_int8_t pf, unsigned int hook,
 				 struct sk_buff *skb,
 				 struct net_device *indev,
@@ -259,6 +259,11 @@ pgoff_t page_cache_next_hole(struct address_space *mapping,
 pgoff_t page_cache_prev_hole(struct address_space *mapping,
 			     pgoff_t index, unsigned long max_scan);
 
+struct fincore_range;
+struct fincore_extent;
+int filemap_fincore(struct address_space *mapping, struct fincore_range *fr,
+		    struct fincore_extent __user *uext);
+
 struct page *find_get_entry(struct address_space *mapping, pgoff_t offset);
 struct page *find_get_page(struct address_space *mapping, pgoff_t offset);
 struct page *find_lock_entry(struct address_space *mapping, pgoff_t offset);
@@ -429,6 +434,8 @@ void wait_for_stable_page(struct page *page);
  * Add an arbitrary waiter to a page's wait queue
  */
 extern void add_page_wait_queue(struct page *page, wait_queue_t *waiter);
+extern int wait_on_page_locked_async(struct page *page,
+				     struct wait_bit_queue *wait);
 
 /*
  * Fault a userspace page into pagetables.  Return non-zero on a fault.
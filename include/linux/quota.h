@@ -287,6 +287,10 @@ struct dquot {
 	loff_t dq_off;			/* Offset of dquot on disk */
 	unsigned long dq_flags;		/* See DQ_* */
 	struct mem_dqblk dq_dqb;	/* Diskquota usage */
+	/* Usage deltas not yet folded into dq_dqb, see dquot_fold() */
+	struct percpu_counter dq_curspace;
+	struct percpu_counter dq_rsvspace;
+	struct percpu_counter dq_curinodes;
 };
 
 /* Operations which must be implemented by each quota format */
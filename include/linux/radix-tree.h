@@ -28,9 +28,9 @@
 #include <linux/rcupdate.h>
 
 /*
- * An indirect pointer (root->rnode pointing to a radix_tree_node, rather
- * than a data item) is signalled by the low bit set in the root->rnode
- * pointer.
+ * An indirect pointer (root->rnode or a node slot pointing to a
+ * radix_tree_node, rather than a data item) is signalled by the low bit
+ * set in the pointer.
  *
  * In this case root->height is > 0, but the indirect pointer tests are
  * needed for RCU lookups (because root->height is unreliable). The only
@@ -40,6 +40,11 @@
  * Indirect pointer in fact is also used to tag the last pointer of a node
  * when it is shrunk, before we rcu free the node. See shrink code for
  * details.
+ *
+ * A node slot can also hold an indirect pointer back to another slot of
+ * the same node: a sibling entry, continuing the multi-order entry stored
+ * in that slot.  Lookups and iterators resolve these, so callers never
+ * see them.
  */
 #define RADIX_TREE_INDIRECT_PTR		1
 /*
@@ -261,8 +266,15 @@ static inline void radix_tree_replace_slot(void **pslot, void *item)
 }
 
 int __radix_tree_create(struct radix_tree_root *root, unsigned long index,
-			struct radix_tree_node **nodep, void ***slotp);
-int radix_tree_insert(struct radix_tree_root *, unsigned long, void *);
+			unsigned order, struct radix_tree_node **nodep,
+			void ***slotp);
+int __radix_tree_insert(struct radix_tree_root *, unsigned long index,
+			unsigned order, void *);
+static inline int radix_tree_insert(struct radix_tree_root *root,
+			unsigned long index, void *entry)
+{
+	return __radix_tree_insert(root, index, 0, entry);
+}
 void *__radix_tree_lookup(struct radix_tree_root *root, unsigned long index,
 			  struct radix_tree_node **nodep, void ***slotp);
 void *radix_tree_lookup(struct radix_tree_root *, unsigned long);
@@ -312,18 +324,22 @@ static inline void radix_tree_preload_end(void)
  * @index:	index of current slot
  * @next_index:	next-to-last index for this chunk
  * @tags:	bit-mask for tag-iterating
+ * @shift:	log2 of the number of indices each slot of the chunk covers
  *
  * This radix tree iterator works in terms of "chunks" of slots.  A chunk is a
  * subinterval of slots contained within one radix tree leaf node.  It is
  * described by a pointer to its first slot and a struct radix_tree_iter
  * which holds the chunk's position in the tree and its size.  For tagged
  * iteration radix_tree_iter also holds the slots' bit-mask for one chosen
- * radix tree tag.
+ * radix tree tag.  A multi-order entry stored above the leaf level is
+ * returned as a chunk of its own, a single slot spanning 1 << @shift
+ * indices starting at @index.
  */
 struct radix_tree_iter {
 	unsigned long	index;
 	unsigned long	next_index;
 	unsigned long	tags;
+	unsigned int	shift;
 };
 
 #define RADIX_TREE_ITER_TAG_MASK	0x00FF	/* tag index in lower byte */
@@ -378,7 +394,23 @@ void **radix_tree_next_chunk(struct radix_tree_root *root,
 static __always_inline unsigned
 radix_tree_chunk_size(struct radix_tree_iter *iter)
 {
-	return iter->next_index - iter->index;
+	return (iter->next_index - iter->index) >> iter->shift;
+}
+
+/**
+ * radix_tree_sibling_slot - does this slot continue a multi-order entry?
+ *
+ * @slot:	pointer to a slot in a leaf chunk
+ * Returns:	true if @slot holds a sibling entry, which points back at the
+ *		slot of the multi-order entry earlier in the same node
+ */
+static __always_inline bool radix_tree_sibling_slot(void **slot)
+{
+	unsigned long entry = (unsigned long)*slot;
+	void **canon = (void **)(entry & ~RADIX_TREE_INDIRECT_PTR);
+
+	return (entry & RADIX_TREE_INDIRECT_PTR) &&
+		canon < slot && canon > slot - RADIX_TREE_MAP_SIZE;
 }
 
 /**
@@ -414,8 +446,11 @@ radix_tree_next_slot(void **slot, struct radix_tree_iter *iter, unsigned flags)
 		while (size--) {
 			slot++;
 			iter->index++;
-			if (likely(*slot))
+			if (likely(*slot)) {
+				if (unlikely(radix_tree_sibling_slot(slot)))
+					continue;
 				return slot;
+			}
 			if (flags & RADIX_TREE_ITER_CONTIG) {
 				/* forbid switching to the next chunk */
 				iter->next_index = 0;
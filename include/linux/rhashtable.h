@@ -0,0 +1,106 @@
+/*
+ * Resizable, RCU protected hash table
+ *
+ * Lookups run under rcu_read_lock() and take no lock, insertions and
+ * removals take a lock covering their bucket.  The table grows when it
+ * is more than 75% full and shrinks when it is less than 30% full, in a
+ * worker, by rehashing one bucket at a time into a table of the new
+ * size while lookups, insertions and removals carry on.
+ *
+ * Objects embed a struct rhash_head and a fixed size key, whose offsets
+ * are given in struct rhashtable_params.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _LINUX_RHASHTABLE_H
+#define _LINUX_RHASHTABLE_H
+
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/workqueue.h>
+#include <linux/atomic.h>
+
+struct rhash_head {
+	struct rhash_head __rcu		*next;
+};
+
+/**
+ * struct bucket_table - a table of buckets
+ * @size: number of buckets, a power of two
+ * @locks_mask: number of bucket locks minus one
+ * @locks: the bucket locks, each covers every @locks_mask + 1th bucket
+ * @future_tbl: the table being rehashed into, if any
+ * @buckets: the chains
+ */
+struct bucket_table {
+	unsigned int			size;
+	unsigned int			locks_mask;
+	spinlock_t			*locks;
+	struct bucket_table __rcu	*future_tbl;
+	struct rhash_head __rcu		*buckets[] ____cacheline_aligned_in_smp;
+};
+
+typedef u32 (*rht_hashfn_t)(const void *data, u32 len, u32 seed);
+
+/**
+ * struct rhashtable_params - hash table parameters
+ * @nelem_hint: expected number of objects, to size the first table
+ * @key_len: length of the key
+ * @key_offset: offset of the key in the object
+ * @head_offset: offset of the struct rhash_head in the object
+ * @min_size: smallest number of buckets to shrink to, 0 for the default
+ * @max_size: largest number of buckets to grow to, 0 for no limit
+ * @hashfn: hash function of the key, jhash() if NULL
+ */
+struct rhashtable_params {
+	unsigned int			nelem_hint;
+	unsigned int			key_len;
+	unsigned int			key_offset;
+	unsigned int			head_offset;
+	unsigned int			min_size;
+	unsigned int			max_size;
+	rht_hashfn_t			hashfn;
+};
+
+/**
+ * struct rhashtable - resizable hash table
+ * @tbl: the current table
+ * @nelems: number of objects in the table
+ * @seed: random seed of the hash function
+ * @being_destroyed: no resizing from now on
+ * @p: parameters
+ * @run_work: grows and shrinks the table
+ * @mutex: serializes resizing and destruction
+ */
+struct rhashtable {
+	struct bucket_table __rcu	*tbl;
+	atomic_t			nelems;
+	u32				seed;
+	bool				being_destroyed;
+	struct rhashtable_params	p;
+	struct work_struct		run_work;
+	struct mutex			mutex;
+};
+
+int rhashtable_init(struct rhashtable *ht,
+		    const struct rhashtable_params *params);
+void rhashtable_destroy(struct rhashtable *ht);
+void rhashtable_free_and_destroy(struct rhashtable *ht,
+				 void (*free_fn)(void *obj, void *arg),
+				 void *arg);
+
+int rhashtable_insert(struct rhashtable *ht, struct rhash_head *obj);
+int rhashtable_remove(struct rhashtable *ht, struct rhash_head *obj);
+void *rhashtable_lookup(struct rhashtable *ht, const void *key);
+
+static inline unsigned int rhashtable_nelems(struct rhashtable *ht)
+{
+	return atomic_read(&ht->nelems);
+}
+
+#endif /* _LINUX_RHASHTABLE_H */
@@ -0,0 +1,75 @@
+#ifndef __LINUX_SBITMAP_H
+#define __LINUX_SBITMAP_H
+
+#include <linux/types.h>
+#include <linux/bitops.h>
+#include <linux/cache.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+
+/*
+ * Scalable bitmap tag allocator.
+ *
+ * Tags are bits in a bitmap that is split into words of (1 << shift) bits,
+ * each on its own cacheline, so that allocations from different CPUs mostly
+ * touch different words.  Every CPU remembers where its last allocation
+ * ended and starts searching from there.  Unlike percpu_ida no tags are
+ * ever cached per CPU, so the full depth is always available to whichever
+ * CPU asks for it.
+ */
+struct sbitmap_word {
+	/* number of bits in use in this word */
+	unsigned long		depth;
+	unsigned long		word;
+} ____cacheline_aligned_in_smp;
+
+struct sbitmap {
+	unsigned int		depth;
+	unsigned int		shift;
+	unsigned int		map_nr;
+	struct sbitmap_word	*map;
+};
+
+#define SBQ_WAIT_QUEUES		8
+#define SBQ_WAKE_BATCH		8
+
+struct sbq_wait_state {
+	atomic_t		wait_cnt;
+	wait_queue_head_t	wait;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * A bitmap with per-cpu allocation hints and waitqueues for allocations
+ * that have to sleep.  Waiters are spread over SBQ_WAIT_QUEUES queues and
+ * each queue is only woken once wake_batch tags have been freed, so a
+ * completion does not wake every sleeper for a single tag.
+ */
+struct sbitmap_queue {
+	struct sbitmap		sb;
+	unsigned int __percpu	*alloc_hint;
+	unsigned int		wake_batch;
+	atomic_t		wake_index;
+	atomic_t		wait_index;
+	struct sbq_wait_state	*ws;
+};
+
+int sbitmap_queue_init_node(struct sbitmap_queue *sbq, unsigned int depth,
+			    int node);
+void sbitmap_queue_free(struct sbitmap_queue *sbq);
+
+int __sbitmap_queue_get(struct sbitmap_queue *sbq);
+int sbitmap_queue_get(struct sbitmap_queue *sbq, int state);
+void sbitmap_queue_clear(struct sbitmap_queue *sbq, unsigned int nr);
+
+unsigned int sbitmap_weight(const struct sbitmap *sb);
+
+typedef int (*sbitmap_cb)(unsigned int, void *);
+int sbitmap_for_each_free(const struct sbitmap *sb, sbitmap_cb fn,
+			  void *data);
+
+static inline unsigned int sbitmap_queue_free_tags(struct sbitmap_queue *sbq)
+{
+	return sbq->sb.depth - sbitmap_weight(&sbq->sb);
+}
+
+#endif /* __LINUX_SBITMAP_H */
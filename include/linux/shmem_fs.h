@@ -32,9 +32,22 @@ struct shmem_sb_info {
 	kuid_t uid;		    /* Mount uid for root directory */
 	kgid_t gid;		    /* Mount gid for root directory */
 	umode_t mode;		    /* Mount mode for root directory */
+	int huge;		    /* SHMEM_HUGE_* policy for huge teams */
 	struct mempolicy *mpol;     /* default memory policy for mappings */
 };
 
+/*
+ * Policies for mapping tmpfs with huge pmds, from the huge= mount option
+ * or, for the internal mount and as an override, from shmem_enabled in
+ * /sys/kernel/mm/transparent_hugepage.
+ */
+#define SHMEM_HUGE_NEVER	0	/* never allocate huge teams */
+#define SHMEM_HUGE_ALWAYS	1	/* whenever a huge extent is free */
+#define SHMEM_HUGE_WITHIN_SIZE	2	/* only up to i_size, or advised */
+#define SHMEM_HUGE_ADVISE	3	/* only for madvise(MADV_HUGEPAGE) */
+#define SHMEM_HUGE_DENY		(-1)	/* sysfs only: disable for all */
+#define SHMEM_HUGE_FORCE	(-2)	/* sysfs only: enable for all */
+
 static inline struct shmem_inode_info *SHMEM_I(struct inode *inode)
 {
 	return container_of(inode, struct shmem_inode_info, vfs_inode);
@@ -57,6 +70,26 @@ extern struct page *shmem_read_mapping_page_gfp(struct address_space *mapping,
 					pgoff_t index, gfp_t gfp_mask);
 extern void shmem_truncate_range(struct inode *inode, loff_t start, loff_t end);
 extern int shmem_unuse(swp_entry_t entry, struct page *page);
+extern unsigned long shmem_get_unmapped_area(struct file *, unsigned long addr,
+		unsigned long len, unsigned long pgoff, unsigned long flags);
+
+#if defined(CONFIG_SHMEM) && defined(CONFIG_TRANSPARENT_HUGEPAGE)
+struct kobj_attribute;
+extern struct kobj_attribute shmem_enabled_attr;
+extern bool shmem_huge_collapsible(struct vm_area_struct *vma, pgoff_t index);
+extern int shmem_collapse_team(struct address_space *mapping, pgoff_t index);
+#else
+static inline bool shmem_huge_collapsible(struct vm_area_struct *vma,
+					  pgoff_t index)
+{
+	return false;
+}
+static inline int shmem_collapse_team(struct address_space *mapping,
+				      pgoff_t index)
+{
+	return -EINVAL;
+}
+#endif
 
 static inline struct page *shmem_read_mapping_page(
 				struct address_space *mapping, pgoff_t index)
@@ -22,6 +22,12 @@ struct shrink_control {
 	nodemask_t nodes_to_scan;
 	/* current node being shrunk (for NUMA aware shrinkers) */
 	int nid;
+
+	/*
+	 * cgroup being reclaimed (for memcg aware shrinkers), NULL for global
+	 * reclaim
+	 */
+	struct mem_cgroup *memcg;
 };
 
 #define SHRINK_STOP (~0UL)
@@ -64,6 +70,7 @@ struct shrinker {
 
 /* Flags */
 #define SHRINKER_NUMA_AWARE (1 << 0)
+#define SHRINKER_MEMCG_AWARE (1 << 1)
 
 extern int register_shrinker(struct shrinker *);
 extern void unregister_shrinker(struct shrinker *);
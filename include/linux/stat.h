@@ -19,6 +19,14 @@
 #include <linux/uidgid.h>
 
 struct kstat {
+	/*
+	 * Set for i_op->getattr: the STATX_* fields the caller wants, and
+	 * its AT_STATX_SYNC_TYPE flags.  result_mask is set to the fields
+	 * which were filled in.
+	 */
+	u32		request_mask;
+	unsigned int	query_flags;
+	u32		result_mask;
 	u64		ino;
 	dev_t		dev;
 	umode_t		mode;
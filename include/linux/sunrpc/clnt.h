@@ -28,6 +28,9 @@
 
 struct rpc_inode;
 
+/* Max number of transports an rpc_clnt may spread its requests over */
+#define RPC_MAX_NCONNECT	16
+
 /*
  * The high-level client handle
  */
@@ -38,6 +41,10 @@ struct rpc_clnt {
 	struct list_head	cl_tasks;	/* List of tasks */
 	spinlock_t		cl_lock;	/* spinlock */
 	struct rpc_xprt __rcu *	cl_xprt;	/* transport */
+	unsigned int		cl_nconnect;	/* cl_xprt + cl_xprts[] in use */
+	atomic_t		cl_xprt_next;	/* round-robin cursor */
+	struct rpc_xprt *	cl_xprts[RPC_MAX_NCONNECT - 1];
+						/* additional transports */
 	struct rpc_procinfo *	cl_procinfo;	/* procedure info */
 	u32			cl_prog,	/* RPC program number */
 				cl_vers,	/* RPC version number */
@@ -116,6 +123,7 @@ struct rpc_create_args {
 	unsigned long		flags;
 	char			*client_name;
 	struct svc_xprt		*bc_xprt;	/* NFSv4.1 backchannel */
+	unsigned int		nconnect;	/* number of transports */
 };
 
 /* Values for "flags" field */
@@ -51,8 +51,16 @@ struct svc_pool {
 	struct list_head	sp_all_threads;	/* all server threads */
 	struct svc_pool_stats	sp_stats;	/* statistics on pool operation */
 	int			sp_task_pending;/* has pending task */
+	unsigned long		sp_flags;
+#define	SP_NEED_THREAD	0		/* transport queued, no idle thread */
 } ____cacheline_aligned_in_smp;
 
+/*
+ * How long a thread of an autoscaling pool may sit idle before it
+ * leaves the pool, as long as the pool stays at sv_pool_min_threads.
+ */
+#define SVC_POOL_IDLE_TIMEOUT	(30 * HZ)
+
 /*
  * RPC service.
  *
@@ -84,6 +92,12 @@ struct svc_serv {
 
 	unsigned int		sv_nrpools;	/* number of thread pools */
 	struct svc_pool *	sv_pools;	/* array of thread pools */
+	unsigned int		sv_pool_min_threads;
+	unsigned int		sv_pool_max_threads;
+						/* bounds for each pool's
+						 * thread count when
+						 * autoscaling; a zero max
+						 * means a fixed count */
 
 	void			(*sv_shutdown)(struct svc_serv *serv,
 					       struct net *net);
@@ -116,6 +130,15 @@ static inline void svc_get(struct svc_serv *serv)
 	serv->sv_nrthreads++;
 }
 
+/*
+ * Has a transport had to queue on this autoscaling pool for want of an
+ * idle thread? If so the service should call svc_pool_grow().
+ */
+static inline bool svc_pool_wants_thread(struct svc_pool *pool)
+{
+	return test_bit(SP_NEED_THREAD, &pool->sp_flags);
+}
+
 /*
  * Maximum payload size supported by a kernel RPC server.
  * This is use to determine the max number of pages nfsd is
@@ -277,6 +300,7 @@ struct svc_rqst {
 						 * cache pages */
 	wait_queue_head_t	rq_wait;	/* synchronization */
 	struct task_struct	*rq_task;	/* service thread */
+	bool			rq_pool_exit;	/* left the pool when idle */
 };
 
 #define SVC_NET(svc_rqst)	(svc_rqst->rq_xprt->xpt_net)
@@ -429,6 +453,7 @@ struct svc_serv *  svc_create_pooled(struct svc_program *, unsigned int,
 			void (*shutdown)(struct svc_serv *, struct net *net),
 			svc_thread_fn, struct module *);
 int		   svc_set_num_threads(struct svc_serv *, struct svc_pool *, int);
+int		   svc_pool_grow(struct svc_serv *, struct svc_pool *);
 int		   svc_pool_stats_open(struct svc_serv *serv, struct file *file);
 void		   svc_destroy(struct svc_serv *);
 void		   svc_shutdown_net(struct svc_serv *, struct net *);
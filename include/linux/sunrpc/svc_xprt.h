@@ -65,6 +65,8 @@ struct svc_xprt {
 #define XPT_CACHE_AUTH	12		/* cache auth info */
 
 	struct svc_serv		*xpt_server;	/* service for transport */
+	struct svc_pool		*xpt_pool;	/* pool of the cpu that first
+						 * received on a connection */
 	atomic_t    	    	xpt_reserved;	/* space on outq that is rsvd */
 	struct mutex		xpt_mutex;	/* to serialize sending data */
 	spinlock_t		xpt_lock;	/* protects sk_deferred
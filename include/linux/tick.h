@@ -162,6 +162,7 @@ static inline u64 get_cpu_iowait_time_us(int cpu, u64 *unused) { return -1; }
 #ifdef CONFIG_NO_HZ_FULL
 extern bool tick_nohz_full_running;
 extern cpumask_var_t tick_nohz_full_mask;
+extern cpumask_var_t housekeeping_mask;
 
 static inline bool tick_nohz_full_enabled(void)
 {
@@ -184,6 +185,7 @@ extern void __tick_nohz_full_check(void);
 extern void tick_nohz_full_kick(void);
 extern void tick_nohz_full_kick_all(void);
 extern void __tick_nohz_task_switch(struct task_struct *tsk);
+extern void housekeeping_affine(struct task_struct *t);
 #else
 static inline void tick_nohz_init(void) { }
 static inline bool tick_nohz_full_enabled(void) { return false; }
@@ -192,6 +194,7 @@ static inline void __tick_nohz_full_check(void) { }
 static inline void tick_nohz_full_kick(void) { }
 static inline void tick_nohz_full_kick_all(void) { }
 static inline void __tick_nohz_task_switch(struct task_struct *tsk) { }
+static inline void housekeeping_affine(struct task_struct *t) { }
 #endif
 
 static inline void tick_nohz_full_check(void)
@@ -206,5 +209,62 @@ static inline void tick_nohz_task_switch(struct task_struct *tsk)
 		__tick_nohz_task_switch(tsk);
 }
 
+/*
+ * Housekeeping cpus are the ones not in nohz_full=, they take the work
+ * that would otherwise interrupt the full dynticks cpus.  Without full
+ * dynticks every cpu is a housekeeping cpu.
+ */
+static inline int housekeeping_any_cpu(void)
+{
+#ifdef CONFIG_NO_HZ_FULL
+	if (tick_nohz_full_enabled())
+		return cpumask_any_and(housekeeping_mask, cpu_online_mask);
+#endif
+	return smp_processor_id();
+}
+
+static inline const struct cpumask *housekeeping_cpumask(void)
+{
+#ifdef CONFIG_NO_HZ_FULL
+	if (tick_nohz_full_enabled())
+		return housekeeping_mask;
+#endif
+	return cpu_possible_mask;
+}
+
+static inline bool is_housekeeping_cpu(int cpu)
+{
+	return !tick_nohz_full_cpu(cpu);
+}
+
+/*
+ * What still interrupts the full dynticks cpus, counted on the cpu that
+ * gets interrupted.  See /sys/kernel/debug/nohz_full_noise.
+ */
+enum nohz_full_noise_item {
+	NOHZ_NOISE_TIMER,		/* timer wheel callbacks */
+	NOHZ_NOISE_WORK,		/* workqueue items */
+	NOHZ_NOISE_VMSTAT,		/* vmstat folding */
+	NOHZ_NOISE_LRU_DRAIN,		/* lru_add_drain_all() */
+	NOHZ_NOISE_RCU,			/* RCU callback batches */
+	NR_NOHZ_NOISE_ITEMS
+};
+
+#ifdef CONFIG_NO_HZ_FULL
+struct nohz_full_noise {
+	unsigned long count[NR_NOHZ_NOISE_ITEMS];
+};
+
+DECLARE_PER_CPU(struct nohz_full_noise, nohz_full_noise);
+
+static inline void nohz_full_noise_inc(enum nohz_full_noise_item item)
+{
+	if (tick_nohz_full_cpu(raw_smp_processor_id()))
+		this_cpu_inc(nohz_full_noise.count[item]);
+}
+#else
+static inline void nohz_full_noise_inc(enum nohz_full_noise_item item) { }
+#endif
+
 
 #endif
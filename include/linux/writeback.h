@@ -84,12 +84,16 @@ struct writeback_control {
 	unsigned for_reclaim:1;		/* Invoked from the page allocator */
 	unsigned range_cyclic:1;	/* range_start is cyclic */
 	unsigned for_sync:1;		/* sync(2) WB_SYNC_ALL writeback */
+#ifdef CONFIG_CGROUP_WRITEBACK
+	struct bdi_writeback *wb;	/* the wb written, for its blkcg */
+#endif
 };
 
 /*
  * fs/fs-writeback.c
  */	
 struct bdi_writeback;
+struct bio;
 int inode_wait(void *);
 void writeback_inodes_sb(struct super_block *, enum wb_reason reason);
 void writeback_inodes_sb_nr(struct super_block *, unsigned long nr,
@@ -100,6 +104,14 @@ int try_to_writeback_inodes_sb_nr(struct super_block *, unsigned long nr,
 void sync_inodes_sb(struct super_block *);
 void wakeup_flusher_threads(long nr_pages, enum wb_reason reason);
 void inode_wait_for_writeback(struct inode *inode);
+#ifdef CONFIG_CGROUP_WRITEBACK
+void wbc_init_bio(struct writeback_control *wbc, struct bio *bio);
+#else
+static inline void wbc_init_bio(struct writeback_control *wbc,
+				struct bio *bio)
+{
+}
+#endif
 
 /* writeback.h requires fs.h; it, too, is not included from here. */
 static inline void wait_on_inode(struct inode *inode)
@@ -153,6 +165,10 @@ int dirty_writeback_centisecs_handler(struct ctl_table *, int,
 				      void __user *, size_t *, loff_t *);
 
 void global_dirty_limits(unsigned long *pbackground, unsigned long *pdirty);
+#ifdef CONFIG_CGROUP_WRITEBACK
+void wb_dirty_limits(struct bdi_writeback *wb, unsigned long *pbackground,
+		     unsigned long *pdirty);
+#endif
 unsigned long bdi_dirty_limit(struct backing_dev_info *bdi,
 			       unsigned long dirty);
 
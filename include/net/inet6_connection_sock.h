@@ -33,7 +33,8 @@ struct request_sock *inet6_csk_search_req(const struct sock *sk,
 					  const __be16 rport,
 					  const struct in6_addr *raddr,
 					  const struct in6_addr *laddr,
-					  const int iif);
+					  const int iif,
+					  spinlock_t **lockp);
 
 void inet6_csk_reqsk_queue_hash_add(struct sock *sk, struct request_sock *req,
 				    const unsigned long timeout);
@@ -43,6 +43,7 @@ struct fib_config {
 	int			fc_mp_len;
 	u32			fc_flow;
 	u32			fc_nlflags;
+	u32			fc_nh_id;
 	struct nl_info		fc_nlinfo;
  };
 
@@ -107,6 +108,7 @@ struct fib_info {
 	unsigned char		fib_type;
 	__be32			fib_prefsrc;
 	u32			fib_priority;
+	u32			fib_nh_id;	/* nexthop object, 0 if none */
 	u32			*fib_metrics;
 #define fib_mtu fib_metrics[RTAX_MTU-1]
 #define fib_window fib_metrics[RTAX_WINDOW-1]
@@ -194,6 +196,7 @@ int fib_table_delete(struct fib_table *, struct fib_config *);
 int fib_table_dump(struct fib_table *table, struct sk_buff *skb,
 		   struct netlink_callback *cb);
 int fib_table_flush(struct fib_table *table);
+int fib_table_rebind(struct fib_table *tb, struct list_head *map, bool commit);
 void fib_free_table(struct fib_table *tb);
 
 
@@ -274,6 +277,7 @@ int fib_validate_source(struct sk_buff *skb, __be32 src, __be32 dst,
 			u8 tos, int oif, struct net_device *dev,
 			struct in_device *idev, u32 *itag);
 void fib_select_default(struct fib_result *res);
+int fib_nexthop_rebind(struct net *net);
 #ifdef CONFIG_IP_ROUTE_CLASSID
 static inline int fib_num_tclassid_users(struct net *net)
 {
@@ -292,6 +296,7 @@ int fib_sync_down_dev(struct net_device *dev, int force);
 int fib_sync_down_addr(struct net *net, __be32 local);
 int fib_sync_up(struct net_device *dev);
 void fib_select_multipath(struct fib_result *res);
+void fib_rebind_release(struct list_head *map);
 
 /* Exported by fib_trie.c */
 void fib_trie_init(void);
@@ -181,6 +181,12 @@ struct pneigh_entry {
 
 #define NEIGH_NUM_HASH_RND	4
 
+/* Locks shared by the hash buckets, see neigh_bucket_lock() */
+#define NEIGH_HASH_LOCKS	64
+
+/* Hash buckets the periodic GC scans per run */
+#define NEIGH_GC_SLICE		256
+
 struct neigh_hash_table {
 	struct neighbour __rcu	**hash_buckets;
 	unsigned int		hash_shift;
@@ -218,6 +224,8 @@ struct neigh_table {
 	struct neigh_statistics	__percpu *stats;
 	struct neigh_hash_table __rcu *nht;
 	struct pneigh_entry	**phash_buckets;
+	unsigned int		gc_bucket;
+	spinlock_t		hash_locks[NEIGH_HASH_LOCKS];
 };
 
 static inline int neigh_parms_family(struct neigh_parms *p)
@@ -47,6 +47,8 @@ struct netns_ipv4 {
 #endif
 	struct hlist_head	*fib_table_hash;
 	struct sock		*fibnl;
+	struct hlist_head	*nexthop_hash;
+	u32			nexthop_last_id;
 
 	struct sock		**icmp_sk;
 	struct inet_peer_base	*peers;
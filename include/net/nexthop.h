@@ -3,6 +3,40 @@
 
 #include <linux/rtnetlink.h>
 #include <net/netlink.h>
+#include <linux/nexthop.h>
+
+struct fib_config;
+struct nexthop;
+
+struct nh_grp_entry {
+	struct nexthop		*nh;
+	u16			weight;		/* 1 .. 256 */
+};
+
+/*
+ * Nexthop object shared by all routes referencing it through RTA_NH_ID.
+ * Objects only live in the control plane: routes still carry their own
+ * fib_info built from the object, and replacing the object rebuilds those.
+ * All fields are protected by RTNL.
+ */
+struct nexthop {
+	struct hlist_node	nh_hash;
+	u32			id;
+	u8			protocol;
+	bool			is_group;
+	bool			dirty;		/* routes need (re)binding */
+	unsigned int		fi_refcnt;	/* fib_infos built from us */
+	unsigned int		grp_refcnt;	/* groups we are a member of */
+
+	/* single nexthop */
+	__be32			gw;
+	int			oif;
+	unsigned int		flags;		/* RTNH_F_ONLINK */
+
+	/* nexthop group */
+	u16			num_nh;
+	struct nh_grp_entry	*nh_entries;
+};
 
 static inline int rtnh_ok(const struct rtnexthop *rtnh, int remaining)
 {
@@ -30,4 +64,11 @@ static inline int rtnh_attrlen(const struct rtnexthop *rtnh)
 	return rtnh->rtnh_len - NLA_ALIGN(sizeof(*rtnh));
 }
 
+/* Exported by nexthop.c, all of them must be called under RTNL */
+int nexthop_fib_config(struct net *net, struct fib_config *cfg);
+bool nexthop_is_dirty(struct net *net, u32 id);
+void nexthop_link_fib_info(struct net *net, u32 id);
+void nexthop_unlink_fib_info(struct net *net, u32 id);
+void __init nexthop_init(void);
+
 #endif
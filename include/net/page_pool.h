@@ -0,0 +1,100 @@
+/*
+ * Page pool for driver receive buffers
+ *
+ * A page pool hands out pages to a single receive queue and takes them
+ * back when the stack is done with them, keeping them DMA mapped in
+ * between.  Pages carry a pointer to their pool while they are out, so
+ * an skb marked with skb_mark_for_recycle() returns its fragments here
+ * rather than to the page allocator when it is freed.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+#ifndef _NET_PAGE_POOL_H
+#define _NET_PAGE_POOL_H
+
+#include <linux/mm.h>
+#include <linux/poison.h>
+#include <linux/skbuff.h>
+#include <linux/dma-mapping.h>
+
+/* Marks a page owned by a page pool, kept in page->pp_magic. */
+#define PP_SIGNATURE		(0x40 + POISON_POINTER_DELTA)
+
+/* The pool maps each page once, when it is allocated. */
+#define PP_FLAG_DMA_MAP		1
+
+/* Pages the owning queue may take back without a lock. */
+#define PP_ALLOC_CACHE_SIZE	128
+#define PP_ALLOC_CACHE_REFILL	64
+
+struct page_pool_params {
+	unsigned int		flags;
+	unsigned int		order;
+	unsigned int		pool_size;	/* pages kept for recycling */
+	int			nid;		/* NUMA node to allocate on */
+	struct device		*dev;		/* for PP_FLAG_DMA_MAP */
+	enum dma_data_direction	dma_dir;
+};
+
+struct page_pool {
+	struct page_pool_params p;
+
+	/* Only touched by the queue that owns the pool, from its NAPI
+	 * poll routine.
+	 */
+	unsigned int		alloc_count;
+	struct page		*alloc_cache[PP_ALLOC_CACHE_SIZE];
+
+	/* Pages coming back from anywhere else. */
+	spinlock_t		ring_lock ____cacheline_aligned_in_smp;
+	unsigned int		ring_count;
+	bool			destroyed;
+	struct page		**ring;
+
+	/* One for the owner plus one for every page the pool has mapped. */
+	atomic_t		refcnt;
+};
+
+static inline dma_addr_t page_pool_get_dma_addr(const struct page *page)
+{
+	return (dma_addr_t)page_private(page);
+}
+
+/* Let skb_release_data() hand pool pages back to their pool. */
+static inline void skb_mark_for_recycle(struct sk_buff *skb)
+{
+	skb->pp_recycle = 1;
+}
+
+#ifdef CONFIG_PAGE_POOL
+struct page_pool *page_pool_create(const struct page_pool_params *params);
+void page_pool_destroy(struct page_pool *pool);
+struct page *page_pool_alloc_pages(struct page_pool *pool, gfp_t gfp);
+void page_pool_put_page(struct page_pool *pool, struct page *page,
+			bool allow_direct);
+bool page_pool_return_skb_page(struct page *page);
+
+static inline struct page *page_pool_dev_alloc_pages(struct page_pool *pool)
+{
+	return page_pool_alloc_pages(pool, GFP_ATOMIC | __GFP_NOWARN);
+}
+
+/* For the owning queue, from its NAPI poll routine, e.g. when a frame
+ * is dropped before an skb was built around it.
+ */
+static inline void page_pool_recycle_direct(struct page_pool *pool,
+					    struct page *page)
+{
+	page_pool_put_page(pool, page, true);
+}
+#else
+static inline bool page_pool_return_skb_page(struct page *page)
+{
+	return false;
+}
+#endif
+
+#endif /* _NET_PAGE_POOL_H */
@@ -91,19 +91,39 @@ extern int sysctl_max_syn_backlog;
 /** struct listen_sock - listen state
  *
  * @max_qlen_log - log_2 of maximal queued SYNs/REQUESTs
+ * @dead - the listener stopped, no more requests may be hashed
+ * @syn_lock_mask - number of bucket locks - 1
+ * @syn_lock - hashed bucket locks of syn_table, see reqsk_queue_lock()
+ *
+ * SYN and ACK processing does not take the listener lock, so listen_sock
+ * is freed after a RCU grace period, and fields that are not protected
+ * by a bucket lock are atomic.
  */
 struct listen_sock {
 	u8			max_qlen_log;
 	u8			synflood_warned;
-	/* 2 bytes hole, try to use */
-	int			qlen;
-	int			qlen_young;
+	u8			dead;
+	/* 1 byte hole, try to use */
+	atomic_t		qlen;
+	atomic_t		qlen_young;
 	int			clock_hand;
 	u32			hash_rnd;
 	u32			nr_table_entries;
+	u32			syn_lock_mask;
+	spinlock_t		*syn_lock;
+	struct rcu_head		rcu;
 	struct request_sock	*syn_table[0];
 };
 
+/* The lock of the SYN table bucket for @hash. Requests only change under
+ * it, a request found in the table stays there until the lock is dropped.
+ */
+static inline spinlock_t *reqsk_queue_lock(const struct listen_sock *lopt,
+					   u32 hash)
+{
+	return &lopt->syn_lock[hash & lopt->syn_lock_mask];
+}
+
 /*
  * For a TCP Fast Open listener -
  *	lock - protects the access to all the reqsk, which is co-owned by
@@ -136,22 +156,17 @@ struct fastopen_queue {
  *
  * @rskq_accept_head - FIFO head of established children
  * @rskq_accept_tail - FIFO tail of established children
+ * @rskq_lock - protects the accept FIFO and sk_ack_backlog of the listener
  * @rskq_defer_accept - User waits for some data after accept()
- * @syn_wait_lock - serializer
- *
- * %syn_wait_lock is necessary only to avoid proc interface having to grab the main
- * lock sock while browsing the listening hash (otherwise it's deadlock prone).
  *
- * This lock is acquired in read mode only from listening_get_next() seq_file
- * op and it's acquired in write mode _only_ from code that is actively
- * changing rskq_accept_head. All readers that are holding the master sock lock
- * don't need to grab this lock in read mode too as rskq_accept_head. writes
- * are always protected from the main sock lock.
+ * Established children are added from softirq context without the listener
+ * lock, accept() and inet_csk_listen_stop() take %rskq_lock to remove them.
+ * The SYN table of @listen_opt is protected by its bucket locks.
  */
 struct request_sock_queue {
 	struct request_sock	*rskq_accept_head;
 	struct request_sock	*rskq_accept_tail;
-	rwlock_t		syn_wait_lock;
+	spinlock_t		rskq_lock;
 	u8			rskq_defer_accept;
 	/* 3 bytes hole, try to pack */
 	struct listen_sock	*listen_opt;
@@ -185,96 +200,91 @@ static inline int reqsk_queue_empty(struct request_sock_queue *queue)
 	return queue->rskq_accept_head == NULL;
 }
 
-static inline void reqsk_queue_unlink(struct request_sock_queue *queue,
-				      struct request_sock *req,
+/* caller holds the bucket lock of req */
+static inline void reqsk_queue_unlink(struct request_sock *req,
 				      struct request_sock **prev_req)
 {
-	write_lock(&queue->syn_wait_lock);
 	*prev_req = req->dl_next;
-	write_unlock(&queue->syn_wait_lock);
 }
 
-static inline void reqsk_queue_add(struct request_sock_queue *queue,
-				   struct request_sock *req,
-				   struct sock *parent,
-				   struct sock *child)
+static inline struct request_sock *reqsk_queue_remove(struct request_sock_queue *queue,
+						      struct sock *parent)
 {
-	req->sk = child;
-	sk_acceptq_added(parent);
-
-	if (queue->rskq_accept_head == NULL)
-		queue->rskq_accept_head = req;
-	else
-		queue->rskq_accept_tail->dl_next = req;
-
-	queue->rskq_accept_tail = req;
-	req->dl_next = NULL;
-}
-
-static inline struct request_sock *reqsk_queue_remove(struct request_sock_queue *queue)
-{
-	struct request_sock *req = queue->rskq_accept_head;
+	struct request_sock *req;
 
+	spin_lock_bh(&queue->rskq_lock);
+	req = queue->rskq_accept_head;
 	WARN_ON(req == NULL);
 
 	queue->rskq_accept_head = req->dl_next;
 	if (queue->rskq_accept_head == NULL)
 		queue->rskq_accept_tail = NULL;
+	sk_acceptq_removed(parent);
+	spin_unlock_bh(&queue->rskq_lock);
 
 	return req;
 }
 
+/* caller holds the bucket lock of req, which keeps listen_opt around */
 static inline int reqsk_queue_removed(struct request_sock_queue *queue,
 				      struct request_sock *req)
 {
 	struct listen_sock *lopt = queue->listen_opt;
 
 	if (req->num_timeout == 0)
-		--lopt->qlen_young;
+		atomic_dec(&lopt->qlen_young);
 
-	return --lopt->qlen;
-}
-
-static inline int reqsk_queue_added(struct request_sock_queue *queue)
-{
-	struct listen_sock *lopt = queue->listen_opt;
-	const int prev_qlen = lopt->qlen;
-
-	lopt->qlen_young++;
-	lopt->qlen++;
-	return prev_qlen;
+	return atomic_dec_return(&lopt->qlen);
 }
 
 static inline int reqsk_queue_len(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt != NULL ? queue->listen_opt->qlen : 0;
+	const struct listen_sock *lopt = ACCESS_ONCE(queue->listen_opt);
+
+	return lopt != NULL ? atomic_read(&lopt->qlen) : 0;
 }
 
 static inline int reqsk_queue_len_young(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen_young;
+	const struct listen_sock *lopt = ACCESS_ONCE(queue->listen_opt);
+
+	return lopt != NULL ? atomic_read(&lopt->qlen_young) : 0;
 }
 
 static inline int reqsk_queue_is_full(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen >> queue->listen_opt->max_qlen_log;
+	const struct listen_sock *lopt = ACCESS_ONCE(queue->listen_opt);
+
+	if (lopt == NULL)
+		return 0;
+	return atomic_read(&lopt->qlen) >> lopt->max_qlen_log;
 }
 
-static inline void reqsk_queue_hash_req(struct request_sock_queue *queue,
-					u32 hash, struct request_sock *req,
-					unsigned long timeout)
+/* Returns the queue length before req was added, or -1 when the listener
+ * stopped and the request was not hashed.
+ */
+static inline int reqsk_queue_hash_req(struct listen_sock *lopt,
+				       u32 hash, struct request_sock *req,
+				       unsigned long timeout)
 {
-	struct listen_sock *lopt = queue->listen_opt;
+	spinlock_t *lock = reqsk_queue_lock(lopt, hash);
+	int prev_qlen = -1;
 
 	req->expires = jiffies + timeout;
 	req->num_retrans = 0;
 	req->num_timeout = 0;
 	req->sk = NULL;
-	req->dl_next = lopt->syn_table[hash];
 
-	write_lock(&queue->syn_wait_lock);
-	lopt->syn_table[hash] = req;
-	write_unlock(&queue->syn_wait_lock);
+	spin_lock(lock);
+	if (!lopt->dead) {
+		req->dl_next = lopt->syn_table[hash];
+		lopt->syn_table[hash] = req;
+		atomic_inc(&lopt->qlen_young);
+		prev_qlen = atomic_inc_return(&lopt->qlen) - 1;
+	}
+	spin_unlock(lock);
+
+	return prev_qlen;
 }
 
 #endif /* _REQUEST_SOCK_H */
@@ -110,6 +110,12 @@ void sctp_copy_sock(struct sock *newsk, struct sock *sk,
 extern struct percpu_counter sctp_sockets_allocated;
 int sctp_asconf_mgmt(struct sctp_sock *, struct sctp_sockaddr_entry *);
 
+/*
+ * sctp/offload.c
+ */
+int sctp_offload_init(void);
+void sctp_offload_exit(void);
+
 /*
  * sctp/primitive.c
  */
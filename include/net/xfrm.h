@@ -527,6 +527,8 @@ struct xfrm_policy {
 #endif
 	struct hlist_node	bydst;
 	struct hlist_node	byidx;
+	struct hlist_node	bypfx;
+	u32			pos;
 
 	/* This lock only affects elements except for entry. */
 	rwlock_t		lock;
@@ -7,6 +7,7 @@
 #include <linux/workqueue.h>
 #include <linux/mutex.h>
 #include <linux/seq_file.h>
+#include <linux/blk-mq.h>
 #include <scsi/scsi.h>
 
 struct request_queue;
@@ -484,6 +485,13 @@ struct scsi_host_template {
 	 */
 	unsigned no_async_abort:1;
 
+	/*
+	 * True if the driver can be fed through blk-mq.  Such drivers must
+	 * not rely on block layer tagging (scsi_find_tag() and friends) and
+	 * may see queuecommand called for several hardware queues at once.
+	 */
+	unsigned use_blk_mq:1;
+
 	/*
 	 * Countdown for host blocking with no commands outstanding.
 	 */
@@ -603,12 +611,16 @@ struct Scsi_Host {
 	 */
 	struct blk_queue_tag	*bqt;
 
+	/* Tags and requests shared by the LUNs of a blk-mq host */
+	struct blk_mq_tag_set	tag_set;
+
+	atomic_t host_busy;		   /* commands actually active on low-level */
+
 	/*
 	 * The following two fields are protected with host_lock;
 	 * however, eh routines can safely access during eh processing
 	 * without acquiring the lock.
 	 */
-	unsigned int host_busy;		   /* commands actually active on low-level */
 	unsigned int host_failed;	   /* commands that failed. */
 	unsigned int host_eh_scheduled;    /* EH scheduled without command */
     
@@ -695,6 +707,15 @@ struct Scsi_Host {
 	/* The controller does not support WRITE SAME */
 	unsigned no_write_same:1;
 
+	/* Requests are dispatched through blk-mq instead of request_fn */
+	unsigned use_blk_mq:1;
+
+	/*
+	 * Number of blk-mq hardware queues, the LLDD may raise this from the
+	 * default of one before calling scsi_add_host().
+	 */
+	unsigned nr_hw_queues;
+
 	/*
 	 * Optional work queue to be utilized by the transport
 	 */
@@ -709,7 +730,7 @@ struct Scsi_Host {
 	/*
 	 * Host has rejected a command because it was busy.
 	 */
-	unsigned int host_blocked;
+	atomic_t host_blocked;
 
 	/*
 	 * Value host_blocked counts down from
@@ -792,6 +813,11 @@ static inline struct Scsi_Host *dev_to_shost(struct device *dev)
 	return container_of(dev, struct Scsi_Host, shost_gendev);
 }
 
+static inline bool shost_use_blk_mq(struct Scsi_Host *shost)
+{
+	return shost->use_blk_mq;
+}
+
 static inline int scsi_host_in_recovery(struct Scsi_Host *shost)
 {
 	return shost->shost_state == SHOST_RECOVERY ||
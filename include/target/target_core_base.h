@@ -474,6 +474,11 @@ struct se_dif_v1_tuple {
 	__be32			ref_tag;
 };
 
+struct se_device_queue {
+	spinlock_t		lock;
+	struct list_head	state_list;
+};
+
 struct se_cmd {
 	/* SAM response code being sent to initiator */
 	u8			scsi_status;
@@ -548,6 +553,8 @@ struct se_cmd {
 
 	struct list_head	state_list;
 	bool			state_active;
+	/* CPU the command was submitted on, completion work is queued there */
+	int			cpuid;
 
 	/* old task stop completion, consider merging with some of the above */
 	struct completion	task_stop_comp;
@@ -766,7 +773,8 @@ struct se_device {
 	atomic_t		dev_qf_count;
 	int			export_count;
 	spinlock_t		delayed_cmd_lock;
-	spinlock_t		execute_task_lock;
+	/* Per-CPU lists of commands in flight, see target_add_to_state_list() */
+	struct se_device_queue __percpu *queues;
 	spinlock_t		dev_reservation_lock;
 	unsigned int		dev_reservation_flags;
 #define DRF_SPC2_RESERVATIONS			0x00000001
@@ -786,7 +794,6 @@ struct se_device {
 	struct workqueue_struct *tmr_wq;
 	struct work_struct	qf_work_queue;
 	struct list_head	delayed_cmd_list;
-	struct list_head	state_list;
 	struct list_head	qf_cmd_list;
 	struct list_head	g_dev_node;
 	/* Pointer to associated SE HBA */
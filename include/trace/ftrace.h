@@ -679,7 +679,8 @@ perf_trace_##call(void *__data, proto)					\
 	__data_size = ftrace_get_offsets_##call(&__data_offsets, args); \
 									\
 	head = this_cpu_ptr(event_call->perf_events);			\
-	if (__builtin_constant_p(!__task) && !__task &&			\
+	if (!rcu_access_pointer(event_call->prog) &&			\
+	    __builtin_constant_p(!__task) && !__task &&			\
 				hlist_empty(head))			\
 		return;							\
 									\
@@ -697,8 +698,8 @@ perf_trace_##call(void *__data, proto)					\
 									\
 	{ assign; }							\
 									\
-	perf_trace_buf_submit(entry, __entry_size, rctx, __addr,	\
-		__count, &__regs, head, __task);			\
+	perf_trace_run_bpf_submit(entry, __entry_size, rctx, event_call,\
+		__addr, __count, &__regs, head, __task);		\
 }
 
 /*
@@ -699,9 +699,27 @@ __SYSCALL(__NR_sched_setattr, sys_sched_setattr)
 __SYSCALL(__NR_sched_getattr, sys_sched_getattr)
 #define __NR_renameat2 276
 __SYSCALL(__NR_renameat2, sys_renameat2)
+#define __NR_userfaultfd 277
+__SYSCALL(__NR_userfaultfd, sys_userfaultfd)
+#define __NR_statx 278
+__SYSCALL(__NR_statx, sys_statx)
+#define __NR_readdirplus 279
+__SYSCALL(__NR_readdirplus, sys_readdirplus)
+#define __NR_io_uring_setup 280
+__SYSCALL(__NR_io_uring_setup, sys_io_uring_setup)
+#define __NR_io_uring_enter 281
+__SYSCALL(__NR_io_uring_enter, sys_io_uring_enter)
+#define __NR_io_uring_register 282
+__SYSCALL(__NR_io_uring_register, sys_io_uring_register)
+#define __NR_epoll_ctl_batch 283
+__SYSCALL(__NR_epoll_ctl_batch, sys_epoll_ctl_batch)
+#define __NR_copy_file_range 284
+__SYSCALL(__NR_copy_file_range, sys_copy_file_range)
+#define __NR_bpf 285
+__SYSCALL(__NR_bpf, sys_bpf)
 
 #undef __NR_syscalls
-#define __NR_syscalls 277
+#define __NR_syscalls 286
 
 /*
  * All syscalls below here should go away really,
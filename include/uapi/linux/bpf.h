@@ -0,0 +1,264 @@
+/*
+ * Internal BPF instruction set, maps and the bpf(2) system call
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+#ifndef _UAPI__LINUX_BPF_H__
+#define _UAPI__LINUX_BPF_H__
+
+#include <linux/types.h>
+
+/* Extended instruction set based on top of classic BPF, the classic
+ * opcode fields come from <linux/filter.h>.
+ */
+
+/* instruction classes */
+#define BPF_ALU64	0x07	/* alu mode in double word width */
+
+/* ld/ldx fields */
+#define BPF_DW		0x18	/* double word */
+#define BPF_XADD	0xc0	/* exclusive add */
+
+/* alu/jmp fields */
+#define BPF_MOV		0xb0	/* mov reg to reg */
+#define BPF_ARSH	0xc0	/* sign extending arithmetic shift right */
+
+/* change endianness of a register */
+#define BPF_END		0xd0	/* flags for endianness conversion: */
+#define BPF_TO_LE	0x00	/* convert to little-endian */
+#define BPF_TO_BE	0x08	/* convert to big-endian */
+#define BPF_FROM_LE	BPF_TO_LE
+#define BPF_FROM_BE	BPF_TO_BE
+
+#define BPF_JNE		0x50	/* jump != */
+#define BPF_JSGT	0x60	/* SGT is signed '>', GT in x86 */
+#define BPF_JSGE	0x70	/* SGE is signed '>=', GE in x86 */
+#define BPF_CALL	0x80	/* function call */
+#define BPF_EXIT	0x90	/* function return */
+
+/* Register numbers */
+enum {
+	BPF_REG_0 = 0,
+	BPF_REG_1,
+	BPF_REG_2,
+	BPF_REG_3,
+	BPF_REG_4,
+	BPF_REG_5,
+	BPF_REG_6,
+	BPF_REG_7,
+	BPF_REG_8,
+	BPF_REG_9,
+	BPF_REG_10,
+	__MAX_BPF_REG,
+};
+
+/* BPF has 10 general purpose 64-bit registers and stack frame. */
+#define MAX_BPF_REG	__MAX_BPF_REG
+
+struct bpf_insn {
+	__u8	code;		/* opcode */
+	__u8	dst_reg:4;	/* dest register */
+	__u8	src_reg:4;	/* source register */
+	__s16	off;		/* signed offset */
+	__s32	imm;		/* signed immediate constant */
+};
+
+/* BPF_LD | BPF_IMM | BPF_DW loads a 64-bit constant and takes two
+ * instructions, the second one carries the upper half in imm and has
+ * all other fields zero. With src_reg == BPF_PSEUDO_MAP_FD the constant
+ * is a map file descriptor, which the kernel replaces by the map.
+ */
+#define BPF_PSEUDO_MAP_FD	1
+
+/* BPF syscall commands */
+enum bpf_cmd {
+	/* create a map and return a file descriptor that refers to it */
+	BPF_MAP_CREATE,
+
+	/* lookup key in a given map, copy the value out */
+	BPF_MAP_LOOKUP_ELEM,
+
+	/* create or update key/value pair in a given map */
+	BPF_MAP_UPDATE_ELEM,
+
+	/* find and delete element by key in a given map */
+	BPF_MAP_DELETE_ELEM,
+
+	/* lookup key in a given map and return the key of the next element,
+	 * a missing key returns the first one
+	 */
+	BPF_MAP_GET_NEXT_KEY,
+
+	/* verify and load a BPF program, return a file descriptor */
+	BPF_PROG_LOAD,
+};
+
+enum bpf_map_type {
+	BPF_MAP_TYPE_UNSPEC,
+	BPF_MAP_TYPE_HASH,
+	BPF_MAP_TYPE_ARRAY,
+};
+
+enum bpf_prog_type {
+	BPF_PROG_TYPE_UNSPEC,
+	BPF_PROG_TYPE_SOCKET_FILTER,
+	BPF_PROG_TYPE_SCHED_CLS,
+	BPF_PROG_TYPE_KPROBE,
+	BPF_PROG_TYPE_TRACEPOINT,
+};
+
+/* flags for BPF_MAP_UPDATE_ELEM command */
+#define BPF_ANY		0 /* create new element or update existing */
+#define BPF_NOEXIST	1 /* create new element if it didn't exist */
+#define BPF_EXIST	2 /* update existing element */
+
+union bpf_attr {
+	struct { /* anonymous struct used by BPF_MAP_CREATE command */
+		__u32	map_type;	/* one of enum bpf_map_type */
+		__u32	key_size;	/* size of key in bytes */
+		__u32	value_size;	/* size of value in bytes */
+		__u32	max_entries;	/* max number of entries in a map */
+	};
+
+	struct { /* anonymous struct used by BPF_MAP_*_ELEM commands */
+		__u32		map_fd;
+		__aligned_u64	key;
+		union {
+			__aligned_u64 value;
+			__aligned_u64 next_key;
+		};
+		__u64		flags;
+	};
+
+	struct { /* anonymous struct used by BPF_PROG_LOAD command */
+		__u32		prog_type;	/* one of enum bpf_prog_type */
+		__u32		insn_cnt;
+		__aligned_u64	insns;
+		__aligned_u64	license;
+		__u32		log_level;	/* verbosity of verifier */
+		__u32		log_size;	/* size of user buffer */
+		__aligned_u64	log_buf;	/* user supplied buffer */
+	};
+} __attribute__((aligned(8)));
+
+/* integer value in 'imm' field of BPF_CALL instruction selects which helper
+ * function eBPF program intends to call
+ */
+enum bpf_func_id {
+	BPF_FUNC_unspec,
+
+	/* void *map_lookup_elem(&map, &key)
+	 * Returns: pointer to map value or NULL
+	 */
+	BPF_FUNC_map_lookup_elem,
+
+	/* int map_update_elem(&map, &key, &value, flags)
+	 * Returns: 0 on success or negative error
+	 */
+	BPF_FUNC_map_update_elem,
+
+	/* int map_delete_elem(&map, &key)
+	 * Returns: 0 on success or negative error
+	 */
+	BPF_FUNC_map_delete_elem,
+
+	/* int skb_store_bytes(skb, offset, from, len, flags)
+	 * store bytes into packet
+	 * @skb: pointer to skb
+	 * @offset: offset within packet from skb->data
+	 * @from: pointer where to copy bytes from
+	 * @len: number of bytes to store into packet
+	 * @flags: bit 0 - if true, recompute skb->csum
+	 *         other bits - reserved
+	 * Returns: 0 on success or negative error
+	 */
+	BPF_FUNC_skb_store_bytes,
+
+	/* int l3_csum_replace(skb, offset, from, to, flags)
+	 * recompute IP checksum
+	 * @skb: pointer to skb
+	 * @offset: offset within packet where IP checksum is located
+	 * @from: old value of header field
+	 * @to: new value of header field
+	 * @flags: bits 0-3 - size of header field
+	 *         other bits - reserved
+	 * Returns: 0 on success or negative error
+	 */
+	BPF_FUNC_l3_csum_replace,
+
+	/* int l4_csum_replace(skb, offset, from, to, flags)
+	 * recompute TCP/UDP checksum
+	 * @skb: pointer to skb
+	 * @offset: offset within packet where TCP/UDP checksum is located
+	 * @from: old value of header field
+	 * @to: new value of header field
+	 * @flags: bits 0-3 - size of header field
+	 *         bit 4 - is pseudo header
+	 *         other bits - reserved
+	 * Returns: 0 on success or negative error
+	 */
+	BPF_FUNC_l4_csum_replace,
+
+	/* int clone_redirect(skb, ifindex, flags)
+	 * transmit a clone of the packet on another device, the packet
+	 * itself continues as usual
+	 * @skb: pointer to skb
+	 * @ifindex: ifindex of the net device to send the clone to
+	 * @flags: reserved, must be zero
+	 * Returns: 0 on success or negative error
+	 */
+	BPF_FUNC_clone_redirect,
+
+	/* int bpf_probe_read(void *dst, int size, void *src)
+	 * copy memory the program cannot access directly, e.g. what a
+	 * register of a kprobe points to, without faulting
+	 * Returns: 0 on success or negative error, dst is zeroed then
+	 */
+	BPF_FUNC_probe_read,
+
+	/* u64 bpf_ktime_get_ns(void)
+	 * Returns: nanoseconds of the clock ftrace stamps events with,
+	 * e.g. to measure the time between two events
+	 */
+	BPF_FUNC_ktime_get_ns,
+
+	/* u64 bpf_get_current_pid_tgid(void)
+	 * Returns: current->tgid << 32 | current->pid
+	 */
+	BPF_FUNC_get_current_pid_tgid,
+
+	/* u32 bpf_get_smp_processor_id(void)
+	 * Returns: the cpu the program runs on
+	 */
+	BPF_FUNC_get_smp_processor_id,
+	__BPF_FUNC_MAX_ID,
+};
+
+/* flags of BPF_FUNC_skb_store_bytes */
+#define BPF_F_RECOMPUTE_CSUM		(1ULL << 0)
+
+/* flags of BPF_FUNC_l3_csum_replace and BPF_FUNC_l4_csum_replace */
+#define BPF_F_HDR_FIELD_MASK		0xfULL
+#define BPF_F_PSEUDO_HDR		(1ULL << 4)
+
+/* user accessible mirror of in-kernel sk_buff, the context of socket
+ * filter and tc classifier programs. The layout is fixed, the kernel
+ * rewrites the accesses to the real sk_buff fields. Only aligned
+ * 32-bit accesses are allowed.
+ */
+struct __sk_buff {
+	__u32 len;
+	__u32 mark;
+	__u32 queue_mapping;
+	__u32 protocol;
+	__u32 vlan_tci;
+	__u32 vlan_proto;
+	__u32 priority;
+	__u32 ingress_ifindex;
+	__u32 tc_index;
+	__u32 cb[5];
+};
+
+#endif /* _UAPI__LINUX_BPF_H__ */
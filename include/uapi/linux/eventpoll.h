@@ -26,6 +26,15 @@
 #define EPOLL_CTL_DEL 2
 #define EPOLL_CTL_MOD 3
 
+/*
+ * Set exclusive wakeup mode for the target file descriptor: of the epoll
+ * instances waiting, exclusively, for an event of the same file, only one
+ * or a few are woken up, instead of all of them.  Only valid with
+ * EPOLL_CTL_ADD, with no other events than EPOLLIN, EPOLLOUT, EPOLLERR
+ * and EPOLLHUP, and EPOLLWAKEUP and EPOLLET; and not on an epoll file.
+ */
+#define EPOLLEXCLUSIVE (1 << 28)
+
 /*
  * Request the handling of system wakeup events so as to prevent system suspends
  * from happening while those events are being processed.
@@ -61,6 +70,16 @@ struct epoll_event {
 	__u64 data;
 } EPOLL_PACKED;
 
+/* An operation of epoll_ctl_batch() */
+struct epoll_ctl_cmd {
+	int flags;		/* none yet, must be 0 */
+	int op;			/* as the op of epoll_ctl() */
+	int fd;			/* as the fd of epoll_ctl() */
+	__u32 events;		/* as in struct epoll_event */
+	__u64 data;		/* as in struct epoll_event */
+	int result;		/* set to the result of the operation */
+} EPOLL_PACKED;
+
 #ifdef CONFIG_PM_SLEEP
 static inline void ep_take_care_of_epollwakeup(struct epoll_event *epev)
 {
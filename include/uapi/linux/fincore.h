@@ -0,0 +1,39 @@
+/*
+ * FS_IOC_FINCORE ioctl: page cache residency of a file, as extents.
+ */
+
+#ifndef _LINUX_FINCORE_H
+#define _LINUX_FINCORE_H
+
+#include <linux/types.h>
+
+struct fincore_extent {
+	__u64 fe_offset;	/* byte offset of the extent in the file */
+	__u64 fe_length;	/* length in bytes, a multiple of the page
+				 * size */
+	__u32 fe_flags;		/* FINCORE_* state of the pages */
+	__u32 fe_reserved;
+};
+
+struct fincore_range {
+	__u64 fr_start;		/* byte offset (inclusive) at which to
+				 * start looking (in) */
+	__u64 fr_length;	/* length in bytes of the range (in) */
+	__u32 fr_flags;		/* the one FINCORE_* state to report (in) */
+	__u32 fr_extent_count;	/* size of fr_extents array (in), number
+				 * of extents filled in (out) */
+	__u64 fr_next;		/* byte offset at which to continue, or the
+				 * end of the range when done (out) */
+	struct fincore_extent fr_extents[0]; /* array of extents (out) */
+};
+
+#define FINCORE_MAX_EXTENTS	(~0U / sizeof(struct fincore_extent))
+
+#define FINCORE_CACHED		0x00000001 /* in the page cache */
+#define FINCORE_DIRTY		0x00000002 /* dirty, not yet written back */
+#define FINCORE_WRITEBACK	0x00000004 /* being written back */
+
+#define FINCORE_FLAGS_ALL	(FINCORE_CACHED | FINCORE_DIRTY | \
+				 FINCORE_WRITEBACK)
+
+#endif /* _LINUX_FINCORE_H */
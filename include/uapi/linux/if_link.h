@@ -145,12 +145,24 @@ enum {
 	IFLA_CARRIER,
 	IFLA_PHYS_PORT_ID,
 	IFLA_CARRIER_CHANGES,
+	IFLA_RX_FILTER,		/* struct sock_filter[], empty to detach */
 	__IFLA_MAX
 };
 
 
 #define IFLA_MAX (__IFLA_MAX - 1)
 
+/* IFLA_RX_FILTER
+ *
+ * A classic BPF program run by the driver on each received frame while it
+ * is still in the Rx buffer, before an skb is built for it.  Offsets are
+ * relative to the Ethernet header, as on a SOCK_RAW packet socket.  The
+ * return value of the program decides what happens to the frame.
+ */
+#define RX_FILTER_DROP	0	/* drop the frame */
+#define RX_FILTER_TX	1	/* send it back out of the receiving port */
+#define RX_FILTER_PASS	2	/* pass it to the stack, as any other value */
+
 /* backwards compatibility for userspace */
 #ifndef __KERNEL__
 #define IFLA_RTA(r)  ((struct rtattr*)(((char*)(r)) + NLMSG_ALIGN(sizeof(struct ifinfomsg))))
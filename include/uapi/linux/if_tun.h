@@ -58,6 +58,8 @@
 #define TUNSETQUEUE  _IOW('T', 217, int)
 #define TUNSETIFINDEX	_IOW('T', 218, unsigned int)
 #define TUNGETFILTER _IOR('T', 219, struct sock_fprog)
+#define TUNSENDMMSG  _IOW('T', 220, struct tun_mmsg)
+#define TUNRECVMMSG  _IOW('T', 221, struct tun_mmsg)
 
 /* TUNSETIFF ifr flags */
 #define IFF_TUN		0x0001
@@ -91,6 +93,27 @@ struct tun_pi {
 	__be16 proto;
 };
 
+/*
+ * Batched packet I/O (TUNSENDMMSG and TUNRECVMMSG).  Each message is one
+ * packet, laid out as for write() and read().  The ioctl returns the
+ * number of messages transferred and sets len in each of them.  Only
+ * the first receive may block.
+ */
+#define TUN_MMSG_MAX		256	/* messages per call */
+#define TUN_MMSG_DONTWAIT	0x0001	/* do not block, as O_NONBLOCK */
+
+struct tun_msg {
+	__u64	iov;		/* struct iovec __user * */
+	__u32	iovlen;		/* number of iovecs */
+	__u32	len;		/* bytes transferred */
+};
+
+struct tun_mmsg {
+	__u64	msgs;		/* struct tun_msg __user * */
+	__u32	count;		/* number of messages */
+	__u32	flags;		/* TUN_MMSG_ flags */
+};
+
 /*
  * Filter spec (used for SETXXFILTER ioctls)
  * This stuff is applicable only to the TAP (Ethernet) devices.
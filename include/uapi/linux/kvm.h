@@ -171,6 +171,7 @@ struct kvm_pit_config {
 #define KVM_EXIT_WATCHDOG         21
 #define KVM_EXIT_S390_TSCH        22
 #define KVM_EXIT_EPR              23
+#define KVM_EXIT_DIRTY_RING_FULL  24
 
 /* For KVM_EXIT_INTERNAL_ERROR */
 /* Emulate instruction failed. */
@@ -373,6 +374,21 @@ struct kvm_dirty_log {
 	};
 };
 
+/*
+ * One entry of a vcpu's dirty ring, mapped at KVM_DIRTY_LOG_PAGE_OFFSET of
+ * the vcpu fd.  KVM sets KVM_DIRTY_GFN_F_DIRTY once slot and offset are
+ * valid; userspace sets KVM_DIRTY_GFN_F_RESET when it has collected the
+ * entry, and KVM_RESET_DIRTY_RINGS hands it back to KVM.
+ */
+#define KVM_DIRTY_GFN_F_DIRTY	(1 << 0)
+#define KVM_DIRTY_GFN_F_RESET	(1 << 1)
+
+struct kvm_dirty_gfn {
+	__u32 flags;
+	__u32 slot;	/* memslot id */
+	__u64 offset;	/* page offset in the memslot */
+};
+
 /* for KVM_SET_SIGNAL_MASK */
 struct kvm_signal_mask {
 	__u32 len;
@@ -743,6 +759,7 @@ struct kvm_ppc_smmu_info {
 #define KVM_CAP_IOAPIC_POLARITY_IGNORED 97
 #define KVM_CAP_ENABLE_CAP_VM 98
 #define KVM_CAP_S390_IRQCHIP 99
+#define KVM_CAP_DIRTY_LOG_RING 100
 
 #ifdef KVM_CAP_IRQ_ROUTING
 
@@ -1027,6 +1044,8 @@ struct kvm_s390_ucas_mapping {
 
 /* ioctl for vm fd */
 #define KVM_CREATE_DEVICE	  _IOWR(KVMIO,  0xe0, struct kvm_create_device)
+/* Available with KVM_CAP_DIRTY_LOG_RING */
+#define KVM_RESET_DIRTY_RINGS	  _IO(KVMIO,   0xc7)
 
 /* ioctls for fds returned by KVM_CREATE_DEVICE */
 #define KVM_SET_DEVICE_ATTR	  _IOW(KVMIO,  0xe1, struct kvm_device_attr)
@@ -152,4 +152,19 @@
 #define PR_SET_THP_DISABLE	41
 #define PR_GET_THP_DISABLE	42
 
+/*
+ * Give the process its own hash table for PROCESS_PRIVATE futexes,
+ * instead of sharing the global one with everybody else.
+ */
+#define PR_FUTEX_HASH		43
+# define PR_FUTEX_HASH_SET_SLOTS	1	/* only while single threaded */
+# define PR_FUTEX_HASH_GET_SLOTS	2
+
+/*
+ * Map the read-only executable segments of subsequently exec'ed ELF
+ * binaries with transparent huge pages.  Inherited across fork and exec.
+ */
+#define PR_SET_HUGE_TEXT	44
+#define PR_GET_HUGE_TEXT	45
+
 #endif /* _LINUX_PRCTL_H */
@@ -0,0 +1,113 @@
+/* taskdiag.h - dumping per-task information in binary form
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2.1 of the GNU Lesser General Public License
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef _LINUX_TASKDIAG_H
+#define _LINUX_TASKDIAG_H
+
+#include <linux/types.h>
+#include <linux/cgroupstats.h>
+
+/*
+ * TASKDIAG_CMD_GET is a dump request on the taskstats genetlink family.
+ * The kernel answers with one TASKDIAG_CMD_NEW message per task, carrying
+ * the attribute groups selected by TASKDIAG_CMD_ATTR_SHOW.
+ */
+
+#define TASKDIAG_COMM_LEN	16
+
+/* TASKDIAG_TYPE_BASE */
+struct taskdiag_base {
+	__u32	tgid;
+	__u32	pid;
+	__u32	ppid;
+	__u32	tpid;			/* tracer, or 0 */
+	__u32	sid;
+	__u32	pgid;
+	__u8	state;			/* as in /proc/<pid>/stat */
+	char	comm[TASKDIAG_COMM_LEN];
+};
+
+/* TASKDIAG_TYPE_CRED */
+struct taskdiag_creds {
+	__u32	uid;
+	__u32	euid;
+	__u32	suid;
+	__u32	fsuid;
+	__u32	gid;
+	__u32	egid;
+	__u32	sgid;
+	__u32	fsgid;
+};
+
+/* TASKDIAG_TYPE_VM, all in pages */
+struct taskdiag_vm {
+	__u64	total_vm;
+	__u64	hiwater_vm;
+	__u64	locked_vm;
+	__u64	pinned_vm;
+	__u64	shared_vm;
+	__u64	exec_vm;
+	__u64	stack_vm;
+	__u64	rss_anon;
+	__u64	rss_file;
+	__u64	hiwater_rss;
+	__u64	swap_ents;
+};
+
+/*
+ * Commands sent from userspace
+ * Not versioned. New commands should only be inserted at the enum's end
+ * prior to __TASKDIAG_CMD_MAX
+ */
+
+enum {
+	TASKDIAG_CMD_UNSPEC = __CGROUPSTATS_CMD_MAX,	/* Reserved */
+	TASKDIAG_CMD_GET,		/* user->kernel dump request */
+	TASKDIAG_CMD_NEW,		/* kernel->user, one per task */
+	__TASKDIAG_CMD_MAX,
+};
+
+#define TASKDIAG_CMD_MAX (__TASKDIAG_CMD_MAX - 1)
+
+enum {
+	TASKDIAG_TYPE_UNSPEC = 0,	/* Reserved */
+	TASKDIAG_TYPE_BASE,		/* struct taskdiag_base */
+	TASKDIAG_TYPE_CRED,		/* struct taskdiag_creds */
+	TASKDIAG_TYPE_STATS,		/* struct taskstats */
+	TASKDIAG_TYPE_VM,		/* struct taskdiag_vm */
+	__TASKDIAG_TYPE_MAX,
+};
+
+#define TASKDIAG_TYPE_MAX (__TASKDIAG_TYPE_MAX - 1)
+
+#define TASKDIAG_SHOW_BASE	(1ULL << TASKDIAG_TYPE_BASE)
+#define TASKDIAG_SHOW_CRED	(1ULL << TASKDIAG_TYPE_CRED)
+#define TASKDIAG_SHOW_STATS	(1ULL << TASKDIAG_TYPE_STATS)
+#define TASKDIAG_SHOW_VM	(1ULL << TASKDIAG_TYPE_VM)
+
+/* Values of TASKDIAG_CMD_ATTR_DUMP */
+enum {
+	TASKDIAG_DUMP_ALL = 0,		/* every task */
+	TASKDIAG_DUMP_PGID,		/* tasks of process group ARG */
+	TASKDIAG_DUMP_CGROUP,		/* tasks of cgroup directory fd ARG */
+};
+
+enum {
+	TASKDIAG_CMD_ATTR_UNSPEC = 0,
+	TASKDIAG_CMD_ATTR_SHOW,		/* u64 mask of TASKDIAG_SHOW_* */
+	TASKDIAG_CMD_ATTR_DUMP,		/* u32 TASKDIAG_DUMP_*, default ALL */
+	TASKDIAG_CMD_ATTR_DUMP_ARG,	/* u32 pgid or cgroup fd */
+	__TASKDIAG_CMD_ATTR_MAX,
+};
+
+#define TASKDIAG_CMD_ATTR_MAX (__TASKDIAG_CMD_ATTR_MAX - 1)
+
+#endif /* _LINUX_TASKDIAG_H */
@@ -112,6 +112,8 @@ enum {
 #define TCP_FASTOPEN		23	/* Enable FastOpen on listeners */
 #define TCP_TIMESTAMP		24
 #define TCP_NOTSENT_LOWAT	25	/* limit number of unsent bytes in write queue */
+#define TCP_ZEROCOPY_RECEIVE	26	/* map received payload pages */
+#define TCP_ULP			27	/* Attach a ULP to a TCP connection */
 
 struct tcp_repair_opt {
 	__u32	opt_code;
@@ -202,4 +204,17 @@ struct tcp_md5sig {
 	__u8	tcpm_key[TCP_MD5SIG_MAXKEYLEN];		/* key (binary) */
 };
 
+/* getsockopt(fd, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, ...)
+ *
+ * address must point into a region returned by mmap() on the socket.
+ * On return, length holds the number of bytes mapped there, and
+ * recv_skip_hint the number of bytes to read with recvmsg() before
+ * mapping can resume, e.g. for data that is not page aligned.
+ */
+struct tcp_zerocopy_receive {
+	__u64 address;		/* in: address of mapping */
+	__u32 length;		/* in/out: number of bytes to map/mapped */
+	__u32 recv_skip_hint;	/* out: amount of bytes to skip */
+};
+
 #endif /* _UAPI_LINUX_TCP_H */
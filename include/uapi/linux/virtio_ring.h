@@ -58,6 +58,23 @@
  * at the end of the used ring. Guest should ignore the used->flags field. */
 #define VIRTIO_RING_F_EVENT_IDX		29
 
+/* The Guest lays the ring out as a single array of descriptors, which the
+ * Host writes back in place as it uses them.  See struct vring_packed. */
+#define VIRTIO_RING_F_PACKED		31
+
+/* Bit numbers of the avail and used wrap counters in a packed descriptor's
+ * flags, next to the VRING_DESC_F_* flags above. */
+#define VRING_PACKED_DESC_F_AVAIL	7
+#define VRING_PACKED_DESC_F_USED	15
+
+/* Values of the flags field in a packed ring's event suppression areas. */
+#define VRING_PACKED_EVENT_FLAG_ENABLE	0x0
+#define VRING_PACKED_EVENT_FLAG_DISABLE	0x1
+/* Only notify for the descriptor given in off_wrap (needs EVENT_IDX). */
+#define VRING_PACKED_EVENT_FLAG_DESC	0x2
+/* Bit number of the wrap counter in off_wrap, below it is the offset. */
+#define VRING_PACKED_EVENT_F_WRAP_CTR	15
+
 /* Virtio ring descriptors: 16 bytes.  These can chain together via "next". */
 struct vring_desc {
 	/* Address (guest-physical). */
@@ -146,6 +163,76 @@ static inline unsigned vring_size(unsigned int num, unsigned long align)
 		+ sizeof(__u16) * 3 + sizeof(struct vring_used_elem) * num;
 }
 
+/* Packed ring descriptors: 16 bytes.  The Guest makes one available by
+ * setting its AVAIL flag to, and its USED flag to the inverse of, its wrap
+ * counter, which flips every time it goes round the ring.  The Host marks it
+ * used by making both flags equal to its own wrap counter, writing id and len
+ * of the buffer into the first descriptor it took for it. */
+struct vring_packed_desc {
+	/* Address (guest-physical). */
+	__u64 addr;
+	/* Length. */
+	__u32 len;
+	/* Buffer id, echoed back by the Host. */
+	__u16 id;
+	/* The flags as indicated above, plus the wrap counters. */
+	__u16 flags;
+};
+
+/* Where each side tells the other when it wants to be notified. */
+struct vring_packed_desc_event {
+	/* Descriptor offset and wrap counter, for FLAG_DESC. */
+	__u16 off_wrap;
+	/* One of the VRING_PACKED_EVENT_FLAG_* values. */
+	__u16 flags;
+};
+
+struct vring_packed {
+	unsigned int num;
+
+	struct vring_packed_desc *desc;
+
+	/* Written by the Guest: when to interrupt it. */
+	struct vring_packed_desc_event *driver;
+
+	/* Written by the Host: when to kick it. */
+	struct vring_packed_desc_event *device;
+};
+
+/* The packed ring is laid out as
+ *
+ * struct vring_packed
+ * {
+ *	struct vring_packed_desc desc[num];
+ *	struct vring_packed_desc_event driver;
+ *
+ *	// Padding to the next align boundary.
+ *	char pad[];
+ *
+ *	struct vring_packed_desc_event device;
+ * };
+ *
+ * which never takes more room than vring_size() for the same num and align,
+ * so memory set up for the split ring fits either layout. */
+static inline void vring_packed_init(struct vring_packed *vr,
+				     unsigned int num, void *p,
+				     unsigned long align)
+{
+	vr->num = num;
+	vr->desc = p;
+	vr->driver = p + num * sizeof(struct vring_packed_desc);
+	vr->device = (void *)(((unsigned long)(vr->driver + 1) + align - 1)
+			      & ~(align - 1));
+}
+
+static inline unsigned vring_packed_size(unsigned int num,
+					 unsigned long align)
+{
+	return ((sizeof(struct vring_packed_desc) * num
+		 + sizeof(struct vring_packed_desc_event) + align - 1)
+		& ~(align - 1)) + sizeof(struct vring_packed_desc_event);
+}
+
 /* The following is used with USED_EVENT_IDX and AVAIL_EVENT_IDX */
 /* Assuming a given event_idx value from the other size, if
  * we have just incremented index from old to new_idx,
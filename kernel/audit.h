@@ -115,6 +115,7 @@ struct audit_proctitle {
 struct audit_context {
 	int		    dummy;	/* must be the first element */
 	int		    in_syscall;	/* 1 if task is in a syscall */
+	int		    deferred;	/* 1 if in a syscall no rule matches */
 	enum audit_state    state, current_state;
 	unsigned int	    serial;     /* serial number for record */
 	int		    major;      /* syscall number */
@@ -268,6 +269,7 @@ extern int selinux_audit_rule_update(void);
 extern struct mutex audit_filter_mutex;
 extern void audit_free_rule_rcu(struct rcu_head *);
 extern struct list_head audit_filter_list[];
+extern u32 audit_syscall_mask[AUDIT_BITMASK_SIZE];
 
 extern struct audit_entry *audit_dupe_rule(struct audit_krule *old);
 
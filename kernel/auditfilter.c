@@ -850,6 +850,32 @@ out:
 static u64 prio_low = ~0ULL/2;
 static u64 prio_high = ~0ULL/2 - 1;
 
+#ifdef CONFIG_AUDITSYSCALL
+/*
+ * Recompute audit_syscall_mask from the syscall rules.  Called with
+ * audit_filter_mutex held, once a rule was added or removed.  Rules
+ * dropped behind our back by watches and trees only leave stale bits,
+ * which cost the deferral but nothing else.
+ */
+static void audit_update_syscall_mask(void)
+{
+	static const int lists[] = { AUDIT_FILTER_ENTRY, AUDIT_FILTER_EXIT };
+	u32 mask[AUDIT_BITMASK_SIZE] = { };
+	struct audit_krule *r;
+	int i, l;
+
+	for (l = 0; l < ARRAY_SIZE(lists); l++) {
+		list_for_each_entry(r, &audit_rules_list[lists[l]], list) {
+			for (i = 0; i < AUDIT_BITMASK_SIZE; i++)
+				mask[i] |= r->mask[i];
+		}
+	}
+
+	for (i = 0; i < AUDIT_BITMASK_SIZE; i++)
+		ACCESS_ONCE(audit_syscall_mask[i]) = mask[i];
+}
+#endif
+
 /* Add rule to given filterlist if not a duplicate. */
 static inline int audit_add_rule(struct audit_entry *entry)
 {
@@ -924,6 +950,8 @@ static inline int audit_add_rule(struct audit_entry *entry)
 
 	if (!audit_match_signal(entry))
 		audit_signals++;
+
+	audit_update_syscall_mask();
 #endif
 	mutex_unlock(&audit_filter_mutex);
 
@@ -976,6 +1004,8 @@ static inline int audit_del_rule(struct audit_entry *entry)
 
 	if (!audit_match_signal(entry))
 		audit_signals--;
+
+	audit_update_syscall_mask();
 #endif
 	mutex_unlock(&audit_filter_mutex);
 
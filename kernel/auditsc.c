@@ -88,6 +88,9 @@
 /* number of audit rules */
 int audit_n_rules;
 
+/* syscalls some entry or exit rule may match, see audit_syscall_may_match() */
+u32 audit_syscall_mask[AUDIT_BITMASK_SIZE];
+
 /* determines whether we collect data for signals sent */
 int audit_signals;
 
@@ -744,6 +747,21 @@ static int audit_in_mask(const struct audit_krule *rule, unsigned long val)
 	return rule->mask[word] & bit;
 }
 
+/*
+ * Whether a rule may match syscall @major.  Rules only match syscalls
+ * in their mask, so for any other one, entry and exit filtering are
+ * known to find nothing before they start.
+ */
+static bool audit_syscall_may_match(int major)
+{
+	int word = AUDIT_WORD(major);
+
+	if (major < 0 || word >= AUDIT_BITMASK_SIZE)
+		return true;
+
+	return ACCESS_ONCE(audit_syscall_mask[word]) & AUDIT_BIT(major);
+}
+
 /* At syscall entry and exit time, this filter is called if the
  * audit_state is not low enough that auditing cannot take place, but is
  * also not high enough that we already know we have to write an audit
@@ -1503,6 +1521,16 @@ void __audit_free(struct task_struct *tsk)
 	audit_free_context(context);
 }
 
+static void audit_start_syscall(struct audit_context *context,
+				enum audit_state state)
+{
+	context->serial     = 0;
+	context->ctime      = CURRENT_TIME;
+	context->in_syscall = 1;
+	context->current_state  = state;
+	context->ppid       = 0;
+}
+
 /**
  * audit_syscall_entry - fill in an audit record at syscall entry
  * @arch: architecture type
@@ -1545,6 +1573,17 @@ void __audit_syscall_entry(int arch, int major,
 
 	state = context->state;
 	context->dummy = !audit_n_rules;
+
+	/*
+	 * No rule can match, so unless something else logs a record in
+	 * the syscall, it goes unaudited.  Leave the context to be set up
+	 * by auditsc_get_stamp() when that happens.
+	 */
+	if (state == AUDIT_BUILD_CONTEXT && !audit_syscall_may_match(major)) {
+		context->deferred = 1;
+		return;
+	}
+
 	if (!context->dummy && state == AUDIT_BUILD_CONTEXT) {
 		context->prio = 0;
 		state = audit_filter_syscall(tsk, context, &audit_filter_list[AUDIT_FILTER_ENTRY]);
@@ -1552,11 +1591,7 @@ void __audit_syscall_entry(int arch, int major,
 	if (state == AUDIT_DISABLED)
 		return;
 
-	context->serial     = 0;
-	context->ctime      = CURRENT_TIME;
-	context->in_syscall = 1;
-	context->current_state  = state;
-	context->ppid       = 0;
+	audit_start_syscall(context, state);
 }
 
 /**
@@ -1588,6 +1623,7 @@ void __audit_syscall_exit(int success, long return_code)
 		audit_log_exit(context, tsk);
 
 	context->in_syscall = 0;
+	context->deferred = 0;
 	context->prio = context->state == AUDIT_RECORD_CONTEXT ? ~0ULL : 0;
 
 	if (!list_empty(&context->killed_trees))
@@ -2008,8 +2044,13 @@ EXPORT_SYMBOL_GPL(__audit_inode_child);
 int auditsc_get_stamp(struct audit_context *ctx,
 		       struct timespec *t, unsigned int *serial)
 {
-	if (!ctx->in_syscall)
-		return 0;
+	if (!ctx->in_syscall) {
+		if (!ctx->deferred)
+			return 0;
+		/* a record after all, see __audit_syscall_entry() */
+		ctx->deferred = 0;
+		audit_start_syscall(ctx, ctx->state);
+	}
 	if (!ctx->serial)
 		ctx->serial = audit_serial();
 	t->tv_sec  = ctx->ctime.tv_sec;
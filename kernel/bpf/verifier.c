@@ -0,0 +1,1407 @@
+/*
+ * eBPF verifier: static analysis of programs loaded through bpf(2)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/file.h>
+#include <linux/mutex.h>
+
+/* bpf_check() is a static code analyzer that walks eBPF program
+ * instruction by instruction and updates register/stack state.
+ *
+ * Only forward jumps are accepted, so the program is a DAG and a single
+ * walk in instruction order sees every instruction after all of its
+ * predecessors. The state at an instruction is the merge of the state
+ * falling through into it and the states of all jumps that target it:
+ * registers whose types disagree become plain scalars (UNKNOWN_VALUE) or
+ * unreadable (NOT_INIT), so every path is covered without exploring
+ * the paths one by one.
+ *
+ * Registers hold either scalars or pointers:
+ *  - R1 starts as PTR_TO_CTX and R10 as FRAME_PTR, the others are
+ *    NOT_INIT and cannot be read before they are written;
+ *  - R10 is read only, FRAME_PTR plus a constant is PTR_TO_STACK, any
+ *    other arithmetic on a pointer yields a scalar, which can never be
+ *    dereferenced;
+ *  - loads and stores go through PTR_TO_CTX (checked by the program
+ *    type), PTR_TO_STACK (within the 512 byte frame, reads only from
+ *    initialized bytes) or PTR_TO_MAP_VALUE (within value_size);
+ *  - bpf_map_lookup_elem() returns PTR_TO_MAP_VALUE_OR_NULL, which has
+ *    to be compared against zero before it becomes PTR_TO_MAP_VALUE.
+ *
+ * Register spills to the stack are tracked per 8-byte slot so that
+ * pointers survive being saved and restored. Helper calls are checked
+ * against their bpf_func_proto and scratch R1-R5. Immediates moved into
+ * registers are remembered (CONST_IMM), so buffer sizes passed to
+ * helpers are known constants.
+ *
+ * Once the program is accepted, the loads and stores through PTR_TO_CTX
+ * are rewritten by the program type, e.g. from struct __sk_buff to the
+ * real struct sk_buff layout.
+ *
+ * Map file descriptors loaded with BPF_LD | BPF_IMM | BPF_DW and
+ * src_reg == BPF_PSEUDO_MAP_FD are replaced by map pointers, the maps
+ * are held by the program until it is freed.
+ */
+
+/* the program may refer to at most this many distinct maps */
+#define MAX_USED_MAPS	64
+
+#define BPF_REG_SIZE	8	/* size of eBPF register in bytes */
+
+struct reg_state {
+	enum bpf_reg_type type;
+	union {
+		/* valid when type == PTR_TO_STACK */
+		int off;
+
+		/* valid when type == CONST_IMM */
+		s64 imm;
+
+		/* valid when type == CONST_PTR_TO_MAP | PTR_TO_MAP_VALUE |
+		 *   PTR_TO_MAP_VALUE_OR_NULL
+		 */
+		struct bpf_map *map_ptr;
+	};
+};
+
+enum bpf_stack_slot_type {
+	STACK_INVALID,	/* nothing was stored in this stack slot */
+	STACK_SPILL,	/* register spilled into stack */
+	STACK_MISC	/* BPF program wrote some data into this slot */
+};
+
+/* state of the registers and the stack at one instruction */
+struct verifier_state {
+	struct reg_state regs[MAX_BPF_REG];
+	u8 stack_slot_type[MAX_BPF_STACK];
+	struct reg_state spilled_regs[MAX_BPF_STACK / BPF_REG_SIZE];
+};
+
+struct verifier_env {
+	struct sk_filter *prog;		/* eBPF program being verified */
+	struct verifier_state cur;	/* current verifier state */
+	struct verifier_state tmp;	/* state of a taken branch */
+	struct verifier_state **branch;	/* pending states of jump targets */
+	bool *ctx_access;		/* insn loads or stores bpf_context */
+	int insn_idx;			/* insn being verified */
+	struct bpf_map *used_maps[MAX_USED_MAPS]; /* array of map's used */
+	u32 used_map_cnt;		/* number of used maps */
+	u32 log_level;
+	char *log_buf;
+	u32 log_size;
+	u32 log_len;
+};
+
+/* verbose verifier prints what it's seeing
+ * bpf_check() is called under lock, so no race to access these fields
+ */
+static __printf(2, 3) void verbose(struct verifier_env *env,
+				   const char *fmt, ...)
+{
+	va_list args;
+
+	if (!env->log_level || env->log_len + 1 >= env->log_size)
+		return;
+
+	va_start(args, fmt);
+	env->log_len += vscnprintf(env->log_buf + env->log_len,
+				   env->log_size - env->log_len, fmt, args);
+	va_end(args);
+}
+
+/* string representation of 'enum bpf_reg_type' */
+static const char * const reg_type_str[] = {
+	[NOT_INIT]		= "?",
+	[UNKNOWN_VALUE]		= "inv",
+	[PTR_TO_CTX]		= "ctx",
+	[CONST_PTR_TO_MAP]	= "map_ptr",
+	[PTR_TO_MAP_VALUE]	= "map_value",
+	[PTR_TO_MAP_VALUE_OR_NULL] = "map_value_or_null",
+	[FRAME_PTR]		= "fp",
+	[PTR_TO_STACK]		= "fp",
+	[CONST_IMM]		= "imm",
+};
+
+static void mark_reg(struct reg_state *reg, enum bpf_reg_type type)
+{
+	memset(reg, 0, sizeof(*reg));
+	reg->type = type;
+}
+
+static void init_state(struct verifier_state *state)
+{
+	int i;
+
+	memset(state, 0, sizeof(*state));
+	for (i = 0; i < MAX_BPF_REG; i++)
+		mark_reg(&state->regs[i], NOT_INIT);
+
+	/* frame pointer */
+	mark_reg(&state->regs[BPF_REG_10], FRAME_PTR);
+
+	/* 1st arg to a function */
+	mark_reg(&state->regs[BPF_REG_1], PTR_TO_CTX);
+}
+
+static bool is_stack_ptr(const struct reg_state *reg)
+{
+	return reg->type == FRAME_PTR || reg->type == PTR_TO_STACK;
+}
+
+static int stack_ptr_off(const struct reg_state *reg)
+{
+	return reg->type == FRAME_PTR ? 0 : reg->off;
+}
+
+static bool regs_equal(const struct reg_state *a, const struct reg_state *b)
+{
+	if (a->type != b->type)
+		return false;
+
+	switch (a->type) {
+	case PTR_TO_STACK:
+		return a->off == b->off;
+	case CONST_IMM:
+		return a->imm == b->imm;
+	case CONST_PTR_TO_MAP:
+	case PTR_TO_MAP_VALUE:
+	case PTR_TO_MAP_VALUE_OR_NULL:
+		return a->map_ptr == b->map_ptr;
+	default:
+		return true;
+	}
+}
+
+/* merge register state 'src' of another path into 'dst' */
+static void merge_reg(struct reg_state *dst, const struct reg_state *src)
+{
+	if (regs_equal(dst, src))
+		return;
+
+	if (dst->type == NOT_INIT || src->type == NOT_INIT) {
+		mark_reg(dst, NOT_INIT);
+	} else if ((dst->type == PTR_TO_MAP_VALUE ||
+		    dst->type == PTR_TO_MAP_VALUE_OR_NULL) &&
+		   (src->type == PTR_TO_MAP_VALUE ||
+		    src->type == PTR_TO_MAP_VALUE_OR_NULL) &&
+		   dst->map_ptr == src->map_ptr) {
+		/* the pointer may be NULL on one of the paths */
+		dst->type = PTR_TO_MAP_VALUE_OR_NULL;
+	} else {
+		/* both were written, but the value is not a usable pointer */
+		mark_reg(dst, UNKNOWN_VALUE);
+	}
+}
+
+static void merge_state(struct verifier_state *dst,
+			const struct verifier_state *src)
+{
+	int i, j;
+
+	for (i = 0; i < MAX_BPF_REG; i++)
+		merge_reg(&dst->regs[i], &src->regs[i]);
+
+	for (i = 0; i < MAX_BPF_STACK; i += BPF_REG_SIZE) {
+		struct reg_state *spill = &dst->spilled_regs[i / BPF_REG_SIZE];
+
+		if (dst->stack_slot_type[i] == STACK_SPILL &&
+		    src->stack_slot_type[i] == STACK_SPILL) {
+			merge_reg(spill, &src->spilled_regs[i / BPF_REG_SIZE]);
+			if (spill->type != UNKNOWN_VALUE)
+				continue;
+			/* slot is initialized on both paths, but no longer
+			 * holds a pointer
+			 */
+			mark_reg(spill, NOT_INIT);
+			for (j = 0; j < BPF_REG_SIZE; j++)
+				dst->stack_slot_type[i + j] = STACK_MISC;
+			continue;
+		}
+
+		for (j = i; j < i + BPF_REG_SIZE; j++) {
+			u8 *dt = &dst->stack_slot_type[j];
+			u8 st = src->stack_slot_type[j];
+
+			if (*dt == st)
+				continue;
+			if (*dt == STACK_INVALID || st == STACK_INVALID)
+				*dt = STACK_INVALID;
+			else
+				*dt = STACK_MISC;
+		}
+		mark_reg(spill, NOT_INIT);
+	}
+}
+
+enum reg_arg_type {
+	SRC_OP,		/* register is used as source operand */
+	DST_OP,		/* register is used as destination operand */
+	DST_OP_NO_MARK	/* same as above, check only, don't mark */
+};
+
+static int check_reg_arg(struct verifier_env *env, u32 regno,
+			 enum reg_arg_type t)
+{
+	struct reg_state *regs = env->cur.regs;
+
+	if (regno >= MAX_BPF_REG) {
+		verbose(env, "R%d is invalid\n", regno);
+		return -EINVAL;
+	}
+
+	if (t == SRC_OP) {
+		/* check whether register used as source operand can be read */
+		if (regs[regno].type == NOT_INIT) {
+			verbose(env, "R%d !read_ok\n", regno);
+			return -EACCES;
+		}
+	} else {
+		/* check whether register used as dest operand can be written */
+		if (regno == BPF_REG_10) {
+			verbose(env, "frame pointer is read only\n");
+			return -EACCES;
+		}
+		if (t == DST_OP)
+			mark_reg(&regs[regno], UNKNOWN_VALUE);
+	}
+	return 0;
+}
+
+static int bpf_size_to_bytes(int bpf_size)
+{
+	if (bpf_size == BPF_W)
+		return 4;
+	else if (bpf_size == BPF_H)
+		return 2;
+	else if (bpf_size == BPF_B)
+		return 1;
+	else if (bpf_size == BPF_DW)
+		return 8;
+	else
+		return -EINVAL;
+}
+
+/* check_stack_read/write functions track spill/fill of registers,
+ * stack boundary and alignment are checked in check_mem_access()
+ */
+static void check_stack_write(struct verifier_env *env, int off, int size,
+			      int value_regno)
+{
+	struct verifier_state *state = &env->cur;
+	int slot = (MAX_BPF_STACK + off) / BPF_REG_SIZE;
+	int i;
+
+	/* a partial write clobbers a spilled register */
+	if (state->stack_slot_type[slot * BPF_REG_SIZE] == STACK_SPILL) {
+		for (i = 0; i < BPF_REG_SIZE; i++)
+			state->stack_slot_type[slot * BPF_REG_SIZE + i] =
+				STACK_MISC;
+		mark_reg(&state->spilled_regs[slot], NOT_INIT);
+	}
+
+	if (value_regno >= 0 && size == BPF_REG_SIZE &&
+	    state->regs[value_regno].type != UNKNOWN_VALUE) {
+		/* register containing pointer is being spilled into stack */
+		state->spilled_regs[slot] = state->regs[value_regno];
+
+		for (i = 0; i < BPF_REG_SIZE; i++)
+			state->stack_slot_type[MAX_BPF_STACK + off + i] =
+				STACK_SPILL;
+	} else {
+		/* regular write of data into stack */
+		for (i = 0; i < size; i++)
+			state->stack_slot_type[MAX_BPF_STACK + off + i] =
+				STACK_MISC;
+	}
+}
+
+static int check_stack_read(struct verifier_env *env, int off, int size,
+			    int value_regno)
+{
+	struct verifier_state *state = &env->cur;
+	u8 *slot_type = &state->stack_slot_type[MAX_BPF_STACK + off];
+	int i;
+
+	if (slot_type[0] == STACK_SPILL && size == BPF_REG_SIZE) {
+		/* restore register state from stack */
+		if (value_regno >= 0)
+			state->regs[value_regno] =
+				state->spilled_regs[(MAX_BPF_STACK + off) /
+						    BPF_REG_SIZE];
+		return 0;
+	}
+
+	for (i = 0; i < size; i++) {
+		if (slot_type[i] == STACK_INVALID) {
+			verbose(env, "invalid read from stack off %d+%d size %d\n",
+				off, i, size);
+			return -EACCES;
+		}
+	}
+	if (value_regno >= 0)
+		/* have read misc data from the stack */
+		mark_reg(&state->regs[value_regno], UNKNOWN_VALUE);
+	return 0;
+}
+
+/* check read/write into map element returned by bpf_map_lookup_elem() */
+static int check_map_access(struct verifier_env *env, u32 regno, int off,
+			    int size)
+{
+	struct bpf_map *map = env->cur.regs[regno].map_ptr;
+
+	if (off < 0 || off + size > map->value_size) {
+		verbose(env, "invalid access to map value, value_size=%d off=%d size=%d\n",
+			map->value_size, off, size);
+		return -EACCES;
+	}
+	return 0;
+}
+
+/* check access to 'struct bpf_context' fields */
+static int check_ctx_access(struct verifier_env *env, int off, int size,
+			    enum bpf_access_type t)
+{
+	const struct bpf_verifier_ops *ops = env->prog->aux->ops;
+
+	if (ops->is_valid_access && ops->is_valid_access(off, size, t))
+		return 0;
+
+	verbose(env, "invalid bpf_context access off=%d size=%d\n", off, size);
+	return -EACCES;
+}
+
+/* check whether memory at (regno + off) is accessible for t = (read | write)
+ * if t==write, value_regno is a register which value is stored into memory
+ * if t==read, value_regno is a register which will receive the value from
+ * memory; value_regno == -1 means the value is not tracked (BPF_ST, XADD)
+ */
+static int check_mem_access(struct verifier_env *env, u32 regno, int off,
+			    int bpf_size, enum bpf_access_type t,
+			    int value_regno)
+{
+	struct reg_state *reg = &env->cur.regs[regno];
+	int size, err = 0;
+
+	size = bpf_size_to_bytes(bpf_size);
+	if (size < 0)
+		return size;
+
+	if (reg->type == PTR_TO_MAP_VALUE) {
+		if (off % size != 0) {
+			verbose(env, "misaligned access off %d size %d\n",
+				off, size);
+			return -EACCES;
+		}
+		err = check_map_access(env, regno, off, size);
+		if (!err && t == BPF_READ && value_regno >= 0)
+			mark_reg(&env->cur.regs[value_regno], UNKNOWN_VALUE);
+
+	} else if (reg->type == PTR_TO_CTX) {
+		if (off % size != 0) {
+			verbose(env, "misaligned access off %d size %d\n",
+				off, size);
+			return -EACCES;
+		}
+		err = check_ctx_access(env, off, size, t);
+		if (!err && t == BPF_READ && value_regno >= 0)
+			mark_reg(&env->cur.regs[value_regno], UNKNOWN_VALUE);
+		if (!err)
+			env->ctx_access[env->insn_idx] = true;
+
+	} else if (is_stack_ptr(reg)) {
+		off += stack_ptr_off(reg);
+		if (off >= 0 || off < -MAX_BPF_STACK || off + size > 0) {
+			verbose(env, "invalid stack off=%d size=%d\n",
+				off, size);
+			return -EACCES;
+		}
+		if (off % size != 0) {
+			verbose(env, "misaligned access off %d size %d\n",
+				off, size);
+			return -EACCES;
+		}
+		if (t == BPF_WRITE)
+			check_stack_write(env, off, size, value_regno);
+		else
+			err = check_stack_read(env, off, size, value_regno);
+	} else {
+		verbose(env, "R%d invalid mem access '%s'\n",
+			regno, reg_type_str[reg->type]);
+		return -EACCES;
+	}
+	return err;
+}
+
+static int check_xadd(struct verifier_env *env, struct bpf_insn *insn)
+{
+	int err;
+
+	if ((BPF_SIZE(insn->code) != BPF_W && BPF_SIZE(insn->code) != BPF_DW) ||
+	    insn->imm != 0) {
+		verbose(env, "BPF_XADD uses reserved fields\n");
+		return -EINVAL;
+	}
+
+	/* check src1 operand */
+	err = check_reg_arg(env, insn->src_reg, SRC_OP);
+	if (err)
+		return err;
+
+	/* check src2 operand */
+	err = check_reg_arg(env, insn->dst_reg, SRC_OP);
+	if (err)
+		return err;
+
+	if (env->cur.regs[insn->dst_reg].type == PTR_TO_CTX) {
+		verbose(env, "BPF_XADD into bpf_context is not allowed\n");
+		return -EACCES;
+	}
+
+	/* check whether atomic_add can read the memory */
+	err = check_mem_access(env, insn->dst_reg, insn->off,
+			       BPF_SIZE(insn->code), BPF_READ, -1);
+	if (err)
+		return err;
+
+	/* check whether atomic_add can write into the same memory */
+	return check_mem_access(env, insn->dst_reg, insn->off,
+				BPF_SIZE(insn->code), BPF_WRITE, -1);
+}
+
+/* when register 'regno' is passed into function that will read 'access_size'
+ * bytes from that pointer, make sure that it's within stack boundary
+ * and all elements of stack are initialized
+ */
+static int check_stack_boundary(struct verifier_env *env, u32 regno,
+				int access_size)
+{
+	struct verifier_state *state = &env->cur;
+	struct reg_state *reg = &state->regs[regno];
+	int off, i;
+
+	if (!is_stack_ptr(reg)) {
+		verbose(env, "R%d type=%s expected=fp\n", regno,
+			reg_type_str[reg->type]);
+		return -EACCES;
+	}
+
+	off = stack_ptr_off(reg);
+	if (off >= 0 || off < -MAX_BPF_STACK || off + access_size > 0 ||
+	    access_size <= 0) {
+		verbose(env, "invalid stack type R%d off=%d access_size=%d\n",
+			regno, off, access_size);
+		return -EACCES;
+	}
+
+	for (i = 0; i < access_size; i++) {
+		if (state->stack_slot_type[MAX_BPF_STACK + off + i] ==
+		    STACK_INVALID) {
+			verbose(env, "invalid indirect read from stack off %d+%d size %d\n",
+				off, i, access_size);
+			return -EACCES;
+		}
+	}
+	return 0;
+}
+
+static int check_func_arg(struct verifier_env *env, u32 regno,
+			  enum bpf_arg_type arg_type, struct bpf_map **mapp)
+{
+	struct reg_state *reg = &env->cur.regs[regno];
+	int err;
+
+	if (arg_type == ARG_ANYTHING)
+		return 0;
+
+	err = check_reg_arg(env, regno, SRC_OP);
+	if (err)
+		return err;
+
+	if (arg_type == ARG_PTR_TO_CTX) {
+		if (reg->type != PTR_TO_CTX) {
+			verbose(env, "R%d type=%s expected=ctx\n", regno,
+				reg_type_str[reg->type]);
+			return -EACCES;
+		}
+		return 0;
+	}
+
+	if (arg_type == ARG_PTR_TO_STACK) {
+		/* bounds are checked with the size in the next argument */
+		if (!is_stack_ptr(reg)) {
+			verbose(env, "R%d type=%s expected=fp\n", regno,
+				reg_type_str[reg->type]);
+			return -EACCES;
+		}
+		return 0;
+	}
+
+	if (arg_type == ARG_CONST_STACK_SIZE) {
+		/* bpf_xxx(..., buf, len) call will access 'len' bytes
+		 * from stack pointer 'buf'. Check it
+		 */
+		if (reg->type != CONST_IMM) {
+			verbose(env, "R%d type=%s expected=imm\n", regno,
+				reg_type_str[reg->type]);
+			return -EACCES;
+		}
+		if (reg->imm <= 0 || reg->imm > MAX_BPF_STACK) {
+			verbose(env, "R%d invalid stack size %lld\n", regno,
+				reg->imm);
+			return -EACCES;
+		}
+		return check_stack_boundary(env, regno - 1, reg->imm);
+	}
+
+	if (arg_type == ARG_CONST_MAP_PTR) {
+		if (reg->type != CONST_PTR_TO_MAP) {
+			verbose(env, "R%d type=%s expected=map_ptr\n", regno,
+				reg_type_str[reg->type]);
+			return -EACCES;
+		}
+		/* remember the map, its key and value sizes are needed
+		 * by the following arguments
+		 */
+		*mapp = reg->map_ptr;
+		return 0;
+	}
+
+	if (!*mapp) {
+		/* in function declaration map_ptr must come before
+		 * map_key or map_value
+		 */
+		verbose(env, "invalid map_ptr to access map->%s\n",
+			arg_type == ARG_PTR_TO_MAP_KEY ? "key" : "value");
+		return -EACCES;
+	}
+
+	if (arg_type == ARG_PTR_TO_MAP_KEY)
+		/* bpf_map_xxx(..., map_ptr, ..., key) call:
+		 * check that [key, key + map->key_size) are within
+		 * stack limits and initialized
+		 */
+		return check_stack_boundary(env, regno, (*mapp)->key_size);
+
+	if (arg_type == ARG_PTR_TO_MAP_VALUE)
+		/* bpf_map_xxx(..., map_ptr, ..., value) call:
+		 * check [value, value + map->value_size) validity
+		 */
+		return check_stack_boundary(env, regno, (*mapp)->value_size);
+
+	verbose(env, "unsupported arg_type %d\n", arg_type);
+	return -EFAULT;
+}
+
+static int check_call(struct verifier_env *env, struct bpf_insn *insn)
+{
+	struct reg_state *regs = env->cur.regs;
+	const struct bpf_func_proto *fn = NULL;
+	struct bpf_map *map = NULL;
+	int func_id = insn->imm;
+	int i, err;
+
+	if (insn->src_reg != 0 || insn->dst_reg != 0 || insn->off != 0) {
+		verbose(env, "BPF_CALL uses reserved fields\n");
+		return -EINVAL;
+	}
+
+	/* find function prototype */
+	if (func_id <= BPF_FUNC_unspec || func_id >= __BPF_FUNC_MAX_ID) {
+		verbose(env, "invalid func %d\n", func_id);
+		return -EINVAL;
+	}
+
+	if (env->prog->aux->ops->get_func_proto)
+		fn = env->prog->aux->ops->get_func_proto(func_id);
+
+	if (!fn) {
+		verbose(env, "unknown func %d\n", func_id);
+		return -EINVAL;
+	}
+
+	/* eBPF programs must be GPL compatible to use GPL-ed functions */
+	if (!env->prog->aux->is_gpl_compatible && fn->gpl_only) {
+		verbose(env, "cannot call GPL only function from proprietary program\n");
+		return -EINVAL;
+	}
+
+	/* check args */
+	err = check_func_arg(env, BPF_REG_1, fn->arg1_type, &map);
+	if (err)
+		return err;
+	err = check_func_arg(env, BPF_REG_2, fn->arg2_type, &map);
+	if (err)
+		return err;
+	err = check_func_arg(env, BPF_REG_3, fn->arg3_type, &map);
+	if (err)
+		return err;
+	err = check_func_arg(env, BPF_REG_4, fn->arg4_type, &map);
+	if (err)
+		return err;
+	err = check_func_arg(env, BPF_REG_5, fn->arg5_type, &map);
+	if (err)
+		return err;
+
+	/* reset caller saved regs */
+	for (i = BPF_REG_1; i <= BPF_REG_5; i++)
+		mark_reg(&regs[i], NOT_INIT);
+
+	/* update return register */
+	if (fn->ret_type == RET_INTEGER) {
+		mark_reg(&regs[BPF_REG_0], UNKNOWN_VALUE);
+	} else if (fn->ret_type == RET_VOID) {
+		mark_reg(&regs[BPF_REG_0], NOT_INIT);
+	} else if (fn->ret_type == RET_PTR_TO_MAP_VALUE_OR_NULL) {
+		/* remember map_ptr, so that check_map_access()
+		 * can check 'value_size' boundary of memory access
+		 * to map element returned from bpf_map_lookup_elem()
+		 */
+		if (!map) {
+			verbose(env, "kernel subsystem misconfigured verifier\n");
+			return -EINVAL;
+		}
+		mark_reg(&regs[BPF_REG_0], PTR_TO_MAP_VALUE_OR_NULL);
+		regs[BPF_REG_0].map_ptr = map;
+	} else {
+		verbose(env, "unknown return type %d of func %d\n",
+			fn->ret_type, func_id);
+		return -EINVAL;
+	}
+
+	/* the call was verified, turn the function id into the offset
+	 * the interpreter and the JITs expect
+	 */
+	insn->imm = fn->func - __bpf_call_base;
+	return 0;
+}
+
+/* check validity of 32-bit and 64-bit arithmetic operations */
+static int check_alu_op(struct verifier_env *env, struct bpf_insn *insn)
+{
+	struct reg_state *regs = env->cur.regs;
+	u8 opcode = BPF_OP(insn->code);
+	bool is64 = BPF_CLASS(insn->code) == BPF_ALU64;
+	int err;
+
+	if (opcode == BPF_END || opcode == BPF_NEG) {
+		if (opcode == BPF_NEG) {
+			if (BPF_SRC(insn->code) != 0 ||
+			    insn->src_reg != BPF_REG_0 ||
+			    insn->off != 0 || insn->imm != 0) {
+				verbose(env, "BPF_NEG uses reserved fields\n");
+				return -EINVAL;
+			}
+		} else {
+			if (insn->src_reg != BPF_REG_0 || insn->off != 0 ||
+			    (insn->imm != 16 && insn->imm != 32 &&
+			     insn->imm != 64) || is64) {
+				verbose(env, "BPF_END uses reserved fields\n");
+				return -EINVAL;
+			}
+		}
+
+		/* check src operand */
+		err = check_reg_arg(env, insn->dst_reg, SRC_OP);
+		if (err)
+			return err;
+
+		/* check dest operand */
+		return check_reg_arg(env, insn->dst_reg, DST_OP);
+	}
+
+	if (opcode > BPF_END || (opcode == BPF_ARSH && !is64)) {
+		verbose(env, "invalid BPF_ALU opcode %x\n", opcode);
+		return -EINVAL;
+	}
+
+	if (BPF_SRC(insn->code) == BPF_X) {
+		if (insn->imm != 0 || insn->off != 0) {
+			verbose(env, "BPF_ALU uses reserved fields\n");
+			return -EINVAL;
+		}
+		/* check src operand */
+		err = check_reg_arg(env, insn->src_reg, SRC_OP);
+		if (err)
+			return err;
+	} else {
+		if (insn->src_reg != BPF_REG_0 || insn->off != 0) {
+			verbose(env, "BPF_ALU uses reserved fields\n");
+			return -EINVAL;
+		}
+	}
+
+	if (opcode == BPF_MOV) {
+		/* check dest operand */
+		err = check_reg_arg(env, insn->dst_reg, DST_OP);
+		if (err)
+			return err;
+
+		/* R1 = R2, 64-bit copies keep the type of the source */
+		if (BPF_SRC(insn->code) == BPF_X && is64) {
+			regs[insn->dst_reg] = regs[insn->src_reg];
+		} else if (BPF_SRC(insn->code) == BPF_K) {
+			/* remember the value, sizes of helper arguments
+			 * have to be known constants
+			 */
+			regs[insn->dst_reg].type = CONST_IMM;
+			regs[insn->dst_reg].imm = is64 ? (s64) insn->imm :
+						  (s64) (u32) insn->imm;
+		}
+		return 0;
+	}
+
+	if ((opcode == BPF_MOD || opcode == BPF_DIV) &&
+	    BPF_SRC(insn->code) == BPF_K && insn->imm == 0) {
+		verbose(env, "div by zero\n");
+		return -EINVAL;
+	}
+
+	if ((opcode == BPF_LSH || opcode == BPF_RSH || opcode == BPF_ARSH) &&
+	    BPF_SRC(insn->code) == BPF_K &&
+	    (insn->imm < 0 || insn->imm >= (is64 ? 64 : 32))) {
+		verbose(env, "invalid shift %d\n", insn->imm);
+		return -EINVAL;
+	}
+
+	/* check src2 operand */
+	err = check_reg_arg(env, insn->dst_reg, SRC_OP);
+	if (err)
+		return err;
+
+	/* pointer to the stack plus or minus a constant stays such a
+	 * pointer as long as it stays within the frame
+	 */
+	if (is64 && BPF_SRC(insn->code) == BPF_K &&
+	    (opcode == BPF_ADD || opcode == BPF_SUB) &&
+	    is_stack_ptr(&regs[insn->dst_reg])) {
+		struct reg_state *dst = &regs[insn->dst_reg];
+		int off = stack_ptr_off(dst);
+
+		err = check_reg_arg(env, insn->dst_reg, DST_OP_NO_MARK);
+		if (err)
+			return err;
+
+		if (opcode == BPF_ADD)
+			off += insn->imm;
+		else
+			off -= insn->imm;
+
+		if (off >= -MAX_BPF_STACK && off <= 0 &&
+		    insn->imm >= -MAX_BPF_STACK && insn->imm <= MAX_BPF_STACK) {
+			mark_reg(dst, PTR_TO_STACK);
+			dst->off = off;
+			return 0;
+		}
+	}
+
+	/* check dest operand, anything else produces a scalar */
+	return check_reg_arg(env, insn->dst_reg, DST_OP);
+}
+
+/* remember the state at a jump target, merging it with the states of
+ * other jumps into the same instruction
+ */
+static int push_branch(struct verifier_env *env, int insn_idx, int off,
+		       struct verifier_state *state)
+{
+	int target = insn_idx + off + 1;
+	struct verifier_state *st;
+
+	if (off < 0) {
+		verbose(env, "back-edge from insn %d to %d\n",
+			insn_idx, target);
+		return -EINVAL;
+	}
+	if (target >= env->prog->len) {
+		verbose(env, "jump out of range from insn %d to %d\n",
+			insn_idx, target);
+		return -EINVAL;
+	}
+
+	st = env->branch[target];
+	if (st) {
+		merge_state(st, state);
+		return 0;
+	}
+
+	st = kmalloc(sizeof(*st), GFP_KERNEL);
+	if (!st)
+		return -ENOMEM;
+	memcpy(st, state, sizeof(*st));
+	env->branch[target] = st;
+	return 0;
+}
+
+static int check_cond_jmp_op(struct verifier_env *env,
+			     struct bpf_insn *insn, int insn_idx)
+{
+	struct reg_state *regs = env->cur.regs;
+	struct reg_state *dst;
+	u8 opcode = BPF_OP(insn->code);
+	int err;
+
+	if (opcode > BPF_EXIT) {
+		verbose(env, "invalid BPF_JMP opcode %x\n", opcode);
+		return -EINVAL;
+	}
+
+	if (BPF_SRC(insn->code) == BPF_X) {
+		if (insn->imm != 0) {
+			verbose(env, "BPF_JMP uses reserved fields\n");
+			return -EINVAL;
+		}
+
+		/* check src1 operand */
+		err = check_reg_arg(env, insn->src_reg, SRC_OP);
+		if (err)
+			return err;
+	} else {
+		if (insn->src_reg != BPF_REG_0) {
+			verbose(env, "BPF_JMP uses reserved fields\n");
+			return -EINVAL;
+		}
+	}
+
+	/* check src2 operand */
+	err = check_reg_arg(env, insn->dst_reg, SRC_OP);
+	if (err)
+		return err;
+
+	memcpy(&env->tmp, &env->cur, sizeof(env->tmp));
+	dst = &regs[insn->dst_reg];
+
+	/* detect if R == 0 where R is returned from bpf_map_lookup_elem() */
+	if (BPF_SRC(insn->code) == BPF_K && insn->imm == 0 &&
+	    (opcode == BPF_JEQ || opcode == BPF_JNE) &&
+	    dst->type == PTR_TO_MAP_VALUE_OR_NULL) {
+		struct reg_state *taken = &env->tmp.regs[insn->dst_reg];
+
+		if (opcode == BPF_JEQ) {
+			/* next fallthrough insn can access memory via
+			 * this register
+			 */
+			dst->type = PTR_TO_MAP_VALUE;
+			/* branch target cannot access it, since reg == 0 */
+			mark_reg(taken, UNKNOWN_VALUE);
+		} else {
+			taken->type = PTR_TO_MAP_VALUE;
+			mark_reg(dst, UNKNOWN_VALUE);
+		}
+	}
+
+	return push_branch(env, insn_idx, insn->off, &env->tmp);
+}
+
+static struct bpf_map *ld_imm64_to_map_ptr(struct bpf_insn *insn)
+{
+	u64 imm64 = ((u64) (u32) insn[0].imm) | ((u64) (u32) insn[1].imm) << 32;
+
+	return (struct bpf_map *) (unsigned long) imm64;
+}
+
+/* verify BPF_LD_IMM64 instruction */
+static int check_ld_imm(struct verifier_env *env, struct bpf_insn *insn)
+{
+	struct reg_state *regs = env->cur.regs;
+	int err;
+
+	err = check_reg_arg(env, insn->dst_reg, DST_OP);
+	if (err)
+		return err;
+
+	if (insn->src_reg == 0)
+		/* generic move 64-bit immediate into a register */
+		return 0;
+
+	/* replace_map_fd_with_map_ptr() should have caught bad ld_imm64 */
+	BUG_ON(insn->src_reg != BPF_PSEUDO_MAP_FD);
+
+	regs[insn->dst_reg].type = CONST_PTR_TO_MAP;
+	regs[insn->dst_reg].map_ptr = ld_imm64_to_map_ptr(insn);
+	return 0;
+}
+
+/* verify safety of LD_ABS|LD_IND instructions:
+ * - they can only appear in the programs where ctx == skb
+ * - since they are wrappers of function calls, they scratch R1-R5 registers,
+ *   preserve R6-R9, and store return value into R0
+ *
+ * Implicit input:
+ *   ctx == skb == R6 == CTX
+ *
+ * Explicit input:
+ *   SRC == any register
+ *   IMM == 32-bit immediate
+ *
+ * Output:
+ *   R0 - 8/16/32-bit skb data converted to cpu endianness
+ */
+static int check_ld_abs(struct verifier_env *env, struct bpf_insn *insn)
+{
+	struct reg_state *regs = env->cur.regs;
+	u8 mode = BPF_MODE(insn->code);
+	int i, err;
+
+	if (!env->prog->aux->ops->may_access_skb) {
+		verbose(env, "BPF_LD_ABS|IND instructions not allowed for this program type\n");
+		return -EINVAL;
+	}
+
+	if (insn->dst_reg != BPF_REG_0 || insn->off != 0 ||
+	    BPF_SIZE(insn->code) == BPF_DW ||
+	    (mode == BPF_ABS && insn->src_reg != BPF_REG_0)) {
+		verbose(env, "BPF_LD_ABS uses reserved fields\n");
+		return -EINVAL;
+	}
+
+	/* check whether implicit source operand (register R6) is readable */
+	err = check_reg_arg(env, BPF_REG_6, SRC_OP);
+	if (err)
+		return err;
+
+	if (regs[BPF_REG_6].type != PTR_TO_CTX) {
+		verbose(env, "at the time of BPF_LD_ABS|IND R6 != pointer to skb\n");
+		return -EINVAL;
+	}
+
+	if (mode == BPF_IND) {
+		/* check explicit source operand */
+		err = check_reg_arg(env, insn->src_reg, SRC_OP);
+		if (err)
+			return err;
+	}
+
+	/* reset caller saved regs to unreadable */
+	for (i = BPF_REG_1; i <= BPF_REG_5; i++)
+		mark_reg(&regs[i], NOT_INIT);
+
+	/* mark destination R0 register as readable, since it contains
+	 * the value fetched from the packet
+	 */
+	mark_reg(&regs[BPF_REG_0], UNKNOWN_VALUE);
+	return 0;
+}
+
+static int do_check(struct verifier_env *env)
+{
+	struct bpf_insn *insns = (struct bpf_insn *) env->prog->insnsi;
+	int insn_cnt = env->prog->len;
+	bool reachable = true;
+	int insn_idx, err;
+
+	init_state(&env->cur);
+
+	for (insn_idx = 0; insn_idx < insn_cnt; insn_idx++) {
+		struct bpf_insn *insn = &insns[insn_idx];
+		struct verifier_state *st = env->branch[insn_idx];
+		u8 class = BPF_CLASS(insn->code);
+
+		env->insn_idx = insn_idx;
+		if (st) {
+			if (reachable)
+				merge_state(&env->cur, st);
+			else
+				memcpy(&env->cur, st, sizeof(env->cur));
+			kfree(st);
+			env->branch[insn_idx] = NULL;
+			reachable = true;
+		}
+
+		if (!reachable) {
+			verbose(env, "unreachable insn %d\n", insn_idx);
+			return -EINVAL;
+		}
+
+		if (env->log_level > 1)
+			verbose(env, "%d: (%02x) r%d r%d %d %d\n", insn_idx,
+				insn->code, insn->dst_reg, insn->src_reg,
+				insn->off, insn->imm);
+
+		switch (class) {
+		case BPF_ALU:
+		case BPF_ALU64:
+			err = check_alu_op(env, insn);
+			break;
+
+		case BPF_LDX:
+			if (BPF_MODE(insn->code) != BPF_MEM || insn->imm != 0) {
+				verbose(env, "BPF_LDX uses reserved fields\n");
+				return -EINVAL;
+			}
+
+			/* check src operand */
+			err = check_reg_arg(env, insn->src_reg, SRC_OP);
+			if (err)
+				return err;
+
+			err = check_reg_arg(env, insn->dst_reg, DST_OP_NO_MARK);
+			if (err)
+				return err;
+
+			/* check that memory (src_reg + off) is readable,
+			 * the state of dst_reg will be updated by this func
+			 */
+			err = check_mem_access(env, insn->src_reg, insn->off,
+					       BPF_SIZE(insn->code), BPF_READ,
+					       insn->dst_reg);
+			break;
+
+		case BPF_STX:
+			if (BPF_MODE(insn->code) == BPF_XADD) {
+				err = check_xadd(env, insn);
+				break;
+			}
+
+			if (BPF_MODE(insn->code) != BPF_MEM || insn->imm != 0) {
+				verbose(env, "BPF_STX uses reserved fields\n");
+				return -EINVAL;
+			}
+
+			/* check src1 operand */
+			err = check_reg_arg(env, insn->src_reg, SRC_OP);
+			if (err)
+				return err;
+			/* check src2 operand */
+			err = check_reg_arg(env, insn->dst_reg, SRC_OP);
+			if (err)
+				return err;
+
+			/* check that memory (dst_reg + off) is writeable */
+			err = check_mem_access(env, insn->dst_reg, insn->off,
+					       BPF_SIZE(insn->code), BPF_WRITE,
+					       insn->src_reg);
+			break;
+
+		case BPF_ST:
+			if (BPF_MODE(insn->code) != BPF_MEM ||
+			    insn->src_reg != BPF_REG_0) {
+				verbose(env, "BPF_ST uses reserved fields\n");
+				return -EINVAL;
+			}
+			/* check src operand */
+			err = check_reg_arg(env, insn->dst_reg, SRC_OP);
+			if (err)
+				return err;
+
+			/* check that memory (dst_reg + off) is writeable */
+			err = check_mem_access(env, insn->dst_reg, insn->off,
+					       BPF_SIZE(insn->code), BPF_WRITE,
+					       -1);
+			break;
+
+		case BPF_JMP: {
+			u8 opcode = BPF_OP(insn->code);
+
+			if (opcode == BPF_CALL) {
+				err = check_call(env, insn);
+			} else if (opcode == BPF_JA) {
+				if (BPF_SRC(insn->code) != BPF_K ||
+				    insn->imm != 0 ||
+				    insn->src_reg != BPF_REG_0 ||
+				    insn->dst_reg != BPF_REG_0) {
+					verbose(env, "BPF_JA uses reserved fields\n");
+					return -EINVAL;
+				}
+				err = push_branch(env, insn_idx, insn->off,
+						  &env->cur);
+				reachable = false;
+			} else if (opcode == BPF_EXIT) {
+				if (BPF_SRC(insn->code) != BPF_K ||
+				    insn->imm != 0 ||
+				    insn->src_reg != BPF_REG_0 ||
+				    insn->dst_reg != BPF_REG_0) {
+					verbose(env, "BPF_EXIT uses reserved fields\n");
+					return -EINVAL;
+				}
+
+				/* R0 holds the return value of the program,
+				 * it has to be written before bpf_exit
+				 */
+				err = check_reg_arg(env, BPF_REG_0, SRC_OP);
+				reachable = false;
+			} else {
+				err = check_cond_jmp_op(env, insn, insn_idx);
+			}
+			break;
+		}
+
+		case BPF_LD: {
+			u8 mode = BPF_MODE(insn->code);
+
+			if (mode == BPF_ABS || mode == BPF_IND) {
+				err = check_ld_abs(env, insn);
+			} else if (mode == BPF_IMM &&
+				   BPF_SIZE(insn->code) == BPF_DW) {
+				err = check_ld_imm(env, insn);
+				/* the second half is not an insn of its own */
+				insn_idx++;
+				if (!err && env->branch[insn_idx]) {
+					verbose(env, "jump into the middle of ldimm64 insn %d\n",
+						insn_idx);
+					err = -EINVAL;
+				}
+			} else {
+				verbose(env, "invalid BPF_LD mode\n");
+				err = -EINVAL;
+			}
+			break;
+		}
+
+		default:
+			verbose(env, "unknown insn class %d\n", class);
+			return -EINVAL;
+		}
+
+		if (err)
+			return err;
+	}
+
+	if (reachable) {
+		verbose(env, "last insn is not an exit\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* look for pseudo eBPF instructions that access map FDs and
+ * replace them with actual map pointers
+ */
+static int replace_map_fd_with_map_ptr(struct verifier_env *env)
+{
+	struct bpf_insn *insn = (struct bpf_insn *) env->prog->insnsi;
+	int insn_cnt = env->prog->len;
+	int i, j;
+
+	for (i = 0; i < insn_cnt; i++, insn++) {
+		if (insn[0].code == (BPF_LD | BPF_IMM | BPF_DW)) {
+			struct bpf_map *map;
+			struct fd f;
+			u64 imm64;
+
+			if (i == insn_cnt - 1 || insn[1].code != 0 ||
+			    insn[1].dst_reg != 0 || insn[1].src_reg != 0 ||
+			    insn[1].off != 0 || insn[0].off != 0) {
+				verbose(env, "invalid bpf_ld_imm64 insn\n");
+				return -EINVAL;
+			}
+
+			if (insn->src_reg == 0)
+				/* valid generic load 64-bit imm */
+				goto next_insn;
+
+			if (insn->src_reg != BPF_PSEUDO_MAP_FD) {
+				verbose(env, "unrecognized bpf_ld_imm64 insn\n");
+				return -EINVAL;
+			}
+
+			f = fdget(insn->imm);
+
+			map = bpf_map_get(f);
+			if (IS_ERR(map)) {
+				verbose(env, "fd %d is not pointing to valid bpf_map\n",
+					insn->imm);
+				return PTR_ERR(map);
+			}
+
+			/* store map pointer inside BPF_LD_IMM64 instruction */
+			imm64 = (u64) (unsigned long) map;
+			insn[0].imm = (u32) imm64;
+			insn[1].imm = imm64 >> 32;
+
+			/* check whether we recorded this map already */
+			for (j = 0; j < env->used_map_cnt; j++)
+				if (env->used_maps[j] == map) {
+					fdput(f);
+					goto next_insn;
+				}
+
+			if (env->used_map_cnt >= MAX_USED_MAPS) {
+				fdput(f);
+				return -E2BIG;
+			}
+
+			/* remember this map */
+			env->used_maps[env->used_map_cnt++] = map;
+
+			/* hold the map. If the program is rejected by verifier,
+			 * the map will be released by release_maps() or it
+			 * will be used by the valid program until it's unloaded
+			 * and all maps are released in free_used_maps()
+			 */
+			atomic_inc(&map->refcnt);
+
+			fdput(f);
+next_insn:
+			insn++;
+			i++;
+		}
+	}
+
+	/* now all pseudo BPF_LD_IMM64 instructions load valid
+	 * 'struct bpf_map *' into a register instead of user map_fd.
+	 * These pointers will be used later by verifier to validate map access.
+	 */
+	return 0;
+}
+
+/* rewrite the accesses to bpf_context into accesses to the real context
+ * of the program type, e.g. __sk_buff fields into sk_buff fields
+ */
+static int convert_ctx_accesses(struct verifier_env *env)
+{
+	struct bpf_insn *insns = (struct bpf_insn *) env->prog->insnsi;
+	const struct bpf_verifier_ops *ops = env->prog->aux->ops;
+	int i;
+
+	/* the context of kprobe and tracepoint programs is the real one */
+	if (!ops->convert_ctx_access)
+		return 0;
+
+	for (i = 0; i < env->prog->len; i++) {
+		if (!env->ctx_access[i])
+			continue;
+
+		ops->convert_ctx_access(&insns[i]);
+	}
+	return 0;
+}
+
+/* drop refcnt of maps used by the rejected program */
+static void release_maps(struct verifier_env *env)
+{
+	int i;
+
+	for (i = 0; i < env->used_map_cnt; i++)
+		bpf_map_put(env->used_maps[i]);
+}
+
+/* bpf(2) runs the verifier of one program at a time */
+static DEFINE_MUTEX(bpf_verifier_lock);
+
+int bpf_check(struct sk_filter *prog, union bpf_attr *attr)
+{
+	char __user *log_ubuf = NULL;
+	struct verifier_env *env;
+	int i, ret;
+
+	if (prog->len <= 0 || prog->len > BPF_MAXINSNS)
+		return -E2BIG;
+
+	/* 'struct verifier_env' can be global, but since it's not small,
+	 * allocate/free it every time bpf_check() is called
+	 */
+	env = kzalloc(sizeof(struct verifier_env), GFP_KERNEL);
+	if (!env)
+		return -ENOMEM;
+
+	env->prog = prog;
+
+	ret = -ENOMEM;
+	env->branch = kcalloc(prog->len, sizeof(*env->branch), GFP_KERNEL);
+	if (!env->branch)
+		goto free_env;
+
+	env->ctx_access = kcalloc(prog->len, sizeof(bool), GFP_KERNEL);
+	if (!env->ctx_access)
+		goto free_branch;
+
+	mutex_lock(&bpf_verifier_lock);
+
+	if (attr->log_level || attr->log_buf || attr->log_size) {
+		/* user requested verbose verifier output
+		 * and supplied buffer to store the verification trace
+		 */
+		env->log_level = attr->log_level;
+		log_ubuf = (char __user *) (unsigned long) attr->log_buf;
+		env->log_size = attr->log_size;
+		env->log_len = 0;
+
+		ret = -EINVAL;
+		/* log_* values have to be sane */
+		if (env->log_size < 128 || env->log_size > UINT_MAX >> 8 ||
+		    env->log_level == 0 || log_ubuf == NULL)
+			goto unlock;
+
+		ret = -ENOMEM;
+		env->log_buf = vmalloc(env->log_size);
+		if (!env->log_buf)
+			goto unlock;
+		env->log_buf[0] = 0;
+	}
+
+	ret = replace_map_fd_with_map_ptr(env);
+	if (ret < 0)
+		goto skip_full_check;
+
+	ret = do_check(env);
+	if (ret == 0)
+		ret = convert_ctx_accesses(env);
+
+skip_full_check:
+	if (env->log_level && env->log_len + 1 >= env->log_size) {
+		/* verifier log exceeded user supplied buffer */
+		ret = -ENOSPC;
+		/* fall through to return what was recorded */
+	}
+
+	/* copy verifier log back to user space including trailing zero */
+	if (env->log_level && copy_to_user(log_ubuf, env->log_buf,
+					   env->log_len + 1) != 0) {
+		ret = -EFAULT;
+	}
+
+	if (ret == 0 && env->used_map_cnt) {
+		/* program passed the verifier, hand the maps over to it */
+		prog->aux->used_maps = kmalloc_array(env->used_map_cnt,
+						     sizeof(env->used_maps[0]),
+						     GFP_KERNEL);
+
+		if (!prog->aux->used_maps) {
+			ret = -ENOMEM;
+			goto vfree_log;
+		}
+
+		memcpy(prog->aux->used_maps, env->used_maps,
+		       sizeof(env->used_maps[0]) * env->used_map_cnt);
+		prog->aux->used_map_cnt = env->used_map_cnt;
+
+		/* program is valid, the maps are released when it is
+		 * freed
+		 */
+		env->used_map_cnt = 0;
+	}
+
+vfree_log:
+	if (env->log_level)
+		vfree(env->log_buf);
+unlock:
+	mutex_unlock(&bpf_verifier_lock);
+
+	/* if we didn't copy map pointers into bpf_prog_info, release them */
+	release_maps(env);
+
+	kfree(env->ctx_access);
+	for (i = 0; i < prog->len; i++)
+		kfree(env->branch[i]);
+free_branch:
+	kfree(env->branch);
+free_env:
+	kfree(env);
+	return ret;
+}
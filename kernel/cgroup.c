@@ -3283,17 +3283,19 @@ static int pidlist_array_load(struct cgroup *cgrp, enum cgroup_filetype type,
  * Build and fill cgroupstats so that taskstats can export it to user
  * space.
  */
-int cgroupstats_build(struct cgroupstats *stats, struct dentry *dentry)
+/*
+ * Look up the live cgroup of a cgroupfs directory dentry for a caller
+ * outside of kernfs.  On success cgroup_mutex is held on return.
+ */
+static struct cgroup *cgroup_lock_from_dir(struct dentry *dentry)
 {
 	struct kernfs_node *kn = kernfs_node_from_dentry(dentry);
 	struct cgroup *cgrp;
-	struct css_task_iter it;
-	struct task_struct *tsk;
 
 	/* it should be kernfs_node belonging to cgroupfs and is a directory */
 	if (dentry->d_sb->s_type != &cgroup_fs_type || !kn ||
 	    kernfs_type(kn) != KERNFS_DIR)
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 
 	mutex_lock(&cgroup_mutex);
 
@@ -3307,9 +3309,21 @@ int cgroupstats_build(struct cgroupstats *stats, struct dentry *dentry)
 	if (!cgrp || cgroup_is_dead(cgrp)) {
 		rcu_read_unlock();
 		mutex_unlock(&cgroup_mutex);
-		return -ENOENT;
+		return ERR_PTR(-ENOENT);
 	}
 	rcu_read_unlock();
+	return cgrp;
+}
+
+int cgroupstats_build(struct cgroupstats *stats, struct dentry *dentry)
+{
+	struct cgroup *cgrp;
+	struct css_task_iter it;
+	struct task_struct *tsk;
+
+	cgrp = cgroup_lock_from_dir(dentry);
+	if (IS_ERR(cgrp))
+		return PTR_ERR(cgrp);
 
 	css_task_iter_start(&cgrp->dummy_css, &it);
 	while ((tsk = css_task_iter_next(&it))) {
@@ -3338,6 +3352,43 @@ int cgroupstats_build(struct cgroupstats *stats, struct dentry *dentry)
 	return 0;
 }
 
+/**
+ * cgroup_dir_for_each_task - walk the tasks of a cgroup directory
+ * @dentry: dentry of the cgroupfs directory
+ * @skip: number of tasks to pass over before calling @fn
+ * @fn: called on each following task until it returns non-zero
+ * @data: passed to @fn
+ *
+ * This lets a caller such as a netlink dump walk a cgroup in several
+ * chunks.  @fn is called with cgroup_mutex and css_set_rwsem held.
+ * Returns the position to resume from, i.e. the number of tasks
+ * passed over plus those @fn accepted, or a negative errno.
+ */
+long cgroup_dir_for_each_task(struct dentry *dentry, long skip,
+			      int (*fn)(struct task_struct *, void *),
+			      void *data)
+{
+	struct cgroup *cgrp;
+	struct css_task_iter it;
+	struct task_struct *tsk;
+	long pos = 0;
+
+	cgrp = cgroup_lock_from_dir(dentry);
+	if (IS_ERR(cgrp))
+		return PTR_ERR(cgrp);
+
+	css_task_iter_start(&cgrp->dummy_css, &it);
+	while ((tsk = css_task_iter_next(&it))) {
+		if (pos >= skip && fn(tsk, data))
+			break;
+		pos++;
+	}
+	css_task_iter_end(&it);
+
+	mutex_unlock(&cgroup_mutex);
+	return pos;
+}
+
 
 /*
  * seq_file methods for the tasks/procs files. The seq_file position is the
@@ -3599,6 +3650,8 @@ static void css_free_work_fn(struct work_struct *work)
 		container_of(work, struct cgroup_subsys_state, destroy_work);
 	struct cgroup *cgrp = css->cgroup;
 
+	css_rstat_exit(css);
+
 	if (css->parent)
 		css_put(css->parent);
 
@@ -3629,6 +3682,7 @@ static void init_css(struct cgroup_subsys_state *css, struct cgroup_subsys *ss,
 {
 	css->cgroup = cgrp;
 	css->ss = ss;
+	css->rstat_cpu = NULL;
 	css->flags = 0;
 
 	if (cgrp->parent)
@@ -3704,10 +3758,14 @@ static int create_css(struct cgroup *cgrp, struct cgroup_subsys *ss)
 
 	init_css(css, ss, cgrp);
 
-	err = cgroup_populate_dir(cgrp, 1 << ss->id);
+	err = css_rstat_init(css);
 	if (err)
 		goto err_free_percpu_ref;
 
+	err = cgroup_populate_dir(cgrp, 1 << ss->id);
+	if (err)
+		goto err_free_rstat;
+
 	err = online_css(css);
 	if (err)
 		goto err_clear_dir;
@@ -3730,6 +3788,8 @@ static int create_css(struct cgroup *cgrp, struct cgroup_subsys *ss)
 
 err_clear_dir:
 	cgroup_clear_dir(css->cgroup, 1 << css->ss->id);
+err_free_rstat:
+	css_rstat_exit(css);
 err_free_percpu_ref:
 	percpu_ref_cancel_init(&css->refcnt);
 err_free_css:
@@ -4186,6 +4246,9 @@ static void __init cgroup_init_subsys(struct cgroup_subsys *ss)
 	/* We don't handle early failures gracefully */
 	BUG_ON(IS_ERR(css));
 	init_css(css, ss, &cgrp_dfl_root.cgrp);
+	/* no percpu allocations this early, see cgroup_init() */
+	if (!ss->early_init)
+		BUG_ON(css_rstat_init(css));
 
 	/* Update the init_css_set to contain a subsys
 	 * pointer to this state - since the subsystem is
@@ -4255,6 +4318,8 @@ int __init cgroup_init(void)
 
 	BUG_ON(cgroup_init_cftypes(NULL, cgroup_base_files));
 
+	css_rstat_boot();
+
 	mutex_lock(&cgroup_tree_mutex);
 	mutex_lock(&cgroup_mutex);
 
@@ -4270,6 +4335,8 @@ int __init cgroup_init(void)
 	for_each_subsys(ss, ssid) {
 		if (!ss->early_init)
 			cgroup_init_subsys(ss);
+		else
+			BUG_ON(css_rstat_init(init_css_set.subsys[ssid]));
 
 		/*
 		 * cftype registration needs kmalloc and can't be done
@@ -0,0 +1,233 @@
+/*
+ * cgroup_rstat.c - recursive per-cpu statistics for cgroup subsystems
+ *
+ * Updating a hierarchical counter at every level on every event bounces
+ * the counters of the upper levels between cpus, and summing per-cpu
+ * counters over all cpus and all descendants on every read makes stat
+ * files slow to read on large machines with many cgroups.
+ *
+ * Instead, a subsystem updates only the local per-cpu counter of a css
+ * and tells css_rstat_updated() about it, which links the css and its
+ * ancestors into a per-cpu tree of csses with pending updates.  A reader
+ * calls css_rstat_flush(), which walks those trees below the css being
+ * read and has the subsystem fold the pending deltas of each cpu, so the
+ * cost of a read follows what changed since the last one.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/cgroup.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+
+/* serializes the flushers, and so each subsystem's flush callbacks */
+static DEFINE_MUTEX(css_rstat_mutex);
+
+/* protects the updated trees of each cpu */
+static DEFINE_PER_CPU(raw_spinlock_t, css_rstat_cpu_lock);
+
+static struct css_rstat_cpu *css_rstat_cpu(struct cgroup_subsys_state *css,
+					   int cpu)
+{
+	return per_cpu_ptr(css->rstat_cpu, cpu);
+}
+
+/**
+ * css_rstat_updated - note that a css has stat updates on a cpu
+ * @css: css whose per-cpu counters were updated
+ * @cpu: cpu the counters belong to
+ *
+ * Links @css and its ancestors into @cpu's updated tree, so that the next
+ * css_rstat_flush() of any of them hands @css to ->css_rstat_flush().
+ * Cheap when @css is already there, which is the common case.  May be
+ * called from any context.
+ */
+void css_rstat_updated(struct cgroup_subsys_state *css, int cpu)
+{
+	raw_spinlock_t *cpu_lock = per_cpu_ptr(&css_rstat_cpu_lock, cpu);
+	struct cgroup_subsys_state *parent;
+	unsigned long flags;
+
+	/*
+	 * Racy test, an update that races with the flush taking @css off
+	 * the tree may not be seen until the next update on @cpu.
+	 */
+	if (css_rstat_cpu(css, cpu)->updated_next)
+		return;
+
+	raw_spin_lock_irqsave(cpu_lock, flags);
+
+	for (; css; css = parent) {
+		struct css_rstat_cpu *rstatc = css_rstat_cpu(css, cpu);
+		struct css_rstat_cpu *prstatc;
+
+		/* both additions and removals are bottom-up */
+		if (rstatc->updated_next)
+			break;
+
+		parent = css->parent;
+		if (!parent) {
+			rstatc->updated_next = css;
+			break;
+		}
+
+		prstatc = css_rstat_cpu(parent, cpu);
+		rstatc->updated_next = prstatc->updated_children;
+		prstatc->updated_children = css;
+	}
+
+	raw_spin_unlock_irqrestore(cpu_lock, flags);
+}
+
+/*
+ * Take the next css off @cpu's updated tree below @top: descendants come
+ * before their ancestors and @top comes last.  @pos is what the previous
+ * call returned, NULL for the first one.  Called with @cpu's lock held.
+ */
+static struct cgroup_subsys_state *
+css_rstat_pop_updated(struct cgroup_subsys_state *pos,
+		      struct cgroup_subsys_state *top, int cpu)
+{
+	struct cgroup_subsys_state *parent, **nextp;
+	struct css_rstat_cpu *rstatc;
+
+	if (pos == top)
+		return NULL;
+
+	/* carry on from the parent of the css taken off last */
+	pos = pos ? pos->parent : top;
+
+	/* walk down to the first leaf */
+	for (;;) {
+		rstatc = css_rstat_cpu(pos, cpu);
+		if (rstatc->updated_children == pos)
+			break;
+		pos = rstatc->updated_children;
+	}
+
+	/* Only @top can be off the tree here, and then all below it is. */
+	if (!rstatc->updated_next)
+		return NULL;
+
+	/*
+	 * The walk down always takes the first child, so @pos is usually
+	 * first on its parent's list.
+	 */
+	parent = pos->parent;
+	if (parent) {
+		nextp = &css_rstat_cpu(parent, cpu)->updated_children;
+		while (*nextp != pos)
+			nextp = &css_rstat_cpu(*nextp, cpu)->updated_next;
+		*nextp = rstatc->updated_next;
+	}
+	rstatc->updated_next = NULL;
+
+	return pos;
+}
+
+static void css_rstat_flush_locked(struct cgroup_subsys_state *css)
+{
+	int cpu;
+
+	lockdep_assert_held(&css_rstat_mutex);
+
+	for_each_possible_cpu(cpu) {
+		raw_spinlock_t *lock = per_cpu_ptr(&css_rstat_cpu_lock, cpu);
+		struct cgroup_subsys_state *pos = NULL;
+
+		raw_spin_lock_irq(lock);
+		while ((pos = css_rstat_pop_updated(pos, css, cpu)))
+			pos->ss->css_rstat_flush(pos, cpu);
+		raw_spin_unlock_irq(lock);
+
+		cond_resched();
+	}
+}
+
+/**
+ * css_rstat_flush - fold the pending stat updates of a subtree
+ * @css: root of the subtree
+ *
+ * Calls ->css_rstat_flush() for every css and cpu below and including
+ * @css with updates since they were last flushed, descendants first.
+ * The subsystem's totals for @css are up to date on return.  Might
+ * sleep.
+ */
+void css_rstat_flush(struct cgroup_subsys_state *css)
+{
+	might_sleep();
+
+	mutex_lock(&css_rstat_mutex);
+	css_rstat_flush_locked(css);
+	mutex_unlock(&css_rstat_mutex);
+}
+
+/**
+ * css_rstat_flush_hold - flush a subtree and keep flushers out
+ * @css: root of the subtree
+ *
+ * Like css_rstat_flush(), but no flush can run until the matching
+ * css_rstat_flush_release(), e.g. while the per-cpu counters of a dead
+ * cpu are moved elsewhere.  Might sleep.
+ */
+void css_rstat_flush_hold(struct cgroup_subsys_state *css)
+	__acquires(&css_rstat_mutex)
+{
+	might_sleep();
+
+	mutex_lock(&css_rstat_mutex);
+	css_rstat_flush_locked(css);
+}
+
+/**
+ * css_rstat_flush_release - release the hold taken by css_rstat_flush_hold()
+ */
+void css_rstat_flush_release(void)
+	__releases(&css_rstat_mutex)
+{
+	mutex_unlock(&css_rstat_mutex);
+}
+
+int css_rstat_init(struct cgroup_subsys_state *css)
+{
+	int cpu;
+
+	if (!css->ss->css_rstat_flush)
+		return 0;
+
+	css->rstat_cpu = alloc_percpu(struct css_rstat_cpu);
+	if (!css->rstat_cpu)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu)
+		css_rstat_cpu(css, cpu)->updated_children = css;
+
+	return 0;
+}
+
+/*
+ * Called before the parent of @css is put.  The final flush hands what
+ * @css had pending over to its parent and takes it off the trees.
+ */
+void css_rstat_exit(struct cgroup_subsys_state *css)
+{
+	if (!css->rstat_cpu)
+		return;
+
+	css_rstat_flush(css);
+
+	free_percpu(css->rstat_cpu);
+	css->rstat_cpu = NULL;
+}
+
+void __init css_rstat_boot(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		raw_spin_lock_init(per_cpu_ptr(&css_rstat_cpu_lock, cpu));
+}
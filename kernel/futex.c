@@ -64,6 +64,9 @@
 #include <linux/hugetlb.h>
 #include <linux/freezer.h>
 #include <linux/bootmem.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/prctl.h>
 
 #include <asm/futex.h>
 
@@ -306,15 +309,125 @@ static inline int hb_waiters_pending(struct futex_hash_bucket *hb)
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
+ *
+ * PROCESS_PRIVATE futexes of an mm with a private hash go there instead
+ * of the global table; only the threads of that mm can ever build such
+ * a key.
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
+	struct mm_struct *mm = key->private.mm;
+
+	if (!(key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED)) &&
+	    mm->futex_queues)
+		return &mm->futex_queues[hash & (mm->futex_hashsize - 1)];
+
 	return &futex_queues[hash & (futex_hashsize - 1)];
 }
 
+static void futex_hash_bucket_init(struct futex_hash_bucket *fhb)
+{
+	atomic_set(&fhb->waiters, 0);
+	plist_head_init(&fhb->chain);
+	spin_lock_init(&fhb->lock);
+}
+
+void futex_mm_init(struct mm_struct *mm)
+{
+	mm->futex_queues = NULL;
+	mm->futex_hashsize = 0;
+}
+
+static void futex_free_queues(struct futex_hash_bucket *queues)
+{
+	if (is_vmalloc_addr(queues))
+		vfree(queues);
+	else
+		kfree(queues);
+}
+
+void futex_hash_free(struct mm_struct *mm)
+{
+	if (mm->futex_queues)
+		futex_free_queues(mm->futex_queues);
+	futex_mm_init(mm);
+}
+
+/*
+ * Install a private hash of @slots buckets for the current mm, or go
+ * back to the global hash if @slots is 0.  A queued waiter would be
+ * lost by the switch, so this is only allowed while nobody else uses
+ * the mm, before the process starts its threads.
+ */
+static int futex_hash_set_slots(unsigned long slots)
+{
+	struct mm_struct *mm = current->mm;
+	struct futex_hash_bucket *queues = NULL;
+	int node = numa_node_id();
+	unsigned long i;
+
+	if (slots > futex_hashsize)
+		return -EINVAL;
+
+	if (slots) {
+		slots = roundup_pow_of_two(slots);
+		queues = kmalloc_node(slots * sizeof(*queues),
+				      GFP_KERNEL | __GFP_NOWARN, node);
+		if (!queues)
+			queues = vmalloc_node(slots * sizeof(*queues), node);
+		if (!queues)
+			return -ENOMEM;
+
+		for (i = 0; i < slots; i++)
+			futex_hash_bucket_init(&queues[i]);
+	}
+
+	if (atomic_read(&mm->mm_users) != 1) {
+		if (queues)
+			futex_free_queues(queues);
+		return -EBUSY;
+	}
+
+	futex_hash_free(mm);
+	mm->futex_queues = queues;
+	mm->futex_hashsize = slots;
+
+	return 0;
+}
+
+/**
+ * futex_hash_prctl() - PR_FUTEX_HASH
+ * @arg2:	PR_FUTEX_HASH_SET_SLOTS or PR_FUTEX_HASH_GET_SLOTS
+ * @arg3:	for SET, the number of buckets wanted, rounded up to a power
+ *		of two; -1 sizes the table for as many threads as there are
+ *		online CPUs, 0 goes back to the global hash
+ *
+ * Return: 0 or the current number of private buckets on success, else
+ * a negative error code.
+ */
+int futex_hash_prctl(unsigned long arg2, unsigned long arg3)
+{
+	unsigned long threads;
+
+	switch (arg2) {
+	case PR_FUTEX_HASH_SET_SLOTS:
+		if (arg3 == -1UL) {
+			threads = roundup_pow_of_two(num_online_cpus());
+			arg3 = min(max(4 * threads, 16UL), futex_hashsize);
+		}
+		return futex_hash_set_slots(arg3);
+	case PR_FUTEX_HASH_GET_SLOTS:
+		if (arg3)
+			return -EINVAL;
+		return current->mm->futex_hashsize;
+	}
+
+	return -EINVAL;
+}
+
 /*
  * Return 1 if two futex_keys are equal, 0 otherwise.
  */
@@ -2271,6 +2384,201 @@ static long futex_wait_restart(struct restart_block *restart)
 				restart->futex.val, tp, restart->futex.bitset);
 }
 
+/*
+ * Unqueue the first @count entries of @qs, which have been queued by
+ * futex_wait_multiple_setup().  Return the index of the first one that
+ * had already been woken, or -1.
+ */
+static int futex_unqueue_multiple(struct futex_q *qs, int count)
+{
+	int ret = -1;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (!unqueue_me(&qs[i]) && ret < 0)
+			ret = i;
+	}
+	return ret;
+}
+
+/**
+ * futex_wait_multiple_setup() - Prepare to wait on several futexes
+ * @wb:		the futexes and their expected values
+ * @count:	number of entries in @wb and @qs
+ * @flags:	futex flags (FLAGS_SHARED, etc.)
+ * @qs:		the futex_q of each futex
+ * @woken:	index of a futex that was woken during the setup
+ *
+ * Queue @qs on their hash buckets one by one, with the task already in
+ * TASK_INTERRUPTIBLE.  A wakeup of any queued entry from then on keeps the
+ * caller from sleeping, just as futex_wait_setup() followed by
+ * futex_wait_queue_me() does for a single futex.
+ *
+ * Return:
+ *  0 - all futexes matched and are queued, the task state is set;
+ *  1 - a futex was woken while queueing the others, it is in @woken and
+ *      nothing is left queued;
+ * <0 - -EFAULT or -EWOULDBLOCK, nothing is left queued
+ */
+static int futex_wait_multiple_setup(struct futex_wait_block *wb, int count,
+				     unsigned int flags, struct futex_q *qs,
+				     int *woken)
+{
+	struct futex_hash_bucket *hb;
+	u32 __user *uaddr;
+	u32 uval;
+	int i, j, ret;
+
+retry:
+	for (i = 0; i < count; i++) {
+		uaddr = (u32 __user *)(unsigned long)wb[i].uaddr;
+		ret = get_futex_key(uaddr, flags & FLAGS_SHARED, &qs[i].key,
+				    VERIFY_READ);
+		if (unlikely(ret)) {
+			while (--i >= 0)
+				put_futex_key(&qs[i].key);
+			return ret;
+		}
+	}
+
+	set_current_state(TASK_INTERRUPTIBLE);
+
+	for (i = 0; i < count; i++) {
+		uaddr = (u32 __user *)(unsigned long)wb[i].uaddr;
+		hb = queue_lock(&qs[i]);
+
+		/* See futex_wait_setup() for the ordering against wakers. */
+		ret = get_futex_value_locked(&uval, uaddr);
+		if (ret || uval != wb[i].val) {
+			queue_unlock(hb);
+			__set_current_state(TASK_RUNNING);
+
+			*woken = futex_unqueue_multiple(qs, i);
+			for (j = i; j < count; j++)
+				put_futex_key(&qs[j].key);
+			if (*woken >= 0)
+				return 1;
+
+			if (!ret)
+				return -EWOULDBLOCK;
+
+			/* Fault the page in and start over. */
+			ret = get_user(uval, uaddr);
+			if (ret)
+				return ret;
+			goto retry;
+		}
+
+		queue_me(&qs[i], hb);
+	}
+
+	return 0;
+}
+
+/*
+ * Wait on the array of @count futex_wait_blocks at @uaddr until one of the
+ * futexes is woken, and return its index.
+ */
+static int futex_wait_multiple(u32 __user *uaddr, unsigned int flags,
+			       u32 count, ktime_t *abs_time)
+{
+	struct hrtimer_sleeper timeout, *to = NULL;
+	struct futex_wait_block *wb;
+	struct futex_q *qs;
+	int i, woken, ret;
+
+	if (!count || count > FUTEX_MULTIPLE_MAX_COUNT)
+		return -EINVAL;
+
+	wb = kcalloc(count, sizeof(*wb), GFP_KERNEL);
+	qs = kcalloc(count, sizeof(*qs), GFP_KERNEL);
+	if (!wb || !qs) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	ret = -EFAULT;
+	if (copy_from_user(wb, uaddr, count * sizeof(*wb)))
+		goto out_free;
+
+	for (i = 0; i < count; i++) {
+		ret = -EINVAL;
+		if (!wb[i].bitset)
+			goto out_free;
+		qs[i] = futex_q_init;
+		qs[i].bitset = wb[i].bitset;
+	}
+
+	if (abs_time) {
+		to = &timeout;
+
+		hrtimer_init_on_stack(&to->timer, CLOCK_MONOTONIC,
+				      HRTIMER_MODE_ABS);
+		hrtimer_init_sleeper(to, current);
+		hrtimer_set_expires_range_ns(&to->timer, *abs_time,
+					     current->timer_slack_ns);
+	}
+
+retry:
+	ret = futex_wait_multiple_setup(wb, count, flags, qs, &woken);
+	if (ret) {
+		if (ret > 0)
+			ret = woken;
+		goto out;
+	}
+
+	/* Arm the timer */
+	if (to) {
+		hrtimer_start_expires(&to->timer, HRTIMER_MODE_ABS);
+		if (!hrtimer_active(&to->timer))
+			to->task = NULL;
+	}
+
+	/*
+	 * Sleep once for all of them, unless one has already been woken
+	 * while queueing the others, or the timer has already expired.
+	 */
+	for (i = 0; i < count; i++) {
+		if (plist_node_empty(&qs[i].list))
+			break;
+	}
+	if (i == count && (!to || to->task))
+		freezable_schedule();
+	__set_current_state(TASK_RUNNING);
+
+	/* unqueue_me() drops the q.key refs of the others as well */
+	ret = futex_unqueue_multiple(qs, count);
+	if (ret >= 0)
+		goto out;
+
+	ret = -ETIMEDOUT;
+	if (to && !to->task)
+		goto out;
+
+	/*
+	 * We expect signal_pending(current), but we might be the
+	 * victim of a spurious wakeup as well.
+	 */
+	if (!signal_pending(current))
+		goto retry;
+
+	/*
+	 * A relative timeout would start over on a restart, so only restart
+	 * without one.
+	 */
+	ret = abs_time ? -EINTR : -ERESTARTSYS;
+
+out:
+	if (to) {
+		hrtimer_cancel(&to->timer);
+		destroy_hrtimer_on_stack(&to->timer);
+	}
+out_free:
+	kfree(qs);
+	kfree(wb);
+	return ret;
+}
+
 
 /*
  * Userspace tried a 0 -> TID atomic transition of the futex value
@@ -2991,6 +3299,8 @@ long do_futex(u32 __user *uaddr, int op, u32 val, ktime_t *timeout,
 					     uaddr2);
 	case FUTEX_CMP_REQUEUE_PI:
 		return futex_requeue(uaddr, flags, uaddr2, val, val2, &val3, 1);
+	case FUTEX_WAIT_MULTIPLE:
+		return futex_wait_multiple(uaddr, flags, val, timeout);
 	}
 	return -ENOSYS;
 }
@@ -3007,14 +3317,15 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 
 	if (utime && (cmd == FUTEX_WAIT || cmd == FUTEX_LOCK_PI ||
 		      cmd == FUTEX_WAIT_BITSET ||
-		      cmd == FUTEX_WAIT_REQUEUE_PI)) {
+		      cmd == FUTEX_WAIT_REQUEUE_PI ||
+		      cmd == FUTEX_WAIT_MULTIPLE)) {
 		if (copy_from_user(&ts, utime, sizeof(ts)) != 0)
 			return -EFAULT;
 		if (!timespec_valid(&ts))
 			return -EINVAL;
 
 		t = timespec_to_ktime(ts);
-		if (cmd == FUTEX_WAIT)
+		if (cmd == FUTEX_WAIT || cmd == FUTEX_WAIT_MULTIPLE)
 			t = ktime_add_safe(ktime_get(), t);
 		tp = &t;
 	}
@@ -3069,11 +3380,8 @@ static int __init futex_init(void)
 
 	futex_detect_cmpxchg();
 
-	for (i = 0; i < futex_hashsize; i++) {
-		atomic_set(&futex_queues[i].waiters, 0);
-		plist_head_init(&futex_queues[i].chain);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+	for (i = 0; i < futex_hashsize; i++)
+		futex_hash_bucket_init(&futex_queues[i]);
 
 	return 0;
 }
@@ -0,0 +1,126 @@
+/*
+ * linux/kernel/irq/affinity.c
+ *
+ * Spreading of the interrupt vectors of multiqueue devices over the
+ * online cpus, node by node.
+ */
+
+#include <linux/interrupt.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/cpu.h>
+#include <linux/topology.h>
+
+/*
+ * Hand the cpus in @nmsk out to the @vecs vectors at @masks as evenly as
+ * possible, keeping thread siblings on the same vector.  @vecs must not
+ * be larger than the number of cpus in @nmsk, which is emptied.
+ */
+static void irq_spread_node_cpus(struct cpumask *masks, unsigned int vecs,
+				 struct cpumask *nmsk)
+{
+	unsigned int ncpus = cpumask_weight(nmsk);
+	unsigned int per_vec = ncpus / vecs, extra = ncpus % vecs;
+	unsigned int v, n, cpu, sibl;
+
+	for (v = 0; v < vecs; v++) {
+		n = per_vec + (v < extra);
+
+		while (n && !cpumask_empty(nmsk)) {
+			cpu = cpumask_first(nmsk);
+
+			for_each_cpu(sibl, topology_thread_cpumask(cpu)) {
+				if (!n)
+					break;
+				if (!cpumask_test_and_clear_cpu(sibl, nmsk))
+					continue;
+				cpumask_set_cpu(sibl, &masks[v]);
+				n--;
+			}
+
+			/* in case the topology isn't set up yet */
+			if (cpumask_test_and_clear_cpu(cpu, nmsk)) {
+				cpumask_set_cpu(cpu, &masks[v]);
+				n--;
+			}
+		}
+	}
+}
+
+/**
+ * irq_create_affinity_masks - spread interrupt vectors over the online cpus
+ * @nvec:	number of vectors
+ *
+ * Returns an array of @nvec cpumasks, to be freed with kfree(), or %NULL
+ * if it can't be allocated.  Every node with online cpus gets vectors in
+ * proportion to its number of cpus, and each vector covers cpus of only
+ * one node, unless there are fewer vectors than nodes.  When there are
+ * more vectors than online cpus, the extra vectors share the masks of
+ * the first ones.
+ */
+struct cpumask *irq_create_affinity_masks(unsigned int nvec)
+{
+	unsigned int nr_nodes = 0, nodes_left, cpus_left, vecs_left;
+	unsigned int used = 0, ncpus, vecs, v;
+	struct cpumask *masks;
+	cpumask_var_t nmsk;
+	int node;
+
+	if (!nvec)
+		return NULL;
+
+	masks = kcalloc(nvec, sizeof(*masks), GFP_KERNEL);
+	if (!masks)
+		return NULL;
+
+	if (!zalloc_cpumask_var(&nmsk, GFP_KERNEL)) {
+		kfree(masks);
+		return NULL;
+	}
+
+	get_online_cpus();
+
+	for_each_online_node(node)
+		if (cpumask_intersects(cpumask_of_node(node), cpu_online_mask))
+			nr_nodes++;
+
+	nodes_left = nr_nodes;
+	cpus_left = num_online_cpus();
+	vecs_left = nvec;
+
+	for_each_online_node(node) {
+		cpumask_and(nmsk, cpumask_of_node(node), cpu_online_mask);
+		ncpus = cpumask_weight(nmsk);
+		if (!ncpus)
+			continue;
+
+		/* Not enough vectors to go round, share them between nodes */
+		if (nvec <= nr_nodes) {
+			cpumask_or(&masks[used % nvec], &masks[used % nvec],
+				   nmsk);
+			used++;
+			continue;
+		}
+
+		/* Leave at least one vector for each of the other nodes */
+		vecs = DIV_ROUND_CLOSEST(vecs_left * ncpus, cpus_left);
+		vecs = clamp(vecs, 1U, vecs_left - (nodes_left - 1));
+		vecs = min(vecs, ncpus);
+
+		irq_spread_node_cpus(masks + used, vecs, nmsk);
+
+		used += vecs;
+		vecs_left -= vecs;
+		cpus_left -= ncpus;
+		nodes_left--;
+	}
+
+	put_online_cpus();
+
+	for (v = used; used && v < nvec; v++)
+		cpumask_copy(&masks[v], &masks[v % used]);
+
+	free_cpumask_var(nmsk);
+	return masks;
+}
+EXPORT_SYMBOL_GPL(irq_create_affinity_masks);
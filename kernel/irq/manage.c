@@ -14,6 +14,7 @@
 #include <linux/module.h>
 #include <linux/random.h>
 #include <linux/interrupt.h>
+#include <linux/cpu.h>
 #include <linux/slab.h>
 #include <linux/sched.h>
 #include <linux/sched/rt.h>
@@ -119,6 +120,7 @@ int irq_can_set_affinity(unsigned int irq)
 	struct irq_desc *desc = irq_to_desc(irq);
 
 	if (!desc || !irqd_can_balance(&desc->irq_data) ||
+	    irqd_affinity_is_managed(&desc->irq_data) ||
 	    !desc->irq_data.chip || !desc->irq_data.chip->irq_set_affinity)
 		return 0;
 
@@ -246,6 +248,81 @@ int irq_set_affinity_hint(unsigned int irq, const struct cpumask *m)
 }
 EXPORT_SYMBOL_GPL(irq_set_affinity_hint);
 
+/**
+ *	irq_set_affinity_managed - let the kernel manage an irq's affinity
+ *	@irq:		Interrupt to manage
+ *	@mask:		cpus to deliver the interrupt to, or %NULL to give the
+ *			affinity back to user space
+ *
+ *	The interrupt is moved to @mask, which is also reported as its
+ *	affinity hint.  From then on neither user space nor request_irq()
+ *	changes its affinity, and @mask is applied again each time one of
+ *	its cpus comes online after having been taken down.  @mask must stay
+ *	valid until the interrupt is released with a %NULL mask.
+ */
+int irq_set_affinity_managed(unsigned int irq, const struct cpumask *mask)
+{
+	unsigned long flags;
+	struct irq_desc *desc = irq_get_desc_lock(irq, &flags, IRQ_GET_DESC_CHECK_GLOBAL);
+	int ret = 0;
+
+	if (!desc)
+		return -EINVAL;
+
+	if (mask) {
+		desc->affinity_hint = mask;
+		irqd_set(&desc->irq_data, IRQD_AFFINITY_MANAGED);
+		if (cpumask_intersects(mask, cpu_online_mask))
+			ret = irq_set_affinity_locked(&desc->irq_data, mask,
+						      false);
+	} else {
+		irqd_clear(&desc->irq_data, IRQD_AFFINITY_MANAGED);
+		desc->affinity_hint = NULL;
+	}
+	irq_put_desc_unlock(desc, flags);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(irq_set_affinity_managed);
+
+/*
+ * A managed interrupt moved away from a cpu going down is moved back to
+ * its mask when the cpu comes online again.
+ */
+static int irq_affinity_cpu_callback(struct notifier_block *nfb,
+				     unsigned long action, void *hcpu)
+{
+	unsigned int cpu = (unsigned long)hcpu;
+	struct irq_desc *desc;
+	unsigned long flags;
+	unsigned int irq;
+
+	if ((action & ~CPU_TASKS_FROZEN) != CPU_ONLINE)
+		return NOTIFY_OK;
+
+	for_each_active_irq(irq) {
+		desc = irq_to_desc(irq);
+		if (!desc)
+			continue;
+
+		raw_spin_lock_irqsave(&desc->lock, flags);
+		if (irqd_affinity_is_managed(&desc->irq_data) &&
+		    desc->affinity_hint &&
+		    cpumask_test_cpu(cpu, desc->affinity_hint))
+			irq_set_affinity_locked(&desc->irq_data,
+						desc->affinity_hint, false);
+		raw_spin_unlock_irqrestore(&desc->lock, flags);
+	}
+
+	return NOTIFY_OK;
+}
+
+static int __init irq_affinity_hotplug_init(void)
+{
+	hotcpu_notifier(irq_affinity_cpu_callback, 0);
+	return 0;
+}
+core_initcall(irq_affinity_hotplug_init);
+
 static void irq_affinity_notify(struct work_struct *work)
 {
 	struct irq_affinity_notify *notify =
@@ -1343,8 +1420,12 @@ static struct irqaction *__free_irq(unsigned int irq, void *dev_id)
 	}
 
 #ifdef CONFIG_SMP
-	/* make sure affinity_hint is cleaned up */
-	if (WARN_ON_ONCE(desc->affinity_hint))
+	/*
+	 * make sure affinity_hint is cleaned up, managed interrupts keep
+	 * theirs until the owner of the vector releases it
+	 */
+	if (!irqd_affinity_is_managed(&desc->irq_data) &&
+	    WARN_ON_ONCE(desc->affinity_hint))
 		desc->affinity_hint = NULL;
 #endif
 
@@ -52,10 +52,10 @@
 #include <linux/kthread.h>
 #include <linux/prefetch.h>
 #include <linux/delay.h>
-#include <linux/stop_machine.h>
 #include <linux/random.h>
 #include <linux/ftrace_event.h>
 #include <linux/suspend.h>
+#include <linux/tick.h>
 
 #include "tree.h"
 #include "rcu.h"
@@ -70,6 +70,7 @@ MODULE_ALIAS("rcutree");
 
 static struct lock_class_key rcu_node_class[RCU_NUM_LVLS];
 static struct lock_class_key rcu_fqs_class[RCU_NUM_LVLS];
+static struct lock_class_key rcu_exp_class[RCU_NUM_LVLS];
 
 /*
  * In order to export the rcu_state name to the tracing tools, it
@@ -188,6 +189,8 @@ static int rcu_gp_in_progress(struct rcu_state *rsp)
  * one since the start of the grace period, this just sets a flag.
  * The caller must have disabled preemption.
  */
+static void rcu_report_exp_qs(struct rcu_state *rsp, struct rcu_data *rdp);
+
 void rcu_sched_qs(int cpu)
 {
 	struct rcu_data *rdp = &per_cpu(rcu_sched_data, cpu);
@@ -195,6 +198,8 @@ void rcu_sched_qs(int cpu)
 	if (rdp->passed_quiesce == 0)
 		trace_rcu_grace_period(TPS("rcu_sched"), rdp->gpnum, TPS("cpuqs"));
 	rdp->passed_quiesce = 1;
+	if (unlikely(ACCESS_ONCE(rdp->exp_need_qs)))
+		rcu_report_exp_qs(&rcu_sched_state, rdp);
 }
 
 void rcu_bh_qs(int cpu)
@@ -2115,6 +2120,7 @@ static void rcu_do_batch(struct rcu_state *rsp, struct rcu_data *rdp)
 	 */
 	local_irq_save(flags);
 	WARN_ON_ONCE(cpu_is_offline(smp_processor_id()));
+	nohz_full_noise_inc(NOHZ_NOISE_RCU);
 	bl = rdp->blimit;
 	trace_rcu_batch_start(rsp->name, rdp->qlen_lazy, rdp->qlen, bl);
 	list = rdp->nxtlist;
@@ -2691,21 +2697,73 @@ void cond_synchronize_rcu(unsigned long oldstate)
 }
 EXPORT_SYMBOL_GPL(cond_synchronize_rcu);
 
-static int synchronize_sched_expedited_cpu_stop(void *data)
+/*
+ * Report an expedited quiescent state for the CPU of @rdp, if the current
+ * expedited grace period is still waiting for one.  Called on that CPU,
+ * with preemption disabled.
+ */
+static void rcu_report_exp_qs(struct rcu_state *rsp, struct rcu_data *rdp)
 {
-	/*
-	 * There must be a full memory barrier on each affected CPU
-	 * between the time that try_stop_cpus() is called and the
-	 * time that it returns.
-	 *
-	 * In the current initial implementation of cpu_stop, the
-	 * above condition is already met when the control reaches
-	 * this point and the following smp_mb() is not strictly
-	 * necessary.  Do smp_mb() anyway for documentation and
-	 * robustness against future implementation changes.
-	 */
-	smp_mb(); /* See above comment block. */
-	return 0;
+	if (!xchg(&rdp->exp_need_qs, false))
+		return;
+	if (atomic_dec_and_test(&rsp->expedited_need_qs))
+		wake_up(&rsp->expedited_wq);
+}
+
+/*
+ * IPI handler for synchronize_sched_expedited().  If the CPU was idle, it
+ * is in a quiescent state right now.  Otherwise it may be within an
+ * RCU-sched read-side critical section, so ask for a context switch, which
+ * rcu_sched_qs() reports once it is done.
+ */
+static void synchronize_sched_expedited_ipi(void *data)
+{
+	struct rcu_state *rsp = data;
+	struct rcu_data *rdp = this_cpu_ptr(rsp->rda);
+
+	if (!ACCESS_ONCE(rdp->exp_need_qs))
+		return;
+	if (rcu_is_cpu_rrupt_from_idle()) {
+		rcu_report_exp_qs(rsp, rdp);
+		return;
+	}
+	resched_cpu(smp_processor_id());
+}
+
+/*
+ * Walk up the rcu_node tree from this CPU's leaf, taking each level's
+ * ->exp_funnel_mutex in turn, until either somebody else's expedited grace
+ * period is seen to have covered our ticket @s, or the root is reached.
+ * Return the root rcu_node with its mutex held in the latter case, or NULL.
+ */
+static struct rcu_node *exp_funnel_lock(struct rcu_state *rsp, long s)
+{
+	struct rcu_node *rnp0;
+	struct rcu_node *rnp1 = NULL;
+
+	rnp0 = per_cpu_ptr(rsp->rda, raw_smp_processor_id())->mynode;
+	for (; rnp0 != NULL; rnp0 = rnp0->parent) {
+		if (ULONG_CMP_GE((ulong)atomic_long_read(&rsp->expedited_done),
+				 (ulong)s))
+			goto done;
+		mutex_lock(&rnp0->exp_funnel_mutex);
+		if (rnp1)
+			mutex_unlock(&rnp1->exp_funnel_mutex);
+		rnp1 = rnp0;
+	}
+	if (ULONG_CMP_GE((ulong)atomic_long_read(&rsp->expedited_done),
+			 (ulong)s))
+		goto done;
+	return rnp1;
+
+done:
+	if (rnp1)
+		mutex_unlock(&rnp1->exp_funnel_mutex);
+	/* ensure test happens before caller kfree */
+	smp_mb__before_atomic_inc(); /* ^^^ */
+	atomic_long_inc(rnp1 ? &rsp->expedited_workdone2
+			     : &rsp->expedited_workdone1);
+	return NULL;
 }
 
 /**
@@ -2725,39 +2783,36 @@ static int synchronize_sched_expedited_cpu_stop(void *data)
  * these restriction will result in deadlock.
  *
  * This implementation can be thought of as an application of ticket
- * locking to RCU, with sync_sched_expedited_started and
- * sync_sched_expedited_done taking on the roles of the halves
- * of the ticket-lock word.  Each task atomically increments
- * sync_sched_expedited_started upon entry, snapshotting the old value,
- * then attempts to stop all the CPUs.  If this succeeds, then each
- * CPU will have executed a context switch, resulting in an RCU-sched
- * grace period.  We are then done, so we use atomic_cmpxchg() to
- * update sync_sched_expedited_done to match our snapshot -- but
- * only if someone else has not already advanced past our snapshot.
+ * locking to RCU, with ->expedited_start and ->expedited_done taking on
+ * the roles of the halves of the ticket-lock word.  Each task atomically
+ * increments ->expedited_start upon entry, then funnels up the rcu_node
+ * tree through the ->exp_funnel_mutex of each level.  Whoever gets to the
+ * root drives one expedited grace period on behalf of every ticket taken
+ * before it started, then advances ->expedited_done past them.  Those
+ * still on their way up see that and return without doing anything.
  *
- * On the other hand, if try_stop_cpus() fails, we check the value
- * of sync_sched_expedited_done.  If it has advanced past our
- * initial snapshot, then someone else must have forced a grace period
- * some time after we took our snapshot.  In this case, our work is
- * done for us, and we can simply return.  Otherwise, we try again,
- * but keep our initial snapshot for purposes of checking for someone
- * doing our work for us.
- *
- * If we fail too many times in a row, we fall back to synchronize_sched().
+ * The grace period itself only disturbs CPUs that need it.  CPUs in
+ * dynticks idle, which includes nohz_full CPUs running in user mode, are
+ * already in an extended quiescent state and are left alone.  The
+ * others get an IPI; the idle ones among them report right away, the
+ * rest are asked to reschedule and report from their next context
+ * switch, which rcu_sched_qs() notes.
  */
 void synchronize_sched_expedited(void)
 {
-	long firstsnap, s, snap;
-	int trycount = 0;
+	int cpu, this_cpu;
+	long s, snap;
+	struct rcu_data *rdp;
+	struct rcu_node *rnp;
 	struct rcu_state *rsp = &rcu_sched_state;
 
 	/*
 	 * If we are in danger of counter wrap, just do synchronize_sched().
-	 * By allowing sync_sched_expedited_started to advance no more than
-	 * ULONG_MAX/8 ahead of sync_sched_expedited_done, we are ensuring
-	 * that more than 3.5 billion CPUs would be required to force a
-	 * counter wrap on a 32-bit system.  Quite a few more CPUs would of
-	 * course be required on a 64-bit system.
+	 * By allowing ->expedited_start to advance no more than ULONG_MAX/8
+	 * ahead of ->expedited_done, we are ensuring that more than 3.5
+	 * billion CPUs would be required to force a counter wrap on a 32-bit
+	 * system.  Quite a few more CPUs would of course be required on a
+	 * 64-bit system.
 	 */
 	if (ULONG_CMP_GE((ulong)atomic_long_read(&rsp->expedited_start),
 			 (ulong)atomic_long_read(&rsp->expedited_done) +
@@ -2771,80 +2826,53 @@ void synchronize_sched_expedited(void)
 	 * Take a ticket.  Note that atomic_inc_return() implies a
 	 * full memory barrier.
 	 */
-	snap = atomic_long_inc_return(&rsp->expedited_start);
-	firstsnap = snap;
-	get_online_cpus();
-	WARN_ON_ONCE(cpu_is_offline(raw_smp_processor_id()));
+	s = atomic_long_inc_return(&rsp->expedited_start);
+	rnp = exp_funnel_lock(rsp, s);
+	if (!rnp)
+		return;
 
 	/*
-	 * Each pass through the following loop attempts to force a
-	 * context switch on each CPU.
+	 * Everybody who took a ticket up to now is covered by the grace
+	 * period we are about to start.
 	 */
-	while (try_stop_cpus(cpu_online_mask,
-			     synchronize_sched_expedited_cpu_stop,
-			     NULL) == -EAGAIN) {
-		put_online_cpus();
-		atomic_long_inc(&rsp->expedited_tryfail);
-
-		/* Check to see if someone else did our work for us. */
-		s = atomic_long_read(&rsp->expedited_done);
-		if (ULONG_CMP_GE((ulong)s, (ulong)firstsnap)) {
-			/* ensure test happens before caller kfree */
-			smp_mb__before_atomic_inc(); /* ^^^ */
-			atomic_long_inc(&rsp->expedited_workdone1);
-			return;
-		}
-
-		/* No joy, try again later.  Or just synchronize_sched(). */
-		if (trycount++ < 10) {
-			udelay(trycount * num_online_cpus());
-		} else {
-			wait_rcu_gp(call_rcu_sched);
-			atomic_long_inc(&rsp->expedited_normal);
-			return;
-		}
-
-		/* Recheck to see if someone else did our work for us. */
-		s = atomic_long_read(&rsp->expedited_done);
-		if (ULONG_CMP_GE((ulong)s, (ulong)firstsnap)) {
-			/* ensure test happens before caller kfree */
-			smp_mb__before_atomic_inc(); /* ^^^ */
-			atomic_long_inc(&rsp->expedited_workdone2);
-			return;
-		}
+	snap = atomic_long_read(&rsp->expedited_start);
+	smp_mb(); /* ensure read is before sampling the CPUs. */
 
-		/*
-		 * Refetching sync_sched_expedited_started allows later
-		 * callers to piggyback on our grace period.  We retry
-		 * after they started, so our grace period works for them,
-		 * and they started after our first try, so their grace
-		 * period works for us.
-		 */
-		get_online_cpus();
-		snap = atomic_long_read(&rsp->expedited_start);
-		smp_mb(); /* ensure read is before try_stop_cpus(). */
-	}
-	atomic_long_inc(&rsp->expedited_stoppedcpus);
+	get_online_cpus();
+	WARN_ON_ONCE(cpu_is_offline(raw_smp_processor_id()));
 
 	/*
-	 * Everyone up to our most recent fetch is covered by our grace
-	 * period.  Update the counter, but only if our work is still
-	 * relevant -- which it won't be if someone who started later
-	 * than we did already did their update.
+	 * Hold one count ourselves so that early reports cannot complete
+	 * the grace period before all CPUs have been looked at.  The CPU
+	 * we run on is not in an RCU-sched read-side critical section,
+	 * since we are.
 	 */
-	do {
-		atomic_long_inc(&rsp->expedited_done_tries);
-		s = atomic_long_read(&rsp->expedited_done);
-		if (ULONG_CMP_GE((ulong)s, (ulong)snap)) {
-			/* ensure test happens before caller kfree */
-			smp_mb__before_atomic_inc(); /* ^^^ */
-			atomic_long_inc(&rsp->expedited_done_lost);
-			break;
+	atomic_set(&rsp->expedited_need_qs, 1);
+	this_cpu = raw_smp_processor_id();
+	for_each_online_cpu(cpu) {
+		if (cpu == this_cpu)
+			continue;
+		rdp = per_cpu_ptr(rsp->rda, cpu);
+		if (!(atomic_add_return(0, &rdp->dynticks->dynticks) & 0x1)) {
+			atomic_long_inc(&rsp->expedited_idle);
+			continue;
 		}
-	} while (atomic_long_cmpxchg(&rsp->expedited_done, s, snap) != s);
-	atomic_long_inc(&rsp->expedited_done_exit);
+		atomic_inc(&rsp->expedited_need_qs);
+		smp_mb__after_atomic_inc(); /* Count before the flag. */
+		ACCESS_ONCE(rdp->exp_need_qs) = true;
+		smp_call_function_single(cpu, synchronize_sched_expedited_ipi,
+					 rsp, 0);
+		atomic_long_inc(&rsp->expedited_ipis);
+	}
+	if (!atomic_dec_and_test(&rsp->expedited_need_qs))
+		wait_event(rsp->expedited_wq,
+			   !atomic_read(&rsp->expedited_need_qs));
+	smp_mb(); /* ensure the quiescent states are before the update. */
 
 	put_online_cpus();
+
+	atomic_long_set(&rsp->expedited_done, snap);
+	mutex_unlock(&rnp->exp_funnel_mutex);
 }
 EXPORT_SYMBOL_GPL(synchronize_sched_expedited);
 
@@ -3365,6 +3393,10 @@ static void __init rcu_init_one(struct rcu_state *rsp,
 			       "rcu_node_fqs_1",
 			       "rcu_node_fqs_2",
 			       "rcu_node_fqs_3" };  /* Match MAX_RCU_LVLS */
+	static char *exp[] = { "rcu_node_exp_0",
+			       "rcu_node_exp_1",
+			       "rcu_node_exp_2",
+			       "rcu_node_exp_3" };  /* Match MAX_RCU_LVLS */
 	int cpustride = 1;
 	int i;
 	int j;
@@ -3396,6 +3428,9 @@ static void __init rcu_init_one(struct rcu_state *rsp,
 			raw_spin_lock_init(&rnp->fqslock);
 			lockdep_set_class_and_name(&rnp->fqslock,
 						   &rcu_fqs_class[i], fqs[i]);
+			mutex_init(&rnp->exp_funnel_mutex);
+			lockdep_set_class_and_name(&rnp->exp_funnel_mutex,
+						   &rcu_exp_class[i], exp[i]);
 			rnp->gpnum = rsp->gpnum;
 			rnp->completed = rsp->completed;
 			rnp->qsmask = 0;
@@ -3422,6 +3457,7 @@ static void __init rcu_init_one(struct rcu_state *rsp,
 
 	rsp->rda = rda;
 	init_waitqueue_head(&rsp->gp_wq);
+	init_waitqueue_head(&rsp->expedited_wq);
 	init_irq_work(&rsp->wakeup_work, rsp_wakeup);
 	rnp = rsp->level[rcu_num_lvls - 1];
 	for_each_possible_cpu(i) {
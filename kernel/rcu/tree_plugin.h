@@ -99,6 +99,16 @@ static void __init rcu_bootup_announce_oddness(void)
 	cpumask_copy(rcu_nocb_mask, cpu_possible_mask);
 #endif /* #ifdef CONFIG_RCU_NOCB_CPU_ALL */
 #endif /* #ifndef CONFIG_RCU_NOCB_CPU_NONE */
+#ifdef CONFIG_NO_HZ_FULL
+	/* Full dynticks cpus never invoke their own callbacks. */
+	if (tick_nohz_full_running) {
+		if (!have_rcu_nocb_mask) {
+			zalloc_cpumask_var(&rcu_nocb_mask, GFP_KERNEL);
+			have_rcu_nocb_mask = true;
+		}
+		cpumask_or(rcu_nocb_mask, rcu_nocb_mask, tick_nohz_full_mask);
+	}
+#endif /* #ifdef CONFIG_NO_HZ_FULL */
 	if (have_rcu_nocb_mask) {
 		if (!cpumask_subset(rcu_nocb_mask, cpu_possible_mask)) {
 			pr_info("\tNote: kernel parameter 'rcu_nocbs=' contains nonexistent CPUs.\n");
@@ -2281,6 +2291,9 @@ static int rcu_nocb_kthread(void *arg)
 	struct rcu_head **tail;
 	struct rcu_data *rdp = arg;
 
+	/* The callbacks are invoked on the housekeeping cpus. */
+	housekeeping_affine(current);
+
 	/* Each pass through this loop invokes one batch of callbacks */
 	for (;;) {
 		/* If not polling, wait for next batch of callbacks. */
@@ -2880,8 +2893,10 @@ static bool is_sysidle_rcu_state(struct rcu_state *rsp)
 	return false;
 }
 
+/* Keep the grace-period kthreads off the full dynticks cpus. */
 static void rcu_bind_gp_kthread(void)
 {
+	housekeeping_affine(current);
 }
 
 static void rcu_sysidle_report_gp(struct rcu_state *rsp, int isidle,
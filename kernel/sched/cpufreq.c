@@ -0,0 +1,28 @@
+/*
+ * Scheduler code and data structures related to cpufreq.
+ *
+ * Lets a cpufreq governor hook into the scheduler's utilization updates,
+ * see cpufreq_update_util().
+ */
+
+#include "sched.h"
+
+DEFINE_PER_CPU(struct update_util_data __rcu *, cpufreq_update_util_data);
+
+/**
+ * cpufreq_set_update_util_data - populate the cpu's update_util_data pointer
+ * @cpu: the cpu to set the pointer for
+ * @data: the new pointer value, or %NULL to clear it
+ *
+ * The scheduler calls @data->func with the rq lock held, under
+ * rcu_read_lock_sched().  After clearing the pointer the caller has to wait
+ * with synchronize_sched() before freeing what @data points to.
+ */
+void cpufreq_set_update_util_data(int cpu, struct update_util_data *data)
+{
+	if (WARN_ON(data && !data->func))
+		return;
+
+	rcu_assign_pointer(per_cpu(cpufreq_update_util_data, cpu), data);
+}
+EXPORT_SYMBOL_GPL(cpufreq_set_update_util_data);
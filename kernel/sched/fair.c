@@ -2378,21 +2378,31 @@ static inline void __update_group_entity_contrib(struct sched_entity *se)
 		se->avg.load_avg_contrib >>= NICE_0_SHIFT;
 	}
 }
-
-static inline void update_rq_runnable_avg(struct rq *rq, int runnable)
-{
-	__update_entity_runnable_avg(rq_clock_task(rq), &rq->avg, runnable);
-	__update_tg_runnable_avg(&rq->avg, &rq->cfs);
-}
 #else /* CONFIG_FAIR_GROUP_SCHED */
 static inline void __update_cfs_rq_tg_load_contrib(struct cfs_rq *cfs_rq,
 						 int force_update) {}
 static inline void __update_tg_runnable_avg(struct sched_avg *sa,
 						  struct cfs_rq *cfs_rq) {}
 static inline void __update_group_entity_contrib(struct sched_entity *se) {}
-static inline void update_rq_runnable_avg(struct rq *rq, int runnable) {}
 #endif /* CONFIG_FAIR_GROUP_SCHED */
 
+/*
+ * rq->avg tracks the fraction of recent time the cpu had something to
+ * run; besides feeding the group shares it is the utilization handed to
+ * cpufreq.
+ */
+static inline void update_rq_runnable_avg(struct rq *rq, int runnable)
+{
+	unsigned long util;
+
+	__update_entity_runnable_avg(rq_clock_task(rq), &rq->avg, runnable);
+	__update_tg_runnable_avg(&rq->avg, &rq->cfs);
+
+	util = rq->avg.runnable_avg_sum * SCHED_POWER_SCALE /
+	       (rq->avg.runnable_avg_period + 1);
+	cpufreq_update_util(rq, util, SCHED_POWER_SCALE);
+}
+
 static inline void __update_task_entity_contrib(struct sched_entity *se)
 {
 	u32 contrib;
@@ -3075,22 +3085,53 @@ static inline u64 sched_cfs_bandwidth_slice(void)
 	return (u64)sysctl_sched_cfs_bandwidth_slice * NSEC_PER_USEC;
 }
 
+/*
+ * Fold the runtime returned without the lock back into the pool.
+ *
+ * requires cfs_b->lock
+ */
+static inline void __fold_cfs_returned_runtime(struct cfs_bandwidth *cfs_b)
+{
+	s64 returned = atomic64_xchg(&cfs_b->returned, 0);
+
+	if (returned > 0)
+		cfs_b->runtime += returned;
+}
+
 /*
  * Replenish runtime according to assigned quota and update expiration time.
  * We use sched_clock_cpu directly instead of rq->clock to avoid adding
  * additional synchronization around rq->lock.
  *
+ * With a burst allowance the runtime left unused in a period carries over,
+ * up to quota + burst, instead of being dropped.
+ *
  * requires cfs_b->lock
  */
 void __refill_cfs_bandwidth_runtime(struct cfs_bandwidth *cfs_b)
 {
-	u64 now;
+	u64 now, used;
 
 	if (cfs_b->quota == RUNTIME_INF)
 		return;
 
+	__fold_cfs_returned_runtime(cfs_b);
+
+	/* account the periods which ran on carried over runtime */
+	used = cfs_b->runtime_snap > cfs_b->runtime ?
+	       cfs_b->runtime_snap - cfs_b->runtime : 0;
+	if (used > cfs_b->quota) {
+		cfs_b->nr_bursts++;
+		cfs_b->burst_time += used - cfs_b->quota;
+	}
+
 	now = sched_clock_cpu(smp_processor_id());
-	cfs_b->runtime = cfs_b->quota;
+	if (cfs_b->burst)
+		cfs_b->runtime = min(cfs_b->runtime + cfs_b->quota,
+				     cfs_b->quota + cfs_b->burst);
+	else
+		cfs_b->runtime = cfs_b->quota;
+	cfs_b->runtime_snap = cfs_b->runtime;
 	cfs_b->runtime_expires = now + ktime_to_ns(cfs_b->period);
 }
 
@@ -3108,6 +3149,24 @@ static inline u64 cfs_rq_clock_task(struct cfs_rq *cfs_rq)
 	return rq_clock_task(rq_of(cfs_rq)) - cfs_rq->throttled_clock_task_time;
 }
 
+/*
+ * Take up to @want of the runtime other cfs_rqs handed back, without
+ * cfs_b->lock.
+ */
+static u64 take_cfs_returned_runtime(struct cfs_bandwidth *cfs_b, u64 want)
+{
+	s64 old = atomic64_read(&cfs_b->returned), cur, take;
+
+	while (old > 0) {
+		take = min_t(s64, old, want);
+		cur = atomic64_cmpxchg(&cfs_b->returned, old, old - take);
+		if (cur == old)
+			return take;
+		old = cur;
+	}
+	return 0;
+}
+
 /* returns 0 on failure to allocate runtime */
 static int assign_cfs_rq_runtime(struct cfs_rq *cfs_rq)
 {
@@ -3118,6 +3177,23 @@ static int assign_cfs_rq_runtime(struct cfs_rq *cfs_rq)
 	/* note: this is a positive sum as runtime_remaining <= 0 */
 	min_amount = sched_cfs_bandwidth_slice() - cfs_rq->runtime_remaining;
 
+	/*
+	 * Slices given back by the other cpus are reused first, which most
+	 * of the time spares us cfs_b->lock.  They are only valid for the
+	 * period they were handed back in, see __return_cfs_rq_runtime().
+	 */
+	if (cfs_b->quota != RUNTIME_INF && ACCESS_ONCE(cfs_b->timer_active) &&
+	    cfs_rq->runtime_expires == ACCESS_ONCE(cfs_b->runtime_expires)) {
+		amount = take_cfs_returned_runtime(cfs_b, min_amount);
+		if (amount == min_amount) {
+			/* racy: at worst the timer idles a period early */
+			if (ACCESS_ONCE(cfs_b->idle))
+				ACCESS_ONCE(cfs_b->idle) = 0;
+			cfs_rq->runtime_remaining += amount;
+			return 1;
+		}
+	}
+
 	raw_spin_lock(&cfs_b->lock);
 	if (cfs_b->quota == RUNTIME_INF)
 		amount = min_amount;
@@ -3133,11 +3209,15 @@ static int assign_cfs_rq_runtime(struct cfs_rq *cfs_rq)
 			__start_cfs_bandwidth(cfs_b, false);
 		}
 
+		__fold_cfs_returned_runtime(cfs_b);
 		if (cfs_b->runtime > 0) {
-			amount = min(cfs_b->runtime, min_amount);
-			cfs_b->runtime -= amount;
-			cfs_b->idle = 0;
+			u64 more = min(cfs_b->runtime, min_amount - amount);
+
+			cfs_b->runtime -= more;
+			amount += more;
 		}
+		if (amount)
+			cfs_b->idle = 0;
 	}
 	expires = cfs_b->runtime_expires;
 	raw_spin_unlock(&cfs_b->lock);
@@ -3318,8 +3398,9 @@ void unthrottle_cfs_rq(struct cfs_rq *cfs_rq)
 	struct rq *rq = rq_of(cfs_rq);
 	struct cfs_bandwidth *cfs_b = tg_cfs_bandwidth(cfs_rq->tg);
 	struct sched_entity *se;
-	int enqueue = 1;
+	int enqueue = 1, bucket;
 	long task_delta;
+	u64 delta;
 
 	se = cfs_rq->tg->se[cpu_of(rq)];
 
@@ -3327,8 +3408,13 @@ void unthrottle_cfs_rq(struct cfs_rq *cfs_rq)
 
 	update_rq_clock(rq);
 
+	delta = rq_clock(rq) - cfs_rq->throttled_clock;
+	bucket = min_t(int, fls64(div_u64(delta, NSEC_PER_USEC)),
+		       CFS_THROTTLED_HIST_SIZE - 1);
+
 	raw_spin_lock(&cfs_b->lock);
-	cfs_b->throttled_time += rq_clock(rq) - cfs_rq->throttled_clock;
+	cfs_b->throttled_time += delta;
+	cfs_b->throttled_hist[bucket]++;
 	list_del_rcu(&cfs_rq->throttled_list);
 	raw_spin_unlock(&cfs_b->lock);
 
@@ -3526,26 +3612,37 @@ static void start_cfs_slack_bandwidth(struct cfs_bandwidth *cfs_b)
 				ns_to_ktime(cfs_bandwidth_slack_period));
 }
 
-/* we know any runtime found here is valid as update_curr() precedes return */
+/*
+ * We know any runtime found here is valid as update_curr() precedes return.
+ *
+ * The slack goes back through cfs_b->returned, so that cfs_rqs going idle
+ * on many cpus at once do not all queue up on cfs_b->lock; the lock is
+ * only taken when there is somebody throttled to hand the runtime to.
+ * A return racing with the period refill can carry its slack, at most a
+ * slice, over into the next period.
+ */
 static void __return_cfs_rq_runtime(struct cfs_rq *cfs_rq)
 {
 	struct cfs_bandwidth *cfs_b = tg_cfs_bandwidth(cfs_rq->tg);
 	s64 slack_runtime = cfs_rq->runtime_remaining - min_cfs_rq_runtime;
+	s64 returned;
 
 	if (slack_runtime <= 0)
 		return;
 
-	raw_spin_lock(&cfs_b->lock);
 	if (cfs_b->quota != RUNTIME_INF &&
-	    cfs_rq->runtime_expires == cfs_b->runtime_expires) {
-		cfs_b->runtime += slack_runtime;
+	    cfs_rq->runtime_expires == ACCESS_ONCE(cfs_b->runtime_expires)) {
+		returned = atomic64_add_return(slack_runtime, &cfs_b->returned);
 
 		/* we are under rq->lock, defer unthrottling using a timer */
-		if (cfs_b->runtime > sched_cfs_bandwidth_slice() &&
-		    !list_empty(&cfs_b->throttled_cfs_rq))
+		if (!list_empty(&cfs_b->throttled_cfs_rq) &&
+		    returned + ACCESS_ONCE(cfs_b->runtime) >
+		    sched_cfs_bandwidth_slice()) {
+			raw_spin_lock(&cfs_b->lock);
 			start_cfs_slack_bandwidth(cfs_b);
+			raw_spin_unlock(&cfs_b->lock);
+		}
 	}
-	raw_spin_unlock(&cfs_b->lock);
 
 	/* even if it's not valid for return we don't want to try again */
 	cfs_rq->runtime_remaining -= slack_runtime;
@@ -3578,6 +3675,7 @@ static void do_sched_cfs_slack_timer(struct cfs_bandwidth *cfs_b)
 		return;
 	}
 
+	__fold_cfs_returned_runtime(cfs_b);
 	if (cfs_b->quota != RUNTIME_INF && cfs_b->runtime > slice) {
 		runtime = cfs_b->runtime;
 		cfs_b->runtime = 0;
@@ -3674,6 +3772,7 @@ void init_cfs_bandwidth(struct cfs_bandwidth *cfs_b)
 {
 	raw_spin_lock_init(&cfs_b->lock);
 	cfs_b->runtime = 0;
+	atomic64_set(&cfs_b->returned, 0);
 	cfs_b->quota = RUNTIME_INF;
 	cfs_b->period = ns_to_ktime(default_cfs_period());
 
@@ -4356,13 +4455,199 @@ find_idlest_cpu(struct sched_group *group, struct task_struct *p, int this_cpu)
 	return idlest;
 }
 
+/*
+ * The cpu after @cpu in @mask, wrapping around.
+ */
+static inline int sis_next_cpu(int cpu, const struct cpumask *mask)
+{
+	cpu = cpumask_next(cpu, mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = cpumask_first(mask);
+	return cpu;
+}
+
+#ifdef CONFIG_SCHED_SMT
+static inline void set_idle_cores(int cpu, int val)
+{
+	struct sched_domain_shared *sds;
+
+	sds = rcu_dereference(per_cpu(sd_llc_shared, cpu));
+	if (sds)
+		ACCESS_ONCE(sds->has_idle_cores) = val;
+}
+
+static inline bool test_idle_cores(int cpu, bool def)
+{
+	struct sched_domain_shared *sds;
+
+	sds = rcu_dereference(per_cpu(sd_llc_shared, cpu));
+	if (sds)
+		return ACCESS_ONCE(sds->has_idle_cores);
+
+	return def;
+}
+
+/*
+ * Called when @rq's cpu goes idle: if all its siblings are idle already,
+ * flag the LLC as having an idle core for select_idle_core().  The flag
+ * is only ever a hint, it is cleared by the next scan that finds none.
+ */
+void update_idle_core(struct rq *rq)
+{
+	int core = cpu_of(rq);
+	int cpu;
+
+	rcu_read_lock();
+	if (test_idle_cores(core, true))
+		goto unlock;
+
+	for_each_cpu(cpu, topology_thread_cpumask(core)) {
+		/* rq->curr is not the idle task yet */
+		if (cpu == core)
+			continue;
+
+		if (!idle_cpu(cpu))
+			goto unlock;
+	}
+
+	set_idle_cores(core, 1);
+unlock:
+	rcu_read_unlock();
+}
+
+/*
+ * Look for a core of the LLC whose siblings are all idle, and return one
+ * of them that @p may run on.  The whole LLC is scanned, but only while
+ * the shared flag says there may be such a core.
+ */
+static int select_idle_core(struct task_struct *p, struct sched_domain *sd,
+			    int target)
+{
+	int core, cpu, first, idle;
+
+	if (!test_idle_cores(target, false))
+		return -1;
+
+	core = target;
+	do {
+		const struct cpumask *smt = topology_thread_cpumask(core);
+
+		/* Look at each core once, from its first sibling. */
+		if (core != cpumask_first(smt))
+			goto next;
+
+		first = -1;
+		idle = 1;
+		for_each_cpu(cpu, smt) {
+			if (!idle_cpu(cpu)) {
+				idle = 0;
+				break;
+			}
+			if (first < 0 &&
+			    cpumask_test_cpu(cpu, sched_domain_span(sd)) &&
+			    cpumask_test_cpu(cpu, tsk_cpus_allowed(p)))
+				first = cpu;
+		}
+		if (idle && first >= 0)
+			return first;
+next:
+		core = sis_next_cpu(core, sched_domain_span(sd));
+	} while (core != target);
+
+	/* Failed to find an idle core; stop looking for one. */
+	set_idle_cores(target, 0);
+
+	return -1;
+}
+
+/*
+ * Scan the SMT siblings of @target for an idle cpu.
+ */
+static int select_idle_smt(struct task_struct *p, struct sched_domain *sd,
+			   int target)
+{
+	int cpu;
+
+	for_each_cpu(cpu, topology_thread_cpumask(target)) {
+		if (!cpumask_test_cpu(cpu, tsk_cpus_allowed(p)))
+			continue;
+		if (idle_cpu(cpu))
+			return cpu;
+	}
+
+	return -1;
+}
+#else /* CONFIG_SCHED_SMT */
+static inline int select_idle_core(struct task_struct *p,
+				   struct sched_domain *sd, int target)
+{
+	return -1;
+}
+
+static inline int select_idle_smt(struct task_struct *p,
+				  struct sched_domain *sd, int target)
+{
+	return -1;
+}
+#endif /* CONFIG_SCHED_SMT */
+
+/*
+ * Scan the LLC for an idle cpu, starting after @target.  The number of
+ * cpus looked at is bounded by what the waking cpu can afford: its
+ * average idle time, with a large fuzz factor, over the average cost of
+ * looking at one cpu, tracked in the waker's LLC domain.  Wakeup cost so
+ * stays flat as the LLC grows; the scan just finds less.
+ */
+static int select_idle_cpu(struct task_struct *p, struct sched_domain *sd,
+			   int target)
+{
+	struct sched_domain *this_sd;
+	u64 avg_cost, avg_idle, time;
+	int cpu, nr = 4, scanned = 0;
+	s64 delta;
+
+	this_sd = rcu_dereference(per_cpu(sd_llc, smp_processor_id()));
+	if (!this_sd)
+		return -1;
+
+	/*
+	 * Due to the large variance of both averages the fuzz factor has to
+	 * be large, wakeup heavy loads like hackbench are sensitive to it.
+	 */
+	avg_idle = this_rq()->avg_idle / 512;
+	avg_cost = this_sd->avg_scan_cost + 1;
+	if (avg_idle > nr * avg_cost)
+		nr = div64_u64(avg_idle, avg_cost);
+
+	time = local_clock();
+
+	for (cpu = sis_next_cpu(target, sched_domain_span(sd));
+	     cpu != target && nr;
+	     cpu = sis_next_cpu(cpu, sched_domain_span(sd)), nr--) {
+		scanned++;
+		if (!cpumask_test_cpu(cpu, tsk_cpus_allowed(p)))
+			continue;
+		if (idle_cpu(cpu))
+			break;
+	}
+	if (cpu == target || !nr)
+		cpu = -1;
+
+	if (scanned) {
+		time = div_u64(local_clock() - time, scanned);
+		delta = (s64)(time - this_sd->avg_scan_cost) / 8;
+		this_sd->avg_scan_cost += delta;
+	}
+
+	return cpu;
+}
+
 /*
  * Try and locate an idle CPU in the sched_domain.
  */
 static int select_idle_sibling(struct task_struct *p, int target)
 {
 	struct sched_domain *sd;
-	struct sched_group *sg;
 	int i = task_cpu(p);
 
 	if (idle_cpu(target))
@@ -4374,30 +4659,26 @@ static int select_idle_sibling(struct task_struct *p, int target)
 	if (i != target && cpus_share_cache(i, target) && idle_cpu(i))
 		return i;
 
+	sd = rcu_dereference(per_cpu(sd_llc, target));
+	if (!sd)
+		return target;
+
 	/*
-	 * Otherwise, iterate the domains and find an elegible idle cpu.
+	 * Otherwise look for a fully idle core, then for any idle cpu in a
+	 * bounded scan of the LLC, then for an idle sibling of target.
 	 */
-	sd = rcu_dereference(per_cpu(sd_llc, target));
-	for_each_lower_domain(sd) {
-		sg = sd->groups;
-		do {
-			if (!cpumask_intersects(sched_group_cpus(sg),
-						tsk_cpus_allowed(p)))
-				goto next;
+	i = select_idle_core(p, sd, target);
+	if ((unsigned)i < nr_cpu_ids)
+		return i;
 
-			for_each_cpu(i, sched_group_cpus(sg)) {
-				if (i == target || !idle_cpu(i))
-					goto next;
-			}
+	i = select_idle_cpu(p, sd, target);
+	if ((unsigned)i < nr_cpu_ids)
+		return i;
+
+	i = select_idle_smt(p, sd, target);
+	if ((unsigned)i < nr_cpu_ids)
+		return i;
 
-			target = cpumask_first_and(sched_group_cpus(sg),
-					tsk_cpus_allowed(p));
-			goto done;
-next:
-			sg = sg->next;
-		} while (sg != sd->groups);
-	}
-done:
 	return target;
 }
 
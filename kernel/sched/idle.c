@@ -12,6 +12,8 @@
 
 #include <trace/events/power.h>
 
+#include "sched.h"
+
 static int __read_mostly cpu_idle_force_poll;
 
 void cpu_idle_poll_ctrl(bool enable)
@@ -238,7 +240,17 @@ static void cpu_idle_loop(void)
 		 */
 		preempt_set_need_resched();
 		tick_nohz_idle_exit();
+
+		/*
+		 * A remote wakeup may have found us polling and skipped the
+		 * IPI, leaving the task on our wake_list.  Stop polling so
+		 * later wakers send one, then run what is already queued.
+		 */
+		__current_clr_polling();
+		smp_mb__after_clear_bit();
+		sched_ttwu_pending();
 		schedule_preempt_disabled();
+		__current_set_polling();
 	}
 }
 
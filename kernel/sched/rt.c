@@ -906,6 +906,9 @@ static void update_curr_rt(struct rq *rq)
 
 	sched_rt_avg_update(rq, delta_exec);
 
+	/* Kick cpufreq to the highest frequency while RT tasks run */
+	cpufreq_update_util(rq, ULONG_MAX, SCHED_POWER_SCALE);
+
 	if (!rt_bandwidth_enabled())
 		return;
 
@@ -179,21 +179,32 @@ struct rt_rq;
 
 extern struct list_head task_groups;
 
+#define CFS_THROTTLED_HIST_SIZE	24	/* up to ~8s */
+
 struct cfs_bandwidth {
 #ifdef CONFIG_CFS_BANDWIDTH
 	raw_spinlock_t lock;
 	ktime_t period;
-	u64 quota, runtime;
+	u64 quota, runtime, burst;
 	s64 hierarchal_quota;
 	u64 runtime_expires;
+	u64 runtime_snap;		/* runtime after the last refill */
+
+	/*
+	 * Runtime handed back by the cfs_rqs, added without cfs_b->lock and
+	 * folded into ->runtime by whoever takes the lock next.
+	 */
+	atomic64_t returned;
 
 	int idle, timer_active;
 	struct hrtimer period_timer, slack_timer;
 	struct list_head throttled_cfs_rq;
 
 	/* statistics */
-	int nr_periods, nr_throttled;
-	u64 throttled_time;
+	int nr_periods, nr_throttled, nr_bursts;
+	u64 throttled_time, burst_time;
+	/* throttle durations, bucket i counts those below 2^i us */
+	unsigned int throttled_hist[CFS_THROTTLED_HIST_SIZE];
 #endif
 };
 
@@ -552,9 +563,12 @@ struct rq {
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	/* list of leaf cfs_rq on this cpu: */
 	struct list_head leaf_cfs_rq_list;
+#endif /* CONFIG_FAIR_GROUP_SCHED */
 
+#ifdef CONFIG_SMP
+	/* how busy the cpu has recently been, see update_rq_runnable_avg() */
 	struct sched_avg avg;
-#endif /* CONFIG_FAIR_GROUP_SCHED */
+#endif
 
 	/*
 	 * This is part of a global counter where only the total sum
@@ -734,6 +748,7 @@ static inline struct sched_domain *lowest_flag_domain(int cpu, int flag)
 DECLARE_PER_CPU(struct sched_domain *, sd_llc);
 DECLARE_PER_CPU(int, sd_llc_size);
 DECLARE_PER_CPU(int, sd_llc_id);
+DECLARE_PER_CPU(struct sched_domain_shared *, sd_llc_shared);
 DECLARE_PER_CPU(struct sched_domain *, sd_numa);
 DECLARE_PER_CPU(struct sched_domain *, sd_busy);
 DECLARE_PER_CPU(struct sched_domain *, sd_asym);
@@ -1214,6 +1229,18 @@ unsigned long to_ratio(u64 period, u64 runtime);
 
 extern void update_idle_cpu_load(struct rq *this_rq);
 
+#ifdef CONFIG_SMP
+extern void sched_ttwu_pending(void);
+#else
+static inline void sched_ttwu_pending(void) { }
+#endif
+
+#if defined(CONFIG_SMP) && defined(CONFIG_SCHED_SMT)
+extern void update_idle_core(struct rq *rq);
+#else
+static inline void update_idle_core(struct rq *rq) { }
+#endif
+
 extern void init_task_runnable_average(struct task_struct *p);
 
 static inline void inc_nr_running(struct rq *rq)
@@ -1286,6 +1313,31 @@ static inline int hrtick_enabled(struct rq *rq)
 
 #endif /* CONFIG_SCHED_HRTICK */
 
+#ifdef CONFIG_CPU_FREQ
+DECLARE_PER_CPU(struct update_util_data __rcu *, cpufreq_update_util_data);
+
+/*
+ * Pass a utilization update to the cpufreq governor that registered for
+ * @rq's cpu, if any.  Updates of a remote rq are dropped: the governor
+ * hears from that cpu soon enough, and its callback is per-cpu.
+ */
+static inline void cpufreq_update_util(struct rq *rq, unsigned long util,
+				       unsigned long max)
+{
+	struct update_util_data *data;
+
+	if (cpu_of(rq) != smp_processor_id())
+		return;
+
+	data = rcu_dereference_sched(*this_cpu_ptr(&cpufreq_update_util_data));
+	if (data)
+		data->func(data, rq_clock(rq), util, max);
+}
+#else
+static inline void cpufreq_update_util(struct rq *rq, unsigned long util,
+				       unsigned long max) { }
+#endif /* CONFIG_CPU_FREQ */
+
 #ifdef CONFIG_SMP
 extern void sched_avg_update(struct rq *rq);
 static inline void sched_rt_avg_update(struct rq *rq, u64 rt_delta)
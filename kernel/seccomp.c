@@ -38,8 +38,10 @@
  *         outside of a lifetime-guarded section.  In general, this
  *         is only needed for handling filters shared across tasks.
  * @prev: points to a previously installed, or inherited, filter
- * @len: the number of instructions in the program
- * @insns: the BPF program instructions to evaluate
+ * @prog: the BPF program to evaluate
+ * @cache_arch: the audit arch @cache_allow is valid for
+ * @cache_allow: syscalls this filter and all the ones before it allow
+ *               whatever their arguments, see seccomp_cache_prepare()
  *
  * seccomp_filter objects are organized in a tree linked via the @prev
  * pointer.  For any task, it appears to be a singly-linked list starting
@@ -54,8 +56,9 @@
 struct seccomp_filter {
 	atomic_t usage;
 	struct seccomp_filter *prev;
-	unsigned short len;  /* Instruction count */
-	struct sock_filter_int insnsi[];
+	struct sk_filter *prog;
+	u32 cache_arch;
+	DECLARE_BITMAP(cache_allow, NR_syscalls);
 };
 
 /* Limit any path through the tree to 256KB worth of instructions. */
@@ -166,6 +169,109 @@ static int seccomp_check_filter(struct sock_filter *filter, unsigned int flen)
 	return 0;
 }
 
+/**
+ * seccomp_cache_check_allow - tell whether a filter allows a syscall outright
+ * @filter: filter checked by seccomp_check_filter()
+ * @flen: length of filter
+ * @nr: syscall number
+ * @arch: audit arch of the syscall
+ *
+ * Runs @filter on a syscall whose arguments are unknown.  Returns true
+ * if it returns SECCOMP_RET_ALLOW having looked at nothing but @nr and
+ * @arch, false if it returns anything else or looks at anything else,
+ * or runs instructions this doesn't know about.
+ */
+static bool seccomp_cache_check_allow(const struct sock_filter *filter,
+				      unsigned int flen, int nr, u32 arch)
+{
+	unsigned int pc;
+	u32 A = 0;
+
+	for (pc = 0; pc < flen; pc++) {
+		const struct sock_filter *ftest = &filter[pc];
+		u32 k = ftest->k;
+		bool cond;
+
+		switch (ftest->code) {
+		case BPF_LDX | BPF_W | BPF_ABS:	/* see seccomp_check_filter() */
+			if (k == offsetof(struct seccomp_data, nr))
+				A = nr;
+			else if (k == offsetof(struct seccomp_data, arch))
+				A = arch;
+			else
+				return false;
+			continue;
+		case BPF_ALU | BPF_AND | BPF_K:
+			A &= k;
+			continue;
+		case BPF_JMP | BPF_JA:
+			pc += k;
+			continue;
+		case BPF_JMP | BPF_JEQ | BPF_K:
+			cond = A == k;
+			break;
+		case BPF_JMP | BPF_JGE | BPF_K:
+			cond = A >= k;
+			break;
+		case BPF_JMP | BPF_JGT | BPF_K:
+			cond = A > k;
+			break;
+		case BPF_JMP | BPF_JSET | BPF_K:
+			cond = A & k;
+			break;
+		case BPF_RET | BPF_K:
+			return (k & SECCOMP_RET_ACTION) == SECCOMP_RET_ALLOW;
+		default:
+			return false;
+		}
+		pc += cond ? ftest->jt : ftest->jf;
+	}
+
+	/* sk_chk_filter() makes sure the last instruction is a return */
+	return false;
+}
+
+/**
+ * seccomp_cache_prepare - find the syscalls a new filter allows outright
+ * @filter: the filter being attached
+ * @fp: its program, as checked by seccomp_check_filter()
+ * @flen: length of @fp
+ *
+ * Most filters allow or deny a syscall by its number alone.  The
+ * syscalls of the attaching task's arch that @filter and each filter
+ * already attached allow that way are noted in @filter->cache_allow, and
+ * seccomp_run_filters() lets them through without running any of them.
+ * Only allow is cached: the other actions need the complete result.
+ */
+static void seccomp_cache_prepare(struct seccomp_filter *filter,
+				  const struct sock_filter *fp,
+				  unsigned int flen)
+{
+	struct seccomp_filter *prev = current->seccomp.filter;
+	u32 arch = syscall_get_arch();
+	int nr;
+
+	filter->cache_arch = arch;
+	if (prev && prev->cache_arch != arch)
+		return;
+
+	for (nr = 0; nr < NR_syscalls; nr++) {
+		if (prev && !test_bit(nr, prev->cache_allow))
+			continue;
+		if (seccomp_cache_check_allow(fp, flen, nr, arch))
+			__set_bit(nr, filter->cache_allow);
+	}
+}
+
+static bool seccomp_cache_allowed(struct seccomp_filter *f, int syscall)
+{
+	if (unlikely(syscall < 0 || syscall >= NR_syscalls))
+		return false;
+
+	return test_bit(syscall, f->cache_allow) &&
+	       syscall_get_arch() == f->cache_arch;
+}
+
 /**
  * seccomp_run_filters - evaluates all seccomp filters against @syscall
  * @syscall: number of the current system call
@@ -182,6 +288,9 @@ static u32 seccomp_run_filters(int syscall)
 	if (WARN_ON(current->seccomp.filter == NULL))
 		return SECCOMP_RET_KILL;
 
+	if (seccomp_cache_allowed(current->seccomp.filter, syscall))
+		return SECCOMP_RET_ALLOW;
+
 	populate_seccomp_data(&sd);
 
 	/*
@@ -189,7 +298,7 @@ static u32 seccomp_run_filters(int syscall)
 	 * value always takes priority (ignoring the DATA).
 	 */
 	for (f = current->seccomp.filter; f; f = f->prev) {
-		u32 cur_ret = sk_run_filter_int_seccomp(&sd, f->insnsi);
+		u32 cur_ret = SK_RUN_FILTER(f->prog, (void *)&sd);
 		if ((cur_ret & SECCOMP_RET_ACTION) < (ret & SECCOMP_RET_ACTION))
 			ret = cur_ret;
 	}
@@ -215,7 +324,8 @@ static long seccomp_attach_filter(struct sock_fprog *fprog)
 		return -EINVAL;
 
 	for (filter = current->seccomp.filter; filter; filter = filter->prev)
-		total_insns += filter->len + 4;  /* include a 4 instr penalty */
+		/* include a 4 instr penalty */
+		total_insns += filter->prog->len + 4;
 	if (total_insns > MAX_INSNS_PER_PATH)
 		return -ENOMEM;
 
@@ -256,19 +366,26 @@ static long seccomp_attach_filter(struct sock_fprog *fprog)
 
 	/* Allocate a new seccomp_filter */
 	ret = -ENOMEM;
-	filter = kzalloc(sizeof(struct seccomp_filter) +
-			 sizeof(struct sock_filter_int) * new_len,
+	filter = kzalloc(sizeof(struct seccomp_filter),
 			 GFP_KERNEL|__GFP_NOWARN);
 	if (!filter)
 		goto free_prog;
 
-	ret = sk_convert_filter(fp, fprog->len, filter->insnsi, &new_len);
-	if (ret)
+	filter->prog = kzalloc(sk_filter_size(new_len),
+			       GFP_KERNEL|__GFP_NOWARN);
+	if (!filter->prog)
 		goto free_filter;
+
+	ret = sk_convert_filter(fp, fprog->len, filter->prog->insnsi, &new_len);
+	if (ret)
+		goto free_filter_prog;
+	seccomp_cache_prepare(filter, fp, fprog->len);
 	kfree(fp);
 
 	atomic_set(&filter->usage, 1);
-	filter->len = new_len;
+	filter->prog->len = new_len;
+
+	sk_filter_select_runtime(filter->prog);
 
 	/*
 	 * If there is an existing filter, make it the prev and don't drop its
@@ -278,6 +395,8 @@ static long seccomp_attach_filter(struct sock_fprog *fprog)
 	current->seccomp.filter = filter;
 	return 0;
 
+free_filter_prog:
+	kfree(filter->prog);
 free_filter:
 	kfree(filter);
 free_prog:
@@ -330,6 +449,7 @@ void put_seccomp_filter(struct task_struct *tsk)
 	while (orig && atomic_dec_and_test(&orig->usage)) {
 		struct seccomp_filter *freeme = orig;
 		orig = orig->prev;
+		sk_filter_free(freeme->prog);
 		kfree(freeme);
 	}
 }
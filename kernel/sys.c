@@ -47,6 +47,7 @@
 #include <linux/kprobes.h>
 #include <linux/user_namespace.h>
 #include <linux/binfmts.h>
+#include <linux/futex.h>
 
 #include <linux/sched.h>
 #include <linux/rcupdate.h>
@@ -2011,6 +2012,24 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 			me->mm->def_flags &= ~VM_NOHUGEPAGE;
 		up_write(&me->mm->mmap_sem);
 		break;
+	case PR_GET_HUGE_TEXT:
+		if (arg2 || arg3 || arg4 || arg5)
+			return -EINVAL;
+		error = test_bit(MMF_HUGE_TEXT, &me->mm->flags);
+		break;
+	case PR_SET_HUGE_TEXT:
+		if (arg3 || arg4 || arg5)
+			return -EINVAL;
+		if (arg2)
+			set_bit(MMF_HUGE_TEXT, &me->mm->flags);
+		else
+			clear_bit(MMF_HUGE_TEXT, &me->mm->flags);
+		break;
+	case PR_FUTEX_HASH:
+		if (arg4 || arg5)
+			return -EINVAL;
+		error = futex_hash_prctl(arg2, arg3);
+		break;
 	default:
 		error = -EINVAL;
 		break;
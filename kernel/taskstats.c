@@ -24,7 +24,11 @@
 #include <linux/percpu.h>
 #include <linux/slab.h>
 #include <linux/cgroupstats.h>
+#include <linux/taskdiag.h>
 #include <linux/cgroup.h>
+#include <linux/cred.h>
+#include <linux/mm.h>
+#include <linux/ptrace.h>
 #include <linux/fs.h>
 #include <linux/file.h>
 #include <linux/pid_namespace.h>
@@ -58,6 +62,12 @@ static const struct nla_policy cgroupstats_cmd_get_policy[CGROUPSTATS_CMD_ATTR_M
 	[CGROUPSTATS_CMD_ATTR_FD] = { .type = NLA_U32 },
 };
 
+static const struct nla_policy taskdiag_cmd_get_policy[TASKDIAG_CMD_ATTR_MAX+1] = {
+	[TASKDIAG_CMD_ATTR_SHOW]     = { .type = NLA_U64 },
+	[TASKDIAG_CMD_ATTR_DUMP]     = { .type = NLA_U32 },
+	[TASKDIAG_CMD_ATTR_DUMP_ARG] = { .type = NLA_U32 },
+};
+
 struct listener {
 	struct list_head list;
 	pid_t pid;
@@ -588,6 +598,237 @@ static int taskstats_user_cmd(struct sk_buff *skb, struct genl_info *info)
 		return -EINVAL;
 }
 
+/*
+ * State of one chunk of a TASKDIAG_CMD_GET dump.  cb->args[0] is where the
+ * next chunk resumes: a pid for the pid walks, a position in the cgroup for
+ * TASKDIAG_DUMP_CGROUP.
+ */
+struct taskdiag_dump {
+	struct sk_buff *skb;
+	struct netlink_callback *cb;
+	u64 show;
+	struct user_namespace *user_ns;
+	struct pid_namespace *pid_ns;
+};
+
+static int taskdiag_put_base(struct sk_buff *skb, struct task_struct *tsk,
+			     struct pid_namespace *ns)
+{
+	struct taskdiag_base base;
+	struct task_struct *tracer;
+	unsigned int state;
+
+	BUILD_BUG_ON(TASKDIAG_COMM_LEN != TASK_COMM_LEN);
+
+	memset(&base, 0, sizeof(base));
+	rcu_read_lock();
+	base.tgid = task_tgid_nr_ns(tsk, ns);
+	base.pid = task_pid_nr_ns(tsk, ns);
+	if (pid_alive(tsk))
+		base.ppid = task_tgid_nr_ns(rcu_dereference(tsk->real_parent),
+					    ns);
+	tracer = ptrace_parent(tsk);
+	if (tracer)
+		base.tpid = task_pid_nr_ns(tracer, ns);
+	base.sid = task_session_nr_ns(tsk, ns);
+	base.pgid = task_pgrp_nr_ns(tsk, ns);
+	rcu_read_unlock();
+
+	state = (tsk->state | tsk->exit_state) & TASK_REPORT;
+	base.state = TASK_STATE_TO_CHAR_STR[fls(state)];
+	get_task_comm(base.comm, tsk);
+
+	return nla_put(skb, TASKDIAG_TYPE_BASE, sizeof(base), &base);
+}
+
+static int taskdiag_put_creds(struct sk_buff *skb, struct task_struct *tsk,
+			      struct user_namespace *ns)
+{
+	struct taskdiag_creds creds;
+	const struct cred *cred;
+
+	rcu_read_lock();
+	cred = __task_cred(tsk);
+	creds.uid = from_kuid_munged(ns, cred->uid);
+	creds.euid = from_kuid_munged(ns, cred->euid);
+	creds.suid = from_kuid_munged(ns, cred->suid);
+	creds.fsuid = from_kuid_munged(ns, cred->fsuid);
+	creds.gid = from_kgid_munged(ns, cred->gid);
+	creds.egid = from_kgid_munged(ns, cred->egid);
+	creds.sgid = from_kgid_munged(ns, cred->sgid);
+	creds.fsgid = from_kgid_munged(ns, cred->fsgid);
+	rcu_read_unlock();
+
+	return nla_put(skb, TASKDIAG_TYPE_CRED, sizeof(creds), &creds);
+}
+
+static int taskdiag_put_stats(struct sk_buff *skb, struct task_struct *tsk,
+			      struct taskdiag_dump *d)
+{
+	struct taskstats stats;
+
+	fill_stats(d->user_ns, d->pid_ns, tsk, &stats);
+	return nla_put(skb, TASKDIAG_TYPE_STATS, sizeof(stats), &stats);
+}
+
+static int taskdiag_put_vm(struct sk_buff *skb, struct task_struct *tsk)
+{
+	struct taskdiag_vm vm;
+	struct mm_struct *mm;
+
+	/* kernel threads have no vm to report */
+	mm = get_task_mm(tsk);
+	if (!mm)
+		return 0;
+
+	vm.total_vm = mm->total_vm;
+	vm.hiwater_vm = get_mm_hiwater_vm(mm);
+	vm.locked_vm = mm->locked_vm;
+	vm.pinned_vm = mm->pinned_vm;
+	vm.shared_vm = mm->shared_vm;
+	vm.exec_vm = mm->exec_vm;
+	vm.stack_vm = mm->stack_vm;
+	vm.rss_anon = get_mm_counter(mm, MM_ANONPAGES);
+	vm.rss_file = get_mm_counter(mm, MM_FILEPAGES);
+	vm.hiwater_rss = get_mm_hiwater_rss(mm);
+	vm.swap_ents = get_mm_counter(mm, MM_SWAPENTS);
+	mmput(mm);
+
+	return nla_put(skb, TASKDIAG_TYPE_VM, sizeof(vm), &vm);
+}
+
+/* Add one TASKDIAG_CMD_NEW message for @tsk, or -EMSGSIZE if it won't fit */
+static int taskdiag_fill(struct taskdiag_dump *d, struct task_struct *tsk)
+{
+	struct sk_buff *skb = d->skb;
+	void *hdr;
+
+	hdr = genlmsg_put(skb, NETLINK_CB(d->cb->skb).portid,
+			  d->cb->nlh->nlmsg_seq, &family, NLM_F_MULTI,
+			  TASKDIAG_CMD_NEW);
+	if (!hdr)
+		return -EMSGSIZE;
+
+	if ((d->show & TASKDIAG_SHOW_BASE) &&
+	    taskdiag_put_base(skb, tsk, d->pid_ns))
+		goto cancel;
+	if ((d->show & TASKDIAG_SHOW_CRED) &&
+	    taskdiag_put_creds(skb, tsk, d->user_ns))
+		goto cancel;
+	if ((d->show & TASKDIAG_SHOW_STATS) &&
+	    taskdiag_put_stats(skb, tsk, d))
+		goto cancel;
+	if ((d->show & TASKDIAG_SHOW_VM) && taskdiag_put_vm(skb, tsk))
+		goto cancel;
+
+	return genlmsg_end(skb, hdr);
+cancel:
+	genlmsg_cancel(skb, hdr);
+	return -EMSGSIZE;
+}
+
+/*
+ * Walk the pids of the caller's namespace in order, the way /proc readdir
+ * does, taking a reference to each task only while it is being filled in.
+ */
+static void taskdiag_dump_pids(struct taskdiag_dump *d, bool by_pgid,
+			       pid_t pgid)
+{
+	struct task_struct *tsk;
+	struct pid *pid;
+	pid_t nr = d->cb->args[0];
+
+	for (;;) {
+		tsk = NULL;
+		rcu_read_lock();
+		for (pid = find_ge_pid(nr, d->pid_ns); pid;
+		     pid = find_ge_pid(nr + 1, d->pid_ns)) {
+			nr = pid_nr_ns(pid, d->pid_ns);
+			tsk = pid_task(pid, PIDTYPE_PID);
+			if (tsk && (!by_pgid ||
+				    task_pgrp_nr_ns(tsk, d->pid_ns) == pgid)) {
+				get_task_struct(tsk);
+				break;
+			}
+			tsk = NULL;
+		}
+		rcu_read_unlock();
+		if (!tsk)
+			break;
+
+		if (taskdiag_fill(d, tsk) < 0) {
+			/* skb is full, resume with this task */
+			put_task_struct(tsk);
+			break;
+		}
+		put_task_struct(tsk);
+		d->cb->args[0] = ++nr;
+	}
+}
+
+static int taskdiag_dump_one(struct task_struct *tsk, void *data)
+{
+	return taskdiag_fill(data, tsk) < 0;
+}
+
+static int taskdiag_dump_cgroup(struct taskdiag_dump *d, u32 fd)
+{
+	struct fd f;
+	long pos;
+
+	f = fdget(fd);
+	if (!f.file)
+		return -EBADF;
+
+	pos = cgroup_dir_for_each_task(f.file->f_dentry, d->cb->args[0],
+				       taskdiag_dump_one, d);
+	fdput(f);
+	if (pos < 0)
+		return pos;
+	d->cb->args[0] = pos;
+	return 0;
+}
+
+static int taskdiag_dumpit(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct nlattr *attrs[TASKDIAG_CMD_ATTR_MAX + 1];
+	struct taskdiag_dump d;
+	u32 filter = TASKDIAG_DUMP_ALL, arg = 0;
+	int rc;
+
+	rc = nlmsg_parse(cb->nlh, GENL_HDRLEN, attrs, TASKDIAG_CMD_ATTR_MAX,
+			 taskdiag_cmd_get_policy);
+	if (rc < 0)
+		return rc;
+	if (!attrs[TASKDIAG_CMD_ATTR_SHOW])
+		return -EINVAL;
+	if (attrs[TASKDIAG_CMD_ATTR_DUMP])
+		filter = nla_get_u32(attrs[TASKDIAG_CMD_ATTR_DUMP]);
+	if (attrs[TASKDIAG_CMD_ATTR_DUMP_ARG])
+		arg = nla_get_u32(attrs[TASKDIAG_CMD_ATTR_DUMP_ARG]);
+
+	d.skb = skb;
+	d.cb = cb;
+	d.show = nla_get_u64(attrs[TASKDIAG_CMD_ATTR_SHOW]);
+	d.user_ns = current_user_ns();
+	d.pid_ns = task_active_pid_ns(current);
+
+	switch (filter) {
+	case TASKDIAG_DUMP_ALL:
+	case TASKDIAG_DUMP_PGID:
+		taskdiag_dump_pids(&d, filter == TASKDIAG_DUMP_PGID, arg);
+		break;
+	case TASKDIAG_DUMP_CGROUP:
+		rc = taskdiag_dump_cgroup(&d, arg);
+		if (rc < 0)
+			return rc;
+		break;
+	default:
+		return -EINVAL;
+	}
+	return skb->len;
+}
+
 static struct taskstats *taskstats_tgid_alloc(struct task_struct *tsk)
 {
 	struct signal_struct *sig = tsk->signal;
@@ -685,6 +926,12 @@ static const struct genl_ops taskstats_ops[] = {
 		.doit		= cgroupstats_user_cmd,
 		.policy		= cgroupstats_cmd_get_policy,
 	},
+	{
+		.cmd		= TASKDIAG_CMD_GET,
+		.dumpit		= taskdiag_dumpit,
+		.policy		= taskdiag_cmd_get_policy,
+		.flags		= GENL_ADMIN_PERM,
+	},
 };
 
 /* Needed early in initialization */
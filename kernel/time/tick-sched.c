@@ -24,6 +24,8 @@
 #include <linux/posix-timers.h>
 #include <linux/perf_event.h>
 #include <linux/context_tracking.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <asm/irq_regs.h>
 
@@ -154,7 +156,9 @@ static void tick_sched_handle(struct tick_sched *ts, struct pt_regs *regs)
 
 #ifdef CONFIG_NO_HZ_FULL
 cpumask_var_t tick_nohz_full_mask;
+cpumask_var_t housekeeping_mask;
 bool tick_nohz_full_running;
+DEFINE_PER_CPU(struct nohz_full_noise, nohz_full_noise);
 
 static bool can_stop_full_tick(void)
 {
@@ -275,6 +279,13 @@ out:
 	local_irq_restore(flags);
 }
 
+/* Keep @t, a kthread doing work for all cpus, off the full dynticks ones. */
+void housekeeping_affine(struct task_struct *t)
+{
+	if (tick_nohz_full_enabled())
+		set_cpus_allowed_ptr(t, housekeeping_mask);
+}
+
 /* Parse the boot-time nohz CPU list from the kernel parameters. */
 static int __init tick_nohz_full_setup(char *str)
 {
@@ -291,6 +302,9 @@ static int __init tick_nohz_full_setup(char *str)
 		pr_warning("NO_HZ: Clearing %d from nohz_full range for timekeeping\n", cpu);
 		cpumask_clear_cpu(cpu, tick_nohz_full_mask);
 	}
+	alloc_bootmem_cpumask_var(&housekeeping_mask);
+	cpumask_andnot(housekeeping_mask, cpu_possible_mask,
+		       tick_nohz_full_mask);
 	tick_nohz_full_running = true;
 
 	return 1;
@@ -332,9 +346,15 @@ static int tick_nohz_init_all(void)
 		pr_err("NO_HZ: Can't allocate full dynticks cpumask\n");
 		return err;
 	}
+	if (!alloc_cpumask_var(&housekeeping_mask, GFP_KERNEL)) {
+		pr_err("NO_HZ: Can't allocate not-full dynticks cpumask\n");
+		free_cpumask_var(tick_nohz_full_mask);
+		return err;
+	}
 	err = 0;
 	cpumask_setall(tick_nohz_full_mask);
 	cpumask_clear_cpu(smp_processor_id(), tick_nohz_full_mask);
+	cpumask_copy(housekeeping_mask, cpumask_of(smp_processor_id()));
 	tick_nohz_full_running = true;
 #endif
 	return err;
@@ -356,6 +376,59 @@ void __init tick_nohz_init(void)
 	cpulist_scnprintf(nohz_full_buf, sizeof(nohz_full_buf), tick_nohz_full_mask);
 	pr_info("NO_HZ: Full dynticks CPUs: %s.\n", nohz_full_buf);
 }
+
+#ifdef CONFIG_DEBUG_FS
+static const char * const nohz_full_noise_names[NR_NOHZ_NOISE_ITEMS] = {
+	[NOHZ_NOISE_TIMER]	= "timer",
+	[NOHZ_NOISE_WORK]	= "work",
+	[NOHZ_NOISE_VMSTAT]	= "vmstat",
+	[NOHZ_NOISE_LRU_DRAIN]	= "lru_drain",
+	[NOHZ_NOISE_RCU]	= "rcu",
+};
+
+static int nohz_full_noise_show(struct seq_file *m, void *v)
+{
+	int cpu, i;
+
+	seq_puts(m, "cpu");
+	for (i = 0; i < NR_NOHZ_NOISE_ITEMS; i++)
+		seq_printf(m, " %s", nohz_full_noise_names[i]);
+	seq_putc(m, '\n');
+
+	for_each_cpu(cpu, tick_nohz_full_mask) {
+		struct nohz_full_noise *noise = &per_cpu(nohz_full_noise, cpu);
+
+		seq_printf(m, "%d", cpu);
+		for (i = 0; i < NR_NOHZ_NOISE_ITEMS; i++)
+			seq_printf(m, " %lu", noise->count[i]);
+		seq_putc(m, '\n');
+	}
+	return 0;
+}
+
+static int nohz_full_noise_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nohz_full_noise_show, NULL);
+}
+
+static const struct file_operations nohz_full_noise_fops = {
+	.open		= nohz_full_noise_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init nohz_full_noise_init(void)
+{
+	if (!tick_nohz_full_enabled())
+		return 0;
+
+	debugfs_create_file("nohz_full_noise", 0444, NULL, NULL,
+			    &nohz_full_noise_fops);
+	return 0;
+}
+late_initcall(nohz_full_noise_init);
+#endif /* CONFIG_DEBUG_FS */
 #endif
 
 /*
@@ -0,0 +1,202 @@
+/*
+ * BPF programs attached to kprobe and tracepoint events
+ *
+ * A program attached to an event through PERF_EVENT_IOC_SET_BPF runs
+ * every time the event hits, before the event is written out to perf.
+ * It may update maps, so that histograms and counts are built in the
+ * kernel, and the event only goes out if the program returns non-zero.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/uaccess.h>
+#include <linux/sched.h>
+#include <linux/perf_event.h>
+#include <linux/ftrace_event.h>
+
+/* a program that hits an event of its own does not run again */
+static DEFINE_PER_CPU(int, bpf_prog_active);
+
+/**
+ * trace_call_bpf - run the BPF program attached to an event
+ * @call: the event
+ * @ctx: what the program gets in R1, the pt_regs of a kprobe or the
+ *	record of a tracepoint
+ *
+ * Returns what the program returns, 0 to drop the event.  Returns 1
+ * in NMI context, or when no program is attached by then.  Called with
+ * preemption disabled, from any context the event may hit in.
+ */
+unsigned int trace_call_bpf(struct ftrace_event_call *call, void *ctx)
+{
+	struct sk_filter *prog;
+	unsigned int ret;
+
+	/* the maps take locks that an NMI could deadlock on */
+	if (in_nmi())
+		return 1;
+
+	if (unlikely(__this_cpu_inc_return(bpf_prog_active) != 1)) {
+		/* don't call into another program, nor the same one */
+		ret = 0;
+		goto out;
+	}
+
+	rcu_read_lock();
+	prog = rcu_dereference(call->prog);
+	ret = prog ? SK_RUN_FILTER(prog, ctx) : 1;
+	rcu_read_unlock();
+
+ out:
+	__this_cpu_dec(bpf_prog_active);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(trace_call_bpf);
+
+static u64 bpf_probe_read(u64 r1, u64 r2, u64 r3, u64 r4, u64 r5)
+{
+	void *dst = (void *) (unsigned long) r1;
+	int size = (int) r2;
+	void *unsafe_ptr = (void *) (unsigned long) r3;
+	long ret;
+
+	ret = probe_kernel_read(dst, unsafe_ptr, size);
+	if (unlikely(ret < 0))
+		memset(dst, 0, size);
+
+	return ret;
+}
+
+static const struct bpf_func_proto bpf_probe_read_proto = {
+	.func = bpf_probe_read,
+	.gpl_only = true,
+	.ret_type = RET_INTEGER,
+	.arg1_type = ARG_PTR_TO_STACK,
+	.arg2_type = ARG_CONST_STACK_SIZE,
+	.arg3_type = ARG_ANYTHING,
+};
+
+static u64 bpf_ktime_get_ns(u64 r1, u64 r2, u64 r3, u64 r4, u64 r5)
+{
+	/* the clock ftrace uses by default, safe from any context */
+	return local_clock();
+}
+
+static const struct bpf_func_proto bpf_ktime_get_ns_proto = {
+	.func = bpf_ktime_get_ns,
+	.gpl_only = true,
+	.ret_type = RET_INTEGER,
+};
+
+static u64 bpf_get_current_pid_tgid(u64 r1, u64 r2, u64 r3, u64 r4, u64 r5)
+{
+	struct task_struct *task = current;
+
+	return (u64) task->tgid << 32 | task->pid;
+}
+
+static const struct bpf_func_proto bpf_get_current_pid_tgid_proto = {
+	.func = bpf_get_current_pid_tgid,
+	.gpl_only = false,
+	.ret_type = RET_INTEGER,
+};
+
+static u64 bpf_get_smp_processor_id(u64 r1, u64 r2, u64 r3, u64 r4, u64 r5)
+{
+	return raw_smp_processor_id();
+}
+
+static const struct bpf_func_proto bpf_get_smp_processor_id_proto = {
+	.func = bpf_get_smp_processor_id,
+	.gpl_only = false,
+	.ret_type = RET_INTEGER,
+};
+
+static const struct bpf_func_proto *
+tracing_func_proto(enum bpf_func_id func_id)
+{
+	switch (func_id) {
+	case BPF_FUNC_map_lookup_elem:
+		return &bpf_map_lookup_elem_proto;
+	case BPF_FUNC_map_update_elem:
+		return &bpf_map_update_elem_proto;
+	case BPF_FUNC_map_delete_elem:
+		return &bpf_map_delete_elem_proto;
+	case BPF_FUNC_probe_read:
+		return &bpf_probe_read_proto;
+	case BPF_FUNC_ktime_get_ns:
+		return &bpf_ktime_get_ns_proto;
+	case BPF_FUNC_get_current_pid_tgid:
+		return &bpf_get_current_pid_tgid_proto;
+	case BPF_FUNC_get_smp_processor_id:
+		return &bpf_get_smp_processor_id_proto;
+	default:
+		return NULL;
+	}
+}
+
+/* kprobe programs read the registers, aligned and nothing else */
+static bool kprobe_prog_is_valid_access(int off, int size,
+					enum bpf_access_type type)
+{
+	if (type != BPF_READ)
+		return false;
+	if (off < 0 || off + size > sizeof(struct pt_regs))
+		return false;
+	if (off % size != 0)
+		return false;
+
+	return true;
+}
+
+static const struct bpf_verifier_ops kprobe_prog_ops = {
+	.get_func_proto = tracing_func_proto,
+	.is_valid_access = kprobe_prog_is_valid_access,
+};
+
+/*
+ * Tracepoint programs read the record, which is built in a per-cpu
+ * buffer of PERF_MAX_TRACE_SIZE bytes, so reading past its end is safe.
+ */
+static bool tp_prog_is_valid_access(int off, int size,
+				    enum bpf_access_type type)
+{
+	if (type != BPF_READ)
+		return false;
+	if (off < 0 || off + size > PERF_MAX_TRACE_SIZE)
+		return false;
+	if (off % size != 0)
+		return false;
+
+	return true;
+}
+
+static const struct bpf_verifier_ops tp_prog_ops = {
+	.get_func_proto = tracing_func_proto,
+	.is_valid_access = tp_prog_is_valid_access,
+};
+
+static struct bpf_prog_type_list kprobe_prog_type __read_mostly = {
+	.ops = &kprobe_prog_ops,
+	.type = BPF_PROG_TYPE_KPROBE,
+};
+
+static struct bpf_prog_type_list tp_prog_type __read_mostly = {
+	.ops = &tp_prog_ops,
+	.type = BPF_PROG_TYPE_TRACEPOINT,
+};
+
+static int __init register_tracing_prog_ops(void)
+{
+	bpf_register_prog_type(&kprobe_prog_type);
+	bpf_register_prog_type(&tp_prog_type);
+	return 0;
+}
+late_initcall(register_tracing_prog_ops);
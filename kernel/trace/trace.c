@@ -247,13 +247,28 @@ void trace_array_put(struct trace_array *this_tr)
 	mutex_unlock(&trace_types_lock);
 }
 
+/*
+ * While some events are filtered, each cpu gets a page that a filtered
+ * event is written into instead of the ring buffer.  Only an event that
+ * passes the filter is then copied over, one that does not costs no more
+ * than giving the page back.  The count keeps an event that interrupts
+ * another one off the page, it goes to the ring buffer directly.
+ */
+static DEFINE_PER_CPU(struct ring_buffer_event *, trace_buffered_event);
+static DEFINE_PER_CPU(int, trace_buffered_event_cnt);
+static int trace_buffered_event_ref;
+
+/* Largest event that fits the page, behind its header and length */
+#define TRACE_BUFFERED_EVENT_MAX					\
+	(PAGE_SIZE - offsetof(struct ring_buffer_event, array[1]))
+
 int filter_check_discard(struct ftrace_event_file *file, void *rec,
 			 struct ring_buffer *buffer,
 			 struct ring_buffer_event *event)
 {
 	if (unlikely(file->flags & FTRACE_EVENT_FL_FILTERED) &&
 	    !filter_match_preds(file->filter, rec)) {
-		ring_buffer_discard_commit(buffer, event);
+		trace_current_buffer_discard_commit(buffer, event);
 		return 1;
 	}
 
@@ -1580,6 +1595,16 @@ tracing_generic_entry_update(struct trace_entry *entry, unsigned long flags,
 }
 EXPORT_SYMBOL_GPL(tracing_generic_entry_update);
 
+static inline void
+trace_event_setup(struct ring_buffer_event *event,
+		  int type, unsigned long flags, int pc)
+{
+	struct trace_entry *ent = ring_buffer_event_data(event);
+
+	tracing_generic_entry_update(ent, flags, pc);
+	ent->type = type;
+}
+
 struct ring_buffer_event *
 trace_buffer_lock_reserve(struct ring_buffer *buffer,
 			  int type,
@@ -1589,12 +1614,8 @@ trace_buffer_lock_reserve(struct ring_buffer *buffer,
 	struct ring_buffer_event *event;
 
 	event = ring_buffer_lock_reserve(buffer, len);
-	if (event != NULL) {
-		struct trace_entry *ent = ring_buffer_event_data(event);
-
-		tracing_generic_entry_update(ent, flags, pc);
-		ent->type = type;
-	}
+	if (event != NULL)
+		trace_event_setup(event, type, flags, pc);
 
 	return event;
 }
@@ -1603,7 +1624,13 @@ void
 __buffer_unlock_commit(struct ring_buffer *buffer, struct ring_buffer_event *event)
 {
 	__this_cpu_write(trace_cmdline_save, true);
-	ring_buffer_unlock_commit(buffer, event);
+
+	/* A buffered event is written out now, its length in array[0]. */
+	if (this_cpu_read(trace_buffered_event) == event) {
+		ring_buffer_write(buffer, event->array[0], &event->array[1]);
+		this_cpu_dec(trace_buffered_event_cnt);
+	} else
+		ring_buffer_unlock_commit(buffer, event);
 }
 
 static inline void
@@ -1627,6 +1654,88 @@ EXPORT_SYMBOL_GPL(trace_buffer_unlock_commit);
 
 static struct ring_buffer *temp_buffer;
 
+/**
+ * trace_buffered_event_enable - set up the pages for filtered events
+ *
+ * Gives each cpu the page that events are written into before they are
+ * filtered.  A cpu that does not get one writes its filtered events to
+ * the ring buffer and discards them there.  Calls nest, the pages stay
+ * until the last trace_buffered_event_disable().
+ *
+ * Called with event_mutex held.
+ */
+void trace_buffered_event_enable(void)
+{
+	struct ring_buffer_event *event;
+	struct page *page;
+	int cpu;
+
+	WARN_ON_ONCE(!mutex_is_locked(&event_mutex));
+
+	if (trace_buffered_event_ref++)
+		return;
+
+	for_each_tracing_cpu(cpu) {
+		page = alloc_pages_node(cpu_to_node(cpu),
+					GFP_KERNEL | __GFP_NORETRY, 0);
+		if (!page)
+			continue;
+
+		event = page_address(page);
+		memset(event, 0, sizeof(*event));
+		per_cpu(trace_buffered_event, cpu) = event;
+	}
+}
+
+static void trace_buffered_event_hold(void *data)
+{
+	this_cpu_inc(trace_buffered_event_cnt);
+}
+
+static void trace_buffered_event_unhold(void *data)
+{
+	this_cpu_dec(trace_buffered_event_cnt);
+}
+
+/**
+ * trace_buffered_event_disable - drop the pages for filtered events
+ *
+ * Frees the pages when the last user of trace_buffered_event_enable()
+ * is gone.  The count is raised on every cpu first, which keeps new
+ * events off the pages, and the events still on them go away with
+ * the preempt disabled sections they run in.
+ *
+ * Called with event_mutex held.
+ */
+void trace_buffered_event_disable(void)
+{
+	int cpu;
+
+	WARN_ON_ONCE(!mutex_is_locked(&event_mutex));
+
+	if (WARN_ON_ONCE(!trace_buffered_event_ref))
+		return;
+
+	if (--trace_buffered_event_ref)
+		return;
+
+	on_each_cpu_mask(tracing_buffer_mask, trace_buffered_event_hold,
+			 NULL, true);
+
+	synchronize_sched();
+
+	for_each_tracing_cpu(cpu) {
+		free_page((unsigned long)per_cpu(trace_buffered_event, cpu));
+		per_cpu(trace_buffered_event, cpu) = NULL;
+	}
+
+	/* The pages must be gone before the count lets events back in. */
+	smp_wmb();
+
+	on_each_cpu_mask(tracing_buffer_mask, trace_buffered_event_unhold,
+			 NULL, true);
+}
+
 struct ring_buffer_event *
 trace_event_buffer_lock_reserve(struct ring_buffer **current_rb,
 			  struct ftrace_event_file *ftrace_file,
@@ -1636,6 +1745,22 @@ trace_event_buffer_lock_reserve(struct ring_buffer **current_rb,
 	struct ring_buffer_event *entry;
 
 	*current_rb = ftrace_file->tr->trace_buffer.buffer;
+
+	/*
+	 * Build a filtered event on this cpu's page, it only goes to the
+	 * ring buffer if it passes the filter.
+	 */
+	if ((ftrace_file->flags & FTRACE_EVENT_FL_FILTERED) &&
+	    len <= TRACE_BUFFERED_EVENT_MAX &&
+	    (entry = this_cpu_read(trace_buffered_event))) {
+		if (this_cpu_inc_return(trace_buffered_event_cnt) == 1) {
+			trace_event_setup(entry, type, flags, pc);
+			entry->array[0] = len;
+			return entry;
+		}
+		this_cpu_dec(trace_buffered_event_cnt);
+	}
+
 	entry = trace_buffer_lock_reserve(*current_rb,
 					 type, len, flags, pc);
 	/*
@@ -1687,6 +1812,12 @@ EXPORT_SYMBOL_GPL(trace_buffer_unlock_commit_regs);
 void trace_current_buffer_discard_commit(struct ring_buffer *buffer,
 					 struct ring_buffer_event *event)
 {
+	/* A buffered event was never reserved, just give the page back. */
+	if (this_cpu_read(trace_buffered_event) == event) {
+		this_cpu_dec(trace_buffered_event_cnt);
+		return;
+	}
+
 	ring_buffer_discard_commit(buffer, event);
 }
 EXPORT_SYMBOL_GPL(trace_current_buffer_discard_commit);
@@ -975,6 +975,7 @@ struct event_filter {
 	int			a_preds;	/* allocated */
 	struct filter_pred	*preds;
 	struct filter_pred	*root;
+	struct sk_filter	*prog;		/* compiled preds, or NULL */
 	char			*filter_string;
 };
 
@@ -1063,6 +1064,8 @@ struct ftrace_event_field *
 trace_find_event_field(struct ftrace_event_call *call, char *name);
 
 extern void trace_event_enable_cmd_record(bool enable);
+extern void trace_buffered_event_enable(void);
+extern void trace_buffered_event_disable(void);
 extern int event_trace_add_tracer(struct dentry *parent, struct trace_array *tr);
 extern int event_trace_del_tracer(struct trace_array *tr);
 
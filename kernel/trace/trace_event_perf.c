@@ -282,6 +282,28 @@ __kprobes void *perf_trace_buf_prepare(int size, unsigned short type,
 }
 EXPORT_SYMBOL_GPL(perf_trace_buf_prepare);
 
+/*
+ * Hand a tracepoint record to the BPF program attached to the event, if
+ * any, and only submit it to perf when the program returns non-zero.
+ * The program sees the record as it would be put out.
+ */
+__kprobes void perf_trace_run_bpf_submit(void *raw_data, int size, int rctx,
+					 struct ftrace_event_call *call,
+					 u64 addr, u64 count,
+					 struct pt_regs *regs,
+					 struct hlist_head *head,
+					 struct task_struct *task)
+{
+	if (rcu_access_pointer(call->prog) &&
+	    (!trace_call_bpf(call, raw_data) || hlist_empty(head))) {
+		perf_swevent_put_recursion_context(rctx);
+		return;
+	}
+
+	perf_tp_event(addr, count, raw_data, size, regs, head, rctx, task);
+}
+EXPORT_SYMBOL_GPL(perf_trace_run_bpf_submit);
+
 #ifdef CONFIG_FUNCTION_TRACER
 static void
 perf_ftrace_function_call(unsigned long ip, unsigned long parent_ip,
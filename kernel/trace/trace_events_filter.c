@@ -23,6 +23,7 @@
 #include <linux/mutex.h>
 #include <linux/perf_event.h>
 #include <linux/slab.h>
+#include <linux/filter.h>
 
 #include "trace.h"
 #include "trace_output.h"
@@ -545,12 +546,18 @@ int filter_match_preds(struct event_filter *filter, void *rec)
 		.match = -1,
 		.rec   = rec,
 	};
+	struct sk_filter *prog;
 	int n_preds, ret;
 
 	/* no filter is considered a match */
 	if (!filter)
 		return 1;
 
+	/* A compiled filter is run instead of walking the tree. */
+	prog = filter->prog;
+	if (prog)
+		return SK_RUN_FILTER(prog, rec);
+
 	n_preds = filter->n_preds;
 	if (!n_preds)
 		return 1;
@@ -760,10 +767,21 @@ static int filter_set_pred(struct event_filter *filter,
 	return __push_pred_stack(stack, dest);
 }
 
+static void __free_prog(struct event_filter *filter)
+{
+#ifdef CONFIG_NET
+	if (filter->prog)
+		sk_filter_free(filter->prog);
+#endif
+	filter->prog = NULL;
+}
+
 static void __free_preds(struct event_filter *filter)
 {
 	int i;
 
+	__free_prog(filter);
+
 	if (filter->preds) {
 		for (i = 0; i < filter->n_preds; i++)
 			kfree(filter->preds[i].ops);
@@ -785,8 +803,10 @@ static void filter_disable(struct ftrace_event_file *file)
 
 	if (call->flags & TRACE_EVENT_FL_USE_CALL_FILTER)
 		call_filter_disable(call);
-	else
+	else if (file->flags & FTRACE_EVENT_FL_FILTERED) {
 		file->flags &= ~FTRACE_EVENT_FL_FILTERED;
+		trace_buffered_event_disable();
+	}
 }
 
 static void __free_filter(struct event_filter *filter)
@@ -1579,6 +1599,193 @@ static int fold_pred_tree(struct event_filter *filter,
 			      filter->preds);
 }
 
+#ifdef CONFIG_NET
+/*
+ * A filter made of numeric predicates only is also translated into an
+ * internal BPF program, which filter_match_preds() runs instead of
+ * walking the tree, JIT'ed where the architecture can.  The program gets
+ * the record in R1.  Each leaf leaves its match in R0, and an AND or OR
+ * jumps over its right operand when the left one already decides it,
+ * like the walk does.
+ */
+
+/* The most instructions a leaf takes, see filter_compile_pred() */
+#define FILTER_PRED_MAX_INSNS	8
+
+struct filter_compile_data {
+	struct sock_filter_int	*insns;
+	int			len;
+	int			*jumps;		/* pending short circuits */
+	int			n_jumps;
+};
+
+static void filter_emit(struct filter_compile_data *d, u8 code,
+			u8 a_reg, u8 x_reg, s16 off, s32 imm)
+{
+	struct sock_filter_int *insn = &d->insns[d->len++];
+
+	insn->code = code;
+	insn->a_reg = a_reg;
+	insn->x_reg = x_reg;
+	insn->off = off;
+	insn->imm = imm;
+}
+
+static int filter_compile_pred(struct filter_compile_data *d,
+			       struct filter_pred *pred)
+{
+	struct ftrace_event_field *field = pred->field;
+	int shift = 64 - field->size * 8;
+	u8 size, code, a_reg = BPF_REG_2, x_reg = BPF_REG_3;
+	bool is_signed;
+	u64 val;
+
+	if (is_string_field(field) || is_function_field(field))
+		return -EINVAL;
+	if (pred->offset > S16_MAX)
+		return -E2BIG;
+
+	switch (field->size) {
+	case 1:
+		size = BPF_B;
+		break;
+	case 2:
+		size = BPF_H;
+		break;
+	case 4:
+		size = BPF_W;
+		break;
+	case 8:
+		size = BPF_DW;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	/* Like filter_pred_##size(), equality looks at the raw bits. */
+	is_signed = field->is_signed && pred->op != OP_EQ &&
+		    pred->op != OP_NE;
+
+	switch (pred->op) {
+	case OP_EQ:
+	case OP_NE:
+		code = pred->not ? BPF_JNE : BPF_JEQ;
+		break;
+	case OP_LT:
+		swap(a_reg, x_reg);
+		/* fall through */
+	case OP_GT:
+		code = is_signed ? BPF_JSGT : BPF_JGT;
+		break;
+	case OP_LE:
+		swap(a_reg, x_reg);
+		/* fall through */
+	case OP_GE:
+		code = is_signed ? BPF_JSGE : BPF_JGE;
+		break;
+	case OP_BAND:
+		code = BPF_JSET;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	/* the constant, truncated and extended as the field will be */
+	val = pred->val;
+	if (shift) {
+		val <<= shift;
+		val = is_signed ? (u64)((s64)val >> shift) : val >> shift;
+	}
+
+	filter_emit(d, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, 1);
+	filter_emit(d, BPF_LDX | BPF_MEM | size, BPF_REG_2, BPF_REG_1,
+		    pred->offset, 0);
+	if (is_signed && shift) {
+		filter_emit(d, BPF_ALU64 | BPF_LSH | BPF_K, BPF_REG_2, 0, 0,
+			    shift);
+		filter_emit(d, BPF_ALU64 | BPF_ARSH | BPF_K, BPF_REG_2, 0, 0,
+			    shift);
+	}
+	filter_emit(d, BPF_LD | BPF_IMM | BPF_DW, BPF_REG_3, 0, 0, (u32)val);
+	filter_emit(d, 0, 0, 0, 0, val >> 32);
+	filter_emit(d, BPF_JMP | code | BPF_X, a_reg, x_reg, 1, 0);
+	filter_emit(d, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, 0);
+
+	return 0;
+}
+
+static int filter_compile_cb(enum move_type move, struct filter_pred *pred,
+			     int *err, void *data)
+{
+	struct filter_compile_data *d = data;
+	int pos;
+
+	switch (move) {
+	case MOVE_DOWN:
+		if (pred->left != FILTER_PRED_INVALID)
+			return WALK_PRED_DEFAULT;
+		*err = filter_compile_pred(d, pred);
+		if (*err)
+			return WALK_PRED_ABORT;
+		return WALK_PRED_PARENT;
+	case MOVE_UP_FROM_LEFT:
+		/* R0 decides an OR if set and an AND if clear */
+		d->jumps[d->n_jumps++] = d->len;
+		filter_emit(d, BPF_JMP | BPF_K |
+			    (pred->op == OP_OR ? BPF_JNE : BPF_JEQ),
+			    BPF_REG_0, 0, 0, 0);
+		break;
+	case MOVE_UP_FROM_RIGHT:
+		pos = d->jumps[--d->n_jumps];
+		d->insns[pos].off = d->len - pos - 1;
+		break;
+	}
+
+	return WALK_PRED_DEFAULT;
+}
+
+/*
+ * Failing to compile is not an error, the filter is then matched by
+ * walking the tree as before.
+ */
+static void filter_compile(struct event_filter *filter,
+			   struct filter_pred *root)
+{
+	int max = filter->n_preds * FILTER_PRED_MAX_INSNS + 1;
+	struct filter_compile_data data = { };
+	struct sk_filter *fp;
+
+	if (max > BPF_MAXINSNS)
+		return;
+
+	fp = kzalloc(sk_filter_size(max), GFP_KERNEL);
+	data.jumps = kcalloc(filter->n_preds, sizeof(*data.jumps),
+			     GFP_KERNEL);
+	if (!fp || !data.jumps)
+		goto out;
+
+	data.insns = fp->insnsi;
+	if (walk_pred_tree(filter->preds, root, filter_compile_cb, &data))
+		goto out;
+	filter_emit(&data, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+	atomic_set(&fp->refcnt, 1);
+	fp->len = data.len;
+	sk_filter_select_runtime(fp);
+
+	filter->prog = fp;
+	fp = NULL;
+out:
+	kfree(data.jumps);
+	kfree(fp);
+}
+#else
+static inline void filter_compile(struct event_filter *filter,
+				  struct filter_pred *root)
+{
+}
+#endif /* CONFIG_NET */
+
 static int replace_preds(struct ftrace_event_call *call,
 			 struct event_filter *filter,
 			 struct filter_parse_state *ps,
@@ -1671,6 +1878,8 @@ static int replace_preds(struct ftrace_event_call *call,
 		if (err)
 			goto fail;
 
+		filter_compile(filter, root);
+
 		/* We don't set root until we know it works */
 		barrier();
 		filter->root = root;
@@ -1688,8 +1897,10 @@ static inline void event_set_filtered_flag(struct ftrace_event_file *file)
 
 	if (call->flags & TRACE_EVENT_FL_USE_CALL_FILTER)
 		call->flags |= TRACE_EVENT_FL_FILTERED;
-	else
+	else if (!(file->flags & FTRACE_EVENT_FL_FILTERED)) {
+		trace_buffered_event_enable();
 		file->flags |= FTRACE_EVENT_FL_FILTERED;
+	}
 }
 
 static inline void event_set_filter(struct ftrace_event_file *file,
@@ -48,6 +48,9 @@
 #include <linux/nodemask.h>
 #include <linux/moduleparam.h>
 #include <linux/uaccess.h>
+#include <linux/tick.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "workqueue_internal.h"
 
@@ -106,6 +109,9 @@ enum {
 	HIGHPRI_NICE_LEVEL	= -20,
 
 	WQ_NAME_LEN		= 24,
+
+	/* log2 usecs buckets of the queue to start latency */
+	WQ_STATS_LAT_BUCKETS	= 16,
 };
 
 /*
@@ -225,6 +231,20 @@ struct wq_flusher {
 
 struct wq_device;
 
+/*
+ * Per-cpu statistics of a workqueue, updated with irqs disabled by the
+ * cpu that queues or runs its works.  Times are in nsecs.
+ */
+struct wq_stats {
+	u64			nr_works;	/* works run */
+	u64			nr_delayed;	/* works over max_active */
+	u64			lat_hist[WQ_STATS_LAT_BUCKETS];
+	u64			lat_max;	/* longest queue to start */
+	u64			run_total;	/* time spent running works */
+	u64			run_max;	/* longest run of a work */
+	work_func_t		run_max_func;	/* the function of that work */
+};
+
 /*
  * The externally visible workqueue.  It relays the issued work items to
  * the appropriate worker_pool through its pool_workqueues.
@@ -255,6 +275,9 @@ struct workqueue_struct {
 #endif
 #ifdef CONFIG_LOCKDEP
 	struct lockdep_map	lockdep_map;
+#endif
+#ifdef CONFIG_WQ_STATS
+	struct wq_stats __percpu *stats;	/* I: see wq_stats_account() */
 #endif
 	char			name[WQ_NAME_LEN]; /* I: workqueue name */
 
@@ -1268,6 +1291,74 @@ fail:
 	return -EAGAIN;
 }
 
+#ifdef CONFIG_WQ_STATS
+static int wq_stats_alloc(struct workqueue_struct *wq)
+{
+	wq->stats = alloc_percpu(struct wq_stats);
+	return wq->stats ? 0 : -ENOMEM;
+}
+
+static void wq_stats_free(struct workqueue_struct *wq)
+{
+	free_percpu(wq->stats);
+}
+
+static void wq_stats_queued(struct work_struct *work)
+{
+	work->queued_at = local_clock();
+}
+
+static u64 wq_stats_queued_at(struct work_struct *work)
+{
+	return work->queued_at;
+}
+
+static u64 wq_stats_clock(void)
+{
+	return local_clock();
+}
+
+static void wq_stats_delayed(struct workqueue_struct *wq)
+{
+	__this_cpu_inc(wq->stats->nr_delayed);
+}
+
+/*
+ * Account a work of @wq that was queued at @queued and started running
+ * @func at @start, which has just returned.  Called with irqs disabled,
+ * which keeps the rescuer and the workers of this cpu off the per-cpu
+ * stats.
+ */
+static void wq_stats_account(struct workqueue_struct *wq, work_func_t func,
+			     u64 queued, u64 start)
+{
+	struct wq_stats *stats = this_cpu_ptr(wq->stats);
+	u64 lat = start > queued ? start - queued : 0;
+	u64 run = local_clock() - start;
+
+	stats->nr_works++;
+	stats->lat_hist[min_t(int, fls64(div_u64(lat, NSEC_PER_USEC)),
+			      WQ_STATS_LAT_BUCKETS - 1)]++;
+	if (lat > stats->lat_max)
+		stats->lat_max = lat;
+
+	stats->run_total += run;
+	if (run > stats->run_max) {
+		stats->run_max = run;
+		stats->run_max_func = func;
+	}
+}
+#else	/* CONFIG_WQ_STATS */
+static inline int wq_stats_alloc(struct workqueue_struct *wq) { return 0; }
+static inline void wq_stats_free(struct workqueue_struct *wq) { }
+static inline void wq_stats_queued(struct work_struct *work) { }
+static inline u64 wq_stats_queued_at(struct work_struct *work) { return 0; }
+static inline u64 wq_stats_clock(void) { return 0; }
+static inline void wq_stats_delayed(struct workqueue_struct *wq) { }
+static inline void wq_stats_account(struct workqueue_struct *wq,
+				    work_func_t func, u64 queued, u64 start) { }
+#endif	/* CONFIG_WQ_STATS */
+
 /**
  * insert_work - insert a work into a pool
  * @pwq: pwq @work belongs to
@@ -1289,6 +1380,7 @@ static void insert_work(struct pool_workqueue *pwq, struct work_struct *work,
 	/* we own @work, set data and link */
 	set_work_pwq(work, pwq, extra_flags);
 	list_add_tail(&work->entry, head);
+	wq_stats_queued(work);
 	get_pwq(pwq);
 
 	/*
@@ -1412,6 +1504,7 @@ retry:
 	} else {
 		work_flags |= WORK_STRUCT_DELAYED;
 		worklist = &pwq->delayed_works;
+		wq_stats_delayed(wq);
 	}
 
 	insert_work(pwq, work, worklist, work_flags);
@@ -2154,6 +2247,7 @@ __acquires(&pool->lock)
 	bool cpu_intensive = pwq->wq->flags & WQ_CPU_INTENSIVE;
 	int work_color;
 	struct worker *collision;
+	u64 queued, start;
 #ifdef CONFIG_LOCKDEP
 	/*
 	 * It is permissible to free the struct work_struct from
@@ -2192,6 +2286,7 @@ __acquires(&pool->lock)
 	hash_add(pool->busy_hash, &worker->hentry, (unsigned long)work);
 	worker->current_work = work;
 	worker->current_func = work->func;
+	nohz_full_noise_inc(NOHZ_NOISE_WORK);
 	worker->current_pwq = pwq;
 	work_color = get_work_color(work);
 
@@ -2219,8 +2314,12 @@ __acquires(&pool->lock)
 	 */
 	set_work_pool_and_clear_pending(work, pool->id);
 
+	/* @work may be queued again as soon as the lock is dropped */
+	queued = wq_stats_queued_at(work);
+
 	spin_unlock_irq(&pool->lock);
 
+	start = wq_stats_clock();
 	lock_map_acquire_read(&pwq->wq->lockdep_map);
 	lock_map_acquire(&lockdep_map);
 	trace_workqueue_execute_start(work);
@@ -2253,6 +2352,8 @@ __acquires(&pool->lock)
 
 	spin_lock_irq(&pool->lock);
 
+	wq_stats_account(pwq->wq, worker->current_func, queued, start);
+
 	/* clear cpu intensive status */
 	if (unlikely(cpu_intensive))
 		worker_clr_flags(worker, WORKER_CPU_INTENSIVE);
@@ -3447,6 +3548,86 @@ static void workqueue_sysfs_unregister(struct workqueue_struct *wq)
 static void workqueue_sysfs_unregister(struct workqueue_struct *wq)	{ }
 #endif	/* CONFIG_SYSFS */
 
+#ifdef CONFIG_WQ_STATS
+/*
+ * debugfs workqueue/stats: the stats of each workqueue summed over the
+ * cpus.  The latency histogram counts works by the log2 of the usecs
+ * they waited to start, the last bucket taking all the longer waits.
+ */
+static int wq_stats_show(struct seq_file *m, void *v)
+{
+	struct workqueue_struct *wq;
+	int i, cpu;
+
+	seq_puts(m, "# name works delayed lat_max_us run_us run_max_us func\n");
+	seq_puts(m, "#   lat_us <1 <2 <4 ...\n");
+
+	mutex_lock(&wq_pool_mutex);
+	list_for_each_entry(wq, &workqueues, list) {
+		struct wq_stats sum = { };
+
+		for_each_possible_cpu(cpu) {
+			struct wq_stats *stats = per_cpu_ptr(wq->stats, cpu);
+
+			sum.nr_works += stats->nr_works;
+			sum.nr_delayed += stats->nr_delayed;
+			for (i = 0; i < WQ_STATS_LAT_BUCKETS; i++)
+				sum.lat_hist[i] += stats->lat_hist[i];
+			sum.lat_max = max(sum.lat_max, stats->lat_max);
+			sum.run_total += stats->run_total;
+			if (stats->run_max > sum.run_max) {
+				sum.run_max = stats->run_max;
+				sum.run_max_func = stats->run_max_func;
+			}
+		}
+
+		seq_printf(m, "%s %llu %llu %llu %llu %llu %pf\n", wq->name,
+			   sum.nr_works, sum.nr_delayed,
+			   div_u64(sum.lat_max, NSEC_PER_USEC),
+			   div_u64(sum.run_total, NSEC_PER_USEC),
+			   div_u64(sum.run_max, NSEC_PER_USEC),
+			   sum.run_max_func);
+
+		seq_puts(m, "    lat_us");
+		for (i = 0; i < WQ_STATS_LAT_BUCKETS; i++)
+			seq_printf(m, " %llu", sum.lat_hist[i]);
+		seq_putc(m, '\n');
+	}
+	mutex_unlock(&wq_pool_mutex);
+
+	return 0;
+}
+
+static int wq_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, wq_stats_show, NULL);
+}
+
+static const struct file_operations wq_stats_fops = {
+	.open		= wq_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init wq_stats_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("workqueue", NULL);
+	if (!dir)
+		return -ENOMEM;
+
+	if (!debugfs_create_file("stats", 0444, dir, NULL, &wq_stats_fops)) {
+		debugfs_remove(dir);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+late_initcall(wq_stats_debugfs_init);
+#endif	/* CONFIG_WQ_STATS */
+
 /**
  * free_workqueue_attrs - free a workqueue_attrs
  * @attrs: workqueue_attrs to free
@@ -3746,6 +3927,7 @@ static void pwq_unbound_release_workfn(struct work_struct *work)
 	 */
 	if (is_last) {
 		free_workqueue_attrs(wq->unbound_attrs);
+		wq_stats_free(wq);
 		kfree(wq);
 	}
 }
@@ -4224,6 +4406,9 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 			goto err_free_wq;
 	}
 
+	if (wq_stats_alloc(wq))
+		goto err_free_wq;
+
 	va_start(args, lock_name);
 	vsnprintf(wq->name, sizeof(wq->name), fmt, args);
 	va_end(args);
@@ -4294,6 +4479,7 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 
 err_free_wq:
 	free_workqueue_attrs(wq->unbound_attrs);
+	wq_stats_free(wq);
 	kfree(wq);
 	return NULL;
 err_destroy:
@@ -4359,6 +4545,7 @@ void destroy_workqueue(struct workqueue_struct *wq)
 		 * free the pwqs and wq.
 		 */
 		free_percpu(wq->cpu_pwqs);
+		wq_stats_free(wq);
 		kfree(wq);
 	} else {
 		/*
@@ -5100,6 +5287,8 @@ static int __init init_workqueues(void)
 
 		BUG_ON(!(attrs = alloc_workqueue_attrs(GFP_KERNEL)));
 		attrs->nice = std_nice[i];
+		/* unbound work stays off the full dynticks cpus */
+		cpumask_copy(attrs->cpumask, housekeeping_cpumask());
 		unbound_std_wq_attrs[i] = attrs;
 
 		/*
@@ -5110,6 +5299,7 @@ static int __init init_workqueues(void)
 		BUG_ON(!(attrs = alloc_workqueue_attrs(GFP_KERNEL)));
 		attrs->nice = std_nice[i];
 		attrs->no_numa = true;
+		cpumask_copy(attrs->cpumask, housekeeping_cpumask());
 		ordered_wq_attrs[i] = attrs;
 	}
 
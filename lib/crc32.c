@@ -30,6 +30,12 @@
 #include <linux/module.h>
 #include <linux/types.h>
 #include <linux/sched.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/jiffies.h>
+#include <linux/gfp.h>
+#include <linux/random.h>
+#include <linux/rcupdate.h>
 #include "crc32defs.h"
 
 #if CRC_LE_BITS > 8
@@ -251,26 +257,218 @@ static inline u32 __pure crc32_le_generic(u32 crc, unsigned char const *p,
 }
 
 #if CRC_LE_BITS == 1
-u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+u32 __pure crc32_le_base(u32 crc, unsigned char const *p, size_t len)
 {
 	return crc32_le_generic(crc, p, len, NULL, CRCPOLY_LE);
 }
-u32 __pure __crc32c_le(u32 crc, unsigned char const *p, size_t len)
+u32 __pure __crc32c_le_base(u32 crc, unsigned char const *p, size_t len)
 {
 	return crc32_le_generic(crc, p, len, NULL, CRC32C_POLY_LE);
 }
 #else
-u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+u32 __pure crc32_le_base(u32 crc, unsigned char const *p, size_t len)
 {
 	return crc32_le_generic(crc, p, len,
 			(const u32 (*)[256])crc32table_le, CRCPOLY_LE);
 }
-u32 __pure __crc32c_le(u32 crc, unsigned char const *p, size_t len)
+u32 __pure __crc32c_le_base(u32 crc, unsigned char const *p, size_t len)
 {
 	return crc32_le_generic(crc, p, len,
 			(const u32 (*)[256])crc32ctable_le, CRC32C_POLY_LE);
 }
 #endif
+EXPORT_SYMBOL(crc32_le_base);
+EXPORT_SYMBOL(__crc32c_le_base);
+
+typedef u32 (*crc32_fn_t)(u32 crc, unsigned char const *p, size_t len);
+
+/*
+ * The implementations crc32_le() and __crc32c_le() dispatch to, the
+ * fastest of the table driven ones above and those an architecture
+ * registered with crc32_register_algo().  Calls into a registered one
+ * run with preemption disabled, so that its module can wait for them
+ * on unregistering.
+ */
+static crc32_fn_t __rcu crc32_le_fn = crc32_le_base;
+static crc32_fn_t __rcu crc32c_le_fn = __crc32c_le_base;
+
+static inline u32 crc32_dispatch(crc32_fn_t __rcu *fnp, crc32_fn_t base,
+				 u32 crc, unsigned char const *p, size_t len)
+{
+	crc32_fn_t fn;
+
+	rcu_read_lock_sched();
+	fn = rcu_dereference_sched(*fnp);
+	if (fn != base) {
+		crc = fn(crc, p, len);
+		rcu_read_unlock_sched();
+		return crc;
+	}
+	rcu_read_unlock_sched();
+
+	return base(crc, p, len);
+}
+
+u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+{
+	return crc32_dispatch(&crc32_le_fn, crc32_le_base, crc, p, len);
+}
+
+u32 __pure __crc32c_le(u32 crc, unsigned char const *p, size_t len)
+{
+	return crc32_dispatch(&crc32c_le_fn, __crc32c_le_base, crc, p, len);
+}
+
+#define CRC32_BENCH_SIZE	PAGE_SIZE
+#define CRC32_TIME_JIFFIES_LG2	3
+
+static DEFINE_MUTEX(crc32_algo_mutex);
+static LIST_HEAD(crc32_algos);
+static unsigned long crc32_le_base_perf, crc32c_le_base_perf;
+static u32 crc32_bench_crc;
+
+/* Calls of @fn on a page in 1 << CRC32_TIME_JIFFIES_LG2 jiffies. */
+static unsigned long crc32_bench(crc32_fn_t fn, const u8 *buf)
+{
+	unsigned long j0, j1, perf = 0;
+	u32 crc = ~0;
+
+	preempt_disable();
+	j0 = jiffies;
+	while ((j1 = jiffies) == j0)
+		cpu_relax();
+	while (time_before(jiffies, j1 + (1 << CRC32_TIME_JIFFIES_LG2))) {
+		crc = fn(crc, buf, CRC32_BENCH_SIZE);
+		perf++;
+	}
+	preempt_enable();
+
+	/* keep the calls of a __pure function from being dropped */
+	ACCESS_ONCE(crc32_bench_crc) = crc;
+
+	return perf;
+}
+
+/* Lengths and misalignments around what implementations special-case. */
+static bool crc32_check(crc32_fn_t fn, crc32_fn_t base, const u8 *buf)
+{
+	static const size_t lens[] = { 0, 1, 7, 63, 64, 79, 80, 511, 512,
+				       1023, 1024, CRC32_BENCH_SIZE - 3 };
+	int i, off;
+
+	for (i = 0; i < ARRAY_SIZE(lens); i++) {
+		for (off = 0; off < 4 && off + lens[i] <= CRC32_BENCH_SIZE;
+		     off++) {
+			if (fn(~0, buf + off, lens[i]) !=
+			    base(~0, buf + off, lens[i]))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static void crc32_select(void)
+{
+	unsigned long le_perf = crc32_le_base_perf;
+	unsigned long c_perf = crc32c_le_base_perf;
+	crc32_fn_t le_fn = crc32_le_base, c_fn = __crc32c_le_base;
+	const char *le_name = "generic", *c_name = "generic";
+	struct crc32_algo *algo;
+
+	list_for_each_entry(algo, &crc32_algos, list) {
+		if (algo->crc32_le && algo->crc32_le_perf > le_perf) {
+			le_perf = algo->crc32_le_perf;
+			le_fn = algo->crc32_le;
+			le_name = algo->name;
+		}
+		if (algo->crc32c_le && algo->crc32c_le_perf > c_perf) {
+			c_perf = algo->crc32c_le_perf;
+			c_fn = algo->crc32c_le;
+			c_name = algo->name;
+		}
+	}
+
+	if (le_fn != rcu_dereference_protected(crc32_le_fn,
+				lockdep_is_held(&crc32_algo_mutex)))
+		pr_info("crc32: using %s crc32_le\n", le_name);
+	if (c_fn != rcu_dereference_protected(crc32c_le_fn,
+				lockdep_is_held(&crc32_algo_mutex)))
+		pr_info("crc32: using %s crc32c\n", c_name);
+
+	rcu_assign_pointer(crc32_le_fn, le_fn);
+	rcu_assign_pointer(crc32c_le_fn, c_fn);
+}
+
+/**
+ * crc32_register_algo - offer an implementation of crc32_le() and crc32c
+ * @algo: the implementation, either function may be NULL
+ *
+ * Checks the functions of @algo against the table driven ones and times
+ * them, on a page, like raid6_select_algo() does.  crc32_le() and
+ * __crc32c_le() then call the fastest implementation registered.  The
+ * functions should fall back on crc32_le_base() and __crc32c_le_base(),
+ * rather than on crc32_le() and __crc32c_le(), where they need to.
+ *
+ * Returns 0, -ENOMEM, or -EINVAL if a function gives wrong results.
+ * Might sleep.
+ */
+int crc32_register_algo(struct crc32_algo *algo)
+{
+	u8 *buf;
+	int err = 0;
+
+	buf = (u8 *)__get_free_page(GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	get_random_bytes(buf, CRC32_BENCH_SIZE);
+
+	if ((algo->crc32_le &&
+	     !crc32_check(algo->crc32_le, crc32_le_base, buf)) ||
+	    (algo->crc32c_le &&
+	     !crc32_check(algo->crc32c_le, __crc32c_le_base, buf))) {
+		pr_err("crc32: %s gives wrong results\n", algo->name);
+		err = -EINVAL;
+		goto out;
+	}
+
+	mutex_lock(&crc32_algo_mutex);
+
+	if (!crc32_le_base_perf) {
+		crc32_le_base_perf = crc32_bench(crc32_le_base, buf);
+		crc32c_le_base_perf = crc32_bench(__crc32c_le_base, buf);
+	}
+	if (algo->crc32_le)
+		algo->crc32_le_perf = crc32_bench(algo->crc32_le, buf);
+	if (algo->crc32c_le)
+		algo->crc32c_le_perf = crc32_bench(algo->crc32c_le, buf);
+
+	list_add_tail(&algo->list, &crc32_algos);
+	crc32_select();
+
+	mutex_unlock(&crc32_algo_mutex);
+out:
+	free_page((unsigned long)buf);
+	return err;
+}
+EXPORT_SYMBOL_GPL(crc32_register_algo);
+
+/**
+ * crc32_unregister_algo - withdraw an implementation
+ * @algo: what was passed to crc32_register_algo()
+ *
+ * Returns once no call is left in the functions of @algo.  Might sleep.
+ */
+void crc32_unregister_algo(struct crc32_algo *algo)
+{
+	mutex_lock(&crc32_algo_mutex);
+	list_del(&algo->list);
+	crc32_select();
+	mutex_unlock(&crc32_algo_mutex);
+
+	synchronize_sched();
+}
+EXPORT_SYMBOL_GPL(crc32_unregister_algo);
 u32 __pure crc32_le_combine(u32 crc1, u32 crc2, size_t len2)
 {
 	return crc32_generic_combine(crc1, crc2, len2, CRCPOLY_LE);
@@ -31,6 +31,7 @@
 #include <linux/cpu.h>
 #include <linux/string.h>
 #include <linux/bitops.h>
+#include <linux/log2.h>
 #include <linux/rcupdate.h>
 #include <linux/hardirq.h>		/* in_interrupt() */
 
@@ -78,6 +79,57 @@ static inline void *indirect_to_ptr(void *ptr)
 	return (void *)((unsigned long)ptr & ~RADIX_TREE_INDIRECT_PTR);
 }
 
+/*
+ * A multi-order entry covering more than one slot of a node is stored in
+ * the first of those slots.  The others hold sibling entries: indirect
+ * pointers back to that canonical slot, which tell them apart from the
+ * indirect pointers to child nodes.
+ */
+static inline bool is_sibling_entry(struct radix_tree_node *parent, void *node)
+{
+	void **ptr = indirect_to_ptr(node);
+
+	return radix_tree_is_indirect_ptr(node) &&
+		(parent->slots <= ptr) &&
+		(ptr < parent->slots + RADIX_TREE_MAP_SIZE);
+}
+
+static inline void *make_sibling_entry(struct radix_tree_node *parent,
+				       unsigned int offset)
+{
+	return ptr_to_indirect(parent->slots + offset);
+}
+
+/*
+ * Return the entry in @parent at *@offsetp, following a sibling entry to
+ * its canonical slot and updating *@offsetp accordingly.
+ */
+static inline void *radix_tree_descend(struct radix_tree_node *parent,
+				       unsigned int *offsetp)
+{
+	void *entry = rcu_dereference_raw(parent->slots[*offsetp]);
+
+	if (is_sibling_entry(parent, entry)) {
+		void **sibentry = indirect_to_ptr(entry);
+
+		*offsetp = sibentry - parent->slots;
+		entry = rcu_dereference_raw(*sibentry);
+	}
+	return entry;
+}
+
+/* Number of sibling entries following the canonical slot at @offset. */
+static inline unsigned int nr_sibling_entries(struct radix_tree_node *parent,
+					      unsigned int offset)
+{
+	unsigned int i;
+
+	for (i = offset + 1; i < RADIX_TREE_MAP_SIZE; i++)
+		if (!is_sibling_entry(parent, parent->slots[i]))
+			break;
+	return i - offset - 1;
+}
+
 static inline gfp_t root_gfp_mask(struct radix_tree_root *root)
 {
 	return root->gfp_mask & __GFP_BITS_MASK;
@@ -347,10 +399,9 @@ static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
 		node->count = 1;
 		node->parent = NULL;
 		slot = root->rnode;
-		if (newheight > 1) {
-			slot = indirect_to_ptr(slot);
-			slot->parent = node;
-		}
+		if (newheight > 1)
+			((struct radix_tree_node *)indirect_to_ptr(slot))->parent =
+									node;
 		node->slots[0] = slot;
 		node = ptr_to_indirect(node);
 		rcu_assign_pointer(root->rnode, node);
@@ -364,28 +415,41 @@ out:
  *	__radix_tree_create	-	create a slot in a radix tree
  *	@root:		radix tree root
  *	@index:		index key
+ *	@order:		index occupies 2^order aligned slots
  *	@nodep:		returns node
  *	@slotp:		returns slot
  *
  *	Create, if necessary, and return the node and slot for an item
- *	at position @index in the radix tree @root.
+ *	at position @index in the radix tree @root.  For @order > 0 this
+ *	is the first of the slots the entry occupies in the node whose
+ *	slots each cover 2^(@order rounded down to a multiple of
+ *	RADIX_TREE_MAP_SHIFT) indices.
  *
  *	Until there is more than one item in the tree, no nodes are
  *	allocated and @root->rnode is used as a direct slot instead of
  *	pointing to a node, in which case *@nodep will be NULL.
  *
- *	Returns -ENOMEM, or 0 for success.
+ *	Returns -ENOMEM, -EEXIST if a larger entry already covers @index,
+ *	or 0 for success.
  */
 int __radix_tree_create(struct radix_tree_root *root, unsigned long index,
-			struct radix_tree_node **nodep, void ***slotp)
+			unsigned order, struct radix_tree_node **nodep,
+			void ***slotp)
 {
 	struct radix_tree_node *node = NULL, *slot;
-	unsigned int height, shift, offset;
+	unsigned long max = index | ((1UL << order) - 1);
+	unsigned int height, shift, offset, stop;
 	int error;
 
+	/* Multi-order entries live at the level whose slots they span. */
+	stop = order / RADIX_TREE_MAP_SHIFT;
+	if (stop)
+		max = max_t(unsigned long, max,
+			    radix_tree_maxindex(stop) + 1);
+
 	/* Make sure the tree is high enough.  */
-	if (index > radix_tree_maxindex(root->height)) {
-		error = radix_tree_extend(root, index);
+	if (max > radix_tree_maxindex(root->height)) {
+		error = radix_tree_extend(root, max);
 		if (error)
 			return error;
 	}
@@ -396,7 +460,7 @@ int __radix_tree_create(struct radix_tree_root *root, unsigned long index,
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
 
 	offset = 0;			/* uninitialised var warning */
-	while (height > 0) {
+	while (height > stop) {
 		if (slot == NULL) {
 			/* Have to add a child node.  */
 			if (!(slot = radix_tree_node_alloc(root)))
@@ -404,7 +468,8 @@ int __radix_tree_create(struct radix_tree_root *root, unsigned long index,
 			slot->path = height;
 			slot->parent = node;
 			if (node) {
-				rcu_assign_pointer(node->slots[offset], slot);
+				rcu_assign_pointer(node->slots[offset],
+						   ptr_to_indirect(slot));
 				node->count++;
 				slot->path |= offset << RADIX_TREE_HEIGHT_SHIFT;
 			} else
@@ -417,6 +482,14 @@ int __radix_tree_create(struct radix_tree_root *root, unsigned long index,
 		slot = node->slots[offset];
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
+
+		if (height > stop && slot) {
+			/* Already covered by a multi-order entry? */
+			if (!radix_tree_is_indirect_ptr(slot) ||
+			    is_sibling_entry(node, slot))
+				return -EEXIST;
+			slot = indirect_to_ptr(slot);
+		}
 	}
 
 	if (nodep)
@@ -427,33 +500,48 @@ int __radix_tree_create(struct radix_tree_root *root, unsigned long index,
 }
 
 /**
- *	radix_tree_insert    -    insert into a radix tree
+ *	__radix_tree_insert    -    insert into a radix tree
  *	@root:		radix tree root
  *	@index:		index key
+ *	@order:		key covers the 2^order indices around index
  *	@item:		item to insert
  *
- *	Insert an item into the radix tree at position @index.
+ *	Insert an item into the radix tree at position @index, which must
+ *	be aligned to 2^@order.  The item is then found by lookups of any
+ *	index in the range, and tagged or deleted through any of them.
  */
-int radix_tree_insert(struct radix_tree_root *root,
-			unsigned long index, void *item)
+int __radix_tree_insert(struct radix_tree_root *root, unsigned long index,
+			unsigned order, void *item)
 {
 	struct radix_tree_node *node;
+	unsigned int offset, i, n;
 	void **slot;
 	int error;
 
 	BUG_ON(radix_tree_is_indirect_ptr(item));
+	BUG_ON(order >= RADIX_TREE_INDEX_BITS);
+	BUG_ON(index & ((1UL << order) - 1));
 
-	error = __radix_tree_create(root, index, &node, &slot);
+	error = __radix_tree_create(root, index, order, &node, &slot);
 	if (error)
 		return error;
-	if (*slot != NULL)
-		return -EEXIST;
+
+	n = 1U << (order % RADIX_TREE_MAP_SHIFT);
+	for (i = 0; i < n; i++)
+		if (slot[i] != NULL)
+			return -EEXIST;
+
+	/* Publish the item before the siblings that lead to it. */
 	rcu_assign_pointer(*slot, item);
 
 	if (node) {
-		node->count++;
-		BUG_ON(tag_get(node, 0, index & RADIX_TREE_MAP_MASK));
-		BUG_ON(tag_get(node, 1, index & RADIX_TREE_MAP_MASK));
+		offset = slot - node->slots;
+		for (i = 1; i < n; i++)
+			rcu_assign_pointer(slot[i],
+					   make_sibling_entry(node, offset));
+		node->count += n;
+		BUG_ON(tag_get(node, 0, offset));
+		BUG_ON(tag_get(node, 1, offset));
 	} else {
 		BUG_ON(root_tag_get(root, 0));
 		BUG_ON(root_tag_get(root, 1));
@@ -461,7 +549,7 @@ int radix_tree_insert(struct radix_tree_root *root,
 
 	return 0;
 }
-EXPORT_SYMBOL(radix_tree_insert);
+EXPORT_SYMBOL(__radix_tree_insert);
 
 /**
  *	__radix_tree_lookup	-	lookup an item in a radix tree
@@ -507,14 +595,23 @@ void *__radix_tree_lookup(struct radix_tree_root *root, unsigned long index,
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
 
 	do {
+		unsigned int offset;
+
 		parent = node;
-		slot = node->slots + ((index >> shift) & RADIX_TREE_MAP_MASK);
-		node = rcu_dereference_raw(*slot);
+		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+		node = radix_tree_descend(parent, &offset);
+		slot = parent->slots + offset;
 		if (node == NULL)
 			return NULL;
 
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
+		if (height == 0)
+			break;
+		/* A multi-order entry rather than a child node? */
+		if (!radix_tree_is_indirect_ptr(node))
+			break;
+		node = indirect_to_ptr(node);
 	} while (height > 0);
 
 	if (nodep)
@@ -591,15 +688,21 @@ void *radix_tree_tag_set(struct radix_tree_root *root,
 	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
 
 	while (height > 0) {
-		int offset;
+		unsigned int offset;
+		void *entry;
 
 		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+		entry = radix_tree_descend(slot, &offset);
 		if (!tag_get(slot, tag, offset))
 			tag_set(slot, tag, offset);
-		slot = slot->slots[offset];
-		BUG_ON(slot == NULL);
+		BUG_ON(entry == NULL);
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
+		if (height == 0 || !radix_tree_is_indirect_ptr(entry)) {
+			slot = entry;
+			break;
+		}
+		slot = indirect_to_ptr(entry);
 	}
 
 	/* set the root's tag bit */
@@ -630,7 +733,7 @@ void *radix_tree_tag_clear(struct radix_tree_root *root,
 	struct radix_tree_node *node = NULL;
 	struct radix_tree_node *slot = NULL;
 	unsigned int height, shift;
-	int uninitialized_var(offset);
+	unsigned int uninitialized_var(offset);
 
 	height = root->height;
 	if (index > radix_tree_maxindex(height))
@@ -646,12 +749,18 @@ void *radix_tree_tag_clear(struct radix_tree_root *root,
 		shift -= RADIX_TREE_MAP_SHIFT;
 		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
 		node = slot;
-		slot = slot->slots[offset];
+		slot = radix_tree_descend(node, &offset);
+		if (!radix_tree_is_indirect_ptr(slot))
+			break;
+		slot = indirect_to_ptr(slot);
 	}
 
 	if (slot == NULL)
 		goto out;
 
+	/* Walk back up from the level the entry was found at. */
+	index >>= shift;
+
 	while (node) {
 		if (!tag_get(node, tag, offset))
 			goto out;
@@ -713,17 +822,21 @@ int radix_tree_tag_get(struct radix_tree_root *root,
 	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
 
 	for ( ; ; ) {
-		int offset;
+		unsigned int offset;
+		void *entry;
 
 		if (node == NULL)
 			return 0;
 
 		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+		entry = radix_tree_descend(node, &offset);
 		if (!tag_get(node, tag, offset))
 			return 0;
 		if (height == 1)
 			return 1;
-		node = rcu_dereference_raw(node->slots[offset]);
+		if (entry && !radix_tree_is_indirect_ptr(entry))
+			return 1;	/* multi-order entry */
+		node = indirect_to_ptr(entry);
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
 	}
@@ -784,6 +897,16 @@ restart:
 
 	node = rnode;
 	while (1) {
+		void *entry;
+
+		/* Started inside a multi-order entry: back up to its start */
+		entry = rcu_dereference_raw(node->slots[offset]);
+		if (is_sibling_entry(node, entry)) {
+			offset = (void **)indirect_to_ptr(entry) - node->slots;
+			index &= ~((RADIX_TREE_MAP_SIZE << shift) - 1);
+			index += offset << shift;
+		}
+
 		if ((flags & RADIX_TREE_ITER_TAGGED) ?
 				!test_bit(offset, node->tags[tag]) :
 				!node->slots[offset]) {
@@ -798,7 +921,8 @@ restart:
 						offset + 1);
 			else
 				while (++offset	< RADIX_TREE_MAP_SIZE) {
-					if (node->slots[offset])
+					entry = node->slots[offset];
+					if (entry && !is_sibling_entry(node, entry))
 						break;
 				}
 			index &= ~((RADIX_TREE_MAP_SIZE << shift) - 1);
@@ -814,14 +938,28 @@ restart:
 		if (!shift)
 			break;
 
-		node = rcu_dereference_raw(node->slots[offset]);
-		if (node == NULL)
+		entry = rcu_dereference_raw(node->slots[offset]);
+		if (entry == NULL)
 			goto restart;
+		if (!radix_tree_is_indirect_ptr(entry)) {
+			/*
+			 * A multi-order entry stored in this interior node:
+			 * return it as a chunk of one slot spanning its range.
+			 */
+			iter->shift = shift +
+				ilog2(nr_sibling_entries(node, offset) + 1);
+			iter->index = index & ~((1UL << shift) - 1);
+			iter->next_index = iter->index + (1UL << iter->shift);
+			iter->tags = 1;
+			return node->slots + offset;
+		}
+		node = indirect_to_ptr(entry);
 		shift -= RADIX_TREE_MAP_SHIFT;
 		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
 	}
 
 	/* Update the iterator state */
+	iter->shift = 0;
 	iter->index = index;
 	iter->next_index = (index | RADIX_TREE_MAP_MASK) + 1;
 
@@ -906,27 +1044,30 @@ unsigned long radix_tree_range_tag_if_tagged(struct radix_tree_root *root,
 
 	for (;;) {
 		unsigned long upindex;
+		void *entry;
 		int offset;
 
 		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-		if (!slot->slots[offset])
+		entry = slot->slots[offset];
+		if (!entry)
 			goto next;
+		/* Sibling entries are never tagged, their canonical slot is */
 		if (!tag_get(slot, iftag, offset))
 			goto next;
-		if (shift) {
+		if (shift && radix_tree_is_indirect_ptr(entry)) {
 			/* Go down one level */
 			shift -= RADIX_TREE_MAP_SHIFT;
 			node = slot;
-			slot = slot->slots[offset];
+			slot = indirect_to_ptr(entry);
 			continue;
 		}
 
-		/* tag the leaf */
+		/* tag the leaf, or the multi-order entry */
 		tagged++;
 		tag_set(slot, settag, offset);
 
 		/* walk back up the path tagging interior nodes */
-		upindex = index;
+		upindex = index >> shift;
 		while (node) {
 			upindex >>= RADIX_TREE_MAP_SHIFT;
 			offset = upindex & RADIX_TREE_MAP_MASK;
@@ -1151,8 +1292,17 @@ static unsigned long __locate(struct radix_tree_node *slot, void *item,
 	for ( ; height > 1; height--) {
 		i = (index >> shift) & RADIX_TREE_MAP_MASK;
 		for (;;) {
-			if (slot->slots[i] != NULL)
+			void *entry = slot->slots[i];
+
+			if (radix_tree_is_indirect_ptr(entry) &&
+			    !is_sibling_entry(slot, entry))
 				break;
+			if (entry && entry == item) {
+				/* multi-order entry */
+				*found_index = index & ~((1UL << shift) - 1);
+				index = 0;
+				goto out;
+			}
 			index &= ~((1UL << shift) - 1);
 			index += 1UL << shift;
 			if (index == 0)
@@ -1164,8 +1314,9 @@ static unsigned long __locate(struct radix_tree_node *slot, void *item,
 
 		shift -= RADIX_TREE_MAP_SHIFT;
 		slot = rcu_dereference_raw(slot->slots[i]);
-		if (slot == NULL)
+		if (!radix_tree_is_indirect_ptr(slot))
 			goto out;
+		slot = indirect_to_ptr(slot);
 	}
 
 	/* Bottom level: check items */
@@ -1261,8 +1412,11 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
 		 */
 		slot = to_free->slots[0];
 		if (root->height > 1) {
-			slot->parent = NULL;
-			slot = ptr_to_indirect(slot);
+			/* A multi-order entry cannot move up a level */
+			if (!radix_tree_is_indirect_ptr(slot))
+				break;
+			((struct radix_tree_node *)indirect_to_ptr(slot))->parent =
+									NULL;
 		}
 		root->rnode = slot;
 		root->height--;
@@ -1359,7 +1513,7 @@ void *radix_tree_delete_item(struct radix_tree_root *root,
 			     unsigned long index, void *item)
 {
 	struct radix_tree_node *node;
-	unsigned int offset;
+	unsigned int offset, i, n;
 	void **slot;
 	void *entry;
 	int tag;
@@ -1377,7 +1531,7 @@ void *radix_tree_delete_item(struct radix_tree_root *root,
 		return entry;
 	}
 
-	offset = index & RADIX_TREE_MAP_MASK;
+	offset = slot - node->slots;
 
 	/*
 	 * Clear all tags associated with the item to be deleted.
@@ -1388,8 +1542,12 @@ void *radix_tree_delete_item(struct radix_tree_root *root,
 			radix_tree_tag_clear(root, index, tag);
 	}
 
+	/* Siblings go before the slot they point at */
+	n = nr_sibling_entries(node, offset);
+	for (i = n; i > 0; i--)
+		node->slots[offset + i] = NULL;
 	node->slots[offset] = NULL;
-	node->count--;
+	node->count -= n + 1;
 
 	__radix_tree_delete_node(root, node);
 
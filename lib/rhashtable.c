@@ -0,0 +1,492 @@
+/*
+ * Resizable, RCU protected hash table
+ *
+ * A resize allocates the table of the new size, hangs it off the old
+ * one as its future_tbl and moves the objects over one bucket at a
+ * time, under the lock of that bucket.  Insertions go to the future
+ * table as soon as there is one.  Lookups that miss in a table go on to
+ * its future table, so that an object is found whether or not its
+ * bucket was moved yet.  Once all of them were, the new table replaces
+ * the old one, which is freed after a grace period.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/export.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/log2.h>
+#include <linux/cpumask.h>
+#include <linux/sched.h>
+#include <linux/rhashtable.h>
+
+#define RHT_MIN_SIZE		4
+#define RHT_LOCKS_PER_CPU	32
+
+#define rht_dereference(p, ht) \
+	rcu_dereference_protected(p, lockdep_is_held(&(ht)->mutex))
+
+#define rht_dereference_bucket(p, tbl, hash) \
+	rcu_dereference_protected(p, \
+				  lockdep_is_held(rht_bucket_lock(tbl, hash)))
+
+static void *rht_obj(const struct rhashtable *ht, const struct rhash_head *he)
+{
+	return (char *)he - ht->p.head_offset;
+}
+
+static u32 rht_key_hash(const struct rhashtable *ht, const void *key)
+{
+	if (ht->p.hashfn)
+		return ht->p.hashfn(key, ht->p.key_len, ht->seed);
+	return jhash(key, ht->p.key_len, ht->seed);
+}
+
+static const void *rht_head_key(const struct rhashtable *ht,
+				const struct rhash_head *he)
+{
+	return (char *)rht_obj(ht, he) + ht->p.key_offset;
+}
+
+static unsigned int rht_bucket(const struct bucket_table *tbl, u32 hash)
+{
+	return hash & (tbl->size - 1);
+}
+
+/* locks_mask < size, so a lock covers whole buckets */
+static spinlock_t *rht_bucket_lock(const struct bucket_table *tbl, u32 hash)
+{
+	return &tbl->locks[hash & tbl->locks_mask];
+}
+
+static bool rht_grow_above_75(const struct rhashtable *ht,
+			      const struct bucket_table *tbl)
+{
+	return atomic_read(&ht->nelems) > tbl->size / 4 * 3 &&
+	       (!ht->p.max_size || tbl->size < ht->p.max_size);
+}
+
+static bool rht_shrink_below_30(const struct rhashtable *ht,
+				const struct bucket_table *tbl)
+{
+	return atomic_read(&ht->nelems) < tbl->size * 3 / 10 &&
+	       tbl->size > ht->p.min_size;
+}
+
+static struct bucket_table *bucket_table_alloc(unsigned int size)
+{
+	size_t tbl_size = sizeof(struct bucket_table) +
+			  size * sizeof(struct rhash_head *);
+	struct bucket_table *tbl;
+	unsigned int nr_locks, i;
+
+	tbl = kzalloc(tbl_size, GFP_KERNEL | __GFP_NOWARN);
+	if (!tbl)
+		tbl = vzalloc(tbl_size);
+	if (!tbl)
+		return NULL;
+
+	nr_locks = roundup_pow_of_two(num_possible_cpus() * RHT_LOCKS_PER_CPU);
+	nr_locks = min(nr_locks, size);
+
+	tbl->locks = kmalloc_array(nr_locks, sizeof(spinlock_t), GFP_KERNEL);
+	if (!tbl->locks) {
+		kvfree(tbl);
+		return NULL;
+	}
+	for (i = 0; i < nr_locks; i++)
+		spin_lock_init(&tbl->locks[i]);
+
+	tbl->size = size;
+	tbl->locks_mask = nr_locks - 1;
+
+	return tbl;
+}
+
+static void bucket_table_free(struct bucket_table *tbl)
+{
+	kfree(tbl->locks);
+	kvfree(tbl);
+}
+
+/*
+ * Move the last object of an old bucket to the new table.  Taking the
+ * last one means that a lookup walking the old chain misses nothing:
+ * one that is past the object when it is cut off goes on into the new
+ * chain, which ends just as well, and one that is not yet there finds
+ * the object in the new table after the old chain ends.  Called with
+ * the old bucket locked.
+ */
+static bool rhashtable_rehash_one(struct rhashtable *ht,
+				  struct bucket_table *old_tbl,
+				  struct bucket_table *new_tbl,
+				  unsigned int old_hash)
+{
+	struct rhash_head __rcu **pprev = &old_tbl->buckets[old_hash];
+	struct rhash_head *entry, *next;
+	spinlock_t *new_lock;
+	unsigned int new_bucket;
+	u32 hash;
+
+	entry = rht_dereference_bucket(*pprev, old_tbl, old_hash);
+	if (!entry)
+		return false;
+
+	while ((next = rht_dereference_bucket(entry->next, old_tbl,
+					      old_hash))) {
+		pprev = &entry->next;
+		entry = next;
+	}
+
+	hash = rht_key_hash(ht, rht_head_key(ht, entry));
+	new_bucket = rht_bucket(new_tbl, hash);
+	new_lock = rht_bucket_lock(new_tbl, hash);
+
+	spin_lock_nested(new_lock, SINGLE_DEPTH_NESTING);
+	RCU_INIT_POINTER(entry->next,
+			 rht_dereference_bucket(new_tbl->buckets[new_bucket],
+						new_tbl, hash));
+	rcu_assign_pointer(new_tbl->buckets[new_bucket], entry);
+	spin_unlock(new_lock);
+
+	/* ordered after the above, which a lookup that misses relies on */
+	rcu_assign_pointer(*pprev, NULL);
+
+	return true;
+}
+
+static void rhashtable_rehash_chain(struct rhashtable *ht,
+				    struct bucket_table *old_tbl,
+				    struct bucket_table *new_tbl,
+				    unsigned int old_hash)
+{
+	spinlock_t *old_lock = rht_bucket_lock(old_tbl, old_hash);
+
+	spin_lock_bh(old_lock);
+	while (rhashtable_rehash_one(ht, old_tbl, new_tbl, old_hash))
+		;
+	spin_unlock_bh(old_lock);
+}
+
+static int rhashtable_rehash(struct rhashtable *ht, unsigned int size)
+{
+	struct bucket_table *old_tbl = rht_dereference(ht->tbl, ht);
+	struct bucket_table *new_tbl;
+	unsigned int i;
+
+	new_tbl = bucket_table_alloc(size);
+	if (!new_tbl)
+		return -ENOMEM;
+
+	/*
+	 * An insertion that takes a bucket lock after this sees the new
+	 * table and goes there, an earlier one is moved over below.
+	 */
+	rcu_assign_pointer(old_tbl->future_tbl, new_tbl);
+
+	for (i = 0; i < old_tbl->size; i++) {
+		rhashtable_rehash_chain(ht, old_tbl, new_tbl, i);
+		cond_resched();
+	}
+
+	rcu_assign_pointer(ht->tbl, new_tbl);
+
+	/* wait for lookups, insertions and removals in the old table */
+	synchronize_rcu();
+	bucket_table_free(old_tbl);
+
+	return 0;
+}
+
+static void rht_deferred_worker(struct work_struct *work)
+{
+	struct rhashtable *ht = container_of(work, struct rhashtable, run_work);
+	struct bucket_table *tbl;
+	unsigned int size;
+
+	mutex_lock(&ht->mutex);
+
+	while (!ht->being_destroyed) {
+		tbl = rht_dereference(ht->tbl, ht);
+		if (rht_grow_above_75(ht, tbl))
+			size = tbl->size * 2;
+		else if (rht_shrink_below_30(ht, tbl))
+			size = tbl->size / 2;
+		else
+			break;
+
+		if (rhashtable_rehash(ht, size))
+			break;
+	}
+
+	mutex_unlock(&ht->mutex);
+}
+
+static struct rhash_head *rht_lookup_tbl(struct rhashtable *ht,
+					 struct bucket_table *tbl,
+					 const void *key, u32 hash)
+{
+	struct rhash_head *he;
+
+	for (he = rcu_dereference(tbl->buckets[rht_bucket(tbl, hash)]); he;
+	     he = rcu_dereference(he->next)) {
+		if (!memcmp(rht_head_key(ht, he), key, ht->p.key_len))
+			return he;
+	}
+
+	return NULL;
+}
+
+/**
+ * rhashtable_lookup - look up an object by its key
+ * @ht: the hash table
+ * @key: the key, of the length given in the parameters
+ *
+ * Returns the object, or NULL if there is none with @key.  Must be
+ * called under rcu_read_lock(), and the object must not be used once
+ * that is dropped unless the caller otherwise keeps it around.
+ */
+void *rhashtable_lookup(struct rhashtable *ht, const void *key)
+{
+	struct bucket_table *tbl = rcu_dereference(ht->tbl);
+	struct rhash_head *he;
+	u32 hash = rht_key_hash(ht, key);
+
+	do {
+		he = rht_lookup_tbl(ht, tbl, key, hash);
+		if (he)
+			return rht_obj(ht, he);
+
+		/* it may have been moved, see rhashtable_rehash_one() */
+		smp_rmb();
+		tbl = rcu_dereference(tbl->future_tbl);
+	} while (tbl);
+
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(rhashtable_lookup);
+
+/**
+ * rhashtable_insert - insert an object
+ * @ht: the hash table
+ * @obj: the struct rhash_head of the object, with its key set
+ *
+ * Returns 0, or -EEXIST if there already is an object with the same
+ * key.  Never sleeps nor allocates, a resize the insertion calls for is
+ * left to a worker.  May be called from softirq context.
+ */
+int rhashtable_insert(struct rhashtable *ht, struct rhash_head *obj)
+{
+	const void *key = rht_head_key(ht, obj);
+	struct bucket_table *tbl, *new_tbl;
+	spinlock_t *lock, *new_lock = NULL;
+	u32 hash = rht_key_hash(ht, key);
+	struct rhash_head __rcu **head;
+	int err = 0;
+
+	rcu_read_lock();
+
+	tbl = rcu_dereference(ht->tbl);
+	lock = rht_bucket_lock(tbl, hash);
+	spin_lock_bh(lock);
+
+	new_tbl = rcu_dereference(tbl->future_tbl);
+	if (new_tbl) {
+		new_lock = rht_bucket_lock(new_tbl, hash);
+		spin_lock_nested(new_lock, SINGLE_DEPTH_NESTING);
+	}
+
+	if (rht_lookup_tbl(ht, tbl, key, hash) ||
+	    (new_tbl && rht_lookup_tbl(ht, new_tbl, key, hash))) {
+		err = -EEXIST;
+		goto out;
+	}
+
+	if (new_tbl)
+		tbl = new_tbl;
+
+	head = &tbl->buckets[rht_bucket(tbl, hash)];
+	RCU_INIT_POINTER(obj->next, rht_dereference_bucket(*head, tbl, hash));
+	rcu_assign_pointer(*head, obj);
+
+	atomic_inc(&ht->nelems);
+	if (rht_grow_above_75(ht, tbl))
+		schedule_work(&ht->run_work);
+
+out:
+	if (new_lock)
+		spin_unlock(new_lock);
+	spin_unlock_bh(lock);
+	rcu_read_unlock();
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(rhashtable_insert);
+
+static bool rht_remove_tbl(struct rhashtable *ht, struct bucket_table *tbl,
+			   struct rhash_head *obj, u32 hash)
+{
+	struct rhash_head __rcu **pprev = &tbl->buckets[rht_bucket(tbl, hash)];
+	struct rhash_head *he, *next;
+
+	for (; (he = rht_dereference_bucket(*pprev, tbl, hash));
+	     pprev = &he->next) {
+		if (he != obj)
+			continue;
+		/* @obj->next stays, for lookups still on it */
+		next = rht_dereference_bucket(obj->next, tbl, hash);
+		rcu_assign_pointer(*pprev, next);
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * rhashtable_remove - remove an object
+ * @ht: the hash table
+ * @obj: the struct rhash_head of the object
+ *
+ * Returns 0, or -ENOENT if @obj is not in the table.  Lookups may still
+ * find @obj until a grace period has passed, so it must be freed with
+ * kfree_rcu() or after synchronize_rcu().  May be called from softirq
+ * context.
+ */
+int rhashtable_remove(struct rhashtable *ht, struct rhash_head *obj)
+{
+	struct bucket_table *tbl, *new_tbl;
+	u32 hash = rht_key_hash(ht, rht_head_key(ht, obj));
+	spinlock_t *lock, *new_lock;
+	bool found;
+
+	rcu_read_lock();
+
+	tbl = rcu_dereference(ht->tbl);
+	lock = rht_bucket_lock(tbl, hash);
+	spin_lock_bh(lock);
+
+	/* the bucket lock keeps @obj from being moved meanwhile */
+	found = rht_remove_tbl(ht, tbl, obj, hash);
+
+	new_tbl = rcu_dereference(tbl->future_tbl);
+	if (!found && new_tbl) {
+		new_lock = rht_bucket_lock(new_tbl, hash);
+		spin_lock_nested(new_lock, SINGLE_DEPTH_NESTING);
+		found = rht_remove_tbl(ht, new_tbl, obj, hash);
+		spin_unlock(new_lock);
+	}
+
+	if (found) {
+		atomic_dec(&ht->nelems);
+		if (rht_shrink_below_30(ht, new_tbl ?: tbl))
+			schedule_work(&ht->run_work);
+	}
+
+	spin_unlock_bh(lock);
+	rcu_read_unlock();
+
+	return found ? 0 : -ENOENT;
+}
+EXPORT_SYMBOL_GPL(rhashtable_remove);
+
+/**
+ * rhashtable_init - initialize a hash table
+ * @ht: the hash table
+ * @params: its parameters, copied
+ *
+ * @params->key_len must be set.  The sizes in @params are rounded to
+ * powers of two.  Returns 0, -EINVAL or -ENOMEM.  Might sleep.
+ */
+int rhashtable_init(struct rhashtable *ht,
+		    const struct rhashtable_params *params)
+{
+	struct bucket_table *tbl;
+	unsigned int size;
+
+	if (!params->key_len)
+		return -EINVAL;
+
+	memset(ht, 0, sizeof(*ht));
+	mutex_init(&ht->mutex);
+	memcpy(&ht->p, params, sizeof(*params));
+
+	ht->p.min_size = max_t(unsigned int, RHT_MIN_SIZE,
+			       params->min_size ?
+			       roundup_pow_of_two(params->min_size) : 0);
+	if (params->max_size)
+		ht->p.max_size = max_t(unsigned int, ht->p.min_size,
+				       rounddown_pow_of_two(params->max_size));
+
+	size = ht->p.min_size;
+	if (params->nelem_hint)
+		size = max_t(unsigned int, size,
+			     roundup_pow_of_two(params->nelem_hint * 4 / 3));
+	if (ht->p.max_size)
+		size = min(size, ht->p.max_size);
+
+	tbl = bucket_table_alloc(size);
+	if (!tbl)
+		return -ENOMEM;
+
+	get_random_bytes(&ht->seed, sizeof(ht->seed));
+	atomic_set(&ht->nelems, 0);
+	RCU_INIT_POINTER(ht->tbl, tbl);
+	INIT_WORK(&ht->run_work, rht_deferred_worker);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(rhashtable_init);
+
+/**
+ * rhashtable_free_and_destroy - free the objects and the hash table
+ * @ht: the hash table
+ * @free_fn: called with each object left in the table, or NULL
+ * @arg: passed on to @free_fn
+ *
+ * The caller must make sure that the table is no longer used, nor
+ * objects that @free_fn frees looked up.  Might sleep.
+ */
+void rhashtable_free_and_destroy(struct rhashtable *ht,
+				 void (*free_fn)(void *obj, void *arg),
+				 void *arg)
+{
+	struct bucket_table *tbl;
+	struct rhash_head *he, *next;
+	unsigned int i;
+
+	mutex_lock(&ht->mutex);
+	ht->being_destroyed = true;
+	mutex_unlock(&ht->mutex);
+
+	cancel_work_sync(&ht->run_work);
+
+	mutex_lock(&ht->mutex);
+	tbl = rht_dereference(ht->tbl, ht);
+	for (i = 0; free_fn && i < tbl->size; i++) {
+		for (he = rht_dereference(tbl->buckets[i], ht); he; he = next) {
+			next = rht_dereference(he->next, ht);
+			free_fn(rht_obj(ht, he), arg);
+		}
+	}
+	bucket_table_free(tbl);
+	mutex_unlock(&ht->mutex);
+}
+EXPORT_SYMBOL_GPL(rhashtable_free_and_destroy);
+
+/**
+ * rhashtable_destroy - destroy a hash table
+ * @ht: the hash table
+ *
+ * Like rhashtable_free_and_destroy(), leaving the objects to the caller.
+ */
+void rhashtable_destroy(struct rhashtable *ht)
+{
+	rhashtable_free_and_destroy(ht, NULL, NULL);
+}
+EXPORT_SYMBOL_GPL(rhashtable_destroy);
@@ -0,0 +1,330 @@
+/*
+ * Scalable bitmap tag allocator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <linux/bitops.h>
+#include <linux/export.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/sbitmap.h>
+
+#define SB_NR_TO_INDEX(sb, nr)	((nr) >> (sb)->shift)
+#define SB_NR_TO_BIT(sb, nr)	((nr) & ((1U << (sb)->shift) - 1U))
+
+/*
+ * Find and set a free bit in @word, searching from @hint to the end of the
+ * word and then wrapping around to the beginning once.
+ */
+static int __sbitmap_get_word(unsigned long *word, unsigned long depth,
+			      unsigned int hint)
+{
+	bool wrapped = false;
+	int nr;
+
+	while (1) {
+		nr = find_next_zero_bit(word, depth, hint);
+		if (unlikely(nr >= depth)) {
+			if (wrapped || !hint)
+				return -1;
+			wrapped = true;
+			hint = 0;
+			continue;
+		}
+
+		if (!test_and_set_bit(nr, word))
+			return nr;
+
+		hint = nr + 1;
+	}
+}
+
+static int sbitmap_get(struct sbitmap *sb, unsigned int alloc_hint)
+{
+	unsigned int index, i;
+	int nr;
+
+	index = SB_NR_TO_INDEX(sb, alloc_hint);
+	for (i = 0; i < sb->map_nr; i++) {
+		nr = __sbitmap_get_word(&sb->map[index].word,
+					sb->map[index].depth,
+					SB_NR_TO_BIT(sb, alloc_hint));
+		if (nr != -1)
+			return nr + (index << sb->shift);
+
+		/* Jump to the start of the next word. */
+		if (++index >= sb->map_nr)
+			index = 0;
+		alloc_hint = index << sb->shift;
+	}
+
+	return -1;
+}
+
+unsigned int sbitmap_weight(const struct sbitmap *sb)
+{
+	unsigned int i, weight = 0;
+
+	for (i = 0; i < sb->map_nr; i++)
+		weight += hweight_long(ACCESS_ONCE(sb->map[i].word));
+
+	return weight;
+}
+EXPORT_SYMBOL_GPL(sbitmap_weight);
+
+/**
+ * sbitmap_for_each_free - iterate over the free bits of a bitmap
+ * @sb: bitmap to iterate over
+ * @fn: function to call for each free bit
+ * @data: private data passed to @fn
+ *
+ * The bitmap is not frozen while we walk it, so the result is only a
+ * snapshot.  If @fn returns nonzero the walk stops and that value is
+ * returned.
+ */
+int sbitmap_for_each_free(const struct sbitmap *sb, sbitmap_cb fn,
+			  void *data)
+{
+	unsigned int i, nr;
+	int err;
+
+	for (i = 0; i < sb->map_nr; i++) {
+		unsigned long word = ACCESS_ONCE(sb->map[i].word);
+
+		for_each_clear_bit(nr, &word, sb->map[i].depth) {
+			err = fn((i << sb->shift) + nr, data);
+			if (err)
+				return err;
+		}
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sbitmap_for_each_free);
+
+/**
+ * sbitmap_queue_init_node - initialize a bitmap tag allocator
+ * @sbq: allocator to initialize
+ * @depth: number of tags
+ * @node: memory node to allocate the bitmap on
+ *
+ * A depth of zero is allowed; such an allocator never hands out a tag.
+ */
+int sbitmap_queue_init_node(struct sbitmap_queue *sbq, unsigned int depth,
+			    int node)
+{
+	struct sbitmap *sb = &sbq->sb;
+	unsigned int bits_per_word, i;
+	int cpu;
+
+	/*
+	 * Spread small maps over at least four words, so that allocations
+	 * from different CPUs do not all hit the same cacheline.
+	 */
+	sb->shift = ilog2(BITS_PER_LONG);
+	if (depth >= 4) {
+		while ((4U << sb->shift) > depth)
+			sb->shift--;
+	}
+	bits_per_word = 1U << sb->shift;
+
+	sb->depth = depth;
+	sb->map_nr = DIV_ROUND_UP(depth, bits_per_word);
+	sb->map = kzalloc_node(sb->map_nr * sizeof(*sb->map), GFP_KERNEL, node);
+	if (!sb->map)
+		return -ENOMEM;
+
+	for (i = 0; i < sb->map_nr; i++) {
+		sb->map[i].depth = min(depth, bits_per_word);
+		depth -= sb->map[i].depth;
+	}
+
+	sbq->alloc_hint = alloc_percpu(unsigned int);
+	if (!sbq->alloc_hint)
+		goto err_free_map;
+
+	/* Start every CPU in a different place to avoid early collisions. */
+	if (sb->depth) {
+		for_each_possible_cpu(cpu)
+			*per_cpu_ptr(sbq->alloc_hint, cpu) =
+				prandom_u32_max(sb->depth);
+	}
+
+	/*
+	 * Freeing every tag must be able to wake every waitqueue, so never
+	 * batch more than depth / SBQ_WAIT_QUEUES wakeups.
+	 */
+	sbq->wake_batch = clamp_t(unsigned int, sb->depth / SBQ_WAIT_QUEUES,
+				  1, SBQ_WAKE_BATCH);
+	atomic_set(&sbq->wake_index, 0);
+	atomic_set(&sbq->wait_index, 0);
+
+	sbq->ws = kzalloc_node(SBQ_WAIT_QUEUES * sizeof(*sbq->ws), GFP_KERNEL,
+			       node);
+	if (!sbq->ws)
+		goto err_free_hint;
+
+	for (i = 0; i < SBQ_WAIT_QUEUES; i++) {
+		init_waitqueue_head(&sbq->ws[i].wait);
+		atomic_set(&sbq->ws[i].wait_cnt, sbq->wake_batch);
+	}
+
+	return 0;
+
+err_free_hint:
+	free_percpu(sbq->alloc_hint);
+err_free_map:
+	kfree(sb->map);
+	return -ENOMEM;
+}
+EXPORT_SYMBOL_GPL(sbitmap_queue_init_node);
+
+void sbitmap_queue_free(struct sbitmap_queue *sbq)
+{
+	kfree(sbq->ws);
+	free_percpu(sbq->alloc_hint);
+	kfree(sbq->sb.map);
+}
+EXPORT_SYMBOL_GPL(sbitmap_queue_free);
+
+/**
+ * __sbitmap_queue_get - try to allocate a tag without sleeping
+ * @sbq: allocator to allocate from
+ *
+ * Returns a tag, or -ENOSPC if none is free.
+ */
+int __sbitmap_queue_get(struct sbitmap_queue *sbq)
+{
+	unsigned int hint, depth = sbq->sb.depth;
+	int nr;
+
+	hint = this_cpu_read(*sbq->alloc_hint);
+	if (unlikely(hint >= depth))
+		hint = 0;
+
+	nr = sbitmap_get(&sbq->sb, hint);
+	if (nr == -1) {
+		this_cpu_write(*sbq->alloc_hint, 0);
+		return -ENOSPC;
+	}
+
+	/*
+	 * Only move the hint on when we got the tag it pointed at, so that
+	 * a CPU keeps allocating from the same word while tags are freed
+	 * back to it.
+	 */
+	if (nr == hint) {
+		hint = nr + 1;
+		if (hint >= depth)
+			hint = 0;
+		this_cpu_write(*sbq->alloc_hint, hint);
+	}
+
+	return nr;
+}
+EXPORT_SYMBOL_GPL(__sbitmap_queue_get);
+
+/**
+ * sbitmap_queue_get - allocate a tag
+ * @sbq: allocator to allocate from
+ * @state: task state to sleep in if no tag is free
+ *
+ * Like percpu_ida_alloc(): if @state is TASK_RUNNING this never sleeps and
+ * returns -ENOSPC when no tag is free.  Otherwise it sleeps until a tag is
+ * freed, and returns -ERESTARTSYS if @state allows a signal to interrupt
+ * the wait.
+ */
+int sbitmap_queue_get(struct sbitmap_queue *sbq, int state)
+{
+	struct sbq_wait_state *ws;
+	DEFINE_WAIT(wait);
+	int nr;
+
+	nr = __sbitmap_queue_get(sbq);
+	if (nr >= 0 || state == TASK_RUNNING)
+		return nr;
+
+	ws = &sbq->ws[atomic_inc_return(&sbq->wait_index) % SBQ_WAIT_QUEUES];
+	while (1) {
+		prepare_to_wait(&ws->wait, &wait, state);
+
+		nr = __sbitmap_queue_get(sbq);
+		if (nr >= 0)
+			break;
+
+		if (signal_pending_state(state, current)) {
+			nr = -ERESTARTSYS;
+			break;
+		}
+
+		schedule();
+	}
+	finish_wait(&ws->wait, &wait);
+
+	return nr;
+}
+EXPORT_SYMBOL_GPL(sbitmap_queue_get);
+
+static struct sbq_wait_state *sbq_wake_ptr(struct sbitmap_queue *sbq)
+{
+	int i, wake_index;
+
+	wake_index = atomic_read(&sbq->wake_index);
+	for (i = 0; i < SBQ_WAIT_QUEUES; i++) {
+		struct sbq_wait_state *ws = &sbq->ws[wake_index];
+
+		if (waitqueue_active(&ws->wait)) {
+			if (wake_index != atomic_read(&sbq->wake_index))
+				atomic_set(&sbq->wake_index, wake_index);
+			return ws;
+		}
+
+		wake_index = (wake_index + 1) % SBQ_WAIT_QUEUES;
+	}
+
+	return NULL;
+}
+
+/**
+ * sbitmap_queue_clear - free a tag
+ * @sbq: allocator the tag came from
+ * @nr: tag to free
+ *
+ * Waiters are woken a queue at a time, once every wake_batch frees.
+ */
+void sbitmap_queue_clear(struct sbitmap_queue *sbq, unsigned int nr)
+{
+	struct sbitmap *sb = &sbq->sb;
+	struct sbq_wait_state *ws;
+
+	BUG_ON(nr >= sb->depth);
+
+	clear_bit(SB_NR_TO_BIT(sb, nr), &sb->map[SB_NR_TO_INDEX(sb, nr)].word);
+
+	/* Pairs with the barrier in prepare_to_wait(). */
+	smp_mb__after_clear_bit();
+
+	ws = sbq_wake_ptr(sbq);
+	if (ws && atomic_dec_and_test(&ws->wait_cnt)) {
+		atomic_set(&ws->wait_cnt, sbq->wake_batch);
+		atomic_set(&sbq->wake_index,
+			   (atomic_read(&sbq->wake_index) + 1) %
+			   SBQ_WAIT_QUEUES);
+		wake_up(&ws->wait);
+	}
+}
+EXPORT_SYMBOL_GPL(sbitmap_queue_clear);
@@ -10,6 +10,9 @@
 #include <linux/module.h>
 #include <linux/writeback.h>
 #include <linux/device.h>
+#include <linux/cgroup.h>
+#include <linux/memcontrol.h>
+#include <linux/slab.h>
 #include <trace/events/writeback.h>
 
 static atomic_long_t bdi_seq = ATOMIC_LONG_INIT(0);
@@ -275,6 +278,13 @@ subsys_initcall(default_bdi_init);
 
 int bdi_has_dirty_io(struct backing_dev_info *bdi)
 {
+#ifdef CONFIG_CGROUP_WRITEBACK
+	struct bdi_writeback *wb;
+
+	list_for_each_entry_rcu(wb, &bdi->wb_list, bdi_node)
+		if (wb_has_dirty_io(wb))
+			return 1;
+#endif
 	return wb_has_dirty_io(&bdi->wb);
 }
 
@@ -292,17 +302,23 @@ int bdi_has_dirty_io(struct backing_dev_info *bdi)
  * We have to be careful not to postpone flush work if it is scheduled for
  * earlier. Thus we use queue_delayed_work().
  */
-void bdi_wakeup_thread_delayed(struct backing_dev_info *bdi)
+void wb_wakeup_delayed(struct bdi_writeback *wb)
 {
+	struct backing_dev_info *bdi = wb->bdi;
 	unsigned long timeout;
 
 	timeout = msecs_to_jiffies(dirty_writeback_interval * 10);
 	spin_lock_bh(&bdi->wb_lock);
 	if (test_bit(BDI_registered, &bdi->state))
-		queue_delayed_work(bdi_wq, &bdi->wb.dwork, timeout);
+		queue_delayed_work(bdi_wq, &wb->dwork, timeout);
 	spin_unlock_bh(&bdi->wb_lock);
 }
 
+void bdi_wakeup_thread_delayed(struct backing_dev_info *bdi)
+{
+	wb_wakeup_delayed(&bdi->wb);
+}
+
 /*
  * Remove bdi from bdi_list, and ensure that it is no longer visible
  */
@@ -383,6 +399,16 @@ static void bdi_wb_shutdown(struct backing_dev_info *bdi)
 	 * just in case.
 	 */
 	cancel_delayed_work_sync(&bdi->wb.dwork);
+
+#ifdef CONFIG_CGROUP_WRITEBACK
+	{
+		struct bdi_writeback *wb;
+
+		/* The cgroup wbs only ever do background writeback */
+		list_for_each_entry(wb, &bdi->wb_list, bdi_node)
+			cancel_delayed_work_sync(&wb->dwork);
+	}
+#endif
 }
 
 /*
@@ -434,6 +460,115 @@ static void bdi_wb_init(struct bdi_writeback *wb, struct backing_dev_info *bdi)
 	INIT_DELAYED_WORK(&wb->dwork, bdi_writeback_workfn);
 }
 
+#ifdef CONFIG_CGROUP_WRITEBACK
+/**
+ * wb_get_create - the wb of a bdi for the cgroups of current
+ * @bdi: the bdi being dirtied
+ *
+ * Returns the wb of @bdi for the memory and blkio cgroups of current,
+ * creating it on first use.  Tasks in the root cgroups get the root wb,
+ * and so do the others when it cannot be allocated: this is called when
+ * an inode is first dirtied, which may be in atomic context.
+ *
+ * A cgroup wb pins its cgroups, and lives as long as its bdi.
+ */
+struct bdi_writeback *wb_get_create(struct backing_dev_info *bdi)
+{
+	struct cgroup_subsys_state *memcg_css, *blkcg_css;
+	struct bdi_writeback *wb, *new;
+	unsigned long flags;
+
+	if (mem_cgroup_disabled() || !bdi_cap_writeback_dirty(bdi))
+		return &bdi->wb;
+
+	rcu_read_lock();
+	memcg_css = task_css(current, memory_cgrp_id);
+	blkcg_css = task_css(current, blkio_cgrp_id);
+	if (!memcg_css->parent && !blkcg_css->parent)
+		goto root;
+	list_for_each_entry_rcu(wb, &bdi->wb_list, bdi_node)
+		if (wb->memcg_css == memcg_css && wb->blkcg_css == blkcg_css)
+			goto found;
+	if (!css_tryget(memcg_css))
+		goto root;
+	if (!css_tryget(blkcg_css)) {
+		css_put(memcg_css);
+		goto root;
+	}
+	rcu_read_unlock();
+
+	new = kmalloc(sizeof(*new), GFP_ATOMIC);
+	if (!new) {
+		wb = &bdi->wb;
+		goto out_put;
+	}
+	bdi_wb_init(new, bdi);
+	new->memcg_css = memcg_css;
+	new->blkcg_css = blkcg_css;
+	atomic_long_set(&new->nr_dirty, 0);
+
+	spin_lock_irqsave(&bdi->wb_lock, flags);
+	list_for_each_entry(wb, &bdi->wb_list, bdi_node)
+		if (wb->memcg_css == memcg_css && wb->blkcg_css == blkcg_css)
+			break;
+	if (&wb->bdi_node == &bdi->wb_list) {
+		list_add_tail_rcu(&new->bdi_node, &bdi->wb_list);
+		spin_unlock_irqrestore(&bdi->wb_lock, flags);
+		return new;
+	}
+	spin_unlock_irqrestore(&bdi->wb_lock, flags);
+	kfree(new);
+out_put:
+	css_put(blkcg_css);
+	css_put(memcg_css);
+	return wb;
+
+root:
+	wb = &bdi->wb;
+found:
+	rcu_read_unlock();
+	return wb;
+}
+
+/*
+ * Free the cgroup wbs of a bdi going away, moving any inodes still on
+ * them to @dst as is done for the root wb.
+ */
+static void bdi_destroy_cgwbs(struct backing_dev_info *bdi,
+			      struct bdi_writeback *dst)
+{
+	struct bdi_writeback *wb, *next;
+	struct inode *inode;
+
+	list_for_each_entry_safe(wb, next, &bdi->wb_list, bdi_node) {
+		cancel_delayed_work_sync(&wb->dwork);
+		if (wb_has_dirty_io(wb)) {
+			bdi_lock_two(wb, dst);
+			list_for_each_entry(inode, &wb->b_dirty, i_wb_list)
+				inode->i_wb = dst;
+			list_for_each_entry(inode, &wb->b_io, i_wb_list)
+				inode->i_wb = dst;
+			list_for_each_entry(inode, &wb->b_more_io, i_wb_list)
+				inode->i_wb = dst;
+			list_splice(&wb->b_dirty, &dst->b_dirty);
+			list_splice(&wb->b_io, &dst->b_io);
+			list_splice(&wb->b_more_io, &dst->b_more_io);
+			spin_unlock(&wb->list_lock);
+			spin_unlock(&dst->list_lock);
+		}
+		list_del(&wb->bdi_node);
+		css_put(wb->blkcg_css);
+		css_put(wb->memcg_css);
+		kfree(wb);
+	}
+}
+#else
+static inline void bdi_destroy_cgwbs(struct backing_dev_info *bdi,
+				     struct bdi_writeback *dst)
+{
+}
+#endif
+
 /*
  * Initial write bandwidth: 100 MB/s
  */
@@ -451,6 +586,9 @@ int bdi_init(struct backing_dev_info *bdi)
 	spin_lock_init(&bdi->wb_lock);
 	INIT_LIST_HEAD(&bdi->bdi_list);
 	INIT_LIST_HEAD(&bdi->work_list);
+#ifdef CONFIG_CGROUP_WRITEBACK
+	INIT_LIST_HEAD(&bdi->wb_list);
+#endif
 
 	bdi_wb_init(&bdi->wb, bdi);
 
@@ -509,6 +647,7 @@ void bdi_destroy(struct backing_dev_info *bdi)
 	 * bdi_wakeup_thread_delayed() calls from __mark_inode_dirty().
 	 */
 	cancel_delayed_work_sync(&bdi->wb.dwork);
+	bdi_destroy_cgwbs(bdi, &default_backing_dev_info.wb);
 
 	for (i = 0; i < NR_BDI_STAT_ITEMS; i++)
 		percpu_counter_destroy(&bdi->bdi_stat[i]);
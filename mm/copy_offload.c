@@ -0,0 +1,121 @@
+/*
+ * mm/copy_offload.c
+ *
+ * Offload large kernel-internal page copies to memcpy capable DMA engine
+ * channels, so that moving megabytes between NUMA nodes does not have to
+ * burn CPU cycles in copy_page().
+ *
+ * Copies smaller than COPY_OFFLOAD_MIN_PAGES, or done while no channel is
+ * available, are left to the caller's CPU copy.
+ */
+#include <linux/mm.h>
+#include <linux/init.h>
+#include <linux/dmaengine.h>
+#include <linux/completion.h>
+
+/* Below this, mapping and waiting for the engine costs more than copying */
+#define COPY_OFFLOAD_MIN_PAGES	16
+
+static bool copy_offload_enabled __read_mostly = true;
+
+static int __init setup_no_page_copy_offload(char *str)
+{
+	copy_offload_enabled = false;
+	return 1;
+}
+__setup("no_page_copy_offload", setup_no_page_copy_offload);
+
+static void copy_offload_callback(void *arg)
+{
+	complete(arg);
+}
+
+/*
+ * Copy @len bytes between two physically contiguous page ranges with a
+ * single memcpy descriptor and sleep until the engine signals completion.
+ */
+static int copy_pages_dma(struct dma_chan *chan, struct page *to,
+			  struct page *from, size_t len)
+{
+	struct dma_device *dev = chan->device;
+	struct dma_async_tx_descriptor *tx;
+	struct dmaengine_unmap_data *unmap;
+	DECLARE_COMPLETION_ONSTACK(done);
+	dma_cookie_t cookie;
+	int ret = -ENOMEM;
+
+	if (!is_dma_copy_aligned(dev, 0, 0, len))
+		return -EINVAL;
+
+	unmap = dmaengine_get_unmap_data(dev->dev, 2, GFP_NOWAIT);
+	if (!unmap)
+		return -ENOMEM;
+
+	unmap->to_cnt = 1;
+	unmap->from_cnt = 1;
+	unmap->addr[0] = dma_map_page(dev->dev, from, 0, len, DMA_TO_DEVICE);
+	unmap->addr[1] = dma_map_page(dev->dev, to, 0, len, DMA_FROM_DEVICE);
+	unmap->len = len;
+
+	tx = dev->device_prep_dma_memcpy(chan, unmap->addr[1], unmap->addr[0],
+					 len, DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
+	if (!tx)
+		goto out;
+
+	dma_set_unmap(tx, unmap);
+	tx->callback = copy_offload_callback;
+	tx->callback_param = &done;
+	cookie = dmaengine_submit(tx);
+	if (dma_submit_error(cookie))
+		goto out;
+
+	dma_async_issue_pending(chan);
+	wait_for_completion(&done);
+
+	ret = 0;
+	if (dma_async_is_tx_complete(chan, cookie, NULL, NULL) != DMA_COMPLETE)
+		ret = -EIO;
+out:
+	dmaengine_unmap_put(unmap);
+	return ret;
+}
+
+/**
+ * copy_pages_offload - copy a range of pages with a DMA engine
+ * @to: first destination page
+ * @from: first source page
+ * @nr_pages: number of pages in each range
+ *
+ * Both ranges must be physically contiguous, as the pages of a compound
+ * page are.  The caller must be able to sleep.
+ *
+ * Returns true if the pages were copied, false if the caller has to
+ * copy them itself.
+ */
+bool copy_pages_offload(struct page *to, struct page *from,
+			unsigned int nr_pages)
+{
+	struct dma_chan *chan;
+
+	if (!copy_offload_enabled || nr_pages < COPY_OFFLOAD_MIN_PAGES)
+		return false;
+
+	/* The channel dmaengine balanced onto this cpu, if any */
+	chan = dma_find_channel(DMA_MEMCPY);
+	if (!chan)
+		return false;
+
+	return !copy_pages_dma(chan, to, from, (size_t)nr_pages << PAGE_SHIFT);
+}
+
+static int __init copy_offload_init(void)
+{
+	/*
+	 * Take a dmaengine client reference so that public memcpy
+	 * channels get allocated and show up in dma_find_channel().
+	 */
+	if (copy_offload_enabled)
+		dmaengine_get();
+	return 0;
+}
+late_initcall(copy_offload_init);
@@ -211,6 +211,7 @@ void __delete_from_page_cache(struct page *page, void *shadow)
 	if (PageDirty(page) && mapping_cap_account_dirty(mapping)) {
 		dec_zone_page_state(page, NR_FILE_DIRTY);
 		dec_bdi_stat(mapping->backing_dev_info, BDI_RECLAIMABLE);
+		wb_account_dirty(mapping, -1);
 	}
 }
 
@@ -520,7 +521,7 @@ static int page_cache_tree_insert(struct address_space *mapping,
 	void **slot;
 	int error;
 
-	error = __radix_tree_create(&mapping->page_tree, page->index,
+	error = __radix_tree_create(&mapping->page_tree, page->index, 0,
 				    &node, &slot);
 	if (error)
 		return error;
@@ -633,10 +634,9 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 		 * recently, in which case it should be activated like
 		 * any other repeatedly accessed page.
 		 */
-		if (shadow && workingset_refault(shadow)) {
+		if (shadow && workingset_refault(page, shadow))
 			SetPageActive(page);
-			workingset_activation(page);
-		} else
+		else
 			ClearPageActive(page);
 		lru_cache_add(page);
 	}
@@ -726,6 +726,41 @@ void add_page_wait_queue(struct page *page, wait_queue_t *waiter)
 }
 EXPORT_SYMBOL_GPL(add_page_wait_queue);
 
+/**
+ * wait_on_page_locked_async - queue a waiter for a page to be unlocked
+ * @page: the page, locked
+ * @wait: the waiter, with its wake function set
+ *
+ * Add @wait to the wait queue of @page, to be woken when the page is
+ * unlocked, instead of sleeping on it.  The queue is shared with other
+ * pages, so the wake function must check the key as wake_bit_function()
+ * does.
+ *
+ * Returns 0 if @wait was queued, or -EAGAIN if the page got unlocked
+ * first, in which case it was not.
+ */
+int wait_on_page_locked_async(struct page *page, struct wait_bit_queue *wait)
+{
+	wait_queue_head_t *q = page_waitqueue(page);
+	unsigned long flags;
+	int ret = 0;
+
+	wait->key.flags = &page->flags;
+	wait->key.bit_nr = PG_locked;
+
+	spin_lock_irqsave(&q->lock, flags);
+	__add_wait_queue(q, &wait->wait);
+	/* Pairs with the barrier in unlock_page() before it checks q */
+	smp_mb();
+	if (!PageLocked(page)) {
+		__remove_wait_queue(q, &wait->wait);
+		ret = -EAGAIN;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(wait_on_page_locked_async);
+
 /**
  * unlock_page - unlock a locked page
  * @page: the page
@@ -1433,21 +1468,63 @@ static void shrink_readahead_size_eio(struct file *filp,
 	ra->ra_pages /= 4;
 }
 
+/*
+ * Drop the pages of a batch looked up by find_get_read_page() which were
+ * not used, from @next on.
+ */
+static void release_read_batch(struct pagevec *pvec, unsigned int next)
+{
+	while (next < pagevec_count(pvec))
+		page_cache_release(pvec->pages[next++]);
+	pagevec_reinit(pvec);
+}
+
+/*
+ * Get the page at @index for do_generic_file_read(): from the batch of
+ * contiguous pages looked up last, or else by looking up a new batch of
+ * up to @nr_pages.  Looking the pages of a large read up together saves a
+ * walk of the radix tree, and an RCU read section, for each of them.
+ */
+static struct page *find_get_read_page(struct address_space *mapping,
+				       pgoff_t index, unsigned long nr_pages,
+				       struct pagevec *pvec, unsigned int *next)
+{
+	if (*next < pagevec_count(pvec) && pvec->pages[*next]->index == index)
+		return pvec->pages[(*next)++];
+
+	release_read_batch(pvec, *next);
+	*next = 0;
+	pvec->nr = find_get_pages_contig(mapping, index,
+			clamp_t(unsigned long, nr_pages, 1, PAGEVEC_SIZE),
+			pvec->pages);
+	if (!pagevec_count(pvec))
+		return NULL;
+	return pvec->pages[(*next)++];
+}
+
 /**
  * do_generic_file_read - generic file read routine
  * @filp:	the file to read
  * @ppos:	current file position
  * @iter:	data destination
  * @written:	already copied
+ * @wait:	if set, do not wait for pages to be read in
  *
  * This is a generic file read routine, and uses the
  * mapping->a_ops->readpage() function for the actual low-level stuff.
  *
+ * When @wait is given, the read stops at the first page which it would
+ * have to wait for: what was read so far is returned, or, if nothing was,
+ * @wait is queued on the page and -EIOCBRETRY returned, for the caller to
+ * do the read again when the page gets unlocked.  Readahead and ->readpage
+ * are still started as usual, so the I/O is under way meanwhile.
+ *
  * This is really ugly. But the goto's actually try to clarify some
  * of the logic when it comes to error handling etc.
  */
 static ssize_t do_generic_file_read(struct file *filp, loff_t *ppos,
-		struct iov_iter *iter, ssize_t written)
+		struct iov_iter *iter, ssize_t written,
+		struct wait_bit_queue *wait)
 {
 	struct address_space *mapping = filp->f_mapping;
 	struct inode *inode = mapping->host;
@@ -1457,8 +1534,11 @@ static ssize_t do_generic_file_read(struct file *filp, loff_t *ppos,
 	pgoff_t prev_index;
 	unsigned long offset;      /* offset into pagecache page */
 	unsigned int prev_offset;
+	struct pagevec pvec;
+	unsigned int next = 0;
 	int error = 0;
 
+	pagevec_init(&pvec, 0);
 	index = *ppos >> PAGE_CACHE_SHIFT;
 	prev_index = ra->prev_pos >> PAGE_CACHE_SHIFT;
 	prev_offset = ra->prev_pos & (PAGE_CACHE_SIZE-1);
@@ -1473,12 +1553,15 @@ static ssize_t do_generic_file_read(struct file *filp, loff_t *ppos,
 
 		cond_resched();
 find_page:
-		page = find_get_page(mapping, index);
+		page = find_get_read_page(mapping, index, last_index - index,
+					  &pvec, &next);
 		if (!page) {
 			page_cache_sync_readahead(mapping,
 					ra, filp,
 					index, last_index - index);
-			page = find_get_page(mapping, index);
+			page = find_get_read_page(mapping, index,
+						  last_index - index,
+						  &pvec, &next);
 			if (unlikely(page == NULL))
 				goto no_cached_page;
 		}
@@ -1567,9 +1650,14 @@ page_ok:
 
 page_not_up_to_date:
 		/* Get exclusive access to the page ... */
-		error = lock_page_killable(page);
-		if (unlikely(error))
-			goto readpage_error;
+		if (wait) {
+			if (!trylock_page(page))
+				goto would_block;
+		} else {
+			error = lock_page_killable(page);
+			if (unlikely(error))
+				goto readpage_error;
+		}
 
 page_not_up_to_date_locked:
 		/* Did it get truncated before we got the lock? */
@@ -1585,6 +1673,13 @@ page_not_up_to_date_locked:
 			goto page_ok;
 		}
 
+		/*
+		 * Reading it failed before: wait for this retry, so that a
+		 * bad block does not keep a read being queued forever.
+		 */
+		if (PageError(page))
+			wait = NULL;
+
 readpage:
 		/*
 		 * A previous I/O error may have been due to temporary
@@ -1605,6 +1700,8 @@ readpage:
 		}
 
 		if (!PageUptodate(page)) {
+			if (wait)
+				goto would_block;
 			error = lock_page_killable(page);
 			if (unlikely(error))
 				goto readpage_error;
@@ -1632,6 +1729,21 @@ readpage_error:
 		page_cache_release(page);
 		goto out;
 
+would_block:
+		/*
+		 * The page is locked for I/O.  Return what has been read, or
+		 * else have the caller retry once the page is unlocked.
+		 */
+		if (!written) {
+			if (wait_on_page_locked_async(page, wait)) {
+				page_cache_release(page);
+				goto find_page;
+			}
+			error = -EIOCBRETRY;
+		}
+		page_cache_release(page);
+		goto out;
+
 no_cached_page:
 		/*
 		 * Ok, it wasn't cached, so we need to create a new
@@ -1656,6 +1768,7 @@ no_cached_page:
 	}
 
 out:
+	release_read_batch(&pvec, next);
 	ra->prev_pos = prev_index;
 	ra->prev_pos <<= PAGE_CACHE_SHIFT;
 	ra->prev_pos |= prev_offset;
@@ -1731,7 +1844,7 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 	iov_iter_init(&i, iov, nr_segs, count, 0);
 
 	/* coalesce the iovecs and go direct-to-BIO for O_DIRECT */
-	if (filp->f_flags & O_DIRECT) {
+	if (io_is_direct(filp)) {
 		loff_t size;
 		struct address_space *mapping;
 		struct inode *inode;
@@ -1763,15 +1876,16 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 		 * we've already read everything we wanted to, or if
 		 * there was a short read because we hit EOF, go ahead
 		 * and return.  Otherwise fallthrough to buffered io for
-		 * the rest of the read.
+		 * the rest of the read.  DAX has no buffered io to fall
+		 * back to, a short read there is final.
 		 */
-		if (retval < 0 || !count || *ppos >= size) {
+		if (retval < 0 || !count || *ppos >= size || IS_DAX(inode)) {
 			file_accessed(filp);
 			goto out;
 		}
 	}
 
-	retval = do_generic_file_read(filp, ppos, &i, retval);
+	retval = do_generic_file_read(filp, ppos, &i, retval, iocb->ki_waitq);
 out:
 	return retval;
 }
@@ -2644,12 +2758,19 @@ ssize_t __generic_file_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	iov_iter_init(&from, iov, nr_segs, count, 0);
 
 	/* coalesce the iovecs and go direct-to-BIO for O_DIRECT */
-	if (unlikely(file->f_flags & O_DIRECT)) {
+	if (unlikely(io_is_direct(file))) {
 		loff_t endbyte;
 
 		written = generic_file_direct_write(iocb, iov, &from.nr_segs, pos,
 							count, ocount);
-		if (written < 0 || written == count)
+		/*
+		 * If the write stopped short of completing, fall back to
+		 * buffered writes.  Some filesystems do this for writes to
+		 * holes, for example.  For DAX files, a buffered write will
+		 * not succeed (even if it did, DAX does not handle dirty
+		 * page-cache pages correctly).
+		 */
+		if (written < 0 || written == count || IS_DAX(mapping->host))
 			goto out;
 		iov_iter_advance(&from, written);
 
@@ -76,6 +76,13 @@ static int install_file_pte(struct mm_struct *mm, struct vm_area_struct *vma,
 	pte_t *pte, ptfile;
 	spinlock_t *ptl;
 
+	if (vma_huge_team(vma)) {
+		pmd_t *pmd = mm_find_pmd(mm, addr);
+
+		if (pmd)
+			split_huge_page_pmd(vma, addr, pmd);
+	}
+
 	pte = get_locked_pte(mm, addr, &ptl);
 	if (!pte)
 		goto out;
@@ -239,7 +246,9 @@ get_write_lock:
 		}
 		mutex_lock(&mapping->i_mmap_mutex);
 		flush_dcache_mmap_lock(mapping);
+		vm_write_begin(vma);
 		vma->vm_flags |= VM_NONLINEAR;
+		vm_write_end(vma);
 		vma_interval_tree_remove(vma, &mapping->i_mmap);
 		vma_nonlinear_insert(vma, &mapping->i_mmap_nonlinear);
 		flush_dcache_mmap_unlock(mapping);
@@ -21,6 +21,9 @@
 #include <linux/pagemap.h>
 #include <linux/migrate.h>
 #include <linux/hashtable.h>
+#include <linux/shmem_fs.h>
+#include <linux/file.h>
+#include <linux/userfaultfd_k.h>
 
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
@@ -405,6 +408,9 @@ static struct attribute *hugepage_attr[] = {
 	&enabled_attr.attr,
 	&defrag_attr.attr,
 	&use_zero_page_attr.attr,
+#ifdef CONFIG_SHMEM
+	&shmem_enabled_attr.attr,
+#endif
 #ifdef CONFIG_DEBUG_VM
 	&debug_cow_attr.attr,
 #endif
@@ -792,6 +798,9 @@ int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 
 	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
 		return VM_FAULT_FALLBACK;
+	/* missing pages are reported, and filled in, a pte at a time */
+	if (userfaultfd_missing(vma))
+		return VM_FAULT_FALLBACK;
 	if (unlikely(anon_vma_prepare(vma)))
 		return VM_FAULT_OOM;
 	if (unlikely(khugepaged_enter(vma)))
@@ -843,6 +852,55 @@ int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	return 0;
 }
 
+/**
+ * vmf_insert_pfn_pmd - map a PMD_SIZE run of pfns into a VM_MIXEDMAP vma
+ * @vma: user vma to map into
+ * @addr: PMD aligned user address
+ * @pmd: pmd to fill
+ * @pfn: first pfn, PMD aligned
+ * @write: whether the mapping is to be writable
+ *
+ * Like vm_insert_mixed(), nothing is counted against the pfns; a page
+ * table is deposited so that the pmd can be split into special ptes.
+ * Returns VM_FAULT_NOPAGE, also when another thread won the race.
+ */
+int vmf_insert_pfn_pmd(struct vm_area_struct *vma, unsigned long addr,
+			pmd_t *pmd, unsigned long pfn, bool write)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pgprot_t pgprot = vma->vm_page_prot;
+	pgtable_t pgtable;
+	spinlock_t *ptl;
+	pmd_t entry;
+
+	BUG_ON(!(vma->vm_flags & VM_MIXEDMAP));
+	BUG_ON((addr & ~HPAGE_PMD_MASK) || (pfn & (HPAGE_PMD_NR - 1)));
+	if (addr < vma->vm_start || addr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_SIGBUS;
+	if (track_pfn_insert(vma, &pgprot, pfn))
+		return VM_FAULT_SIGBUS;
+
+	pgtable = pte_alloc_one(mm, addr);
+	if (unlikely(!pgtable))
+		return VM_FAULT_OOM;
+
+	ptl = pmd_lock(mm, pmd);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(ptl);
+		pte_free(mm, pgtable);
+		return VM_FAULT_NOPAGE;
+	}
+	entry = pmd_mkhuge(pfn_pmd(pfn, pgprot));
+	if (write)
+		entry = maybe_pmd_mkwrite(pmd_mkyoung(pmd_mkdirty(entry)), vma);
+	pgtable_trans_huge_deposit(mm, pmd, pgtable);
+	set_pmd_at(mm, addr, pmd, entry);
+	update_mmu_cache_pmd(vma, addr, pmd);
+	atomic_long_inc(&mm->nr_ptes);
+	spin_unlock(ptl);
+	return VM_FAULT_NOPAGE;
+}
+
 int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		  pmd_t *dst_pmd, pmd_t *src_pmd, unsigned long addr,
 		  struct vm_area_struct *vma)
@@ -1183,7 +1241,7 @@ struct page *follow_trans_huge_pmd(struct vm_area_struct *vma,
 		goto out;
 
 	page = pmd_page(*pmd);
-	VM_BUG_ON_PAGE(!PageHead(page), page);
+	VM_BUG_ON_PAGE(!PageHead(page) && !vma_huge_team(vma), page);
 	if (flags & FOLL_TOUCH) {
 		pmd_t _pmd;
 		/*
@@ -1199,6 +1257,13 @@ struct page *follow_trans_huge_pmd(struct vm_area_struct *vma,
 					  pmd, _pmd,  1))
 			update_mmu_cache_pmd(vma, addr, pmd);
 	}
+	if (vma_huge_team(vma)) {
+		/* follow_page_mask() split the team for FOLL_MLOCK */
+		page += (addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
+		if (flags & FOLL_GET)
+			get_page(page);
+		goto out;
+	}
 	if ((flags & FOLL_MLOCK) && (vma->vm_flags & VM_LOCKED)) {
 		if (page->mapping && trylock_page(page)) {
 			lru_add_drain();
@@ -1363,6 +1428,26 @@ int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
 			atomic_long_dec(&tlb->mm->nr_ptes);
 			spin_unlock(ptl);
 			put_huge_zero_page();
+		} else if (vma_huge_dax(vma)) {
+			/* no page behind the pfns is referenced or mapped */
+			atomic_long_dec(&tlb->mm->nr_ptes);
+			spin_unlock(ptl);
+		} else if (vma_huge_team(vma)) {
+			int i;
+
+			/* dirtied when mapped, see shmem_pmd_fault() */
+			page = pmd_page(orig_pmd);
+			for (i = 0; i < HPAGE_PMD_NR; i++) {
+				if (pmd_young(orig_pmd) &&
+				    likely(!(vma->vm_flags & VM_SEQ_READ)))
+					mark_page_accessed(page + i);
+				page_remove_rmap(page + i);
+			}
+			add_mm_counter(tlb->mm, MM_FILEPAGES, -HPAGE_PMD_NR);
+			atomic_long_dec(&tlb->mm->nr_ptes);
+			spin_unlock(ptl);
+			for (i = 0; i < HPAGE_PMD_NR; i++)
+				tlb_remove_page(tlb, page + i);
 		} else {
 			page = pmd_page(orig_pmd);
 			page_remove_rmap(page);
@@ -1474,18 +1559,21 @@ int change_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
 			entry = pmd_modify(entry, newprot);
 			ret = HPAGE_PMD_NR;
 			set_pmd_at(mm, addr, pmd, entry);
-			BUG_ON(pmd_write(entry));
-		} else {
+			BUG_ON(pmd_write(entry) && !vma_huge_team(vma) &&
+			       !vma_huge_dax(vma));
+		} else if (!vma_huge_dax(vma)) {
 			struct page *page = pmd_page(*pmd);
 
 			/*
 			 * Do not trap faults against the zero page. The
 			 * read-only data is likely to be read-cached on the
 			 * local CPU cache and it is less useful to know about
-			 * local vs remote hits on the zero page.
+			 * local vs remote hits on the zero page.  Nor against
+			 * a team of shmem pages, there is no huge page to
+			 * migrate.
 			 */
 			if (!is_huge_zero_page(page) &&
-			    !pmd_numa(*pmd)) {
+			    !vma_huge_team(vma) && !pmd_numa(*pmd)) {
 				pmdp_set_numa(mm, addr, pmd);
 				ret = HPAGE_PMD_NR;
 			}
@@ -1909,6 +1997,16 @@ int hugepage_madvise(struct vm_area_struct *vma,
 		if (mm_has_pgste(vma->vm_mm))
 			return 0;
 #endif
+		if (vma_huge_team(vma) && (*vm_flags & VM_SHARED)) {
+			/* for tmpfs huge=advise */
+			if (*vm_flags & VM_HUGEPAGE)
+				return -EINVAL;
+			*vm_flags &= ~VM_NOHUGEPAGE;
+			*vm_flags |= VM_HUGEPAGE;
+			if (unlikely(khugepaged_enter_team(vma)))
+				return -ENOMEM;
+			break;
+		}
 		/*
 		 * Be somewhat over-protective like KSM for now!
 		 */
@@ -1925,6 +2023,13 @@ int hugepage_madvise(struct vm_area_struct *vma,
 			return -ENOMEM;
 		break;
 	case MADV_NOHUGEPAGE:
+		if (vma_huge_team(vma) && (*vm_flags & VM_SHARED)) {
+			if (*vm_flags & VM_NOHUGEPAGE)
+				return -EINVAL;
+			*vm_flags &= ~VM_HUGEPAGE;
+			*vm_flags |= VM_NOHUGEPAGE;
+			break;
+		}
 		/*
 		 * Be somewhat over-protective like KSM for now!
 		 */
@@ -2102,7 +2207,8 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 	     _pte++, address += PAGE_SIZE) {
 		pte_t pteval = *_pte;
 		if (pte_none(pteval)) {
-			if (++none <= khugepaged_max_ptes_none)
+			if (!userfaultfd_armed(vma) &&
+			    ++none <= khugepaged_max_ptes_none)
 				continue;
 			else
 				goto out;
@@ -2115,7 +2221,10 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 
 		VM_BUG_ON_PAGE(PageCompound(page), page);
 		VM_BUG_ON_PAGE(!PageAnon(page), page);
-		VM_BUG_ON_PAGE(!PageSwapBacked(page), page);
+
+		/* don't bring back memory given up with MADV_FREE */
+		if (!PageSwapBacked(page))
+			goto out;
 
 		/* cannot use mapcount: can't collapse if there's a gup pin */
 		if (page_count(page) != 1)
@@ -2390,7 +2499,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 	pmd = mm_find_pmd(mm, address);
 	if (!pmd)
 		goto out;
-	if (pmd_trans_huge(*pmd))
+	if (pmd_trans_huge(*pmd) || pmd_shared(*pmd))
 		goto out;
 
 	anon_vma_lock_write(vma->anon_vma);
@@ -2490,7 +2599,8 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	pmd = mm_find_pmd(mm, address);
 	if (!pmd)
 		goto out;
-	if (pmd_trans_huge(*pmd))
+	/* a table shared on fork is not collapsed until unshared */
+	if (pmd_trans_huge(*pmd) || pmd_shared(*pmd))
 		goto out;
 
 	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
@@ -2499,7 +2609,8 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	     _pte++, _address += PAGE_SIZE) {
 		pte_t pteval = *_pte;
 		if (pte_none(pteval)) {
-			if (++none <= khugepaged_max_ptes_none)
+			if (!userfaultfd_armed(vma) &&
+			    ++none <= khugepaged_max_ptes_none)
 				continue;
 			else
 				goto out_unmap;
@@ -2596,13 +2707,15 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 	progress++;
 	for (; vma; vma = vma->vm_next) {
 		unsigned long hstart, hend;
+		bool team;
 
 		cond_resched();
 		if (unlikely(khugepaged_test_exit(mm))) {
 			progress++;
 			break;
 		}
-		if (!hugepage_vma_check(vma)) {
+		team = vma_huge_team(vma) && (vma->vm_flags & VM_SHARED);
+		if (!team && !hugepage_vma_check(vma)) {
 skip:
 			progress++;
 			continue;
@@ -2626,6 +2739,29 @@ skip:
 			VM_BUG_ON(khugepaged_scan.address < hstart ||
 				  khugepaged_scan.address + HPAGE_PMD_SIZE >
 				  hend);
+			if (team) {
+				struct file *file;
+				pgoff_t pgoff;
+
+				pgoff = linear_page_index(vma,
+						khugepaged_scan.address);
+				khugepaged_scan.address += HPAGE_PMD_SIZE;
+				progress += HPAGE_PMD_NR;
+				if (shmem_huge_collapsible(vma, pgoff)) {
+					/* collapsing shmem needs no mmap_sem */
+					file = get_file(vma->vm_file);
+					up_read(&mm->mmap_sem);
+					ret = shmem_collapse_team(
+							file->f_mapping, pgoff);
+					if (!ret)
+						khugepaged_pages_collapsed++;
+					fput(file);
+					goto breakouterloop_mmap_sem;
+				}
+				if (progress >= pages)
+					goto breakouterloop;
+				continue;
+			}
 			ret = khugepaged_scan_pmd(mm, vma,
 						  khugepaged_scan.address,
 						  hpage);
@@ -2784,6 +2920,70 @@ static void __split_huge_zero_page_pmd(struct vm_area_struct *vma,
 	put_huge_zero_page();
 }
 
+static void __split_huge_team_pmd(struct vm_area_struct *vma,
+		unsigned long haddr, pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *page = pmd_page(*pmd);
+	pgtable_t pgtable;
+	pmd_t _pmd, old_pmd;
+	int i;
+
+	old_pmd = pmdp_clear_flush(vma, haddr, pmd);
+	/* leave pmd empty until pte is filled */
+
+	pgtable = pgtable_trans_huge_withdraw(mm, pmd);
+	pmd_populate(mm, &_pmd, pgtable);
+
+	/* each page already holds its own reference and mapcount */
+	for (i = 0; i < HPAGE_PMD_NR; i++, haddr += PAGE_SIZE) {
+		pte_t *pte, entry;
+		entry = mk_pte(page + i, vma->vm_page_prot);
+		if (!pmd_write(old_pmd))
+			entry = pte_wrprotect(entry);
+		if (!pmd_young(old_pmd))
+			entry = pte_mkold(entry);
+		pte = pte_offset_map(&_pmd, haddr);
+		VM_BUG_ON(!pte_none(*pte));
+		set_pte_at(mm, haddr, pte, entry);
+		pte_unmap(pte);
+	}
+	smp_wmb(); /* make pte visible before pmd */
+	pmd_populate(mm, pmd, pgtable);
+}
+
+static void __split_huge_dax_pmd(struct vm_area_struct *vma,
+		unsigned long haddr, pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long pfn = pmd_pfn(*pmd);
+	pgtable_t pgtable;
+	pmd_t _pmd, old_pmd;
+	int i;
+
+	old_pmd = pmdp_clear_flush(vma, haddr, pmd);
+	/* leave pmd empty until pte is filled */
+
+	pgtable = pgtable_trans_huge_withdraw(mm, pmd);
+	pmd_populate(mm, &_pmd, pgtable);
+
+	/* special ptes, as vm_insert_mixed() would have made them */
+	for (i = 0; i < HPAGE_PMD_NR; i++, haddr += PAGE_SIZE) {
+		pte_t *pte, entry;
+		entry = pte_mkspecial(pfn_pte(pfn + i, vma->vm_page_prot));
+		if (!pmd_write(old_pmd))
+			entry = pte_wrprotect(entry);
+		if (!pmd_young(old_pmd))
+			entry = pte_mkold(entry);
+		pte = pte_offset_map(&_pmd, haddr);
+		VM_BUG_ON(!pte_none(*pte));
+		set_pte_at(mm, haddr, pte, entry);
+		pte_unmap(pte);
+	}
+	smp_wmb(); /* make pte visible before pmd */
+	pmd_populate(mm, pmd, pgtable);
+}
+
 void __split_huge_page_pmd(struct vm_area_struct *vma, unsigned long address,
 		pmd_t *pmd)
 {
@@ -2812,6 +3012,18 @@ again:
 		mmu_notifier_invalidate_range_end(mm, mmun_start, mmun_end);
 		return;
 	}
+	if (vma_huge_team(vma)) {
+		__split_huge_team_pmd(vma, haddr, pmd);
+		spin_unlock(ptl);
+		mmu_notifier_invalidate_range_end(mm, mmun_start, mmun_end);
+		return;
+	}
+	if (vma_huge_dax(vma)) {
+		__split_huge_dax_pmd(vma, haddr, pmd);
+		spin_unlock(ptl);
+		mmu_notifier_invalidate_range_end(mm, mmun_start, mmun_end);
+		return;
+	}
 	page = pmd_page(*pmd);
 	VM_BUG_ON_PAGE(!page_count(page), page);
 	get_page(page);
@@ -90,20 +90,31 @@
  *
  * If the merge_across_nodes tunable is unset, then KSM maintains multiple
  * stable trees and multiple unstable trees: one of each for each NUMA node.
+ * That is the default, so that merging does not leave tasks mapping ksm pages
+ * on a remote node.
+ *
+ * The scanning is shared out between ksm_workers, one ksmd thread for each
+ * NUMA node with memory.  Each worker scans its own list of mm_slots, and
+ * keeps its own unstable trees: an mm is handed to the worker of the node on
+ * which it first asked for merging, a forked mm to the worker of its parent,
+ * so that pages shared by fork are not scanned by two workers at once.  The
+ * stable trees are shared by all the workers, under ksm_stable_mutex.
  */
 
 /**
  * struct mm_slot - ksm information per mm that is being scanned
  * @link: link to the mm_slots hash list
- * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
+ * @mm_list: link into the mm_slots list, rooted in its worker's mm_head
  * @rmap_list: head for this mm_slot's singly-linked list of rmap_items
  * @mm: the mm that this information is valid for
+ * @worker: the ksm_worker scanning this mm
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct rmap_item *rmap_list;
 	struct mm_struct *mm;
+	struct ksm_worker *worker;
 };
 
 /**
@@ -113,7 +124,7 @@ struct mm_slot {
  * @rmap_list: link to the next rmap to be scanned in the rmap_list
  * @seqnr: count of completed full scans (needed when removing unstable node)
  *
- * There is only the one ksm_scan instance of this cursor structure.
+ * There is one ksm_scan instance of this cursor structure in each ksm_worker.
  */
 struct ksm_scan {
 	struct mm_slot *mm_slot;
@@ -122,6 +133,28 @@ struct ksm_scan {
 	unsigned long seqnr;
 };
 
+/**
+ * struct ksm_worker - a ksmd thread and the mm_slots it scans
+ * @list: link into the list of all workers, rooted in ksm_workers
+ * @mm_head: head of this worker's list of mm_slots
+ * @scan: this worker's cursor into that list
+ * @unstable_tree: this worker's unstable tree heads, one per NUMA node
+ * @pages_unshared: the number of nodes in those unstable trees
+ * @wait: where the thread waits for something to scan
+ * @thread: the ksmd thread itself
+ * @nid: the NUMA node whose cpus the thread runs on
+ */
+struct ksm_worker {
+	struct list_head list;
+	struct mm_slot mm_head;
+	struct ksm_scan scan;
+	struct rb_root *unstable_tree;
+	unsigned long pages_unshared;
+	wait_queue_head_t wait;
+	struct task_struct *thread;
+	int nid;
+};
+
 /**
  * struct stable_node - node of the stable rbtree
  * @node: rb node of this ksm page in the stable tree
@@ -182,11 +215,8 @@ struct rmap_item {
 #define UNSTABLE_FLAG	0x100	/* is a node of the unstable tree */
 #define STABLE_FLAG	0x200	/* is listed from the stable tree */
 
-/* The stable and unstable tree heads */
-static struct rb_root one_stable_tree[1] = { RB_ROOT };
-static struct rb_root one_unstable_tree[1] = { RB_ROOT };
-static struct rb_root *root_stable_tree = one_stable_tree;
-static struct rb_root *root_unstable_tree = one_unstable_tree;
+/* The stable tree heads: the unstable ones are private to each worker */
+static struct rb_root *root_stable_tree;
 
 /* Recently migrated nodes of stable tree, pending proper placement */
 static LIST_HEAD(migrate_nodes);
@@ -194,12 +224,9 @@ static LIST_HEAD(migrate_nodes);
 #define MM_SLOTS_HASH_BITS 10
 static DEFINE_HASHTABLE(mm_slots_hash, MM_SLOTS_HASH_BITS);
 
-static struct mm_slot ksm_mm_head = {
-	.mm_list = LIST_HEAD_INIT(ksm_mm_head.mm_list),
-};
-static struct ksm_scan ksm_scan = {
-	.mm_slot = &ksm_mm_head,
-};
+/* All the workers, and the worker that each node's new mms are handed to */
+static LIST_HEAD(ksm_workers);
+static struct ksm_worker **node_ksm_worker;
 
 static struct kmem_cache *rmap_item_cache;
 static struct kmem_cache *stable_node_cache;
@@ -211,22 +238,19 @@ static unsigned long ksm_pages_shared;
 /* The number of page slots additionally sharing those nodes */
 static unsigned long ksm_pages_sharing;
 
-/* The number of nodes in the unstable tree */
-static unsigned long ksm_pages_unshared;
-
 /* The number of rmap_items in use: to calculate pages_volatile */
-static unsigned long ksm_rmap_items;
+static atomic_long_t ksm_rmap_items = ATOMIC_LONG_INIT(0);
 
-/* Number of pages ksmd should scan in one batch */
+/* Number of pages each ksmd should scan in one batch */
 static unsigned int ksm_thread_pages_to_scan = 100;
 
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
 #ifdef CONFIG_NUMA
-/* Zeroed when merging across nodes is not allowed */
-static unsigned int ksm_merge_across_nodes = 1;
-static int ksm_nr_node_ids = 1;
+/* Set when merging across nodes is allowed */
+static unsigned int ksm_merge_across_nodes;
+static int ksm_nr_node_ids;		/* set to nr_node_ids by ksm_init */
 #else
 #define ksm_merge_across_nodes	1U
 #define ksm_nr_node_ids		1
@@ -237,10 +261,15 @@ static int ksm_nr_node_ids = 1;
 #define KSM_RUN_UNMERGE	2
 #define KSM_RUN_OFFLINE	4
 static unsigned long ksm_run = KSM_RUN_STOP;
-static void wait_while_offlining(void);
 
-static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
-static DEFINE_MUTEX(ksm_thread_mutex);
+/*
+ * ksm_thread_sem is held for read by each ksmd while it scans a batch of
+ * pages, and for write by the sysfs knobs and memory hotremove, which must
+ * keep all of them out.  ksm_stable_mutex serializes the ksmds on the stable
+ * trees, the stable_nodes and their hlists of rmap_items, and migrate_nodes.
+ */
+static DECLARE_RWSEM(ksm_thread_sem);
+static DEFINE_MUTEX(ksm_stable_mutex);
 static DEFINE_SPINLOCK(ksm_mmlist_lock);
 
 #define KSM_KMEM_CACHE(__struct, __flags) kmem_cache_create("ksm_"#__struct,\
@@ -285,13 +314,13 @@ static inline struct rmap_item *alloc_rmap_item(void)
 
 	rmap_item = kmem_cache_zalloc(rmap_item_cache, GFP_KERNEL);
 	if (rmap_item)
-		ksm_rmap_items++;
+		atomic_long_inc(&ksm_rmap_items);
 	return rmap_item;
 }
 
 static inline void free_rmap_item(struct rmap_item *rmap_item)
 {
-	ksm_rmap_items--;
+	atomic_long_dec(&ksm_rmap_items);
 	rmap_item->mm = NULL;	/* debug safety */
 	kmem_cache_free(rmap_item_cache, rmap_item);
 }
@@ -610,16 +639,25 @@ stale:
  * Removing rmap_item from stable or unstable tree.
  * This function will clean the information from the stable/unstable tree.
  */
-static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
+static void remove_rmap_item_from_tree(struct ksm_worker *worker,
+				       struct rmap_item *rmap_item)
 {
 	if (rmap_item->address & STABLE_FLAG) {
 		struct stable_node *stable_node;
 		struct page *page;
 
+		mutex_lock(&ksm_stable_mutex);
+		/*
+		 * Another ksmd may have found the stable_node stale and
+		 * removed it, clearing our STABLE_FLAG, since we looked.
+		 */
+		if (!(rmap_item->address & STABLE_FLAG))
+			goto unlock;
+
 		stable_node = rmap_item->head;
 		page = get_ksm_page(stable_node, true);
 		if (!page)
-			goto out;
+			goto unlock;
 
 		hlist_del(&rmap_item->hlist);
 		unlock_page(page);
@@ -632,25 +670,26 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 
 		put_anon_vma(rmap_item->anon_vma);
 		rmap_item->address &= PAGE_MASK;
+unlock:
+		mutex_unlock(&ksm_stable_mutex);
 
 	} else if (rmap_item->address & UNSTABLE_FLAG) {
 		unsigned char age;
 		/*
 		 * Usually ksmd can and must skip the rb_erase, because
-		 * root_unstable_tree was already reset to RB_ROOT.
+		 * its unstable_tree was already reset to RB_ROOT.
 		 * But be careful when an mm is exiting: do the rb_erase
 		 * if this rmap_item was inserted by this scan, rather
 		 * than left over from before.
 		 */
-		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
+		age = (unsigned char)(worker->scan.seqnr - rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
 			rb_erase(&rmap_item->node,
-				 root_unstable_tree + NUMA(rmap_item->nid));
-		ksm_pages_unshared--;
+				 worker->unstable_tree + NUMA(rmap_item->nid));
+		worker->pages_unshared--;
 		rmap_item->address &= PAGE_MASK;
 	}
-out:
 	cond_resched();		/* we're called from many long loops */
 }
 
@@ -660,7 +699,7 @@ static void remove_trailing_rmap_items(struct mm_slot *mm_slot,
 	while (*rmap_list) {
 		struct rmap_item *rmap_item = *rmap_list;
 		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
+		remove_rmap_item_from_tree(mm_slot->worker, rmap_item);
 		free_rmap_item(rmap_item);
 	}
 }
@@ -764,7 +803,7 @@ static int remove_all_stable_nodes(void)
 	return err;
 }
 
-static int unmerge_and_remove_all_rmap_items(void)
+static int unmerge_and_remove_worker_rmap_items(struct ksm_worker *worker)
 {
 	struct mm_slot *mm_slot;
 	struct mm_struct *mm;
@@ -772,12 +811,12 @@ static int unmerge_and_remove_all_rmap_items(void)
 	int err = 0;
 
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(ksm_mm_head.mm_list.next,
+	worker->scan.mm_slot = list_entry(worker->mm_head.mm_list.next,
 						struct mm_slot, mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
-	for (mm_slot = ksm_scan.mm_slot;
-			mm_slot != &ksm_mm_head; mm_slot = ksm_scan.mm_slot) {
+	for (mm_slot = worker->scan.mm_slot; mm_slot != &worker->mm_head;
+	     mm_slot = worker->scan.mm_slot) {
 		mm = mm_slot->mm;
 		down_read(&mm->mmap_sem);
 		for (vma = mm->mmap; vma; vma = vma->vm_next) {
@@ -794,7 +833,7 @@ static int unmerge_and_remove_all_rmap_items(void)
 		remove_trailing_rmap_items(mm_slot, &mm_slot->rmap_list);
 
 		spin_lock(&ksm_mmlist_lock);
-		ksm_scan.mm_slot = list_entry(mm_slot->mm_list.next,
+		worker->scan.mm_slot = list_entry(mm_slot->mm_list.next,
 						struct mm_slot, mm_list);
 		if (ksm_test_exit(mm)) {
 			hash_del(&mm_slot->link);
@@ -811,18 +850,32 @@ static int unmerge_and_remove_all_rmap_items(void)
 		}
 	}
 
-	/* Clean up stable nodes, but don't worry if some are still busy */
-	remove_all_stable_nodes();
-	ksm_scan.seqnr = 0;
+	worker->scan.seqnr = 0;
 	return 0;
 
 error:
 	up_read(&mm->mmap_sem);
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = &ksm_mm_head;
+	worker->scan.mm_slot = &worker->mm_head;
 	spin_unlock(&ksm_mmlist_lock);
 	return err;
 }
+
+static int unmerge_and_remove_all_rmap_items(void)
+{
+	struct ksm_worker *worker;
+	int err;
+
+	list_for_each_entry(worker, &ksm_workers, list) {
+		err = unmerge_and_remove_worker_rmap_items(worker);
+		if (err)
+			return err;
+	}
+
+	/* Clean up stable nodes, but don't worry if some are still busy */
+	remove_all_stable_nodes();
+	return 0;
+}
 #endif /* CONFIG_SYSFS */
 
 static u32 calc_checksum(struct page *page)
@@ -1080,7 +1133,8 @@ out:
  *
  * This function returns 0 if the pages were merged, -EFAULT otherwise.
  */
-static int try_to_merge_with_ksm_page(struct rmap_item *rmap_item,
+static int try_to_merge_with_ksm_page(struct ksm_worker *worker,
+				      struct rmap_item *rmap_item,
 				      struct page *page, struct page *kpage)
 {
 	struct mm_struct *mm = rmap_item->mm;
@@ -1099,7 +1153,7 @@ static int try_to_merge_with_ksm_page(struct rmap_item *rmap_item,
 		goto out;
 
 	/* Unstable nid is in union with stable anon_vma: remove first */
-	remove_rmap_item_from_tree(rmap_item);
+	remove_rmap_item_from_tree(worker, rmap_item);
 
 	/* Must get reference to anon_vma while still holding mmap_sem */
 	rmap_item->anon_vma = vma->anon_vma;
@@ -1119,16 +1173,17 @@ out:
  * Note that this function upgrades page to ksm page: if one of the pages
  * is already a ksm page, try_to_merge_with_ksm_page should be used.
  */
-static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
+static struct page *try_to_merge_two_pages(struct ksm_worker *worker,
+					   struct rmap_item *rmap_item,
 					   struct page *page,
 					   struct rmap_item *tree_rmap_item,
 					   struct page *tree_page)
 {
 	int err;
 
-	err = try_to_merge_with_ksm_page(rmap_item, page, NULL);
+	err = try_to_merge_with_ksm_page(worker, rmap_item, page, NULL);
 	if (!err) {
-		err = try_to_merge_with_ksm_page(tree_rmap_item,
+		err = try_to_merge_with_ksm_page(worker, tree_rmap_item,
 							tree_page, page);
 		/*
 		 * If that fails, we have a ksm page with only one pte
@@ -1147,7 +1202,7 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
  * with identical content to the page that we are scanning right now.
  *
  * This function returns the stable tree node of identical content if found,
- * NULL otherwise.
+ * NULL otherwise.  Called with ksm_stable_mutex held.
  */
 static struct page *stable_tree_search(struct page *page)
 {
@@ -1247,7 +1302,7 @@ replace:
  * into the stable tree.
  *
  * This function returns the stable tree node just allocated on success,
- * NULL otherwise.
+ * NULL otherwise.  Called with ksm_stable_mutex held.
  */
 static struct stable_node *stable_tree_insert(struct page *kpage)
 {
@@ -1317,10 +1372,12 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
  * to the currently scanned page, NULL otherwise.
  *
  * This function does both searching and inserting, because they share
- * the same walking algorithm in an rbtree.
+ * the same walking algorithm in an rbtree.  Only the worker which owns
+ * the unstable tree ever touches it, so no locking is needed.
  */
 static
-struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
+struct rmap_item *unstable_tree_search_insert(struct ksm_worker *worker,
+					      struct rmap_item *rmap_item,
 					      struct page *page,
 					      struct page **tree_pagep)
 {
@@ -1330,7 +1387,7 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 	int nid;
 
 	nid = get_kpfn_nid(page_to_pfn(page));
-	root = root_unstable_tree + nid;
+	root = worker->unstable_tree + nid;
 	new = &root->rb_node;
 
 	while (*new) {
@@ -1377,19 +1434,19 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 	}
 
 	rmap_item->address |= UNSTABLE_FLAG;
-	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	rmap_item->address |= (worker->scan.seqnr & SEQNR_MASK);
 	DO_NUMA(rmap_item->nid = nid);
 	rb_link_node(&rmap_item->node, parent, new);
 	rb_insert_color(&rmap_item->node, root);
 
-	ksm_pages_unshared++;
+	worker->pages_unshared++;
 	return NULL;
 }
 
 /*
  * stable_tree_append - add another rmap_item to the linked list of
  * rmap_items hanging off a given node of the stable tree, all sharing
- * the same ksm page.
+ * the same ksm page.  Called with ksm_stable_mutex and the page lock held.
  */
 static void stable_tree_append(struct rmap_item *rmap_item,
 			       struct stable_node *stable_node)
@@ -1410,10 +1467,12 @@ static void stable_tree_append(struct rmap_item *rmap_item,
  * be inserted into the unstable tree, or merged with a page already there and
  * both transferred to the stable tree.
  *
+ * @worker: the ksm_worker scanning the page
  * @page: the page that we are searching identical page to.
  * @rmap_item: the reverse mapping into the virtual address of this page
  */
-static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
+static void cmp_and_merge_page(struct ksm_worker *worker, struct page *page,
+			       struct rmap_item *rmap_item)
 {
 	struct rmap_item *tree_rmap_item;
 	struct page *tree_page = NULL;
@@ -1422,6 +1481,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	unsigned int checksum;
 	int err;
 
+	mutex_lock(&ksm_stable_mutex);
 	stable_node = page_stable_node(page);
 	if (stable_node) {
 		if (stable_node->head != &migrate_nodes &&
@@ -1432,29 +1492,36 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			list_add(&stable_node->list, stable_node->head);
 		}
 		if (stable_node->head != &migrate_nodes &&
-		    rmap_item->head == stable_node)
+		    rmap_item->head == stable_node) {
+			mutex_unlock(&ksm_stable_mutex);
 			return;
+		}
 	}
 
 	/* We first start with searching the page inside the stable tree */
 	kpage = stable_tree_search(page);
 	if (kpage == page && rmap_item->head == stable_node) {
+		mutex_unlock(&ksm_stable_mutex);
 		put_page(kpage);
 		return;
 	}
+	mutex_unlock(&ksm_stable_mutex);
 
-	remove_rmap_item_from_tree(rmap_item);
+	remove_rmap_item_from_tree(worker, rmap_item);
 
 	if (kpage) {
-		err = try_to_merge_with_ksm_page(rmap_item, page, kpage);
+		err = try_to_merge_with_ksm_page(worker, rmap_item,
+						 page, kpage);
 		if (!err) {
 			/*
 			 * The page was successfully merged:
 			 * add its rmap_item to the stable tree.
 			 */
+			mutex_lock(&ksm_stable_mutex);
 			lock_page(kpage);
 			stable_tree_append(rmap_item, page_stable_node(kpage));
 			unlock_page(kpage);
+			mutex_unlock(&ksm_stable_mutex);
 		}
 		put_page(kpage);
 		return;
@@ -1472,10 +1539,10 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		return;
 	}
 
-	tree_rmap_item =
-		unstable_tree_search_insert(rmap_item, page, &tree_page);
+	tree_rmap_item = unstable_tree_search_insert(worker, rmap_item,
+						     page, &tree_page);
 	if (tree_rmap_item) {
-		kpage = try_to_merge_two_pages(rmap_item, page,
+		kpage = try_to_merge_two_pages(worker, rmap_item, page,
 						tree_rmap_item, tree_page);
 		put_page(tree_page);
 		if (kpage) {
@@ -1483,6 +1550,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			 * The pages were successfully merged: insert new
 			 * node in the stable tree and add both rmap_items.
 			 */
+			mutex_lock(&ksm_stable_mutex);
 			lock_page(kpage);
 			stable_node = stable_tree_insert(kpage);
 			if (stable_node) {
@@ -1490,6 +1558,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 				stable_tree_append(rmap_item, stable_node);
 			}
 			unlock_page(kpage);
+			mutex_unlock(&ksm_stable_mutex);
 
 			/*
 			 * If we fail to insert the page into the stable tree,
@@ -1518,7 +1587,7 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 		if (rmap_item->address > addr)
 			break;
 		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
+		remove_rmap_item_from_tree(mm_slot->worker, rmap_item);
 		free_rmap_item(rmap_item);
 	}
 
@@ -1533,19 +1602,21 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+static struct rmap_item *scan_get_next_rmap_item(struct ksm_worker *worker,
+						 struct page **page)
 {
+	struct ksm_scan *scan = &worker->scan;
 	struct mm_struct *mm;
 	struct mm_slot *slot;
 	struct vm_area_struct *vma;
 	struct rmap_item *rmap_item;
 	int nid;
 
-	if (list_empty(&ksm_mm_head.mm_list))
+	if (list_empty(&worker->mm_head.mm_list))
 		return NULL;
 
-	slot = ksm_scan.mm_slot;
-	if (slot == &ksm_mm_head) {
+	slot = scan->mm_slot;
+	if (slot == &worker->mm_head) {
 		/*
 		 * A number of pages can hang around indefinitely on per-cpu
 		 * pagevecs, raised page count preventing write_protect_page
@@ -1569,6 +1640,7 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 			struct list_head *this, *next;
 			struct page *page;
 
+			mutex_lock(&ksm_stable_mutex);
 			list_for_each_safe(this, next, &migrate_nodes) {
 				stable_node = list_entry(this,
 						struct stable_node, list);
@@ -1577,24 +1649,25 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 					put_page(page);
 				cond_resched();
 			}
+			mutex_unlock(&ksm_stable_mutex);
 		}
 
 		for (nid = 0; nid < ksm_nr_node_ids; nid++)
-			root_unstable_tree[nid] = RB_ROOT;
+			worker->unstable_tree[nid] = RB_ROOT;
 
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
-		ksm_scan.mm_slot = slot;
+		scan->mm_slot = slot;
 		spin_unlock(&ksm_mmlist_lock);
 		/*
 		 * Although we tested list_empty() above, a racing __ksm_exit
 		 * of the last mm on the list may have removed it since then.
 		 */
-		if (slot == &ksm_mm_head)
+		if (slot == &worker->mm_head)
 			return NULL;
 next_mm:
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
 	}
 
 	mm = slot->mm;
@@ -1602,60 +1675,60 @@ next_mm:
 	if (ksm_test_exit(mm))
 		vma = NULL;
 	else
-		vma = find_vma(mm, ksm_scan.address);
+		vma = find_vma(mm, scan->address);
 
 	for (; vma; vma = vma->vm_next) {
 		if (!(vma->vm_flags & VM_MERGEABLE))
 			continue;
-		if (ksm_scan.address < vma->vm_start)
-			ksm_scan.address = vma->vm_start;
+		if (scan->address < vma->vm_start)
+			scan->address = vma->vm_start;
 		if (!vma->anon_vma)
-			ksm_scan.address = vma->vm_end;
+			scan->address = vma->vm_end;
 
-		while (ksm_scan.address < vma->vm_end) {
+		while (scan->address < vma->vm_end) {
 			if (ksm_test_exit(mm))
 				break;
-			*page = follow_page(vma, ksm_scan.address, FOLL_GET);
+			*page = follow_page(vma, scan->address, FOLL_GET);
 			if (IS_ERR_OR_NULL(*page)) {
-				ksm_scan.address += PAGE_SIZE;
+				scan->address += PAGE_SIZE;
 				cond_resched();
 				continue;
 			}
 			if (PageAnon(*page) ||
 			    page_trans_compound_anon(*page)) {
-				flush_anon_page(vma, *page, ksm_scan.address);
+				flush_anon_page(vma, *page, scan->address);
 				flush_dcache_page(*page);
 				rmap_item = get_next_rmap_item(slot,
-					ksm_scan.rmap_list, ksm_scan.address);
+					scan->rmap_list, scan->address);
 				if (rmap_item) {
-					ksm_scan.rmap_list =
+					scan->rmap_list =
 							&rmap_item->rmap_list;
-					ksm_scan.address += PAGE_SIZE;
+					scan->address += PAGE_SIZE;
 				} else
 					put_page(*page);
 				up_read(&mm->mmap_sem);
 				return rmap_item;
 			}
 			put_page(*page);
-			ksm_scan.address += PAGE_SIZE;
+			scan->address += PAGE_SIZE;
 			cond_resched();
 		}
 	}
 
 	if (ksm_test_exit(mm)) {
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
 	}
 	/*
 	 * Nuke all the rmap_items that are above this current rmap:
 	 * because there were no VM_MERGEABLE vmas with such addresses.
 	 */
-	remove_trailing_rmap_items(slot, ksm_scan.rmap_list);
+	remove_trailing_rmap_items(slot, scan->rmap_list);
 
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(slot->mm_list.next,
+	scan->mm_slot = list_entry(slot->mm_list.next,
 						struct mm_slot, mm_list);
-	if (ksm_scan.address == 0) {
+	if (scan->address == 0) {
 		/*
 		 * We've completed a full scan of all vmas, holding mmap_sem
 		 * throughout, and found no VM_MERGEABLE: so do the same as
@@ -1679,58 +1752,77 @@ next_mm:
 	}
 
 	/* Repeat until we've completed scanning the whole list */
-	slot = ksm_scan.mm_slot;
-	if (slot != &ksm_mm_head)
+	slot = scan->mm_slot;
+	if (slot != &worker->mm_head)
 		goto next_mm;
 
-	ksm_scan.seqnr++;
+	scan->seqnr++;
 	return NULL;
 }
 
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
+ * @worker - the ksm_worker whose mm_slots to scan.
  * @scan_npages - number of pages we want to scan before we return.
  */
-static void ksm_do_scan(unsigned int scan_npages)
+static void ksm_do_scan(struct ksm_worker *worker, unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
 
 	while (scan_npages-- && likely(!freezing(current))) {
 		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
+		rmap_item = scan_get_next_rmap_item(worker, &page);
 		if (!rmap_item)
 			return;
-		cmp_and_merge_page(page, rmap_item);
+		cmp_and_merge_page(worker, page, rmap_item);
 		put_page(page);
 	}
 }
 
-static int ksmd_should_run(void)
+/*
+ * Memory hotremove sets KSM_RUN_OFFLINE under ksm_thread_sem: the ksmds
+ * then keep off the stable tree until it is cleared and they are woken.
+ */
+static int ksmd_should_run(struct ksm_worker *worker)
+{
+	return (ksm_run & (KSM_RUN_MERGE | KSM_RUN_OFFLINE)) == KSM_RUN_MERGE &&
+		!list_empty(&worker->mm_head.mm_list);
+}
+
+static void ksm_wake_workers(void)
 {
-	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
+	struct ksm_worker *worker;
+
+	list_for_each_entry(worker, &ksm_workers, list)
+		wake_up_interruptible(&worker->wait);
 }
 
-static int ksm_scan_thread(void *nothing)
+static int ksm_scan_thread(void *data)
 {
+	struct ksm_worker *worker = data;
+	const struct cpumask *cpumask = cpumask_of_node(worker->nid);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
 	set_freezable();
 	set_user_nice(current, 5);
 
 	while (!kthread_should_stop()) {
-		mutex_lock(&ksm_thread_mutex);
-		wait_while_offlining();
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
-		mutex_unlock(&ksm_thread_mutex);
+		down_read(&ksm_thread_sem);
+		if (ksmd_should_run(worker))
+			ksm_do_scan(worker, ksm_thread_pages_to_scan);
+		up_read(&ksm_thread_sem);
 
 		try_to_freeze();
 
-		if (ksmd_should_run()) {
+		if (ksmd_should_run(worker)) {
 			schedule_timeout_interruptible(
 				msecs_to_jiffies(ksm_thread_sleep_millisecs));
 		} else {
-			wait_event_freezable(ksm_thread_wait,
-				ksmd_should_run() || kthread_should_stop());
+			wait_event_freezable(worker->wait,
+					     ksmd_should_run(worker) ||
+					     kthread_should_stop());
 		}
 	}
 	return 0;
@@ -1783,8 +1875,25 @@ int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 	return 0;
 }
 
+/*
+ * Hand a forked mm to the worker which scans its parent, as the two share
+ * all their anonymous pages to begin with; otherwise to the worker of the
+ * node we are running on.  Called under ksm_mmlist_lock.
+ */
+static struct ksm_worker *ksm_pick_worker(struct mm_struct *mm)
+{
+	struct mm_slot *parent_slot = NULL;
+
+	if (current->mm && current->mm != mm)
+		parent_slot = get_mm_slot(current->mm);
+	if (parent_slot)
+		return parent_slot->worker;
+	return node_ksm_worker[numa_node_id()];
+}
+
 int __ksm_enter(struct mm_struct *mm)
 {
+	struct ksm_worker *worker;
 	struct mm_slot *mm_slot;
 	int needs_wakeup;
 
@@ -1792,10 +1901,13 @@ int __ksm_enter(struct mm_struct *mm)
 	if (!mm_slot)
 		return -ENOMEM;
 
+	spin_lock(&ksm_mmlist_lock);
+	worker = ksm_pick_worker(mm);
+	mm_slot->worker = worker;
+
 	/* Check ksm_run too?  Would need tighter locking */
-	needs_wakeup = list_empty(&ksm_mm_head.mm_list);
+	needs_wakeup = list_empty(&worker->mm_head.mm_list);
 
-	spin_lock(&ksm_mmlist_lock);
 	insert_to_mm_slots_hash(mm, mm_slot);
 	/*
 	 * When KSM_RUN_MERGE (or KSM_RUN_STOP),
@@ -1808,16 +1920,17 @@ int __ksm_enter(struct mm_struct *mm)
 	 * missed: then we might as well insert at the end of the list.
 	 */
 	if (ksm_run & KSM_RUN_UNMERGE)
-		list_add_tail(&mm_slot->mm_list, &ksm_mm_head.mm_list);
+		list_add_tail(&mm_slot->mm_list, &worker->mm_head.mm_list);
 	else
-		list_add_tail(&mm_slot->mm_list, &ksm_scan.mm_slot->mm_list);
+		list_add_tail(&mm_slot->mm_list,
+			      &worker->scan.mm_slot->mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
 	set_bit(MMF_VM_MERGEABLE, &mm->flags);
 	atomic_inc(&mm->mm_count);
 
 	if (needs_wakeup)
-		wake_up_interruptible(&ksm_thread_wait);
+		wake_up_interruptible(&worker->wait);
 
 	return 0;
 }
@@ -1838,14 +1951,14 @@ void __ksm_exit(struct mm_struct *mm)
 
 	spin_lock(&ksm_mmlist_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && ksm_scan.mm_slot != mm_slot) {
+	if (mm_slot && mm_slot->worker->scan.mm_slot != mm_slot) {
 		if (!mm_slot->rmap_list) {
 			hash_del(&mm_slot->link);
 			list_del(&mm_slot->mm_list);
 			easy_to_free = 1;
 		} else {
 			list_move(&mm_slot->mm_list,
-				  &ksm_scan.mm_slot->mm_list);
+				  &mm_slot->worker->scan.mm_slot->mm_list);
 		}
 	}
 	spin_unlock(&ksm_mmlist_lock);
@@ -1979,22 +2092,6 @@ void ksm_migrate_page(struct page *newpage, struct page *oldpage)
 #endif /* CONFIG_MIGRATION */
 
 #ifdef CONFIG_MEMORY_HOTREMOVE
-static int just_wait(void *word)
-{
-	schedule();
-	return 0;
-}
-
-static void wait_while_offlining(void)
-{
-	while (ksm_run & KSM_RUN_OFFLINE) {
-		mutex_unlock(&ksm_thread_mutex);
-		wait_on_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE),
-				just_wait, TASK_UNINTERRUPTIBLE);
-		mutex_lock(&ksm_thread_mutex);
-	}
-}
-
 static void ksm_check_stable_tree(unsigned long start_pfn,
 				  unsigned long end_pfn)
 {
@@ -2041,11 +2138,11 @@ static int ksm_memory_callback(struct notifier_block *self,
 		 * and remove_all_stable_nodes() while memory is going offline:
 		 * it is unsafe for them to touch the stable tree at this time.
 		 * But unmerge_ksm_pages(), rmap lookups and other entry points
-		 * which do not need the ksm_thread_mutex are all safe.
+		 * which do not need the ksm_thread_sem are all safe.
 		 */
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 		ksm_run |= KSM_RUN_OFFLINE;
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 		break;
 
 	case MEM_OFFLINE:
@@ -2061,20 +2158,17 @@ static int ksm_memory_callback(struct notifier_block *self,
 		/* fallthrough */
 
 	case MEM_CANCEL_OFFLINE:
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 		ksm_run &= ~KSM_RUN_OFFLINE;
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 
 		smp_mb();	/* wake_up_bit advises this */
 		wake_up_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE));
+		ksm_wake_workers();
 		break;
 	}
 	return NOTIFY_OK;
 }
-#else
-static void wait_while_offlining(void)
-{
-}
 #endif /* CONFIG_MEMORY_HOTREMOVE */
 
 #ifdef CONFIG_SYSFS
@@ -2082,6 +2176,28 @@ static void wait_while_offlining(void)
  * This all compiles without CONFIG_SYSFS, but is a waste of space.
  */
 
+#ifdef CONFIG_MEMORY_HOTREMOVE
+static int just_wait(void *word)
+{
+	schedule();
+	return 0;
+}
+
+static void wait_while_offlining(void)
+{
+	while (ksm_run & KSM_RUN_OFFLINE) {
+		up_write(&ksm_thread_sem);
+		wait_on_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE),
+				just_wait, TASK_UNINTERRUPTIBLE);
+		down_write(&ksm_thread_sem);
+	}
+}
+#else
+static void wait_while_offlining(void)
+{
+}
+#endif /* CONFIG_MEMORY_HOTREMOVE */
+
 #define KSM_ATTR_RO(_name) \
 	static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
 #define KSM_ATTR(_name) \
@@ -2159,7 +2275,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 	 * on the list for when ksmd may be set running again).
 	 */
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	wait_while_offlining();
 	if (ksm_run != flags) {
 		ksm_run = flags;
@@ -2173,10 +2289,10 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 			}
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	if (flags & KSM_RUN_MERGE)
-		wake_up_interruptible(&ksm_thread_wait);
+		ksm_wake_workers();
 
 	return count;
 }
@@ -2202,38 +2318,21 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 	if (knob > 1)
 		return -EINVAL;
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	wait_while_offlining();
 	if (ksm_merge_across_nodes != knob) {
+		/*
+		 * The unstable trees need no emptying: each rmap_item records
+		 * its own tree, and they are all flushed after the next scan.
+		 */
 		if (ksm_pages_shared || remove_all_stable_nodes())
 			err = -EBUSY;
-		else if (root_stable_tree == one_stable_tree) {
-			struct rb_root *buf;
-			/*
-			 * This is the first time that we switch away from the
-			 * default of merging across nodes: must now allocate
-			 * a buffer to hold as many roots as may be needed.
-			 * Allocate stable and unstable together:
-			 * MAXSMP NODES_SHIFT 10 will use 16kB.
-			 */
-			buf = kcalloc(nr_node_ids + nr_node_ids, sizeof(*buf),
-				      GFP_KERNEL);
-			/* Let us assume that RB_ROOT is NULL is zero */
-			if (!buf)
-				err = -ENOMEM;
-			else {
-				root_stable_tree = buf;
-				root_unstable_tree = buf + nr_node_ids;
-				/* Stable tree is empty but not the unstable */
-				root_unstable_tree[0] = one_unstable_tree[0];
-			}
-		}
-		if (!err) {
+		else {
 			ksm_merge_across_nodes = knob;
 			ksm_nr_node_ids = knob ? 1 : nr_node_ids;
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	return err ? err : count;
 }
@@ -2254,10 +2353,21 @@ static ssize_t pages_sharing_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(pages_sharing);
 
+static unsigned long ksm_pages_unshared(void)
+{
+	struct ksm_worker *worker;
+	unsigned long pages_unshared = 0;
+
+	list_for_each_entry(worker, &ksm_workers, list)
+		pages_unshared += worker->pages_unshared;
+
+	return pages_unshared;
+}
+
 static ssize_t pages_unshared_show(struct kobject *kobj,
 				   struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_unshared);
+	return sprintf(buf, "%lu\n", ksm_pages_unshared());
 }
 KSM_ATTR_RO(pages_unshared);
 
@@ -2266,8 +2376,9 @@ static ssize_t pages_volatile_show(struct kobject *kobj,
 {
 	long ksm_pages_volatile;
 
-	ksm_pages_volatile = ksm_rmap_items - ksm_pages_shared
-				- ksm_pages_sharing - ksm_pages_unshared;
+	ksm_pages_volatile = atomic_long_read(&ksm_rmap_items)
+				- ksm_pages_shared - ksm_pages_sharing
+				- ksm_pages_unshared();
 	/*
 	 * It was not worth any locking to calculate that statistic,
 	 * but it might therefore sometimes be negative: conceal that.
@@ -2281,7 +2392,14 @@ KSM_ATTR_RO(pages_volatile);
 static ssize_t full_scans_show(struct kobject *kobj,
 			       struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_scan.seqnr);
+	struct ksm_worker *worker;
+	unsigned long full_scans = ULONG_MAX;
+
+	/* The whole of memory has been scanned when the slowest is done */
+	list_for_each_entry(worker, &ksm_workers, list)
+		full_scans = min(full_scans, worker->scan.seqnr);
+
+	return sprintf(buf, "%lu\n", full_scans);
 }
 KSM_ATTR_RO(full_scans);
 
@@ -2306,28 +2424,95 @@ static struct attribute_group ksm_attr_group = {
 };
 #endif /* CONFIG_SYSFS */
 
+static int __init ksm_start_worker(int nid)
+{
+	struct ksm_worker *worker;
+	int err = -ENOMEM;
+
+	worker = kzalloc_node(sizeof(*worker), GFP_KERNEL, nid);
+	if (!worker)
+		goto out;
+	/* Let us assume that RB_ROOT is NULL is zero */
+	worker->unstable_tree = kcalloc(nr_node_ids,
+				sizeof(*worker->unstable_tree), GFP_KERNEL);
+	if (!worker->unstable_tree)
+		goto out_free;
+
+	INIT_LIST_HEAD(&worker->mm_head.mm_list);
+	worker->scan.mm_slot = &worker->mm_head;
+	init_waitqueue_head(&worker->wait);
+	worker->nid = nid;
+
+	worker->thread = kthread_create_on_node(ksm_scan_thread, worker, nid,
+						"ksmd%d", nid);
+	if (IS_ERR(worker->thread)) {
+		err = PTR_ERR(worker->thread);
+		goto out_free;
+	}
+
+	list_add_tail(&worker->list, &ksm_workers);
+	node_ksm_worker[nid] = worker;
+	wake_up_process(worker->thread);
+	return 0;
+
+out_free:
+	kfree(worker->unstable_tree);
+	kfree(worker);
+out:
+	return err;
+}
+
+static void __init ksm_stop_workers(void)
+{
+	struct ksm_worker *worker, *next;
+
+	list_for_each_entry_safe(worker, next, &ksm_workers, list) {
+		kthread_stop(worker->thread);
+		list_del(&worker->list);
+		kfree(worker->unstable_tree);
+		kfree(worker);
+	}
+}
+
 static int __init ksm_init(void)
 {
-	struct task_struct *ksm_thread;
+	int nid;
 	int err;
 
 	err = ksm_slab_init();
 	if (err)
 		goto out;
 
-	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
-	if (IS_ERR(ksm_thread)) {
-		printk(KERN_ERR "ksm: creating kthread failed\n");
-		err = PTR_ERR(ksm_thread);
+	err = -ENOMEM;
+	root_stable_tree = kcalloc(nr_node_ids, sizeof(*root_stable_tree),
+				   GFP_KERNEL);
+	if (!root_stable_tree)
 		goto out_free;
+	node_ksm_worker = kcalloc(nr_node_ids, sizeof(*node_ksm_worker),
+				  GFP_KERNEL);
+	if (!node_ksm_worker)
+		goto out_free;
+	DO_NUMA(ksm_nr_node_ids = nr_node_ids);
+
+	for_each_node_state(nid, N_MEMORY) {
+		err = ksm_start_worker(nid);
+		if (err) {
+			printk(KERN_ERR "ksm: creating kthread failed\n");
+			goto out_stop;
+		}
 	}
 
+	/* Nodes without memory hand their mms to the first worker */
+	for_each_node(nid)
+		if (!node_ksm_worker[nid])
+			node_ksm_worker[nid] = list_first_entry(&ksm_workers,
+						struct ksm_worker, list);
+
 #ifdef CONFIG_SYSFS
 	err = sysfs_create_group(mm_kobj, &ksm_attr_group);
 	if (err) {
 		printk(KERN_ERR "ksm: register sysfs failed\n");
-		kthread_stop(ksm_thread);
-		goto out_free;
+		goto out_stop;
 	}
 #else
 	ksm_run = KSM_RUN_MERGE;	/* no way for user to start it */
@@ -2340,7 +2525,11 @@ static int __init ksm_init(void)
 #endif
 	return 0;
 
+out_stop:
+	ksm_stop_workers();
 out_free:
+	kfree(node_ksm_worker);
+	kfree(root_stable_tree);
 	ksm_slab_free();
 out:
 	return err;
@@ -9,16 +9,88 @@
 #include <linux/mm.h>
 #include <linux/list_lru.h>
 #include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/memcontrol.h>
+
+#ifdef CONFIG_MEMCG_KMEM
+/*
+ * The cgroup aware lrus, for their per cgroup lists to be extended as
+ * more cgroups are kmem accounted, and the number of lists each one has.
+ */
+static LIST_HEAD(list_lrus);
+static DEFINE_MUTEX(list_lrus_mutex);
+static int list_lrus_nr_memcgs;
+
+static inline bool list_lru_memcg_aware(struct list_lru *lru)
+{
+	return !!lru->node[0].memcg_lrus;
+}
+
+/* Called with nlru->lock held: it keeps the array from being replaced */
+static inline struct list_lru_one *
+list_lru_from_memcg_idx(struct list_lru_node *nlru, int idx)
+{
+	if (nlru->memcg_lrus && idx >= 0 && idx < nlru->memcg_lrus->nr)
+		return nlru->memcg_lrus->lru[idx];
+	return &nlru->lru;
+}
+
+static inline int list_lru_memcg_nr(struct list_lru_node *nlru)
+{
+	return nlru->memcg_lrus ? nlru->memcg_lrus->nr : 0;
+}
+
+/*
+ * The list for @item: that of the cgroup its slab is charged to, if the
+ * cgroup is kmem accounted.
+ */
+static inline struct list_lru_one *
+list_lru_from_kmem(struct list_lru_node *nlru, void *item)
+{
+	struct mem_cgroup *memcg;
+
+	if (!nlru->memcg_lrus)
+		return &nlru->lru;
+
+	memcg = mem_cgroup_from_kmem(item);
+	return list_lru_from_memcg_idx(nlru, memcg_cache_id(memcg));
+}
+#else
+static inline bool list_lru_memcg_aware(struct list_lru *lru)
+{
+	return false;
+}
+
+static inline struct list_lru_one *
+list_lru_from_memcg_idx(struct list_lru_node *nlru, int idx)
+{
+	return &nlru->lru;
+}
+
+static inline int list_lru_memcg_nr(struct list_lru_node *nlru)
+{
+	return 0;
+}
+
+static inline struct list_lru_one *
+list_lru_from_kmem(struct list_lru_node *nlru, void *item)
+{
+	return &nlru->lru;
+}
+#endif /* CONFIG_MEMCG_KMEM */
 
 bool list_lru_add(struct list_lru *lru, struct list_head *item)
 {
 	int nid = page_to_nid(virt_to_page(item));
 	struct list_lru_node *nlru = &lru->node[nid];
+	struct list_lru_one *l;
 
 	spin_lock(&nlru->lock);
 	WARN_ON_ONCE(nlru->nr_items < 0);
 	if (list_empty(item)) {
-		list_add_tail(item, &nlru->list);
+		l = list_lru_from_kmem(nlru, item);
+		list_add_tail(item, &l->list);
+		l->nr_items++;
 		if (nlru->nr_items++ == 0)
 			node_set(nid, lru->active_nodes);
 		spin_unlock(&nlru->lock);
@@ -33,13 +105,16 @@ bool list_lru_del(struct list_lru *lru, struct list_head *item)
 {
 	int nid = page_to_nid(virt_to_page(item));
 	struct list_lru_node *nlru = &lru->node[nid];
+	struct list_lru_one *l;
 
 	spin_lock(&nlru->lock);
 	if (!list_empty(item)) {
+		l = list_lru_from_kmem(nlru, item);
 		list_del_init(item);
+		l->nr_items--;
 		if (--nlru->nr_items == 0)
 			node_clear(nid, lru->active_nodes);
-		WARN_ON_ONCE(nlru->nr_items < 0);
+		WARN_ON_ONCE(l->nr_items < 0);
 		spin_unlock(&nlru->lock);
 		return true;
 	}
@@ -48,6 +123,29 @@ bool list_lru_del(struct list_lru *lru, struct list_head *item)
 }
 EXPORT_SYMBOL_GPL(list_lru_del);
 
+static unsigned long
+__list_lru_count_one(struct list_lru *lru, int nid, int memcg_idx)
+{
+	struct list_lru_node *nlru = &lru->node[nid];
+	struct list_lru_one *l;
+	unsigned long count;
+
+	spin_lock(&nlru->lock);
+	l = list_lru_from_memcg_idx(nlru, memcg_idx);
+	WARN_ON_ONCE(l->nr_items < 0);
+	count = l->nr_items;
+	spin_unlock(&nlru->lock);
+
+	return count;
+}
+
+unsigned long list_lru_count_one(struct list_lru *lru,
+				 int nid, struct mem_cgroup *memcg)
+{
+	return __list_lru_count_one(lru, nid, memcg_cache_id(memcg));
+}
+EXPORT_SYMBOL_GPL(list_lru_count_one);
+
 unsigned long
 list_lru_count_node(struct list_lru *lru, int nid)
 {
@@ -63,18 +161,22 @@ list_lru_count_node(struct list_lru *lru, int nid)
 }
 EXPORT_SYMBOL_GPL(list_lru_count_node);
 
-unsigned long
-list_lru_walk_node(struct list_lru *lru, int nid, list_lru_walk_cb isolate,
-		   void *cb_arg, unsigned long *nr_to_walk)
+static unsigned long
+__list_lru_walk_one(struct list_lru *lru, int nid, int memcg_idx,
+		    list_lru_walk_cb isolate, void *cb_arg,
+		    unsigned long *nr_to_walk)
 {
 
 	struct list_lru_node	*nlru = &lru->node[nid];
+	struct list_lru_one *l;
 	struct list_head *item, *n;
 	unsigned long isolated = 0;
 
 	spin_lock(&nlru->lock);
 restart:
-	list_for_each_safe(item, n, &nlru->list) {
+	/* the array of lists may have been replaced while unlocked */
+	l = list_lru_from_memcg_idx(nlru, memcg_idx);
+	list_for_each_safe(item, n, &l->list) {
 		enum lru_status ret;
 
 		/*
@@ -90,9 +192,10 @@ restart:
 		case LRU_REMOVED_RETRY:
 			assert_spin_locked(&nlru->lock);
 		case LRU_REMOVED:
+			l->nr_items--;
 			if (--nlru->nr_items == 0)
 				node_clear(nid, lru->active_nodes);
-			WARN_ON_ONCE(nlru->nr_items < 0);
+			WARN_ON_ONCE(l->nr_items < 0);
 			isolated++;
 			/*
 			 * If the lru lock has been dropped, our list
@@ -103,7 +206,7 @@ restart:
 				goto restart;
 			break;
 		case LRU_ROTATE:
-			list_move_tail(item, &nlru->list);
+			list_move_tail(item, &l->list);
 			break;
 		case LRU_SKIP:
 			break;
@@ -122,12 +225,242 @@ restart:
 	spin_unlock(&nlru->lock);
 	return isolated;
 }
+
+unsigned long
+list_lru_walk_one(struct list_lru *lru, int nid, struct mem_cgroup *memcg,
+		  list_lru_walk_cb isolate, void *cb_arg,
+		  unsigned long *nr_to_walk)
+{
+	return __list_lru_walk_one(lru, nid, memcg_cache_id(memcg),
+				   isolate, cb_arg, nr_to_walk);
+}
+EXPORT_SYMBOL_GPL(list_lru_walk_one);
+
+unsigned long list_lru_walk_node(struct list_lru *lru, int nid,
+				 list_lru_walk_cb isolate, void *cb_arg,
+				 unsigned long *nr_to_walk)
+{
+	struct list_lru_node *nlru = &lru->node[nid];
+	unsigned long total, budget, isolated = 0;
+	int memcg_idx, nr_memcgs;
+
+	if (!list_lru_memcg_aware(lru))
+		return __list_lru_walk_one(lru, nid, -1, isolate, cb_arg,
+					   nr_to_walk);
+
+	spin_lock(&nlru->lock);
+	total = max(nlru->nr_items, 1L);
+	nr_memcgs = list_lru_memcg_nr(nlru);
+	spin_unlock(&nlru->lock);
+	budget = *nr_to_walk;
+
+	/* the root's list first, then those of the cgroups */
+	for (memcg_idx = -1; memcg_idx < nr_memcgs; memcg_idx++) {
+		unsigned long share, nr_items;
+
+		if (!*nr_to_walk)
+			break;
+		nr_items = __list_lru_count_one(lru, nid, memcg_idx);
+		if (!nr_items)
+			continue;
+		share = min(DIV_ROUND_UP(budget * nr_items, total),
+			    *nr_to_walk);
+		*nr_to_walk -= share;
+		isolated += __list_lru_walk_one(lru, nid, memcg_idx, isolate,
+						cb_arg, &share);
+		*nr_to_walk += share;
+	}
+	return isolated;
+}
 EXPORT_SYMBOL_GPL(list_lru_walk_node);
 
-int list_lru_init_key(struct list_lru *lru, struct lock_class_key *key)
+static void init_one_lru(struct list_lru_one *l)
+{
+	INIT_LIST_HEAD(&l->list);
+	l->nr_items = 0;
+}
+
+#ifdef CONFIG_MEMCG_KMEM
+static void __memcg_free_list_lru_node(struct list_lru_memcg *memcg_lrus,
+				       int begin, int end)
+{
+	int i;
+
+	for (i = begin; i < end; i++)
+		kfree(memcg_lrus->lru[i]);
+}
+
+static int __memcg_init_list_lru_node(struct list_lru_memcg *memcg_lrus,
+				      int begin, int end)
+{
+	int i;
+
+	for (i = begin; i < end; i++) {
+		struct list_lru_one *l;
+
+		l = kmalloc(sizeof(struct list_lru_one), GFP_KERNEL);
+		if (!l)
+			goto fail;
+
+		init_one_lru(l);
+		memcg_lrus->lru[i] = l;
+	}
+	return 0;
+fail:
+	__memcg_free_list_lru_node(memcg_lrus, begin, i);
+	return -ENOMEM;
+}
+
+static struct list_lru_memcg *memcg_alloc_list_lru_node(int nr)
+{
+	struct list_lru_memcg *memcg_lrus;
+
+	memcg_lrus = kmalloc(sizeof(*memcg_lrus) +
+			     nr * sizeof(struct list_lru_one *), GFP_KERNEL);
+	if (memcg_lrus)
+		memcg_lrus->nr = nr;
+	return memcg_lrus;
+}
+
+static int memcg_init_list_lru_node(struct list_lru_node *nlru, int nr)
+{
+	struct list_lru_memcg *memcg_lrus;
+
+	memcg_lrus = memcg_alloc_list_lru_node(nr);
+	if (!memcg_lrus)
+		return -ENOMEM;
+
+	if (__memcg_init_list_lru_node(memcg_lrus, 0, nr)) {
+		kfree(memcg_lrus);
+		return -ENOMEM;
+	}
+	nlru->memcg_lrus = memcg_lrus;
+	return 0;
+}
+
+static void memcg_destroy_list_lru_node(struct list_lru_node *nlru)
+{
+	__memcg_free_list_lru_node(nlru->memcg_lrus, 0, nlru->memcg_lrus->nr);
+	kfree(nlru->memcg_lrus);
+}
+
+/* Give the lists of a node room for @nr cgroups, keeping those it has */
+static int memcg_update_list_lru_node(struct list_lru_node *nlru, int nr)
+{
+	struct list_lru_memcg *old, *new;
+	int old_nr = nlru->memcg_lrus->nr;
+
+	if (nr <= old_nr)
+		return 0;
+
+	old = nlru->memcg_lrus;
+	new = memcg_alloc_list_lru_node(nr);
+	if (!new)
+		return -ENOMEM;
+
+	if (__memcg_init_list_lru_node(new, old_nr, nr)) {
+		kfree(new);
+		return -ENOMEM;
+	}
+	memcpy(new->lru, old->lru, old_nr * sizeof(struct list_lru_one *));
+
+	/*
+	 * The lock keeps list_lru_{add,del,count,walk} from looking at the
+	 * old array while it is replaced.
+	 */
+	spin_lock(&nlru->lock);
+	nlru->memcg_lrus = new;
+	spin_unlock(&nlru->lock);
+
+	kfree(old);
+	return 0;
+}
+
+static int memcg_init_list_lru(struct list_lru *lru, bool memcg_aware)
+{
+	int i;
+
+	if (!memcg_aware)
+		return 0;
+
+	mutex_lock(&list_lrus_mutex);
+	for (i = 0; i < nr_node_ids; i++) {
+		if (memcg_init_list_lru_node(&lru->node[i],
+					     list_lrus_nr_memcgs))
+			goto fail;
+	}
+	list_add(&lru->list, &list_lrus);
+	mutex_unlock(&list_lrus_mutex);
+	return 0;
+fail:
+	for (i = i - 1; i >= 0; i--)
+		memcg_destroy_list_lru_node(&lru->node[i]);
+	mutex_unlock(&list_lrus_mutex);
+	return -ENOMEM;
+}
+
+static void memcg_destroy_list_lru(struct list_lru *lru)
+{
+	int i;
+
+	if (!list_lru_memcg_aware(lru))
+		return;
+
+	mutex_lock(&list_lrus_mutex);
+	list_del(&lru->list);
+	mutex_unlock(&list_lrus_mutex);
+
+	for (i = 0; i < nr_node_ids; i++)
+		memcg_destroy_list_lru_node(&lru->node[i]);
+}
+
+/**
+ * memcg_update_all_list_lrus - make room for more cgroups in the lrus
+ * @num_groups: the number of kmem accounted cgroups to make room for
+ *
+ * Called before a cgroup is given a kmem cache id below @num_groups, for
+ * the cgroup aware lrus to have a list for it. On failure, the lists
+ * already added are kept.
+ */
+int memcg_update_all_list_lrus(int num_groups)
+{
+	struct list_lru *lru;
+	int i, ret = 0;
+
+	mutex_lock(&list_lrus_mutex);
+	if (num_groups <= list_lrus_nr_memcgs)
+		goto out;
+
+	list_for_each_entry(lru, &list_lrus, list) {
+		for (i = 0; i < nr_node_ids; i++) {
+			ret = memcg_update_list_lru_node(&lru->node[i],
+							 num_groups);
+			if (ret)
+				goto out;
+		}
+	}
+	list_lrus_nr_memcgs = num_groups;
+out:
+	mutex_unlock(&list_lrus_mutex);
+	return ret;
+}
+#else
+static int memcg_init_list_lru(struct list_lru *lru, bool memcg_aware)
+{
+	return 0;
+}
+
+static void memcg_destroy_list_lru(struct list_lru *lru)
+{
+}
+#endif /* CONFIG_MEMCG_KMEM */
+
+int __list_lru_init(struct list_lru *lru, bool memcg_aware,
+		    struct lock_class_key *key)
 {
 	int i;
 	size_t size = sizeof(*lru->node) * nr_node_ids;
+	int err;
 
 	lru->node = kzalloc(size, GFP_KERNEL);
 	if (!lru->node)
@@ -138,15 +471,27 @@ int list_lru_init_key(struct list_lru *lru, struct lock_class_key *key)
 		spin_lock_init(&lru->node[i].lock);
 		if (key)
 			lockdep_set_class(&lru->node[i].lock, key);
-		INIT_LIST_HEAD(&lru->node[i].list);
+		init_one_lru(&lru->node[i].lru);
 		lru->node[i].nr_items = 0;
 	}
-	return 0;
+
+	err = memcg_init_list_lru(lru, memcg_aware);
+	if (err) {
+		kfree(lru->node);
+		lru->node = NULL;
+	}
+	return err;
 }
-EXPORT_SYMBOL_GPL(list_lru_init_key);
+EXPORT_SYMBOL_GPL(__list_lru_init);
 
 void list_lru_destroy(struct list_lru *lru)
 {
+	/* Already destroyed or not yet initialized? */
+	if (!lru->node)
+		return;
+
+	memcg_destroy_list_lru(lru);
 	kfree(lru->node);
+	lru->node = NULL;
 }
 EXPORT_SYMBOL_GPL(list_lru_destroy);
@@ -61,6 +61,9 @@
 #include <linux/string.h>
 #include <linux/dma-debug.h>
 #include <linux/debugfs.h>
+#include <linux/vmacache.h>
+#include <linux/userfaultfd_k.h>
+#include <linux/backing-dev.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -888,6 +891,377 @@ out_set_pte:
 	return 0;
 }
 
+#ifdef CONFIG_FORK_SHARE_PTE
+/*
+ * Page tables shared on fork.
+ *
+ * Copying the ptes of a big process on fork takes time in proportion to its
+ * rss, most of it spent on the struct pages whose counts are raised.  So a
+ * pte table which lies wholly in a private anonymous vma is not copied: the
+ * child's pmd points at the parent's table, and both pmds are made
+ * read-only, so that neither mm can write through it.  Whichever mm next
+ * has to change one of its ptes first takes a copy of the table, as fork
+ * would have made it, in pte_table_unshare().
+ *
+ * pt_share_count counts the mms mapping a shared table, under the table's
+ * page table lock, which they all take: that is why split pte locks are
+ * needed.  Its pages are counted and mapped just once, as if by a single
+ * mm, and charged to the rss of pt_owner alone: the mm which shared it, or
+ * NULL once that one has gone its own way, to be charged to the last mm
+ * left with the table.
+ *
+ * The pages of a shared table are left mapped by reclaim, migration, KSM
+ * and khugepaged, which work on the ptes of one mm at a time, until the
+ * table is unshared.
+ */
+int sysctl_fork_share_pte __read_mostly = 1;
+
+/* Add (@sign 1) or remove (-1) the pages of a table to the rss of @mm */
+static void pte_table_charge(struct mm_struct *mm, pmd_t pmd, int sign)
+{
+	int rss[NR_MM_COUNTERS];
+	pte_t *start_pte, *pte;
+	int i;
+
+	init_rss_vec(rss);
+	start_pte = pte = pte_offset_map(&pmd, 0);
+	for (i = 0; i < PTRS_PER_PTE; i++, pte++) {
+		pte_t ptent = *pte;
+
+		if (pte_none(ptent))
+			continue;
+		if (pte_present(ptent)) {
+			/* all anonymous, but for the special ZERO_PAGE */
+			if (!pte_special(ptent))
+				rss[MM_ANONPAGES] += sign;
+		} else if (!pte_file(ptent)) {
+			swp_entry_t entry = pte_to_swp_entry(ptent);
+
+			if (!non_swap_entry(entry))
+				rss[MM_SWAPENTS] += sign;
+			else if (is_migration_entry(entry))
+				rss[MM_ANONPAGES] += sign;
+		}
+	}
+	pte_unmap(start_pte);
+	add_mm_rss_vec(mm, rss);
+}
+
+/*
+ * No other mm maps the table @pmd points to any more: it is @mm's own
+ * again.  Called with the table's page table lock held.
+ */
+static void pte_table_adopt(struct mm_struct *mm, pmd_t *pmd, pmd_t orig_pmd)
+{
+	struct page *table = pmd_page(orig_pmd);
+
+	if (table->pt_owner != mm)
+		pte_table_charge(mm, orig_pmd, 1);
+	table->pt_owner = NULL;
+	set_pmd(pmd, pmd_mkwrite(orig_pmd));
+}
+
+/*
+ * Share the pte table of @src_pmd with the child being forked, instead of
+ * copying it, if the table wholly belongs to the private anonymous @vma.
+ */
+static bool pte_table_share(struct mm_struct *dst_mm,
+			    struct mm_struct *src_mm, pmd_t *dst_pmd,
+			    pmd_t *src_pmd, struct vm_area_struct *vma,
+			    unsigned long addr, unsigned long end)
+{
+	struct page *table;
+	spinlock_t *ptl;
+	pmd_t pmd;
+
+	if (!sysctl_fork_share_pte || !USE_SPLIT_PTE_PTLOCKS)
+		return false;
+	if (vma->vm_ops || (vma->vm_flags & (VM_SHARED | VM_HUGETLB)))
+		return false;
+	if ((addr & ~PMD_MASK) || end - addr != PMD_SIZE)
+		return false;
+
+	ptl = pte_lockptr(src_mm, src_pmd);
+	spin_lock(ptl);
+	pmd = *src_pmd;
+	table = pmd_page(pmd);
+	if (pmd_write(pmd)) {
+		table->pt_share_count = 1;
+		table->pt_owner = src_mm;
+		pmd = pmd_wrprotect(pmd);
+		set_pmd(src_pmd, pmd);
+	}
+	table->pt_share_count++;
+	set_pmd(dst_pmd, pmd);
+	spin_unlock(ptl);
+	atomic_long_inc(&dst_mm->nr_ptes);
+
+	/* so that swapoff finds the swap entries of the table in dst_mm */
+	if (unlikely(!list_empty(&src_mm->mmlist)) &&
+	    list_empty(&dst_mm->mmlist)) {
+		spin_lock(&mmlist_lock);
+		if (list_empty(&dst_mm->mmlist))
+			list_add(&dst_mm->mmlist, &src_mm->mmlist);
+		spin_unlock(&mmlist_lock);
+	}
+	return true;
+}
+
+/* Undo the copy of the first @nr ptes of a table into @pte */
+static void pte_table_uncopy(struct vm_area_struct *vma, pte_t *pte,
+			     unsigned long addr, int nr)
+{
+	for (; nr; nr--, pte++, addr += PAGE_SIZE) {
+		pte_t ptent = *pte;
+
+		if (pte_none(ptent))
+			continue;
+		if (pte_present(ptent)) {
+			struct page *page = vm_normal_page(vma, addr, ptent);
+
+			if (page) {
+				page_remove_rmap(page);
+				put_page(page);
+			}
+		} else {
+			swp_entry_t entry = pte_to_swp_entry(ptent);
+
+			if (!non_swap_entry(entry))
+				swap_free(entry);
+		}
+		pte_clear(vma->vm_mm, addr, pte);
+	}
+}
+
+/**
+ * pte_table_unshare - give an mm its own copy of a pte table shared on fork
+ * @vma:	the vma of the mm, which is to change a pte at @address
+ * @pmd:	the pmd for @address
+ * @address:	the address
+ *
+ * Copies the table @pmd points to, as fork would have copied it, and points
+ * @pmd at the copy; or, if no other mm maps it any more, just makes @pmd
+ * writable again.  Called with mmap_sem held, which keeps the table from
+ * being shared again meanwhile.
+ *
+ * Returns 0, or -ENOMEM if no table could be allocated for the copy.
+ */
+int pte_table_unshare(struct vm_area_struct *vma, pmd_t *pmd,
+		      unsigned long address)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long start = address & PMD_MASK;
+	int rss[NR_MM_COUNTERS];
+	pgtable_t new = NULL;
+	struct page *table;
+	pte_t *src, *dst;
+	pmd_t orig_pmd, new_pmd;
+	swp_entry_t entry;
+	spinlock_t *ptl;
+	int i, ret = 0;
+
+again:
+	orig_pmd = *pmd;
+	barrier();
+	if (!pmd_shared(orig_pmd))
+		goto out;
+	table = pmd_page(orig_pmd);
+	ptl = pte_lockptr(mm, &orig_pmd);
+	spin_lock(ptl);
+	if (unlikely(!pmd_same(*pmd, orig_pmd))) {
+		spin_unlock(ptl);
+		goto again;
+	}
+	if (table->pt_share_count == 1) {
+		pte_table_adopt(mm, pmd, orig_pmd);
+		goto unlock;
+	}
+	if (!new) {
+		spin_unlock(ptl);
+		new = pte_alloc_one(mm, start);
+		if (!new)
+			return -ENOMEM;
+		pmd_populate(mm, &new_pmd, new);
+		goto again;
+	}
+
+	init_rss_vec(rss);
+	entry.val = 0;
+	src = pte_offset_map(&orig_pmd, start);
+	dst = pte_offset_map(&new_pmd, start);
+	for (i = 0; i < PTRS_PER_PTE; i++) {
+		if (pte_none(src[i]))
+			continue;
+		entry.val = copy_one_pte(mm, mm, dst + i, src + i, vma,
+					 start + i * PAGE_SIZE, rss);
+		if (entry.val)
+			break;
+	}
+	if (unlikely(entry.val)) {
+		/*
+		 * Start again once the swap count can be raised: the other
+		 * ptes might change while the table is unlocked.
+		 */
+		pte_table_uncopy(vma, dst, start, i);
+		pte_unmap(dst);
+		pte_unmap(src);
+		spin_unlock(ptl);
+		if (add_swap_count_continuation(entry, GFP_KERNEL) < 0) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		goto again;
+	}
+	pte_unmap(dst);
+	pte_unmap(src);
+
+	if (table->pt_owner == mm)
+		table->pt_owner = NULL;
+	else
+		add_mm_rss_vec(mm, rss);
+	table->pt_share_count--;
+	pmd_populate(mm, pmd, new);
+	new = NULL;
+	/* the other mms may free the table as soon as it is unlocked */
+	flush_tlb_range(vma, start, start + PMD_SIZE);
+unlock:
+	spin_unlock(ptl);
+out:
+	if (new)
+		pte_free(mm, new);
+	return ret;
+}
+
+/**
+ * unshare_pte_tables - give an mm its own copies of the pte tables of a range
+ * @vma:	the vma the range belongs to
+ * @start:	start of the range
+ * @end:	end of the range
+ *
+ * For a change to all the ptes of the range, such as mprotect()'s.  Called
+ * with mmap_sem held.  Returns 0, or -ENOMEM.
+ */
+int unshare_pte_tables(struct vm_area_struct *vma, unsigned long start,
+		       unsigned long end)
+{
+	unsigned long addr;
+	pmd_t *pmd;
+	int err;
+
+	for (addr = start & PMD_MASK; addr < end; addr += PMD_SIZE) {
+		pmd = mm_find_pmd(vma->vm_mm, addr);
+		if (pmd && pmd_shared(*pmd)) {
+			err = pte_table_unshare(vma, pmd, addr);
+			if (err)
+				return err;
+		}
+		cond_resched();
+	}
+	return 0;
+}
+
+/**
+ * unshare_pte_edges - give an mm its own copies of the tables at a range's ends
+ * @mm:		the mm
+ * @start:	start of the range
+ * @end:	end of the range
+ *
+ * Before [@start, @end) is unmapped: the shared tables it covers whole are
+ * just dropped by zapping, but those it covers only in part must be copied
+ * for the rest.  Called with mmap_sem held.  Returns 0, or -ENOMEM.
+ */
+int unshare_pte_edges(struct mm_struct *mm, unsigned long start,
+		      unsigned long end)
+{
+	struct vm_area_struct *vma;
+	int err = 0;
+
+	if (start & ~PMD_MASK) {
+		vma = find_vma(mm, start);
+		if (vma && vma->vm_start <= start)
+			err = unshare_pte_tables(vma, start, start + 1);
+	}
+	if (!err && (end & ~PMD_MASK)) {
+		vma = find_vma(mm, end - 1);
+		if (vma && vma->vm_start < end)
+			err = unshare_pte_tables(vma, end - 1, end);
+	}
+	return err;
+}
+
+/*
+ * The shared table @pmd points to is within [@addr, @end) being zapped.
+ * If the range covers it whole, just drop the reference to it, unless no
+ * other mm maps it: then it is made the mm's own, to be zapped as usual.
+ * Returns true if the table was dropped.
+ */
+static bool zap_shared_pte_table(struct mmu_gather *tlb,
+				 struct vm_area_struct *vma, pmd_t *pmd,
+				 unsigned long addr, unsigned long end)
+{
+	struct mm_struct *mm = tlb->mm;
+	unsigned long start = addr & PMD_MASK;
+	struct page *table;
+	spinlock_t *ptl;
+	pmd_t orig_pmd;
+
+	if (!tlb->fullmm && (addr != start || end - addr != PMD_SIZE)) {
+		/*
+		 * munmap() and madvise() unshared the tables at the edges of
+		 * the range beforehand: this one must span two vmas, and has
+		 * to be copied to zap only some of it.
+		 */
+		while (pte_table_unshare(vma, pmd, addr))
+			congestion_wait(BLK_RW_ASYNC, HZ/50);
+		return false;
+	}
+
+	orig_pmd = *pmd;
+	barrier();
+	if (!pmd_shared(orig_pmd))
+		return false;
+	table = pmd_page(orig_pmd);
+	ptl = pte_lockptr(mm, &orig_pmd);
+	spin_lock(ptl);
+	if (unlikely(!pmd_same(*pmd, orig_pmd))) {
+		spin_unlock(ptl);
+		return false;
+	}
+	if (table->pt_share_count == 1) {
+		pte_table_adopt(mm, pmd, orig_pmd);
+		spin_unlock(ptl);
+		return false;
+	}
+	if (table->pt_owner == mm) {
+		pte_table_charge(mm, orig_pmd, -1);
+		table->pt_owner = NULL;
+	}
+	table->pt_share_count--;
+	pmd_clear(pmd);
+	/* the other mms may free the table as soon as it is unlocked */
+	flush_tlb_range(vma, start, start + PMD_SIZE);
+	spin_unlock(ptl);
+	atomic_long_dec(&mm->nr_ptes);
+	return true;
+}
+#else
+static inline bool pte_table_share(struct mm_struct *dst_mm,
+				   struct mm_struct *src_mm, pmd_t *dst_pmd,
+				   pmd_t *src_pmd, struct vm_area_struct *vma,
+				   unsigned long addr, unsigned long end)
+{
+	return false;
+}
+
+static inline bool zap_shared_pte_table(struct mmu_gather *tlb,
+					struct vm_area_struct *vma,
+					pmd_t *pmd, unsigned long addr,
+					unsigned long end)
+{
+	return false;
+}
+#endif /* CONFIG_FORK_SHARE_PTE */
+
 int copy_pte_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		   pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma,
 		   unsigned long addr, unsigned long end)
@@ -967,6 +1341,9 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 		if (pmd_trans_huge(*src_pmd)) {
 			int err;
 			VM_BUG_ON(next-addr != HPAGE_PMD_SIZE);
+			/* the child faults DAX pfns in again for itself */
+			if (vma_huge_dax(vma))
+				continue;
 			err = copy_huge_pmd(dst_mm, src_mm,
 					    dst_pmd, src_pmd, addr, vma);
 			if (err == -ENOMEM)
@@ -977,6 +1354,9 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 		}
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
+		if (pte_table_share(dst_mm, src_mm, dst_pmd, src_pmd,
+				    vma, addr, next))
+			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
 						vma, addr, next))
 			return -ENOMEM;
@@ -1091,6 +1471,7 @@ again:
 	init_rss_vec(rss);
 	start_pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
 	pte = start_pte;
+	flush_tlb_batched_pending(mm);
 	arch_enter_lazy_mmu_mode();
 	do {
 		pte_t ptent = *pte;
@@ -1235,7 +1616,9 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		if (pmd_trans_huge(*pmd)) {
 			if (next - addr != HPAGE_PMD_SIZE) {
 #ifdef CONFIG_DEBUG_VM
-				if (!rwsem_is_locked(&tlb->mm->mmap_sem)) {
+				/* truncation splits teams without mmap_sem */
+				if (!rwsem_is_locked(&tlb->mm->mmap_sem) &&
+				    !vma_huge_team(vma) && !vma_huge_dax(vma)) {
 					pr_err("%s: mmap_sem is unlocked! addr=0x%lx end=0x%lx vma->vm_start=0x%lx vma->vm_end=0x%lx\n",
 						__func__, addr, end,
 						vma->vm_start,
@@ -1257,6 +1640,9 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		 */
 		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			goto next;
+		if (unlikely(pmd_shared(*pmd)) &&
+		    zap_shared_pte_table(tlb, vma, pmd, addr, next))
+			goto next;
 		next = zap_pte_range(tlb, vma, pmd, addr, next, details);
 next:
 		cond_resched();
@@ -1530,7 +1916,14 @@ struct page *follow_page_mask(struct vm_area_struct *vma,
 	if ((flags & FOLL_NUMA) && pmd_numa(*pmd))
 		goto no_page_table;
 	if (pmd_trans_huge(*pmd)) {
-		if (flags & FOLL_SPLIT) {
+		/*
+		 * A team of small pages is mlocked, munlocked and dumped
+		 * page by page: give those callers ptes to work on.  DAX
+		 * pfns have no huge page to return at all.
+		 */
+		if ((flags & FOLL_SPLIT) || vma_huge_dax(vma) ||
+		    ((flags & (FOLL_MLOCK | FOLL_DUMP)) &&
+		     vma_huge_team(vma))) {
 			split_huge_page_pmd(vma, address, pmd);
 			goto split_fallthrough;
 		}
@@ -1553,6 +1946,9 @@ struct page *follow_page_mask(struct vm_area_struct *vma,
 split_fallthrough:
 	if (unlikely(pmd_bad(*pmd)))
 		goto no_page_table;
+	/* a table shared since fork is to be unshared by a write fault */
+	if ((flags & FOLL_WRITE) && pmd_shared(*pmd))
+		goto no_page_table;
 
 	ptep = pte_offset_map_lock(mm, pmd, address, &ptl);
 
@@ -1859,6 +2255,11 @@ long __get_user_pages(struct task_struct *tsk, struct mm_struct *mm,
 					fault_flags |= FAULT_FLAG_ALLOW_RETRY;
 				if (foll_flags & FOLL_NOWAIT)
 					fault_flags |= (FAULT_FLAG_ALLOW_RETRY | FAULT_FLAG_RETRY_NOWAIT);
+				if (foll_flags & FOLL_TRIED) {
+					WARN_ON_ONCE(fault_flags &
+						     FAULT_FLAG_ALLOW_RETRY);
+					fault_flags |= FAULT_FLAG_TRIED;
+				}
 
 				ret = handle_mm_fault(mm, vma, start,
 							fault_flags);
@@ -2068,6 +2469,83 @@ long get_user_pages(struct task_struct *tsk, struct mm_struct *mm,
 }
 EXPORT_SYMBOL(get_user_pages);
 
+/**
+ * get_user_pages_unlocked() - pin user pages, taking mmap_sem as needed
+ * @tsk:	the task_struct to use for page fault accounting, or
+ *		NULL if faults are not to be recorded.
+ * @mm:		mm_struct of target mm
+ * @start:	starting user address
+ * @nr_pages:	number of pages from start to pin
+ * @write:	whether pages will be written to by the caller
+ * @force:	whether to force access even when user mapping is currently
+ *		protected (but never forces write access to shared mapping).
+ * @pages:	array that receives pointers to the pages pinned.
+ *		Should be at least nr_pages long.
+ *
+ * This is get_user_pages() for callers which don't hold mmap_sem and have
+ * no use for the vmas: it takes mmap_sem for read itself, and lets the
+ * faults drop it and retry, as the page fault handler does.  That way the
+ * fault can wait for I/O, or for userspace to resolve a userfault, without
+ * holding up writers of mmap_sem.
+ *
+ * Returns number of pages pinned, as get_user_pages() does.
+ */
+long get_user_pages_unlocked(struct task_struct *tsk, struct mm_struct *mm,
+			     unsigned long start, unsigned long nr_pages,
+			     int write, int force, struct page **pages)
+{
+	unsigned int flags = FOLL_TOUCH | FOLL_GET;
+	long ret, pages_done = 0;
+	int locked;
+
+	if (write)
+		flags |= FOLL_WRITE;
+	if (force)
+		flags |= FOLL_FORCE;
+
+	for (;;) {
+		locked = 1;
+		down_read(&mm->mmap_sem);
+		ret = __get_user_pages(tsk, mm, start, nr_pages, flags, pages,
+				       NULL, &locked);
+		if (ret < 0) {
+			if (locked)
+				up_read(&mm->mmap_sem);
+			return pages_done ? pages_done : ret;
+		}
+		pages_done += ret;
+		nr_pages -= ret;
+		if (locked || !nr_pages) {
+			/* done, or failed pinning the next page */
+			if (locked)
+				up_read(&mm->mmap_sem);
+			return pages_done;
+		}
+
+		/*
+		 * The fault dropped mmap_sem to wait: take it again and
+		 * repeat the fault on that page, this time without letting
+		 * it retry, as the page fault handler does on its second try.
+		 */
+		pages += ret;
+		start += ret << PAGE_SHIFT;
+
+		down_read(&mm->mmap_sem);
+		ret = __get_user_pages(tsk, mm, start, 1, flags | FOLL_TRIED,
+				       pages, NULL, NULL);
+		up_read(&mm->mmap_sem);
+		if (ret != 1)
+			return pages_done ? pages_done : ret;
+		pages_done++;
+		nr_pages--;
+		if (!nr_pages)
+			return pages_done;
+		pages++;
+		start += PAGE_SIZE;
+	}
+}
+EXPORT_SYMBOL(get_user_pages_unlocked);
+
 /**
  * get_dump_page() - pin user page in memory while writing it to core dump
  * @addr: user address
@@ -2647,6 +3125,7 @@ static int do_page_mkwrite(struct vm_area_struct *vma, struct page *page,
 	vmf.pgoff = page->index;
 	vmf.flags = FAULT_FLAG_WRITE|FAULT_FLAG_MKWRITE;
 	vmf.page = page;
+	vmf.cow_page = NULL;
 
 	ret = vma->vm_ops->page_mkwrite(vma, &vmf);
 	if (unlikely(ret & (VM_FAULT_ERROR | VM_FAULT_NOPAGE)))
@@ -3074,10 +3553,14 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		goto out;
 	}
 	delayacct_set_flag(DELAYACCT_PF_SWAPIN);
-	page = lookup_swap_cache(entry);
+	page = lookup_swap_cache(entry, vma, address);
 	if (!page) {
-		page = swapin_readahead(entry,
-					GFP_HIGHUSER_MOVABLE, vma, address);
+		if (swap_use_vma_readahead())
+			page = swap_vma_readahead(entry, GFP_HIGHUSER_MOVABLE,
+						  vma, address, pmd);
+		else
+			page = swapin_readahead(entry, GFP_HIGHUSER_MOVABLE,
+						vma, address);
 		if (!page) {
 			/*
 			 * Back out if somebody else faulted in this pte
@@ -3285,6 +3768,12 @@ static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
 		if (!pte_none(*page_table))
 			goto unlock;
+		/* Deliver the page fault to userland, check inside PT lock */
+		if (userfaultfd_missing(vma)) {
+			pte_unmap_unlock(page_table, ptl);
+			return handle_userfault(vma, address, flags,
+						VM_UFFD_MISSING);
+		}
 		goto setpte;
 	}
 
@@ -3312,6 +3801,15 @@ static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	if (!pte_none(*page_table))
 		goto release;
 
+	/* Deliver the page fault to userland, check inside PT lock */
+	if (userfaultfd_missing(vma)) {
+		pte_unmap_unlock(page_table, ptl);
+		mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+		return handle_userfault(vma, address, flags,
+					VM_UFFD_MISSING);
+	}
+
 	inc_mm_counter_fast(mm, MM_ANONPAGES);
 	page_add_new_anon_rmap(page, vma, address);
 setpte:
@@ -3332,8 +3830,17 @@ oom:
 	return VM_FAULT_OOM;
 }
 
+/*
+ * The mmap_sem must have been held on entry, and may have been
+ * released depending on flags and vma->vm_ops->fault() return value.
+ *
+ * If @cow_page is passed, the handler may copy the data into it itself
+ * and return VM_FAULT_LOCKED with no page, holding i_mmap_mutex instead
+ * of a page lock.  DAX does this, having no page cache page to copy.
+ */
 static int __do_fault(struct vm_area_struct *vma, unsigned long address,
-		pgoff_t pgoff, unsigned int flags, struct page **page)
+		pgoff_t pgoff, unsigned int flags, struct page *cow_page,
+		struct page **page)
 {
 	struct vm_fault vmf;
 	int ret;
@@ -3342,10 +3849,13 @@ static int __do_fault(struct vm_area_struct *vma, unsigned long address,
 	vmf.pgoff = pgoff;
 	vmf.flags = flags;
 	vmf.page = NULL;
+	vmf.cow_page = cow_page;
 
 	ret = vma->vm_ops->fault(vma, &vmf);
 	if (unlikely(ret & (VM_FAULT_ERROR | VM_FAULT_NOPAGE | VM_FAULT_RETRY)))
 		return ret;
+	if (!vmf.page)
+		goto out;
 
 	if (unlikely(PageHWPoison(vmf.page))) {
 		if (ret & VM_FAULT_LOCKED)
@@ -3359,6 +3869,7 @@ static int __do_fault(struct vm_area_struct *vma, unsigned long address,
 	else
 		VM_BUG_ON_PAGE(!PageLocked(vmf.page), vmf.page);
 
+ out:
 	*page = vmf.page;
 	return ret;
 }
@@ -3523,7 +4034,7 @@ static int do_read_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 		pte_unmap_unlock(pte, ptl);
 	}
 
-	ret = __do_fault(vma, address, pgoff, flags, &fault_page);
+	ret = __do_fault(vma, address, pgoff, flags, NULL, &fault_page);
 	if (unlikely(ret & (VM_FAULT_ERROR | VM_FAULT_NOPAGE | VM_FAULT_RETRY)))
 		return ret;
 
@@ -3562,24 +4073,37 @@ static int do_cow_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 		return VM_FAULT_OOM;
 	}
 
-	ret = __do_fault(vma, address, pgoff, flags, &fault_page);
+	ret = __do_fault(vma, address, pgoff, flags, new_page, &fault_page);
 	if (unlikely(ret & (VM_FAULT_ERROR | VM_FAULT_NOPAGE | VM_FAULT_RETRY)))
 		goto uncharge_out;
 
-	copy_user_highpage(new_page, fault_page, address, vma);
+	if (fault_page)
+		copy_user_highpage(new_page, fault_page, address, vma);
 	__SetPageUptodate(new_page);
 
 	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
 	if (unlikely(!pte_same(*pte, orig_pte))) {
 		pte_unmap_unlock(pte, ptl);
-		unlock_page(fault_page);
-		page_cache_release(fault_page);
+		if (fault_page) {
+			unlock_page(fault_page);
+			page_cache_release(fault_page);
+		} else {
+			/*
+			 * The fault handler has no page to lock, so it holds
+			 * i_mmap_mutex for us to stop truncation races.
+			 */
+			mutex_unlock(&vma->vm_file->f_mapping->i_mmap_mutex);
+		}
 		goto uncharge_out;
 	}
 	do_set_pte(vma, address, new_page, pte, true, true);
 	pte_unmap_unlock(pte, ptl);
-	unlock_page(fault_page);
-	page_cache_release(fault_page);
+	if (fault_page) {
+		unlock_page(fault_page);
+		page_cache_release(fault_page);
+	} else {
+		mutex_unlock(&vma->vm_file->f_mapping->i_mmap_mutex);
+	}
 	return ret;
 uncharge_out:
 	mem_cgroup_uncharge_page(new_page);
@@ -3598,7 +4122,7 @@ static int do_shared_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	int dirtied = 0;
 	int ret, tmp;
 
-	ret = __do_fault(vma, address, pgoff, flags, &fault_page);
+	ret = __do_fault(vma, address, pgoff, flags, NULL, &fault_page);
 	if (unlikely(ret & (VM_FAULT_ERROR | VM_FAULT_NOPAGE | VM_FAULT_RETRY)))
 		return ret;
 
@@ -3880,7 +4404,11 @@ static int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
+	if (pmd_none(*pmd) && (vma_huge_team(vma) || vma_huge_dax(vma))) {
+		int ret = vma->vm_ops->pmd_fault(vma, address, pmd, flags);
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	} else if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
 		int ret = VM_FAULT_FALLBACK;
 		if (!vma->vm_ops)
 			ret = do_huge_pmd_anonymous_page(mm, vma, address,
@@ -3907,7 +4435,11 @@ static int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 				return do_huge_pmd_numa_page(mm, vma, address,
 							     orig_pmd, pmd);
 
-			if (dirty && !pmd_write(orig_pmd)) {
+			if (dirty && !pmd_write(orig_pmd) &&
+			    (vma_huge_team(vma) || vma_huge_dax(vma))) {
+				/* let the pte fault path handle the write */
+				split_huge_page_pmd(vma, address, pmd);
+			} else if (dirty && !pmd_write(orig_pmd)) {
 				ret = do_huge_pmd_wp_page(mm, vma, address, pmd,
 							  orig_pmd);
 				if (!(ret & VM_FAULT_FALLBACK))
@@ -3931,6 +4463,9 @@ static int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	/* if an huge pmd materialized from under us just retry later */
 	if (unlikely(pmd_trans_huge(*pmd)))
 		return 0;
+	/* the pte may be changed: copy a table still shared since fork */
+	if (unlikely(pmd_shared(*pmd)) && pte_table_unshare(vma, pmd, address))
+		return VM_FAULT_OOM;
 	/*
 	 * A regular pmd is established and it can't morph into a huge pmd
 	 * from under us anymore at this point because we hold the mmap_sem
@@ -3979,6 +4514,264 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return ret;
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Speculative page faults.
+ *
+ * A fault on a vma that the faulting task has looked up recently can often
+ * be resolved without mmap_sem: find the vma in the task's vmacache, copy
+ * it under its vm_sequence count, and then work from the copy with no lock
+ * but the page table lock.  Before anything is written to the page table,
+ * the copy is validated with that lock held: a vma which is changed bumps
+ * its vm_sequence, one that is unlinked bumps mm->vmacache_seqnum, and both
+ * happen before its page tables are modified under the same lock.  vmas
+ * are SLAB_DESTROY_BY_RCU, so the lookup may only see a stale one, never
+ * freed memory; and interrupts are kept disabled from the page table walk
+ * until we are done with the pte, so that, as for get_user_pages_fast(),
+ * page tables cannot be freed or pmds cleared under us.
+ *
+ * Only the simplest faults are attempted: first touch of anonymous memory,
+ * file read faults that ->map_pages() can satisfy from the page cache, and
+ * faults that only have to set the accessed or dirty bit.  Anything else,
+ * or losing any race, returns VM_FAULT_RETRY to send the caller down the
+ * usual path under mmap_sem.
+ */
+static struct vm_area_struct *spf_find_vma(struct mm_struct *mm,
+					   unsigned long address, u32 *seqnum)
+{
+	struct task_struct *curr = current;
+	struct vm_area_struct *vma;
+	int i;
+
+	*seqnum = curr->vmacache_seqnum;
+	if (ACCESS_ONCE(mm->vmacache_seqnum) != *seqnum)
+		return NULL;
+
+	for (i = 0; i < VMACACHE_SIZE; i++) {
+		vma = ACCESS_ONCE(curr->vmacache[i]);
+		/* the entry means nothing once the mm's seqnum moved on */
+		smp_rmb();
+		if (ACCESS_ONCE(mm->vmacache_seqnum) != *seqnum)
+			return NULL;
+		if (vma && vma->vm_mm == mm &&
+		    vma->vm_start <= address && address < vma->vm_end)
+			return vma;
+	}
+	return NULL;
+}
+
+/*
+ * Can the fault be handled from the snapshot @vma at all?  Stack guard page
+ * faults may need to expand the stack, and mlocked, nonlinear, special or
+ * userfaultfd registered vmas need the care of the usual path.
+ */
+static bool spf_vma_suitable(struct vm_area_struct *vma, unsigned long address,
+			     unsigned int flags)
+{
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(vma->vm_flags & VM_WRITE))
+			return false;
+	} else if (!(vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE))) {
+		return false;
+	}
+
+	if (vma->vm_flags & (VM_LOCKED | VM_NONLINEAR | VM_HUGETLB |
+			     VM_PFNMAP | VM_MIXEDMAP | VM_IO | VM_UFFD_MISSING))
+		return false;
+	if ((vma->vm_flags & VM_GROWSDOWN) &&
+	    address - vma->vm_start < PAGE_SIZE)
+		return false;
+	if ((vma->vm_flags & VM_GROWSUP) && vma->vm_end - address <= PAGE_SIZE)
+		return false;
+
+	/* anon_vma_prepare() may sleep, leave that to the usual path */
+	if (!vma->vm_ops)
+		return !(flags & FAULT_FLAG_WRITE) || vma->anon_vma;
+
+	return !(flags & FAULT_FLAG_WRITE) && vma->vm_ops->map_pages &&
+		fault_around_pages() > 1;
+}
+
+/*
+ * Walk to the pte for @address and trylock its page table.  On success
+ * returns the mapped pte, locked, with interrupts disabled; otherwise NULL.
+ */
+static pte_t *spf_lock_pte(struct mm_struct *mm, unsigned long address,
+			   spinlock_t **ptlp)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, orig_pmd;
+	spinlock_t *ptl;
+
+	local_irq_disable();
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		goto fail;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		goto fail;
+	pmd = pmd_offset(pud, address);
+	/* see the comment on pmd reads in get_user_pages_fast() */
+	orig_pmd = *pmd;
+	barrier();
+	if (!pmd_present(orig_pmd) || pmd_trans_huge(orig_pmd) ||
+	    pmd_bad(orig_pmd) || pmd_shared(orig_pmd))
+		goto fail;
+	smp_rmb();
+
+	ptl = pte_lockptr(mm, &orig_pmd);
+	if (!spin_trylock(ptl))
+		goto fail;
+	if (!pmd_same(*pmd, orig_pmd)) {
+		spin_unlock(ptl);
+		goto fail;
+	}
+	*ptlp = ptl;
+	return pte_offset_map(&orig_pmd, address);
+fail:
+	local_irq_enable();
+	return NULL;
+}
+
+static void spf_unlock_pte(pte_t *pte, spinlock_t *ptl)
+{
+	pte_unmap_unlock(pte, ptl);
+	local_irq_enable();
+}
+
+/*
+ * With the page table lock held, check that @vma is still the vma that
+ * was snapshotted: still in the mm, and unchanged.
+ */
+static bool spf_vma_unchanged(struct mm_struct *mm, struct vm_area_struct *vma,
+			      unsigned int seq, u32 seqnum)
+{
+	if (ACCESS_ONCE(mm->vmacache_seqnum) != seqnum)
+		return false;
+	return !read_seqcount_retry(&vma->vm_sequence, seq);
+}
+
+/**
+ * handle_speculative_fault - try to handle a user fault without mmap_sem
+ * @mm:		the faulting mm, current->mm
+ * @address:	the faulting address
+ * @flags:	FAULT_FLAG_xxx flags
+ *
+ * Called by an architecture's fault handler before it takes mmap_sem, for
+ * faults from user mode.  Returns 0 if the fault was handled, else
+ * VM_FAULT_RETRY, and the fault must be handled the usual way.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_area_struct *vma, snap;
+	struct page *page = NULL;
+	spinlock_t *ptl;
+	pte_t *pte, entry;
+	unsigned int seq;
+	u32 seqnum;
+	int ret = VM_FAULT_RETRY;
+
+	rcu_read_lock();
+	vma = spf_find_vma(mm, address, &seqnum);
+	if (!vma) {
+		rcu_read_unlock();
+		return VM_FAULT_RETRY;
+	}
+	seq = raw_seqcount_begin(&vma->vm_sequence);
+	snap = *vma;
+	if (read_seqcount_retry(&vma->vm_sequence, seq) ||
+	    snap.vm_mm != mm || address < snap.vm_start ||
+	    address >= snap.vm_end || vma_policy(&snap) ||
+	    !spf_vma_suitable(&snap, address, flags))
+		goto out_rcu;
+
+again:
+	pte = spf_lock_pte(mm, address, &ptl);
+	if (!pte)
+		goto out_rcu;
+	if (!spf_vma_unchanged(mm, vma, seq, seqnum))
+		goto unlock;
+
+	entry = *pte;
+	if (pte_present(entry)) {
+		if (pte_numa(entry))
+			goto unlock;
+		if (flags & FAULT_FLAG_WRITE) {
+			if (!pte_write(entry))
+				goto unlock;
+			entry = pte_mkdirty(entry);
+		}
+		entry = pte_mkyoung(entry);
+		if (ptep_set_access_flags(vma, address, pte, entry,
+					  flags & FAULT_FLAG_WRITE))
+			update_mmu_cache(vma, address, pte);
+		else if (flags & FAULT_FLAG_WRITE)
+			flush_tlb_fix_spurious_fault(vma, address);
+		ret = 0;
+	} else if (!pte_none(entry)) {
+		/* swap, migration or nonlinear file pte */
+		goto unlock;
+	} else if (snap.vm_ops) {
+		do_fault_around(vma, address, pte,
+				linear_page_index(&snap, address), flags);
+		if (!pte_none(*pte))
+			ret = 0;
+	} else if (!(flags & FAULT_FLAG_WRITE)) {
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+					      snap.vm_page_prot));
+		set_pte_at(mm, address, pte, entry);
+		update_mmu_cache(vma, address, pte);
+		ret = 0;
+	} else if (page) {
+		entry = mk_pte(page, snap.vm_page_prot);
+		entry = pte_mkwrite(pte_mkdirty(entry));
+		inc_mm_counter_fast(mm, MM_ANONPAGES);
+		page_add_new_anon_rmap(page, vma, address);
+		set_pte_at(mm, address, pte, entry);
+		update_mmu_cache(vma, address, pte);
+		page = NULL;
+		ret = 0;
+	} else {
+		/* first write to this anonymous page: get one and retry */
+		spf_unlock_pte(pte, ptl);
+		rcu_read_unlock();
+
+		page = alloc_zeroed_user_highpage_movable(&snap, address);
+		if (!page)
+			return VM_FAULT_RETRY;
+		/* see do_anonymous_page() */
+		__SetPageUptodate(page);
+		if (mem_cgroup_charge_anon(page, mm, GFP_KERNEL)) {
+			page_cache_release(page);
+			return VM_FAULT_RETRY;
+		}
+
+		rcu_read_lock();
+		goto again;
+	}
+
+unlock:
+	spf_unlock_pte(pte, ptl);
+out_rcu:
+	rcu_read_unlock();
+
+	if (page) {
+		mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+	}
+
+	if (!ret) {
+		count_vm_event(PGFAULT);
+		count_vm_event(SPECULATIVE_PGFAULT);
+		mem_cgroup_count_vm_event(mm, PGFAULT);
+		check_sync_rss_stat(current);
+	}
+	return ret;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
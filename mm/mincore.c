@@ -15,6 +15,8 @@
 #include <linux/swap.h>
 #include <linux/swapops.h>
 #include <linux/hugetlb.h>
+#include <linux/slab.h>
+#include <linux/fincore.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
@@ -315,3 +317,197 @@ SYSCALL_DEFINE3(mincore, unsigned long, start, size_t, len,
 	free_page((unsigned long) tmp);
 	return retval;
 }
+
+/*
+ * FS_IOC_FINCORE: the page cache of a file, walked under rcu_read_lock()
+ * and reported as extents, without mapping it or looking at every index.
+ */
+#define FINCORE_BATCH		16	/* extents gathered per copy out */
+#define FINCORE_SCAN_BATCH	4096	/* slots looked at per rcu section */
+
+enum {
+	FINCORE_DONE,
+	FINCORE_FULL,
+	FINCORE_RESCHED,
+};
+
+struct fincore_control {
+	struct fincore_extent ext[FINCORE_BATCH];
+	unsigned int nr;		/* extents in ext[] */
+	unsigned int max;		/* room in ext[] for this batch */
+	pgoff_t next;			/* index just past ext[nr - 1] */
+	unsigned int iter_flags;	/* RADIX_TREE_ITER_* to walk with */
+	__u32 state;			/* FINCORE_* to report */
+};
+
+/*
+ * Gathers extents from *@index up to @end, merging adjacent pages into the
+ * last one. Stops when a new extent would not fit, or after looking at
+ * FINCORE_SCAN_BATCH slots, with *@index updated to where to continue.
+ */
+static int fincore_walk(struct address_space *mapping,
+			struct fincore_control *fc, pgoff_t *index, pgoff_t end)
+{
+	struct radix_tree_iter iter;
+	unsigned int scanned = 0;
+	void **slot;
+
+restart:
+	radix_tree_for_each_chunk(slot, &mapping->page_tree, &iter, *index,
+				  fc->iter_flags) {
+		radix_tree_for_each_chunk_slot(slot, &iter, fc->iter_flags) {
+			struct fincore_extent *ext;
+			void *entry;
+
+			if (iter.index > end)
+				goto done;
+			if (++scanned > FINCORE_SCAN_BATCH) {
+				*index = iter.index;
+				return FINCORE_RESCHED;
+			}
+
+			entry = radix_tree_deref_slot(slot);
+			if (unlikely(!entry))
+				continue;
+			if (radix_tree_exception(entry)) {
+				if (radix_tree_deref_retry(entry)) {
+					if (fc->nr)
+						*index = fc->next;
+					goto restart;
+				}
+				/*
+				 * A shadow entry of an evicted page, or a
+				 * swapped out shmem page: not resident.
+				 */
+				continue;
+			}
+
+			if (fc->nr && iter.index == fc->next) {
+				ext = &fc->ext[fc->nr - 1];
+				ext->fe_length += PAGE_CACHE_SIZE;
+			} else {
+				if (fc->nr == fc->max) {
+					*index = iter.index;
+					return FINCORE_FULL;
+				}
+				ext = &fc->ext[fc->nr++];
+				ext->fe_offset = (__u64)iter.index <<
+						 PAGE_CACHE_SHIFT;
+				ext->fe_length = PAGE_CACHE_SIZE;
+				ext->fe_flags = fc->state;
+				ext->fe_reserved = 0;
+			}
+			fc->next = iter.index + 1;
+		}
+	}
+done:
+	*index = end + 1;
+	return FINCORE_DONE;
+}
+
+/**
+ * filemap_fincore - report which parts of a file are in the page cache
+ * @mapping:	the address_space of the file
+ * @fr:		the range and state asked for, updated with the result
+ * @uext:	where to copy the extents found
+ *
+ * Reports the pages of @mapping in the range of @fr which are in the one
+ * state of @fr->fr_flags, as up to @fr->fr_extent_count extents of
+ * adjacent pages. Cached pages are found by walking the populated nodes of
+ * the radix tree, dirty and writeback pages by walking just the nodes
+ * tagged with them, so the cost does not grow with the size of a sparsely
+ * cached file. The result is a snapshot which may be stale by the time it
+ * is returned; a page still being read in counts as cached.
+ *
+ * @fr->fr_extent_count is set to the number of extents copied out, and
+ * @fr->fr_next to the offset at which to call again for more, which is
+ * the end of the range once it has all been walked.
+ */
+int filemap_fincore(struct address_space *mapping, struct fincore_range *fr,
+		    struct fincore_extent __user *uext)
+{
+	struct fincore_control *fc;
+	unsigned int filled = 0;
+	pgoff_t index, end;
+	u64 last;
+	int ret = FINCORE_FULL;
+	int error = 0;
+
+	if (!fr->fr_flags || (fr->fr_flags & ~FINCORE_FLAGS_ALL) ||
+	    (fr->fr_flags & (fr->fr_flags - 1)))
+		return -EINVAL;
+	if (fr->fr_extent_count > FINCORE_MAX_EXTENTS)
+		return -EINVAL;
+	if (fr->fr_start > MAX_LFS_FILESIZE)
+		return -EFBIG;
+
+	if (!fr->fr_length) {
+		fr->fr_extent_count = 0;
+		fr->fr_next = fr->fr_start;
+		return 0;
+	}
+
+	if (!access_ok(VERIFY_WRITE, uext,
+		       fr->fr_extent_count * sizeof(struct fincore_extent)))
+		return -EFAULT;
+
+	fc = kmalloc(sizeof(*fc), GFP_KERNEL);
+	if (!fc)
+		return -ENOMEM;
+
+	fc->state = fr->fr_flags;
+	switch (fc->state) {
+	case FINCORE_DIRTY:
+		fc->iter_flags = RADIX_TREE_ITER_TAGGED | PAGECACHE_TAG_DIRTY;
+		break;
+	case FINCORE_WRITEBACK:
+		fc->iter_flags = RADIX_TREE_ITER_TAGGED |
+				 PAGECACHE_TAG_WRITEBACK;
+		break;
+	default:
+		fc->iter_flags = 0;
+		break;
+	}
+
+	last = fr->fr_start + fr->fr_length - 1;
+	if (fr->fr_length > MAX_LFS_FILESIZE - fr->fr_start)
+		last = MAX_LFS_FILESIZE;
+	index = fr->fr_start >> PAGE_CACHE_SHIFT;
+	end = last >> PAGE_CACHE_SHIFT;
+
+	while (filled < fr->fr_extent_count) {
+		fc->nr = 0;
+		fc->max = min_t(unsigned int, FINCORE_BATCH,
+				fr->fr_extent_count - filled);
+		for (;;) {
+			rcu_read_lock();
+			ret = fincore_walk(mapping, fc, &index, end);
+			rcu_read_unlock();
+			if (ret != FINCORE_RESCHED)
+				break;
+			if (fatal_signal_pending(current)) {
+				error = -EINTR;
+				goto out;
+			}
+			cond_resched();
+		}
+
+		if (__copy_to_user(uext + filled, fc->ext,
+				   fc->nr * sizeof(struct fincore_extent))) {
+			error = -EFAULT;
+			goto out;
+		}
+		filled += fc->nr;
+		if (ret == FINCORE_DONE)
+			break;
+	}
+
+	fr->fr_extent_count = filled;
+	if (ret == FINCORE_DONE)
+		fr->fr_next = last + 1;
+	else
+		fr->fr_next = (u64)index << PAGE_CACHE_SHIFT;
+out:
+	kfree(fc);
+	return error;
+}
@@ -136,6 +136,7 @@ static void move_ptes(struct vm_area_struct *vma, pmd_t *old_pmd,
 	new_ptl = pte_lockptr(mm, new_pmd);
 	if (new_ptl != old_ptl)
 		spin_lock_nested(new_ptl, SINGLE_DEPTH_NESTING);
+	flush_tlb_batched_pending(mm);
 	arch_enter_lazy_mmu_mode();
 
 	for (; old_addr < old_end; old_pte++, old_addr += PAGE_SIZE,
@@ -194,7 +195,9 @@ unsigned long move_page_tables(struct vm_area_struct *vma,
 			break;
 		if (pmd_trans_huge(*old_pmd)) {
 			int err = 0;
-			if (extent == HPAGE_PMD_SIZE) {
+			/* teams, DAX: split, move_ptes() takes i_mmap_mutex */
+			if (extent == HPAGE_PMD_SIZE && !vma_huge_team(vma) &&
+			    !vma_huge_dax(vma)) {
 				VM_BUG_ON(vma->vm_file || !vma->anon_vma);
 				/* See comment in move_ptes() */
 				if (need_rmap_locks)
@@ -213,6 +216,13 @@ unsigned long move_page_tables(struct vm_area_struct *vma,
 			}
 			VM_BUG_ON(pmd_trans_huge(*old_pmd));
 		}
+		/* ptes are not to be moved out of or into a shared table */
+		if (pmd_shared(*old_pmd) &&
+		    pte_table_unshare(vma, old_pmd, old_addr))
+			break;
+		if (pmd_shared(*new_pmd) &&
+		    pte_table_unshare(new_vma, new_pmd, new_addr))
+			break;
 		if (pmd_none(*new_pmd) && __pte_alloc(new_vma->vm_mm, new_vma,
 						      new_pmd, new_addr))
 			break;
@@ -273,8 +283,19 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 	if (!new_vma)
 		return -ENOMEM;
 
+	/*
+	 * A speculative fault must not put a pte back in the old range once
+	 * move_page_tables() has passed it, nor fill the new range (which
+	 * copy_vma() may have merged into a vma in use) before it arrives.
+	 */
+	vm_write_begin(vma);
+	if (new_vma != vma)
+		vm_write_begin(new_vma);
 	moved_len = move_page_tables(vma, old_addr, new_vma, new_addr, old_len,
 				     need_rmap_locks);
+	if (new_vma != vma)
+		vm_write_end(new_vma);
+	vm_write_end(vma);
 	if (moved_len < old_len) {
 		/*
 		 * On error, move entries back from new area to old,
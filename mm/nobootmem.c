@@ -116,9 +116,13 @@ static unsigned long __init __free_memory_core(phys_addr_t start,
 static unsigned long __init free_low_memory_core_early(void)
 {
 	unsigned long count = 0;
+	struct memblock_region *reg;
 	phys_addr_t start, end;
 	u64 i;
 
+	for_each_memblock(reserved, reg)
+		init_reserved_region(reg->base, reg->base + reg->size);
+
 	for_each_free_mem_range(i, NUMA_NO_NODE, &start, &end, NULL)
 		count += __free_memory_core(start, end);
 
@@ -131,10 +135,15 @@ static unsigned long __init free_low_memory_core_early(void)
 		if (size)
 			count += __free_memory_core(start, start + size);
 
-		/* Free memblock.memory array if it was allocated */
+#ifndef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+		/*
+		 * Free memblock.memory array if it was allocated: the deferred
+		 * struct page initialisation still walks it, so keep it then.
+		 */
 		size = get_allocated_memblock_memory_regions_info(&start);
 		if (size)
 			count += __free_memory_core(start, start + size);
+#endif
 	}
 #endif
 
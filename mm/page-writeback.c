@@ -37,6 +37,7 @@
 #include <linux/timer.h>
 #include <linux/sched/rt.h>
 #include <linux/mm_inline.h>
+#include <linux/memcontrol.h>
 #include <trace/events/writeback.h>
 
 #include "internal.h"
@@ -309,6 +310,30 @@ void global_dirty_limits(unsigned long *pbackground, unsigned long *pdirty)
 	trace_global_dirty_state(background, dirty);
 }
 
+#ifdef CONFIG_CGROUP_WRITEBACK
+/**
+ * wb_dirty_limits - writeback and throttling thresholds of a cgroup wb
+ * @wb: a cgroup wb
+ * @pbackground: out parameter for the background threshold
+ * @pdirty: out parameter for the dirty threshold
+ *
+ * The global thresholds, scaled down to the memory which the memory cgroup
+ * of @wb could give to dirty page cache: so that a cgroup dirtying a lot is
+ * throttled, and its inodes written back, on its own.
+ */
+void wb_dirty_limits(struct bdi_writeback *wb, unsigned long *pbackground,
+		     unsigned long *pdirty)
+{
+	unsigned long global_avail = global_dirtyable_memory();
+	unsigned long avail;
+
+	avail = min(mem_cgroup_dirtyable_pages(wb->memcg_css), global_avail);
+	global_dirty_limits(pbackground, pdirty);
+	*pbackground = div64_u64((u64)*pbackground * avail, global_avail);
+	*pdirty = div64_u64((u64)*pdirty * avail, global_avail);
+}
+#endif
+
 /**
  * zone_dirty_limit - maximum number of dirty pages allowed in a zone
  * @zone: the zone
@@ -1375,6 +1400,10 @@ static void balance_dirty_pages(struct address_space *mapping,
 	struct backing_dev_info *bdi = mapping->backing_dev_info;
 	bool strictlimit = bdi->capabilities & BDI_CAP_STRICTLIMIT;
 	unsigned long start_time = jiffies;
+#ifdef CONFIG_CGROUP_WRITEBACK
+	struct bdi_writeback *wb = mapping->host ?
+				   inode_to_wb(mapping->host) : &bdi->wb;
+#endif
 
 	for (;;) {
 		unsigned long now = jiffies;
@@ -1383,6 +1412,8 @@ static void balance_dirty_pages(struct address_space *mapping,
 		unsigned long uninitialized_var(bdi_dirty);
 		unsigned long dirty;
 		unsigned long bg_thresh;
+		unsigned long cg_thresh = 0, cg_bg_thresh = 0, cg_dirty = 0;
+		bool cg_exceeded = false;
 
 		/*
 		 * Unstable writes are a feature of certain networked
@@ -1408,6 +1439,19 @@ static void balance_dirty_pages(struct address_space *mapping,
 			bg_thresh = background_thresh;
 		}
 
+#ifdef CONFIG_CGROUP_WRITEBACK
+		/*
+		 * The dirtier of a cgroup wb is also held to the limits of
+		 * its memory cgroup, whatever the global state.
+		 */
+		if (!wb_is_root(wb)) {
+			wb_dirty_limits(wb, &cg_bg_thresh, &cg_thresh);
+			cg_dirty = wb_dirty_pages(wb);
+			cg_exceeded = cg_dirty >
+				dirty_freerun_ceiling(cg_thresh, cg_bg_thresh);
+		}
+#endif
+
 		/*
 		 * Throttle it only when the background writeback cannot
 		 * catch-up. This avoids (excessively) small writeouts
@@ -1417,7 +1461,8 @@ static void balance_dirty_pages(struct address_space *mapping,
 		 * and limits. Small writeouts when the bdi limits are ramping
 		 * up are the price we consciously pay for strictlimit-ing.
 		 */
-		if (dirty <= dirty_freerun_ceiling(thresh, bg_thresh)) {
+		if (dirty <= dirty_freerun_ceiling(thresh, bg_thresh) &&
+		    !cg_exceeded) {
 			current->dirty_paused_when = now;
 			current->nr_dirtied = 0;
 			current->nr_dirtied_pause =
@@ -1425,6 +1470,10 @@ static void balance_dirty_pages(struct address_space *mapping,
 			break;
 		}
 
+#ifdef CONFIG_CGROUP_WRITEBACK
+		if (cg_exceeded)
+			wb_start_background_writeback(wb);
+#endif
 		if (unlikely(!writeback_in_progress(bdi)))
 			bdi_start_background_writeback(bdi);
 
@@ -1445,6 +1494,14 @@ static void balance_dirty_pages(struct address_space *mapping,
 		pos_ratio = bdi_position_ratio(bdi, dirty_thresh,
 					       background_thresh, nr_dirty,
 					       bdi_thresh, bdi_dirty);
+		if (cg_exceeded) {
+			unsigned long setpoint = (dirty_freerun_ceiling(
+				cg_thresh, cg_bg_thresh) + cg_thresh) / 2;
+
+			pos_ratio = min_t(unsigned long, pos_ratio,
+				pos_ratio_polynom(setpoint, cg_dirty,
+						  cg_thresh));
+		}
 		task_ratelimit = ((u64)dirty_ratelimit * pos_ratio) >>
 							RATELIMIT_CALC_SHIFT;
 		max_pause = bdi_max_pause(bdi, bdi_dirty);
@@ -2129,6 +2186,9 @@ void account_page_dirtied(struct page *page, struct address_space *mapping)
 		__inc_zone_page_state(page, NR_DIRTIED);
 		__inc_bdi_stat(mapping->backing_dev_info, BDI_RECLAIMABLE);
 		__inc_bdi_stat(mapping->backing_dev_info, BDI_DIRTIED);
+		if (mapping->host)
+			inode_attach_wb(mapping->host);
+		wb_account_dirty(mapping, 1);
 		task_io_account_write(PAGE_CACHE_SIZE);
 		current->nr_dirtied++;
 		this_cpu_inc(bdp_ratelimits);
@@ -2354,6 +2414,7 @@ int clear_page_dirty_for_io(struct page *page)
 			dec_zone_page_state(page, NR_FILE_DIRTY);
 			dec_bdi_stat(mapping->backing_dev_info,
 					BDI_RECLAIMABLE);
+			wb_account_dirty(mapping, -1);
 			return 1;
 		}
 		return 0;
@@ -61,6 +61,7 @@
 #include <linux/page-debug-flags.h>
 #include <linux/hugetlb.h>
 #include <linux/sched/rt.h>
+#include <linux/kthread.h>
 
 #include <asm/sections.h>
 #include <asm/tlbflush.h>
@@ -768,7 +769,25 @@ static void __free_pages_ok(struct page *page, unsigned int order)
 	local_irq_restore(flags);
 }
 
-void __init __free_pages_bootmem(struct page *page, unsigned int order)
+static void __meminit __init_single_page(struct page *page, unsigned long pfn,
+					 unsigned long zone, int nid)
+{
+	set_page_links(page, zone, nid, pfn);
+	mminit_verify_page_links(page, zone, nid, pfn);
+	init_page_count(page);
+	page_mapcount_reset(page);
+	page_cpupid_reset_last(page);
+	SetPageReserved(page);
+	INIT_LIST_HEAD(&page->lru);
+#ifdef WANT_PAGE_VIRTUAL
+	/* The shift won't overflow because ZONE_NORMAL is below 4G. */
+	if (!is_highmem_idx(zone))
+		set_page_address(page, __va(pfn << PAGE_SHIFT));
+#endif
+}
+
+static void __init __free_pages_boot_core(struct page *page,
+					  unsigned int order)
 {
 	unsigned int nr_pages = 1 << order;
 	struct page *p = page;
@@ -788,6 +807,286 @@ void __init __free_pages_bootmem(struct page *page, unsigned int order)
 	__free_pages(page, order);
 }
 
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+/*
+ * On large machines, initialising every struct page on the boot cpu takes
+ * a long time.  memmap_init_zone() therefore stops early in the highest
+ * zone of each node, and records where in first_deferred_pfn.  The rest is
+ * initialised and freed by one kthread per node from page_alloc_init_late(),
+ * or a section at a time by the page allocator itself when a zone runs out
+ * of initialised free pages before that.
+ *
+ * All struct pages start out zeroed by the memmap allocation, and every
+ * initialised one has PG_reserved or a zone or node link set, so a zero
+ * page->flags tells an uninitialised page apart until then.
+ */
+static bool deferred_init_pending __read_mostly;
+static atomic_t pgdat_init_n_undone __initdata;
+static __initdata DECLARE_COMPLETION(pgdat_init_all_done_comp);
+
+/* Initialise at least this many pages of a node before deferring */
+#define DEFERRED_INIT_MIN_PAGES	(1UL << (30 - PAGE_SHIFT))
+
+static inline void reset_deferred_meminit(pg_data_t *pgdat)
+{
+	pgdat->first_deferred_pfn = ULONG_MAX;
+}
+
+static inline bool early_page_uninitialised(struct page *page)
+{
+	return !page->flags;
+}
+
+/*
+ * Returns false when the remaining initialisation of the zone should be
+ * deferred, after recording where it stopped.
+ */
+static inline bool update_defer_init(pg_data_t *pgdat, unsigned long pfn,
+				     unsigned long zone_end,
+				     unsigned long *nr_initialised)
+{
+	/* Always populate low zones, for address-constrained allocations */
+	if (zone_end < pgdat_end_pfn(pgdat))
+		return true;
+
+	(*nr_initialised)++;
+	if (*nr_initialised > DEFERRED_INIT_MIN_PAGES &&
+	    !(pfn & (PAGES_PER_SECTION - 1))) {
+		pgdat->first_deferred_pfn = pfn;
+		deferred_init_pending = true;
+		return false;
+	}
+	return true;
+}
+
+static struct zone * __init deferred_zone(pg_data_t *pgdat, unsigned long pfn)
+{
+	struct zone *zone;
+
+	for (zone = pgdat->node_zones;
+	     zone < pgdat->node_zones + MAX_NR_ZONES; zone++)
+		if (pfn >= zone->zone_start_pfn && pfn < zone_end_pfn(zone))
+			return zone;
+	return NULL;
+}
+
+/**
+ * init_reserved_region - initialise the struct pages of reserved memory
+ * @start: start of the range
+ * @end: end of the range
+ *
+ * Called for each memblock reserved range before free memory is handed to
+ * the buddy allocator, so that the deferred initialisation only has to
+ * deal with free pages, and later frees of reserved memory find their
+ * struct pages set up.
+ */
+void __init init_reserved_region(phys_addr_t start, phys_addr_t end)
+{
+	unsigned long pfn = PFN_DOWN(start);
+	unsigned long end_pfn = PFN_UP(end);
+	struct zone *zone;
+	struct page *page;
+	int nid;
+
+	for (; pfn < end_pfn; pfn++) {
+		if (!pfn_valid(pfn))
+			continue;
+		page = pfn_to_page(pfn);
+		if (!early_page_uninitialised(page))
+			continue;
+		nid = early_pfn_to_nid(pfn);
+		if (pfn < NODE_DATA(nid)->first_deferred_pfn)
+			continue;
+		zone = deferred_zone(NODE_DATA(nid), pfn);
+		if (!zone)
+			continue;
+		__init_single_page(page, pfn, zone_idx(zone), nid);
+		if (!(pfn & (pageblock_nr_pages - 1)))
+			set_pageblock_migratetype(page, MIGRATE_MOVABLE);
+	}
+}
+
+static unsigned long __init deferred_free_range(unsigned long pfn,
+						unsigned long end_pfn)
+{
+	unsigned long nr_pages = end_pfn - pfn;
+	int order;
+
+	while (pfn < end_pfn) {
+		order = min(MAX_ORDER - 1UL, __ffs(pfn));
+		while (pfn + (1UL << order) > end_pfn)
+			order--;
+		__free_pages_boot_core(pfn_to_page(pfn), order);
+		pfn += 1UL << order;
+	}
+	return nr_pages;
+}
+
+/*
+ * Initialise and free the next section of @pgdat's deferred memory, with
+ * pgdat_resize_lock() held.  Returns the number of pages freed.
+ */
+static unsigned long __init deferred_init_section(pg_data_t *pgdat)
+{
+	unsigned long start_pfn = pgdat->first_deferred_pfn;
+	unsigned long end_pfn, spfn, epfn, pfn, free_pfn;
+	unsigned long nr_pages = 0;
+	struct zone *zone;
+	struct page *page;
+	int i, zid;
+
+	zone = deferred_zone(pgdat, start_pfn);
+	if (WARN_ON_ONCE(!zone)) {
+		reset_deferred_meminit(pgdat);
+		return 0;
+	}
+	zid = zone_idx(zone);
+	end_pfn = min(ALIGN(start_pfn + 1, PAGES_PER_SECTION),
+		      zone_end_pfn(zone));
+
+	for_each_mem_pfn_range(i, pgdat->node_id, &spfn, &epfn, NULL) {
+		spfn = max(spfn, start_pfn);
+		epfn = min(epfn, end_pfn);
+
+		for (pfn = free_pfn = spfn; pfn < epfn; pfn++) {
+			if (!pfn_valid_within(pfn))
+				goto skip;
+			page = pfn_to_page(pfn);
+			/* reserved, see init_reserved_region() */
+			if (!early_page_uninitialised(page))
+				goto skip;
+			__init_single_page(page, pfn, zid, pgdat->node_id);
+			if (!(pfn & (pageblock_nr_pages - 1)))
+				set_pageblock_migratetype(page,
+							  MIGRATE_MOVABLE);
+			continue;
+skip:
+			nr_pages += deferred_free_range(free_pfn, pfn);
+			free_pfn = pfn + 1;
+		}
+		if (free_pfn < epfn)
+			nr_pages += deferred_free_range(free_pfn, epfn);
+	}
+
+	if (end_pfn < zone_end_pfn(zone))
+		pgdat->first_deferred_pfn = end_pfn;
+	else
+		reset_deferred_meminit(pgdat);
+	return nr_pages;
+}
+
+static int __init deferred_init_memmap(void *data)
+{
+	pg_data_t *pgdat = data;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+	unsigned long start = jiffies;
+	unsigned long nr_pages = 0;
+	unsigned long flags;
+
+	/* Bind memory initialisation thread to a local node if possible */
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+
+	for (;;) {
+		pgdat_resize_lock(pgdat, &flags);
+		if (pgdat->first_deferred_pfn == ULONG_MAX) {
+			pgdat_resize_unlock(pgdat, &flags);
+			break;
+		}
+		nr_pages += deferred_init_section(pgdat);
+		pgdat_resize_unlock(pgdat, &flags);
+		cond_resched();
+	}
+
+	pr_info("node %d initialised, %lu pages in %ums\n", pgdat->node_id,
+		nr_pages, jiffies_to_msecs(jiffies - start));
+
+	if (atomic_dec_and_test(&pgdat_init_n_undone))
+		complete(&pgdat_init_all_done_comp);
+	return 0;
+}
+
+static noinline bool __init _deferred_grow_zone(struct zone *zone,
+						unsigned int order)
+{
+	pg_data_t *pgdat = zone->zone_pgdat;
+	unsigned long nr_pages = 0;
+	unsigned long flags;
+
+	pgdat_resize_lock(pgdat, &flags);
+	while (nr_pages < (1UL << order) &&
+	       pgdat->first_deferred_pfn >= zone->zone_start_pfn &&
+	       pgdat->first_deferred_pfn < zone_end_pfn(zone))
+		nr_pages += deferred_init_section(pgdat);
+	pgdat_resize_unlock(pgdat, &flags);
+
+	return nr_pages > 0;
+}
+
+/*
+ * The zone is short of free pages, but may still have some waiting to be
+ * initialised: do a section of that work now rather than fail, or reclaim.
+ */
+static bool __ref deferred_grow_zone(struct zone *zone, unsigned int order)
+{
+	if (likely(!deferred_init_pending))
+		return false;
+	return _deferred_grow_zone(zone, order);
+}
+#else
+static inline void reset_deferred_meminit(pg_data_t *pgdat)
+{
+}
+
+static inline bool early_page_uninitialised(struct page *page)
+{
+	return false;
+}
+
+static inline bool update_defer_init(pg_data_t *pgdat, unsigned long pfn,
+				     unsigned long zone_end,
+				     unsigned long *nr_initialised)
+{
+	return true;
+}
+
+static inline bool deferred_grow_zone(struct zone *zone, unsigned int order)
+{
+	return false;
+}
+#endif /* CONFIG_DEFERRED_STRUCT_PAGE_INIT */
+
+void __init __free_pages_bootmem(struct page *page, unsigned int order)
+{
+	/* Left for the deferred initialisation to free */
+	if (early_page_uninitialised(page))
+		return;
+	__free_pages_boot_core(page, order);
+}
+
+/**
+ * page_alloc_init_late - finish the memory initialisation deferred at boot
+ *
+ * Starts one thread per node to initialise and free the struct pages left
+ * by memmap_init_zone(), and waits for all of them.
+ */
+void __init page_alloc_init_late(void)
+{
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+	int nid;
+
+	if (!deferred_init_pending)
+		return;
+
+	atomic_set(&pgdat_init_n_undone, num_node_state(N_MEMORY));
+	for_each_node_state(nid, N_MEMORY)
+		kthread_run(deferred_init_memmap, NODE_DATA(nid),
+			    "pgdatinit%d", nid);
+	wait_for_completion(&pgdat_init_all_done_comp);
+	deferred_init_pending = false;
+#endif
+}
+
 #ifdef CONFIG_CMA
 /* Free whole pageblock and set its migration type to MIGRATE_CMA. */
 void __init init_cma_reserved_pageblock(struct page *page)
@@ -1370,23 +1669,26 @@ void mark_free_pages(struct zone *zone)
 }
 #endif /* CONFIG_PM */
 
+static bool free_hot_cold_page_prepare(struct page *page)
+{
+	if (!free_pages_prepare(page, 0))
+		return false;
+
+	set_freepage_migratetype(page, get_pageblock_migratetype(page));
+	return true;
+}
+
 /*
- * Free a 0-order page
- * cold == 1 ? free a cold page : free a hot page
+ * Put a prepared 0-order page on the local pcp list of its zone.
+ * Must be called with interrupts disabled.
  */
-void free_hot_cold_page(struct page *page, int cold)
+static void free_hot_cold_page_commit(struct page *page, int cold)
 {
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
-	unsigned long flags;
 	int migratetype;
 
-	if (!free_pages_prepare(page, 0))
-		return;
-
-	migratetype = get_pageblock_migratetype(page);
-	set_freepage_migratetype(page, migratetype);
-	local_irq_save(flags);
+	migratetype = get_freepage_migratetype(page);
 	__count_vm_event(PGFREE);
 
 	/*
@@ -1399,7 +1701,7 @@ void free_hot_cold_page(struct page *page, int cold)
 	if (migratetype >= MIGRATE_PCPTYPES) {
 		if (unlikely(is_migrate_isolate(migratetype))) {
 			free_one_page(zone, page, 0, migratetype);
-			goto out;
+			return;
 		}
 		migratetype = MIGRATE_MOVABLE;
 	}
@@ -1415,22 +1717,56 @@ void free_hot_cold_page(struct page *page, int cold)
 		free_pcppages_bulk(zone, batch, pcp);
 		pcp->count -= batch;
 	}
+}
 
-out:
+/*
+ * Free a 0-order page
+ * cold == 1 ? free a cold page : free a hot page
+ */
+void free_hot_cold_page(struct page *page, int cold)
+{
+	unsigned long flags;
+
+	if (!free_hot_cold_page_prepare(page))
+		return;
+
+	local_irq_save(flags);
+	free_hot_cold_page_commit(page, cold);
 	local_irq_restore(flags);
 }
 
 /*
  * Free a list of 0-order pages
+ *
+ * The pages are prepared first, so the pcp lists are then filled with
+ * interrupts disabled only once per SWAP_CLUSTER_MAX pages, rather than
+ * once per page; a full pcp list is drained through free_pcppages_bulk()
+ * as usual.
  */
 void free_hot_cold_page_list(struct list_head *list, int cold)
 {
 	struct page *page, *next;
+	unsigned long flags;
+	int batch_count = 0;
 
+	list_for_each_entry_safe(page, next, list, lru) {
+		if (!free_hot_cold_page_prepare(page))
+			list_del(&page->lru);
+	}
+
+	local_irq_save(flags);
 	list_for_each_entry_safe(page, next, list, lru) {
 		trace_mm_page_free_batched(page, cold);
-		free_hot_cold_page(page, cold);
+		free_hot_cold_page_commit(page, cold);
+
+		/* don't keep interrupts off for too long on long lists */
+		if (++batch_count == SWAP_CLUSTER_MAX) {
+			local_irq_restore(flags);
+			batch_count = 0;
+			local_irq_save(flags);
+		}
 	}
+	local_irq_restore(flags);
 }
 
 /*
@@ -1996,6 +2332,10 @@ zonelist_scan:
 				       classzone_idx, alloc_flags)) {
 			int ret;
 
+			/* Maybe the zone just isn't fully initialised yet */
+			if (deferred_grow_zone(zone, order))
+				goto try_this_zone;
+
 			if (IS_ENABLED(CONFIG_NUMA) &&
 					!did_zlc_setup && nr_online_nodes > 1) {
 				/*
@@ -2801,6 +3141,168 @@ out:
 }
 EXPORT_SYMBOL(__alloc_pages_nodemask);
 
+/**
+ * __alloc_pages_bulk - allocate a number of order-0 pages to a list or array
+ * @gfp_mask: GFP flags for the allocation
+ * @zonelist: zonelist to allocate from
+ * @nodemask: set of nodes to allocate from, may be NULL
+ * @nr_pages: number of pages to put on the list or in the array
+ * @page_list: list to add the pages to, or NULL
+ * @page_array: array to store the pages in if @page_list is NULL
+ *
+ * A batched version of the page allocator for callers that want many
+ * order-0 pages at once. It picks a zone that stays above its low
+ * watermark with all @nr_pages gone, then takes the pages from the local
+ * pcp list with interrupts disabled once. A pcp list that runs empty is
+ * refilled with what is still missing, with a single hold of zone->lock.
+ *
+ * Only the NULL entries of @page_array are filled in.
+ *
+ * This never enters the slowpath. If the fast path can't be used, a
+ * single page is allocated the normal way, so callers must be prepared
+ * to get fewer pages than asked for.
+ *
+ * Returns the number of pages on the list, or in the array.
+ */
+unsigned long __alloc_pages_bulk(gfp_t gfp_mask, struct zonelist *zonelist,
+			nodemask_t *nodemask, int nr_pages,
+			struct list_head *page_list, struct page **page_array)
+{
+	enum zone_type high_zoneidx = gfp_zone(gfp_mask);
+	int migratetype = allocflags_to_migratetype(gfp_mask);
+	int cold = !!(gfp_mask & __GFP_COLD);
+	int alloc_flags = ALLOC_WMARK_LOW | ALLOC_CPUSET;
+	struct zone *preferred_zone, *zone;
+	struct per_cpu_pages *pcp;
+	struct list_head *list;
+	struct zoneref *z;
+	struct page *page;
+	unsigned long flags;
+	int nr_populated = 0, nr_account = 0;
+	bool refilled = false;
+
+	/* skip the array entries that are already populated */
+	while (page_array && nr_populated < nr_pages &&
+	       page_array[nr_populated])
+		nr_populated++;
+
+	if (unlikely(nr_pages <= nr_populated))
+		return nr_populated;
+
+	/* not worth the setup for a single page */
+	if (nr_pages - nr_populated == 1)
+		goto failed;
+
+	gfp_mask &= gfp_allowed_mask;
+
+	/* leave fault injection and kmem accounting to the normal path */
+	if (should_fail_alloc_page(gfp_mask, 0) || (gfp_mask & __GFP_KMEMCG))
+		goto failed;
+
+	if (unlikely(!zonelist->_zonerefs->zone))
+		goto failed;
+
+	first_zones_zonelist(zonelist, high_zoneidx,
+				nodemask ? : &cpuset_current_mems_allowed,
+				&preferred_zone);
+	if (!preferred_zone)
+		goto failed;
+
+#ifdef CONFIG_CMA
+	if (migratetype == MIGRATE_MOVABLE)
+		alloc_flags |= ALLOC_CMA;
+#endif
+
+	/* find a local zone with room for the whole batch */
+	for_each_zone_zonelist_nodemask(zone, z, zonelist,
+						high_zoneidx, nodemask) {
+		unsigned long mark;
+
+		if (!cpuset_zone_allowed_softwall(zone,
+						  gfp_mask | __GFP_HARDWALL))
+			continue;
+		if (!zone_local(preferred_zone, zone))
+			continue;
+		if (zone_page_state(zone, NR_ALLOC_BATCH) <= 0)
+			continue;
+		if ((gfp_mask & __GFP_WRITE) && !zone_dirty_ok(zone))
+			continue;
+
+		mark = low_wmark_pages(zone) + nr_pages - nr_populated;
+		if (zone_watermark_ok(zone, 0, mark,
+				      zone_idx(preferred_zone), alloc_flags))
+			break;
+	}
+
+	if (!zone)
+		goto failed;
+
+	local_irq_save(flags);
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	list = &pcp->lists[migratetype];
+
+	while (nr_populated < nr_pages) {
+		if (page_array && page_array[nr_populated]) {
+			nr_populated++;
+			continue;
+		}
+
+		if (list_empty(list)) {
+			if (refilled)
+				break;
+			pcp->count += rmqueue_bulk(zone, 0,
+					max_t(unsigned long, pcp->batch,
+					      nr_pages - nr_populated),
+					list, migratetype, cold);
+			refilled = true;
+			if (unlikely(list_empty(list)))
+				break;
+		}
+
+		if (cold)
+			page = list_entry(list->prev, struct page, lru);
+		else
+			page = list_entry(list->next, struct page, lru);
+
+		list_del(&page->lru);
+		pcp->count--;
+		nr_account++;
+
+		zone_statistics(preferred_zone, zone, gfp_mask);
+		VM_BUG_ON_PAGE(bad_range(zone, page), page);
+		if (prep_new_page(page, 0, gfp_mask))
+			continue;
+
+		page->pfmemalloc = false;
+		trace_mm_page_alloc(page, 0, gfp_mask, migratetype);
+
+		if (page_list)
+			list_add(&page->lru, page_list);
+		else
+			page_array[nr_populated] = page;
+		nr_populated++;
+	}
+
+	__mod_zone_page_state(zone, NR_ALLOC_BATCH, -nr_account);
+	__count_zone_vm_events(PGALLOC, zone, nr_account);
+	local_irq_restore(flags);
+
+	return nr_populated;
+
+failed:
+	page = __alloc_pages_nodemask(gfp_mask, 0, zonelist, nodemask);
+	if (page) {
+		if (page_list)
+			list_add(&page->lru, page_list);
+		else
+			page_array[nr_populated] = page;
+		nr_populated++;
+	}
+
+	return nr_populated;
+}
+EXPORT_SYMBOL(__alloc_pages_bulk);
+
 /*
  * Common helper functions.
  */
@@ -4050,15 +4552,17 @@ static void setup_zone_migrate_reserve(struct zone *zone)
 void __meminit memmap_init_zone(unsigned long size, int nid, unsigned long zone,
 		unsigned long start_pfn, enum memmap_context context)
 {
+	pg_data_t *pgdat = NODE_DATA(nid);
 	struct page *page;
 	unsigned long end_pfn = start_pfn + size;
+	unsigned long nr_initialised = 0;
 	unsigned long pfn;
 	struct zone *z;
 
 	if (highest_memmap_pfn < end_pfn - 1)
 		highest_memmap_pfn = end_pfn - 1;
 
-	z = &NODE_DATA(nid)->node_zones[zone];
+	z = &pgdat->node_zones[zone];
 	for (pfn = start_pfn; pfn < end_pfn; pfn++) {
 		/*
 		 * There can be holes in boot-time mem_map[]s
@@ -4070,14 +4574,12 @@ void __meminit memmap_init_zone(unsigned long size, int nid, unsigned long zone,
 				continue;
 			if (!early_pfn_in_nid(pfn, nid))
 				continue;
+			if (!update_defer_init(pgdat, pfn, end_pfn,
+					       &nr_initialised))
+				break;
 		}
 		page = pfn_to_page(pfn);
-		set_page_links(page, zone, nid, pfn);
-		mminit_verify_page_links(page, zone, nid, pfn);
-		init_page_count(page);
-		page_mapcount_reset(page);
-		page_cpupid_reset_last(page);
-		SetPageReserved(page);
+		__init_single_page(page, pfn, zone, nid);
 		/*
 		 * Mark the block movable so that blocks are reserved for
 		 * movable at startup. This will force kernel allocations
@@ -4096,13 +4598,6 @@ void __meminit memmap_init_zone(unsigned long size, int nid, unsigned long zone,
 		    && (pfn < zone_end_pfn(z))
 		    && !(pfn & (pageblock_nr_pages - 1)))
 			set_pageblock_migratetype(page, MIGRATE_MOVABLE);
-
-		INIT_LIST_HEAD(&page->lru);
-#ifdef WANT_PAGE_VIRTUAL
-		/* The shift won't overflow because ZONE_NORMAL is below 4G. */
-		if (!is_highmem_idx(zone))
-			set_page_address(page, __va(pfn << PAGE_SHIFT));
-#endif
 	}
 }
 
@@ -4798,6 +5293,9 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 #endif
 	init_waitqueue_head(&pgdat->kswapd_wait);
 	init_waitqueue_head(&pgdat->pfmemalloc_wait);
+#ifdef CONFIG_COMPACTION
+	init_waitqueue_head(&pgdat->kcompactd_wait);
+#endif
 	pgdat_page_cgroup_init(pgdat);
 
 	for (j = 0; j < MAX_NR_ZONES; j++) {
@@ -4934,6 +5432,7 @@ void __paginginit free_area_init_node(int nid, unsigned long *zones_size,
 
 	pgdat->node_id = nid;
 	pgdat->node_start_pfn = node_start_pfn;
+	reset_deferred_meminit(pgdat);
 	if (node_state(nid, N_MEMORY))
 		init_zone_allows_reclaim(nid);
 #ifdef CONFIG_HAVE_MEMBLOCK_NODE_MAP
@@ -5977,7 +6476,14 @@ void *__init alloc_large_system_hash(const char *tablename,
 		if (flags & HASH_EARLY)
 			table = memblock_virt_alloc_nopanic(size, 0);
 		else if (hashdist)
-			table = __vmalloc(size, GFP_ATOMIC, PAGE_KERNEL);
+			/*
+			 * Hash lookups are spread all over the table, so use
+			 * huge mappings if possible to save on TLB misses.
+			 */
+			table = __vmalloc_node_range(size, 1, VMALLOC_START,
+					VMALLOC_END, GFP_ATOMIC, PAGE_KERNEL,
+					VM_HUGE_VMAP, NUMA_NO_NODE,
+					__builtin_return_address(0));
 		else {
 			/*
 			 * If bucketsize is not a power-of-two, we may free
@@ -32,6 +32,7 @@
 #include <linux/export.h>
 #include <linux/swap.h>
 #include <linux/aio.h>
+#include <linux/khugepaged.h>
 
 static struct vfsmount *shm_mnt;
 
@@ -66,9 +67,14 @@ static struct vfsmount *shm_mnt;
 #include <linux/highmem.h>
 #include <linux/seq_file.h>
 #include <linux/magic.h>
+#include <linux/rmap.h>
+#include <linux/sysfs.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
+#include <asm/pgalloc.h>
+
+#include "internal.h"
 
 #define BLOCKS_PER_PAGE  (PAGE_CACHE_SIZE/512)
 #define VM_ACCT(size)    (PAGE_CACHE_ALIGN(size) >> PAGE_SHIFT)
@@ -117,13 +123,14 @@ static bool shmem_should_replace_page(struct page *page, gfp_t gfp);
 static int shmem_replace_page(struct page **pagep, gfp_t gfp,
 				struct shmem_inode_info *info, pgoff_t index);
 static int shmem_getpage_gfp(struct inode *inode, pgoff_t index,
-	struct page **pagep, enum sgp_type sgp, gfp_t gfp, int *fault_type);
+	struct page **pagep, enum sgp_type sgp, gfp_t gfp, int *fault_type,
+	struct vm_area_struct *vma);
 
 static inline int shmem_getpage(struct inode *inode, pgoff_t index,
 	struct page **pagep, enum sgp_type sgp, int *fault_type)
 {
 	return shmem_getpage_gfp(inode, index, pagep, sgp,
-			mapping_gfp_mask(inode->i_mapping), fault_type);
+			mapping_gfp_mask(inode->i_mapping), fault_type, NULL);
 }
 
 static inline struct shmem_sb_info *SHMEM_SB(struct super_block *sb)
@@ -155,10 +162,11 @@ static inline void shmem_unacct_size(unsigned long flags, loff_t size)
  * shmem_getpage reports shmem_acct_block failure as -ENOSPC not -ENOMEM,
  * so that a failure on a sparse tmpfs mapping will give SIGBUS not OOM.
  */
-static inline int shmem_acct_block(unsigned long flags)
+static inline int shmem_acct_block(unsigned long flags, long pages)
 {
 	return (flags & VM_NORESERVE) ?
-		security_vm_enough_memory_mm(current->mm, VM_ACCT(PAGE_CACHE_SIZE)) : 0;
+		security_vm_enough_memory_mm(current->mm,
+				pages * VM_ACCT(PAGE_CACHE_SIZE)) : 0;
 }
 
 static inline void shmem_unacct_blocks(unsigned long flags, long pages)
@@ -890,6 +898,29 @@ static struct page *shmem_alloc_page(gfp_t gfp,
 
 	return page;
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, pgoff_t index)
+{
+	struct vm_area_struct pvma;
+	struct page *page;
+
+	/* Create a pseudo vma that just contains the policy */
+	pvma.vm_start = 0;
+	/* Bias interleave by inode number to distribute better across nodes */
+	pvma.vm_pgoff = index + info->vfs_inode.i_ino;
+	pvma.vm_ops = NULL;
+	pvma.vm_policy = mpol_shared_policy_lookup(&info->policy, index);
+
+	page = alloc_pages_vma(gfp, HPAGE_PMD_ORDER, &pvma, 0, numa_node_id());
+
+	/* Drop reference taken by mpol_shared_policy_lookup() */
+	mpol_cond_put(pvma.vm_policy);
+
+	return page;
+}
+#endif
 #else /* !CONFIG_NUMA */
 #ifdef CONFIG_TMPFS
 static inline void shmem_show_mpol(struct seq_file *seq, struct mempolicy *mpol)
@@ -908,6 +939,14 @@ static inline struct page *shmem_alloc_page(gfp_t gfp,
 {
 	return alloc_page(gfp);
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static inline struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, pgoff_t index)
+{
+	return alloc_pages(gfp, HPAGE_PMD_ORDER);
+}
+#endif
 #endif /* CONFIG_NUMA */
 
 #if !defined(CONFIG_NUMA) || !defined(CONFIG_TMPFS)
@@ -917,6 +956,269 @@ static inline struct mempolicy *shmem_get_sbmpol(struct shmem_sb_info *sbinfo)
 }
 #endif
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * tmpfs keeps no compound pages in its page cache.  A huge page is
+ * allocated, split at once, and its small pages inserted as a "team":
+ * HPAGE_PMD_NR naturally aligned, physically contiguous pages covering one
+ * aligned extent of the file.  Everything that works on single pages
+ * (swap, truncation, memcg, page cache lookup) goes on as before; only a
+ * MAP_SHARED mapping sees the team as a whole, when shmem_pmd_fault() maps
+ * it with a huge pmd.  So splitting a team is just splitting that pmd.
+ */
+
+/* Policy for shm_mnt, or SHMEM_HUGE_DENY or SHMEM_HUGE_FORCE for all */
+static int shmem_huge __read_mostly;
+
+static int shmem_parse_huge(const char *str)
+{
+	if (!strcmp(str, "never"))
+		return SHMEM_HUGE_NEVER;
+	if (!strcmp(str, "always"))
+		return SHMEM_HUGE_ALWAYS;
+	if (!strcmp(str, "within_size"))
+		return SHMEM_HUGE_WITHIN_SIZE;
+	if (!strcmp(str, "advise"))
+		return SHMEM_HUGE_ADVISE;
+	if (!strcmp(str, "deny"))
+		return SHMEM_HUGE_DENY;
+	if (!strcmp(str, "force"))
+		return SHMEM_HUGE_FORCE;
+	return -EINVAL;
+}
+
+#if defined(CONFIG_SYSFS) || defined(CONFIG_TMPFS)
+static const char *shmem_format_huge(int huge)
+{
+	switch (huge) {
+	case SHMEM_HUGE_NEVER:
+		return "never";
+	case SHMEM_HUGE_ALWAYS:
+		return "always";
+	case SHMEM_HUGE_WITHIN_SIZE:
+		return "within_size";
+	case SHMEM_HUGE_ADVISE:
+		return "advise";
+	case SHMEM_HUGE_DENY:
+		return "deny";
+	case SHMEM_HUGE_FORCE:
+		return "force";
+	default:
+		VM_BUG_ON(1);
+		return "bad_val";
+	}
+}
+#endif
+
+static int __init setup_transparent_hugepage_shmem(char *str)
+{
+	int huge = shmem_parse_huge(str);
+
+	if (huge == -EINVAL) {
+		pr_warn("transparent_hugepage_shmem= cannot parse, ignored\n");
+		return 0;
+	}
+	shmem_huge = huge;
+	return 1;
+}
+__setup("transparent_hugepage_shmem=", setup_transparent_hugepage_shmem);
+
+/*
+ * Should the extent holding @index be allocated as a team?  @vma is the
+ * faulting vma, or NULL for read and write.
+ */
+static bool shmem_huge_enabled(struct inode *inode, pgoff_t index,
+			       struct vm_area_struct *vma)
+{
+	loff_t i_size;
+
+	if (!S_ISREG(inode->i_mode))
+		return false;
+	if (shmem_huge == SHMEM_HUGE_DENY)
+		return false;
+	if (vma && (vma->vm_flags & VM_NOHUGEPAGE))
+		return false;
+	if (shmem_huge == SHMEM_HUGE_FORCE)
+		return true;
+
+	switch (SHMEM_SB(inode->i_sb)->huge) {
+	case SHMEM_HUGE_ALWAYS:
+		return true;
+	case SHMEM_HUGE_WITHIN_SIZE:
+		index = round_up(index + 1, HPAGE_PMD_NR);
+		i_size = round_up(i_size_read(inode), PAGE_CACHE_SIZE);
+		if (i_size >> PAGE_CACHE_SHIFT >= index)
+			return true;
+		/* fall through */
+	case SHMEM_HUGE_ADVISE:
+		return vma && (vma->vm_flags & VM_HUGEPAGE);
+	default:
+		return false;
+	}
+}
+
+/* Should khugepaged look at MAP_SHARED mappings of this inode? */
+static bool shmem_huge_scan(struct inode *inode)
+{
+	if (shmem_huge == SHMEM_HUGE_FORCE)
+		return true;
+	if (shmem_huge == SHMEM_HUGE_DENY)
+		return false;
+	return SHMEM_SB(inode->i_sb)->huge != SHMEM_HUGE_NEVER;
+}
+
+/* Nothing at all, not even a swap entry, in the extent from @index? */
+static bool shmem_extent_empty(struct address_space *mapping, pgoff_t index)
+{
+	struct radix_tree_iter iter;
+	void **slot;
+	bool empty = true;
+
+	rcu_read_lock();
+	radix_tree_for_each_slot(slot, &mapping->page_tree, &iter, index) {
+		if (iter.index >= index + HPAGE_PMD_NR)
+			break;
+		if (radix_tree_deref_slot(slot)) {
+			empty = false;
+			break;
+		}
+	}
+	rcu_read_unlock();
+	return empty;
+}
+
+/*
+ * Allocate a team for the extent holding @index and insert it into the
+ * page cache, cleared and uptodate.  Fails with -EEXIST unless the whole
+ * extent is still empty: the caller then goes on with a small page.
+ */
+static int shmem_alloc_team(struct inode *inode, pgoff_t index, gfp_t gfp)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	struct shmem_sb_info *sbinfo = SHMEM_SB(inode->i_sb);
+	pgoff_t hindex = round_down(index, HPAGE_PMD_NR);
+	struct page *head, *page;
+	int charged = 0;
+	int error;
+	int i;
+
+	if (!shmem_extent_empty(mapping, hindex))
+		return -EEXIST;
+
+	if (shmem_acct_block(info->flags, HPAGE_PMD_NR))
+		return -ENOSPC;
+	if (sbinfo->max_blocks) {
+		if (sbinfo->max_blocks < HPAGE_PMD_NR ||
+		    percpu_counter_compare(&sbinfo->used_blocks,
+				sbinfo->max_blocks - HPAGE_PMD_NR) > 0) {
+			error = -ENOSPC;
+			goto unacct;
+		}
+		percpu_counter_add(&sbinfo->used_blocks, HPAGE_PMD_NR);
+	}
+
+	head = shmem_alloc_hugepage(gfp | __GFP_NORETRY | __GFP_NOWARN,
+				    info, hindex);
+	if (!head) {
+		error = -ENOMEM;
+		goto decused;
+	}
+	split_page(head, HPAGE_PMD_ORDER);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page = head + i;
+		clear_highpage(page);
+		flush_dcache_page(page);
+		SetPageUptodate(page);
+		SetPageSwapBacked(page);
+		__set_page_locked(page);
+	}
+	for (; charged < HPAGE_PMD_NR; charged++) {
+		error = mem_cgroup_charge_file(head + charged, current->mm,
+						gfp & GFP_RECLAIM_MASK);
+		if (error)
+			goto release;
+	}
+
+	error = radix_tree_maybe_preload(gfp & GFP_RECLAIM_MASK);
+	if (error)
+		goto release;
+	spin_lock_irq(&mapping->tree_lock);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page = head + i;
+		page->mapping = mapping;
+		page->index = hindex + i;
+		error = radix_tree_insert(&mapping->page_tree, page->index,
+					  page);
+		if (error)
+			break;
+	}
+	if (error) {
+		head[i].mapping = NULL;
+		while (i--) {
+			radix_tree_delete(&mapping->page_tree, hindex + i);
+			head[i].mapping = NULL;
+		}
+	} else {
+		mapping->nrpages += HPAGE_PMD_NR;
+		__mod_zone_page_state(page_zone(head), NR_FILE_PAGES,
+				      HPAGE_PMD_NR);
+		__mod_zone_page_state(page_zone(head), NR_SHMEM, HPAGE_PMD_NR);
+	}
+	spin_unlock_irq(&mapping->tree_lock);
+	radix_tree_preload_end();
+	if (error)
+		goto release;
+
+	spin_lock(&info->lock);
+	info->alloced += HPAGE_PMD_NR;
+	inode->i_blocks += BLOCKS_PER_PAGE * HPAGE_PMD_NR;
+	shmem_recalc_inode(inode);
+	spin_unlock(&info->lock);
+
+	/* The allocation reference is the page cache reference */
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		lru_cache_add_anon(head + i);
+		unlock_page(head + i);
+	}
+	count_vm_event(THP_FILE_ALLOC);
+	return 0;
+
+release:
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page = head + i;
+		if (i < charged)
+			mem_cgroup_uncharge_cache_page(page);
+		unlock_page(page);
+		page_cache_release(page);
+	}
+decused:
+	if (sbinfo->max_blocks)
+		percpu_counter_sub(&sbinfo->used_blocks, HPAGE_PMD_NR);
+unacct:
+	shmem_unacct_blocks(info->flags, HPAGE_PMD_NR);
+	return error;
+}
+#else /* !CONFIG_TRANSPARENT_HUGEPAGE */
+static inline bool shmem_huge_enabled(struct inode *inode, pgoff_t index,
+				      struct vm_area_struct *vma)
+{
+	return false;
+}
+
+static inline bool shmem_huge_scan(struct inode *inode)
+{
+	return false;
+}
+
+static inline int shmem_alloc_team(struct inode *inode, pgoff_t index,
+				   gfp_t gfp)
+{
+	return -EINVAL;
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 /*
  * When a page is moved from swapcache to shmem filecache (either by the
  * usual swapin of shmem_getpage_gfp(), or by the less common swapoff of
@@ -1005,10 +1307,13 @@ static int shmem_replace_page(struct page **pagep, gfp_t gfp,
  *
  * If we allocate a new one we do not mark it dirty. That's up to the
  * vm. If we swap it in we mark it dirty since we also free the swap
- * entry since a page cannot live in both the swap and page cache
+ * entry since a page cannot live in both the swap and page cache.
+ *
+ * @vma, when faulting, lets madvise(MADV_HUGEPAGE) ask for a huge team.
  */
 static int shmem_getpage_gfp(struct inode *inode, pgoff_t index,
-	struct page **pagep, enum sgp_type sgp, gfp_t gfp, int *fault_type)
+	struct page **pagep, enum sgp_type sgp, gfp_t gfp, int *fault_type,
+	struct vm_area_struct *vma)
 {
 	struct address_space *mapping = inode->i_mapping;
 	struct shmem_inode_info *info;
@@ -1057,7 +1362,7 @@ repeat:
 
 	if (swap.val) {
 		/* Look it up and read it in.. */
-		page = lookup_swap_cache(swap);
+		page = lookup_swap_cache(swap, NULL, 0);
 		if (!page) {
 			/* here we actually do the io */
 			if (fault_type)
@@ -1121,7 +1426,12 @@ repeat:
 		swap_free(swap);
 
 	} else {
-		if (shmem_acct_block(info->flags)) {
+		if (sgp != SGP_FALLOC &&
+		    shmem_huge_enabled(inode, index, vma) &&
+		    !shmem_alloc_team(inode, index, gfp))
+			goto repeat;
+
+		if (shmem_acct_block(info->flags, 1)) {
 			error = -ENOSPC;
 			goto failed;
 		}
@@ -1299,7 +1609,8 @@ static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 		spin_unlock(&inode->i_lock);
 	}
 
-	error = shmem_getpage(inode, vmf->pgoff, &vmf->page, SGP_CACHE, &ret);
+	error = shmem_getpage_gfp(inode, vmf->pgoff, &vmf->page, SGP_CACHE,
+			mapping_gfp_mask(inode->i_mapping), &ret, vma);
 	if (error)
 		return ((error == -ENOMEM) ? VM_FAULT_OOM : VM_FAULT_SIGBUS);
 
@@ -1310,6 +1621,359 @@ static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	return ret;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Map a whole team with one huge pmd, allocating the team first if its
+ * extent is still empty.  Anything short of a complete team, uptodate and
+ * within i_size, falls back to mapping small pages with shmem_fault().
+ */
+static int shmem_pmd_fault(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd, unsigned int flags)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct inode *inode = file_inode(vma->vm_file);
+	struct address_space *mapping = inode->i_mapping;
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *pages[PAGEVEC_SIZE];
+	struct page *head = NULL;
+	pgoff_t hindex;
+	pgtable_t pgtable;
+	spinlock_t *ptl;
+	pmd_t entry;
+	int nr = 0;
+	int got = 0;
+	int i = 0;
+
+	if (!(vma->vm_flags & VM_SHARED) ||
+	    (vma->vm_flags & (VM_LOCKED | VM_NONLINEAR)))
+		return VM_FAULT_FALLBACK;
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	hindex = linear_page_index(vma, haddr);
+	if (hindex & (HPAGE_PMD_NR - 1))
+		return VM_FAULT_FALLBACK;
+	/* Leave a hole being punched to shmem_fault() */
+	if (unlikely(inode->i_private))
+		return VM_FAULT_FALLBACK;
+	if (((loff_t)(hindex + HPAGE_PMD_NR) << PAGE_CACHE_SHIFT) >
+	    i_size_read(inode))
+		return VM_FAULT_FALLBACK;
+	if (!shmem_huge_enabled(inode, hindex, vma))
+		return VM_FAULT_FALLBACK;
+
+	shmem_alloc_team(inode, hindex, mapping_gfp_mask(mapping));
+
+	while (nr < HPAGE_PMD_NR) {
+		got = find_get_pages_contig(mapping, hindex + nr,
+				min(PAGEVEC_SIZE, HPAGE_PMD_NR - nr), pages);
+		if (!got)
+			goto fallback;
+		for (i = 0; i < got; i++) {
+			struct page *page = pages[i];
+
+			if (!nr) {
+				head = page;
+				if (page_to_pfn(head) & (HPAGE_PMD_NR - 1))
+					goto put_rest;
+			}
+			if (page != head + nr || !trylock_page(page))
+				goto put_rest;
+			nr++;
+			if (page->mapping != mapping || !PageUptodate(page)) {
+				i++;
+				goto put_rest;
+			}
+		}
+	}
+
+	/* Truncation cannot get past the locked pages now */
+	if (((loff_t)(hindex + HPAGE_PMD_NR) << PAGE_CACHE_SHIFT) >
+	    i_size_read(inode))
+		goto fallback;
+
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable))
+		goto fallback;
+
+	/*
+	 * A writable team is dirtied now, as we could not tell later: not all
+	 * architectures have pmd_dirty(), and tmpfs has no dirty accounting.
+	 */
+	entry = pmd_mkhuge(mk_pmd(head, vma->vm_page_prot));
+	if (vma->vm_flags & VM_WRITE)
+		entry = pmd_mkdirty(entry);
+
+	ptl = pmd_lock(mm, pmd);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(ptl);
+		pte_free(mm, pgtable);
+		goto fallback;
+	}
+	/* Each page keeps the reference from find_get_pages_contig() */
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (vma->vm_flags & VM_WRITE)
+			set_page_dirty(head + i);
+		page_add_file_rmap(head + i);
+	}
+	pgtable_trans_huge_deposit(mm, pmd, pgtable);
+	set_pmd_at(mm, haddr, pmd, entry);
+	add_mm_counter(mm, MM_FILEPAGES, HPAGE_PMD_NR);
+	atomic_long_inc(&mm->nr_ptes);
+	spin_unlock(ptl);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		unlock_page(head + i);
+	count_vm_event(THP_FILE_MAPPED);
+	return VM_FAULT_NOPAGE;
+
+put_rest:
+	while (i < got)
+		page_cache_release(pages[i++]);
+fallback:
+	while (nr--) {
+		unlock_page(head + nr);
+		page_cache_release(head + nr);
+	}
+	return VM_FAULT_FALLBACK;
+}
+
+/*
+ * Is the extent at @index, seen through @vma, fully populated with small
+ * pages which are not already a team?  Asked by khugepaged, under mmap_sem.
+ */
+bool shmem_huge_collapsible(struct vm_area_struct *vma, pgoff_t index)
+{
+	struct inode *inode = file_inode(vma->vm_file);
+	struct address_space *mapping = inode->i_mapping;
+	struct radix_tree_iter iter;
+	unsigned long head_pfn = 0;
+	struct page *page;
+	void **slot;
+	bool team = true;
+	int nr = 0;
+
+	if (!(vma->vm_flags & VM_SHARED) || (vma->vm_flags & VM_LOCKED))
+		return false;
+	if (index & (HPAGE_PMD_NR - 1))
+		return false;
+	if (((loff_t)(index + HPAGE_PMD_NR) << PAGE_CACHE_SHIFT) >
+	    i_size_read(inode))
+		return false;
+	if (!shmem_huge_enabled(inode, index, vma))
+		return false;
+
+	rcu_read_lock();
+	radix_tree_for_each_slot(slot, &mapping->page_tree, &iter, index) {
+		if (iter.index != index + nr)
+			break;
+		page = radix_tree_deref_slot(slot);
+		if (!page || radix_tree_exception(page))
+			break;
+		if (!nr)
+			head_pfn = page_to_pfn(page);
+		if (page_to_pfn(page) != head_pfn + nr)
+			team = false;
+		if (++nr == HPAGE_PMD_NR)
+			break;
+	}
+	rcu_read_unlock();
+
+	if (nr < HPAGE_PMD_NR)
+		return false;
+	return !team || (head_pfn & (HPAGE_PMD_NR - 1));
+}
+
+/*
+ * Free the page tables left empty where the extent at @index was unmapped,
+ * so that the next fault there can map a huge pmd.  The mmap_sem of each
+ * mm is only trylocked: we hold locks which rank below it.
+ */
+static void shmem_retract_page_tables(struct address_space *mapping,
+				      pgoff_t index)
+{
+	struct vm_area_struct *vma;
+	struct mm_struct *mm;
+	unsigned long addr;
+	spinlock_t *pml, *ptl;
+	pte_t *pte;
+	pmd_t *pmd, _pmd;
+	int i;
+
+	mutex_lock(&mapping->i_mmap_mutex);
+	vma_interval_tree_foreach(vma, &mapping->i_mmap, index, index) {
+		/* A private mapping may have anonymous COWs in that table */
+		if (vma->anon_vma || !vma_huge_team(vma))
+			continue;
+		addr = vma->vm_start +
+			((index - vma->vm_pgoff) << PAGE_SHIFT);
+		if ((addr & ~HPAGE_PMD_MASK) ||
+		    addr + HPAGE_PMD_SIZE > vma->vm_end)
+			continue;
+		mm = vma->vm_mm;
+		pmd = mm_find_pmd(mm, addr);
+		if (!pmd || pmd_trans_huge(*pmd))
+			continue;
+		if (!down_write_trylock(&mm->mmap_sem))
+			continue;
+
+		/*
+		 * Keep the page table locked until the pmd is cleared: a
+		 * speculative fault may fill it without mmap_sem.
+		 */
+		pml = pmd_lock(mm, pmd);
+		ptl = pte_lockptr(mm, pmd);
+		if (ptl != pml)
+			spin_lock_nested(ptl, SINGLE_DEPTH_NESTING);
+		pte = pte_offset_map(pmd, addr);
+		for (i = 0; i < HPAGE_PMD_NR; i++)
+			if (!pte_none(pte[i]))
+				break;
+		pte_unmap(pte);
+		if (i == HPAGE_PMD_NR)
+			_pmd = pmdp_clear_flush(vma, addr, pmd);
+		if (ptl != pml)
+			spin_unlock(ptl);
+		spin_unlock(pml);
+
+		if (i == HPAGE_PMD_NR) {
+			atomic_long_dec(&mm->nr_ptes);
+			pte_free(mm, pmd_pgtable(_pmd));
+		}
+		up_write(&mm->mmap_sem);
+	}
+	mutex_unlock(&mapping->i_mmap_mutex);
+}
+
+/*
+ * Copy the small pages of the extent at @index into a new team, and put
+ * that in their place in the page cache.  Called by khugepaged without
+ * mmap_sem, after shmem_huge_collapsible(): gives up with -EAGAIN if any
+ * page is busy, or is mapped in a way which unmapping cannot undo.
+ */
+int shmem_collapse_team(struct address_space *mapping, pgoff_t index)
+{
+	struct inode *inode = mapping->host;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	gfp_t gfp = mapping_gfp_mask(mapping);
+	struct page *head, *page;
+	struct page **old;
+	int nr = 0;
+	int error;
+	int i;
+
+	old = kmalloc(HPAGE_PMD_NR * sizeof(struct page *), GFP_KERNEL);
+	if (!old)
+		return -ENOMEM;
+	head = shmem_alloc_hugepage(gfp | __GFP_NORETRY | __GFP_NOWARN,
+				    info, index);
+	if (!head) {
+		kfree(old);
+		return -ENOMEM;
+	}
+	split_page(head, HPAGE_PMD_ORDER);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		SetPageSwapBacked(head + i);
+		__set_page_locked(head + i);
+	}
+
+	error = -EAGAIN;
+	lru_add_drain();
+	for (; nr < HPAGE_PMD_NR; nr++) {
+		page = find_get_page(mapping, index + nr);
+		if (!page)
+			goto out;
+		if (!trylock_page(page)) {
+			page_cache_release(page);
+			goto out;
+		}
+		old[nr] = page;
+		if (page->mapping != mapping || !PageUptodate(page) ||
+		    PageWriteback(page) || PageSwapCache(page) ||
+		    PageMlocked(page)) {
+			nr++;
+			goto out;
+		}
+	}
+
+	/* Checked again now that truncation is held off */
+	if (((loff_t)(index + HPAGE_PMD_NR) << PAGE_CACHE_SHIFT) >
+	    i_size_read(inode))
+		goto out;
+
+	unmap_mapping_range(mapping, (loff_t)index << PAGE_CACHE_SHIFT,
+			    HPAGE_PMD_SIZE, 0);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (page_mapped(old[i]))
+			goto out;
+		copy_highpage(head + i, old[i]);
+		flush_dcache_page(head + i);
+		SetPageUptodate(head + i);
+		/* unmapping has transferred any pte dirty bit to the page */
+		if (PageDirty(old[i]))
+			SetPageDirty(head + i);
+	}
+
+	spin_lock_irq(&mapping->tree_lock);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		/* one reference from the page cache, one from us */
+		if (!page_freeze_refs(old[i], 2))
+			break;
+	}
+	if (i < HPAGE_PMD_NR) {
+		while (i--)
+			page_unfreeze_refs(old[i], 2);
+		spin_unlock_irq(&mapping->tree_lock);
+		goto out;
+	}
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		void **slot;
+
+		page = head + i;
+		page->mapping = mapping;
+		page->index = index + i;
+		slot = radix_tree_lookup_slot(&mapping->page_tree, index + i);
+		radix_tree_replace_slot(slot, page);
+		old[i]->mapping = NULL;
+		__dec_zone_page_state(old[i], NR_FILE_PAGES);
+		__dec_zone_page_state(old[i], NR_SHMEM);
+		page_unfreeze_refs(old[i], 1);
+	}
+	__mod_zone_page_state(page_zone(head), NR_FILE_PAGES, HPAGE_PMD_NR);
+	__mod_zone_page_state(page_zone(head), NR_SHMEM, HPAGE_PMD_NR);
+	spin_unlock_irq(&mapping->tree_lock);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		mem_cgroup_replace_page_cache(old[i], head + i);
+
+	/* Before unlocking, so that no fault can find those tables in use */
+	shmem_retract_page_tables(mapping, index);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		lru_cache_add_anon(head + i);
+		unlock_page(head + i);
+	}
+	/* The allocation reference is the page cache reference */
+	head = NULL;
+	error = 0;
+out:
+	while (nr--) {
+		if (!error)
+			ClearPageDirty(old[nr]);
+		unlock_page(old[nr]);
+		page_cache_release(old[nr]);
+	}
+	if (head) {
+		for (i = 0; i < HPAGE_PMD_NR; i++) {
+			ClearPageDirty(head + i);
+			unlock_page(head + i);
+			page_cache_release(head + i);
+		}
+	}
+	kfree(old);
+	return error;
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 #ifdef CONFIG_NUMA
 static int shmem_set_policy(struct vm_area_struct *vma, struct mempolicy *mpol)
 {
@@ -1353,10 +2017,90 @@ out_nomem:
 	return retval;
 }
 
+/*
+ * Place a MAP_SHARED mapping which may be mapped by huge pmds so that its
+ * virtual address is congruent with its file offset modulo HPAGE_PMD_SIZE;
+ * by asking for a larger area, then trimming it to the right alignment.
+ */
+unsigned long shmem_get_unmapped_area(struct file *file,
+				      unsigned long uaddr, unsigned long len,
+				      unsigned long pgoff, unsigned long flags)
+{
+	unsigned long (*get_area)(struct file *, unsigned long,
+			unsigned long, unsigned long, unsigned long);
+	unsigned long addr;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	unsigned long offset;
+	unsigned long inflated_len;
+	unsigned long inflated_addr;
+	unsigned long inflated_offset;
+	struct super_block *sb;
+#endif
+
+	if (len > TASK_SIZE)
+		return -ENOMEM;
+
+	get_area = current->mm->get_unmapped_area;
+	addr = get_area(file, uaddr, len, pgoff, flags);
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (IS_ERR_VALUE(addr) || (addr & ~PAGE_MASK) ||
+	    addr > TASK_SIZE - len)
+		return addr;
+	/* Respect MAP_FIXED and an address hint, as before */
+	if ((flags & MAP_FIXED) || uaddr)
+		return addr;
+	if (!(flags & MAP_SHARED) || len < HPAGE_PMD_SIZE)
+		return addr;
+
+	if (file) {
+		sb = file_inode(file)->i_sb;
+	} else {
+		/* a shared anonymous object, from mm/mmap.c */
+		if (IS_ERR(shm_mnt))
+			return addr;
+		sb = shm_mnt->mnt_sb;
+	}
+	if (shmem_huge == SHMEM_HUGE_DENY)
+		return addr;
+	if (shmem_huge != SHMEM_HUGE_FORCE &&
+	    SHMEM_SB(sb)->huge == SHMEM_HUGE_NEVER)
+		return addr;
+
+	offset = (pgoff << PAGE_SHIFT) & (HPAGE_PMD_SIZE - 1);
+	if (offset && offset + len < 2 * HPAGE_PMD_SIZE)
+		return addr;
+	if ((addr & (HPAGE_PMD_SIZE - 1)) == offset)
+		return addr;
+
+	inflated_len = len + HPAGE_PMD_SIZE - PAGE_SIZE;
+	if (inflated_len > TASK_SIZE || inflated_len < len)
+		return addr;
+
+	inflated_addr = get_area(NULL, 0, inflated_len, 0, flags);
+	if (IS_ERR_VALUE(inflated_addr) || (inflated_addr & ~PAGE_MASK))
+		return addr;
+
+	inflated_offset = inflated_addr & (HPAGE_PMD_SIZE - 1);
+	inflated_addr += offset - inflated_offset;
+	if (inflated_offset > offset)
+		inflated_addr += HPAGE_PMD_SIZE;
+
+	if (inflated_addr > TASK_SIZE - len)
+		return addr;
+	return inflated_addr;
+#else
+	return addr;
+#endif
+}
+
 static int shmem_mmap(struct file *file, struct vm_area_struct *vma)
 {
 	file_accessed(file);
 	vma->vm_ops = &shmem_vm_ops;
+	if ((vma->vm_flags & VM_SHARED) && shmem_huge_scan(file_inode(file)) &&
+	    khugepaged_enter_team(vma))
+		return -ENOMEM;
 	return 0;
 }
 
@@ -2484,6 +3228,19 @@ static int shmem_parse_options(char *options, struct shmem_sb_info *sbinfo,
 			mpol = NULL;
 			if (mpol_parse_str(value, &mpol))
 				goto bad_val;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		} else if (!strcmp(this_char, "huge")) {
+			int huge;
+
+			/* deny and force are only for the sysfs override */
+			huge = shmem_parse_huge(value);
+			if (huge < 0)
+				goto bad_val;
+			if (!has_transparent_hugepage() &&
+			    huge != SHMEM_HUGE_NEVER)
+				goto bad_val;
+			sbinfo->huge = huge;
+#endif
 		} else {
 			printk(KERN_ERR "tmpfs: Bad mount option %s\n",
 			       this_char);
@@ -2533,6 +3290,7 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 	sbinfo->max_blocks  = config.max_blocks;
 	sbinfo->max_inodes  = config.max_inodes;
 	sbinfo->free_inodes = config.max_inodes - inodes;
+	sbinfo->huge = config.huge;
 
 	/*
 	 * Preserve previous mempolicy unless mpol remount option was specified.
@@ -2564,6 +3322,10 @@ static int shmem_show_options(struct seq_file *seq, struct dentry *root)
 		seq_printf(seq, ",gid=%u",
 				from_kgid_munged(&init_user_ns, sbinfo->gid));
 	shmem_show_mpol(seq, sbinfo->mpol);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (sbinfo->huge)
+		seq_printf(seq, ",huge=%s", shmem_format_huge(sbinfo->huge));
+#endif
 	return 0;
 }
 #endif /* CONFIG_TMPFS */
@@ -2706,6 +3468,7 @@ static const struct address_space_operations shmem_aops = {
 
 static const struct file_operations shmem_file_operations = {
 	.mmap		= shmem_mmap,
+	.get_unmapped_area = shmem_get_unmapped_area,
 #ifdef CONFIG_TMPFS
 	.llseek		= shmem_file_llseek,
 	.read		= do_sync_read,
@@ -2784,6 +3547,9 @@ static const struct super_operations shmem_ops = {
 static const struct vm_operations_struct shmem_vm_ops = {
 	.fault		= shmem_fault,
 	.map_pages	= filemap_map_pages,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.pmd_fault	= shmem_pmd_fault,
+#endif
 #ifdef CONFIG_NUMA
 	.set_policy     = shmem_set_policy,
 	.get_policy     = shmem_get_policy,
@@ -2833,6 +3599,13 @@ int __init shmem_init(void)
 		printk(KERN_ERR "Could not kern_mount tmpfs\n");
 		goto out1;
 	}
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (!has_transparent_hugepage())
+		shmem_huge = SHMEM_HUGE_NEVER;
+	else if (shmem_huge > SHMEM_HUGE_DENY)
+		SHMEM_SB(shm_mnt->mnt_sb)->huge = shmem_huge;
+#endif
 	return 0;
 
 out1:
@@ -2846,6 +3619,60 @@ out4:
 	return error;
 }
 
+#if defined(CONFIG_SYSFS) && defined(CONFIG_TRANSPARENT_HUGEPAGE)
+static ssize_t shmem_enabled_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	static const int values[] = {
+		SHMEM_HUGE_ALWAYS,
+		SHMEM_HUGE_WITHIN_SIZE,
+		SHMEM_HUGE_ADVISE,
+		SHMEM_HUGE_NEVER,
+		SHMEM_HUGE_DENY,
+		SHMEM_HUGE_FORCE,
+	};
+	int i, count;
+
+	for (i = 0, count = 0; i < ARRAY_SIZE(values); i++) {
+		const char *fmt = shmem_huge == values[i] ? "[%s] " : "%s ";
+
+		count += sprintf(buf + count, fmt,
+				 shmem_format_huge(values[i]));
+	}
+	buf[count - 1] = '\n';
+	return count;
+}
+
+static ssize_t shmem_enabled_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	char tmp[16];
+	int huge;
+
+	if (count + 1 > sizeof(tmp))
+		return -EINVAL;
+	memcpy(tmp, buf, count);
+	tmp[count] = '\0';
+	if (count && tmp[count - 1] == '\n')
+		tmp[count - 1] = '\0';
+
+	huge = shmem_parse_huge(tmp);
+	if (huge == -EINVAL)
+		return -EINVAL;
+	if (!has_transparent_hugepage() &&
+	    huge != SHMEM_HUGE_NEVER && huge != SHMEM_HUGE_DENY)
+		return -EINVAL;
+
+	shmem_huge = huge;
+	if (shmem_huge > SHMEM_HUGE_DENY)
+		SHMEM_SB(shm_mnt->mnt_sb)->huge = shmem_huge;
+	return count;
+}
+
+struct kobj_attribute shmem_enabled_attr =
+	__ATTR(shmem_enabled, 0644, shmem_enabled_show, shmem_enabled_store);
+#endif /* CONFIG_SYSFS && CONFIG_TRANSPARENT_HUGEPAGE */
+
 #else /* !CONFIG_SHMEM */
 
 /*
@@ -2894,11 +3721,21 @@ void shmem_truncate_range(struct inode *inode, loff_t lstart, loff_t lend)
 }
 EXPORT_SYMBOL_GPL(shmem_truncate_range);
 
+#ifdef CONFIG_MMU
+unsigned long shmem_get_unmapped_area(struct file *file,
+				      unsigned long addr, unsigned long len,
+				      unsigned long pgoff, unsigned long flags)
+{
+	return current->mm->get_unmapped_area(file, addr, len, pgoff, flags);
+}
+#endif
+
 #define shmem_vm_ops				generic_file_vm_ops
 #define shmem_file_operations			ramfs_file_operations
 #define shmem_get_inode(sb, dir, mode, dev, flags)	ramfs_get_inode(sb, dir, mode, dev)
 #define shmem_acct_size(flags, size)		0
 #define shmem_unacct_size(flags, size)		do {} while (0)
+#define shmem_huge_scan(inode)			false
 
 #endif /* CONFIG_SHMEM */
 
@@ -3008,6 +3845,8 @@ int shmem_zero_setup(struct vm_area_struct *vma)
 		fput(vma->vm_file);
 	vma->vm_file = file;
 	vma->vm_ops = &shmem_vm_ops;
+	if (shmem_huge_scan(file_inode(file)) && khugepaged_enter_team(vma))
+		return -ENOMEM;
 	return 0;
 }
 
@@ -3035,7 +3874,8 @@ struct page *shmem_read_mapping_page_gfp(struct address_space *mapping,
 	int error;
 
 	BUG_ON(mapping->a_ops != &shmem_aops);
-	error = shmem_getpage_gfp(inode, index, &page, SGP_CACHE, gfp, NULL);
+	error = shmem_getpage_gfp(inode, index, &page, SGP_CACHE, gfp, NULL,
+				  NULL);
 	if (error)
 		page = ERR_PTR(error);
 	else
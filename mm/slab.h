@@ -93,6 +93,10 @@ __kmem_cache_alias(const char *name, size_t size, size_t align,
 int __kmem_cache_shutdown(struct kmem_cache *);
 void slab_kmem_cache_release(struct kmem_cache *);
 
+/* Object by object bulk operations, for allocators without a faster way */
+void __kmem_cache_free_bulk(struct kmem_cache *, size_t, void **);
+bool __kmem_cache_alloc_bulk(struct kmem_cache *, gfp_t, size_t, void **);
+
 struct seq_file;
 struct file;
 
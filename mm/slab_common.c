@@ -372,6 +372,30 @@ out_put_cpus:
 }
 EXPORT_SYMBOL(kmem_cache_destroy);
 
+void __kmem_cache_free_bulk(struct kmem_cache *s, size_t nr, void **p)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++)
+		kmem_cache_free(s, p[i]);
+}
+
+bool __kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t nr,
+			     void **p)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		p[i] = kmem_cache_alloc(s, flags);
+		if (!p[i]) {
+			__kmem_cache_free_bulk(s, i, p);
+			return false;
+		}
+	}
+
+	return true;
+}
+
 int slab_is_available(void)
 {
 	return slab_state >= UP;
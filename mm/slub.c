@@ -2706,6 +2706,125 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+/*
+ * Bulk allocation and freeing
+ *
+ * The per cpu freelist is worked on with interrupts disabled once for the
+ * whole batch instead of with a cmpxchg_double per object. Objects it
+ * can't serve go through __slab_alloc() and __slab_free(), which fall
+ * back to the partial lists and whole slabs.
+ *
+ * Interrupts must be enabled when calling these.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
+{
+	struct kmem_cache_cpu *c;
+	struct page *page;
+	size_t i;
+
+	/* the debug checks want the regular paths */
+	if (kmem_cache_debug(s)) {
+		__kmem_cache_free_bulk(s, size, p);
+		return;
+	}
+
+	local_irq_disable();
+	c = this_cpu_ptr(s->cpu_slab);
+
+	for (i = 0; i < size; i++) {
+		void *object = p[i];
+		struct kmem_cache *cachep;
+
+		cachep = cache_from_obj(s, object);
+		if (unlikely(!cachep))
+			continue;
+
+		slab_free_hook(cachep, object);
+		page = virt_to_head_page(object);
+
+		if (likely(cachep == s && page == c->page)) {
+			set_freepointer(s, object, c->freelist);
+			c->freelist = object;
+			stat(s, FREE_FASTPATH);
+		} else {
+			/* a racing fastpath must see the freelist changed */
+			c->tid = next_tid(c->tid);
+			local_irq_enable();
+			__slab_free(cachep, page, object, _RET_IP_);
+			local_irq_disable();
+			c = this_cpu_ptr(s->cpu_slab);
+		}
+		trace_kmem_cache_free(_RET_IP_, object);
+	}
+
+	c->tid = next_tid(c->tid);
+	local_irq_enable();
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
+bool kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
+			   void **p)
+{
+	struct kmem_cache_cpu *c;
+	size_t i, j;
+
+	if (kmem_cache_debug(s))
+		return __kmem_cache_alloc_bulk(s, flags, size, p);
+
+	if (slab_pre_alloc_hook(s, flags))
+		return false;
+
+	s = memcg_kmem_get_cache(s, flags);
+
+	local_irq_disable();
+	c = this_cpu_ptr(s->cpu_slab);
+
+	for (i = 0; i < size; i++) {
+		void *object = c->freelist;
+
+		if (unlikely(!object)) {
+			c->tid = next_tid(c->tid);
+			local_irq_enable();
+
+			/* this usually refills the per cpu freelist too */
+			p[i] = __slab_alloc(s, flags, NUMA_NO_NODE,
+					    _RET_IP_, c);
+			if (unlikely(!p[i]))
+				goto error;
+
+			local_irq_disable();
+			c = this_cpu_ptr(s->cpu_slab);
+			continue;
+		}
+
+		c->freelist = get_freepointer(s, object);
+		p[i] = object;
+		stat(s, ALLOC_FASTPATH);
+	}
+
+	c->tid = next_tid(c->tid);
+	local_irq_enable();
+
+	/* clear and register the objects outside of the irq disabled loop */
+	for (j = 0; j < size; j++) {
+		if (unlikely(flags & __GFP_ZERO))
+			memset(p[j], 0, s->object_size);
+		slab_post_alloc_hook(s, flags, p[j]);
+		trace_kmem_cache_alloc(_RET_IP_, p[j], s->object_size,
+				       s->size, flags);
+	}
+
+	return true;
+
+error:
+	for (j = 0; j < i; j++)
+		slab_post_alloc_hook(s, flags, p[j]);
+	__kmem_cache_free_bulk(s, i, p);
+
+	return false;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
 /*
  * Object placement in a slab is made very easy because we always start at
  * offset 0. If we tune the size of the object to the alignment then we can
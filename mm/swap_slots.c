@@ -0,0 +1,291 @@
+/*
+ *  linux/mm/swap_slots.c
+ *
+ *  Per-cpu caches of swap slots, so that allocating and freeing a swap
+ *  entry does not have to take swap_lock and si->lock each time.
+ *
+ *  Each cpu keeps an array of entries which get_swap_page() hands out,
+ *  refilled in a batch by get_swap_pages(); and an array of entries which
+ *  free_swap_slot() collects, returned in a batch by
+ *  swapcache_free_entries() when it is full.
+ *
+ *  An entry in either array is kept allocated in swap_map, with just
+ *  SWAP_HAS_CACHE set: swapoff must drain the caches before it can look
+ *  for entries still in use, and does so by disable_swap_slots_cache_lock().
+ *
+ *  The caches hold back swap space from the other cpus, so they are
+ *  deactivated, and drained, when free swap gets low; and reactivated
+ *  when there is plenty again.
+ */
+
+#include <linux/swap.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+
+#define SWAP_SLOTS_CACHE_SIZE			64
+#define THRESHOLD_ACTIVATE_SWAP_SLOTS_CACHE	(5 * SWAP_SLOTS_CACHE_SIZE)
+#define THRESHOLD_DEACTIVATE_SWAP_SLOTS_CACHE	(2 * SWAP_SLOTS_CACHE_SIZE)
+
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects slots, nr, cur */
+	swp_entry_t	*slots;
+	int		nr;
+	int		cur;
+	spinlock_t	free_lock;	/* protects slots_ret, n_ret */
+	swp_entry_t	*slots_ret;
+	int		n_ret;
+};
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+
+/* Cleared by swapoff while it looks for entries in use */
+bool swap_slot_cache_enabled;
+/* Cleared while free swap is too low to leave any in the caches */
+static bool swap_slot_cache_active;
+static bool swap_slot_cache_initialized;
+/* Serializes activation and deactivation */
+static DEFINE_MUTEX(swap_slots_cache_mutex);
+/* Serializes enabling and disabling */
+static DEFINE_MUTEX(swap_slots_cache_enable_mutex);
+
+#define SLOTS_CACHE	0x1
+#define SLOTS_CACHE_RET	0x2
+
+#define use_swap_slot_cache	(swap_slot_cache_active && \
+				 swap_slot_cache_enabled)
+
+static void drain_slots_cache_cpu(unsigned int cpu, unsigned int type)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+	if ((type & SLOTS_CACHE) && cache->slots) {
+		mutex_lock(&cache->alloc_lock);
+		swapcache_free_entries(cache->slots + cache->cur, cache->nr);
+		cache->cur = 0;
+		cache->nr = 0;
+		mutex_unlock(&cache->alloc_lock);
+	}
+	if ((type & SLOTS_CACHE_RET) && cache->slots_ret) {
+		spin_lock(&cache->free_lock);
+		swapcache_free_entries(cache->slots_ret, cache->n_ret);
+		cache->n_ret = 0;
+		spin_unlock(&cache->free_lock);
+	}
+}
+
+/*
+ * The caches of all possible cpus were set up together, and are never
+ * freed: so draining them needs no protection against cpu hotplug.
+ */
+static void __drain_swap_slots_cache(unsigned int type)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		drain_slots_cache_cpu(cpu, type);
+}
+
+static void deactivate_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	swap_slot_cache_active = false;
+	__drain_swap_slots_cache(SLOTS_CACHE | SLOTS_CACHE_RET);
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+static void reactivate_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	swap_slot_cache_active = true;
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+static bool check_cache_active(void)
+{
+	long pages;
+
+	if (!swap_slot_cache_enabled)
+		return false;
+
+	pages = get_nr_swap_pages();
+	if (!swap_slot_cache_active) {
+		if (pages > num_online_cpus() *
+			    THRESHOLD_ACTIVATE_SWAP_SLOTS_CACHE)
+			reactivate_swap_slots_cache();
+		goto out;
+	}
+
+	/* If the global pool of free entries is too low, stop caching */
+	if (pages < num_online_cpus() * THRESHOLD_DEACTIVATE_SWAP_SLOTS_CACHE)
+		deactivate_swap_slots_cache();
+out:
+	return swap_slot_cache_active;
+}
+
+/* A cpu going away leaves its entries behind: give them back */
+static int swap_slots_cpu_callback(struct notifier_block *nfb,
+				   unsigned long action, void *hcpu)
+{
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_slots_cache_cpu((long)hcpu, SLOTS_CACHE | SLOTS_CACHE_RET);
+	return NOTIFY_OK;
+}
+
+static int alloc_swap_slot_caches(void)
+{
+	struct swap_slots_cache *cache;
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		cache = &per_cpu(swp_slots, cpu);
+		cache->slots = kcalloc(SWAP_SLOTS_CACHE_SIZE,
+				       sizeof(swp_entry_t), GFP_KERNEL);
+		cache->slots_ret = kcalloc(SWAP_SLOTS_CACHE_SIZE,
+					   sizeof(swp_entry_t), GFP_KERNEL);
+		if (!cache->slots || !cache->slots_ret)
+			goto fail;
+		mutex_init(&cache->alloc_lock);
+		spin_lock_init(&cache->free_lock);
+		cache->nr = 0;
+		cache->cur = 0;
+		cache->n_ret = 0;
+	}
+	hotcpu_notifier(swap_slots_cpu_callback, 0);
+	return 0;
+
+fail:
+	for_each_possible_cpu(cpu) {
+		cache = &per_cpu(swp_slots, cpu);
+		kfree(cache->slots);
+		kfree(cache->slots_ret);
+		cache->slots = NULL;
+		cache->slots_ret = NULL;
+	}
+	return -ENOMEM;
+}
+
+/*
+ * Called by swapon: the caches are set up the first time, and are not used
+ * until there is some swap for them to hold.  If they cannot be allocated,
+ * swap just goes on without them.
+ */
+void enable_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_enable_mutex);
+	if (!swap_slot_cache_initialized) {
+		if (alloc_swap_slot_caches())
+			goto out_unlock;
+		swap_slot_cache_initialized = true;
+		swap_slot_cache_active = true;
+	}
+	swap_slot_cache_enabled = has_usable_swap();
+out_unlock:
+	mutex_unlock(&swap_slots_cache_enable_mutex);
+}
+
+/*
+ * Called by swapoff, before try_to_unuse(): stops using the caches, and
+ * returns all the entries held in them to their devices.
+ */
+void disable_swap_slots_cache_lock(void)
+{
+	mutex_lock(&swap_slots_cache_enable_mutex);
+	swap_slot_cache_enabled = false;
+	if (swap_slot_cache_initialized)
+		__drain_swap_slots_cache(SLOTS_CACHE | SLOTS_CACHE_RET);
+}
+
+void reenable_swap_slots_cache_unlock(void)
+{
+	if (swap_slot_cache_initialized)
+		swap_slot_cache_enabled = has_usable_swap();
+	mutex_unlock(&swap_slots_cache_enable_mutex);
+}
+
+/* Called with cache->alloc_lock held */
+static int refill_swap_slots_cache(struct swap_slots_cache *cache)
+{
+	if (!use_swap_slot_cache || cache->nr)
+		return 0;
+
+	cache->cur = 0;
+	cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE, cache->slots);
+
+	return cache->nr;
+}
+
+/**
+ * free_swap_slot - free a swap entry no longer referenced
+ * @entry: the entry, left with just SWAP_HAS_CACHE by its last user
+ *
+ * The entry is collected in this cpu's cache, to be returned to its device
+ * with the others at once.  May be called under spinlocks.
+ */
+int free_swap_slot(swp_entry_t entry)
+{
+	struct swap_slots_cache *cache;
+
+	cache = &get_cpu_var(swp_slots);
+	if (use_swap_slot_cache && cache->slots_ret) {
+		spin_lock(&cache->free_lock);
+		/* The cache may have been deactivated meanwhile */
+		if (!use_swap_slot_cache) {
+			spin_unlock(&cache->free_lock);
+			goto direct_free;
+		}
+		if (cache->n_ret >= SWAP_SLOTS_CACHE_SIZE) {
+			swapcache_free_entries(cache->slots_ret,
+					       cache->n_ret);
+			cache->n_ret = 0;
+		}
+		cache->slots_ret[cache->n_ret++] = entry;
+		spin_unlock(&cache->free_lock);
+	} else {
+direct_free:
+		swapcache_free_entries(&entry, 1);
+	}
+	put_cpu_var(swp_slots);
+
+	return 0;
+}
+
+/**
+ * get_swap_page - allocate a swap entry for the swap cache
+ *
+ * Takes an entry from this cpu's cache, refilling it by a batch from the
+ * swap devices when empty.  May sleep: the cache is protected by a mutex,
+ * so it does not matter if we are moved to another cpu meanwhile.
+ */
+swp_entry_t get_swap_page(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t entry, *pentry;
+
+	entry.val = 0;
+	cache = raw_cpu_ptr(&swp_slots);
+
+	if (check_cache_active()) {
+		mutex_lock(&cache->alloc_lock);
+		if (cache->slots) {
+repeat:
+			if (cache->nr) {
+				pentry = &cache->slots[cache->cur++];
+				entry = *pentry;
+				pentry->val = 0;
+				cache->nr--;
+			} else if (refill_swap_slots_cache(cache)) {
+				goto repeat;
+			}
+		}
+		mutex_unlock(&cache->alloc_lock);
+		if (entry.val)
+			return entry;
+	}
+
+	get_swap_pages(1, &entry);
+
+	return entry;
+}
@@ -65,6 +65,30 @@ unsigned long total_swapcache_pages(void)
 
 static atomic_t swapin_readahead_hits = ATOMIC_INIT(4);
 
+bool swap_vma_readahead_enabled __read_mostly = true;
+
+/*
+ * vma->swap_readahead_info packs the page aligned address of the last swap
+ * fault in the vma, with the readahead window used for it, and the hits on
+ * the pages read ahead since then in the bits below PAGE_SHIFT.
+ */
+#define SWAP_RA_WIN_SHIFT	(PAGE_SHIFT / 2)
+#define SWAP_RA_HITS_MASK	((1UL << SWAP_RA_WIN_SHIFT) - 1)
+#define SWAP_RA_HITS_MAX	SWAP_RA_HITS_MASK
+#define SWAP_RA_WIN_MASK	(~PAGE_MASK & ~SWAP_RA_HITS_MASK)
+
+#define SWAP_RA_HITS(v)		((v) & SWAP_RA_HITS_MASK)
+#define SWAP_RA_WIN(v)		(((v) & SWAP_RA_WIN_MASK) >> SWAP_RA_WIN_SHIFT)
+#define SWAP_RA_ADDR(v)		((v) & PAGE_MASK)
+
+#define SWAP_RA_VAL(addr, win, hits)				\
+	(((addr) & PAGE_MASK) |					\
+	 (((win) << SWAP_RA_WIN_SHIFT) & SWAP_RA_WIN_MASK) |	\
+	 ((hits) & SWAP_RA_HITS_MASK))
+
+/* Readahead by virtual address never looks at more than 32 ptes */
+#define SWAP_RA_ORDER_CEILING	5
+
 void show_swap_cache_info(void)
 {
 	printk("%lu pages in swap cache\n", total_swapcache_pages());
@@ -79,11 +103,14 @@ void show_swap_cache_info(void)
 /*
  * __add_to_swap_cache resembles add_to_page_cache_locked on swapper_space,
  * but sets SwapCache flag and private instead of mapping and index.
+ * A shadow entry left by the eviction of the page last read from the
+ * entry is replaced, and returned in *@shadowp if that is not NULL.
  */
-int __add_to_swap_cache(struct page *page, swp_entry_t entry)
+int __add_to_swap_cache(struct page *page, swp_entry_t entry, void **shadowp)
 {
 	int error;
 	struct address_space *address_space;
+	void **slot;
 
 	VM_BUG_ON_PAGE(!PageLocked(page), page);
 	VM_BUG_ON_PAGE(PageSwapCache(page), page);
@@ -95,8 +122,23 @@ int __add_to_swap_cache(struct page *page, swp_entry_t entry)
 
 	address_space = swap_address_space(entry);
 	spin_lock_irq(&address_space->tree_lock);
-	error = radix_tree_insert(&address_space->page_tree,
-					entry.val, page);
+	slot = radix_tree_lookup_slot(&address_space->page_tree, entry.val);
+	if (slot) {
+		void *p;
+
+		p = radix_tree_deref_slot_protected(slot,
+						    &address_space->tree_lock);
+		error = -EEXIST;
+		if (radix_tree_exceptional_entry(p)) {
+			if (shadowp)
+				*shadowp = p;
+			radix_tree_replace_slot(slot, page);
+			address_space->nrshadows--;
+			error = 0;
+		}
+	} else
+		error = radix_tree_insert(&address_space->page_tree,
+					  entry.val, page);
 	if (likely(!error)) {
 		address_space->nrpages++;
 		__inc_zone_page_state(page, NR_FILE_PAGES);
@@ -126,7 +168,7 @@ int add_to_swap_cache(struct page *page, swp_entry_t entry, gfp_t gfp_mask)
 
 	error = radix_tree_maybe_preload(gfp_mask);
 	if (!error) {
-		error = __add_to_swap_cache(page, entry);
+		error = __add_to_swap_cache(page, entry, NULL);
 		radix_tree_preload_end();
 	}
 	return error;
@@ -134,9 +176,10 @@ int add_to_swap_cache(struct page *page, swp_entry_t entry, gfp_t gfp_mask)
 
 /*
  * This must be called only on pages that have
- * been verified to be in the swap cache.
+ * been verified to be in the swap cache.  A @shadow entry, if any, is left
+ * in the page's place until the swap entry is freed.
  */
-void __delete_from_swap_cache(struct page *page)
+void __delete_from_swap_cache(struct page *page, void *shadow)
 {
 	swp_entry_t entry;
 	struct address_space *address_space;
@@ -147,7 +190,19 @@ void __delete_from_swap_cache(struct page *page)
 
 	entry.val = page_private(page);
 	address_space = swap_address_space(entry);
-	radix_tree_delete(&address_space->page_tree, page_private(page));
+	if (shadow) {
+		unsigned int tag;
+		void **slot;
+
+		slot = radix_tree_lookup_slot(&address_space->page_tree,
+					      entry.val);
+		for (tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++)
+			radix_tree_tag_clear(&address_space->page_tree,
+					     entry.val, tag);
+		radix_tree_replace_slot(slot, shadow);
+		address_space->nrshadows++;
+	} else
+		radix_tree_delete(&address_space->page_tree, entry.val);
 	set_page_private(page, 0);
 	ClearPageSwapCache(page);
 	address_space->nrpages--;
@@ -155,6 +210,33 @@ void __delete_from_swap_cache(struct page *page)
 	INC_CACHE_INFO(del_total);
 }
 
+/**
+ * clear_shadow_from_swap_cache - drop the shadow entry of a freed swap entry
+ * @entry: the swap entry, which no longer has a page or any users
+ *
+ * Shadow entries in the swap cache are not reclaimed by the shadow node
+ * shrinker: they live only as long as the swap entry they were left in.
+ */
+void clear_shadow_from_swap_cache(swp_entry_t entry)
+{
+	struct address_space *address_space = swap_address_space(entry);
+	unsigned long flags;
+	void **slot;
+
+	if (!ACCESS_ONCE(address_space->nrshadows))
+		return;
+
+	spin_lock_irqsave(&address_space->tree_lock, flags);
+	slot = radix_tree_lookup_slot(&address_space->page_tree, entry.val);
+	if (slot && radix_tree_exceptional_entry(
+			radix_tree_deref_slot_protected(slot,
+					&address_space->tree_lock))) {
+		radix_tree_delete(&address_space->page_tree, entry.val);
+		address_space->nrshadows--;
+	}
+	spin_unlock_irqrestore(&address_space->tree_lock, flags);
+}
+
 /**
  * add_to_swap - allocate swap space for a page
  * @page: page we want to move to swap
@@ -222,7 +304,7 @@ void delete_from_swap_cache(struct page *page)
 
 	address_space = swap_address_space(entry);
 	spin_lock_irq(&address_space->tree_lock);
-	__delete_from_swap_cache(page);
+	__delete_from_swap_cache(page, NULL);
 	spin_unlock_irq(&address_space->tree_lock);
 
 	swapcache_free(entry, page);
@@ -282,16 +364,33 @@ void free_pages_and_swap_cache(struct page **pages, int nr)
  * lock getting page table operations atomic even if we drop the page
  * lock before returning.
  */
-struct page * lookup_swap_cache(swp_entry_t entry)
+struct page *lookup_swap_cache(swp_entry_t entry,
+			struct vm_area_struct *vma, unsigned long addr)
 {
 	struct page *page;
 
 	page = find_get_page(swap_address_space(entry), entry.val);
 
 	if (page) {
+		bool readahead = TestClearPageReadahead(page);
+
 		INC_CACHE_INFO(find_success);
-		if (TestClearPageReadahead(page))
+		if (vma && swap_use_vma_readahead()) {
+			unsigned long ra_info, win, hits;
+
+			ra_info = atomic_long_read(&vma->swap_readahead_info);
+			win = SWAP_RA_WIN(ra_info);
+			hits = SWAP_RA_HITS(ra_info);
+			if (readahead)
+				hits = min_t(unsigned long, hits + 1,
+					     SWAP_RA_HITS_MAX);
+			atomic_long_set(&vma->swap_readahead_info,
+					SWAP_RA_VAL(addr, win, hits));
+		} else if (readahead) {
 			atomic_inc(&swapin_readahead_hits);
+		}
+		if (readahead)
+			count_vm_event(SWAP_RA_HIT);
 	}
 
 	INC_CACHE_INFO(find_total);
@@ -308,6 +407,7 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 			struct vm_area_struct *vma, unsigned long addr)
 {
 	struct page *found_page, *new_page = NULL;
+	void *shadow = NULL;
 	int err;
 
 	do {
@@ -343,6 +443,14 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		err = swapcache_prepare(entry);
 		if (err == -EEXIST) {
 			radix_tree_preload_end();
+			/*
+			 * A free entry parked in a swap slots cache is left
+			 * with just SWAP_HAS_CACHE for as long as it is there:
+			 * don't wait for that, there is nothing to read.
+			 * Swapoff disables the caches before it gets here.
+			 */
+			if (swap_slot_cache_enabled && !swap_entry_count(entry))
+				break;
 			/*
 			 * We might race against get_swap_page() and stumble
 			 * across a SWAP_HAS_CACHE swap_map entry whose page
@@ -369,9 +477,16 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		/* May fail (-ENOMEM) if radix-tree node allocation failed. */
 		__set_page_locked(new_page);
 		SetPageSwapBacked(new_page);
-		err = __add_to_swap_cache(new_page, entry);
+		err = __add_to_swap_cache(new_page, entry, &shadow);
 		if (likely(!err)) {
 			radix_tree_preload_end();
+			/*
+			 * A page swapped in soon after it was reclaimed goes
+			 * straight back to the active list, and the refault
+			 * is charged to the lruvec it was evicted from.
+			 */
+			if (shadow && workingset_refault(new_page, shadow))
+				SetPageActive(new_page);
 			/*
 			 * Initiate read into locked page and return.
 			 */
@@ -394,22 +509,23 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 	return found_page;
 }
 
-static unsigned long swapin_nr_pages(unsigned long offset)
+/*
+ * Size the readahead window from the hits on the previous one, and from
+ * whether @offset is next to @prev_offset; whether these are offsets in
+ * swap or page numbers in a vma.
+ */
+static unsigned int __swapin_nr_pages(unsigned long prev_offset,
+				      unsigned long offset, int hits,
+				      int max_pages, int prev_win)
 {
-	static unsigned long prev_offset;
-	unsigned int pages, max_pages, last_ra;
-	static atomic_t last_readahead_pages;
-
-	max_pages = 1 << ACCESS_ONCE(page_cluster);
-	if (max_pages <= 1)
-		return 1;
+	unsigned int pages, last_ra;
 
 	/*
 	 * This heuristic has been found to work well on both sequential and
 	 * random loads, swapping to hard disk or to SSD: please don't ask
 	 * what the "+ 2" means, it just happens to work well, that's all.
 	 */
-	pages = atomic_xchg(&swapin_readahead_hits, 0) + 2;
+	pages = hits + 2;
 	if (pages == 2) {
 		/*
 		 * We can have no readahead hits to judge by: but must not get
@@ -418,7 +534,6 @@ static unsigned long swapin_nr_pages(unsigned long offset)
 		 */
 		if (offset != prev_offset + 1 && offset != prev_offset - 1)
 			pages = 1;
-		prev_offset = offset;
 	} else {
 		unsigned int roundup = 4;
 		while (roundup < pages)
@@ -430,9 +545,29 @@ static unsigned long swapin_nr_pages(unsigned long offset)
 		pages = max_pages;
 
 	/* Don't shrink readahead too fast */
-	last_ra = atomic_read(&last_readahead_pages) / 2;
+	last_ra = prev_win / 2;
 	if (pages < last_ra)
 		pages = last_ra;
+
+	return pages;
+}
+
+static unsigned long swapin_nr_pages(unsigned long offset)
+{
+	static unsigned long prev_offset;
+	unsigned int pages, max_pages;
+	static atomic_t last_readahead_pages;
+	int hits;
+
+	max_pages = 1 << ACCESS_ONCE(page_cluster);
+	if (max_pages <= 1)
+		return 1;
+
+	hits = atomic_xchg(&swapin_readahead_hits, 0);
+	pages = __swapin_nr_pages(prev_offset, offset, hits, max_pages,
+				  atomic_read(&last_readahead_pages));
+	if (!hits)
+		prev_offset = offset;
 	atomic_set(&last_readahead_pages, pages);
 
 	return pages;
@@ -484,8 +619,10 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 						gfp_mask, vma, addr);
 		if (!page)
 			continue;
-		if (offset != entry_offset)
+		if (offset != entry_offset) {
 			SetPageReadahead(page);
+			count_vm_event(SWAP_RA);
+		}
 		page_cache_release(page);
 	}
 	blk_finish_plug(&plug);
@@ -494,3 +631,165 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 skip:
 	return read_swap_cache_async(entry, gfp_mask, vma, addr);
 }
+
+/*
+ * Keep the window inside the vma, and inside the page table which maps
+ * the faulting address.
+ */
+static inline void swap_ra_clamp_pfn(struct vm_area_struct *vma,
+				     unsigned long faddr,
+				     unsigned long lpfn, unsigned long rpfn,
+				     unsigned long *start, unsigned long *end)
+{
+	*start = max3(lpfn, PFN_DOWN(vma->vm_start),
+		      PFN_DOWN(faddr & PMD_MASK));
+	*end = min3(rpfn, PFN_DOWN(vma->vm_end),
+		    PFN_DOWN((faddr & PMD_MASK) + PMD_SIZE));
+}
+
+/**
+ * swap_vma_readahead - swap in pages mapped near the faulting address
+ * @fentry: swap entry of the faulting pte
+ * @gfp_mask: memory allocation flags
+ * @vma: user vma the faulting address belongs to
+ * @faddr: the faulting address
+ * @pmd: the pmd mapping the page table of @faddr
+ *
+ * Returns the struct page for @fentry and @faddr, after queueing swapin.
+ *
+ * Unlike swapin_readahead(), which reads the neighbours of @fentry in the
+ * swap area, this reads the swap entries found in the ptes around @faddr:
+ * those are the pages likely to be faulted next, wherever they were put
+ * in swap.  The window is sized from the hits on the pages last read ahead
+ * for @vma, and follows the direction the faults are moving in.
+ *
+ * Caller must hold down_read on the vma->vm_mm.
+ */
+struct page *swap_vma_readahead(swp_entry_t fentry, gfp_t gfp_mask,
+				struct vm_area_struct *vma, unsigned long faddr,
+				pmd_t *pmd)
+{
+	pte_t ptes[1 << SWAP_RA_ORDER_CEILING];
+	unsigned long ra_info, fpfn, pfn, start, end, addr;
+	unsigned int max_win, win, prev_win, hits, left;
+	unsigned int i, nr_pte;
+	struct blk_plug plug;
+	struct page *page;
+	swp_entry_t entry;
+	pte_t *pte;
+
+	max_win = 1 << min_t(unsigned int, ACCESS_ONCE(page_cluster),
+			     SWAP_RA_ORDER_CEILING);
+	if (max_win == 1)
+		goto skip;
+
+	fpfn = PFN_DOWN(faddr);
+	ra_info = atomic_long_read(&vma->swap_readahead_info);
+	pfn = PFN_DOWN(SWAP_RA_ADDR(ra_info));
+	prev_win = SWAP_RA_WIN(ra_info);
+	hits = SWAP_RA_HITS(ra_info);
+	win = __swapin_nr_pages(pfn, fpfn, hits, max_win, prev_win);
+	atomic_long_set(&vma->swap_readahead_info,
+			SWAP_RA_VAL(faddr, win, 0));
+	if (win == 1)
+		goto skip;
+
+	/* Read ahead the way the faults are moving, or else around this one */
+	if (fpfn == pfn + 1)
+		left = 0;
+	else if (pfn == fpfn + 1)
+		left = win - 1;
+	else
+		left = (win - 1) / 2;
+	left = min_t(unsigned long, left, fpfn);
+	swap_ra_clamp_pfn(vma, faddr, fpfn - left, fpfn - left + win,
+			  &start, &end);
+
+	/*
+	 * Take a copy of the ptes without the pte lock: they are only a hint,
+	 * read_swap_cache_async() checks each entry is still in use.
+	 */
+	nr_pte = end - start;
+	pte = pte_offset_map(pmd, start << PAGE_SHIFT);
+	for (i = 0; i < nr_pte; i++)
+		ptes[i] = pte[i];
+	pte_unmap(pte);
+
+	blk_start_plug(&plug);
+	addr = start << PAGE_SHIFT;
+	for (i = 0; i < nr_pte; i++, addr += PAGE_SIZE) {
+		if (pte_none(ptes[i]) || pte_present(ptes[i]) ||
+		    pte_file(ptes[i]))
+			continue;
+		entry = pte_to_swp_entry(ptes[i]);
+		if (unlikely(non_swap_entry(entry)))
+			continue;
+		page = read_swap_cache_async(entry, gfp_mask, vma, addr);
+		if (!page)
+			continue;
+		if (PFN_DOWN(addr) != fpfn) {
+			SetPageReadahead(page);
+			count_vm_event(SWAP_RA);
+		}
+		page_cache_release(page);
+	}
+	blk_finish_plug(&plug);
+
+	lru_add_drain();	/* Push any new pages onto the LRU now */
+skip:
+	return read_swap_cache_async(fentry, gfp_mask, vma, faddr);
+}
+
+#ifdef CONFIG_SYSFS
+static ssize_t vma_ra_enabled_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", swap_vma_readahead_enabled);
+}
+
+static ssize_t vma_ra_enabled_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	bool enabled;
+
+	if (strtobool(buf, &enabled))
+		return -EINVAL;
+
+	swap_vma_readahead_enabled = enabled;
+
+	return count;
+}
+static struct kobj_attribute vma_ra_enabled_attr =
+	__ATTR(vma_ra_enabled, 0644, vma_ra_enabled_show,
+	       vma_ra_enabled_store);
+
+static struct attribute *swap_attrs[] = {
+	&vma_ra_enabled_attr.attr,
+	NULL,
+};
+
+static struct attribute_group swap_attr_group = {
+	.attrs = swap_attrs,
+};
+
+static int __init swap_init_sysfs(void)
+{
+	struct kobject *swap_kobj;
+	int err;
+
+	swap_kobj = kobject_create_and_add("swap", mm_kobj);
+	if (!swap_kobj) {
+		pr_err("failed to create swap kobject\n");
+		return -ENOMEM;
+	}
+	err = sysfs_create_group(swap_kobj, &swap_attr_group);
+	if (err) {
+		pr_err("failed to register swap group\n");
+		kobject_put(swap_kobj);
+		return err;
+	}
+	return 0;
+}
+subsys_initcall(swap_init_sysfs);
+#endif /* CONFIG_SYSFS */
@@ -51,6 +51,8 @@ atomic_long_t nr_swap_pages;
 /* protected with swap_lock. reading in vm_swap_full() doesn't need lock */
 long total_swap_pages;
 static int least_priority;
+/* Number of swap devices on rotating disks, see swap_use_vma_readahead() */
+atomic_t nr_rotate_swap = ATOMIC_INIT(0);
 static atomic_t highest_priority_index = ATOMIC_INIT(-1);
 
 static const char Bad_file[] = "Bad swap file entry ";
@@ -638,18 +640,52 @@ no_page:
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/*
+ * Allocate up to @nr entries from @si under a single hold of si->lock.  On
+ * SSDs scan_swap_map() hands out the entries of this cpu's own cluster in
+ * order, so that a batch is written out sequentially.
+ */
+static int scan_swap_map_slots(struct swap_info_struct *si,
+			       unsigned char usage, int nr,
+			       swp_entry_t slots[])
+{
+	unsigned long offset;
+	int n_ret = 0;
+
+	while (n_ret < nr) {
+		offset = scan_swap_map(si, usage);
+		if (!offset)
+			break;
+		slots[n_ret++] = swp_entry(si->type, offset);
+	}
+	return n_ret;
+}
+
+/**
+ * get_swap_pages - allocate a batch of swap entries for the swap cache
+ * @n_goal: the number of entries wanted
+ * @swp_entries: where to store them
+ *
+ * Allocates the entries from the highest priority swap device with space,
+ * all from the same one, and returns how many were allocated: maybe fewer
+ * than @n_goal, or none when swap is full.
+ */
+int get_swap_pages(int n_goal, swp_entry_t swp_entries[])
 {
 	struct swap_info_struct *si;
-	pgoff_t offset;
+	long avail_pgs;
+	int n_ret;
 	int type, next;
 	int wrapped = 0;
 	int hp_index;
 
 	spin_lock(&swap_lock);
-	if (atomic_long_read(&nr_swap_pages) <= 0)
+	avail_pgs = atomic_long_read(&nr_swap_pages);
+	if (avail_pgs <= 0)
 		goto noswap;
-	atomic_long_dec(&nr_swap_pages);
+	if (n_goal > avail_pgs)
+		n_goal = avail_pgs;
+	atomic_long_sub(n_goal, &nr_swap_pages);
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
 		hp_index = atomic_xchg(&highest_priority_index, -1);
@@ -694,18 +730,23 @@ swp_entry_t get_swap_page(void)
 
 		spin_unlock(&swap_lock);
 		/* This is called for allocating swap entry for cache */
-		offset = scan_swap_map(si, SWAP_HAS_CACHE);
+		n_ret = scan_swap_map_slots(si, SWAP_HAS_CACHE, n_goal,
+					    swp_entries);
 		spin_unlock(&si->lock);
-		if (offset)
-			return swp_entry(type, offset);
+		if (n_ret) {
+			if (n_ret < n_goal)
+				atomic_long_add(n_goal - n_ret,
+						&nr_swap_pages);
+			return n_ret;
+		}
 		spin_lock(&swap_lock);
 		next = swap_list.next;
 	}
 
-	atomic_long_inc(&nr_swap_pages);
+	atomic_long_add(n_goal, &nr_swap_pages);
 noswap:
 	spin_unlock(&swap_lock);
-	return (swp_entry_t) {0};
+	return 0;
 }
 
 /* The only caller of this function is now suspend routine */
@@ -730,7 +771,7 @@ swp_entry_t get_swap_page_of_type(int type)
 	return (swp_entry_t) {0};
 }
 
-static struct swap_info_struct *swap_info_get(swp_entry_t entry)
+static struct swap_info_struct *__swap_info_get(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
 	unsigned long offset, type;
@@ -748,7 +789,6 @@ static struct swap_info_struct *swap_info_get(swp_entry_t entry)
 		goto bad_offset;
 	if (!p->swap_map[offset])
 		goto bad_free;
-	spin_lock(&p->lock);
 	return p;
 
 bad_free:
@@ -766,6 +806,35 @@ out:
 	return NULL;
 }
 
+static struct swap_info_struct *swap_info_get(swp_entry_t entry)
+{
+	struct swap_info_struct *p;
+
+	p = __swap_info_get(entry);
+	if (p)
+		spin_lock(&p->lock);
+	return p;
+}
+
+/*
+ * Like swap_info_get(), but keeps the lock of @q, the swap_info_struct of
+ * the previous entry, when this entry is on the same device.
+ */
+static struct swap_info_struct *swap_info_get_cont(swp_entry_t entry,
+					struct swap_info_struct *q)
+{
+	struct swap_info_struct *p;
+
+	p = __swap_info_get(entry);
+	if (p != q) {
+		if (q)
+			spin_unlock(&q->lock);
+		if (p)
+			spin_lock(&p->lock);
+	}
+	return p;
+}
+
 /*
  * This swap type frees swap entry, check if it is the highest priority swap
  * type which just frees swap entry. get_swap_page() uses
@@ -787,8 +856,13 @@ static void set_highest_priority_index(int type)
 		old_hp_index, new_hp_index) != old_hp_index);
 }
 
-static unsigned char swap_entry_free(struct swap_info_struct *p,
-				     swp_entry_t entry, unsigned char usage)
+/*
+ * Drop a reference to the swap entry: when that was the last, the entry is
+ * left with just SWAP_HAS_CACHE, to be freed by free_swap_slot() once the
+ * caller has dropped si->lock.
+ */
+static unsigned char __swap_entry_free(struct swap_info_struct *p,
+				       swp_entry_t entry, unsigned char usage)
 {
 	unsigned long offset = swp_offset(entry);
 	unsigned char count;
@@ -821,30 +895,35 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 		mem_cgroup_uncharge_swap(entry);
 
 	usage = count | has_cache;
-	p->swap_map[offset] = usage;
-
-	/* free if no reference */
-	if (!usage) {
-		dec_cluster_info_page(p, p->cluster_info, offset);
-		if (offset < p->lowest_bit)
-			p->lowest_bit = offset;
-		if (offset > p->highest_bit)
-			p->highest_bit = offset;
-		set_highest_priority_index(p->type);
-		atomic_long_inc(&nr_swap_pages);
-		p->inuse_pages--;
-		frontswap_invalidate_page(p->type, offset);
-		if (p->flags & SWP_BLKDEV) {
-			struct gendisk *disk = p->bdev->bd_disk;
-			if (disk->fops->swap_slot_free_notify)
-				disk->fops->swap_slot_free_notify(p->bdev,
-								  offset);
-		}
-	}
+	p->swap_map[offset] = usage ? : SWAP_HAS_CACHE;
 
 	return usage;
 }
 
+/* Really free an unreferenced entry: it was left with just SWAP_HAS_CACHE */
+static void swap_entry_free(struct swap_info_struct *p, swp_entry_t entry)
+{
+	unsigned long offset = swp_offset(entry);
+
+	VM_BUG_ON(p->swap_map[offset] != SWAP_HAS_CACHE);
+	p->swap_map[offset] = 0;
+	dec_cluster_info_page(p, p->cluster_info, offset);
+	if (offset < p->lowest_bit)
+		p->lowest_bit = offset;
+	if (offset > p->highest_bit)
+		p->highest_bit = offset;
+	set_highest_priority_index(p->type);
+	atomic_long_inc(&nr_swap_pages);
+	p->inuse_pages--;
+	clear_shadow_from_swap_cache(entry);
+	frontswap_invalidate_page(p->type, offset);
+	if (p->flags & SWP_BLKDEV) {
+		struct gendisk *disk = p->bdev->bd_disk;
+		if (disk->fops->swap_slot_free_notify)
+			disk->fops->swap_slot_free_notify(p->bdev, offset);
+	}
+}
+
 /*
  * Caller has made sure that the swap device corresponding to entry
  * is still around or has not been recycled.
@@ -852,12 +931,15 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 void swap_free(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
+	unsigned char usage = 1;
 
 	p = swap_info_get(entry);
 	if (p) {
-		swap_entry_free(p, entry, 1);
+		usage = __swap_entry_free(p, entry, 1);
 		spin_unlock(&p->lock);
 	}
+	if (!usage)
+		free_swap_slot(entry);
 }
 
 /*
@@ -866,15 +948,60 @@ void swap_free(swp_entry_t entry)
 void swapcache_free(swp_entry_t entry, struct page *page)
 {
 	struct swap_info_struct *p;
-	unsigned char count;
+	unsigned char count = 1;
 
 	p = swap_info_get(entry);
 	if (p) {
-		count = swap_entry_free(p, entry, SWAP_HAS_CACHE);
+		count = __swap_entry_free(p, entry, SWAP_HAS_CACHE);
 		if (page)
 			mem_cgroup_uncharge_swapcache(page, entry, count != 0);
 		spin_unlock(&p->lock);
 	}
+	if (!count)
+		free_swap_slot(entry);
+}
+
+/**
+ * swapcache_free_entries - free a batch of unreferenced swap entries
+ * @entries: the entries, each left with just SWAP_HAS_CACHE
+ * @n: how many there are
+ *
+ * Takes each si->lock only once for a run of entries on the same device.
+ */
+void swapcache_free_entries(swp_entry_t *entries, int n)
+{
+	struct swap_info_struct *p, *prev = NULL;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		p = swap_info_get_cont(entries[i], prev);
+		if (p)
+			swap_entry_free(p, entries[i]);
+		prev = p;
+	}
+	if (prev)
+		spin_unlock(&prev->lock);
+}
+
+/*
+ * How many references to the swap entry are there, not counting the swap
+ * cache?  Unlike page_swapcount(), this quietly returns 0 for an entry
+ * which is free, or on a device being swapped off.
+ */
+int swap_entry_count(swp_entry_t entry)
+{
+	struct swap_info_struct *p;
+	unsigned long offset = swp_offset(entry);
+	int count = 0;
+
+	if (swp_type(entry) >= nr_swapfiles)
+		return 0;
+	p = swap_info[swp_type(entry)];
+	spin_lock(&p->lock);
+	if (offset < p->max)
+		count = swap_count(p->swap_map[offset]);
+	spin_unlock(&p->lock);
+	return count;
 }
 
 /*
@@ -967,13 +1094,15 @@ int free_swap_and_cache(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
 	struct page *page = NULL;
+	unsigned char usage = 1;
 
 	if (non_swap_entry(entry))
 		return 1;
 
 	p = swap_info_get(entry);
 	if (p) {
-		if (swap_entry_free(p, entry, 1) == SWAP_HAS_CACHE) {
+		usage = __swap_entry_free(p, entry, 1);
+		if (usage == SWAP_HAS_CACHE) {
 			page = find_get_page(swap_address_space(entry),
 						entry.val);
 			if (page && !trylock_page(page)) {
@@ -983,6 +1112,8 @@ int free_swap_and_cache(swp_entry_t entry)
 		}
 		spin_unlock(&p->lock);
 	}
+	if (!usage)
+		free_swap_slot(entry);
 	if (page) {
 		/*
 		 * Not mapped elsewhere, or swap space full? Free it!
@@ -1190,6 +1321,11 @@ static int unuse_pte_range(struct vm_area_struct *vma, pmd_t *pmd,
 		 */
 		if (unlikely(maybe_same_pte(*pte, swp_pte))) {
 			pte_unmap(pte);
+			if (pmd_shared(*pmd)) {
+				ret = pte_table_unshare(vma, pmd, addr);
+				if (ret)
+					goto out;
+			}
 			ret = unuse_pte(vma, pmd, addr, entry, page);
 			if (ret)
 				goto out;
@@ -1884,6 +2020,9 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	spin_unlock(&p->lock);
 	spin_unlock(&swap_lock);
 
+	/* Return the entries held in the slots caches, and stop caching */
+	disable_swap_slots_cache_lock();
+
 	set_current_oom_origin();
 	err = try_to_unuse(type, false, 0); /* force all pages to be unused */
 	clear_current_oom_origin();
@@ -1891,9 +2030,15 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	if (err) {
 		/* re-insert swap space back into swap_list */
 		reinsert_swap_info(p);
+		reenable_swap_slots_cache_unlock();
 		goto out_dput;
 	}
 
+	reenable_swap_slots_cache_unlock();
+
+	if (!(p->flags & SWP_SOLIDSTATE))
+		atomic_dec(&nr_rotate_swap);
+
 	flush_work(&p->discard_work);
 
 	destroy_swap_extents(p);
@@ -2533,6 +2678,9 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		(p->flags & SWP_PAGE_DISCARD) ? "c" : "",
 		(frontswap_map) ? "FS" : "");
 
+	if (!(p->flags & SWP_SOLIDSTATE))
+		atomic_inc(&nr_rotate_swap);
+
 	mutex_unlock(&swapon_mutex);
 	atomic_inc(&proc_poll_event);
 	wake_up_interruptible(&proc_poll_wait);
@@ -2572,9 +2720,21 @@ out:
 		putname(name);
 	if (inode && S_ISREG(inode->i_mode))
 		mutex_unlock(&inode->i_mutex);
+	if (!error)
+		enable_swap_slots_cache();
 	return error;
 }
 
+bool has_usable_swap(void)
+{
+	bool ret;
+
+	spin_lock(&swap_lock);
+	ret = swap_list.head >= 0;
+	spin_unlock(&swap_lock);
+	return ret;
+}
+
 void si_swapinfo(struct sysinfo *val)
 {
 	unsigned int type;
@@ -113,6 +113,7 @@ void cancel_dirty_page(struct page *page, unsigned int account_size)
 			dec_zone_page_state(page, NR_FILE_DIRTY);
 			dec_bdi_stat(mapping->backing_dev_info,
 					BDI_RECLAIMABLE);
+			wb_account_dirty(mapping, -1);
 			if (account_size)
 				task_io_account_cancelled_write(account_size);
 		}
@@ -74,6 +74,8 @@ static void vunmap_pmd_range(pud_t *pud, unsigned long addr, unsigned long end)
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pmd_clear_huge(pmd))
+			continue;
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		vunmap_pte_range(pmd, addr, next);
@@ -135,8 +137,36 @@ static int vmap_pte_range(pmd_t *pmd, unsigned long addr,
 	return 0;
 }
 
-static int vmap_pmd_range(pud_t *pud, unsigned long addr,
+/*
+ * Map a whole pmd with a single huge entry, if the pages backing it are
+ * physically contiguous and naturally aligned.  Returns 1 on success and
+ * 0 if the range has to be mapped with ptes.
+ */
+static int vmap_try_huge_pmd(pmd_t *pmd, unsigned long addr,
 		unsigned long end, pgprot_t prot, struct page **pages, int *nr)
+{
+	unsigned long pfn;
+	int i;
+
+	if (end - addr != PMD_SIZE || !pmd_none(*pmd))
+		return 0;
+
+	pfn = page_to_pfn(pages[*nr]);
+	if (!IS_ALIGNED(pfn, PTRS_PER_PTE))
+		return 0;
+	for (i = 1; i < PTRS_PER_PTE; i++)
+		if (page_to_pfn(pages[*nr + i]) != pfn + i)
+			return 0;
+
+	if (!pmd_set_huge(pmd, PFN_PHYS(pfn), prot))
+		return 0;
+	*nr += PTRS_PER_PTE;
+	return 1;
+}
+
+static int vmap_pmd_range(pud_t *pud, unsigned long addr,
+		unsigned long end, pgprot_t prot, struct page **pages, int *nr,
+		bool huge)
 {
 	pmd_t *pmd;
 	unsigned long next;
@@ -146,6 +176,8 @@ static int vmap_pmd_range(pud_t *pud, unsigned long addr,
 		return -ENOMEM;
 	do {
 		next = pmd_addr_end(addr, end);
+		if (huge && vmap_try_huge_pmd(pmd, addr, next, prot, pages, nr))
+			continue;
 		if (vmap_pte_range(pmd, addr, next, prot, pages, nr))
 			return -ENOMEM;
 	} while (pmd++, addr = next, addr != end);
@@ -153,7 +185,8 @@ static int vmap_pmd_range(pud_t *pud, unsigned long addr,
 }
 
 static int vmap_pud_range(pgd_t *pgd, unsigned long addr,
-		unsigned long end, pgprot_t prot, struct page **pages, int *nr)
+		unsigned long end, pgprot_t prot, struct page **pages, int *nr,
+		bool huge)
 {
 	pud_t *pud;
 	unsigned long next;
@@ -163,7 +196,7 @@ static int vmap_pud_range(pgd_t *pgd, unsigned long addr,
 		return -ENOMEM;
 	do {
 		next = pud_addr_end(addr, end);
-		if (vmap_pmd_range(pud, addr, next, prot, pages, nr))
+		if (vmap_pmd_range(pud, addr, next, prot, pages, nr, huge))
 			return -ENOMEM;
 	} while (pud++, addr = next, addr != end);
 	return 0;
@@ -174,9 +207,13 @@ static int vmap_pud_range(pgd_t *pgd, unsigned long addr,
  * will have pfns corresponding to the "pages" array.
  *
  * Ie. pte at addr+N*PAGE_SIZE shall point to pfn corresponding to pages[N]
+ *
+ * If "huge" is set, pmd sized and aligned runs of contiguous pages are
+ * mapped with huge pmds where the architecture supports it.
  */
 static int vmap_page_range_noflush(unsigned long start, unsigned long end,
-				   pgprot_t prot, struct page **pages)
+				   pgprot_t prot, struct page **pages,
+				   bool huge)
 {
 	pgd_t *pgd;
 	unsigned long next;
@@ -188,7 +225,7 @@ static int vmap_page_range_noflush(unsigned long start, unsigned long end,
 	pgd = pgd_offset_k(addr);
 	do {
 		next = pgd_addr_end(addr, end);
-		err = vmap_pud_range(pgd, addr, next, prot, pages, &nr);
+		err = vmap_pud_range(pgd, addr, next, prot, pages, &nr, huge);
 		if (err)
 			return err;
 	} while (pgd++, addr = next, addr != end);
@@ -197,11 +234,11 @@ static int vmap_page_range_noflush(unsigned long start, unsigned long end,
 }
 
 static int vmap_page_range(unsigned long start, unsigned long end,
-			   pgprot_t prot, struct page **pages)
+			   pgprot_t prot, struct page **pages, bool huge)
 {
 	int ret;
 
-	ret = vmap_page_range_noflush(start, end, prot, pages);
+	ret = vmap_page_range_noflush(start, end, prot, pages, huge);
 	flush_cache_vmap(start, end);
 	return ret;
 }
@@ -243,6 +280,12 @@ struct page *vmalloc_to_page(const void *vmalloc_addr)
 			if (!pmd_none(*pmd)) {
 				pte_t *ptep, pte;
 
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+				if (pmd_large(*pmd))
+					return pmd_page(*pmd) +
+					((addr & ~PMD_MASK) >> PAGE_SHIFT);
+#endif
+
 				ptep = pte_offset_map(pmd, addr);
 				pte = *ptep;
 				if (pte_present(pte))
@@ -1114,7 +1157,7 @@ void *vm_map_ram(struct page **pages, unsigned int count, int node, pgprot_t pro
 		addr = va->va_start;
 		mem = (void *)addr;
 	}
-	if (vmap_page_range(addr, addr + size, prot, pages) < 0) {
+	if (vmap_page_range(addr, addr + size, prot, pages, false) < 0) {
 		vm_unmap_ram(mem, count);
 		return NULL;
 	}
@@ -1229,7 +1272,7 @@ void __init vmalloc_init(void)
 int map_kernel_range_noflush(unsigned long addr, unsigned long size,
 			     pgprot_t prot, struct page **pages)
 {
-	return vmap_page_range_noflush(addr, addr + size, prot, pages);
+	return vmap_page_range_noflush(addr, addr + size, prot, pages, false);
 }
 
 /**
@@ -1275,7 +1318,8 @@ int map_vm_area(struct vm_struct *area, pgprot_t prot, struct page ***pages)
 	unsigned long end = addr + get_vm_area_size(area);
 	int err;
 
-	err = vmap_page_range(addr, end, prot, *pages);
+	err = vmap_page_range(addr, end, prot, *pages,
+			      area->flags & VM_HUGE_VMAP);
 	if (err > 0) {
 		*pages += err;
 		err = 0;
@@ -1559,6 +1603,48 @@ EXPORT_SYMBOL(vmap);
 static void *__vmalloc_node(unsigned long size, unsigned long align,
 			    gfp_t gfp_mask, pgprot_t prot,
 			    int node, const void *caller);
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+/*
+ * Back a VM_HUGE_VMAP area with naturally aligned PMD_SIZE chunks, so that
+ * map_vm_area() can map each of them with a single huge pmd.  The chunks
+ * are split into order-0 pages: vfree(), vmalloc_to_page() and friends
+ * keep dealing in small pages.  Returns false, with the chunks allocated
+ * so far freed again, if there is no such free memory.
+ */
+static bool vmalloc_huge_pages(struct vm_struct *area, gfp_t gfp_mask,
+			       int node)
+{
+	const int order = PMD_SHIFT - PAGE_SHIFT;
+	unsigned int i, j;
+
+	gfp_mask |= __GFP_NOWARN | __GFP_NORETRY;
+	for (i = 0; i < area->nr_pages; i += 1 << order) {
+		struct page *page;
+
+		if (node == NUMA_NO_NODE)
+			page = alloc_pages(gfp_mask, order);
+		else
+			page = alloc_pages_node(node, gfp_mask, order);
+
+		if (!page) {
+			while (i)
+				__free_page(area->pages[--i]);
+			return false;
+		}
+		split_page(page, order);
+		for (j = 0; j < 1 << order; j++)
+			area->pages[i + j] = page + j;
+	}
+	return true;
+}
+#else
+static inline bool vmalloc_huge_pages(struct vm_struct *area,
+				      gfp_t gfp_mask, int node)
+{
+	return false;
+}
+#endif
+
 static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 				 pgprot_t prot, int node)
 {
@@ -1586,6 +1672,12 @@ static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 		return NULL;
 	}
 
+	if (area->flags & VM_HUGE_VMAP) {
+		if (vmalloc_huge_pages(area, gfp_mask, node))
+			goto map;
+		area->flags &= ~VM_HUGE_VMAP;
+	}
+
 	for (i = 0; i < area->nr_pages; i++) {
 		struct page *page;
 		gfp_t tmp_mask = gfp_mask | __GFP_NOWARN;
@@ -1603,6 +1695,7 @@ static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 		area->pages[i] = page;
 	}
 
+map:
 	if (map_vm_area(area, prot, &pages))
 		goto fail;
 	return area->addr;
@@ -1623,16 +1716,25 @@ fail:
  *	@end:		vm area range end
  *	@gfp_mask:	flags for the page level allocator
  *	@prot:		protection mask for the allocated pages
+ *	@vm_flags:	additional vm area flags (e.g. %VM_HUGE_VMAP)
  *	@node:		node to use for allocation or NUMA_NO_NODE
  *	@caller:	caller's return address
  *
  *	Allocate enough pages to cover @size from the page level
  *	allocator with @gfp_mask flags.  Map them into contiguous
  *	kernel virtual space, using a pagetable protection of @prot.
+ *
+ *	With %VM_HUGE_VMAP, an allocation of at least PMD_SIZE is rounded
+ *	up to a multiple of PMD_SIZE and is backed by huge pages mapped
+ *	with huge pmds, if the architecture supports that and such pages
+ *	are available.  Otherwise small pages are used as usual.  Only
+ *	callers which neither change the protection of parts of the area
+ *	nor care about the rounding should ask for it.
  */
 void *__vmalloc_node_range(unsigned long size, unsigned long align,
 			unsigned long start, unsigned long end, gfp_t gfp_mask,
-			pgprot_t prot, int node, const void *caller)
+			pgprot_t prot, unsigned long vm_flags, int node,
+			const void *caller)
 {
 	struct vm_struct *area;
 	void *addr;
@@ -1642,7 +1744,15 @@ void *__vmalloc_node_range(unsigned long size, unsigned long align,
 	if (!size || (size >> PAGE_SHIFT) > totalram_pages)
 		goto fail;
 
-	area = __get_vm_area_node(size, align, VM_ALLOC | VM_UNINITIALIZED,
+	if (!IS_ENABLED(CONFIG_HAVE_ARCH_HUGE_VMAP) || size < PMD_SIZE)
+		vm_flags &= ~VM_HUGE_VMAP;
+	if (vm_flags & VM_HUGE_VMAP) {
+		size = ALIGN(size, PMD_SIZE);
+		align = max_t(unsigned long, align, PMD_SIZE);
+	}
+
+	area = __get_vm_area_node(size, align,
+				  VM_ALLOC | VM_UNINITIALIZED | vm_flags,
 				  start, end, node, gfp_mask, caller);
 	if (!area)
 		goto fail;
@@ -1692,7 +1802,7 @@ static void *__vmalloc_node(unsigned long size, unsigned long align,
 			    int node, const void *caller)
 {
 	return __vmalloc_node_range(size, align, VMALLOC_START, VMALLOC_END,
-				gfp_mask, prot, node, caller);
+				gfp_mask, prot, 0, node, caller);
 }
 
 void *__vmalloc(unsigned long size, gfp_t gfp_mask, pgprot_t prot)
@@ -2633,6 +2743,9 @@ static int s_show(struct seq_file *m, void *p)
 	if (v->flags & VM_VPAGES)
 		seq_printf(m, " vpages");
 
+	if (v->flags & VM_HUGE_VMAP)
+		seq_printf(m, " huge");
+
 	show_numa_info(m, v);
 	seq_putc(m, '\n');
 	return 0;
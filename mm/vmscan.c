@@ -94,6 +94,9 @@ struct scan_control {
 	 * are scanned.
 	 */
 	nodemask_t	*nodemask;
+
+	/* Evicting from the generations of the multi-generational LRU */
+	int lru_gen;
 };
 
 #define lru_to_page(_head) (list_entry((_head)->prev, struct page, lru))
@@ -166,7 +169,7 @@ bool zone_reclaimable(struct zone *zone)
 	return zone->pages_scanned < zone_reclaimable_pages(zone) * 6;
 }
 
-static unsigned long get_lru_size(struct lruvec *lruvec, enum lru_list lru)
+unsigned long lruvec_lru_size(struct lruvec *lruvec, enum lru_list lru)
 {
 	if (!mem_cgroup_disabled())
 		return mem_cgroup_get_lru_size(lruvec, lru);
@@ -345,6 +348,9 @@ shrink_slab_node(struct shrink_control *shrinkctl, struct shrinker *shrinker,
  * are eligible for the caller's allocation attempt.  It is used for balancing
  * slab reclaim versus page reclaim.
  *
+ * If shrinkctl->memcg is set, only the memcg aware shrinkers are called, to
+ * shrink the objects charged to that cgroup; `lru_pages' are its own then.
+ *
  * Returns the number of slab objects which we shrunk.
  */
 unsigned long shrink_slab(struct shrink_control *shrinkctl,
@@ -369,6 +375,11 @@ unsigned long shrink_slab(struct shrink_control *shrinkctl,
 	}
 
 	list_for_each_entry(shrinker, &shrinker_list, list) {
+		/* a cgroup's reclaim only shrinks the objects charged to it */
+		if (shrinkctl->memcg &&
+		    !(shrinker->flags & SHRINKER_MEMCG_AWARE))
+			continue;
+
 		if (!(shrinker->flags & SHRINKER_NUMA_AWARE)) {
 			shrinkctl->nid = 0;
 			freed += shrink_slab_node(shrinkctl, shrinker,
@@ -565,7 +576,12 @@ static int __remove_mapping(struct address_space *mapping, struct page *page,
 
 	if (PageSwapCache(page)) {
 		swp_entry_t swap = { .val = page_private(page) };
-		__delete_from_swap_cache(page);
+		void *shadow = NULL;
+
+		/* Anon refaults are detected from the swap cache */
+		if (reclaimed)
+			shadow = workingset_eviction(mapping, page);
+		__delete_from_swap_cache(page, shadow);
 		spin_unlock_irq(&mapping->tree_lock);
 		swapcache_free(swap, page);
 	} else {
@@ -706,6 +722,14 @@ static enum page_references page_check_references(struct page *page,
 	int referenced_ptes, referenced_page;
 	unsigned long vm_flags;
 
+	/*
+	 * The multi-generational LRU has moved the accessed bits of the ptes
+	 * to PG_referenced by walking page tables, and has already spared
+	 * the pages which had it.
+	 */
+	if (sc->lru_gen)
+		return PAGEREF_RECLAIM;
+
 	referenced_ptes = page_referenced(page, 1, sc->target_mem_cgroup,
 					  &vm_flags);
 	referenced_page = TestClearPageReferenced(page);
@@ -953,9 +977,11 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 
 		/*
 		 * Anonymous process memory has backing store?
-		 * Try to allocate it some swap space here.
+		 * Try to allocate it some swap space here, unless it
+		 * was given up with MADV_FREE and can just be dropped.
 		 */
-		if (PageAnon(page) && !PageSwapCache(page)) {
+		if (PageAnon(page) && PageSwapBacked(page) &&
+		    !PageSwapCache(page)) {
 			if (!(sc->gfp_mask & __GFP_IO))
 				goto keep_locked;
 			if (!add_to_swap(page, page_list))
@@ -970,8 +996,9 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		 * The page is mapped into the page tables of one or more
 		 * processes. Try to unmap it here.
 		 */
-		if (page_mapped(page) && mapping) {
-			switch (try_to_unmap(page, ttu_flags)) {
+		if (page_mapped(page) && (mapping || PageAnon(page))) {
+			switch (try_to_unmap(page,
+					ttu_flags | TTU_BATCH_FLUSH)) {
 			case SWAP_FAIL:
 				goto activate_locked;
 			case SWAP_AGAIN:
@@ -983,6 +1010,9 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
+		if (PageAnon(page) && !PageSwapBacked(page) && PageDirty(page))
+			goto activate_locked;
+
 		if (PageDirty(page)) {
 			/*
 			 * Only kswapd can writeback filesystem pages to
@@ -1011,7 +1041,12 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			if (!sc->may_writepage)
 				goto keep_locked;
 
-			/* Page is dirty, try to write it out here */
+			/*
+			 * Page is dirty. Flush the TLB if a writable entry
+			 * potentially exists to avoid CPU writes after IO
+			 * starts and then write it out here.
+			 */
+			try_to_unmap_flush_dirty();
 			switch (pageout(page, mapping, sc)) {
 			case PAGE_KEEP:
 				goto keep_locked;
@@ -1079,7 +1114,16 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
-		if (!mapping || !__remove_mapping(mapping, page, true))
+		if (PageAnon(page) && !PageSwapBacked(page)) {
+			/* unmapped and clean: as __remove_mapping() would */
+			if (!page_freeze_refs(page, 1))
+				goto keep_locked;
+			if (PageDirty(page)) {
+				page_unfreeze_refs(page, 1);
+				goto keep_locked;
+			}
+			count_vm_event(PGLAZYFREED);
+		} else if (!mapping || !__remove_mapping(mapping, page, true))
 			goto keep_locked;
 
 		/*
@@ -1111,6 +1155,9 @@ activate_locked:
 		/* Not a candidate for swapping, so reclaim swap space. */
 		if (PageSwapCache(page) && vm_swap_full())
 			try_to_free_swap(page);
+		/* Written to since MADV_FREE: the data is wanted after all */
+		if (PageAnon(page) && PageDirty(page))
+			SetPageSwapBacked(page);
 		VM_BUG_ON_PAGE(PageActive(page), page);
 		SetPageActive(page);
 		pgactivate++;
@@ -1121,6 +1168,8 @@ keep:
 		VM_BUG_ON_PAGE(PageLRU(page) || PageUnevictable(page), page);
 	}
 
+	/* Stale TLB entries must not outlive the pages they map */
+	try_to_unmap_flush();
 	free_hot_cold_page_list(&free_pages, 1);
 
 	list_splice(&ret_pages, page_list);
@@ -1236,6 +1285,452 @@ int __isolate_lru_page(struct page *page, isolate_mode_t mode)
 	return ret;
 }
 
+#ifdef CONFIG_LRU_GEN
+bool lru_gen_enabled __read_mostly = IS_ENABLED(CONFIG_LRU_GEN_ENABLED);
+
+/* Serializes switching between the multi-generational and classic LRU */
+static DEFINE_MUTEX(lru_gen_state_mutex);
+
+/* All the mms, for aging to walk their page tables */
+static LIST_HEAD(lru_gen_mm_list);
+static DEFINE_SPINLOCK(lru_gen_mm_lock);
+
+/*
+ * One walk serves all the lruvecs being aged at about the same time: it
+ * clears the accessed bits, so walking again straight away finds little.
+ */
+#define LRU_GEN_WALK_INTERVAL	(HZ / 10)
+static DEFINE_MUTEX(lru_gen_walk_mutex);
+static unsigned long lru_gen_walk_stamp;
+
+void lru_gen_add_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_add_tail(&mm->lru_gen_list, &lru_gen_mm_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+void lru_gen_del_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_del(&mm->lru_gen_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+static int lru_gen_walk_pmd_range(pmd_t *pmd, unsigned long addr,
+				  unsigned long end, struct mm_walk *walk)
+{
+	struct vm_area_struct *vma = walk->private;
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	if (pmd_trans_huge_lock(pmd, vma, &ptl) == 1) {
+		if (pmdp_test_and_clear_young(vma, addr, pmd))
+			SetPageReferenced(pmd_page(*pmd));
+		spin_unlock(ptl);
+		return 0;
+	}
+
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		struct page *page;
+
+		if (!pte_present(*pte) || !pte_young(*pte))
+			continue;
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page || !PageLRU(page))
+			continue;
+		if (ptep_test_and_clear_young(vma, addr, pte))
+			SetPageReferenced(page);
+	}
+	pte_unmap_unlock(pte - 1, ptl);
+	cond_resched();
+	return 0;
+}
+
+/*
+ * Moves the accessed bits of the ptes mapping pages on the LRU over to
+ * PG_referenced, where eviction finds them without an rmap walk. An mm
+ * whose mmap_sem is not readily available is left for the next time.
+ */
+static void lru_gen_walk_mm(struct mm_struct *mm)
+{
+	struct vm_area_struct *vma;
+	struct mm_walk walk = {
+		.pmd_entry = lru_gen_walk_pmd_range,
+		.mm = mm,
+	};
+
+	if (!down_read_trylock(&mm->mmap_sem))
+		return;
+
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (vma->vm_flags & (VM_LOCKED | VM_IO | VM_PFNMAP) ||
+		    is_vm_hugetlb_page(vma))
+			continue;
+		walk.private = vma;
+		walk_page_range(vma->vm_start, vma->vm_end, &walk);
+	}
+
+	up_read(&mm->mmap_sem);
+}
+
+/* Walks the mms of the memcg being reclaimed from, or all of them */
+static void lru_gen_walk_mms(struct scan_control *sc)
+{
+	struct mem_cgroup *memcg = NULL;
+	struct mm_struct *mm, *prev_mm = NULL;
+	struct list_head *p;
+
+	if (!global_reclaim(sc))
+		memcg = sc->target_mem_cgroup;
+
+	if (!mutex_trylock(&lru_gen_walk_mutex))
+		return;
+	if (!memcg) {
+		if (time_before(jiffies,
+				lru_gen_walk_stamp + LRU_GEN_WALK_INTERVAL))
+			goto out;
+		lru_gen_walk_stamp = jiffies;
+	}
+
+	/*
+	 * As in try_to_unuse(), holding a reference on the mm just walked
+	 * keeps it on the list, so we can carry on from there.
+	 */
+	spin_lock(&lru_gen_mm_lock);
+	p = &lru_gen_mm_list;
+	while ((p = p->next) != &lru_gen_mm_list) {
+		mm = list_entry(p, struct mm_struct, lru_gen_list);
+		if (memcg && !mm_match_cgroup(mm, memcg))
+			continue;
+		if (!atomic_inc_not_zero(&mm->mm_users))
+			continue;
+		spin_unlock(&lru_gen_mm_lock);
+
+		if (prev_mm)
+			mmput(prev_mm);
+		prev_mm = mm;
+
+		lru_gen_walk_mm(mm);
+
+		spin_lock(&lru_gen_mm_lock);
+	}
+	spin_unlock(&lru_gen_mm_lock);
+
+	if (prev_mm)
+		mmput(prev_mm);
+out:
+	mutex_unlock(&lru_gen_walk_mutex);
+}
+
+static struct list_head *lru_gen_list(struct lru_gen *lrugen,
+				      unsigned long seq, int file)
+{
+	return &lrugen->lists[lru_gen_from_seq(seq)][file];
+}
+
+/* Retires the oldest generation of a type, once it has been emptied */
+static bool lru_gen_inc_min_seq(struct lru_gen *lrugen, int file)
+{
+	if (lrugen->max_seq - lrugen->min_seq[file] + 1 <= MIN_NR_GENS)
+		return false;
+
+	lrugen->min_seq[file]++;
+	return true;
+}
+
+static bool lru_gen_need_aging(struct lru_gen *lrugen, int file)
+{
+	return lrugen->max_seq - lrugen->min_seq[file] + 1 <= MIN_NR_GENS &&
+	       list_empty(lru_gen_list(lrugen, lrugen->min_seq[file], file));
+}
+
+static void lru_gen_inc_max_seq(struct lru_gen *lrugen)
+{
+	int file;
+
+	for (file = 0; file < 2; file++) {
+		unsigned long min_seq = lrugen->min_seq[file];
+
+		if (lrugen->max_seq + 1 - min_seq < MAX_NR_GENS)
+			continue;
+		/* No room for another: fold the oldest into the next */
+		list_splice_tail_init(lru_gen_list(lrugen, min_seq, file),
+				      lru_gen_list(lrugen, min_seq + 1, file));
+		lrugen->min_seq[file]++;
+	}
+
+	lrugen->max_seq++;
+}
+
+/*
+ * Called before evicting pages of type @file from @lruvec: when only
+ * MIN_NR_GENS generations are left and the oldest is empty, walks page
+ * tables and opens a new youngest generation.
+ */
+static void lru_gen_age(struct lruvec *lruvec, struct scan_control *sc,
+			int file)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	struct zone *zone = lruvec_zone(lruvec);
+
+	if (!lru_gen_need_aging(lrugen, file))
+		return;
+
+	lru_gen_walk_mms(sc);
+
+	spin_lock_irq(&zone->lru_lock);
+	if (lrugen->enabled && lru_gen_need_aging(lrugen, file))
+		lru_gen_inc_max_seq(lrugen);
+	spin_unlock_irq(&zone->lru_lock);
+}
+
+/*
+ * isolate_lru_pages() for the multi-generational LRU: takes pages from
+ * the tail of the oldest generation, retiring it when empty. The pages
+ * found referenced go to the youngest generation instead, and count as
+ * rotated for get_scan_count().
+ */
+static unsigned long lru_gen_isolate_pages(unsigned long nr_to_scan,
+		struct lruvec *lruvec, struct list_head *dst,
+		unsigned long *nr_scanned, isolate_mode_t mode,
+		enum lru_list lru)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	struct zone_reclaim_stat *reclaim_stat = &lruvec->reclaim_stat;
+	int file = is_file_lru(lru);
+	unsigned long nr_taken = 0;
+	unsigned long nr_rotated = 0;
+	unsigned long scan;
+
+	for (scan = 0; scan < nr_to_scan; scan++) {
+		struct list_head *src;
+		struct page *page;
+		int nr_pages;
+
+		src = lru_gen_list(lrugen, lrugen->min_seq[file], file);
+		while (list_empty(src)) {
+			if (!lru_gen_inc_min_seq(lrugen, file))
+				goto out;
+			src = lru_gen_list(lrugen, lrugen->min_seq[file], file);
+		}
+
+		page = lru_to_page(src);
+		prefetchw_prev_lru_page(page, src, flags);
+
+		VM_BUG_ON_PAGE(!PageLRU(page), page);
+
+		nr_pages = hpage_nr_pages(page);
+		if (TestClearPageReferenced(page)) {
+			list_move(&page->lru,
+				  lru_gen_list(lrugen, lrugen->max_seq, file));
+			nr_rotated += nr_pages;
+			continue;
+		}
+		/* It has aged out of the generation it was activated into */
+		ClearPageActive(page);
+
+		switch (__isolate_lru_page(page, mode)) {
+		case 0:
+			mem_cgroup_update_lru_size(lruvec, lru, -nr_pages);
+			list_move(&page->lru, dst);
+			nr_taken += nr_pages;
+			break;
+
+		case -EBUSY:
+			/* else it is being freed elsewhere */
+			list_move(&page->lru, src);
+			continue;
+
+		default:
+			BUG();
+		}
+	}
+out:
+	reclaim_stat->recent_scanned[file] += nr_rotated;
+	reclaim_stat->recent_rotated[file] += nr_rotated;
+	*nr_scanned = scan;
+	return nr_taken;
+}
+
+/* Moves the accounting of @nr_pages of @lruvec from @from to @to */
+static void lru_gen_move_account(struct lruvec *lruvec, enum lru_list from,
+				 enum lru_list to, long nr_pages)
+{
+	struct zone *zone = lruvec_zone(lruvec);
+
+	mem_cgroup_update_lru_size(lruvec, from, -nr_pages);
+	__mod_zone_page_state(zone, NR_LRU_BASE + from, -nr_pages);
+	mem_cgroup_update_lru_size(lruvec, to, nr_pages);
+	__mod_zone_page_state(zone, NR_LRU_BASE + to, nr_pages);
+}
+
+/*
+ * Moves the active pages to the youngest generation, the inactive ones to
+ * the oldest.
+ */
+static void lru_gen_fill_lruvec(struct lruvec *lruvec)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	enum lru_list lru;
+
+	for_each_evictable_lru(lru) {
+		int file = is_file_lru(lru);
+		unsigned long seq = lrugen->min_seq[file];
+		struct page *page;
+		long nr_pages = 0;
+
+		if (is_active_lru(lru)) {
+			list_for_each_entry(page, &lruvec->lists[lru], lru)
+				nr_pages += hpage_nr_pages(page);
+			lru_gen_move_account(lruvec, lru, lru - LRU_ACTIVE,
+					     nr_pages);
+			seq = lrugen->max_seq;
+		}
+		list_splice_tail_init(&lruvec->lists[lru],
+				      lru_gen_list(lrugen, seq, file));
+	}
+}
+
+/* Moves the pages back onto the lists their PG_active tells */
+static void lru_gen_drain_lruvec(struct lruvec *lruvec)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	int file;
+
+	for (file = 0; file < 2; file++) {
+		enum lru_list lru = LRU_BASE + file * LRU_FILE;
+		unsigned long seq = lrugen->max_seq;
+		long nr_active = 0;
+
+		/* Youngest first, so that the oldest end up at the tail */
+		do {
+			struct list_head *src = lru_gen_list(lrugen, seq, file);
+			struct page *page, *next;
+
+			list_for_each_entry_safe(page, next, src, lru) {
+				enum lru_list dst = page_lru(page);
+
+				list_move_tail(&page->lru, &lruvec->lists[dst]);
+				if (dst != lru)
+					nr_active += hpage_nr_pages(page);
+			}
+		} while (seq-- != lrugen->min_seq[file]);
+
+		lru_gen_move_account(lruvec, lru, lru + LRU_ACTIVE, nr_active);
+	}
+}
+
+/*
+ * Switches every lruvec, under its lru_lock, between the generations and
+ * the active and inactive lists. A lruvec set up meanwhile starts with
+ * the new state.
+ */
+static void lru_gen_change_state(bool enable)
+{
+	struct mem_cgroup *memcg;
+
+	mutex_lock(&lru_gen_state_mutex);
+	if (enable == lru_gen_enabled)
+		goto unlock;
+	lru_gen_enabled = enable;
+
+	memcg = mem_cgroup_iter(NULL, NULL, NULL);
+	do {
+		struct zone *zone;
+
+		for_each_zone(zone) {
+			struct lruvec *lruvec;
+
+			lruvec = mem_cgroup_zone_lruvec(zone, memcg);
+			spin_lock_irq(&zone->lru_lock);
+			if (lruvec->lrugen.enabled != enable) {
+				if (enable)
+					lru_gen_fill_lruvec(lruvec);
+				else
+					lru_gen_drain_lruvec(lruvec);
+				lruvec->lrugen.enabled = enable;
+			}
+			spin_unlock_irq(&zone->lru_lock);
+			cond_resched();
+		}
+		memcg = mem_cgroup_iter(NULL, memcg, NULL);
+	} while (memcg);
+unlock:
+	mutex_unlock(&lru_gen_state_mutex);
+}
+
+#ifdef CONFIG_SYSFS
+static ssize_t lru_gen_enabled_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", lru_gen_enabled);
+}
+
+static ssize_t lru_gen_enabled_store(struct kobject *kobj,
+				     struct kobj_attribute *attr,
+				     const char *buf, size_t count)
+{
+	bool enabled;
+
+	if (strtobool(buf, &enabled))
+		return -EINVAL;
+
+	lru_gen_change_state(enabled);
+
+	return count;
+}
+static struct kobj_attribute lru_gen_enabled_attr =
+	__ATTR(enabled, 0644, lru_gen_enabled_show, lru_gen_enabled_store);
+
+static struct attribute *lru_gen_attrs[] = {
+	&lru_gen_enabled_attr.attr,
+	NULL,
+};
+
+static struct attribute_group lru_gen_attr_group = {
+	.attrs = lru_gen_attrs,
+};
+
+static int __init lru_gen_init_sysfs(void)
+{
+	struct kobject *lru_gen_kobj;
+	int err;
+
+	lru_gen_kobj = kobject_create_and_add("lru_gen", mm_kobj);
+	if (!lru_gen_kobj) {
+		pr_err("failed to create lru_gen kobject\n");
+		return -ENOMEM;
+	}
+	err = sysfs_create_group(lru_gen_kobj, &lru_gen_attr_group);
+	if (err) {
+		pr_err("failed to register lru_gen group\n");
+		kobject_put(lru_gen_kobj);
+		return err;
+	}
+	return 0;
+}
+subsys_initcall(lru_gen_init_sysfs);
+#endif /* CONFIG_SYSFS */
+#else /* !CONFIG_LRU_GEN */
+static inline void lru_gen_age(struct lruvec *lruvec, struct scan_control *sc,
+			       int file)
+{
+}
+
+static inline unsigned long lru_gen_isolate_pages(unsigned long nr_to_scan,
+		struct lruvec *lruvec, struct list_head *dst,
+		unsigned long *nr_scanned, isolate_mode_t mode,
+		enum lru_list lru)
+{
+	return 0;
+}
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * zone->lru_lock is heavily contended.  Some of the functions that
  * shrink the lists perform better by taking out a batch of pages
@@ -1265,6 +1760,12 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 	unsigned long nr_taken = 0;
 	unsigned long scan;
 
+	if (lru_gen_lruvec(lruvec, lru) && !is_active_lru(lru)) {
+		nr_taken = lru_gen_isolate_pages(nr_to_scan, lruvec, dst,
+						 &scan, mode, lru);
+		goto out;
+	}
+
 	for (scan = 0; scan < nr_to_scan && !list_empty(src); scan++) {
 		struct page *page;
 		int nr_pages;
@@ -1291,7 +1792,7 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 			BUG();
 		}
 	}
-
+out:
 	*nr_scanned = scan;
 	trace_mm_vmscan_lru_isolate(sc->order, nr_to_scan, scan,
 				    nr_taken, mode, is_file_lru(lru));
@@ -1417,6 +1918,7 @@ putback_inactive_pages(struct lruvec *lruvec, struct list_head *page_list)
 			int file = is_file_lru(lru);
 			int numpages = hpage_nr_pages(page);
 			reclaim_stat->recent_rotated[file] += numpages;
+			workingset_age_nonresident(lruvec, numpages);
 		}
 		if (put_page_testzero(page)) {
 			__ClearPageLRU(page);
@@ -1470,6 +1972,9 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
 
 	lru_add_drain();
 
+	if (lru_gen_lruvec(lruvec, lru))
+		lru_gen_age(lruvec, sc, file);
+
 	if (!sc->may_unmap)
 		isolate_mode |= ISOLATE_UNMAPPED;
 	if (!sc->may_writepage)
@@ -1495,10 +2000,12 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
 	if (nr_taken == 0)
 		return 0;
 
+	sc->lru_gen = lru_gen_lruvec(lruvec, lru);
 	nr_reclaimed = shrink_page_list(&page_list, zone, sc, TTU_UNMAP,
 				&nr_dirty, &nr_unqueued_dirty, &nr_congested,
 				&nr_writeback, &nr_immediate,
 				false);
+	sc->lru_gen = 0;
 
 	spin_lock_irq(&zone->lru_lock);
 
@@ -1803,8 +2310,8 @@ static int inactive_file_is_low(struct lruvec *lruvec)
 	unsigned long inactive;
 	unsigned long active;
 
-	inactive = get_lru_size(lruvec, LRU_INACTIVE_FILE);
-	active = get_lru_size(lruvec, LRU_ACTIVE_FILE);
+	inactive = lruvec_lru_size(lruvec, LRU_INACTIVE_FILE);
+	active = lruvec_lru_size(lruvec, LRU_ACTIVE_FILE);
 
 	return active > inactive;
 }
@@ -1909,10 +2416,10 @@ static void get_scan_count(struct lruvec *lruvec, struct scan_control *sc,
 		goto out;
 	}
 
-	anon  = get_lru_size(lruvec, LRU_ACTIVE_ANON) +
-		get_lru_size(lruvec, LRU_INACTIVE_ANON);
-	file  = get_lru_size(lruvec, LRU_ACTIVE_FILE) +
-		get_lru_size(lruvec, LRU_INACTIVE_FILE);
+	anon  = lruvec_lru_size(lruvec, LRU_ACTIVE_ANON) +
+		lruvec_lru_size(lruvec, LRU_INACTIVE_ANON);
+	file  = lruvec_lru_size(lruvec, LRU_ACTIVE_FILE) +
+		lruvec_lru_size(lruvec, LRU_INACTIVE_FILE);
 
 	/*
 	 * Prevent the reclaimer from falling into the cache trap: as
@@ -1935,8 +2442,11 @@ static void get_scan_count(struct lruvec *lruvec, struct scan_control *sc,
 	/*
 	 * There is enough inactive page cache, do not reclaim
 	 * anything from the anonymous working set right now.
+	 * The multi-generational LRU has no inactive list to
+	 * speak of: it is balanced by the rotation ratios.
 	 */
-	if (!inactive_file_is_low(lruvec)) {
+	if (!lru_gen_lruvec(lruvec, LRU_INACTIVE_FILE) &&
+	    !inactive_file_is_low(lruvec)) {
 		scan_balance = SCAN_FILE;
 		goto out;
 	}
@@ -1993,7 +2503,7 @@ out:
 		unsigned long size;
 		unsigned long scan;
 
-		size = get_lru_size(lruvec, lru);
+		size = lruvec_lru_size(lruvec, lru);
 		scan = size >> sc->priority;
 
 		if (!scan && force_scan)
@@ -2202,6 +2712,36 @@ static inline bool should_continue_reclaim(struct zone *zone,
 	}
 }
 
+/*
+ * Limit reclaim shrinks the slab objects charged to a kmem accounted
+ * cgroup, such as its dentries and inodes, in proportion to the pages
+ * scanned on its own LRU lists in @zone; and leaves the others alone.
+ */
+static void shrink_memcg_slab(struct zone *zone, struct mem_cgroup *memcg,
+			      struct lruvec *lruvec, struct scan_control *sc,
+			      unsigned long nr_scanned)
+{
+	struct reclaim_state *reclaim_state = current->reclaim_state;
+	struct shrink_control shrink = {
+		.gfp_mask = sc->gfp_mask,
+		.memcg = memcg,
+	};
+	unsigned long lru_pages = 0;
+	enum lru_list lru;
+
+	for_each_evictable_lru(lru)
+		lru_pages += lruvec_lru_size(lruvec, lru);
+
+	nodes_clear(shrink.nodes_to_scan);
+	node_set(zone_to_nid(zone), shrink.nodes_to_scan);
+	shrink_slab(&shrink, nr_scanned, lru_pages);
+
+	if (reclaim_state) {
+		sc->nr_reclaimed += reclaim_state->reclaimed_slab;
+		reclaim_state->reclaimed_slab = 0;
+	}
+}
+
 static void shrink_zone(struct zone *zone, struct scan_control *sc)
 {
 	unsigned long nr_reclaimed, nr_scanned;
@@ -2219,12 +2759,17 @@ static void shrink_zone(struct zone *zone, struct scan_control *sc)
 
 		memcg = mem_cgroup_iter(root, NULL, &reclaim);
 		do {
+			unsigned long scanned = sc->nr_scanned;
 			struct lruvec *lruvec;
 
 			lruvec = mem_cgroup_zone_lruvec(zone, memcg);
 
 			shrink_lruvec(lruvec, sc);
 
+			if (!global_reclaim(sc) && memcg_kmem_is_active(memcg))
+				shrink_memcg_slab(zone, memcg, lruvec, sc,
+						  sc->nr_scanned - scanned);
+
 			/*
 			 * Direct reclaim and kswapd have to scan all memory
 			 * cgroups to fulfill the overall scan target for the
@@ -2387,10 +2932,10 @@ static bool shrink_zones(struct zonelist *zonelist, struct scan_control *sc)
 	}
 
 	/*
-	 * Don't shrink slabs when reclaiming memory from over limit cgroups
-	 * but do shrink slab at least once when aborting reclaim for
-	 * compaction to avoid unevenly scanning file/anon LRU pages over slab
-	 * pages.
+	 * Over limit cgroups only shrink their own slab objects, from
+	 * shrink_zone(), but do shrink slab at least once when aborting
+	 * reclaim for compaction to avoid unevenly scanning file/anon LRU
+	 * pages over slab pages.
 	 */
 	if (global_reclaim(sc)) {
 		shrink_slab(&shrink, sc->nr_scanned, lru_pages);
@@ -3141,8 +3686,11 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
 		 * prevent kswapd reclaiming excessively. Assume that a
 		 * process requested a high-order can direct reclaim/compact.
 		 */
-		if (order && sc.nr_reclaimed >= 2UL << order)
+		if (order && sc.nr_reclaimed >= 2UL << order) {
+			/* Leave the high-order request to kcompactd */
+			wakeup_kcompactd(pgdat, order, *classzone_idx);
 			order = sc.order = 0;
+		}
 
 		/* Check if kswapd should be suspending */
 		if (try_to_freeze() || kthread_should_stop())
@@ -3217,6 +3765,12 @@ static void kswapd_try_to_sleep(pg_data_t *pgdat, int order, int classzone_idx)
 		 */
 		reset_isolation_suitable(pgdat);
 
+		/*
+		 * We have freed the memory, now we should compact it to make
+		 * allocation of the requested order possible.
+		 */
+		wakeup_kcompactd(pgdat, order, classzone_idx);
+
 		if (!kthread_should_stop())
 			schedule();
 
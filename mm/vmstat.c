@@ -20,6 +20,7 @@
 #include <linux/writeback.h>
 #include <linux/compaction.h>
 #include <linux/mm_inline.h>
+#include <linux/tick.h>
 
 #include "internal.h"
 
@@ -648,6 +649,24 @@ int fragmentation_index(struct zone *zone, unsigned int order)
 	fill_contig_page_info(zone, order, &info);
 	return __fragmentation_index(order, &info);
 }
+
+/*
+ * Calculates external fragmentation within a zone wrt the given order.
+ * It is defined as the percentage of free pages found in blocks of size
+ * less than 1 << order. It returns values in range [0, 100].
+ */
+unsigned int extfrag_for_order(struct zone *zone, unsigned int order)
+{
+	struct contig_page_info info;
+
+	fill_contig_page_info(zone, order, &info);
+	if (info.free_pages == 0)
+		return 0;
+
+	return div_u64((info.free_pages -
+			(info.free_blocks_suitable << order)) * 100,
+			info.free_pages);
+}
 #endif
 
 #if defined(CONFIG_PROC_FS) || defined(CONFIG_COMPACTION)
@@ -789,9 +808,13 @@ const char * const vmstat_text[] = {
 	"pgfree",
 	"pgactivate",
 	"pgdeactivate",
+	"pglazyfree",
 
 	"pgfault",
 	"pgmajfault",
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	"speculative_pgfault",
+#endif
 
 	TEXTS_FOR_ZONES("pgrefill")
 	TEXTS_FOR_ZONES("pgsteal_kswapd")
@@ -812,6 +835,7 @@ const char * const vmstat_text[] = {
 	"allocstall",
 
 	"pgrotated",
+	"pglazyfreed",
 
 	"drop_pagecache",
 	"drop_slab",
@@ -834,6 +858,8 @@ const char * const vmstat_text[] = {
 	"compact_stall",
 	"compact_fail",
 	"compact_success",
+	"compact_daemon_wake",
+	"compact_daemon_proactive",
 #endif
 
 #ifdef CONFIG_HUGETLB_PAGE
@@ -856,6 +882,12 @@ const char * const vmstat_text[] = {
 	"thp_split",
 	"thp_zero_page_alloc",
 	"thp_zero_page_alloc_failed",
+	"thp_file_alloc",
+	"thp_file_mapped",
+#endif
+#ifdef CONFIG_SWAP
+	"swap_ra",
+	"swap_ra_hit",
 #endif
 #ifdef CONFIG_DEBUG_TLBFLUSH
 #ifdef CONFIG_SMP
@@ -1225,9 +1257,12 @@ int sysctl_stat_interval __read_mostly = HZ;
 
 static void vmstat_update(struct work_struct *w)
 {
+	nohz_full_noise_inc(NOHZ_NOISE_VMSTAT);
 	refresh_cpu_vm_stats();
-	schedule_delayed_work(&__get_cpu_var(vmstat_work),
-		round_jiffies_relative(sysctl_stat_interval));
+	/* Full dynticks cpus are kicked by vmstat_nohz_full_update(). */
+	if (is_housekeeping_cpu(smp_processor_id()))
+		schedule_delayed_work(&__get_cpu_var(vmstat_work),
+			round_jiffies_relative(sysctl_stat_interval));
 }
 
 static void start_cpu_timer(int cpu)
@@ -1235,9 +1270,60 @@ static void start_cpu_timer(int cpu)
 	struct delayed_work *work = &per_cpu(vmstat_work, cpu);
 
 	INIT_DEFERRABLE_WORK(work, vmstat_update);
-	schedule_delayed_work_on(cpu, work, __round_jiffies_relative(HZ, cpu));
+	if (is_housekeeping_cpu(cpu))
+		schedule_delayed_work_on(cpu, work,
+					 __round_jiffies_relative(HZ, cpu));
+}
+
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * Full dynticks cpus do not fold their differentials every second, a
+ * housekeeping cpu looks at them instead and only queues the fold on the
+ * ones that have something to fold, that is which ran kernel code.
+ */
+static void vmstat_nohz_full_update(struct work_struct *w);
+static DECLARE_DEFERRABLE_WORK(vmstat_nohz_full_work, vmstat_nohz_full_update);
+
+static bool need_vm_stats_fold(int cpu)
+{
+	struct zone *zone;
+
+	for_each_populated_zone(zone) {
+		struct per_cpu_pageset *p = per_cpu_ptr(zone->pageset, cpu);
+
+		if (memchr_inv(p->vm_stat_diff, 0, NR_VM_ZONE_STAT_ITEMS))
+			return true;
+	}
+	return false;
+}
+
+static void vmstat_nohz_full_update(struct work_struct *w)
+{
+	int cpu;
+
+	get_online_cpus();
+	for_each_cpu_and(cpu, tick_nohz_full_mask, cpu_online_mask)
+		if (need_vm_stats_fold(cpu))
+			schedule_delayed_work_on(cpu,
+					&per_cpu(vmstat_work, cpu), 0);
+	put_online_cpus();
+
+	schedule_delayed_work_on(housekeeping_any_cpu(),
+				 &vmstat_nohz_full_work,
+				 round_jiffies_relative(sysctl_stat_interval));
 }
 
+static void __init start_nohz_full_timer(void)
+{
+	if (tick_nohz_full_enabled())
+		schedule_delayed_work_on(housekeeping_any_cpu(),
+					 &vmstat_nohz_full_work,
+					 round_jiffies_relative(HZ));
+}
+#else
+static inline void start_nohz_full_timer(void) { }
+#endif
+
 static void vmstat_cpu_dead(int node)
 {
 	int cpu;
@@ -1306,6 +1392,7 @@ static int __init setup_vmstat(void)
 		node_set_state(cpu_to_node(cpu), N_CPU);
 	}
 	cpu_notifier_register_done();
+	start_nohz_full_timer();
 #endif
 #ifdef CONFIG_PROC_FS
 	proc_create("buddyinfo", S_IRUGO, NULL, &fragmentation_file_operations);
@@ -12,6 +12,7 @@
 #include <linux/swap.h>
 #include <linux/fs.h>
 #include <linux/mm.h>
+#include <linux/mm_inline.h>
 
 /*
  *		Double CLOCK lists
@@ -139,21 +140,51 @@
  * and the used pages get to stay in cache.
  *
  *
+ *		Anon and file
+ *
+ * The same is done for anon pages, whose shadow entries are left in
+ * the swap cache.  A thrashing anon page competes with the whole file
+ * cache and the active anon pages; a thrashing cache page with all
+ * the anon pages and the active cache, if there is swap to reclaim
+ * anon into.
+ *
+ * A thrashing refault also counts as a rotation of its type in the
+ * lruvec's reclaim_stat, as if reclaim had found it referenced on the
+ * inactive list: so the anon/file scan balance of get_scan_count()
+ * follows the refaults, and backs off whichever type is thrashing.
+ *
+ *
  *		Implementation
  *
- * For each zone's file LRU lists, a counter for inactive evictions
- * and activations is maintained (zone->inactive_age).
+ * For each lruvec, a counter for inactive evictions and activations
+ * is maintained (lruvec->inactive_age).
  *
  * On eviction, a snapshot of this counter (along with some bits to
- * identify the zone) is stored in the now empty page cache radix tree
- * slot of the evicted page.  This is called a shadow entry.
+ * identify the memcg and the zone) is stored in the now empty page
+ * cache or swap cache radix tree slot of the evicted page.  This is
+ * called a shadow entry.
  *
  * On cache misses for which there are shadow entries, an eligible
  * refault distance will immediately activate the refaulting page.
  */
 
-static void *pack_shadow(unsigned long eviction, struct zone *zone)
+#define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_SHIFT + \
+			 NODES_SHIFT + ZONES_SHIFT + MEM_CGROUP_ID_SHIFT)
+#define EVICTION_MASK	(~0UL >> EVICTION_SHIFT)
+
+/*
+ * Eviction timestamps need to be able to cover the full range of
+ * actionable refaults.  When there are not enough bits left in the
+ * shadow entry for that, the timestamps are kept in buckets of
+ * 1 << bucket_order evictions.
+ */
+static unsigned int bucket_order __read_mostly;
+
+static void *pack_shadow(int memcgid, struct zone *zone,
+			 unsigned long eviction)
 {
+	eviction >>= bucket_order;
+	eviction = (eviction << MEM_CGROUP_ID_SHIFT) | memcgid;
 	eviction = (eviction << NODES_SHIFT) | zone_to_nid(zone);
 	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
 	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
@@ -161,45 +192,33 @@ static void *pack_shadow(unsigned long eviction, struct zone *zone)
 	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
 }
 
-static void unpack_shadow(void *shadow,
-			  struct zone **zone,
-			  unsigned long *distance)
+static void unpack_shadow(void *shadow, int *memcgidp, struct zone **zonep,
+			  unsigned long *evictionp)
 {
 	unsigned long entry = (unsigned long)shadow;
-	unsigned long eviction;
-	unsigned long refault;
-	unsigned long mask;
-	int zid, nid;
+	int memcgid, nid, zid;
 
 	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
 	zid = entry & ((1UL << ZONES_SHIFT) - 1);
 	entry >>= ZONES_SHIFT;
 	nid = entry & ((1UL << NODES_SHIFT) - 1);
 	entry >>= NODES_SHIFT;
-	eviction = entry;
+	memcgid = entry & ((1UL << MEM_CGROUP_ID_SHIFT) - 1);
+	entry >>= MEM_CGROUP_ID_SHIFT;
 
-	*zone = NODE_DATA(nid)->node_zones + zid;
+	*memcgidp = memcgid;
+	*zonep = NODE_DATA(nid)->node_zones + zid;
+	*evictionp = entry << bucket_order;
+}
 
-	refault = atomic_long_read(&(*zone)->inactive_age);
-	mask = ~0UL >> (NODES_SHIFT + ZONES_SHIFT +
-			RADIX_TREE_EXCEPTIONAL_SHIFT);
-	/*
-	 * The unsigned subtraction here gives an accurate distance
-	 * across inactive_age overflows in most cases.
-	 *
-	 * There is a special case: usually, shadow entries have a
-	 * short lifetime and are either refaulted or reclaimed along
-	 * with the inode before they get too old.  But it is not
-	 * impossible for the inactive_age to lap a shadow entry in
-	 * the field, which can then can result in a false small
-	 * refault distance, leading to a false activation should this
-	 * old entry actually refault again.  However, earlier kernels
-	 * used to deactivate unconditionally with *every* reclaim
-	 * invocation for the longest time, so the occasional
-	 * inappropriate activation leading to pressure on the active
-	 * list is not a problem.
-	 */
-	*distance = (refault - eviction) & mask;
+/**
+ * workingset_age_nonresident - age non-resident entries of an lruvec
+ * @lruvec: the lruvec that saw evictions or activations
+ * @nr_pages: how many
+ */
+void workingset_age_nonresident(struct lruvec *lruvec, unsigned long nr_pages)
+{
+	atomic_long_add(nr_pages, &lruvec->inactive_age);
 }
 
 /**
@@ -208,39 +227,108 @@ static void unpack_shadow(void *shadow,
  * @page: the page being evicted
  *
  * Returns a shadow entry to be stored in @mapping->page_tree in place
- * of the evicted @page so that a later refault can be detected.
+ * of the evicted @page so that a later refault can be detected.  The
+ * page must be isolated from the LRU, and charged if memcg is enabled.
  */
 void *workingset_eviction(struct address_space *mapping, struct page *page)
 {
 	struct zone *zone = page_zone(page);
+	struct lruvec *lruvec;
 	unsigned long eviction;
 
-	eviction = atomic_long_inc_return(&zone->inactive_age);
-	return pack_shadow(eviction, zone);
+	lruvec = mem_cgroup_page_lruvec(page, zone);
+	eviction = atomic_long_inc_return(&lruvec->inactive_age);
+	return pack_shadow(mem_cgroup_lruvec_id(lruvec), zone, eviction);
+}
+
+/* Account a thrashing refault as a rotation of its type */
+static void workingset_note_rotation(struct lruvec *lruvec, int file)
+{
+	struct zone *zone = lruvec_zone(lruvec);
+	struct zone_reclaim_stat *reclaim_stat = &lruvec->reclaim_stat;
+
+	spin_lock_irq(&zone->lru_lock);
+	reclaim_stat->recent_scanned[file]++;
+	reclaim_stat->recent_rotated[file]++;
+	spin_unlock_irq(&zone->lru_lock);
 }
 
 /**
  * workingset_refault - evaluate the refault of a previously evicted page
+ * @page: the page being read back in
  * @shadow: shadow entry of the evicted page
  *
  * Calculates and evaluates the refault distance of the previously
- * evicted page in the context of the zone it was allocated in.
+ * evicted page in the context of the lruvec it was evicted from.
  *
  * Returns %true if the page should be activated, %false otherwise.
  */
-bool workingset_refault(void *shadow)
+bool workingset_refault(struct page *page, void *shadow)
 {
+	int file = page_is_file_cache(page);
 	unsigned long refault_distance;
+	unsigned long workingset_size;
+	unsigned long eviction;
+	unsigned long refault;
+	struct lruvec *lruvec;
 	struct zone *zone;
+	bool activate = false;
+	int memcgid;
+
+	unpack_shadow(shadow, &memcgid, &zone, &eviction);
+
+	rcu_read_lock();
+	/*
+	 * The memcg the page was evicted from may be gone by now, in
+	 * which case the refault cannot be put in relation to anything.
+	 */
+	lruvec = mem_cgroup_id_lruvec(memcgid, zone);
+	if (!lruvec)
+		goto out;
+	refault = atomic_long_read(&lruvec->inactive_age);
+
+	/*
+	 * The unsigned subtraction here gives an accurate distance
+	 * across inactive_age overflows in most cases.
+	 *
+	 * There is a special case: usually, shadow entries have a
+	 * short lifetime and are either refaulted or reclaimed along
+	 * with the inode before they get too old.  But it is not
+	 * impossible for the inactive_age to lap a shadow entry in
+	 * the field, which can then can result in a false small
+	 * refault distance, leading to a false activation should this
+	 * old entry actually refault again.  However, earlier kernels
+	 * used to deactivate unconditionally with *every* reclaim
+	 * invocation for the longest time, so the occasional
+	 * inappropriate activation leading to pressure on the active
+	 * list is not a problem.
+	 */
+	refault_distance = (refault - eviction) & EVICTION_MASK;
 
-	unpack_shadow(shadow, &zone, &refault_distance);
 	inc_zone_state(zone, WORKINGSET_REFAULT);
+	mem_cgroup_count_refault(lruvec, file, false);
+
+	/* What the refaulting page competes with, see the top of file */
+	workingset_size = lruvec_lru_size(lruvec, LRU_ACTIVE_FILE);
+	if (!file)
+		workingset_size += lruvec_lru_size(lruvec, LRU_INACTIVE_FILE);
+	if (total_swap_pages > 0) {
+		workingset_size += lruvec_lru_size(lruvec, LRU_ACTIVE_ANON);
+		if (file)
+			workingset_size += lruvec_lru_size(lruvec,
+							   LRU_INACTIVE_ANON);
+	}
 
-	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+	if (refault_distance <= workingset_size) {
 		inc_zone_state(zone, WORKINGSET_ACTIVATE);
-		return true;
+		mem_cgroup_count_refault(lruvec, file, true);
+		workingset_age_nonresident(lruvec, 1);
+		workingset_note_rotation(lruvec, file);
+		activate = true;
 	}
-	return false;
+out:
+	rcu_read_unlock();
+	return activate;
 }
 
 /**
@@ -249,7 +337,13 @@ bool workingset_refault(void *shadow)
  */
 void workingset_activation(struct page *page)
 {
-	atomic_long_inc(&page_zone(page)->inactive_age);
+	struct lruvec *lruvec;
+
+	/* The memcg of a page not isolated may go away under us */
+	rcu_read_lock();
+	lruvec = mem_cgroup_page_lruvec(page, page_zone(page));
+	workingset_age_nonresident(lruvec, 1);
+	rcu_read_unlock();
 }
 
 /*
@@ -397,8 +491,21 @@ static struct lock_class_key shadow_nodes_key;
 
 static int __init workingset_init(void)
 {
+	unsigned int timestamp_bits;
+	unsigned int max_order;
 	int ret;
 
+	/*
+	 * Refaults from further back than all of memory are not
+	 * actionable: buckets just need to tell those apart.
+	 */
+	timestamp_bits = BITS_PER_LONG - EVICTION_SHIFT;
+	max_order = fls_long(totalram_pages - 1);
+	if (max_order > timestamp_bits)
+		bucket_order = max_order - timestamp_bits;
+	pr_info("workingset: timestamp_bits=%d max_order=%d bucket_order=%u\n",
+		timestamp_bits, max_order, bucket_order);
+
 	ret = list_lru_init_key(&workingset_shadow_nodes, &shadow_nodes_key);
 	if (ret)
 		goto err;
@@ -30,7 +30,7 @@
 #include <linux/types.h>
 #include <linux/atomic.h>
 #include <linux/frontswap.h>
-#include <linux/rbtree.h>
+#include <linux/radix-tree.h>
 #include <linux/swap.h>
 #include <linux/crypto.h>
 #include <linux/mempool.h>
@@ -49,6 +49,8 @@
 static u64 zswap_pool_pages;
 /* The number of compressed pages currently stored in zswap */
 static atomic_t zswap_stored_pages = ATOMIC_INIT(0);
+/* The number of same-value filled pages currently stored in zswap */
+static atomic_t zswap_same_filled_pages = ATOMIC_INIT(0);
 
 /*
  * The statistics below are not protected from concurrent access for
@@ -89,6 +91,11 @@ static unsigned int zswap_max_pool_percent = 20;
 module_param_named(max_pool_percent,
 			zswap_max_pool_percent, uint, 0644);
 
+/* Store pages filled with one repeated word without compressing them */
+static bool zswap_same_filled_pages_enabled = true;
+module_param_named(same_filled_pages_enabled,
+			zswap_same_filled_pages_enabled, bool, 0644);
+
 /* zbud_pool is shared by all of zswap backend  */
 static struct zbud_pool *zswap_pool;
 
@@ -160,24 +167,26 @@ static void zswap_comp_exit(void)
  * This structure contains the metadata for tracking a single compressed
  * page within zswap.
  *
- * rbnode - links the entry into red-black tree for the appropriate swap type
  * refcount - the number of outstanding reference to the entry. This is needed
  *            to protect against premature freeing of the entry by code
  *            concurrent calls to load, invalidate, and writeback.  The lock
  *            for the zswap_tree structure that contains the entry must
  *            be held while changing the refcount.  Since the lock must
  *            be held, there is no reason to also make refcount atomic.
- * offset - the swap offset for the entry.  Index into the red-black tree.
+ * offset - the swap offset for the entry.  Index into the radix tree.
  * handle - zbud allocation handle that stores the compressed page data
  * length - the length in bytes of the compressed page data.  Needed during
- *          decompression
+ *          decompression.  Zero for a same-value filled page.
+ * value - the word a same-value filled page is filled with
  */
 struct zswap_entry {
-	struct rb_node rbnode;
 	pgoff_t offset;
 	int refcount;
 	unsigned int length;
-	unsigned long handle;
+	union {
+		unsigned long handle;
+		unsigned long value;
+	};
 };
 
 struct zswap_header {
@@ -186,16 +195,31 @@ struct zswap_header {
 
 /*
  * The tree lock in the zswap_tree struct protects a few things:
- * - the rbtree
+ * - the radix tree
  * - the refcount field of each entry in the tree
  */
 struct zswap_tree {
-	struct rb_root rbroot;
+	struct radix_tree_root root;
 	spinlock_t lock;
-};
+} ____cacheline_aligned_in_smp;
+
+/*
+ * Each swap type is indexed by ZSWAP_NR_TREES trees with their own lock.
+ * Runs of 1 << ZSWAP_TREE_SHIFT offsets share a tree, which matches the
+ * swap cluster size, so pages swapped out from one cpu tend to stay in
+ * one tree while other cpus use others.
+ */
+#define ZSWAP_TREE_SHIFT	8
+#define ZSWAP_NR_TREES		64
 
 static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
 
+static struct zswap_tree *zswap_tree(unsigned type, pgoff_t offset)
+{
+	return &zswap_trees[type][(offset >> ZSWAP_TREE_SHIFT) &
+				  (ZSWAP_NR_TREES - 1)];
+}
+
 /*********************************
 * zswap entry functions
 **********************************/
@@ -219,7 +243,6 @@ static struct zswap_entry *zswap_entry_cache_alloc(gfp_t gfp)
 	if (!entry)
 		return NULL;
 	entry->refcount = 1;
-	RB_CLEAR_NODE(&entry->rbnode);
 	return entry;
 }
 
@@ -229,58 +252,34 @@ static void zswap_entry_cache_free(struct zswap_entry *entry)
 }
 
 /*********************************
-* rbtree functions
+* tree functions
 **********************************/
-static struct zswap_entry *zswap_rb_search(struct rb_root *root, pgoff_t offset)
+static struct zswap_entry *zswap_tree_search(struct zswap_tree *tree,
+				pgoff_t offset)
 {
-	struct rb_node *node = root->rb_node;
-	struct zswap_entry *entry;
-
-	while (node) {
-		entry = rb_entry(node, struct zswap_entry, rbnode);
-		if (entry->offset > offset)
-			node = node->rb_left;
-		else if (entry->offset < offset)
-			node = node->rb_right;
-		else
-			return entry;
-	}
-	return NULL;
+	return radix_tree_lookup(&tree->root, offset);
 }
 
 /*
  * In the case that a entry with the same offset is found, a pointer to
- * the existing entry is stored in dupentry and the function returns -EEXIST
+ * the existing entry is stored in dupentry and the function returns -EEXIST.
+ * The caller must have preloaded the radix tree.
  */
-static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
+static int zswap_tree_insert(struct zswap_tree *tree, struct zswap_entry *entry,
 			struct zswap_entry **dupentry)
 {
-	struct rb_node **link = &root->rb_node, *parent = NULL;
-	struct zswap_entry *myentry;
-
-	while (*link) {
-		parent = *link;
-		myentry = rb_entry(parent, struct zswap_entry, rbnode);
-		if (myentry->offset > entry->offset)
-			link = &(*link)->rb_left;
-		else if (myentry->offset < entry->offset)
-			link = &(*link)->rb_right;
-		else {
-			*dupentry = myentry;
-			return -EEXIST;
-		}
-	}
-	rb_link_node(&entry->rbnode, parent, link);
-	rb_insert_color(&entry->rbnode, root);
-	return 0;
+	int ret;
+
+	ret = radix_tree_insert(&tree->root, entry->offset, entry);
+	if (ret == -EEXIST)
+		*dupentry = zswap_tree_search(tree, entry->offset);
+	return ret;
 }
 
-static void zswap_rb_erase(struct rb_root *root, struct zswap_entry *entry)
+/* only removes @entry, not a newer entry stored at the same offset */
+static void zswap_tree_erase(struct zswap_tree *tree, struct zswap_entry *entry)
 {
-	if (!RB_EMPTY_NODE(&entry->rbnode)) {
-		rb_erase(&entry->rbnode, root);
-		RB_CLEAR_NODE(&entry->rbnode);
-	}
+	radix_tree_delete_item(&tree->root, entry->offset, entry);
 }
 
 /*
@@ -289,7 +288,10 @@ static void zswap_rb_erase(struct rb_root *root, struct zswap_entry *entry)
  */
 static void zswap_free_entry(struct zswap_entry *entry)
 {
-	zbud_free(zswap_pool, entry->handle);
+	if (!entry->length)
+		atomic_dec(&zswap_same_filled_pages);
+	else
+		zbud_free(zswap_pool, entry->handle);
 	zswap_entry_cache_free(entry);
 	atomic_dec(&zswap_stored_pages);
 	zswap_pool_pages = zbud_get_pool_size(zswap_pool);
@@ -311,18 +313,18 @@ static void zswap_entry_put(struct zswap_tree *tree,
 
 	BUG_ON(refcount < 0);
 	if (refcount == 0) {
-		zswap_rb_erase(&tree->rbroot, entry);
+		zswap_tree_erase(tree, entry);
 		zswap_free_entry(entry);
 	}
 }
 
 /* caller must hold the tree lock */
-static struct zswap_entry *zswap_entry_find_get(struct rb_root *root,
+static struct zswap_entry *zswap_entry_find_get(struct zswap_tree *tree,
 				pgoff_t offset)
 {
 	struct zswap_entry *entry = NULL;
 
-	entry = zswap_rb_search(root, offset);
+	entry = zswap_tree_search(tree, offset);
 	if (entry)
 		zswap_entry_get(entry);
 
@@ -488,7 +490,7 @@ static int zswap_get_swap_cache_page(swp_entry_t entry,
 		/* May fail (-ENOMEM) if radix-tree node allocation failed. */
 		__set_page_locked(new_page);
 		SetPageSwapBacked(new_page);
-		err = __add_to_swap_cache(new_page, entry);
+		err = __add_to_swap_cache(new_page, entry, NULL);
 		if (likely(!err)) {
 			radix_tree_preload_end();
 			lru_cache_add_anon(new_page);
@@ -544,12 +546,12 @@ static int zswap_writeback_entry(struct zbud_pool *pool, unsigned long handle)
 	zhdr = zbud_map(pool, handle);
 	swpentry = zhdr->swpentry; /* here */
 	zbud_unmap(pool, handle);
-	tree = zswap_trees[swp_type(swpentry)];
 	offset = swp_offset(swpentry);
+	tree = zswap_tree(swp_type(swpentry), offset);
 
 	/* find and ref zswap entry */
 	spin_lock(&tree->lock);
-	entry = zswap_entry_find_get(&tree->rbroot, offset);
+	entry = zswap_entry_find_get(tree, offset);
 	if (!entry) {
 		/* entry was invalidated */
 		spin_unlock(&tree->lock);
@@ -606,7 +608,7 @@ static int zswap_writeback_entry(struct zbud_pool *pool, unsigned long handle)
 	*     because invalidate happened during writeback
 	*  search the tree and free the entry if find entry
 	*/
-	if (entry == zswap_rb_search(&tree->rbroot, offset))
+	if (entry == zswap_tree_search(tree, offset))
 		zswap_entry_put(tree, entry);
 	spin_unlock(&tree->lock);
 
@@ -628,6 +630,41 @@ end:
 	return ret;
 }
 
+/*********************************
+* same-filled functions
+**********************************/
+static bool zswap_is_page_same_filled(void *ptr, unsigned long *value)
+{
+	unsigned int pos, last_pos = PAGE_SIZE / sizeof(unsigned long) - 1;
+	unsigned long *page = ptr;
+	unsigned long val = page[0];
+
+	if (val != page[last_pos])
+		return false;
+
+	for (pos = 1; pos < last_pos; pos++) {
+		if (val != page[pos])
+			return false;
+	}
+
+	*value = val;
+	return true;
+}
+
+static void zswap_fill_page(void *ptr, unsigned long value)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	if (value == 0) {
+		clear_page(ptr);
+		return;
+	}
+
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page); pos++)
+		page[pos] = value;
+}
+
 /*********************************
 * frontswap hooks
 **********************************/
@@ -635,19 +672,42 @@ end:
 static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 				struct page *page)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *tree;
 	struct zswap_entry *entry, *dupentry;
 	int ret;
 	unsigned int dlen = PAGE_SIZE, len;
 	unsigned long handle;
+	unsigned long value;
 	char *buf;
 	u8 *src, *dst;
 	struct zswap_header *zhdr;
 
-	if (!tree) {
+	if (!zswap_trees[type]) {
 		ret = -ENODEV;
 		goto reject;
 	}
+	tree = zswap_tree(type, offset);
+
+	/* same-filled pages need neither the compressor nor pool space */
+	if (zswap_same_filled_pages_enabled) {
+		bool same;
+
+		src = kmap_atomic(page);
+		same = zswap_is_page_same_filled(src, &value);
+		kunmap_atomic(src);
+		if (same) {
+			entry = zswap_entry_cache_alloc(GFP_KERNEL);
+			if (!entry) {
+				zswap_reject_kmemcache_fail++;
+				ret = -ENOMEM;
+				goto reject;
+			}
+			entry->offset = offset;
+			entry->length = 0;
+			entry->value = value;
+			goto insert;
+		}
+	}
 
 	/* reclaim space if needed */
 	if (zswap_is_full()) {
@@ -701,20 +761,37 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 	entry->handle = handle;
 	entry->length = dlen;
 
+insert:
 	/* map */
+	if (radix_tree_preload(GFP_KERNEL)) {
+		zswap_reject_alloc_fail++;
+		if (entry->length)
+			zbud_free(zswap_pool, entry->handle);
+		ret = -ENOMEM;
+		goto freeentry;
+	}
 	spin_lock(&tree->lock);
 	do {
-		ret = zswap_rb_insert(&tree->rbroot, entry, &dupentry);
+		ret = zswap_tree_insert(tree, entry, &dupentry);
 		if (ret == -EEXIST) {
 			zswap_duplicate_entry++;
-			/* remove from rbtree */
-			zswap_rb_erase(&tree->rbroot, dupentry);
+			/* remove from the tree */
+			zswap_tree_erase(tree, dupentry);
 			zswap_entry_put(tree, dupentry);
 		}
 	} while (ret == -EEXIST);
 	spin_unlock(&tree->lock);
+	radix_tree_preload_end();
+	if (ret) {
+		zswap_reject_alloc_fail++;
+		if (entry->length)
+			zbud_free(zswap_pool, entry->handle);
+		goto freeentry;
+	}
 
 	/* update stats */
+	if (!entry->length)
+		atomic_inc(&zswap_same_filled_pages);
 	atomic_inc(&zswap_stored_pages);
 	zswap_pool_pages = zbud_get_pool_size(zswap_pool);
 
@@ -722,6 +799,7 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 
 freepage:
 	put_cpu_var(zswap_dstmem);
+freeentry:
 	zswap_entry_cache_free(entry);
 reject:
 	return ret;
@@ -734,7 +812,7 @@ reject:
 static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 				struct page *page)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *tree = zswap_tree(type, offset);
 	struct zswap_entry *entry;
 	u8 *src, *dst;
 	unsigned int dlen;
@@ -742,7 +820,7 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 
 	/* find */
 	spin_lock(&tree->lock);
-	entry = zswap_entry_find_get(&tree->rbroot, offset);
+	entry = zswap_entry_find_get(tree, offset);
 	if (!entry) {
 		/* entry was written back */
 		spin_unlock(&tree->lock);
@@ -750,6 +828,13 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 	}
 	spin_unlock(&tree->lock);
 
+	if (!entry->length) {
+		dst = kmap_atomic(page);
+		zswap_fill_page(dst, entry->value);
+		kunmap_atomic(dst);
+		goto freeentry;
+	}
+
 	/* decompress */
 	dlen = PAGE_SIZE;
 	src = (u8 *)zbud_map(zswap_pool, entry->handle) +
@@ -761,6 +846,7 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 	zbud_unmap(zswap_pool, entry->handle);
 	BUG_ON(ret);
 
+freeentry:
 	spin_lock(&tree->lock);
 	zswap_entry_put(tree, entry);
 	spin_unlock(&tree->lock);
@@ -771,20 +857,20 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
 /* frees an entry in zswap */
 static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 {
-	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_tree *tree = zswap_tree(type, offset);
 	struct zswap_entry *entry;
 
 	/* find */
 	spin_lock(&tree->lock);
-	entry = zswap_rb_search(&tree->rbroot, offset);
+	entry = zswap_tree_search(tree, offset);
 	if (!entry) {
 		/* entry was written back */
 		spin_unlock(&tree->lock);
 		return;
 	}
 
-	/* remove from rbtree */
-	zswap_rb_erase(&tree->rbroot, entry);
+	/* remove from the tree */
+	zswap_tree_erase(tree, entry);
 
 	/* drop the initial reference from entry creation */
 	zswap_entry_put(tree, entry);
@@ -792,22 +878,38 @@ static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 	spin_unlock(&tree->lock);
 }
 
+#define ZSWAP_FREE_BATCH 16
+
 /* frees all zswap entries for the given swap type */
 static void zswap_frontswap_invalidate_area(unsigned type)
 {
-	struct zswap_tree *tree = zswap_trees[type];
-	struct zswap_entry *entry, *n;
+	struct zswap_tree *trees = zswap_trees[type], *tree;
+	struct zswap_entry *entries[ZSWAP_FREE_BATCH];
+	unsigned long pos;
+	int i, j, nr;
 
-	if (!tree)
+	if (!trees)
 		return;
 
-	/* walk the tree and free everything */
-	spin_lock(&tree->lock);
-	rbtree_postorder_for_each_entry_safe(entry, n, &tree->rbroot, rbnode)
-		zswap_free_entry(entry);
-	tree->rbroot = RB_ROOT;
-	spin_unlock(&tree->lock);
-	kfree(tree);
+	/* walk the trees and free everything */
+	for (i = 0; i < ZSWAP_NR_TREES; i++) {
+		tree = &trees[i];
+		pos = 0;
+
+		spin_lock(&tree->lock);
+		do {
+			nr = radix_tree_gang_lookup(&tree->root,
+					(void **)entries, pos, ZSWAP_FREE_BATCH);
+			for (j = 0; j < nr; j++) {
+				pos = entries[j]->offset;
+				radix_tree_delete(&tree->root, pos);
+				zswap_free_entry(entries[j]);
+			}
+			pos++;
+		} while (nr == ZSWAP_FREE_BATCH);
+		spin_unlock(&tree->lock);
+	}
+	kfree(trees);
 	zswap_trees[type] = NULL;
 }
 
@@ -817,17 +919,20 @@ static struct zbud_ops zswap_zbud_ops = {
 
 static void zswap_frontswap_init(unsigned type)
 {
-	struct zswap_tree *tree;
+	struct zswap_tree *trees;
+	int i;
 
-	tree = kzalloc(sizeof(struct zswap_tree), GFP_KERNEL);
-	if (!tree) {
+	trees = kcalloc(ZSWAP_NR_TREES, sizeof(struct zswap_tree), GFP_KERNEL);
+	if (!trees) {
 		pr_err("alloc failed, zswap disabled for swap type %d\n", type);
 		return;
 	}
 
-	tree->rbroot = RB_ROOT;
-	spin_lock_init(&tree->lock);
-	zswap_trees[type] = tree;
+	for (i = 0; i < ZSWAP_NR_TREES; i++) {
+		INIT_RADIX_TREE(&trees[i].root, GFP_ATOMIC | __GFP_NOWARN);
+		spin_lock_init(&trees[i].lock);
+	}
+	zswap_trees[type] = trees;
 }
 
 static struct frontswap_ops zswap_frontswap_ops = {
@@ -873,6 +978,8 @@ static int __init zswap_debugfs_init(void)
 			zswap_debugfs_root, &zswap_pool_pages);
 	debugfs_create_atomic_t("stored_pages", S_IRUGO,
 			zswap_debugfs_root, &zswap_stored_pages);
+	debugfs_create_atomic_t("same_filled_pages", S_IRUGO,
+			zswap_debugfs_root, &zswap_same_filled_pages);
 
 	return 0;
 }
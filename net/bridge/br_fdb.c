@@ -78,6 +78,11 @@ static inline int br_mac_hash(const unsigned char *mac, __u16 vid)
 	return jhash_2words(key, vid, fdb_salt) & (BR_HASH_SIZE - 1);
 }
 
+static inline spinlock_t *fdb_bucket_lock(struct net_bridge *br, int hash)
+{
+	return &br->hash_locks[hash & (BR_HASH_LOCKS - 1)];
+}
+
 static void fdb_rcu_free(struct rcu_head *head)
 {
 	struct net_bridge_fdb_entry *ent
@@ -126,13 +131,16 @@ void br_fdb_find_delete_local(struct net_bridge *br,
 			      const struct net_bridge_port *p,
 			      const unsigned char *addr, u16 vid)
 {
-	struct hlist_head *head = &br->hash[br_mac_hash(addr, vid)];
+	int hash = br_mac_hash(addr, vid);
+	struct hlist_head *head = &br->hash[hash];
 	struct net_bridge_fdb_entry *f;
 
 	spin_lock_bh(&br->hash_lock);
+	spin_lock(fdb_bucket_lock(br, hash));
 	f = fdb_find(head, addr, vid);
 	if (f && f->is_local && !f->added_by_user && f->dst == p)
 		fdb_delete_local(br, p, f);
+	spin_unlock(fdb_bucket_lock(br, hash));
 	spin_unlock_bh(&br->hash_lock);
 }
 
@@ -148,8 +156,10 @@ void br_fdb_changeaddr(struct net_bridge_port *p, const unsigned char *newaddr)
 
 	/* Search all chains since old address/hash is unknown */
 	for (i = 0; i < BR_HASH_SIZE; i++) {
-		struct hlist_node *h;
-		hlist_for_each(h, &br->hash[i]) {
+		struct hlist_node *h, *n;
+
+		spin_lock(fdb_bucket_lock(br, i));
+		hlist_for_each_safe(h, n, &br->hash[i]) {
 			struct net_bridge_fdb_entry *f;
 
 			f = hlist_entry(h, struct net_bridge_fdb_entry, hlist);
@@ -161,10 +171,13 @@ void br_fdb_changeaddr(struct net_bridge_port *p, const unsigned char *newaddr)
 				 * configured, we can safely be done at
 				 * this point.
 				 */
-				if (no_vlan)
+				if (no_vlan) {
+					spin_unlock(fdb_bucket_lock(br, i));
 					goto insert;
+				}
 			}
 		}
+		spin_unlock(fdb_bucket_lock(br, i));
 	}
 
 insert:
@@ -185,18 +198,31 @@ done:
 	spin_unlock_bh(&br->hash_lock);
 }
 
-void br_fdb_change_mac_address(struct net_bridge *br, const u8 *newaddr)
+/* Delete the local entry of the bridge device itself, called with
+ * hash_lock held.
+ */
+static void fdb_find_delete_local_nodst(struct net_bridge *br,
+					const unsigned char *addr, u16 vid)
 {
+	int hash = br_mac_hash(addr, vid);
 	struct net_bridge_fdb_entry *f;
+
+	spin_lock(fdb_bucket_lock(br, hash));
+	f = fdb_find(&br->hash[hash], addr, vid);
+	if (f && f->is_local && !f->dst)
+		fdb_delete_local(br, NULL, f);
+	spin_unlock(fdb_bucket_lock(br, hash));
+}
+
+void br_fdb_change_mac_address(struct net_bridge *br, const u8 *newaddr)
+{
 	struct net_port_vlans *pv;
 	u16 vid = 0;
 
 	spin_lock_bh(&br->hash_lock);
 
 	/* If old entry was unassociated with any port, then delete it. */
-	f = __br_fdb_get(br, br->dev->dev_addr, 0);
-	if (f && f->is_local && !f->dst)
-		fdb_delete_local(br, NULL, f);
+	fdb_find_delete_local_nodst(br, br->dev->dev_addr, 0);
 
 	fdb_insert(br, NULL, newaddr, 0);
 
@@ -209,27 +235,35 @@ void br_fdb_change_mac_address(struct net_bridge *br, const u8 *newaddr)
 		goto out;
 
 	for_each_set_bit_from(vid, pv->vlan_bitmap, VLAN_N_VID) {
-		f = __br_fdb_get(br, br->dev->dev_addr, vid);
-		if (f && f->is_local && !f->dst)
-			fdb_delete_local(br, NULL, f);
+		fdb_find_delete_local_nodst(br, br->dev->dev_addr, vid);
 		fdb_insert(br, NULL, newaddr, vid);
 	}
 out:
 	spin_unlock_bh(&br->hash_lock);
 }
 
+/* Ageing walks BR_FDB_GC_SLICE buckets per run, under their own locks,
+ * and sleeps till the next expiry once a pass over the table is done.
+ */
+#define BR_FDB_GC_SLICE		16
+#define BR_FDB_GC_INTERVAL	(HZ / 10)
+
 void br_fdb_cleanup(unsigned long _data)
 {
 	struct net_bridge *br = (struct net_bridge *)_data;
 	unsigned long delay = hold_time(br);
-	unsigned long next_timer = jiffies + br->ageing_time;
-	int i;
+	unsigned int i, end;
 
-	spin_lock(&br->hash_lock);
-	for (i = 0; i < BR_HASH_SIZE; i++) {
+	if (br->gc_bucket == 0)
+		br->gc_next = jiffies + br->ageing_time;
+
+	end = min_t(unsigned int, br->gc_bucket + BR_FDB_GC_SLICE,
+		    BR_HASH_SIZE);
+	for (i = br->gc_bucket; i < end; i++) {
 		struct net_bridge_fdb_entry *f;
 		struct hlist_node *n;
 
+		spin_lock(fdb_bucket_lock(br, i));
 		hlist_for_each_entry_safe(f, n, &br->hash[i], hlist) {
 			unsigned long this_timer;
 			if (f->is_static)
@@ -237,13 +271,17 @@ void br_fdb_cleanup(unsigned long _data)
 			this_timer = f->updated + delay;
 			if (time_before_eq(this_timer, jiffies))
 				fdb_delete(br, f);
-			else if (time_before(this_timer, next_timer))
-				next_timer = this_timer;
+			else if (time_before(this_timer, br->gc_next))
+				br->gc_next = this_timer;
 		}
+		spin_unlock(fdb_bucket_lock(br, i));
 	}
-	spin_unlock(&br->hash_lock);
+	br->gc_bucket = end % BR_HASH_SIZE;
 
-	mod_timer(&br->gc_timer, round_jiffies_up(next_timer));
+	if (br->gc_bucket)
+		mod_timer(&br->gc_timer, jiffies + BR_FDB_GC_INTERVAL);
+	else
+		mod_timer(&br->gc_timer, round_jiffies_up(br->gc_next));
 }
 
 /* Completely flush all dynamic entries in forwarding database.*/
@@ -255,10 +293,13 @@ void br_fdb_flush(struct net_bridge *br)
 	for (i = 0; i < BR_HASH_SIZE; i++) {
 		struct net_bridge_fdb_entry *f;
 		struct hlist_node *n;
+
+		spin_lock(fdb_bucket_lock(br, i));
 		hlist_for_each_entry_safe(f, n, &br->hash[i], hlist) {
 			if (!f->is_static)
 				fdb_delete(br, f);
 		}
+		spin_unlock(fdb_bucket_lock(br, i));
 	}
 	spin_unlock_bh(&br->hash_lock);
 }
@@ -276,6 +317,7 @@ void br_fdb_delete_by_port(struct net_bridge *br,
 	for (i = 0; i < BR_HASH_SIZE; i++) {
 		struct hlist_node *h, *g;
 
+		spin_lock(fdb_bucket_lock(br, i));
 		hlist_for_each_safe(h, g, &br->hash[i]) {
 			struct net_bridge_fdb_entry *f
 				= hlist_entry(h, struct net_bridge_fdb_entry, hlist);
@@ -290,6 +332,7 @@ void br_fdb_delete_by_port(struct net_bridge *br,
 			else
 				fdb_delete(br, f);
 		}
+		spin_unlock(fdb_bucket_lock(br, i));
 	}
 	spin_unlock_bh(&br->hash_lock);
 }
@@ -442,19 +485,22 @@ static struct net_bridge_fdb_entry *fdb_create(struct hlist_head *head,
 static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 		  const unsigned char *addr, u16 vid)
 {
-	struct hlist_head *head = &br->hash[br_mac_hash(addr, vid)];
+	int hash = br_mac_hash(addr, vid);
+	struct hlist_head *head = &br->hash[hash];
 	struct net_bridge_fdb_entry *fdb;
+	int err = 0;
 
 	if (!is_valid_ether_addr(addr))
 		return -EINVAL;
 
+	spin_lock(fdb_bucket_lock(br, hash));
 	fdb = fdb_find(head, addr, vid);
 	if (fdb) {
 		/* it is okay to have multiple ports with same
 		 * address, just use the first one.
 		 */
 		if (fdb->is_local)
-			return 0;
+			goto out;
 		br_warn(br, "adding interface %s with same address "
 		       "as a received packet\n",
 		       source ? source->dev->name : br->dev->name);
@@ -462,12 +508,16 @@ static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 	}
 
 	fdb = fdb_create(head, source, addr, vid);
-	if (!fdb)
-		return -ENOMEM;
+	if (!fdb) {
+		err = -ENOMEM;
+		goto out;
+	}
 
 	fdb->is_local = fdb->is_static = 1;
 	fdb_notify(br, fdb, RTM_NEWNEIGH);
-	return 0;
+out:
+	spin_unlock(fdb_bucket_lock(br, hash));
+	return err;
 }
 
 /* Add entry for local address of interface */
@@ -485,7 +535,8 @@ int br_fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 		   const unsigned char *addr, u16 vid, bool added_by_user)
 {
-	struct hlist_head *head = &br->hash[br_mac_hash(addr, vid)];
+	int hash = br_mac_hash(addr, vid);
+	struct hlist_head *head = &br->hash[hash];
 	struct net_bridge_fdb_entry *fdb;
 	bool fdb_modified = false;
 
@@ -500,6 +551,8 @@ void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 
 	fdb = fdb_find_rcu(head, addr, vid);
 	if (likely(fdb)) {
+		unsigned long now = jiffies;
+
 		/* attempt to update an entry for a local interface */
 		if (unlikely(fdb->is_local)) {
 			if (net_ratelimit())
@@ -512,14 +565,16 @@ void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 				fdb->dst = source;
 				fdb_modified = true;
 			}
-			fdb->updated = jiffies;
+			/* only dirty the entry once per tick */
+			if (fdb->updated != now)
+				fdb->updated = now;
 			if (unlikely(added_by_user))
 				fdb->added_by_user = 1;
 			if (unlikely(fdb_modified))
 				fdb_notify(br, fdb, RTM_NEWNEIGH);
 		}
 	} else {
-		spin_lock(&br->hash_lock);
+		spin_lock(fdb_bucket_lock(br, hash));
 		if (likely(!fdb_find(head, addr, vid))) {
 			fdb = fdb_create(head, source, addr, vid);
 			if (fdb) {
@@ -531,7 +586,7 @@ void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 		/* else  we lose race and someone else inserts
 		 * it first, don't bother updating
 		 */
-		spin_unlock(&br->hash_lock);
+		spin_unlock(fdb_bucket_lock(br, hash));
 	}
 }
 
@@ -659,23 +714,31 @@ static int fdb_add_entry(struct net_bridge_port *source, const __u8 *addr,
 			 __u16 state, __u16 flags, __u16 vid)
 {
 	struct net_bridge *br = source->br;
-	struct hlist_head *head = &br->hash[br_mac_hash(addr, vid)];
+	int hash = br_mac_hash(addr, vid);
+	struct hlist_head *head = &br->hash[hash];
 	struct net_bridge_fdb_entry *fdb;
 	bool modified = false;
+	int err = 0;
 
+	spin_lock(fdb_bucket_lock(br, hash));
 	fdb = fdb_find(head, addr, vid);
 	if (fdb == NULL) {
+		err = -ENOENT;
 		if (!(flags & NLM_F_CREATE))
-			return -ENOENT;
+			goto out;
 
+		err = -ENOMEM;
 		fdb = fdb_create(head, source, addr, vid);
 		if (!fdb)
-			return -ENOMEM;
+			goto out;
 
+		err = 0;
 		modified = true;
 	} else {
+		err = -EEXIST;
 		if (flags & NLM_F_EXCL)
-			return -EEXIST;
+			goto out;
+		err = 0;
 
 		if (fdb->dst != source) {
 			fdb->dst = source;
@@ -702,7 +765,9 @@ static int fdb_add_entry(struct net_bridge_port *source, const __u8 *addr,
 		fdb_notify(br, fdb, RTM_NEWNEIGH);
 	}
 
-	return 0;
+out:
+	spin_unlock(fdb_bucket_lock(br, hash));
+	return err;
 }
 
 static int __br_fdb_add(struct ndmsg *ndm, struct net_bridge_port *p,
@@ -799,15 +864,18 @@ out:
 
 static int fdb_delete_by_addr(struct net_bridge *br, const u8 *addr, u16 vlan)
 {
-	struct hlist_head *head = &br->hash[br_mac_hash(addr, vlan)];
+	int hash = br_mac_hash(addr, vlan);
 	struct net_bridge_fdb_entry *fdb;
+	int err = -ENOENT;
 
-	fdb = fdb_find(head, addr, vlan);
-	if (!fdb)
-		return -ENOENT;
-
-	fdb_delete(br, fdb);
-	return 0;
+	spin_lock(fdb_bucket_lock(br, hash));
+	fdb = fdb_find(&br->hash[hash], addr, vlan);
+	if (fdb) {
+		fdb_delete(br, fdb);
+		err = 0;
+	}
+	spin_unlock(fdb_bucket_lock(br, hash));
+	return err;
 }
 
 static int __br_fdb_delete(struct net_bridge_port *p,
@@ -125,7 +125,11 @@ int br_handle_frame_finish(struct sk_buff *skb)
 
 	if (skb) {
 		if (dst) {
-			dst->used = jiffies;
+			unsigned long now = jiffies;
+
+			/* only write the entry once per tick */
+			if (dst->used != now)
+				dst->used = now;
 			br_forward(dst->dst, skb, skb2);
 		} else
 			br_flood_forward(br, skb, skb2, unicast);
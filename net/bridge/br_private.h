@@ -22,6 +22,7 @@
 
 #define BR_HASH_BITS 8
 #define BR_HASH_SIZE (1 << BR_HASH_BITS)
+#define BR_HASH_LOCKS 32
 
 #define BR_HOLD_TIME (1*HZ)
 
@@ -99,7 +100,8 @@ struct net_bridge_fdb_entry
 	struct net_bridge_port		*dst;
 
 	struct rcu_head			rcu;
-	unsigned long			updated;
+	/* written by the datapath, keep them off the lookup fields */
+	unsigned long			updated ____cacheline_aligned_in_smp;
 	unsigned long			used;
 	mac_addr			addr;
 	unsigned char			is_local;
@@ -218,7 +220,12 @@ struct net_bridge
 	struct net_device		*dev;
 
 	struct pcpu_sw_netstats		__percpu *stats;
+	/* hash_lock serializes control path updates of the fdb, a chain is
+	 * changed under its bucket lock, which is all that learning and
+	 * ageing take.
+	 */
 	spinlock_t			hash_lock;
+	spinlock_t			hash_locks[BR_HASH_LOCKS];
 	struct hlist_head		hash[BR_HASH_SIZE];
 #ifdef CONFIG_BRIDGE_NETFILTER
 	struct rtable 			fake_rtable;
@@ -289,6 +296,8 @@ struct net_bridge
 	struct timer_list		tcn_timer;
 	struct timer_list		topology_change_timer;
 	struct timer_list		gc_timer;
+	unsigned int			gc_bucket;	/* ageing cursor */
+	unsigned long			gc_next;
 	struct kobject			*ifobj;
 #ifdef CONFIG_BRIDGE_VLAN_FILTERING
 	u8				vlan_enabled;
@@ -232,6 +232,26 @@ static void encode_my_addr(struct ceph_messenger *msgr)
  */
 static struct workqueue_struct *ceph_msgr_wq;
 
+/*
+ * Connections are spread round-robin over the online CPUs, each one's
+ * work always running on the per-cpu worker of its own CPU.  Otherwise
+ * it runs wherever it was queued from, which for socket callbacks is
+ * the few CPUs taking the NIC's receive interrupts.
+ */
+static atomic_t ceph_con_next_cpu = ATOMIC_INIT(0);
+
+static int ceph_con_pick_cpu(void)
+{
+	unsigned int n = atomic_inc_return(&ceph_con_next_cpu);
+	int cpu;
+
+	cpu = cpumask_next((int)(n % nr_cpu_ids) - 1, cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = cpumask_first(cpu_online_mask);
+
+	return cpu;
+}
+
 static int ceph_msgr_slab_init(void)
 {
 	BUG_ON(ceph_msg_cache);
@@ -520,8 +540,12 @@ static int ceph_tcp_recvmsg(struct socket *sock, void *buf, size_t len)
 	return r;
 }
 
+/*
+ * Receive into a page.  If @crc is non-NULL, it is updated with what was
+ * received, through the same mapping and while the data is still hot.
+ */
 static int ceph_tcp_recvpage(struct socket *sock, struct page *page,
-		     int page_offset, size_t length)
+		     int page_offset, size_t length, u32 *crc)
 {
 	void *kaddr;
 	int ret;
@@ -531,6 +555,8 @@ static int ceph_tcp_recvpage(struct socket *sock, struct page *page,
 	kaddr = kmap(page);
 	BUG_ON(!kaddr);
 	ret = ceph_tcp_recvmsg(sock, kaddr + page_offset, length);
+	if (crc && ret > 0)
+		*crc = crc32c(*crc, kaddr + page_offset, ret);
 	kunmap(page);
 
 	return ret;
@@ -570,20 +596,37 @@ static int __ceph_tcp_sendpage(struct socket *sock, struct page *page,
 	return ret;
 }
 
+/*
+ * Send from a page.  If @crc is non-NULL, it is updated with what the
+ * socket took.  For the zero-copy case that is the only time the CPU
+ * touches the data; in the copying fallback the crc reuses the mapping
+ * the copy went through.
+ */
 static int ceph_tcp_sendpage(struct socket *sock, struct page *page,
-		     int offset, size_t size, bool more)
+		     int offset, size_t size, bool more, u32 *crc)
 {
 	int ret;
 	struct kvec iov;
+	void *kaddr;
 
 	/* sendpage cannot properly handle pages with page_count == 0,
 	 * we need to fallback to sendmsg if that's the case */
-	if (page_count(page) >= 1)
-		return __ceph_tcp_sendpage(sock, page, offset, size, more);
+	if (page_count(page) >= 1) {
+		ret = __ceph_tcp_sendpage(sock, page, offset, size, more);
+		if (crc && ret > 0) {
+			kaddr = kmap(page);
+			*crc = crc32c(*crc, kaddr + offset, ret);
+			kunmap(page);
+		}
+		return ret;
+	}
 
-	iov.iov_base = kmap(page) + offset;
+	kaddr = kmap(page);
+	iov.iov_base = kaddr + offset;
 	iov.iov_len = size;
 	ret = ceph_tcp_sendmsg(sock, &iov, 1, size, more);
+	if (crc && ret > 0)
+		*crc = crc32c(*crc, kaddr + offset, ret);
 	kunmap(page);
 
 	return ret;
@@ -736,6 +779,7 @@ void ceph_con_init(struct ceph_connection *con, void *private,
 	INIT_LIST_HEAD(&con->out_queue);
 	INIT_LIST_HEAD(&con->out_sent);
 	INIT_DELAYED_WORK(&con->work, con_work);
+	con->cpu = ceph_con_pick_cpu();
 
 	con->state = CON_STATE_CLOSED;
 }
@@ -1066,7 +1110,6 @@ static void __ceph_msg_data_cursor_init(struct ceph_msg_data_cursor *cursor)
 		/* BUG(); */
 		break;
 	}
-	cursor->need_crc = true;
 }
 
 static void ceph_msg_data_cursor_init(struct ceph_msg *msg, size_t length)
@@ -1159,8 +1202,6 @@ static bool ceph_msg_data_advance(struct ceph_msg_data_cursor *cursor,
 		__ceph_msg_data_cursor_init(cursor);
 		new_piece = true;
 	}
-	cursor->need_crc = new_piece;
-
 	return new_piece;
 }
 
@@ -1469,19 +1510,6 @@ out:
 	return ret;  /* done! */
 }
 
-static u32 ceph_crc32c_page(u32 crc, struct page *page,
-				unsigned int page_offset,
-				unsigned int length)
-{
-	char *kaddr;
-
-	kaddr = kmap(page);
-	BUG_ON(kaddr == NULL);
-	crc = crc32c(crc, kaddr + page_offset, length);
-	kunmap(page);
-
-	return crc;
-}
 /*
  * Write as much message data payload as we can.  If we finish, queue
  * up the footer.
@@ -1515,22 +1543,19 @@ static int write_partial_message_data(struct ceph_connection *con)
 		size_t page_offset;
 		size_t length;
 		bool last_piece;
-		bool need_crc;
 		int ret;
 
 		page = ceph_msg_data_next(&msg->cursor, &page_offset, &length,
 							&last_piece);
-		ret = ceph_tcp_sendpage(con->sock, page, page_offset,
-				      length, last_piece);
+		ret = ceph_tcp_sendpage(con->sock, page, page_offset, length,
+					last_piece, do_datacrc ? &crc : NULL);
 		if (ret <= 0) {
 			if (do_datacrc)
 				msg->footer.data_crc = cpu_to_le32(crc);
 
 			return ret;
 		}
-		if (do_datacrc && cursor->need_crc)
-			crc = ceph_crc32c_page(crc, page, page_offset, length);
-		need_crc = ceph_msg_data_advance(&msg->cursor, (size_t)ret);
+		(void) ceph_msg_data_advance(&msg->cursor, (size_t)ret);
 	}
 
 	dout("%s %p msg %p done\n", __func__, con, msg);
@@ -1556,7 +1581,8 @@ static int write_partial_skip(struct ceph_connection *con)
 	while (con->out_skip > 0) {
 		size_t size = min(con->out_skip, (int) PAGE_CACHE_SIZE);
 
-		ret = ceph_tcp_sendpage(con->sock, zero_page, 0, size, true);
+		ret = ceph_tcp_sendpage(con->sock, zero_page, 0, size, true,
+					NULL);
 		if (ret <= 0)
 			goto out;
 		con->out_skip -= ret;
@@ -2210,7 +2236,8 @@ static int read_partial_msg_data(struct ceph_connection *con)
 	while (cursor->resid) {
 		page = ceph_msg_data_next(&msg->cursor, &page_offset, &length,
 							NULL);
-		ret = ceph_tcp_recvpage(con->sock, page, page_offset, length);
+		ret = ceph_tcp_recvpage(con->sock, page, page_offset, length,
+					do_datacrc ? &crc : NULL);
 		if (ret <= 0) {
 			if (do_datacrc)
 				con->in_data_crc = crc;
@@ -2218,8 +2245,6 @@ static int read_partial_msg_data(struct ceph_connection *con)
 			return ret;
 		}
 
-		if (do_datacrc)
-			crc = ceph_crc32c_page(crc, page, page_offset, ret);
 		(void) ceph_msg_data_advance(&msg->cursor, (size_t)ret);
 	}
 	if (do_datacrc)
@@ -2665,13 +2690,19 @@ bad_tag:
  */
 static int queue_con_delay(struct ceph_connection *con, unsigned long delay)
 {
+	int cpu = con->cpu;
+
 	if (!con->ops->get(con)) {
 		dout("%s %p ref count 0\n", __func__, con);
 
 		return -ENOENT;
 	}
 
-	if (!queue_delayed_work(ceph_msgr_wq, &con->work, delay)) {
+	/* the workqueue copes with the cpu going away after this */
+	if (!cpu_online(cpu))
+		cpu = WORK_CPU_UNBOUND;
+
+	if (!queue_delayed_work_on(cpu, ceph_msgr_wq, &con->work, delay)) {
 		dout("%s %p - already queued\n", __func__, con);
 		con->ops->put(con);
 
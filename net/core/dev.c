@@ -132,6 +132,7 @@
 #include <linux/hashtable.h>
 #include <linux/vmalloc.h>
 #include <linux/if_macvlan.h>
+#include <linux/filter.h>
 
 #include "net-sysfs.h"
 
@@ -1713,7 +1714,7 @@ static inline int deliver_skb(struct sk_buff *skb,
 			      struct packet_type *pt_prev,
 			      struct net_device *orig_dev)
 {
-	if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+	if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC)))
 		return -ENOMEM;
 	atomic_inc(&skb->users);
 	return pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
@@ -2468,52 +2469,6 @@ static int illegal_highdma(struct net_device *dev, struct sk_buff *skb)
 	return 0;
 }
 
-struct dev_gso_cb {
-	void (*destructor)(struct sk_buff *skb);
-};
-
-#define DEV_GSO_CB(skb) ((struct dev_gso_cb *)(skb)->cb)
-
-static void dev_gso_skb_destructor(struct sk_buff *skb)
-{
-	struct dev_gso_cb *cb;
-
-	kfree_skb_list(skb->next);
-	skb->next = NULL;
-
-	cb = DEV_GSO_CB(skb);
-	if (cb->destructor)
-		cb->destructor(skb);
-}
-
-/**
- *	dev_gso_segment - Perform emulated hardware segmentation on skb.
- *	@skb: buffer to segment
- *	@features: device features as applicable to this skb
- *
- *	This function segments the given skb and stores the list of segments
- *	in skb->next.
- */
-static int dev_gso_segment(struct sk_buff *skb, netdev_features_t features)
-{
-	struct sk_buff *segs;
-
-	segs = skb_gso_segment(skb, features);
-
-	/* Verifying header integrity only. */
-	if (!segs)
-		return 0;
-
-	if (IS_ERR(segs))
-		return PTR_ERR(segs);
-
-	skb->next = segs;
-	DEV_GSO_CB(skb)->destructor = skb->destructor;
-	skb->destructor = dev_gso_skb_destructor;
-
-	return 0;
-}
-
 static netdev_features_t harmonize_features(struct sk_buff *skb,
 	netdev_features_t features)
 {
@@ -2556,117 +2511,180 @@ netdev_features_t netif_skb_features(struct sk_buff *skb)
 }
 EXPORT_SYMBOL(netif_skb_features);
 
-int dev_hard_start_xmit(struct sk_buff *skb, struct net_device *dev,
-			struct netdev_queue *txq)
+static struct sk_buff *validate_xmit_vlan(struct sk_buff *skb,
+					  netdev_features_t features)
 {
-	const struct net_device_ops *ops = dev->netdev_ops;
-	int rc = NETDEV_TX_OK;
-	unsigned int skb_len;
-
-	if (likely(!skb->next)) {
-		netdev_features_t features;
+	if (vlan_tx_tag_present(skb) &&
+	    !vlan_hw_offload_capable(features, skb->vlan_proto)) {
+		skb = __vlan_put_tag(skb, skb->vlan_proto,
+				     vlan_tx_tag_get(skb));
+		if (skb)
+			skb->vlan_tci = 0;
+	}
+	return skb;
+}
 
-		/*
-		 * If device doesn't need skb->dst, release it right now while
-		 * its hot in this cpu cache
-		 */
-		if (dev->priv_flags & IFF_XMIT_DST_RELEASE)
-			skb_dst_drop(skb);
+/* Apply everything the device cannot do itself to one skb: software
+ * vlan tagging, GSO, linearization and checksumming. Returns the skb or
+ * the list of its segments ready for the driver, or NULL if it had to
+ * be dropped.
+ */
+static struct sk_buff *validate_xmit_skb(struct sk_buff *skb,
+					 struct net_device *dev)
+{
+	netdev_features_t features;
 
-		features = netif_skb_features(skb);
+	/*
+	 * If device doesn't need skb->dst, release it right now while
+	 * its hot in this cpu cache
+	 */
+	if (dev->priv_flags & IFF_XMIT_DST_RELEASE)
+		skb_dst_drop(skb);
 
-		if (vlan_tx_tag_present(skb) &&
-		    !vlan_hw_offload_capable(features, skb->vlan_proto)) {
-			skb = __vlan_put_tag(skb, skb->vlan_proto,
-					     vlan_tx_tag_get(skb));
-			if (unlikely(!skb))
-				goto out;
+	features = netif_skb_features(skb);
+	skb = validate_xmit_vlan(skb, features);
+	if (unlikely(!skb))
+		goto out_null;
 
-			skb->vlan_tci = 0;
+	/* If encapsulation offload request, verify we are testing
+	 * hardware encapsulation features instead of standard
+	 * features for the netdev
+	 */
+	if (skb->encapsulation)
+		features &= dev->hw_enc_features;
+
+	if (netif_needs_gso(skb, features)) {
+		struct sk_buff *segs;
+
+		segs = skb_gso_segment(skb, features);
+		if (IS_ERR(segs))
+			goto out_kfree_skb;
+		/* NULL means the headers were verified only */
+		if (segs) {
+			consume_skb(skb);
+			skb = segs;
 		}
+	} else {
+		if (skb_needs_linearize(skb, features) &&
+		    __skb_linearize(skb))
+			goto out_kfree_skb;
 
-		/* If encapsulation offload request, verify we are testing
-		 * hardware encapsulation features instead of standard
-		 * features for the netdev
+		/* If packet is not checksummed and device does not
+		 * support checksumming for this protocol, complete
+		 * checksumming here.
 		 */
-		if (skb->encapsulation)
-			features &= dev->hw_enc_features;
-
-		if (netif_needs_gso(skb, features)) {
-			if (unlikely(dev_gso_segment(skb, features)))
-				goto out_kfree_skb;
-			if (skb->next)
-				goto gso;
-		} else {
-			if (skb_needs_linearize(skb, features) &&
-			    __skb_linearize(skb))
+		if (skb->ip_summed == CHECKSUM_PARTIAL) {
+			if (skb->encapsulation)
+				skb_set_inner_transport_header(skb,
+					skb_checksum_start_offset(skb));
+			else
+				skb_set_transport_header(skb,
+					skb_checksum_start_offset(skb));
+			if (!(features & NETIF_F_ALL_CSUM) &&
+			    skb_checksum_help(skb))
 				goto out_kfree_skb;
-
-			/* If packet is not checksummed and device does not
-			 * support checksumming for this protocol, complete
-			 * checksumming here.
-			 */
-			if (skb->ip_summed == CHECKSUM_PARTIAL) {
-				if (skb->encapsulation)
-					skb_set_inner_transport_header(skb,
-						skb_checksum_start_offset(skb));
-				else
-					skb_set_transport_header(skb,
-						skb_checksum_start_offset(skb));
-				if (!(features & NETIF_F_ALL_CSUM) &&
-				     skb_checksum_help(skb))
-					goto out_kfree_skb;
-			}
 		}
+	}
+
+	return skb;
 
-		if (!list_empty(&ptype_all))
-			dev_queue_xmit_nit(skb, dev);
+out_kfree_skb:
+	kfree_skb(skb);
+out_null:
+	return NULL;
+}
 
-		skb_len = skb->len;
-		trace_net_dev_start_xmit(skb, dev);
-		rc = ops->ndo_start_xmit(skb, dev);
-		trace_net_dev_xmit(skb, rc, dev, skb_len);
-		if (rc == NETDEV_TX_OK)
-			txq_trans_update(txq);
-		return rc;
+/**
+ *	validate_xmit_skb_list - validate a list of skbs for transmission
+ *	@skb: first skb of the list, linked through skb->next
+ *	@dev: device the list is going to be sent on
+ *
+ *	Runs validate_xmit_skb() on each skb and returns the resulting list,
+ *	with GSO skbs replaced by their segments and dropped skbs left out.
+ */
+struct sk_buff *validate_xmit_skb_list(struct sk_buff *skb,
+				       struct net_device *dev)
+{
+	struct sk_buff *next, *head = NULL, *tail;
+
+	for (; skb != NULL; skb = next) {
+		next = skb->next;
+		skb->next = NULL;
+
+		skb = validate_xmit_skb(skb, dev);
+		if (!skb)
+			continue;
+
+		if (!head)
+			head = skb;
+		else
+			tail->next = skb;
+		/* skb may be a list of segments, find its end */
+		while (skb->next)
+			skb = skb->next;
+		tail = skb;
 	}
+	return head;
+}
+EXPORT_SYMBOL_GPL(validate_xmit_skb_list);
 
-gso:
-	do {
-		struct sk_buff *nskb = skb->next;
+static int xmit_one(struct sk_buff *skb, struct net_device *dev,
+		    struct netdev_queue *txq, bool more)
+{
+	unsigned int len;
+	int rc;
 
-		skb->next = nskb->next;
-		nskb->next = NULL;
+	if (!list_empty(&ptype_all))
+		dev_queue_xmit_nit(skb, dev);
 
-		if (!list_empty(&ptype_all))
-			dev_queue_xmit_nit(nskb, dev);
-
-		skb_len = nskb->len;
-		trace_net_dev_start_xmit(nskb, dev);
-		rc = ops->ndo_start_xmit(nskb, dev);
-		trace_net_dev_xmit(nskb, rc, dev, skb_len);
-		if (unlikely(rc != NETDEV_TX_OK)) {
-			if (rc & ~NETDEV_TX_MASK)
-				goto out_kfree_gso_skb;
-			nskb->next = skb->next;
-			skb->next = nskb;
-			return rc;
+	len = skb->len;
+	trace_net_dev_start_xmit(skb, dev);
+	rc = netdev_start_xmit(skb, dev, txq, more);
+	trace_net_dev_xmit(skb, rc, dev, len);
+
+	return rc;
+}
+
+/**
+ *	dev_hard_start_xmit - hand a list of skbs to the driver
+ *	@first: first skb of the list, linked through skb->next
+ *	@dev: device to transmit on
+ *	@txq: transmit queue, its xmit lock must be held
+ *	@ret: set to the status of the last ndo_start_xmit() call
+ *
+ *	The skbs must have been through validate_xmit_skb(). All but the
+ *	last one are passed with skb->xmit_more set, so that the driver can
+ *	defer kicking the hardware. Stops early when the driver refuses an
+ *	skb or stops the queue, and returns the untransmitted remainder of
+ *	the list (NULL once everything went out).
+ */
+struct sk_buff *dev_hard_start_xmit(struct sk_buff *first,
+				    struct net_device *dev,
+				    struct netdev_queue *txq, int *ret)
+{
+	struct sk_buff *skb = first;
+	int rc = NETDEV_TX_OK;
+
+	while (skb) {
+		struct sk_buff *next = skb->next;
+
+		skb->next = NULL;
+		rc = xmit_one(skb, dev, txq, next != NULL);
+		if (unlikely(!dev_xmit_complete(rc))) {
+			skb->next = next;
+			goto out;
 		}
-		txq_trans_update(txq);
-		if (unlikely(netif_xmit_stopped(txq) && skb->next))
-			return NETDEV_TX_BUSY;
-	} while (skb->next);
 
-out_kfree_gso_skb:
-	if (likely(skb->next == NULL)) {
-		skb->destructor = DEV_GSO_CB(skb)->destructor;
-		consume_skb(skb);
-		return rc;
+		skb = next;
+		if (netif_xmit_stopped(txq) && skb) {
+			rc = NETDEV_TX_BUSY;
+			break;
+		}
 	}
-out_kfree_skb:
-	kfree_skb(skb);
+
 out:
-	return rc;
+	*ret = rc;
+	return skb;
 }
 EXPORT_SYMBOL_GPL(dev_hard_start_xmit);
 
@@ -2736,7 +2754,7 @@ static inline int __dev_xmit_skb(struct sk_buff *skb, struct Qdisc *q,
 
 		qdisc_bstats_update(q, skb);
 
-		if (sch_direct_xmit(skb, q, dev, txq, root_lock)) {
+		if (sch_direct_xmit(skb, q, dev, txq, root_lock, true)) {
 			if (unlikely(contended)) {
 				spin_unlock(&q->busylock);
 				contended = false;
@@ -2873,11 +2891,15 @@ static int __dev_queue_xmit(struct sk_buff *skb, void *accel_priv)
 			if (__this_cpu_read(xmit_recursion) > RECURSION_LIMIT)
 				goto recursion_alert;
 
+			skb = validate_xmit_skb(skb, dev);
+			if (!skb)
+				goto drop;
+
 			HARD_TX_LOCK(dev, txq, cpu);
 
 			if (!netif_xmit_stopped(txq)) {
 				__this_cpu_inc(xmit_recursion);
-				rc = dev_hard_start_xmit(skb, dev, txq);
+				skb = dev_hard_start_xmit(skb, dev, txq, &rc);
 				__this_cpu_dec(xmit_recursion);
 				if (dev_xmit_complete(rc)) {
 					HARD_TX_UNLOCK(dev, txq);
@@ -2898,10 +2920,11 @@ recursion_alert:
 	}
 
 	rc = -ENETDOWN;
+drop:
 	rcu_read_unlock_bh();
 
 	atomic_long_inc(&dev->tx_dropped);
-	kfree_skb(skb);
+	kfree_skb_list(skb);
 	return rc;
 out:
 	rcu_read_unlock_bh();
@@ -2930,6 +2953,7 @@ EXPORT_SYMBOL(netdev_max_backlog);
 
 int netdev_tstamp_prequeue __read_mostly = 1;
 int netdev_budget __read_mostly = 300;
+int gro_normal_batch __read_mostly = 8;
 int weight_p __read_mostly = 64;            /* old backlog weight */
 
 /* Called with irq disabled */
@@ -3506,6 +3530,112 @@ void netdev_rx_handler_unregister(struct net_device *dev)
 }
 EXPORT_SYMBOL_GPL(netdev_rx_handler_unregister);
 
+/**
+ *	dev_change_rx_filter - attach or detach the Rx filter of a device
+ *	@dev: device
+ *	@insns: classic BPF program
+ *	@len: length of @insns in bytes, 0 to detach the current filter
+ *
+ *	The filter is run by the driver through netdev_rx_filter_run(), so
+ *	only devices which set IFF_RX_FILTER support it.
+ *
+ *	The caller must hold the rtnl_mutex.
+ */
+int dev_change_rx_filter(struct net_device *dev, struct sock_filter *insns,
+			 unsigned int len)
+{
+	struct sk_filter *fp = NULL, *old;
+	struct sock_fprog fprog;
+	int err;
+
+	ASSERT_RTNL();
+
+	if (!(dev->priv_flags & IFF_RX_FILTER))
+		return -EOPNOTSUPP;
+	if (len % sizeof(*insns) || len / sizeof(*insns) > BPF_MAXINSNS)
+		return -EINVAL;
+
+	if (len) {
+		fprog.len = len / sizeof(*insns);
+		fprog.filter = (struct sock_filter __user *) insns;
+		err = sk_unattached_filter_create(&fp, &fprog);
+		if (err)
+			return err;
+	}
+
+	old = rtnl_dereference(dev->rx_filter);
+	rcu_assign_pointer(dev->rx_filter, fp);
+	if (old)
+		sk_unattached_filter_destroy(old);
+	return 0;
+}
+EXPORT_SYMBOL(dev_change_rx_filter);
+
+/*
+ * Frames seen by the Rx filter are not in an skb yet, so the filter runs on
+ * a per-cpu skb header describing the driver's buffer.  Drivers run the
+ * filter from NAPI poll, which cannot nest on a cpu.
+ */
+static DEFINE_PER_CPU(struct sk_buff, rx_filter_skb);
+
+/**
+ *	netdev_rx_filter_run - run the Rx filter of a device on a raw frame
+ *	@fp: filter returned by netdev_rx_filter()
+ *	@dev: receiving device
+ *	@data: start of the Ethernet header in the Rx buffer
+ *	@len: length of the frame
+ *	@queue: Rx queue the frame arrived on
+ *
+ *	Must be called from the NAPI poll routine of @dev, with the buffer
+ *	synced for the cpu.  Returns RX_FILTER_DROP, RX_FILTER_TX or
+ *	RX_FILTER_PASS.  Only a linear buffer can be filtered, so frames
+ *	spanning several buffers should be passed without calling this.
+ */
+u32 netdev_rx_filter_run(const struct sk_filter *fp, struct net_device *dev,
+			 void *data, unsigned int len, u16 queue)
+{
+	struct sk_buff *skb = this_cpu_ptr(&rx_filter_skb);
+	u32 res;
+
+	if (unlikely(len < ETH_HLEN))
+		return RX_FILTER_PASS;
+
+	skb->head = data;
+	skb->data = data;
+	skb->len = len;
+	skb->data_len = 0;
+	skb_set_tail_pointer(skb, len);
+	skb->queue_mapping = queue;
+	skb->protocol = eth_type_trans(skb, dev);
+	skb_reset_network_header(skb);
+	__skb_push(skb, ETH_HLEN);
+
+	res = SK_RUN_FILTER(fp, skb);
+	skb->dev = NULL;
+
+	if (res == RX_FILTER_DROP || res == RX_FILTER_TX)
+		return res;
+	return RX_FILTER_PASS;
+}
+EXPORT_SYMBOL(netdev_rx_filter_run);
+
+/**
+ *	netdev_rx_filter_xmit - send a frame back out of its receiving port
+ *	@skb: frame with skb->data at the Ethernet header
+ *	@dev: device the frame was received on
+ *
+ *	Used by drivers for frames the Rx filter returned RX_FILTER_TX for.
+ *	The frame bypasses GRO and the protocol stack.
+ */
+void netdev_rx_filter_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+	skb->dev = dev;
+	skb_reset_mac_header(skb);
+	skb->protocol = eth_hdr(skb)->h_proto;
+	dev_queue_xmit(skb);
+}
+EXPORT_SYMBOL(netdev_rx_filter_xmit);
+
 /*
  * Limit the use of PFMEMALLOC reserves to those protocols that implement
  * the special handling of PFMEMALLOC skbs.
@@ -3524,10 +3654,17 @@ static bool skb_pfmemalloc_protocol(struct sk_buff *skb)
 	}
 }
 
-static int __netif_receive_skb_core(struct sk_buff *skb, bool pfmemalloc)
+/* Runs the taps, ingress, vlan and rx_handler stages for one skb and
+ * returns the packet_type that should finally receive it in *ppt_prev,
+ * which the caller delivers. *pskb is updated as the skb may be replaced
+ * on the way. Must be called under rcu_read_lock().
+ */
+static int __netif_receive_skb_core(struct sk_buff **pskb, bool pfmemalloc,
+				    struct packet_type **ppt_prev)
 {
 	struct packet_type *ptype, *pt_prev;
 	rx_handler_func_t *rx_handler;
+	struct sk_buff *skb = *pskb;
 	struct net_device *orig_dev;
 	struct net_device *null_or_dev;
 	bool deliver_exact = false;
@@ -3547,8 +3684,6 @@ static int __netif_receive_skb_core(struct sk_buff *skb, bool pfmemalloc)
 
 	pt_prev = NULL;
 
-	rcu_read_lock();
-
 another_round:
 	skb->skb_iif = skb->dev->ifindex;
 
@@ -3558,7 +3693,7 @@ another_round:
 	    skb->protocol == cpu_to_be16(ETH_P_8021AD)) {
 		skb = vlan_untag(skb);
 		if (unlikely(!skb))
-			goto unlock;
+			goto out;
 	}
 
 #ifdef CONFIG_NET_CLS_ACT
@@ -3583,7 +3718,7 @@ skip_taps:
 #ifdef CONFIG_NET_CLS_ACT
 	skb = handle_ing(skb, &pt_prev, &ret, orig_dev);
 	if (!skb)
-		goto unlock;
+		goto out;
 ncls:
 #endif
 
@@ -3598,7 +3733,7 @@ ncls:
 		if (vlan_do_receive(&skb))
 			goto another_round;
 		else if (unlikely(!skb))
-			goto unlock;
+			goto out;
 	}
 
 	rx_handler = rcu_dereference(skb->dev->rx_handler);
@@ -3610,7 +3745,7 @@ ncls:
 		switch (rx_handler(&skb)) {
 		case RX_HANDLER_CONSUMED:
 			ret = NET_RX_SUCCESS;
-			goto unlock;
+			goto out;
 		case RX_HANDLER_ANOTHER:
 			goto another_round;
 		case RX_HANDLER_EXACT:
@@ -3648,10 +3783,9 @@ ncls:
 	}
 
 	if (pt_prev) {
-		if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+		if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC)))
 			goto drop;
-		else
-			ret = pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
+		*ppt_prev = pt_prev;
 	} else {
 drop:
 		atomic_long_inc(&skb->dev->rx_dropped);
@@ -3662,7 +3796,21 @@ drop:
 		ret = NET_RX_DROP;
 	}
 
-unlock:
+out:
+	*pskb = skb;
+	return ret;
+}
+
+static int __netif_receive_skb_one_core(struct sk_buff *skb, bool pfmemalloc)
+{
+	struct net_device *orig_dev = skb->dev;
+	struct packet_type *pt_prev = NULL;
+	int ret;
+
+	rcu_read_lock();
+	ret = __netif_receive_skb_core(&skb, pfmemalloc, &pt_prev);
+	if (pt_prev)
+		ret = pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
 	rcu_read_unlock();
 	return ret;
 }
@@ -3684,10 +3832,10 @@ static int __netif_receive_skb(struct sk_buff *skb)
 		 * context down to all allocation sites.
 		 */
 		current->flags |= PF_MEMALLOC;
-		ret = __netif_receive_skb_core(skb, true);
+		ret = __netif_receive_skb_one_core(skb, true);
 		tsk_restore_flags(current, pflags, PF_MEMALLOC);
 	} else
-		ret = __netif_receive_skb_core(skb, false);
+		ret = __netif_receive_skb_one_core(skb, false);
 
 	return ret;
 }
@@ -3742,6 +3890,161 @@ int netif_receive_skb(struct sk_buff *skb)
 }
 EXPORT_SYMBOL(netif_receive_skb);
 
+static void __netif_receive_skb_list_ptype(struct sk_buff_head *head,
+					   struct packet_type *pt_prev,
+					   struct net_device *orig_dev)
+{
+	struct sk_buff *skb;
+
+	if (!pt_prev || skb_queue_empty(head))
+		return;
+	if (pt_prev->list_func != NULL) {
+		pt_prev->list_func(head, pt_prev, orig_dev);
+		return;
+	}
+	while ((skb = __skb_dequeue(head)) != NULL)
+		pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
+}
+
+static void __netif_receive_skb_list_core(struct sk_buff_head *head,
+					  bool pfmemalloc)
+{
+	/* Taps, rx_handlers and all but the last matching packet_type are
+	 * still run per packet by __netif_receive_skb_core(). Only runs of
+	 * packets that end up at the same final packet_type are batched,
+	 * so no single packet_type can see packets out of order.
+	 */
+	struct packet_type *pt_curr = NULL;
+	struct net_device *od_curr = NULL;
+	struct sk_buff_head sublist;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&sublist);
+	rcu_read_lock();
+	while ((skb = __skb_dequeue(head)) != NULL) {
+		struct net_device *orig_dev = skb->dev;
+		struct packet_type *pt_prev = NULL;
+
+		__netif_receive_skb_core(&skb, pfmemalloc, &pt_prev);
+		if (!pt_prev)
+			continue;
+		if (pt_curr != pt_prev || od_curr != orig_dev) {
+			__netif_receive_skb_list_ptype(&sublist, pt_curr,
+						       od_curr);
+			pt_curr = pt_prev;
+			od_curr = orig_dev;
+		}
+		__skb_queue_tail(&sublist, skb);
+	}
+	__netif_receive_skb_list_ptype(&sublist, pt_curr, od_curr);
+	rcu_read_unlock();
+}
+
+static void __netif_receive_skb_list(struct sk_buff_head *head)
+{
+	unsigned long pflags = current->flags;
+	struct sk_buff_head sublist;
+	bool pfmemalloc = false;
+	struct sk_buff *skb;
+
+	/* See __netif_receive_skb() for the PFMEMALLOC rules, runs of such
+	 * skbs are handed down separately with PF_MEMALLOC set.
+	 */
+	__skb_queue_head_init(&sublist);
+	while ((skb = __skb_dequeue(head)) != NULL) {
+		bool skb_pfmemalloc_run = sk_memalloc_socks() &&
+					  skb_pfmemalloc(skb);
+
+		if (skb_pfmemalloc_run != pfmemalloc) {
+			__netif_receive_skb_list_core(&sublist, pfmemalloc);
+			pfmemalloc = skb_pfmemalloc_run;
+			if (pfmemalloc)
+				current->flags |= PF_MEMALLOC;
+			else
+				tsk_restore_flags(current, pflags, PF_MEMALLOC);
+		}
+		__skb_queue_tail(&sublist, skb);
+	}
+	__netif_receive_skb_list_core(&sublist, pfmemalloc);
+	if (pfmemalloc)
+		tsk_restore_flags(current, pflags, PF_MEMALLOC);
+}
+
+static void netif_receive_skb_list_internal(struct sk_buff_head *head)
+{
+	struct sk_buff_head sublist;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&sublist);
+	while ((skb = __skb_dequeue(head)) != NULL) {
+		net_timestamp_check(netdev_tstamp_prequeue, skb);
+		if (skb_defer_rx_timestamp(skb))
+			continue;
+#ifdef CONFIG_RPS
+		if (static_key_false(&rps_needed)) {
+			struct rps_dev_flow voidflow, *rflow = &voidflow;
+			int cpu;
+
+			rcu_read_lock();
+			cpu = get_rps_cpu(skb->dev, skb, &rflow);
+			if (cpu >= 0) {
+				enqueue_to_backlog(skb, cpu,
+						   &rflow->last_qtail);
+				rcu_read_unlock();
+				continue;
+			}
+			rcu_read_unlock();
+		}
+#endif
+		__skb_queue_tail(&sublist, skb);
+	}
+	__netif_receive_skb_list(&sublist);
+}
+
+/**
+ *	netif_receive_skb_list - process many receive buffers from network
+ *	@head: list of skbs to process
+ *
+ *	Batched version of netif_receive_skb(). The skbs are run through
+ *	the core receive path one by one, but runs of skbs that end up at
+ *	the same protocol handler are passed to its list_func, when it has
+ *	one, in a single call. @head is empty on return. Unlike
+ *	netif_receive_skb() nothing is returned, as a single status would
+ *	be meaningless for a list.
+ *
+ *	This function may only be called from softirq context and interrupts
+ *	should be enabled.
+ */
+void netif_receive_skb_list(struct sk_buff_head *head)
+{
+	struct sk_buff *skb;
+
+	skb_queue_walk(head, skb)
+		trace_netif_receive_skb_entry(skb);
+
+	netif_receive_skb_list_internal(head);
+}
+EXPORT_SYMBOL(netif_receive_skb_list);
+
+/* Pass the GRO_NORMAL skbs batched so far up the stack */
+static void gro_normal_list(struct napi_struct *napi)
+{
+	if (!napi->rx_count)
+		return;
+	netif_receive_skb_list_internal(&napi->rx_list);
+	napi->rx_count = 0;
+}
+
+/* Batch one GRO_NORMAL skb, the batch is passed up once it reaches
+ * gro_normal_batch skbs or at the end of the NAPI poll at the latest.
+ */
+static void gro_normal_one(struct napi_struct *napi, struct sk_buff *skb)
+{
+	__skb_queue_tail(&napi->rx_list, skb);
+	if (++napi->rx_count >= gro_normal_batch)
+		gro_normal_list(napi);
+}
+
 /* Network device is going away, flush any packets still pending
  * Called with irqs disabled.
  */
@@ -3770,7 +4073,7 @@ static void flush_backlog(void *arg)
 	}
 }
 
-static int napi_gro_complete(struct sk_buff *skb)
+static void napi_gro_complete(struct napi_struct *napi, struct sk_buff *skb)
 {
 	struct packet_offload *ptype;
 	__be16 type = skb->protocol;
@@ -3797,11 +4100,11 @@ static int napi_gro_complete(struct sk_buff *skb)
 	if (err) {
 		WARN_ON(&ptype->list == head);
 		kfree_skb(skb);
-		return NET_RX_SUCCESS;
+		return;
 	}
 
 out:
-	return netif_receive_skb_internal(skb);
+	gro_normal_one(napi, skb);
 }
 
 /* napi->gro_list contains packets ordered by age.
@@ -3822,14 +4125,16 @@ void napi_gro_flush(struct napi_struct *napi, bool flush_old)
 		skb->next = NULL;
 
 		if (flush_old && NAPI_GRO_CB(skb)->age == jiffies)
-			return;
+			goto out;
 
 		prev = skb->prev;
-		napi_gro_complete(skb);
+		napi_gro_complete(napi, skb);
 		napi->gro_count--;
 	}
 
 	napi->gro_list = NULL;
+out:
+	gro_normal_list(napi);
 }
 EXPORT_SYMBOL(napi_gro_flush);
 
@@ -3947,7 +4252,7 @@ static enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff
 
 		*pp = nskb->next;
 		nskb->next = NULL;
-		napi_gro_complete(nskb);
+		napi_gro_complete(napi, nskb);
 		napi->gro_count--;
 	}
 
@@ -3967,7 +4272,7 @@ static enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff
 		}
 		*pp = NULL;
 		nskb->next = NULL;
-		napi_gro_complete(nskb);
+		napi_gro_complete(napi, nskb);
 	} else {
 		napi->gro_count++;
 	}
@@ -4019,12 +4324,13 @@ struct packet_offload *gro_find_complete_by_type(__be16 type)
 }
 EXPORT_SYMBOL(gro_find_complete_by_type);
 
-static gro_result_t napi_skb_finish(gro_result_t ret, struct sk_buff *skb)
+static gro_result_t napi_skb_finish(struct napi_struct *napi,
+				    struct sk_buff *skb,
+				    gro_result_t ret)
 {
 	switch (ret) {
 	case GRO_NORMAL:
-		if (netif_receive_skb_internal(skb))
-			ret = GRO_DROP;
+		gro_normal_one(napi, skb);
 		break;
 
 	case GRO_DROP:
@@ -4052,7 +4358,7 @@ gro_result_t napi_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 
 	skb_gro_reset_offset(skb);
 
-	return napi_skb_finish(dev_gro_receive(napi, skb), skb);
+	return napi_skb_finish(napi, skb, dev_gro_receive(napi, skb));
 }
 EXPORT_SYMBOL(napi_gro_receive);
 
@@ -4092,8 +4398,8 @@ static gro_result_t napi_frags_finish(struct napi_struct *napi,
 	case GRO_HELD:
 		__skb_push(skb, ETH_HLEN);
 		skb->protocol = eth_type_trans(skb, skb->dev);
-		if (ret == GRO_NORMAL && netif_receive_skb_internal(skb))
-			ret = GRO_DROP;
+		if (ret == GRO_NORMAL)
+			gro_normal_one(napi, skb);
 		break;
 
 	case GRO_DROP:
@@ -4349,6 +4655,8 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 	napi->gro_count = 0;
 	napi->gro_list = NULL;
 	napi->skb = NULL;
+	__skb_queue_head_init(&napi->rx_list);
+	napi->rx_count = 0;
 	napi->poll = poll;
 	if (weight > NAPI_POLL_WEIGHT)
 		pr_err_once("netif_napi_add() called with weight %d on device %s\n",
@@ -4372,6 +4680,8 @@ void netif_napi_del(struct napi_struct *napi)
 	kfree_skb_list(napi->gro_list);
 	napi->gro_list = NULL;
 	napi->gro_count = 0;
+	__skb_queue_purge(&napi->rx_list);
+	napi->rx_count = 0;
 }
 EXPORT_SYMBOL(netif_napi_del);
 
@@ -4437,9 +4747,11 @@ static void net_rx_action(struct softirq_action *h)
 				napi_complete(n);
 				local_irq_disable();
 			} else {
-				if (n->gro_list) {
+				if (n->gro_list || n->rx_count) {
 					/* flush too old packets
 					 * If HZ < 1000, flush all packets.
+					 * This also passes up the batched
+					 * GRO_NORMAL packets.
 					 */
 					local_irq_enable();
 					napi_gro_flush(n, HZ >= 1000);
@@ -4453,6 +4765,7 @@ static void net_rx_action(struct softirq_action *h)
 	}
 out:
 	net_rps_action_and_irq_enable(sd);
+	__kfree_skb_flush();
 
 #ifdef CONFIG_NET_DMA
 	/*
@@ -6553,6 +6866,10 @@ void free_netdev(struct net_device *dev)
 
 	kfree(rcu_dereference_protected(dev->ingress_queue, 1));
 
+	if (rcu_access_pointer(dev->rx_filter))
+		sk_unattached_filter_destroy(
+			rcu_dereference_protected(dev->rx_filter, 1));
+
 	/* Flush device addresses */
 	dev_addr_flush(dev);
 
@@ -34,6 +34,8 @@
 #include <net/ip.h>
 #include <net/protocol.h>
 #include <net/netlink.h>
+#include <net/sch_generic.h>
+#include <net/sock_reuseport.h>
 #include <linux/skbuff.h>
 #include <net/sock.h>
 #include <linux/errno.h>
@@ -41,6 +43,7 @@
 #include <asm/uaccess.h>
 #include <asm/unaligned.h>
 #include <linux/filter.h>
+#include <linux/bpf.h>
 #include <linux/ratelimit.h>
 #include <linux/seccomp.h>
 #include <linux/if_vlan.h>
@@ -244,6 +247,7 @@ unsigned int __sk_run_filter(void *ctx, const struct sock_filter_int *insn)
 		DL(BPF_LD, BPF_IND, BPF_W),
 		DL(BPF_LD, BPF_IND, BPF_H),
 		DL(BPF_LD, BPF_IND, BPF_B),
+		DL(BPF_LD, BPF_IMM, BPF_DW),
 #undef DL
 	};
 
@@ -495,6 +499,10 @@ select_insn:
 		atomic64_add((u64) X, (atomic64_t *)(unsigned long)
 			     (A + insn->off));
 		CONT;
+	BPF_LD_BPF_IMM_BPF_DW: /* A = 64-bit K, upper half in the next insn */
+		A = (u32) K | ((u64) (u32) insn[1].imm) << 32;
+		insn++;
+		CONT;
 	BPF_LD_BPF_ABS_BPF_W: /* R0 = ntohl(*(u32 *) (skb->data + K)) */
 		off = K;
 load_word:
@@ -574,6 +582,33 @@ u32 sk_run_filter_int_skb(const struct sk_buff *ctx,
     __attribute__ ((alias ("__sk_run_filter")));
 EXPORT_SYMBOL_GPL(sk_run_filter_int_skb);
 
+/* Architectures with an internal BPF JIT override this. */
+void __weak bpf_int_jit_compile(struct sk_filter *fp)
+{
+}
+
+/**
+ *	sk_filter_select_runtime - select execution runtime for BPF program
+ *	@fp: sk_filter populated with internal BPF program
+ *
+ * Try to JIT the internal BPF program, if JIT is not available select the
+ * interpreter. The program is executed via SK_RUN_FILTER() afterwards.
+ */
+void sk_filter_select_runtime(struct sk_filter *fp)
+{
+	fp->bpf_func = (void *) __sk_run_filter;
+
+	bpf_int_jit_compile(fp);
+}
+EXPORT_SYMBOL_GPL(sk_filter_select_runtime);
+
+/* Free an sk_filter set up by sk_filter_select_runtime(). */
+void sk_filter_free(struct sk_filter *fp)
+{
+	bpf_jit_free(fp);
+}
+EXPORT_SYMBOL_GPL(sk_filter_free);
+
 /* Helper to find the offset of pkt_type in sk_buff structure. We want
  * to make sure its still a 3bit field starting at a byte boundary;
  * taken from arch/x86/net/bpf_jit_comp.c.
@@ -1444,10 +1479,13 @@ void sk_filter_uncharge(struct sock *sk, struct sk_filter *fp)
 	sk_filter_release(fp);
 }
 
-void sk_filter_charge(struct sock *sk, struct sk_filter *fp)
+bool sk_filter_charge(struct sock *sk, struct sk_filter *fp)
 {
-	atomic_inc(&fp->refcnt);
+	/* fp may belong to an unlocked listener that is dropping it */
+	if (!atomic_inc_not_zero(&fp->refcnt))
+		return false;
 	atomic_add(sk_filter_size(fp->len), &sk->sk_omem_alloc);
+	return true;
 }
 
 static struct sk_filter *__sk_migrate_realloc(struct sk_filter *fp,
@@ -1523,7 +1561,6 @@ static struct sk_filter *__sk_migrate_filter(struct sk_filter *fp,
 		goto out_err_free;
 	}
 
-	fp->bpf_func = sk_run_filter_int_skb;
 	fp->len = new_len;
 
 	/* 2nd pass: remap sock_filter insns into sock_filter_int insns. */
@@ -1536,6 +1573,8 @@ static struct sk_filter *__sk_migrate_filter(struct sk_filter *fp,
 		 */
 		goto out_err_free;
 
+	sk_filter_select_runtime(fp);
+
 	kfree(old_prog);
 	return fp;
 
@@ -1557,6 +1596,7 @@ static struct sk_filter *__sk_prepare_filter(struct sk_filter *fp,
 
 	fp->bpf_func = NULL;
 	fp->jited = 0;
+	fp->aux = NULL;
 
 	err = sk_chk_filter(fp->insns, fp->len);
 	if (err) {
@@ -1573,7 +1613,8 @@ static struct sk_filter *__sk_prepare_filter(struct sk_filter *fp,
 	bpf_jit_compile(fp);
 
 	/* JIT compiler couldn't process this filter, so do the
-	 * internal BPF translation for the optimized interpreter.
+	 * internal BPF translation; the result is either JITed by
+	 * bpf_int_jit_compile() or run by the optimized interpreter.
 	 */
 	if (!fp->jited)
 		fp = __sk_migrate_filter(fp, sk);
@@ -1633,6 +1674,65 @@ void sk_unattached_filter_destroy(struct sk_filter *fp)
 }
 EXPORT_SYMBOL_GPL(sk_unattached_filter_destroy);
 
+/**
+ *	sk_reuseport_attach_filter - attach a reuseport socket selector
+ *	@fprog: the filter program
+ *	@sk: the socket to use
+ *
+ * The filter runs on the payload of packets for the SO_REUSEPORT group
+ * of @sk and returns the index of the group member that receives them.
+ * An out of range index falls back to hashing.
+ */
+int sk_reuseport_attach_filter(struct sock_fprog *fprog, struct sock *sk)
+{
+	unsigned int fsize = sk_filter_proglen(fprog);
+	struct sk_filter *fp;
+
+	/* Make sure new filter is there and in the right amounts. */
+	if (fprog->filter == NULL)
+		return -EINVAL;
+
+	fp = kmalloc(sk_filter_size(fprog->len), GFP_KERNEL);
+	if (!fp)
+		return -ENOMEM;
+
+	if (copy_from_user(fp->insns, fprog->filter, fsize)) {
+		kfree(fp);
+		return -EFAULT;
+	}
+
+	atomic_set(&fp->refcnt, 1);
+	fp->len = fprog->len;
+	fp->orig_prog = NULL;
+
+	fp = __sk_prepare_filter(fp, NULL);
+	if (IS_ERR(fp))
+		return PTR_ERR(fp);
+
+	return reuseport_attach_prog(sk, fp);
+}
+
+/**
+ *	sk_reuseport_attach_bpf - attach a reuseport selector loaded by bpf(2)
+ *	@ufd: file descriptor of a BPF_PROG_TYPE_SOCKET_FILTER program
+ *	@sk: the socket to use
+ */
+int sk_reuseport_attach_bpf(u32 ufd, struct sock *sk)
+{
+	struct sk_filter *prog;
+
+	prog = bpf_prog_get(ufd);
+	if (IS_ERR(prog))
+		return PTR_ERR(prog);
+
+	if (prog->aux->prog_type != BPF_PROG_TYPE_SOCKET_FILTER) {
+		bpf_prog_put(prog);
+		return -EINVAL;
+	}
+
+	return reuseport_attach_prog(sk, prog);
+}
+
 /**
  *	sk_attach_filter - attach a socket filter
  *	@fprog: the filter program
@@ -1829,3 +1929,362 @@ out:
 	release_sock(sk);
 	return ret;
 }
+
+static u64 bpf_skb_store_bytes(u64 r1, u64 r2, u64 r3, u64 r4, u64 flags)
+{
+	struct sk_buff *skb = (struct sk_buff *) (long) r1;
+	unsigned int offset = (unsigned int) r2;
+	void *from = (void *) (long) r3;
+	unsigned int len = (unsigned int) r4;
+	char buf[16];
+	void *ptr;
+
+	/* bpf verifier guarantees that:
+	 * 'from' pointer points to bpf program stack
+	 * 'len' bytes of it were initialized
+	 * 'len' > 0
+	 * 'skb' is a valid pointer to 'struct sk_buff'
+	 *
+	 * so check for invalid 'offset' and too large 'len'
+	 */
+	if (unlikely(offset > 0xffff || len > sizeof(buf)))
+		return -EFAULT;
+
+	if (unlikely(skb_cloned(skb) &&
+		     !skb_clone_writable(skb, offset + len)))
+		return -EFAULT;
+
+	ptr = skb_header_pointer(skb, offset, len, buf);
+	if (unlikely(!ptr))
+		return -EFAULT;
+
+	if ((flags & BPF_F_RECOMPUTE_CSUM) &&
+	    skb->ip_summed == CHECKSUM_COMPLETE)
+		skb->csum = csum_sub(skb->csum, csum_partial(ptr, len, 0));
+
+	memcpy(ptr, from, len);
+
+	if (ptr == buf)
+		/* skb_store_bits cannot return -EFAULT here */
+		skb_store_bits(skb, offset, ptr, len);
+
+	if ((flags & BPF_F_RECOMPUTE_CSUM) &&
+	    skb->ip_summed == CHECKSUM_COMPLETE)
+		skb->csum = csum_add(skb->csum, csum_partial(ptr, len, 0));
+	return 0;
+}
+
+static const struct bpf_func_proto bpf_skb_store_bytes_proto = {
+	.func		= bpf_skb_store_bytes,
+	.gpl_only	= false,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_PTR_TO_CTX,
+	.arg2_type	= ARG_ANYTHING,
+	.arg3_type	= ARG_PTR_TO_STACK,
+	.arg4_type	= ARG_CONST_STACK_SIZE,
+	.arg5_type	= ARG_ANYTHING,
+};
+
+/* make the checksum field at 'offset' writable and return a pointer to
+ * it, 'buf' is used when the field is not in the linear part
+ */
+static __sum16 *bpf_csum_field(struct sk_buff *skb, unsigned int offset,
+			       __sum16 *buf)
+{
+	if (unlikely(offset > 0xffff))
+		return NULL;
+
+	if (unlikely(skb_cloned(skb) &&
+		     !skb_clone_writable(skb, offset + sizeof(*buf))))
+		return NULL;
+
+	return skb_header_pointer(skb, offset, sizeof(*buf), buf);
+}
+
+static u64 bpf_l3_csum_replace(u64 r1, u64 r2, u64 from, u64 to, u64 flags)
+{
+	struct sk_buff *skb = (struct sk_buff *) (long) r1;
+	unsigned int offset = (unsigned int) r2;
+	__sum16 sum, *ptr;
+
+	ptr = bpf_csum_field(skb, offset, &sum);
+	if (unlikely(!ptr))
+		return -EFAULT;
+
+	switch (flags & BPF_F_HDR_FIELD_MASK) {
+	case 2:
+		csum_replace2(ptr, from, to);
+		break;
+	case 4:
+		csum_replace4(ptr, from, to);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (ptr == &sum)
+		/* skb_store_bits guaranteed to not return -EFAULT here */
+		skb_store_bits(skb, offset, ptr, sizeof(sum));
+
+	return 0;
+}
+
+static const struct bpf_func_proto bpf_l3_csum_replace_proto = {
+	.func		= bpf_l3_csum_replace,
+	.gpl_only	= false,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_PTR_TO_CTX,
+	.arg2_type	= ARG_ANYTHING,
+	.arg3_type	= ARG_ANYTHING,
+	.arg4_type	= ARG_ANYTHING,
+	.arg5_type	= ARG_ANYTHING,
+};
+
+static u64 bpf_l4_csum_replace(u64 r1, u64 r2, u64 from, u64 to, u64 flags)
+{
+	struct sk_buff *skb = (struct sk_buff *) (long) r1;
+	bool is_pseudo = flags & BPF_F_PSEUDO_HDR;
+	unsigned int offset = (unsigned int) r2;
+	__sum16 sum, *ptr;
+
+	ptr = bpf_csum_field(skb, offset, &sum);
+	if (unlikely(!ptr))
+		return -EFAULT;
+
+	switch (flags & BPF_F_HDR_FIELD_MASK) {
+	case 2:
+		inet_proto_csum_replace2(ptr, skb, from, to, is_pseudo);
+		break;
+	case 4:
+		inet_proto_csum_replace4(ptr, skb, from, to, is_pseudo);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (ptr == &sum)
+		/* skb_store_bits guaranteed to not return -EFAULT here */
+		skb_store_bits(skb, offset, ptr, sizeof(sum));
+
+	return 0;
+}
+
+static const struct bpf_func_proto bpf_l4_csum_replace_proto = {
+	.func		= bpf_l4_csum_replace,
+	.gpl_only	= false,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_PTR_TO_CTX,
+	.arg2_type	= ARG_ANYTHING,
+	.arg3_type	= ARG_ANYTHING,
+	.arg4_type	= ARG_ANYTHING,
+	.arg5_type	= ARG_ANYTHING,
+};
+
+#ifdef CONFIG_NET_CLS_ACT
+/* same as the egress mirror of act_mirred, done from the classifier */
+static u64 bpf_clone_redirect(u64 r1, u64 ifindex, u64 flags, u64 r4, u64 r5)
+{
+	struct sk_buff *skb = (struct sk_buff *) (long) r1, *skb2;
+	struct net_device *dev;
+	u32 at;
+
+	if (unlikely(flags))
+		return -EINVAL;
+
+	dev = dev_get_by_index_rcu(dev_net(skb->dev), ifindex);
+	if (unlikely(!dev || !(dev->flags & IFF_UP)))
+		return -EINVAL;
+
+	at = G_TC_AT(skb->tc_verd);
+	skb2 = skb_clone(skb, GFP_ATOMIC);
+	if (unlikely(!skb2))
+		return -ENOMEM;
+
+	/* at ingress the link layer header was already pulled */
+	if (!(at & AT_EGRESS) && dev->header_ops)
+		skb_push(skb2, skb->mac_len);
+
+	skb2->tc_verd = SET_TC_FROM(skb2->tc_verd, at);
+	skb2->skb_iif = skb->dev->ifindex;
+	skb2->dev = dev;
+	return dev_queue_xmit(skb2);
+}
+
+static const struct bpf_func_proto bpf_clone_redirect_proto = {
+	.func		= bpf_clone_redirect,
+	.gpl_only	= false,
+	.ret_type	= RET_INTEGER,
+	.arg1_type	= ARG_PTR_TO_CTX,
+	.arg2_type	= ARG_ANYTHING,
+	.arg3_type	= ARG_ANYTHING,
+};
+#endif
+
+static const struct bpf_func_proto *
+sock_filter_func_proto(enum bpf_func_id func_id)
+{
+	switch (func_id) {
+	case BPF_FUNC_map_lookup_elem:
+		return &bpf_map_lookup_elem_proto;
+	case BPF_FUNC_map_update_elem:
+		return &bpf_map_update_elem_proto;
+	case BPF_FUNC_map_delete_elem:
+		return &bpf_map_delete_elem_proto;
+	default:
+		return NULL;
+	}
+}
+
+static const struct bpf_func_proto *
+tc_cls_func_proto(enum bpf_func_id func_id)
+{
+	switch (func_id) {
+	case BPF_FUNC_skb_store_bytes:
+		return &bpf_skb_store_bytes_proto;
+	case BPF_FUNC_l3_csum_replace:
+		return &bpf_l3_csum_replace_proto;
+	case BPF_FUNC_l4_csum_replace:
+		return &bpf_l4_csum_replace_proto;
+#ifdef CONFIG_NET_CLS_ACT
+	case BPF_FUNC_clone_redirect:
+		return &bpf_clone_redirect_proto;
+#endif
+	default:
+		return sock_filter_func_proto(func_id);
+	}
+}
+
+static bool __is_valid_access(int off, int size)
+{
+	if (off < 0 || off >= sizeof(struct __sk_buff))
+		return false;
+	if (off % size != 0 || size != sizeof(__u32))
+		return false;
+#ifndef CONFIG_NET_SCHED
+	if (off == offsetof(struct __sk_buff, tc_index))
+		return false;
+#endif
+	return true;
+}
+
+static bool sock_filter_is_valid_access(int off, int size,
+					enum bpf_access_type type)
+{
+	/* skb->cb belongs to the protocol, the fields are read only */
+	if (type == BPF_WRITE ||
+	    off >= offsetof(struct __sk_buff, cb[0]))
+		return false;
+
+	return __is_valid_access(off, size);
+}
+
+static bool tc_cls_is_valid_access(int off, int size,
+				   enum bpf_access_type type)
+{
+	if (type == BPF_WRITE) {
+		switch (off) {
+		case offsetof(struct __sk_buff, mark):
+		case offsetof(struct __sk_buff, priority):
+		case offsetof(struct __sk_buff, tc_index):
+		case offsetof(struct __sk_buff, cb[0]) ...
+		     offsetof(struct __sk_buff, cb[4]):
+			break;
+		default:
+			return false;
+		}
+	}
+
+	return __is_valid_access(off, size);
+}
+
+#define BPF_SKB_FIELD(insn, field)				\
+	do {							\
+		BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, field) != 2 &&\
+			     FIELD_SIZEOF(struct sk_buff, field) != 4);\
+		(insn)->off = offsetof(struct sk_buff, field);	\
+		(insn)->code = BPF_CLASS((insn)->code) |	\
+			BPF_MODE((insn)->code) |		\
+			(FIELD_SIZEOF(struct sk_buff, field) == 2 ? \
+			 BPF_H : BPF_W);			\
+	} while (0)
+
+/* turn an access to a struct __sk_buff field into the access of the
+ * sk_buff field, __is_valid_access() only lets aligned 32-bit accesses
+ * through, so one instruction of the new size is enough
+ */
+static void sk_filter_convert_ctx_access(struct bpf_insn *insn)
+{
+	int off = insn->off;
+
+	switch (off) {
+	case offsetof(struct __sk_buff, len):
+		BPF_SKB_FIELD(insn, len);
+		break;
+	case offsetof(struct __sk_buff, mark):
+		BPF_SKB_FIELD(insn, mark);
+		break;
+	case offsetof(struct __sk_buff, queue_mapping):
+		BPF_SKB_FIELD(insn, queue_mapping);
+		break;
+	case offsetof(struct __sk_buff, protocol):
+		BPF_SKB_FIELD(insn, protocol);
+		break;
+	case offsetof(struct __sk_buff, vlan_tci):
+		BPF_SKB_FIELD(insn, vlan_tci);
+		break;
+	case offsetof(struct __sk_buff, vlan_proto):
+		BPF_SKB_FIELD(insn, vlan_proto);
+		break;
+	case offsetof(struct __sk_buff, priority):
+		BPF_SKB_FIELD(insn, priority);
+		break;
+	case offsetof(struct __sk_buff, ingress_ifindex):
+		BPF_SKB_FIELD(insn, skb_iif);
+		break;
+#ifdef CONFIG_NET_SCHED
+	case offsetof(struct __sk_buff, tc_index):
+		BPF_SKB_FIELD(insn, tc_index);
+		break;
+#endif
+	case offsetof(struct __sk_buff, cb[0]) ...
+	     offsetof(struct __sk_buff, cb[4]):
+		BUILD_BUG_ON(FIELD_SIZEOF(struct __sk_buff, cb) >
+			     FIELD_SIZEOF(struct qdisc_skb_cb, data));
+		insn->off = offsetof(struct sk_buff, cb) +
+			    offsetof(struct qdisc_skb_cb, data) +
+			    off - offsetof(struct __sk_buff, cb[0]);
+		break;
+	}
+}
+
+static const struct bpf_verifier_ops sock_filter_ops = {
+	.get_func_proto = sock_filter_func_proto,
+	.is_valid_access = sock_filter_is_valid_access,
+	.convert_ctx_access = sk_filter_convert_ctx_access,
+	.may_access_skb = true,
+};
+
+static const struct bpf_verifier_ops tc_cls_ops = {
+	.get_func_proto = tc_cls_func_proto,
+	.is_valid_access = tc_cls_is_valid_access,
+	.convert_ctx_access = sk_filter_convert_ctx_access,
+	.may_access_skb = true,
+};
+
+static struct bpf_prog_type_list sock_filter_type __read_mostly = {
+	.ops = &sock_filter_ops,
+	.type = BPF_PROG_TYPE_SOCKET_FILTER,
+};
+
+static struct bpf_prog_type_list sched_cls_type __read_mostly = {
+	.ops = &tc_cls_ops,
+	.type = BPF_PROG_TYPE_SCHED_CLS,
+};
+
+static int __init register_sk_filter_ops(void)
+{
+	bpf_register_prog_type(&sock_filter_type);
+	bpf_register_prog_type(&sched_cls_type);
+	return 0;
+}
+late_initcall(register_sk_filter_ops);
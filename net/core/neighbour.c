@@ -62,10 +62,16 @@ static const struct file_operations neigh_stat_seq_fops;
 #endif
 
 /*
-   Neighbour hash table buckets are protected with rwlock tbl->lock.
-
-   - All the scans/updates to hash buckets MUST be made under this lock.
-   - NOTHING clever should be made under this lock: no callbacks
+   Neighbour hash table buckets are protected with rwlock tbl->lock
+   and the bucket locks tbl->hash_locks.
+
+   - Lookups walk the buckets under RCU only.
+   - Adding or unlinking entries of a single bucket is made with tbl->lock
+     held for reading plus the bucket lock, so inserts and GC on different
+     buckets do not serialize.
+   - Operations on the whole table (resize, flush of a device) take
+     tbl->lock for writing and need no bucket lock.
+   - NOTHING clever should be made under these locks: no callbacks
      to protocol backends, no attempts to send something to network.
      It will result in deadlocks, if backend/driver wants to use neighbour
      cache.
@@ -121,6 +127,12 @@ unsigned long neigh_rand_reach_time(unsigned long base)
 }
 EXPORT_SYMBOL(neigh_rand_reach_time);
 
+static spinlock_t *neigh_bucket_lock(struct neigh_table *tbl,
+				     unsigned int bucket)
+{
+	return &tbl->hash_locks[bucket & (NEIGH_HASH_LOCKS - 1)];
+}
+
 
 static int neigh_forced_gc(struct neigh_table *tbl)
 {
@@ -130,13 +142,15 @@ static int neigh_forced_gc(struct neigh_table *tbl)
 
 	NEIGH_CACHE_STAT_INC(tbl, forced_gc_runs);
 
-	write_lock_bh(&tbl->lock);
+	read_lock_bh(&tbl->lock);
 	nht = rcu_dereference_protected(tbl->nht,
 					lockdep_is_held(&tbl->lock));
 	for (i = 0; i < (1 << nht->hash_shift); i++) {
+		spinlock_t *lock = neigh_bucket_lock(tbl, i);
 		struct neighbour *n;
 		struct neighbour __rcu **np;
 
+		spin_lock(lock);
 		np = &nht->hash_buckets[i];
 		while ((n = rcu_dereference_protected(*np,
 					lockdep_is_held(&tbl->lock))) != NULL) {
@@ -159,11 +173,12 @@ static int neigh_forced_gc(struct neigh_table *tbl)
 			write_unlock(&n->lock);
 			np = &n->next;
 		}
+		spin_unlock(lock);
 	}
 
 	tbl->last_flush = jiffies;
 
-	write_unlock_bh(&tbl->lock);
+	read_unlock_bh(&tbl->lock);
 
 	return shrunk;
 }
@@ -399,6 +414,27 @@ static struct neigh_hash_table *neigh_hash_grow(struct neigh_table *tbl,
 	return new_nht;
 }
 
+/* Grow the hash table once it holds more entries than buckets. */
+static void neigh_hash_maybe_grow(struct neigh_table *tbl)
+{
+	struct neigh_hash_table *nht;
+	bool grow;
+
+	rcu_read_lock_bh();
+	nht = rcu_dereference_bh(tbl->nht);
+	grow = atomic_read(&tbl->entries) > (1 << nht->hash_shift);
+	rcu_read_unlock_bh();
+	if (!grow)
+		return;
+
+	write_lock_bh(&tbl->lock);
+	nht = rcu_dereference_protected(tbl->nht,
+					lockdep_is_held(&tbl->lock));
+	if (atomic_read(&tbl->entries) > (1 << nht->hash_shift))
+		neigh_hash_grow(tbl, nht->hash_shift + 1);
+	write_unlock_bh(&tbl->lock);
+}
+
 struct neighbour *neigh_lookup(struct neigh_table *tbl, const void *pkey,
 			       struct net_device *dev)
 {
@@ -468,6 +504,7 @@ struct neighbour *__neigh_create(struct neigh_table *tbl, const void *pkey,
 	int error;
 	struct neighbour *n1, *rc, *n = neigh_alloc(tbl, dev);
 	struct neigh_hash_table *nht;
+	spinlock_t *lock;
 
 	if (!n) {
 		rc = ERR_PTR(-ENOBUFS);
@@ -501,14 +538,15 @@ struct neighbour *__neigh_create(struct neigh_table *tbl, const void *pkey,
 
 	n->confirmed = jiffies - (NEIGH_VAR(n->parms, BASE_REACHABLE_TIME) << 1);
 
-	write_lock_bh(&tbl->lock);
+	neigh_hash_maybe_grow(tbl);
+
+	read_lock_bh(&tbl->lock);
 	nht = rcu_dereference_protected(tbl->nht,
 					lockdep_is_held(&tbl->lock));
 
-	if (atomic_read(&tbl->entries) > (1 << nht->hash_shift))
-		nht = neigh_hash_grow(tbl, nht->hash_shift + 1);
-
 	hash_val = tbl->hash(pkey, dev, nht->hash_rnd) >> (32 - nht->hash_shift);
+	lock = neigh_bucket_lock(tbl, hash_val);
+	spin_lock(lock);
 
 	if (n->parms->dead) {
 		rc = ERR_PTR(-EINVAL);
@@ -535,13 +573,15 @@ struct neighbour *__neigh_create(struct neigh_table *tbl, const void *pkey,
 			   rcu_dereference_protected(nht->hash_buckets[hash_val],
 						     lockdep_is_held(&tbl->lock)));
 	rcu_assign_pointer(nht->hash_buckets[hash_val], n);
-	write_unlock_bh(&tbl->lock);
+	spin_unlock(lock);
+	read_unlock_bh(&tbl->lock);
 	neigh_dbg(2, "neigh %p is created\n", n);
 	rc = n;
 out:
 	return rc;
 out_tbl_unlock:
-	write_unlock_bh(&tbl->lock);
+	spin_unlock(lock);
+	read_unlock_bh(&tbl->lock);
 out_neigh_release:
 	neigh_release(n);
 	goto out;
@@ -757,12 +797,13 @@ static void neigh_periodic_work(struct work_struct *work)
 	struct neigh_table *tbl = container_of(work, struct neigh_table, gc_work.work);
 	struct neighbour *n;
 	struct neighbour __rcu **np;
-	unsigned int i;
+	unsigned int i, end, nbuckets;
+	unsigned long delay;
 	struct neigh_hash_table *nht;
 
 	NEIGH_CACHE_STAT_INC(tbl, periodic_gc_runs);
 
-	write_lock_bh(&tbl->lock);
+	read_lock_bh(&tbl->lock);
 	nht = rcu_dereference_protected(tbl->nht,
 					lockdep_is_held(&tbl->lock));
 
@@ -778,10 +819,29 @@ static void neigh_periodic_work(struct work_struct *work)
 				neigh_rand_reach_time(NEIGH_VAR(p, BASE_REACHABLE_TIME));
 	}
 
+	/* Cycle through all hash buckets every BASE_REACHABLE_TIME/2 ticks.
+	 * ARP entry timeouts range from 1/2 BASE_REACHABLE_TIME to 3/2
+	 * BASE_REACHABLE_TIME.
+	 * Each run only scans NEIGH_GC_SLICE buckets, so large tables are
+	 * covered by more frequent runs rather than by longer ones.
+	 */
+	delay = NEIGH_VAR(&tbl->parms, BASE_REACHABLE_TIME) >> 1;
+	nbuckets = 1 << nht->hash_shift;
+	if (nbuckets > NEIGH_GC_SLICE)
+		delay = max(delay / (nbuckets / NEIGH_GC_SLICE), 1UL);
+
 	if (atomic_read(&tbl->entries) < tbl->gc_thresh1)
 		goto out;
 
-	for (i = 0 ; i < (1 << nht->hash_shift); i++) {
+	/* The table may have been resized since the previous run. */
+	if (tbl->gc_bucket >= nbuckets)
+		tbl->gc_bucket = 0;
+	end = min(tbl->gc_bucket + NEIGH_GC_SLICE, nbuckets);
+
+	for (i = tbl->gc_bucket; i < end; i++) {
+		spinlock_t *lock = neigh_bucket_lock(tbl, i);
+
+		spin_lock(lock);
 		np = &nht->hash_buckets[i];
 
 		while ((n = rcu_dereference_protected(*np,
@@ -813,24 +873,12 @@ static void neigh_periodic_work(struct work_struct *work)
 next_elt:
 			np = &n->next;
 		}
-		/*
-		 * It's fine to release lock here, even if hash table
-		 * grows while we are preempted.
-		 */
-		write_unlock_bh(&tbl->lock);
-		cond_resched();
-		write_lock_bh(&tbl->lock);
-		nht = rcu_dereference_protected(tbl->nht,
-						lockdep_is_held(&tbl->lock));
+		spin_unlock(lock);
 	}
+	tbl->gc_bucket = end < nbuckets ? end : 0;
 out:
-	/* Cycle through all hash buckets every BASE_REACHABLE_TIME/2 ticks.
-	 * ARP entry timeouts range from 1/2 BASE_REACHABLE_TIME to 3/2
-	 * BASE_REACHABLE_TIME.
-	 */
-	queue_delayed_work(system_power_efficient_wq, &tbl->gc_work,
-			      NEIGH_VAR(&tbl->parms, BASE_REACHABLE_TIME) >> 1);
-	write_unlock_bh(&tbl->lock);
+	queue_delayed_work(system_power_efficient_wq, &tbl->gc_work, delay);
+	read_unlock_bh(&tbl->lock);
 }
 
 static __inline__ int neigh_max_probes(struct neighbour *n)
@@ -1534,6 +1582,7 @@ static void neigh_table_init_no_netlink(struct neigh_table *tbl)
 {
 	unsigned long now = jiffies;
 	unsigned long phsize;
+	int i;
 
 	write_pnet(&tbl->parms.net, &init_net);
 	atomic_set(&tbl->parms.refcnt, 1);
@@ -1565,6 +1614,8 @@ static void neigh_table_init_no_netlink(struct neigh_table *tbl)
 		WARN_ON(tbl->entry_size % NEIGH_PRIV_ALIGN);
 
 	rwlock_init(&tbl->lock);
+	for (i = 0; i < NEIGH_HASH_LOCKS; i++)
+		spin_lock_init(&tbl->hash_locks[i]);
 	INIT_DEFERRABLE_WORK(&tbl->gc_work, neigh_periodic_work);
 	queue_delayed_work(system_power_efficient_wq, &tbl->gc_work,
 			tbl->parms.reachable_time);
@@ -0,0 +1,249 @@
+/*
+ * Page pool for driver receive buffers
+ *
+ * Pages are mapped for DMA once, when the pool takes them from the page
+ * allocator, and stay mapped for as long as they cycle between the
+ * driver and the stack.  A page only goes back to the page allocator,
+ * and is unmapped, when the pool is full, when somebody besides the
+ * pool still holds a reference to it, or when the pool is destroyed.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/dma-mapping.h>
+#include <linux/interrupt.h>
+#include <net/page_pool.h>
+
+static void page_pool_free(struct page_pool *pool)
+{
+	kfree(pool->ring);
+	kfree(pool);
+}
+
+static void page_pool_put_ref(struct page_pool *pool)
+{
+	if (atomic_dec_and_test(&pool->refcnt))
+		page_pool_free(pool);
+}
+
+/**
+ * page_pool_create - set up a page pool for one receive queue
+ * @params: pool parameters, copied into the pool
+ *
+ * Returns the new pool or an ERR_PTR().  The pool is owned by the
+ * caller until page_pool_destroy() and may outlive that call until the
+ * last page it handed out has come back.
+ */
+struct page_pool *page_pool_create(const struct page_pool_params *params)
+{
+	struct page_pool *pool;
+
+	if (params->flags & ~PP_FLAG_DMA_MAP)
+		return ERR_PTR(-EINVAL);
+
+	if (params->flags & PP_FLAG_DMA_MAP) {
+		/* The DMA address is kept in page->private. */
+		if (sizeof(dma_addr_t) > sizeof(unsigned long) ||
+		    !params->dev)
+			return ERR_PTR(-EINVAL);
+		if (params->dma_dir != DMA_FROM_DEVICE &&
+		    params->dma_dir != DMA_BIDIRECTIONAL)
+			return ERR_PTR(-EINVAL);
+	}
+
+	if (!params->pool_size || params->pool_size > 32768)
+		return ERR_PTR(-E2BIG);
+
+	pool = kzalloc_node(sizeof(*pool), GFP_KERNEL, params->nid);
+	if (!pool)
+		return ERR_PTR(-ENOMEM);
+
+	pool->p = *params;
+	pool->ring = kcalloc(params->pool_size, sizeof(*pool->ring),
+			     GFP_KERNEL);
+	if (!pool->ring) {
+		kfree(pool);
+		return ERR_PTR(-ENOMEM);
+	}
+	spin_lock_init(&pool->ring_lock);
+	atomic_set(&pool->refcnt, 1);
+
+	return pool;
+}
+EXPORT_SYMBOL(page_pool_create);
+
+static struct page *page_pool_alloc_page_slow(struct page_pool *pool,
+					      gfp_t gfp)
+{
+	struct page *page;
+	dma_addr_t dma = 0;
+
+	if (pool->p.order)
+		gfp |= __GFP_COMP;
+
+	page = alloc_pages_node(pool->p.nid, gfp, pool->p.order);
+	if (!page)
+		return NULL;
+
+	if (pool->p.flags & PP_FLAG_DMA_MAP) {
+		dma = dma_map_page(pool->p.dev, page, 0,
+				   PAGE_SIZE << pool->p.order,
+				   pool->p.dma_dir);
+		if (dma_mapping_error(pool->p.dev, dma)) {
+			__free_pages(page, pool->p.order);
+			return NULL;
+		}
+	}
+
+	set_page_private(page, (unsigned long)dma);
+	page->pp = pool;
+	page->pp_magic = PP_SIGNATURE;
+	atomic_inc(&pool->refcnt);
+
+	return page;
+}
+
+/**
+ * page_pool_alloc_pages - get a page from the pool
+ * @pool: pool owned by the calling queue
+ * @gfp: allocation flags, used only if the pool is empty
+ *
+ * Must be called from the owning queue's NAPI poll routine, which is
+ * what serialises access to the lockless cache.
+ */
+struct page *page_pool_alloc_pages(struct page_pool *pool, gfp_t gfp)
+{
+	unsigned long flags;
+	unsigned int n;
+
+	if (likely(pool->alloc_count))
+		return pool->alloc_cache[--pool->alloc_count];
+
+	/* Refill the cache from the ring in one go. */
+	spin_lock_irqsave(&pool->ring_lock, flags);
+	n = min_t(unsigned int, pool->ring_count, PP_ALLOC_CACHE_REFILL);
+	pool->ring_count -= n;
+	memcpy(pool->alloc_cache, pool->ring + pool->ring_count,
+	       n * sizeof(*pool->ring));
+	spin_unlock_irqrestore(&pool->ring_lock, flags);
+
+	if (n) {
+		pool->alloc_count = n;
+		return pool->alloc_cache[--pool->alloc_count];
+	}
+
+	return page_pool_alloc_page_slow(pool, gfp);
+}
+EXPORT_SYMBOL(page_pool_alloc_pages);
+
+/* Disconnect a page from its pool, the caller drops its reference. */
+static void page_pool_release_page(struct page_pool *pool, struct page *page)
+{
+	if (pool->p.flags & PP_FLAG_DMA_MAP)
+		dma_unmap_page(pool->p.dev, page_pool_get_dma_addr(page),
+			       PAGE_SIZE << pool->p.order, pool->p.dma_dir);
+	set_page_private(page, 0);
+	page->pp_magic = 0;
+	page->pp = NULL;
+	page_pool_put_ref(pool);
+}
+
+static bool page_pool_recycle_in_ring(struct page_pool *pool,
+				      struct page *page)
+{
+	unsigned long flags;
+	bool ret = false;
+
+	spin_lock_irqsave(&pool->ring_lock, flags);
+	if (!pool->destroyed && pool->ring_count < pool->p.pool_size) {
+		pool->ring[pool->ring_count++] = page;
+		ret = true;
+	}
+	spin_unlock_irqrestore(&pool->ring_lock, flags);
+
+	return ret;
+}
+
+/**
+ * page_pool_put_page - give a page back to its pool
+ * @pool: the pool the page came from
+ * @page: the page
+ * @allow_direct: caller is the owning queue's NAPI poll routine
+ *
+ * A page still referenced by someone else, or allocated from the
+ * emergency reserves, leaves the pool for good.
+ */
+void page_pool_put_page(struct page_pool *pool, struct page *page,
+			bool allow_direct)
+{
+	if (likely(page_count(page) == 1 && !page->pfmemalloc &&
+		   page_to_nid(page) == numa_mem_id())) {
+		if (allow_direct && in_serving_softirq() &&
+		    pool->alloc_count < PP_ALLOC_CACHE_SIZE) {
+			pool->alloc_cache[pool->alloc_count++] = page;
+			return;
+		}
+		if (page_pool_recycle_in_ring(pool, page))
+			return;
+	}
+
+	page_pool_release_page(pool, page);
+	put_page(page);
+}
+EXPORT_SYMBOL(page_pool_put_page);
+
+/* Called by skb_release_data() for the pages of skbs marked for recycling.
+ * Returns false for pages that do not belong to a pool.
+ */
+bool page_pool_return_skb_page(struct page *page)
+{
+	page = compound_head(page);
+	if (page->pp_magic != PP_SIGNATURE)
+		return false;
+
+	page_pool_put_page(page->pp, page, false);
+	return true;
+}
+EXPORT_SYMBOL(page_pool_return_skb_page);
+
+/**
+ * page_pool_destroy - release a pool
+ * @pool: pool to release
+ *
+ * Frees every page the pool still caches.  Pages still in flight are
+ * unmapped and freed as they come back, the last one frees the pool.
+ * The caller must keep the DMA device around until then.
+ */
+void page_pool_destroy(struct page_pool *pool)
+{
+	unsigned long flags;
+	struct page *page;
+
+	spin_lock_irqsave(&pool->ring_lock, flags);
+	pool->destroyed = true;
+	spin_unlock_irqrestore(&pool->ring_lock, flags);
+
+	while (pool->alloc_count) {
+		page = pool->alloc_cache[--pool->alloc_count];
+		page_pool_release_page(pool, page);
+		put_page(page);
+	}
+
+	/* No page can enter the ring once destroyed is set. */
+	while (pool->ring_count) {
+		page = pool->ring[--pool->ring_count];
+		page_pool_release_page(pool, page);
+		put_page(page);
+	}
+
+	page_pool_put_ref(pool);
+}
+EXPORT_SYMBOL(page_pool_destroy);
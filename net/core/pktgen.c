@@ -216,6 +216,7 @@
 #define PKTGEN_MAGIC 0xbe9be955
 #define PG_PROC_DIR "pktgen"
 #define PGCTRL	    "pgctrl"
+#define PGRX	    "pgrx"
 
 #define MAX_CFLOWS  65536
 
@@ -287,6 +288,10 @@ struct pktgen_dev {
 				 * before creating a new packet,
 				 * set clone_skb to 1024.
 				 */
+	unsigned int burst;	/* number of copies of the packet handed to
+				 * the driver back to back, all but the last
+				 * one with skb->xmit_more set
+				 */
 
 	char dst_min[IP_NAME_SZ];	/* IP, ie 1.2.3.4 */
 	char dst_max[IP_NAME_SZ];	/* IP, ie 1.2.3.4 */
@@ -406,11 +411,30 @@ struct pktgen_hdr {
 
 static int pg_net_id __read_mostly;
 
+/* Receive sink counters.  Each cpu only updates its own, from softirq. */
+struct pktgen_rx_stats {
+	u64	packets;
+	u64	bytes;
+	u64	lat_sum;	/* in us, over lat_count packets */
+	u64	lat_count;
+	u32	lat_min;
+	u32	lat_max;
+	ktime_t	first;
+	ktime_t	last;
+};
+
 struct pktgen_net {
 	struct net		*net;
 	struct proc_dir_entry	*proc_dir;
 	struct list_head	pktgen_threads;
 	bool			pktgen_exiting;
+
+	/* Receive sink, under RTNL */
+	bool			rx_enabled;
+	struct net_device	*rx_dev;	/* NULL for all devices */
+	struct packet_type	rx_ip;
+	struct packet_type	rx_ipv6;
+	struct pktgen_rx_stats __percpu *rx_stats;
 };
 
 struct pktgen_thread {
@@ -462,6 +486,223 @@ static struct notifier_block pktgen_notifier_block = {
 	.notifier_call = pktgen_device_event,
 };
 
+/*
+ * Receive sink: count pktgen packets as they arrive, and how long they
+ * took since pktgen stamped them.  Senders and sink must share a clock,
+ * which they do when looping packets back to the same host.
+ */
+static void pktgen_rx_account(struct pktgen_rx_stats *st, unsigned int len,
+			      const struct pktgen_hdr *pgh)
+{
+	ktime_t now = ktime_get_real();
+	s64 lat;
+
+	if (!st->packets)
+		st->first = now;
+	st->last = now;
+	st->packets++;
+	st->bytes += len;
+
+	if (!pgh->tv_sec)
+		return;
+
+	lat = ktime_us_delta(now, ktime_set(ntohl(pgh->tv_sec),
+					    ntohl(pgh->tv_usec) *
+					    NSEC_PER_USEC));
+	if (lat < 0 || lat > U32_MAX)
+		return;
+
+	if (!st->lat_count || lat < st->lat_min)
+		st->lat_min = lat;
+	if (lat > st->lat_max)
+		st->lat_max = lat;
+	st->lat_sum += lat;
+	st->lat_count++;
+}
+
+static int pktgen_rcv(struct sk_buff *skb, struct net_device *dev,
+		      struct packet_type *pt, struct net_device *orig_dev)
+{
+	struct pktgen_net *pn = pt->af_packet_priv;
+	const struct pktgen_hdr *pgh;
+	struct pktgen_hdr _pgh;
+	unsigned int off;
+
+	if (skb->pkt_type == PACKET_OTHERHOST)
+		goto out;
+
+	/* The skb is shared with the protocol handlers, only peek at it. */
+	if (skb->protocol == htons(ETH_P_IP)) {
+		const struct iphdr *iph;
+		struct iphdr _iph;
+
+		iph = skb_header_pointer(skb, 0, sizeof(_iph), &_iph);
+		if (!iph || iph->protocol != IPPROTO_UDP ||
+		    ip_is_fragment(iph))
+			goto out;
+		off = iph->ihl * 4;
+	} else {
+		const struct ipv6hdr *ip6h;
+		struct ipv6hdr _ip6h;
+
+		ip6h = skb_header_pointer(skb, 0, sizeof(_ip6h), &_ip6h);
+		if (!ip6h || ip6h->nexthdr != IPPROTO_UDP)
+			goto out;
+		off = sizeof(*ip6h);
+	}
+
+	pgh = skb_header_pointer(skb, off + sizeof(struct udphdr),
+				 sizeof(_pgh), &_pgh);
+	if (pgh && pgh->pgh_magic == htonl(PKTGEN_MAGIC))
+		pktgen_rx_account(this_cpu_ptr(pn->rx_stats), skb->len, pgh);
+out:
+	consume_skb(skb);
+	return NET_RX_SUCCESS;
+}
+
+static void pktgen_rx_disable(struct pktgen_net *pn)
+{
+	ASSERT_RTNL();
+
+	if (!pn->rx_enabled)
+		return;
+
+	__dev_remove_pack(&pn->rx_ip);
+	__dev_remove_pack(&pn->rx_ipv6);
+	synchronize_net();
+
+	if (pn->rx_dev)
+		dev_put(pn->rx_dev);
+	pn->rx_dev = NULL;
+	pn->rx_enabled = false;
+}
+
+static int pktgen_rx_enable(struct pktgen_net *pn, const char *ifname)
+{
+	struct net_device *dev = NULL;
+
+	ASSERT_RTNL();
+
+	pktgen_rx_disable(pn);
+
+	if (!pn->rx_stats) {
+		pn->rx_stats = alloc_percpu(struct pktgen_rx_stats);
+		if (!pn->rx_stats)
+			return -ENOMEM;
+	}
+
+	if (*ifname) {
+		dev = dev_get_by_name(pn->net, ifname);
+		if (!dev)
+			return -ENODEV;
+	}
+
+	pn->rx_dev = dev;
+	pn->rx_ip.type = htons(ETH_P_IP);
+	pn->rx_ip.dev = dev;
+	pn->rx_ip.func = pktgen_rcv;
+	pn->rx_ip.af_packet_priv = pn;
+	pn->rx_ipv6 = pn->rx_ip;
+	pn->rx_ipv6.type = htons(ETH_P_IPV6);
+	dev_add_pack(&pn->rx_ip);
+	dev_add_pack(&pn->rx_ipv6);
+	pn->rx_enabled = true;
+
+	return 0;
+}
+
+/* Best effort while packets are still arriving. */
+static void pktgen_rx_reset(struct pktgen_net *pn)
+{
+	int cpu;
+
+	if (!pn->rx_stats)
+		return;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(pn->rx_stats, cpu), 0,
+		       sizeof(struct pktgen_rx_stats));
+}
+
+static void pgrx_show_stats(struct seq_file *seq, const char *name,
+			    const struct pktgen_rx_stats *st)
+{
+	u64 us = ktime_us_delta(st->last, st->first);
+	u64 pps = 0, mbps = 0, lat_avg = 0;
+
+	if (us) {
+		pps = div64_u64(st->packets * USEC_PER_SEC, us);
+		mbps = div64_u64(st->bytes * 8, us);
+	}
+	if (st->lat_count)
+		lat_avg = div64_u64(st->lat_sum, st->lat_count);
+
+	seq_printf(seq, "%5s %12llu %14llu %10llupps %6lluMb/sec %u/%llu/%u\n",
+		   name, st->packets, st->bytes, pps, mbps,
+		   st->lat_min, lat_avg, st->lat_max);
+}
+
+static int pgrx_show(struct seq_file *seq, void *v)
+{
+	struct pktgen_net *pn = seq->private;
+	struct pktgen_rx_stats total = { 0 };
+	char name[8];
+	int cpu;
+
+	rtnl_lock();
+	if (!pn->rx_enabled)
+		seq_puts(seq, "RX sink: disabled\n");
+	else
+		seq_printf(seq, "RX sink: %s\n",
+			   pn->rx_dev ? pn->rx_dev->name : "all devices");
+	rtnl_unlock();
+
+	if (!pn->rx_stats)
+		return 0;
+
+	seq_puts(seq, "  cpu      packets          bytes"
+		 "       rate  throughput lat(us) min/avg/max\n");
+	for_each_possible_cpu(cpu) {
+		const struct pktgen_rx_stats *st;
+
+		st = per_cpu_ptr(pn->rx_stats, cpu);
+		if (!st->packets)
+			continue;
+
+		snprintf(name, sizeof(name), "%d", cpu);
+		pgrx_show_stats(seq, name, st);
+
+		if (!total.packets || st->first.tv64 < total.first.tv64)
+			total.first = st->first;
+		if (st->last.tv64 > total.last.tv64)
+			total.last = st->last;
+		total.packets += st->packets;
+		total.bytes += st->bytes;
+		total.lat_sum += st->lat_sum;
+		if (st->lat_count &&
+		    (!total.lat_count || st->lat_min < total.lat_min))
+			total.lat_min = st->lat_min;
+		total.lat_max = max(total.lat_max, st->lat_max);
+		total.lat_count += st->lat_count;
+	}
+	pgrx_show_stats(seq, "total", &total);
+
+	return 0;
+}
+
+static int pgrx_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pgrx_show, PDE_DATA(inode));
+}
+
+static const struct file_operations pktgen_rx_fops = {
+	.owner   = THIS_MODULE,
+	.open    = pgrx_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
 /*
  * /proc handling functions
  *
@@ -502,6 +743,25 @@ static ssize_t pgctrl_write(struct file *file, const char __user *buf,
 	else if (!strcmp(data, "reset"))
 		pktgen_reset_all_threads(pn);
 
+	else if (!strcmp(data, "rx") || !strncmp(data, "rx ", 3)) {
+		int err;
+
+		rtnl_lock();
+		err = pktgen_rx_enable(pn, strstrip(data + 2));
+		rtnl_unlock();
+		if (err)
+			return err;
+	}
+
+	else if (!strcmp(data, "rx_disable")) {
+		rtnl_lock();
+		pktgen_rx_disable(pn);
+		rtnl_unlock();
+	}
+
+	else if (!strcmp(data, "rx_reset"))
+		pktgen_rx_reset(pn);
+
 	else
 		pr_warning("Unknown command: %s\n", data);
 
@@ -534,9 +794,9 @@ static int pktgen_if_show(struct seq_file *seq, void *v)
 		   pkt_dev->max_pkt_size);
 
 	seq_printf(seq,
-		   "     frags: %d  delay: %llu  clone_skb: %d  ifname: %s\n",
+		   "     frags: %d  delay: %llu  clone_skb: %d  burst: %u  ifname: %s\n",
 		   pkt_dev->nfrags, (unsigned long long) pkt_dev->delay,
-		   pkt_dev->clone_skb, pkt_dev->odevname);
+		   pkt_dev->clone_skb, pkt_dev->burst, pkt_dev->odevname);
 
 	seq_printf(seq, "     flows: %u flowlen: %u\n", pkt_dev->cflows,
 		   pkt_dev->lflow);
@@ -1080,6 +1340,19 @@ static ssize_t pktgen_if_write(struct file *file,
 		sprintf(pg_result, "OK: clone_skb=%d", pkt_dev->clone_skb);
 		return count;
 	}
+	if (!strcmp(name, "burst")) {
+		len = num_arg(&user_buffer[i], 10, &value);
+		if (len < 0)
+			return len;
+		if ((value > 1) &&
+		    (!(pkt_dev->odev->priv_flags & IFF_TX_SKB_SHARING)))
+			return -ENOTSUPP;
+		i += len;
+		pkt_dev->burst = value < 1 ? 1 : value;
+
+		sprintf(pg_result, "OK: burst=%u", pkt_dev->burst);
+		return count;
+	}
 	if (!strcmp(name, "count")) {
 		len = num_arg(&user_buffer[i], 10, &value);
 		if (len < 0)
@@ -1969,6 +2242,8 @@ static int pktgen_device_event(struct notifier_block *unused,
 
 	case NETDEV_UNREGISTER:
 		pktgen_mark_device(pn, dev->name);
+		if (pn->rx_dev == dev)
+			pktgen_rx_disable(pn);
 		break;
 	}
 
@@ -3293,9 +3568,8 @@ static void pktgen_wait_for_skb(struct pktgen_dev *pkt_dev)
 
 static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 {
+	unsigned int burst = ACCESS_ONCE(pkt_dev->burst);
 	struct net_device *odev = pkt_dev->odev;
-	netdev_tx_t (*xmit)(struct sk_buff *, struct net_device *)
-		= odev->netdev_ops->ndo_start_xmit;
 	struct netdev_queue *txq;
 	u16 queue_map;
 	int ret;
@@ -3347,16 +3621,19 @@ static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 		pkt_dev->last_ok = 0;
 		goto unlock;
 	}
-	atomic_inc(&(pkt_dev->skb->users));
-	ret = (*xmit)(pkt_dev->skb, odev);
+	atomic_add(burst, &pkt_dev->skb->users);
+
+xmit_more:
+	ret = netdev_start_xmit(pkt_dev->skb, odev, txq, --burst > 0);
 
 	switch (ret) {
 	case NETDEV_TX_OK:
-		txq_trans_update(txq);
 		pkt_dev->last_ok = 1;
 		pkt_dev->sofar++;
 		pkt_dev->seq_num++;
 		pkt_dev->tx_bytes += pkt_dev->last_pkt_size;
+		if (burst > 0 && !netif_xmit_frozen_or_drv_stopped(txq))
+			goto xmit_more;
 		break;
 	case NET_XMIT_DROP:
 	case NET_XMIT_CN:
@@ -3375,6 +3652,8 @@ static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 		atomic_dec(&(pkt_dev->skb->users));
 		pkt_dev->last_ok = 0;
 	}
+	if (unlikely(burst))
+		atomic_sub(burst, &pkt_dev->skb->users);
 unlock:
 	HARD_TX_UNLOCK(odev, txq);
 
@@ -3571,6 +3850,7 @@ static int pktgen_add_device(struct pktgen_thread *t, const char *ifname)
 	pkt_dev->svlan_cfi = 0;
 	pkt_dev->svlan_id = 0xffff;
 	pkt_dev->node = -1;
+	pkt_dev->burst = 1;
 
 	err = pktgen_setup_dev(t->net, pkt_dev, ifname);
 	if (err)
@@ -3737,6 +4017,13 @@ static int __net_init pg_net_init(struct net *net)
 		goto remove;
 	}
 
+	pe = proc_create_data(PGRX, 0400, pn->proc_dir, &pktgen_rx_fops, pn);
+	if (pe == NULL) {
+		pr_err("cannot create %s procfs entry\n", PGRX);
+		ret = -EINVAL;
+		goto remove_ctrl;
+	}
+
 	for_each_online_cpu(cpu) {
 		int err;
 
@@ -3755,6 +4042,8 @@ static int __net_init pg_net_init(struct net *net)
 	return 0;
 
 remove_entry:
+	remove_proc_entry(PGRX, pn->proc_dir);
+remove_ctrl:
 	remove_proc_entry(PGCTRL, pn->proc_dir);
 remove:
 	remove_proc_entry(PG_PROC_DIR, pn->net->proc_net);
@@ -3782,6 +4071,12 @@ static void __net_exit pg_net_exit(struct net *net)
 		kfree(t);
 	}
 
+	rtnl_lock();
+	pktgen_rx_disable(pn);
+	rtnl_unlock();
+	free_percpu(pn->rx_stats);
+
+	remove_proc_entry(PGRX, pn->proc_dir);
 	remove_proc_entry(PGCTRL, pn->proc_dir);
 	remove_proc_entry(PG_PROC_DIR, pn->net->proc_net);
 }
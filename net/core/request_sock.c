@@ -42,11 +42,16 @@ int reqsk_queue_alloc(struct request_sock_queue *queue,
 {
 	size_t lopt_size = sizeof(struct listen_sock);
 	struct listen_sock *lopt;
+	unsigned int nr_locks, i;
 
 	nr_table_entries = min_t(u32, nr_table_entries, sysctl_max_syn_backlog);
 	nr_table_entries = max_t(u32, nr_table_entries, 8);
 	nr_table_entries = roundup_pow_of_two(nr_table_entries + 1);
+	/* enough bucket locks to keep SYNs handled on different cpus apart */
+	nr_locks = roundup_pow_of_two(4 * num_possible_cpus());
+	nr_locks = min(nr_locks, nr_table_entries);
 	lopt_size += nr_table_entries * sizeof(struct request_sock *);
+	lopt_size += nr_locks * sizeof(spinlock_t);
 	if (lopt_size > PAGE_SIZE)
 		lopt = vzalloc(lopt_size);
 	else
@@ -59,76 +64,64 @@ int reqsk_queue_alloc(struct request_sock_queue *queue,
 	     lopt->max_qlen_log++);
 
 	get_random_bytes(&lopt->hash_rnd, sizeof(lopt->hash_rnd));
-	rwlock_init(&queue->syn_wait_lock);
+	lopt->syn_lock = (spinlock_t *)&lopt->syn_table[nr_table_entries];
+	lopt->syn_lock_mask = nr_locks - 1;
+	for (i = 0; i < nr_locks; i++)
+		spin_lock_init(&lopt->syn_lock[i]);
+	spin_lock_init(&queue->rskq_lock);
 	queue->rskq_accept_head = NULL;
 	lopt->nr_table_entries = nr_table_entries;
 
-	write_lock_bh(&queue->syn_wait_lock);
+	/* pairs with the lockless readers in softirq context */
+	smp_wmb();
 	queue->listen_opt = lopt;
-	write_unlock_bh(&queue->syn_wait_lock);
 
 	return 0;
 }
 
 void __reqsk_queue_destroy(struct request_sock_queue *queue)
 {
-	struct listen_sock *lopt;
-	size_t lopt_size;
-
 	/*
 	 * this is an error recovery path only
 	 * no locking needed and the lopt is not NULL
 	 */
-
-	lopt = queue->listen_opt;
-	lopt_size = sizeof(struct listen_sock) +
-		lopt->nr_table_entries * sizeof(struct request_sock *);
-
-	if (lopt_size > PAGE_SIZE)
-		vfree(lopt);
-	else
-		kfree(lopt);
+	kvfree(queue->listen_opt);
+	queue->listen_opt = NULL;
 }
 
-static inline struct listen_sock *reqsk_queue_yank_listen_sk(
-		struct request_sock_queue *queue)
+static void reqsk_queue_free_rcu(struct rcu_head *head)
 {
-	struct listen_sock *lopt;
-
-	write_lock_bh(&queue->syn_wait_lock);
-	lopt = queue->listen_opt;
-	queue->listen_opt = NULL;
-	write_unlock_bh(&queue->syn_wait_lock);
-
-	return lopt;
+	kvfree(container_of(head, struct listen_sock, rcu));
 }
 
 void reqsk_queue_destroy(struct request_sock_queue *queue)
 {
-	/* make all the listen_opt local to us */
-	struct listen_sock *lopt = reqsk_queue_yank_listen_sk(queue);
-	size_t lopt_size = sizeof(struct listen_sock) +
-		lopt->nr_table_entries * sizeof(struct request_sock *);
-
-	if (lopt->qlen != 0) {
-		unsigned int i;
-
-		for (i = 0; i < lopt->nr_table_entries; i++) {
-			struct request_sock *req;
-
-			while ((req = lopt->syn_table[i]) != NULL) {
-				lopt->syn_table[i] = req->dl_next;
-				lopt->qlen--;
-				reqsk_free(req);
-			}
+	struct listen_sock *lopt = queue->listen_opt;
+	unsigned int i;
+
+	/* SYNs are processed without the listener lock: stop new requests
+	 * from being hashed, then empty every bucket under its lock. Once
+	 * a bucket is drained nothing can be added to it anymore, see
+	 * reqsk_queue_hash_req().
+	 */
+	lopt->dead = 1;
+	for (i = 0; i < lopt->nr_table_entries; i++) {
+		spinlock_t *lock = reqsk_queue_lock(lopt, i);
+		struct request_sock *req;
+
+		spin_lock_bh(lock);
+		while ((req = lopt->syn_table[i]) != NULL) {
+			lopt->syn_table[i] = req->dl_next;
+			atomic_dec(&lopt->qlen);
+			reqsk_free(req);
 		}
+		spin_unlock_bh(lock);
 	}
 
-	WARN_ON(lopt->qlen != 0);
-	if (lopt_size > PAGE_SIZE)
-		vfree(lopt);
-	else
-		kfree(lopt);
+	WARN_ON(atomic_read(&lopt->qlen) != 0);
+	queue->listen_opt = NULL;
+	/* lockless readers may still look at lopt */
+	call_rcu(&lopt->rcu, reqsk_queue_free_rcu);
 }
 
 /*
@@ -38,6 +38,7 @@
 #include <linux/if_bridge.h>
 #include <linux/pci.h>
 #include <linux/etherdevice.h>
+#include <linux/filter.h>
 
 #include <asm/uaccess.h>
 
@@ -1186,6 +1187,8 @@ static const struct nla_policy ifla_policy[IFLA_MAX+1] = {
 	[IFLA_NUM_RX_QUEUES]	= { .type = NLA_U32 },
 	[IFLA_PHYS_PORT_ID]	= { .type = NLA_BINARY, .len = MAX_PHYS_PORT_ID_LEN },
 	[IFLA_CARRIER_CHANGES]	= { .type = NLA_U32 },  /* ignored */
+	[IFLA_RX_FILTER]	= { .type = NLA_BINARY,
+				    .len = BPF_MAXINSNS * sizeof(struct sock_filter) },
 };
 
 static const struct nla_policy ifla_info_policy[IFLA_INFO_MAX+1] = {
@@ -1577,6 +1580,14 @@ static int do_setlink(const struct sk_buff *skb,
 		modified = 1;
 	}
 
+	if (tb[IFLA_RX_FILTER]) {
+		err = dev_change_rx_filter(dev, nla_data(tb[IFLA_RX_FILTER]),
+					   nla_len(tb[IFLA_RX_FILTER]));
+		if (err)
+			goto errout;
+		modified = 1;
+	}
+
 	if (tb[IFLA_TXQLEN])
 		dev->tx_queue_len = nla_get_u32(tb[IFLA_TXQLEN]);
 
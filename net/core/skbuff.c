@@ -69,6 +69,7 @@
 #include <net/checksum.h>
 #include <net/ip6_checksum.h>
 #include <net/xfrm.h>
+#include <net/page_pool.h>
 
 #include <asm/uaccess.h>
 #include <trace/events/skb.h>
@@ -482,10 +483,14 @@ static void skb_clone_fraglist(struct sk_buff *skb)
 
 static void skb_free_head(struct sk_buff *skb)
 {
-	if (skb->head_frag)
-		put_page(virt_to_head_page(skb->head));
-	else
+	if (skb->head_frag) {
+		struct page *page = virt_to_head_page(skb->head);
+
+		if (!skb->pp_recycle || !page_pool_return_skb_page(page))
+			put_page(page);
+	} else {
 		kfree(skb->head);
+	}
 }
 
 static void skb_release_data(struct sk_buff *skb)
@@ -494,22 +499,25 @@ static void skb_release_data(struct sk_buff *skb)
 	    !atomic_sub_return(skb->nohdr ? (1 << SKB_DATAREF_SHIFT) + 1 : 1,
 			       &skb_shinfo(skb)->dataref)) {
 		if (skb_shinfo(skb)->nr_frags) {
+			struct skb_shared_info *shinfo = skb_shinfo(skb);
 			int i;
-			for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
+
+			for (i = 0; i < shinfo->nr_frags; i++) {
+				struct page *page;
+
+				page = skb_frag_page(&shinfo->frags[i]);
+				if (skb->pp_recycle &&
+				    page_pool_return_skb_page(page))
+					continue;
 				skb_frag_unref(skb, i);
+			}
 		}
 
 		/*
 		 * If skb buf is from userspace, we need to notify the caller
 		 * the lower device DMA has done;
 		 */
-		if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
-			struct ubuf_info *uarg;
-
-			uarg = skb_shinfo(skb)->destructor_arg;
-			if (uarg->callback)
-				uarg->callback(uarg, true);
-		}
+		skb_zcopy_clear(skb, true);
 
 		if (skb_has_frag_list(skb))
 			skb_drop_fraglist(skb);
@@ -641,14 +649,7 @@ EXPORT_SYMBOL(kfree_skb_list);
  */
 void skb_tx_error(struct sk_buff *skb)
 {
-	if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
-		struct ubuf_info *uarg;
-
-		uarg = skb_shinfo(skb)->destructor_arg;
-		if (uarg->callback)
-			uarg->callback(uarg, false);
-		skb_shinfo(skb)->tx_flags &= ~SKBTX_DEV_ZEROCOPY;
-	}
+	skb_zcopy_clear(skb, false);
 }
 EXPORT_SYMBOL(skb_tx_error);
 
@@ -673,6 +674,87 @@ void consume_skb(struct sk_buff *skb)
 }
 EXPORT_SYMBOL(consume_skb);
 
+/*
+ * sk_buff shells freed from NAPI context are collected per cpu and given
+ * back to skbuff_head_cache in bulk, once the cache fills up or the
+ * NET_RX softirq is done.
+ */
+#define NAPI_SKB_CACHE_SIZE	64
+
+struct napi_free_cache {
+	unsigned int skb_count;
+	void *skb_cache[NAPI_SKB_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct napi_free_cache, napi_free_cache);
+
+void __kfree_skb_flush(void)
+{
+	struct napi_free_cache *nc = this_cpu_ptr(&napi_free_cache);
+
+	if (nc->skb_count) {
+		kmem_cache_free_bulk(skbuff_head_cache, nc->skb_count,
+				     nc->skb_cache);
+		nc->skb_count = 0;
+	}
+}
+
+static void _kfree_skb_defer(struct sk_buff *skb)
+{
+	struct napi_free_cache *nc = this_cpu_ptr(&napi_free_cache);
+
+	/* drop skb->head and call any destructors for packet */
+	skb_release_all(skb);
+
+	nc->skb_cache[nc->skb_count++] = skb;
+
+#ifdef CONFIG_SLUB
+	/* SLUB writes into objects when freeing */
+	prefetchw(skb);
+#endif
+
+	if (unlikely(nc->skb_count == NAPI_SKB_CACHE_SIZE)) {
+		kmem_cache_free_bulk(skbuff_head_cache, NAPI_SKB_CACHE_SIZE,
+				     nc->skb_cache);
+		nc->skb_count = 0;
+	}
+}
+
+/**
+ *	napi_consume_skb - free an skbuff from NAPI context
+ *	@skb: buffer to free
+ *	@budget: NAPI budget of the caller, 0 if not called from NAPI poll
+ *
+ *	Like consume_skb(), but the sk_buff itself is returned to its cache
+ *	in bulk later on. Must be called from softirq context; a zero
+ *	@budget (as used by netpoll) falls back to dev_consume_skb_any().
+ */
+void napi_consume_skb(struct sk_buff *skb, int budget)
+{
+	if (unlikely(!skb))
+		return;
+
+	if (unlikely(!budget)) {
+		dev_consume_skb_any(skb);
+		return;
+	}
+
+	if (likely(atomic_read(&skb->users) == 1))
+		smp_rmb();
+	else if (likely(!atomic_dec_and_test(&skb->users)))
+		return;
+	trace_consume_skb(skb);
+
+	/* fast clones live in skbuff_fclone_cache */
+	if (skb->fclone != SKB_FCLONE_UNAVAILABLE) {
+		__kfree_skb(skb);
+		return;
+	}
+
+	_kfree_skb_defer(skb);
+}
+EXPORT_SYMBOL(napi_consume_skb);
+
 static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 {
 	new->tstamp		= old->tstamp;
@@ -746,6 +828,7 @@ static struct sk_buff *__skb_clone(struct sk_buff *n, struct sk_buff *skb)
 	C(end);
 	C(head);
 	C(head_frag);
+	C(pp_recycle);
 	C(data);
 	C(truesize);
 	atomic_set(&n->users, 1);
@@ -774,6 +857,317 @@ struct sk_buff *skb_morph(struct sk_buff *dst, struct sk_buff *src)
 }
 EXPORT_SYMBOL_GPL(skb_morph);
 
+/* Charge pages pinned by MSG_ZEROCOPY against RLIMIT_MEMLOCK of the user */
+static int mm_account_pinned_pages(struct mmpin *mmp, size_t size)
+{
+	unsigned long max_pg, num_pg, new_pg, old_pg;
+	struct user_struct *user;
+
+	if (capable(CAP_IPC_LOCK) || !size)
+		return 0;
+
+	num_pg = (size >> PAGE_SHIFT) + 2;	/* worst case */
+	max_pg = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+	user = mmp->user ? : current_user();
+
+	do {
+		old_pg = atomic_long_read(&user->locked_vm);
+		new_pg = old_pg + num_pg;
+		if (new_pg > max_pg)
+			return -ENOBUFS;
+	} while (atomic_long_cmpxchg(&user->locked_vm, old_pg, new_pg) !=
+		 old_pg);
+
+	if (!mmp->user) {
+		mmp->user = get_uid(user);
+		mmp->num_pg = num_pg;
+	} else {
+		mmp->num_pg += num_pg;
+	}
+
+	return 0;
+}
+
+static void mm_unaccount_pinned_pages(struct mmpin *mmp)
+{
+	if (mmp->user) {
+		atomic_long_sub(mmp->num_pg, &mmp->user->locked_vm);
+		free_uid(mmp->user);
+	}
+}
+
+/* The ubuf_info of a MSG_ZEROCOPY send lives in the cb of the skb that is
+ * later queued on the error queue as its completion notification.
+ */
+static struct sk_buff *skb_from_uarg(struct ubuf_info *uarg)
+{
+	return container_of((void *)uarg, struct sk_buff, cb);
+}
+
+struct ubuf_info *sock_zerocopy_alloc(struct sock *sk, size_t size)
+{
+	struct ubuf_info *uarg;
+	struct sk_buff *skb;
+
+	skb = sock_omalloc(sk, 0, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	BUILD_BUG_ON(sizeof(*uarg) > sizeof(skb->cb));
+	uarg = (void *)skb->cb;
+	uarg->mmp.user = NULL;
+
+	if (mm_account_pinned_pages(&uarg->mmp, size)) {
+		kfree_skb(skb);
+		return NULL;
+	}
+
+	uarg->callback = sock_zerocopy_callback;
+	uarg->id = ((u32)atomic_inc_return(&sk->sk_zckey)) - 1;
+	uarg->len = 1;
+	uarg->bytelen = size;
+	uarg->zerocopy = 1;
+	atomic_set(&uarg->refcnt, 1);
+	sock_hold(sk);
+
+	return uarg;
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_alloc);
+
+/**
+ *	sock_zerocopy_realloc - get a completion for the next zerocopy send
+ *	@sk: socket that sends
+ *	@size: number of bytes the send may pin
+ *	@uarg: completion of the skb the data would be appended to, or %NULL
+ *
+ *	Extends @uarg to also cover the next send call if it is the most
+ *	recent completion of @sk, so that a stream of small sends appended
+ *	to the same skb is notified as one range; allocates a new
+ *	completion otherwise. The socket must be owned by the caller, which
+ *	serializes access to sk_zckey. Returns a referenced completion or
+ *	%NULL on failure.
+ */
+struct ubuf_info *sock_zerocopy_realloc(struct sock *sk, size_t size,
+					struct ubuf_info *uarg)
+{
+	if (uarg) {
+		const u32 byte_limit = 1 << 19;	/* limit to a few TSO */
+		u32 bytelen, next;
+
+		if (WARN_ON_ONCE(!sock_owned_by_user(sk)))
+			return NULL;
+
+		bytelen = uarg->bytelen + size;
+		if (uarg->len == USHRT_MAX - 1 || bytelen > byte_limit) {
+			/* TCP can create a new skb to attach a new uarg */
+			if (sk->sk_type == SOCK_STREAM)
+				goto new_alloc;
+			return NULL;
+		}
+
+		next = (u32)atomic_read(&sk->sk_zckey);
+		if ((u32)(uarg->id + uarg->len) == next) {
+			if (mm_account_pinned_pages(&uarg->mmp, size))
+				return NULL;
+			uarg->len++;
+			uarg->bytelen = bytelen;
+			atomic_set(&sk->sk_zckey, ++next);
+			sock_zerocopy_get(uarg);
+			return uarg;
+		}
+	}
+
+new_alloc:
+	return sock_zerocopy_alloc(sk, size);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_realloc);
+
+static bool skb_zerocopy_notify_extend(struct sk_buff *skb, u32 lo, u16 len)
+{
+	struct sock_exterr_skb *serr = SKB_EXT_ERR(skb);
+	u32 old_lo, old_hi;
+	u64 sum_len;
+
+	old_lo = serr->ee.ee_info;
+	old_hi = serr->ee.ee_data;
+	sum_len = old_hi - old_lo + 1ULL + len;
+
+	if (sum_len >= (1ULL << 32))
+		return false;
+
+	if (lo != old_hi + 1)
+		return false;
+
+	serr->ee.ee_data += len;
+	return true;
+}
+
+void sock_zerocopy_callback(struct ubuf_info *uarg, bool success)
+{
+	struct sk_buff *tail, *skb = skb_from_uarg(uarg);
+	struct sock_exterr_skb *serr;
+	struct sock *sk = skb->sk;
+	struct sk_buff_head *q;
+	unsigned long flags;
+	u32 lo, hi;
+	u16 len;
+
+	mm_unaccount_pinned_pages(&uarg->mmp);
+
+	/* if !len, there was only 1 call, and it was aborted
+	 * so do not queue a completion notification
+	 */
+	if (!uarg->len || sock_flag(sk, SOCK_DEAD))
+		goto release;
+
+	len = uarg->len;
+	lo = uarg->id;
+	hi = uarg->id + len - 1;
+
+	/* the notification overwrites uarg, which lives in skb->cb */
+	serr = SKB_EXT_ERR(skb);
+	memset(serr, 0, sizeof(*serr));
+	serr->ee.ee_errno = 0;
+	serr->ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+	serr->ee.ee_data = hi;
+	serr->ee.ee_info = lo;
+	if (!success)
+		serr->ee.ee_code |= SO_EE_CODE_ZEROCOPY_COPIED;
+
+	q = &sk->sk_error_queue;
+	spin_lock_irqsave(&q->lock, flags);
+	tail = skb_peek_tail(q);
+	if (!tail || SKB_EXT_ERR(tail)->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+	    SKB_EXT_ERR(tail)->ee.ee_code != serr->ee.ee_code ||
+	    !skb_zerocopy_notify_extend(tail, lo, len)) {
+		__skb_queue_tail(q, skb);
+		skb = NULL;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	sk->sk_error_report(sk);
+
+release:
+	consume_skb(skb);
+	sock_put(sk);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_callback);
+
+void sock_zerocopy_put(struct ubuf_info *uarg)
+{
+	if (uarg && atomic_dec_and_test(&uarg->refcnt))
+		uarg->callback(uarg, uarg->zerocopy);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put);
+
+/* Undo the sendmsg call accounted in sock_zerocopy_realloc() */
+void sock_zerocopy_put_abort(struct ubuf_info *uarg)
+{
+	if (uarg) {
+		struct sock *sk = skb_from_uarg(uarg)->sk;
+
+		atomic_dec(&sk->sk_zckey);
+		uarg->len--;
+
+		sock_zerocopy_put(uarg);
+	}
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put_abort);
+
+/**
+ *	skb_zerocopy_iter_stream - append user pages to a stream skb
+ *	@sk: socket that owns @skb
+ *	@skb: buffer to append to
+ *	@from: userspace buffer
+ *	@len: number of bytes at @from
+ *	@uarg: completion that tracks the pages
+ *
+ *	Pins the pages backing @from and adds them to the free frag slots
+ *	of @skb, charging the memory to @sk like the copy path does. If
+ *	not all of @len fits, a prefix is appended. Returns the number of
+ *	bytes appended, -EMSGSIZE if @skb has no free frag slot left,
+ *	-EEXIST if @skb is tracked by another completion or -EFAULT. @skb
+ *	is left unmodified on error.
+ */
+int skb_zerocopy_iter_stream(struct sock *sk, struct sk_buff *skb,
+			     const void __user *from, int len,
+			     struct ubuf_info *uarg)
+{
+	struct page *pages[MAX_SKB_FRAGS];
+	unsigned long base = (unsigned long)from;
+	int i = skb_shinfo(skb)->nr_frags;
+	int num_pages, n, copied = 0;
+
+	if (skb_zcopy(skb) && skb_uarg(skb) != uarg)
+		return -EEXIST;
+	if (i >= MAX_SKB_FRAGS)
+		return -EMSGSIZE;
+
+	/* pin no more pages than there are free frag slots */
+	num_pages = ((base & ~PAGE_MASK) + len + ~PAGE_MASK) >> PAGE_SHIFT;
+	if (num_pages > MAX_SKB_FRAGS - i) {
+		num_pages = MAX_SKB_FRAGS - i;
+		len = (num_pages << PAGE_SHIFT) - (base & ~PAGE_MASK);
+	}
+
+	n = get_user_pages_fast(base, num_pages, 0, pages);
+	if (n != num_pages) {
+		while (n > 0)
+			put_page(pages[--n]);
+		return -EFAULT;
+	}
+
+	for (n = 0; n < num_pages; n++) {
+		int off = base & ~PAGE_MASK;
+		int size = min_t(int, len - copied, PAGE_SIZE - off);
+
+		skb_fill_page_desc(skb, i++, pages[n], off, size);
+		base += size;
+		copied += size;
+	}
+
+	skb->len += copied;
+	skb->data_len += copied;
+	skb->truesize += copied;
+	sk->sk_wmem_queued += copied;
+	sk_mem_charge(sk, copied);
+
+	skb_zcopy_set(skb, uarg);
+	return copied;
+}
+EXPORT_SYMBOL_GPL(skb_zerocopy_iter_stream);
+
+/**
+ *	skb_zerocopy_clone - share the zerocopy completion of an skb
+ *	@nskb: buffer that takes over frags of @orig
+ *	@orig: buffer whose frags may be tracked by a completion
+ *	@gfp_mask: allocation priority, 0 if @nskb is known to hold no
+ *		   zerocopy frags of its own
+ *
+ *	Called when frags of @orig are referenced from @nskb, so that the
+ *	pages of a MSG_ZEROCOPY send are not copied merely because an skb
+ *	is split or copied. Returns 0 or a negative error.
+ */
+int skb_zerocopy_clone(struct sk_buff *nskb, struct sk_buff *orig,
+		       gfp_t gfp_mask)
+{
+	if (skb_zcopy(orig)) {
+		if (skb_zcopy(nskb)) {
+			if (!gfp_mask) {
+				WARN_ON_ONCE(1);
+				return -ENOMEM;
+			}
+			if (skb_uarg(nskb) == skb_uarg(orig))
+				return 0;
+			if (skb_copy_ubufs(nskb, GFP_ATOMIC))
+				return -EIO;
+		}
+		skb_zcopy_set(nskb, skb_uarg(orig));
+	}
+	return 0;
+}
+EXPORT_SYMBOL_GPL(skb_zerocopy_clone);
+
 /**
  *	skb_copy_ubufs	-	copy userspace skb frags buffers to kernel
  *	@skb: the skb to modify
@@ -794,7 +1188,6 @@ int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
 	int i;
 	int num_frags = skb_shinfo(skb)->nr_frags;
 	struct page *page, *head = NULL;
-	struct ubuf_info *uarg = skb_shinfo(skb)->destructor_arg;
 
 	for (i = 0; i < num_frags; i++) {
 		u8 *vaddr;
@@ -821,8 +1214,6 @@ int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
 	for (i = 0; i < num_frags; i++)
 		skb_frag_unref(skb, i);
 
-	uarg->callback(uarg, false);
-
 	/* skb frags point to kernel buffers */
 	for (i = num_frags - 1; i >= 0; i--) {
 		__skb_fill_page_desc(skb, i, head, 0,
@@ -830,7 +1221,7 @@ int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
 		head = (struct page *)page_private(head);
 	}
 
-	skb_shinfo(skb)->tx_flags &= ~SKBTX_DEV_ZEROCOPY;
+	skb_zcopy_clear(skb, false);
 	return 0;
 }
 EXPORT_SYMBOL_GPL(skb_copy_ubufs);
@@ -987,7 +1378,8 @@ struct sk_buff *__pskb_copy(struct sk_buff *skb, int headroom, gfp_t gfp_mask)
 	if (skb_shinfo(skb)->nr_frags) {
 		int i;
 
-		if (skb_orphan_frags(skb, gfp_mask)) {
+		if (skb_orphan_frags(skb, gfp_mask) ||
+		    skb_zerocopy_clone(n, skb, gfp_mask)) {
 			kfree_skb(n);
 			n = NULL;
 			goto out;
@@ -1067,6 +1459,9 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 		/* copy this zero copy skb frags */
 		if (skb_orphan_frags(skb, gfp_mask))
 			goto nofrags;
+		/* the new shinfo holds its own reference */
+		if (skb_zcopy(skb))
+			sock_zerocopy_get(skb_uarg(skb));
 		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
 			skb_frag_ref(skb, i);
 
@@ -1788,9 +2183,12 @@ static bool __skb_splice_bits(struct sk_buff *skb, struct pipe_inode_info *pipe,
  * the frag list, if such a thing exists. We'd probably need to recurse to
  * handle that cleanly.
  */
-int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
+int skb_splice_bits(struct sk_buff *skb, struct sock *sk, unsigned int offset,
 		    struct pipe_inode_info *pipe, unsigned int tlen,
-		    unsigned int flags)
+		    unsigned int flags,
+		    ssize_t (*splice_cb)(struct sock *,
+					 struct pipe_inode_info *,
+					 struct splice_pipe_desc *))
 {
 	struct partial_page partial[MAX_SKB_FRAGS];
 	struct page *pages[MAX_SKB_FRAGS];
@@ -1803,7 +2201,6 @@ int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
 		.spd_release = sock_spd_release,
 	};
 	struct sk_buff *frag_iter;
-	struct sock *sk = skb->sk;
 	int ret = 0;
 
 	/*
@@ -1826,23 +2223,131 @@ int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
 	}
 
 done:
-	if (spd.nr_pages) {
-		/*
-		 * Drop the socket lock, otherwise we have reverse
-		 * locking dependencies between sk_lock and i_mutex
-		 * here as compared to sendfile(). We enter here
-		 * with the socket lock held, and splice_to_pipe() will
-		 * grab the pipe inode lock. For sendfile() emulation,
-		 * we call into ->sendpage() with the i_mutex lock held
-		 * and networking will grab the socket lock.
-		 */
-		release_sock(sk);
-		ret = splice_to_pipe(pipe, &spd);
-		lock_sock(sk);
-	}
+	if (spd.nr_pages)
+		ret = splice_cb(sk, pipe, &spd);
 
 	return ret;
 }
+EXPORT_SYMBOL_GPL(skb_splice_bits);
+
+/*
+ * Callback for skb_splice_bits() used by sockets that are read under the
+ * socket lock. Drop the lock, otherwise we have reverse locking
+ * dependencies between sk_lock and i_mutex here as compared to
+ * sendfile(). We enter here with the socket lock held, and
+ * splice_to_pipe() will grab the pipe inode lock. For sendfile()
+ * emulation, we call into ->sendpage() with the i_mutex lock held and
+ * networking will grab the socket lock.
+ */
+ssize_t skb_socket_splice(struct sock *sk,
+			  struct pipe_inode_info *pipe,
+			  struct splice_pipe_desc *spd)
+{
+	int ret;
+
+	release_sock(sk);
+	ret = splice_to_pipe(pipe, spd);
+	lock_sock(sk);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(skb_socket_splice);
+
+/**
+ *	skb_send_sock - send skb data to a socket
+ *	@sock: socket to send on
+ *	@skb: buffer holding the data
+ *	@offset: offset in @skb to start at
+ *	@len: number of bytes to send
+ *	@flags: MSG_ flags for the sends
+ *
+ *	Push @len bytes of @skb out through @sock without bouncing them
+ *	through a pipe. The linear part is copied with kernel_sendmsg(), the
+ *	page fragments are handed to kernel_sendpage() so that protocols
+ *	supporting it take a reference instead of copying. The frag list is
+ *	walked as well. Must be called without the lock of @sock held.
+ *
+ *	Returns the number of bytes sent, or a negative error if nothing
+ *	could be sent.
+ */
+int skb_send_sock(struct socket *sock, struct sk_buff *skb, int offset,
+		  int len, int flags)
+{
+	struct sk_buff *head = skb;
+	int orig_len = len;
+	int fragidx, slen, ret = 0;
+
+do_frag_list:
+	while (offset < skb_headlen(skb) && len) {
+		struct msghdr msg = { .msg_flags = flags };
+		struct kvec kv;
+
+		slen = min_t(int, len, skb_headlen(skb) - offset);
+		kv.iov_base = skb->data + offset;
+		kv.iov_len = slen;
+		if (slen < len)
+			msg.msg_flags |= MSG_MORE;
+
+		ret = kernel_sendmsg(sock, &msg, &kv, 1, slen);
+		if (ret <= 0)
+			goto error;
+		offset += ret;
+		len -= ret;
+	}
+	if (!len)
+		goto out;
+
+	/* Make the offset relative to the start of the frags */
+	offset -= skb_headlen(skb);
+	for (fragidx = 0; fragidx < skb_shinfo(skb)->nr_frags; fragidx++) {
+		int size = skb_frag_size(&skb_shinfo(skb)->frags[fragidx]);
+
+		if (offset < size)
+			break;
+		offset -= size;
+	}
+
+	for (; len && fragidx < skb_shinfo(skb)->nr_frags; fragidx++) {
+		skb_frag_t *frag = &skb_shinfo(skb)->frags[fragidx];
+
+		slen = min_t(int, len, skb_frag_size(frag) - offset);
+		while (slen) {
+			int more = slen < len ? MSG_MORE : 0;
+
+			ret = kernel_sendpage(sock, skb_frag_page(frag),
+					      frag->page_offset + offset,
+					      slen, flags | more);
+			if (ret <= 0)
+				goto error;
+			len -= ret;
+			offset += ret;
+			slen -= ret;
+		}
+		offset = 0;
+	}
+
+	/*
+	 * Whatever is left of the offset once the frags are exhausted
+	 * carries over into the next buffer on the frag list.
+	 */
+	if (len) {
+		if (skb == head) {
+			if (skb_has_frag_list(skb)) {
+				skb = skb_shinfo(skb)->frag_list;
+				goto do_frag_list;
+			}
+		} else if (skb->next) {
+			skb = skb->next;
+			goto do_frag_list;
+		}
+	}
+
+out:
+	return orig_len - len;
+error:
+	return orig_len == len ? ret : orig_len - len;
+}
+EXPORT_SYMBOL_GPL(skb_send_sock);
 
 /**
  *	skb_store_bits - store bits from kernel buffer to skb
@@ -2169,7 +2674,7 @@ skb_zerocopy(struct sk_buff *to, struct sk_buff *from, int len, int hlen)
 	to->len += len + plen;
 	to->data_len += len + plen;
 
-	if (unlikely(skb_orphan_frags(from, GFP_ATOMIC))) {
+	if (unlikely(skb_orphan_frags_rx(from, GFP_ATOMIC))) {
 		skb_tx_error(from);
 		return -ENOMEM;
 	}
@@ -2450,6 +2955,7 @@ void skb_split(struct sk_buff *skb, struct sk_buff *skb1, const u32 len)
 	int pos = skb_headlen(skb);
 
 	skb_shinfo(skb1)->tx_flags = skb_shinfo(skb)->tx_flags & SKBTX_SHARED_FRAG;
+	skb_zerocopy_clone(skb1, skb, 0);
 	if (len < pos)	/* Split line is inside header. */
 		skb_split_inside_header(skb, skb1, len, pos);
 	else		/* Second chunk has no header, nothing to copy. */
@@ -2492,6 +2998,9 @@ int skb_shift(struct sk_buff *tgt, struct sk_buff *skb, int shiftlen)
 	BUG_ON(shiftlen > skb->len);
 	BUG_ON(skb_headlen(skb));	/* Would corrupt stream */
 
+	if (skb_zcopy(tgt) || skb_zcopy(skb))
+		return 0;
+
 	todo = shiftlen;
 	from = 0;
 	to = skb_shinfo(tgt)->nr_frags;
@@ -2828,6 +3337,35 @@ int skb_append_datato_frags(struct sock *sk, struct sk_buff *skb,
 }
 EXPORT_SYMBOL(skb_append_datato_frags);
 
+/**
+ *	skb_append_pagefrags - append a page to the fragments of an skb
+ *	@skb: buffer to extend
+ *	@page: page holding the data
+ *	@offset: offset of the data in @page
+ *	@size: length of the data
+ *
+ *	Takes a reference on @page, unless the data directly follows the
+ *	last fragment, which then just grows. Does not update skb->len,
+ *	data_len or truesize. Returns -EMSGSIZE if no fragment is free.
+ */
+int skb_append_pagefrags(struct sk_buff *skb, struct page *page,
+			 int offset, size_t size)
+{
+	int i = skb_shinfo(skb)->nr_frags;
+
+	if (skb_can_coalesce(skb, i, page, offset)) {
+		skb_frag_size_add(&skb_shinfo(skb)->frags[i - 1], size);
+	} else if (i < MAX_SKB_FRAGS) {
+		get_page(page);
+		skb_fill_page_desc(skb, i, page, offset, size);
+	} else {
+		return -EMSGSIZE;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(skb_append_pagefrags);
+
 /**
  *	skb_pull_rcsum - pull skb and update receive checksum
  *	@skb: buffer to update
@@ -2897,9 +3435,13 @@ struct sk_buff *skb_segment(struct sk_buff *head_skb,
 		int hsize;
 		int size;
 
-		len = head_skb->len - offset;
-		if (len > mss)
-			len = mss;
+		if (unlikely(mss == GSO_BY_FRAGS)) {
+			len = list_skb->len;
+		} else {
+			len = head_skb->len - offset;
+			if (len > mss)
+				len = mss;
+		}
 
 		hsize = skb_headlen(head_skb) - offset;
 		if (hsize < 0)
@@ -3017,7 +3559,9 @@ struct sk_buff *skb_segment(struct sk_buff *head_skb,
 				goto err;
 			}
 
-			if (unlikely(skb_orphan_frags(frag_skb, GFP_ATOMIC)))
+			if (unlikely(skb_orphan_frags(frag_skb, GFP_ATOMIC) ||
+				     skb_zerocopy_clone(nskb, frag_skb,
+							GFP_ATOMIC)))
 				goto err;
 
 			*nskb_frag = *frag;
@@ -3080,6 +3624,10 @@ int skb_gro_receive(struct sk_buff **head, struct sk_buff *skb)
 	lp = NAPI_GRO_CB(p)->last;
 	pinfo = skb_shinfo(lp);
 
+	/* Only stealing pages needs both skbs to agree on recycling. */
+	if (lp->pp_recycle != skb->pp_recycle)
+		goto merge;
+
 	if (headlen <= offset) {
 		skb_frag_t *frag;
 		skb_frag_t *frag2;
@@ -3842,6 +4390,10 @@ bool skb_try_coalesce(struct sk_buff *to, struct sk_buff *from,
 	if (skb_has_frag_list(to) || skb_has_frag_list(from))
 		return false;
 
+	/* Page pool pages must stay with skbs that know to return them. */
+	if (to->pp_recycle != from->pp_recycle)
+		return false;
+
 	if (skb_headlen(from) != 0) {
 		struct page *page;
 		unsigned int offset;
@@ -3940,6 +4492,18 @@ unsigned int skb_gso_transport_seglen(const struct sk_buff *skb)
 	if (likely(shinfo->gso_type & (SKB_GSO_TCPV4 | SKB_GSO_TCPV6)))
 		return tcp_hdrlen(skb) + shinfo->gso_size;
 
+	/* Each frag_list skb is the payload of one segment, the headers
+	 * in the head are copied in front of every one of them.
+	 */
+	if (unlikely(shinfo->gso_size == GSO_BY_FRAGS)) {
+		const struct sk_buff *iter;
+		unsigned int len = 0;
+
+		skb_walk_frags(skb, iter)
+			len = max(len, iter->len);
+		return skb_tail_pointer(skb) - skb_transport_header(skb) + len;
+	}
+
 	/* UFO sets gso_size to the size of the fragmentation
 	 * payload, i.e. the size of the L4 (UDP) header is already
 	 * accounted for.
@@ -229,7 +229,7 @@ static void dccp_v4_err(struct sk_buff *skb, u32 info)
 		return;
 	}
 
-	sk = inet_lookup(net, &dccp_hashinfo,
+	sk = inet_lookup(net, &dccp_hashinfo, NULL, 0,
 			iph->daddr, dh->dccph_dport,
 			iph->saddr, dh->dccph_sport, inet_iif(skb));
 	if (sk == NULL) {
@@ -291,11 +291,12 @@ static void dccp_v4_err(struct sk_buff *skb, u32 info)
 
 	switch (sk->sk_state) {
 		struct request_sock *req , **prev;
+		spinlock_t *lock;
 	case DCCP_LISTEN:
 		if (sock_owned_by_user(sk))
 			goto out;
 		req = inet_csk_search_req(sk, &prev, dh->dccph_dport,
-					  iph->daddr, iph->saddr);
+					  iph->daddr, iph->saddr, &lock);
 		if (!req)
 			goto out;
 
@@ -307,6 +308,7 @@ static void dccp_v4_err(struct sk_buff *skb, u32 info)
 
 		if (!between48(seq, dccp_rsk(req)->dreq_iss,
 				    dccp_rsk(req)->dreq_gss)) {
+			spin_unlock(lock);
 			NET_INC_STATS_BH(net, LINUX_MIB_OUTOFWINDOWICMPS);
 			goto out;
 		}
@@ -317,6 +319,7 @@ static void dccp_v4_err(struct sk_buff *skb, u32 info)
 		 * errors returned from accept().
 		 */
 		inet_csk_reqsk_queue_drop(sk, req, prev);
+		spin_unlock(lock);
 		goto out;
 
 	case DCCP_REQUESTING:
@@ -453,12 +456,17 @@ static struct sock *dccp_v4_hnd_req(struct sock *sk, struct sk_buff *skb)
 	const struct iphdr *iph = ip_hdr(skb);
 	struct sock *nsk;
 	struct request_sock **prev;
+	spinlock_t *lock;
 	/* Find possible connection requests. */
 	struct request_sock *req = inet_csk_search_req(sk, &prev,
 						       dh->dccph_sport,
-						       iph->saddr, iph->daddr);
-	if (req != NULL)
-		return dccp_check_req(sk, skb, req, prev);
+						       iph->saddr, iph->daddr,
+						       &lock);
+	if (req != NULL) {
+		nsk = dccp_check_req(sk, skb, req, prev);
+		spin_unlock(lock);
+		return nsk;
+	}
 
 	nsk = inet_lookup_established(sock_net(sk), &dccp_hashinfo,
 				      iph->saddr, dh->dccph_sport,
@@ -847,7 +855,7 @@ static int dccp_v4_rcv(struct sk_buff *skb)
 
 	/* Step 2:
 	 *	Look up flow ID in table and get corresponding socket */
-	sk = __inet_lookup_skb(&dccp_hashinfo, skb,
+	sk = __inet_lookup_skb(&dccp_hashinfo, skb, __dccp_hdr_len(dh),
 			       dh->dccph_sport, dh->dccph_dport);
 	/*
 	 * Step 2:
@@ -163,13 +163,14 @@ static void dccp_v6_err(struct sk_buff *skb, struct inet6_skb_parm *opt,
 	/* Might be for an request_sock */
 	switch (sk->sk_state) {
 		struct request_sock *req, **prev;
+		spinlock_t *lock;
 	case DCCP_LISTEN:
 		if (sock_owned_by_user(sk))
 			goto out;
 
 		req = inet6_csk_search_req(sk, &prev, dh->dccph_dport,
 					   &hdr->daddr, &hdr->saddr,
-					   inet6_iif(skb));
+					   inet6_iif(skb), &lock);
 		if (req == NULL)
 			goto out;
 
@@ -181,11 +182,13 @@ static void dccp_v6_err(struct sk_buff *skb, struct inet6_skb_parm *opt,
 
 		if (!between48(seq, dccp_rsk(req)->dreq_iss,
 				    dccp_rsk(req)->dreq_gss)) {
+			spin_unlock(lock);
 			NET_INC_STATS_BH(net, LINUX_MIB_OUTOFWINDOWICMPS);
 			goto out;
 		}
 
 		inet_csk_reqsk_queue_drop(sk, req, prev);
+		spin_unlock(lock);
 		goto out;
 
 	case DCCP_REQUESTING:
@@ -332,14 +335,19 @@ static struct sock *dccp_v6_hnd_req(struct sock *sk,struct sk_buff *skb)
 	const struct ipv6hdr *iph = ipv6_hdr(skb);
 	struct sock *nsk;
 	struct request_sock **prev;
+	spinlock_t *lock;
 	/* Find possible connection requests. */
 	struct request_sock *req = inet6_csk_search_req(sk, &prev,
 							dh->dccph_sport,
 							&iph->saddr,
 							&iph->daddr,
-							inet6_iif(skb));
-	if (req != NULL)
-		return dccp_check_req(sk, skb, req, prev);
+							inet6_iif(skb),
+							&lock);
+	if (req != NULL) {
+		nsk = dccp_check_req(sk, skb, req, prev);
+		spin_unlock(lock);
+		return nsk;
+	}
 
 	nsk = __inet6_lookup_established(sock_net(sk), &dccp_hashinfo,
 					 &iph->saddr, dh->dccph_sport,
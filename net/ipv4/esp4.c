@@ -514,12 +514,35 @@ static void esp_destroy(struct xfrm_state *x)
 	crypto_free_aead(aead);
 }
 
+/* Parallelise the AEAD through pcrypt when asked to.  padata hands the
+ * completions back in submission order, so packets leave in sequence.
+ */
+static bool pcrypt __read_mostly;
+module_param(pcrypt, bool, 0644);
+MODULE_PARM_DESC(pcrypt, "Run ESP crypto through the pcrypt template");
+
+static struct crypto_aead *esp_alloc_aead(const char *name)
+{
+	char pname[CRYPTO_MAX_ALG_NAME];
+	struct crypto_aead *aead;
+
+	if (ACCESS_ONCE(pcrypt) &&
+	    snprintf(pname, sizeof(pname), "pcrypt(%s)", name) <
+	    sizeof(pname)) {
+		aead = crypto_alloc_aead(pname, 0, 0);
+		if (!IS_ERR(aead))
+			return aead;
+	}
+
+	return crypto_alloc_aead(name, 0, 0);
+}
+
 static int esp_init_aead(struct xfrm_state *x)
 {
 	struct crypto_aead *aead;
 	int err;
 
-	aead = crypto_alloc_aead(x->aead->alg_name, 0, 0);
+	aead = esp_alloc_aead(x->aead->alg_name);
 	err = PTR_ERR(aead);
 	if (IS_ERR(aead))
 		goto error;
@@ -570,7 +593,7 @@ static int esp_init_authenc(struct xfrm_state *x)
 			goto error;
 	}
 
-	aead = crypto_alloc_aead(authenc_name, 0, 0);
+	aead = esp_alloc_aead(authenc_name);
 	err = PTR_ERR(aead);
 	if (IS_ERR(aead))
 		goto error;
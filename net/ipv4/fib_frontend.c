@@ -43,6 +43,7 @@
 #include <net/sock.h>
 #include <net/arp.h>
 #include <net/ip_fib.h>
+#include <net/nexthop.h>
 #include <net/rtnetlink.h>
 #include <net/xfrm.h>
 
@@ -149,6 +150,43 @@ static void fib_flush(struct net *net)
 		rt_cache_flush(net);
 }
 
+/*
+ * Switch all routes using a nexthop object that is marked dirty over to
+ * fib_infos built from its new state. Either every route is switched or,
+ * on error, none is.
+ * Caller must hold RTNL.
+ */
+int fib_nexthop_rebind(struct net *net)
+{
+	struct fib_table *tb;
+	struct hlist_head *head;
+	LIST_HEAD(map);
+	unsigned int h;
+	int err = 0;
+
+	for (h = 0; h < FIB_TABLE_HASHSZ && !err; h++) {
+		head = &net->ipv4.fib_table_hash[h];
+		hlist_for_each_entry(tb, head, tb_hlist) {
+			err = fib_table_rebind(tb, &map, false);
+			if (err)
+				break;
+		}
+	}
+
+	if (!err) {
+		for (h = 0; h < FIB_TABLE_HASHSZ; h++) {
+			head = &net->ipv4.fib_table_hash[h];
+			hlist_for_each_entry(tb, head, tb_hlist)
+				fib_table_rebind(tb, &map, true);
+		}
+	}
+
+	fib_rebind_release(&map);
+	if (!err)
+		rt_cache_flush(net);
+	return err;
+}
+
 /*
  * Find address type as if only "dev" was present in the system. If
  * on_dev is NULL then all interfaces are taken into consideration.
@@ -531,6 +569,7 @@ const struct nla_policy rtm_ipv4_policy[RTA_MAX + 1] = {
 	[RTA_METRICS]		= { .type = NLA_NESTED },
 	[RTA_MULTIPATH]		= { .len = sizeof(struct rtnexthop) },
 	[RTA_FLOW]		= { .type = NLA_U32 },
+	[RTA_NH_ID]		= { .type = NLA_U32 },
 };
 
 static int rtm_to_fib_config(struct net *net, struct sk_buff *skb,
@@ -596,6 +635,9 @@ static int rtm_to_fib_config(struct net *net, struct sk_buff *skb,
 		case RTA_TABLE:
 			cfg->fc_table = nla_get_u32(attr);
 			break;
+		case RTA_NH_ID:
+			cfg->fc_nh_id = nla_get_u32(attr);
+			break;
 		}
 	}
 
@@ -1176,4 +1218,5 @@ void __init ip_fib_init(void)
 	register_inetaddr_notifier(&fib_inetaddr_notifier);
 
 	fib_trie_init();
+	nexthop_init();
 }
@@ -33,6 +33,8 @@ int fib_dump_info(struct sk_buff *skb, u32 pid, u32 seq, int event, u32 tb_id,
 void rtmsg_fib(int event, __be32 key, struct fib_alias *fa, int dst_len,
 	       u32 tb_id, const struct nl_info *info, unsigned int nlm_flags);
 struct fib_alias *fib_find_alias(struct list_head *fah, u8 tos, u32 prio);
+struct fib_info *fib_rebind_info(struct list_head *map, struct fib_info *fi,
+				 u32 tb_id, __be32 dst, bool commit);
 
 static inline void fib_result_assign(struct fib_result *res,
 				     struct fib_info *fi)
@@ -246,6 +246,8 @@ void fib_release_info(struct fib_info *fi)
 			hlist_del(&nexthop_nh->nh_hash);
 		} endfor_nexthops(fi)
 		fi->fib_dead = 1;
+		if (fi->fib_nh_id)
+			nexthop_unlink_fib_info(fi->fib_net, fi->fib_nh_id);
 		fib_info_put(fi);
 	}
 	spin_unlock_bh(&fib_info_lock);
@@ -315,6 +317,7 @@ static struct fib_info *fib_find_info(const struct fib_info *nfi)
 		    nfi->fib_prefsrc == fi->fib_prefsrc &&
 		    nfi->fib_priority == fi->fib_priority &&
 		    nfi->fib_type == fi->fib_type &&
+		    nfi->fib_nh_id == fi->fib_nh_id &&
 		    memcmp(nfi->fib_metrics, fi->fib_metrics,
 			   sizeof(u32) * RTAX_MAX) == 0 &&
 		    ((nfi->fib_flags ^ fi->fib_flags) & ~RTNH_F_DEAD) == 0 &&
@@ -358,7 +361,8 @@ static inline size_t fib_nlmsg_size(struct fib_info *fi)
 			 + nla_total_size(4) /* RTA_TABLE */
 			 + nla_total_size(4) /* RTA_DST */
 			 + nla_total_size(4) /* RTA_PRIORITY */
-			 + nla_total_size(4); /* RTA_PREFSRC */
+			 + nla_total_size(4) /* RTA_PREFSRC */
+			 + nla_total_size(4); /* RTA_NH_ID */
 
 	/* space for nested metrics */
 	payload += nla_total_size((RTAX_MAX * nla_total_size(4)));
@@ -511,6 +515,9 @@ int fib_nh_match(struct fib_config *cfg, struct fib_info *fi)
 	if (cfg->fc_priority && cfg->fc_priority != fi->fib_priority)
 		return 1;
 
+	if (cfg->fc_nh_id)
+		return cfg->fc_nh_id != fi->fib_nh_id;
+
 	if (cfg->fc_oif || cfg->fc_gw) {
 		if ((!cfg->fc_oif || cfg->fc_oif == fi->fib_nh->nh_oif) &&
 		    (!cfg->fc_gw  || cfg->fc_gw == fi->fib_nh->nh_gw))
@@ -773,7 +780,7 @@ __be32 fib_info_update_nh_saddr(struct net *net, struct fib_nh *nh)
 	return nh->nh_saddr;
 }
 
-struct fib_info *fib_create_info(struct fib_config *cfg)
+static struct fib_info *__fib_create_info(struct fib_config *cfg)
 {
 	int err;
 	struct fib_info *fi = NULL;
@@ -836,6 +843,7 @@ struct fib_info *fib_create_info(struct fib_config *cfg)
 	fi->fib_priority = cfg->fc_priority;
 	fi->fib_prefsrc = cfg->fc_prefsrc;
 	fi->fib_type = cfg->fc_type;
+	fi->fib_nh_id = cfg->fc_nh_id;
 
 	fi->fib_nhs = nhs;
 	change_nexthops(fi) {
@@ -960,6 +968,8 @@ link_it:
 
 	fi->fib_treeref++;
 	atomic_inc(&fi->fib_clntref);
+	if (fi->fib_nh_id)
+		nexthop_link_fib_info(net, fi->fib_nh_id);
 	spin_lock_bh(&fib_info_lock);
 	hlist_add_head(&fi->fib_hash,
 		       &fib_info_hash[fib_info_hashfn(fi)]);
@@ -994,6 +1004,132 @@ failure:
 	return ERR_PTR(err);
 }
 
+struct fib_info *fib_create_info(struct fib_config *cfg)
+{
+	struct fib_config nhcfg;
+	struct fib_info *fi;
+	int err;
+
+	if (!cfg->fc_nh_id)
+		return __fib_create_info(cfg);
+
+	/* Build the route from the current state of its nexthop object,
+	 * on a copy so that the caller still sees what it asked for.
+	 */
+	nhcfg = *cfg;
+	err = nexthop_fib_config(cfg->fc_nlinfo.nl_net, &nhcfg);
+	if (err)
+		return ERR_PTR(err);
+
+	fi = __fib_create_info(&nhcfg);
+	kfree(nhcfg.fc_mp);
+	return fi;
+}
+
+/*
+ * Rebuild fi after its nexthop object changed, for the route to dst in
+ * table tb_id. Everything but the nexthop comes from fi itself.
+ */
+static struct fib_info *fib_rebuild_info(struct fib_info *fi, u32 tb_id,
+					 __be32 dst)
+{
+	struct fib_config cfg = {
+		.fc_protocol	= fi->fib_protocol,
+		.fc_scope	= fi->fib_scope,
+		.fc_type	= fi->fib_type,
+		.fc_table	= tb_id,
+		.fc_dst		= dst,
+		.fc_flags	= fi->fib_flags & ~RTNH_F_DEAD,
+		.fc_priority	= fi->fib_priority,
+		.fc_prefsrc	= fi->fib_prefsrc,
+		.fc_nh_id	= fi->fib_nh_id,
+		.fc_nlinfo	= {
+			.nl_net = fi->fib_net,
+		},
+	};
+	struct fib_info *nfi;
+
+	if (fi->fib_metrics != (u32 *) dst_default_metrics) {
+		struct nlattr *nla;
+		int i;
+
+		cfg.fc_mx = kmalloc(RTAX_MAX * nla_total_size(4), GFP_KERNEL);
+		if (!cfg.fc_mx)
+			return ERR_PTR(-ENOMEM);
+
+		nla = cfg.fc_mx;
+		for (i = 0; i < RTAX_MAX; i++) {
+			if (!fi->fib_metrics[i])
+				continue;
+			nla->nla_type = i + 1;
+			nla->nla_len = nla_attr_size(sizeof(u32));
+			*(u32 *) nla_data(nla) = fi->fib_metrics[i];
+			nla = (struct nlattr *) ((char *) nla +
+						 nla_total_size(sizeof(u32)));
+		}
+		cfg.fc_mx_len = (char *) nla - (char *) cfg.fc_mx;
+	}
+
+	nfi = fib_create_info(&cfg);
+	kfree(cfg.fc_mx);
+	return nfi;
+}
+
+struct fib_rebind {
+	struct list_head	list;
+	struct fib_info		*ofi;
+	struct fib_info		*nfi;
+};
+
+/*
+ * Return the fib_info a route using fi must switch to because its nexthop
+ * object changed, or NULL if fi is not affected. Every distinct fib_info
+ * is rebuilt only once, the result is cached in map until
+ * fib_rebind_release(). With commit set nothing is built anymore, only
+ * the results of the first pass are handed out.
+ */
+struct fib_info *fib_rebind_info(struct list_head *map, struct fib_info *fi,
+				 u32 tb_id, __be32 dst, bool commit)
+{
+	struct fib_rebind *rb;
+	struct fib_info *nfi;
+
+	if (!fi->fib_nh_id || !nexthop_is_dirty(fi->fib_net, fi->fib_nh_id))
+		return NULL;
+
+	list_for_each_entry(rb, map, list) {
+		if (rb->ofi == fi)
+			return rb->nfi;
+	}
+	if (commit)
+		return NULL;
+
+	rb = kmalloc(sizeof(*rb), GFP_KERNEL);
+	if (!rb)
+		return ERR_PTR(-ENOMEM);
+
+	nfi = fib_rebuild_info(fi, tb_id, dst);
+	if (IS_ERR(nfi)) {
+		kfree(rb);
+		return nfi;
+	}
+
+	rb->ofi = fi;
+	rb->nfi = nfi;
+	list_add(&rb->list, map);
+	return nfi;
+}
+
+void fib_rebind_release(struct list_head *map)
+{
+	struct fib_rebind *rb, *tmp;
+
+	list_for_each_entry_safe(rb, tmp, map, list) {
+		fib_release_info(rb->nfi);
+		kfree(rb);
+	}
+}
+
 int fib_dump_info(struct sk_buff *skb, u32 portid, u32 seq, int event,
 		  u32 tb_id, u8 type, __be32 dst, int dst_len, u8 tos,
 		  struct fib_info *fi, unsigned int flags)
@@ -1033,6 +1169,9 @@ int fib_dump_info(struct sk_buff *skb, u32 portid, u32 seq, int event,
 	if (fi->fib_prefsrc &&
 	    nla_put_be32(skb, RTA_PREFSRC, fi->fib_prefsrc))
 		goto nla_put_failure;
+	if (fi->fib_nh_id &&
+	    nla_put_u32(skb, RTA_NH_ID, fi->fib_nh_id))
+		goto nla_put_failure;
 	if (fi->fib_nhs == 1) {
 		if (fi->fib_nh->nh_gw &&
 		    nla_put_be32(skb, RTA_GATEWAY, fi->fib_nh->nh_gw))
@@ -248,6 +248,27 @@ static inline t_key tkey_extract_bits(t_key a, unsigned int offset, unsigned int
 		return 0;
 }
 
+/*
+ * Index of key in the child array of tn. A result of 1 << tn->bits or more
+ * means key differs from tn->key in the bits before tn->pos, i.e. the key
+ * is not below tn.
+ */
+static inline t_key tnode_get_index(t_key key, const struct tnode *tn)
+{
+	return (key ^ tn->key) >> (KEYLENGTH - tn->pos - tn->bits);
+}
+
+/*
+ * Prefixes stored below a node have every bit after their length cleared,
+ * so one of them can only match key if the bits where key and the node key
+ * differ all follow the last set bit of the node key. Returns true when
+ * that is not the case and nothing below the node can match.
+ */
+static inline bool prefix_mismatch(t_key key, t_key prefix)
+{
+	return (key ^ prefix) & (prefix | -prefix);
+}
+
 static inline int tkey_equals(t_key a, t_key b)
 {
 	return a == b;
@@ -334,6 +355,11 @@ static inline int tkey_mismatch(t_key a, int offset, t_key b)
   The rest of the bits, from (n->pos + n->bits) onward, are completely unknown
   at this point.
 
+  tnode_new() clears every bit of a tnode key from n->pos onward, so the "C"
+  and "u" bits above read as zero in n->key. fib_table_lookup() relies on
+  that to compare the skipped bits and extract the child index in one go,
+  see tnode_get_index() and prefix_mismatch().
+
 */
 
 static inline void check_tnode(const struct tnode *tn)
@@ -456,7 +482,7 @@ static struct tnode *tnode_new(t_key key, int pos, int bits)
 		tn->parent = T_TNODE;
 		tn->pos = pos;
 		tn->bits = bits;
-		tn->key = key;
+		tn->key = mask_pfx(key, pos);
 		tn->full_children = 0;
 		tn->empty_children = 1<<bits;
 	}
@@ -1398,16 +1424,11 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 		     struct fib_result *res, int fib_flags)
 {
 	struct trie *t = (struct trie *) tb->tb_data;
-	int ret;
-	struct rt_trie_node *n;
-	struct tnode *pn;
-	unsigned int pos, bits;
 	t_key key = ntohl(flp->daddr);
-	unsigned int chopped_off;
+	struct rt_trie_node *n;
+	struct tnode *pn = NULL;
 	t_key cindex = 0;
-	unsigned int current_prefix_length = KEYLENGTH;
-	struct tnode *cn;
-	t_key pref_mismatch;
+	int ret;
 
 	rcu_read_lock();
 
@@ -1419,166 +1440,78 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 	t->stats.gets++;
 #endif
 
-	/* Just a leaf? */
-	if (IS_LEAF(n)) {
-		ret = check_leaf(tb, t, (struct leaf *)n, key, flp, res, fib_flags);
-		goto found;
-	}
-
-	pn = (struct tnode *) n;
-	chopped_off = 0;
-
-	while (pn) {
-		pos = pn->pos;
-		bits = pn->bits;
-
-		if (!chopped_off)
-			cindex = tkey_extract_bits(mask_pfx(key, current_prefix_length),
-						   pos, bits);
+	/*
+	 * Step 1: walk down for as long as the key matches the skipped bits
+	 * of each tnode, remembering the last tnode we indexed into and the
+	 * index taken there. On the way we only touch each node once.
+	 */
+	while (IS_TNODE(n)) {
+		struct tnode *tn = (struct tnode *)n;
+		t_key index = tnode_get_index(key, tn);
 
-		n = tnode_get_child_rcu(pn, cindex);
+		if (index >> tn->bits)
+			break;
 
-		if (n == NULL) {
+		pn = tn;
+		cindex = index;
+		n = tnode_get_child_rcu(tn, index);
+		if (!n) {
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 			t->stats.null_node_hit++;
 #endif
 			goto backtrace;
 		}
+	}
 
-		if (IS_LEAF(n)) {
-			ret = check_leaf(tb, t, (struct leaf *)n, key, flp, res, fib_flags);
-			if (ret > 0)
-				goto backtrace;
-			goto found;
-		}
-
-		cn = (struct tnode *)n;
-
-		/*
-		 * It's a tnode, and we can do some extra checks here if we
-		 * like, to avoid descending into a dead-end branch.
-		 * This tnode is in the parent's child array at index
-		 * key[p_pos..p_pos+p_bits] but potentially with some bits
-		 * chopped off, so in reality the index may be just a
-		 * subprefix, padded with zero at the end.
-		 * We can also take a look at any skipped bits in this
-		 * tnode - everything up to p_pos is supposed to be ok,
-		 * and the non-chopped bits of the index (se previous
-		 * paragraph) are also guaranteed ok, but the rest is
-		 * considered unknown.
-		 *
-		 * The skipped bits are key[pos+bits..cn->pos].
-		 */
-
-		/* If current_prefix_length < pos+bits, we are already doing
-		 * actual prefix  matching, which means everything from
-		 * pos+(bits-chopped_off) onward must be zero along some
-		 * branch of this subtree - otherwise there is *no* valid
-		 * prefix present. Here we can only check the skipped
-		 * bits. Remember, since we have already indexed into the
-		 * parent's child array, we know that the bits we chopped of
-		 * *are* zero.
-		 */
-
-		/* NOTA BENE: Checking only skipped bits
-		   for the new node here */
-
-		if (current_prefix_length < pos+bits) {
-			if (tkey_extract_bits(cn->key, current_prefix_length,
-						cn->pos - current_prefix_length)
-			    || !(cn->child[0]))
-				goto backtrace;
-		}
-
-		/*
-		 * If chopped_off=0, the index is fully validated and we
-		 * only need to look at the skipped bits for this, the new,
-		 * tnode. What we actually want to do is to find out if
-		 * these skipped bits match our key perfectly, or if we will
-		 * have to count on finding a matching prefix further down,
-		 * because if we do, we would like to have some way of
-		 * verifying the existence of such a prefix at this point.
-		 */
-
-		/* The only thing we can do at this point is to verify that
-		 * any such matching prefix can indeed be a prefix to our
-		 * key, and if the bits in the node we are inspecting that
-		 * do not match our key are not ZERO, this cannot be true.
-		 * Thus, find out where there is a mismatch (before cn->pos)
-		 * and verify that all the mismatching bits are zero in the
-		 * new tnode's key.
-		 */
-
-		/*
-		 * Note: We aren't very concerned about the piece of
-		 * the key that precede pn->pos+pn->bits, since these
-		 * have already been checked. The bits after cn->pos
-		 * aren't checked since these are by definition
-		 * "unknown" at this point. Thus, what we want to see
-		 * is if we are about to enter the "prefix matching"
-		 * state, and in that case verify that the skipped
-		 * bits that will prevail throughout this subtree are
-		 * zero, as they have to be if we are to find a
-		 * matching prefix.
-		 */
-
-		pref_mismatch = mask_pfx(cn->key ^ key, cn->pos);
-
-		/*
-		 * In short: If skipped bits in this node do not match
-		 * the search key, enter the "prefix matching"
-		 * state.directly.
-		 */
-		if (pref_mismatch) {
-			/* fls(x) = __fls(x) + 1 */
-			int mp = KEYLENGTH - __fls(pref_mismatch) - 1;
-
-			if (tkey_extract_bits(cn->key, mp, cn->pos - mp) != 0)
-				goto backtrace;
-
-			if (current_prefix_length >= cn->pos)
-				current_prefix_length = mp;
+	/*
+	 * Step 2: n is a leaf, or a tnode whose skipped bits differ from the
+	 * key. Only prefixes ending before the first differing bit can match
+	 * now, and as their remaining bits are zero they all sit on the
+	 * child[0] path of n.
+	 */
+	for (;;) {
+		if (!prefix_mismatch(key, n->key)) {
+			if (IS_LEAF(n)) {
+				ret = check_leaf(tb, t, (struct leaf *)n, key,
+						 flp, res, fib_flags);
+				if (ret <= 0)
+					goto found;
+			} else {
+				n = tnode_get_child_rcu((struct tnode *)n, 0);
+				if (n)
+					continue;
+			}
 		}
 
-		pn = (struct tnode *)n; /* Descend */
-		chopped_off = 0;
-		continue;
-
 backtrace:
-		chopped_off++;
-
-		/* As zero don't change the child key (cindex) */
-		while ((chopped_off <= pn->bits)
-		       && !(cindex & (1<<(chopped_off-1))))
-			chopped_off++;
-
-		/* Decrease current_... with bits chopped off */
-		if (current_prefix_length > pn->pos + pn->bits - chopped_off)
-			current_prefix_length = pn->pos + pn->bits
-				- chopped_off;
-
 		/*
-		 * Either we do the actual chop off according or if we have
-		 * chopped off all bits in this tnode walk up to our parent.
+		 * Retry with the next shorter prefix: clear the lowest set
+		 * bit of the index taken in pn, climbing up to the parent once
+		 * no bit is left, and continue in step 2 from that child.
 		 */
-
-		if (chopped_off <= pn->bits) {
-			cindex &= ~(1 << (chopped_off-1));
-		} else {
-			struct tnode *parent = node_parent_rcu((struct rt_trie_node *) pn);
-			if (!parent)
-				goto failed;
-
-			/* Get Child's index */
-			cindex = tkey_extract_bits(pn->key, parent->pos, parent->bits);
-			pn = parent;
-			chopped_off = 0;
-
+		do {
+			while (!cindex) {
+				struct tnode *parent;
+
+				if (!pn)
+					goto failed;
+				parent = node_parent_rcu(
+						(struct rt_trie_node *)pn);
+				if (!parent)
+					goto failed;
+
+				/* Get Child's index */
+				cindex = tkey_extract_bits(pn->key, parent->pos,
+							   parent->bits);
+				pn = parent;
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			t->stats.backtrack++;
+				t->stats.backtrack++;
 #endif
-			goto backtrace;
-		}
+			}
+
+			cindex &= cindex - 1;
+			n = tnode_get_child_rcu(pn, cindex);
+		} while (!n);
 	}
 failed:
 	ret = 1;
@@ -1827,6 +1760,43 @@ int fib_table_flush(struct fib_table *tb)
 	return found;
 }
 
+/*
+ * Move the aliases using a changed nexthop object to their rebuilt
+ * fib_info. The first pass (commit false) only builds the new fib_infos
+ * and may fail, the second one cannot.
+ * Caller must hold RTNL.
+ */
+int fib_table_rebind(struct fib_table *tb, struct list_head *map, bool commit)
+{
+	struct trie *t = (struct trie *) tb->tb_data;
+	struct leaf *l;
+
+	for (l = trie_firstleaf(t); l; l = trie_nextleaf(l)) {
+		struct leaf_info *li;
+
+		hlist_for_each_entry(li, &l->list, hlist) {
+			struct fib_alias *fa;
+
+			list_for_each_entry(fa, &li->falh, fa_list) {
+				struct fib_info *fi = fa->fa_info;
+				struct fib_info *nfi;
+
+				nfi = fib_rebind_info(map, fi, tb->tb_id,
+						      htonl(l->key), commit);
+				if (IS_ERR(nfi))
+					return PTR_ERR(nfi);
+				if (!commit || !nfi || nfi == fi)
+					continue;
+
+				nfi->fib_treeref++;
+				rcu_assign_pointer(fa->fa_info, nfi);
+				fib_release_info(fi);
+			}
+		}
+	}
+	return 0;
+}
+
 void fib_free_table(struct fib_table *tb)
 {
 	kfree(tb);
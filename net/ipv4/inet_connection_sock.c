@@ -322,10 +322,9 @@ struct sock *inet_csk_accept(struct sock *sk, int flags, int *err)
 		if (error)
 			goto out_err;
 	}
-	req = reqsk_queue_remove(queue);
+	req = reqsk_queue_remove(queue, sk);
 	newsk = req->sk;
 
-	sk_acceptq_removed(sk);
 	if (sk->sk_protocol == IPPROTO_TCP && queue->fastopenq != NULL) {
 		spin_lock_bh(&queue->fastopenq->lock);
 		if (tcp_rsk(req)->listener) {
@@ -480,17 +479,39 @@ static inline u32 inet_synq_hash(const __be32 raddr, const __be16 rport,
 #define AF_INET_FAMILY(fam) 1
 #endif
 
+/**
+ *	inet_csk_search_req - find a pending connection request of a listener
+ *	@sk: the listening socket
+ *	@prevp: set to the link pointing to the request
+ *	@rport: remote port
+ *	@raddr: remote address
+ *	@laddr: local address
+ *	@lockp: set to the bucket lock of the request
+ *
+ *	Called without the listener lock. When a request is found it is
+ *	returned with *@lockp held, the caller must drop it once it is done
+ *	with the request and *@prevp.
+ */
 struct request_sock *inet_csk_search_req(const struct sock *sk,
 					 struct request_sock ***prevp,
 					 const __be16 rport, const __be32 raddr,
-					 const __be32 laddr)
+					 const __be32 laddr, spinlock_t **lockp)
 {
 	const struct inet_connection_sock *icsk = inet_csk(sk);
-	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
+	struct listen_sock *lopt;
 	struct request_sock *req, **prev;
-
-	for (prev = &lopt->syn_table[inet_synq_hash(raddr, rport, lopt->hash_rnd,
-						    lopt->nr_table_entries)];
+	spinlock_t *lock;
+	u32 hash;
+
+	lopt = ACCESS_ONCE(icsk->icsk_accept_queue.listen_opt);
+	if (lopt == NULL)
+		return NULL;
+
+	hash = inet_synq_hash(raddr, rport, lopt->hash_rnd,
+			      lopt->nr_table_entries);
+	lock = reqsk_queue_lock(lopt, hash);
+	spin_lock(lock);
+	for (prev = &lopt->syn_table[hash];
 	     (req = *prev) != NULL;
 	     prev = &req->dl_next) {
 		const struct inet_request_sock *ireq = inet_rsk(req);
@@ -501,25 +522,46 @@ struct request_sock *inet_csk_search_req(const struct sock *sk,
 		    AF_INET_FAMILY(req->rsk_ops->family)) {
 			WARN_ON(req->sk);
 			*prevp = prev;
-			break;
+			*lockp = lock;
+			return req;
 		}
 	}
+	spin_unlock(lock);
 
-	return req;
+	return NULL;
 }
 EXPORT_SYMBOL_GPL(inet_csk_search_req);
 
+void __inet_csk_reqsk_queue_hash_add(struct sock *sk, struct listen_sock *lopt,
+				     u32 hash, struct request_sock *req,
+				     unsigned long timeout)
+{
+	int prev_qlen = reqsk_queue_hash_req(lopt, hash, req, timeout);
+
+	/* the listener was closed under us */
+	if (unlikely(prev_qlen < 0))
+		reqsk_free(req);
+	else if (prev_qlen == 0)
+		inet_csk_reset_keepalive_timer(sk, timeout);
+}
+EXPORT_SYMBOL_GPL(__inet_csk_reqsk_queue_hash_add);
+
 void inet_csk_reqsk_queue_hash_add(struct sock *sk, struct request_sock *req,
 				   unsigned long timeout)
 {
 	struct inet_connection_sock *icsk = inet_csk(sk);
-	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
-	const u32 h = inet_synq_hash(inet_rsk(req)->ir_rmt_addr,
-				     inet_rsk(req)->ir_rmt_port,
-				     lopt->hash_rnd, lopt->nr_table_entries);
+	struct listen_sock *lopt;
+	u32 h;
 
-	reqsk_queue_hash_req(&icsk->icsk_accept_queue, h, req, timeout);
-	inet_csk_reqsk_queue_added(sk, timeout);
+	lopt = ACCESS_ONCE(icsk->icsk_accept_queue.listen_opt);
+	if (unlikely(lopt == NULL)) {
+		reqsk_free(req);
+		return;
+	}
+	h = inet_synq_hash(inet_rsk(req)->ir_rmt_addr,
+			   inet_rsk(req)->ir_rmt_port,
+			   lopt->hash_rnd, lopt->nr_table_entries);
+	__inet_csk_reqsk_queue_hash_add(sk, lopt, h, req, timeout);
 }
 EXPORT_SYMBOL_GPL(inet_csk_reqsk_queue_hash_add);
 
@@ -571,9 +613,9 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 	int thresh = max_retries;
 	unsigned long now = jiffies;
 	struct request_sock **reqp, *req;
-	int i, budget;
+	int i, budget, qlen;
 
-	if (lopt == NULL || lopt->qlen == 0)
+	if (lopt == NULL || atomic_read(&lopt->qlen) == 0)
 		return;
 
 	/* Normally all the openreqs are young and become mature
@@ -593,11 +635,12 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 	 * embrions; and abort old ones without pity, if old
 	 * ones are about to clog our table.
 	 */
-	if (lopt->qlen>>(lopt->max_qlen_log-1)) {
-		int young = (lopt->qlen_young<<1);
+	qlen = atomic_read(&lopt->qlen);
+	if (qlen>>(lopt->max_qlen_log-1)) {
+		int young = (atomic_read(&lopt->qlen_young)<<1);
 
 		while (thresh > 2) {
-			if (lopt->qlen < young)
+			if (qlen < young)
 				break;
 			thresh--;
 			young <<= 1;
@@ -611,6 +654,9 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 	i = lopt->clock_hand;
 
 	do {
+		spinlock_t *lock = reqsk_queue_lock(lopt, i);
+
+		spin_lock(lock);
 		reqp=&lopt->syn_table[i];
 		while ((req = *reqp) != NULL) {
 			if (time_after_eq(now, req->expires)) {
@@ -627,7 +673,7 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 					unsigned long timeo;
 
 					if (req->num_timeout++ == 0)
-						lopt->qlen_young--;
+						atomic_dec(&lopt->qlen_young);
 					timeo = min(timeout << req->num_timeout,
 						    max_rto);
 					req->expires = now + timeo;
@@ -643,6 +689,7 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 			}
 			reqp = &req->dl_next;
 		}
+		spin_unlock(lock);
 
 		i = (i + 1) & (lopt->nr_table_entries - 1);
 
@@ -650,7 +697,7 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 
 	lopt->clock_hand = i;
 
-	if (lopt->qlen)
+	if (atomic_read(&lopt->qlen))
 		inet_csk_reset_keepalive_timer(parent, interval);
 }
 EXPORT_SYMBOL_GPL(inet_csk_reqsk_queue_prune);
@@ -774,6 +821,71 @@ int inet_csk_listen_start(struct sock *sk, const int nr_table_entries)
 }
 EXPORT_SYMBOL_GPL(inet_csk_listen_start);
 
+/* Close a child that will never be accepted, with the child locked */
+static void inet_child_forget(struct sock *sk, struct request_sock *req,
+			      struct sock *child)
+{
+	sk->sk_prot->disconnect(child, O_NONBLOCK);
+
+	sock_orphan(child);
+
+	percpu_counter_inc(sk->sk_prot->orphan_count);
+
+	if (sk->sk_protocol == IPPROTO_TCP && tcp_rsk(req)->listener) {
+		BUG_ON(tcp_sk(child)->fastopen_rsk != req);
+		BUG_ON(sk != tcp_rsk(req)->listener);
+
+		/* Paranoid, to prevent race condition if
+		 * an inbound pkt destined for child is
+		 * blocked by sock lock in tcp_v4_rcv().
+		 * Also to satisfy an assertion in
+		 * tcp_v4_destroy_sock().
+		 */
+		tcp_sk(child)->fastopen_rsk = NULL;
+		sock_put(sk);
+	}
+	inet_csk_destroy_sock(child);
+}
+
+/**
+ *	inet_csk_reqsk_queue_add - queue an established child for accept()
+ *	@sk: the listening socket
+ *	@req: the request the child was created from
+ *	@child: the new socket, locked
+ *
+ *	Called without the listener lock, which may be closing. Returns false
+ *	if it was, the child is then closed and @req freed, the caller still
+ *	has to unlock and release @child.
+ */
+bool inet_csk_reqsk_queue_add(struct sock *sk, struct request_sock *req,
+			      struct sock *child)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	bool queued = true;
+
+	spin_lock(&queue->rskq_lock);
+	if (unlikely(sk->sk_state != TCP_LISTEN)) {
+		inet_child_forget(sk, req, child);
+		__reqsk_free(req);
+		queued = false;
+	} else {
+		req->sk = child;
+		sk_acceptq_added(sk);
+
+		if (queue->rskq_accept_head == NULL)
+			queue->rskq_accept_head = req;
+		else
+			queue->rskq_accept_tail->dl_next = req;
+
+		queue->rskq_accept_tail = req;
+		req->dl_next = NULL;
+	}
+	spin_unlock(&queue->rskq_lock);
+
+	return queued;
+}
+EXPORT_SYMBOL(inet_csk_reqsk_queue_add);
+
 /*
  *	This routine closes sockets which have been at least partially
  *	opened, but not yet accepted.
@@ -787,8 +899,12 @@ void inet_csk_listen_stop(struct sock *sk)
 
 	inet_csk_delete_keepalive_timer(sk);
 
-	/* make all the listen_opt local to us */
+	/* make all the listen_opt local to us, the listener is no longer
+	 * in TCP_LISTEN so inet_csk_reqsk_queue_add() cannot add to it
+	 */
+	spin_lock_bh(&queue->rskq_lock);
 	acc_req = reqsk_queue_yank_acceptq(queue);
+	spin_unlock_bh(&queue->rskq_lock);
 
 	/* Following specs, it would be better either to send FIN
 	 * (and enter FIN-WAIT-1, it is normal close)
@@ -810,26 +926,7 @@ void inet_csk_listen_stop(struct sock *sk)
 		WARN_ON(sock_owned_by_user(child));
 		sock_hold(child);
 
-		sk->sk_prot->disconnect(child, O_NONBLOCK);
-
-		sock_orphan(child);
-
-		percpu_counter_inc(sk->sk_prot->orphan_count);
-
-		if (sk->sk_protocol == IPPROTO_TCP && tcp_rsk(req)->listener) {
-			BUG_ON(tcp_sk(child)->fastopen_rsk != req);
-			BUG_ON(sk != tcp_rsk(req)->listener);
-
-			/* Paranoid, to prevent race condition if
-			 * an inbound pkt destined for child is
-			 * blocked by sock lock in tcp_v4_rcv().
-			 * Also to satisfy an assertion in
-			 * tcp_v4_destroy_sock().
-			 */
-			tcp_sk(child)->fastopen_rsk = NULL;
-			sock_put(sk);
-		}
-		inet_csk_destroy_sock(child);
+		inet_child_forget(sk, req, child);
 
 		bh_unlock_sock(child);
 		local_bh_enable();
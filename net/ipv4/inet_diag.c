@@ -298,7 +298,7 @@ int inet_diag_dump_one_icsk(struct inet_hashinfo *hashinfo, struct sk_buff *in_s
 
 	err = -EINVAL;
 	if (req->sdiag_family == AF_INET) {
-		sk = inet_lookup(net, hashinfo, req->id.idiag_dst[0],
+		sk = inet_lookup(net, hashinfo, NULL, 0, req->id.idiag_dst[0],
 				 req->id.idiag_dport, req->id.idiag_src[0],
 				 req->id.idiag_sport, req->id.idiag_if);
 	}
@@ -782,10 +782,9 @@ static int inet_diag_dump_reqs(struct sk_buff *skb, struct sock *sk,
 
 	entry.family = sk->sk_family;
 
-	read_lock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
-
+	/* the listener is hashed, ilb->lock keeps lopt around */
 	lopt = icsk->icsk_accept_queue.listen_opt;
-	if (!lopt || !lopt->qlen)
+	if (!lopt || !atomic_read(&lopt->qlen))
 		goto out;
 
 	if (bc != NULL) {
@@ -794,8 +793,11 @@ static int inet_diag_dump_reqs(struct sk_buff *skb, struct sock *sk,
 	}
 
 	for (j = s_j; j < lopt->nr_table_entries; j++) {
-		struct request_sock *req, *head = lopt->syn_table[j];
+		spinlock_t *lock = reqsk_queue_lock(lopt, j);
+		struct request_sock *req, *head;
 
+		spin_lock(lock);
+		head = lopt->syn_table[j];
 		reqnum = 0;
 		for (req = head; req; reqnum++, req = req->dl_next) {
 			struct inet_request_sock *ireq = inet_rsk(req);
@@ -819,18 +821,18 @@ static int inet_diag_dump_reqs(struct sk_buff *skb, struct sock *sk,
 					       NETLINK_CB(cb->skb).portid,
 					       cb->nlh->nlmsg_seq, cb->nlh);
 			if (err < 0) {
+				spin_unlock(lock);
 				cb->args[3] = j + 1;
 				cb->args[4] = reqnum;
 				goto out;
 			}
 		}
+		spin_unlock(lock);
 
 		s_reqnum = 0;
 	}
 
 out:
-	read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
-
 	return err;
 }
 
@@ -309,7 +309,59 @@ drop:
 int sysctl_ip_early_demux __read_mostly = 1;
 EXPORT_SYMBOL(sysctl_ip_early_demux);
 
-static int ip_rcv_finish(struct sk_buff *skb)
+/* Result of the last input route lookup of a batch, see ip_list_rcv().
+ * Packets with the same route keys reuse the route instead of looking
+ * it up again.
+ */
+struct ip_rcv_hint {
+	struct dst_entry		*dst;
+	const struct net_device		*dev;
+	__be32				daddr;
+	__be32				saddr;
+	u32				mark;
+	u8				tos;
+};
+
+static bool ip_rcv_hint_match(const struct ip_rcv_hint *hint,
+			      const struct sk_buff *skb,
+			      const struct iphdr *iph)
+{
+	return hint->dst &&
+	       hint->daddr == iph->daddr &&
+	       hint->saddr == iph->saddr &&
+	       hint->tos == iph->tos &&
+	       hint->mark == skb->mark &&
+	       hint->dev == skb->dev;
+}
+
+/* Only routes found in the nexthop cache are remembered: they are not
+ * refcounted and stay valid for the rest of the RCU read side section
+ * the batch is processed in. Broadcast and multicast routes are left
+ * out as they are never cached anyway.
+ */
+static void ip_rcv_hint_set(struct ip_rcv_hint *hint,
+			    const struct sk_buff *skb,
+			    const struct iphdr *iph)
+{
+	const struct rtable *rt = skb_rtable(skb);
+
+	hint->dst = NULL;
+	if (!skb_dst_is_noref(skb) ||
+	    (rt->rt_type != RTN_UNICAST && rt->rt_type != RTN_LOCAL))
+		return;
+
+	hint->dst = skb_dst(skb);
+	hint->dev = skb->dev;
+	hint->daddr = iph->daddr;
+	hint->saddr = iph->saddr;
+	hint->mark = skb->mark;
+	hint->tos = iph->tos;
+}
+
+/* Everything ip_rcv_finish() does but passing the skb to its route.
+ * On failure the skb is freed and NET_RX_DROP returned.
+ */
+static int ip_rcv_finish_core(struct sk_buff *skb, struct ip_rcv_hint *hint)
 {
 	const struct iphdr *iph = ip_hdr(skb);
 	struct rtable *rt;
@@ -331,15 +383,25 @@ static int ip_rcv_finish(struct sk_buff *skb)
 	 *	how the packet travels inside Linux networking.
 	 */
 	if (!skb_dst(skb)) {
-		int err = ip_route_input_noref(skb, iph->daddr, iph->saddr,
-					       iph->tos, skb->dev);
+		int err;
+
+		if (hint && ip_rcv_hint_match(hint, skb, iph)) {
+			skb_dst_set_noref(skb, hint->dst);
+			goto routed;
+		}
+
+		err = ip_route_input_noref(skb, iph->daddr, iph->saddr,
+					   iph->tos, skb->dev);
 		if (unlikely(err)) {
 			if (err == -EXDEV)
 				NET_INC_STATS_BH(dev_net(skb->dev),
 						 LINUX_MIB_IPRPFILTER);
 			goto drop;
 		}
+		if (hint)
+			ip_rcv_hint_set(hint, skb, iph);
 	}
+routed:
 
 #ifdef CONFIG_IP_ROUTE_CLASSID
 	if (unlikely(skb_dst(skb)->tclassid)) {
@@ -363,17 +425,26 @@ static int ip_rcv_finish(struct sk_buff *skb)
 		IP_UPD_PO_STATS_BH(dev_net(rt->dst.dev), IPSTATS_MIB_INBCAST,
 				skb->len);
 
-	return dst_input(skb);
+	return NET_RX_SUCCESS;
 
 drop:
 	kfree_skb(skb);
 	return NET_RX_DROP;
 }
 
-/*
- * 	Main IP Receive routine.
+static int ip_rcv_finish(struct sk_buff *skb)
+{
+	int ret = ip_rcv_finish_core(skb, NULL);
+
+	if (ret != NET_RX_DROP)
+		ret = dst_input(skb);
+	return ret;
+}
+
+/* Sanity checks of ip_rcv(), returns the skb to go on with or NULL if
+ * it was dropped.
  */
-int ip_rcv(struct sk_buff *skb, struct net_device *dev, struct packet_type *pt, struct net_device *orig_dev)
+static struct sk_buff *ip_rcv_core(struct sk_buff *skb, struct net_device *dev)
 {
 	const struct iphdr *iph;
 	u32 len;
@@ -450,8 +521,7 @@ int ip_rcv(struct sk_buff *skb, struct net_device *dev, struct packet_type *pt,
 	/* Must drop socket now because of tproxy. */
 	skb_orphan(skb);
 
-	return NF_HOOK(NFPROTO_IPV4, NF_INET_PRE_ROUTING, skb, dev, NULL,
-		       ip_rcv_finish);
+	return skb;
 
 csum_error:
 	IP_INC_STATS_BH(dev_net(dev), IPSTATS_MIB_CSUMERRORS);
@@ -460,5 +530,78 @@ inhdr_error:
 drop:
 	kfree_skb(skb);
 out:
-	return NET_RX_DROP;
+	return NULL;
+}
+
+/*
+ * 	Main IP Receive routine.
+ */
+int ip_rcv(struct sk_buff *skb, struct net_device *dev, struct packet_type *pt, struct net_device *orig_dev)
+{
+	skb = ip_rcv_core(skb, dev);
+	if (skb == NULL)
+		return NET_RX_DROP;
+
+	return NF_HOOK(NFPROTO_IPV4, NF_INET_PRE_ROUTING, skb, dev, NULL,
+		       ip_rcv_finish);
+}
+
+static void ip_list_rcv_finish(struct sk_buff_head *head)
+{
+	struct ip_rcv_hint hint = { .dst = NULL };
+	struct sk_buff_head sublist;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&sublist);
+	while ((skb = __skb_dequeue(head)) != NULL)
+		if (ip_rcv_finish_core(skb, &hint) != NET_RX_DROP)
+			__skb_queue_tail(&sublist, skb);
+
+	while ((skb = __skb_dequeue(&sublist)) != NULL)
+		dst_input(skb);
+}
+
+static void ip_sublist_rcv(struct sk_buff_head *head, struct net_device *dev)
+{
+	NF_HOOK_LIST(NFPROTO_IPV4, NF_INET_PRE_ROUTING, head, dev, NULL,
+		     ip_rcv_finish);
+	ip_list_rcv_finish(head);
+}
+
+/**
+ *	ip_list_rcv - receive a batch of IP packets
+ *	@head: list of skbs, emptied on return
+ *	@pt: the packet_type they were received for
+ *	@orig_dev: original receiving device
+ *
+ *	Batched ip_rcv(), the list_func of the IPv4 packet_type. Packets
+ *	are checked one by one, then each run of packets from the same
+ *	device goes through PRE_ROUTING and the route lookup together.
+ *	Consecutive packets with the same addresses, TOS and mark share a
+ *	single input route lookup. Called under rcu_read_lock().
+ */
+void ip_list_rcv(struct sk_buff_head *head, struct packet_type *pt,
+		 struct net_device *orig_dev)
+{
+	struct net_device *curr_dev = NULL;
+	struct sk_buff_head sublist;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&sublist);
+	while ((skb = __skb_dequeue(head)) != NULL) {
+		struct net_device *dev = skb->dev;
+
+		skb = ip_rcv_core(skb, dev);
+		if (skb == NULL)
+			continue;
+
+		if (curr_dev != dev) {
+			if (curr_dev)
+				ip_sublist_rcv(&sublist, curr_dev);
+			curr_dev = dev;
+		}
+		__skb_queue_tail(&sublist, skb);
+	}
+	if (curr_dev)
+		ip_sublist_rcv(&sublist, curr_dev);
 }
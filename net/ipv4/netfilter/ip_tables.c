@@ -25,6 +25,8 @@
 #include <linux/proc_fs.h>
 #include <linux/err.h>
 #include <linux/cpumask.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
 
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter_ipv4/ip_tables.h>
@@ -284,6 +286,102 @@ struct ipt_entry *ipt_next_entry(const struct ipt_entry *entry)
 	return (void *)entry + entry->next_offset;
 }
 
+/*
+ * Rule dispatch.
+ *
+ * A run of consecutive rules that all match on an exact destination
+ * address (-d a.b.c.d/32, not inverted) can only match a packet whose
+ * daddr equals the rule's. For long runs we hash the rules by that
+ * address, so a packet only visits the rules of its own bucket, in rule
+ * order, and then continues after the run. Everything else about the
+ * rules is still evaluated as usual, so this only skips rules that
+ * could not have matched.
+ *
+ * The upper bits of e->comefrom hold the index + 1 of the run a rule
+ * belongs to; the lower ones keep the hook mask, and userspace ignores
+ * the field.
+ */
+#define IPT_RUN_SHIFT		16
+#define IPT_RUN_MAX		((1U << (32 - IPT_RUN_SHIFT)) - 1)
+#define IPT_RUN_MIN_RULES	8
+
+struct ipt_dispatch_run {
+	unsigned int	end;		/* offset of the rule after the run */
+	unsigned int	hmask;
+	unsigned int	*bucket;	/* hmask + 2 indexes into rule[] */
+	unsigned int	*rule;		/* rule offsets, grouped by bucket */
+};
+
+struct ipt_dispatch {
+	unsigned int		nruns;
+	struct ipt_dispatch_run	run[0];
+};
+
+/* Where the current packet is in a run; only valid while e == expect. */
+struct ipt_dispatch_cursor {
+	const struct ipt_entry	*expect;
+	const unsigned int	*next;
+	const unsigned int	*last;
+	unsigned int		end;
+};
+
+static inline unsigned int ipt_entry_run(const struct ipt_entry *e)
+{
+	return e->comefrom >> IPT_RUN_SHIFT;
+}
+
+static inline u32 ipt_dispatch_hash(__be32 addr, unsigned int hmask)
+{
+	return jhash_1word((__force u32)addr, 0) & hmask;
+}
+
+static struct ipt_entry *
+ipt_dispatch_next(const void *table_base, struct ipt_dispatch_cursor *dc)
+{
+	if (dc->next < dc->last) {
+		dc->expect = get_entry(table_base, *dc->next++);
+		return (struct ipt_entry *)dc->expect;
+	}
+	dc->expect = NULL;
+	return get_entry(table_base, dc->end);
+}
+
+/* Entered the run of e: go to the first candidate at or after e. */
+static struct ipt_entry *
+ipt_dispatch_start(const struct ipt_dispatch *d, const void *table_base,
+		   const struct ipt_entry *e, __be32 daddr,
+		   struct ipt_dispatch_cursor *dc)
+{
+	const struct ipt_dispatch_run *run = &d->run[ipt_entry_run(e) - 1];
+	unsigned int off = (void *)e - table_base;
+	u32 h = ipt_dispatch_hash(daddr, run->hmask);
+	const unsigned int *lo = run->rule + run->bucket[h];
+	const unsigned int *hi = run->rule + run->bucket[h + 1];
+
+	dc->last = hi;
+	while (lo < hi) {
+		const unsigned int *mid = lo + (hi - lo) / 2;
+
+		if (*mid < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	dc->next = lo;
+	dc->end = run->end;
+	return ipt_dispatch_next(table_base, dc);
+}
+
+/* The rule to evaluate once e did not end the traversal. */
+static inline struct ipt_entry *
+ipt_next_rule(const void *table_base, struct ipt_entry *e,
+	      struct ipt_dispatch_cursor *dc)
+{
+	if (e == dc->expect)
+		return ipt_dispatch_next(table_base, dc);
+	return ipt_next_entry(e);
+}
+
 /* Returns one of the generic firewall policies, like NF_ACCEPT. */
 unsigned int
 ipt_do_table(struct sk_buff *skb,
@@ -301,6 +399,8 @@ ipt_do_table(struct sk_buff *skb,
 	struct ipt_entry *e, **jumpstack;
 	unsigned int *stackptr, origptr, cpu;
 	const struct xt_table_info *private;
+	const struct ipt_dispatch *dispatch;
+	struct ipt_dispatch_cursor dc = { .expect = NULL };
 	struct xt_action_param acpar;
 	unsigned int addend;
 
@@ -336,6 +436,7 @@ ipt_do_table(struct sk_buff *skb,
 	jumpstack  = (struct ipt_entry **)private->jumpstack[cpu];
 	stackptr   = per_cpu_ptr(private->stackptr, cpu);
 	origptr    = *stackptr;
+	dispatch   = private->dispatch;
 
 	e = get_entry(table_base, private->hook_entry[hook]);
 
@@ -348,10 +449,15 @@ ipt_do_table(struct sk_buff *skb,
 		const struct xt_entry_match *ematch;
 
 		IP_NF_ASSERT(e);
+		if (unlikely(ipt_entry_run(e)) && e != dc.expect) {
+			e = ipt_dispatch_start(dispatch, table_base, e,
+					       ip->daddr, &dc);
+			continue;
+		}
 		if (!ip_packet_match(ip, indev, outdev,
 		    &e->ip, acpar.fragoff)) {
  no_match:
-			e = ipt_next_entry(e);
+			e = ipt_next_rule(table_base, e, &dc);
 			continue;
 		}
 
@@ -377,6 +483,7 @@ ipt_do_table(struct sk_buff *skb,
 		if (!t->u.kernel.target->target) {
 			int v;
 
+			dc.expect = NULL;
 			v = ((struct xt_standard_target *)t)->verdict;
 			if (v < 0) {
 				/* Pop from stack? */
@@ -416,8 +523,9 @@ ipt_do_table(struct sk_buff *skb,
 		acpar.targinfo = t->data;
 
 		verdict = t->u.kernel.target->target(skb, &acpar);
-		/* Target might have changed stuff. */
+		/* Target might have changed stuff, daddr included. */
 		ip = ip_hdr(skb);
+		dc.expect = NULL;
 		if (verdict == XT_CONTINUE)
 			e = ipt_next_entry(e);
 		else
@@ -787,6 +895,112 @@ cleanup_entry(struct ipt_entry *e, struct net *net)
 	module_put(par.target->me);
 }
 
+static bool ipt_dispatch_eligible(const struct ipt_entry *e)
+{
+	return e->ip.dmsk.s_addr == htonl(0xFFFFFFFF) &&
+	       !(e->ip.invflags & IPT_INV_DSTIP);
+}
+
+static void ipt_fill_run(struct ipt_dispatch_run *run, void *entry0,
+			 struct ipt_entry *start, struct ipt_entry *end,
+			 unsigned int len, unsigned int **slot)
+{
+	unsigned int hsize = roundup_pow_of_two(len);
+	struct ipt_entry *e;
+	unsigned int i;
+
+	run->end = (void *)end - entry0;
+	run->hmask = hsize - 1;
+	run->bucket = *slot;
+	run->rule = run->bucket + hsize + 1;
+	*slot = run->rule + len;
+
+	/* Count the rules of each bucket, then turn that into bucket starts */
+	for (e = start; e != end; e = ipt_next_entry(e)) {
+		u32 h = ipt_dispatch_hash(e->ip.dst.s_addr, run->hmask);
+
+		run->bucket[h + 1]++;
+	}
+	for (i = 1; i <= hsize; i++)
+		run->bucket[i] += run->bucket[i - 1];
+
+	/* Filling in rule order keeps every bucket sorted by offset */
+	for (e = start; e != end; e = ipt_next_entry(e)) {
+		u32 h = ipt_dispatch_hash(e->ip.dst.s_addr, run->hmask);
+
+		run->rule[run->bucket[h]++] = (void *)e - entry0;
+	}
+	for (i = hsize - 1; i > 0; i--)
+		run->bucket[i] = run->bucket[i - 1];
+	run->bucket[0] = 0;
+}
+
+/*
+ * Find the runs of exact destination rules in a checked table, tag their
+ * rules and build the run hashes. Without memory the table simply runs
+ * without dispatch. A run only ends at a rule that is not part of it, so
+ * the rule after a run always exists.
+ */
+static void ipt_build_dispatch(struct xt_table_info *newinfo, void *entry0)
+{
+	unsigned int nruns = 0, nrules = 0, nbuckets = 0, len = 0;
+	struct ipt_entry *iter, *start = NULL;
+	struct ipt_dispatch *d;
+	unsigned int *slot;
+	size_t size;
+
+	xt_entry_foreach(iter, entry0, newinfo->size) {
+		if (ipt_dispatch_eligible(iter)) {
+			len++;
+			continue;
+		}
+		if (len >= IPT_RUN_MIN_RULES && nruns < IPT_RUN_MAX) {
+			nruns++;
+			nrules += len;
+			nbuckets += roundup_pow_of_two(len) + 1;
+		}
+		len = 0;
+	}
+	if (!nruns)
+		return;
+
+	size = sizeof(*d) + nruns * sizeof(d->run[0]) +
+	       (nbuckets + nrules) * sizeof(unsigned int);
+	if (size <= PAGE_SIZE)
+		d = kzalloc(size, GFP_KERNEL);
+	else
+		d = vzalloc(size);
+	if (!d)
+		return;
+
+	slot = (unsigned int *)&d->run[nruns];
+	len = 0;
+	xt_entry_foreach(iter, entry0, newinfo->size) {
+		struct ipt_entry *e;
+
+		if (ipt_dispatch_eligible(iter)) {
+			if (!len++)
+				start = iter;
+			continue;
+		}
+		if (len >= IPT_RUN_MIN_RULES && d->nruns < nruns) {
+			ipt_fill_run(&d->run[d->nruns], entry0, start, iter,
+				     len, &slot);
+			d->nruns++;
+			for (e = start; e != iter; e = ipt_next_entry(e))
+				e->comefrom |= d->nruns << IPT_RUN_SHIFT;
+		}
+		len = 0;
+	}
+	newinfo->dispatch = d;
+}
+
+static void ipt_free_table_info(struct xt_table_info *info)
+{
+	kvfree(info->dispatch);
+	xt_free_table_info(info);
+}
+
 /* Checks and translates the user-supplied table segment (held in
    newinfo) */
 static int
@@ -867,6 +1081,8 @@ translate_table(struct net *net, struct xt_table_info *newinfo, void *entry0,
 		return ret;
 	}
 
+	ipt_build_dispatch(newinfo, entry0);
+
 	/* And one copy for every other CPU */
 	for_each_possible_cpu(i) {
 		if (newinfo->entries[i] && newinfo->entries[i] != entry0)
@@ -1229,7 +1445,7 @@ __do_replace(struct net *net, const char *name, unsigned int valid_hooks,
 	xt_entry_foreach(iter, loc_cpu_old_entry, oldinfo->size)
 		cleanup_entry(iter, net);
 
-	xt_free_table_info(oldinfo);
+	ipt_free_table_info(oldinfo);
 	if (copy_to_user(counters_ptr, counters,
 			 sizeof(struct xt_counters) * num_counters) != 0) {
 		/* Silent error, can't fail, new table is already in place */
@@ -1293,7 +1509,7 @@ do_replace(struct net *net, const void __user *user, unsigned int len)
 	xt_entry_foreach(iter, loc_cpu_entry, newinfo->size)
 		cleanup_entry(iter, net);
  free_newinfo:
-	xt_free_table_info(newinfo);
+	ipt_free_table_info(newinfo);
 	return ret;
 }
 
@@ -1764,10 +1980,12 @@ translate_compat_table(struct net *net,
 				break;
 			cleanup_entry(iter1, net);
 		}
-		xt_free_table_info(newinfo);
+		ipt_free_table_info(newinfo);
 		return ret;
 	}
 
+	ipt_build_dispatch(newinfo, entry1);
+
 	/* And one copy for every other CPU */
 	for_each_possible_cpu(i)
 		if (newinfo->entries[i] && newinfo->entries[i] != entry1)
@@ -1775,11 +1993,11 @@ translate_compat_table(struct net *net,
 
 	*pinfo = newinfo;
 	*pentry0 = entry1;
-	xt_free_table_info(info);
+	ipt_free_table_info(info);
 	return 0;
 
 free_newinfo:
-	xt_free_table_info(newinfo);
+	ipt_free_table_info(newinfo);
 out:
 	xt_entry_foreach(iter0, entry0, total_size) {
 		if (j-- == 0)
@@ -1843,7 +2061,7 @@ compat_do_replace(struct net *net, void __user *user, unsigned int len)
 	xt_entry_foreach(iter, loc_cpu_entry, newinfo->size)
 		cleanup_entry(iter, net);
  free_newinfo:
-	xt_free_table_info(newinfo);
+	ipt_free_table_info(newinfo);
 	return ret;
 }
 
@@ -2095,7 +2313,7 @@ struct xt_table *ipt_register_table(struct net *net,
 	return new_table;
 
 out_free:
-	xt_free_table_info(newinfo);
+	ipt_free_table_info(newinfo);
 out:
 	return ERR_PTR(ret);
 }
@@ -2115,7 +2333,7 @@ void ipt_unregister_table(struct net *net, struct xt_table *table)
 		cleanup_entry(iter, net);
 	if (private->number > private->initial_entries)
 		module_put(table_owner);
-	xt_free_table_info(private);
+	ipt_free_table_info(private);
 }
 
 /* Returns 1 if the type and code is matched by the range, 0 otherwise */
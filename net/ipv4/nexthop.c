@@ -0,0 +1,788 @@
+/*
+ * IPv4 nexthop objects.
+ *
+ * A nexthop object is a gateway/device pair, or a weighted group of those,
+ * managed through RTM_NEWNEXTHOP, RTM_DELNEXTHOP and RTM_GETNEXTHOP. Routes
+ * added with RTA_NH_ID take their nexthops from the object instead of from
+ * their own attributes, so replacing the object moves all of them over to
+ * the new path with a single message.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/netdevice.h>
+#include <linux/rtnetlink.h>
+#include <net/net_namespace.h>
+#include <net/sock.h>
+#include <net/netlink.h>
+#include <net/ip_fib.h>
+#include <net/nexthop.h>
+
+#define NH_HASH_BITS	8
+#define NH_HASH_SIZE	(1U << NH_HASH_BITS)
+
+static const struct nla_policy rtm_nh_policy[NHA_MAX + 1] = {
+	[NHA_ID]		= { .type = NLA_U32 },
+	[NHA_GROUP]		= { .type = NLA_BINARY },
+	[NHA_GROUP_TYPE]	= { .type = NLA_U16 },
+	[NHA_OIF]		= { .type = NLA_U32 },
+	[NHA_GATEWAY]		= { .type = NLA_U32 },
+	[NHA_GROUPS]		= { .type = NLA_FLAG },
+};
+
+struct nh_config {
+	u32		nh_id;
+	u8		nh_family;
+	u8		nh_protocol;
+	u32		nh_flags;
+	int		nh_oif;
+	__be32		nh_gw;
+	struct nlattr	*nh_grp;
+	u16		nh_grp_type;
+	struct nl_info	nlinfo;
+};
+
+static struct hlist_head *nh_head(struct net *net, u32 id)
+{
+	return &net->ipv4.nexthop_hash[hash_32(id, NH_HASH_BITS)];
+}
+
+static struct nexthop *nexthop_find_by_id(struct net *net, u32 id)
+{
+	struct nexthop *nh;
+
+	/* fib_infos may outlive the table on namespace exit */
+	if (!net->ipv4.nexthop_hash)
+		return NULL;
+
+	hlist_for_each_entry(nh, nh_head(net, id), nh_hash) {
+		if (nh->id == id)
+			return nh;
+	}
+	return NULL;
+}
+
+bool nexthop_is_dirty(struct net *net, u32 id)
+{
+	struct nexthop *nh = nexthop_find_by_id(net, id);
+
+	return nh && nh->dirty;
+}
+
+void nexthop_link_fib_info(struct net *net, u32 id)
+{
+	struct nexthop *nh = nexthop_find_by_id(net, id);
+
+	if (nh)
+		nh->fi_refcnt++;
+}
+
+void nexthop_unlink_fib_info(struct net *net, u32 id)
+{
+	struct nexthop *nh = nexthop_find_by_id(net, id);
+
+	if (nh && !WARN_ON(!nh->fi_refcnt))
+		nh->fi_refcnt--;
+}
+
+#ifdef CONFIG_IP_ROUTE_MULTIPATH
+/* Express the group as the RTA_MULTIPATH blob fib_create_info() expects. */
+static int nh_group_fib_config(struct nexthop *nh, struct fib_config *cfg)
+{
+	struct rtnexthop *rtnh;
+	int i, len = 0;
+
+	for (i = 0; i < nh->num_nh; i++) {
+		len += NLA_ALIGN(sizeof(*rtnh));
+		if (nh->nh_entries[i].nh->gw)
+			len += nla_total_size(4);
+	}
+
+	rtnh = kzalloc(len, GFP_KERNEL);
+	if (!rtnh)
+		return -ENOMEM;
+	cfg->fc_mp = rtnh;
+	cfg->fc_mp_len = len;
+
+	for (i = 0; i < nh->num_nh; i++) {
+		struct nexthop *nhe = nh->nh_entries[i].nh;
+
+		rtnh->rtnh_len = NLA_ALIGN(sizeof(*rtnh));
+		rtnh->rtnh_flags = nhe->flags;
+		rtnh->rtnh_hops = nh->nh_entries[i].weight - 1;
+		rtnh->rtnh_ifindex = nhe->oif;
+		if (nhe->gw) {
+			struct nlattr *nla = rtnh_attrs(rtnh);
+
+			nla->nla_type = RTA_GATEWAY;
+			nla->nla_len = nla_attr_size(4);
+			*(__be32 *) nla_data(nla) = nhe->gw;
+			rtnh->rtnh_len += nla_total_size(4);
+		}
+		rtnh = (struct rtnexthop *) ((char *) rtnh + rtnh->rtnh_len);
+	}
+	return 0;
+}
+#else
+static int nh_group_fib_config(struct nexthop *nh, struct fib_config *cfg)
+{
+	return -EOPNOTSUPP;
+}
+#endif
+
+/*
+ * Fill in the nexthop part of a route referencing cfg->fc_nh_id. A route
+ * either names an object or carries its own nexthops, never both.
+ * On success cfg->fc_mp, if set, must be freed by the caller.
+ */
+int nexthop_fib_config(struct net *net, struct fib_config *cfg)
+{
+	struct nexthop *nh = nexthop_find_by_id(net, cfg->fc_nh_id);
+
+	if (!nh)
+		return -EINVAL;
+	if (cfg->fc_oif || cfg->fc_gw || cfg->fc_mp || cfg->fc_flow)
+		return -EINVAL;
+
+	cfg->fc_flags &= ~RTNH_F_ONLINK;
+	if (nh->is_group)
+		return nh_group_fib_config(nh, cfg);
+
+	cfg->fc_oif = nh->oif;
+	cfg->fc_gw = nh->gw;
+	cfg->fc_flags |= nh->flags;
+	return 0;
+}
+
+static size_t nh_nlmsg_size(struct nexthop *nh)
+{
+	size_t sz = NLMSG_ALIGN(sizeof(struct nhmsg))
+		    + nla_total_size(4); /* NHA_ID */
+
+	if (nh->is_group)
+		sz += nla_total_size(nh->num_nh * sizeof(struct nexthop_grp))
+		      + nla_total_size(2); /* NHA_GROUP_TYPE */
+	else
+		sz += nla_total_size(4) /* NHA_OIF */
+		      + nla_total_size(4); /* NHA_GATEWAY */
+	return sz;
+}
+
+static int nh_fill_node(struct sk_buff *skb, struct nexthop *nh, int event,
+			u32 portid, u32 seq, unsigned int nlflags)
+{
+	struct nlmsghdr *nlh;
+	struct nhmsg *nhm;
+
+	nlh = nlmsg_put(skb, portid, seq, event, sizeof(*nhm), nlflags);
+	if (nlh == NULL)
+		return -EMSGSIZE;
+
+	nhm = nlmsg_data(nlh);
+	nhm->nh_family = nh->is_group ? AF_UNSPEC : AF_INET;
+	nhm->nh_scope = nh->gw || nh->is_group ? RT_SCOPE_UNIVERSE :
+						 RT_SCOPE_LINK;
+	nhm->nh_protocol = nh->protocol;
+	nhm->resvd = 0;
+	nhm->nh_flags = nh->flags;
+
+	if (nla_put_u32(skb, NHA_ID, nh->id))
+		goto nla_put_failure;
+
+	if (nh->is_group) {
+		struct nexthop_grp *p;
+		struct nlattr *nla;
+		int i;
+
+		nla = nla_reserve(skb, NHA_GROUP, nh->num_nh * sizeof(*p));
+		if (nla == NULL)
+			goto nla_put_failure;
+		p = nla_data(nla);
+		for (i = 0; i < nh->num_nh; i++, p++) {
+			p->id = nh->nh_entries[i].nh->id;
+			p->weight = nh->nh_entries[i].weight - 1;
+			p->resvd1 = 0;
+			p->resvd2 = 0;
+		}
+		if (nla_put_u16(skb, NHA_GROUP_TYPE, NEXTHOP_GRP_TYPE_MPATH))
+			goto nla_put_failure;
+	} else {
+		if (nla_put_u32(skb, NHA_OIF, nh->oif))
+			goto nla_put_failure;
+		if (nh->gw && nla_put_be32(skb, NHA_GATEWAY, nh->gw))
+			goto nla_put_failure;
+	}
+
+	return nlmsg_end(skb, nlh);
+
+nla_put_failure:
+	nlmsg_cancel(skb, nlh);
+	return -EMSGSIZE;
+}
+
+static void nexthop_notify(int event, struct nexthop *nh,
+			   const struct nl_info *info)
+{
+	u32 seq = info->nlh ? info->nlh->nlmsg_seq : 0;
+	struct sk_buff *skb;
+	int err = -ENOBUFS;
+
+	skb = nlmsg_new(nh_nlmsg_size(nh), GFP_KERNEL);
+	if (skb == NULL)
+		goto errout;
+
+	err = nh_fill_node(skb, nh, event, info->portid, seq, 0);
+	if (err < 0) {
+		/* -EMSGSIZE implies BUG in nh_nlmsg_size() */
+		WARN_ON(err == -EMSGSIZE);
+		kfree_skb(skb);
+		goto errout;
+	}
+	rtnl_notify(skb, info->nl_net, info->portid, RTNLGRP_NEXTHOP,
+		    info->nlh, GFP_KERNEL);
+	return;
+errout:
+	rtnl_set_sk_err(info->nl_net, RTNLGRP_NEXTHOP, err);
+}
+
+static bool nh_group_has(struct nexthop *grp, struct nexthop *nh)
+{
+	int i;
+
+	for (i = 0; i < grp->num_nh; i++) {
+		if (grp->nh_entries[i].nh == nh)
+			return true;
+	}
+	return false;
+}
+
+/* Flag nh, and every group it is a member of, for fib_nexthop_rebind(). */
+static void nh_mark_dirty(struct net *net, struct nexthop *nh, bool dirty)
+{
+	struct nexthop *grp;
+	unsigned int h;
+
+	nh->dirty = dirty;
+	if (nh->is_group || !nh->grp_refcnt)
+		return;
+
+	for (h = 0; h < NH_HASH_SIZE; h++) {
+		hlist_for_each_entry(grp, &net->ipv4.nexthop_hash[h], nh_hash) {
+			if (grp->is_group && nh_group_has(grp, nh))
+				grp->dirty = dirty;
+		}
+	}
+}
+
+static int nh_check_group(struct net *net, struct nlattr *attr)
+{
+#ifdef CONFIG_IP_ROUTE_MULTIPATH
+	struct nexthop_grp *nhg = nla_data(attr);
+	int len = nla_len(attr);
+	int i, j;
+
+	if (!len || len % sizeof(*nhg))
+		return -EINVAL;
+
+	len /= sizeof(*nhg);
+	for (i = 0; i < len; i++) {
+		struct nexthop *nh;
+
+		if (nhg[i].resvd1 || nhg[i].resvd2)
+			return -EINVAL;
+
+		nh = nexthop_find_by_id(net, nhg[i].id);
+		if (!nh || nh->is_group)
+			return -EINVAL;
+
+		for (j = i + 1; j < len; j++) {
+			if (nhg[i].id == nhg[j].id)
+				return -EINVAL;
+		}
+	}
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+static int rtm_to_nh_config(struct net *net, struct sk_buff *skb,
+			    struct nlmsghdr *nlh, struct nh_config *cfg)
+{
+	struct nlattr *tb[NHA_MAX + 1];
+	struct nhmsg *nhm;
+	int err;
+
+	err = nlmsg_parse(nlh, sizeof(*nhm), tb, NHA_MAX, rtm_nh_policy);
+	if (err < 0)
+		return err;
+
+	nhm = nlmsg_data(nlh);
+	if (nhm->nh_scope || nhm->resvd || nhm->nh_flags & ~RTNH_F_ONLINK)
+		return -EINVAL;
+	if (tb[NHA_GROUPS])
+		return -EINVAL;
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->nh_family = nhm->nh_family;
+	cfg->nh_protocol = nhm->nh_protocol;
+	cfg->nh_flags = nhm->nh_flags;
+	cfg->nlinfo.portid = NETLINK_CB(skb).portid;
+	cfg->nlinfo.nlh = nlh;
+	cfg->nlinfo.nl_net = net;
+
+	if (tb[NHA_ID])
+		cfg->nh_id = nla_get_u32(tb[NHA_ID]);
+
+	if (tb[NHA_GROUP]) {
+		if (cfg->nh_family != AF_UNSPEC || cfg->nh_flags ||
+		    tb[NHA_OIF] || tb[NHA_GATEWAY])
+			return -EINVAL;
+
+		cfg->nh_grp = tb[NHA_GROUP];
+		if (tb[NHA_GROUP_TYPE])
+			cfg->nh_grp_type = nla_get_u16(tb[NHA_GROUP_TYPE]);
+		if (cfg->nh_grp_type > NEXTHOP_GRP_TYPE_MAX)
+			return -EINVAL;
+
+		return nh_check_group(net, cfg->nh_grp);
+	}
+
+	if (cfg->nh_family != AF_INET || !tb[NHA_OIF] || tb[NHA_GROUP_TYPE])
+		return -EINVAL;
+
+	cfg->nh_oif = nla_get_u32(tb[NHA_OIF]);
+	if (!__dev_get_by_index(net, cfg->nh_oif))
+		return -ENODEV;
+
+	if (tb[NHA_GATEWAY])
+		cfg->nh_gw = nla_get_be32(tb[NHA_GATEWAY]);
+
+	return 0;
+}
+
+static void nexthop_free(struct nexthop *nh)
+{
+	int i;
+
+	for (i = 0; i < nh->num_nh; i++)
+		nh->nh_entries[i].nh->grp_refcnt--;
+	kfree(nh->nh_entries);
+	kfree(nh);
+}
+
+/* Build an unhashed nexthop from a validated configuration. */
+static struct nexthop *nexthop_create(struct net *net, struct nh_config *cfg)
+{
+	struct nexthop *nh;
+
+	nh = kzalloc(sizeof(*nh), GFP_KERNEL);
+	if (!nh)
+		return ERR_PTR(-ENOMEM);
+
+	nh->id = cfg->nh_id;
+	nh->protocol = cfg->nh_protocol;
+
+	if (cfg->nh_grp) {
+		struct nexthop_grp *nhg = nla_data(cfg->nh_grp);
+		int i, len = nla_len(cfg->nh_grp) / sizeof(*nhg);
+
+		nh->nh_entries = kcalloc(len, sizeof(*nh->nh_entries),
+					 GFP_KERNEL);
+		if (!nh->nh_entries) {
+			kfree(nh);
+			return ERR_PTR(-ENOMEM);
+		}
+
+		nh->is_group = true;
+		for (i = 0; i < len; i++) {
+			struct nexthop *nhe;
+
+			nhe = nexthop_find_by_id(net, nhg[i].id);
+			nhe->grp_refcnt++;
+			nh->nh_entries[i].nh = nhe;
+			nh->nh_entries[i].weight = nhg[i].weight + 1;
+		}
+		nh->num_nh = len;
+	} else {
+		nh->oif = cfg->nh_oif;
+		nh->gw = cfg->nh_gw;
+		nh->flags = cfg->nh_flags;
+	}
+
+	return nh;
+}
+
+static void nh_swap_config(struct nexthop *a, struct nexthop *b)
+{
+	swap(a->protocol, b->protocol);
+	swap(a->oif, b->oif);
+	swap(a->gw, b->gw);
+	swap(a->flags, b->flags);
+	swap(a->num_nh, b->num_nh);
+	swap(a->nh_entries, b->nh_entries);
+}
+
+/*
+ * Give old the configuration in cfg and move every route using it, directly
+ * or through a group, to the new path. Routes are rebuilt before anything
+ * is switched, so on failure the object and all routes stay as they were.
+ */
+static int replace_nexthop(struct net *net, struct nexthop *old,
+			   struct nh_config *cfg)
+{
+	struct nexthop *new;
+	int err = 0;
+
+	if (!!cfg->nh_grp != old->is_group)
+		return -EINVAL;
+
+	new = nexthop_create(net, cfg);
+	if (IS_ERR(new))
+		return PTR_ERR(new);
+
+	nh_swap_config(old, new);
+	if (old->fi_refcnt || old->grp_refcnt) {
+		nh_mark_dirty(net, old, true);
+		err = fib_nexthop_rebind(net);
+		nh_mark_dirty(net, old, false);
+		if (err)
+			nh_swap_config(old, new);
+	}
+
+	/* new holds whichever configuration is no longer in use */
+	nexthop_free(new);
+	return err;
+}
+
+static u32 nh_find_unused_id(struct net *net)
+{
+	u32 id_start = net->ipv4.nexthop_last_id;
+
+	while (1) {
+		net->ipv4.nexthop_last_id++;
+		if (net->ipv4.nexthop_last_id == id_start)
+			return 0;
+		if (!net->ipv4.nexthop_last_id)
+			continue;
+		if (!nexthop_find_by_id(net, net->ipv4.nexthop_last_id))
+			return net->ipv4.nexthop_last_id;
+	}
+}
+
+static int rtm_new_nexthop(struct sk_buff *skb, struct nlmsghdr *nlh)
+{
+	struct net *net = sock_net(skb->sk);
+	struct nh_config cfg;
+	struct nexthop *nh = NULL;
+	int err;
+
+	err = rtm_to_nh_config(net, skb, nlh, &cfg);
+	if (err)
+		return err;
+
+	if (cfg.nh_id)
+		nh = nexthop_find_by_id(net, cfg.nh_id);
+
+	if (nh) {
+		if (nlh->nlmsg_flags & NLM_F_EXCL ||
+		    !(nlh->nlmsg_flags & NLM_F_REPLACE))
+			return -EEXIST;
+
+		err = replace_nexthop(net, nh, &cfg);
+		if (err)
+			return err;
+	} else {
+		if (!(nlh->nlmsg_flags & NLM_F_CREATE))
+			return -ENOENT;
+
+		if (!cfg.nh_id) {
+			cfg.nh_id = nh_find_unused_id(net);
+			if (!cfg.nh_id)
+				return -ENOSPC;
+		}
+
+		nh = nexthop_create(net, &cfg);
+		if (IS_ERR(nh))
+			return PTR_ERR(nh);
+		hlist_add_head(&nh->nh_hash, nh_head(net, nh->id));
+	}
+
+	nexthop_notify(RTM_NEWNEXTHOP, nh, &cfg.nlinfo);
+	return 0;
+}
+
+static int nh_valid_get_del_req(struct nlmsghdr *nlh, u32 *id)
+{
+	struct nlattr *tb[NHA_MAX + 1];
+	struct nhmsg *nhm;
+	int err, i;
+
+	err = nlmsg_parse(nlh, sizeof(*nhm), tb, NHA_MAX, rtm_nh_policy);
+	if (err < 0)
+		return err;
+
+	nhm = nlmsg_data(nlh);
+	if (nhm->nh_scope || nhm->resvd || nhm->nh_flags || nhm->nh_protocol)
+		return -EINVAL;
+
+	for (i = 0; i <= NHA_MAX; i++) {
+		if (tb[i] && i != NHA_ID)
+			return -EINVAL;
+	}
+	if (!tb[NHA_ID])
+		return -EINVAL;
+
+	*id = nla_get_u32(tb[NHA_ID]);
+	return *id ? 0 : -EINVAL;
+}
+
+static void remove_nexthop(struct nexthop *nh, const struct nl_info *info)
+{
+	nexthop_notify(RTM_DELNEXTHOP, nh, info);
+	hlist_del(&nh->nh_hash);
+	nexthop_free(nh);
+}
+
+static int rtm_del_nexthop(struct sk_buff *skb, struct nlmsghdr *nlh)
+{
+	struct net *net = sock_net(skb->sk);
+	struct nl_info info = {
+		.nlh = nlh,
+		.nl_net = net,
+		.portid = NETLINK_CB(skb).portid,
+	};
+	struct nexthop *nh;
+	int err;
+	u32 id;
+
+	err = nh_valid_get_del_req(nlh, &id);
+	if (err)
+		return err;
+
+	nh = nexthop_find_by_id(net, id);
+	if (!nh)
+		return -ENOENT;
+
+	/* Routes and groups keep their nexthop alive */
+	if (nh->fi_refcnt || nh->grp_refcnt)
+		return -EBUSY;
+
+	remove_nexthop(nh, &info);
+	return 0;
+}
+
+static int rtm_get_nexthop(struct sk_buff *in_skb, struct nlmsghdr *nlh)
+{
+	struct net *net = sock_net(in_skb->sk);
+	struct sk_buff *skb;
+	struct nexthop *nh;
+	int err;
+	u32 id;
+
+	err = nh_valid_get_del_req(nlh, &id);
+	if (err)
+		return err;
+
+	nh = nexthop_find_by_id(net, id);
+	if (!nh)
+		return -ENOENT;
+
+	skb = nlmsg_new(nh_nlmsg_size(nh), GFP_KERNEL);
+	if (skb == NULL)
+		return -ENOBUFS;
+
+	err = nh_fill_node(skb, nh, RTM_NEWNEXTHOP, NETLINK_CB(in_skb).portid,
+			   nlh->nlmsg_seq, 0);
+	if (err < 0) {
+		WARN_ON(err == -EMSGSIZE);
+		kfree_skb(skb);
+		return err;
+	}
+
+	return rtnl_unicast(skb, net, NETLINK_CB(in_skb).portid);
+}
+
+static int rtm_dump_nexthop(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct net *net = sock_net(skb->sk);
+	struct nlattr *tb[NHA_MAX + 1];
+	bool groups_only = false;
+	unsigned int h, s_h;
+	int idx = 0, s_idx;
+	struct nexthop *nh;
+
+	if (nlmsg_len(cb->nlh) >= sizeof(struct nhmsg) &&
+	    nlmsg_parse(cb->nlh, sizeof(struct nhmsg), tb, NHA_MAX,
+			rtm_nh_policy) >= 0 && tb[NHA_GROUPS])
+		groups_only = true;
+
+	s_h = cb->args[0];
+	s_idx = cb->args[1];
+
+	for (h = s_h; h < NH_HASH_SIZE; h++, s_idx = 0) {
+		idx = 0;
+		hlist_for_each_entry(nh, &net->ipv4.nexthop_hash[h], nh_hash) {
+			if (idx < s_idx || (groups_only && !nh->is_group))
+				goto cont;
+			if (nh_fill_node(skb, nh, RTM_NEWNEXTHOP,
+					 NETLINK_CB(cb->skb).portid,
+					 cb->nlh->nlmsg_seq, NLM_F_MULTI) < 0)
+				goto out;
+cont:
+			idx++;
+		}
+	}
+out:
+	cb->args[0] = h;
+	cb->args[1] = idx;
+
+	return skb->len;
+}
+
+/* Drop nh from all groups, routes built from those keep their copy. */
+static void nh_remove_from_groups(struct net *net, struct nexthop *nh,
+				  const struct nl_info *info)
+{
+	struct nexthop *grp;
+	unsigned int h;
+	int i;
+
+	for (h = 0; h < NH_HASH_SIZE && nh->grp_refcnt; h++) {
+		hlist_for_each_entry(grp, &net->ipv4.nexthop_hash[h], nh_hash) {
+			if (!grp->is_group)
+				continue;
+
+			for (i = 0; i < grp->num_nh; i++) {
+				if (grp->nh_entries[i].nh == nh)
+					break;
+			}
+			if (i == grp->num_nh)
+				continue;
+
+			memmove(&grp->nh_entries[i], &grp->nh_entries[i + 1],
+				(grp->num_nh - i - 1) *
+				sizeof(*grp->nh_entries));
+			grp->num_nh--;
+			nh->grp_refcnt--;
+			nexthop_notify(RTM_NEWNEXTHOP, grp, info);
+		}
+	}
+}
+
+static bool nh_flushable(struct nexthop *nh, struct net_device *dev)
+{
+	if (nh->fi_refcnt)
+		return false;
+	if (nh->is_group)
+		return !nh->num_nh;
+	return nh->oif == dev->ifindex;
+}
+
+/*
+ * The device is going away. Routes through it have already been flushed
+ * by fib_netdev_event(), remove the nexthops on it that are no longer used
+ * and the groups that end up empty.
+ */
+static void nexthop_flush_dev(struct net_device *dev)
+{
+	struct net *net = dev_net(dev);
+	struct nl_info info = {
+		.nl_net = net,
+	};
+	struct nexthop *nh;
+	unsigned int h;
+
+	if (!net->ipv4.nexthop_hash)
+		return;
+
+restart:
+	for (h = 0; h < NH_HASH_SIZE; h++) {
+		hlist_for_each_entry(nh, &net->ipv4.nexthop_hash[h], nh_hash) {
+			if (!nh_flushable(nh, dev))
+				continue;
+
+			/* may empty groups anywhere in the table */
+			nh_remove_from_groups(net, nh, &info);
+			remove_nexthop(nh, &info);
+			goto restart;
+		}
+	}
+}
+
+static int nh_netdev_event(struct notifier_block *this,
+			   unsigned long event, void *ptr)
+{
+	struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+
+	if (event == NETDEV_UNREGISTER)
+		nexthop_flush_dev(dev);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block nh_netdev_notifier = {
+	.notifier_call = nh_netdev_event,
+};
+
+static int __net_init nexthop_net_init(struct net *net)
+{
+	net->ipv4.nexthop_hash = kcalloc(NH_HASH_SIZE,
+					 sizeof(struct hlist_head),
+					 GFP_KERNEL);
+	if (!net->ipv4.nexthop_hash)
+		return -ENOMEM;
+
+	net->ipv4.nexthop_last_id = 0;
+	return 0;
+}
+
+static void __net_exit nexthop_net_exit(struct net *net)
+{
+	struct hlist_head *hash = net->ipv4.nexthop_hash;
+	struct hlist_node *tmp;
+	struct nexthop *nh;
+	unsigned int h;
+	int pass;
+
+	rtnl_lock();
+	/* groups first, they hold references on their members */
+	for (pass = 0; pass < 2; pass++) {
+		for (h = 0; h < NH_HASH_SIZE; h++) {
+			hlist_for_each_entry_safe(nh, tmp, &hash[h], nh_hash) {
+				if (nh->is_group != !pass)
+					continue;
+				hlist_del(&nh->nh_hash);
+				nexthop_free(nh);
+			}
+		}
+	}
+	net->ipv4.nexthop_hash = NULL;
+	rtnl_unlock();
+
+	kfree(hash);
+}
+
+static struct pernet_operations nexthop_net_ops = {
+	.init = nexthop_net_init,
+	.exit = nexthop_net_exit,
+};
+
+void __init nexthop_init(void)
+{
+	register_pernet_subsys(&nexthop_net_ops);
+	register_netdevice_notifier(&nh_netdev_notifier);
+
+	rtnl_register(PF_UNSPEC, RTM_NEWNEXTHOP, rtm_new_nexthop, NULL, NULL);
+	rtnl_register(PF_UNSPEC, RTM_DELNEXTHOP, rtm_del_nexthop, NULL, NULL);
+	rtnl_register(PF_UNSPEC, RTM_GETNEXTHOP, rtm_get_nexthop,
+		      rtm_dump_nexthop, NULL);
+}
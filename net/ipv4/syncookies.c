@@ -204,10 +204,13 @@ static inline struct sock *get_cookie_sock(struct sock *sk, struct sk_buff *skb,
 	struct sock *child;
 
 	child = icsk->icsk_af_ops->syn_recv_sock(sk, skb, req, dst);
-	if (child)
-		inet_csk_reqsk_queue_add(sk, req, child);
-	else
+	if (!child) {
 		reqsk_free(req);
+	} else if (!inet_csk_reqsk_queue_add(sk, req, child)) {
+		bh_unlock_sock(child);
+		sock_put(child);
+		child = NULL;
+	}
 
 	return child;
 }
@@ -47,6 +47,91 @@ static int udp4_ufo_send_check(struct sk_buff *skb)
 	return 0;
 }
 
+/*
+ * Split a UDP_SEGMENT datagram into gso_size sized UDP datagrams. Unlike
+ * UFO every segment gets its own UDP header, so only the length and the
+ * pseudo header checksum of each header need fixing up.
+ */
+static struct sk_buff *__udp_gso_segment(struct sk_buff *gso_skb,
+					 netdev_features_t features)
+{
+	struct sk_buff *segs, *skb;
+	unsigned int sum_truesize = 0;
+	bool copy_destructor;
+	struct udphdr *uh;
+	unsigned int mss;
+	__sum16 check;
+	__be16 newlen;
+
+	mss = skb_shinfo(gso_skb)->gso_size;
+	if (gso_skb->len <= sizeof(*uh) + mss)
+		return ERR_PTR(-EINVAL);
+
+	if (!pskb_may_pull(gso_skb, sizeof(*uh)))
+		return ERR_PTR(-EINVAL);
+	__skb_pull(gso_skb, sizeof(*uh));
+
+	copy_destructor = gso_skb->destructor == sock_wfree;
+
+	segs = skb_segment(gso_skb, features);
+	if (IS_ERR_OR_NULL(segs))
+		return segs;
+
+	skb = segs;
+	uh = udp_hdr(skb);
+
+	/* udp4_hwcsum() left the pseudo header sum of the whole datagram
+	 * in uh->check, replace its length by the one of a full segment.
+	 */
+	newlen = htons(sizeof(*uh) + mss);
+	check = csum16_add(csum16_sub(uh->check, uh->len), newlen);
+
+	do {
+		uh->len = newlen;
+		uh->check = check;
+
+		if (skb->ip_summed != CHECKSUM_PARTIAL)
+			uh->check = csum_fold(csum_partial(uh, sizeof(*uh),
+							   skb->csum)) ? :
+				    CSUM_MANGLED_0;
+
+		if (copy_destructor) {
+			skb->destructor = gso_skb->destructor;
+			skb->sk = gso_skb->sk;
+			sum_truesize += skb->truesize;
+		}
+		skb = skb->next;
+		uh = udp_hdr(skb);
+	} while (skb->next);
+
+	/* Like tcp_gso_segment(), hand the socket reference of the original
+	 * skb over to the last segment so that the write space is released
+	 * when the data has actually left the host.
+	 */
+	if (copy_destructor) {
+		swap(gso_skb->sk, skb->sk);
+		swap(gso_skb->destructor, skb->destructor);
+		sum_truesize += skb->truesize;
+		atomic_add(sum_truesize - gso_skb->truesize,
+			   &skb->sk->sk_wmem_alloc);
+	}
+
+	/* the last segment may be shorter than gso_size */
+	newlen = htons(skb_tail_pointer(skb) - skb_transport_header(skb) +
+		       skb->data_len);
+	check = csum16_add(csum16_sub(uh->check, uh->len), newlen);
+
+	uh->len = newlen;
+	uh->check = check;
+
+	if (skb->ip_summed != CHECKSUM_PARTIAL)
+		uh->check = csum_fold(csum_partial(uh, sizeof(*uh),
+						   skb->csum)) ? :
+			    CSUM_MANGLED_0;
+
+	return segs;
+}
+
 static struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb,
 					 netdev_features_t features)
 {
@@ -61,6 +146,11 @@ static struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb,
 		goto out;
 	}
 
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4) {
+		segs = __udp_gso_segment(skb, features);
+		goto out;
+	}
+
 	mss = skb_shinfo(skb)->gso_size;
 	if (unlikely(skb->len <= mss))
 		goto out;
@@ -113,20 +113,33 @@ static u32 inet6_synq_hash(const struct in6_addr *raddr, const __be16 rport,
 	return c & (synq_hsize - 1);
 }
 
+/*
+ * Like inet_csk_search_req(), a request found is returned with its
+ * bucket lock *lockp held.
+ */
 struct request_sock *inet6_csk_search_req(const struct sock *sk,
 					  struct request_sock ***prevp,
 					  const __be16 rport,
 					  const struct in6_addr *raddr,
 					  const struct in6_addr *laddr,
-					  const int iif)
+					  const int iif,
+					  spinlock_t **lockp)
 {
 	const struct inet_connection_sock *icsk = inet_csk(sk);
-	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
+	struct listen_sock *lopt;
 	struct request_sock *req, **prev;
+	spinlock_t *lock;
+	u32 hash;
 
-	for (prev = &lopt->syn_table[inet6_synq_hash(raddr, rport,
-						     lopt->hash_rnd,
-						     lopt->nr_table_entries)];
+	lopt = ACCESS_ONCE(icsk->icsk_accept_queue.listen_opt);
+	if (lopt == NULL)
+		return NULL;
+
+	hash = inet6_synq_hash(raddr, rport, lopt->hash_rnd,
+			       lopt->nr_table_entries);
+	lock = reqsk_queue_lock(lopt, hash);
+	spin_lock(lock);
+	for (prev = &lopt->syn_table[hash];
 	     (req = *prev) != NULL;
 	     prev = &req->dl_next) {
 		const struct inet_request_sock *ireq = inet_rsk(req);
@@ -138,9 +151,11 @@ struct request_sock *inet6_csk_search_req(const struct sock *sk,
 		    (!ireq->ir_iif || ireq->ir_iif == iif)) {
 			WARN_ON(req->sk != NULL);
 			*prevp = prev;
+			*lockp = lock;
 			return req;
 		}
 	}
+	spin_unlock(lock);
 
 	return NULL;
 }
@@ -152,13 +167,18 @@ void inet6_csk_reqsk_queue_hash_add(struct sock *sk,
 				    const unsigned long timeout)
 {
 	struct inet_connection_sock *icsk = inet_csk(sk);
-	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
-	const u32 h = inet6_synq_hash(&inet_rsk(req)->ir_v6_rmt_addr,
-				      inet_rsk(req)->ir_rmt_port,
-				      lopt->hash_rnd, lopt->nr_table_entries);
+	struct listen_sock *lopt;
+	u32 h;
 
-	reqsk_queue_hash_req(&icsk->icsk_accept_queue, h, req, timeout);
-	inet_csk_reqsk_queue_added(sk, timeout);
+	lopt = ACCESS_ONCE(icsk->icsk_accept_queue.listen_opt);
+	if (unlikely(lopt == NULL)) {
+		reqsk_free(req);
+		return;
+	}
+	h = inet6_synq_hash(&inet_rsk(req)->ir_v6_rmt_addr,
+			    inet_rsk(req)->ir_rmt_port,
+			    lopt->hash_rnd, lopt->nr_table_entries);
+	__inet_csk_reqsk_queue_hash_add(sk, lopt, h, req, timeout);
 }
 
 EXPORT_SYMBOL_GPL(inet6_csk_reqsk_queue_hash_add);
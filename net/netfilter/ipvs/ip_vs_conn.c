@@ -46,20 +46,53 @@
 #endif
 
 /*
- * Connection hash size. Default is what was selected at compile time.
+ * Initial connection hash size. Default is what was selected at compile
+ * time, the table then grows and shrinks with the number of connections.
 */
 static int ip_vs_conn_tab_bits = CONFIG_IP_VS_TAB_BITS;
 module_param_named(conn_tab_bits, ip_vs_conn_tab_bits, int, 0444);
-MODULE_PARM_DESC(conn_tab_bits, "Set connections' hash size");
+MODULE_PARM_DESC(conn_tab_bits, "Set connections' initial hash size");
 
-/* size and mask values */
+#define IP_VS_CONN_TAB_MIN_BITS	8
+#define IP_VS_CONN_TAB_MAX_BITS	20
+
+/* size of the current table */
 int ip_vs_conn_tab_size __read_mostly;
-static int ip_vs_conn_tab_mask __read_mostly;
+
+struct ip_vs_conn_bucket {
+	struct hlist_head	head;
+	spinlock_t		lock;
+};
 
 /*
  *  Connection hash table: for input and output packets lookups of IPVS
+ *
+ *  While the table is resized, the table being drained points to its
+ *  successor with ->next. Its buckets below ->moved have been emptied
+ *  into the new table and connections hashing to them are added there,
+ *  the other buckets are still used as before. A bucket is moved under
+ *  its own lock and ip_vs_conn_seq, so that lookups missing an entry
+ *  that moved under their feet know they have to retry.
  */
-static struct hlist_head *ip_vs_conn_tab __read_mostly;
+struct ip_vs_conn_tab {
+	struct ip_vs_conn_tab __rcu	*next;
+	unsigned int			mask;
+	unsigned int			moved;
+	struct ip_vs_conn_bucket	buckets[0];
+};
+
+/* oldest table in use, the one lookups start from */
+static struct ip_vs_conn_tab __rcu *ip_vs_conn_tab __read_mostly;
+static seqcount_t ip_vs_conn_seq;
+
+/* number of hashed connections, drives the resizing */
+static atomic_t ip_vs_conn_hashed = ATOMIC_INIT(0);
+
+static void ip_vs_conn_resize(struct work_struct *work);
+static DECLARE_WORK(ip_vs_conn_resize_work, ip_vs_conn_resize);
+
+/* serializes resizing with walks of the whole table that may sleep */
+static DEFINE_MUTEX(ip_vs_conn_resize_mutex);
 
 /*  SLAB cache for IPVS connections */
 static struct kmem_cache *ip_vs_conn_cachep __read_mostly;
@@ -71,34 +104,49 @@ static atomic_t ip_vs_conn_no_cport_cnt = ATOMIC_INIT(0);
 static unsigned int ip_vs_conn_rnd __read_mostly;
 
 /*
- *  Fine locking granularity for big connection hash table
+ *	Lock the bucket that holds, or is to hold, the connections with
+ *	this hash value. Keeps the RCU read lock until the bucket is
+ *	unlocked, so that the table can not go away under us.
  */
-#define CT_LOCKARRAY_BITS  5
-#define CT_LOCKARRAY_SIZE  (1<<CT_LOCKARRAY_BITS)
-#define CT_LOCKARRAY_MASK  (CT_LOCKARRAY_SIZE-1)
-
-struct ip_vs_aligned_lock
+static struct ip_vs_conn_bucket *ip_vs_conn_lock_bucket(unsigned int hash)
 {
-	spinlock_t	l;
-} __attribute__((__aligned__(SMP_CACHE_BYTES)));
-
-/* lock array for conn table */
-static struct ip_vs_aligned_lock
-__ip_vs_conntbl_lock_array[CT_LOCKARRAY_SIZE] __cacheline_aligned;
+	struct ip_vs_conn_tab *t;
+	struct ip_vs_conn_bucket *b;
+	unsigned int idx;
 
-static inline void ct_write_lock_bh(unsigned int key)
-{
-	spin_lock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	rcu_read_lock();
+	t = rcu_dereference(ip_vs_conn_tab);
+	for (;;) {
+		idx = hash & t->mask;
+		b = &t->buckets[idx];
+		spin_lock_bh(&b->lock);
+		/* ->moved only changes under the lock of the moved bucket */
+		if (likely(idx >= t->moved))
+			return b;
+		spin_unlock_bh(&b->lock);
+		t = rcu_dereference(t->next);
+	}
 }
 
-static inline void ct_write_unlock_bh(unsigned int key)
+static inline void ip_vs_conn_unlock_bucket(struct ip_vs_conn_bucket *b)
 {
-	spin_unlock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	spin_unlock_bh(&b->lock);
+	rcu_read_unlock();
 }
 
+/*
+ *	Walk the chains a connection with this hash value can be on, from
+ *	the oldest table to the newest one. Called under RCU.
+ */
+#define ip_vs_conn_for_each_chain(t, hash, head)			\
+	for (t = rcu_dereference(ip_vs_conn_tab);			\
+	     t && ((head) = &t->buckets[(hash) & t->mask].head, 1);	\
+	     t = rcu_dereference(t->next))
+
 
 /*
- *	Returns hash value for IPVS connection entry
+ *	Returns hash value for IPVS connection entry, it is masked with
+ *	the size of the table by the users
  */
 static unsigned int ip_vs_conn_hashkey(struct net *net, int af, unsigned int proto,
 				       const union nf_inet_addr *addr,
@@ -108,11 +156,11 @@ static unsigned int ip_vs_conn_hashkey(struct net *net, int af, unsigned int pro
 	if (af == AF_INET6)
 		return (jhash_3words(jhash(addr, 16, ip_vs_conn_rnd),
 				    (__force u32)port, proto, ip_vs_conn_rnd) ^
-			((size_t)net>>8)) & ip_vs_conn_tab_mask;
+			((size_t)net>>8));
 #endif
 	return (jhash_3words((__force u32)addr->ip, (__force u32)port, proto,
 			    ip_vs_conn_rnd) ^
-		((size_t)net>>8)) & ip_vs_conn_tab_mask;
+		((size_t)net>>8));
 }
 
 static unsigned int ip_vs_conn_hashkey_param(const struct ip_vs_conn_param *p,
@@ -122,8 +170,7 @@ static unsigned int ip_vs_conn_hashkey_param(const struct ip_vs_conn_param *p,
 	__be16 port;
 
 	if (p->pe_data && p->pe->hashkey_raw)
-		return p->pe->hashkey_raw(p, ip_vs_conn_rnd, inverse) &
-			ip_vs_conn_tab_mask;
+		return p->pe->hashkey_raw(p, ip_vs_conn_rnd, inverse);
 
 	if (likely(!inverse)) {
 		addr = p->caddr;
@@ -152,12 +199,26 @@ static unsigned int ip_vs_conn_hashkey_conn(const struct ip_vs_conn *cp)
 	return ip_vs_conn_hashkey_param(&p, false);
 }
 
+/*
+ *	Kick the resizing when the number of hashed connections moved too
+ *	far from the size of the table.
+ */
+static inline void ip_vs_conn_check_size(int hashed)
+{
+	int size = ip_vs_conn_tab_size;
+
+	if ((hashed > 2 * size && size < (1 << IP_VS_CONN_TAB_MAX_BITS)) ||
+	    (hashed < size / 8 && size > (1 << IP_VS_CONN_TAB_MIN_BITS)))
+		schedule_work(&ip_vs_conn_resize_work);
+}
+
 /*
  *	Hashes ip_vs_conn in ip_vs_conn_tab by netns,proto,addr,port.
  *	returns bool success.
  */
 static inline int ip_vs_conn_hash(struct ip_vs_conn *cp)
 {
+	struct ip_vs_conn_bucket *b;
 	unsigned int hash;
 	int ret;
 
@@ -167,13 +228,13 @@ static inline int ip_vs_conn_hash(struct ip_vs_conn *cp)
 	/* Hash by protocol, client address and port */
 	hash = ip_vs_conn_hashkey_conn(cp);
 
-	ct_write_lock_bh(hash);
+	b = ip_vs_conn_lock_bucket(hash);
 	spin_lock(&cp->lock);
 
 	if (!(cp->flags & IP_VS_CONN_F_HASHED)) {
 		cp->flags |= IP_VS_CONN_F_HASHED;
 		atomic_inc(&cp->refcnt);
-		hlist_add_head_rcu(&cp->c_list, &ip_vs_conn_tab[hash]);
+		hlist_add_head_rcu(&cp->c_list, &b->head);
 		ret = 1;
 	} else {
 		pr_err("%s(): request for already hashed, called from %pF\n",
@@ -182,7 +243,10 @@ static inline int ip_vs_conn_hash(struct ip_vs_conn *cp)
 	}
 
 	spin_unlock(&cp->lock);
-	ct_write_unlock_bh(hash);
+	ip_vs_conn_unlock_bucket(b);
+
+	if (ret)
+		ip_vs_conn_check_size(atomic_inc_return(&ip_vs_conn_hashed));
 
 	return ret;
 }
@@ -194,13 +258,14 @@ static inline int ip_vs_conn_hash(struct ip_vs_conn *cp)
  */
 static inline int ip_vs_conn_unhash(struct ip_vs_conn *cp)
 {
+	struct ip_vs_conn_bucket *b;
 	unsigned int hash;
 	int ret;
 
 	/* unhash it and decrease its reference counter */
 	hash = ip_vs_conn_hashkey_conn(cp);
 
-	ct_write_lock_bh(hash);
+	b = ip_vs_conn_lock_bucket(hash);
 	spin_lock(&cp->lock);
 
 	if (cp->flags & IP_VS_CONN_F_HASHED) {
@@ -212,7 +277,10 @@ static inline int ip_vs_conn_unhash(struct ip_vs_conn *cp)
 		ret = 0;
 
 	spin_unlock(&cp->lock);
-	ct_write_unlock_bh(hash);
+	ip_vs_conn_unlock_bucket(b);
+
+	if (ret)
+		ip_vs_conn_check_size(atomic_dec_return(&ip_vs_conn_hashed));
 
 	return ret;
 }
@@ -222,12 +290,14 @@ static inline int ip_vs_conn_unhash(struct ip_vs_conn *cp)
  */
 static inline bool ip_vs_conn_unlink(struct ip_vs_conn *cp)
 {
+	struct ip_vs_conn_bucket *b;
 	unsigned int hash;
+	bool unhashed = false;
 	bool ret;
 
 	hash = ip_vs_conn_hashkey_conn(cp);
 
-	ct_write_lock_bh(hash);
+	b = ip_vs_conn_lock_bucket(hash);
 	spin_lock(&cp->lock);
 
 	if (cp->flags & IP_VS_CONN_F_HASHED) {
@@ -236,17 +306,98 @@ static inline bool ip_vs_conn_unlink(struct ip_vs_conn *cp)
 		if (atomic_cmpxchg(&cp->refcnt, 1, 0) == 1) {
 			hlist_del_rcu(&cp->c_list);
 			cp->flags &= ~IP_VS_CONN_F_HASHED;
-			ret = true;
+			unhashed = ret = true;
 		}
 	} else
 		ret = atomic_read(&cp->refcnt) ? false : true;
 
 	spin_unlock(&cp->lock);
-	ct_write_unlock_bh(hash);
+	ip_vs_conn_unlock_bucket(b);
+
+	if (unhashed)
+		ip_vs_conn_check_size(atomic_dec_return(&ip_vs_conn_hashed));
 
 	return ret;
 }
 
+static struct ip_vs_conn_tab *ip_vs_conn_tab_alloc(int bits)
+{
+	unsigned int idx, size = 1U << bits;
+	struct ip_vs_conn_tab *t;
+
+	t = vmalloc(sizeof(*t) + size * sizeof(t->buckets[0]));
+	if (!t)
+		return NULL;
+
+	RCU_INIT_POINTER(t->next, NULL);
+	t->mask = size - 1;
+	t->moved = 0;
+	for (idx = 0; idx < size; idx++) {
+		INIT_HLIST_HEAD(&t->buckets[idx].head);
+		spin_lock_init(&t->buckets[idx].lock);
+	}
+	return t;
+}
+
+/*
+ *	Move the connections to a table sized for their number, one bucket
+ *	at a time. Lookups and updates keep running meanwhile.
+ */
+static void ip_vs_conn_resize(struct work_struct *work)
+{
+	struct ip_vs_conn_tab *old, *new;
+	unsigned int idx;
+	int bits;
+
+	bits = ilog2(roundup_pow_of_two(max(atomic_read(&ip_vs_conn_hashed),
+					    1)));
+	bits = clamp(bits, IP_VS_CONN_TAB_MIN_BITS, IP_VS_CONN_TAB_MAX_BITS);
+
+	mutex_lock(&ip_vs_conn_resize_mutex);
+	old = rcu_dereference_protected(ip_vs_conn_tab,
+			lockdep_is_held(&ip_vs_conn_resize_mutex));
+	if (old->mask + 1 == 1U << bits)
+		goto out;
+
+	new = ip_vs_conn_tab_alloc(bits);
+	if (!new)
+		goto out;
+
+	/* ->next is seen by any writer that finds its bucket moved */
+	rcu_assign_pointer(old->next, new);
+
+	for (idx = 0; idx <= old->mask; idx++) {
+		struct ip_vs_conn_bucket *ob = &old->buckets[idx];
+		struct ip_vs_conn_bucket *nb;
+		struct hlist_node *n;
+		struct ip_vs_conn *cp;
+
+		spin_lock_bh(&ob->lock);
+		write_seqcount_begin(&ip_vs_conn_seq);
+		hlist_for_each_entry_safe(cp, n, &ob->head, c_list) {
+			nb = &new->buckets[ip_vs_conn_hashkey_conn(cp) &
+					   new->mask];
+			spin_lock_nested(&nb->lock, SINGLE_DEPTH_NESTING);
+			hlist_del_rcu(&cp->c_list);
+			hlist_add_head_rcu(&cp->c_list, &nb->head);
+			spin_unlock(&nb->lock);
+		}
+		old->moved = idx + 1;
+		write_seqcount_end(&ip_vs_conn_seq);
+		spin_unlock_bh(&ob->lock);
+		cond_resched();
+	}
+
+	rcu_assign_pointer(ip_vs_conn_tab, new);
+	ip_vs_conn_tab_size = new->mask + 1;
+	synchronize_rcu();
+	vfree(old);
+
+	IP_VS_DBG(2, "Connection hash table resized to %u\n", new->mask + 1);
+out:
+	mutex_unlock(&ip_vs_conn_resize_mutex);
+}
+
 
 /*
  *  Gets ip_vs_conn associated with supplied parameters in the ip_vs_conn_tab.
@@ -257,28 +408,37 @@ static inline bool ip_vs_conn_unlink(struct ip_vs_conn *cp)
 static inline struct ip_vs_conn *
 __ip_vs_conn_in_get(const struct ip_vs_conn_param *p)
 {
-	unsigned int hash;
+	unsigned int hash, seq;
+	struct ip_vs_conn_tab *t;
+	struct hlist_head *head;
 	struct ip_vs_conn *cp;
 
 	hash = ip_vs_conn_hashkey_param(p, false);
 
 	rcu_read_lock();
 
-	hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
-		if (p->cport == cp->cport && p->vport == cp->vport &&
-		    cp->af == p->af &&
-		    ip_vs_addr_equal(p->af, p->caddr, &cp->caddr) &&
-		    ip_vs_addr_equal(p->af, p->vaddr, &cp->vaddr) &&
-		    ((!p->cport) ^ (!(cp->flags & IP_VS_CONN_F_NO_CPORT))) &&
-		    p->protocol == cp->protocol &&
-		    ip_vs_conn_net_eq(cp, p->net)) {
-			if (!__ip_vs_conn_get(cp))
-				continue;
-			/* HIT */
-			rcu_read_unlock();
-			return cp;
+retry:
+	seq = read_seqcount_begin(&ip_vs_conn_seq);
+	ip_vs_conn_for_each_chain(t, hash, head) {
+		hlist_for_each_entry_rcu(cp, head, c_list) {
+			if (p->cport == cp->cport && p->vport == cp->vport &&
+			    cp->af == p->af &&
+			    ip_vs_addr_equal(p->af, p->caddr, &cp->caddr) &&
+			    ip_vs_addr_equal(p->af, p->vaddr, &cp->vaddr) &&
+			    ((!p->cport) ^
+			     (!(cp->flags & IP_VS_CONN_F_NO_CPORT))) &&
+			    p->protocol == cp->protocol &&
+			    ip_vs_conn_net_eq(cp, p->net)) {
+				if (!__ip_vs_conn_get(cp))
+					continue;
+				/* HIT */
+				rcu_read_unlock();
+				return cp;
+			}
 		}
 	}
+	if (read_seqcount_retry(&ip_vs_conn_seq, seq))
+		goto retry;
 
 	rcu_read_unlock();
 
@@ -342,38 +502,48 @@ EXPORT_SYMBOL_GPL(ip_vs_conn_in_get_proto);
 /* Get reference to connection template */
 struct ip_vs_conn *ip_vs_ct_in_get(const struct ip_vs_conn_param *p)
 {
-	unsigned int hash;
+	unsigned int hash, seq;
+	struct ip_vs_conn_tab *t;
+	struct hlist_head *head;
 	struct ip_vs_conn *cp;
 
 	hash = ip_vs_conn_hashkey_param(p, false);
 
 	rcu_read_lock();
 
-	hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
-		if (unlikely(p->pe_data && p->pe->ct_match)) {
-			if (!ip_vs_conn_net_eq(cp, p->net))
+retry:
+	seq = read_seqcount_begin(&ip_vs_conn_seq);
+	ip_vs_conn_for_each_chain(t, hash, head) {
+		hlist_for_each_entry_rcu(cp, head, c_list) {
+			if (unlikely(p->pe_data && p->pe->ct_match)) {
+				if (!ip_vs_conn_net_eq(cp, p->net))
+					continue;
+				if (p->pe == cp->pe &&
+				    p->pe->ct_match(p, cp)) {
+					if (__ip_vs_conn_get(cp))
+						goto out;
+				}
 				continue;
-			if (p->pe == cp->pe && p->pe->ct_match(p, cp)) {
+			}
+
+			if (cp->af == p->af &&
+			    ip_vs_addr_equal(p->af, p->caddr, &cp->caddr) &&
+			    /* protocol should only be IPPROTO_IP if
+			     * p->vaddr is a fwmark */
+			    ip_vs_addr_equal(p->protocol == IPPROTO_IP ?
+					     AF_UNSPEC : p->af,
+					     p->vaddr, &cp->vaddr) &&
+			    p->vport == cp->vport && p->cport == cp->cport &&
+			    cp->flags & IP_VS_CONN_F_TEMPLATE &&
+			    p->protocol == cp->protocol &&
+			    ip_vs_conn_net_eq(cp, p->net)) {
 				if (__ip_vs_conn_get(cp))
 					goto out;
 			}
-			continue;
-		}
-
-		if (cp->af == p->af &&
-		    ip_vs_addr_equal(p->af, p->caddr, &cp->caddr) &&
-		    /* protocol should only be IPPROTO_IP if
-		     * p->vaddr is a fwmark */
-		    ip_vs_addr_equal(p->protocol == IPPROTO_IP ? AF_UNSPEC :
-				     p->af, p->vaddr, &cp->vaddr) &&
-		    p->vport == cp->vport && p->cport == cp->cport &&
-		    cp->flags & IP_VS_CONN_F_TEMPLATE &&
-		    p->protocol == cp->protocol &&
-		    ip_vs_conn_net_eq(cp, p->net)) {
-			if (__ip_vs_conn_get(cp))
-				goto out;
 		}
 	}
+	if (read_seqcount_retry(&ip_vs_conn_seq, seq))
+		goto retry;
 	cp = NULL;
 
   out:
@@ -394,7 +564,9 @@ struct ip_vs_conn *ip_vs_ct_in_get(const struct ip_vs_conn_param *p)
  *	p->vaddr, p->vport: pkt dest address (foreign host) */
 struct ip_vs_conn *ip_vs_conn_out_get(const struct ip_vs_conn_param *p)
 {
-	unsigned int hash;
+	unsigned int hash, seq;
+	struct ip_vs_conn_tab *t;
+	struct hlist_head *head;
 	struct ip_vs_conn *cp, *ret=NULL;
 
 	/*
@@ -404,21 +576,28 @@ struct ip_vs_conn *ip_vs_conn_out_get(const struct ip_vs_conn_param *p)
 
 	rcu_read_lock();
 
-	hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
-		if (p->vport == cp->cport && p->cport == cp->dport &&
-		    cp->af == p->af &&
-		    ip_vs_addr_equal(p->af, p->vaddr, &cp->caddr) &&
-		    ip_vs_addr_equal(p->af, p->caddr, &cp->daddr) &&
-		    p->protocol == cp->protocol &&
-		    ip_vs_conn_net_eq(cp, p->net)) {
-			if (!__ip_vs_conn_get(cp))
-				continue;
-			/* HIT */
-			ret = cp;
-			break;
+retry:
+	seq = read_seqcount_begin(&ip_vs_conn_seq);
+	ip_vs_conn_for_each_chain(t, hash, head) {
+		hlist_for_each_entry_rcu(cp, head, c_list) {
+			if (p->vport == cp->cport && p->cport == cp->dport &&
+			    cp->af == p->af &&
+			    ip_vs_addr_equal(p->af, p->vaddr, &cp->caddr) &&
+			    ip_vs_addr_equal(p->af, p->caddr, &cp->daddr) &&
+			    p->protocol == cp->protocol &&
+			    ip_vs_conn_net_eq(cp, p->net)) {
+				if (!__ip_vs_conn_get(cp))
+					continue;
+				/* HIT */
+				ret = cp;
+				goto out;
+			}
 		}
 	}
+	if (read_seqcount_retry(&ip_vs_conn_seq, seq))
+		goto retry;
 
+  out:
 	rcu_read_unlock();
 
 	IP_VS_DBG_BUF(9, "lookup/out %s %s:%d->%s:%d %s\n",
@@ -956,74 +1135,88 @@ ip_vs_conn_new(const struct ip_vs_conn_param *p,
 #ifdef CONFIG_PROC_FS
 struct ip_vs_iter_state {
 	struct seq_net_private	p;
-	struct hlist_head	*l;
+	struct ip_vs_conn_tab	*t;
+	unsigned int		idx;
 };
 
-static void *ip_vs_conn_array(struct seq_file *seq, loff_t pos)
+/* First entry from bucket idx of the table on */
+static struct ip_vs_conn *
+ip_vs_conn_seq_first(struct ip_vs_iter_state *iter, struct ip_vs_conn_tab *t,
+		     unsigned int idx)
 {
-	int idx;
 	struct ip_vs_conn *cp;
-	struct ip_vs_iter_state *iter = seq->private;
 
-	for (idx = 0; idx < ip_vs_conn_tab_size; idx++) {
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[idx], c_list) {
-			/* __ip_vs_conn_get() is not needed by
-			 * ip_vs_conn_seq_show and ip_vs_conn_sync_seq_show
-			 */
-			if (pos-- == 0) {
-				iter->l = &ip_vs_conn_tab[idx];
-				return cp;
-			}
+	iter->t = t;
+	for (; idx <= t->mask; idx++) {
+		hlist_for_each_entry_rcu(cp, &t->buckets[idx].head, c_list) {
+			iter->idx = idx;
+			return cp;
 		}
 		cond_resched_rcu();
 	}
-
 	return NULL;
 }
 
+static struct ip_vs_conn *
+ip_vs_conn_seq_advance(struct ip_vs_iter_state *iter, struct ip_vs_conn *cp)
+{
+	struct hlist_node *e;
+
+	/* more on same hash chain? */
+	e = rcu_dereference(hlist_next_rcu(&cp->c_list));
+	if (e)
+		return hlist_entry(e, struct ip_vs_conn, c_list);
+
+	return ip_vs_conn_seq_first(iter, iter->t, iter->idx + 1);
+}
+
+static void *ip_vs_conn_array(struct seq_file *seq, loff_t pos)
+{
+	struct ip_vs_conn *cp;
+	struct ip_vs_iter_state *iter = seq->private;
+
+	/* __ip_vs_conn_get() is not needed by
+	 * ip_vs_conn_seq_show and ip_vs_conn_sync_seq_show
+	 */
+	cp = ip_vs_conn_seq_first(iter, rcu_dereference(ip_vs_conn_tab), 0);
+	while (cp && pos--)
+		cp = ip_vs_conn_seq_advance(iter, cp);
+
+	return cp;
+}
+
+/*
+ * The table is not resized while it is walked: the walk drops the RCU
+ * read lock now and then and keeps a pointer to the table, which is then
+ * also the only one.
+ */
 static void *ip_vs_conn_seq_start(struct seq_file *seq, loff_t *pos)
 	__acquires(RCU)
 {
 	struct ip_vs_iter_state *iter = seq->private;
 
-	iter->l = NULL;
+	iter->t = NULL;
+	mutex_lock(&ip_vs_conn_resize_mutex);
 	rcu_read_lock();
 	return *pos ? ip_vs_conn_array(seq, *pos - 1) :SEQ_START_TOKEN;
 }
 
 static void *ip_vs_conn_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 {
-	struct ip_vs_conn *cp = v;
 	struct ip_vs_iter_state *iter = seq->private;
-	struct hlist_node *e;
-	struct hlist_head *l = iter->l;
-	int idx;
 
 	++*pos;
 	if (v == SEQ_START_TOKEN)
 		return ip_vs_conn_array(seq, 0);
 
-	/* more on same hash chain? */
-	e = rcu_dereference(hlist_next_rcu(&cp->c_list));
-	if (e)
-		return hlist_entry(e, struct ip_vs_conn, c_list);
-
-	idx = l - ip_vs_conn_tab;
-	while (++idx < ip_vs_conn_tab_size) {
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[idx], c_list) {
-			iter->l = &ip_vs_conn_tab[idx];
-			return cp;
-		}
-		cond_resched_rcu();
-	}
-	iter->l = NULL;
-	return NULL;
+	return ip_vs_conn_seq_advance(iter, v);
 }
 
 static void ip_vs_conn_seq_stop(struct seq_file *seq, void *v)
 	__releases(RCU)
 {
 	rcu_read_unlock();
+	mutex_unlock(&ip_vs_conn_resize_mutex);
 }
 
 static int ip_vs_conn_seq_show(struct seq_file *seq, void *v)
@@ -1203,15 +1396,19 @@ void ip_vs_random_dropentry(struct net *net)
 {
 	int idx;
 	struct ip_vs_conn *cp, *cp_c;
+	struct ip_vs_conn_tab *t;
 
+	/* No resize in progress, the table is the only one */
+	mutex_lock(&ip_vs_conn_resize_mutex);
 	rcu_read_lock();
+	t = rcu_dereference(ip_vs_conn_tab);
 	/*
 	 * Randomly scan 1/32 of the whole table every second
 	 */
-	for (idx = 0; idx < (ip_vs_conn_tab_size>>5); idx++) {
-		unsigned int hash = prandom_u32() & ip_vs_conn_tab_mask;
+	for (idx = 0; idx < ((t->mask + 1) >> 5); idx++) {
+		unsigned int hash = prandom_u32() & t->mask;
 
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[hash], c_list) {
+		hlist_for_each_entry_rcu(cp, &t->buckets[hash].head, c_list) {
 			if (cp->flags & IP_VS_CONN_F_TEMPLATE)
 				/* connection template */
 				continue;
@@ -1261,6 +1458,7 @@ void ip_vs_random_dropentry(struct net *net)
 		cond_resched_rcu();
 	}
 	rcu_read_unlock();
+	mutex_unlock(&ip_vs_conn_resize_mutex);
 }
 
 
@@ -1269,15 +1467,19 @@ void ip_vs_random_dropentry(struct net *net)
  */
 static void ip_vs_conn_flush(struct net *net)
 {
-	int idx;
+	unsigned int idx;
 	struct ip_vs_conn *cp, *cp_c;
+	struct ip_vs_conn_tab *t;
 	struct netns_ipvs *ipvs = net_ipvs(net);
 
 flush_again:
+	/* No resize in progress, the table is the only one */
+	mutex_lock(&ip_vs_conn_resize_mutex);
 	rcu_read_lock();
-	for (idx = 0; idx < ip_vs_conn_tab_size; idx++) {
+	t = rcu_dereference(ip_vs_conn_tab);
+	for (idx = 0; idx <= t->mask; idx++) {
 
-		hlist_for_each_entry_rcu(cp, &ip_vs_conn_tab[idx], c_list) {
+		hlist_for_each_entry_rcu(cp, &t->buckets[idx].head, c_list) {
 			if (!ip_vs_conn_net_eq(cp, net))
 				continue;
 			IP_VS_DBG(4, "del connection\n");
@@ -1293,6 +1495,7 @@ flush_again:
 		cond_resched_rcu();
 	}
 	rcu_read_unlock();
+	mutex_unlock(&ip_vs_conn_resize_mutex);
 
 	/* the counter may be not NULL, because maybe some conn entries
 	   are run by slow timer handler or unhashed but still referred */
@@ -1325,17 +1528,18 @@ void __net_exit ip_vs_conn_net_cleanup(struct net *net)
 
 int __init ip_vs_conn_init(void)
 {
-	int idx;
+	struct ip_vs_conn_tab *t;
 
-	/* Compute size and mask */
+	ip_vs_conn_tab_bits = clamp(ip_vs_conn_tab_bits,
+				    IP_VS_CONN_TAB_MIN_BITS,
+				    IP_VS_CONN_TAB_MAX_BITS);
 	ip_vs_conn_tab_size = 1 << ip_vs_conn_tab_bits;
-	ip_vs_conn_tab_mask = ip_vs_conn_tab_size - 1;
 
 	/*
-	 * Allocate the connection hash table and initialize its list heads
+	 * Allocate the connection hash table and initialize its buckets
 	 */
-	ip_vs_conn_tab = vmalloc(ip_vs_conn_tab_size * sizeof(*ip_vs_conn_tab));
-	if (!ip_vs_conn_tab)
+	t = ip_vs_conn_tab_alloc(ip_vs_conn_tab_bits);
+	if (!t)
 		return -ENOMEM;
 
 	/* Allocate ip_vs_conn slab cache */
@@ -1343,23 +1547,19 @@ int __init ip_vs_conn_init(void)
 					      sizeof(struct ip_vs_conn), 0,
 					      SLAB_HWCACHE_ALIGN, NULL);
 	if (!ip_vs_conn_cachep) {
-		vfree(ip_vs_conn_tab);
+		vfree(t);
 		return -ENOMEM;
 	}
 
 	pr_info("Connection hash table configured "
 		"(size=%d, memory=%ldKbytes)\n",
 		ip_vs_conn_tab_size,
-		(long)(ip_vs_conn_tab_size*sizeof(struct list_head))/1024);
+		(long)(ip_vs_conn_tab_size*sizeof(t->buckets[0]))/1024);
 	IP_VS_DBG(0, "Each connection entry needs %Zd bytes at least\n",
 		  sizeof(struct ip_vs_conn));
 
-	for (idx = 0; idx < ip_vs_conn_tab_size; idx++)
-		INIT_HLIST_HEAD(&ip_vs_conn_tab[idx]);
-
-	for (idx = 0; idx < CT_LOCKARRAY_SIZE; idx++)  {
-		spin_lock_init(&__ip_vs_conntbl_lock_array[idx].l);
-	}
+	seqcount_init(&ip_vs_conn_seq);
+	RCU_INIT_POINTER(ip_vs_conn_tab, t);
 
 	/* calculate the random value for connection hash */
 	get_random_bytes(&ip_vs_conn_rnd, sizeof(ip_vs_conn_rnd));
@@ -1369,9 +1569,11 @@ int __init ip_vs_conn_init(void)
 
 void ip_vs_conn_cleanup(void)
 {
+	/* All connections are gone, no resize can be scheduled again */
+	cancel_work_sync(&ip_vs_conn_resize_work);
 	/* Wait all ip_vs_conn_rcu_free() callbacks to complete */
 	rcu_barrier();
 	/* Release the empty cache */
 	kmem_cache_destroy(ip_vs_conn_cachep);
-	vfree(ip_vs_conn_tab);
+	vfree(rcu_dereference_protected(ip_vs_conn_tab, 1));
 }
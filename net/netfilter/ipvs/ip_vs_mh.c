@@ -0,0 +1,469 @@
+/*
+ * IPVS:        Maglev Hashing scheduling module
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Changes:
+ *
+ */
+
+/*
+ * The mh algorithm assigns a preference list of all the lookup table
+ * positions to each destination and populates the table with the most
+ * preferred position of each destination in turn. The table size is a
+ * prime M, a destination starts at offset = h1(dest) mod M and steps by
+ * skip = h2(dest) mod (M - 1) + 1, so its preference list visits every
+ * position once:
+ *
+ *       while table is not full:
+ *           for each destination d with weight > 0:
+ *               repeat turns(d) times:
+ *                   p <- next position in preference list of d
+ *                        that is still empty
+ *                   table[p] <- d
+ *
+ *       n <- table[hash(src_ip, src_port) mod M];
+ *
+ * turns(d) is the weight of d reduced by the gcd of all the weights, so
+ * that the share of the table a destination gets follows its weight.
+ * When a destination is added or removed, most positions keep their
+ * destination, so few of the flows of a stateless director move. The
+ * hashes use fixed seeds: directors with the same destinations build the
+ * same table and send a flow to the same server.
+ *
+ * The table is rebuilt in process context when the destinations change,
+ * and swapped with RCU; packets only look it up.
+ *
+ * Reference: D. E. Eisenbud et al., "Maglev: A Fast and Reliable
+ * Software Network Load Balancer", NSDI 2016.
+ *
+ */
+
+#define KMSG_COMPONENT "IPVS"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/ip.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/skbuff.h>
+#include <linux/jhash.h>
+#include <linux/gcd.h>
+
+#include <net/ip_vs.h>
+
+#include <net/tcp.h>
+#include <linux/udp.h>
+#include <linux/sctp.h>
+
+
+/*
+ *     for IPVS MH lookup table, the size is a prime
+ */
+#ifndef CONFIG_IP_VS_MH_TAB_INDEX
+#define CONFIG_IP_VS_MH_TAB_INDEX	12
+#endif
+
+static const int ip_vs_mh_primes[] = {
+	251, 509, 1021, 2039, 4093, 8191, 16381, 32749, 65521, 131071
+};
+
+#define IP_VS_MH_TAB_SIZE	ip_vs_mh_primes[CONFIG_IP_VS_MH_TAB_INDEX - 8]
+
+/* fixed seeds, directors must agree on the table */
+#define IP_VS_MH_OFFSET_SEED	0x4d414731	/* "MAG1" */
+#define IP_VS_MH_SKIP_SEED	0x4d414732	/* "MAG2" */
+
+/*
+ *      IPVS MH lookup table, holding a reference to its destinations
+ */
+struct ip_vs_mh_lookup {
+	struct rcu_head		rcu_head;
+	struct ip_vs_dest	*dest[0];	/* real server (cache) */
+};
+
+struct ip_vs_mh_state {
+	struct rcu_head			rcu_head;
+	struct ip_vs_mh_lookup __rcu	*lookup;
+};
+
+/* Preference list walk of a destination while populating */
+struct ip_vs_mh_dest_setup {
+	struct ip_vs_dest	*dest;
+	unsigned int		perm;	/* next position to try */
+	unsigned int		skip;
+	unsigned int		turns;
+};
+
+/* Helper function to determine if server is unavailable */
+static inline bool is_unavailable(struct ip_vs_dest *dest)
+{
+	return atomic_read(&dest->weight) <= 0 ||
+	       dest->flags & IP_VS_DEST_F_OVERLOAD;
+}
+
+/*
+ *	Returns hash value for IPVS MH entry
+ */
+static inline unsigned int
+ip_vs_mh_hashkey(int af, const union nf_inet_addr *addr,
+		 __be16 port, u32 initval)
+{
+#ifdef CONFIG_IP_VS_IPV6
+	if (af == AF_INET6)
+		return jhash_2words(jhash(addr->ip6, 16, initval),
+				    (__force u32)port, initval);
+#endif
+	return jhash_2words((__force u32)addr->ip, (__force u32)port,
+			    initval);
+}
+
+
+/*
+ *      Get ip_vs_dest associated with supplied parameters.
+ */
+static inline struct ip_vs_dest *
+ip_vs_mh_get(struct ip_vs_service *svc, struct ip_vs_mh_lookup *l,
+	     const union nf_inet_addr *addr, __be16 port)
+{
+	unsigned int hash = ip_vs_mh_hashkey(svc->af, addr, port, 0);
+	struct ip_vs_dest *dest = l->dest[hash % IP_VS_MH_TAB_SIZE];
+
+	return (!dest || is_unavailable(dest)) ? NULL : dest;
+}
+
+
+/* As ip_vs_mh_get, but with fallback if selected server is unavailable
+ *
+ * The fallback strategy rehashes the flow with an increasing offset,
+ * starting from the original hash value to keep it deterministic, until
+ * it finds an available server.
+ */
+static inline struct ip_vs_dest *
+ip_vs_mh_get_fallback(struct ip_vs_service *svc, struct ip_vs_mh_lookup *l,
+		      const union nf_inet_addr *addr, __be16 port)
+{
+	unsigned int offset, roffset;
+	unsigned int hash, ihash;
+	struct ip_vs_dest *dest;
+
+	/* first try the dest it's supposed to go to */
+	ihash = ip_vs_mh_hashkey(svc->af, addr, port, 0) % IP_VS_MH_TAB_SIZE;
+	dest = l->dest[ihash];
+	if (!dest)
+		return NULL;
+	if (!is_unavailable(dest))
+		return dest;
+
+	IP_VS_DBG_BUF(6, "MH: selected unavailable server %s:%d, reselecting",
+		      IP_VS_DBG_ADDR(svc->af, &dest->addr), ntohs(dest->port));
+
+	/* if the original dest is unavailable, rehash from ihash on
+	 * to find a new dest
+	 */
+	for (offset = 0; offset < IP_VS_MH_TAB_SIZE; offset++) {
+		roffset = (offset + ihash) % IP_VS_MH_TAB_SIZE;
+		hash = ip_vs_mh_hashkey(svc->af, addr, port, roffset);
+		dest = l->dest[hash % IP_VS_MH_TAB_SIZE];
+		if (!dest)
+			break;
+		if (!is_unavailable(dest))
+			return dest;
+		IP_VS_DBG_BUF(6, "MH: selected unavailable "
+			      "server %s:%d (offset %d), reselecting",
+			      IP_VS_DBG_ADDR(svc->af, &dest->addr),
+			      ntohs(dest->port), roffset);
+	}
+
+	return NULL;
+}
+
+
+static struct ip_vs_mh_lookup *ip_vs_mh_lookup_alloc(void)
+{
+	size_t size = sizeof(struct ip_vs_mh_lookup) +
+		      IP_VS_MH_TAB_SIZE * sizeof(struct ip_vs_dest *);
+	struct ip_vs_mh_lookup *l;
+
+	l = kzalloc(size, GFP_KERNEL | __GFP_NOWARN);
+	if (!l)
+		l = vzalloc(size);
+	return l;
+}
+
+static void ip_vs_mh_lookup_free(struct rcu_head *head)
+{
+	struct ip_vs_mh_lookup *l;
+	int i;
+
+	l = container_of(head, struct ip_vs_mh_lookup, rcu_head);
+	for (i = 0; i < IP_VS_MH_TAB_SIZE; i++) {
+		if (l->dest[i])
+			ip_vs_dest_put(l->dest[i]);
+	}
+	kvfree(l);
+}
+
+
+/*
+ *      Reduce the weights to turns per round: divide them by their gcd,
+ *      then halve them while a round would take more than a quarter of
+ *      the table, so that the last destinations of the list still get
+ *      their share before the table is full.
+ */
+static void ip_vs_mh_turns(struct ip_vs_mh_dest_setup *ds, int n)
+{
+	unsigned int g = 0, sum, max;
+	int i;
+
+	for (i = 0; i < n; i++)
+		g = g ? gcd(g, ds[i].turns) : ds[i].turns;
+
+	for (;;) {
+		sum = max = 0;
+		for (i = 0; i < n; i++) {
+			ds[i].turns /= g;
+			sum += ds[i].turns;
+			max = max_t(unsigned int, max, ds[i].turns);
+		}
+		if (sum <= IP_VS_MH_TAB_SIZE / 4 || max == 1)
+			break;
+		for (i = 0; i < n; i++)
+			ds[i].turns = (ds[i].turns + 1) >> 1;
+		g = 1;
+	}
+}
+
+/*
+ *      Build the lookup table from the destinations of the service and
+ *      replace the current one.
+ */
+static int
+ip_vs_mh_populate(struct ip_vs_mh_state *s, struct ip_vs_service *svc)
+{
+	struct ip_vs_mh_dest_setup *ds, *d;
+	struct ip_vs_mh_lookup *l, *old;
+	struct ip_vs_dest *dest;
+	unsigned int filled = 0, t;
+	int i, n = 0;
+
+	l = ip_vs_mh_lookup_alloc();
+	if (!l)
+		return -ENOMEM;
+
+	ds = kcalloc(max_t(int, svc->num_dests, 1), sizeof(*ds), GFP_KERNEL);
+	if (!ds) {
+		kvfree(l);
+		return -ENOMEM;
+	}
+
+	list_for_each_entry(dest, &svc->destinations, n_list) {
+		int weight = atomic_read(&dest->weight);
+
+		if (weight <= 0 || n >= svc->num_dests)
+			continue;
+		d = &ds[n++];
+		d->dest = dest;
+		d->perm = ip_vs_mh_hashkey(svc->af, &dest->addr, dest->port,
+					   IP_VS_MH_OFFSET_SEED) %
+			  IP_VS_MH_TAB_SIZE;
+		d->skip = ip_vs_mh_hashkey(svc->af, &dest->addr, dest->port,
+					   IP_VS_MH_SKIP_SEED) %
+			  (IP_VS_MH_TAB_SIZE - 1) + 1;
+		d->turns = weight;
+	}
+	ip_vs_mh_turns(ds, n);
+
+	/* The table size is prime, every preference list visits all the
+	 * positions and the inner walk ends while the table is not full.
+	 */
+	while (n && filled < IP_VS_MH_TAB_SIZE) {
+		for (i = 0; i < n && filled < IP_VS_MH_TAB_SIZE; i++) {
+			d = &ds[i];
+			for (t = 0; t < d->turns &&
+				    filled < IP_VS_MH_TAB_SIZE; t++) {
+				while (l->dest[d->perm])
+					d->perm = (d->perm + d->skip) %
+						  IP_VS_MH_TAB_SIZE;
+				ip_vs_dest_hold(d->dest);
+				l->dest[d->perm] = d->dest;
+				filled++;
+			}
+		}
+	}
+	kfree(ds);
+
+	IP_VS_DBG(6, "MH: lookup table populated with %d dests\n", n);
+
+	old = rcu_dereference_protected(s->lookup, 1);
+	rcu_assign_pointer(s->lookup, l);
+	if (old)
+		call_rcu(&old->rcu_head, ip_vs_mh_lookup_free);
+	return 0;
+}
+
+
+static int ip_vs_mh_init_svc(struct ip_vs_service *svc)
+{
+	struct ip_vs_mh_state *s;
+	int ret;
+
+	/* allocate the MH state for this service */
+	s = kzalloc(sizeof(struct ip_vs_mh_state), GFP_KERNEL);
+	if (s == NULL)
+		return -ENOMEM;
+
+	/* populate the lookup table with current dests */
+	ret = ip_vs_mh_populate(s, svc);
+	if (ret) {
+		kfree(s);
+		return ret;
+	}
+
+	svc->sched_data = s;
+	IP_VS_DBG(6, "MH lookup table (memory=%Zdbytes) allocated for "
+		  "current service\n",
+		  sizeof(struct ip_vs_dest *) * IP_VS_MH_TAB_SIZE);
+
+	return 0;
+}
+
+
+static void ip_vs_mh_done_svc(struct ip_vs_service *svc)
+{
+	struct ip_vs_mh_state *s = svc->sched_data;
+	struct ip_vs_mh_lookup *l = rcu_dereference_protected(s->lookup, 1);
+
+	/* release the table and its dests once no packet uses them */
+	call_rcu(&l->rcu_head, ip_vs_mh_lookup_free);
+	kfree_rcu(s, rcu_head);
+	IP_VS_DBG(6, "MH lookup table (memory=%Zdbytes) released\n",
+		  sizeof(struct ip_vs_dest *) * IP_VS_MH_TAB_SIZE);
+}
+
+
+static int ip_vs_mh_dest_changed(struct ip_vs_service *svc,
+				 struct ip_vs_dest *dest)
+{
+	struct ip_vs_mh_state *s = svc->sched_data;
+
+	/* rebuild the lookup table with the updated service */
+	return ip_vs_mh_populate(s, svc);
+}
+
+
+/* Helper function to get port number */
+static inline __be16
+ip_vs_mh_get_port(const struct sk_buff *skb, struct ip_vs_iphdr *iph)
+{
+	__be16 port;
+	struct tcphdr _tcph, *th;
+	struct udphdr _udph, *uh;
+	sctp_sctphdr_t _sctph, *sh;
+
+	switch (iph->protocol) {
+	case IPPROTO_TCP:
+		th = skb_header_pointer(skb, iph->len, sizeof(_tcph), &_tcph);
+		if (unlikely(th == NULL))
+			return 0;
+		port = th->source;
+		break;
+	case IPPROTO_UDP:
+		uh = skb_header_pointer(skb, iph->len, sizeof(_udph), &_udph);
+		if (unlikely(uh == NULL))
+			return 0;
+		port = uh->source;
+		break;
+	case IPPROTO_SCTP:
+		sh = skb_header_pointer(skb, iph->len, sizeof(_sctph), &_sctph);
+		if (unlikely(sh == NULL))
+			return 0;
+		port = sh->source;
+		break;
+	default:
+		port = 0;
+	}
+
+	return port;
+}
+
+
+/*
+ *      Maglev Hashing scheduling
+ */
+static struct ip_vs_dest *
+ip_vs_mh_schedule(struct ip_vs_service *svc, const struct sk_buff *skb,
+		  struct ip_vs_iphdr *iph)
+{
+	struct ip_vs_dest *dest;
+	struct ip_vs_mh_state *s;
+	struct ip_vs_mh_lookup *l;
+	__be16 port = 0;
+
+	IP_VS_DBG(6, "ip_vs_mh_schedule(): Scheduling...\n");
+
+	if (svc->flags & IP_VS_SVC_F_SCHED_MH_PORT)
+		port = ip_vs_mh_get_port(skb, iph);
+
+	s = (struct ip_vs_mh_state *) svc->sched_data;
+	l = rcu_dereference(s->lookup);
+
+	if (svc->flags & IP_VS_SVC_F_SCHED_MH_FALLBACK)
+		dest = ip_vs_mh_get_fallback(svc, l, &iph->saddr, port);
+	else
+		dest = ip_vs_mh_get(svc, l, &iph->saddr, port);
+
+	if (!dest) {
+		ip_vs_scheduler_err(svc, "no destination available");
+		return NULL;
+	}
+
+	IP_VS_DBG_BUF(6, "MH: source IP address %s --> server %s:%d\n",
+		      IP_VS_DBG_ADDR(svc->af, &iph->saddr),
+		      IP_VS_DBG_ADDR(svc->af, &dest->addr),
+		      ntohs(dest->port));
+
+	return dest;
+}
+
+
+/*
+ *      IPVS MH Scheduler structure
+ */
+static struct ip_vs_scheduler ip_vs_mh_scheduler =
+{
+	.name =			"mh",
+	.refcnt =		ATOMIC_INIT(0),
+	.module =		THIS_MODULE,
+	.n_list	 =		LIST_HEAD_INIT(ip_vs_mh_scheduler.n_list),
+	.init_service =		ip_vs_mh_init_svc,
+	.done_service =		ip_vs_mh_done_svc,
+	.add_dest =		ip_vs_mh_dest_changed,
+	.del_dest =		ip_vs_mh_dest_changed,
+	.upd_dest =		ip_vs_mh_dest_changed,
+	.schedule =		ip_vs_mh_schedule,
+};
+
+
+static int __init ip_vs_mh_init(void)
+{
+	return register_ip_vs_scheduler(&ip_vs_mh_scheduler);
+}
+
+
+static void __exit ip_vs_mh_cleanup(void)
+{
+	unregister_ip_vs_scheduler(&ip_vs_mh_scheduler);
+	/* wait for the tables released with call_rcu() */
+	rcu_barrier();
+}
+
+
+module_init(ip_vs_mh_init);
+module_exit(ip_vs_mh_cleanup);
+MODULE_DESCRIPTION("Maglev hashing ipvs scheduler");
+MODULE_LICENSE("GPL");
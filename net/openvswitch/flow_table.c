@@ -40,12 +40,14 @@
 #include <linux/icmp.h>
 #include <linux/icmpv6.h>
 #include <linux/rculist.h>
+#include <linux/sort.h>
 #include <net/ip.h>
 #include <net/ipv6.h>
 #include <net/ndisc.h>
 
 #define TBL_MIN_BUCKETS		1024
 #define REHASH_INTERVAL		(10 * 60 * HZ)
+#define MASK_SORT_INTERVAL	(HZ)
 
 static struct kmem_cache *flow_cache;
 
@@ -216,20 +218,169 @@ static struct table_instance *table_instance_alloc(int new_size)
 	return ti;
 }
 
+static struct mask_array *mask_array_alloc(int count)
+{
+	struct mask_array *ma;
+
+	ma = kzalloc(sizeof(*ma) + count * sizeof(ma->masks[0]), GFP_KERNEL);
+	if (!ma)
+		return NULL;
+
+	ma->hits = __alloc_percpu(max(count, 1) * sizeof(u64),
+				  __alignof__(u64));
+	if (!ma->hits) {
+		kfree(ma);
+		return NULL;
+	}
+	return ma;
+}
+
+static void __mask_array_free(struct mask_array *ma)
+{
+	free_percpu(ma->cache);
+	free_percpu(ma->hits);
+	kfree(ma);
+}
+
+static void mask_array_free_rcu_cb(struct rcu_head *rcu)
+{
+	__mask_array_free(container_of(rcu, struct mask_array, rcu));
+}
+
+static void mask_array_free(struct mask_array *ma, bool deferred)
+{
+	if (deferred)
+		call_rcu(&ma->rcu, mask_array_free_rcu_cb);
+	else
+		__mask_array_free(ma);
+}
+
+static u64 mask_array_hits(const struct mask_array *ma, int index)
+{
+	u64 hits = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		hits += per_cpu_ptr(ma->hits, cpu)[index];
+	return hits;
+}
+
+struct mask_sort {
+	struct sw_flow_mask *mask;
+	u64 hits;
+};
+
+static int mask_sort_cmp(const void *a, const void *b)
+{
+	const struct mask_sort *ma = a, *mb = b;
+
+	if (ma->hits == mb->hits)
+		return 0;
+	return ma->hits > mb->hits ? -1 : 1;
+}
+
+static bool mask_listed(const struct flow_table *tbl,
+			const struct sw_flow_mask *mask)
+{
+	struct sw_flow_mask *m;
+
+	list_for_each_entry(m, &tbl->mask_list, list)
+		if (m == mask)
+			return true;
+	return false;
+}
+
+/* Rebuild the datapath mask array from the mask list, leaving 'exclude'
+ * out. Masks are ordered by the hits they got in the current array, new
+ * masks first as they have just been asked for. Called with ovs_mutex.
+ */
+static int tbl_mask_array_rebuild(struct flow_table *tbl,
+				  const struct sw_flow_mask *exclude)
+{
+	struct mask_array *old = ovsl_dereference(tbl->mask_array);
+	struct mask_array *new;
+	struct sw_flow_mask *mask;
+	struct mask_sort *ms;
+	int i, n = 0;
+
+	list_for_each_entry(mask, &tbl->mask_list, list)
+		n++;
+
+	new = mask_array_alloc(n);
+	ms = kmalloc_array(max(n, 1), sizeof(*ms), GFP_KERNEL);
+	if (!new || !ms) {
+		if (new)
+			mask_array_free(new, false);
+		kfree(ms);
+		/* Keep the current array, without the masks going away. */
+		for (i = 0; old && i < old->count; i++) {
+			mask = ovsl_dereference(old->masks[i]);
+			if (!mask)
+				continue;
+			if (mask == exclude || !mask_listed(tbl, mask))
+				RCU_INIT_POINTER(old->masks[i], NULL);
+		}
+		return -ENOMEM;
+	}
+
+	n = 0;
+	list_for_each_entry(mask, &tbl->mask_list, list) {
+		if (mask == exclude)
+			continue;
+		ms[n].mask = mask;
+		ms[n].hits = U64_MAX;
+		for (i = 0; old && i < old->count; i++) {
+			if (ovsl_dereference(old->masks[i]) == mask) {
+				ms[n].hits = mask_array_hits(old, i);
+				break;
+			}
+		}
+		n++;
+	}
+	sort(ms, n, sizeof(*ms), mask_sort_cmp, NULL);
+
+	for (i = 0; i < n; i++)
+		RCU_INIT_POINTER(new->masks[i], ms[i].mask);
+	new->count = n;
+	kfree(ms);
+
+	rcu_assign_pointer(tbl->mask_array, new);
+	if (old)
+		mask_array_free(old, true);
+	tbl->last_sort = jiffies;
+	return 0;
+}
+
 int ovs_flow_tbl_init(struct flow_table *table)
 {
 	struct table_instance *ti;
 
+	table->mask_cache = __alloc_percpu(sizeof(struct mask_cache_entry) *
+					   MC_HASH_ENTRIES,
+					   __alignof__(u32));
+	if (!table->mask_cache)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&table->mask_list);
+	RCU_INIT_POINTER(table->mask_array, NULL);
+	if (tbl_mask_array_rebuild(table, NULL))
+		goto free_mask_cache;
+
 	ti = table_instance_alloc(TBL_MIN_BUCKETS);
 
 	if (!ti)
-		return -ENOMEM;
+		goto free_mask_array;
 
 	rcu_assign_pointer(table->ti, ti);
-	INIT_LIST_HEAD(&table->mask_list);
 	table->last_rehash = jiffies;
 	table->count = 0;
 	return 0;
+
+free_mask_array:
+	mask_array_free(ovsl_dereference(table->mask_array), false);
+free_mask_cache:
+	free_percpu(table->mask_cache);
+	return -ENOMEM;
 }
 
 static void flow_tbl_destroy_rcu_cb(struct rcu_head *rcu)
@@ -271,8 +422,15 @@ skip_flows:
 void ovs_flow_tbl_destroy(struct flow_table *table, bool deferred)
 {
 	struct table_instance *ti = ovsl_dereference(table->ti);
+	struct mask_array *ma = ovsl_dereference(table->mask_array);
 
 	table_instance_destroy(ti, deferred);
+
+	/* The datapath may still look the cache up until the grace period
+	 * ends, let it go with the last mask array.
+	 */
+	ma->cache = table->mask_cache;
+	mask_array_free(ma, deferred);
 }
 
 struct sw_flow *ovs_flow_tbl_dump_next(struct table_instance *ti,
@@ -369,6 +527,8 @@ int ovs_flow_tbl_flush(struct flow_table *flow_table)
 	flow_table->count = 0;
 
 	table_instance_destroy(old_ti, true);
+	/* All the masks are gone with the flows. */
+	tbl_mask_array_rebuild(flow_table, NULL);
 	return 0;
 }
 
@@ -448,30 +608,110 @@ static struct sw_flow *masked_flow_lookup(struct table_instance *ti,
 	return NULL;
 }
 
-struct sw_flow *ovs_flow_tbl_lookup_stats(struct flow_table *tbl,
-				    const struct sw_flow_key *key,
-				    u32 *n_mask_hit)
+/* Try the mask at '*index' first, then the others in order. On a match
+ * '*index' is set to the mask that matched.
+ */
+static struct sw_flow *flow_lookup(struct table_instance *ti,
+				   struct mask_array *ma,
+				   const struct sw_flow_key *key,
+				   u32 *n_mask_hit, u32 *index)
 {
-	struct table_instance *ti = rcu_dereference_ovsl(tbl->ti);
 	struct sw_flow_mask *mask;
 	struct sw_flow *flow;
+	int i;
 
-	*n_mask_hit = 0;
-	list_for_each_entry_rcu(mask, &tbl->mask_list, list) {
+	if (likely(*index < ma->count)) {
+		mask = rcu_dereference_ovsl(ma->masks[*index]);
+		if (mask) {
+			(*n_mask_hit)++;
+			flow = masked_flow_lookup(ti, key, mask);
+			if (flow)  /* Found */
+				return flow;
+		}
+	}
+
+	for (i = 0; i < ma->count; i++) {
+		if (i == *index)
+			continue;
+		mask = rcu_dereference_ovsl(ma->masks[i]);
+		if (!mask)
+			continue;
 		(*n_mask_hit)++;
 		flow = masked_flow_lookup(ti, key, mask);
-		if (flow)  /* Found */
+		if (flow) {  /* Found */
+			*index = i;
 			return flow;
+		}
 	}
 	return NULL;
 }
 
+/* Datapath lookup. The per-CPU mask cache remembers, for an skb hash,
+ * which mask matched last, so that most packets need a single masked
+ * lookup. This relies on the flows of the datapath not overlapping: the
+ * first mask that matches is the only one.
+ */
+struct sw_flow *ovs_flow_tbl_lookup_stats(struct flow_table *tbl,
+				    const struct sw_flow_key *key,
+				    u32 skb_hash,
+				    u32 *n_mask_hit)
+{
+	struct table_instance *ti = rcu_dereference_ovsl(tbl->ti);
+	struct mask_array *ma = rcu_dereference_ovsl(tbl->mask_array);
+	struct mask_cache_entry *entries, *ce, *e;
+	struct sw_flow *flow;
+	u32 hash = skb_hash;
+	u32 index = 0, *pindex = &index;
+	int seg;
+
+	*n_mask_hit = 0;
+	if (unlikely(!skb_hash)) {
+		flow = flow_lookup(ti, ma, key, n_mask_hit, pindex);
+		goto out;
+	}
+
+	ce = NULL;
+	entries = this_cpu_ptr(tbl->mask_cache);
+
+	/* Find the cache entry of this hash, or the one to replace. */
+	for (seg = 0; seg < MC_HASH_SEGS; seg++) {
+		e = &entries[hash & (MC_HASH_ENTRIES - 1)];
+
+		if (e->skb_hash == skb_hash) {
+			pindex = &e->mask_index;
+			flow = flow_lookup(ti, ma, key, n_mask_hit, pindex);
+			if (!flow)
+				e->skb_hash = 0;
+			goto out;
+		}
+
+		if (!ce || e->skb_hash < ce->skb_hash)
+			ce = e;  /* A better replacement cache candidate. */
+
+		hash >>= MC_HASH_SHIFT;
+	}
+
+	/* Cache miss, do full lookup. */
+	pindex = &ce->mask_index;
+	flow = flow_lookup(ti, ma, key, n_mask_hit, pindex);
+	if (flow)
+		ce->skb_hash = skb_hash;
+
+out:
+	if (flow)
+		this_cpu_ptr(ma->hits)[*pindex]++;
+	return flow;
+}
+
 struct sw_flow *ovs_flow_tbl_lookup(struct flow_table *tbl,
 				    const struct sw_flow_key *key)
 {
+	struct mask_array *ma = rcu_dereference_ovsl(tbl->mask_array);
+	struct table_instance *ti = rcu_dereference_ovsl(tbl->ti);
 	u32 __always_unused n_mask_hit;
+	u32 index = 0;
 
-	return ovs_flow_tbl_lookup_stats(tbl, key, &n_mask_hit);
+	return flow_lookup(ti, ma, key, &n_mask_hit, &index);
 }
 
 int ovs_flow_tbl_num_masks(const struct flow_table *table)
@@ -497,6 +737,12 @@ void ovs_flow_tbl_remove(struct flow_table *table, struct sw_flow *flow)
 	BUG_ON(table->count == 0);
 	hlist_del_rcu(&flow->hash_node[ti->node_ver]);
 	table->count--;
+
+	/* The mask goes away with its last flow in ovs_flow_free(), take it
+	 * off the datapath array before.
+	 */
+	if (flow->mask && flow->mask->ref_count == 1)
+		tbl_mask_array_rebuild(table, flow->mask);
 }
 
 static struct sw_flow_mask *mask_alloc(void)
@@ -550,6 +796,11 @@ static int flow_mask_insert(struct flow_table *tbl, struct sw_flow *flow,
 		mask->key = new->key;
 		mask->range = new->range;
 		list_add_rcu(&mask->list, &tbl->mask_list);
+		if (tbl_mask_array_rebuild(tbl, NULL)) {
+			list_del_rcu(&mask->list);
+			kfree_rcu(mask, rcu);
+			return -ENOMEM;
+		}
 	} else {
 		BUG_ON(!mask->ref_count);
 		mask->ref_count++;
@@ -587,6 +838,10 @@ int ovs_flow_tbl_insert(struct flow_table *table, struct sw_flow *flow,
 		table_instance_destroy(ti, true);
 		table->last_rehash = jiffies;
 	}
+
+	/* Follow the hit counts of the masks. */
+	if (time_after(jiffies, table->last_sort + MASK_SORT_INTERVAL))
+		tbl_mask_array_rebuild(table, NULL);
 	return 0;
 }
 
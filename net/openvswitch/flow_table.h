@@ -45,10 +45,37 @@ struct table_instance {
 	bool keep_flows;
 };
 
+/* Per-CPU cache of the mask that last matched a packet with this skb hash,
+ * looked up with MC_HASH_SEGS slices of the hash.
+ */
+#define MC_HASH_SHIFT		8
+#define MC_HASH_ENTRIES		(1u << MC_HASH_SHIFT)
+#define MC_HASH_SEGS		((sizeof(u32) * 8) / MC_HASH_SHIFT)
+
+struct mask_cache_entry {
+	u32 skb_hash;
+	u32 mask_index;
+};
+
+/* Masks in the order the datapath tries them, most hit first. Rebuilt
+ * under ovs_mutex whenever a mask comes or goes, and once in a while to
+ * follow the hit counts.
+ */
+struct mask_array {
+	struct rcu_head rcu;
+	u64 __percpu *hits;	/* per mask, since the array was built */
+	struct mask_cache_entry __percpu *cache; /* released with the table */
+	int count;
+	struct sw_flow_mask __rcu *masks[];
+};
+
 struct flow_table {
 	struct table_instance __rcu *ti;
+	struct mask_cache_entry __percpu *mask_cache;
+	struct mask_array __rcu *mask_array;
 	struct list_head mask_list;
 	unsigned long last_rehash;
+	unsigned long last_sort;
 	unsigned int count;
 };
 
@@ -71,6 +98,7 @@ struct sw_flow *ovs_flow_tbl_dump_next(struct table_instance *table,
 				       u32 *bucket, u32 *idx);
 struct sw_flow *ovs_flow_tbl_lookup_stats(struct flow_table *,
 				    const struct sw_flow_key *,
+				    u32 skb_hash,
 				    u32 *n_mask_hit);
 struct sw_flow *ovs_flow_tbl_lookup(struct flow_table *,
 				    const struct sw_flow_key *);
@@ -3,7 +3,9 @@
  *
  * Might be used to classify traffic through flexible, user-defined and
  * possibly JIT-ed BPF filters for traffic control as an alternative to
- * ematches.
+ * ematches. Besides classic BPF, internal BPF programs loaded through
+ * bpf(2) are accepted. In direct-action mode the value the program
+ * returns is the final TC_ACT_* verdict, no actions are run.
  *
  * (C) 2013 Daniel Borkmann <dborkman@redhat.com>
  *
@@ -16,6 +18,7 @@
 #include <linux/types.h>
 #include <linux/skbuff.h>
 #include <linux/filter.h>
+#include <linux/bpf.h>
 #include <net/rtnetlink.h>
 #include <net/pkt_cls.h>
 #include <net/sock.h>
@@ -31,31 +34,70 @@ struct cls_bpf_head {
 
 struct cls_bpf_prog {
 	struct sk_filter *filter;
-	struct sock_filter *bpf_ops;
+	struct sock_filter *bpf_ops;	/* classic BPF only */
+	char *bpf_name;			/* internal BPF only */
 	struct tcf_exts exts;
 	struct tcf_result res;
 	struct list_head link;
 	u32 handle;
 	u16 bpf_len;
+	bool exts_integrated;		/* direct-action mode */
 };
 
+#define CLS_BPF_NAME_LEN	256
+
 static const struct nla_policy bpf_policy[TCA_BPF_MAX + 1] = {
 	[TCA_BPF_CLASSID]	= { .type = NLA_U32 },
 	[TCA_BPF_OPS_LEN]	= { .type = NLA_U16 },
 	[TCA_BPF_OPS]		= { .type = NLA_BINARY,
 				    .len = sizeof(struct sock_filter) * BPF_MAXINSNS },
+	[TCA_BPF_FD]		= { .type = NLA_U32 },
+	[TCA_BPF_NAME]		= { .type = NLA_NUL_STRING,
+				    .len = CLS_BPF_NAME_LEN },
+	[TCA_BPF_FLAGS]		= { .type = NLA_U32 },
 };
 
+static bool cls_bpf_is_ebpf(const struct cls_bpf_prog *prog)
+{
+	return !prog->bpf_ops;
+}
+
+/* verdicts a direct-action program may return, anything else lets the
+ * next filter have a go
+ */
+static int cls_bpf_exec_opcode(int code)
+{
+	switch (code) {
+	case TC_ACT_OK:
+	case TC_ACT_SHOT:
+	case TC_ACT_STOLEN:
+		return code;
+	default:
+		return TC_ACT_UNSPEC;
+	}
+}
+
 static int cls_bpf_classify(struct sk_buff *skb, const struct tcf_proto *tp,
 			    struct tcf_result *res)
 {
 	struct cls_bpf_head *head = tp->root;
 	struct cls_bpf_prog *prog;
-	int ret;
+	int ret = -1;
 
+	/* maps used by internal BPF programs are RCU protected */
+	rcu_read_lock();
 	list_for_each_entry(prog, &head->plist, link) {
 		int filter_res = SK_RUN_FILTER(prog->filter, skb);
 
+		if (prog->exts_integrated) {
+			ret = cls_bpf_exec_opcode(filter_res);
+			if (ret == TC_ACT_UNSPEC)
+				continue;
+
+			*res = prog->res;
+			break;
+		}
+
 		if (filter_res == 0)
 			continue;
 
@@ -67,10 +109,11 @@ static int cls_bpf_classify(struct sk_buff *skb, const struct tcf_proto *tp,
 		if (ret < 0)
 			continue;
 
-		return ret;
+		break;
 	}
+	rcu_read_unlock();
 
-	return -1;
+	return ret;
 }
 
 static int cls_bpf_init(struct tcf_proto *tp)
@@ -87,14 +130,25 @@ static int cls_bpf_init(struct tcf_proto *tp)
 	return 0;
 }
 
+static void cls_bpf_release_filter(struct sk_filter *fp,
+				   struct sock_filter *bpf_ops,
+				   char *bpf_name)
+{
+	if (bpf_ops) {
+		sk_unattached_filter_destroy(fp);
+		kfree(bpf_ops);
+	} else if (fp) {
+		bpf_prog_put(fp);
+		kfree(bpf_name);
+	}
+}
+
 static void cls_bpf_delete_prog(struct tcf_proto *tp, struct cls_bpf_prog *prog)
 {
 	tcf_unbind_filter(tp, &prog->res);
 	tcf_exts_destroy(tp, &prog->exts);
 
-	sk_unattached_filter_destroy(prog->filter);
-
-	kfree(prog->bpf_ops);
+	cls_bpf_release_filter(prog->filter, prog->bpf_ops, prog->bpf_name);
 	kfree(prog);
 }
 
@@ -153,72 +207,144 @@ static void cls_bpf_put(struct tcf_proto *tp, unsigned long f)
 {
 }
 
+static int cls_bpf_prog_from_ops(struct nlattr **tb, struct sk_filter **fpp,
+				 struct sock_filter **opsp, u16 *lenp)
+{
+	struct sock_filter *bpf_ops;
+	struct sock_fprog tmp;
+	u16 bpf_size, bpf_len;
+	int ret;
+
+	bpf_len = nla_get_u16(tb[TCA_BPF_OPS_LEN]);
+	if (bpf_len > BPF_MAXINSNS || bpf_len == 0)
+		return -EINVAL;
+
+	bpf_size = bpf_len * sizeof(*bpf_ops);
+	if (bpf_size != nla_len(tb[TCA_BPF_OPS]))
+		return -EINVAL;
+
+	bpf_ops = kzalloc(bpf_size, GFP_KERNEL);
+	if (bpf_ops == NULL)
+		return -ENOMEM;
+
+	memcpy(bpf_ops, nla_data(tb[TCA_BPF_OPS]), bpf_size);
+
+	tmp.len = bpf_len;
+	tmp.filter = (struct sock_filter __user *) bpf_ops;
+
+	ret = sk_unattached_filter_create(fpp, &tmp);
+	if (ret) {
+		kfree(bpf_ops);
+		return ret;
+	}
+
+	*opsp = bpf_ops;
+	*lenp = bpf_len;
+	return 0;
+}
+
+static int cls_bpf_prog_from_efd(struct nlattr **tb, struct sk_filter **fpp,
+				 char **namep)
+{
+	struct sk_filter *fp;
+	char *name = NULL;
+
+	fp = bpf_prog_get(nla_get_u32(tb[TCA_BPF_FD]));
+	if (IS_ERR(fp))
+		return PTR_ERR(fp);
+
+	if (fp->aux->prog_type != BPF_PROG_TYPE_SCHED_CLS) {
+		bpf_prog_put(fp);
+		return -EINVAL;
+	}
+
+	if (tb[TCA_BPF_NAME]) {
+		name = kmemdup(nla_data(tb[TCA_BPF_NAME]),
+			       nla_len(tb[TCA_BPF_NAME]), GFP_KERNEL);
+		if (!name) {
+			bpf_prog_put(fp);
+			return -ENOMEM;
+		}
+	}
+
+	*fpp = fp;
+	*namep = name;
+	return 0;
+}
+
 static int cls_bpf_modify_existing(struct net *net, struct tcf_proto *tp,
 				   struct cls_bpf_prog *prog,
 				   unsigned long base, struct nlattr **tb,
 				   struct nlattr *est)
 {
-	struct sock_filter *bpf_ops, *bpf_old;
-	struct tcf_exts exts;
-	struct sock_fprog tmp;
+	struct sock_filter *bpf_ops = NULL, *bpf_old;
 	struct sk_filter *fp, *fp_old;
-	u16 bpf_size, bpf_len;
-	u32 classid;
+	char *bpf_name = NULL, *name_old;
+	bool is_bpf, is_ebpf, act_direct = false;
+	struct tcf_exts exts;
+	u16 bpf_len = 0;
+	u32 classid = 0;
 	int ret;
 
-	if (!tb[TCA_BPF_OPS_LEN] || !tb[TCA_BPF_OPS] || !tb[TCA_BPF_CLASSID])
+	is_bpf = tb[TCA_BPF_OPS_LEN] && tb[TCA_BPF_OPS];
+	is_ebpf = tb[TCA_BPF_FD];
+	if (is_bpf == is_ebpf)
 		return -EINVAL;
 
-	tcf_exts_init(&exts, TCA_BPF_ACT, TCA_BPF_POLICE);
-	ret = tcf_exts_validate(net, tp, tb, est, &exts);
-	if (ret < 0)
-		return ret;
+	if (tb[TCA_BPF_FLAGS]) {
+		u32 bpf_flags = nla_get_u32(tb[TCA_BPF_FLAGS]);
 
-	classid = nla_get_u32(tb[TCA_BPF_CLASSID]);
-	bpf_len = nla_get_u16(tb[TCA_BPF_OPS_LEN]);
-	if (bpf_len > BPF_MAXINSNS || bpf_len == 0) {
-		ret = -EINVAL;
-		goto errout;
+		if (bpf_flags & ~TCA_BPF_FLAG_ACT_DIRECT)
+			return -EINVAL;
+
+		act_direct = bpf_flags & TCA_BPF_FLAG_ACT_DIRECT;
 	}
 
-	bpf_size = bpf_len * sizeof(*bpf_ops);
-	bpf_ops = kzalloc(bpf_size, GFP_KERNEL);
-	if (bpf_ops == NULL) {
-		ret = -ENOMEM;
-		goto errout;
+	/* in direct-action mode the program is the action, the classid
+	 * is optional
+	 */
+	if (act_direct) {
+		if (tb[TCA_BPF_ACT] || tb[TCA_BPF_POLICE])
+			return -EINVAL;
+	} else if (!tb[TCA_BPF_CLASSID]) {
+		return -EINVAL;
 	}
 
-	memcpy(bpf_ops, nla_data(tb[TCA_BPF_OPS]), bpf_size);
+	tcf_exts_init(&exts, TCA_BPF_ACT, TCA_BPF_POLICE);
+	ret = tcf_exts_validate(net, tp, tb, est, &exts);
+	if (ret < 0)
+		return ret;
 
-	tmp.len = bpf_len;
-	tmp.filter = (struct sock_filter __user *) bpf_ops;
+	if (tb[TCA_BPF_CLASSID])
+		classid = nla_get_u32(tb[TCA_BPF_CLASSID]);
 
-	ret = sk_unattached_filter_create(&fp, &tmp);
-	if (ret)
-		goto errout_free;
+	if (is_bpf)
+		ret = cls_bpf_prog_from_ops(tb, &fp, &bpf_ops, &bpf_len);
+	else
+		ret = cls_bpf_prog_from_efd(tb, &fp, &bpf_name);
+	if (ret < 0)
+		goto errout;
 
 	tcf_tree_lock(tp);
 	fp_old = prog->filter;
 	bpf_old = prog->bpf_ops;
+	name_old = prog->bpf_name;
 
 	prog->bpf_len = bpf_len;
 	prog->bpf_ops = bpf_ops;
+	prog->bpf_name = bpf_name;
 	prog->filter = fp;
+	prog->exts_integrated = act_direct;
 	prog->res.classid = classid;
 	tcf_tree_unlock(tp);
 
 	tcf_bind_filter(tp, &prog->res, base);
 	tcf_exts_change(tp, &prog->exts, &exts);
 
-	if (fp_old)
-		sk_unattached_filter_destroy(fp_old);
-	if (bpf_old)
-		kfree(bpf_old);
+	cls_bpf_release_filter(fp_old, bpf_old, name_old);
 
 	return 0;
 
-errout_free:
-	kfree(bpf_ops);
 errout:
 	tcf_exts_destroy(tp, &exts);
 	return ret;
@@ -312,15 +438,26 @@ static int cls_bpf_dump(struct net *net, struct tcf_proto *tp, unsigned long fh,
 
 	if (nla_put_u32(skb, TCA_BPF_CLASSID, prog->res.classid))
 		goto nla_put_failure;
-	if (nla_put_u16(skb, TCA_BPF_OPS_LEN, prog->bpf_len))
-		goto nla_put_failure;
 
-	nla = nla_reserve(skb, TCA_BPF_OPS, prog->bpf_len *
-			  sizeof(struct sock_filter));
-	if (nla == NULL)
-		goto nla_put_failure;
+	if (cls_bpf_is_ebpf(prog)) {
+		if (prog->bpf_name &&
+		    nla_put_string(skb, TCA_BPF_NAME, prog->bpf_name))
+			goto nla_put_failure;
+	} else {
+		if (nla_put_u16(skb, TCA_BPF_OPS_LEN, prog->bpf_len))
+			goto nla_put_failure;
+
+		nla = nla_reserve(skb, TCA_BPF_OPS, prog->bpf_len *
+				  sizeof(struct sock_filter));
+		if (nla == NULL)
+			goto nla_put_failure;
 
-	memcpy(nla_data(nla), prog->bpf_ops, nla_len(nla));
+		memcpy(nla_data(nla), prog->bpf_ops, nla_len(nla));
+	}
+
+	if (prog->exts_integrated &&
+	    nla_put_u32(skb, TCA_BPF_FLAGS, TCA_BPF_FLAG_ACT_DIRECT))
+		goto nla_put_failure;
 
 	if (tcf_exts_dump(skb, &prog->exts) < 0)
 		goto nla_put_failure;
@@ -0,0 +1,123 @@
+/* SCTP kernel implementation
+ *
+ * This file is part of the SCTP kernel implementation
+ *
+ * GSO support for SCTP.  sctp_packet_transmit() hands down one skb
+ * whose frag_list skbs each hold the bundled chunks of one packet, the
+ * head carrying the common header for all of them.  Segmentation puts
+ * a copy of the headers in front of every frag and fills in the CRC32c
+ * of each resulting packet, unless the device does that itself.
+ *
+ * This SCTP implementation is free software;
+ * you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This SCTP implementation is distributed in the hope that it
+ * will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ *                 ************************
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU CC; see the file COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Please send any bug reports or fixes you make to the
+ * email address(es):
+ *    lksctp developers <linux-sctp@vger.kernel.org>
+ */
+
+#include <linux/kernel.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <net/protocol.h>
+#include <net/sctp/sctp.h>
+#include <net/sctp/checksum.h>
+
+static struct sk_buff *sctp_gso_segment(struct sk_buff *skb,
+					netdev_features_t features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	struct sk_buff *frag;
+	struct sctphdr *sh;
+
+	if (!(skb_shinfo(skb)->gso_type & SKB_GSO_SCTP) ||
+	    skb_shinfo(skb)->gso_size != GSO_BY_FRAGS)
+		goto out;
+
+	if (!pskb_may_pull(skb, sizeof(*sh)))
+		goto out;
+
+	__skb_pull(skb, sizeof(*sh));
+
+	if (skb_gso_ok(skb, features | NETIF_F_GSO_ROBUST)) {
+		/* Packet is from an untrusted source, reset gso_segs. */
+		int gso_segs = 0;
+
+		skb_walk_frags(skb, frag)
+			gso_segs++;
+		skb_shinfo(skb)->gso_segs = gso_segs;
+
+		segs = NULL;
+		goto out;
+	}
+
+	/* The frag_list skbs are linear, so every segment ends up a
+	 * clone of one of them whatever the device supports.
+	 */
+	segs = skb_segment(skb, features | NETIF_F_HW_CSUM | NETIF_F_SG);
+	if (IS_ERR(segs))
+		goto out;
+
+	for (frag = segs; frag; frag = frag->next) {
+		sh = sctp_hdr(frag);
+		if (features & NETIF_F_SCTP_CSUM) {
+			frag->ip_summed = CHECKSUM_PARTIAL;
+			frag->csum_start = skb_transport_header(frag) -
+					   frag->head;
+			frag->csum_offset = offsetof(struct sctphdr, checksum);
+		} else {
+			sh->checksum = sctp_compute_cksum(frag,
+						skb_transport_offset(frag));
+			frag->ip_summed = CHECKSUM_NONE;
+		}
+	}
+
+out:
+	return segs;
+}
+
+static const struct net_offload sctp_offload = {
+	.callbacks = {
+		.gso_segment = sctp_gso_segment,
+	},
+};
+
+static const struct net_offload sctp6_offload = {
+	.callbacks = {
+		.gso_segment = sctp_gso_segment,
+	},
+};
+
+int __init sctp_offload_init(void)
+{
+	int ret;
+
+	ret = inet_add_offload(&sctp_offload, IPPROTO_SCTP);
+	if (ret)
+		return ret;
+
+	ret = inet6_add_offload(&sctp6_offload, IPPROTO_SCTP);
+	if (ret)
+		inet_del_offload(&sctp_offload, IPPROTO_SCTP);
+
+	return ret;
+}
+
+void sctp_offload_exit(void)
+{
+	inet6_del_offload(&sctp6_offload, IPPROTO_SCTP);
+	inet_del_offload(&sctp_offload, IPPROTO_SCTP);
+}
@@ -371,6 +371,24 @@ static void sctp_packet_set_owner_w(struct sk_buff *skb, struct sock *sk)
 	atomic_inc(&sk->sk_wmem_alloc);
 }
 
+/* The path MTU the packets of this transport are cut to. */
+static size_t sctp_packet_pmtu(const struct sctp_packet *packet)
+{
+	const struct sctp_transport *tp = packet->transport;
+
+	return tp->asoc ? tp->asoc->pathmtu : tp->pathmtu;
+}
+
+/* Can a packet bundled past the path MTU go down as one GSO skb?  Like
+ * CRC offload, this is not done for packets that go through IPsec.
+ */
+static bool sctp_packet_gso_ok(const struct sctp_transport *tp)
+{
+	const struct dst_entry *dst = tp->dst;
+
+	return dst && !dst_xfrm(dst) && (dst->dev->features & NETIF_F_GSO);
+}
+
 /* All packets are sent to the network through this function from
  * sctp_outq_tail().
  *
@@ -381,7 +399,8 @@ int sctp_packet_transmit(struct sctp_packet *packet)
 	struct sctp_transport *tp = packet->transport;
 	struct sctp_association *asoc = tp->asoc;
 	struct sctphdr *sh;
-	struct sk_buff *nskb;
+	struct sk_buff *nskb = NULL;
+	struct sk_buff *pkt;	/* skb the chunks are copied to */
 	struct sctp_chunk *chunk, *tmp;
 	struct sock *sk;
 	int err = 0;
@@ -389,6 +408,8 @@ int sctp_packet_transmit(struct sctp_packet *packet)
 	__u8 has_data = 0;
 	struct dst_entry *dst;
 	unsigned char *auth = NULL;	/* pointer to auth in skb data */
+	size_t pmtu, chunk_len, seg_len = 0;
+	int gso = 0, gso_segs = 0;
 
 	pr_debug("%s: packet:%p\n", __func__, packet);
 
@@ -400,10 +421,35 @@ int sctp_packet_transmit(struct sctp_packet *packet)
 	chunk = list_entry(packet->chunk_list.next, struct sctp_chunk, list);
 	sk = chunk->skb->sk;
 
+	if (!sctp_transport_dst_check(tp)) {
+		sctp_transport_route(tp, NULL, sctp_sk(sk));
+		if (asoc && (asoc->param_flags & SPP_PMTUD_ENABLE)) {
+			sctp_assoc_sync_pmtu(sk, asoc);
+		}
+	}
+	dst = dst_clone(tp->dst);
+	if (!dst)
+		goto no_route;
+
+	/* A packet bundled past the path MTU goes out as GSO segments, or
+	 * as IP fragments if the route no longer allows for GSO.  The GSO
+	 * head only carries the headers, each segment is a frag_list skb.
+	 */
+	pmtu = sctp_packet_pmtu(packet);
+	if (packet->size > pmtu && !packet->ipfragok) {
+		if (sctp_packet_gso_ok(tp))
+			gso = 1;
+		else
+			packet->ipfragok = 1;
+	}
+
 	/* Allocate the new skb.  */
-	nskb = alloc_skb(packet->size + LL_MAX_HEADER, GFP_ATOMIC);
-	if (!nskb)
+	nskb = alloc_skb((gso ? packet->overhead : packet->size) +
+			 LL_MAX_HEADER, GFP_ATOMIC);
+	if (!nskb) {
+		dst_release(dst);
 		goto nomem;
+	}
 
 	/* Make sure the outbound skb has enough header room reserved. */
 	skb_reserve(nskb, packet->overhead + LL_MAX_HEADER);
@@ -412,16 +458,6 @@ int sctp_packet_transmit(struct sctp_packet *packet)
 	 * destination IP address.
 	 */
 	sctp_packet_set_owner_w(nskb, sk);
-
-	if (!sctp_transport_dst_check(tp)) {
-		sctp_transport_route(tp, NULL, sctp_sk(sk));
-		if (asoc && (asoc->param_flags & SPP_PMTUD_ENABLE)) {
-			sctp_assoc_sync_pmtu(sk, asoc);
-		}
-	}
-	dst = dst_clone(tp->dst);
-	if (!dst)
-		goto no_route;
 	skb_dst_set(nskb, dst);
 
 	/* Build the SCTP header.  */
@@ -463,7 +499,32 @@ int sctp_packet_transmit(struct sctp_packet *packet)
 
 	pr_debug("***sctp_transmit_packet***\n");
 
+	pkt = nskb;
 	list_for_each_entry_safe(chunk, tmp, &packet->chunk_list, list) {
+		chunk_len = WORD_ROUND(chunk->skb->len);
+
+		/* Start the next GSO segment once this chunk no longer
+		 * fits into the current one.
+		 */
+		if (gso && (pkt == nskb || seg_len + chunk_len > pmtu)) {
+			size_t size = max(pmtu, packet->overhead + chunk_len);
+			struct sk_buff *seg;
+
+			seg = alloc_skb(size + LL_MAX_HEADER, GFP_ATOMIC);
+			if (!seg)
+				goto nomem_seg;
+			skb_reserve(seg, packet->overhead + LL_MAX_HEADER);
+
+			if (pkt == nskb)
+				skb_shinfo(nskb)->frag_list = seg;
+			else
+				pkt->next = seg;
+			pkt = seg;
+			seg_len = packet->overhead;
+			gso_segs++;
+		}
+		seg_len += chunk_len;
+
 		list_del_init(&chunk->list);
 		if (sctp_chunk_is_data(chunk)) {
 			/* 6.3.1 C4) When data is in flight and when allowed
@@ -490,9 +551,9 @@ int sctp_packet_transmit(struct sctp_packet *packet)
 		 * the auth into the packet.
 		 */
 		if (chunk == packet->auth)
-			auth = skb_tail_pointer(nskb);
+			auth = skb_tail_pointer(pkt);
 
-		memcpy(skb_put(nskb, chunk->skb->len),
+		memcpy(skb_put(pkt, chunk->skb->len),
 			       chunk->skb->data, chunk->skb->len);
 
 		pr_debug("*** Chunk:%p[%s] %s 0x%x, length:%d, chunk->skb->len:%d, "
@@ -512,6 +573,19 @@ int sctp_packet_transmit(struct sctp_packet *packet)
 			sctp_chunk_free(chunk);
 	}
 
+	if (gso) {
+		struct sk_buff *seg;
+
+		skb_walk_frags(nskb, seg) {
+			nskb->len += seg->len;
+			nskb->data_len += seg->len;
+			nskb->truesize += seg->truesize;
+		}
+		skb_shinfo(nskb)->gso_type = SKB_GSO_SCTP;
+		skb_shinfo(nskb)->gso_size = GSO_BY_FRAGS;
+		skb_shinfo(nskb)->gso_segs = gso_segs;
+	}
+
 	/* SCTP-AUTH, Section 6.2
 	 *    The sender MUST calculate the MAC as described in RFC2104 [2]
 	 *    using the hash function H as described by the MAC Identifier and
@@ -533,7 +607,14 @@ int sctp_packet_transmit(struct sctp_packet *packet)
 	 * Note: Adler-32 is no longer applicable, as has been replaced
 	 * by CRC32-C as described in <draft-ietf-tsvwg-sctpcsum-02.txt>.
 	 */
-	if (!sctp_checksum_disable) {
+	if (gso) {
+		/* sctp_gso_segment() does it for each segment, or leaves
+		 * it to the device.
+		 */
+		nskb->ip_summed = CHECKSUM_PARTIAL;
+		nskb->csum_start = skb_transport_header(nskb) - nskb->head;
+		nskb->csum_offset = offsetof(struct sctphdr, checksum);
+	} else if (!sctp_checksum_disable) {
 		if (!(dst->dev->features & NETIF_F_SCTP_CSUM) ||
 		    (dst_xfrm(dst) != NULL) || packet->ipfragok) {
 			sh->checksum = sctp_compute_cksum(nskb, 0);
@@ -620,6 +701,8 @@ err:
 			sctp_chunk_free(chunk);
 	}
 	goto out;
+nomem_seg:
+	kfree_skb(nskb);
 nomem:
 	err = -ENOMEM;
 	goto err;
@@ -741,6 +824,27 @@ static void sctp_packet_append_data(struct sctp_packet *packet,
 	sctp_chunk_assign_ssn(chunk);
 }
 
+/* Whether a DATA chunk that takes the packet past the path MTU can go
+ * into a segment of its own.  That needs GSO on the route and nothing
+ * in the packet that only makes sense once, like AUTH or COOKIE-ECHO.
+ */
+static bool sctp_packet_gso_fits(const struct sctp_packet *packet,
+				 const struct sctp_chunk *chunk,
+				 u16 chunk_len, size_t pmtu)
+{
+	const struct sctp_transport *tp = packet->transport;
+
+	if (!sctp_chunk_is_data(chunk) || !packet->has_data ||
+	    packet->ipfragok || packet->has_cookie_echo ||
+	    packet->auth || chunk->auth)
+		return false;
+
+	if (packet->overhead + chunk_len > pmtu || !sctp_packet_gso_ok(tp))
+		return false;
+
+	return packet->size + chunk_len < tp->dst->dev->gso_max_size;
+}
+
 static sctp_xmit_t sctp_packet_will_fit(struct sctp_packet *packet,
 					struct sctp_chunk *chunk,
 					u16 chunk_len)
@@ -751,12 +855,16 @@ static sctp_xmit_t sctp_packet_will_fit(struct sctp_packet *packet,
 	sctp_xmit_t retval = SCTP_XMIT_OK;
 
 	psize = packet->size;
-	pmtu  = ((packet->transport->asoc) ?
-		(packet->transport->asoc->pathmtu) :
-		(packet->transport->pathmtu));
+	pmtu  = sctp_packet_pmtu(packet);
 
 	too_big = (psize + chunk_len > pmtu);
 
+	/* Past the path MTU, DATA may still go into the next segment of
+	 * a GSO packet.
+	 */
+	if (too_big && sctp_packet_gso_fits(packet, chunk, chunk_len, pmtu))
+		too_big = 0;
+
 	/* Decide if we need to fragment or resubmit later. */
 	if (too_big) {
 		/* It's OK to fragmet at IP level if any one of the following
@@ -767,8 +875,9 @@ static sctp_xmit_t sctp_packet_will_fit(struct sctp_packet *packet,
 		 * 	3. The packet doesn't have any data in it yet and data
 		 * 	requires authentication.
 		 */
-		if (sctp_packet_empty(packet) || !sctp_chunk_is_data(chunk) ||
-		    (!packet->has_data && chunk->auth)) {
+		if ((psize <= pmtu || packet->ipfragok) &&
+		    (sctp_packet_empty(packet) || !sctp_chunk_is_data(chunk) ||
+		     (!packet->has_data && chunk->auth))) {
 			/* We no longer do re-fragmentation.
 			 * Just fragment at the IP layer, if we
 			 * actually hit this condition
@@ -1466,8 +1466,14 @@ static __init int sctp_init(void)
 	if (status)
 		goto err_v6_add_protocol;
 
+	status = sctp_offload_init();
+	if (status)
+		goto err_offload_init;
+
 out:
 	return status;
+err_offload_init:
+	sctp_v6_del_protocol();
 err_v6_add_protocol:
 	sctp_v4_del_protocol();
 err_add_protocol:
@@ -1505,6 +1511,8 @@ static __exit void sctp_exit(void)
 	 * up all the remaining associations and all that memory.
 	 */
 
+	sctp_offload_exit();
+
 	/* Unregister with inet6/inet layers. */
 	sctp_v6_del_protocol();
 	sctp_v4_del_protocol();
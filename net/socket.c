@@ -884,6 +884,37 @@ static ssize_t sock_splice_read(struct file *file, loff_t *ppos,
 	return sock->ops->splice_read(sock, ppos, pipe, len, flags);
 }
 
+/**
+ *	sock_splice_to_sock - splice data from one socket to another
+ *	@in: file of the socket to read from
+ *	@out: file of the socket to write to
+ *	@len: number of bytes to move
+ *	@flags: splice modifier flags
+ *
+ *	Called by splice() when both ends are sockets, so that the data does
+ *	not need to go through a pipe. Only supported if the protocol of @in
+ *	implements ->splice_to_sock().
+ */
+long sock_splice_to_sock(struct file *in, struct file *out, size_t len,
+			 unsigned int flags)
+{
+	struct socket *sock, *sock_out;
+	int err;
+
+	sock = sock_from_file(in, &err);
+	if (!sock)
+		return err;
+	sock_out = sock_from_file(out, &err);
+	if (!sock_out)
+		return err;
+
+	if (unlikely(!sock->ops->splice_to_sock))
+		return -EINVAL;
+
+	return sock->ops->splice_to_sock(sock, sock_out, len, flags);
+}
+EXPORT_SYMBOL(sock_splice_to_sock);
+
 static struct sock_iocb *alloc_sock_iocb(struct kiocb *iocb,
 					 struct sock_iocb *siocb)
 {
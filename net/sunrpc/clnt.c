@@ -284,6 +284,87 @@ static struct rpc_xprt *rpc_clnt_set_transport(struct rpc_clnt *clnt,
 	return old;
 }
 
+/*
+ * Transport number i of clnt; 0 is cl_xprt. Must be called under
+ * rcu_read_lock().
+ */
+static struct rpc_xprt *rpc_clnt_xprt(struct rpc_clnt *clnt, unsigned int i)
+{
+	if (i == 0)
+		return rcu_dereference(clnt->cl_xprt);
+	return clnt->cl_xprts[i - 1];
+}
+
+/*
+ * Pick the transport a new task will use, and take a reference to it.
+ * Tasks are spread round-robin over the client's transports, passing
+ * over any whose slot table is congested when another one is not.
+ */
+static struct rpc_xprt *rpc_clnt_pick_xprt(struct rpc_clnt *clnt)
+{
+	unsigned int n = clnt->cl_nconnect;
+	unsigned int start, i;
+	struct rpc_xprt *xprt;
+
+	rcu_read_lock();
+	if (n <= 1) {
+		xprt = xprt_get(rcu_dereference(clnt->cl_xprt));
+		goto out;
+	}
+	start = (unsigned int)atomic_inc_return(&clnt->cl_xprt_next);
+	for (i = 0; i < n; i++) {
+		xprt = rpc_clnt_xprt(clnt, (start + i) % n);
+		if (!test_bit(XPRT_CONGESTED, &xprt->state))
+			break;
+	}
+	if (i == n)
+		xprt = rpc_clnt_xprt(clnt, start % n);
+	xprt = xprt_get(xprt);
+out:
+	rcu_read_unlock();
+	return xprt;
+}
+
+/*
+ * Open the additional transports asked for by args->nconnect, all to the
+ * same server as cl_xprt. Running with fewer than asked for is not an
+ * error.
+ */
+static void rpc_clnt_add_xprts(struct rpc_clnt *clnt,
+			       const struct rpc_create_args *args,
+			       struct xprt_create *xprtargs)
+{
+	unsigned int nconnect = min_t(unsigned int, args->nconnect,
+				      RPC_MAX_NCONNECT);
+	struct rpc_xprt *xprt;
+
+	while (clnt->cl_nconnect < nconnect) {
+		xprt = xprt_create_transport(xprtargs);
+		if (IS_ERR(xprt)) {
+			dprintk("RPC:       %s: transport %u failed: %ld\n",
+				__func__, clnt->cl_nconnect, PTR_ERR(xprt));
+			break;
+		}
+		xprt->resvport = 1;
+		if (args->flags & RPC_CLNT_CREATE_NONPRIVPORT)
+			xprt->resvport = 0;
+		clnt->cl_xprts[clnt->cl_nconnect - 1] = xprt;
+		clnt->cl_nconnect++;
+	}
+}
+
+/*
+ * Drop the additional transports, leaving clnt with cl_xprt alone.
+ */
+static void rpc_clnt_put_xprts(struct rpc_clnt *clnt)
+{
+	while (clnt->cl_nconnect > 1) {
+		clnt->cl_nconnect--;
+		xprt_put(clnt->cl_xprts[clnt->cl_nconnect - 1]);
+		clnt->cl_xprts[clnt->cl_nconnect - 1] = NULL;
+	}
+}
+
 static void rpc_clnt_set_nodename(struct rpc_clnt *clnt, const char *nodename)
 {
 	clnt->cl_nodelen = strlen(nodename);
@@ -409,6 +490,7 @@ static struct rpc_clnt * rpc_new_client(const struct rpc_create_args *args,
 	}
 
 	rpc_clnt_set_transport(clnt, xprt, timeout);
+	clnt->cl_nconnect = 1;
 
 	clnt->cl_rtt = &clnt->cl_rtt_default;
 	rpc_init_rtt(&clnt->cl_rtt_default, clnt->cl_timeout->to_initval);
@@ -483,6 +565,7 @@ EXPORT_SYMBOL_GPL(rpc_create_xprt);
 struct rpc_clnt *rpc_create(struct rpc_create_args *args)
 {
 	struct rpc_xprt *xprt;
+	struct rpc_clnt *clnt;
 	struct xprt_create xprtargs = {
 		.net = args->net,
 		.ident = args->protocol,
@@ -546,7 +629,10 @@ struct rpc_clnt *rpc_create(struct rpc_create_args *args)
 	if (args->flags & RPC_CLNT_CREATE_NONPRIVPORT)
 		xprt->resvport = 0;
 
-	return rpc_create_xprt(args, xprt);
+	clnt = rpc_create_xprt(args, xprt);
+	if (!IS_ERR(clnt) && args->nconnect > 1)
+		rpc_clnt_add_xprts(clnt, args, &xprtargs);
+	return clnt;
 }
 EXPORT_SYMBOL_GPL(rpc_create);
 
@@ -560,6 +646,7 @@ static struct rpc_clnt *__rpc_clone_client(struct rpc_create_args *args,
 {
 	struct rpc_xprt *xprt;
 	struct rpc_clnt *new;
+	unsigned int i;
 	int err;
 
 	err = -ENOMEM;
@@ -576,6 +663,11 @@ static struct rpc_clnt *__rpc_clone_client(struct rpc_create_args *args,
 		goto out_err;
 	}
 
+	/* Clones share all of the parent's transports */
+	for (i = 1; i < clnt->cl_nconnect; i++)
+		new->cl_xprts[i - 1] = xprt_get(clnt->cl_xprts[i - 1]);
+	new->cl_nconnect = clnt->cl_nconnect;
+
 	/* Turn off autobind on clones */
 	new->cl_autobind = 0;
 	new->cl_softrtry = clnt->cl_softrtry;
@@ -688,6 +780,8 @@ int rpc_switch_client_transport(struct rpc_clnt *clnt,
 	synchronize_rcu();
 	if (parent != clnt)
 		rpc_release_client(parent);
+	/* The additional transports go to the old server too */
+	rpc_clnt_put_xprts(clnt);
 	xprt_put(old);
 	dprintk("RPC:       replaced xprt for clnt %p\n", clnt);
 	return 0;
@@ -772,6 +866,7 @@ rpc_free_client(struct rpc_clnt *clnt)
 	rpc_unregister_client(clnt);
 	rpc_free_iostats(clnt->cl_metrics);
 	clnt->cl_metrics = NULL;
+	rpc_clnt_put_xprts(clnt);
 	xprt_put(rcu_dereference_raw(clnt->cl_xprt));
 	rpciod_down();
 	rpc_free_clid(clnt);
@@ -865,6 +960,10 @@ void rpc_task_release_client(struct rpc_task *task)
 		list_del(&task->tk_task);
 		spin_unlock(&clnt->cl_lock);
 		task->tk_client = NULL;
+		if (task->tk_xprt) {
+			xprt_put(task->tk_xprt);
+			task->tk_xprt = NULL;
+		}
 
 		rpc_release_client(clnt);
 	}
@@ -881,15 +980,10 @@ void rpc_task_set_client(struct rpc_task *task, struct rpc_clnt *clnt)
 			task->tk_flags |= RPC_TASK_SOFT;
 		if (clnt->cl_noretranstimeo)
 			task->tk_flags |= RPC_TASK_NO_RETRANS_TIMEOUT;
-		if (sk_memalloc_socks()) {
-			struct rpc_xprt *xprt;
-
-			rcu_read_lock();
-			xprt = rcu_dereference(clnt->cl_xprt);
-			if (xprt->swapper)
-				task->tk_flags |= RPC_TASK_SWAPPER;
-			rcu_read_unlock();
-		}
+		task->tk_xprt = rpc_clnt_pick_xprt(clnt);
+		if (sk_memalloc_socks() && task->tk_xprt &&
+		    task->tk_xprt->swapper)
+			task->tk_flags |= RPC_TASK_SWAPPER;
 		/* Add to the client's list of all tasks */
 		spin_lock(&clnt->cl_lock);
 		list_add_tail(&task->tk_task, &clnt->cl_tasks);
@@ -683,7 +683,8 @@ void rpcb_getport_async(struct rpc_task *task)
 	rcu_read_lock();
 	do {
 		clnt = rpcb_find_transport_owner(task->tk_client);
-		xprt = xprt_get(rcu_dereference(clnt->cl_xprt));
+		xprt = xprt_get(task->tk_xprt ? :
+				rcu_dereference(clnt->cl_xprt));
 	} while (xprt == NULL);
 	rcu_read_unlock();
 
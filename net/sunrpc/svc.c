@@ -766,6 +766,33 @@ svc_set_num_threads(struct svc_serv *serv, struct svc_pool *pool, int nrservs)
 }
 EXPORT_SYMBOL_GPL(svc_set_num_threads);
 
+/*
+ * Add a thread to an autoscaling pool that has had transports queue for
+ * want of an idle thread, unless it is at sv_pool_max_threads already.
+ * Threads leave such a pool again after SVC_POOL_IDLE_TIMEOUT idle, down
+ * to sv_pool_min_threads. Called from a thread of the service, with the
+ * same mutual exclusion as svc_set_num_threads().
+ */
+int
+svc_pool_grow(struct svc_serv *serv, struct svc_pool *pool)
+{
+	unsigned int nrthreads;
+
+	if (!test_and_clear_bit(SP_NEED_THREAD, &pool->sp_flags))
+		return 0;
+
+	spin_lock_bh(&pool->sp_lock);
+	nrthreads = pool->sp_nrthreads;
+	spin_unlock_bh(&pool->sp_lock);
+	if (nrthreads >= serv->sv_pool_max_threads)
+		return 0;
+
+	dprintk("svc: growing pool %u of %s to %u threads\n",
+		pool->sp_id, serv->sv_name, nrthreads + 1);
+	return svc_set_num_threads(serv, pool, nrthreads + 1);
+}
+EXPORT_SYMBOL_GPL(svc_pool_grow);
+
 /*
  * Called from a server thread as it's exiting. Caller must hold the BKL or
  * the "service mutex", whichever is appropriate for the service.
@@ -782,7 +809,9 @@ svc_exit_thread(struct svc_rqst *rqstp)
 	kfree(rqstp->rq_auth_data);
 
 	spin_lock_bh(&pool->sp_lock);
-	pool->sp_nrthreads--;
+	/* svc_get_next_xprt() already uncounted threads that left idle */
+	if (!rqstp->rq_pool_exit)
+		pool->sp_nrthreads--;
 	list_del(&rqstp->rq_all);
 	spin_unlock_bh(&pool->sp_lock);
 
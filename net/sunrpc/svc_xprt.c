@@ -349,9 +349,20 @@ void svc_xprt_enqueue(struct svc_xprt *xprt)
 	if (!svc_xprt_has_something_to_do(xprt))
 		return;
 
-	cpu = get_cpu();
-	pool = svc_pool_for_cpu(xprt->xpt_server, cpu);
-	put_cpu();
+	pool = ACCESS_ONCE(xprt->xpt_pool);
+	if (!pool) {
+		cpu = get_cpu();
+		pool = svc_pool_for_cpu(xprt->xpt_server, cpu);
+		put_cpu();
+		/*
+		 * Data arriving in softirq context came in on this cpu's
+		 * NIC queue. Bind the connection to that pool, so it is
+		 * not moved by enqueues from wherever its threads run.
+		 */
+		if (in_serving_softirq() &&
+		    test_bit(XPT_TEMP, &xprt->xpt_flags))
+			xprt->xpt_pool = pool;
+	}
 
 	spin_lock_bh(&pool->sp_lock);
 
@@ -393,6 +404,8 @@ void svc_xprt_enqueue(struct svc_xprt *xprt)
 		dprintk("svc: transport %p put into queue\n", xprt);
 		list_add_tail(&xprt->xpt_ready, &pool->sp_sockets);
 		pool->sp_stats.sockets_queued++;
+		if (pool->sp_nrthreads < xprt->xpt_server->sv_pool_max_threads)
+			set_bit(SP_NEED_THREAD, &pool->sp_flags);
 	}
 
 out_unlock:
@@ -612,9 +625,20 @@ static int svc_alloc_arg(struct svc_rqst *rqstp)
 	return 0;
 }
 
+/*
+ * May a thread that found nothing to do leave its autoscaling pool?
+ * Must be called with pool->sp_lock held.
+ */
+static bool svc_pool_may_shrink(struct svc_serv *serv, struct svc_pool *pool)
+{
+	return serv->sv_pool_max_threads &&
+	       pool->sp_nrthreads > max(serv->sv_pool_min_threads, 1U);
+}
+
 static struct svc_xprt *svc_get_next_xprt(struct svc_rqst *rqstp, long timeout)
 {
 	struct svc_xprt *xprt;
+	struct svc_serv		*serv = rqstp->rq_server;
 	struct svc_pool		*pool = rqstp->rq_pool;
 	DECLARE_WAITQUEUE(wait, current);
 	long			time_left;
@@ -644,6 +668,9 @@ static struct svc_xprt *svc_get_next_xprt(struct svc_rqst *rqstp, long timeout)
 		}
 		/* No data pending. Go to sleep */
 		svc_thread_enqueue(pool, rqstp);
+		clear_bit(SP_NEED_THREAD, &pool->sp_flags);
+		if (serv->sv_pool_max_threads)
+			timeout = min_t(long, timeout, SVC_POOL_IDLE_TIMEOUT);
 
 		/*
 		 * We have to be able to interrupt this wait
@@ -679,6 +706,15 @@ static struct svc_xprt *svc_get_next_xprt(struct svc_rqst *rqstp, long timeout)
 		xprt = rqstp->rq_xprt;
 		if (!xprt) {
 			svc_thread_dequeue(pool, rqstp);
+			if (!time_left && svc_pool_may_shrink(serv, pool)) {
+				/* Idle too long: leave the pool */
+				pool->sp_nrthreads--;
+				rqstp->rq_pool_exit = true;
+				spin_unlock_bh(&pool->sp_lock);
+				dprintk("svc: server %p idle, leaving pool %u\n",
+					rqstp, pool->sp_id);
+				return ERR_PTR(-EINTR);
+			}
 			spin_unlock_bh(&pool->sp_lock);
 			dprintk("svc: server %p, no data yet\n", rqstp);
 			if (signalled() || kthread_should_stop())
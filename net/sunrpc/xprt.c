@@ -1136,6 +1136,17 @@ void xprt_free(struct rpc_xprt *xprt)
 }
 EXPORT_SYMBOL_GPL(xprt_free);
 
+/*
+ * The transport a task without a request slot yet will reserve from.
+ * Must be called under rcu_read_lock().
+ */
+static struct rpc_xprt *xprt_task_xprt(struct rpc_task *task)
+{
+	if (task->tk_xprt)
+		return task->tk_xprt;
+	return rcu_dereference(task->tk_client->cl_xprt);
+}
+
 /**
  * xprt_reserve - allocate an RPC request slot
  * @task: RPC task requesting a slot allocation
@@ -1155,7 +1166,7 @@ void xprt_reserve(struct rpc_task *task)
 	task->tk_timeout = 0;
 	task->tk_status = -EAGAIN;
 	rcu_read_lock();
-	xprt = rcu_dereference(task->tk_client->cl_xprt);
+	xprt = xprt_task_xprt(task);
 	if (!xprt_throttle_congested(xprt, task))
 		xprt->ops->alloc_slot(xprt, task);
 	rcu_read_unlock();
@@ -1181,7 +1192,7 @@ void xprt_retry_reserve(struct rpc_task *task)
 	task->tk_timeout = 0;
 	task->tk_status = -EAGAIN;
 	rcu_read_lock();
-	xprt = rcu_dereference(task->tk_client->cl_xprt);
+	xprt = xprt_task_xprt(task);
 	xprt->ops->alloc_slot(xprt, task);
 	rcu_read_unlock();
 }
@@ -1231,7 +1242,7 @@ void xprt_release(struct rpc_task *task)
 	if (req == NULL) {
 		if (task->tk_client) {
 			rcu_read_lock();
-			xprt = rcu_dereference(task->tk_client->cl_xprt);
+			xprt = xprt_task_xprt(task);
 			if (xprt->snd_task == task)
 				xprt_release_write(xprt, task);
 			rcu_read_unlock();
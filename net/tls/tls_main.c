@@ -0,0 +1,443 @@
+/*
+ * TLS record layer offload for TCP sockets
+ *
+ * The TLS handshake stays in user space. Once it is done, the
+ * application attaches the "tls" ULP to the TCP socket and installs the
+ * transmit keys with setsockopt(SOL_TLS, TLS_TX); from then on data sent
+ * on the socket, including with sendfile(), is framed and encrypted as
+ * TLS records in the kernel.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+
+#include <net/tcp.h>
+#include <net/inet_common.h>
+#include <linux/highmem.h>
+#include <linux/netdevice.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+
+#include <net/tls.h>
+
+MODULE_DESCRIPTION("Transport Layer Security Support");
+MODULE_LICENSE("GPL");
+
+enum {
+	TLSV4,
+	TLSV6,
+	TLS_NUM_PROTS,
+};
+
+static struct proto *saved_tcpv6_prot;
+static DEFINE_MUTEX(tcpv6_prot_mutex);
+static struct proto tls_prots[TLS_NUM_PROTS][TLS_NUM_CONFIG];
+
+static inline void update_sk_prot(struct sock *sk, struct tls_context *ctx)
+{
+	int ip_ver = sk->sk_family == AF_INET6 ? TLSV6 : TLSV4;
+
+	sk->sk_prot = &tls_prots[ip_ver][ctx->tx_conf];
+}
+
+/* Wait for another thread that is sleeping while pushing a record */
+static int wait_on_pending_writer(struct sock *sk, long *timeo)
+{
+	int rc = 0;
+	DEFINE_WAIT(wait);
+
+	while (1) {
+		if (!*timeo) {
+			rc = -EAGAIN;
+			break;
+		}
+
+		if (signal_pending(current)) {
+			rc = sock_intr_errno(*timeo);
+			break;
+		}
+
+		prepare_to_wait(sk_sleep(sk), &wait, TASK_INTERRUPTIBLE);
+		if (sk_wait_event(sk, timeo, !sk->sk_write_pending))
+			break;
+	}
+	finish_wait(sk_sleep(sk), &wait);
+
+	return rc;
+}
+
+/**
+ *	tls_push_sg - hand an encrypted record to TCP
+ *	@sk: socket to send on
+ *	@ctx: TLS context of @sk
+ *	@sg: first element of the record left to send
+ *	@first_offset: bytes of @sg already sent
+ *	@flags: MSG_DONTWAIT and MSG_NOSIGNAL are honoured
+ *
+ *	The pages are queued with do_tcp_sendpages() and released as they
+ *	are taken. If TCP does not take the whole record, the remainder is
+ *	remembered as partially sent record and sent before any new record.
+ *	Returns 0 once the whole record went out, or the error of TCP.
+ */
+int tls_push_sg(struct sock *sk, struct tls_context *ctx,
+		struct scatterlist *sg, u16 first_offset, int flags)
+{
+	int sendpage_flags = flags | MSG_SENDPAGE_NOTLAST;
+	int offset = first_offset;
+	struct page *p;
+	size_t size;
+	int ret;
+
+	size = sg->length - offset;
+	offset += sg->offset;
+
+	ctx->partially_sent_record = NULL;
+	ctx->in_tcp_sendpages = true;
+	while (1) {
+		if (sg_is_last(sg))
+			sendpage_flags = flags;
+
+		p = sg_page(sg);
+retry:
+		ret = do_tcp_sendpages(sk, p, offset, size, sendpage_flags);
+
+		if (ret != size) {
+			if (ret > 0) {
+				offset += ret;
+				size -= ret;
+				goto retry;
+			}
+
+			offset -= sg->offset;
+			ctx->partially_sent_offset = offset;
+			ctx->partially_sent_record = sg;
+			ctx->in_tcp_sendpages = false;
+			return ret;
+		}
+
+		put_page(p);
+		sk_mem_uncharge(sk, sg->length);
+		if (sg_is_last(sg))
+			break;
+
+		sg = sg_next(sg);
+		offset = sg->offset;
+		size = sg->length;
+	}
+
+	ctx->in_tcp_sendpages = false;
+	ctx->sk_write_space(sk);
+
+	return 0;
+}
+EXPORT_SYMBOL(tls_push_sg);
+
+static int tls_push_pending_closed_record(struct sock *sk,
+					  struct tls_context *ctx, int flags)
+{
+	struct scatterlist *sg = ctx->partially_sent_record;
+	u16 offset = ctx->partially_sent_offset;
+
+	return tls_push_sg(sk, ctx, sg, offset, flags);
+}
+
+/* Called with the socket locked before a new record may be started */
+int tls_complete_pending_work(struct sock *sk, struct tls_context *ctx,
+			      int flags, long *timeo)
+{
+	int rc = 0;
+
+	if (unlikely(sk->sk_write_pending))
+		rc = wait_on_pending_writer(sk, timeo);
+
+	if (!rc && tls_is_pending_closed_record(ctx))
+		rc = tls_push_pending_closed_record(sk, ctx, flags);
+
+	return rc;
+}
+EXPORT_SYMBOL(tls_complete_pending_work);
+
+static void tls_write_space(struct sock *sk)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	/* When called from inside do_tcp_sendpages(), only wake up the
+	 * waiters there; the record is pushed by its caller.
+	 */
+	if (ctx->in_tcp_sendpages) {
+		ctx->sk_write_space(sk);
+		return;
+	}
+
+	if (!sk->sk_write_pending && tls_is_pending_closed_record(ctx)) {
+		gfp_t sk_allocation = sk->sk_allocation;
+		int rc;
+
+		sk->sk_allocation = GFP_ATOMIC;
+		rc = tls_push_pending_closed_record(sk, ctx,
+						    MSG_DONTWAIT |
+						    MSG_NOSIGNAL);
+		sk->sk_allocation = sk_allocation;
+
+		if (rc < 0)
+			return;
+	}
+
+	ctx->sk_write_space(sk);
+}
+
+static void tls_sk_proto_close(struct sock *sk, long timeout)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	long timeo = sock_sndtimeo(sk, 0);
+	struct proto *sk_proto = ctx->sk_proto;
+
+	lock_sock(sk);
+
+	if (ctx->tx_conf == TLS_BASE_TX)
+		goto skip_tx_cleanup;
+
+	if (!tls_complete_pending_work(sk, ctx, 0, &timeo))
+		tls_sw_push_open_record(sk, 0);
+
+	/* drop what TCP did not take before the socket went away */
+	if (ctx->partially_sent_record) {
+		struct scatterlist *sg = ctx->partially_sent_record;
+
+		while (1) {
+			put_page(sg_page(sg));
+			sk_mem_uncharge(sk, sg->length);
+
+			if (sg_is_last(sg))
+				break;
+			sg++;
+		}
+	}
+
+	tls_sw_free_tx_resources(sk);
+	sk->sk_write_space = ctx->sk_write_space;
+
+skip_tx_cleanup:
+	sk->sk_prot = sk_proto;
+	inet_csk(sk)->icsk_ulp_data = NULL;
+	kzfree(ctx);
+	release_sock(sk);
+
+	sk_proto->close(sk, timeout);
+}
+
+static int do_tls_getsockopt_tx(struct sock *sk, char __user *optval,
+				int __user *optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	struct tls_crypto_info *crypto_info;
+	int len;
+
+	if (get_user(len, optlen))
+		return -EFAULT;
+
+	if (!optval || (len < sizeof(*crypto_info)))
+		return -EINVAL;
+
+	/* get user crypto info */
+	crypto_info = &ctx->crypto_send;
+
+	if (!TLS_CRYPTO_INFO_READY(crypto_info))
+		return -EBUSY;
+
+	if (len == sizeof(*crypto_info)) {
+		if (copy_to_user(optval, crypto_info, sizeof(*crypto_info)))
+			return -EFAULT;
+		return 0;
+	}
+
+	switch (crypto_info->cipher_type) {
+	case TLS_CIPHER_AES_GCM_128: {
+		struct tls12_crypto_info_aes_gcm_128 info;
+
+		if (len != sizeof(info))
+			return -EINVAL;
+
+		/* report the state of the next record */
+		lock_sock(sk);
+		info = ctx->crypto_send_aes_gcm_128;
+		memcpy(info.iv, ctx->iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE,
+		       TLS_CIPHER_AES_GCM_128_IV_SIZE);
+		memcpy(info.rec_seq, ctx->rec_seq,
+		       TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+		release_sock(sk);
+
+		if (copy_to_user(optval, &info, sizeof(info)))
+			return -EFAULT;
+		return 0;
+	}
+	default:
+		return -EINVAL;
+	}
+}
+
+static int tls_getsockopt(struct sock *sk, int level, int optname,
+			  char __user *optval, int __user *optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	if (level != SOL_TLS)
+		return ctx->sk_proto->getsockopt(sk, level, optname,
+						 optval, optlen);
+
+	switch (optname) {
+	case TLS_TX:
+		return do_tls_getsockopt_tx(sk, optval, optlen);
+	default:
+		return -ENOPROTOOPT;
+	}
+}
+
+static int do_tls_setsockopt_tx(struct sock *sk, char __user *optval,
+				unsigned int optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	struct tls_crypto_info *crypto_info;
+	struct tls_crypto_info tmp_crypto_info;
+	int rc;
+
+	if (!optval || (optlen < sizeof(*crypto_info)))
+		return -EINVAL;
+
+	crypto_info = &ctx->crypto_send;
+
+	/* Currently we don't support set crypto info more than one time */
+	if (TLS_CRYPTO_INFO_READY(crypto_info))
+		return -EBUSY;
+
+	if (copy_from_user(&tmp_crypto_info, optval, sizeof(*crypto_info)))
+		return -EFAULT;
+
+	/* check version */
+	if (tmp_crypto_info.version != TLS_1_2_VERSION)
+		return -ENOTSUPP;
+
+	switch (tmp_crypto_info.cipher_type) {
+	case TLS_CIPHER_AES_GCM_128:
+		if (optlen != sizeof(struct tls12_crypto_info_aes_gcm_128))
+			return -EINVAL;
+		if (copy_from_user(&ctx->crypto_send_aes_gcm_128, optval,
+				   optlen))
+			return -EFAULT;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	rc = tls_set_sw_offload(sk, ctx);
+	if (rc)
+		goto err_crypto_info;
+
+	ctx->sk_write_space = sk->sk_write_space;
+	sk->sk_write_space = tls_write_space;
+
+	ctx->tx_conf = TLS_SW_TX;
+	update_sk_prot(sk, ctx);
+	return 0;
+
+err_crypto_info:
+	memset(&ctx->crypto_send_aes_gcm_128, 0,
+	       sizeof(ctx->crypto_send_aes_gcm_128));
+	return rc;
+}
+
+static int tls_setsockopt(struct sock *sk, int level, int optname,
+			  char __user *optval, unsigned int optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	int rc;
+
+	if (level != SOL_TLS)
+		return ctx->sk_proto->setsockopt(sk, level, optname,
+						 optval, optlen);
+
+	switch (optname) {
+	case TLS_TX:
+		lock_sock(sk);
+		rc = do_tls_setsockopt_tx(sk, optval, optlen);
+		release_sock(sk);
+		return rc;
+	default:
+		return -ENOPROTOOPT;
+	}
+}
+
+static void build_protos(struct proto *prot, struct proto *base)
+{
+	prot[TLS_BASE_TX] = *base;
+	prot[TLS_BASE_TX].setsockopt	= tls_setsockopt;
+	prot[TLS_BASE_TX].getsockopt	= tls_getsockopt;
+	prot[TLS_BASE_TX].close		= tls_sk_proto_close;
+
+	prot[TLS_SW_TX] = prot[TLS_BASE_TX];
+	prot[TLS_SW_TX].sendmsg		= tls_sw_sendmsg;
+	prot[TLS_SW_TX].sendpage	= tls_sw_sendpage;
+}
+
+static int tls_init(struct sock *sk)
+{
+	int ip_ver = sk->sk_family == AF_INET6 ? TLSV6 : TLSV4;
+	struct inet_connection_sock *icsk = inet_csk(sk);
+	struct tls_context *ctx;
+
+	/* Only established sockets: a listener would have to clone rather
+	 * than share its context with the sockets it accepts.
+	 */
+	if (sk->sk_state != TCP_ESTABLISHED)
+		return -ENOTSUPP;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	icsk->icsk_ulp_data = ctx;
+	ctx->sk_proto = sk->sk_prot;
+
+	/* Build the IPv6 protos from the first socket, tcpv6_prot lives in
+	 * a module of its own. Rebuild whenever its address changes.
+	 */
+	if (ip_ver == TLSV6 &&
+	    unlikely(sk->sk_prot != smp_load_acquire(&saved_tcpv6_prot))) {
+		mutex_lock(&tcpv6_prot_mutex);
+		if (likely(sk->sk_prot != saved_tcpv6_prot)) {
+			build_protos(tls_prots[TLSV6], sk->sk_prot);
+			smp_store_release(&saved_tcpv6_prot, sk->sk_prot);
+		}
+		mutex_unlock(&tcpv6_prot_mutex);
+	}
+
+	ctx->tx_conf = TLS_BASE_TX;
+	update_sk_prot(sk, ctx);
+	return 0;
+}
+
+static struct tcp_ulp_ops tcp_tls_ulp_ops __read_mostly = {
+	.name			= "tls",
+	.owner			= THIS_MODULE,
+	.init			= tls_init,
+};
+
+static int __init tls_register(void)
+{
+	build_protos(tls_prots[TLSV4], &tcp_prot);
+
+	return tcp_register_ulp(&tcp_tls_ulp_ops);
+}
+
+static void __exit tls_unregister(void)
+{
+	tcp_unregister_ulp(&tcp_tls_ulp_ops);
+}
+
+module_init(tls_register);
+module_exit(tls_unregister);
+MODULE_ALIAS_TCP_ULP("tls");
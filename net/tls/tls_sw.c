@@ -0,0 +1,605 @@
+/*
+ * TLS record layer offload for TCP sockets, software encryption
+ *
+ * Plaintext is gathered into an open record, from copies of user data
+ * for sendmsg() and from references to the pages for sendpage(). When
+ * the record is full or the caller has no more data, it is encrypted
+ * into pages from the socket page frag and those are handed to TCP.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <crypto/aead.h>
+#include <crypto/scatterwalk.h>
+
+#include <net/tls.h>
+
+struct tls_crypt_result {
+	struct completion completion;
+	int err;
+};
+
+/* Grow sg to len bytes with memory from the socket page frag. Returns
+ * -ENOSPC if all entries of sg are used up before that.
+ */
+static int alloc_sg(struct sock *sk, int len, struct scatterlist *sg,
+		    int *sg_num_elem, unsigned int *sg_size)
+{
+	struct page_frag *pfrag = sk_page_frag(sk);
+	unsigned int size = *sg_size;
+	int num_elem = *sg_num_elem;
+	int use, rc = 0;
+
+	len -= size;
+	while (len > 0) {
+		struct scatterlist *sge = &sg[num_elem - 1];
+
+		if (!sk_page_frag_refill(sk, pfrag)) {
+			rc = -ENOMEM;
+			break;
+		}
+
+		use = min_t(int, len, pfrag->size - pfrag->offset);
+		if (!sk_wmem_schedule(sk, use)) {
+			rc = -ENOMEM;
+			break;
+		}
+
+		if (num_elem && sg_page(sge) == pfrag->page &&
+		    sge->offset + sge->length == pfrag->offset) {
+			sge->length += use;
+		} else {
+			if (num_elem == MAX_SKB_FRAGS) {
+				rc = -ENOSPC;
+				break;
+			}
+			sge = &sg[num_elem++];
+			sg_unmark_end(sge);
+			sg_set_page(sge, pfrag->page, use, pfrag->offset);
+			get_page(pfrag->page);
+		}
+
+		sk_mem_charge(sk, use);
+		pfrag->offset += use;
+		size += use;
+		len -= use;
+	}
+
+	*sg_size = size;
+	*sg_num_elem = num_elem;
+	return rc;
+}
+
+/* Shrink sg back to target_size bytes */
+static void trim_sg(struct sock *sk, struct scatterlist *sg,
+		    int *sg_num_elem, unsigned int *sg_size, int target_size)
+{
+	int i = *sg_num_elem - 1;
+	int trim = *sg_size - target_size;
+
+	if (trim <= 0)
+		return;
+
+	*sg_size = target_size;
+	while (trim && trim >= sg[i].length) {
+		trim -= sg[i].length;
+		sk_mem_uncharge(sk, sg[i].length);
+		put_page(sg_page(&sg[i]));
+		i--;
+	}
+
+	if (trim) {
+		sg[i].length -= trim;
+		sk_mem_uncharge(sk, trim);
+	}
+
+	*sg_num_elem = i + 1;
+}
+
+static void free_sg(struct sock *sk, struct scatterlist *sg,
+		    int *sg_num_elem, unsigned int *sg_size)
+{
+	int i, n = *sg_num_elem;
+
+	for (i = 0; i < n; ++i) {
+		sk_mem_uncharge(sk, sg[i].length);
+		put_page(sg_page(&sg[i]));
+	}
+	*sg_num_elem = 0;
+	*sg_size = 0;
+}
+
+/* Point sg_encrypted_payload at sg_encrypted_data minus its first skip
+ * bytes, where the record header and the explicit nonce go.
+ */
+static void tls_sg_skip_prepend(struct tls_sw_context *ctx, u16 skip)
+{
+	struct scatterlist *dst = ctx->sg_encrypted_payload;
+	int i, n = 0;
+
+	for (i = 0; i < ctx->sg_encrypted_num_elem; i++) {
+		struct scatterlist *src = &ctx->sg_encrypted_data[i];
+
+		if (skip >= src->length) {
+			skip -= src->length;
+			continue;
+		}
+		if (!n)
+			sg_init_table(dst, ctx->sg_encrypted_num_elem - i);
+		sg_set_page(&dst[n++], sg_page(src), src->length - skip,
+			    src->offset + skip);
+		skip = 0;
+	}
+}
+
+static void tls_crypt_done(struct crypto_async_request *req, int err)
+{
+	struct tls_crypt_result *res = req->data;
+
+	if (err == -EINPROGRESS)
+		return;
+
+	res->err = err;
+	complete(&res->completion);
+}
+
+static int tls_do_encryption(struct tls_context *tls_ctx,
+			     struct tls_sw_context *ctx, size_t data_len,
+			     gfp_t flags)
+{
+	unsigned int req_size = sizeof(struct aead_request) +
+		crypto_aead_reqsize(ctx->aead_send);
+	struct tls_crypt_result result;
+	struct aead_request *aead_req;
+	int rc;
+
+	aead_req = kzalloc(req_size, flags);
+	if (!aead_req)
+		return -ENOMEM;
+
+	init_completion(&result.completion);
+	aead_request_set_tfm(aead_req, ctx->aead_send);
+	aead_request_set_callback(aead_req, CRYPTO_TFM_REQ_MAY_BACKLOG |
+				  CRYPTO_TFM_REQ_MAY_SLEEP,
+				  tls_crypt_done, &result);
+	aead_request_set_assoc(aead_req, &ctx->sg_aad, TLS_AAD_SPACE_SIZE);
+	aead_request_set_crypt(aead_req, ctx->sg_plaintext_data,
+			       ctx->sg_encrypted_payload, data_len,
+			       tls_ctx->iv);
+
+	rc = crypto_aead_encrypt(aead_req);
+	if (rc == -EINPROGRESS || rc == -EBUSY) {
+		wait_for_completion(&result.completion);
+		rc = result.err;
+	}
+
+	kfree(aead_req);
+	return rc;
+}
+
+/* Close the open record: encrypt it and hand it to TCP */
+static int tls_push_record(struct sock *sk, int flags,
+			   unsigned char record_type)
+{
+	struct tls_context *tls_ctx = tls_get_ctx(sk);
+	struct tls_sw_context *ctx = tls_sw_ctx(tls_ctx);
+	char prepend[TLS_HEADER_SIZE + TLS_CIPHER_AES_GCM_128_IV_SIZE];
+	int rc;
+
+	rc = alloc_sg(sk, ctx->sg_plaintext_size + tls_ctx->overhead_size,
+		      ctx->sg_encrypted_data, &ctx->sg_encrypted_num_elem,
+		      &ctx->sg_encrypted_size);
+	if (rc) {
+		/* keep the open record, the caller waits for memory */
+		trim_sg(sk, ctx->sg_encrypted_data,
+			&ctx->sg_encrypted_num_elem,
+			&ctx->sg_encrypted_size, 0);
+		return -ENOMEM;
+	}
+
+	sg_mark_end(ctx->sg_plaintext_data + ctx->sg_plaintext_num_elem - 1);
+	sg_mark_end(ctx->sg_encrypted_data + ctx->sg_encrypted_num_elem - 1);
+
+	tls_make_aad(tls_ctx, ctx->aad_space, ctx->sg_plaintext_size,
+		     record_type);
+
+	tls_fill_prepend(tls_ctx, prepend, ctx->sg_plaintext_size, record_type);
+	scatterwalk_map_and_copy(prepend, ctx->sg_encrypted_data, 0,
+				 tls_ctx->prepend_size, 1);
+	tls_sg_skip_prepend(ctx, tls_ctx->prepend_size);
+
+	rc = tls_do_encryption(tls_ctx, ctx, ctx->sg_plaintext_size,
+			       sk->sk_allocation);
+	if (rc < 0) {
+		/* the stream is unusable once a record is lost */
+		tls_err_abort(sk);
+		return rc;
+	}
+
+	free_sg(sk, ctx->sg_plaintext_data, &ctx->sg_plaintext_num_elem,
+		&ctx->sg_plaintext_size);
+
+	/* the pages now belong to the record being sent */
+	ctx->sg_encrypted_num_elem = 0;
+	ctx->sg_encrypted_size = 0;
+
+	tls_advance_record_sn(sk, tls_ctx);
+
+	/* Only pass through MSG_DONTWAIT and MSG_NOSIGNAL flags */
+	return tls_push_sg(sk, tls_ctx, ctx->sg_encrypted_data, 0,
+			   flags & (MSG_DONTWAIT | MSG_NOSIGNAL));
+}
+
+/**
+ *	tls_sw_push_open_record - send what has been gathered so far
+ *	@sk: socket with a TLS context in software mode
+ *	@flags: MSG_DONTWAIT and MSG_NOSIGNAL are honoured
+ *
+ *	Data sent with MSG_MORE stays in an open record until the record is
+ *	full; this closes the record early, e.g. before a record of another
+ *	type or when the socket is closed. Called with the socket locked.
+ */
+int tls_sw_push_open_record(struct sock *sk, int flags)
+{
+	struct tls_sw_context *ctx = tls_sw_ctx(tls_get_ctx(sk));
+
+	if (!ctx->sg_plaintext_size)
+		return 0;
+
+	return tls_push_record(sk, flags, TLS_RECORD_TYPE_DATA);
+}
+
+static int tls_proccess_cmsg(struct sock *sk, struct msghdr *msg,
+			     unsigned char *record_type)
+{
+	struct cmsghdr *cmsg;
+	int rc = -EINVAL;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (!CMSG_OK(msg, cmsg))
+			return -EINVAL;
+		if (cmsg->cmsg_level != SOL_TLS)
+			continue;
+
+		switch (cmsg->cmsg_type) {
+		case TLS_SET_RECORD_TYPE:
+			if (cmsg->cmsg_len < CMSG_LEN(sizeof(*record_type)))
+				return -EINVAL;
+
+			/* only data records may be left open */
+			if (msg->msg_flags & MSG_MORE)
+				return -EINVAL;
+
+			rc = tls_sw_push_open_record(sk, msg->msg_flags);
+			if (rc)
+				return rc;
+
+			*record_type = *(unsigned char *)CMSG_DATA(cmsg);
+			rc = 0;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	return rc;
+}
+
+/* Copy len bytes of msg at iov_offset into the open record at start */
+static int tls_copy_from_iovec(struct tls_sw_context *ctx,
+			       struct msghdr *msg, int iov_offset,
+			       unsigned int start, int len)
+{
+	struct scatterlist *sg = ctx->sg_plaintext_data;
+	int i, err;
+
+	for (i = 0; len && i < ctx->sg_plaintext_num_elem; i++) {
+		int copy;
+
+		if (start >= sg[i].length) {
+			start -= sg[i].length;
+			continue;
+		}
+
+		copy = min_t(int, len, sg[i].length - start);
+		err = memcpy_fromiovecend(page_address(sg_page(&sg[i])) +
+					  sg[i].offset + start,
+					  msg->msg_iov, iov_offset, copy);
+		if (err)
+			return err;
+
+		iov_offset += copy;
+		len -= copy;
+		start = 0;
+	}
+
+	return 0;
+}
+
+int tls_sw_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
+		   size_t size)
+{
+	struct tls_context *tls_ctx = tls_get_ctx(sk);
+	struct tls_sw_context *ctx = tls_sw_ctx(tls_ctx);
+	long timeo = sock_sndtimeo(sk, msg->msg_flags & MSG_DONTWAIT);
+	unsigned char record_type = TLS_RECORD_TYPE_DATA;
+	bool eor = !(msg->msg_flags & MSG_MORE);
+	bool full_record, closed = false;
+	size_t try_to_copy, copied = 0;
+	unsigned int orig_size;
+	int ret = 0;
+
+	if (msg->msg_flags & ~(MSG_MORE | MSG_DONTWAIT | MSG_NOSIGNAL))
+		return -ENOTSUPP;
+
+	lock_sock(sk);
+
+	ret = tls_complete_pending_work(sk, tls_ctx, msg->msg_flags, &timeo);
+	if (ret)
+		goto send_end;
+
+	if (unlikely(msg->msg_controllen)) {
+		ret = tls_proccess_cmsg(sk, msg, &record_type);
+		if (ret)
+			goto send_end;
+	}
+
+	while (copied < size || closed) {
+		if (sk->sk_err) {
+			ret = -sk->sk_err;
+			goto send_end;
+		}
+
+		if (closed)
+			goto push_record;
+
+		orig_size = ctx->sg_plaintext_size;
+		try_to_copy = min_t(size_t, size - copied,
+				    TLS_MAX_PAYLOAD_SIZE - orig_size);
+		full_record = orig_size + try_to_copy == TLS_MAX_PAYLOAD_SIZE;
+
+		if (!sk_stream_memory_free(sk)) {
+			set_bit(SOCK_NOSPACE, &sk->sk_socket->flags);
+			goto wait_for_memory;
+		}
+
+		ret = alloc_sg(sk, orig_size + try_to_copy,
+			       ctx->sg_plaintext_data,
+			       &ctx->sg_plaintext_num_elem,
+			       &ctx->sg_plaintext_size);
+		if (ret == -ENOSPC) {
+			/* out of sg entries, the record ends here */
+			try_to_copy = ctx->sg_plaintext_size - orig_size;
+			full_record = true;
+		} else if (ret) {
+			trim_sg(sk, ctx->sg_plaintext_data,
+				&ctx->sg_plaintext_num_elem,
+				&ctx->sg_plaintext_size, orig_size);
+			goto wait_for_memory;
+		}
+
+		ret = tls_copy_from_iovec(ctx, msg, copied, orig_size,
+					  try_to_copy);
+		if (ret) {
+			trim_sg(sk, ctx->sg_plaintext_data,
+				&ctx->sg_plaintext_num_elem,
+				&ctx->sg_plaintext_size, orig_size);
+			goto send_end;
+		}
+
+		copied += try_to_copy;
+		closed = full_record || (eor && copied == size);
+		if (!closed)
+			continue;
+
+push_record:
+		ret = tls_push_record(sk, msg->msg_flags, record_type);
+		if (ret == -ENOMEM)
+			goto wait_for_memory;
+		closed = false;
+		if (ret)
+			goto send_end;
+		continue;
+
+wait_for_memory:
+		ret = sk_stream_wait_memory(sk, &timeo);
+		if (ret)
+			goto send_end;
+	}
+
+send_end:
+	ret = sk_stream_error(sk, msg->msg_flags, ret);
+
+	release_sock(sk);
+	return copied ? copied : ret;
+}
+
+int tls_sw_sendpage(struct sock *sk, struct page *page,
+		    int offset, size_t size, int flags)
+{
+	struct tls_context *tls_ctx = tls_get_ctx(sk);
+	struct tls_sw_context *ctx = tls_sw_ctx(tls_ctx);
+	long timeo = sock_sndtimeo(sk, flags & MSG_DONTWAIT);
+	bool eor = !(flags & (MSG_MORE | MSG_SENDPAGE_NOTLAST));
+	size_t copy, copied = 0;
+	bool closed = false;
+	int ret = 0;
+
+	if (flags & ~(MSG_MORE | MSG_DONTWAIT | MSG_NOSIGNAL |
+		      MSG_SENDPAGE_NOTLAST))
+		return -ENOTSUPP;
+
+	/* No MSG_EOR from splice, only look at MSG_MORE */
+	lock_sock(sk);
+
+	clear_bit(SOCK_ASYNC_NOSPACE, &sk->sk_socket->flags);
+
+	ret = tls_complete_pending_work(sk, tls_ctx, flags, &timeo);
+	if (ret)
+		goto sendpage_end;
+
+	/* The page is referenced by the open record and encrypted from
+	 * directly, page cache data is never copied in plaintext.
+	 */
+	while (size > 0 || closed) {
+		struct scatterlist *sg;
+
+		if (sk->sk_err) {
+			ret = -sk->sk_err;
+			goto sendpage_end;
+		}
+
+		/* a record left full by an earlier error goes first */
+		if (ctx->sg_plaintext_size == TLS_MAX_PAYLOAD_SIZE ||
+		    ctx->sg_plaintext_num_elem == MAX_SKB_FRAGS)
+			closed = true;
+
+		if (closed)
+			goto push_record;
+
+		if (!sk_stream_memory_free(sk)) {
+			set_bit(SOCK_NOSPACE, &sk->sk_socket->flags);
+			goto wait_for_memory;
+		}
+
+		copy = min_t(size_t, size,
+			     TLS_MAX_PAYLOAD_SIZE - ctx->sg_plaintext_size);
+		if (!sk_wmem_schedule(sk, copy))
+			goto wait_for_memory;
+
+		sk_mem_charge(sk, copy);
+		get_page(page);
+		sg = ctx->sg_plaintext_data + ctx->sg_plaintext_num_elem;
+		sg_unmark_end(sg);
+		sg_set_page(sg, page, copy, offset);
+		ctx->sg_plaintext_num_elem++;
+		ctx->sg_plaintext_size += copy;
+
+		offset += copy;
+		size -= copy;
+		copied += copy;
+
+		closed = ctx->sg_plaintext_size == TLS_MAX_PAYLOAD_SIZE ||
+			 ctx->sg_plaintext_num_elem == MAX_SKB_FRAGS ||
+			 (eor && !size);
+		if (!closed)
+			continue;
+
+push_record:
+		ret = tls_push_record(sk, flags, TLS_RECORD_TYPE_DATA);
+		if (ret == -ENOMEM)
+			goto wait_for_memory;
+		closed = false;
+		if (ret)
+			goto sendpage_end;
+		continue;
+
+wait_for_memory:
+		ret = sk_stream_wait_memory(sk, &timeo);
+		if (ret)
+			goto sendpage_end;
+	}
+
+sendpage_end:
+	if (copied)
+		ret = copied;
+	else
+		ret = sk_stream_error(sk, flags, ret);
+
+	release_sock(sk);
+	return ret;
+}
+
+void tls_sw_free_tx_resources(struct sock *sk)
+{
+	struct tls_context *tls_ctx = tls_get_ctx(sk);
+	struct tls_sw_context *ctx = tls_sw_ctx(tls_ctx);
+
+	if (ctx->aead_send)
+		crypto_free_aead(ctx->aead_send);
+
+	trim_sg(sk, ctx->sg_encrypted_data, &ctx->sg_encrypted_num_elem,
+		&ctx->sg_encrypted_size, 0);
+	free_sg(sk, ctx->sg_plaintext_data, &ctx->sg_plaintext_num_elem,
+		&ctx->sg_plaintext_size);
+
+	kfree(ctx);
+	tls_ctx->priv_ctx = NULL;
+}
+
+/**
+ *	tls_set_sw_offload - set up software encryption for a socket
+ *	@sk: socket the keys were installed on
+ *	@ctx: TLS context holding the crypto info from user space
+ *
+ *	This tree's AES-NI glue only provides rfc4106(gcm(aes)), which takes
+ *	8 or 12 bytes of associated data while TLS needs 13, so the gcm
+ *	template is used; it still picks up the AES-NI cipher and the
+ *	CLMUL GHASH where the CPU has them.
+ */
+int tls_set_sw_offload(struct sock *sk, struct tls_context *ctx)
+{
+	struct tls12_crypto_info_aes_gcm_128 *gcm_128_info;
+	struct tls_sw_context *sw_ctx;
+	int rc;
+
+	if (ctx->priv_ctx)
+		return -EEXIST;
+
+	if (ctx->crypto_send.cipher_type != TLS_CIPHER_AES_GCM_128)
+		return -EINVAL;
+
+	sw_ctx = kzalloc(sizeof(*sw_ctx), GFP_KERNEL);
+	if (!sw_ctx)
+		return -ENOMEM;
+
+	ctx->priv_ctx = sw_ctx;
+
+	gcm_128_info = &ctx->crypto_send_aes_gcm_128;
+	ctx->prepend_size = TLS_HEADER_SIZE + TLS_CIPHER_AES_GCM_128_IV_SIZE;
+	ctx->tag_size = TLS_CIPHER_AES_GCM_128_TAG_SIZE;
+	ctx->overhead_size = ctx->prepend_size + ctx->tag_size;
+	ctx->iv_size = TLS_CIPHER_AES_GCM_128_IV_SIZE;
+	memcpy(ctx->iv, gcm_128_info->salt, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+	memcpy(ctx->iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE, gcm_128_info->iv,
+	       TLS_CIPHER_AES_GCM_128_IV_SIZE);
+	ctx->rec_seq_size = TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE;
+	memcpy(ctx->rec_seq, gcm_128_info->rec_seq,
+	       TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+
+	sg_init_table(sw_ctx->sg_encrypted_data,
+		      ARRAY_SIZE(sw_ctx->sg_encrypted_data));
+	sg_init_table(sw_ctx->sg_plaintext_data,
+		      ARRAY_SIZE(sw_ctx->sg_plaintext_data));
+	sg_init_one(&sw_ctx->sg_aad, sw_ctx->aad_space,
+		    sizeof(sw_ctx->aad_space));
+
+	sw_ctx->aead_send = crypto_alloc_aead("gcm(aes)", 0, 0);
+	if (IS_ERR(sw_ctx->aead_send)) {
+		rc = PTR_ERR(sw_ctx->aead_send);
+		sw_ctx->aead_send = NULL;
+		goto free_priv;
+	}
+
+	rc = crypto_aead_setkey(sw_ctx->aead_send, gcm_128_info->key,
+				TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+	if (rc)
+		goto free_aead;
+
+	rc = crypto_aead_setauthsize(sw_ctx->aead_send, ctx->tag_size);
+	if (!rc)
+		return 0;
+
+free_aead:
+	crypto_free_aead(sw_ctx->aead_send);
+free_priv:
+	kfree(sw_ctx);
+	ctx->priv_ctx = NULL;
+	return rc;
+}
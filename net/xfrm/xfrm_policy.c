@@ -25,6 +25,7 @@
 #include <linux/module.h>
 #include <linux/cache.h>
 #include <linux/audit.h>
+#include <linux/jhash.h>
 #include <net/dst.h>
 #include <net/flow.h>
 #include <net/xfrm.h>
@@ -282,6 +283,7 @@ struct xfrm_policy *xfrm_policy_alloc(struct net *net, gfp_t gfp)
 		INIT_LIST_HEAD(&policy->walk.all);
 		INIT_HLIST_NODE(&policy->bydst);
 		INIT_HLIST_NODE(&policy->byidx);
+		INIT_HLIST_NODE(&policy->bypfx);
 		rwlock_init(&policy->lock);
 		atomic_set(&policy->refcnt, 1);
 		skb_queue_head_init(&policy->polq.hold_queue);
@@ -606,6 +608,162 @@ static void xfrm_policy_requeue(struct xfrm_policy *old,
 	spin_unlock_bh(&pq->hold_queue.lock);
 }
 
+/* Inexact policies of one family and pair of prefix lengths, hashed by
+ * their selector addresses masked to those lengths.  A lookup probes one
+ * bucket per group instead of walking the whole inexact list.
+ */
+struct xfrm_pol_pfx {
+	struct list_head	list;
+	u16			family;
+	u8			prefixlen_d;
+	u8			prefixlen_s;
+	unsigned int		count;
+	unsigned int		hmask;
+	struct hlist_head	*table;
+};
+
+#define XFRM_PFX_MIN_HMASK	(16 - 1)
+#define XFRM_PFX_MAX_HMASK	(4096 - 1)
+
+static void xfrm_pfx_mask(xfrm_address_t *dst, const xfrm_address_t *src,
+			  u16 family, u8 prefixlen)
+{
+	int i, n = family == AF_INET ? 1 : 4;
+
+	for (i = 0; i < n; i++) {
+		int bits = clamp_t(int, prefixlen - 32 * i, 0, 32);
+
+		dst->a6[i] = bits ? src->a6[i] & htonl(~0U << (32 - bits)) : 0;
+	}
+}
+
+static unsigned int xfrm_pfx_hash(const struct xfrm_pol_pfx *pfx,
+				  const xfrm_address_t *daddr,
+				  const xfrm_address_t *saddr,
+				  unsigned int hmask)
+{
+	int n = pfx->family == AF_INET ? 1 : 4;
+	xfrm_address_t d, s;
+
+	xfrm_pfx_mask(&d, daddr, pfx->family, pfx->prefixlen_d);
+	xfrm_pfx_mask(&s, saddr, pfx->family, pfx->prefixlen_s);
+
+	return jhash2((__force u32 *)s.a6, n,
+		      jhash2((__force u32 *)d.a6, n, 0)) & hmask;
+}
+
+static unsigned int xfrm_pfx_pol_hash(const struct xfrm_pol_pfx *pfx,
+				      const struct xfrm_policy *pol,
+				      unsigned int hmask)
+{
+	return xfrm_pfx_hash(pfx, &pol->selector.daddr, &pol->selector.saddr,
+			     hmask);
+}
+
+static struct xfrm_pol_pfx *xfrm_pfx_find(struct net *net,
+					  const struct xfrm_policy *pol,
+					  int dir)
+{
+	struct xfrm_pol_pfx *pfx;
+
+	list_for_each_entry(pfx, &net->xfrm.policy_pfx[dir], list) {
+		if (pfx->family == pol->family &&
+		    pfx->prefixlen_d == pol->selector.prefixlen_d &&
+		    pfx->prefixlen_s == pol->selector.prefixlen_s)
+			return pfx;
+	}
+	return NULL;
+}
+
+/* All of the prefix group helpers run with the policy lock held for
+ * writing, hence the atomic allocations.
+ */
+static struct xfrm_pol_pfx *xfrm_pfx_get(struct net *net,
+					 const struct xfrm_policy *pol,
+					 int dir)
+{
+	struct xfrm_pol_pfx *pfx = xfrm_pfx_find(net, pol, dir);
+
+	if (pfx)
+		return pfx;
+
+	pfx = kzalloc(sizeof(*pfx), GFP_ATOMIC);
+	if (!pfx)
+		return NULL;
+	pfx->table = kcalloc(XFRM_PFX_MIN_HMASK + 1, sizeof(*pfx->table),
+			     GFP_ATOMIC);
+	if (!pfx->table) {
+		kfree(pfx);
+		return NULL;
+	}
+	pfx->family = pol->family;
+	pfx->prefixlen_d = pol->selector.prefixlen_d;
+	pfx->prefixlen_s = pol->selector.prefixlen_s;
+	pfx->hmask = XFRM_PFX_MIN_HMASK;
+	list_add_tail(&pfx->list, &net->xfrm.policy_pfx[dir]);
+	return pfx;
+}
+
+/* A failed grow keeps the current table, only the chains get longer. */
+static void xfrm_pfx_grow(struct xfrm_pol_pfx *pfx)
+{
+	unsigned int i, hmask = xfrm_new_hash_mask(pfx->hmask);
+	struct hlist_head *table;
+	struct hlist_node *tmp;
+	struct xfrm_policy *pol;
+
+	table = kcalloc(hmask + 1, sizeof(*table), GFP_ATOMIC);
+	if (!table)
+		return;
+
+	for (i = 0; i <= pfx->hmask; i++) {
+		hlist_for_each_entry_safe(pol, tmp, pfx->table + i, bypfx) {
+			hlist_del(&pol->bypfx);
+			hlist_add_head(&pol->bypfx,
+				       table + xfrm_pfx_pol_hash(pfx, pol,
+								 hmask));
+		}
+	}
+	kfree(pfx->table);
+	pfx->table = table;
+	pfx->hmask = hmask;
+}
+
+/* Index a policy just placed on the inexact list and renumber that list,
+ * so that ->pos gives each policy's place in it.
+ */
+static void xfrm_pfx_link(struct net *net, struct xfrm_pol_pfx *pfx,
+			  struct xfrm_policy *policy, int dir)
+{
+	struct xfrm_policy *pol;
+	u32 pos = 0;
+
+	hlist_for_each_entry(pol, &net->xfrm.policy_inexact[dir], bydst)
+		pol->pos = pos++;
+
+	hlist_add_head(&policy->bypfx,
+		       pfx->table + xfrm_pfx_pol_hash(pfx, policy, pfx->hmask));
+	if (++pfx->count > pfx->hmask + 1 && pfx->hmask < XFRM_PFX_MAX_HMASK)
+		xfrm_pfx_grow(pfx);
+}
+
+static void xfrm_pfx_unlink(struct net *net, struct xfrm_policy *pol,
+			    int dir)
+{
+	struct xfrm_pol_pfx *pfx;
+
+	if (hlist_unhashed(&pol->bypfx))
+		return;
+
+	hlist_del_init(&pol->bypfx);
+	pfx = xfrm_pfx_find(net, pol, dir);
+	if (!--pfx->count) {
+		list_del(&pfx->list);
+		kfree(pfx->table);
+		kfree(pfx);
+	}
+}
+
 static bool xfrm_policy_mark_match(struct xfrm_policy *policy,
 				   struct xfrm_policy *pol)
 {
@@ -628,6 +786,7 @@ int xfrm_policy_insert(int dir, struct xfrm_policy *policy, int excl)
 	struct xfrm_policy *delpol;
 	struct hlist_head *chain;
 	struct hlist_node *newpos;
+	struct xfrm_pol_pfx *pfx;
 
 	write_lock_bh(&net->xfrm.xfrm_policy_lock);
 	chain = policy_hash_bysel(net, &policy->selector, policy->family, dir);
@@ -653,10 +812,20 @@ int xfrm_policy_insert(int dir, struct xfrm_policy *policy, int excl)
 		if (delpol)
 			break;
 	}
+	pfx = NULL;
+	if (chain == &net->xfrm.policy_inexact[dir]) {
+		pfx = xfrm_pfx_get(net, policy, dir);
+		if (!pfx) {
+			write_unlock_bh(&net->xfrm.xfrm_policy_lock);
+			return -ENOMEM;
+		}
+	}
 	if (newpos)
 		hlist_add_after(newpos, &policy->bydst);
 	else
 		hlist_add_head(&policy->bydst, chain);
+	if (pfx)
+		xfrm_pfx_link(net, pfx, policy, dir);
 	xfrm_pol_hold(policy);
 	net->xfrm.policy_count[dir]++;
 	atomic_inc(&net->xfrm.flow_cache_genid);
@@ -974,6 +1143,42 @@ static int xfrm_policy_match(const struct xfrm_policy *pol,
 	return ret;
 }
 
+/* The policy a walk of the priority ordered inexact list would stop at:
+ * the first one, by (priority, pos), that either matches with a priority
+ * better than @priority or fails the security check.
+ */
+static struct xfrm_policy *
+xfrm_pfx_lookup(struct net *net, u8 type, const struct flowi *fl,
+		u16 family, u8 dir, const xfrm_address_t *daddr,
+		const xfrm_address_t *saddr, u32 priority, int *errp)
+{
+	struct xfrm_policy *pol, *ret = NULL;
+	struct xfrm_pol_pfx *pfx;
+	struct hlist_head *chain;
+	int err;
+
+	*errp = 0;
+	list_for_each_entry(pfx, &net->xfrm.policy_pfx[dir], list) {
+		if (pfx->family != family)
+			continue;
+		chain = pfx->table + xfrm_pfx_hash(pfx, daddr, saddr,
+						   pfx->hmask);
+		hlist_for_each_entry(pol, chain, bypfx) {
+			if (ret && (ret->priority < pol->priority ||
+				    (ret->priority == pol->priority &&
+				     ret->pos < pol->pos)))
+				continue;
+			err = xfrm_policy_match(pol, fl, type, family, dir);
+			if (err == -ESRCH ||
+			    (!err && pol->priority >= priority))
+				continue;
+			ret = pol;
+			*errp = err;
+		}
+	}
+	return ret;
+}
+
 static struct xfrm_policy *xfrm_policy_lookup_bytype(struct net *net, u8 type,
 						     const struct flowi *fl,
 						     u16 family, u8 dir)
@@ -1007,20 +1212,14 @@ static struct xfrm_policy *xfrm_policy_lookup_bytype(struct net *net, u8 type,
 			break;
 		}
 	}
-	chain = &net->xfrm.policy_inexact[dir];
-	hlist_for_each_entry(pol, chain, bydst) {
-		err = xfrm_policy_match(pol, fl, type, family, dir);
+	pol = xfrm_pfx_lookup(net, type, fl, family, dir, daddr, saddr,
+			      priority, &err);
+	if (pol) {
 		if (err) {
-			if (err == -ESRCH)
-				continue;
-			else {
-				ret = ERR_PTR(err);
-				goto fail;
-			}
-		} else if (pol->priority < priority) {
-			ret = pol;
-			break;
+			ret = ERR_PTR(err);
+			goto fail;
 		}
+		ret = pol;
 	}
 	if (ret)
 		xfrm_pol_hold(ret);
@@ -1157,6 +1356,8 @@ static struct xfrm_policy *__xfrm_policy_unlink(struct xfrm_policy *pol,
 		return NULL;
 
 	hlist_del_init(&pol->bydst);
+	if (dir < XFRM_POLICY_MAX)
+		xfrm_pfx_unlink(net, pol, dir);
 	hlist_del(&pol->byidx);
 	list_del(&pol->walk.all);
 	net->xfrm.policy_count[dir]--;
@@ -2842,6 +3043,9 @@ static int __net_init xfrm_policy_init(struct net *net)
 		htab->hmask = hmask;
 	}
 
+	for (dir = 0; dir < XFRM_POLICY_MAX; dir++)
+		INIT_LIST_HEAD(&net->xfrm.policy_pfx[dir]);
+
 	INIT_LIST_HEAD(&net->xfrm.policy_all);
 	INIT_WORK(&net->xfrm.policy_hash_work, xfrm_hash_resize);
 	if (net_eq(net, &init_net))
@@ -2891,6 +3095,9 @@ static void xfrm_policy_fini(struct net *net)
 		xfrm_hash_free(htab->table, sz);
 	}
 
+	for (dir = 0; dir < XFRM_POLICY_MAX; dir++)
+		WARN_ON(!list_empty(&net->xfrm.policy_pfx[dir]));
+
 	sz = (net->xfrm.policy_idx_hmask + 1) * sizeof(struct hlist_head);
 	WARN_ON(!hlist_empty(net->xfrm.policy_byidx));
 	xfrm_hash_free(net->xfrm.policy_byidx, sz);
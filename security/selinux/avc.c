@@ -36,6 +36,7 @@
 #define AVC_CACHE_SLOTS			512
 #define AVC_DEF_CACHE_THRESHOLD		512
 #define AVC_CACHE_RECLAIM		16
+#define AVC_PCPU_SLOTS			64
 
 #ifdef CONFIG_SECURITY_SELINUX_AVC_STATS
 #define avc_cache_stats_incr(field)	this_cpu_inc(avc_cache_stats.field)
@@ -62,6 +63,23 @@ struct avc_cache {
 	atomic_t		lru_hint;	/* LRU hint for reclaim scan */
 	atomic_t		active_nodes;
 	u32			latest_notif;	/* latest revocation notification */
+	atomic_t		pcpu_gen;	/* generation of the per-cpu copies */
+};
+
+/*
+ * Per-cpu front cache of recent decisions, so that a hit neither walks
+ * nor bounces the shared slots.  A copy is good for as long as the
+ * generation it was taken in is current: anything that changes or
+ * drops a decision in avc_cache, rather than just adding one, starts a
+ * new generation.  Only used from task context, with preemption off.
+ */
+struct avc_pcpu_entry {
+	struct avc_entry	ae;
+	unsigned int		gen;
+};
+
+struct avc_pcpu_cache {
+	struct avc_pcpu_entry	slots[AVC_PCPU_SLOTS];
 };
 
 struct avc_callback_node {
@@ -78,6 +96,7 @@ DEFINE_PER_CPU(struct avc_cache_stats, avc_cache_stats) = { 0 };
 #endif
 
 static struct avc_cache avc_cache;
+static DEFINE_PER_CPU(struct avc_pcpu_cache, avc_pcpu_cache);
 static struct avc_callback_node *avc_callbacks;
 static struct kmem_cache *avc_node_cachep;
 
@@ -86,6 +105,55 @@ static inline int avc_hash(u32 ssid, u32 tsid, u16 tclass)
 	return (ssid ^ (tsid<<2) ^ (tclass<<4)) & (AVC_CACHE_SLOTS - 1);
 }
 
+/* invalidate every per-cpu copy of a decision */
+static inline void avc_pcpu_invalidate(void)
+{
+	atomic_inc(&avc_cache.pcpu_gen);
+}
+
+static bool avc_pcpu_lookup(u32 ssid, u32 tsid, u16 tclass,
+			    struct av_decision *avd)
+{
+	struct avc_pcpu_entry *pe;
+	bool hit = false;
+
+	if (in_interrupt())
+		return false;
+
+	pe = &get_cpu_var(avc_pcpu_cache).slots[avc_hash(ssid, tsid, tclass) &
+						 (AVC_PCPU_SLOTS - 1)];
+	if (pe->ae.ssid == ssid && pe->ae.tsid == tsid &&
+	    pe->ae.tclass == tclass &&
+	    pe->gen == atomic_read(&avc_cache.pcpu_gen)) {
+		memcpy(avd, &pe->ae.avd, sizeof(*avd));
+		avc_cache_stats_incr(lookups);
+		hit = true;
+	}
+	put_cpu_var(avc_pcpu_cache);
+
+	return hit;
+}
+
+/*
+ * Copy a decision found in avc_cache into this cpu's front cache.  @gen
+ * is the generation read before looking it up there, so that a change
+ * racing with the lookup leaves the copy stale from the start.
+ */
+static void avc_pcpu_fill(unsigned int gen, struct avc_entry *ae)
+{
+	struct avc_pcpu_entry *pe;
+
+	if (in_interrupt())
+		return;
+
+	pe = &get_cpu_var(avc_pcpu_cache).slots[avc_hash(ae->ssid, ae->tsid,
+							 ae->tclass) &
+						 (AVC_PCPU_SLOTS - 1)];
+	memcpy(&pe->ae, ae, sizeof(pe->ae));
+	pe->gen = gen;
+	put_cpu_var(avc_pcpu_cache);
+}
+
 /**
  * avc_dump_av - Display an access vector in human-readable form.
  * @tclass: target security class
@@ -168,6 +236,8 @@ void __init avc_init(void)
 	}
 	atomic_set(&avc_cache.active_nodes, 0);
 	atomic_set(&avc_cache.lru_hint, 0);
+	/* zeroed per-cpu slots are of no generation */
+	atomic_set(&avc_cache.pcpu_gen, 1);
 
 	avc_node_cachep = kmem_cache_create("avc_node", sizeof(struct avc_node),
 					     0, SLAB_PANIC, NULL);
@@ -231,6 +301,7 @@ static void avc_node_replace(struct avc_node *new, struct avc_node *old)
 	hlist_replace_rcu(&old->list, &new->list);
 	call_rcu(&old->rhead, avc_node_free);
 	atomic_dec(&avc_cache.active_nodes);
+	avc_pcpu_invalidate();
 }
 
 static inline int avc_reclaim_node(void)
@@ -628,6 +699,8 @@ static void avc_flush(void)
 		rcu_read_unlock();
 		spin_unlock_irqrestore(lock, flag);
 	}
+
+	avc_pcpu_invalidate();
 }
 
 /**
@@ -684,8 +757,13 @@ static noinline int avc_denied(u32 ssid, u32 tsid,
 	if (selinux_enforcing && !(avd->flags & AVD_FLAGS_PERMISSIVE))
 		return -EACCES;
 
-	avc_update_node(AVC_CALLBACK_GRANT, requested, ssid,
-				tsid, tclass, avd->seqno);
+	/*
+	 * If the entry has been reclaimed meanwhile, per-cpu copies of it
+	 * would keep on denying.
+	 */
+	if (avc_update_node(AVC_CALLBACK_GRANT, requested, ssid,
+				tsid, tclass, avd->seqno))
+		avc_pcpu_invalidate();
 	return 0;
 }
 
@@ -716,6 +794,7 @@ inline int avc_has_perm_noaudit(u32 ssid, u32 tsid,
 			 struct av_decision *avd)
 {
 	struct avc_node *node;
+	unsigned int gen;
 	int rc = 0;
 	u32 denied;
 
@@ -723,6 +802,12 @@ inline int avc_has_perm_noaudit(u32 ssid, u32 tsid,
 
 	rcu_read_lock();
 
+	if (avc_pcpu_lookup(ssid, tsid, tclass, avd))
+		goto check;
+
+	gen = atomic_read(&avc_cache.pcpu_gen);
+	smp_rmb();
+
 	node = avc_lookup(ssid, tsid, tclass);
 	if (unlikely(!node)) {
 		node = avc_compute_av(ssid, tsid, tclass, avd);
@@ -730,7 +815,10 @@ inline int avc_has_perm_noaudit(u32 ssid, u32 tsid,
 		memcpy(avd, &node->ae.avd, sizeof(*avd));
 		avd = &node->ae.avd;
 	}
+	if (node)
+		avc_pcpu_fill(gen, &node->ae);
 
+check:
 	denied = requested & ~(avd->allowed);
 	if (unlikely(denied))
 		rc = avc_denied(ssid, tsid, tclass, requested, flags, avd);
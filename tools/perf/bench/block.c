@@ -0,0 +1,229 @@
+/*
+ * block.c
+ *
+ * block: Benchmark for the block layer submission and completion paths
+ *
+ * Threads issue direct I/O to a null_blk device, one request in flight
+ * each, so the number of threads is the queue depth.  With --poll the
+ * completions are polled for through the queue's io_poll attribute
+ * rather than waited for.
+ */
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <pthread.h>
+
+static const char		*device = "/dev/nullb0";
+static unsigned int		depth = 1;
+static unsigned int		block_size = 4096;
+static int			loops = 100000;
+static bool			do_write;
+static bool			do_poll;
+
+static const struct option options[] = {
+	OPT_STRING('d', "device", &device, "/dev/nullb0",
+		   "Specify the block device"),
+	OPT_UINTEGER('q', "depth", &depth,
+		     "Specify the queue depth, i.e. number of threads"),
+	OPT_UINTEGER('b', "block-size", &block_size,
+		     "Specify the I/O size in bytes"),
+	OPT_INTEGER('l', "loop", &loops, "Specify number of loops per thread"),
+	OPT_BOOLEAN('w', "write", &do_write, "Write instead of reading"),
+	OPT_BOOLEAN('p', "poll", &do_poll, "Poll for completions"),
+	OPT_END()
+};
+
+static const char * const bench_block_usage[] = {
+	"perf bench block nullb <options>",
+	NULL
+};
+
+struct block_thread {
+	pthread_t		pthread;
+	int			nr;
+	int			fd;
+	unsigned long long	dev_size;
+	int			err;
+};
+
+static void *block_worker(void *arg)
+{
+	struct block_thread *td = arg;
+	unsigned long long off;
+	void *buf;
+	int i;
+
+	if (posix_memalign(&buf, page_size, block_size)) {
+		td->err = ENOMEM;
+		return NULL;
+	}
+	memset(buf, 0, block_size);
+
+	/* each thread walks its own stride of the device */
+	off = (unsigned long long)td->nr * block_size;
+
+	for (i = 0; i < loops; i++) {
+		ssize_t ret;
+
+		if (off + block_size > td->dev_size)
+			off = 0;
+
+		if (do_write)
+			ret = pwrite(td->fd, buf, block_size, off);
+		else
+			ret = pread(td->fd, buf, block_size, off);
+		if (ret != (ssize_t)block_size) {
+			td->err = ret < 0 ? errno : EIO;
+			break;
+		}
+
+		off += (unsigned long long)depth * block_size;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+/* /sys/block/<dev>/queue/io_poll, to switch polling on and back off */
+static int block_set_poll(const char *dev, char *old, char val)
+{
+	const char *name = strrchr(dev, '/');
+	char path[PATH_MAX];
+	int fd, ret = -1;
+
+	scnprintf(path, sizeof(path), "/sys/block/%s/queue/io_poll",
+		  name ? name + 1 : dev);
+
+	fd = open(path, O_RDWR);
+	if (fd < 0)
+		return -1;
+
+	if (old && read(fd, old, 1) != 1)
+		goto out;
+	if (write(fd, &val, 1) == 1)
+		ret = 0;
+out:
+	close(fd);
+	return ret;
+}
+
+int bench_block_nullb(int argc, const char **argv,
+		      const char *prefix __maybe_unused)
+{
+	struct block_thread *threads;
+	struct timeval start, stop, diff;
+	unsigned long long result_usec, dev_size, ops;
+	char old_poll = '0';
+	unsigned int t;
+	int fd, err = 0;
+
+	argc = parse_options(argc, argv, options, bench_block_usage, 0);
+
+	if (!depth || !block_size || block_size % 512) {
+		fprintf(stderr, "Invalid depth or block size\n");
+		return 1;
+	}
+
+	fd = open(device, (do_write ? O_RDWR : O_RDONLY) | O_DIRECT);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", device,
+			strerror(errno));
+		return 1;
+	}
+
+	if (ioctl(fd, BLKGETSIZE64, &dev_size) || dev_size < block_size) {
+		fprintf(stderr, "Failed to get the size of %s\n", device);
+		close(fd);
+		return 1;
+	}
+
+	if (do_poll && block_set_poll(device, &old_poll, '1')) {
+		fprintf(stderr, "Failed to enable polling on %s: %s\n",
+			device, strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	threads = zalloc(depth * sizeof(*threads));
+	BUG_ON(!threads);
+
+	gettimeofday(&start, NULL);
+
+	for (t = 0; t < depth; t++) {
+		threads[t].nr = t;
+		threads[t].fd = fd;
+		threads[t].dev_size = dev_size;
+		err = pthread_create(&threads[t].pthread, NULL, block_worker,
+				     &threads[t]);
+		BUG_ON(err);
+	}
+
+	for (t = 0; t < depth; t++) {
+		pthread_join(threads[t].pthread, NULL);
+		if (threads[t].err)
+			err = threads[t].err;
+	}
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	if (do_poll)
+		block_set_poll(device, NULL, old_poll);
+	close(fd);
+	free(threads);
+
+	if (err) {
+		fprintf(stderr, "I/O to %s failed: %s\n", device,
+			strerror(err));
+		return 1;
+	}
+
+	result_usec = diff.tv_sec * 1000000 + diff.tv_usec;
+	ops = (unsigned long long)loops * depth;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# Executed %llu %u byte %s on %s at queue depth %u%s\n\n",
+		       ops, block_size, do_write ? "writes" : "reads", device,
+		       depth, do_poll ? ", polled" : "");
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		/* each thread has one request in flight */
+		printf(" %14lf usecs/op\n",
+		       (double)result_usec * depth / (double)ops);
+		printf(" %14d ops/sec\n",
+		       (int)((double)ops /
+			     ((double)result_usec / (double)1000000)));
+		printf(" %14lf MB/sec\n",
+		       (double)ops * block_size / (double)result_usec);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
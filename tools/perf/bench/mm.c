@@ -0,0 +1,270 @@
+/*
+ * mm.c
+ *
+ * mm: Benchmarks for page faults and munmap()
+ *
+ * fault:  touch every page of a fresh anonymous, file or THP mapping
+ * munmap: unmap a touched mapping while other threads of the process
+ *         run on other cpus, so that their TLBs have to be shot down
+ */
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+/* the PMD size on x86, and what THP faults in at once */
+#define THP_SIZE		(2UL << 20)
+
+static const char		*fault_type_str = "anon";
+static unsigned int		fault_size_mb = 256;
+static int			fault_loops = 10;
+
+static const struct option fault_options[] = {
+	OPT_STRING('t', "type", &fault_type_str, "anon",
+		   "Specify the mapping type: anon, file or thp"),
+	OPT_UINTEGER('s', "size", &fault_size_mb,
+		     "Specify the size of the mapping in MB"),
+	OPT_INTEGER('l', "loop", &fault_loops, "Specify number of loops"),
+	OPT_END()
+};
+
+static const char * const bench_mm_fault_usage[] = {
+	"perf bench mm fault <options>",
+	NULL
+};
+
+static unsigned int		munmap_threads = 1;
+static unsigned int		munmap_pages = 16;
+static int			munmap_loops = 100000;
+
+static const struct option munmap_options[] = {
+	OPT_UINTEGER('t', "threads", &munmap_threads,
+		     "Specify number of threads running on other cpus"),
+	OPT_UINTEGER('p', "pages", &munmap_pages,
+		     "Specify the number of pages unmapped at once"),
+	OPT_INTEGER('l', "loop", &munmap_loops, "Specify number of loops"),
+	OPT_END()
+};
+
+static const char * const bench_mm_munmap_usage[] = {
+	"perf bench mm munmap <options>",
+	NULL
+};
+
+static unsigned long long timeval_usec(struct timeval *tv)
+{
+	return tv->tv_sec * 1000000ULL + tv->tv_usec;
+}
+
+static unsigned long long now_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return timeval_usec(&tv);
+}
+
+static void print_result(const char *what, unsigned long long ops,
+			 unsigned long long total_usec)
+{
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# Executed %llu %s\n\n", ops, what);
+
+		printf(" %14s: %llu.%03llu [sec]\n\n", "Total time",
+		       total_usec / 1000000, total_usec % 1000000 / 1000);
+
+		printf(" %14lf usecs/op\n",
+		       (double)total_usec / (double)ops);
+		printf(" %14d ops/sec\n",
+		       (int)((double)ops /
+			     ((double)total_usec / (double)1000000)));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu.%03llu\n",
+		       total_usec / 1000000, total_usec % 1000000 / 1000);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+/*
+ * Map @size bytes as asked for, aligned to THP_SIZE for thp.  Returns
+ * the start of the usable area, with the whole mapping in @map.
+ */
+static void *fault_map(const char *type, int fd, size_t size, void **map,
+		       size_t *map_size)
+{
+	char *p;
+
+	if (!strcmp(type, "file")) {
+		*map_size = size;
+		*map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			    fd, 0);
+		return *map == MAP_FAILED ? NULL : *map;
+	}
+
+	*map_size = size + (!strcmp(type, "thp") ? THP_SIZE : 0);
+	*map = mmap(NULL, *map_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (*map == MAP_FAILED)
+		return NULL;
+
+	if (strcmp(type, "thp"))
+		return *map;
+
+	p = (char *)(((unsigned long)*map + THP_SIZE - 1) & ~(THP_SIZE - 1));
+	if (madvise(p, size, MADV_HUGEPAGE)) {
+		munmap(*map, *map_size);
+		return NULL;
+	}
+
+	return p;
+}
+
+int bench_mm_fault(int argc, const char **argv,
+		   const char *prefix __maybe_unused)
+{
+	size_t size, step, map_size, off;
+	unsigned long long total_usec = 0, start;
+	char path[] = "/tmp/perf-bench-mm-XXXXXX";
+	const char *type;
+	int fd = -1;
+	int i;
+
+	argc = parse_options(argc, argv, fault_options,
+			     bench_mm_fault_usage, 0);
+
+	type = fault_type_str;
+	if (strcmp(type, "anon") && strcmp(type, "file") &&
+	    strcmp(type, "thp")) {
+		fprintf(stderr, "Unknown mapping type: %s\n", type);
+		return 1;
+	}
+
+	size = (size_t)fault_size_mb << 20;
+	step = !strcmp(type, "thp") ? THP_SIZE : (size_t)page_size;
+	if (!size || size % THP_SIZE) {
+		fprintf(stderr, "Invalid size: %u MB\n", fault_size_mb);
+		return 1;
+	}
+
+	if (!strcmp(type, "file")) {
+		fd = mkstemp(path);
+		if (fd < 0 || unlink(path) || ftruncate(fd, size)) {
+			fprintf(stderr, "Failed to create the file: %s\n",
+				strerror(errno));
+			return 1;
+		}
+	}
+
+	for (i = 0; i < fault_loops; i++) {
+		void *map;
+		char *p;
+
+		p = fault_map(type, fd, size, &map, &map_size);
+		if (!p) {
+			fprintf(stderr, "Failed to map %u MB: %s\n",
+				fault_size_mb, strerror(errno));
+			return 1;
+		}
+
+		/* touch each page, or hugepage, once */
+		start = now_usec();
+		for (off = 0; off < size; off += step)
+			p[off] = 1;
+		total_usec += now_usec() - start;
+
+		munmap(map, map_size);
+	}
+
+	if (fd >= 0)
+		close(fd);
+
+	print_result(!strcmp(type, "thp") ? "hugepage faults" :
+		     !strcmp(type, "file") ? "file page faults" :
+					     "anon page faults",
+		     (unsigned long long)fault_loops * (size / step),
+		     total_usec);
+
+	return 0;
+}
+
+static volatile bool munmap_done;
+
+/* keep the mm live on another cpu */
+static void *munmap_spinner(void *arg __maybe_unused)
+{
+	while (!munmap_done)
+		;
+	return NULL;
+}
+
+int bench_mm_munmap(int argc, const char **argv,
+		    const char *prefix __maybe_unused)
+{
+	unsigned long long total_usec = 0, start;
+	size_t size, off;
+	pthread_t *spinners;
+	unsigned int t;
+	int i, err;
+
+	argc = parse_options(argc, argv, munmap_options,
+			     bench_mm_munmap_usage, 0);
+
+	size = (size_t)munmap_pages * page_size;
+	if (!size) {
+		fprintf(stderr, "Invalid number of pages: %u\n", munmap_pages);
+		return 1;
+	}
+
+	spinners = zalloc(munmap_threads * sizeof(*spinners));
+	BUG_ON(munmap_threads && !spinners);
+
+	munmap_done = false;
+	for (t = 0; t < munmap_threads; t++) {
+		err = pthread_create(&spinners[t], NULL, munmap_spinner, NULL);
+		BUG_ON(err);
+	}
+
+	for (i = 0; i < munmap_loops; i++) {
+		char *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		BUG_ON(p == MAP_FAILED);
+
+		/* populate the TLB of this cpu */
+		for (off = 0; off < size; off += page_size)
+			p[off] = 1;
+
+		start = now_usec();
+		munmap(p, size);
+		total_usec += now_usec() - start;
+	}
+
+	munmap_done = true;
+	for (t = 0; t < munmap_threads; t++)
+		pthread_join(spinners[t], NULL);
+	free(spinners);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %u threads on other cpus\n", munmap_threads);
+	print_result("munmaps", munmap_loops, total_usec);
+
+	return 0;
+}
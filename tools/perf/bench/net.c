@@ -0,0 +1,341 @@
+/*
+ * net.c
+ *
+ * net: Benchmarks for the socket paths over loopback
+ *
+ * Two threads pass messages back and forth (latency) or one way
+ * (throughput) over a TCP, UDP or unix domain socket connection.
+ */
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+
+#define LOOPS_DEFAULT		100000
+
+/* UDP throughput: datagrams sent before waiting for the receiver */
+#define UDP_WINDOW		32
+
+static int			loops = LOOPS_DEFAULT;
+static unsigned int		msg_size = 64;
+static bool			throughput;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop",	&loops,		"Specify number of loops"),
+	OPT_UINTEGER('s', "size",	&msg_size,	"Specify message size in bytes"),
+	OPT_BOOLEAN('t', "throughput",	&throughput,	"Send one way instead of round trips"),
+	OPT_END()
+};
+
+static const char * const bench_net_usage[] = {
+	"perf bench net <tcp|udp|unix> <options>",
+	NULL
+};
+
+struct net_conn {
+	const char		*name;
+	bool			dgram;
+	int			fd[2];
+};
+
+static int net_send(struct net_conn *conn, int fd, char *buf, size_t size)
+{
+	while (size) {
+		ssize_t ret = write(fd, buf, size);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		/* a datagram goes out whole or not at all */
+		if (conn->dgram)
+			break;
+		buf += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static int net_recv(struct net_conn *conn, int fd, char *buf, size_t size)
+{
+	while (size) {
+		ssize_t ret = read(fd, buf, size);
+
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if (conn->dgram)
+			break;
+		buf += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static int net_connect_tcp(struct net_conn *conn)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int one = 1;
+	int lfd;
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (lfd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    getsockname(lfd, (struct sockaddr *)&addr, &len) ||
+	    listen(lfd, 1))
+		goto out_close;
+
+	conn->fd[0] = socket(AF_INET, SOCK_STREAM, 0);
+	if (conn->fd[0] < 0)
+		goto out_close;
+	if (connect(conn->fd[0], (struct sockaddr *)&addr, sizeof(addr)))
+		goto out_close;
+
+	conn->fd[1] = accept(lfd, NULL, NULL);
+	if (conn->fd[1] < 0)
+		goto out_close;
+
+	/* measure the stack, not Nagle */
+	setsockopt(conn->fd[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(conn->fd[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	close(lfd);
+	return 0;
+
+out_close:
+	close(lfd);
+	return -1;
+}
+
+static int net_connect_udp(struct net_conn *conn)
+{
+	struct sockaddr_in addr[2];
+	socklen_t len;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		conn->fd[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		if (conn->fd[i] < 0)
+			return -1;
+
+		memset(&addr[i], 0, sizeof(addr[i]));
+		addr[i].sin_family = AF_INET;
+		addr[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		len = sizeof(addr[i]);
+		if (bind(conn->fd[i], (struct sockaddr *)&addr[i], len) ||
+		    getsockname(conn->fd[i], (struct sockaddr *)&addr[i], &len))
+			return -1;
+	}
+
+	if (connect(conn->fd[0], (struct sockaddr *)&addr[1], sizeof(addr[1])) ||
+	    connect(conn->fd[1], (struct sockaddr *)&addr[0], sizeof(addr[0])))
+		return -1;
+
+	return 0;
+}
+
+static int net_connect_unix(struct net_conn *conn)
+{
+	return socketpair(AF_UNIX, SOCK_STREAM, 0, conn->fd);
+}
+
+/* The far end: echo back, or sink and pace the sender over UDP. */
+static void *net_server(void *arg)
+{
+	struct net_conn *conn = arg;
+	int fd = conn->fd[1];
+	char *buf;
+	long err = -1;
+	int i;
+
+	buf = zalloc(msg_size);
+	if (!buf)
+		return (void *)err;
+
+	for (i = 0; i < loops; i++) {
+		if (net_recv(conn, fd, buf, msg_size))
+			goto out;
+
+		if (!throughput) {
+			if (net_send(conn, fd, buf, msg_size))
+				goto out;
+		} else if (conn->dgram && (i + 1) % UDP_WINDOW == 0) {
+			if (net_send(conn, fd, buf, 1))
+				goto out;
+		}
+	}
+	err = 0;
+out:
+	/* don't leave the client waiting */
+	if (err)
+		shutdown(fd, SHUT_RDWR);
+	free(buf);
+	return (void *)err;
+}
+
+static int net_client(struct net_conn *conn)
+{
+	int fd = conn->fd[0];
+	char *buf;
+	int err = -1;
+	int i;
+
+	buf = zalloc(msg_size);
+	if (!buf)
+		return -1;
+
+	for (i = 0; i < loops; i++) {
+		if (net_send(conn, fd, buf, msg_size))
+			goto out;
+
+		if (!throughput) {
+			if (net_recv(conn, fd, buf, msg_size))
+				goto out;
+		} else if (conn->dgram && (i + 1) % UDP_WINDOW == 0) {
+			if (net_recv(conn, fd, buf, 1))
+				goto out;
+		}
+	}
+	err = 0;
+out:
+	free(buf);
+	return err;
+}
+
+static int bench_net(struct net_conn *conn,
+		     int (*connect_fn)(struct net_conn *conn))
+{
+	struct timeval start, stop, diff;
+	unsigned long long result_usec;
+	pthread_t server;
+	void *server_err;
+	int err;
+
+	if (!msg_size || (conn->dgram && msg_size > 65507)) {
+		fprintf(stderr, "Invalid message size: %u\n", msg_size);
+		return 1;
+	}
+
+	conn->fd[0] = conn->fd[1] = -1;
+	if (connect_fn(conn)) {
+		fprintf(stderr, "Failed to set up the %s connection: %s\n",
+			conn->name, strerror(errno));
+		return 1;
+	}
+
+	gettimeofday(&start, NULL);
+
+	err = pthread_create(&server, NULL, net_server, conn);
+	BUG_ON(err);
+
+	err = net_client(conn);
+	if (err)
+		shutdown(conn->fd[0], SHUT_RDWR);
+
+	pthread_join(server, &server_err);
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	close(conn->fd[0]);
+	close(conn->fd[1]);
+
+	if (err || server_err) {
+		fprintf(stderr, "Failed to pass the messages: %s\n",
+			strerror(errno));
+		return 1;
+	}
+
+	result_usec = diff.tv_sec * 1000000 + diff.tv_usec;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# Executed %d %s of %u bytes over %s\n\n", loops,
+		       throughput ? "sends" : "round trips", msg_size,
+		       conn->name);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14lf usecs/op\n",
+		       (double)result_usec / (double)loops);
+		printf(" %14d ops/sec\n",
+		       (int)((double)loops /
+			     ((double)result_usec / (double)1000000)));
+		if (throughput)
+			printf(" %14lf MB/sec\n",
+			       (double)loops * msg_size / (double)result_usec);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
+
+int bench_net_tcp(int argc, const char **argv,
+		  const char *prefix __maybe_unused)
+{
+	struct net_conn conn = { .name = "TCP", };
+
+	argc = parse_options(argc, argv, options, bench_net_usage, 0);
+	return bench_net(&conn, net_connect_tcp);
+}
+
+int bench_net_udp(int argc, const char **argv,
+		  const char *prefix __maybe_unused)
+{
+	struct net_conn conn = { .name = "UDP", .dgram = true, };
+
+	argc = parse_options(argc, argv, options, bench_net_usage, 0);
+	return bench_net(&conn, net_connect_udp);
+}
+
+int bench_net_unix(int argc, const char **argv,
+		   const char *prefix __maybe_unused)
+{
+	struct net_conn conn = { .name = "unix socket", };
+
+	argc = parse_options(argc, argv, options, bench_net_usage, 0);
+	return bench_net(&conn, net_connect_unix);
+}
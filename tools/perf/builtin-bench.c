@@ -13,6 +13,9 @@
  *  mem   ... memory access performance
  *  numa  ... NUMA scheduling and MM performance
  *  futex ... Futex performance
+ *  block ... Block layer submission and completion performance
+ *  net   ... Socket performance over loopback
+ *  mm    ... Page fault and munmap performance
  */
 #include "perf.h"
 #include "util/util.h"
@@ -63,6 +66,27 @@ static struct bench futex_benchmarks[] = {
 	{ NULL,		NULL,						NULL			}
 };
 
+static struct bench block_benchmarks[] = {
+	{ "nullb",	"Benchmark for direct I/O to null_blk",		bench_block_nullb	},
+	{ "all",	"Test all block benchmarks",			NULL			},
+	{ NULL,		NULL,						NULL			}
+};
+
+static struct bench net_benchmarks[] = {
+	{ "tcp",	"Benchmark for TCP over loopback",		bench_net_tcp		},
+	{ "udp",	"Benchmark for UDP over loopback",		bench_net_udp		},
+	{ "unix",	"Benchmark for unix domain sockets",		bench_net_unix		},
+	{ "all",	"Test all network benchmarks",			NULL			},
+	{ NULL,		NULL,						NULL			}
+};
+
+static struct bench mm_benchmarks[] = {
+	{ "fault",	"Benchmark for page faults",			bench_mm_fault		},
+	{ "munmap",	"Benchmark for munmap() and TLB shootdown",	bench_mm_munmap		},
+	{ "all",	"Test all mm benchmarks",			NULL			},
+	{ NULL,		NULL,						NULL			}
+};
+
 struct collection {
 	const char	*name;
 	const char	*summary;
@@ -76,6 +100,9 @@ static struct collection collections[] = {
 	{ "numa",	"NUMA scheduling and MM benchmarks",		numa_benchmarks		},
 #endif
 	{"futex",       "Futex stressing benchmarks",                   futex_benchmarks        },
+	{ "block",	"Block layer benchmarks",			block_benchmarks	},
+	{ "net",	"Network benchmarks",				net_benchmarks		},
+	{ "mm",		"Page fault and munmap benchmarks",		mm_benchmarks		},
 	{ "all",	"All benchmarks",				NULL			},
 	{ NULL,		NULL,						NULL			}
 };
@@ -28,6 +28,7 @@
 
 #include <unistd.h>
 #include <sched.h>
+#include <pthread.h>
 #include <sys/mman.h>
 
 #ifndef HAVE_ON_EXIT_SUPPORT
@@ -62,6 +63,22 @@ static void __handle_on_exit_funcs(void)
 }
 #endif
 
+struct record;
+
+/*
+ * A reader thread of --threads, draining the mmaps [start, end) and
+ * polling their fds, pinned to their cpus.
+ */
+struct record_thread {
+	pthread_t		tid;
+	struct record		*rec;
+	int			start;
+	int			end;
+	long			samples;
+	unsigned long		waking;
+	unsigned int		round_done;
+};
+
 struct record {
 	struct perf_tool	tool;
 	struct record_opts	opts;
@@ -74,10 +91,45 @@ struct record {
 	bool			no_buildid;
 	bool			no_buildid_cache;
 	long			samples;
+	unsigned int		nr_threads;
+	struct record_thread	*threads;
+	pthread_t		main_thread;
+	u64			data_end;
+	pthread_mutex_t		round_lock;
+	unsigned int		round;
+	unsigned int		round_left;
 };
 
+/*
+ * The reader threads write at once, each to a range of the file it
+ * reserves, so that the writes are not serialized on the file position.
+ */
+static int record__pwrite(struct record *rec, void *bf, size_t size)
+{
+	off_t offset = __sync_fetch_and_add(&rec->data_end, size);
+	int fd = perf_data_file__fd(rec->session->file);
+
+	while (size) {
+		ssize_t ret = pwrite(fd, bf, size, offset);
+
+		if (ret <= 0) {
+			pr_err("failed to write perf data, error: %m\n");
+			return -1;
+		}
+
+		bf += ret;
+		size -= ret;
+		offset += ret;
+	}
+
+	return 0;
+}
+
 static int record__write(struct record *rec, void *bf, size_t size)
 {
+	if (rec->threads)
+		return record__pwrite(rec, bf, size);
+
 	if (perf_data_file__write(rec->session->file, bf, size) < 0) {
 		pr_err("failed to write perf data, error: %m\n");
 		return -1;
@@ -108,8 +160,6 @@ static int record__mmap_read(struct record *rec, struct perf_mmap *md)
 	if (old == head)
 		return 0;
 
-	rec->samples++;
-
 	size = head - old;
 
 	if ((old & md->mask) + size != (head & md->mask)) {
@@ -134,6 +184,7 @@ static int record__mmap_read(struct record *rec, struct perf_mmap *md)
 
 	md->prev = old;
 	perf_mmap__write_tail(md, old);
+	rc = 1;
 
 out:
 	return rc;
@@ -305,13 +356,14 @@ static int record__mmap_read_all(struct record *rec)
 
 	for (i = 0; i < rec->evlist->nr_mmaps; i++) {
 		if (rec->evlist->mmap[i].base) {
-			if (record__mmap_read(rec, &rec->evlist->mmap[i]) != 0) {
-				rc = -1;
+			rc = record__mmap_read(rec, &rec->evlist->mmap[i]);
+			if (rc < 0)
 				goto out;
-			}
+			rec->samples += rc;
 		}
 	}
 
+	rc = 0;
 	if (perf_header__has_feat(&rec->session->header, HEADER_TRACING_DATA))
 		rc = record__write(rec, &finished_round_event, sizeof(finished_round_event));
 
@@ -319,6 +371,249 @@ out:
 	return rc;
 }
 
+/*
+ * perf report may sort the events up to a round marker once it has seen
+ * the next one, which holds as long as every mmap was drained between
+ * the two.  With reader threads, a round ends once each of them has
+ * gone through all its mmaps in a pass that started after the round
+ * did, and the last one to do so writes the marker.
+ */
+static int record__thread_finish_round(struct record_thread *thread,
+				       unsigned int round)
+{
+	struct record *rec = thread->rec;
+	int rc = 0;
+
+	pthread_mutex_lock(&rec->round_lock);
+	if (round == rec->round && thread->round_done != round) {
+		thread->round_done = round;
+		if (--rec->round_left == 0) {
+			rc = record__write(rec, &finished_round_event,
+					   sizeof(finished_round_event));
+			rec->round++;
+			rec->round_left = rec->nr_threads;
+		}
+	}
+	pthread_mutex_unlock(&rec->round_lock);
+
+	return rc;
+}
+
+static int record__thread_mmap_read(struct record_thread *thread)
+{
+	struct record *rec = thread->rec;
+	bool rounds = perf_header__has_feat(&rec->session->header,
+					    HEADER_TRACING_DATA);
+	unsigned int round = 0;
+	int i, rc;
+
+	if (rounds) {
+		pthread_mutex_lock(&rec->round_lock);
+		round = rec->round;
+		pthread_mutex_unlock(&rec->round_lock);
+	}
+
+	for (i = thread->start; i < thread->end; i++) {
+		if (rec->evlist->mmap[i].base) {
+			rc = record__mmap_read(rec, &rec->evlist->mmap[i]);
+			if (rc < 0)
+				return rc;
+			thread->samples += rc;
+		}
+	}
+
+	if (rounds)
+		return record__thread_finish_round(thread, round);
+	return 0;
+}
+
+static void record__thread_pin(struct record_thread *thread)
+{
+	struct cpu_map *cpus = thread->rec->evlist->cpus;
+	cpu_set_t set;
+	int i;
+
+	/* per-thread mmaps are not tied to a cpu */
+	if (cpu_map__empty(cpus))
+		return;
+
+	CPU_ZERO(&set);
+	for (i = thread->start; i < thread->end; i++)
+		CPU_SET(cpus->map[i], &set);
+
+	if (sched_setaffinity(0, sizeof(set), &set))
+		pr_debug("failed to pin reader thread, error: %m\n");
+}
+
+static void record__thread_wakeup(int sig __maybe_unused)
+{
+}
+
+static void *record__thread(void *arg)
+{
+	struct record_thread *thread = arg;
+	struct record *rec = thread->rec;
+	struct pollfd *pollfd = &rec->evlist->pollfd[thread->start];
+	int err = 0;
+
+	record__thread_pin(thread);
+
+	for (;;) {
+		long hits = thread->samples;
+
+		if (record__thread_mmap_read(thread) < 0) {
+			err = -1;
+			done = 1;
+			pthread_kill(rec->main_thread, SIGUSR2);
+			break;
+		}
+
+		if (hits == thread->samples) {
+			if (done)
+				break;
+			/*
+			 * The signals go to the main thread, so don't wait
+			 * for them to interrupt poll.
+			 */
+			poll(pollfd, thread->end - thread->start, 100);
+			thread->waking++;
+		}
+	}
+
+	return (void *)(long)err;
+}
+
+static int record__join_threads(struct record *rec, unsigned int nr,
+				unsigned long *waking)
+{
+	unsigned int i;
+	int err = 0;
+
+	done = 1;
+	for (i = 0; i < nr; i++) {
+		void *ret;
+
+		pthread_join(rec->threads[i].tid, &ret);
+		if (ret)
+			err = -1;
+		rec->samples += rec->threads[i].samples;
+		*waking += rec->threads[i].waking;
+	}
+
+	zfree(&rec->threads);
+	pthread_mutex_destroy(&rec->round_lock);
+
+	return err;
+}
+
+static int record__mmap_read_loop(struct record *rec, unsigned long *waking)
+{
+	bool disabled = false;
+
+	for (;;) {
+		int hits = rec->samples;
+
+		if (record__mmap_read_all(rec) < 0)
+			return -1;
+
+		if (hits == rec->samples) {
+			if (done)
+				break;
+			poll(rec->evlist->pollfd, rec->evlist->nr_fds, -1);
+			(*waking)++;
+		}
+
+		/*
+		 * When perf is starting the traced process, at the end events
+		 * die with the process and we wait for that. Thus no need to
+		 * disable events in this case.
+		 */
+		if (done && !disabled && !target__none(&rec->opts.target)) {
+			perf_evlist__disable(rec->evlist);
+			disabled = true;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Drain the mmaps from rec->nr_threads reader threads, each owning a
+ * contiguous range of them, i.e. of cpus, so that a single thread does
+ * not lose events on large machines.  They write into the same file, so
+ * perf report reads it as usual.  The main thread waits for the signals
+ * that end the session.
+ */
+static int record__mmap_read_threads(struct record *rec,
+				     unsigned long *waking)
+{
+	struct perf_evlist *evlist = rec->evlist;
+	int fd = perf_data_file__fd(&rec->file);
+	unsigned int i, nr = rec->nr_threads;
+	sigset_t mask, oldmask;
+	off_t data_start;
+	int err;
+
+	/* pollfd[i] is the fd mmap[i] is mapped from */
+	BUG_ON(evlist->nr_fds != evlist->nr_mmaps);
+	if (nr > (unsigned int)evlist->nr_mmaps)
+		nr = evlist->nr_mmaps;
+
+	rec->threads = zalloc(nr * sizeof(*rec->threads));
+	if (rec->threads == NULL)
+		return -ENOMEM;
+
+	rec->main_thread = pthread_self();
+	pthread_mutex_init(&rec->round_lock, NULL);
+	rec->round = 0;
+	rec->round_left = rec->nr_threads = nr;
+
+	data_start = lseek(fd, 0, SEEK_CUR);
+	rec->data_end = data_start;
+
+	/* keep the signals away from the reader threads */
+	signal(SIGUSR2, record__thread_wakeup);
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+
+	for (i = 0; i < nr; i++) {
+		struct record_thread *thread = &rec->threads[i];
+
+		thread->rec = rec;
+		thread->start = i * evlist->nr_mmaps / nr;
+		thread->end = (i + 1) * evlist->nr_mmaps / nr;
+		thread->round_done = UINT_MAX;
+
+		err = pthread_create(&thread->tid, NULL, record__thread, thread);
+		if (err) {
+			pr_err("failed to create reader thread, error: %m\n");
+			record__join_threads(rec, i, waking);
+			err = -1;
+			goto out;
+		}
+	}
+
+	while (!done)
+		sigsuspend(&oldmask);
+
+	/* see record__mmap_read_loop() */
+	if (!target__none(&rec->opts.target))
+		perf_evlist__disable(evlist);
+
+	err = record__join_threads(rec, nr, waking);
+out:
+	pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+
+	rec->bytes_written += rec->data_end - data_start;
+	lseek(fd, rec->data_end, SEEK_SET);
+
+	return err;
+}
+
 static void record__init_features(struct record *rec)
 {
 	struct perf_session *session = rec->session;
@@ -363,7 +658,6 @@ static int __cmd_record(struct record *rec, int argc, const char **argv)
 	struct record_opts *opts = &rec->opts;
 	struct perf_data_file *file = &rec->file;
 	struct perf_session *session;
-	bool disabled = false;
 
 	rec->progname = argv[0];
 
@@ -507,30 +801,19 @@ static int __cmd_record(struct record *rec, int argc, const char **argv)
 		perf_evlist__enable(rec->evlist);
 	}
 
-	for (;;) {
-		int hits = rec->samples;
-
-		if (record__mmap_read_all(rec) < 0) {
-			err = -1;
-			goto out_delete_session;
-		}
-
-		if (hits == rec->samples) {
-			if (done)
-				break;
-			err = poll(rec->evlist->pollfd, rec->evlist->nr_fds, -1);
-			waking++;
-		}
+	if (rec->nr_threads > 1 && file->is_pipe) {
+		pr_warning("Can't use reader threads with a pipe, "
+			   "reading from a single thread.\n");
+		rec->nr_threads = 1;
+	}
 
-		/*
-		 * When perf is starting the traced process, at the end events
-		 * die with the process and we wait for that. Thus no need to
-		 * disable events in this case.
-		 */
-		if (done && !disabled && !target__none(&opts->target)) {
-			perf_evlist__disable(rec->evlist);
-			disabled = true;
-		}
+	if (rec->nr_threads > 1)
+		err = record__mmap_read_threads(rec, &waking);
+	else
+		err = record__mmap_read_loop(rec, &waking);
+	if (err < 0) {
+		err = -1;
+		goto out_delete_session;
 	}
 
 	if (forks && workload_exec_errno) {
@@ -910,6 +1193,8 @@ const struct option record_options[] = {
 		    "sample transaction flags (special events only)"),
 	OPT_BOOLEAN(0, "per-thread", &record.opts.target.per_thread,
 		    "use per-thread mmaps"),
+	OPT_UINTEGER(0, "threads", &record.nr_threads,
+		     "read the mmaps from this many threads"),
 	OPT_END()
 };
 
@@ -259,6 +259,48 @@ static void deassign_host_irq(struct kvm *kvm,
 	assigned_dev->irq_requested_type &= ~(KVM_DEV_IRQ_HOST_MASK);
 }
 
+int __weak kvm_arch_update_pi_irte(struct kvm *kvm, unsigned int host_irq,
+				   u32 guest_irq, bool set)
+{
+	return 0;
+}
+
+/*
+ * Have the MSIs of @dev posted straight to the guest where the IOMMU
+ * can do it, or taken back by the host handlers.  Posting is only an
+ * optimization, the host handlers still work if it fails.  Called with
+ * kvm->lock held.
+ */
+static void kvm_assigned_dev_set_posting(struct kvm *kvm,
+					 struct kvm_assigned_dev_kernel *dev,
+					 bool set)
+{
+	unsigned long type = dev->irq_requested_type;
+	int i;
+
+	if ((type & KVM_DEV_IRQ_HOST_MSIX) && (type & KVM_DEV_IRQ_GUEST_MSIX))
+		for (i = 0; i < dev->entries_nr; i++)
+			kvm_arch_update_pi_irte(kvm,
+					dev->host_msix_entries[i].vector,
+					dev->guest_msix_entries[i].vector,
+					set);
+	else if ((type & KVM_DEV_IRQ_HOST_MSI) &&
+		 (type & KVM_DEV_IRQ_GUEST_MSI))
+		kvm_arch_update_pi_irte(kvm, dev->host_irq, dev->guest_irq,
+					set);
+}
+
+/* The guest may have pointed its MSIs elsewhere, post them again */
+void kvm_assigned_dev_update_posting(struct kvm *kvm)
+{
+	struct kvm_assigned_dev_kernel *dev;
+
+	mutex_lock(&kvm->lock);
+	list_for_each_entry(dev, &kvm->arch.assigned_dev_head, list)
+		kvm_assigned_dev_set_posting(kvm, dev, true);
+	mutex_unlock(&kvm->lock);
+}
+
 static int kvm_deassign_irq(struct kvm *kvm,
 			    struct kvm_assigned_dev_kernel *assigned_dev,
 			    unsigned long irq_requested_type)
@@ -274,6 +316,8 @@ static int kvm_deassign_irq(struct kvm *kvm,
 	host_irq_type = irq_requested_type & KVM_DEV_IRQ_HOST_MASK;
 	guest_irq_type = irq_requested_type & KVM_DEV_IRQ_GUEST_MASK;
 
+	kvm_assigned_dev_set_posting(kvm, assigned_dev, false);
+
 	if (host_irq_type)
 		deassign_host_irq(kvm, assigned_dev);
 	if (guest_irq_type)
@@ -570,6 +614,8 @@ static int kvm_vm_ioctl_assign_irq(struct kvm *kvm,
 
 	if (guest_irq_type)
 		r = assign_guest_irq(kvm, match, assigned_irq, guest_irq_type);
+	if (!r)
+		kvm_assigned_dev_set_posting(kvm, match, true);
 out:
 	mutex_unlock(&kvm->lock);
 	return r;
@@ -0,0 +1,155 @@
+/*
+ * KVM dirty ring
+ *
+ * Each vcpu reports the pages it dirties through a ring shared with
+ * userspace, so that collecting them costs in proportion to how many
+ * pages were written rather than to the size of the guest.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <linux/kvm_host.h>
+#include <linux/kvm.h>
+#include <linux/vmalloc.h>
+#include <linux/kvm_dirty_ring.h>
+
+/* Entries pushed after the soft limit, before the vcpu gets to exit */
+#define KVM_DIRTY_RING_RSVD_ENTRIES	64
+
+/* Entries a vcpu may log in hardware, e.g. PML, and flush at once */
+int __weak kvm_cpu_dirty_log_size(void)
+{
+	return 0;
+}
+
+u32 kvm_dirty_ring_get_rsvd_entries(void)
+{
+	return KVM_DIRTY_RING_RSVD_ENTRIES + kvm_cpu_dirty_log_size();
+}
+
+int kvm_dirty_ring_alloc(struct kvm_dirty_ring *ring, u32 size)
+{
+	ring->dirty_gfns = vzalloc(size);
+	if (!ring->dirty_gfns)
+		return -ENOMEM;
+
+	ring->size = size / sizeof(struct kvm_dirty_gfn);
+	ring->soft_limit = ring->size - kvm_dirty_ring_get_rsvd_entries();
+	ring->dirty_index = 0;
+	ring->reset_index = 0;
+
+	return 0;
+}
+
+void kvm_dirty_ring_free(struct kvm_dirty_ring *ring)
+{
+	vfree(ring->dirty_gfns);
+	ring->dirty_gfns = NULL;
+	ring->size = 0;
+}
+
+/*
+ * Called by the vcpu that owns @ring.  Returns false if the ring is full,
+ * in which case the caller must record the page some other way.
+ */
+bool kvm_dirty_ring_push(struct kvm_dirty_ring *ring, u32 slot, u64 offset)
+{
+	struct kvm_dirty_gfn *entry;
+
+	if (ring->dirty_index - ACCESS_ONCE(ring->reset_index) >= ring->size)
+		return false;
+
+	entry = &ring->dirty_gfns[ring->dirty_index & (ring->size - 1)];
+	entry->slot = slot;
+	entry->offset = offset;
+	/* Userspace must see slot and offset before the entry is valid. */
+	smp_wmb();
+	entry->flags = KVM_DIRTY_GFN_F_DIRTY;
+	ring->dirty_index++;
+
+	return true;
+}
+
+static void kvm_reset_dirty_gfn(struct kvm *kvm, u32 slot, u64 offset,
+				unsigned long mask)
+{
+	struct kvm_memory_slot *memslot;
+
+	if (!mask || slot >= KVM_USER_MEM_SLOTS)
+		return;
+
+	memslot = id_to_memslot(kvm->memslots, slot);
+	if (offset >= memslot->npages ||
+	    offset + __fls(mask) >= memslot->npages)
+		return;
+
+	spin_lock(&kvm->mmu_lock);
+	kvm_arch_mmu_enable_log_dirty_pt_masked(kvm, memslot, offset, mask);
+	spin_unlock(&kvm->mmu_lock);
+}
+
+/*
+ * Retire the entries userspace has collected, in order, stopping at the
+ * first one it has not flagged yet.  Neighbouring gfns of a slot are
+ * batched into one mask.  Returns the number of entries reset; the
+ * caller flushes the TLBs.  Called with kvm->slots_lock held.
+ */
+int kvm_dirty_ring_reset(struct kvm *kvm, struct kvm_dirty_ring *ring)
+{
+	struct kvm_dirty_gfn *entry;
+	u32 cur_slot = 0, next_slot;
+	u64 cur_offset = 0, next_offset;
+	unsigned long mask = 0;
+	int count = 0;
+
+	while (ring->reset_index != ACCESS_ONCE(ring->dirty_index)) {
+		entry = &ring->dirty_gfns[ring->reset_index & (ring->size - 1)];
+
+		if (!(ACCESS_ONCE(entry->flags) & KVM_DIRTY_GFN_F_RESET))
+			break;
+
+		next_slot = ACCESS_ONCE(entry->slot);
+		next_offset = ACCESS_ONCE(entry->offset);
+
+		/*
+		 * Give the entry back to the vcpu, which may reuse it as
+		 * soon as it sees the new reset_index.
+		 */
+		entry->flags = 0;
+		smp_wmb();
+		ring->reset_index++;
+		count++;
+
+		if (mask && next_slot == cur_slot) {
+			s64 delta = next_offset - cur_offset;
+
+			if (delta >= 0 && delta < BITS_PER_LONG) {
+				mask |= 1UL << delta;
+				continue;
+			}
+
+			/* A gfn just below the batch, if the mask can grow. */
+			if (delta < 0 && -delta < BITS_PER_LONG &&
+			    (mask << -delta >> -delta) == mask) {
+				cur_offset = next_offset;
+				mask = (mask << -delta) | 1;
+				continue;
+			}
+		}
+
+		kvm_reset_dirty_gfn(kvm, cur_slot, cur_offset, mask);
+		cur_slot = next_slot;
+		cur_offset = next_offset;
+		mask = 1;
+	}
+
+	kvm_reset_dirty_gfn(kvm, cur_slot, cur_offset, mask);
+
+	return count;
+}
+
+struct page *kvm_dirty_ring_get_page(struct kvm_dirty_ring *ring, u32 offset)
+{
+	return vmalloc_to_page((void *)ring->dirty_gfns + offset * PAGE_SIZE);
+}